@@ -27,6 +27,8 @@
 #include <asm/mtrr.h>
 #include <asm/mpspec.h>
 #include <asm/pgalloc.h>
+#include <asm/msr.h>
+#include <asm/div64.h>
 
 int prof_multiplier[NR_CPUS] = { 1, };
 int prof_old_multiplier[NR_CPUS] = { 1, };
@@ -466,6 +468,11 @@ void __setup_APIC_LVTT(unsigned int clocks)
 	apic_write_around(APIC_TMICT, clocks/APIC_DIVISOR);
 }
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+extern unsigned long cpu_khz;
+static void start_APIC_oneshot(void);
+#endif
+
 void setup_APIC_timer(void * data)
 {
 	unsigned int clocks = (unsigned int) data, slice, t0, t1;
@@ -512,6 +519,11 @@ void setup_APIC_timer(void * data)
 	printk("CPU%d<T0:%d,T1:%d,D:%d,S:%d,C:%d>\n",
 			smp_processor_id(), t0, t1, delta, slice, clocks);
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+	if (cpu_has_tsc && cpu_khz)
+		start_APIC_oneshot();
+#endif
+
 	__restore_flags(flags);
 }
 
@@ -614,6 +626,85 @@ void __init setup_APIC_clocks (void)
  * the frequency of the profiling timer can be changed
  * by writing a multiplier value into /proc/profile.
  */
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * With high resolution timers the local APIC timer runs in one-shot
+ * mode. Every interrupt programs the next one for whichever comes
+ * first, the next local tick or the first pending hrtimer. The
+ * local ticks are kept on the TSC so that they do not drift.
+ */
+static int apic_oneshot[NR_CPUS];
+static unsigned long long apic_next_tick[NR_CPUS];
+static unsigned long apic_tick_cycles[NR_CPUS];	/* TSC cycles per local tick */
+static unsigned long tsc_per_tick;
+
+static void __setup_APIC_oneshot(unsigned int clocks)
+{
+	unsigned int lvtt1_value;
+
+	lvtt1_value = SET_APIC_TIMER_BASE(APIC_TIMER_BASE_DIV) |
+			LOCAL_TIMER_VECTOR;
+	apic_write_around(APIC_LVTT, lvtt1_value);
+	apic_write_around(APIC_TMICT, clocks/APIC_DIVISOR ? : 1);
+}
+
+/*
+ * Called with interrupts off.
+ */
+static void program_APIC_oneshot(int cpu)
+{
+	unsigned long long now, delta;
+	long ns;
+
+	rdtscll(now);
+	delta = 0;
+	if ((long long) (apic_next_tick[cpu] - now) > 0)
+		delta = apic_next_tick[cpu] - now;
+
+	ns = hrtimer_next_event();
+	if (ns >= 0) {
+		unsigned long long hr = (unsigned long long) ns * cpu_khz;
+
+		do_div(hr, 1000000);
+		if (hr < delta)
+			delta = hr;
+	}
+
+	/* TSC cycles to APIC bus clocks */
+	delta *= calibration_result;
+	do_div(delta, tsc_per_tick);
+	__setup_APIC_oneshot(delta);
+}
+
+static void start_APIC_oneshot(void)
+{
+	int cpu = smp_processor_id();
+	int multiplier = prof_old_multiplier[cpu] ? : 1;
+	unsigned long long cycles;
+	unsigned long flags;
+
+	__save_flags(flags);
+	__cli();
+	cycles = (unsigned long long) cpu_khz * 1000;
+	do_div(cycles, HZ);
+	tsc_per_tick = cycles;
+	apic_tick_cycles[cpu] = tsc_per_tick / multiplier;
+	rdtscll(apic_next_tick[cpu]);
+	apic_next_tick[cpu] += apic_tick_cycles[cpu];
+	apic_oneshot[cpu] = 1;
+	program_APIC_oneshot(cpu);
+	__restore_flags(flags);
+}
+
+void arch_hrtimer_reprogram(void)
+{
+	int cpu = smp_processor_id();
+
+	if (apic_oneshot[cpu])
+		program_APIC_oneshot(cpu);
+}
+#endif /* CONFIG_HIGH_RES_TIMERS */
+
 int setup_profiling_timer(unsigned int multiplier)
 {
 	int i;
@@ -675,6 +766,11 @@ inline void smp_local_timer_interrupt(struct pt_regs * regs)
 		 */
 		prof_counter[cpu] = prof_multiplier[cpu];
 		if (prof_counter[cpu] != prof_old_multiplier[cpu]) {
+#ifdef CONFIG_HIGH_RES_TIMERS
+			if (apic_oneshot[cpu])
+				apic_tick_cycles[cpu] = tsc_per_tick/prof_counter[cpu];
+			else
+#endif
 			__setup_APIC_LVTT(calibration_result/prof_counter[cpu]);
 			prof_old_multiplier[cpu] = prof_counter[cpu];
 		}
@@ -706,6 +802,29 @@ inline void smp_local_timer_interrupt(struct pt_regs * regs)
  */
 unsigned int apic_timer_irqs [NR_CPUS];
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+static void smp_apic_oneshot_interrupt(struct pt_regs * regs)
+{
+	int cpu = smp_processor_id();
+	unsigned long long now;
+
+	/*
+	 * Allow for the interrupt coming in a hair early, or we would
+	 * program a tiny interval and then have to come back.
+	 */
+	rdtscll(now);
+	if ((long long) (now - apic_next_tick[cpu]) >=
+			-(long long) (apic_tick_cycles[cpu] >> 6)) {
+		smp_local_timer_interrupt(regs);
+		apic_next_tick[cpu] += apic_tick_cycles[cpu];
+		if ((long long) (apic_next_tick[cpu] - now) <= 0)
+			apic_next_tick[cpu] = now + apic_tick_cycles[cpu];
+	}
+	hrtimer_run_queues();
+	program_APIC_oneshot(cpu);
+}
+#endif
+
 void smp_apic_timer_interrupt(struct pt_regs * regs)
 {
 	int cpu = smp_processor_id();
@@ -726,6 +845,11 @@ void smp_apic_timer_interrupt(struct pt_regs * regs)
 	 * interrupt lock, which is the WrongThing (tm) to do.
 	 */
 	irq_enter(cpu, 0);
+#ifdef CONFIG_HIGH_RES_TIMERS
+	if (apic_oneshot[cpu])
+		smp_apic_oneshot_interrupt(regs);
+	else
+#endif
 	smp_local_timer_interrupt(regs);
 	irq_exit(cpu, 0);
 }
@@ -102,6 +102,9 @@ EXPORT_SYMBOL(clear_user);
 EXPORT_SYMBOL(__clear_user);
 EXPORT_SYMBOL(__generic_copy_from_user);
 EXPORT_SYMBOL(__generic_copy_to_user);
+EXPORT_SYMBOL(copy_user_nt_threshold);
+EXPORT_SYMBOL(__copy_to_user_large);
+EXPORT_SYMBOL(__copy_from_user_large);
 EXPORT_SYMBOL(strnlen_user);
 
 EXPORT_SYMBOL(pci_alloc_consistent);
@@ -124,6 +127,16 @@ EXPORT_SYMBOL(smp_num_cpus);
 EXPORT_SYMBOL(cpu_online_map);
 EXPORT_SYMBOL_NOVERS(__write_lock_failed);
 EXPORT_SYMBOL_NOVERS(__read_lock_failed);
+#ifdef CONFIG_LOCKMETER
+EXPORT_SYMBOL(lockmeter_enabled);
+EXPORT_SYMBOL(_metered_spin_lock);
+EXPORT_SYMBOL(_metered_spin_trylock);
+EXPORT_SYMBOL(_metered_spin_unlock);
+EXPORT_SYMBOL(_metered_read_lock);
+EXPORT_SYMBOL(_metered_write_lock);
+EXPORT_SYMBOL(_metered_write_trylock);
+EXPORT_SYMBOL(_metered_write_unlock);
+#endif
 
 /* Global SMP irq stuff */
 EXPORT_SYMBOL(synchronize_irq);
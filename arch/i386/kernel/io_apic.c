@@ -28,6 +28,7 @@
 #include <linux/config.h>
 #include <linux/smp_lock.h>
 #include <linux/mc146818rtc.h>
+#include <linux/kernel_stat.h>
 
 #include <asm/io.h>
 #include <asm/smp.h>
@@ -1241,6 +1242,147 @@ static struct hw_interrupt_type ioapic_level_irq_type = {
 	set_ioapic_affinity,
 };
 
+#if CONFIG_SMP
+
+/*
+ * IRQ balancing.
+ *
+ * With lowest priority delivery to all CPUs most chipsets simply send
+ * everything to one of them.  So every IRQ_BALANCE_INTERVAL the per-CPU
+ * interrupt counts in kstat are sampled, each active IRQ is bound to the
+ * CPU that has been taking it, and while one CPU handles clearly more
+ * interrupts than another, the IRQ that best evens them out is moved
+ * from the busiest to the idlest.  Nothing moves without an imbalance,
+ * so an IRQ stays with one CPU and its handler's data stays in that
+ * CPU's cache.  IRQs set through /proc/irq/N/smp_affinity are left alone,
+ * and so is the timer.
+ */
+
+#define IRQ_BALANCE_INTERVAL	(5*HZ)
+#define IRQ_BALANCE_MIN_GAP	(1000*(IRQ_BALANCE_INTERVAL/HZ)) /* 1000/sec */
+
+static int irq_balance_disabled __initdata = 0;
+
+static int __init irqbalance_setup(char *str)
+{
+	irq_balance_disabled = 1;
+	return 1;
+}
+
+__setup("noirqbalance", irqbalance_setup);
+
+static unsigned int irq_last_count[NR_CPUS][NR_IRQS];
+static unsigned int irq_rate[NR_IRQS];
+static int irq_cpu[NR_IRQS] = { [0 ... NR_IRQS-1] = -1 };
+static int irq_balance_cpus;
+static struct timer_list irq_balance_timer;
+
+static inline int irq_balanceable(unsigned int irq)
+{
+	irq_desc_t *desc = irq_desc + irq;
+
+	return irq != 0 && IO_APIC_IRQ(irq) && desc->action &&
+		!(desc->status & IRQ_DISABLED) &&
+		desc->handler->set_affinity == set_ioapic_affinity &&
+		irq_affinity[irq] == ~0UL;
+}
+
+static void do_irq_balance(void)
+{
+	unsigned int load[NR_CPUS], gap, best, d, n;
+	int irq, cpu, busiest, idlest, moved, pick;
+
+	memset(load, 0, sizeof(load));
+	for (irq = 0; irq < NR_IRQS; irq++) {
+		int here = -1;
+		unsigned int most = 0;
+
+		irq_rate[irq] = 0;
+		for (cpu = 0; cpu < irq_balance_cpus; cpu++) {
+			n = kstat.irqs[cpu][irq];
+			d = n - irq_last_count[cpu][irq];
+			irq_last_count[cpu][irq] = n;
+			load[cpu] += d;
+			irq_rate[irq] += d;
+			if (d > most) {
+				most = d;
+				here = cpu;
+			}
+		}
+		if (!irq_balanceable(irq)) {
+			irq_cpu[irq] = -1;
+			continue;
+		}
+		/* Bind it where it has been running so far */
+		if (irq_cpu[irq] < 0 && here >= 0) {
+			irq_cpu[irq] = here;
+			set_ioapic_affinity(irq, 1UL << here);
+		}
+	}
+
+	for (moved = 0; moved < irq_balance_cpus; moved++) {
+		busiest = idlest = 0;
+		for (cpu = 1; cpu < irq_balance_cpus; cpu++) {
+			if (load[cpu] > load[busiest])
+				busiest = cpu;
+			if (load[cpu] < load[idlest])
+				idlest = cpu;
+		}
+		gap = load[busiest] - load[idlest];
+		if (gap < IRQ_BALANCE_MIN_GAP)
+			break;
+
+		/* The one that leaves the two closest together */
+		pick = -1;
+		best = gap;
+		for (irq = 0; irq < NR_IRQS; irq++) {
+			if (irq_cpu[irq] != busiest || !irq_rate[irq] ||
+			    irq_rate[irq] >= gap)
+				continue;
+			d = gap - 2*irq_rate[irq];
+			if ((int) d < 0)
+				d = -d;
+			if (d < best) {
+				best = d;
+				pick = irq;
+			}
+		}
+		if (pick < 0)
+			break;
+
+		irq_cpu[pick] = idlest;
+		load[busiest] -= irq_rate[pick];
+		load[idlest] += irq_rate[pick];
+		set_ioapic_affinity(pick, 1UL << idlest);
+	}
+}
+
+static void irq_balance_timer_fn(unsigned long data)
+{
+	do_irq_balance();
+	mod_timer(&irq_balance_timer, jiffies + IRQ_BALANCE_INTERVAL);
+}
+
+static int __init irq_balance_init(void)
+{
+	if (irq_balance_disabled || !io_apic_irqs || smp_num_cpus < 2)
+		return 0;
+
+	/* Destinations are bits in the flat logical APIC ID */
+	irq_balance_cpus = smp_num_cpus < 8 ? smp_num_cpus : 8;
+
+	init_timer(&irq_balance_timer);
+	irq_balance_timer.function = irq_balance_timer_fn;
+	irq_balance_timer.expires = jiffies + IRQ_BALANCE_INTERVAL;
+	add_timer(&irq_balance_timer);
+	printk(KERN_INFO "IRQ balancing over %d CPUs\n", irq_balance_cpus);
+	return 0;
+}
+
+__initcall(irq_balance_init);
+
+#endif /* CONFIG_SMP */
+
 static inline void init_IO_APIC_traps(void)
 {
 	int irq;
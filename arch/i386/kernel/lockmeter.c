@@ -0,0 +1,338 @@
+/*
+ *  linux/arch/i386/kernel/lockmeter.c
+ *
+ *  Spinlock and rwlock metering.
+ *
+ *  With CONFIG_LOCKMETER the lock operations in <asm/spinlock.h> test
+ *  lockmeter_enabled, and while it is set go through the functions
+ *  here.  They count, per CPU and per lock and place it was taken
+ *  from, how often the lock was taken, how often it had to be waited
+ *  for, the cycles spent spinning and, for spinlocks and write locks,
+ *  the cycles it was held.  Read locks can have many holders at once
+ *  and their hold time is not measured.
+ *
+ *  The counts are kept in a small open hash table per CPU which is only
+ *  touched by that CPU with interrupts off, so metering itself takes no
+ *  locks and does not bounce cache lines between CPUs.  A lock and
+ *  place that does not find a slot is counted as dropped.
+ *
+ *  /proc/lockmeter shows the tables, one line per CPU, lock and place;
+ *  times are TSC cycles.  Writing "1" to it starts metering, "0" stops
+ *  it and "reset" clears the counts.  The places are return addresses
+ *  and can be looked up in System.map.
+ */
+
+#include <linux/config.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/smp.h>
+#include <linux/proc_fs.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include <asm/processor.h>
+#include <asm/msr.h>
+#include <asm/system.h>
+#include <asm/uaccess.h>
+
+struct lockmeter_stat {
+	void			*lock;		/* NULL: free slot */
+	void			*site;
+	unsigned long		acquired;
+	unsigned long		contended;
+	unsigned long long	spin;
+	unsigned int		spin_max;
+	unsigned long long	hold;
+	unsigned int		hold_max;
+};
+
+#define LOCKMETER_ENTRIES	1024	/* per CPU, a power of 2 */
+#define LOCKMETER_PROBE		16
+
+#define LOCKMETER_ORDER	get_order(LOCKMETER_ENTRIES * sizeof(struct lockmeter_stat))
+
+extern unsigned long cpu_khz;
+
+int lockmeter_enabled __cacheline_aligned;
+
+static struct lockmeter_stat *lockmeter_table[NR_CPUS];
+static unsigned long lockmeter_dropped[NR_CPUS];
+
+static struct lockmeter_stat *lockmeter_find(void *lock, void *site)
+{
+	int cpu = smp_processor_id();
+	struct lockmeter_stat *s;
+	unsigned long h;
+	int i;
+
+	h = (unsigned long) lock * 0x9e370001UL ^ (unsigned long) site;
+	h ^= h >> 16;
+	for (i = 0; i < LOCKMETER_PROBE; i++) {
+		s = lockmeter_table[cpu] + ((h + i) & (LOCKMETER_ENTRIES-1));
+		if (s->lock == lock && s->site == site)
+			return s;
+		if (!s->lock) {
+			s->lock = lock;
+			s->site = site;
+			return s;
+		}
+	}
+	lockmeter_dropped[cpu]++;
+	return NULL;
+}
+
+static struct lockmeter_stat *lockmeter_acquired(void *lock, void *site,
+						 int contended, unsigned int spin)
+{
+	struct lockmeter_stat *s;
+	unsigned long flags;
+
+	__save_flags(flags);
+	__cli();
+	s = lockmeter_find(lock, site);
+	if (s) {
+		s->acquired++;
+		if (contended) {
+			s->contended++;
+			s->spin += spin;
+			if (spin > s->spin_max)
+				s->spin_max = spin;
+		}
+	}
+	__restore_flags(flags);
+	return s;
+}
+
+static void lockmeter_released(struct lockmeter_stat *s, void *lock,
+			       unsigned int hold)
+{
+	unsigned long flags;
+
+	if (!s)
+		return;
+	__save_flags(flags);
+	__cli();
+	/* The counts may have been reset while it was held */
+	if (s->lock == lock) {
+		s->hold += hold;
+		if (hold > s->hold_max)
+			s->hold_max = hold;
+	}
+	__restore_flags(flags);
+}
+
+void _metered_spin_lock(spinlock_t *lock)
+{
+	void *site = __builtin_return_address(0);
+	unsigned int start, now;
+	int contended = 0;
+
+	rdtscl(start);
+	if (!__raw_spin_trylock(lock)) {
+		__raw_spin_lock(lock);
+		contended = 1;
+	}
+	rdtscl(now);
+	lock->meter = lockmeter_acquired(lock, site, contended, now - start);
+	lock->held_since = now;
+}
+
+int _metered_spin_trylock(spinlock_t *lock)
+{
+	void *site = __builtin_return_address(0);
+	unsigned int now;
+
+	if (!__raw_spin_trylock(lock))
+		return 0;
+	rdtscl(now);
+	lock->meter = lockmeter_acquired(lock, site, 0, 0);
+	lock->held_since = now;
+	return 1;
+}
+
+void _metered_spin_unlock(spinlock_t *lock)
+{
+	struct lockmeter_stat *s = lock->meter;
+	unsigned int now;
+
+	rdtscl(now);
+	now -= lock->held_since;
+	lock->meter = NULL;
+	__raw_spin_unlock(lock);
+	lockmeter_released(s, lock, now);
+}
+
+void _metered_read_lock(rwlock_t *rw)
+{
+	void *site = __builtin_return_address(0);
+	unsigned int start, now;
+	int contended;
+
+	rdtscl(start);
+	contended = (int) rw->lock <= 0;	/* a writer has it */
+	__raw_read_lock(rw);
+	rdtscl(now);
+	lockmeter_acquired(rw, site, contended, now - start);
+}
+
+void _metered_write_lock(rwlock_t *rw)
+{
+	void *site = __builtin_return_address(0);
+	unsigned int start, now;
+	int contended;
+
+	rdtscl(start);
+	contended = rw->lock != RW_LOCK_BIAS;
+	__raw_write_lock(rw);
+	rdtscl(now);
+	rw->meter = lockmeter_acquired(rw, site, contended, now - start);
+	rw->held_since = now;
+}
+
+int _metered_write_trylock(rwlock_t *rw)
+{
+	void *site = __builtin_return_address(0);
+	unsigned int now;
+
+	if (!__raw_write_trylock(rw))
+		return 0;
+	rdtscl(now);
+	rw->meter = lockmeter_acquired(rw, site, 0, 0);
+	rw->held_since = now;
+	return 1;
+}
+
+void _metered_write_unlock(rwlock_t *rw)
+{
+	struct lockmeter_stat *s = rw->meter;
+	unsigned int now;
+
+	rdtscl(now);
+	now -= rw->held_since;
+	rw->meter = NULL;
+	__raw_write_unlock(rw);
+	lockmeter_released(s, rw, now);
+}
+
+static void lockmeter_reset_cpu(void *unused)
+{
+	int cpu = smp_processor_id();
+	unsigned long flags;
+
+	__save_flags(flags);
+	__cli();
+	memset(lockmeter_table[cpu], 0,
+	       LOCKMETER_ENTRIES * sizeof(struct lockmeter_stat));
+	lockmeter_dropped[cpu] = 0;
+	__restore_flags(flags);
+}
+
+/*
+ * f_pos counts lines rather than bytes: the header, then one for every
+ * slot of every CPU's table, most of which print nothing.
+ */
+#define LOCKMETER_LINE	(96 + NR_CPUS * 12)
+
+static ssize_t lockmeter_read(struct file *file, char *buf, size_t count,
+			      loff_t *ppos)
+{
+	char line[LOCKMETER_LINE];
+	struct lockmeter_stat *s;
+	unsigned int pos = *ppos, last = smp_num_cpus * LOCKMETER_ENTRIES;
+	size_t done = 0;
+	int cpu, len;
+
+	if (*ppos > last)
+		return 0;
+	while (pos <= last) {
+		len = 0;
+		if (pos == 0) {
+			len = sprintf(line, "# %s, %lu kHz; dropped",
+				      lockmeter_enabled ? "on" : "off", cpu_khz);
+			for (cpu = 0; cpu < smp_num_cpus; cpu++)
+				len += sprintf(line + len, " %lu",
+					       lockmeter_dropped[cpu]);
+			len += sprintf(line + len, "\n# cpu lock site acquired "
+				       "contended spin spin_max hold hold_max\n");
+		} else {
+			cpu = (pos - 1) / LOCKMETER_ENTRIES;
+			s = lockmeter_table[cpu] + (pos - 1) % LOCKMETER_ENTRIES;
+			if (s->lock)
+				len = sprintf(line, "%d %p %p %lu %lu %Lu %u %Lu %u\n",
+					      cpu, s->lock, s->site, s->acquired,
+					      s->contended, s->spin, s->spin_max,
+					      s->hold, s->hold_max);
+		}
+		if (done + len > count)
+			break;
+		if (copy_to_user(buf + done, line, len))
+			return done ? done : -EFAULT;
+		done += len;
+		pos++;
+	}
+	if (!done && pos <= last)
+		return -EINVAL;		/* not even room for a line */
+	*ppos = pos;
+	return done;
+}
+
+static ssize_t lockmeter_write(struct file *file, const char *buf,
+			       size_t count, loff_t *ppos)
+{
+	char cmd[8];
+	int len = count;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (len > sizeof(cmd) - 1)
+		len = sizeof(cmd) - 1;
+	if (copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	cmd[len] = 0;
+
+	if (!strncmp(cmd, "1", 1)) {
+		if (!cpu_has_tsc)
+			return -ENODEV;
+		lockmeter_enabled = 1;
+	} else if (!strncmp(cmd, "0", 1))
+		lockmeter_enabled = 0;
+	else if (!strncmp(cmd, "reset", 5)) {
+		smp_call_function(lockmeter_reset_cpu, NULL, 1, 1);
+		lockmeter_reset_cpu(NULL);
+	} else
+		return -EINVAL;
+	return count;
+}
+
+static struct file_operations lockmeter_fops = {
+	read:		lockmeter_read,
+	write:		lockmeter_write,
+};
+
+static int __init lockmeter_init(void)
+{
+	struct proc_dir_entry *entry;
+	int cpu;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		lockmeter_table[cpu] = (struct lockmeter_stat *)
+			__get_free_pages(GFP_KERNEL, LOCKMETER_ORDER);
+		if (!lockmeter_table[cpu]) {
+			printk(KERN_ERR "lockmeter: no memory\n");
+			while (--cpu >= 0)
+				free_pages((unsigned long) lockmeter_table[cpu],
+					   LOCKMETER_ORDER);
+			return 0;
+		}
+		memset(lockmeter_table[cpu], 0,
+		       LOCKMETER_ENTRIES * sizeof(struct lockmeter_stat));
+	}
+
+	entry = create_proc_entry("lockmeter", S_IWUSR | S_IRUGO, NULL);
+	if (entry)
+		entry->proc_fops = &lockmeter_fops;
+	return 0;
+}
+
+__initcall(lockmeter_init);
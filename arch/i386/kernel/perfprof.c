@@ -0,0 +1,442 @@
+/*
+ *  linux/arch/i386/kernel/perfprof.c
+ *
+ *  Performance counter sampling profiler.
+ *
+ *  The P6 and Athlon performance counters can interrupt when they
+ *  overflow.  With the local APIC's LVTPC entry set to deliver an NMI
+ *  they are loaded with minus the sampling period, and every overflow
+ *  records where the CPU was: user or kernel eip, the current pid and
+ *  the event, so code running with interrupts off is seen as well.
+ *
+ *  The samples go into one ring per CPU.  Only that CPU's NMI handler
+ *  moves the head and only the reader moves the tail, so neither side
+ *  takes a lock; when the ring is full the sample is counted as lost.
+ *  A daemon configures the counters and reads the samples through
+ *  /dev/cpu/perfprof (misc minor 185), see <asm/perfprof.h>.
+ *
+ *  The Pentium 4 counters work differently and are not supported.
+ */
+
+#include <linux/config.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/smp.h>
+#include <linux/miscdevice.h>
+#include <linux/devfs_fs_kernel.h>
+
+#include <asm/processor.h>
+#include <asm/msr.h>
+#include <asm/apic.h>
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
+#include <asm/perfprof.h>
+
+#define PERFPROF_BUF_SAMPLES	8192	/* per CPU, a power of 2 */
+
+/* Event select bits, the same on both */
+#define EVNTSEL_USR		(1 << 16)
+#define EVNTSEL_OS		(1 << 17)
+#define EVNTSEL_INT		(1 << 20)
+#define EVNTSEL_EN		(1 << 22)
+
+struct perfprof_buf {
+	unsigned int		head;	/* moved by the NMI handler only */
+	unsigned int		tail;	/* moved by the reader only */
+	unsigned long		samples;
+	unsigned long		lost;
+	struct perfprof_sample	sample[PERFPROF_BUF_SAMPLES];
+};
+
+#define PERFPROF_BUF_ORDER	get_order(sizeof(struct perfprof_buf))
+
+static struct perfprof_buf *perfprof_buf[NR_CPUS];
+static unsigned long perfprof_saved_lvtpc[NR_CPUS];
+
+static int perfprof_ncounters;		/* 0: this CPU is not supported */
+static int perfprof_p6;			/* one enable bit for both counters */
+static unsigned int perfprof_evntsel[PERFPROF_COUNTERS];
+static unsigned int perfprof_perfctr[PERFPROF_COUNTERS];
+
+static struct perfprof_config perfprof_cfg;
+static volatile int perfprof_running;
+
+static unsigned long perfprof_in_use;
+static DECLARE_MUTEX(perfprof_sem);
+static DECLARE_WAIT_QUEUE_HEAD(perfprof_wait);
+static struct timer_list perfprof_timer;
+
+static inline void perfprof_record(int cpu, struct pt_regs *regs,
+				   struct perfprof_counter *c)
+{
+	struct perfprof_buf *buf = perfprof_buf[cpu];
+	struct perfprof_sample *s;
+	unsigned int head = buf->head;
+
+	if (head - buf->tail >= PERFPROF_BUF_SAMPLES) {
+		buf->lost++;
+		return;
+	}
+
+	s = buf->sample + (head & (PERFPROF_BUF_SAMPLES-1));
+	s->eip = regs->eip;
+	s->pid = current->pid;
+	s->event = (c->event & 0xff) | (c->unit_mask & 0xff) << 8;
+	s->cpu = cpu;
+	s->flags = 0;
+	if ((regs->xcs & 3) || (regs->eflags & X86_EFLAGS_VM))
+		s->flags = PERFPROF_SAMPLE_USER;
+	wmb();
+	buf->head = head + 1;
+	buf->samples++;
+}
+
+/*
+ * Called from do_nmi() for every NMI.  Returns 1 if one of our counters
+ * overflowed; they count up from minus the period, so an overflowed one
+ * has the top bit clear.
+ */
+int perfprof_nmi(struct pt_regs *regs)
+{
+	struct perfprof_counter *c;
+	unsigned int low, high;
+	int cpu, i, handled = 0;
+
+	if (!perfprof_running)
+		return 0;
+
+	cpu = smp_processor_id();
+	for (i = 0; i < perfprof_ncounters; i++) {
+		c = perfprof_cfg.counter + i;
+		if (!c->count)
+			continue;
+		rdmsr(perfprof_perfctr[i], low, high);
+		if (low & (1U << 31))
+			continue;
+		perfprof_record(cpu, regs, c);
+		wrmsr(perfprof_perfctr[i], -c->count, -1);
+		handled = 1;
+	}
+
+	/* Some APICs mask LVTPC when it fires */
+	if (handled)
+		apic_write_around(APIC_LVTPC, APIC_DM_NMI);
+	return handled;
+}
+
+static void perfprof_start_cpu(void *unused)
+{
+	struct perfprof_counter *c;
+	unsigned int sel;
+	int i;
+
+	perfprof_saved_lvtpc[smp_processor_id()] = apic_read(APIC_LVTPC);
+
+	for (i = 0; i < perfprof_ncounters; i++) {
+		wrmsr(perfprof_evntsel[i], 0, 0);
+		c = perfprof_cfg.counter + i;
+		if (c->count)
+			wrmsr(perfprof_perfctr[i], -c->count, -1);
+	}
+
+	apic_write_around(APIC_LVTPC, APIC_DM_NMI);
+
+	for (i = 0; i < perfprof_ncounters; i++) {
+		c = perfprof_cfg.counter + i;
+		sel = 0;
+		if (c->count) {
+			sel = (c->event & 0xff) | (c->unit_mask & 0xff) << 8 |
+				EVNTSEL_INT | EVNTSEL_EN;
+			if (c->flags & PERFPROF_USER)
+				sel |= EVNTSEL_USR;
+			if (c->flags & PERFPROF_KERNEL)
+				sel |= EVNTSEL_OS;
+		} else if (perfprof_p6 && i == 0)
+			sel = EVNTSEL_EN;	/* counter 1 needs it too */
+		if (sel)
+			wrmsr(perfprof_evntsel[i], sel, 0);
+	}
+}
+
+static void perfprof_stop_cpu(void *unused)
+{
+	int i;
+
+	for (i = 0; i < perfprof_ncounters; i++)
+		wrmsr(perfprof_evntsel[i], 0, 0);
+	apic_write_around(APIC_LVTPC, perfprof_saved_lvtpc[smp_processor_id()]);
+}
+
+static int perfprof_pending(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++)
+		if (perfprof_buf[cpu]->head != perfprof_buf[cpu]->tail)
+			return 1;
+	return 0;
+}
+
+/* NMIs cannot wake anybody up, so look every now and then */
+static void perfprof_timer_fn(unsigned long data)
+{
+	if (perfprof_pending())
+		wake_up_interruptible(&perfprof_wait);
+	mod_timer(&perfprof_timer, jiffies + HZ/10);
+}
+
+/* Called with perfprof_sem held */
+static void perfprof_stop(void)
+{
+	if (!perfprof_running)
+		return;
+
+	/*
+	 * An NMI still in flight sees perfprof_running clear; one that
+	 * already got past it finishes before the IPI is taken.
+	 */
+	perfprof_running = 0;
+	wmb();
+	smp_call_function(perfprof_stop_cpu, NULL, 1, 1);
+	perfprof_stop_cpu(NULL);
+	del_timer_sync(&perfprof_timer);
+	wake_up_interruptible(&perfprof_wait);
+}
+
+static int perfprof_start(struct perfprof_config *cfg)
+{
+	struct perfprof_counter *c;
+	int i, used = 0;
+
+	for (i = 0; i < PERFPROF_COUNTERS; i++) {
+		c = cfg->counter + i;
+		if (!c->count)
+			continue;
+		if (i >= perfprof_ncounters || c->count < PERFPROF_MIN_COUNT ||
+		    c->count >= (1U << 31) ||
+		    !(c->flags & (PERFPROF_USER|PERFPROF_KERNEL)))
+			return -EINVAL;
+		used++;
+	}
+	if (!used)
+		return -EINVAL;
+
+	perfprof_stop();
+	for (i = 0; i < smp_num_cpus; i++) {
+		perfprof_buf[i]->head = perfprof_buf[i]->tail = 0;
+		perfprof_buf[i]->samples = perfprof_buf[i]->lost = 0;
+	}
+	perfprof_cfg = *cfg;
+	wmb();
+	perfprof_running = 1;
+	smp_call_function(perfprof_start_cpu, NULL, 1, 1);
+	perfprof_start_cpu(NULL);
+
+	perfprof_timer.expires = jiffies + HZ/10;
+	add_timer(&perfprof_timer);
+	return 0;
+}
+
+static ssize_t perfprof_read(struct file *file, char *buf, size_t count,
+			     loff_t *ppos)
+{
+	struct perfprof_buf *b;
+	size_t done = 0, size = sizeof(struct perfprof_sample);
+	unsigned int head, tail, n;
+	int cpu;
+
+	if (ppos != &file->f_pos)
+		return -ESPIPE;
+	count -= count % size;
+	if (!count)
+		return -EINVAL;
+
+	down(&perfprof_sem);
+	for (;;) {
+		for (cpu = 0; cpu < smp_num_cpus && done < count; cpu++) {
+			b = perfprof_buf[cpu];
+			head = b->head;
+			rmb();
+			while ((tail = b->tail) != head && done < count) {
+				/* as many as are contiguous in the ring */
+				n = head - tail;
+				if (n > (count - done) / size)
+					n = (count - done) / size;
+				tail &= PERFPROF_BUF_SAMPLES-1;
+				if (n > PERFPROF_BUF_SAMPLES - tail)
+					n = PERFPROF_BUF_SAMPLES - tail;
+				if (copy_to_user(buf + done, b->sample + tail,
+						 n * size)) {
+					up(&perfprof_sem);
+					return done ? done : -EFAULT;
+				}
+				mb();
+				b->tail += n;
+				done += n * size;
+			}
+		}
+		if (done || (file->f_flags & O_NONBLOCK) || !perfprof_running)
+			break;
+
+		up(&perfprof_sem);
+		if (wait_event_interruptible(perfprof_wait,
+				perfprof_pending() || !perfprof_running))
+			return -ERESTARTSYS;
+		down(&perfprof_sem);
+	}
+	up(&perfprof_sem);
+
+	if (!done && (file->f_flags & O_NONBLOCK))
+		return -EAGAIN;
+	return done;
+}
+
+static unsigned int perfprof_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &perfprof_wait, wait);
+	if (perfprof_pending())
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static int perfprof_ioctl(struct inode *inode, struct file *file,
+			  unsigned int cmd, unsigned long arg)
+{
+	struct perfprof_config cfg;
+	struct perfprof_stats stats;
+	int cpu, err = 0;
+
+	switch (cmd) {
+	case PERFPROF_START:
+		if (copy_from_user(&cfg, (void *) arg, sizeof(cfg)))
+			return -EFAULT;
+		down(&perfprof_sem);
+		err = perfprof_start(&cfg);
+		up(&perfprof_sem);
+		return err;
+
+	case PERFPROF_STOP:
+		down(&perfprof_sem);
+		perfprof_stop();
+		up(&perfprof_sem);
+		return 0;
+
+	case PERFPROF_STATS:
+		stats.samples = stats.lost = 0;
+		for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+			stats.samples += perfprof_buf[cpu]->samples;
+			stats.lost += perfprof_buf[cpu]->lost;
+		}
+		if (copy_to_user((void *) arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static void perfprof_free(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		if (perfprof_buf[cpu])
+			free_pages((unsigned long) perfprof_buf[cpu],
+				   PERFPROF_BUF_ORDER);
+		perfprof_buf[cpu] = NULL;
+	}
+}
+
+static int perfprof_open(struct inode *inode, struct file *file)
+{
+	int cpu;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!perfprof_ncounters)
+		return -ENODEV;
+	if (test_and_set_bit(0, &perfprof_in_use))
+		return -EBUSY;
+
+	/* Not vmalloc: a vmalloc fault in the NMI handler would unblock NMIs */
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		perfprof_buf[cpu] = (struct perfprof_buf *)
+			__get_free_pages(GFP_KERNEL, PERFPROF_BUF_ORDER);
+		if (!perfprof_buf[cpu]) {
+			perfprof_free();
+			clear_bit(0, &perfprof_in_use);
+			return -ENOMEM;
+		}
+		memset(perfprof_buf[cpu], 0, sizeof(struct perfprof_buf));
+	}
+	return 0;
+}
+
+static int perfprof_release(struct inode *inode, struct file *file)
+{
+	down(&perfprof_sem);
+	perfprof_stop();
+	perfprof_free();
+	up(&perfprof_sem);
+	clear_bit(0, &perfprof_in_use);
+	return 0;
+}
+
+static struct file_operations perfprof_fops = {
+	read:		perfprof_read,
+	poll:		perfprof_poll,
+	ioctl:		perfprof_ioctl,
+	open:		perfprof_open,
+	release:	perfprof_release,
+};
+
+static struct miscdevice perfprof_dev = {
+	minor:	PERFPROF_MINOR,
+	name:	"perfprof",
+	fops:	&perfprof_fops,
+};
+
+static int __init perfprof_init(void)
+{
+	struct cpuinfo_x86 *c = &boot_cpu_data;
+	int i;
+
+	if (!test_bit(X86_FEATURE_APIC, c->x86_capability) || c->x86 != 6)
+		return 0;
+
+	if (c->x86_vendor == X86_VENDOR_INTEL) {
+		perfprof_ncounters = 2;
+		perfprof_p6 = 1;
+		for (i = 0; i < 2; i++) {
+			perfprof_evntsel[i] = MSR_P6_EVNTSEL0 + i;
+			perfprof_perfctr[i] = MSR_P6_PERFCTR0 + i;
+		}
+	} else if (c->x86_vendor == X86_VENDOR_AMD) {
+		perfprof_ncounters = 4;
+		for (i = 0; i < 4; i++) {
+			perfprof_evntsel[i] = MSR_K7_EVNTSEL0 + i;
+			perfprof_perfctr[i] = MSR_K7_PERFCTR0 + i;
+		}
+	} else
+		return 0;
+
+	init_timer(&perfprof_timer);
+	perfprof_timer.function = perfprof_timer_fn;
+
+	if (misc_register(&perfprof_dev)) {
+		printk(KERN_WARNING "perfprof: can't misc_register on minor=%d\n",
+		       PERFPROF_MINOR);
+		perfprof_ncounters = 0;
+		return 0;
+	}
+	devfs_register(NULL, "cpu/perfprof", DEVFS_FL_DEFAULT, MISC_MAJOR,
+		       PERFPROF_MINOR, S_IFCHR | S_IRUSR | S_IWUSR,
+		       &perfprof_fops, NULL);
+	printk(KERN_INFO "perfprof: %d performance counters per CPU\n",
+	       perfprof_ncounters);
+	return 0;
+}
+
+__initcall(perfprof_init);
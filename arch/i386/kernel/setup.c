@@ -893,6 +893,31 @@ static int __init get_model_name(struct cpuinfo_x86 *c)
 }
 
 
+/*
+ * Tell the page allocator how many page colours the boot CPU's L2 has:
+ * its size over the size of one way.
+ */
+static void __init set_page_colours(struct cpuinfo_x86 *c,
+	unsigned int l2size, unsigned int assoc)
+{
+	unsigned int colours;
+
+	if (c != &boot_cpu_data || !l2size || !assoc)
+		return;
+	colours = (l2size << 10) / (assoc * PAGE_SIZE);
+	while (colours & (colours - 1))
+		colours &= colours - 1;
+	if (colours > 1) {
+		page_colours = colours;
+		printk("CPU: %d page colours\n", colours);
+	}
+}
+
+/* Ways of the L2 for the cpuid 0x80000006 codes, 0 for fully associative */
+static unsigned char l2_assoc[16] __initdata = {
+	0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 0, 0, 0, 0, 0, 0
+};
+
 static void __init display_cacheinfo(struct cpuinfo_x86 *c)
 {
 	unsigned int n, dummy, ecx, edx, l2size;
@@ -927,6 +952,7 @@ static void __init display_cacheinfo(struct cpuinfo_x86 *c)
 
 	printk("CPU: L2 Cache: %dK (%d bytes/line)\n",
 	       l2size, ecx & 0xFF);
+	set_page_colours(c, l2size, l2_assoc[(ecx >> 12) & 0xF]);
 }
 
 /*
@@ -1486,6 +1512,7 @@ static void __init init_intel(struct cpuinfo_x86 *c)
 	extern void mcheck_init(struct cpuinfo_x86 *c);
 	char *p = NULL;
 	unsigned int l1i = 0, l1d = 0, l2 = 0, l3 = 0; /* Cache sizes */
+	unsigned int l2assoc = 0;
 
 #ifndef CONFIG_M686
 	/*
@@ -1580,6 +1607,8 @@ static void __init init_intel(struct cpuinfo_x86 *c)
 						/* L2 cache */
 						cs = 128 << (dl-1);
 						l2 += cs;
+						/* 0x4x are 4-way, 0x8x 8-way */
+						l2assoc = (dh == 8) ? 8 : 4;
 					}
 					break;
 				case 6:
@@ -1592,9 +1621,10 @@ static void __init init_intel(struct cpuinfo_x86 *c)
 				case 7:
 					if ( dl >= 8 ) 
 					{
-						/* L2 cache */
+						/* L2 cache, 8-way */
 						cs = 64<<(dl-8);
 						l2 += cs;
+						l2assoc = 8;
 					} else {
 						/* L0 I cache, count as L1 */
 						cs = dl ? (16 << (dl-1)) : 12;
@@ -1622,6 +1652,7 @@ static void __init init_intel(struct cpuinfo_x86 *c)
 		 * SMP switching weights.
 		 */
 		c->x86_cache_size = l2 ? l2 : (l1i+l1d);
+		set_page_colours(c, l2, l2assoc);
 	}
 
 	/* SEP CPUID bug: Pentium Pro reports SEP but doesn't have it */
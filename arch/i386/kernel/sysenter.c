@@ -0,0 +1,119 @@
+/*
+ *  linux/arch/i386/kernel/sysenter.c
+ *
+ *  The system call page.
+ *
+ *  int $0x80 costs hundreds of cycles on a P6 or a Pentium 4, SYSENTER
+ *  and SYSEXIT a fraction of that.  But SYSENTER does not say where it
+ *  came from, so the kernel has to know where to return to: user mode
+ *  does not use it directly but calls a stub in a page the kernel maps
+ *  at VSYSCALL_BASE in every address space, and which it fills with the
+ *  best way to enter the kernel this CPU has.  The address is passed to
+ *  programs as AT_SYSINFO in the ELF auxiliary vector.
+ *
+ *  The stub takes the same registers as int $0x80, so a C library can
+ *  simply replace the instruction with "call *sysinfo".  clone() with a
+ *  new stack must stay with int $0x80: the stub returns through the
+ *  stack it was called on.
+ *
+ *  AMD's SYSCALL is not used.  Outside of long mode it does not switch
+ *  stacks, which leaves the kernel on the user stack until the first
+ *  instruction, and the Athlon has SYSENTER anyway.
+ */
+
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/stddef.h>
+
+#include <asm/processor.h>
+#include <asm/msr.h>
+#include <asm/pgtable.h>
+#include <asm/fixmap.h>
+#include <asm/segment.h>
+
+extern asmlinkage void sysenter_entry(void);
+
+static int nosysenter __initdata;
+
+static int __init nosysenter_setup(char *str)
+{
+	nosysenter = 1;
+	return 1;
+}
+
+__setup("nosysenter", nosysenter_setup);
+
+static const char int80[] __initdata = {
+	0xcd, 0x80,		/* int $0x80 */
+	0xc3			/* ret */
+};
+
+/* entry.S knows the offset of the return point */
+static const char sysent[] __initdata = {
+	0x51,			/* push %ecx */
+	0x52,			/* push %edx */
+	0x55,			/* push %ebp */
+	0x89, 0xe5,		/* movl %esp,%ebp */
+	0x0f, 0x34,		/* sysenter */
+	0x90,			/* nop */
+	/* 0x08: a restarted system call comes back here (eip - 2) */
+	0xeb, 0xf9,		/* jmp to "movl %esp,%ebp" */
+	/* 0x0a: SYSENTER_RETURN */
+	0x5d,			/* pop %ebp */
+	0x5a,			/* pop %edx */
+	0x59,			/* pop %ecx */
+	0xc3			/* ret */
+};
+
+static void __init enable_sep_cpu(void *info)
+{
+	struct tss_struct *tss = init_tss + smp_processor_id();
+
+	wrmsr(MSR_IA32_SYSENTER_CS, __KERNEL_CS, 0);
+	wrmsr(MSR_IA32_SYSENTER_ESP, (unsigned long) (tss + 1), 0);
+	wrmsr(MSR_IA32_SYSENTER_EIP, (unsigned long) sysenter_entry, 0);
+}
+
+static int __init have_sep(struct cpuinfo_x86 *c)
+{
+	if (!test_bit(X86_FEATURE_SEP, c->x86_capability))
+		return 0;
+
+	/* The Pentium Pro claims SEP but has no working SYSENTER */
+	if (c->x86_vendor == X86_VENDOR_INTEL && c->x86 == 6 &&
+	    c->x86_model < 3 && c->x86_mask < 3)
+		return 0;
+
+	/* entry.S finds esp0 from the end of the TSS */
+	if (sizeof(struct tss_struct) != 0x200 ||
+	    offsetof(struct tss_struct, esp0) != 4) {
+		printk(KERN_ERR "sysenter: unexpected TSS layout\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int __init sysenter_setup(void)
+{
+	unsigned long page = get_zeroed_page(GFP_KERNEL);
+
+	if (!page)
+		panic("sysenter: no memory for the system call page");
+
+	if (!nosysenter && have_sep(&boot_cpu_data)) {
+		/* every CPU has to be able to take it before anyone uses it */
+		enable_sep_cpu(NULL);
+		smp_call_function(enable_sep_cpu, NULL, 1, 1);
+		memcpy((void *) page, sysent, sizeof(sysent));
+		printk(KERN_INFO "sysenter: using SYSENTER/SYSEXIT\n");
+	} else
+		memcpy((void *) page, int80, sizeof(int80));
+
+	__set_fixmap(FIX_VSYSCALL, __pa(page), PAGE_KERNEL_VSYSCALL);
+	return 0;
+}
+
+__initcall(sysenter_setup);
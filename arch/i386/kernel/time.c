@@ -43,6 +43,7 @@
 #include <linux/smp.h>
 
 #include <asm/io.h>
+#include <asm/div64.h>
 #include <asm/smp.h>
 #include <asm/irq.h>
 #include <asm/msr.h>
@@ -66,6 +67,18 @@
 
 unsigned long cpu_khz;	/* Detected as we calibrate the TSC */
 
+#ifdef CONFIG_TSC_ACCOUNTING
+/* Nanoseconds per cycle, scaled by 2^CYC2NS_SHIFT; 0 if the TSC is unusable */
+#define CYC2NS_SHIFT	16
+static unsigned long cyc2ns_scale;
+
+unsigned long long cycles_to_ns(cycles_t cycles)
+{
+	return (cycles >> CYC2NS_SHIFT) * cyc2ns_scale +
+	       (((cycles & ((1 << CYC2NS_SHIFT) - 1)) * cyc2ns_scale) >> CYC2NS_SHIFT);
+}
+#endif
+
 /* Number of usecs that the last interrupt was delayed */
 static int delay_at_last_interrupt;
 
@@ -253,22 +266,37 @@ static unsigned long (*do_gettimeoffset)(void) = do_slow_gettimeoffset;
 /*
  * This version of gettimeofday has microsecond resolution
  * and better than microsecond precision on fast x86 machines with TSC.
+ *
+ * Everything we read here only changes inside xtime_seq, so we need
+ * no lock: with the TSC we just take another snapshot if a tick came
+ * in meanwhile. All the state lives in a few words that a user
+ * mapped page could carry one day. The PIT fallback keeps private
+ * state of its own and has to run with interrupts off.
  */
 void do_gettimeofday(struct timeval *tv)
 {
+#ifndef CONFIG_X86_TSC
 	unsigned long flags;
-	unsigned long usec, sec;
+#endif
+	unsigned long usec, sec, lost;
+	unsigned int seq;
 
-	read_lock_irqsave(&xtime_lock, flags);
-	usec = do_gettimeoffset();
-	{
-		unsigned long lost = jiffies - wall_jiffies;
-		if (lost)
-			usec += lost * (1000000 / HZ);
-	}
-	sec = xtime.tv_sec;
-	usec += xtime.tv_usec;
-	read_unlock_irqrestore(&xtime_lock, flags);
+#ifndef CONFIG_X86_TSC
+	local_irq_save(flags);
+#endif
+	do {
+		seq = read_seqcount_begin(&xtime_seq);
+		usec = do_gettimeoffset();
+		lost = jiffies - wall_jiffies;
+		sec = xtime.tv_sec;
+		usec += xtime.tv_usec;
+	} while (read_seqcount_retry(&xtime_seq, seq));
+#ifndef CONFIG_X86_TSC
+	local_irq_restore(flags);
+#endif
+
+	if (lost)
+		usec += lost * (1000000 / HZ);
 
 	while (usec >= 1000000) {
 		usec -= 1000000;
@@ -279,9 +307,26 @@ void do_gettimeofday(struct timeval *tv)
 	tv->tv_usec = usec;
 }
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * Nanoseconds since the last tick, for the high resolution timers.
+ * The hardware only gives us microseconds here.
+ */
+unsigned long arch_hrtimer_offset(void)
+{
+	unsigned long flags, usec;
+
+	local_irq_save(flags);
+	usec = do_gettimeoffset();
+	local_irq_restore(flags);
+	return usec * 1000;
+}
+#endif
+
 void do_settimeofday(struct timeval *tv)
 {
 	write_lock_irq(&xtime_lock);
+	write_seqcount_begin(&xtime_seq);
 	/*
 	 * This is revolting. We need to set "xtime" correctly. However, the
 	 * value in this location is the value at the most recent update of
@@ -301,6 +346,7 @@ void do_settimeofday(struct timeval *tv)
 	time_status |= STA_UNSYNC;
 	time_maxerror = NTP_PHASE_LIMIT;
 	time_esterror = NTP_PHASE_LIMIT;
+	write_seqcount_end(&xtime_seq);
 	write_unlock_irq(&xtime_lock);
 }
 
@@ -468,6 +514,7 @@ static void timer_interrupt(int irq, void *dev_id, struct pt_regs *regs)
 	 * locally disabled. -arca
 	 */
 	write_lock(&xtime_lock);
+	write_seqcount_begin(&xtime_seq);
 
 	if (use_tsc)
 	{
@@ -500,6 +547,7 @@ static void timer_interrupt(int irq, void *dev_id, struct pt_regs *regs)
  
 	do_timer_interrupt(irq, NULL, regs);
 
+	write_seqcount_end(&xtime_seq);
 	write_unlock(&xtime_lock);
 
 }
@@ -683,6 +731,14 @@ void __init time_init(void)
 	                	"0" (eax), "1" (edx));
 				printk("Detected %lu.%03lu MHz processor.\n", cpu_khz / 1000, cpu_khz % 1000);
 			}
+#ifdef CONFIG_TSC_ACCOUNTING
+			if (cpu_khz) {
+				unsigned long long scale = 1000000ULL << CYC2NS_SHIFT;
+
+				do_div(scale, cpu_khz);
+				cyc2ns_scale = scale;
+			}
+#endif
 		}
 	}
 
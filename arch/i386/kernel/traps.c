@@ -38,6 +38,7 @@
 #include <asm/i387.h>
 
 #include <asm/smp.h>
+#include <asm/perfprof.h>
 #include <asm/pgalloc.h>
 
 #ifdef CONFIG_X86_VISWS_APIC
@@ -197,9 +198,10 @@ void die(const char * str, struct pt_regs * regs, long err)
 {
 	console_verbose();
 	spin_lock_irq(&die_lock);
+	oops_in_progress++;
 	printk("%s: %04lx\n", str, err & 0xffff);
 	show_registers(regs);
-
+	oops_in_progress--;
 	spin_unlock_irq(&die_lock);
 	do_exit(SIGSEGV);
 }
@@ -426,6 +428,7 @@ inline void nmi_watchdog_tick(struct pt_regs * regs)
 			 * to get a message out.
 			 */
 			bust_spinlocks();
+			oops_in_progress = 1;
 			printk("NMI Watchdog detected LOCKUP on CPU%d, registers:\n", cpu);
 			show_registers(regs);
 			printk("console shuts up ...\n");
@@ -446,6 +449,10 @@ asmlinkage void do_nmi(struct pt_regs * regs, long error_code)
 
 
 	++nmi_count(smp_processor_id());
+#ifdef CONFIG_X86_PERFPROF
+	if (perfprof_nmi(regs) && !(reason & 0xc0))
+		return;
+#endif
 	if (!(reason & 0xc0)) {
 #if CONFIG_X86_IO_APIC
 		/*
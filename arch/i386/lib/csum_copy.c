@@ -0,0 +1,198 @@
+/*
+ * Selection of csum_partial_copy_generic.
+ *
+ * checksum.S has a plain copy-and-checksum loop and variants for newer
+ * CPUs.  Those that the CPU can run are checked against the plain one and
+ * timed at boot, the way the RAID code picks its xor routine, and the
+ * fastest is used from then on.  The timing copies packet sized pieces
+ * out of a buffer larger than the L2 cache, which is what the receive
+ * path sees: the data was just put there by the card.
+ */
+#include <linux/config.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <asm/processor.h>
+#include <asm/uaccess.h>
+#include <asm/checksum.h>
+
+/* Called from assembly, like csum_partial_copy_generic() itself */
+typedef asmlinkage unsigned int csum_copy_t(const char *src, char *dst,
+		int len, int sum, int *src_err_ptr, int *dst_err_ptr);
+
+extern csum_copy_t csum_partial_copy_plain;
+extern csum_copy_t csum_partial_copy_prefetch;
+extern csum_copy_t csum_partial_copy_wide;
+
+/* Used by the csum_partial_copy_generic stub in checksum.S */
+csum_copy_t *csum_partial_copy_fn = csum_partial_copy_plain;
+
+struct csum_copy_template {
+	struct csum_copy_template *next;
+	const char *name;
+	csum_copy_t *copy;
+	int speed;
+};
+
+static struct csum_copy_template csum_copy_plain = {
+	name:	"plain",
+	copy:	csum_partial_copy_plain,
+};
+
+/* PIII, Athlon: prefetchnta is in SSE and in AMD's MMX extensions */
+static struct csum_copy_template csum_copy_prefetch = {
+	name:	"prefetch",
+	copy:	csum_partial_copy_prefetch,
+};
+
+/* Pentium 4 */
+static struct csum_copy_template csum_copy_wide = {
+	name:	"wide",
+	copy:	csum_partial_copy_wide,
+};
+
+#define CSUM_BENCH_ORDER	8
+#define CSUM_BENCH_SIZE		(PAGE_SIZE << CSUM_BENCH_ORDER)
+#define CSUM_BENCH_PACKET	1500
+
+/* Variants may return a different 32-bit sum, but it must fold the same */
+static unsigned int __init csum_copy_fold(unsigned int sum)
+{
+	sum = csum_fold(sum) & 0xffff;
+	return sum == 0xffff ? 0 : sum;
+}
+
+static int __init csum_copy_check(struct csum_copy_template *tmpl,
+				  char *src, char *dst, char *ref, int len)
+{
+	static unsigned int sums[] __initdata = { 0, 0xffffffff, 0x89abcdef };
+	unsigned int want, got;
+	int s, d, i;
+
+	for (s = 0; s < 4; s++)
+	    for (d = 0; d < 4; d++)
+		for (i = 0; i < sizeof(sums) / sizeof(sums[0]); i++) {
+			memset(ref, 0x5a, len + 8);
+			memset(dst, 0x5a, len + 8);
+			want = csum_partial_copy_plain(src + s, ref + d, len,
+						       sums[i], NULL, NULL);
+			got = tmpl->copy(src + s, dst + d, len,
+					 sums[i], NULL, NULL);
+			if (csum_copy_fold(got) != csum_copy_fold(want) ||
+			    memcmp(dst, ref, len + 8)) {
+				printk(KERN_ERR "csum_copy: %s fails for %d "
+				       "bytes at %d/%d, not used\n",
+				       tmpl->name, len, s, d);
+				return -1;
+			}
+		}
+	return 0;
+}
+
+/* Every length up to a few rounds, packet sizes, and past one fold */
+static int __init csum_copy_test(struct csum_copy_template *tmpl,
+				 char *src, char *dst)
+{
+	static int lens[] __initdata = { 576, 1460, 1500, 4096, 9000,
+					 65536 + 100, 2 * 65536 + 1234 + 3 };
+	char *ref = dst + CSUM_BENCH_SIZE / 2;
+	int i;
+
+	for (i = 0; i <= 260; i++)
+		if (csum_copy_check(tmpl, src, dst, ref, i))
+			return -1;
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+		if (csum_copy_check(tmpl, src, dst, ref, lens[i]))
+			return -1;
+	return 0;
+}
+
+static void __init do_csum_copy_speed(struct csum_copy_template *tmpl,
+				      char *src, char *dst)
+{
+	unsigned long now;
+	int i, count, max, off;
+
+	/* Count the packets done during a whole jiffy, best of five */
+	max = 0;
+	off = 0;
+	for (i = 0; i < 5; i++) {
+		now = jiffies;
+		count = 0;
+		while (jiffies == now) {
+			mb();
+			tmpl->copy(src + off, dst, CSUM_BENCH_PACKET, 0,
+				   NULL, NULL);
+			mb();
+			off += CSUM_BENCH_PACKET;
+			if (off > CSUM_BENCH_SIZE - CSUM_BENCH_PACKET)
+				off = 0;
+			count++;
+		}
+		if (count > max)
+			max = count;
+	}
+
+	tmpl->speed = max * HZ * (CSUM_BENCH_PACKET / 4) / 256;
+	printk(KERN_INFO "   %-10s: %5d.%03d MB/sec\n", tmpl->name,
+	       tmpl->speed / 1000, tmpl->speed % 1000);
+}
+
+static int __init calibrate_csum_copy(void)
+{
+	struct csum_copy_template *list = &csum_copy_plain, *t, **p, *fastest;
+	char *b1, *b2;
+	int i;
+
+	if (test_bit(X86_FEATURE_XMM, boot_cpu_data.x86_capability) ||
+	    test_bit(X86_FEATURE_MMXEXT, boot_cpu_data.x86_capability)) {
+		csum_copy_prefetch.next = list;
+		list = &csum_copy_prefetch;
+	}
+	if (test_bit(X86_FEATURE_XMM2, boot_cpu_data.x86_capability)) {
+		csum_copy_wide.next = list;
+		list = &csum_copy_wide;
+	}
+	if (list == &csum_copy_plain)
+		return 0;
+
+	b1 = (char *)__get_free_pages(GFP_KERNEL, CSUM_BENCH_ORDER);
+	b2 = (char *)__get_free_pages(GFP_KERNEL, CSUM_BENCH_ORDER);
+	if (!b1 || !b2)
+		goto out;
+
+	for (i = 0; i < CSUM_BENCH_SIZE; i++)
+		b1[i] = (i * 131) ^ (i >> 9);
+
+	/* Drop whatever does not agree with the plain version */
+	for (p = &list; *p != &csum_copy_plain; ) {
+		if (csum_copy_test(*p, b1, b2))
+			*p = (*p)->next;
+		else
+			p = &(*p)->next;
+	}
+	if (list == &csum_copy_plain)
+		goto out;
+
+	printk(KERN_INFO "csum_copy: measuring checksumming copy speed\n");
+	for (t = list; t; t = t->next)
+		do_csum_copy_speed(t, b1, b2);
+
+	fastest = list;
+	for (t = list; t; t = t->next)
+		if (t->speed > fastest->speed)
+			fastest = t;
+
+	csum_partial_copy_fn = fastest->copy;
+	printk(KERN_INFO "csum_copy: using function: %s (%d.%03d MB/sec)\n",
+	       fastest->name, fastest->speed / 1000, fastest->speed % 1000);
+out:
+	if (b1)
+		free_pages((unsigned long)b1, CSUM_BENCH_ORDER);
+	if (b2)
+		free_pages((unsigned long)b2, CSUM_BENCH_ORDER);
+	return 0;
+}
+
+__initcall(calibrate_csum_copy);
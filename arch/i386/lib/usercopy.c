@@ -6,7 +6,11 @@
  * Copyright 1997 Linus Torvalds
  */
 #include <linux/config.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
 #include <asm/uaccess.h>
+#include <asm/processor.h>
 #include <asm/mmx.h>
 
 #ifdef CONFIG_X86_USE_3DNOW_AND_WORKS
@@ -43,7 +47,7 @@ unsigned long
 __generic_copy_to_user(void *to, const void *from, unsigned long n)
 {
 	if (access_ok(VERIFY_WRITE, to, n))
-		__copy_user(to,from,n);
+		n = __generic_copy_to_user_nocheck(to,from,n);
 	return n;
 }
 
@@ -51,12 +55,196 @@ unsigned long
 __generic_copy_from_user(void *to, const void *from, unsigned long n)
 {
 	if (access_ok(VERIFY_READ, from, n))
-		__copy_user_zeroing(to,from,n);
+		n = __generic_copy_from_user_nocheck(to,from,n);
 	return n;
 }
 
 #endif
 
+/*
+ * Large copies.  The routines for them are timed at boot, the way the
+ * RAID code picks its xor routine, and the fastest one is used for
+ * copies of copy_user_nt_threshold bytes or more.  The non-temporal
+ * one writes around the caches, so that a read() of many megabytes
+ * does not evict everything else.  It uses no FPU state, so it is
+ * free to sleep in a page fault.
+ */
+
+unsigned long copy_user_nt_threshold = ~0UL;	/* off until timed */
+static unsigned long nt_threshold __initdata = PAGE_SIZE;
+
+struct copy_user_template {
+	struct copy_user_template *next;
+	const char *name;
+	/* Returns what could not be copied; zero: clear that part of to */
+	unsigned long (*copy)(void *to, const void *from, unsigned long n,
+			      int zero);
+	int speed;
+};
+
+static unsigned long movsl_copy(void *to, const void *from, unsigned long n,
+				int zero)
+{
+	if (zero)
+		__copy_user_zeroing(to,from,n);
+	else
+		__copy_user(to,from,n);
+	return n;
+}
+
+static struct copy_user_template copy_movsl = {
+	name:	"rep movsl",
+	copy:	movsl_copy,
+};
+
+/* 8 bytes from %2 to %1, going around the cache.  Any fault ends the loop. */
+#define NT_MOVE8(off)						\
+	"1:	movl " #off "(%2), %%eax\n"			\
+	"2:	movl " #off "+4(%2), %%edx\n"			\
+	"3:	movnti %%eax, " #off "(%1)\n"			\
+	"4:	movnti %%edx, " #off "+4(%1)\n"			\
+	".section __ex_table,\"a\"\n"				\
+	"	.align 4\n"					\
+	"	.long 1b,99f\n"					\
+	"	.long 2b,99f\n"					\
+	"	.long 3b,99f\n"					\
+	"	.long 4b,99f\n"					\
+	".previous\n"
+
+/*
+ * SSE2.  Whole cache lines of the destination are stored with movnti;
+ * the unaligned head and the tail, or whatever is left after a fault,
+ * go through rep movsl, which then finds the exact extent of the fault.
+ */
+static unsigned long movnti_copy(void *to, const void *from, unsigned long n,
+				 int zero)
+{
+	unsigned long head, blocks, left;
+	int d0, d1;
+
+	head = -(unsigned long)to & 63;
+	if (head > n)
+		head = n;
+	if (head && movsl_copy(to, from, head, zero))
+		return movsl_copy(to, from, n, zero);
+
+	blocks = left = (n - head) >> 6;
+	if (blocks) {
+		__asm__ __volatile__(
+			"0:\n"
+			NT_MOVE8(0) NT_MOVE8(8) NT_MOVE8(16) NT_MOVE8(24)
+			NT_MOVE8(32) NT_MOVE8(40) NT_MOVE8(48) NT_MOVE8(56)
+			"	addl $64,%1\n"
+			"	addl $64,%2\n"
+			"	decl %0\n"
+			"	jnz 0b\n"
+			"99:	sfence\n"
+			: "=r" (left), "=r" (d0), "=r" (d1)
+			: "0" (left), "1" (to + head), "2" (from + head)
+			: "eax", "edx", "memory");
+	}
+
+	head += (blocks - left) << 6;
+	return movsl_copy(to + head, from + head, n - head, zero);
+}
+
+static struct copy_user_template copy_movnti = {
+	name:	"movnti",
+	copy:	movnti_copy,
+};
+
+static struct copy_user_template *copy_user_large = &copy_movsl;
+
+unsigned long __copy_to_user_large(void *to, const void *from, unsigned long n)
+{
+	return copy_user_large->copy(to, from, n, 0);
+}
+
+unsigned long __copy_from_user_large(void *to, const void *from, unsigned long n)
+{
+	return copy_user_large->copy(to, from, n, 1);
+}
+
+static int __init nt_copy_setup(char *str)
+{
+	nt_threshold = simple_strtoul(str, NULL, 0);
+	return 1;
+}
+
+__setup("nt_copy_threshold=", nt_copy_setup);
+
+/* Larger than the L2 cache, which is where the difference shows */
+#define COPY_BENCH_ORDER	8
+#define COPY_BENCH_SIZE		(PAGE_SIZE << COPY_BENCH_ORDER)
+
+static void __init do_copy_speed(struct copy_user_template *tmpl,
+				 void *to, void *from)
+{
+	unsigned long now;
+	int i, count, max;
+
+	/* Count the copies done during a whole jiffy, best of five */
+	max = 0;
+	for (i = 0; i < 5; i++) {
+		now = jiffies;
+		count = 0;
+		while (jiffies == now) {
+			mb();
+			tmpl->copy(to, from, COPY_BENCH_SIZE, 0);
+			mb();
+			count++;
+		}
+		if (count > max)
+			max = count;
+	}
+
+	tmpl->speed = max * HZ * (COPY_BENCH_SIZE / 1024);
+	printk(KERN_INFO "   %-10s: %5d.%03d MB/sec\n", tmpl->name,
+	       tmpl->speed / 1000, tmpl->speed % 1000);
+}
+
+static int __init calibrate_copy_user(void)
+{
+	struct copy_user_template *list = &copy_movsl, *t, *fastest;
+	void *b1, *b2;
+
+	if (test_bit(X86_FEATURE_XMM2, boot_cpu_data.x86_capability)) {
+		copy_movnti.next = list;
+		list = &copy_movnti;
+	}
+	if (list == &copy_movsl || nt_threshold == 0)
+		return 0;
+
+	b1 = (void *)__get_free_pages(GFP_KERNEL, COPY_BENCH_ORDER);
+	b2 = (void *)__get_free_pages(GFP_KERNEL, COPY_BENCH_ORDER);
+	if (!b1 || !b2)
+		goto out;
+
+	printk(KERN_INFO "copy_user: measuring large copies\n");
+	for (t = list; t; t = t->next)
+		do_copy_speed(t, b1, b2);
+
+	fastest = list;
+	for (t = list; t; t = t->next)
+		if (t->speed > fastest->speed)
+			fastest = t;
+
+	if (fastest != &copy_movsl) {
+		copy_user_large = fastest;
+		copy_user_nt_threshold = nt_threshold;
+		printk(KERN_INFO "copy_user: using %s from %lu bytes up\n",
+		       fastest->name, nt_threshold);
+	}
+out:
+	if (b1)
+		free_pages((unsigned long)b1, COPY_BENCH_ORDER);
+	if (b2)
+		free_pages((unsigned long)b2, COPY_BENCH_ORDER);
+	return 0;
+}
+
+__initcall(calibrate_copy_user);
+
 /*
  * Copy a null terminated string from userspace.
  */
@@ -77,17 +77,17 @@ bad_area:
 	return 0;
 }
 
-extern spinlock_t console_lock, timerlist_lock;
+extern spinlock_t console_lock;
 
 /*
  * Unlock any spinlocks which will prevent us from getting the
- * message out (timerlist_lock is aquired through the
+ * message out (the timer locks are aquired through the
  * console unblank code)
  */
 void bust_spinlocks(void)
 {
 	spin_lock_init(&console_lock);
-	spin_lock_init(&timerlist_lock);
+	bust_timer_locks();
 }
 
 asmlinkage void do_invalid_op(struct pt_regs *, unsigned long);
@@ -137,8 +137,9 @@ asmlinkage void do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	/*
 	 * If we're in an interrupt or have no user
 	 * context, we must not take the fault..
+	 * Neither while copying through an atomic kmap.
 	 */
-	if (in_interrupt() || !mm)
+	if (in_interrupt() || !mm || (tsk->flags & PF_ATOMICCOPY))
 		goto no_context;
 
 	down(&mm->mmap_sem);
@@ -25,6 +25,7 @@
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
 #include <linux/bootmem.h>
+#include <linux/bigpages.h>
 
 #include <asm/processor.h>
 #include <asm/system.h>
@@ -232,9 +233,8 @@ extern char _text, _etext, _edata, __bss_start, _end;
 extern char __init_begin, __init_end;
 
 static inline void set_pte_phys (unsigned long vaddr,
-			unsigned long phys, pgprot_t flags)
+			unsigned long phys, pgprot_t prot)
 {
-	pgprot_t prot;
 	pgd_t *pgd;
 	pmd_t *pmd;
 	pte_t *pte;
@@ -252,7 +252,6 @@ static inline void set_pte_phys (unsigned long vaddr,
 	pte = pte_offset(pmd, vaddr);
 	if (pte_val(*pte))
 		pte_ERROR(*pte);
-	pgprot_val(prot) = pgprot_val(PAGE_KERNEL) | pgprot_val(flags);
 	set_pte(pte, mk_pte_phys(phys, prot));
 
 	/*
@@ -301,7 +300,8 @@ static void __init fixrange_init (unsigned long start, unsigned long end, pgd_t
 		for (; (j < PTRS_PER_PMD) && (vaddr != end); pmd++, j++) {
 			if (pmd_none(*pmd)) {
 				pte = (pte_t *) alloc_bootmem_low_pages(PAGE_SIZE);
-				set_pmd(pmd, __pmd(_KERNPG_TABLE + __pa(pte)));
+				/* user mode may see FIX_VSYSCALL */
+				set_pmd(pmd, __pmd(_PAGE_TABLE + __pa(pte)));
 				if (pte != pte_offset(pmd, 0))
 					BUG();
 			}
@@ -551,6 +551,71 @@ static inline int page_is_ram (unsigned long pagenr)
 	return 0;
 }
 
+#ifdef CONFIG_BIGPAGES
+static unsigned long bigpages_wanted __initdata;
+static unsigned long bigpages_high __initdata;
+
+static int __init bigpages_setup(char *str)
+{
+	bigpages_wanted = simple_strtoul(str, NULL, 0);
+	return 1;
+}
+
+__setup("bigpages=", bigpages_setup);
+
+static int __init bigpage_is_ram(unsigned long pfn)
+{
+	unsigned long i;
+
+	for (i = 0; i < BIGPAGE_NR; i++)
+		if (!page_is_ram(pfn + i))
+			return 0;
+	return 1;
+}
+
+/*
+ * Set aside the big pages asked for with bigpages=. High memory goes
+ * first, the kernel itself has the least use for it; mem_init() takes
+ * those when it frees high memory, we only count them here. The rest
+ * comes from the bootmem allocator, as long as that leaves the kernel
+ * half of low memory.
+ */
+static void __init reserve_bigpages(void)
+{
+	unsigned long left = bigpages_wanted, low = 0;
+#ifdef CONFIG_HIGHMEM
+	unsigned long pfn;
+#endif
+
+	if (!left)
+		return;
+	if (!cpu_has_pse) {
+		printk(KERN_WARNING "bigpages: CPU has no PSE, none set aside\n");
+		return;
+	}
+
+#ifdef CONFIG_HIGHMEM
+	pfn = (highstart_pfn + BIGPAGE_NR - 1) & ~(BIGPAGE_NR - 1);
+	for (; left && pfn + BIGPAGE_NR <= highend_pfn; pfn += BIGPAGE_NR) {
+		if (bigpage_is_ram(pfn)) {
+			bigpages_high++;
+			left--;
+		}
+	}
+#endif
+	while (left && (low + 1) * BIGPAGE_NR <= max_low_pfn / 2) {
+		void *p = __alloc_bootmem(BIGPAGE_SIZE, BIGPAGE_SIZE,
+					  __pa(MAX_DMA_ADDRESS));
+		bigpage_add(virt_to_page(p));
+		low++;
+		left--;
+	}
+	if (left)
+		printk(KERN_WARNING "bigpages: only room for %lu of %lu\n",
+			bigpages_wanted - left, bigpages_wanted);
+}
+#endif
+
 void __init mem_init(void)
 {
 	int codesize, reservedpages, datasize, initsize;
@@ -570,6 +635,10 @@ void __init mem_init(void)
 	/* clear the zero-page */
 	memset(empty_zero_page, 0, PAGE_SIZE);
 
+#ifdef CONFIG_BIGPAGES
+	reserve_bigpages();
+#endif
+
 	/* this will put all low memory onto the freelists */
 	totalram_pages += free_all_bootmem();
 
@@ -584,6 +653,19 @@ void __init mem_init(void)
 	for (tmp = highstart_pfn; tmp < highend_pfn; tmp++) {
 		struct page *page = mem_map + tmp;
 
+#ifdef CONFIG_BIGPAGES
+		if (bigpages_high && !(tmp & (BIGPAGE_NR - 1)) &&
+		    tmp + BIGPAGE_NR <= highend_pfn && bigpage_is_ram(tmp)) {
+			int i;
+
+			for (i = 0; i < BIGPAGE_NR; i++)
+				set_bit(PG_highmem, &page[i].flags);
+			bigpage_add(page);
+			bigpages_high--;
+			tmp += BIGPAGE_NR - 1;
+			continue;
+		}
+#endif
 		if (!page_is_ram(tmp)) {
 			SetPageReserved(page);
 			continue;
@@ -609,6 +691,11 @@ void __init mem_init(void)
 		initsize >> 10,
 		(unsigned long) (totalhigh_pages << (PAGE_SHIFT-10))
 	       );
+#ifdef CONFIG_BIGPAGES
+	if (nr_bigpages)
+		printk("Memory: %lu big pages of %luk set aside\n",
+			nr_bigpages, BIGPAGE_SIZE >> 10);
+#endif
 
 #if CONFIG_X86_PAE
 	if (!cpu_has_pae)
@@ -0,0 +1,514 @@
+/*
+ *  linux/arch/i386/net/bpf_jit.c
+ *
+ *  Socket filter compiler for i386.
+ *
+ *  A filter which passed sk_chk_filter() is translated into native
+ *  code when it is attached. Anything the compiler does not know
+ *  leaves fp->bpf_func NULL, and the filter runs in sk_run_filter()
+ *  as before.
+ *
+ *  Register use of the generated code:
+ *
+ *	%eax	A
+ *	%ebx	X
+ *	%esi	skb->data
+ *	%edi	skb_headlen(skb)
+ *	%ebp	frame: 8(%ebp) is the skb, mem[] lies just below
+ *		%ebp, and one more word below it receives the
+ *		values of sk_filter_load().
+ *
+ *  Loads inside the linear data are done inline; everything else
+ *  calls sk_filter_load(), which answers as the interpreter would.
+ */
+
+#include <linux/config.h>
+#include <linux/types.h>
+#include <linux/stddef.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/filter.h>
+
+#define MEM_OFF(k)	(-4*BPF_MEMWORDS + 4*(k))	/* mem[k] off %ebp */
+#define TMP_OFF		(-4*BPF_MEMWORDS - 4)		/* sk_filter_load() value */
+#define FRAME_SIZE	(4*BPF_MEMWORDS + 4)
+
+#define MAX_INSN_SIZE	128	/* More than the code of any one instruction */
+
+#define EMIT1(b1)		(*prog++ = (u8)(b1))
+#define EMIT2(b1, b2)		do { EMIT1(b1); EMIT1(b2); } while (0)
+#define EMIT3(b1, b2, b3)	do { EMIT2(b1, b2); EMIT1(b3); } while (0)
+#define EMIT_LONG(x)		do { *(u32 *)prog = (u32)(x); prog += 4; } while (0)
+
+/* Offset in the image of the next byte written */
+#define CUR_OFF			(off + (prog - temp))
+
+/* Near jumps; all of them take a 32 bit displacement, so the size of
+   the code never depends on where a jump goes. */
+#define EMIT_JMP(to)		do { EMIT1(0xe9); EMIT_LONG((to) - (CUR_OFF + 4)); } while (0)
+#define EMIT_JCC(cc, to)	do { EMIT2(0x0f, cc); EMIT_LONG((to) - (CUR_OFF + 4)); } while (0)
+
+/* Short forward jump to a label set later by LABEL() */
+#define EMIT_JSHORT(op, p)	do { EMIT2(op, 0); (p) = prog; } while (0)
+#define LABEL(p)		((p)[-1] = (u8)(prog - (p)))
+
+#define X86_JB		0x82
+#define X86_JAE		0x83
+#define X86_JE		0x84
+#define X86_JNE		0x85
+#define X86_JBE		0x86
+#define X86_JA		0x87
+
+/* Byte order of a word in %eax */
+#ifdef CONFIG_X86_BSWAP
+#define EMIT_SWAB32()	EMIT2(0x0f, 0xc8)		/* bswap %eax */
+#else
+#define EMIT_SWAB32()	do { EMIT2(0x86, 0xe0);		/* xchg %ah,%al */ \
+			     EMIT3(0xc1, 0xc8, 16);	/* ror $16,%eax */ \
+			     EMIT2(0x86, 0xe0); } while (0)
+#endif
+#define EMIT_SWAB16()	EMIT2(0x86, 0xe0)		/* xchg %ah,%al */
+
+/* Leaves the frame, A already in %eax */
+#define EMIT_EPILOGUE()	do { EMIT1(0x5f);		/* pop %edi */ \
+			     EMIT1(0x5e);		/* pop %esi */ \
+			     EMIT1(0x5b);		/* pop %ebx */ \
+			     EMIT1(0xc9);		/* leave */ \
+			     EMIT1(0xc3); } while (0)	/* ret */
+
+/*
+ * Call sk_filter_load(skb, %edx, size, &tmp). Clobbers %eax, %ecx
+ * and %edx; the result is left in %eax.
+ */
+#define EMIT_LOAD_CALL(size) do {					\
+	EMIT3(0x8d, 0x4d, TMP_OFF);	/* lea TMP_OFF(%ebp),%ecx */	\
+	EMIT1(0x51);			/* push %ecx */			\
+	EMIT2(0x6a, size);		/* push $size */		\
+	EMIT1(0x52);			/* push %edx */			\
+	EMIT3(0xff, 0x75, 8);		/* push 8(%ebp) */		\
+	EMIT1(0xe8);			/* call sk_filter_load */	\
+	EMIT_LONG((u32)sk_filter_load - ((u32)image + CUR_OFF + 4));	\
+	EMIT3(0x83, 0xc4, 16);		/* add $16,%esp */		\
+} while (0)
+
+/* A = load of size bytes at k, out of line; the filter returns 0
+   when sk_filter_load() fails. */
+#define EMIT_LOAD_SLOW(size) do {					\
+	EMIT_LOAD_CALL(size);						\
+	EMIT2(0x85, 0xc0);		/* test %eax,%eax */		\
+	EMIT_JCC(X86_JE, ret0);						\
+	EMIT3(0x8b, 0x45, TMP_OFF);	/* mov TMP_OFF(%ebp),%eax */	\
+} while (0)
+
+/* A = load of size bytes at a constant k */
+static u8 *emit_load_abs(u8 *prog, u8 *temp, u8 *image, int off, int ret0,
+			 u32 k, int size)
+{
+	u8 *slow, *done;
+
+	if ((int)k < 0 || k > 0x7fffffff - 4) {
+		EMIT1(0xba);			/* mov $k,%edx */
+		EMIT_LONG(k);
+		EMIT_LOAD_SLOW(size);
+		return prog;
+	}
+
+	EMIT2(0x81, 0xff);			/* cmp $k+size,%edi */
+	EMIT_LONG(k + size);
+	EMIT_JSHORT(0x72, slow);		/* jb slow */
+	switch (size) {
+	case 4:
+		EMIT2(0x8b, 0x86);		/* mov k(%esi),%eax */
+		EMIT_LONG(k);
+		EMIT_SWAB32();
+		break;
+	case 2:
+		EMIT3(0x0f, 0xb7, 0x86);	/* movzwl k(%esi),%eax */
+		EMIT_LONG(k);
+		EMIT_SWAB16();
+		break;
+	default:
+		EMIT3(0x0f, 0xb6, 0x86);	/* movzbl k(%esi),%eax */
+		EMIT_LONG(k);
+	}
+	EMIT_JSHORT(0xeb, done);		/* jmp done */
+	LABEL(slow);
+	EMIT1(0xba);				/* mov $k,%edx */
+	EMIT_LONG(k);
+	EMIT_LOAD_SLOW(size);
+	LABEL(done);
+	return prog;
+}
+
+/* A = load of size bytes at X + k */
+static u8 *emit_load_ind(u8 *prog, u8 *temp, u8 *image, int off, int ret0,
+			 u32 k, int size)
+{
+	u8 *slow1, *slow2, *done;
+
+	EMIT2(0x89, 0xda);			/* mov %ebx,%edx */
+	if (k) {
+		EMIT2(0x81, 0xc2);		/* add $k,%edx */
+		EMIT_LONG(k);
+	}
+	EMIT2(0x85, 0xd2);			/* test %edx,%edx */
+	EMIT_JSHORT(0x78, slow1);		/* js slow */
+	EMIT3(0x8d, 0x4a, size);		/* lea size(%edx),%ecx */
+	EMIT2(0x39, 0xf9);			/* cmp %edi,%ecx */
+	EMIT_JSHORT(0x77, slow2);		/* ja slow */
+	switch (size) {
+	case 4:
+		EMIT3(0x8b, 0x04, 0x16);	/* mov (%esi,%edx),%eax */
+		EMIT_SWAB32();
+		break;
+	case 2:
+		EMIT2(0x0f, 0xb7);		/* movzwl (%esi,%edx),%eax */
+		EMIT2(0x04, 0x16);
+		EMIT_SWAB16();
+		break;
+	default:
+		EMIT2(0x0f, 0xb6);		/* movzbl (%esi,%edx),%eax */
+		EMIT2(0x04, 0x16);
+	}
+	EMIT_JSHORT(0xeb, done);		/* jmp done */
+	LABEL(slow1);
+	LABEL(slow2);
+	EMIT_LOAD_SLOW(size);
+	LABEL(done);
+	return prog;
+}
+
+/* X = (byte at k & 0xf) << 2; A is kept */
+static u8 *emit_load_msh(u8 *prog, u8 *temp, u8 *image, int off, int ret0,
+			 u32 k)
+{
+	u8 *slow, *done;
+
+	if ((int)k < 0) {
+		/* Always beyond the packet for the interpreter */
+		EMIT_JMP(ret0);
+		return prog;
+	}
+
+	EMIT2(0x81, 0xff);			/* cmp $k+1,%edi */
+	EMIT_LONG(k + 1);
+	EMIT_JSHORT(0x72, slow);		/* jb slow */
+	EMIT3(0x0f, 0xb6, 0x9e);		/* movzbl k(%esi),%ebx */
+	EMIT_LONG(k);
+	EMIT_JSHORT(0xeb, done);		/* jmp done */
+	LABEL(slow);
+	EMIT1(0x50);				/* push %eax */
+	EMIT1(0xba);				/* mov $k,%edx */
+	EMIT_LONG(k);
+	EMIT_LOAD_CALL(1);
+	EMIT2(0x89, 0xc1);			/* mov %eax,%ecx */
+	EMIT1(0x58);				/* pop %eax */
+	EMIT2(0x85, 0xc9);			/* test %ecx,%ecx */
+	EMIT_JCC(X86_JE, ret0);
+	EMIT3(0x8b, 0x5d, TMP_OFF);		/* mov TMP_OFF(%ebp),%ebx */
+	LABEL(done);
+	EMIT3(0x83, 0xe3, 0x0f);		/* and $0xf,%ebx */
+	EMIT3(0xc1, 0xe3, 2);			/* shl $2,%ebx */
+	return prog;
+}
+
+static u8 *emit_prologue(u8 *prog)
+{
+	EMIT1(0x55);				/* push %ebp */
+	EMIT2(0x89, 0xe5);			/* mov %esp,%ebp */
+	EMIT3(0x83, 0xec, FRAME_SIZE);		/* sub $FRAME_SIZE,%esp */
+	EMIT1(0x53);				/* push %ebx */
+	EMIT1(0x56);				/* push %esi */
+	EMIT1(0x57);				/* push %edi */
+	EMIT2(0x31, 0xc0);			/* xor %eax,%eax */
+	EMIT2(0x31, 0xdb);			/* xor %ebx,%ebx */
+	EMIT3(0x8b, 0x55, 8);			/* mov 8(%ebp),%edx */
+	EMIT2(0x8b, 0xb2);			/* mov data(%edx),%esi */
+	EMIT_LONG(offsetof(struct sk_buff, data));
+	EMIT2(0x8b, 0xba);			/* mov len(%edx),%edi */
+	EMIT_LONG(offsetof(struct sk_buff, len));
+	EMIT2(0x2b, 0xba);			/* sub data_len(%edx),%edi */
+	EMIT_LONG(offsetof(struct sk_buff, data_len));
+	return prog;
+}
+
+/*
+ * Code for filter instruction pc, at offset off of the image. Returns
+ * the end of the code, or NULL for an instruction we do not compile.
+ * addrs[] holds the offset of every instruction; ret0 and epilogue
+ * the offsets of the two exits.
+ */
+static u8 *emit_insn(u8 *prog, u8 *temp, u8 *image, int off,
+		     struct sock_filter *filter, int pc, int flen,
+		     int *addrs, int ret0, int epilogue)
+{
+	struct sock_filter *f = &filter[pc];
+	u32 k = f->k;
+	int t, e, cc;
+
+	switch (f->code) {
+	case BPF_ALU|BPF_ADD|BPF_X:
+		EMIT2(0x01, 0xd8);		/* add %ebx,%eax */
+		break;
+	case BPF_ALU|BPF_ADD|BPF_K:
+		EMIT1(0x05);			/* add $k,%eax */
+		EMIT_LONG(k);
+		break;
+	case BPF_ALU|BPF_SUB|BPF_X:
+		EMIT2(0x29, 0xd8);		/* sub %ebx,%eax */
+		break;
+	case BPF_ALU|BPF_SUB|BPF_K:
+		EMIT1(0x2d);			/* sub $k,%eax */
+		EMIT_LONG(k);
+		break;
+	case BPF_ALU|BPF_MUL|BPF_X:
+		EMIT3(0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+		break;
+	case BPF_ALU|BPF_MUL|BPF_K:
+		EMIT2(0x69, 0xc0);		/* imul $k,%eax,%eax */
+		EMIT_LONG(k);
+		break;
+	case BPF_ALU|BPF_DIV|BPF_X:
+		EMIT2(0x85, 0xdb);		/* test %ebx,%ebx */
+		EMIT_JCC(X86_JE, ret0);
+		EMIT2(0x31, 0xd2);		/* xor %edx,%edx */
+		EMIT2(0xf7, 0xf3);		/* div %ebx */
+		break;
+	case BPF_ALU|BPF_DIV|BPF_K:
+		if (k == 0) {
+			EMIT_JMP(ret0);
+			break;
+		}
+		EMIT1(0xb9);			/* mov $k,%ecx */
+		EMIT_LONG(k);
+		EMIT2(0x31, 0xd2);		/* xor %edx,%edx */
+		EMIT2(0xf7, 0xf1);		/* div %ecx */
+		break;
+	case BPF_ALU|BPF_AND|BPF_X:
+		EMIT2(0x21, 0xd8);		/* and %ebx,%eax */
+		break;
+	case BPF_ALU|BPF_AND|BPF_K:
+		EMIT1(0x25);			/* and $k,%eax */
+		EMIT_LONG(k);
+		break;
+	case BPF_ALU|BPF_OR|BPF_X:
+		EMIT2(0x09, 0xd8);		/* or %ebx,%eax */
+		break;
+	case BPF_ALU|BPF_OR|BPF_K:
+		EMIT1(0x0d);			/* or $k,%eax */
+		EMIT_LONG(k);
+		break;
+	case BPF_ALU|BPF_LSH|BPF_X:
+		EMIT2(0x89, 0xd9);		/* mov %ebx,%ecx */
+		EMIT2(0xd3, 0xe0);		/* shl %cl,%eax */
+		break;
+	case BPF_ALU|BPF_LSH|BPF_K:
+		EMIT3(0xc1, 0xe0, k);		/* shl $k,%eax */
+		break;
+	case BPF_ALU|BPF_RSH|BPF_X:
+		EMIT2(0x89, 0xd9);		/* mov %ebx,%ecx */
+		EMIT2(0xd3, 0xe8);		/* shr %cl,%eax */
+		break;
+	case BPF_ALU|BPF_RSH|BPF_K:
+		EMIT3(0xc1, 0xe8, k);		/* shr $k,%eax */
+		break;
+	case BPF_ALU|BPF_NEG:
+		EMIT2(0xf7, 0xd8);		/* neg %eax */
+		break;
+
+	case BPF_JMP|BPF_JA:
+		if (k)
+			EMIT_JMP(addrs[pc+1+k]);
+		break;
+	case BPF_JMP|BPF_JGT|BPF_K:
+	case BPF_JMP|BPF_JGE|BPF_K:
+	case BPF_JMP|BPF_JEQ|BPF_K:
+		EMIT1(0x3d);			/* cmp $k,%eax */
+		EMIT_LONG(k);
+		goto cond;
+	case BPF_JMP|BPF_JSET|BPF_K:
+		EMIT1(0xa9);			/* test $k,%eax */
+		EMIT_LONG(k);
+		goto cond;
+	case BPF_JMP|BPF_JGT|BPF_X:
+	case BPF_JMP|BPF_JGE|BPF_X:
+	case BPF_JMP|BPF_JEQ|BPF_X:
+		EMIT2(0x39, 0xd8);		/* cmp %ebx,%eax */
+		goto cond;
+	case BPF_JMP|BPF_JSET|BPF_X:
+		EMIT2(0x85, 0xd8);		/* test %ebx,%eax */
+cond:
+		switch (BPF_OP(f->code)) {
+		case BPF_JGT:
+			cc = X86_JA;
+			break;
+		case BPF_JGE:
+			cc = X86_JAE;
+			break;
+		case BPF_JEQ:
+			cc = X86_JE;
+			break;
+		default:
+			cc = X86_JNE;
+		}
+		t = addrs[pc+1+f->jt];
+		e = addrs[pc+1+f->jf];
+		if (f->jt == f->jf) {
+			if (f->jt)
+				EMIT_JMP(t);
+		} else if (f->jt == 0) {
+			/* The x86 conditions come in pairs, cc^1 is the negation */
+			EMIT_JCC(cc^1, e);
+		} else {
+			EMIT_JCC(cc, t);
+			if (f->jf)
+				EMIT_JMP(e);
+		}
+		break;
+
+	case BPF_LD|BPF_W|BPF_ABS:
+		prog = emit_load_abs(prog, temp, image, off, ret0, k, 4);
+		break;
+	case BPF_LD|BPF_H|BPF_ABS:
+		prog = emit_load_abs(prog, temp, image, off, ret0, k, 2);
+		break;
+	case BPF_LD|BPF_B|BPF_ABS:
+		prog = emit_load_abs(prog, temp, image, off, ret0, k, 1);
+		break;
+	case BPF_LD|BPF_W|BPF_IND:
+		prog = emit_load_ind(prog, temp, image, off, ret0, k, 4);
+		break;
+	case BPF_LD|BPF_H|BPF_IND:
+		prog = emit_load_ind(prog, temp, image, off, ret0, k, 2);
+		break;
+	case BPF_LD|BPF_B|BPF_IND:
+		prog = emit_load_ind(prog, temp, image, off, ret0, k, 1);
+		break;
+	case BPF_LDX|BPF_B|BPF_MSH:
+		prog = emit_load_msh(prog, temp, image, off, ret0, k);
+		break;
+	case BPF_LD|BPF_W|BPF_LEN:
+		EMIT3(0x8b, 0x45, 8);		/* mov 8(%ebp),%eax */
+		EMIT2(0x8b, 0x80);		/* mov len(%eax),%eax */
+		EMIT_LONG(offsetof(struct sk_buff, len));
+		break;
+	case BPF_LDX|BPF_W|BPF_LEN:
+		EMIT3(0x8b, 0x5d, 8);		/* mov 8(%ebp),%ebx */
+		EMIT2(0x8b, 0x9b);		/* mov len(%ebx),%ebx */
+		EMIT_LONG(offsetof(struct sk_buff, len));
+		break;
+	case BPF_LD|BPF_IMM:
+		EMIT1(0xb8);			/* mov $k,%eax */
+		EMIT_LONG(k);
+		break;
+	case BPF_LDX|BPF_IMM:
+		EMIT1(0xbb);			/* mov $k,%ebx */
+		EMIT_LONG(k);
+		break;
+	case BPF_LD|BPF_MEM:
+		EMIT3(0x8b, 0x45, MEM_OFF(k));	/* mov mem[k],%eax */
+		break;
+	case BPF_LDX|BPF_MEM:
+		EMIT3(0x8b, 0x5d, MEM_OFF(k));	/* mov mem[k],%ebx */
+		break;
+	case BPF_ST:
+		EMIT3(0x89, 0x45, MEM_OFF(k));	/* mov %eax,mem[k] */
+		break;
+	case BPF_STX:
+		EMIT3(0x89, 0x5d, MEM_OFF(k));	/* mov %ebx,mem[k] */
+		break;
+	case BPF_MISC|BPF_TAX:
+		EMIT2(0x89, 0xc3);		/* mov %eax,%ebx */
+		break;
+	case BPF_MISC|BPF_TXA:
+		EMIT2(0x89, 0xd8);		/* mov %ebx,%eax */
+		break;
+
+	case BPF_RET|BPF_K:
+		EMIT1(0xb8);			/* mov $k,%eax */
+		EMIT_LONG(k);
+		/* fall through */
+	case BPF_RET|BPF_A:
+		/* The last one falls into the epilogue */
+		if (pc != flen - 1)
+			EMIT_JMP(epilogue);
+		break;
+
+	default:
+		return NULL;
+	}
+	return prog;
+}
+
+/*
+ * Two passes: the first only measures, which fixes the offset of every
+ * instruction, the second writes the code into the image.
+ */
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[MAX_INSN_SIZE];
+	u8 *image = NULL;
+	u8 *prog;
+	int *addrs;
+	int flen = fp->len;
+	int pass, pc, off, len;
+	int ret0 = 0, epilogue = 0;
+
+	addrs = kmalloc((flen + 1) * sizeof(int), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	for (pass = 0; pass < 2; pass++) {
+		prog = emit_prologue(temp);
+		off = prog - temp;
+		if (image)
+			memcpy(image, temp, off);
+
+		for (pc = 0; pc < flen; pc++) {
+			prog = emit_insn(temp, temp, image, off, fp->insns, pc,
+					 flen, addrs, ret0, epilogue);
+			if (prog == NULL)
+				goto out;
+			len = prog - temp;
+			if (image)
+				memcpy(image + off, temp, len);
+			else
+				addrs[pc] = off;
+			off += len;
+		}
+		addrs[flen] = off;
+
+		/* Exits: the epilogue, then "return 0" */
+		epilogue = off;
+		prog = temp;
+		EMIT_EPILOGUE();
+		ret0 = off + (prog - temp);
+		EMIT2(0x31, 0xc0);		/* xor %eax,%eax */
+		EMIT_EPILOGUE();
+		len = prog - temp;
+		if (image) {
+			memcpy(image + off, temp, len);
+			break;
+		}
+
+		/* kmalloc'ed memory is executable on i386 */
+		image = kmalloc(off + len, GFP_KERNEL);
+		if (image == NULL)
+			goto out;
+	}
+
+	fp->bpf_func = (void *)image;
+	image = NULL;
+out:
+	if (image)
+		kfree(image);
+	kfree(addrs);
+}
+
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func)
+		kfree((void *)fp->bpf_func);
+}
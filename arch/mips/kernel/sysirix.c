@@ -634,31 +634,7 @@ asmlinkage int irix_stime(int value)
 
 extern int do_setitimer(int which, struct itimerval *value,
                         struct itimerval *ovalue);
-
-static inline void jiffiestotv(unsigned long jiffies, struct timeval *value)
-{
-	value->tv_usec = (jiffies % HZ) * (1000000 / HZ);
-	value->tv_sec = jiffies / HZ;
-}
-
-static inline void getitimer_real(struct itimerval *value)
-{
-	register unsigned long val, interval;
-
-	interval = current->it_real_incr;
-	val = 0;
-	if (del_timer(&current->real_timer)) {
-		unsigned long now = jiffies;
-		val = current->real_timer.expires;
-		add_timer(&current->real_timer);
-		/* look out for negative/zero itimer.. */
-		if (val <= now)
-			val = now+1;
-		val -= now;
-	}
-	jiffiestotv(val, &value->it_value);
-	jiffiestotv(interval, &value->it_interval);
-}
+extern int do_getitimer(int which, struct itimerval *value);
 
 asmlinkage unsigned int irix_alarm(unsigned int seconds)
 {
@@ -666,8 +642,8 @@ asmlinkage unsigned int irix_alarm(unsigned int seconds)
 	unsigned int oldalarm;
 
 	if (!seconds) {
-		getitimer_real(&it_old);
-		del_timer(&current->real_timer);
+		do_getitimer(ITIMER_REAL, &it_old);
+		del_hrtimer(&current->real_timer);
 	} else {
 		it_new.it_interval.tv_sec = it_new.it_interval.tv_usec = 0;
 		it_new.it_value.tv_sec = seconds;
@@ -57,17 +57,17 @@ dodebug2(abi64_no_regargs, struct pt_regs regs)
 	printk("Got exception 0x%lx at 0x%lx\n", retaddr, regs.cp0_epc);
 }
 
-extern spinlock_t console_lock, timerlist_lock;
+extern spinlock_t console_lock;
 
 /*
  * Unlock any spinlocks which will prevent us from getting the
- * message out (timerlist_lock is aquired through the
+ * message out (the timer locks are aquired through the
  * console unblank code)
  */
 void bust_spinlocks(void)
 {
 	spin_lock_init(&console_lock);
-	spin_lock_init(&timerlist_lock);
+	bust_timer_locks();
 }
 
 /*
@@ -95,7 +95,8 @@ void do_page_fault(struct pt_regs *regs, unsigned long address,
 #endif /* !CONFIG_4xx */
 #endif /* CONFIG_XMON || CONFIG_KGDB */
 
-	if (in_interrupt() || mm == NULL) {
+	if (in_interrupt() || mm == NULL ||
+	    (current->flags & PF_ATOMICCOPY)) {
 		bad_page_fault(regs, address);
 		return;
 	}
@@ -706,6 +706,7 @@ void smp_local_timer_interrupt(struct pt_regs * regs)
 
                 irq_enter(cpu, 0);
                 update_one_process(p, 1, user, system, cpu);
+                raise_softirq(TIMER_SOFTIRQ);
                 if (p->pid) {
                         p->counter -= 1;
                         if (p->counter <= 0) {
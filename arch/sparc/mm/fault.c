@@ -220,8 +220,9 @@ asmlinkage void do_sparc_fault(struct pt_regs *regs, int text_fault, int write,
 	/*
 	 * If we're in an interrupt or have no user
 	 * context, we must not take the fault..
+	 * Neither while copying through an atomic kmap.
 	 */
-        if (in_interrupt() || !mm)
+        if (in_interrupt() || !mm || (tsk->flags & PF_ATOMICCOPY))
                 goto no_context;
 
 	down(&mm->mmap_sem);
@@ -34,12 +34,100 @@
 			     : "r" (__val), "r" (__reg), \
 			       "i" (ASI_PHYS_BYPASS_EC_E))
 
+/* Start flushing the streaming buffer lines of NPAGES pages at VADDR,
+ * mapped with context CTX.  A single page is cheaper to flush by address
+ * than by context, which has to poll the context match register.
+ * Must be invoked under the IOMMU lock.
+ */
+static void __strbuf_flush(struct pci_iommu *iommu, struct pci_strbuf *strbuf,
+			   u32 vaddr, unsigned long ctx, unsigned long npages)
+{
+	if (npages > 1 &&
+	    strbuf->strbuf_ctxflush &&
+	    iommu->iommu_ctxflush) {
+		unsigned long matchreg, flushreg;
+
+		flushreg = strbuf->strbuf_ctxflush;
+		matchreg = PCI_STC_CTXMATCH_ADDR(strbuf, ctx);
+		do {
+			pci_iommu_write(flushreg, ctx);
+		} while(((long)pci_iommu_read(matchreg)) < 0L);
+	} else {
+		unsigned long i;
+
+		for (i = 0; i < npages; i++, vaddr += PAGE_SIZE)
+			pci_iommu_write(strbuf->strbuf_pflush, vaddr);
+	}
+}
+
+/* Perform the flush synchronization sequence: wait until the
+ * flushes started on STRBUF have reached memory.
+ * Must be invoked under the IOMMU lock.
+ */
+static void __strbuf_sync(struct pci_iommu *iommu, struct pci_strbuf *strbuf)
+{
+	PCI_STC_FLUSHFLAG_INIT(strbuf);
+	pci_iommu_write(strbuf->strbuf_fsync, strbuf->strbuf_flushflag_pa);
+	(void) pci_iommu_read(iommu->write_complete_reg);
+	while (!PCI_STC_FLUSHFLAG_SET(strbuf))
+		membar("#LoadLoad");
+}
+
+/* The device only reads through a PCI_DMA_TODEVICE mapping, so when
+ * it is unmapped the streaming buffer holds nothing that must reach
+ * memory.  Its lines only have to be gone before the IOMMU entries are
+ * used again, and that cannot happen before the next __iommu_flushall().
+ * So these flushes are collected and done as a batch, with a single
+ * synchronization per streaming buffer instead of one per unmap.
+ * Must be invoked under the IOMMU lock.
+ */
+static void __strbuf_flush_pending(struct pci_iommu *iommu)
+{
+	struct pci_flush_pending *p;
+	int i, j;
+
+	for (i = 0; i < iommu->flush_npending; i++) {
+		p = &iommu->flush_pending[i];
+		__strbuf_flush(iommu, p->strbuf, p->vaddr, p->ctx, p->npages);
+	}
+	for (i = 0; i < iommu->flush_npending; i++) {
+		p = &iommu->flush_pending[i];
+		for (j = 0; j < i; j++)
+			if (iommu->flush_pending[j].strbuf == p->strbuf)
+				break;
+		if (j == i)
+			__strbuf_sync(iommu, p->strbuf);
+	}
+	iommu->flush_npending = 0;
+}
+
+static void __strbuf_defer_flush(struct pci_iommu *iommu, struct pci_strbuf *strbuf,
+				 u32 vaddr, unsigned long ctx, unsigned long npages)
+{
+	struct pci_flush_pending *p;
+
+	if (iommu->flush_npending == PCI_FLUSH_BATCH)
+		__strbuf_flush_pending(iommu);
+
+	p = &iommu->flush_pending[iommu->flush_npending++];
+	p->strbuf = strbuf;
+	p->vaddr = vaddr;
+	p->npages = npages;
+	p->ctx = ctx;
+}
+
 /* Must be invoked under the IOMMU lock. */
 static void __iommu_flushall(struct pci_iommu *iommu)
 {
 	unsigned long tag;
 	int entry;
 
+	/* Entries about to be reused may still have lines in
+	 * the streaming buffers.
+	 */
+	if (iommu->flush_npending)
+		__strbuf_flush_pending(iommu);
+
 	tag = iommu->iommu_flush + (0xa580UL - 0x0210UL);
 	for (entry = 0; entry < 16; entry++) {
 		pci_iommu_write(tag, 0);
@@ -350,7 +438,7 @@ void pci_unmap_single(struct pci_dev *pdev, dma_addr_t bus_addr, size_t sz, int
 	struct pci_iommu *iommu;
 	struct pci_strbuf *strbuf;
 	iopte_t *base;
-	unsigned long flags, npages, i, ctx;
+	unsigned long flags, npages, ctx;
 
 	if (direction == PCI_DMA_NONE)
 		BUG();
@@ -378,27 +466,12 @@ void pci_unmap_single(struct pci_dev *pdev, dma_addr_t bus_addr, size_t sz, int
 
 	/* Step 1: Kick data out of streaming buffers if necessary. */
 	if (strbuf->strbuf_enabled) {
-		u32 vaddr = bus_addr;
-
-		PCI_STC_FLUSHFLAG_INIT(strbuf);
-		if (strbuf->strbuf_ctxflush &&
-		    iommu->iommu_ctxflush) {
-			unsigned long matchreg, flushreg;
-
-			flushreg = strbuf->strbuf_ctxflush;
-			matchreg = PCI_STC_CTXMATCH_ADDR(strbuf, ctx);
-			do {
-				pci_iommu_write(flushreg, ctx);
-			} while(((long)pci_iommu_read(matchreg)) < 0L);
+		if (direction == PCI_DMA_TODEVICE) {
+			__strbuf_defer_flush(iommu, strbuf, bus_addr, ctx, npages);
 		} else {
-			for (i = 0; i < npages; i++, vaddr += PAGE_SIZE)
-				pci_iommu_write(strbuf->strbuf_pflush, vaddr);
+			__strbuf_flush(iommu, strbuf, bus_addr, ctx, npages);
+			__strbuf_sync(iommu, strbuf);
 		}
-
-		pci_iommu_write(strbuf->strbuf_fsync, strbuf->strbuf_flushflag_pa);
-		(void) pci_iommu_read(iommu->write_complete_reg);
-		while (!PCI_STC_FLUSHFLAG_SET(strbuf))
-			membar("#LoadLoad");
 	}
 
 	/* Step 2: Clear out first TSB entry. */
@@ -596,27 +669,12 @@ void pci_unmap_sg(struct pci_dev *pdev, struct scatterlist *sglist, int nelems,
 
 	/* Step 1: Kick data out of streaming buffers if necessary. */
 	if (strbuf->strbuf_enabled) {
-		u32 vaddr = bus_addr;
-
-		PCI_STC_FLUSHFLAG_INIT(strbuf);
-		if (strbuf->strbuf_ctxflush &&
-		    iommu->iommu_ctxflush) {
-			unsigned long matchreg, flushreg;
-
-			flushreg = strbuf->strbuf_ctxflush;
-			matchreg = PCI_STC_CTXMATCH_ADDR(strbuf, ctx);
-			do {
-				pci_iommu_write(flushreg, ctx);
-			} while(((long)pci_iommu_read(matchreg)) < 0L);
+		if (direction == PCI_DMA_TODEVICE) {
+			__strbuf_defer_flush(iommu, strbuf, bus_addr, ctx, npages);
 		} else {
-			for (i = 0; i < npages; i++, vaddr += PAGE_SIZE)
-				pci_iommu_write(strbuf->strbuf_pflush, vaddr);
+			__strbuf_flush(iommu, strbuf, bus_addr, ctx, npages);
+			__strbuf_sync(iommu, strbuf);
 		}
-
-		pci_iommu_write(strbuf->strbuf_fsync, strbuf->strbuf_flushflag_pa);
-		(void) pci_iommu_read(iommu->write_complete_reg);
-		while (!PCI_STC_FLUSHFLAG_SET(strbuf))
-			membar("#LoadLoad");
 	}
 
 	/* Step 2: Clear out first TSB entry. */
@@ -663,28 +721,10 @@ void pci_dma_sync_single(struct pci_dev *pdev, dma_addr_t bus_addr, size_t sz, i
 	}
 
 	/* Step 2: Kick data out of streaming buffers. */
-	PCI_STC_FLUSHFLAG_INIT(strbuf);
-	if (iommu->iommu_ctxflush &&
-	    strbuf->strbuf_ctxflush) {
-		unsigned long matchreg, flushreg;
-
-		flushreg = strbuf->strbuf_ctxflush;
-		matchreg = PCI_STC_CTXMATCH_ADDR(strbuf, ctx);
-		do {
-			pci_iommu_write(flushreg, ctx);
-		} while(((long)pci_iommu_read(matchreg)) < 0L);
-	} else {
-		unsigned long i;
-
-		for (i = 0; i < npages; i++, bus_addr += PAGE_SIZE)
-			pci_iommu_write(strbuf->strbuf_pflush, bus_addr);
-	}
+	__strbuf_flush(iommu, strbuf, bus_addr, ctx, npages);
 
 	/* Step 3: Perform flush synchronization sequence. */
-	pci_iommu_write(strbuf->strbuf_fsync, strbuf->strbuf_flushflag_pa);
-	(void) pci_iommu_read(iommu->write_complete_reg);
-	while (!PCI_STC_FLUSHFLAG_SET(strbuf))
-		membar("#LoadLoad");
+	__strbuf_sync(iommu, strbuf);
 
 	spin_unlock_irqrestore(&iommu->lock, flags);
 }
@@ -697,7 +737,8 @@ void pci_dma_sync_sg(struct pci_dev *pdev, struct scatterlist *sglist, int nelem
 	struct pcidev_cookie *pcp;
 	struct pci_iommu *iommu;
 	struct pci_strbuf *strbuf;
-	unsigned long flags, ctx;
+	unsigned long flags, ctx, i, npages;
+	u32 bus_addr;
 
 	pcp = pdev->sysdata;
 	iommu = &pcp->pbm->parent->iommu;
@@ -720,36 +761,16 @@ void pci_dma_sync_sg(struct pci_dev *pdev, struct scatterlist *sglist, int nelem
 	}
 
 	/* Step 2: Kick data out of streaming buffers. */
-	PCI_STC_FLUSHFLAG_INIT(strbuf);
-	if (iommu->iommu_ctxflush &&
-	    strbuf->strbuf_ctxflush) {
-		unsigned long matchreg, flushreg;
-
-		flushreg = strbuf->strbuf_ctxflush;
-		matchreg = PCI_STC_CTXMATCH_ADDR(strbuf, ctx);
-		do {
-			pci_iommu_write(flushreg, ctx);
-		} while (((long)pci_iommu_read(matchreg)) < 0L);
-	} else {
-		unsigned long i, npages;
-		u32 bus_addr;
-
-		bus_addr = sglist[0].dvma_address & PAGE_MASK;
-
-		for(i = 1; i < nelems; i++)
-			if (!sglist[i].dvma_length)
-				break;
-		i--;
-		npages = (PAGE_ALIGN(sglist[i].dvma_address + sglist[i].dvma_length) - bus_addr) >> PAGE_SHIFT;
-		for (i = 0; i < npages; i++, bus_addr += PAGE_SIZE)
-			pci_iommu_write(strbuf->strbuf_pflush, bus_addr);
-	}
+	bus_addr = sglist[0].dvma_address & PAGE_MASK;
+	for (i = 1; i < nelems; i++)
+		if (!sglist[i].dvma_length)
+			break;
+	i--;
+	npages = (PAGE_ALIGN(sglist[i].dvma_address + sglist[i].dvma_length) - bus_addr) >> PAGE_SHIFT;
+	__strbuf_flush(iommu, strbuf, bus_addr, ctx, npages);
 
 	/* Step 3: Perform flush synchronization sequence. */
-	pci_iommu_write(strbuf->strbuf_fsync, strbuf->strbuf_flushflag_pa);
-	(void) pci_iommu_read(iommu->write_complete_reg);
-	while (!PCI_STC_FLUSHFLAG_SET(strbuf))
-		membar("#LoadLoad");
+	__strbuf_sync(iommu, strbuf);
 
 	spin_unlock_irqrestore(&iommu->lock, flags);
 }
@@ -300,9 +300,9 @@ static inline void DAC960_DeallocateCommand(DAC960_Command_T *Command)
 
 static void DAC960_WaitForCommand(DAC960_Controller_T *Controller)
 {
-  spin_unlock_irq(&io_request_lock);
+  spin_unlock_irq(&Controller->RequestQueueLock);
   __wait_event(Controller->CommandWaitQueue, Controller->FreeCommands);
-  spin_lock_irq(&io_request_lock);
+  spin_lock_irq(&Controller->RequestQueueLock);
 }
 
 
@@ -1907,6 +1907,8 @@ static boolean DAC960_RegisterBlockDevice(DAC960_Controller_T *Controller)
   RequestQueue = BLK_DEFAULT_QUEUE(MajorNumber);
   blk_init_queue(RequestQueue, DAC960_RequestFunction);
   blk_queue_headactive(RequestQueue, 0);
+  blk_queue_lock(RequestQueue, &Controller->RequestQueueLock);
+  blk_queue_depth(RequestQueue, Controller->DriverQueueDepth);
   RequestQueue->back_merge_fn = DAC960_BackMergeFunction;
   RequestQueue->front_merge_fn = DAC960_FrontMergeFunction;
   RequestQueue->merge_requests_fn = DAC960_MergeRequestsFunction;
@@ -2190,6 +2192,7 @@ static void DAC960_DetectControllers(DAC960_HardwareType_T HardwareType)
 	}
       memset(Controller, 0, sizeof(DAC960_Controller_T));
       Controller->ControllerNumber = DAC960_ControllerCount;
+      spin_lock_init(&Controller->RequestQueueLock);
       init_waitqueue_head(&Controller->CommandWaitQueue);
       init_waitqueue_head(&Controller->HealthStatusWaitQueue);
       DAC960_Controllers[DAC960_ControllerCount++] = Controller;
@@ -2784,6 +2787,7 @@ static boolean DAC960_ProcessRequest(DAC960_Controller_T *Controller,
   Command->BufferHeader = Request->bh;
   Command->RequestBuffer = Request->buffer;
   blkdev_dequeue_request(Request);
+  req_finished_io(Request);
   blkdev_release_request(Request);
   DAC960_QueueReadWriteCommand(Command);
   return true;
@@ -4475,6 +4479,7 @@ static void DAC960_BA_InterruptHandler(int IRQ_Channel,
   /*
     Process Hardware Interrupts for Controller.
   */
+  Controller->InterruptCount++;
   DAC960_BA_AcknowledgeInterrupt(ControllerBaseAddress);
   NextStatusMailbox = Controller->V2.NextStatusMailbox;
   while (NextStatusMailbox->Fields.CommandIdentifier > 0)
@@ -4490,6 +4495,7 @@ static void DAC960_BA_InterruptHandler(int IRQ_Channel,
       NextStatusMailbox->Words[0] = 0;
       if (++NextStatusMailbox > Controller->V2.LastStatusMailbox)
 	NextStatusMailbox = Controller->V2.FirstStatusMailbox;
+      Controller->CompletionCount++;
       DAC960_V2_ProcessCompletedCommand(Command);
     }
   Controller->V2.NextStatusMailbox = NextStatusMailbox;
@@ -4525,6 +4531,7 @@ static void DAC960_LP_InterruptHandler(int IRQ_Channel,
   /*
     Process Hardware Interrupts for Controller.
   */
+  Controller->InterruptCount++;
   DAC960_LP_AcknowledgeInterrupt(ControllerBaseAddress);
   NextStatusMailbox = Controller->V2.NextStatusMailbox;
   while (NextStatusMailbox->Fields.CommandIdentifier > 0)
@@ -4540,6 +4547,7 @@ static void DAC960_LP_InterruptHandler(int IRQ_Channel,
       NextStatusMailbox->Words[0] = 0;
       if (++NextStatusMailbox > Controller->V2.LastStatusMailbox)
 	NextStatusMailbox = Controller->V2.FirstStatusMailbox;
+      Controller->CompletionCount++;
       DAC960_V2_ProcessCompletedCommand(Command);
     }
   Controller->V2.NextStatusMailbox = NextStatusMailbox;
@@ -4575,6 +4583,7 @@ static void DAC960_LA_InterruptHandler(int IRQ_Channel,
   /*
     Process Hardware Interrupts for Controller.
   */
+  Controller->InterruptCount++;
   DAC960_LA_AcknowledgeInterrupt(ControllerBaseAddress);
   NextStatusMailbox = Controller->V1.NextStatusMailbox;
   while (NextStatusMailbox->Fields.Valid)
@@ -4586,6 +4595,7 @@ static void DAC960_LA_InterruptHandler(int IRQ_Channel,
       NextStatusMailbox->Word = 0;
       if (++NextStatusMailbox > Controller->V1.LastStatusMailbox)
 	NextStatusMailbox = Controller->V1.FirstStatusMailbox;
+      Controller->CompletionCount++;
       DAC960_V1_ProcessCompletedCommand(Command);
     }
   Controller->V1.NextStatusMailbox = NextStatusMailbox;
@@ -4621,6 +4631,7 @@ static void DAC960_PG_InterruptHandler(int IRQ_Channel,
   /*
     Process Hardware Interrupts for Controller.
   */
+  Controller->InterruptCount++;
   DAC960_PG_AcknowledgeInterrupt(ControllerBaseAddress);
   NextStatusMailbox = Controller->V1.NextStatusMailbox;
   while (NextStatusMailbox->Fields.Valid)
@@ -4632,6 +4643,7 @@ static void DAC960_PG_InterruptHandler(int IRQ_Channel,
       NextStatusMailbox->Word = 0;
       if (++NextStatusMailbox > Controller->V1.LastStatusMailbox)
 	NextStatusMailbox = Controller->V1.FirstStatusMailbox;
+      Controller->CompletionCount++;
       DAC960_V1_ProcessCompletedCommand(Command);
     }
   Controller->V1.NextStatusMailbox = NextStatusMailbox;
@@ -4666,6 +4678,7 @@ static void DAC960_PD_InterruptHandler(int IRQ_Channel,
   /*
     Process Hardware Interrupts for Controller.
   */
+  Controller->InterruptCount++;
   while (DAC960_PD_StatusAvailableP(ControllerBaseAddress))
     {
       DAC960_V1_CommandIdentifier_T CommandIdentifier =
@@ -4675,6 +4688,7 @@ static void DAC960_PD_InterruptHandler(int IRQ_Channel,
 	DAC960_PD_ReadStatusRegister(ControllerBaseAddress);
       DAC960_PD_AcknowledgeInterrupt(ControllerBaseAddress);
       DAC960_PD_AcknowledgeStatus(ControllerBaseAddress);
+      Controller->CompletionCount++;
       DAC960_V1_ProcessCompletedCommand(Command);
     }
   /*
@@ -6365,6 +6379,33 @@ static int DAC960_ProcReadCurrentStatus(char *Page, char **Start, off_t Offset,
 }
 
 
+/*
+  DAC960_ProcReadInterrupts implements reading /proc/rd/cN/interrupts.
+  Every interrupt completes all the Commands the Controller has posted
+  by then, so the ratio shows how well completions are being batched.
+*/
+
+static int DAC960_ProcReadInterrupts(char *Page, char **Start, off_t Offset,
+				     int Count, int *EOF, void *Data)
+{
+  DAC960_Controller_T *Controller = (DAC960_Controller_T *) Data;
+  unsigned long Interrupts = Controller->InterruptCount;
+  unsigned long Completions = Controller->CompletionCount;
+  int Length;
+  Length = sprintf(Page, "Interrupts: %lu\nCommands Completed: %lu\n"
+		   "Commands per Interrupt: %lu.%02lu\n",
+		   Interrupts, Completions,
+		   Interrupts ? Completions / Interrupts : 0,
+		   Interrupts ? (Completions % Interrupts) * 100 / Interrupts : 0);
+  if (Length <= Offset + Count) *EOF = true;
+  *Start = Page + Offset;
+  Length -= Offset;
+  if (Length > Count) Length = Count;
+  if (Length < 0) Length = 0;
+  return Length;
+}
+
+
 /*
   DAC960_ProcReadUserCommand implements reading /proc/rd/cN/user_command.
 */
@@ -6439,6 +6480,8 @@ static void DAC960_CreateProcEntries(void)
 			     DAC960_ProcReadInitialStatus, Controller);
       create_proc_read_entry("current_status", 0, ControllerProcEntry,
 			     DAC960_ProcReadCurrentStatus, Controller);
+      create_proc_read_entry("interrupts", 0, ControllerProcEntry,
+			     DAC960_ProcReadInterrupts, Controller);
       UserCommandProcEntry =
 	create_proc_read_entry("user_command", S_IWUSR | S_IRUSR,
 			       ControllerProcEntry, DAC960_ProcReadUserCommand,
@@ -6465,6 +6508,7 @@ static void DAC960_DestroyProcEntries(void)
       if (Controller == NULL) continue;
       remove_proc_entry("initial_status", Controller->ControllerProcEntry);
       remove_proc_entry("current_status", Controller->ControllerProcEntry);
+      remove_proc_entry("interrupts", Controller->ControllerProcEntry);
       remove_proc_entry("user_command", Controller->ControllerProcEntry);
       remove_proc_entry(Controller->ControllerName, DAC960_ProcDirectoryEntry);
     }
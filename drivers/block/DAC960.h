@@ -2146,6 +2146,7 @@ typedef struct pt_regs Registers_T;
 typedef struct request IO_Request_T;
 typedef request_queue_t RequestQueue_T;
 typedef struct semaphore Semaphore_T;
+typedef spinlock_t Spinlock_T;
 typedef struct super_block SuperBlock_T;
 typedef struct timer_list Timer_T;
 typedef wait_queue_head_t WaitQueue_T;
@@ -2291,6 +2292,8 @@ typedef struct DAC960_Controller
   unsigned long SecondaryMonitoringTime;
   unsigned long LastProgressReportTime;
   unsigned long LastCurrentStatusTime;
+  unsigned long InterruptCount;
+  unsigned long CompletionCount;
   boolean ControllerDetectionSuccessful;
   boolean ControllerInitialized;
   boolean MonitoringCommandDeferred;
@@ -2304,6 +2307,7 @@ typedef struct DAC960_Controller
   unsigned char *CombinedStatusBuffer;
   unsigned char *CurrentStatusBuffer;
   RequestQueue_T *RequestQueue;
+  Spinlock_T RequestQueueLock;
   WaitQueue_T CommandWaitQueue;
   WaitQueue_T HealthStatusWaitQueue;
   DAC960_Command_T InitialCommand;
@@ -2436,7 +2440,7 @@ static inline
 void DAC960_AcquireControllerLock(DAC960_Controller_T *Controller,
 				  ProcessorFlags_T *ProcessorFlags)
 {
-  spin_lock_irqsave(&io_request_lock, *ProcessorFlags);
+  spin_lock_irqsave(&Controller->RequestQueueLock, *ProcessorFlags);
 }
 
 
@@ -2448,13 +2452,14 @@ static inline
 void DAC960_ReleaseControllerLock(DAC960_Controller_T *Controller,
 				  ProcessorFlags_T *ProcessorFlags)
 {
-  spin_unlock_irqrestore(&io_request_lock, *ProcessorFlags);
+  spin_unlock_irqrestore(&Controller->RequestQueueLock, *ProcessorFlags);
 }
 
 
 /*
   DAC960_AcquireControllerLockRF acquires exclusive access to Controller,
-  but is only called from the request function with the io_request_lock held.
+  but is only called from the request function with the Request Queue Lock
+  held.
 */
 
 static inline
@@ -2466,7 +2471,8 @@ void DAC960_AcquireControllerLockRF(DAC960_Controller_T *Controller,
 
 /*
   DAC960_ReleaseControllerLockRF releases exclusive access to Controller,
-  but is only called from the request function with the io_request_lock held.
+  but is only called from the request function with the Request Queue Lock
+  held.
 */
 
 static inline
@@ -2485,7 +2491,7 @@ static inline
 void DAC960_AcquireControllerLockIH(DAC960_Controller_T *Controller,
 				    ProcessorFlags_T *ProcessorFlags)
 {
-  spin_lock_irqsave(&io_request_lock, *ProcessorFlags);
+  spin_lock_irqsave(&Controller->RequestQueueLock, *ProcessorFlags);
 }
 
 
@@ -2498,7 +2504,7 @@ static inline
 void DAC960_ReleaseControllerLockIH(DAC960_Controller_T *Controller,
 				    ProcessorFlags_T *ProcessorFlags)
 {
-  spin_unlock_irqrestore(&io_request_lock, *ProcessorFlags);
+  spin_unlock_irqrestore(&Controller->RequestQueueLock, *ProcessorFlags);
 }
 
 
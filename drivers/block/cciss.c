@@ -36,6 +36,7 @@
 #include <linux/init.h> 
 #include <linux/hdreg.h>
 #include <linux/spinlock.h>
+#include <linux/highmem.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 
@@ -57,6 +58,38 @@ MODULE_DESCRIPTION("Driver for Compaq Smart Array Controller 5300");
 
 #define NR_PRODUCTS (sizeof(products)/sizeof(struct board_type))
 
+/*
+ * Interrupt coalescing: the controller holds back the completion
+ * interrupt for up to coalesce_delay microseconds, or until
+ * coalesce_count commands have completed.  -1 leaves the firmware
+ * defaults alone.
+ */
+static int coalesce_delay = -1;
+static int coalesce_count = -1;
+MODULE_PARM(coalesce_delay, "i");
+MODULE_PARM_DESC(coalesce_delay, "interrupt coalescing delay in usecs");
+MODULE_PARM(coalesce_count, "i");
+MODULE_PARM_DESC(coalesce_count, "commands completed per coalesced interrupt");
+
+#ifndef MODULE
+/*
+ * cciss_coalesce=delay,count
+ */
+static int __init cciss_coalesce_setup(char *str)
+{
+	int ints[3];
+
+	(void)get_options(str, ARRAY_SIZE(ints), ints);
+	if (ints[0] > 0)
+		coalesce_delay = ints[1];
+	if (ints[0] > 1)
+		coalesce_count = ints[2];
+	return 1;
+}
+
+__setup("cciss_coalesce=", cciss_coalesce_setup);
+#endif
+
 /*  board_id = Subsystem Device ID & Vendor ID
  *  product = Marketing Name for the board
  *  access = Address of the struct of function pointers 
@@ -148,7 +181,9 @@ static int cciss_proc_get_info(char *buffer, char **start, off_t offset,
 		"       Current # commands on controller %d\n"
                 "       Max Q depth since init: %d\n"
 		"       Max # commands on controller since init: %d\n"
-		"       Max SG entries since init: %d\n\n",
+		"       Max SG entries since init: %d\n"
+		"       Interrupts: %u, commands completed: %u (%u.%02u per interrupt)\n"
+		"       Interrupt coalescing: %u usecs, %u commands\n\n",
                 h->devname,
                 h->product_name,
                 (unsigned long)h->board_id,
@@ -157,7 +192,12 @@ static int cciss_proc_get_info(char *buffer, char **start, off_t offset,
                 (unsigned int)h->intr,
                 h->num_luns, 
                 h->Qdepth, h->commands_outstanding,
-		h->maxQsinceinit, h->max_outstanding, h->maxSG);
+		h->maxQsinceinit, h->max_outstanding, h->maxSG,
+		h->nr_intrs, h->nr_completions,
+		h->nr_intrs ? h->nr_completions / h->nr_intrs : 0,
+		h->nr_intrs ? (h->nr_completions % h->nr_intrs) * 100 / h->nr_intrs : 0,
+		readl(&h->cfgtable->HostWrite.CoalIntDelay),
+		readl(&h->cfgtable->HostWrite.CoalIntCount));
 
         pos += size; len += size;
 	for(i=0; i<h->num_luns; i++) {
@@ -440,14 +480,14 @@ static int cciss_ioctl(struct inode *inode, struct file *filep,
 //			printk("cciss_ioctl: delay and count cannot be 0\n");
 			return( -EINVAL);
 		}
-		spin_lock_irqsave(&io_request_lock, flags);
+		spin_lock_irqsave(CCISS_LOCK(ctlr), flags);
 		/* Can only safely update if no commands outstanding */ 
 		if (c->commands_outstanding > 0 )
 		{
 //			printk("cciss_ioctl: cannot change coalasing "
 //				"%d commands outstanding on controller\n", 
 //					c->commands_outstanding);
-			spin_unlock_irqrestore(&io_request_lock, flags);
+			spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
 			return(-EINVAL);
 		}
 		/* Update the field, and then ring the doorbell */ 
@@ -465,7 +505,7 @@ static int cciss_ioctl(struct inode *inode, struct file *filep,
 			/* delay and try again */
 			udelay(1000);
 		}	
-		spin_unlock_irqrestore(&io_request_lock, flags);
+		spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
 		if (i >= MAX_CONFIG_WAIT)
 			return( -EFAULT);
                 return(0);
@@ -496,7 +536,7 @@ static int cciss_ioctl(struct inode *inode, struct file *filep,
 		if (copy_from_user(NodeName, (void *) arg, sizeof( NodeName_type)))
 			return -EFAULT;
 
-		spin_lock_irqsave(&io_request_lock, flags);
+		spin_lock_irqsave(CCISS_LOCK(ctlr), flags);
 
 			/* Update the field, and then ring the doorbell */ 
 		for(i=0;i<16;i++)
@@ -512,7 +552,7 @@ static int cciss_ioctl(struct inode *inode, struct file *filep,
 			/* delay and try again */
 			udelay(1000);
 		}	
-		spin_unlock_irqrestore(&io_request_lock, flags);
+		spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
 		if (i >= MAX_CONFIG_WAIT)
 			return( -EFAULT);
                 return(0);
@@ -635,11 +675,11 @@ static int cciss_ioctl(struct inode *inode, struct file *filep,
 			c->SG[0].Ext = 0;  // we are not chaining
 		}
 		/* Put the request on the tail of the request queue */
-		spin_lock_irqsave(&io_request_lock, flags);
+		spin_lock_irqsave(CCISS_LOCK(ctlr), flags);
 		addQ(&h->reqQ, c);
 		h->Qdepth++;
 		start_io(h);
-		spin_unlock_irqrestore(&io_request_lock, flags);
+		spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
 
 		/* Wait for completion */
 		while(c->cmd_type != CMD_IOCTL_DONE)
@@ -690,16 +730,16 @@ static int revalidate_logvol(kdev_t dev, int maxusage)
         ctlr = MAJOR(dev) - MAJOR_NR;
         gdev = &(hba[ctlr]->gendisk);
 
-        spin_lock_irqsave(&io_request_lock, flags);
+        spin_lock_irqsave(CCISS_LOCK(ctlr), flags);
         if (hba[ctlr]->drv[target].usage_count > maxusage) {
-                spin_unlock_irqrestore(&io_request_lock, flags);
+                spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
                 printk(KERN_WARNING "cpqarray: Device busy for "
                         "revalidation (usage=%d)\n",
                         hba[ctlr]->drv[target].usage_count);
                 return -EBUSY;
         }
         hba[ctlr]->drv[target].usage_count++;
-        spin_unlock_irqrestore(&io_request_lock, flags);
+        spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
 
         max_p = gdev->max_p;
         start = target << gdev->minor_shift;
@@ -752,14 +792,14 @@ static int revalidate_allvol(kdev_t dev)
         if (MINOR(dev) != 0)
                 return -ENXIO;
 
-        spin_lock_irqsave(&io_request_lock, flags);
+        spin_lock_irqsave(CCISS_LOCK(ctlr), flags);
         if (hba[ctlr]->usage_count > 1) {
-                spin_unlock_irqrestore(&io_request_lock, flags);
+                spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
                 printk(KERN_WARNING "cciss: Device busy for volume"
                         " revalidation (usage=%d)\n", hba[ctlr]->usage_count);
                 return -EBUSY;
         }
-        spin_unlock_irqrestore(&io_request_lock, flags);
+        spin_unlock_irqrestore(CCISS_LOCK(ctlr), flags);
         hba[ctlr]->usage_count++;
 
         /*
@@ -1175,23 +1215,23 @@ static inline void complete_command( CommandList_struct *cmd, int timeout)
 	complete_buffers(cmd->bh, status);
 }
 /* 
- * Get a request and submit it to the controller. 
- * Currently we do one request at a time.  Ideally we would like to send
- * everything to the controller on the first call, but there is a danger
- * of holding the io_request_lock for to long.  
+ * Get requests and submit them to the controller.  Commands are built
+ * for as many requests as we have free command blocks, and then all
+ * sent down by a single start_io().  The command pool bounds how long
+ * we hold the controller lock.
  */
 static void do_cciss_request(int ctlr)
 {
 	ctlr_info_t *h= hba[ctlr];
 	CommandList_struct *c;
 	int log_unit, start_blk, seg, sect;
-	char *lastdataend;
-	struct buffer_head *bh;
+	struct buffer_head *bh, *lastbh;
 	struct list_head *queue_head;
 	struct request *creq;
 	u64bit temp64;
 
 	queue_head = &blk_dev[MAJOR_NR+ctlr].request_queue.queue_head;	
+queue_next:
 	if (list_empty(queue_head))
 	{
 		/* nothing to do... */
@@ -1245,7 +1285,7 @@ static void do_cciss_request(int ctlr)
 		(int) creq->nr_sectors);	
 #endif /* CCISS_DEBUG */
 	seg = 0; 
-	lastdataend = NULL;
+	lastbh = NULL;
 	sect = 0;
 	while(bh)
 	{
@@ -1256,18 +1296,27 @@ static void do_cciss_request(int ctlr)
 				(int) creq->sector, sect, (int) bh->b_size);
 			panic("b_size 512 != 0\n");
 		}
-		if (bh->b_data == lastdataend)
+		if (lastbh && bh_contig(lastbh, bh))
 		{  // tack it on to the last segment 
 			c->SG[seg-1].Len +=bh->b_size;
-			lastdataend += bh->b_size;
+			lastbh = bh;
 		} else
 		{
 			c->SG[seg].Len = bh->b_size;
-			temp64.val = (__u64) virt_to_bus(bh->b_data);
+#ifdef CONFIG_HIGHMEM
+			/* only with the bounce limit raised, see cciss_init() */
+			if (PageHighMem(bh->b_page))
+				temp64.val = pci_dac_page_to_dma(h->pdev,
+					bh->b_page, bh_offset(bh),
+					(creq->cmd == READ) ?
+					PCI_DMA_FROMDEVICE : PCI_DMA_TODEVICE);
+			else
+#endif
+				temp64.val = (__u64) virt_to_bus(bh->b_data);
 			c->SG[seg].Addr.lower = temp64.val32.lower;
 			c->SG[seg].Addr.upper = temp64.val32.upper;
 			c->SG[0].Ext = 0;  // we are not chaining
-			lastdataend = bh->b_data + bh->b_size;
+			lastbh = bh;
 			if( ++seg == MAXSGENTRIES)
 			{
 				break; 
@@ -1323,7 +1372,7 @@ static void do_cciss_request(int ctlr)
 	h->Qdepth++;
 	if(h->Qdepth > h->maxQsinceinit)
 		h->maxQsinceinit = h->Qdepth; 
-	start_io(h);
+	goto queue_next;
 }
 
 static void do_cciss_intr(int irq, void *dev_id, struct pt_regs *regs)
@@ -1337,12 +1386,13 @@ static void do_cciss_intr(int irq, void *dev_id, struct pt_regs *regs)
 	/* Is this interrupt for us? */
 	if ( h->access.intr_pending(h) == 0)
 		return;
+	h->nr_intrs++;
 
 	/*
 	 * If there are completed commands in the completion queue,
 	 * we had better do something about it.
 	 */
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(CCISS_LOCK(h->ctlr), flags);
 	while( h->access.intr_pending(h))
 	{
 		while((a = h->access.command_completed(h)) != FIFO_EMPTY) 
@@ -1365,6 +1415,7 @@ static void do_cciss_intr(int irq, void *dev_id, struct pt_regs *regs)
 			 */
 			 if (c->busaddr == a) {
 				removeQ(&h->cmpQ, c);
+				h->nr_completions++;
 				if (c->cmd_type == CMD_RWREQ) {
 					complete_command(c, 0);
 					cmd_free(h, c);
@@ -1379,7 +1430,7 @@ static void do_cciss_intr(int irq, void *dev_id, struct pt_regs *regs)
 	 * See if we can queue up some more IO
 	 */
 	do_cciss_request(h->ctlr);
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(CCISS_LOCK(h->ctlr), flags);
 }
 /* 
  *  We cannot read the structure directly, for portablity we must use 
@@ -1467,6 +1518,7 @@ static int cciss_pci_init(ctlr_info_t *c, unchar bus, unchar device_fn)
 #endif /* CCISS_DEBUG */ 
 
 	c->intr = irq;
+	c->pdev = pdev;
 
 	/*
 	 * Memory base addr is first addr , the second points to the config
@@ -1501,6 +1553,11 @@ static int cciss_pci_init(ctlr_info_t *c, unchar bus, unchar device_fn)
 	/* Update the field, and then ring the doorbell */ 
 	writel( CFGTBL_Trans_Simple, 
 		&(c->cfgtable->HostWrite.TransportRequest));
+	/* Coalescing rides along on the same change request */
+	if (coalesce_delay >= 0)
+		writel(coalesce_delay, &(c->cfgtable->HostWrite.CoalIntDelay));
+	if (coalesce_count >= 0)
+		writel(coalesce_count, &(c->cfgtable->HostWrite.CoalIntCount));
 	writel( CFGTBL_ChangeReq, c->vaddr + SA5_DOORBELL);
 
 	for(i=0;i<MAX_CONFIG_WAIT;i++)
@@ -1556,6 +1613,7 @@ static int cciss_pci_detect(void)
 				continue;
 			}
 			memset(hba[nr_ctlr], 0, sizeof(ctlr_info_t));
+			spin_lock_init(&hba[nr_ctlr]->lock);
 			if (cciss_pci_init(hba[nr_ctlr], bus, dev_fn) != 0)
 			{
 				kfree(hba[nr_ctlr]);
@@ -1837,6 +1895,14 @@ int __init cciss_init(void)
 		blk_init_queue(BLK_DEFAULT_QUEUE(MAJOR_NR+i),
 				request_fns[i]);
 		blk_queue_headactive(BLK_DEFAULT_QUEUE(MAJOR_NR+i), 0);
+		blk_queue_lock(BLK_DEFAULT_QUEUE(MAJOR_NR+i), CCISS_LOCK(i));
+		blk_queue_depth(BLK_DEFAULT_QUEUE(MAJOR_NR+i), NR_CMDS);
+#ifdef CONFIG_HIGHMEM
+		/* The SG entries take 64 bit addresses: no bouncing */
+		if (pci_dac_dma_supported(hba[i]->pdev, 0xffffffffffffffffULL))
+			blk_queue_bounce_limit(BLK_DEFAULT_QUEUE(MAJOR_NR+i),
+					       BLK_BOUNCE_ANY);
+#endif
 
 		/* fill in the other Kernel structs */
 		blksize_size[MAJOR_NR+i] = hba[i]->blocksizes;
@@ -44,6 +44,7 @@ struct ctlr_info
 	char	firm_ver[4]; // Firmware version 
 	unchar  pci_bus;
         unchar  pci_dev_fn;
+	struct pci_dev *pdev;
 	__u32	board_id;
 	ulong   vaddr;
 	__u32	paddr;	
@@ -56,6 +57,9 @@ struct ctlr_info
 	int	num_luns;
 	int	usage_count;  /* number of opens all all minor devices */
 
+	/* protects the controller queues and the request queue */
+	spinlock_t	lock;
+
 	// information about each logical volume
 	drive_info_struct drv[CISS_MAX_LUN];
 
@@ -67,6 +71,8 @@ struct ctlr_info
 	unsigned int Qdepth;
 	unsigned int maxQsinceinit;
 	unsigned int maxSG;
+	unsigned int nr_intrs;		/* interrupts that were ours */
+	unsigned int nr_completions;	/* commands they completed */
 
 	//* pointers to command and error info pool */ 
 	CommandList_struct 	*cmd_pool;
@@ -84,6 +90,8 @@ struct ctlr_info
 	int              hardsizes[256];
 };
 
+#define CCISS_LOCK(i)	(&hba[i]->lock)
+
 /*  Defining the diffent access_menthods */
 /*
  * Memory mapped FIFO interface (SMART 53xx cards)
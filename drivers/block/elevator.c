@@ -18,8 +18,12 @@
  * Removed tests for max-bomb-segments, which was breaking elvtune
  *  when run without -bN
  *
+ * Added the deadline elevator, and made BLKELVSET able to switch a
+ * queue between elevators.
+ *
  */
 
+#include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
@@ -144,6 +148,130 @@ int elevator_noop_merge(request_queue_t *q, struct request **req,
  */
 void elevator_noop_dequeue(struct request *req) {}
 
+/*
+ * Deadline elevator. req->elevator_sequence is the jiffy at which the
+ * request expires; the int truncation is fine since only differences
+ * are ever looked at.
+ */
+#define DEADLINE_EXPIRED(rq)	((int) ((int) jiffies - (rq)->elevator_sequence) >= 0)
+
+/*
+ * Find the oldest expired read, or failing that the oldest expired
+ * write, and move it to the front of the queue along with the next
+ * fifo_batch-1 requests of the same direction behind it, which are
+ * the ones closest to it on disk. The moved requests are all marked
+ * expired, so that new arrivals are not sorted in ahead of them.
+ *
+ * Expired requests already at the front are being dispatched; they
+ * are left alone and the batch goes in behind them. The queue is
+ * scanned at most once per jiffy.
+ */
+static void deadline_move_expired(elevator_t *elevator,
+				  struct list_head *real_head,
+				  struct list_head *head)
+{
+	struct list_head *entry, *front;
+	struct request *rq, *oldest[2] = { NULL, NULL };
+	int batch, cmd;
+
+	if (elevator->last_expire_check == jiffies)
+		return;
+	elevator->last_expire_check = jiffies;
+
+	front = head;
+	while (front->next != real_head &&
+	       DEADLINE_EXPIRED(blkdev_entry_to_request(front->next)))
+		front = front->next;
+
+	for (entry = front->next; entry != real_head; entry = entry->next) {
+		rq = blkdev_entry_to_request(entry);
+		if (!DEADLINE_EXPIRED(rq))
+			continue;
+		cmd = rq->cmd == READ ? 0 : 1;
+		if (!oldest[cmd] ||
+		    rq->elevator_sequence - oldest[cmd]->elevator_sequence < 0)
+			oldest[cmd] = rq;
+	}
+
+	rq = oldest[0] ? oldest[0] : oldest[1];
+	if (!rq)
+		return;
+
+	entry = front;
+	cmd = rq->cmd;
+	batch = elevator->fifo_batch;
+	for (;;) {
+		struct list_head *next = rq->queue.next;
+
+		list_del(&rq->queue);
+		list_add(&rq->queue, entry);
+		entry = &rq->queue;
+		if (!DEADLINE_EXPIRED(rq))
+			rq->elevator_sequence = jiffies;
+
+		if (--batch <= 0 || next == real_head)
+			break;
+		rq = blkdev_entry_to_request(next);
+		if (rq->cmd != cmd)
+			break;
+	}
+}
+
+/*
+ * Insert in sector order, but never ahead of a request that has
+ * already expired.
+ */
+void elevator_deadline(struct request *req, elevator_t *elevator,
+		       struct list_head *real_head,
+		       struct list_head *head, int orig_latency)
+{
+	struct list_head *entry = real_head;
+	struct request *tmp;
+
+	req->elevator_sequence = jiffies + orig_latency;
+
+	while ((entry = entry->prev) != head) {
+		tmp = blkdev_entry_to_request(entry);
+		if (IN_ORDER(tmp, req))
+			break;
+		if (DEADLINE_EXPIRED(tmp))
+			break;
+	}
+	list_add(&req->queue, entry);
+
+	deadline_move_expired(elevator, real_head, head);
+}
+
+/*
+ * Merging does not reorder anything, so any request will do. The
+ * merge path is also where we see every new buffer, which makes it
+ * the place to look for expired requests; those never go ahead of
+ * the synchronous writes at the front.
+ */
+int elevator_deadline_merge(request_queue_t *q, struct request **req,
+			    struct buffer_head *bh, int rw,
+			    int *max_sectors, int *max_segments)
+{
+	struct list_head *head = &q->queue_head;
+
+	if (q->head_active && !q->plugged)
+		head = head->next;
+	deadline_move_expired(&q->elevator, &q->queue_head, blk_sync_tail(q, head));
+
+	return elevator_noop_merge(q, req, bh, rw, max_sectors, max_segments);
+}
+
+static int elevator_type(elevator_t * elevator)
+{
+	if (elevator->elevator_fn == elevator_noop)
+		return BLKELV_NOOP;
+	if (elevator->elevator_fn == elevator_linus)
+		return BLKELV_LINUS;
+	if (elevator->elevator_fn == elevator_deadline)
+		return BLKELV_DEADLINE;
+	return 0;
+}
+
 int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 {
 	blkelv_ioctl_arg_t output;
@@ -151,7 +279,12 @@ int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 	output.queue_ID			= elevator->queue_ID;
 	output.read_latency		= elevator->read_latency;
 	output.write_latency		= elevator->write_latency;
-	output.max_bomb_segments	= 0;
+	output.max_bomb_segments	= elevator_type(elevator);
+
+	if (output.max_bomb_segments == BLKELV_DEADLINE) {
+		output.read_latency = output.read_latency * 1000 / HZ;
+		output.write_latency = output.write_latency * 1000 / HZ;
+	}
 
 	if (copy_to_user(arg, &output, sizeof(blkelv_ioctl_arg_t)))
 		return -EFAULT;
@@ -159,9 +292,13 @@ int blkelvget_ioctl(elevator_t * elevator, blkelv_ioctl_arg_t * arg)
 	return 0;
 }
 
-int blkelvset_ioctl(elevator_t * elevator, const blkelv_ioctl_arg_t * arg)
+int blkelvset_ioctl(request_queue_t * q, const blkelv_ioctl_arg_t * arg)
 {
+	elevator_t * elevator = &q->elevator;
+	spinlock_t * lock = q->queue_lock ? q->queue_lock : &io_request_lock;
 	blkelv_ioctl_arg_t input;
+	elevator_t type;
+	unsigned long flags;
 
 	if (copy_from_user(&input, arg, sizeof(blkelv_ioctl_arg_t)))
 		return -EFAULT;
@@ -171,6 +308,34 @@ int blkelvset_ioctl(elevator_t * elevator, const blkelv_ioctl_arg_t * arg)
 	if (input.write_latency < 0)
 		return -EINVAL;
 
+	if (input.max_bomb_segments &&
+	    input.max_bomb_segments != elevator_type(elevator)) {
+		switch (input.max_bomb_segments) {
+		case BLKELV_NOOP:
+			type = ELEVATOR_NOOP;
+			break;
+		case BLKELV_LINUS:
+			type = ELEVATOR_LINUS;
+			break;
+		case BLKELV_DEADLINE:
+			type = ELEVATOR_DEADLINE;
+			break;
+		default:
+			return -EINVAL;
+		}
+		spin_lock_irqsave(lock, flags);
+		type.queue_ID = elevator->queue_ID;
+		type.nr_segments = elevator->nr_segments;
+		*elevator = type;
+		spin_unlock_irqrestore(lock, flags);
+		return 0;
+	}
+
+	if (elevator_type(elevator) == BLKELV_DEADLINE) {
+		input.read_latency = input.read_latency * HZ / 1000;
+		input.write_latency = input.write_latency * HZ / 1000;
+	}
+
 	elevator->read_latency		= input.read_latency;
 	elevator->write_latency		= input.write_latency;
 	return 0;
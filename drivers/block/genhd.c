@@ -8,6 +8,8 @@
  *
  *  Moved partition checking code to fs/partitions* - Russell King
  *  (linux@arm.uk.linux.org)
+ *
+ *  Per-partition I/O statistics in /proc/diskstats
  */
 
 #include <linux/config.h>
@@ -16,6 +18,7 @@
 #include <linux/kernel.h>
 #include <linux/blk.h>
 #include <linux/init.h>
+#include <linux/spinlock.h>
 
 extern int parport_init(void);
 extern int chr_dev_init(void);
@@ -31,6 +34,82 @@ extern int i2o_init(void);
 extern int cpqarray_init(void);
 extern void ieee1394_init(void);
 
+/* a linear search, superfluous when dev is a pointer */
+struct gendisk *get_gendisk(kdev_t dev)
+{
+	struct gendisk *g;
+	int m = MAJOR(dev);
+
+	for (g = gendisk_head; g; g = g->next)
+		if (g->major == m)
+			break;
+	return g;
+}
+
+#ifdef CONFIG_PROC_FS
+static inline unsigned int ticks_to_msec(unsigned int ticks)
+{
+	return (ticks / HZ) * 1000 + (ticks % HZ) * 1000 / HZ;
+}
+
+/*
+ * One line per disk and partition:
+ *
+ *   major minor name
+ *   reads merged sectors ms-reading
+ *   writes merged sectors ms-writing
+ *   in-flight ms-busy weighted-ms-in-queue
+ */
+int get_disk_stats_list(char *page, char **start, off_t offset, int count)
+{
+	struct gendisk *dsk;
+	int len = 0;
+
+	for (dsk = gendisk_head; dsk; dsk = dsk->next) {
+		int n;
+
+		for (n = 0; n < (dsk->nr_real << dsk->minor_shift); n++) {
+			struct hd_struct *hd = &dsk->part[n];
+			request_queue_t *q;
+			unsigned long flags;
+			char buf[64];
+
+			if (!hd->nr_sects)
+				continue;
+
+			/* bring io_ticks and aveq up to date */
+			q = blk_get_queue(MKDEV(dsk->major, n));
+			if (q && q->queue_lock) {
+				spin_lock_irqsave(q->queue_lock, flags);
+				disk_round_stats(hd);
+				spin_unlock_irqrestore(q->queue_lock, flags);
+			}
+
+			len += sprintf(page + len,
+				       "%4d %4d %s %u %u %u %u %u %u %u %u %u %u %u\n",
+				       dsk->major, n, disk_name(dsk, n, buf),
+				       hd->rd_ios, hd->rd_merges, hd->rd_sectors,
+				       ticks_to_msec(hd->rd_ticks),
+				       hd->wr_ios, hd->wr_merges, hd->wr_sectors,
+				       ticks_to_msec(hd->wr_ticks),
+				       hd->ios_in_flight,
+				       ticks_to_msec(hd->io_ticks),
+				       ticks_to_msec(hd->aveq));
+			if (len < offset)
+				offset -= len, len = 0;
+			else if (len >= offset + count)
+				goto leave_loops;
+		}
+	}
+leave_loops:
+	*start = page + offset;
+	len -= offset;
+	if (len < 0)
+		len = 0;
+	return len > count ? count : len;
+}
+#endif
+
 void __init device_init(void)
 {
 #ifdef CONFIG_PARPORT
@@ -21,12 +21,15 @@
 #include <linux/mm.h>
 #include <linux/init.h>
 #include <linux/smp_lock.h>
+#include <linux/bootmem.h>
 
 #include <asm/system.h>
 #include <asm/io.h>
 #include <linux/blk.h>
 #include <linux/highmem.h>
 #include <linux/raid/md.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
 
 #include <linux/module.h>
 
@@ -65,6 +68,12 @@ DECLARE_TASK_QUEUE(tq_disk);
  */
 spinlock_t io_request_lock = SPIN_LOCK_UNLOCKED;
 
+/*
+ * Default size of the request pool of a queue, set at boot from the
+ * amount of memory.
+ */
+static int queue_nr_requests;
+
 /* This specifies how many sectors to read ahead on the disk. */
 
 int read_ahead[MAX_BLKDEV];
@@ -188,7 +197,7 @@ static int __blk_cleanup_queue(struct list_head *head)
  **/
 void blk_cleanup_queue(request_queue_t * q)
 {
-	int count = QUEUE_NR_REQUESTS;
+	int count = q->nr_requests;
 
 	count -= __blk_cleanup_queue(&q->request_freelist[READ]);
 	count -= __blk_cleanup_queue(&q->request_freelist[WRITE]);
@@ -229,6 +238,31 @@ void blk_queue_headactive(request_queue_t * q, int active)
 	q->head_active = active;
 }
 
+/**
+ * blk_queue_lock - give a request queue a lock of its own
+ * @q:    the request queue
+ * @lock: the spin lock that is to protect @q
+ *
+ * Description:
+ *    By default every queue is protected by the global $io_request_lock,
+ *    which is what older drivers expect to be holding when their request
+ *    function runs and what they take themselves when they touch the
+ *    queue from interrupt context.  A driver that only ever touches its
+ *    queues under q->queue_lock can hand them a lock of its own here,
+ *    either &q->request_lock or one lock shared by all the queues of a
+ *    controller, and then no longer contends with every other block
+ *    device in the system.
+ *
+ *    The request function is then called with @lock held and interrupts
+ *    disabled, and the driver must hold @lock when it ends requests.
+ *    Must be called before the first request is queued.
+ **/
+
+void blk_queue_lock(request_queue_t * q, spinlock_t * lock)
+{
+	q->queue_lock = lock;
+}
+
 /**
  * blk_queue_pluggable - define a plugging function for a request queue
  * @q:   the request queue to which the function will apply
@@ -284,6 +318,78 @@ void blk_queue_pluggable (request_queue_t * q, plug_device_fn *plug)
 void blk_queue_make_request(request_queue_t * q, make_request_fn * mfn)
 {
 	q->make_request_fn = mfn;
+	q->make_bio_fn = NULL;
+	blk_queue_bounce_limit(q, BLK_BOUNCE_HIGH);
+}
+
+/**
+ * blk_queue_make_bio - take whole bios on a queue
+ * @q:  the request queue for the device
+ * @mfn: the function that handles a bio
+ *
+ * Description:
+ *    By default submit_bio() cuts a bio into buffer_heads and passes
+ *    those through make_request_fn.  A driver that can deal with a
+ *    &struct bio directly sets @mfn here, after blk_init_queue() or
+ *    blk_queue_make_request(), and gets the bio unchanged.
+ *
+ *    @mfn completes the bio with bi_end_io and returns 0, or it
+ *    remaps bi_dev and bi_sector and returns non-zero to have the bio
+ *    passed on to the new device, the same as a make_request_fn.
+ *    It is called from process context and may sleep, and has to
+ *    cope with highmem pages in the bio.
+ **/
+void blk_queue_make_bio(request_queue_t * q, make_bio_fn * mfn)
+{
+	q->make_bio_fn = mfn;
+}
+
+unsigned long blk_max_low_pfn;
+
+/**
+ * blk_queue_bounce_limit - set the highest address a device can DMA to
+ * @q:  the request queue for the device
+ * @dma_addr:  the highest bus address it reaches
+ *
+ * Description:
+ *    Buffers in highmem are copied to and from a bounce buffer in low
+ *    memory before they are passed to the driver, unless they lie at
+ *    or below @dma_addr.  By default all of highmem is bounced
+ *    (%BLK_BOUNCE_HIGH).  A driver that builds its DMA addresses from
+ *    b_page and bh_offset() rather than b_data, with pci_map_page() or
+ *    pci_dac_page_to_dma(), sets the limit of its device here, e.g.
+ *    %BLK_BOUNCE_4G or %BLK_BOUNCE_ANY.  req->buffer and b_data must
+ *    then not be used for I/O, they are no kernel addresses for
+ *    highmem.
+ *
+ *    Low memory is never bounced here; devices that cannot reach all
+ *    of it (ISA) still do that themselves.
+ **/
+void blk_queue_bounce_limit(request_queue_t *q, u64 dma_addr)
+{
+	unsigned long bounce_pfn = dma_addr >> PAGE_SHIFT;
+
+	if (bounce_pfn < blk_max_low_pfn)
+		bounce_pfn = blk_max_low_pfn;
+	q->bounce_pfn = bounce_pfn;
+}
+
+/*
+ * Bounce a highmem buffer the device cannot reach.  The pfn test
+ * is only made for a queue whose limit was raised.
+ */
+static inline struct buffer_head *blk_queue_bounce(request_queue_t *q, int rw,
+						   struct buffer_head *bh)
+{
+#ifdef CONFIG_HIGHMEM
+	if (!PageHighMem(bh->b_page))
+		return bh;
+	if (q->bounce_pfn > blk_max_low_pfn &&
+	    bh->b_page - mem_map <= q->bounce_pfn)
+		return bh;
+	bh = create_bounce(rw, bh);
+#endif
+	return bh;
 }
 
 static inline int ll_new_segment(request_queue_t *q, struct request *req, int max_segments)
@@ -299,7 +405,7 @@ static inline int ll_new_segment(request_queue_t *q, struct request *req, int ma
 static int ll_back_merge_fn(request_queue_t *q, struct request *req, 
 			    struct buffer_head *bh, int max_segments)
 {
-	if (req->bhtail->b_data + req->bhtail->b_size == bh->b_data)
+	if (bh_contig(req->bhtail, bh))
 		return 1;
 	return ll_new_segment(q, req, max_segments);
 }
@@ -307,7 +413,7 @@ static int ll_back_merge_fn(request_queue_t *q, struct request *req,
 static int ll_front_merge_fn(request_queue_t *q, struct request *req, 
 			     struct buffer_head *bh, int max_segments)
 {
-	if (bh->b_data + bh->b_size == req->bh->b_data)
+	if (bh_contig(bh, req->bh))
 		return 1;
 	return ll_new_segment(q, req, max_segments);
 }
@@ -319,7 +425,7 @@ static int ll_merge_requests_fn(request_queue_t *q, struct request *req,
 	int same_segment;
 
 	same_segment = 0;
-	if (req->bhtail->b_data + req->bhtail->b_size == next->bh->b_data) {
+	if (bh_contig(req->bhtail, next->bh)) {
 		total_segments--;
 		same_segment = 1;
 	}
@@ -369,14 +475,19 @@ static void generic_unplug_device(void *data)
 	request_queue_t *q = (request_queue_t *) data;
 	unsigned long flags;
 
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(q->queue_lock, flags);
 	__generic_unplug_device(q);
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(q->queue_lock, flags);
 }
 
-static void blk_init_free_list(request_queue_t *q)
+/*
+ * Grow the request pool of q to nr requests.  The lists may already be
+ * in use, so the new requests are added under the queue lock.
+ */
+static void blk_grow_free_list(request_queue_t *q, int nr)
 {
 	struct request *rq;
+	unsigned long flags;
 	int i;
 
 	/*
@@ -384,14 +495,64 @@ static void blk_init_free_list(request_queue_t *q)
 	 * be a 2/3 advantage for reads, but now reads can steal from
 	 * the write free list.
 	 */
-	for (i = 0; i < QUEUE_NR_REQUESTS; i++) {
+	for (i = q->nr_requests; i < nr; i++) {
 		rq = kmem_cache_alloc(request_cachep, SLAB_KERNEL);
+		if (!rq)
+			break;
 		rq->rq_status = RQ_INACTIVE;
+		spin_lock_irqsave(q->queue_lock, flags);
 		list_add(&rq->table, &q->request_freelist[i & 1]);
+		q->free_requests[i & 1]++;
+		q->nr_requests++;
+		spin_unlock_irqrestore(q->queue_lock, flags);
 	}
 
-	init_waitqueue_head(&q->wait_for_request);
+	/*
+	 * Wake waiters once an eighth of the pool has been freed up,
+	 * but don't make them wait for more than 32 requests.
+	 */
+	q->batch_requests = q->nr_requests / 8;
+	if (q->batch_requests > 32)
+		q->batch_requests = 32;
+	if (q->batch_requests < 1)
+		q->batch_requests = 1;
+
+	wake_up(&q->wait_for_request[READ]);
+	wake_up(&q->wait_for_request[WRITE]);
+}
+
+static void blk_init_free_list(request_queue_t *q)
+{
+	q->free_requests[READ] = q->free_requests[WRITE] = 0;
+	q->nr_requests = 0;
+	init_waitqueue_head(&q->wait_for_request[READ]);
+	init_waitqueue_head(&q->wait_for_request[WRITE]);
 	spin_lock_init(&q->request_lock);
+
+	blk_grow_free_list(q, queue_nr_requests);
+}
+
+/**
+ * blk_queue_depth - size the request pool for the device's queue depth
+ * @q:     the request queue
+ * @depth: the number of commands the device can have outstanding
+ *
+ * Description:
+ *    Every queue starts out with the same number of requests, which
+ *    is too few to keep a controller with hundreds of tags busy while
+ *    still leaving the elevator something to sort and merge.  Drivers
+ *    that know how many commands they can have in flight call this to
+ *    grow the pool to twice that, within %BLKDEV_MAX_RQ.  The pool is
+ *    never shrunk.  May sleep; call it after blk_queue_lock().
+ **/
+void blk_queue_depth(request_queue_t * q, int depth)
+{
+	int nr = 2 * depth;
+
+	if (nr > BLKDEV_MAX_RQ)
+		nr = BLKDEV_MAX_RQ;
+	if (nr > q->nr_requests)
+		blk_grow_free_list(q, nr);
 }
 
 static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
@@ -417,8 +578,9 @@ static int __make_request(request_queue_t * q, int rw, struct buffer_head * bh);
  *    requests on the queue, it is responsible for arranging that the requests
  *    get dealt with eventually.
  *
- *    A global spin lock $io_request_lock must be held while manipulating the
- *    requests on the request queue.
+ *    The queue lock (q->queue_lock) must be held while manipulating the
+ *    requests on the request queue.  This is the global $io_request_lock
+ *    unless the driver has picked another one with blk_queue_lock().
  *
  *    The request on the head of the queue is by default assumed to be
  *    potentially active, and it is not considered for re-ordering or merging
@@ -435,12 +597,14 @@ void blk_init_queue(request_queue_t * q, request_fn_proc * rfn)
 	INIT_LIST_HEAD(&q->request_freelist[READ]);
 	INIT_LIST_HEAD(&q->request_freelist[WRITE]);
 	elevator_init(&q->elevator, ELEVATOR_LINUS);
+	q->queue_lock		= &io_request_lock;
 	blk_init_free_list(q);
 	q->request_fn     	= rfn;
 	q->back_merge_fn       	= ll_back_merge_fn;
 	q->front_merge_fn      	= ll_front_merge_fn;
 	q->merge_requests_fn	= ll_merge_requests_fn;
 	q->make_request_fn	= __make_request;
+	q->make_bio_fn		= NULL;
 	q->plug_tq.sync		= 0;
 	q->plug_tq.routine	= &generic_unplug_device;
 	q->plug_tq.data		= q;
@@ -453,15 +617,16 @@ void blk_init_queue(request_queue_t * q, request_fn_proc * rfn)
 	 */
 	q->plug_device_fn 	= generic_plug_device;
 	q->head_active    	= 1;
+	blk_queue_bounce_limit(q, BLK_BOUNCE_HIGH);
 }
 
 
 #define blkdev_free_rq(list) list_entry((list)->next, struct request, table);
 /*
- * Get a free request. io_request_lock must be held and interrupts
+ * Get a free request. q->queue_lock must be held and interrupts
  * disabled on the way in.
  */
-static inline struct request *get_request(request_queue_t *q, int rw)
+static inline struct request *get_request(request_queue_t *q, int rw, int sync)
 {
 	struct list_head *list = &q->request_freelist[rw];
 	struct request *rq;
@@ -475,6 +640,17 @@ static inline struct request *get_request(request_queue_t *q, int rw)
 		goto got_rq;
 	}
 
+	/*
+	 * Synchronous writes must not wait for background writeout to
+	 * drain the write list; they may borrow a read request as long
+	 * as a batch of them is left for the readers.
+	 */
+	if (sync && q->free_requests[READ] > q->batch_requests) {
+		list = &q->request_freelist[READ];
+		rq = blkdev_free_rq(list);
+		goto got_rq;
+	}
+
 	/*
 	 * if the WRITE list is non-empty, we know that rw is READ
 	 * and that the READ list is empty. allow reads to 'steal'
@@ -490,6 +666,7 @@ static inline struct request *get_request(request_queue_t *q, int rw)
 
 got_rq:
 	list_del(&rq->table);
+	q->free_requests[list == &q->request_freelist[WRITE]]--;
 	rq->free_list = list;
 	rq->rq_status = RQ_ACTIVE;
 	rq->special = NULL;
@@ -498,25 +675,27 @@ got_rq:
 }
 
 /*
- * No available requests for this queue, unplug the device.
+ * No available requests for this queue, unplug the device.  We are
+ * only woken once a batch of requests has been freed, see
+ * blkdev_release_request().
  */
-static struct request *__get_request_wait(request_queue_t *q, int rw)
+static struct request *__get_request_wait(request_queue_t *q, int rw, int sync)
 {
 	register struct request *rq;
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&q->wait_for_request, &wait);
+	add_wait_queue_exclusive(&q->wait_for_request[rw], &wait);
 	for (;;) {
 		__set_current_state(TASK_UNINTERRUPTIBLE);
-		spin_lock_irq(&io_request_lock);
-		rq = get_request(q, rw);
-		spin_unlock_irq(&io_request_lock);
+		spin_lock_irq(q->queue_lock);
+		rq = get_request(q, rw, sync);
+		spin_unlock_irq(q->queue_lock);
 		if (rq)
 			break;
 		generic_unplug_device(q);
 		schedule();
 	}
-	remove_wait_queue(&q->wait_for_request, &wait);
+	remove_wait_queue(&q->wait_for_request[rw], &wait);
 	current->state = TASK_RUNNING;
 	return rq;
 }
@@ -525,12 +704,12 @@ static inline struct request *get_request_wait(request_queue_t *q, int rw)
 {
 	register struct request *rq;
 
-	spin_lock_irq(&io_request_lock);
-	rq = get_request(q, rw);
-	spin_unlock_irq(&io_request_lock);
+	spin_lock_irq(q->queue_lock);
+	rq = get_request(q, rw, 0);
+	spin_unlock_irq(q->queue_lock);
 	if (rq)
 		return rq;
-	return __get_request_wait(q, rw);
+	return __get_request_wait(q, rw, 0);
 }
 
 /* RO fail safe mechanism */
@@ -579,6 +758,110 @@ inline void drive_stat_acct (kdev_t dev, int rw,
 		printk(KERN_ERR "drive_stat_acct: cmd not R/W?\n");
 }
 
+/*
+ * Per-partition I/O statistics for /proc/diskstats.  Every request is
+ * charged to its partition and, for a partition, to the whole disk as
+ * well.  All of this runs under the queue lock.
+ */
+static int locate_hd_structs(kdev_t dev, struct hd_struct *hd[2])
+{
+	struct gendisk *gd = get_gendisk(dev);
+	int minor = MINOR(dev);
+	int whole;
+
+	if (!gd || !gd->part || minor >= (gd->nr_real << gd->minor_shift))
+		return 0;
+	hd[0] = &gd->part[minor];
+	whole = minor & ~((1 << gd->minor_shift) - 1);
+	if (whole == minor)
+		return 1;
+	hd[1] = &gd->part[whole];
+	return 2;
+}
+
+void disk_round_stats(struct hd_struct *hd)
+{
+	unsigned long now = jiffies;
+
+	hd->aveq += hd->ios_in_flight * (now - hd->last_queue_change);
+	hd->last_queue_change = now;
+	if (hd->ios_in_flight)
+		hd->io_ticks += now - hd->last_idle_time;
+	hd->last_idle_time = now;
+}
+
+/*
+ * A new request (merge == 0) or a buffer merged into a queued one.
+ */
+static void req_new_io(struct request *req, int merge, int sectors)
+{
+	struct hd_struct *hd[2];
+	int i, n;
+
+	n = locate_hd_structs(req->rq_dev, hd);
+	for (i = 0; i < n; i++) {
+		if (req->cmd == READ) {
+			hd[i]->rd_sectors += sectors;
+			hd[i]->rd_merges += merge;
+		} else {
+			hd[i]->wr_sectors += sectors;
+			hd[i]->wr_merges += merge;
+		}
+		if (!merge) {
+			disk_round_stats(hd[i]);
+			hd[i]->ios_in_flight++;
+		}
+	}
+}
+
+/*
+ * req has been folded into the request in front of it.
+ */
+static void req_merged_io(struct request *req)
+{
+	struct hd_struct *hd[2];
+	int i, n;
+
+	n = locate_hd_structs(req->rq_dev, hd);
+	for (i = 0; i < n; i++) {
+		if (req->cmd == READ)
+			hd[i]->rd_merges++;
+		else
+			hd[i]->wr_merges++;
+		disk_round_stats(hd[i]);
+		if (hd[i]->ios_in_flight)
+			hd[i]->ios_in_flight--;
+	}
+}
+
+/*
+ * The driver is done with req.  end_that_request_last() calls this;
+ * drivers that release the request before the I/O completes, like the
+ * SCSI mid-layer, call it themselves with the queue lock held.
+ */
+void req_finished_io(struct request *req)
+{
+	unsigned long duration = jiffies - req->start_time;
+	struct hd_struct *hd[2];
+	int i, n;
+
+	if (req->cmd != READ && req->cmd != WRITE)
+		return;
+	n = locate_hd_structs(req->rq_dev, hd);
+	for (i = 0; i < n; i++) {
+		if (req->cmd == READ) {
+			hd[i]->rd_ios++;
+			hd[i]->rd_ticks += duration;
+		} else {
+			hd[i]->wr_ios++;
+			hd[i]->wr_ticks += duration;
+		}
+		disk_round_stats(hd[i]);
+		if (hd[i]->ios_in_flight)
+			hd[i]->ios_in_flight--;
+	}
+}
+
 /*
  * add-request adds a request to the linked list.
  * It disables interrupts (acquires the request spinlock) so that it can muck
@@ -589,6 +872,25 @@ inline void drive_stat_acct (kdev_t dev, int rw,
  * which is important for drive_stat_acct() above.
  */
 
+/*
+ * Put a request with synchronous writes at the front of the queue,
+ * behind the other synchronous ones that come first in sector order.
+ */
+static void add_sync_request(request_queue_t * q, struct request * req,
+			     struct list_head *head)
+{
+	struct list_head *entry = head;
+	struct request *tmp;
+
+	while (entry->next != &q->queue_head) {
+		tmp = blkdev_entry_next_request(entry);
+		if (!tmp->sync || !IN_ORDER(tmp, req))
+			break;
+		entry = entry->next;
+	}
+	list_add(&req->queue, entry);
+}
+
 static inline void add_request(request_queue_t * q, struct request * req,
 			       struct list_head *head, int lat)
 {
@@ -597,9 +899,14 @@ static inline void add_request(request_queue_t * q, struct request * req,
 	drive_stat_acct(req->rq_dev, req->cmd, req->nr_sectors, 1);
 
 	/*
-	 * let selected elevator insert the request
+	 * Synchronous writes go first, the selected elevator sorts
+	 * everything else in behind them.
 	 */
-	q->elevator.elevator_fn(req, &q->elevator, &q->queue_head, head, lat);
+	if (req->sync)
+		add_sync_request(q, req, head);
+	else
+		q->elevator.elevator_fn(req, &q->elevator, &q->queue_head,
+					blk_sync_tail(q, head), lat);
 
         /*
 	 * FIXME(eric) I don't understand why there is a need for this
@@ -618,7 +925,7 @@ static inline void add_request(request_queue_t * q, struct request * req,
 }
 
 /*
- * Must be called with io_request_lock held and interrupts disabled
+ * Must be called with q->queue_lock held and interrupts disabled
  */
 void inline blkdev_release_request(struct request *req)
 {
@@ -628,9 +935,23 @@ void inline blkdev_release_request(struct request *req)
 	 * Request may not have originated from ll_rw_blk
 	 */
 	if (req->free_list) {
+		request_queue_t *q = req->q;
+		int rw = req->free_list == &q->request_freelist[WRITE];
+
 		list_add(&req->table, req->free_list);
 		req->free_list = NULL;
-		wake_up(&req->q->wait_for_request);
+
+		/*
+		 * Let the waiters in a batch at a time.  Once there are
+		 * batch_requests free, every further release wakes one
+		 * more.  Reads can use a free write request as well.
+		 */
+		if (++q->free_requests[rw] < q->batch_requests)
+			return;
+		if (waitqueue_active(&q->wait_for_request[rw]))
+			wake_up(&q->wait_for_request[rw]);
+		else if (rw == WRITE)
+			wake_up(&q->wait_for_request[READ]);
 	}
 }
 
@@ -648,6 +969,7 @@ static void attempt_merge(request_queue_t * q,
 	if (req->sector + req->nr_sectors != next->sector)
 		return;
 	if (req->cmd != next->cmd
+	    || req->sync != next->sync
 	    || req->rq_dev != next->rq_dev
 	    || req->nr_sectors + next->nr_sectors > max_sectors
 	    || next->sem)
@@ -665,6 +987,7 @@ static void attempt_merge(request_queue_t * q,
 	req->bhtail = next->bhtail;
 	req->nr_sectors = req->hard_nr_sectors += next->hard_nr_sectors;
 	list_del(&next->queue);
+	req_merged_io(next);
 	blkdev_release_request(next);
 }
 
@@ -692,13 +1015,26 @@ static inline void attempt_front_merge(request_queue_t * q,
 	attempt_merge(q, blkdev_entry_to_request(prev), max_sectors, max_segments);
 }
 
+/*
+ * A synchronous write was merged into a background request: move
+ * the request up to the synchronous ones.
+ */
+static inline void promote_request(request_queue_t * q,
+				   struct list_head * head,
+				   struct request * req)
+{
+	list_del(&req->queue);
+	req->sync = 1;
+	add_sync_request(q, req, head);
+}
+
 static int __make_request(request_queue_t * q, int rw,
 				  struct buffer_head * bh)
 {
 	unsigned int sector, count;
 	int max_segments = MAX_SEGMENTS;
 	struct request * req = NULL, *freereq = NULL;
-	int rw_ahead, max_sectors, el_ret;
+	int rw_ahead, max_sectors, el_ret, sync;
 	struct list_head *head;
 	int latency;
 	elevator_t *elevator = &q->elevator;
@@ -726,14 +1062,13 @@ static int __make_request(request_queue_t * q, int rw,
 	if (!buffer_mapped(bh))
 		BUG();
 
+	sync = test_and_clear_bit(BH_Sync, &bh->b_state) && rw == WRITE;
+
 	/*
-	 * Temporary solution - in 2.5 this will be done by the lowlevel
-	 * driver. Create a bounce buffer if the buffer data points into
-	 * high memory - keep the original buffer otherwise.
+	 * Create a bounce buffer if the buffer data is in high memory
+	 * the device cannot reach - keep the original buffer otherwise.
 	 */
-#if CONFIG_HIGHMEM
-	bh = create_bounce(rw, bh);
-#endif
+	bh = blk_queue_bounce(q, rw, bh);
 
 /* look for a free request. */
 	/*
@@ -748,7 +1083,7 @@ static int __make_request(request_queue_t * q, int rw,
 	 * not to schedule or do something nonatomic
 	 */
 again:
-	spin_lock_irq(&io_request_lock);
+	spin_lock_irq(q->queue_lock);
 
 	/*
 	 * skip first entry, for devices with active queue head
@@ -774,6 +1109,9 @@ again:
 			req->nr_sectors = req->hard_nr_sectors += count;
 			req->e = elevator;
 			drive_stat_acct(req->rq_dev, req->cmd, count, 0);
+			req_new_io(req, 1, count);
+			if (sync && !req->sync)
+				promote_request(q, head, req);
 			attempt_back_merge(q, req, max_sectors, max_segments);
 			goto out;
 
@@ -788,6 +1126,9 @@ again:
 			req->nr_sectors = req->hard_nr_sectors += count;
 			req->e = elevator;
 			drive_stat_acct(req->rq_dev, req->cmd, count, 0);
+			req_new_io(req, 1, count);
+			if (sync && !req->sync)
+				promote_request(q, head, req);
 			attempt_front_merge(q, head, req, max_sectors, max_segments);
 			goto out;
 		/*
@@ -811,18 +1152,19 @@ get_rq:
 	if (freereq) {
 		req = freereq;
 		freereq = NULL;
-	} else if ((req = get_request(q, rw)) == NULL) {
-		spin_unlock_irq(&io_request_lock);
+	} else if ((req = get_request(q, rw, sync)) == NULL) {
+		spin_unlock_irq(q->queue_lock);
 		if (rw_ahead)
 			goto end_io;
 
-		freereq = __get_request_wait(q, rw);
+		freereq = __get_request_wait(q, rw, sync);
 		goto again;
 	}
 
 /* fill up the request-info, and add it to the queue */
 	req->cmd = rw;
 	req->errors = 0;
+	req->sync = sync;
 	req->hard_sector = req->sector = sector;
 	req->hard_nr_sectors = req->nr_sectors = count;
 	req->current_nr_sectors = count;
@@ -834,13 +1176,15 @@ get_rq:
 	req->bhtail = bh;
 	req->rq_dev = bh->b_rdev;
 	req->e = elevator;
+	req->start_time = jiffies;
+	req_new_io(req, 0, count);
 	add_request(q, req, head, latency);
 out:
 	if (!q->plugged)
 		(q->request_fn)(q);
 	if (freereq)
 		blkdev_release_request(freereq);
-	spin_unlock_irq(&io_request_lock);
+	spin_unlock_irq(q->queue_lock);
 	return 0;
 end_io:
 	bh->b_end_io(bh, test_bit(BH_Uptodate, &bh->b_state));
@@ -956,6 +1300,15 @@ void submit_bh(int rw, struct buffer_head * bh)
 
 	set_bit(BH_Req, &bh->b_state);
 
+	/*
+	 * A task in fsync() or an O_SYNC write waits for its writes:
+	 * the queue puts them ahead of background writeout.
+	 */
+	if (rw == WRITE && (current->flags & PF_SYNCWRITE))
+		set_bit(BH_Sync, &bh->b_state);
+	else
+		clear_bit(BH_Sync, &bh->b_state);
+
 	/*
 	 * First step, 'identity mapping' - RAID or LVM might
 	 * further remap this.
@@ -975,6 +1328,229 @@ void submit_bh(int rw, struct buffer_head * bh)
 	}
 }
 
+/**
+ * bio_alloc: allocate a bio
+ * @gfp_mask: allocation flags, GFP_BUFFER on the way out to disk
+ * @nr_vecs: number of pieces the bio can hold
+ *
+ * The bio comes back empty, with room for @nr_vecs pieces.  The
+ * caller fills in bi_dev, bi_sector, bi_end_io and bi_private, adds
+ * pages with bio_add_page() and frees it with bio_put() once it has
+ * completed.  A bio may be reused after its completion by setting
+ * bi_vcnt and bi_size back to zero.
+ */
+struct bio *bio_alloc(int gfp_mask, int nr_vecs)
+{
+	struct bio *bio;
+
+	bio = kmalloc(sizeof(*bio) + nr_vecs * sizeof(struct bio_vec), gfp_mask);
+	if (!bio)
+		return NULL;
+	memset(bio, 0, sizeof(*bio));
+	bio->bi_io_vec = (struct bio_vec *) (bio + 1);
+	bio->bi_max = nr_vecs;
+	return bio;
+}
+
+void bio_put(struct bio *bio)
+{
+	kfree(bio);
+}
+
+/**
+ * bio_add_page: add a piece of a page to the end of a bio
+ * @bio: the bio
+ * @page: the page
+ * @len: bytes in the piece
+ * @offset: where in the page the piece starts
+ *
+ * A piece that continues the last one in the same page just extends
+ * it.  Returns 0, or -ENOSPC when the bio has no room left.
+ */
+int bio_add_page(struct bio *bio, struct page *page,
+		 unsigned int len, unsigned int offset)
+{
+	struct bio_vec *bv;
+
+	if (((len | offset) & 511) || offset + len > PAGE_SIZE)
+		BUG();
+
+	if (bio->bi_vcnt) {
+		bv = &bio->bi_io_vec[bio->bi_vcnt - 1];
+		if (bv->bv_page == page && bv->bv_offset + bv->bv_len == offset) {
+			bv->bv_len += len;
+			bio->bi_size += len;
+			return 0;
+		}
+	}
+	if (bio->bi_vcnt == bio->bi_max)
+		return -ENOSPC;
+
+	bv = &bio->bi_io_vec[bio->bi_vcnt++];
+	bv->bv_page = page;
+	bv->bv_len = len;
+	bv->bv_offset = offset;
+	bio->bi_size += len;
+	return 0;
+}
+
+static inline void bio_piece_done(struct bio *bio)
+{
+	if (atomic_dec_and_test(&bio->bi_remaining))
+		bio->bi_end_io(bio, test_bit(BIO_UPTODATE, &bio->bi_flags));
+}
+
+static void end_buffer_io_bio(struct buffer_head *bh, int uptodate)
+{
+	struct bio *bio = bh->b_private;
+
+	if (!uptodate)
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	kmem_cache_free(bh_cachep, bh);
+	bio_piece_done(bio);
+}
+
+static struct buffer_head *bio_get_bh(void)
+{
+	struct buffer_head *bh;
+
+	/* The same rule as for the buffer cache: no I/O to get memory */
+	while (!(bh = kmem_cache_alloc(bh_cachep, SLAB_BUFFER))) {
+		run_task_queue(&tq_disk);
+		current->policy |= SCHED_YIELD;
+		__set_current_state(TASK_RUNNING);
+		schedule();
+	}
+	memset(bh, 0, sizeof(*bh));
+	init_waitqueue_head(&bh->b_wait);
+	return bh;
+}
+
+/*
+ * The largest buffer_head that fits at this point of a piece: a power
+ * of two up to PAGE_SIZE, aligned both on the disk and in the page, so
+ * that drivers and the elevator see the sizes they are used to.
+ */
+static inline unsigned int bio_bh_size(unsigned long sector,
+				       unsigned int offset, unsigned int len)
+{
+	unsigned int size = PAGE_SIZE;
+
+	while (size > 512 &&
+	       (size > len || (offset & (size - 1)) ||
+		(sector & ((size >> 9) - 1))))
+		size >>= 1;
+	return size;
+}
+
+/*
+ * The shim for queues that only know buffer_heads.  bi_remaining
+ * holds one extra count until every piece is submitted, so bi_end_io
+ * can't run early.
+ */
+static void bio_make_bh_requests(int rw, struct bio *bio)
+{
+	struct bio_vec *bv = bio->bi_io_vec;
+	struct buffer_head *bh;
+	unsigned long sector = bio->bi_sector;
+	unsigned int offset, len, size;
+	int i;
+
+	atomic_set(&bio->bi_remaining, 1);
+	for (i = 0; i < bio->bi_vcnt; i++, bv++) {
+		offset = bv->bv_offset;
+		len = bv->bv_len;
+		while (len) {
+			size = bio_bh_size(sector, offset, len);
+
+			bh = bio_get_bh();
+			bh->b_size = size;
+			set_bh_page(bh, bv->bv_page, offset);
+			bh->b_this_page = bh;
+			init_buffer(bh, end_buffer_io_bio, bio);
+			bh->b_dev = bh->b_rdev = bio->bi_dev;
+			bh->b_blocknr = sector / (size >> 9);
+			bh->b_rsector = sector;
+			bh->b_state = (1 << BH_Mapped) | (1 << BH_Lock) | (1 << BH_Req);
+			if (rw == WRITE) {
+				set_bit(BH_Uptodate, &bh->b_state);
+				if (current->flags & PF_SYNCWRITE)
+					set_bit(BH_Sync, &bh->b_state);
+			}
+
+			atomic_inc(&bio->bi_remaining);
+			generic_make_request(rw, bh);
+
+			sector += size >> 9;
+			offset += size;
+			len -= size;
+		}
+	}
+	bio_piece_done(bio);
+}
+
+/**
+ * submit_bio: submit a bio to the block device for I/O
+ * @rw: whether to %READ or %WRITE, or maybe to %READA (read ahead)
+ * @bio: The &struct bio which describes the I/O
+ *
+ * submit_bio() does for a whole vector of pages what submit_bh() does
+ * for one buffer.  Queues that registered a make_bio_fn get the bio
+ * itself, all others a buffer_head for each aligned piece of it.
+ * Either way bi_end_io is called once when all of the bio is done,
+ * possibly before submit_bio() returns.
+ *
+ * Must be called from process context: it may sleep for memory.
+ */
+void submit_bio(int rw, struct bio *bio)
+{
+	int major = MAJOR(bio->bi_dev);
+	request_queue_t *q;
+
+	if (!bio->bi_end_io) BUG();
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+
+	switch (rw) {
+		case WRITE:
+			kstat.pgpgout += bio->bi_vcnt;
+			break;
+		default:
+			kstat.pgpgin += bio->bi_vcnt;
+			break;
+	}
+
+	if (blk_size[major]) {
+		unsigned long maxsector = (blk_size[major][MINOR(bio->bi_dev)] << 1) + 1;
+		unsigned long count = bio->bi_size >> 9;
+
+		if (maxsector < count || maxsector - count < bio->bi_sector) {
+			if (blk_size[major][MINOR(bio->bi_dev)])
+				printk(KERN_INFO "attempt to access beyond end of device\n"
+				       "%s: rw=%d, want=%ld, limit=%d\n",
+				       kdevname(bio->bi_dev), rw,
+				       (bio->bi_sector + count) >> 1,
+				       blk_size[major][MINOR(bio->bi_dev)]);
+			bio->bi_end_io(bio, 0);
+			return;
+		}
+	}
+
+	do {
+		q = blk_get_queue(bio->bi_dev);
+		if (!q) {
+			printk(KERN_ERR
+			       "submit_bio: Trying to access nonexistent block-device %s (%ld)\n",
+			       kdevname(bio->bi_dev), bio->bi_sector);
+			bio->bi_end_io(bio, 0);
+			return;
+		}
+		if (!q->make_bio_fn) {
+			bio_make_bh_requests(rw, bio);
+			return;
+		}
+	} while (q->make_bio_fn(q, rw, bio));
+}
+
 /*
  * Default IO end handler, used by "ll_rw_block()".
  */
@@ -1142,6 +1718,7 @@ void end_that_request_last(struct request *req)
 		printk("end_that_request_last called with non-dequeued req\n");
 		BUG();
 	}
+	req_finished_io(req);
 	if (req->sem != NULL)
 		up(req->sem);
 
@@ -1152,6 +1729,8 @@ int __init blk_dev_init(void)
 {
 	struct blk_dev_struct *dev;
 
+	blk_max_low_pfn = max_low_pfn - 1;
+
 	request_cachep = kmem_cache_create("blkdev_requests",
 					   sizeof(struct request),
 					   0, SLAB_HWCACHE_ALIGN, NULL, NULL);
@@ -1159,6 +1738,16 @@ int __init blk_dev_init(void)
 	if (!request_cachep)
 		panic("Can't create request pool slab cache\n");
 
+	/*
+	 * Small boxes can't afford to tie up much memory in requests
+	 * for every queue; big ones want deep queues to sort and merge.
+	 */
+	queue_nr_requests = 64;
+	if (num_physpages > (32 << (20 - PAGE_SHIFT)))
+		queue_nr_requests = 128;
+	if (num_physpages > (256 << (20 - PAGE_SHIFT)))
+		queue_nr_requests = 256;
+
 	for (dev = blk_dev + MAX_BLKDEV; dev-- != blk_dev;)
 		dev->queue = NULL;
 
@@ -1281,7 +1870,17 @@ EXPORT_SYMBOL(blk_init_queue);
 EXPORT_SYMBOL(blk_get_queue);
 EXPORT_SYMBOL(blk_cleanup_queue);
 EXPORT_SYMBOL(blk_queue_headactive);
+EXPORT_SYMBOL(blk_queue_lock);
+EXPORT_SYMBOL(blk_queue_depth);
 EXPORT_SYMBOL(blk_queue_pluggable);
 EXPORT_SYMBOL(blk_queue_make_request);
+EXPORT_SYMBOL(blk_queue_make_bio);
+EXPORT_SYMBOL(blk_queue_bounce_limit);
+EXPORT_SYMBOL(blk_max_low_pfn);
+EXPORT_SYMBOL(bio_alloc);
+EXPORT_SYMBOL(bio_put);
+EXPORT_SYMBOL(bio_add_page);
+EXPORT_SYMBOL(submit_bio);
 EXPORT_SYMBOL(generic_make_request);
 EXPORT_SYMBOL(blkdev_release_request);
+EXPORT_SYMBOL(req_finished_io);
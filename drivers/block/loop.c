@@ -46,6 +46,12 @@
  *   problem above. Encryption modules that used to rely on the old scheme
  *   should just call ->i_mapping->bmap() to calculate the physical block
  *   number.
+ *
+ * Unencrypted loops no longer go through a request queue: buffer heads
+ * are remapped straight onto the backing device (through bmap() for
+ * files, cached per block), so the image is not cached twice.  What
+ * cannot be remapped (transfer functions, holes, filesystems without
+ * bmap) is copied by a per-device "loopN" thread, in batches.
  */ 
 
 #include <linux/module.h>
@@ -59,6 +65,8 @@
 
 #include <linux/init.h>
 #include <linux/devfs_fs_kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
 
 #include <asm/uaccess.h>
 
@@ -67,7 +75,6 @@
 #define MAJOR_NR LOOP_MAJOR
 
 #define DEVICE_NAME "loop"
-#define DEVICE_REQUEST do_lo_request
 #define DEVICE_NR(device) (MINOR(device))
 #define DEVICE_ON(device)
 #define DEVICE_OFF(device)
@@ -150,6 +157,9 @@ struct loop_func_table *xfer_funcs[MAX_LO_CRYPT] = {
 
 #define MAX_DISK_SIZE 1024*1024*1024
 
+/* Don't cache the block map of huge backing files beyond 4MB */
+#define MAX_BMAP_ENTRIES (1024*1024)
+
 static void figure_loop_size(struct loop_device *lo)
 {
 	int	size;
@@ -268,52 +278,85 @@ static int lo_receive(struct loop_device *lo, char *data, int len, loff_t pos,
 	return desc.error;
 }
 
-static void do_lo_request(request_queue_t * q)
+static int loop_get_blksize(struct loop_device *lo)
 {
-	int	block, offset, len, blksize, size;
-	char	*dest_addr;
-	struct loop_device *lo;
-	struct buffer_head *bh;
-	struct request *current_request;
-	loff_t pos;
+	int blksize = BLOCK_SIZE;
 
-repeat:
-	INIT_REQUEST;
-	current_request=CURRENT;
-	blkdev_dequeue_request(current_request);
-	if (MINOR(current_request->rq_dev) >= max_loop)
-		goto error_out;
-	lo = &loop_dev[MINOR(current_request->rq_dev)];
-	if (!lo->lo_dentry || !lo->transfer)
-		goto error_out;
-	if (current_request->cmd == WRITE) {
-		if (lo->lo_flags & LO_FLAGS_READ_ONLY)
-			goto error_out;
-	} else if (current_request->cmd != READ) {
-		printk(KERN_ERR "unknown loop device command (%d)?!?",
-		       current_request->cmd);
-		goto error_out;
+	if (blksize_size[MAJOR(lo->lo_device)]) {
+		blksize = blksize_size[MAJOR(lo->lo_device)][MINOR(lo->lo_device)];
+		if (!blksize)
+			blksize = BLOCK_SIZE;
 	}
+	return blksize;
+}
+
+/*
+ * Device block backing file block 'block', or 0 for a hole.  Holes are
+ * not cached: they get filled by writes through lo_send().
+ */
+static int loop_bmap(struct loop_device *lo, int block)
+{
+	int phys;
+
+	if (block < lo->lo_bmap_size && lo->lo_bmap[block])
+		return lo->lo_bmap[block];
+	phys = bmap(lo->lo_dentry->d_inode, block);
+	if (block < lo->lo_bmap_size)
+		lo->lo_bmap[block] = phys;
+	return phys;
+}
 
-	dest_addr = current_request->buffer;
-	len = current_request->current_nr_sectors << 9;
+/*
+ * Point bh at the backing device if it can be done without copying.
+ * Returns 1 if the buffer was remapped.
+ */
+static int loop_remap(struct loop_device *lo, struct buffer_head *bh)
+{
+	loff_t pos;
+	int block, last, phys, i, bits;
 
-	blksize = BLOCK_SIZE;
-	if (blksize_size[MAJOR(lo->lo_device)]) {
-	    blksize = blksize_size[MAJOR(lo->lo_device)][MINOR(lo->lo_device)];
-	    if (!blksize)
-	      blksize = BLOCK_SIZE;
+	if (!(lo->lo_flags & LO_FLAGS_BH_REMAP) || lo->lo_encrypt_type)
+		return 0;
+	if (lo->lo_offset & 511)
+		return 0;
+
+	pos = ((loff_t)bh->b_rsector << 9) + lo->lo_offset;
+	if (!lo->lo_backing_file) {
+		bh->b_rdev = lo->lo_device;
+		bh->b_rsector = pos >> 9;
+		return 1;
 	}
 
-	if (lo->lo_flags & LO_FLAGS_DO_BMAP)
-		goto file_backed;
+	/* The buffer must sit on contiguous, allocated file blocks */
+	bits = lo->lo_blkbits;
+	block = pos >> bits;
+	last = (pos + bh->b_size - 1) >> bits;
+	phys = loop_bmap(lo, block);
+	if (!phys)
+		return 0;
+	for (i = 1; block + i <= last; i++)
+		if (loop_bmap(lo, block + i) != phys + i)
+			return 0;
+
+	bh->b_rdev = lo->lo_device;
+	bh->b_rsector = ((unsigned long)phys << (bits - 9)) +
+			((pos & ((1 << bits) - 1)) >> 9);
+	return 1;
+}
+
+static int lo_transfer_device(struct loop_device *lo, int rw, char *data,
+	int len, unsigned long sector)
+{
+	struct buffer_head *bh;
+	int block, offset, size, blksize;
 
+	blksize = loop_get_blksize(lo);
 	if (blksize < 512) {
-		block = current_request->sector * (512/blksize);
+		block = sector * (512/blksize);
 		offset = 0;
 	} else {
-		block = current_request->sector / (blksize >> 9);
-		offset = (current_request->sector % (blksize >> 9)) << 9;
+		block = sector / (blksize >> 9);
+		offset = (sector % (blksize >> 9)) << 9;
 	}
 	block += lo->lo_offset / blksize;
 	offset += lo->lo_offset % blksize;
@@ -321,7 +364,6 @@ repeat:
 		block++;
 		offset -= blksize;
 	}
-	spin_unlock_irq(&io_request_lock);
 
 	while (len > 0) {
 
@@ -334,62 +376,205 @@ repeat:
 			printk(KERN_ERR "loop: device %s: getblk(-, %d, %d) returned NULL",
 				kdevname(lo->lo_device),
 				block, blksize);
-			goto error_out_lock;
+			return -1;
 		}
-		if (!buffer_uptodate(bh) && ((current_request->cmd == READ) ||
+		if (!buffer_uptodate(bh) && ((rw == READ) ||
 					(offset || (len < blksize)))) {
 			ll_rw_block(READ, 1, &bh);
 			wait_on_buffer(bh);
 			if (!buffer_uptodate(bh)) {
 				brelse(bh);
-				goto error_out_lock;
+				return -1;
 			}
 		}
 
-		if ((lo->transfer)(lo, current_request->cmd,
-				   bh->b_data + offset,
-				   dest_addr, size, block)) {
+		if ((lo->transfer)(lo, rw, bh->b_data + offset,
+				   data, size, block)) {
 			printk(KERN_ERR "loop: transfer error block %d\n",
 			       block);
 			brelse(bh);
-			goto error_out_lock;
+			return -1;
 		}
 
-		if (current_request->cmd == WRITE) {
+		if (rw == WRITE) {
 			mark_buffer_uptodate(bh, 1);
 			mark_buffer_dirty(bh);
 		}
 		brelse(bh);
-		dest_addr += size;
+		data += size;
 		len -= size;
 		offset = 0;
 		block++;
 	}
-	goto done;
-
-file_backed:
-	pos = ((loff_t)current_request->sector << 9) + lo->lo_offset;
-	spin_unlock_irq(&io_request_lock);
-	if (current_request->cmd == WRITE) {
-		if (lo_send(lo, dest_addr, len, pos, blksize))
-			goto error_out_lock;
-	} else {
-		if (lo_receive(lo, dest_addr, len, pos, blksize))
-			goto error_out_lock;
+	return 0;
+}
+
+static int lo_transfer_file(struct loop_device *lo, int rw, char *data,
+	int len, unsigned long sector)
+{
+	loff_t pos = ((loff_t)sector << 9) + lo->lo_offset;
+	int blksize = loop_get_blksize(lo);
+
+	if (rw == READ)
+		return lo_receive(lo, data, len, pos, blksize);
+	if (lo_send(lo, data, len, pos, blksize))
+		return -1;
+
+	/*
+	 * Remapped buffers go around the page cache, so what we just
+	 * wrote there (usually into a hole) must reach the disk before
+	 * a remapped read or write can touch the same blocks.
+	 */
+	if (lo->lo_flags & LO_FLAGS_BH_REMAP)
+		return generic_buffer_fdatasync(lo->lo_dentry->d_inode,
+				pos >> PAGE_CACHE_SHIFT,
+				((pos + len - 1) >> PAGE_CACHE_SHIFT) + 1);
+	return 0;
+}
+
+static void loop_handle_bh(struct loop_device *lo, int rw,
+	struct buffer_head *bh)
+{
+	char *data;
+	int ret;
+
+	data = bh_kmap(bh);
+	if (lo->lo_backing_file)
+		ret = lo_transfer_file(lo, rw, data, bh->b_size, bh->b_rsector);
+	else
+		ret = lo_transfer_device(lo, rw, data, bh->b_size, bh->b_rsector);
+	bh_kunmap(bh);
+	bh->b_end_io(bh, !ret);
+}
+
+static int loop_make_request(request_queue_t *q, int rw, struct buffer_head *bh)
+{
+	struct loop_device *lo;
+	unsigned long flags;
+
+	if (MINOR(bh->b_rdev) >= max_loop)
+		goto out;
+	lo = &loop_dev[MINOR(bh->b_rdev)];
+	if (rw == READA)
+		rw = READ;
+	else if (rw == WRITE) {
+		if (lo->lo_flags & LO_FLAGS_READ_ONLY)
+			goto out;
+	} else if (rw != READ) {
+		printk(KERN_ERR "unknown loop device command (%d)?!?\n", rw);
+		goto out;
+	}
+	if (lo->lo_state != Lo_bound)
+		goto out;
+
+	if (loop_remap(lo, bh))
+		return 1;
+
+	spin_lock_irqsave(&lo->lo_lock, flags);
+	if (lo->lo_state != Lo_bound) {
+		spin_unlock_irqrestore(&lo->lo_lock, flags);
+		goto out;
+	}
+	atomic_inc(&lo->lo_pending);
+	bh->b_reqnext = NULL;
+	if (lo->lo_bhtail[rw])
+		lo->lo_bhtail[rw]->b_reqnext = bh;
+	else
+		lo->lo_bh[rw] = bh;
+	lo->lo_bhtail[rw] = bh;
+	spin_unlock_irqrestore(&lo->lo_lock, flags);
+	up(&lo->lo_bh_mutex);
+	return 0;
+
+out:
+	buffer_IO_error(bh);
+	return 0;
+}
+
+/*
+ * Take every buffer queued in one direction; the thread works through
+ * them as one batch.
+ */
+static struct buffer_head *loop_get_bhs(struct loop_device *lo, int rw)
+{
+	struct buffer_head *bh;
+
+	spin_lock_irq(&lo->lo_lock);
+	bh = lo->lo_bh[rw];
+	lo->lo_bh[rw] = lo->lo_bhtail[rw] = NULL;
+	spin_unlock_irq(&lo->lo_lock);
+	return bh;
+}
+
+/*
+ * Worker thread for buffers that can't be remapped.  lo_pending counts
+ * the queued buffers plus one for the thread itself, which
+ * loop_clr_fd() drops; the thread exits once it reaches zero.
+ */
+static int loop_thread(void *data)
+{
+	struct loop_device *lo = data;
+	struct buffer_head *bh, *next;
+	int rw;
+
+	daemonize();
+	sprintf(current->comm, "loop%d", lo->lo_number);
+
+	spin_lock_irq(&current->sigmask_lock);
+	sigfillset(&current->blocked);
+	flush_signals(current);
+	spin_unlock_irq(&current->sigmask_lock);
+
+	current->policy = SCHED_OTHER;
+	current->nice = -20;
+
+	atomic_inc(&lo->lo_pending);
+	lo->lo_state = Lo_bound;
+	up(&lo->lo_sem);
+
+	for (;;) {
+		down(&lo->lo_bh_mutex);
+		if (!atomic_read(&lo->lo_pending))
+			break;
+		for (rw = READ; rw <= WRITE; rw++) {
+			bh = loop_get_bhs(lo, rw);
+			while (bh) {
+				next = bh->b_reqnext;
+				bh->b_reqnext = NULL;
+				loop_handle_bh(lo, rw, bh);
+				bh = next;
+				if (atomic_dec_and_test(&lo->lo_pending))
+					goto out;
+			}
+		}
 	}
-done:
-	spin_lock_irq(&io_request_lock);
-	current_request->sector += current_request->current_nr_sectors;
-	current_request->nr_sectors -= current_request->current_nr_sectors;
-	list_add(&current_request->queue, &q->queue_head);
-	end_request(1);
-	goto repeat;
-error_out_lock:
-	spin_lock_irq(&io_request_lock);
-error_out:
-	list_add(&current_request->queue, &q->queue_head);
-	end_request(0);
-	goto repeat;
+out:
+	up(&lo->lo_sem);
+	return 0;
+}
+
+/*
+ * Remapped buffers bypass the backing file's page cache: push out
+ * anything dirty in it and drop what we can, then set up the block map.
+ */
+static void loop_init_bmap(struct loop_device *lo, struct inode *inode)
+{
+	int size;
+
+	down(&inode->i_sem);
+	generic_buffer_fdatasync(inode, 0, ~0UL);
+	up(&inode->i_sem);
+	invalidate_inode_pages(inode);
+
+	lo->lo_blkbits = inode->i_sb->s_blocksize_bits;
+	size = (inode->i_size + (1 << lo->lo_blkbits) - 1) >> lo->lo_blkbits;
+	if (size > MAX_BMAP_ENTRIES)
+		size = MAX_BMAP_ENTRIES;
+	lo->lo_bmap = vmalloc(size * sizeof(int));
+	if (!lo->lo_bmap)
+		return;
+	memset(lo->lo_bmap, 0, size * sizeof(int));
+	lo->lo_bmap_size = size;
 }
 
 static int loop_set_fd(struct loop_device *lo, kdev_t dev, unsigned int arg)
@@ -418,7 +603,7 @@ static int loop_set_fd(struct loop_device *lo, kdev_t dev, unsigned int arg)
 				   file->f_flags, BDEV_FILE);
 
 		lo->lo_device = inode->i_rdev;
-		lo->lo_flags = 0;
+		lo->lo_flags = LO_FLAGS_BH_REMAP;
 
 		/* Backed by a block device - don't need to hold onto
 		   a file structure */
@@ -454,6 +639,8 @@ static int loop_set_fd(struct loop_device *lo, kdev_t dev, unsigned int arg)
 
 		lo->lo_device = inode->i_dev;
 		lo->lo_flags |= LO_FLAGS_DO_BMAP;
+		if (aops->bmap)
+			lo->lo_flags |= LO_FLAGS_BH_REMAP;
 
 		error = -ENFILE;
 		lo->lo_backing_file = get_empty_filp();
@@ -473,7 +660,8 @@ static int loop_set_fd(struct loop_device *lo, kdev_t dev, unsigned int arg)
 		file_moveto(lo->lo_backing_file, file);
 
 		error = 0;
-	}
+	} else
+		goto out_putf;
 
 	if (IS_RDONLY (inode) || is_read_only(lo->lo_device))
 		lo->lo_flags |= LO_FLAGS_READ_ONLY;
@@ -485,6 +673,17 @@ static int loop_set_fd(struct loop_device *lo, kdev_t dev, unsigned int arg)
 	lo->ioctl = NULL;
 	figure_loop_size(lo);
 
+	if ((lo->lo_flags & LO_FLAGS_BH_REMAP) && lo->lo_backing_file)
+		loop_init_bmap(lo, inode);
+
+	lo->lo_bh[READ] = lo->lo_bhtail[READ] = NULL;
+	lo->lo_bh[WRITE] = lo->lo_bhtail[WRITE] = NULL;
+	atomic_set(&lo->lo_pending, 0);
+	init_MUTEX_LOCKED(&lo->lo_sem);
+	init_MUTEX_LOCKED(&lo->lo_bh_mutex);
+	kernel_thread(loop_thread, lo, CLONE_FS | CLONE_FILES | CLONE_SIGHAND);
+	down(&lo->lo_sem);
+
  out_putf:
 	fput(file);
  out:
@@ -532,9 +731,26 @@ static int loop_clr_fd(struct loop_device *lo, kdev_t dev)
 	if (lo->lo_refcnt > 1)	/* we needed one fd for the ioctl */
 		return -EBUSY;
 
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_state = Lo_rundown;
+	if (atomic_dec_and_test(&lo->lo_pending))
+		up(&lo->lo_bh_mutex);
+	spin_unlock_irq(&lo->lo_lock);
+	down(&lo->lo_sem);
+	lo->lo_state = Lo_unbound;
+
 	if (S_ISBLK(dentry->d_inode->i_mode))
 		blkdev_put(dentry->d_inode->i_bdev, BDEV_FILE);
 
+	/* Remapped writes went around the page cache */
+	if (lo->lo_flags & LO_FLAGS_BH_REMAP)
+		invalidate_inode_pages(dentry->d_inode);
+	if (lo->lo_bmap) {
+		vfree(lo->lo_bmap);
+		lo->lo_bmap = NULL;
+		lo->lo_bmap_size = 0;
+	}
+
 	lo->lo_dentry = NULL;
 
 	if (lo->lo_backing_file != NULL) {
@@ -601,6 +817,12 @@ static int loop_set_status(struct loop_device *lo, struct loop_info *arg)
 		       info.lo_encrypt_key_size);
 		lo->lo_key_owner = current->uid; 
 	}	
+	/*
+	 * A transfer function turns remapping off: drop page cache that
+	 * remapped writes have made stale.
+	 */
+	if (lo->lo_backing_file && (lo->lo_flags & LO_FLAGS_BH_REMAP))
+		invalidate_inode_pages(lo->lo_dentry->d_inode);
 	figure_loop_size(lo);
 	return 0;
 }
@@ -767,10 +989,6 @@ int loop_unregister_transfer(int number)
 EXPORT_SYMBOL(loop_register_transfer);
 EXPORT_SYMBOL(loop_unregister_transfer);
 
-static void no_plug_device(request_queue_t *q, kdev_t device)
-{
-}
-
 int __init loop_init(void) 
 {
 	int	i;
@@ -814,12 +1032,11 @@ int __init loop_init(void)
 		return -ENOMEM;
 	}		
 
-	blk_init_queue(BLK_DEFAULT_QUEUE(MAJOR_NR), DEVICE_REQUEST);
-	blk_queue_pluggable(BLK_DEFAULT_QUEUE(MAJOR_NR), no_plug_device);
-	blk_queue_headactive(BLK_DEFAULT_QUEUE(MAJOR_NR), 0);
+	blk_queue_make_request(BLK_DEFAULT_QUEUE(MAJOR_NR), loop_make_request);
 	for (i=0; i < max_loop; i++) {
 		memset(&loop_dev[i], 0, sizeof(struct loop_device));
 		loop_dev[i].lo_number = i;
+		spin_lock_init(&loop_dev[i].lo_lock);
 	}
 	memset(loop_sizes, 0, max_loop * sizeof(int));
 	memset(loop_blksizes, 0, max_loop * sizeof(int));
@@ -838,7 +1055,6 @@ void cleanup_module(void)
 	if (devfs_unregister_blkdev(MAJOR_NR, "loop") != 0)
 		printk(KERN_WARNING "loop: cannot unregister blkdev\n");
 
-	blk_cleanup_queue(BLK_DEFAULT_QUEUE(MAJOR_NR));
 	kfree (loop_dev);
 	kfree (loop_sizes);
 	kfree (loop_blksizes);
@@ -18,6 +18,10 @@
  * 97-9-13 Cosmetic changes
  * 98-5-13 Attempt to make 64-bit-clean on 64-bit machines
  * 99-1-11 Attempt to make 64-bit-clean on 32-bit machines <ankry@mif.pg.gda.pl>
+ * 01-1-15 Requests are pipelined: a sender thread per device keeps them
+ *   in flight, striped over up to NBD_MAX_CONN connections (NBD_ADD_SOCK),
+ *   and a receiver thread per connection matches replies by handle.
+ *   Whole requests go over the wire, not just their first buffer.
  *
  * possible FIXME: make set_sock / set_blksize / set_size / do_it one syscall
  * why not: would need verify_area and friends, would share yet another 
@@ -143,9 +147,25 @@ static int nbd_xmit(int send, struct socket *sock, char *buf, int size)
 	return result;
 }
 
+/*
+ * Send or receive the data of a whole request, buffer by buffer.
+ */
+static int nbd_xmit_req(int send, struct socket *sock, struct request *req)
+{
+	struct buffer_head *bh;
+	int result = 1;
+
+	for (bh = req->bh; bh; bh = bh->b_reqnext) {
+		result = nbd_xmit(send, sock, bh->b_data, bh->b_size);
+		if (result <= 0)
+			break;
+	}
+	return result;
+}
+
 #define FAIL( s ) { printk( KERN_ERR "NBD: " s "(result %d)\n", result ); goto error_out; }
 
-void nbd_send_req(struct socket *sock, struct request *req)
+int nbd_send_req(struct socket *sock, struct request *req)
 {
 	int result;
 	struct nbd_request request;
@@ -154,7 +174,7 @@ void nbd_send_req(struct socket *sock, struct request *req)
 	request.magic = htonl(NBD_REQUEST_MAGIC);
 	request.type = htonl(req->cmd);
 	request.from = cpu_to_be64( (u64) req->sector << 9);
-	request.len = htonl(req->current_nr_sectors << 9);
+	request.len = htonl(req->nr_sectors << 9);
 	memcpy(request.handle, &req, sizeof(req));
 
 	result = nbd_xmit(1, sock, (char *) &request, sizeof(request));
@@ -163,18 +183,41 @@ void nbd_send_req(struct socket *sock, struct request *req)
 
 	if (req->cmd == WRITE) {
 		DEBUG("data, ");
-		result = nbd_xmit(1, sock, req->buffer, req->current_nr_sectors << 9);
+		result = nbd_xmit_req(1, sock, req);
 		if (result <= 0)
 			FAIL("Send data failed.");
 	}
-	return;
+	return 0;
 
       error_out:
 	req->errors++;
+	return -EIO;
+}
+
+/*
+ * Find the request a reply is for and take it off the connection.
+ */
+static struct request *nbd_find_request(struct nbd_device *lo,
+					struct nbd_conn *conn,
+					struct request *xreq)
+{
+	struct list_head *entry;
+	struct request *req = NULL;
+
+	spin_lock_irq(&lo->lock);
+	list_for_each(entry, &conn->inflight) {
+		if (blkdev_entry_to_request(entry) == xreq) {
+			req = xreq;
+			list_del(&req->queue);
+			break;
+		}
+	}
+	spin_unlock_irq(&lo->lock);
+	return req;
 }
 
 #define HARDFAIL( s ) { printk( KERN_ERR "NBD: " s "(result %d)\n", result ); lo->harderror = result; return NULL; }
-struct request *nbd_read_stat(struct nbd_device *lo)
+struct request *nbd_read_stat(struct nbd_device *lo, struct nbd_conn *conn)
 		/* NULL returned = something went wrong, inform userspace       */ 
 {
 	int result;
@@ -183,25 +226,28 @@ struct request *nbd_read_stat(struct nbd_device *lo)
 
 	DEBUG("reading control, ");
 	reply.magic = 0;
-	result = nbd_xmit(0, lo->sock, (char *) &reply, sizeof(reply));
+	result = nbd_xmit(0, conn->sock, (char *) &reply, sizeof(reply));
 	if (result <= 0)
 		HARDFAIL("Recv control failed.");
+	if (ntohl(reply.magic) != NBD_REPLY_MAGIC)
+		HARDFAIL("Not enough magic.");
 	memcpy(&xreq, reply.handle, sizeof(xreq));
-	req = blkdev_entry_prev_request(&lo->queue_head);
-
-	if (xreq != req)
-		FAIL("Unexpected handle received.\n");
+	result = -EBADMSG;
+	req = nbd_find_request(lo, conn, xreq);
+	if (!req)
+		HARDFAIL("Unexpected handle received.");
 
 	DEBUG("ok, ");
-	if (ntohl(reply.magic) != NBD_REPLY_MAGIC)
-		HARDFAIL("Not enough magic.");
 	if (ntohl(reply.error))
 		FAIL("Other side returned error.");
 	if (req->cmd == READ) {
 		DEBUG("data, ");
-		result = nbd_xmit(0, lo->sock, req->buffer, req->current_nr_sectors << 9);
-		if (result <= 0)
+		result = nbd_xmit_req(0, conn->sock, req);
+		if (result <= 0) {
+			req->errors++;
+			nbd_end_request(req);
 			HARDFAIL("Recv data failed.");
+		}
 	}
 	DEBUG("done.\n");
 	return req;
@@ -212,51 +258,153 @@ struct request *nbd_read_stat(struct nbd_device *lo)
 	return req;
 }
 
-void nbd_do_it(struct nbd_device *lo)
+static void nbd_fail_list(struct list_head *head)
 {
 	struct request *req;
-	int dequeued;
 
-	down (&lo->queue_lock);
-	while (1) {
-		up (&lo->queue_lock);
-		req = nbd_read_stat(lo);
-		down (&lo->queue_lock);
+	while (!list_empty(head)) {
+		req = blkdev_entry_next_request(head);
+		list_del(&req->queue);
+		req->errors++;
+		nbd_end_request(req);
+	}
+}
 
-		if (!req) {
-			printk(KERN_ALERT "req should never be null\n" );
-			goto out;
-		}
+/*
+ * Stop using a connection: nothing more is sent on it and whatever
+ * still waits for a reply on it has failed.
+ */
+static void nbd_kill_conn(struct nbd_device *lo, struct nbd_conn *conn)
+{
+	LIST_HEAD(dead);
+
+	spin_lock_irq(&lo->lock);
+	conn->dead = 1;
+	list_splice(&conn->inflight, &dead);
+	INIT_LIST_HEAD(&conn->inflight);
+	spin_unlock_irq(&lo->lock);
+
+	conn->sock->ops->shutdown(conn->sock, 2);
+	nbd_fail_list(&dead);
+}
+
+static void nbd_daemonize(char *fmt, int dev, int nr)
+{
+	daemonize();
+	sprintf(current->comm, fmt, dev, nr);
+
+	spin_lock_irq(&current->sigmask_lock);
+	sigfillset(&current->blocked);
+	flush_signals(current);
+	spin_unlock_irq(&current->sigmask_lock);
+}
+
+/*
+ * One receiver per connection.  Replies can come back in any order;
+ * they are matched to their request by handle.
+ */
+static int nbd_recv_thread(void *arg)
+{
+	struct nbd_conn *conn = arg;
+	struct nbd_device *lo = conn->lo;
+	struct request *req;
+
+	nbd_daemonize("nbd%d.%d", (int) (lo - nbd_dev), (int) (conn - lo->conn));
+
+	while ((req = nbd_read_stat(lo, conn)) != NULL) {
 #ifdef PARANOIA
-		if (req != blkdev_entry_prev_request(&lo->queue_head)) {
-			printk(KERN_ALERT "NBD: I have problem...\n");
-		}
 		if (lo != &nbd_dev[MINOR(req->rq_dev)]) {
 			printk(KERN_ALERT "NBD: request corrupted!\n");
 			continue;
 		}
 		if (lo->magic != LO_MAGIC) {
 			printk(KERN_ALERT "NBD: nbd_dev[] corrupted: Not enough magic\n");
-			goto out;
+			break;
 		}
 #endif
-		list_del(&req->queue);
-		up (&lo->queue_lock);
-		
-		dequeued = nbd_end_request(req);
+		nbd_end_request(req);
+	}
+
+	nbd_kill_conn(lo, conn);
+
+	spin_lock_irq(&lo->lock);
+	lo->nlive--;
+	spin_unlock_irq(&lo->lock);
+	wake_up(&lo->recv_wait);
+	wake_up(&lo->send_wait);
+	return 0;
+}
+
+/*
+ * Next connection to stripe a request over, or NULL when they have
+ * all died.  Called with lo->lock held.
+ */
+static struct nbd_conn *nbd_pick_conn(struct nbd_device *lo)
+{
+	int i;
 
-		down (&lo->queue_lock);
-		if (!dequeued)
-			list_add(&req->queue, &lo->queue_head);
+	for (i = 0; i < lo->nconn; i++) {
+		struct nbd_conn *conn = &lo->conn[lo->next_conn];
+
+		if (++lo->next_conn >= lo->nconn)
+			lo->next_conn = 0;
+		if (!conn->dead)
+			return conn;
 	}
- out:
-	up (&lo->queue_lock);
+	return NULL;
 }
 
-void nbd_clear_que(struct nbd_device *lo)
+/*
+ * The sender keeps the pipe full: requests go out as soon as they are
+ * queued, without waiting for earlier replies.
+ */
+static int nbd_send_thread(void *arg)
 {
+	struct nbd_device *lo = arg;
+	struct nbd_conn *conn;
 	struct request *req;
-	int dequeued;
+
+	nbd_daemonize("nbd%d", (int) (lo - nbd_dev), 0);
+	up(&lo->sender_sem);
+
+	for (;;) {
+		wait_event(lo->send_wait,
+			   !list_empty(&lo->queue_head) || lo->sender_stop);
+
+		spin_lock_irq(&lo->lock);
+		if (list_empty(&lo->queue_head)) {
+			spin_unlock_irq(&lo->lock);
+			if (lo->sender_stop)
+				break;
+			continue;
+		}
+		req = blkdev_entry_next_request(&lo->queue_head);
+		list_del(&req->queue);
+		conn = nbd_pick_conn(lo);
+		if (!conn || lo->sender_stop) {
+			spin_unlock_irq(&lo->lock);
+			req->errors++;
+			nbd_end_request(req);
+			continue;
+		}
+		/* on the list before the reply can possibly arrive */
+		list_add_tail(&req->queue, &conn->inflight);
+		spin_unlock_irq(&lo->lock);
+
+		down(&conn->tx_sem);
+		if (nbd_send_req(conn->sock, req))
+			/* the receiver fails req along with the rest */
+			conn->sock->ops->shutdown(conn->sock, 2);
+		up(&conn->tx_sem);
+	}
+
+	up(&lo->sender_sem);
+	return 0;
+}
+
+void nbd_clear_que(struct nbd_device *lo)
+{
+	LIST_HEAD(queued);
 
 #ifdef PARANOIA
 	if (lo->magic != LO_MAGIC) {
@@ -265,28 +413,12 @@ void nbd_clear_que(struct nbd_device *lo)
 	}
 #endif
 
-	while (!list_empty(&lo->queue_head)) {
-		req = blkdev_entry_prev_request(&lo->queue_head);
-#ifdef PARANOIA
-		if (!req) {
-			printk( KERN_ALERT "NBD: panic, panic, panic\n" );
-			break;
-		}
-		if (lo != &nbd_dev[MINOR(req->rq_dev)]) {
-			printk(KERN_ALERT "NBD: request corrupted when clearing!\n");
-			continue;
-		}
-#endif
-		req->errors++;
-		list_del(&req->queue);
-		up(&lo->queue_lock);
-
-		dequeued = nbd_end_request(req);
+	spin_lock_irq(&lo->lock);
+	list_splice(&lo->queue_head, &queued);
+	INIT_LIST_HEAD(&lo->queue_head);
+	spin_unlock_irq(&lo->lock);
 
-		down(&lo->queue_lock);
-		if (!dequeued)
-			list_add(&req->queue, &lo->queue_head);
-	}
+	nbd_fail_list(&queued);
 }
 
 /*
@@ -299,6 +431,10 @@ void nbd_clear_que(struct nbd_device *lo)
 #undef FAIL
 #define FAIL( s ) { printk( KERN_ERR "NBD, minor %d: " s "\n", dev ); goto error_out; }
 
+/*
+ * Called with io_request_lock held: only hand the requests to the
+ * sender thread, never touch the network here.
+ */
 static void do_nbd_request(request_queue_t * q)
 {
 	struct request *req;
@@ -317,7 +453,7 @@ static void do_nbd_request(request_queue_t * q)
 			FAIL("Minor too big.");		/* Probably can not happen */
 #endif
 		lo = &nbd_dev[dev];
-		if (!lo->file)
+		if (!lo->nconn)
 			FAIL("Request when not-ready.");
 		if ((req->cmd == WRITE) && (lo->flags & NBD_READ_ONLY))
 			FAIL("Write on read-only");
@@ -328,14 +464,11 @@ static void do_nbd_request(request_queue_t * q)
 #endif
 		req->errors = 0;
 		blkdev_dequeue_request(req);
-		spin_unlock_irq(&io_request_lock);
-
-		down (&lo->queue_lock);
-		list_add(&req->queue, &lo->queue_head);
-		nbd_send_req(lo->sock, req);	/* Why does this block?         */
-		up (&lo->queue_lock);
 
-		spin_lock_irq(&io_request_lock);
+		spin_lock(&lo->lock);
+		list_add_tail(&req->queue, &lo->queue_head);
+		spin_unlock(&lo->lock);
+		wake_up(&lo->send_wait);
 		continue;
 
 	      error_out:
@@ -348,11 +481,93 @@ static void do_nbd_request(request_queue_t * q)
 	return;
 }
 
+static int nbd_add_sock(struct nbd_device *lo, unsigned long arg)
+{
+	struct nbd_conn *conn;
+	struct file *file;
+	struct inode *inode;
+	int error;
+
+	if (lo->nconn >= NBD_MAX_CONN)
+		return -EBUSY;
+	file = fget(arg);
+	if (!file)
+		return -EINVAL;
+	inode = file->f_dentry->d_inode;
+	if (!inode->i_sock) {
+		fput(file);
+		return -ENOTSOCK;
+	}
+
+	if (!lo->nconn) {
+		lo->harderror = 0;
+		lo->next_conn = 0;
+		lo->sender_stop = 0;
+		error = kernel_thread(nbd_send_thread, lo,
+				      CLONE_FS | CLONE_FILES | CLONE_SIGHAND);
+		if (error < 0) {
+			fput(file);
+			return error;
+		}
+		down(&lo->sender_sem);
+	}
+
+	conn = &lo->conn[lo->nconn];
+	conn->lo = lo;
+	conn->file = file;
+	conn->sock = &inode->u.socket_i;
+	conn->dead = 0;
+	INIT_LIST_HEAD(&conn->inflight);
+	init_MUTEX(&conn->tx_sem);
+
+	spin_lock_irq(&lo->lock);
+	lo->nlive++;
+	lo->nconn++;
+	spin_unlock_irq(&lo->lock);
+
+	error = kernel_thread(nbd_recv_thread, conn,
+			      CLONE_FS | CLONE_FILES | CLONE_SIGHAND);
+	if (error < 0) {
+		nbd_kill_conn(lo, conn);
+		spin_lock_irq(&lo->lock);
+		lo->nlive--;
+		spin_unlock_irq(&lo->lock);
+		return error;
+	}
+	return 0;
+}
+
+static int nbd_clear_sock(struct nbd_device *lo)
+{
+	int i;
+
+	if (!lo->nconn)
+		return -EINVAL;
+
+	/* Receivers fail what is in flight on their way out */
+	for (i = 0; i < lo->nconn; i++)
+		lo->conn[i].sock->ops->shutdown(lo->conn[i].sock, 2);
+	wait_event(lo->recv_wait, !lo->nlive);
+
+	lo->sender_stop = 1;
+	wake_up(&lo->send_wait);
+	down(&lo->sender_sem);
+	nbd_clear_que(lo);
+
+	for (i = 0; i < lo->nconn; i++) {
+		fput(lo->conn[i].file);
+		lo->conn[i].file = NULL;
+		lo->conn[i].sock = NULL;
+	}
+	lo->nconn = 0;
+	return 0;
+}
+
 static int nbd_ioctl(struct inode *inode, struct file *file,
 		     unsigned int cmd, unsigned long arg)
 {
 	struct nbd_device *lo;
-	int dev, error, temp;
+	int dev, temp, i;
 	struct request sreq ;
 
 	/* Anyone capable of this syscall can do *real bad* things */
@@ -370,39 +585,28 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 	case NBD_DISCONNECT:
 	        printk("NBD_DISCONNECT\n") ;
                 sreq.cmd=2 ; /* shutdown command */
-                if (!lo->sock) return -EINVAL ;
-                nbd_send_req(lo->sock,&sreq) ;
+                sreq.bh=NULL ;
+                sreq.sector=sreq.nr_sectors=0 ;
+                if (!lo->nconn) return -EINVAL ;
+                for (i = 0; i < lo->nconn; i++) {
+                        if (lo->conn[i].dead)
+                                continue;
+                        down(&lo->conn[i].tx_sem);
+                        nbd_send_req(lo->conn[i].sock,&sreq) ;
+                        up(&lo->conn[i].tx_sem);
+                }
                 return 0 ;
  
 	case NBD_CLEAR_SOCK:
-		down(&lo->queue_lock);
-		nbd_clear_que(lo);
-		if (!list_empty(&lo->queue_head)) {
-			up(&lo->queue_lock);
-			printk(KERN_ERR "nbd: Some requests are in progress -> can not turn off.\n");
-			return -EBUSY;
-		}
-		up(&lo->queue_lock);
-		file = lo->file;
-		if (!file)
-			return -EINVAL;
-		lo->file = NULL;
-		lo->sock = NULL;
-		fput(file);
-		return 0;
+		return nbd_clear_sock(lo);
 	case NBD_SET_SOCK:
-		if (lo->file)
+		if (lo->nconn)
 			return -EBUSY;
-		error = -EINVAL;
-		file = fget(arg);
-		if (file) {
-			inode = file->f_dentry->d_inode;
-			/* N.B. Should verify that it's a socket */
-			lo->file = file;
-			lo->sock = &inode->u.socket_i;
-			error = 0;
-		}
-		return error;
+		return nbd_add_sock(lo, arg);
+	case NBD_ADD_SOCK:
+		if (!lo->nconn)
+			return -EINVAL;
+		return nbd_add_sock(lo, arg);
 	case NBD_SET_BLKSIZE:
 		if ((arg & (arg-1)) || (arg < 512) || (arg > PAGE_SIZE))
 			return -EINVAL;
@@ -425,9 +629,11 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		nbd_bytesizes[dev] = ((u64) arg) << nbd_blksize_bits[dev];
 		return 0;
 	case NBD_DO_IT:
-		if (!lo->file)
+		/* The threads do the work; wait until the last connection dies */
+		if (!lo->nconn)
 			return -EINVAL;
-		nbd_do_it(lo);
+		if (wait_event_interruptible(lo->recv_wait, !lo->nlive))
+			return -EINTR;
 		return lo->harderror;
 	case NBD_CLEAR_QUE:
 		nbd_clear_que(lo);
@@ -505,11 +711,14 @@ int nbd_init(void)
 	blk_queue_headactive(BLK_DEFAULT_QUEUE(MAJOR_NR), 0);
 	for (i = 0; i < MAX_NBD; i++) {
 		nbd_dev[i].refcnt = 0;
-		nbd_dev[i].file = NULL;
+		nbd_dev[i].nconn = 0;
 		nbd_dev[i].magic = LO_MAGIC;
 		nbd_dev[i].flags = 0;
 		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
-		init_MUTEX(&nbd_dev[i].queue_lock);
+		spin_lock_init(&nbd_dev[i].lock);
+		init_waitqueue_head(&nbd_dev[i].send_wait);
+		init_waitqueue_head(&nbd_dev[i].recv_wait);
+		init_MUTEX_LOCKED(&nbd_dev[i].sender_sem);
 		nbd_blksizes[i] = 1024;
 		nbd_blksize_bits[i] = 10;
 		nbd_bytesizes[i] = 0x7ffffc00; /* 2GB */
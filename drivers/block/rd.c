@@ -40,6 +40,11 @@
  *
  * Make block size and block size shift for RAM disks a global macro
  * and set blk_size for -ENOSPC,     Werner Fink <werner@suse.de>, Apr '99
+ *
+ * Keep the RAM disk data in a page store of its own rather than in
+ * protected buffer cache buffers, so that cached copies of it are
+ * freeable like those of any other disk.  Pages written with zeroes
+ * are given back.
  */
 
 #include <linux/config.h>
@@ -54,6 +59,10 @@
 #include <linux/mm.h>
 #include <linux/mman.h>
 #include <linux/malloc.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/bio.h>
+#include <linux/spinlock.h>
 #include <linux/ioctl.h>
 #include <linux/fd.h>
 #include <linux/module.h>
@@ -101,6 +110,8 @@ static int rd_blocksizes[NUM_RAMDISKS];		/* Size of 1024 byte blocks :)  */
 static int rd_kbsize[NUM_RAMDISKS];		/* Size in blocks of 1024 bytes */
 static devfs_handle_t devfs_handle;
 static struct inode *rd_inode[NUM_RAMDISKS];	/* Protected device inodes */
+static struct page **rd_pages[NUM_RAMDISKS];	/* Page store of each RAM disk */
+static spinlock_t rd_lock[NUM_RAMDISKS];	/* Protects the page stores */
 
 /*
  * Parameters for the boot-loading of the RAM disk.  These are set by
@@ -187,62 +198,209 @@ __setup("ramdisk_blocksize=", ramdisk_blocksize);
 #endif
 
 /*
- *  Basically, my strategy here is to set up a buffer-head which can't be
- *  deleted, and make that my Ramdisk.  If the request is outside of the
- *  allocated size, we must get rid of it...
+ *  The RAM disk data lives in a page store of its own: an array of page
+ *  pointers per disk, allocated on first open, with the pages themselves
+ *  allocated on first write.  Buffers and pages cached for a filesystem
+ *  on the RAM disk are then ordinary clean copies which the VM can drop,
+ *  instead of pinned buffer cache buffers on top of the page cache.
+ *
+ *  A hole reads back as zeroes, and a page which ends up all zeroes is
+ *  freed again, so zeroing unused blocks (or BLKFLSBUF for the whole
+ *  disk) gives their memory back.
  *
  * 19-JAN-1998  Richard Gooch <rgooch@atnf.csiro.au>  Added devfs support
  *
  */
-static int rd_make_request(request_queue_t * q, int rw, struct buffer_head *sbh)
+static inline unsigned long rd_nr_pages(int minor)
 {
-	unsigned int minor;
-	unsigned long offset, len;
-	struct buffer_head *rbh;
-	char *bdata;
+	return (rd_length[minor] + PAGE_SIZE - 1) >> PAGE_SHIFT;
+}
 
-	
-	minor = MINOR(sbh->b_rdev);
+static int rd_is_zero(char *p, unsigned long len)
+{
+	unsigned long *q = (unsigned long *) p;
 
-	if (minor >= NUM_RAMDISKS)
-		goto fail;
+	for (len /= sizeof(unsigned long); len; len--)
+		if (*q++)
+			return 0;
+	return 1;
+}
 
-	
-	offset = sbh->b_rsector << 9;
-	len = sbh->b_size;
+/*
+ * Free all pages of a RAM disk; with "all" set, the page store too.
+ */
+static void rd_free_store(int minor, int all)
+{
+	struct page **slots;
+	struct page *page;
+	unsigned long i;
+
+	if ((slots = rd_pages[minor]) == NULL)
+		return;
+	for (i = 0; i < rd_nr_pages(minor); i++) {
+		spin_lock(&rd_lock[minor]);
+		page = slots[i];
+		slots[i] = NULL;
+		spin_unlock(&rd_lock[minor]);
+		if (page)
+			__free_page(page);
+	}
+	if (all) {
+		rd_pages[minor] = NULL;
+		vfree(slots);
+	}
+}
+
+/*
+ * Copy one piece of a buffer, which lies within a single page of the
+ * store.  The copy is done under the lock, so that a page found to be
+ * all zeroes can be freed without losing a write racing with it.
+ */
+static int rd_transfer(int minor, int rw, char *p, unsigned long offset, unsigned long n)
+{
+	unsigned long index = offset >> PAGE_SHIFT;
+	unsigned long poff = offset & ~PAGE_MASK;
+	struct page *page, *new = NULL, *freed = NULL;
+	char *kaddr;
+	int zero = 0;
+
+	if (rw == WRITE)
+		zero = rd_is_zero(p, n);
+again:
+	spin_lock(&rd_lock[minor]);
+	page = rd_pages[minor] ? rd_pages[minor][index] : NULL;
+	if (rw == READ) {
+		if (page) {
+			kaddr = kmap_atomic(page, KM_USER0);
+			memcpy(p, kaddr + poff, n);
+			kunmap_atomic(kaddr, KM_USER0);
+		} else
+			memset(p, 0, n);
+		spin_unlock(&rd_lock[minor]);
+		return 1;
+	}
+	if (!page && !zero) {
+		if (!new) {
+			spin_unlock(&rd_lock[minor]);
+			/* we are on the way out to disk: no I/O here */
+			new = alloc_page(GFP_BUFFER | __GFP_HIGHMEM);
+			if (!new)
+				return 0;
+			clear_highpage(new);
+			goto again;
+		}
+		page = rd_pages[minor][index] = new;
+		new = NULL;
+	}
+	if (page) {
+		/* zeroes over a hole need no page, and may free one */
+		kaddr = kmap_atomic(page, KM_USER0);
+		memcpy(kaddr + poff, p, n);
+		if (zero && rd_is_zero(kaddr, PAGE_SIZE)) {
+			rd_pages[minor][index] = NULL;
+			freed = page;
+		}
+		kunmap_atomic(kaddr, KM_USER0);
+	}
+	spin_unlock(&rd_lock[minor]);
+	if (new)
+		__free_page(new);
+	if (freed)
+		__free_page(freed);
+	return 1;
+}
+
+/*
+ * Copy a piece of a buffer, page by page of the store.
+ */
+static int rd_do_transfer(int minor, int rw, char *p, unsigned long offset, unsigned long len)
+{
+	unsigned long n;
+	int ok = 1;
+
+	for (; ok && len; p += n, offset += n, len -= n) {
+		n = PAGE_SIZE - (offset & ~PAGE_MASK);
+		if (n > len)
+			n = len;
+		ok = rd_transfer(minor, rw, p, offset, n);
+	}
+	return ok;
+}
 
+/*
+ * Checks common to buffer_heads and bios; returns the direction to
+ * use, or -1 to fail the I/O.
+ */
+static int rd_check(int minor, int rw, unsigned long offset, unsigned long len)
+{
+	if (minor >= NUM_RAMDISKS)
+		return -1;
 	if ((offset + len) > rd_length[minor])
-		goto fail;
+		return -1;
 
 	if (rw==READA)
 		rw=READ;
 	if ((rw != READ) && (rw != WRITE)) {
 		printk(KERN_INFO "RAMDISK: bad command: %d\n", rw);
-		goto fail;
+		return -1;
 	}
+	if (rw == WRITE && !rd_pages[minor])
+		return -1;
+	return rw;
+}
 
-	rbh = getblk(sbh->b_rdev, sbh->b_rsector/(sbh->b_size>>9), sbh->b_size);
-	/* I think that it is safe to assume that rbh is not in HighMem, though
-	 * sbh might be - NeilBrown
-	 */
-	bdata = bh_kmap(sbh);
-	if (rw == READ) {
-		if (sbh != rbh)
-			memcpy(bdata, rbh->b_data, rbh->b_size);
-	} else
-		if (sbh != rbh)
-			memcpy(rbh->b_data, bdata, rbh->b_size);
+static int rd_make_request(request_queue_t * q, int rw, struct buffer_head *sbh)
+{
+	unsigned int minor;
+	unsigned long offset;
+	int ok;
+
+	minor = MINOR(sbh->b_rdev);
+	offset = sbh->b_rsector << 9;
+	rw = rd_check(minor, rw, offset, sbh->b_size);
+	if (rw < 0) {
+		sbh->b_end_io(sbh,0);
+		return 0;
+	}
+
+	ok = rd_do_transfer(minor, rw, bh_kmap(sbh), offset, sbh->b_size);
 	bh_kunmap(sbh);
-	mark_buffer_protected(rbh);
-	brelse(rbh);
 
-	sbh->b_end_io(sbh,1);
-	return 0;
- fail:
-	sbh->b_end_io(sbh,0);
+	sbh->b_end_io(sbh,ok);
 	return 0;
 } 
 
+/*
+ * Whole bios are copied straight to and from their pages.
+ */
+static int rd_make_bio(request_queue_t * q, int rw, struct bio *bio)
+{
+	unsigned int minor;
+	unsigned long offset;
+	struct bio_vec *bv = bio->bi_io_vec;
+	int i, ok = 1;
+
+	minor = MINOR(bio->bi_dev);
+	offset = bio->bi_sector << 9;
+	rw = rd_check(minor, rw, offset, bio->bi_size);
+	if (rw < 0) {
+		bio->bi_end_io(bio, 0);
+		return 0;
+	}
+
+	for (i = 0; ok && i < bio->bi_vcnt; i++, bv++) {
+		ok = rd_do_transfer(minor, rw, kmap(bv->bv_page) + bv->bv_offset,
+				    offset, bv->bv_len);
+		if (rw == READ)
+			flush_dcache_page(bv->bv_page);
+		kunmap(bv->bv_page);
+		offset += bv->bv_len;
+	}
+
+	bio->bi_end_io(bio, ok);
+	return 0;
+}
+
 static int rd_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsigned long arg)
 {
 	unsigned int minor;
@@ -262,6 +420,7 @@ static int rd_ioctl(struct inode *inode, struct file *file, unsigned int cmd, un
 			if ((atomic_read(&inode->i_bdev->bd_openers) > 2))
 				return -EBUSY;
 			destroy_buffers(inode->i_rdev);
+			rd_free_store(minor, 0);
 			rd_blocksizes[minor] = 0;
 			break;
 
@@ -336,6 +495,27 @@ static int rd_open(struct inode * inode, struct file * filp)
 	if (DEVICE_NR(inode->i_rdev) >= NUM_RAMDISKS)
 		return -ENXIO;
 
+	/*
+	 * Set up the page store; pages are only allocated as they are written.
+	 */
+	if (rd_pages[DEVICE_NR(inode->i_rdev)] == NULL) {
+		int minor = DEVICE_NR(inode->i_rdev);
+		unsigned long size = rd_nr_pages(minor) * sizeof(struct page *);
+		struct page **slots = vmalloc(size);
+
+		if (!slots)
+			return -ENOMEM;
+		memset(slots, 0, size);
+		spin_lock(&rd_lock[minor]);
+		if (rd_pages[minor] == NULL) {
+			rd_pages[minor] = slots;
+			slots = NULL;
+		}
+		spin_unlock(&rd_lock[minor]);
+		if (slots)
+			vfree(slots);
+	}
+
 	/*
 	 * Immunize device against invalidate_buffers() and prune_icache().
 	 */
@@ -377,6 +557,7 @@ static void __exit rd_cleanup (void)
 			iput(rd_inode[i]);
 		}
 		destroy_buffers(MKDEV(MAJOR_NR, i));
+		rd_free_store(i, 1);
 	}
 
 	devfs_unregister (devfs_handle);
@@ -406,8 +587,10 @@ int __init rd_init (void)
 	}
 
 	blk_queue_make_request(BLK_DEFAULT_QUEUE(MAJOR_NR), &rd_make_request);
+	blk_queue_make_bio(BLK_DEFAULT_QUEUE(MAJOR_NR), &rd_make_bio);
 
 	for (i = 0; i < NUM_RAMDISKS; i++) {
+		spin_lock_init(&rd_lock[i]);
 		/* rd_size is given in kB */
 		rd_length[i] = rd_size << 10;
 		rd_hardsec[i] = rd_blocksize;
@@ -690,6 +873,9 @@ successful_load:
 done:
 	if (infile.f_op->release)
 		infile.f_op->release(inode, &infile);
+	/* Write the image out of the page cache before it is mounted */
+	if (outfile.f_op->release)
+		outfile.f_op->release(out_inode, &outfile);
 	set_fs(fs);
 	return;
 free_inodes: /* free inodes on error */ 
@@ -773,7 +959,7 @@ typedef unsigned char  uch;
 typedef unsigned short ush;
 typedef unsigned long  ulg;
 
-#define INBUFSIZ 4096
+#define INBUFSIZ 32768
 #define WSIZE 0x8000    /* window size--must be a power of two, and */
 			/*  at least 32K for zip's deflate method */
 
@@ -799,6 +985,10 @@ static struct file *crd_infp, *crd_outfp;
 
 #define STATIC static
 
+/* We have kmalloc(), so afford inflate bigger first level tables. */
+#define INFLATE_LBITS 10
+#define INFLATE_DBITS 8
+
 static int  fill_inbuf(void);
 static void flush_window(void);
 static void *malloc(int size);
@@ -876,6 +1066,7 @@ static int __init
 crd_load(struct file * fp, struct file *outfp)
 {
 	int result;
+	unsigned long start, ms, rate;
 
 	insize = 0;		/* valid bytes in inbuf */
 	inptr = 0;		/* index of next byte to be processed in inbuf */
@@ -898,7 +1089,15 @@ crd_load(struct file * fp, struct file *outfp)
 		return -1;
 	}
 	makecrc();
+	start = jiffies;
 	result = gunzip();
+	ms = (jiffies - start) * 1000 / HZ;
+	if (!ms)
+		ms = 1;
+	rate = (bytes_out >> 10) * 1000 / ms;		/* KB/s */
+	rate = rate / 1024 * 100 + (rate % 1024) * 100 / 1024;	/* MB/s * 100 */
+	printk(KERN_NOTICE "RAMDISK: inflated %ldKB in %lums (%lu.%02lu MB/s)\n",
+	       bytes_out >> 10, ms, rate / 100, rate % 100);
 	kfree(inbuf);
 	kfree(window);
 	return result;
@@ -1208,7 +1208,7 @@ cyy_interrupt(int irq, void *dev_id, struct pt_regs *regs)
 				info->icount.rx++;
                                 continue;
                             }
-                            if (tty->flip.count < TTY_FLIPBUF_SIZE){
+                            if (tty->flip.count < tty->flip.size){
                                 tty->flip.count++;
                                 if (data & info->read_status_mask){
                                     if(data & CyBREAK){
@@ -1244,7 +1244,7 @@ cyy_interrupt(int irq, void *dev_id, struct pt_regs *regs)
                                            the next incoming character.
                                          */
                                         if(tty->flip.count
-					           < TTY_FLIPBUF_SIZE){
+					           < tty->flip.size){
                                             tty->flip.count++;
                                             *tty->flip.flag_buf_ptr++ =
 							     TTY_NORMAL;
@@ -1288,7 +1288,7 @@ cyy_interrupt(int irq, void *dev_id, struct pt_regs *regs)
 			    info->idle_stats.recv_bytes += char_count;
 			    info->idle_stats.recv_idle   = jiffies;
                             while(char_count--){
-                                if (tty->flip.count >= TTY_FLIPBUF_SIZE){
+                                if (tty->flip.count >= tty->flip.size){
                                         break;
                                 }
                                 tty->flip.count++;
@@ -1640,7 +1640,7 @@ cyz_handle_rx(struct cyclades_port *info, volatile struct CH_CTRL *ch_ctrl,
 	       may be several steps to the operation */
 	    while(0 < (small_count = 
 		       cy_min((rx_bufsize - new_rx_get),
-		       cy_min((TTY_FLIPBUF_SIZE - tty->flip.count), char_count))
+		       cy_min((tty->flip.size - tty->flip.count), char_count))
 		 )) {
 		memcpy_fromio(tty->flip.char_buf_ptr,
 			      (char *)(cinfo->base_addr
@@ -1658,7 +1658,7 @@ cyz_handle_rx(struct cyclades_port *info, volatile struct CH_CTRL *ch_ctrl,
 	    }
 #else
 	    while(char_count--){
-		if (tty->flip.count >= TTY_FLIPBUF_SIZE){
+		if (tty->flip.count >= tty->flip.size){
 		    break;
 		}
 		data = cy_readb(cinfo->base_addr + rx_bufaddr + new_rx_get);
@@ -360,6 +360,8 @@ typedef struct drm_agp_info {
 #define DRM_IOCTL_I810_SWAP    DRM_IO ( 0x46)
 #define DRM_IOCTL_I810_COPY    DRM_IOW( 0x47, drm_i810_copy_t)
 #define DRM_IOCTL_I810_DOCOPY  DRM_IO ( 0x48)
+#define DRM_IOCTL_I810_MVERTEX DRM_IOW( 0x49, drm_i810_mvertex_t)
+#define DRM_IOCTL_I810_MAPBUFS DRM_IOR( 0x4a, drm_i810_mapbufs_t)
 
 /* Rage 128 specific ioctls */
 #define DRM_IOCTL_R128_INIT	DRM_IOW( 0x40, drm_r128_init_t)
@@ -431,6 +431,8 @@ typedef struct drm_file {
 	struct drm_file	  *prev;
 	struct drm_device *dev;
 	int 		  remove_auth_on_close;
+	struct mm_struct  *buffers_mm;	   /* Client that mapped all buffers */
+	unsigned long	  buffers_virtual; /* Its address minus bus address  */
 } drm_file_t;
 
 
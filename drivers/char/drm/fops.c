@@ -54,6 +54,8 @@ int drm_open_helper(struct inode *inode, struct file *filp, drm_device_t *dev)
 	priv->minor	    = minor;
 	priv->dev	    = dev;
 	priv->ioctl_count   = 0;
+	priv->buffers_mm    = NULL;
+	priv->buffers_virtual = 0;
 	priv->authenticated = capable(CAP_SYS_ADMIN);
 
 	down(&dev->struct_sem);
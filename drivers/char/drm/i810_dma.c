@@ -46,6 +46,9 @@
 
 #define I810_BUF_UNMAPPED 0
 #define I810_BUF_MAPPED   1
+#define I810_BUF_PINNED   2	/* inside the client's I810_MAPBUFS mapping */
+
+#define I810_MVERTEX_CHUNK 16
 
 #define I810_REG(reg)		2
 #define I810_BASE(reg)		((unsigned long) \
@@ -75,7 +78,8 @@
 #define ADVANCE_LP_RING() do {					\
 	if (I810_VERBOSE) DRM_DEBUG("ADVANCE_LP_RING\n");	\
 	dev_priv->ring.tail = outring;				\
-	I810_WRITE(LP_RING + RING_TAIL, outring);		\
+	if (!dev_priv->ring.deferred)				\
+		I810_WRITE(LP_RING + RING_TAIL, outring);	\
 } while(0)
 
 #define OUT_RING(n) do {						\
@@ -180,6 +184,28 @@ int i810_mmap_buffers(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 }
 
+static int i810_mmap_all_buffers(struct file *filp, struct vm_area_struct *vma)
+{
+	vma->vm_flags |= (VM_IO | VM_DONTCOPY);
+
+	if (remap_page_range(vma->vm_start,
+			     VM_OFFSET(vma),
+			     vma->vm_end - vma->vm_start,
+			     vma->vm_page_prot)) return -EAGAIN;
+	return 0;
+}
+
+static struct file_operations i810_all_buffers_fops = {
+	open:	 i810_open,
+	flush:	 drm_flush,
+	release: i810_release,
+	ioctl:	 i810_ioctl,
+	mmap:	 i810_mmap_all_buffers,
+	read:	 drm_read,
+	fasync:	 drm_fasync,
+      	poll:	 drm_poll,
+};
+
 static int i810_map_buffer(drm_buf_t *buf, struct file *filp)
 {
 	drm_file_t	  *priv	  = filp->private_data;
@@ -191,7 +217,11 @@ static int i810_map_buffer(drm_buf_t *buf, struct file *filp)
 
 	if(buf_priv->currently_mapped == I810_BUF_MAPPED) return -EINVAL;
 
-	if(VM_DONTCOPY != 0) {
+	if (priv->buffers_mm && priv->buffers_mm == current->mm) {
+		buf_priv->virtual = (void *)(priv->buffers_virtual +
+					     buf->bus_address);
+		buf_priv->currently_mapped = I810_BUF_PINNED;
+	} else if(VM_DONTCOPY != 0) {
 		down(&current->mm->mmap_sem);
 		old_fops = filp->f_op;
 		filp->f_op = &i810_buffer_fops;
@@ -337,6 +367,10 @@ static int i810_wait_ring(drm_device_t *dev, int n)
    	unsigned long end;
 	unsigned int last_head = I810_READ(LP_RING + RING_HEAD) & HEAD_ADDR;
 
+	/* The hardware cannot make room before it has seen our commands */
+	if (ring->deferred)
+		I810_WRITE(LP_RING + RING_TAIL, ring->tail);
+
 	end = jiffies + (HZ*3);
    	while (ring->space < n) {
 	   	int i;
@@ -368,7 +402,9 @@ static void i810_kernel_lost_context(drm_device_t *dev)
    	drm_i810_ring_buffer_t *ring = &(dev_priv->ring);
       
    	ring->head = I810_READ(LP_RING + RING_HEAD) & HEAD_ADDR;
-     	ring->tail = I810_READ(LP_RING + RING_TAIL);
+	/* A deferred tail is ahead of the register and is still ours */
+	if (!ring->deferred)
+     		ring->tail = I810_READ(LP_RING + RING_TAIL);
      	ring->space = ring->head - (ring->tail+8);
      	if (ring->space < 0) ring->space += ring->Size;
 }
@@ -817,17 +853,28 @@ static void i810_dma_dispatch_vertex(drm_device_t *dev,
 	DRM_DEBUG(  "used : %d\n", used);
    	DRM_DEBUG(  "start + used - 4 : %ld\n", start + used - 4);
 
-	if (buf_priv->currently_mapped == I810_BUF_MAPPED) {
-		*(u32 *)buf_priv->virtual = (GFX_OP_PRIMITIVE |
-					     sarea_priv->vertex_prim |
-					     ((used/4)-2));
+	if (buf_priv->currently_mapped != I810_BUF_UNMAPPED) {
+		/* A pinned buffer stays mapped in the client, so write
+		 * through our own mapping and leave the client's alone.
+		 */
+		void *virtual = buf_priv->currently_mapped == I810_BUF_PINNED ?
+				buf_priv->kernel_virtual : buf_priv->virtual;
+
+		*(u32 *)virtual = (GFX_OP_PRIMITIVE |
+				   sarea_priv->vertex_prim |
+				   ((used/4)-2));
 		
 		if (used & 4) {
-			*(u32 *)((u32)buf_priv->virtual + used) = 0;
+			*(u32 *)((u32)virtual + used) = 0;
 			used += 4;
 		}
 
-		i810_unmap_buffer(buf);
+		if (buf_priv->currently_mapped == I810_BUF_MAPPED)
+			i810_unmap_buffer(buf);
+		else {
+			buf_priv->currently_mapped = I810_BUF_UNMAPPED;
+			buf_priv->virtual = 0;
+		}
 	}
 		   
 	if (used) {
@@ -1161,7 +1208,7 @@ void i810_reclaim_buffers(drm_device_t *dev, pid_t pid)
 
 			if (used == I810_BUF_CLIENT)
 				DRM_DEBUG("reclaimed from client\n");
-		   	if(buf_priv->currently_mapped == I810_BUF_MAPPED)
+		   	if(buf_priv->currently_mapped != I810_BUF_UNMAPPED)
 		     		buf_priv->currently_mapped = I810_BUF_UNMAPPED;
 		}
 	}
@@ -1286,6 +1333,9 @@ int i810_dma_vertex(struct inode *inode, struct file *filp,
 	DRM_DEBUG("i810 dma vertex, idx %d used %d discard %d\n",
 		  vertex.idx, vertex.used, vertex.discard);
 
+	if (vertex.idx < 0 || vertex.idx >= dma->buf_count)
+		return -EINVAL;
+
 	i810_dma_dispatch_vertex( dev, 
 				  dma->buflist[ vertex.idx ], 
 				  vertex.discard, vertex.used );
@@ -1298,6 +1348,122 @@ int i810_dma_vertex(struct inode *inode, struct file *filp,
 	return 0;
 }
 
+/* Dispatch a list of vertex buffers, telling the hardware about all of
+ * them with a single write of the ring tail.
+ */
+int i810_dma_mvertex(struct inode *inode, struct file *filp,
+		     unsigned int cmd, unsigned long arg)
+{
+	drm_file_t *priv = filp->private_data;
+	drm_device_t *dev = priv->dev;
+	drm_device_dma_t *dma = dev->dma;
+   	drm_i810_private_t *dev_priv = (drm_i810_private_t *)dev->dev_private;
+      	u32 *hw_status = (u32 *)dev_priv->hw_status_page;
+   	drm_i810_sarea_t *sarea_priv = (drm_i810_sarea_t *) 
+     					dev_priv->sarea_priv; 
+	drm_i810_mvertex_t mvertex;
+	drm_i810_vertex_t vertex[I810_MVERTEX_CHUNK];
+	int done, n, i, retcode = 0;
+
+	if (copy_from_user(&mvertex, (drm_i810_mvertex_t *)arg, 
+			   sizeof(mvertex)))
+		return -EFAULT;
+
+   	if(!_DRM_LOCK_IS_HELD(dev->lock.hw_lock->lock)) {
+		DRM_ERROR("i810_dma_mvertex called without lock held\n");
+		return -EINVAL;
+	}
+
+	if (mvertex.count < 0)
+		return -EINVAL;
+
+	DRM_DEBUG("i810 dma mvertex, count %d\n", mvertex.count);
+
+	dev_priv->ring.deferred = 1;
+	for (done = 0; done < mvertex.count; done += n) {
+		n = mvertex.count - done;
+		if (n > I810_MVERTEX_CHUNK)
+			n = I810_MVERTEX_CHUNK;
+		if (copy_from_user(vertex, mvertex.list + done, 
+				   n * sizeof(vertex[0]))) {
+			retcode = -EFAULT;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (vertex[i].idx < 0 || 
+			    vertex[i].idx >= dma->buf_count) {
+				retcode = -EINVAL;
+				goto out;
+			}
+			i810_dma_dispatch_vertex( dev, 
+						  dma->buflist[ vertex[i].idx ], 
+						  vertex[i].discard, 
+						  vertex[i].used );
+			atomic_add(vertex[i].used, &dma->total_bytes);
+			atomic_inc(&dma->total_dmas);
+		}
+	}
+out:
+	dev_priv->ring.deferred = 0;
+	I810_WRITE(LP_RING + RING_TAIL, dev_priv->ring.tail);
+
+	sarea_priv->last_enqueue = dev_priv->counter-1;
+   	sarea_priv->last_dispatch = (int) hw_status[5];
+   
+	return retcode;
+}
+
+/* Map every buffer into the client at once.  Buffers it gets afterwards
+ * are already mapped, so neither GETBUF nor dispatch has to touch the
+ * client's address space.
+ */
+int i810_mapbufs(struct inode *inode, struct file *filp, unsigned int cmd,
+		 unsigned long arg)
+{
+	drm_file_t	  *priv	  = filp->private_data;
+	drm_device_t	  *dev	  = priv->dev;
+	drm_device_dma_t  *dma	  = dev->dma;
+   	struct file_operations *old_fops;
+	drm_i810_mapbufs_t m;
+	unsigned long start = ~0UL, end = 0, virtual;
+	int i;
+
+	if (!dma || !dma->buf_count || !dev->dev_private) return -EINVAL;
+	if (VM_DONTCOPY == 0) return -EINVAL;
+	if (priv->buffers_mm) return -EBUSY;
+
+	/* The buffers are contiguous in the AGP aperture */
+	for (i = 0; i < dma->buf_count; i++) {
+		drm_buf_t *buf = dma->buflist[ i ];
+
+		if (buf->bus_address < start)
+			start = buf->bus_address;
+		if (buf->bus_address + buf->total > end)
+			end = buf->bus_address + buf->total;
+	}
+
+	down(&current->mm->mmap_sem);
+	old_fops = filp->f_op;
+	filp->f_op = &i810_all_buffers_fops;
+	virtual = do_mmap(filp, 0, end - start, PROT_READ|PROT_WRITE,
+			  MAP_SHARED, start);
+   	filp->f_op = old_fops;
+	up(&current->mm->mmap_sem);
+	if (virtual > -1024UL) {
+		DRM_DEBUG("mmap error\n");
+		return (signed long)virtual;
+	}
+
+	priv->buffers_mm = current->mm;
+	priv->buffers_virtual = virtual - start;
+
+	m.virtual = (void *)virtual;
+	m.size = end - start;
+	if (copy_to_user((drm_i810_mapbufs_t *)arg, &m, sizeof(m)))
+		return -EFAULT;
+	return 0;
+}
+
 
 
 int i810_clear_bufs(struct inode *inode, struct file *filp,
@@ -1412,7 +1578,7 @@ int i810_copybuf(struct inode *inode, struct file *filp, unsigned int cmd,
 	if(d.idx > dma->buf_count) return -EINVAL;
 	buf = dma->buflist[ d.idx ];
    	buf_priv = buf->dev_private;
-	if (buf_priv->currently_mapped != I810_BUF_MAPPED) return -EPERM;
+	if (buf_priv->currently_mapped == I810_BUF_UNMAPPED) return -EPERM;
 
    	if (copy_from_user(buf_priv->virtual, d.address, d.used))
 		return -EFAULT;
@@ -178,6 +178,12 @@ typedef struct _drm_i810_vertex {
 	int discard;		/* client is finished with the buffer? */
 } drm_i810_vertex_t;
 
+/* Several vertex buffers, dispatched with one update of the ring tail */
+typedef struct _drm_i810_mvertex {
+	int count;
+	drm_i810_vertex_t *list;
+} drm_i810_mvertex_t;
+
 typedef struct _drm_i810_copy_t {
    	int idx;		/* buffer index */
 	int used;		/* nr bytes in use */
@@ -191,4 +197,12 @@ typedef struct drm_i810_dma {
 	int granted;
 } drm_i810_dma_t;
 
+/* After this, GETBUF returns addresses inside the one mapping instead
+ * of mapping each buffer it hands out.
+ */
+typedef struct drm_i810_mapbufs {
+	void *virtual;		/* start of all the buffers */
+	unsigned long size;
+} drm_i810_mapbufs_t;
+
 #endif /* _I810_DRM_H_ */
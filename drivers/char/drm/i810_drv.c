@@ -113,6 +113,8 @@ static drm_ioctl_desc_t	      i810_ioctls[] = {
    	[DRM_IOCTL_NR(DRM_IOCTL_I810_SWAP)]   = { i810_swap_bufs,  1, 0 },
    	[DRM_IOCTL_NR(DRM_IOCTL_I810_COPY)]   = { i810_copybuf,    1, 0 },
    	[DRM_IOCTL_NR(DRM_IOCTL_I810_DOCOPY)] = { i810_docopy,     1, 0 },
+   	[DRM_IOCTL_NR(DRM_IOCTL_I810_MVERTEX)] = { i810_dma_mvertex, 1, 0 },
+   	[DRM_IOCTL_NR(DRM_IOCTL_I810_MAPBUFS)] = { i810_mapbufs,   1, 0 },
 };
 
 #define I810_IOCTL_COUNT DRM_ARRAY_SIZE(i810_ioctls)
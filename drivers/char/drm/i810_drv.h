@@ -51,6 +51,7 @@ typedef struct _drm_i810_ring_buffer{
 	int head;
 	int tail;
 	int space;
+	int deferred;		/* tail is written to the hardware later */
 } drm_i810_ring_buffer_t;
 
 typedef struct drm_i810_private {
@@ -146,6 +147,12 @@ extern int  i810_context_switch_complete(drm_device_t *dev, int new);
 int i810_dma_vertex(struct inode *inode, struct file *filp,
 		    unsigned int cmd, unsigned long arg);
 
+int i810_dma_mvertex(struct inode *inode, struct file *filp,
+		     unsigned int cmd, unsigned long arg);
+
+int i810_mapbufs(struct inode *inode, struct file *filp,
+		 unsigned int cmd, unsigned long arg);
+
 int i810_swap_bufs(struct inode *inode, struct file *filp,
 		   unsigned int cmd, unsigned long arg);
 
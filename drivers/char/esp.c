@@ -703,8 +703,8 @@ static void rs_interrupt_single(int irq, void *dev_id, struct pt_regs * regs)
 		num_bytes = serial_in(info, UART_ESI_STAT1) << 8;
 		num_bytes |= serial_in(info, UART_ESI_STAT2);
 
-		if (num_bytes > (TTY_FLIPBUF_SIZE - info->tty->flip.count))
-		  num_bytes = TTY_FLIPBUF_SIZE - info->tty->flip.count;
+		if (num_bytes > (info->tty->flip.size - info->tty->flip.count))
+		  num_bytes = info->tty->flip.size - info->tty->flip.count;
 
 		if (num_bytes) {
 			if (dma_bytes ||
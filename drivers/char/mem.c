@@ -370,7 +370,7 @@ static inline size_t read_zero_pagealigned(char * buf, size_t size)
 			count = size;
 
 		flush_cache_range(mm, addr, addr + count);
-		zap_page_range(mm, addr, count);
+		zap_page_range(mm, addr, count, ZPR_COND_RESCHED);
         	zeromap_page_range(addr, count, PAGE_COPY);
         	flush_tlb_range(mm, addr, addr + count);
 
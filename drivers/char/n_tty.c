@@ -702,57 +702,93 @@ static int n_tty_receive_room(struct tty_struct *tty)
 	return 0;
 }
 
+/*
+ * Characters that need no processing: copy as many as there is room
+ * for straight into the read buffer.
+ */
+static void n_tty_receive_raw(struct tty_struct *tty, const unsigned char *cp,
+			      int count)
+{
+	unsigned long cpuflags;
+	int i;
+
+	spin_lock_irqsave(&tty->read_lock, cpuflags);
+	i = MIN(count, MIN(N_TTY_BUF_SIZE - tty->read_cnt,
+			   N_TTY_BUF_SIZE - tty->read_head));
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	cp += i;
+	count -= i;
+
+	i = MIN(count, MIN(N_TTY_BUF_SIZE - tty->read_cnt,
+		       N_TTY_BUF_SIZE - tty->read_head));
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	spin_unlock_irqrestore(&tty->read_lock, cpuflags);
+}
+
+static void n_tty_receive_flagged(struct tty_struct *tty, unsigned char c,
+				  char flags)
+{
+	char	buf[64];
+
+	switch (flags) {
+	case TTY_NORMAL:
+		n_tty_receive_char(tty, c);
+		break;
+	case TTY_BREAK:
+		n_tty_receive_break(tty);
+		break;
+	case TTY_PARITY:
+	case TTY_FRAME:
+		n_tty_receive_parity_error(tty, c);
+		break;
+	case TTY_OVERRUN:
+		n_tty_receive_overrun(tty);
+		break;
+	default:
+		printk("%s: unknown flag %d\n", tty_name(tty, buf), flags);
+		break;
+	}
+}
+
 static void n_tty_receive_buf(struct tty_struct *tty, const unsigned char *cp,
 			      char *fp, int count)
 {
 	const unsigned char *p;
 	char *f, flags = TTY_NORMAL;
 	int	i;
-	char	buf[64];
-	unsigned long cpuflags;
 
 	if (!tty->read_buf)
 		return;
 
 	if (tty->real_raw) {
-		spin_lock_irqsave(&tty->read_lock, cpuflags);
-		i = MIN(count, MIN(N_TTY_BUF_SIZE - tty->read_cnt,
-				   N_TTY_BUF_SIZE - tty->read_head));
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		cp += i;
-		count -= i;
-
-		i = MIN(count, MIN(N_TTY_BUF_SIZE - tty->read_cnt,
-			       N_TTY_BUF_SIZE - tty->read_head));
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		spin_unlock_irqrestore(&tty->read_lock, cpuflags);
+		n_tty_receive_raw(tty, cp, count);
+	} else if (tty->raw) {
+		/*
+		 * Raw, but the driver reports errors: take the runs of
+		 * good characters in one go, the others one by one.
+		 */
+		while (count) {
+			for (i = 0; i < count; i++)
+				if (fp && fp[i] != TTY_NORMAL)
+					break;
+			n_tty_receive_raw(tty, cp, i);
+			cp += i;
+			count -= i;
+			if (!count)
+				break;
+			fp += i;
+			n_tty_receive_flagged(tty, *cp++, *fp++);
+			count--;
+		}
 	} else {
 		for (i=count, p = cp, f = fp; i; i--, p++) {
 			if (f)
 				flags = *f++;
-			switch (flags) {
-			case TTY_NORMAL:
-				n_tty_receive_char(tty, *p);
-				break;
-			case TTY_BREAK:
-				n_tty_receive_break(tty);
-				break;
-			case TTY_PARITY:
-			case TTY_FRAME:
-				n_tty_receive_parity_error(tty, *p);
-				break;
-			case TTY_OVERRUN:
-				n_tty_receive_overrun(tty);
-				break;
-			default:
-				printk("%s: unknown flag %d\n",
-				       tty_name(tty, buf), flags);
-				break;
-			}
+			n_tty_receive_flagged(tty, *p, flags);
 		}
 		if (tty->driver.flush_chars)
 			tty->driver.flush_chars(tty);
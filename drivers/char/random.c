@@ -244,6 +244,8 @@
 #include <linux/random.h>
 #include <linux/poll.h>
 #include <linux/init.h>
+#include <linux/cache.h>
+#include <linux/timer.h>
 
 #include <asm/processor.h>
 #include <asm/uaccess.h>
@@ -598,55 +600,84 @@ static void credit_entropy_store(struct entropy_store *r, int num)
  *
  * Entropy batch input management
  *
- * We batch entropy to be added to avoid increasing interrupt latency
+ * We batch entropy to be added to avoid increasing interrupt latency.
+ * Every CPU has a batch of its own, which only that CPU adds to (with
+ * interrupts off) and only batch_entropy_process() takes from, so the
+ * interrupt path neither takes a lock nor touches another CPU's cache
+ * lines.  The batches are mixed into the pool from tq_timer.
  *
  **********************************************************************/
 
-static __u32	*batch_entropy_pool;
-static int	*batch_entropy_credit;
+struct entropy_batch {
+	int	head;
+	int	tail;
+	int	queued;
+	__u32	*pool;
+	int	*credit;
+};
+
+static struct entropy_batch batch_entropy[NR_CPUS] __cacheline_aligned;
 static int	batch_max;
-static int	batch_head, batch_tail;
 static struct tq_struct	batch_tqueue;
 static void batch_entropy_process(void *private_);
 
 /* note: the size must be a power of 2 */
 static int batch_entropy_init(int size, struct entropy_store *r)
 {
-	batch_entropy_pool = kmalloc(2*size*sizeof(__u32), GFP_KERNEL);
-	if (!batch_entropy_pool)
-		return -1;
-	batch_entropy_credit =kmalloc(size*sizeof(int), GFP_KERNEL);
-	if (!batch_entropy_credit) {
-		kfree(batch_entropy_pool);
-		return -1;
+	struct entropy_batch *b;
+	int cpu;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		b = batch_entropy + cpu;
+		b->pool = kmalloc(2*size*sizeof(__u32), GFP_KERNEL);
+		b->credit = kmalloc(size*sizeof(int), GFP_KERNEL);
+		if (!b->pool || !b->credit)
+			goto fail;
+		b->head = b->tail = 0;
 	}
-	batch_head = batch_tail = 0;
-	batch_max = size;
 	batch_tqueue.routine = batch_entropy_process;
 	batch_tqueue.data = r;
+	batch_max = size;
 	return 0;
+
+fail:
+	for (; cpu >= 0; cpu--) {
+		b = batch_entropy + cpu;
+		if (b->pool)
+			kfree(b->pool);
+		if (b->credit)
+			kfree(b->credit);
+	}
+	return -1;
 }
 
 void batch_entropy_store(u32 a, u32 b, int num)
 {
+	struct entropy_batch *batch;
+	unsigned long flags;
 	int	new;
 
 	if (!batch_max)
 		return;
-	
-	batch_entropy_pool[2*batch_head] = a;
-	batch_entropy_pool[(2*batch_head) + 1] = b;
-	batch_entropy_credit[batch_head] = num;
-
-	new = (batch_head+1) & (batch_max-1);
-	if (new != batch_tail) {
-		queue_task(&batch_tqueue, &tq_timer);
-		batch_head = new;
-	} else {
-#if 0
-		printk(KERN_NOTICE "random: batch entropy buffer full\n");
-#endif
+
+	__save_flags(flags);
+	__cli();
+	batch = batch_entropy + smp_processor_id();
+	batch->pool[2*batch->head] = a;
+	batch->pool[(2*batch->head) + 1] = b;
+	batch->credit[batch->head] = num;
+
+	new = (batch->head+1) & (batch_max-1);
+	if (new != batch->tail) {
+		batch->head = new;
+		mb();
+		/* one queue_task() per batch, not per sample */
+		if (!batch->queued) {
+			batch->queued = 1;
+			queue_task(&batch_tqueue, &tq_timer);
+		}
 	}
+	__restore_flags(flags);
 }
 
 static void batch_entropy_process(void *private_)
@@ -654,19 +685,28 @@ static void batch_entropy_process(void *private_)
 	int	num = 0;
 	int	max_entropy;
 	struct entropy_store *r	= (struct entropy_store *) private_, *p;
+	struct entropy_batch *batch;
+	int	cpu, head;
 	
 	if (!batch_max)
 		return;
 
 	max_entropy = r->poolinfo.poolwords*32;
-	while (batch_head != batch_tail) {
-		add_entropy_words(r, batch_entropy_pool + 2*batch_tail, 2);
-		p = r;
-		if (r->entropy_count > max_entropy && (num & 1))
-			r = sec_random_state;
-		credit_entropy_store(r, batch_entropy_credit[batch_tail]);
-		batch_tail = (batch_tail+1) & (batch_max-1);
-		num++;
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		batch = batch_entropy + cpu;
+		/* from here on an addition to the batch queues us again */
+		batch->queued = 0;
+		mb();
+		head = batch->head;
+		while (head != batch->tail) {
+			add_entropy_words(r, batch->pool + 2*batch->tail, 2);
+			p = r;
+			if (r->entropy_count > max_entropy && (num & 1))
+				r = sec_random_state;
+			credit_entropy_store(r, batch->credit[batch->tail]);
+			batch->tail = (batch->tail+1) & (batch_max-1);
+			num++;
+		}
 	}
 	if (r->entropy_count >= random_read_wakeup_thresh)
 		wake_up_interruptible(&random_read_wait);
@@ -1345,6 +1385,122 @@ void get_random_bytes(void *buf, int nbytes)
 				   "random driver initialization\n");
 }
 
+/*********************************************************************
+ *
+ * Output stage for /dev/urandom
+ *
+ * Hashing the secondary pool gives 10 bytes for two SHA transforms,
+ * which is far too slow for programs reading /dev/urandom in bulk.
+ * Instead each CPU runs the ChaCha20 stream cipher, keyed from the
+ * secondary pool and rekeyed from it every CRNG_RESEED_INTERVAL.  After
+ * every read the key is replaced by cipher output, so the state left
+ * behind does not reveal what was read.
+ *
+ * The state of a CPU is only used by urandom_read() running on it, and
+ * nothing in between takes the CPU away, so it needs no lock.
+ *
+ *********************************************************************/
+
+#define CRNG_RESEED_INTERVAL	(300*HZ)
+
+struct crng_state {
+	__u32		state[16];	/* constants, key, counter, nonce */
+	unsigned long	reseed_at;
+	int		seeded;
+} ____cacheline_aligned;
+
+static struct crng_state crng[NR_CPUS];
+
+#define QUARTERROUND(a, b, c, d) \
+	x[a] += x[b]; x[d] = rotate_left(16, x[d] ^ x[a]); \
+	x[c] += x[d]; x[b] = rotate_left(12, x[b] ^ x[c]); \
+	x[a] += x[b]; x[d] = rotate_left(8, x[d] ^ x[a]); \
+	x[c] += x[d]; x[b] = rotate_left(7, x[b] ^ x[c]);
+
+static void chacha20_block(__u32 state[16], __u32 out[16])
+{
+	__u32 x[16];
+	int i;
+
+	memcpy(x, state, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(0, 4, 8, 12)
+		QUARTERROUND(1, 5, 9, 13)
+		QUARTERROUND(2, 6, 10, 14)
+		QUARTERROUND(3, 7, 11, 15)
+		QUARTERROUND(0, 5, 10, 15)
+		QUARTERROUND(1, 6, 11, 12)
+		QUARTERROUND(2, 7, 8, 13)
+		QUARTERROUND(3, 4, 9, 14)
+	}
+	for (i = 0; i < 16; i++)
+		out[i] = x[i] + state[i];
+	if (!++state[12])
+		state[13]++;
+}
+
+static void crng_reseed(struct crng_state *c)
+{
+	__u32 seed[10];			/* key and nonce */
+
+	extract_entropy(sec_random_state, seed, sizeof(seed),
+			EXTRACT_ENTROPY_SECONDARY);
+	c->state[0] = 0x61707865;	/* "expand 32-byte k" */
+	c->state[1] = 0x3320646e;
+	c->state[2] = 0x79622d32;
+	c->state[3] = 0x6b206574;
+	memcpy(&c->state[4], seed, 8*sizeof(__u32));
+	c->state[12] = c->state[13] = 0;
+	c->state[14] = seed[8];
+	c->state[15] = seed[9];
+	memset(seed, 0, sizeof(seed));
+	c->reseed_at = jiffies + CRNG_RESEED_INTERVAL;
+	c->seeded = 1;
+}
+
+static ssize_t crng_read(char *buf, size_t nbytes)
+{
+	struct crng_state *c;
+	__u32 block[16];
+	ssize_t ret = 0;
+	size_t i;
+
+	while (nbytes) {
+		if (current->need_resched) {
+			if (signal_pending(current)) {
+				if (ret == 0)
+					ret = -ERESTARTSYS;
+				break;
+			}
+			schedule();
+		}
+
+		c = crng + smp_processor_id();
+		if (!c->seeded || time_after(jiffies, c->reseed_at))
+			crng_reseed(c);
+		chacha20_block(c->state, block);
+
+		/* copy_to_user() may sleep, we are done with c */
+		i = MIN(nbytes, sizeof(block));
+		i -= copy_to_user(buf, block, i);
+		if (!i) {
+			ret = -EFAULT;
+			break;
+		}
+		nbytes -= i;
+		buf += i;
+		ret += i;
+	}
+
+	c = crng + smp_processor_id();
+	if (c->seeded) {
+		chacha20_block(c->state, block);
+		memcpy(&c->state[4], block, 8*sizeof(__u32));
+	}
+	memset(block, 0, sizeof(block));
+	return ret;
+}
+
 /*********************************************************************
  *
  * Functions to interface with Linux
@@ -1503,9 +1659,7 @@ static ssize_t
 urandom_read(struct file * file, char * buf,
 		      size_t nbytes, loff_t *ppos)
 {
-	return extract_entropy(sec_random_state, buf, nbytes,
-			       EXTRACT_ENTROPY_USER |
-			       EXTRACT_ENTROPY_SECONDARY);
+	return crng_read(buf, nbytes);
 }
 
 static unsigned int
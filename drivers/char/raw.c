@@ -15,6 +15,8 @@
 #include <linux/raw.h>
 #include <linux/capability.h>
 #include <linux/smp_lock.h>
+#include <linux/aio.h>
+#include <linux/bio.h>
 #include <asm/uaccess.h>
 
 #define dprintk(x...) 
@@ -25,9 +27,12 @@ static int raw_device_sector_size[256];
 static int raw_device_sector_bits[256];
 
 static ssize_t rw_raw_dev(int rw, struct file *, char *, size_t, loff_t *);
+static ssize_t rw_raw_dev_async(int rw, struct kiocb *, char *, size_t, loff_t);
 
 ssize_t	raw_read(struct file *, char *, size_t, loff_t *);
 ssize_t	raw_write(struct file *, const char *, size_t, loff_t *);
+ssize_t	raw_aio_read(struct kiocb *, char *, size_t, loff_t);
+ssize_t	raw_aio_write(struct kiocb *, const char *, size_t, loff_t);
 int	raw_open(struct inode *, struct file *);
 int	raw_release(struct inode *, struct file *);
 int	raw_ctl_ioctl(struct inode *, struct file *, unsigned int, unsigned long);
@@ -38,6 +43,8 @@ static struct file_operations raw_fops = {
 	write:		raw_write,
 	open:		raw_open,
 	release:	raw_release,
+	aio_read:	raw_aio_read,
+	aio_write:	raw_aio_write,
 };
 
 static struct file_operations raw_ctl_fops = {
@@ -236,20 +243,107 @@ ssize_t	raw_write(struct file *filp, const char *buf,
 	return rw_raw_dev(WRITE, filp, (char *) buf, size, offp);
 }
 
+ssize_t	raw_aio_read(struct kiocb *iocb, char * buf, 
+		     size_t size, loff_t pos)
+{
+	return rw_raw_dev_async(READ, iocb, buf, size, pos);
+}
+
+ssize_t	raw_aio_write(struct kiocb *iocb, const char *buf, 
+		      size_t size, loff_t pos)
+{
+	return rw_raw_dev_async(WRITE, iocb, (char *) buf, size, pos);
+}
+
 #define SECTOR_BITS 9
 #define SECTOR_SIZE (1U << SECTOR_BITS)
 #define SECTOR_MASK (SECTOR_SIZE - 1)
 
+/*
+ * Synchronous raw IO is cut into chunks of RAW_CHUNK_BYTES, each with a
+ * kiobuf of its own and sent down as a single bio.  Chunks are mapped
+ * and started as fast as we can until RAW_MAX_CHUNKS of them are in
+ * flight, which bounds the amount of user memory pinned by one call;
+ * only then do we wait, for the oldest chunk, and start the next one
+ * in its place.  This keeps the device queue full instead of doing one
+ * chunk at a time.
+ */
+#define RAW_CHUNK_BYTES	(256 * 1024)
+#define RAW_MAX_CHUNKS	16		/* 4MB pinned at most */
+#define RAW_CHUNK_VECS	((RAW_CHUNK_BYTES >> PAGE_SHIFT) + 1)
+
+struct raw_chunk {
+	struct kiobuf *	iobuf;
+	struct bio *	bio;
+	int		iosize;
+};
+
+static void end_bio_raw(struct bio *bio, int uptodate)
+{
+	end_kio_request(bio->bi_private, uptodate);
+}
+
+/*
+ * Start the IO of a mapped chunk.
+ */
+static int raw_chunk_start(struct raw_chunk *c, int rw, kdev_t dev,
+			   unsigned long sector, int sector_mask)
+{
+	struct kiobuf *iobuf = c->iobuf;
+	struct bio *bio = c->bio;
+	int offset = iobuf->offset;
+	int len = iobuf->length;
+	int i, n;
+
+	if (offset & sector_mask)
+		return -EINVAL;
+
+	bio->bi_vcnt = 0;
+	bio->bi_size = 0;
+	for (i = 0; i < iobuf->nr_pages; i++) {
+		if (!iobuf->maplist[i])
+			return -EFAULT;
+		n = PAGE_SIZE - offset;
+		if (n > len)
+			n = len;
+		bio_add_page(bio, iobuf->maplist[i], n, offset);
+		offset = 0;
+		len -= n;
+	}
+	bio->bi_dev = dev;
+	bio->bi_sector = sector;
+	bio->bi_end_io = end_bio_raw;
+	bio->bi_private = iobuf;
+
+	iobuf->errno = 0;
+	atomic_inc(&iobuf->io_count);
+	submit_bio(rw, bio);
+	return 0;
+}
+
+/*
+ * A chunk has completed: return how many bytes were transferred and
+ * release the chunk's pages.  A bio only tells us that some part of it
+ * failed, so a failed chunk counts as not done at all.
+ */
+static int raw_chunk_done(struct raw_chunk *c)
+{
+	kiobuf_wait_for_io(c->iobuf);
+	unmap_kiobuf(c->iobuf);
+	return c->iobuf->errno ? 0 : c->iosize;
+}
+
 ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf, 
 		   size_t size, loff_t *offp)
 {
-	struct kiobuf * iobuf;
-	int		err;
+	struct kiobuf *	iobufs[RAW_MAX_CHUNKS];
+	struct raw_chunk chunks[RAW_MAX_CHUNKS];
+	struct raw_chunk *c;
+	int		err, failed;
 	unsigned long	blocknr, blocks;
-	unsigned long	b[KIO_MAX_SECTORS];
 	size_t		transferred;
 	int		iosize;
-	int		i;
+	int		i, n, nr_chunks, head, tail, inflight;
 	int		minor;
 	kdev_t		dev;
 	unsigned long	limit;
@@ -266,7 +360,7 @@ ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf,
 	sector_size = raw_device_sector_size[minor];
 	sector_bits = raw_device_sector_bits[minor];
 	sector_mask = sector_size- 1;
-	max_sectors = KIO_MAX_SECTORS >> (sector_bits - 9);
+	max_sectors = RAW_CHUNK_BYTES >> sector_bits;
 	
 	if (blk_size[MAJOR(dev)])
 		limit = (((loff_t) blk_size[MAJOR(dev)][MINOR(dev)]) << BLOCK_SIZE_BITS) >> sector_bits;
@@ -281,21 +375,141 @@ ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf,
 		return 0;
 
 	/* 
-	 * We'll just use one kiobuf
+	 * No more chunks than this IO needs
 	 */
 
-	err = alloc_kiovec(1, &iobuf);
+	nr_chunks = (size + RAW_CHUNK_BYTES - 1) / RAW_CHUNK_BYTES;
+	if (nr_chunks > RAW_MAX_CHUNKS)
+		nr_chunks = RAW_MAX_CHUNKS;
+	if (!nr_chunks)
+		return 0;
+
+	err = alloc_kiovec(nr_chunks, iobufs);
 	if (err)
 		return err;
-
-	/*
-	 * Split the IO into KIO_MAX_SECTORS chunks, mapping and
-	 * unmapping the single kiobuf as we go to perform each chunk of
-	 * IO.  
-	 */
+	for (i = 0; i < nr_chunks; i++) {
+		chunks[i].iobuf = iobufs[i];
+		chunks[i].bio = bio_alloc(GFP_KERNEL, RAW_CHUNK_VECS);
+		if (!chunks[i].bio) {
+			while (--i >= 0)
+				bio_put(chunks[i].bio);
+			free_kiovec(nr_chunks, iobufs);
+			return -ENOMEM;
+		}
+	}
 
 	transferred = 0;
+	failed = 0;
+	head = tail = inflight = 0;
 	blocknr = *offp >> sector_bits;
+	for (;;) {
+		/*
+		 * Map and start as much as we may have in flight.
+		 */
+		while (!failed && size > 0 && inflight < nr_chunks) {
+			blocks = size >> sector_bits;
+			if (blocks > max_sectors)
+				blocks = max_sectors;
+			if (blocks > limit - blocknr)
+				blocks = limit - blocknr;
+			if (!blocks) {
+				size = 0;
+				break;
+			}
+
+			iosize = blocks << sector_bits;
+			c = &chunks[head];
+
+			err = map_user_kiobuf(rw, c->iobuf, (unsigned long) buf, iosize);
+			if (err) {
+				failed = 1;
+				break;
+			}
+			c->iosize = iosize;
+
+			err = raw_chunk_start(c, rw, dev, blocknr << (sector_bits - 9), sector_mask);
+			if (err) {
+				unmap_kiobuf(c->iobuf);
+				failed = 1;
+				break;
+			}
+			blocknr += blocks;
+			size -= iosize;
+			buf += iosize;
+			head = (head + 1) % nr_chunks;
+			inflight++;
+		}
+		if (!inflight)
+			break;
+
+		/*
+		 * Then wait for the oldest chunk.  Once one has failed, the
+		 * rest is waited for but no longer counted.
+		 */
+		c = &chunks[tail];
+		n = raw_chunk_done(c);
+		if (!failed) {
+			transferred += n;
+			if (n != c->iosize) {
+				err = c->iobuf->errno;
+				failed = 1;
+			}
+		}
+		tail = (tail + 1) % nr_chunks;
+		inflight--;
+	}
+	
+	for (i = 0; i < nr_chunks; i++)
+		bio_put(chunks[i].bio);
+	free_kiovec(nr_chunks, iobufs);
+
+	if (transferred) {
+		*offp += transferred;
+		return transferred;
+	}
+	
+	return err;
+}
+
+/*
+ * rw_raw_dev() for aio: each chunk gets its own kiobuf, and the IO is
+ * only started. The request completes when all of it is done.
+ */
+
+static ssize_t rw_raw_dev_async(int rw, struct kiocb *iocb, char *buf, 
+				size_t size, loff_t pos)
+{
+	struct kiobuf * iobuf;
+	int		err = 0;
+	unsigned long	blocknr, blocks;
+	unsigned long	b[KIO_MAX_SECTORS];
+	int		iosize;
+	int		i;
+	int		minor;
+	kdev_t		dev;
+	unsigned long	limit;
+
+	int		sector_size, sector_bits, sector_mask;
+	int		max_sectors;
+
+	minor = MINOR(iocb->ki_filp->f_dentry->d_inode->i_rdev);
+	dev = to_kdev_t(raw_device_bindings[minor]->bd_dev);
+	sector_size = raw_device_sector_size[minor];
+	sector_bits = raw_device_sector_bits[minor];
+	sector_mask = sector_size- 1;
+	max_sectors = KIO_MAX_SECTORS >> (sector_bits - 9);
+	
+	if (blk_size[MAJOR(dev)])
+		limit = (((loff_t) blk_size[MAJOR(dev)][MINOR(dev)]) << BLOCK_SIZE_BITS) >> sector_bits;
+	else
+		limit = INT_MAX;
+
+	if ((pos & sector_mask) || (size & sector_mask))
+		return -EINVAL;
+	if ((pos >> sector_bits) > limit)
+		return 0;
+
+	blocknr = pos >> sector_bits;
 	while (size > 0) {
 		blocks = size >> sector_bits;
 		if (blocks > max_sectors)
@@ -307,38 +521,23 @@ ssize_t	rw_raw_dev(int rw, struct file *filp, char *buf,
 
 		iosize = blocks << sector_bits;
 
-		err = map_user_kiobuf(rw, iobuf, (unsigned long) buf, iosize);
-		if (err)
-			break;
-#if 0
-		err = lock_kiovec(1, &iobuf, 1);
-		if (err) 
+		iobuf = aio_map_kiobuf(iocb, rw, buf, iosize);
+		if (IS_ERR(iobuf)) {
+			err = PTR_ERR(iobuf);
 			break;
-#endif
-	
-		for (i=0; i < blocks; i++) 
-			b[i] = blocknr++;
-		
-		err = brw_kiovec(rw, 1, &iobuf, dev, b, sector_size);
-
-		if (err >= 0) {
-			transferred += err;
-			size -= err;
-			buf += err;
 		}
 
-		unmap_kiobuf(iobuf); /* The unlock_kiobuf is implicit here */
+		for (i=0; i < blocks; i++) 
+			b[i] = blocknr++;
 
-		if (err != iosize)
+		err = brw_kiovec_async(rw, iobuf, dev, b, sector_size);
+		if (err) {
+			aio_kiobuf_error(iobuf, err);
 			break;
+		}
+		size -= iosize;
+		buf += iosize;
 	}
-	
-	free_kiovec(1, &iobuf);
 
-	if (transferred) {
-		*offp += transferred;
-		return transferred;
-	}
-	
-	return err;
+	return iocb->ki_nr_iobufs ? -EIOCBQUEUED : err;
 }
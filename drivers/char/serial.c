@@ -570,7 +570,7 @@ static _INLINE_ void receive_chars(struct async_struct *info,
 	icount = &info->state->icount;
 	do {
 		ch = serial_inp(info, UART_RX);
-		if (tty->flip.count >= TTY_FLIPBUF_SIZE)
+		if (tty->flip.count >= tty->flip.size)
 			goto ignore_char;
 		*tty->flip.char_buf_ptr = ch;
 		icount->rx++;
@@ -649,7 +649,7 @@ static _INLINE_ void receive_chars(struct async_struct *info,
 				tty->flip.flag_buf_ptr++;
 				tty->flip.char_buf_ptr++;
 				*tty->flip.flag_buf_ptr = TTY_OVERRUN;
-				if (tty->flip.count >= TTY_FLIPBUF_SIZE)
+				if (tty->flip.count >= tty->flip.size)
 					goto ignore_char;
 			}
 		}
@@ -176,6 +176,8 @@ static inline struct tty_struct *alloc_tty_struct(void)
 
 static inline void free_tty_struct(struct tty_struct *tty)
 {
+	if (tty->flip.char_base != tty->flip.char_buf)
+		kfree(tty->flip.char_base);
 	if (PAGE_SIZE > 8192)
 		kfree(tty);
 	else
@@ -1876,22 +1878,19 @@ static void flush_to_ldisc(void *private_)
 		queue_task(&tty->flip.tqueue, &tq_timer);
 		return;
 	}
+	save_flags(flags); cli();
 	if (tty->flip.buf_num) {
-		cp = tty->flip.char_buf + TTY_FLIPBUF_SIZE;
-		fp = tty->flip.flag_buf + TTY_FLIPBUF_SIZE;
+		cp = tty->flip.char_base + tty->flip.size;
+		fp = tty->flip.flag_base + tty->flip.size;
 		tty->flip.buf_num = 0;
-
-		save_flags(flags); cli();
-		tty->flip.char_buf_ptr = tty->flip.char_buf;
-		tty->flip.flag_buf_ptr = tty->flip.flag_buf;
+		tty->flip.char_buf_ptr = tty->flip.char_base;
+		tty->flip.flag_buf_ptr = tty->flip.flag_base;
 	} else {
-		cp = tty->flip.char_buf;
-		fp = tty->flip.flag_buf;
+		cp = tty->flip.char_base;
+		fp = tty->flip.flag_base;
 		tty->flip.buf_num = 1;
-
-		save_flags(flags); cli();
-		tty->flip.char_buf_ptr = tty->flip.char_buf + TTY_FLIPBUF_SIZE;
-		tty->flip.flag_buf_ptr = tty->flip.flag_buf + TTY_FLIPBUF_SIZE;
+		tty->flip.char_buf_ptr = tty->flip.char_base + tty->flip.size;
+		tty->flip.flag_buf_ptr = tty->flip.flag_base + tty->flip.size;
 	}
 	count = tty->flip.count;
 	tty->flip.count = 0;
@@ -1900,6 +1899,42 @@ static void flush_to_ldisc(void *private_)
 	tty->ldisc.receive_buf(tty, cp, fp, count);
 }
 
+/*
+ * The flip buffer is emptied once a tick, and from 460800 baud on a line
+ * can deliver more than half of the 512 bytes in a tick.  Those get a
+ * TTY_FLIPBUF_MAX buffer the first time they are set to such a speed.
+ * The characters not yet pushed are moved over with interrupts off; the
+ * half flush_to_ldisc() may be working on is the embedded one, which
+ * stays valid.  The buffer is only freed with the tty.
+ */
+void tty_flip_buffer_grow(struct tty_struct *tty)
+{
+	unsigned char *buf;
+	unsigned long flags;
+	int from, to;
+
+	if (tty->flip.size >= TTY_FLIPBUF_MAX ||
+	    tty->driver.type == TTY_DRIVER_TYPE_PTY ||
+	    tty_get_baud_rate(tty) / (10 * HZ) < TTY_FLIPBUF_SIZE / 2)
+		return;
+	buf = kmalloc(4 * TTY_FLIPBUF_MAX, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	save_flags(flags); cli();
+	from = tty->flip.buf_num ? tty->flip.size : 0;
+	to = tty->flip.buf_num ? TTY_FLIPBUF_MAX : 0;
+	memcpy(buf + to, tty->flip.char_base + from, tty->flip.count);
+	memcpy(buf + 2 * TTY_FLIPBUF_MAX + to, tty->flip.flag_base + from,
+	       tty->flip.count);
+	tty->flip.char_base = buf;
+	tty->flip.flag_base = (char *) buf + 2 * TTY_FLIPBUF_MAX;
+	tty->flip.char_buf_ptr = tty->flip.char_base + to + tty->flip.count;
+	tty->flip.flag_buf_ptr = tty->flip.flag_base + to + tty->flip.count;
+	tty->flip.size = TTY_FLIPBUF_MAX;
+	restore_flags(flags);
+}
+
 /*
  * Routine which returns the baud rate of the tty
  *
@@ -1961,6 +1996,9 @@ static void initialize_tty_struct(struct tty_struct *tty)
 	tty->magic = TTY_MAGIC;
 	tty->ldisc = ldiscs[N_TTY];
 	tty->pgrp = -1;
+	tty->flip.char_base = tty->flip.char_buf;
+	tty->flip.flag_base = tty->flip.flag_buf;
+	tty->flip.size = TTY_FLIPBUF_SIZE;
 	tty->flip.char_buf_ptr = tty->flip.char_buf;
 	tty->flip.flag_buf_ptr = tty->flip.flag_buf;
 	tty->flip.tqueue.routine = flush_to_ldisc;
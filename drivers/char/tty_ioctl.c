@@ -137,6 +137,7 @@ static void change_termios(struct tty_struct * tty, struct termios * new_termios
 
 	if (tty->driver.set_termios)
 		(*tty->driver.set_termios)(tty, &old_termios);
+	tty_flip_buffer_grow(tty);
 
 	if (tty->ldisc.set_termios)
 		(*tty->ldisc.set_termios)(tty, &old_termios);
@@ -420,6 +420,10 @@ static ide_startstop_t do_rw_disk (ide_drive_t *drive, struct request *rq, unsig
 		return do_pdc4030_io (drive, rq);
 	}
 #endif /* CONFIG_BLK_DEV_PDC4030 */
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+	if (drive->using_tcq && drive->using_dma && (rq->cmd == READ || rq->cmd == WRITE))
+		return ide_tcq_do_rw(drive, rq);
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
 	if (rq->cmd == READ) {
 #ifdef CONFIG_BLK_DEV_IDEDMA
 		if (drive->using_dma && !(HWIF(drive)->dmaproc(ide_dma_read, drive)))
@@ -706,6 +710,10 @@ static void idedisk_add_settings(ide_drive_t *drive)
 	ide_add_setting(drive,	"file_readahead",	SETTING_RW,					BLKFRAGET,		BLKFRASET,		TYPE_INTA,	0,	INT_MAX,			1,	1024,	&max_readahead[major][minor],	NULL);
 	ide_add_setting(drive,	"max_kb_per_request",	SETTING_RW,					BLKSECTGET,		BLKSECTSET,		TYPE_INTA,	1,	255,				1,	2,	&max_sectors[major][minor],	NULL);
 	ide_add_setting(drive,	"lun",			SETTING_RW,					-1,			-1,			TYPE_INT,	0,	7,				1,	1,	&drive->lun,			NULL);
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+	ide_add_setting(drive,	"using_tcq",		SETTING_RW,					-1,			-1,			TYPE_BYTE,	0,	1,				1,	1,	&drive->using_tcq,		ide_tcq_set);
+	ide_add_setting(drive,	"queue_depth",		SETTING_RW,					-1,			-1,			TYPE_BYTE,	1,	IDE_MAX_TAG,			1,	1,	&drive->queue_depth,		ide_tcq_set_depth);
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
 }
 
 /*
@@ -742,7 +750,16 @@ static ide_module_t idedisk_module = {
 
 static int idedisk_cleanup (ide_drive_t *drive)
 {
-	return ide_unregister_subdriver(drive);
+	if (ide_unregister_subdriver(drive))
+		return 1;
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+	drive->using_tcq = 0;
+	if (drive->tcq != NULL) {
+		kfree(drive->tcq);
+		drive->tcq = NULL;
+	}
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
+	return 0;
 }
 
 static void idedisk_setup (ide_drive_t *drive)
@@ -847,6 +864,10 @@ static void idedisk_setup (ide_drive_t *drive)
 #endif
 	}
 	drive->no_io_32bit = id->dword_io ? 1 : 0;
+#ifdef CONFIG_BLK_DEV_IDE_TCQ_DEFAULT
+	if (drive->using_dma && HWIF(drive)->tcq_capable && (id->command_set_2 & 2))
+		(void) ide_tcq_set(drive, 1);
+#endif /* CONFIG_BLK_DEV_IDE_TCQ_DEFAULT */
 }
 
 int idedisk_init (void)
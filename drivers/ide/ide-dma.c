@@ -472,6 +472,22 @@ int ide_dmaproc (ide_dma_action_t func, ide_drive_t *drive)
 			return 0;
 		case ide_dma_check:
 			return config_drive_for_dma (drive);
+		case ide_dma_read_queued:
+		case ide_dma_write_queued:
+			/*
+			 * Tagged queueing: the command is already with the
+			 * drive, which is now asking for the data (ide-tcq.c).
+			 */
+			func = (func == ide_dma_read_queued) ? ide_dma_read : ide_dma_write;
+			reading = (func == ide_dma_read) << 3;
+			SELECT_READ_WRITE(hwif,drive,func);
+			if (!(count = ide_build_dmatable(drive, func)))
+				return 1;
+			outl(hwif->dmatable_dma, dma_base + 4); /* PRD table */
+			outb(reading, dma_base);			/* specify r/w */
+			outb(inb(dma_base+2)|6, dma_base+2);		/* clear INTR & ERROR flags */
+			drive->waiting_for_dma = 1;
+			return 0;
 		case ide_dma_read:
 			reading = 1 << 3;
 		case ide_dma_write:
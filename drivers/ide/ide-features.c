@@ -106,6 +106,8 @@ char *ide_dmafunc_verbose (ide_dma_action_t dmafunc)
 		case ide_dma_retune:		return("ide_dma_retune");
 		case ide_dma_lostirq:		return("ide_dma_lostirq");
 		case ide_dma_timeout:		return("ide_dma_timeout");
+		case ide_dma_read_queued:	return("ide_dma_read_queued");
+		case ide_dma_write_queued:	return("ide_dma_write_queued");
 		default:			return("unknown");
 	}
 }
@@ -705,6 +705,23 @@ check_if_enabled:
 				printk("%s: %s Bus-Master DMA disabled (BIOS)\n", hwif->name, d->name);
 			}
 		}
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+		/*
+		 * Chipsets known to cope with a drive releasing the bus in
+		 * the middle of a queued DMA command.
+		 */
+		if (hwif->dma_base &&
+		   (IDE_PCI_DEVID_EQ(d->devid, DEVID_PIIX4) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_PIIX4E) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_PIIX4E2) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_PIIX4U) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_PIIX4U2) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_PIIX4U3) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_VP_IDE) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_CMD648) ||
+		    IDE_PCI_DEVID_EQ(d->devid, DEVID_CMD649)))
+			hwif->tcq_capable = 1;
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
 #endif	/* CONFIG_BLK_DEV_IDEDMA */
 bypass_umc_dma:
 		if (d->init_hwif)  /* Call chipset-specific routine for each enabled hwif */
@@ -0,0 +1,315 @@
+/*
+ *  linux/drivers/ide/ide-tcq.c
+ *
+ *  May be copied or modified under the terms of the GNU General Public License
+ */
+
+/*
+ * ATA tagged command queueing ("overlapped and queued" feature set) for
+ * IDE disks using bus-master DMA.
+ *
+ * A queued READ/WRITE DMA carries a five bit tag in the sector count
+ * register.  The drive may start the transfer at once, or release the bus
+ * and come back for it later: it then sets SERV in the status register and,
+ * with the service interrupt enabled, raises an interrupt.  We answer with
+ * a SERVICE command, read back the tag of the command the drive wants to
+ * run, and do the DMA for it.
+ *
+ * While the bus is released the hwgroup is not busy, so ide_do_request()
+ * can queue further commands; ide_tcq_intr() stays installed as handler
+ * to catch the service interrupt.  Only reads and writes may be queued,
+ * anything else waits until the drive has drained its queue (see
+ * choose_drive()), and so does the other drive on the interface.
+ *
+ * Any error or timeout aborts the lot: outstanding requests go back on the
+ * queue, the interface is reset and the drive reverts to untagged DMA.
+ */
+
+#include <linux/config.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/timer.h>
+#include <linux/mm.h>
+#include <linux/malloc.h>
+#include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/blkdev.h>
+#include <linux/ide.h>
+
+#include <asm/io.h>
+
+#ifndef CONFIG_BLK_DEV_IDE_TCQ_DEPTH
+#define CONFIG_BLK_DEV_IDE_TCQ_DEPTH	8
+#endif
+
+#define SERVICE_STAT	SEEK_STAT	/* SERV shares the bit with DSC */
+#define RELEASE_BIT	0x04		/* sector count: bus released */
+
+#define IDE_TCQ_BUSY_POLL	1000		/* x 10us for BSY to clear */
+#define IDE_TCQ_POLL		(HZ/10)		/* look for a lost service irq */
+#define IDE_TCQ_TIMEOUT		WAIT_CMD	/* max time between completions */
+
+static ide_startstop_t ide_tcq_service (ide_drive_t *drive);
+
+/*
+ * Wait a little for the drive to take a queued or SERVICE command.
+ * Both complete quickly, so there is no point in taking an interrupt.
+ */
+static byte ide_tcq_wait_busy (ide_drive_t *drive)
+{
+	int i = IDE_TCQ_BUSY_POLL;
+	byte stat;
+
+	udelay(1);	/* BSY is not valid for 400ns after the command */
+	while (((stat = IDE_CONTROL_REG ? GET_ALTSTAT() : GET_STAT()) & BUSY_STAT) && --i)
+		udelay(10);
+	return stat;
+}
+
+/*
+ * Put every request the drive holds back on the queue, in front of
+ * whatever was queued meanwhile.
+ */
+static void ide_tcq_requeue (ide_drive_t *drive)
+{
+	ide_tag_info_t *tcq = drive->tcq;
+	struct request *rq;
+	unsigned long flags;
+	int tag;
+
+	spin_lock_irqsave(&io_request_lock, flags);
+	for (tag = IDE_MAX_TAG - 1; tag >= 0; tag--) {
+		if ((rq = tcq->tag_rq[tag]) == NULL)
+			continue;
+		/* requests for which the bus was released are off the queue */
+		if (list_empty(&rq->queue))
+			list_add(&rq->queue, &drive->queue.queue_head);
+		tcq->tag_rq[tag] = NULL;
+	}
+	tcq->tag_mask = 0;
+	tcq->queued = 0;
+	HWGROUP(drive)->rq = NULL;
+	spin_unlock_irqrestore(&io_request_lock, flags);
+}
+
+static ide_startstop_t ide_tcq_fail (ide_drive_t *drive, const char *msg, byte stat)
+{
+	if (drive->waiting_for_dma)
+		(void) HWIF(drive)->dmaproc(ide_dma_end, drive);
+	(void) ide_dump_status(drive, msg, stat);
+	ide_tcq_requeue(drive);
+	drive->using_tcq = 0;
+	printk("%s: tagged queueing disabled, reverting to untagged DMA\n", drive->name);
+	return ide_do_reset(drive);
+}
+
+static int ide_tcq_expiry (ide_drive_t *drive)
+{
+	byte stat = IDE_CONTROL_REG ? GET_ALTSTAT() : GET_STAT();
+
+	if (stat & SERVICE_STAT)
+		return 0;	/* lost the service interrupt */
+	if (0 < (signed long)(drive->tcq->last_service + IDE_TCQ_TIMEOUT - jiffies))
+		return IDE_TCQ_POLL;
+	return 0;		/* ide_tcq_intr() will give up */
+}
+
+/*
+ * Leave the bus to others until the drive asks for service.
+ */
+ide_startstop_t ide_tcq_idle (ide_drive_t *drive)
+{
+	ide_set_handler(drive, &ide_tcq_intr, IDE_TCQ_POLL, &ide_tcq_expiry);
+	return ide_stopped;
+}
+
+/*
+ * Handler while the bus is released: a service interrupt, or the timer.
+ */
+ide_startstop_t ide_tcq_intr (ide_drive_t *drive)
+{
+	byte stat = GET_STAT();
+
+	if (stat & (BUSY_STAT|ERR_STAT))
+		return ide_tcq_fail(drive, "tcq_intr", stat);
+	if (stat & SERVICE_STAT)
+		return ide_tcq_service(drive);
+	if (0 >= (signed long)(drive->tcq->last_service + IDE_TCQ_TIMEOUT - jiffies))
+		return ide_tcq_fail(drive, "service timeout", stat);
+	return ide_tcq_idle(drive);	/* shared irq, not for us */
+}
+
+/*
+ * The drive is ready to transfer the data of "tag": start the DMA.
+ */
+static ide_startstop_t ide_tcq_start_dma (ide_drive_t *drive, int tag)
+{
+	ide_tag_info_t *tcq = drive->tcq;
+	ide_hwif_t *hwif = HWIF(drive);
+	struct request *rq = tcq->tag_rq[tag];
+
+	HWGROUP(drive)->rq = rq;
+	tcq->active_tag = tag;
+	if (hwif->dmaproc(rq->cmd == READ ? ide_dma_read_queued : ide_dma_write_queued, drive))
+		return ide_tcq_fail(drive, "no DMA table", GET_STAT());
+	ide_set_handler(drive, &ide_tcq_dma_intr, WAIT_CMD, NULL);
+	(void) hwif->dmaproc(ide_dma_begin, drive);
+	return ide_started;
+}
+
+static ide_startstop_t ide_tcq_service (ide_drive_t *drive)
+{
+	ide_tag_info_t *tcq = drive->tcq;
+	byte stat;
+	int tag;
+
+	OUT_BYTE(WIN_QUEUED_SERVICE, IDE_COMMAND_REG);
+	stat = ide_tcq_wait_busy(drive);
+	if (stat & (BUSY_STAT|ERR_STAT))
+		return ide_tcq_fail(drive, "service", stat);
+	tag = IN_BYTE(IDE_NSECTOR_REG) >> 3;
+	if (!(stat & DRQ_STAT) || tcq->tag_rq[tag] == NULL)
+		return ide_tcq_fail(drive, "bad service tag", stat);
+	return ide_tcq_start_dma(drive, tag);
+}
+
+/*
+ * End of a queued DMA transfer.
+ */
+ide_startstop_t ide_tcq_dma_intr (ide_drive_t *drive)
+{
+	ide_tag_info_t *tcq = drive->tcq;
+	ide_hwgroup_t *hwgroup = HWGROUP(drive);
+	struct request *rq = tcq->tag_rq[tcq->active_tag];
+	byte stat, dma_stat;
+	int i;
+
+	dma_stat = HWIF(drive)->dmaproc(ide_dma_end, drive);
+	stat = GET_STAT();
+	if (dma_stat || !OK_STAT(stat, READY_STAT, drive->bad_wstat|DRQ_STAT))
+		return ide_tcq_fail(drive, "queued dma_intr", stat);
+
+	tcq->tag_rq[tcq->active_tag] = NULL;
+	tcq->tag_mask &= ~(1UL << tcq->active_tag);
+	tcq->queued--;
+	tcq->last_service = jiffies;
+
+	hwgroup->rq = rq;
+	for (i = rq->nr_sectors; i > 0;) {
+		i -= rq->current_nr_sectors;
+		ide_end_request(1, hwgroup);
+	}
+
+	if (stat & SERVICE_STAT)
+		return ide_tcq_service(drive);
+	if (tcq->queued)
+		return ide_tcq_idle(drive);
+	return ide_stopped;
+}
+
+/*
+ * ide_tcq_do_rw() queues a READ or WRITE to the drive.  do_rw_disk()
+ * has already selected the drive and loaded the block address.
+ */
+ide_startstop_t ide_tcq_do_rw (ide_drive_t *drive, struct request *rq)
+{
+	ide_tag_info_t *tcq = drive->tcq;
+	unsigned long flags;
+	byte stat;
+	int tag;
+
+	for (tag = 0; tag < drive->queue_depth; tag++)
+		if (!(tcq->tag_mask & (1UL << tag)))
+			break;
+	if (tag == drive->queue_depth)
+		return ide_tcq_fail(drive, "no free tag", GET_STAT());
+
+	tcq->tag_mask |= 1UL << tag;
+	tcq->tag_rq[tag] = rq;
+	if (!tcq->queued++)
+		tcq->last_service = jiffies;
+
+	OUT_BYTE(rq->nr_sectors, IDE_FEATURE_REG);
+	OUT_BYTE(tag << 3, IDE_NSECTOR_REG);
+	OUT_BYTE(rq->cmd == READ ? WIN_READDMA_QUEUED : WIN_WRITEDMA_QUEUED, IDE_COMMAND_REG);
+
+	stat = ide_tcq_wait_busy(drive);
+	if (stat & (BUSY_STAT|ERR_STAT))
+		return ide_tcq_fail(drive, "queued command", stat);
+	if (stat & DRQ_STAT)
+		return ide_tcq_start_dma(drive, tag);
+	if (!(IN_BYTE(IDE_NSECTOR_REG) & RELEASE_BIT))
+		return ide_tcq_fail(drive, "queued command not released", stat);
+
+	/*
+	 * The drive released the bus: the request now lives in the tag
+	 * table until the drive asks for it.
+	 */
+	spin_lock_irqsave(&io_request_lock, flags);
+	blkdev_dequeue_request(rq);
+	INIT_LIST_HEAD(&rq->queue);
+	HWGROUP(drive)->rq = NULL;
+	spin_unlock_irqrestore(&io_request_lock, flags);
+
+	if (stat & SERVICE_STAT)
+		return ide_tcq_service(drive);
+	return ide_tcq_idle(drive);
+}
+
+/*
+ * ide_tcq_set() turns tagged queueing on or off for a drive, through
+ * the "using_tcq" setting or from idedisk_setup().
+ */
+int ide_tcq_set (ide_drive_t *drive, int on)
+{
+	struct hd_driveid *id = drive->id;
+
+	if (!on) {
+		if (!drive->using_tcq)
+			return 0;
+		/*
+		 * New requests go out untagged from here on; the
+		 * SETFEATURES waits until the queued ones are done.
+		 */
+		drive->using_tcq = 0;
+		(void) ide_wait_cmd(drive, WIN_SETFEATURES, 0, SETFEATURES_DIS_SI, 0, NULL);
+		return 0;
+	}
+	if (drive->using_tcq)
+		return 0;
+	if (id == NULL || !(id->command_set_2 & 2) || !HWIF(drive)->tcq_capable)
+		return -EPERM;
+	if (!drive->using_dma)
+		return -EIO;
+	if (drive->tcq == NULL) {
+		drive->tcq = kmalloc(sizeof(ide_tag_info_t), GFP_KERNEL);
+		if (drive->tcq == NULL)
+			return -ENOMEM;
+		memset(drive->tcq, 0, sizeof(ide_tag_info_t));
+	}
+	if (!drive->queue_depth)
+		drive->queue_depth = CONFIG_BLK_DEV_IDE_TCQ_DEPTH;
+	if (drive->queue_depth > (id->queue_depth & 0x1f) + 1)
+		drive->queue_depth = (id->queue_depth & 0x1f) + 1;
+	if (drive->queue_depth > IDE_MAX_TAG)
+		drive->queue_depth = IDE_MAX_TAG;
+
+	if (ide_wait_cmd(drive, WIN_SETFEATURES, 0, SETFEATURES_DIS_RI, 0, NULL) ||
+	    ide_wait_cmd(drive, WIN_SETFEATURES, 0, SETFEATURES_EN_SI, 0, NULL)) {
+		printk("%s: unable to set up tagged queueing\n", drive->name);
+		return -EIO;
+	}
+	drive->using_tcq = 1;
+	printk("%s: tagged queueing enabled, depth %d\n", drive->name, drive->queue_depth);
+	return 0;
+}
+
+int ide_tcq_set_depth (ide_drive_t *drive, int depth)
+{
+	struct hd_driveid *id = drive->id;
+
+	if (id != NULL && (id->command_set_2 & 2) && depth > (id->queue_depth & 0x1f) + 1)
+		return -EINVAL;
+	drive->queue_depth = depth;
+	return 0;
+}
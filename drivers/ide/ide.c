@@ -1215,6 +1215,27 @@ static inline ide_drive_t *choose_drive (ide_hwgroup_t *hwgroup)
 {
 	ide_drive_t *drive, *best;
 
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+	/*
+	 * A drive holding tagged commands keeps the interface until they
+	 * are done: only further reads and writes can be queued to it, and
+	 * only while it has a free tag.  Anything else waits for the drain.
+	 */
+	drive = hwgroup->drive;
+	if (IDE_TCQ_QUEUED(drive)) {
+		struct request *rq;
+
+		if (list_empty(&drive->queue.queue_head) || drive->queue.plugged)
+			return NULL;
+		if (!drive->using_tcq || drive->tcq->queued >= drive->queue_depth)
+			return NULL;
+		rq = blkdev_entry_next_request(&drive->queue.queue_head);
+		if (rq->cmd != READ && rq->cmd != WRITE)
+			return NULL;
+		return drive;
+	}
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
+
 repeat:	
 	best = NULL;
 	drive = hwgroup->drive;
@@ -1307,7 +1328,7 @@ static void ide_do_request(ide_hwgroup_t *hwgroup, int masked_irq)
 				if (drive->sleep && (!sleep || 0 < (signed long)(sleep - drive->sleep)))
 					sleep = drive->sleep;
 			} while ((drive = drive->next) != hwgroup->drive);
-			if (sleep) {
+			if (sleep && !IDE_TCQ_IDLE(hwgroup)) {
 				/*
 				 * Take a short snooze, and then wake up this hwgroup again.
 				 * This gives other hwgroups on the same a chance to
@@ -1339,6 +1360,14 @@ static void ide_do_request(ide_hwgroup_t *hwgroup, int masked_irq)
 		hwgroup->drive = drive;
 		drive->sleep = 0;
 		drive->service_start = jiffies;
+		if (IDE_TCQ_IDLE(hwgroup)) {
+			/*
+			 * Take the bus back from a drive waiting to be serviced;
+			 * ide-tcq.c picks up its service request after queueing.
+			 */
+			hwgroup->handler = NULL;
+			del_timer(&hwgroup->timer);
+		}
 
 		if ( drive->queue.plugged )	/* paranoia */
 			printk("%s: Huh? nuking plugged queue\n", drive->name);
@@ -1356,6 +1385,11 @@ static void ide_do_request(ide_hwgroup_t *hwgroup, int masked_irq)
 		spin_unlock(&io_request_lock);
 		ide__sti();	/* allow other IRQs while we start this request */
 		startstop = start_request(drive);
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+		/* a request refused up front must not orphan the queued ones */
+		if (startstop == ide_stopped && IDE_TCQ_QUEUED(drive) && hwgroup->handler == NULL)
+			startstop = ide_tcq_idle(drive);
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
 		spin_lock_irq(&io_request_lock);
 		if (masked_irq && hwif->irq != masked_irq)
 			enable_irq(hwif->irq);
@@ -1417,7 +1451,7 @@ void ide_timer_expiry (unsigned long data)
 		} else {
 			ide_hwif_t *hwif;
 			ide_startstop_t startstop;
-			if (!hwgroup->busy) {
+			if (!hwgroup->busy && !IDE_TCQ_IDLE(hwgroup)) {
 				hwgroup->busy = 1;	/* paranoia */
 				printk("%s: ide_timer_expiry: hwgroup->busy was 0 ??\n", drive->name);
 			}
@@ -1431,6 +1465,7 @@ void ide_timer_expiry (unsigned long data)
 					return;
 				}
 			}
+			hwgroup->busy = 1;
 			hwgroup->handler = NULL;
 			/*
 			 * We need to simulate a real interrupt when invoking
@@ -1445,7 +1480,8 @@ void ide_timer_expiry (unsigned long data)
 			disable_irq(hwif->irq);	/* disable_irq_nosync ?? */
 #endif /* DISABLE_IRQ_NOSYNC */
 			__cli();	/* local CPU only, as if we were handling an interrupt */
-			if (hwgroup->poll_timeout != 0) {
+			if (hwgroup->poll_timeout != 0 || IDE_TCQ_HANDLER(handler)) {
+				/* tagged queueing sorts out its own timeouts */
 				startstop = handler(drive);
 			} else if (drive_is_ready(drive)) {
 				if (drive->waiting_for_dma)
@@ -1593,8 +1629,9 @@ void ide_intr (int irq, void *dev_id, struct pt_regs *regs)
 		return;
 	}
 	if (!hwgroup->busy) {
-		hwgroup->busy = 1;	/* paranoia */
-		printk("%s: ide_intr: hwgroup->busy was 0 ??\n", drive->name);
+		hwgroup->busy = 1;	/* paranoia, unless a queued drive wants service */
+		if (!IDE_TCQ_IDLE(hwgroup))
+			printk("%s: ide_intr: hwgroup->busy was 0 ??\n", drive->name);
 	}
 	hwgroup->handler = NULL;
 	del_timer(&hwgroup->timer);
@@ -1615,7 +1652,7 @@ void ide_intr (int irq, void *dev_id, struct pt_regs *regs)
 	set_recovery_timer(HWIF(drive));
 	drive->service_time = jiffies - drive->service_start;
 	if (startstop == ide_stopped) {
-		if (hwgroup->handler == NULL) {	/* paranoia */
+		if (hwgroup->handler == NULL || IDE_TCQ_IDLE(hwgroup)) {	/* paranoia */
 			hwgroup->busy = 0;
 			ide_do_request(hwgroup, hwif->irq);
 		} else {
@@ -3543,6 +3580,11 @@ EXPORT_SYMBOL(ide_wait_cmd);
 EXPORT_SYMBOL(ide_wait_cmd_task);
 EXPORT_SYMBOL(ide_delay_50ms);
 EXPORT_SYMBOL(ide_stall_queue);
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+EXPORT_SYMBOL(ide_tcq_do_rw);
+EXPORT_SYMBOL(ide_tcq_set);
+EXPORT_SYMBOL(ide_tcq_set_depth);
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
 #ifdef CONFIG_PROC_FS
 EXPORT_SYMBOL(ide_add_proc_entries);
 EXPORT_SYMBOL(ide_remove_proc_entries);
@@ -23,6 +23,7 @@
 
 #include <linux/kernel.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <linux/blkdev.h>
 #include <linux/smp_lock.h>
 #include <linux/types.h>
@@ -54,6 +55,9 @@ uint lvm_pv_get_number(vg_t * vg, kdev_t rdev)
 #define hashfn(dev,block,mask,chunk_size) \
 	((HASHDEV(dev)^((block)/(chunk_size))) & (mask))
 
+/* snapshots of one original whose chunk copies are done together */
+#define LVM_COW_BATCH	8
+
 static inline lv_block_exception_t *
 lvm_find_exception_table(kdev_t org_dev, unsigned long org_start, lv_t * lv)
 {
@@ -223,129 +227,136 @@ void lvm_snapshot_fill_COW_page(vg_t * vg, lv_t * lv_snap)
 
 
 /*
- * writes a COW exception table sector to disk (HM)
- *
+ * waits for brw_kiovec_async() IO on a snapshot iobuf
  */
+static int lvm_snapshot_wait_io(struct kiobuf * iobuf)
+{
+	kiobuf_wait_for_io(iobuf);
+	brw_kiovec_done(iobuf);
+	return iobuf->errno;
+}
 
-int lvm_write_COW_table_block(vg_t * vg,
-			      lv_t * lv_snap)
+/*
+ * where the COW table entry of exception idx is stored on disk (HM)
+ */
+static kdev_t lvm_COW_table_block(vg_t * vg, lv_t * lv_snap, int idx,
+				  ulong * block, int * blksize)
 {
-	int blksize_snap;
-	int end_of_table;
-	int idx = lv_snap->lv_remap_ptr, idx_COW_table;
-	int nr_pages_tmp;
-	int length_tmp;
-	ulong snap_pe_start, COW_table_sector_offset,
-	      COW_entries_per_pe, COW_chunks_per_pe, COW_entries_per_block;
-	ulong blocks[1];
-	const char * reason;
+	ulong snap_pe_start, COW_table_sector_offset, COW_entries_per_pe;
 	kdev_t snap_phys_dev;
-	struct kiobuf * iobuf = lv_snap->lv_iobuf;
-	struct page * page_tmp;
-	lv_COW_table_disk_t * lv_COW_table =
-	   ( lv_COW_table_disk_t *) page_address(lv_snap->lv_COW_table_page);
 
-	idx--;
-
-	COW_chunks_per_pe = LVM_GET_COW_TABLE_CHUNKS_PER_PE(vg, lv_snap);
 	COW_entries_per_pe = LVM_GET_COW_TABLE_ENTRIES_PER_PE(vg, lv_snap);
 
 	/* get physical addresse of destination chunk */
 	snap_phys_dev = lv_snap->lv_block_exception[idx].rdev_new;
 	snap_pe_start = lv_snap->lv_block_exception[idx - (idx % COW_entries_per_pe)].rsector_new - lv_snap->lv_chunk_size;
 
-	blksize_snap = lvm_get_blksize(snap_phys_dev);
+	*blksize = lvm_get_blksize(snap_phys_dev);
+
+	/* sector offset into the on disk COW table */
+	COW_table_sector_offset = (idx % COW_entries_per_pe) / (SECTOR_SIZE / sizeof(lv_COW_table_disk_t));
+
+	*block = (snap_pe_start + COW_table_sector_offset) >> (*blksize >> 10);
+	return snap_phys_dev;
+}
+
+
+/*
+ * stores the COW table entry of the last exception and starts writing
+ * its COW exception table block to disk (HM)
+ */
+static int lvm_start_COW_table_block(vg_t * vg, lv_t * lv_snap)
+{
+	int blksize_snap;
+	int idx = lv_snap->lv_remap_ptr - 1, idx_COW_table;
+	ulong COW_entries_per_pe, COW_entries_per_block;
+	ulong blocks[1];
+	kdev_t snap_phys_dev;
+	struct kiobuf * iobuf = lv_snap->lv_COW_table_iobuf;
+	lv_COW_table_disk_t * lv_COW_table =
+	   ( lv_COW_table_disk_t *) page_address(lv_snap->lv_COW_table_page);
+
+	COW_entries_per_pe = LVM_GET_COW_TABLE_ENTRIES_PER_PE(vg, lv_snap);
+	snap_phys_dev = lvm_COW_table_block(vg, lv_snap, idx,
+					    blocks, &blksize_snap);
 
         COW_entries_per_block = blksize_snap / sizeof(lv_COW_table_disk_t);
         idx_COW_table = idx % COW_entries_per_pe % COW_entries_per_block;
 
 	if ( idx_COW_table == 0) memset(lv_COW_table, 0, blksize_snap);
 
-	/* sector offset into the on disk COW table */
-	COW_table_sector_offset = (idx % COW_entries_per_pe) / (SECTOR_SIZE / sizeof(lv_COW_table_disk_t));
-
-        /* COW table block to write next */
-	blocks[0] = (snap_pe_start + COW_table_sector_offset) >> (blksize_snap >> 10);
-
 	/* store new COW_table entry */
 	lv_COW_table[idx_COW_table].pv_org_number = LVM_TO_DISK64(lvm_pv_get_number(vg, lv_snap->lv_block_exception[idx].rdev_org));
 	lv_COW_table[idx_COW_table].pv_org_rsector = LVM_TO_DISK64(lv_snap->lv_block_exception[idx].rsector_org);
 	lv_COW_table[idx_COW_table].pv_snap_number = LVM_TO_DISK64(lvm_pv_get_number(vg, snap_phys_dev));
 	lv_COW_table[idx_COW_table].pv_snap_rsector = LVM_TO_DISK64(lv_snap->lv_block_exception[idx].rsector_new);
 
-	length_tmp = iobuf->length;
 	iobuf->length = blksize_snap;
-	page_tmp = iobuf->maplist[0];
-        iobuf->maplist[0] = lv_snap->lv_COW_table_page;
-	nr_pages_tmp = iobuf->nr_pages;
-	iobuf->nr_pages = 1;
+	return brw_kiovec_async(WRITE, iobuf, snap_phys_dev,
+				blocks, blksize_snap);
+}
 
-	if (brw_kiovec(WRITE, 1, &iobuf, snap_phys_dev,
-		       blocks, blksize_snap) != blksize_snap)
-		goto fail_raw_write;
+/*
+ * waits for the COW table block written by lvm_start_COW_table_block();
+ * if that block is full, the next one gets initialized with zeroes (HM)
+ */
+static int lvm_end_COW_table_block(vg_t * vg, lv_t * lv_snap)
+{
+	int blksize_snap;
+	int end_of_table;
+	int idx = lv_snap->lv_remap_ptr - 1, idx_COW_table;
+	ulong COW_entries_per_pe, COW_entries_per_block;
+	ulong blocks[1];
+	kdev_t snap_phys_dev;
+	struct kiobuf * iobuf = lv_snap->lv_COW_table_iobuf;
 
+	if (lvm_snapshot_wait_io(iobuf))
+		return -EIO;
 
-	/* initialization of next COW exception table block with zeroes */
-	end_of_table = idx % COW_entries_per_pe == COW_entries_per_pe - 1;
-	if (idx_COW_table % COW_entries_per_block == COW_entries_per_block - 1 || end_of_table)
-	{
-		/* don't go beyond the end */
-		if (idx + 1 >= lv_snap->lv_remap_end) goto good_out;
+	COW_entries_per_pe = LVM_GET_COW_TABLE_ENTRIES_PER_PE(vg, lv_snap);
+	snap_phys_dev = lvm_COW_table_block(vg, lv_snap, idx,
+					    blocks, &blksize_snap);
 
-		memset(lv_COW_table, 0, blksize_snap);
+        COW_entries_per_block = blksize_snap / sizeof(lv_COW_table_disk_t);
+        idx_COW_table = idx % COW_entries_per_pe % COW_entries_per_block;
 
-		if (end_of_table)
-		{
-			idx++;
-			snap_phys_dev = lv_snap->lv_block_exception[idx].rdev_new;
-			snap_pe_start = lv_snap->lv_block_exception[idx - (idx % COW_entries_per_pe)].rsector_new - lv_snap->lv_chunk_size;
-			blksize_snap = lvm_get_blksize(snap_phys_dev);
-			blocks[0] = snap_pe_start >> (blksize_snap >> 10);
-		} else blocks[0]++;
-
-		if (brw_kiovec(WRITE, 1, &iobuf, snap_phys_dev,
-			       blocks, blksize_snap) != blksize_snap)
-			goto fail_raw_write;
-	}
+	end_of_table = idx % COW_entries_per_pe == COW_entries_per_pe - 1;
+	if (idx_COW_table % COW_entries_per_block != COW_entries_per_block - 1 && !end_of_table)
+		return 0;
 
+	/* don't go beyond the end */
+	if (idx + 1 >= lv_snap->lv_remap_end)
+		return 0;
 
- good_out:
-	iobuf->length = length_tmp;
-        iobuf->maplist[0] = page_tmp;
-	iobuf->nr_pages = nr_pages_tmp;
-	return 0;
+	memset(page_address(lv_snap->lv_COW_table_page), 0, blksize_snap);
 
-	/* slow path */
- out:
-	lvm_drop_snapshot(lv_snap, reason);
-	return 1;
+	if (end_of_table)
+		snap_phys_dev = lvm_COW_table_block(vg, lv_snap, idx + 1,
+						    blocks, &blksize_snap);
+	else
+		blocks[0]++;
 
- fail_raw_write:
-	reason = "write error";
-	goto out;
+	iobuf->length = blksize_snap;
+	if (brw_kiovec(WRITE, 1, &iobuf, snap_phys_dev,
+		       blocks, blksize_snap) != blksize_snap)
+		return -EIO;
+	return 0;
 }
 
 /*
- * copy on write handler for one snapshot logical volume
- *
- * read the original blocks and store it/them on the new one(s).
- * if there is no exception storage space free any longer --> release snapshot.
- *
- * this routine gets called for each _first_ write to a physical chunk.
+ * COW step 1: start reading the original chunk into the snapshot iobuf
  */
-int lvm_snapshot_COW(kdev_t org_phys_dev,
-		     unsigned long org_phys_sector,
-		     unsigned long org_pe_start,
-		     unsigned long org_virt_sector,
-		     lv_t * lv_snap)
+static int lvm_snapshot_COW_read(kdev_t org_phys_dev,
+				 unsigned long org_phys_sector,
+				 unsigned long org_pe_start,
+				 unsigned long org_virt_sector,
+				 lv_t * lv_snap)
 {
 	const char * reason;
 	unsigned long org_start, snap_start, snap_phys_dev, virt_start, pe_off;
 	int idx = lv_snap->lv_remap_ptr, chunk_size = lv_snap->lv_chunk_size;
 	struct kiobuf * iobuf;
-	unsigned long blocks[KIO_MAX_SECTORS];
-	int blksize_snap, blksize_org, min_blksize, max_blksize;
-	int max_sectors, nr_sectors;
+	int blksize_snap, blksize_org, max_blksize;
 
 	/* check if we are out of snapshot space */
 	if (idx >= lv_snap->lv_remap_end)
@@ -373,57 +384,33 @@ int lvm_snapshot_COW(kdev_t org_phys_dev,
 	       chunk_size,
 	       org_pe_start, pe_off,
 	       org_virt_sector);
-#endif
 
-	iobuf = lv_snap->lv_iobuf;
+	/* invalidate the logical snapshot buffer cache */
+	invalidate_snap_cache(virt_start, lv_snap->lv_chunk_size,
+			      lv_snap->lv_dev);
+#endif
 
 	blksize_org = lvm_get_blksize(org_phys_dev);
 	blksize_snap = lvm_get_blksize(snap_phys_dev);
 	max_blksize = max(blksize_org, blksize_snap);
-	min_blksize = min(blksize_org, blksize_snap);
-	max_sectors = KIO_MAX_SECTORS * (min_blksize>>9);
 
 	if (chunk_size % (max_blksize>>9))
 		goto fail_blksize;
 
-	while (chunk_size)
-	{
-		nr_sectors = min(chunk_size, max_sectors);
-		chunk_size -= nr_sectors;
-
-		iobuf->length = nr_sectors << 9;
-
-		lvm_snapshot_prepare_blocks(blocks, org_start,
-					    nr_sectors, blksize_org);
-		if (brw_kiovec(READ, 1, &iobuf, org_phys_dev,
-			       blocks, blksize_org) != (nr_sectors<<9))
-			goto fail_raw_read;
-
-		lvm_snapshot_prepare_blocks(blocks, snap_start,
-					    nr_sectors, blksize_snap);
-		if (brw_kiovec(WRITE, 1, &iobuf, snap_phys_dev,
-			       blocks, blksize_snap) != (nr_sectors<<9))
-			goto fail_raw_write;
-	}
-
-#ifdef DEBUG_SNAPSHOT
-	/* invalidate the logical snapshot buffer cache */
-	invalidate_snap_cache(virt_start, lv_snap->lv_chunk_size,
-			      lv_snap->lv_dev);
-#endif
-
-	/* the original chunk is now stored on the snapshot volume
-	   so update the execption table */
+	/* the exception is not linked before the copy is on disk */
 	lv_snap->lv_block_exception[idx].rdev_org = org_phys_dev;
 	lv_snap->lv_block_exception[idx].rsector_org = org_start;
 
-	lvm_hash_link(lv_snap->lv_block_exception + idx,
-		      org_phys_dev, org_start, lv_snap);
-	lv_snap->lv_remap_ptr = idx + 1;
-	if (lv_snap->lv_snapshot_use_rate > 0) {
-		if (lv_snap->lv_remap_ptr * 100 / lv_snap->lv_remap_end >= lv_snap->lv_snapshot_use_rate)
-			wake_up_interruptible(&lv_snap->lv_snapshot_wait);
-	}
+	/* the whole chunk goes in one go, the iobuf holds a chunk */
+	iobuf = lv_snap->lv_iobuf;
+	iobuf->offset = 0;
+	iobuf->length = chunk_size << 9;
+
+	lvm_snapshot_prepare_blocks(lv_snap->lv_COW_blocks, org_start,
+				    chunk_size, blksize_org);
+	if (brw_kiovec_async(READ, iobuf, org_phys_dev,
+			     lv_snap->lv_COW_blocks, blksize_org))
+		goto fail_raw_read;
 	return 0;
 
 	/* slow path */
@@ -437,14 +424,155 @@ int lvm_snapshot_COW(kdev_t org_phys_dev,
  fail_raw_read:
 	reason = "read error";
 	goto out;
- fail_raw_write:
-	reason = "write error";
-	goto out;
  fail_blksize:
 	reason = "blocksize error";
 	goto out;
 }
 
+/*
+ * COW step 2: once the original chunk is in, start writing it
+ * to the snapshot
+ */
+static int lvm_snapshot_COW_write(lv_t * lv_snap)
+{
+	const char * reason;
+	int idx = lv_snap->lv_remap_ptr;
+	kdev_t snap_phys_dev = lv_snap->lv_block_exception[idx].rdev_new;
+	struct kiobuf * iobuf = lv_snap->lv_iobuf;
+	int blksize_snap = lvm_get_blksize(snap_phys_dev);
+
+	if (lvm_snapshot_wait_io(iobuf))
+		goto fail_raw_read;
+
+	lvm_snapshot_prepare_blocks(lv_snap->lv_COW_blocks,
+				    lv_snap->lv_block_exception[idx].rsector_new,
+				    lv_snap->lv_chunk_size, blksize_snap);
+	if (brw_kiovec_async(WRITE, iobuf, snap_phys_dev,
+			     lv_snap->lv_COW_blocks, blksize_snap))
+		goto fail_raw_write;
+	return 0;
+
+	/* slow path */
+ out:
+	lvm_drop_snapshot(lv_snap, reason);
+	return 1;
+
+ fail_raw_read:
+	reason = "read error";
+	goto out;
+ fail_raw_write:
+	reason = "write error";
+	goto out;
+}
+
+/*
+ * COW step 3: once the copy is on disk, update the exception table
+ * and start writing the COW table entry for it
+ */
+static int lvm_snapshot_COW_commit(vg_t * vg, lv_t * lv_snap)
+{
+	int idx = lv_snap->lv_remap_ptr;
+
+	if (lvm_snapshot_wait_io(lv_snap->lv_iobuf))
+		goto fail_raw_write;
+
+	/* the original chunk is now stored on the snapshot volume
+	   so update the execption table */
+	lvm_hash_link(lv_snap->lv_block_exception + idx,
+		      lv_snap->lv_block_exception[idx].rdev_org,
+		      lv_snap->lv_block_exception[idx].rsector_org,
+		      lv_snap);
+	lv_snap->lv_remap_ptr = idx + 1;
+	if (lv_snap->lv_snapshot_use_rate > 0) {
+		if (lv_snap->lv_remap_ptr * 100 / lv_snap->lv_remap_end >= lv_snap->lv_snapshot_use_rate)
+			wake_up_interruptible(&lv_snap->lv_snapshot_wait);
+	}
+
+	if (lvm_start_COW_table_block(vg, lv_snap))
+		goto fail_raw_write;
+	return 0;
+
+ fail_raw_write:
+	lvm_drop_snapshot(lv_snap, "write error");
+	return 1;
+}
+
+/*
+ * copy on write handler for the snapshots of an original logical volume
+ *
+ * read the original blocks and store them on every active snapshot that
+ * has no copy of the chunk yet.  if there is no exception storage space
+ * free any longer --> release that snapshot.
+ *
+ * the copies for up to LVM_COW_BATCH snapshots are done together, every
+ * step is started for all of them before waiting for any: reading the
+ * original chunk, writing the copies, writing the COW table blocks.
+ * a COW table entry still never goes to disk before its chunk.
+ *
+ * this routine gets called for each write to the original logical
+ * volume with lv_org->lv_snapshot_sem held.  returns 1 if a snapshot
+ * had to be dropped.
+ */
+int lvm_snapshot_COW(kdev_t org_phys_dev,
+		     unsigned long org_phys_sector,
+		     unsigned long org_pe_start,
+		     unsigned long org_virt_sector,
+		     vg_t * vg, lv_t * lv_org)
+{
+	lv_t * batch[LVM_COW_BATCH], * lv_snap;
+	int i, nr, ret = 0;
+
+	lv_snap = lv_org->lv_snapshot_next;
+	while (lv_snap != NULL)
+	{
+		for (nr = 0; lv_snap != NULL && nr < LVM_COW_BATCH;
+		     lv_snap = lv_snap->lv_snapshot_next)
+		{
+			kdev_t rdev = org_phys_dev;
+			unsigned long rsector = org_phys_sector;
+
+			/* Check for inactive or dropped snapshot */
+			if (!(lv_snap->lv_status & LV_ACTIVE) ||
+			    lv_snap->lv_block_exception == NULL)
+				continue;
+			/* chunk already copied */
+			if (lvm_snapshot_remap_block(&rdev, &rsector,
+						     org_pe_start, lv_snap))
+				continue;
+			if (lvm_snapshot_COW_read(org_phys_dev,
+						  org_phys_sector,
+						  org_pe_start,
+						  org_virt_sector,
+						  lv_snap))
+				ret = 1;
+			else
+				batch[nr++] = lv_snap;
+		}
+
+		for (i = 0; i < nr; i++)
+			if (lvm_snapshot_COW_write(batch[i]))
+			{
+				batch[i] = NULL;
+				ret = 1;
+			}
+
+		for (i = 0; i < nr; i++)
+			if (batch[i] && lvm_snapshot_COW_commit(vg, batch[i]))
+			{
+				batch[i] = NULL;
+				ret = 1;
+			}
+
+		for (i = 0; i < nr; i++)
+			if (batch[i] && lvm_end_COW_table_block(vg, batch[i]))
+			{
+				lvm_drop_snapshot(batch[i], "write error");
+				ret = 1;
+			}
+	}
+	return ret;
+}
+
 int lvm_snapshot_alloc_iobuf_pages(struct kiobuf * iobuf, int sectors)
 {
 	int bytes, nr_pages, err, i;
@@ -488,17 +616,22 @@ static int calc_max_buckets(void)
 	return mem;
 }
 
+/*
+ * one bucket per exception the snapshot can hold, so the chains stay
+ * short even when it is full; only the memory cap may make them longer
+ */
 int lvm_snapshot_alloc_hash_table(lv_t * lv)
 {
 	int err;
 	unsigned long buckets, max_buckets, size;
 	struct list_head * hash;
 
-	buckets = lv->lv_remap_end;
 	max_buckets = calc_max_buckets();
-	buckets = min(buckets, max_buckets);
-	while (buckets & (buckets-1))
-		buckets &= (buckets-1);
+	while (max_buckets & (max_buckets-1))
+		max_buckets &= (max_buckets-1);
+	for (buckets = 1; buckets < lv->lv_remap_end; buckets <<= 1)
+		if (buckets >= max_buckets)
+			break;
 
 	size = buckets * sizeof(struct list_head);
 
@@ -518,38 +651,93 @@ int lvm_snapshot_alloc_hash_table(lv_t * lv)
 	return err;
 }
 
+/*
+ * (re)builds the exception hash of a snapshot for its current
+ * lv_remap_end and links all exceptions in use into it.
+ *
+ * called when the snapshot is set up and whenever its exception table
+ * got moved or resized.  if no new table can be had, the old one is
+ * reused: lookups get slower but still work.
+ */
+int lvm_snapshot_rehash(lv_t * lv)
+{
+	struct list_head * old_hash = lv->lv_snapshot_hash_table;
+	ulong old_size = lv->lv_snapshot_hash_table_size;
+	ulong old_mask = lv->lv_snapshot_hash_mask;
+	uint e;
+
+	if (lvm_snapshot_alloc_hash_table(lv) == 0)
+	{
+		if (old_hash)
+			vfree(old_hash);
+	} else {
+		if (!old_hash)
+			return -ENOMEM;
+		lv->lv_snapshot_hash_table = old_hash;
+		lv->lv_snapshot_hash_table_size = old_size;
+		lv->lv_snapshot_hash_mask = old_mask;
+		for (e = 0; e <= old_mask; e++)
+			INIT_LIST_HEAD(old_hash + e);
+	}
+
+	for (e = 0; e < lv->lv_remap_ptr; e++)
+		lvm_hash_link(lv->lv_block_exception + e,
+			      lv->lv_block_exception[e].rdev_org,
+			      lv->lv_block_exception[e].rsector_org, lv);
+	return 0;
+}
+
+/*
+ * the copy buffer holds one chunk and the COW table buffer one page;
+ * the exception hash is set up by lvm_snapshot_rehash()
+ */
 int lvm_snapshot_alloc(lv_t * lv_snap)
 {
-	int err, blocksize, max_sectors;
+	int err, chunk_size = lv_snap->lv_chunk_size;
+
+	err = -EINVAL;
+	if (chunk_size < (LVM_SNAPSHOT_MIN_CHUNK << 1) ||
+	    chunk_size > (LVM_SNAPSHOT_MAX_CHUNK << 1))
+		goto out;
 
 	err = alloc_kiovec(1, &lv_snap->lv_iobuf);
 	if (err)
 		goto out;
 
-	blocksize = lvm_blocksizes[MINOR(lv_snap->lv_dev)];
-	max_sectors = KIO_MAX_SECTORS << (PAGE_SHIFT-9);
-
-	err = lvm_snapshot_alloc_iobuf_pages(lv_snap->lv_iobuf, max_sectors);
+	err = lvm_snapshot_alloc_iobuf_pages(lv_snap->lv_iobuf, chunk_size);
 	if (err)
 		goto out_free_kiovec;
 
-	err = lvm_snapshot_alloc_hash_table(lv_snap);
-	if (err)
+	err = -ENOMEM;
+	lv_snap->lv_COW_blocks = kmalloc(chunk_size * sizeof(ulong),
+					 GFP_KERNEL);
+	if (!lv_snap->lv_COW_blocks)
 		goto out_free_kiovec;
 
+	err = alloc_kiovec(1, &lv_snap->lv_COW_table_iobuf);
+	if (err)
+		goto out_free_blocks;
 
-		lv_snap->lv_COW_table_page = alloc_page(GFP_KERNEL);
-		if (!lv_snap->lv_COW_table_page)
-			goto out_free_kiovec;
+	err = lvm_snapshot_alloc_iobuf_pages(lv_snap->lv_COW_table_iobuf,
+					     PAGE_SIZE >> 9);
+	if (err)
+		goto out_free_table_kiovec;
+	lv_snap->lv_COW_table_page = lv_snap->lv_COW_table_iobuf->maplist[0];
 
  out:
 	return err;
 
+ out_free_table_kiovec:
+	unmap_kiobuf(lv_snap->lv_COW_table_iobuf);
+	free_kiovec(1, &lv_snap->lv_COW_table_iobuf);
+	lv_snap->lv_COW_table_iobuf = NULL;
+ out_free_blocks:
+	kfree(lv_snap->lv_COW_blocks);
+	lv_snap->lv_COW_blocks = NULL;
  out_free_kiovec:
 	unmap_kiobuf(lv_snap->lv_iobuf);
 	free_kiovec(1, &lv_snap->lv_iobuf);
-	vfree(lv_snap->lv_snapshot_hash_table);
-	lv_snap->lv_snapshot_hash_table = NULL;
+	lv_snap->lv_iobuf = NULL;
 	goto out;
 }
 
@@ -572,9 +760,17 @@ void lvm_snapshot_release(lv_t * lv)
 		free_kiovec(1, &lv->lv_iobuf);
 		lv->lv_iobuf = NULL;
 	}
-	if (lv->lv_COW_table_page)
+	if (lv->lv_COW_blocks)
+	{
+		kfree(lv->lv_COW_blocks);
+		lv->lv_COW_blocks = NULL;
+	}
+	/* the COW table page goes with its iobuf */
+	if (lv->lv_COW_table_iobuf)
 	{
-		free_page((ulong)lv->lv_COW_table_page);
+		unmap_kiobuf(lv->lv_COW_table_iobuf);
+		free_kiovec(1, &lv->lv_COW_table_iobuf);
+		lv->lv_COW_table_iobuf = NULL;
 		lv->lv_COW_table_page = NULL;
 	}
 }
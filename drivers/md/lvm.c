@@ -252,12 +252,10 @@ static void lvm_init_vars(void);
 extern inline int lvm_get_blksize(kdev_t);
 extern int lvm_snapshot_alloc(lv_t *);
 extern void lvm_snapshot_fill_COW_page(vg_t *, lv_t *);
-extern int lvm_snapshot_COW(kdev_t, ulong, ulong, ulong, lv_t *);
+extern int lvm_snapshot_COW(kdev_t, ulong, ulong, ulong, vg_t *, lv_t *);
 extern int lvm_snapshot_remap_block(kdev_t *, ulong *, ulong, lv_t *);
 extern void lvm_snapshot_release(lv_t *); 
-extern int lvm_write_COW_table_block(vg_t *, lv_t *);
-extern inline void lvm_hash_link(lv_block_exception_t *, kdev_t, ulong, lv_t *);
-extern int lvm_snapshot_alloc_hash_table(lv_t *);
+extern int lvm_snapshot_rehash(lv_t *);
 extern void lvm_drop_snapshot(lv_t *, char *);
 
 #ifdef LVM_HD_NAME
@@ -1661,37 +1659,12 @@ lvm_second_remap:
 		if (lv->lv_access & LV_SNAPSHOT_ORG) {
 			if (rw == WRITE || rw == WRITEA)
 			{
-				lv_t *lv_ptr;
-
-				/* start with first snapshot and loop thrugh all of them */
-				for (lv_ptr = lv->lv_snapshot_next;
-				     lv_ptr != NULL;
-				     lv_ptr = lv_ptr->lv_snapshot_next) {
-					/* Check for inactive snapshot */
-					if (!(lv_ptr->lv_status & LV_ACTIVE)) continue;
-					down(&lv->lv_snapshot_org->lv_snapshot_sem);
-					/* do we still have exception storage for this snapshot free? */
-					if (lv_ptr->lv_block_exception != NULL) {
-						rdev_sav = rdev_tmp;
-						rsector_sav = rsector_tmp;
-						if (!lvm_snapshot_remap_block(&rdev_tmp,
-									      &rsector_tmp,
-									      pe_start,
-									      lv_ptr)) {
-							/* create a new mapping */
-							if (!(ret = lvm_snapshot_COW(rdev_tmp,
-									       	     rsector_tmp,
-									             pe_start,
-									             rsector_sav,
-									             lv_ptr)))
-								ret = lvm_write_COW_table_block(vg_this,
-												lv_ptr);
-						}
-						rdev_tmp = rdev_sav;
-						rsector_tmp = rsector_sav;
-					}
-					up(&lv->lv_snapshot_org->lv_snapshot_sem);
-				}
+				/* copy the chunk to all snapshots lacking it */
+				down(&lv->lv_snapshot_org->lv_snapshot_sem);
+				ret = lvm_snapshot_COW(rdev_tmp, rsector_tmp,
+						       pe_start, rsector_sav,
+						       vg_this, lv);
+				up(&lv->lv_snapshot_org->lv_snapshot_sem);
 			}
 		} else {
 			/* remap snapshot logical volume */
@@ -2259,7 +2232,7 @@ static int lvm_do_pv_remove(vg_t *vg_ptr, ulong p) {
  */
 static int lvm_do_lv_create(int minor, char *lv_name, lv_t *lv)
 {
-	int e, ret, l, le, l_new, p, size;
+	int ret, l, le, l_new, p, size;
 	ulong lv_status_save;
 	lv_block_exception_t *lvbe = lv->lv_block_exception;
 	vg_t *vg_ptr = vg[VG_CHR(minor)];
@@ -2307,6 +2280,8 @@ static int lvm_do_lv_create(int minor, char *lv_name, lv_t *lv)
 	lv_ptr->lv_snapshot_hash_table_size = 0;
 	lv_ptr->lv_snapshot_hash_mask = 0;
 	lv_ptr->lv_COW_table_page = NULL;
+	lv_ptr->lv_COW_table_iobuf = NULL;
+	lv_ptr->lv_COW_blocks = NULL;
 	init_MUTEX(&lv_ptr->lv_snapshot_sem);
 	lv_ptr->lv_snapshot_use_rate = 0;
 	vg_ptr->lv[l] = lv_ptr;
@@ -2390,15 +2365,14 @@ static int lvm_do_lv_create(int minor, char *lv_name, lv_t *lv)
 				lv_ptr->lv_size = lv_ptr->lv_snapshot_org->lv_size;
 				lv_ptr->lv_stripes = lv_ptr->lv_snapshot_org->lv_stripes;
 				lv_ptr->lv_stripesize = lv_ptr->lv_snapshot_org->lv_stripesize;
-				if ((ret = lvm_snapshot_alloc(lv_ptr)) != 0)
+				if ((ret = lvm_snapshot_alloc(lv_ptr)) != 0 ||
+				    (ret = lvm_snapshot_rehash(lv_ptr)) != 0)
 				{
-					vfree(lv_ptr->lv_block_exception);
+					lvm_snapshot_release(lv_ptr);
 					kfree(lv_ptr);
 					vg[VG_CHR(minor)]->lv[l] = NULL;
 					return ret;
 				}
-				for ( e = 0; e < lv_ptr->lv_remap_ptr; e++)
-					lvm_hash_link (lv_ptr->lv_block_exception + e, lv_ptr->lv_block_exception[e].rdev_org, lv_ptr->lv_block_exception[e].rsector_org, lv_ptr);
 				/* need to fill the COW exception table data
 				   into the page for disk i/o */
 				lvm_snapshot_fill_COW_page(vg_ptr, lv_ptr);
@@ -2601,9 +2575,7 @@ static int lvm_do_lv_extend_reduce(int minor, char *lv_name, lv_t *lv)
 	/* check for active snapshot */
 	if (lv->lv_access & LV_SNAPSHOT)
 	{
-		ulong e;
 		lv_block_exception_t *lvbe, *lvbe_old;
-		struct list_head * lvs_hash_table_old;
 
 		if (lv->lv_block_exception == NULL) return -ENXIO;
 		size = lv->lv_remap_end * sizeof ( lv_block_exception_t);
@@ -2625,7 +2597,6 @@ static int lvm_do_lv_extend_reduce(int minor, char *lv_name, lv_t *lv)
 		}
 
 		lvbe_old = lv_ptr->lv_block_exception;
-		lvs_hash_table_old = lv_ptr->lv_snapshot_hash_table;
 
 		/* we need to play on the safe side here... */
 		down(&lv_ptr->lv_snapshot_org->lv_snapshot_sem);
@@ -2642,22 +2613,13 @@ static int lvm_do_lv_extend_reduce(int minor, char *lv_name, lv_t *lv)
 
 		lv_ptr->lv_block_exception = lvbe;
 		lv_ptr->lv_remap_end = lv->lv_remap_end;
-		if (lvm_snapshot_alloc_hash_table(lv_ptr) != 0)
-		{
-			lvm_drop_snapshot(lv_ptr, "hash_alloc");
-			up(&lv_ptr->lv_snapshot_org->lv_snapshot_sem);
-			vfree(lvbe_old);
-			vfree(lvs_hash_table_old);
-			return 1;
-		}
-
-		for (e = 0; e < lv_ptr->lv_remap_ptr; e++)
-			lvm_hash_link (lv_ptr->lv_block_exception + e, lv_ptr->lv_block_exception[e].rdev_org, lv_ptr->lv_block_exception[e].rsector_org, lv_ptr);
+		/* resize the hash for the new size, relinking the moved
+		   exceptions; keeps the old table if it can't grow */
+		lvm_snapshot_rehash(lv_ptr);
 
 		up(&lv_ptr->lv_snapshot_org->lv_snapshot_sem);
 
 		vfree(lvbe_old);
-		vfree(lvs_hash_table_old);
 
 		return 0;
 	}
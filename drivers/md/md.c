@@ -72,7 +72,9 @@ static mdk_personality_t *pers[MAX_PERSONALITY];
  * speed limit - in case reconstruction slows down your system despite
  * idle IO detection.
  *
- * you can change it via /proc/sys/dev/raid/speed_limit_min and _max.
+ * you can change it via /proc/sys/dev/raid/speed_limit_min and _max,
+ * or for a single array via /proc/sys/dev/raid/mdN/sync_speed_min and
+ * _max (0 there means the system wide value).
  */
 
 static int sysctl_speed_limit_min = 100;
@@ -98,6 +100,59 @@ static ctl_table raid_root_table[] = {
 	{0}
 };
 
+static ctl_table md_ctl_template[] = {
+	{DEV_RAID_MD_SYNC_SPEED_MIN, "sync_speed_min",
+	 NULL, sizeof(int), 0644, NULL, &proc_dointvec},
+	{DEV_RAID_MD_SYNC_SPEED_MAX, "sync_speed_max",
+	 NULL, sizeof(int), 0644, NULL, &proc_dointvec},
+	{0}
+};
+
+static void md_register_sysctl (mddev_t *mddev)
+{
+	ctl_table *t = mddev->ctl_table;
+
+	memcpy(t, md_ctl_template, sizeof(md_ctl_template));
+	t[0].data = &mddev->sync_speed_min;
+	t[1].data = &mddev->sync_speed_max;
+
+	sprintf(mddev->ctl_name, "md%d", mdidx(mddev));
+	mddev->ctl_md[0].ctl_name = DEV_RAID_MD_BASE + mdidx(mddev);
+	mddev->ctl_md[0].procname = mddev->ctl_name;
+	mddev->ctl_md[0].mode = 0555;
+	mddev->ctl_md[0].child = t;
+	mddev->ctl_raid[0].ctl_name = DEV_RAID;
+	mddev->ctl_raid[0].procname = "raid";
+	mddev->ctl_raid[0].mode = 0555;
+	mddev->ctl_raid[0].child = mddev->ctl_md;
+	mddev->ctl_root[0].ctl_name = CTL_DEV;
+	mddev->ctl_root[0].procname = "dev";
+	mddev->ctl_root[0].mode = 0555;
+	mddev->ctl_root[0].child = mddev->ctl_raid;
+
+	mddev->ctl_header = register_sysctl_table(mddev->ctl_root, 0);
+}
+
+static void md_unregister_sysctl (mddev_t *mddev)
+{
+	if (mddev->ctl_header) {
+		unregister_sysctl_table(mddev->ctl_header);
+		mddev->ctl_header = NULL;
+	}
+}
+
+static inline int sync_speed_min (mddev_t *mddev)
+{
+	return mddev->sync_speed_min ?
+		mddev->sync_speed_min : sysctl_speed_limit_min;
+}
+
+static inline int sync_speed_max (mddev_t *mddev)
+{
+	return mddev->sync_speed_max ?
+		mddev->sync_speed_max : sysctl_speed_limit_max;
+}
+
 /*
  * these have to be allocated separately because external
  * subsystems want to have a pre-defined structure
@@ -732,6 +787,7 @@ static void free_mddev (mddev_t *mddev)
 		return;
 	}
 
+	md_unregister_sysctl(mddev);
 	export_array(mddev);
 	md_size[mdidx(mddev)] = 0;
 	md_hd_struct[mdidx(mddev)].nr_sects = 0;
@@ -1652,6 +1708,16 @@ static int do_md_run (mddev_t * mddev)
 		md_blocksizes[mdidx(mddev)] = md_hardsect_sizes[mdidx(mddev)];
 	mddev->pers = pers[pnum];
 
+	/*
+	 * A resync interrupted by stopping the array goes on where it
+	 * was. After a crash the checkpoint is 0 and it starts over.
+	 */
+	mddev->recovery_cp = 0;
+	if (!(mddev->sb->state & (1 << MD_SB_CLEAN)) &&
+			mddev->sb->recovery_cp < mddev->sb->size)
+		mddev->recovery_cp = mddev->sb->recovery_cp;
+	mddev->sb->recovery_cp = 0;
+
 	err = mddev->pers->run(mddev);
 	if (err) {
 		printk("pers->run() failed ...\n");
@@ -1670,6 +1736,7 @@ static int do_md_run (mddev_t * mddev)
 	md_hd_struct[mdidx(mddev)].nr_sects = md_size[mdidx(mddev)] << 1;
 
 	read_ahead[MD_MAJOR] = 1024;
+	md_register_sysctl(mddev);
 	return (0);
 }
 
@@ -1787,6 +1854,12 @@ static int do_md_stop (mddev_t * mddev, int ro)
 				printk("marking sb clean...\n");
 				mddev->sb->state |= 1 << MD_SB_CLEAN;
 			}
+			/*
+			 * the array is stopped cleanly, the resync can
+			 * go on from where it was interrupted.
+			 */
+			if (resync_interrupted)
+				mddev->sb->recovery_cp = mddev->recovery_cp;
 			md_update_sb(mddev);
 		}
 		if (ro)
@@ -2063,6 +2136,7 @@ int md__init md_run_setup(void)
 	else {
 
 		printk(KERN_INFO "autodetecting RAID arrays\n");
+		wait_for_partitions();
 
 		for (i=0; i<dev_cnt; i++) {
 			kdev_t dev = detected_devices[i];
@@ -3238,14 +3312,19 @@ void md_sync_acct(kdev_t dev, unsigned long nr_sectors)
 	sync_io[major][index] += nr_sectors;
 }
 
-static int is_mddev_idle (mddev_t *mddev)
+/*
+ * Sectors of foreground I/O on the member disks since the last call:
+ * everything but our own resync traffic, so this includes I/O from
+ * other arrays and partitions sharing the disks.
+ */
+static unsigned long foreground_io (mddev_t *mddev)
 {
 	mdk_rdev_t * rdev;
 	struct md_list_head *tmp;
-	int idle;
-	unsigned long curr_events;
+	unsigned long io;
+	unsigned int curr_events;
 
-	idle = 1;
+	io = 0;
 	ITERATE_RDEV(mddev,rdev,tmp) {
 		int major = MAJOR(rdev->dev);
 		int idx = disk_index(rdev->dev);
@@ -3256,14 +3335,10 @@ static int is_mddev_idle (mddev_t *mddev)
 		curr_events = kstat.dk_drive_rblk[major][idx] +
 						kstat.dk_drive_wblk[major][idx] ;
 		curr_events -= sync_io[major][idx];
-//		printk("events(major: %d, idx: %d): %ld\n", major, idx, curr_events);
-		if (curr_events != rdev->last_events) {
-//			printk("!I(%ld)", curr_events - rdev->last_events);
-			rdev->last_events = curr_events;
-			idle = 0;
-		}
+		io += (unsigned int) (curr_events - rdev->last_events);
+		rdev->last_events = curr_events;
 	}
-	return idle;
+	return io;
 }
 
 MD_DECLARE_WAIT_QUEUE_HEAD(resync_wait);
@@ -3280,6 +3355,15 @@ void md_done_sync(mddev_t *mddev, int blocks, int ok)
 
 #define SYNC_MARKS	10
 #define	SYNC_MARK_STEP	(3*HZ)
+/*
+ * Foreground I/O below SYNC_IDLE_IO sectors per check is noise (sync
+ * I/O is accounted a little before or after the disk stats see it).
+ * Above it the resync backs off for SYNC_BACKOFF_MIN, doubling up to
+ * SYNC_BACKOFF_MAX while the disks stay busy, halving once idle.
+ */
+#define SYNC_IDLE_IO		64
+#define SYNC_BACKOFF_MIN	(HZ/50 + 1)
+#define SYNC_BACKOFF_MAX	(HZ/2)
 int md_do_sync(mddev_t *mddev, mdp_disk_t *spare)
 {
 	mddev_t *mddev2;
@@ -3290,13 +3374,14 @@ int md_do_sync(mddev_t *mddev, mdp_disk_t *spare)
 	unsigned long mark_cnt[SYNC_MARKS];	
 	int last_mark,m;
 	struct md_list_head *tmp;
-	unsigned long last_check;
+	unsigned long last_check, backoff, start;
 
 
 	err = down_interruptible(&mddev->resync_sem);
 	if (err)
 		goto out_nolock;
 
+	j = mddev->recovery_cp;
 recheck:
 	serialize = 0;
 	ITERATE_MDDEV(mddev2,tmp) {
@@ -3322,20 +3407,36 @@ recheck:
 
 	max_blocks = mddev->sb->size;
 
+	/*
+	 * A resync (not a rebuild onto a spare) starts at its checkpoint.
+	 * From here on the checkpoint on disk is stale: only stopping the
+	 * array writes a new one.
+	 */
+	start = 0;
+	if (!spare) {
+		if (mddev->recovery_cp < max_blocks)
+			start = mddev->recovery_cp;
+		mddev->sb->recovery_cp = 0;
+	}
+
 	printk(KERN_INFO "md: syncing RAID array md%d\n", mdidx(mddev));
+	if (start)
+		printk(KERN_INFO "md: md%d: resuming resync at block %lu.\n",
+						mdidx(mddev), start);
 	printk(KERN_INFO "md: minimum _guaranteed_ reconstruction speed: %d KB/sec/disc.\n",
-						sysctl_speed_limit_min);
-	printk(KERN_INFO "md: using maximum available idle IO bandwith (but not more than %d KB/sec) for reconstruction.\n", sysctl_speed_limit_max);
+						sync_speed_min(mddev));
+	printk(KERN_INFO "md: using maximum available idle IO bandwith (but not more than %d KB/sec) for reconstruction.\n", sync_speed_max(mddev));
 
 	/*
 	 * Resync has low priority.
 	 */
 	current->nice = 19;
 
-	is_mddev_idle(mddev); /* this also initializes IO event counters */
+	foreground_io(mddev); /* this also initializes IO event counters */
+	backoff = 0;
 	for (m = 0; m < SYNC_MARKS; m++) {
 		mark[m] = jiffies;
-		mark_cnt[m] = 0;
+		mark_cnt[m] = start;
 	}
 	last_mark = 0;
 	mddev->resync_mark = mark[last_mark];
@@ -3349,8 +3450,8 @@ recheck:
 
 	atomic_set(&mddev->recovery_active, 0);
 	init_waitqueue_head(&mddev->recovery_wait);
-	last_check = 0;
-	for (j = 0; j < max_blocks;) {
+	last_check = start;
+	for (j = start; j < max_blocks;) {
 		int blocks;
 
 		blocks = mddev->pers->sync_request(mddev, j);
@@ -3393,8 +3494,8 @@ recheck:
 
 		/*
 		 * this loop exits only if either when we are slower than
-		 * the 'hard' speed limit, or the system was IO-idle for
-		 * a jiffy.
+		 * the 'hard' speed limit, or the member disks had (almost)
+		 * no other I/O since the last check.
 		 * the system might be non-idle CPU-wise, but we only care
 		 * about not overloading the IO subsystem. (things like an
 		 * e2fsck being done on the RAID array should execute fast)
@@ -3405,16 +3506,27 @@ repeat:
 
 		currspeed = (j-mddev->resync_mark_cnt)/((jiffies-mddev->resync_mark)/HZ +1) +1;
 
-		if (currspeed > sysctl_speed_limit_min) {
+		if (currspeed > sync_speed_min(mddev)) {
 			current->nice = 19;
 
-			if ((currspeed > sysctl_speed_limit_max) ||
-					!is_mddev_idle(mddev)) {
+			if (currspeed > sync_speed_max(mddev)) {
 				current->state = TASK_INTERRUPTIBLE;
 				md_schedule_timeout(HZ/4);
 				if (!md_signal_pending(current))
 					goto repeat;
-			}
+			} else if (foreground_io(mddev) > SYNC_IDLE_IO) {
+				if (!backoff)
+					backoff = SYNC_BACKOFF_MIN;
+				else if (backoff < SYNC_BACKOFF_MAX / 2)
+					backoff <<= 1;
+				else
+					backoff = SYNC_BACKOFF_MAX;
+				current->state = TASK_INTERRUPTIBLE;
+				md_schedule_timeout(backoff);
+				if (!md_signal_pending(current))
+					goto repeat;
+			} else
+				backoff >>= 1;
 		} else
 			current->nice = -20;
 	}
@@ -3426,6 +3538,16 @@ repeat:
 	 */
 out:
 	wait_event(mddev->recovery_wait, atomic_read(&mddev->recovery_active)==0);
+	/*
+	 * everything below j is in sync now; remember it in case the
+	 * array is stopped before the resync is restarted.
+	 */
+	if (!spare) {
+		if (!err)
+			mddev->recovery_cp = 0;
+		else if (err == -EINTR)
+			mddev->recovery_cp = j;
+	}
 	up(&mddev->resync_sem);
 out_nolock:
 	mddev->curr_resync = 0;
@@ -31,7 +31,6 @@
 #define MD_DRIVER
 #define MD_PERSONALITY
 
-#define MAX_WORK_PER_DISK 128
 
 /*
  * The following can be used to debug the driver
@@ -365,6 +364,22 @@ static void inline sync_request_done (unsigned long sector, raid1_conf_t *conf)
 	spin_unlock_irqrestore(&conf->segment_lock, flags);
 }
 
+/*
+ * Reads outstanding per mirror, for read balancing.  The mirror is
+ * found by device: hot-add and spare activation may shuffle slots
+ * while reads are in flight.
+ */
+static void raid1_pending (raid1_conf_t *conf, kdev_t dev, int delta)
+{
+	int i;
+
+	for (i = 0; i < conf->raid_disks; i++)
+		if (conf->mirrors[i].dev == dev) {
+			atomic_add(delta, &conf->mirrors[i].nr_pending);
+			return;
+		}
+}
+
 /*
  * raid1_end_bh_io() is called when we have finished servicing a mirrored
  * operation and are ready to return a success/failure code to the buffer
@@ -410,6 +425,7 @@ void raid1_end_request (struct buffer_head *bh, int uptodate)
 		/*
 		 * we have only one buffer_head on the read side
 		 */
+		raid1_pending(mddev_to_conf(r1_bh->mddev), bh->b_dev, -1);
 		
 		if (uptodate) {
 			raid1_end_bh_io(r1_bh, uptodate);
@@ -437,14 +453,16 @@ void raid1_end_request (struct buffer_head *bh, int uptodate)
 
 /*
  * This routine returns the disk from which the requested read should
- * be done. It bookkeeps the last read position for every disk
- * in array and when new read requests come, the disk which last
- * position is nearest to the request, is chosen.
+ * be done.
+ *
+ * A read that continues where the last one on a disk stopped stays
+ * on that disk, so sequential reads keep one disk streaming.  Any
+ * other read goes to the disk with the fewest reads outstanding, and
+ * among those to the one whose head was left nearest to the request.
  *
  * TODO: now if there are 2 mirrors in the same 2 devices, performance
  * degrades dramatically because position is mirror, not device based.
- * This should be changed to be device based. Also atomic sequential
- * reads should be somehow balanced.
+ * This should be changed to be device based.
  */
 
 static int raid1_read_balance (raid1_conf_t *conf, struct buffer_head *bh)
@@ -455,6 +473,7 @@ static int raid1_read_balance (raid1_conf_t *conf, struct buffer_head *bh)
 	int disk = new_disk;
 	unsigned long new_distance;
 	unsigned long current_distance;
+	int new_pending, current_pending;
 	
 	/*
 	 * Check if it is sane at all to balance
@@ -490,32 +509,11 @@ static int raid1_read_balance (raid1_conf_t *conf, struct buffer_head *bh)
 	if (this_sector == conf->mirrors[new_disk].head_position)
 		goto rb_out;
 	
-	/*
-	 * If reads have been done only on a single disk
-	 * for a time, lets give another disk a change.
-	 * This is for kicking those idling disks so that
-	 * they would find work near some hotspot.
-	 */
-	
-	if (conf->sect_count >= conf->mirrors[new_disk].sect_limit) {
-		conf->sect_count = 0;
-
-		do {
-			if (new_disk<=0)
-				new_disk = conf->raid_disks;
-			new_disk--;
-			if (new_disk == disk)
-				break;
-		} while ((conf->mirrors[new_disk].write_only) ||
-			 (!conf->mirrors[new_disk].operational));
-
-		goto rb_out;
-	}
-	
 	current_distance = abs(this_sector -
 				conf->mirrors[disk].head_position);
+	current_pending = atomic_read(&conf->mirrors[disk].nr_pending);
 	
-	/* Find the disk which is closest */
+	/* Find the least loaded disk, and of those the closest */
 	
 	do {
 		if (disk <= 0)
@@ -526,11 +524,14 @@ static int raid1_read_balance (raid1_conf_t *conf, struct buffer_head *bh)
 				(!conf->mirrors[disk].operational))
 			continue;
 		
+		new_pending = atomic_read(&conf->mirrors[disk].nr_pending);
 		new_distance = abs(this_sector -
 					conf->mirrors[disk].head_position);
 		
-		if (new_distance < current_distance) {
-			conf->sect_count = 0;
+		if (new_pending < current_pending ||
+		    (new_pending == current_pending &&
+		     new_distance < current_distance)) {
+			current_pending = new_pending;
 			current_distance = new_distance;
 			new_disk = disk;
 		}
@@ -540,7 +541,6 @@ rb_out:
 	conf->mirrors[new_disk].head_position = this_sector + sectors;
 
 	conf->last_used = new_disk;
-	conf->sect_count += sectors;
 
 	return new_disk;
 }
@@ -599,6 +599,8 @@ static int raid1_make_request (mddev_t *mddev, int rw,
 		 * read balancing logic:
 		 */
 		mirror = conf->mirrors + raid1_read_balance(conf, bh);
+		atomic_inc(&mirror->nr_pending);
+		mirror->reads++;
 
 		bh_req = &r1_bh->bh_req;
 		memcpy(bh_req, bh, sizeof(*bh));
@@ -698,7 +700,10 @@ static int raid1_status (char *page, mddev_t *mddev)
 	for (i = 0; i < conf->raid_disks; i++)
 		sz += sprintf (page+sz, "%s",
 			conf->mirrors[i].operational ? "U" : "_");
-	sz += sprintf (page+sz, "]");
+	sz += sprintf (page+sz, "] reads ");
+	for (i = 0; i < conf->raid_disks; i++)
+		sz += sprintf (page+sz, "%s%lu", i ? "/" : "",
+			conf->mirrors[i].reads);
 	return sz;
 }
 
@@ -1057,6 +1062,7 @@ static int raid1_diskop(mddev_t *mddev, mdp_disk_t **d, int state)
 		adisk->spare = 1;
 		adisk->used_slot = 1;
 		adisk->head_position = 0;
+		adisk->reads = 0;
 		conf->nr_disks++;
 
 		break;
@@ -1209,6 +1215,7 @@ static void raid1d (void *data)
 				printk (REDIRECT_SECTOR,
 					partition_name(bh->b_dev), bh->b_blocknr);
 				bh->b_rdev = bh->b_dev;
+				raid1_pending(mddev_to_conf(mddev), bh->b_dev, 1);
 				generic_make_request (r1_bh->cmd, bh);
 			}
 			break;
@@ -1304,8 +1311,11 @@ static int raid1_sync_request (mddev_t *mddev, unsigned long block_nr)
 	int disk;
 
 	spin_lock_irq(&conf->segment_lock);
-	if (!block_nr) {
-		/* initialize ...*/
+	if (!conf->start_future) {
+		/*
+		 * initialize ... a resync resumed at a checkpoint walks
+		 * the windows up to block_nr right away, below.
+		 */
 		int buffs;
 		conf->start_active = 0;
 		conf->start_ready = 0;
@@ -1594,7 +1604,6 @@ static int raid1_run (mddev_t *mddev)
 			disk->number = descriptor->number;
 			disk->raid_disk = disk_idx;
 			disk->dev = rdev->dev;
-			disk->sect_limit = MAX_WORK_PER_DISK;
 			disk->operational = 0;
 			disk->write_only = 0;
 			disk->spare = 0;
@@ -1626,7 +1635,6 @@ static int raid1_run (mddev_t *mddev)
 			disk->number = descriptor->number;
 			disk->raid_disk = disk_idx;
 			disk->dev = rdev->dev;
-			disk->sect_limit = MAX_WORK_PER_DISK;
 			disk->operational = 1;
 			disk->write_only = 0;
 			disk->spare = 0;
@@ -1641,7 +1649,6 @@ static int raid1_run (mddev_t *mddev)
 			disk->number = descriptor->number;
 			disk->raid_disk = disk_idx;
 			disk->dev = rdev->dev;
-			disk->sect_limit = MAX_WORK_PER_DISK;
 			disk->operational = 0;
 			disk->write_only = 0;
 			disk->spare = 1;
@@ -31,6 +31,9 @@ static mdk_personality_t raid5_personality;
  */
 
 #define NR_STRIPES		256
+#define MIN_STRIPES		16
+#define MAX_STRIPES		4096
+#define STRIPE_DELAY		((HZ+49)/50)	/* partial writes wait 20ms */
 #define HASH_PAGES		1
 #define HASH_PAGES_ORDER	0
 #define NR_HASH			(HASH_PAGES * PAGE_SIZE / sizeof(struct stripe_head *))
@@ -66,8 +69,15 @@ static inline void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 		if (atomic_read(&conf->active_stripes)==0)
 			BUG();
 		if (test_bit(STRIPE_HANDLE, &sh->state)) {
-			list_add_tail(&sh->lru, &conf->handle_list);
-			md_wakeup_thread(conf->thread);
+			if (test_bit(STRIPE_DELAYED, &sh->state)) {
+				list_add_tail(&sh->lru, &conf->delayed_list);
+				if (!timer_pending(&conf->delay_timer))
+					mod_timer(&conf->delay_timer,
+						  jiffies + STRIPE_DELAY);
+			} else {
+				list_add_tail(&sh->lru, &conf->handle_list);
+				md_wakeup_thread(conf->thread);
+			}
 		}
 		else {
 			list_add_tail(&sh->lru, &conf->inactive_list);
@@ -85,6 +95,37 @@ static void release_stripe(struct stripe_head *sh)
 	spin_unlock_irq(&conf->device_lock);
 }
 
+/*
+ * Stop waiting for delayed stripes to fill up: they go to raid5d,
+ * which reads what it needs for parity and writes them out.
+ */
+static void raid5_activate_delayed(raid5_conf_t *conf)
+{
+	struct stripe_head *sh;
+
+	CHECK_DEVLOCK();
+	if (list_empty(&conf->delayed_list))
+		return;
+	while (!list_empty(&conf->delayed_list)) {
+		sh = list_entry(conf->delayed_list.next, struct stripe_head, lru);
+		list_del_init(&sh->lru);
+		clear_bit(STRIPE_DELAYED, &sh->state);
+		set_bit(STRIPE_PREREAD_ACTIVE, &sh->state);
+		list_add_tail(&sh->lru, &conf->handle_list);
+	}
+	md_wakeup_thread(conf->thread);
+}
+
+static void raid5_delay_expired(unsigned long data)
+{
+	raid5_conf_t *conf = (raid5_conf_t *) data;
+	unsigned long flags;
+
+	md_spin_lock_irqsave(&conf->device_lock, flags);
+	raid5_activate_delayed(conf);
+	md_spin_unlock_irqrestore(&conf->device_lock, flags);
+}
+
 static void remove_hash(struct stripe_head *sh)
 {
 	PRINTK("remove_hash(), stripe %lu\n", sh->sector);
@@ -288,6 +329,8 @@ static struct stripe_head *get_active_stripe(raid5_conf_t *conf, unsigned long s
 			if (noblock && sh == NULL)
 				break;
 			if (!sh) {
+				/* delayed stripes are holding on to the cache */
+				raid5_activate_delayed(conf);
 				wait_event_lock_irq(conf->wait_for_stripe,
 						    !list_empty(&conf->inactive_list),
 						    conf->device_lock);
@@ -340,9 +383,11 @@ static int grow_stripes(raid5_conf_t *conf, int num, int priority)
 	return 0;
 }
 
-static void shrink_stripes(raid5_conf_t *conf, int num)
+/* Free up to num idle stripes, returns how many were freed */
+static int shrink_stripes(raid5_conf_t *conf, int num)
 {
 	struct stripe_head *sh;
+	int freed = 0;
 
 	while (num--) {
 		spin_lock_irq(&conf->device_lock);
@@ -355,7 +400,23 @@ static void shrink_stripes(raid5_conf_t *conf, int num)
 		shrink_buffers(sh, conf->raid_disks);
 		kfree(sh);
 		atomic_dec(&conf->active_stripes);
+		freed++;
 	}
+	return freed;
+}
+
+/*
+ * Resize the stripe cache to nr stripes.  Only idle stripes can be
+ * freed, so shrinking may stop short of nr.
+ */
+static void resize_stripes(raid5_conf_t *conf, int nr)
+{
+	down(&conf->cache_sem);
+	while (conf->max_nr_stripes < nr && !grow_stripes(conf, 1, GFP_KERNEL))
+		conf->max_nr_stripes++;
+	while (conf->max_nr_stripes > nr && shrink_stripes(conf, 1))
+		conf->max_nr_stripes--;
+	up(&conf->cache_sem);
 }
 
 
@@ -816,6 +877,7 @@ static void handle_stripe(struct stripe_head *sh)
 
 	spin_lock(&sh->lock);
 	clear_bit(STRIPE_HANDLE, &sh->state);
+	clear_bit(STRIPE_DELAYED, &sh->state);
 
 	syncing = test_bit(STRIPE_SYNCING, &sh->state);
 	/* Now to look around and see what can be done */
@@ -971,35 +1033,53 @@ static void handle_stripe(struct stripe_head *sh)
 		}
 		PRINTK("for sector %ld, rmw=%d rcw=%d\n", sh->sector, rmw, rcw);
 		set_bit(STRIPE_HANDLE, &sh->state);
-		if (rmw < rcw && rmw > 0)
-			/* prefer read-modify-write, but need to get some data */
-			for (i=disks; i--;) {
-				bh = sh->bh_cache[i];
-				if ((sh->bh_write[i] || i == sh->pd_idx) &&
-				    !buffer_locked(bh) && !buffer_uptodate(bh) &&
-				    conf->disks[i].operational) {
-					PRINTK("Read_old block %d for r-m-w\n", i);
-					set_bit(BH_Lock, &bh->b_state);
-					action[i] = READ+1;
-					locked++;
+		if (rmw > 0 && rcw > 0 && !syncing && !to_read &&
+		    !test_bit(STRIPE_PREREAD_ACTIVE, &sh->state)) {
+			/*
+			 * Either way we would have to read.  Give the rest
+			 * of the stripe a moment to arrive first: a
+			 * sequential writer fills it and saves the reads.
+			 */
+			PRINTK("delaying partial stripe %ld\n", sh->sector);
+			set_bit(STRIPE_DELAYED, &sh->state);
+		} else {
+			if (rmw < rcw && rmw > 0)
+				/* prefer read-modify-write, but need to get some data */
+				for (i=disks; i--;) {
+					bh = sh->bh_cache[i];
+					if ((sh->bh_write[i] || i == sh->pd_idx) &&
+					    !buffer_locked(bh) && !buffer_uptodate(bh) &&
+					    conf->disks[i].operational) {
+						PRINTK("Read_old block %d for r-m-w\n", i);
+						set_bit(BH_Lock, &bh->b_state);
+						action[i] = READ+1;
+						locked++;
+					}
 				}
-			}
-		if (rcw <= rmw && rcw > 0)
-			/* want reconstruct write, but need to get some data */
-			for (i=disks; i--;) {
-				bh = sh->bh_cache[i];
-				if (!sh->bh_write[i]  && i != sh->pd_idx &&
-				    !buffer_locked(bh) && !buffer_uptodate(bh) &&
-				    conf->disks[i].operational) {
-					PRINTK("Read_old block %d for Reconstruct\n", i);
-					set_bit(BH_Lock, &bh->b_state);
-					action[i] = READ+1;
-					locked++;
+			if (rcw <= rmw && rcw > 0)
+				/* want reconstruct write, but need to get some data */
+				for (i=disks; i--;) {
+					bh = sh->bh_cache[i];
+					if (!sh->bh_write[i]  && i != sh->pd_idx &&
+					    !buffer_locked(bh) && !buffer_uptodate(bh) &&
+					    conf->disks[i].operational) {
+						PRINTK("Read_old block %d for Reconstruct\n", i);
+						set_bit(BH_Lock, &bh->b_state);
+						action[i] = READ+1;
+						locked++;
+					}
 				}
-			}
+		}
 		/* now if nothing is locked, and if we have enough data, we can start a write request */
 		if (locked == 0 && (rcw == 0 ||rmw == 0)) {
 			PRINTK("Computing parity...\n");
+			if (rcw == 0 && to_write == disks-1)
+				atomic_inc(&conf->full_writes);
+			else if (rcw == 0)
+				atomic_inc(&conf->rcw_writes);
+			else
+				atomic_inc(&conf->rmw_writes);
+			clear_bit(STRIPE_PREREAD_ACTIVE, &sh->state);
 			compute_parity(sh, rcw==0 ? RECONSTRUCT_WRITE : READ_MODIFY_WRITE);
 			/* now every locked buffer is ready to be written */
 			for (i=disks; i--;)
@@ -1324,6 +1404,78 @@ static int check_consistency (mddev_t *mddev)
 	return 0;
 }
 
+/*
+ * /proc/sys/dev/raid/mdN: stripe cache size and write statistics
+ */
+static int raid5_sysctl_cache_size(ctl_table *table, int write,
+		struct file *filp, void *buffer, size_t *lenp)
+{
+	raid5_conf_t *conf = table->extra1;
+	ctl_table tmp = *table;
+	int nr = conf->max_nr_stripes, err;
+
+	tmp.data = &nr;
+	err = proc_dointvec(&tmp, write, filp, buffer, lenp);
+	if (err || !write)
+		return err;
+	if (nr < MIN_STRIPES || nr > MAX_STRIPES)
+		return -EINVAL;
+	resize_stripes(conf, nr);
+	return 0;
+}
+
+static int raid5_sysctl_atomic(ctl_table *table, int write,
+		struct file *filp, void *buffer, size_t *lenp)
+{
+	ctl_table tmp = *table;
+	int val = atomic_read((atomic_t *) table->data);
+
+	tmp.data = &val;
+	return proc_dointvec(&tmp, write, filp, buffer, lenp);
+}
+
+static ctl_table raid5_ctl_template[] = {
+	{DEV_RAID5_STRIPE_CACHE_SIZE, "stripe_cache_size",
+	 NULL, sizeof(int), 0644, NULL, &raid5_sysctl_cache_size},
+	{DEV_RAID5_STRIPE_CACHE_ACTIVE, "stripe_cache_active",
+	 NULL, sizeof(int), 0444, NULL, &raid5_sysctl_atomic},
+	{DEV_RAID5_RMW_WRITES, "rmw_writes",
+	 NULL, sizeof(int), 0444, NULL, &raid5_sysctl_atomic},
+	{DEV_RAID5_RCW_WRITES, "rcw_writes",
+	 NULL, sizeof(int), 0444, NULL, &raid5_sysctl_atomic},
+	{DEV_RAID5_FULL_WRITES, "full_stripe_writes",
+	 NULL, sizeof(int), 0444, NULL, &raid5_sysctl_atomic},
+	{0}
+};
+
+static void raid5_register_sysctl(raid5_conf_t *conf, int minor)
+{
+	ctl_table *t = conf->ctl_table;
+
+	memcpy(t, raid5_ctl_template, sizeof(raid5_ctl_template));
+	t[0].extra1 = conf;
+	t[1].data = &conf->active_stripes;
+	t[2].data = &conf->rmw_writes;
+	t[3].data = &conf->rcw_writes;
+	t[4].data = &conf->full_writes;
+
+	sprintf(conf->ctl_name, "md%d", minor);
+	conf->ctl_md[0].ctl_name = DEV_RAID_MD_BASE + minor;
+	conf->ctl_md[0].procname = conf->ctl_name;
+	conf->ctl_md[0].mode = 0555;
+	conf->ctl_md[0].child = t;
+	conf->ctl_raid[0].ctl_name = DEV_RAID;
+	conf->ctl_raid[0].procname = "raid";
+	conf->ctl_raid[0].mode = 0555;
+	conf->ctl_raid[0].child = conf->ctl_md;
+	conf->ctl_root[0].ctl_name = CTL_DEV;
+	conf->ctl_root[0].procname = "dev";
+	conf->ctl_root[0].mode = 0555;
+	conf->ctl_root[0].child = conf->ctl_raid;
+
+	conf->ctl_header = register_sysctl_table(conf->ctl_root, 0);
+}
+
 static int raid5_run (mddev_t *mddev)
 {
 	raid5_conf_t *conf;
@@ -1357,6 +1509,11 @@ static int raid5_run (mddev_t *mddev)
 	md_init_waitqueue_head(&conf->wait_for_stripe);
 	INIT_LIST_HEAD(&conf->handle_list);
 	INIT_LIST_HEAD(&conf->inactive_list);
+	INIT_LIST_HEAD(&conf->delayed_list);
+	init_timer(&conf->delay_timer);
+	conf->delay_timer.function = raid5_delay_expired;
+	conf->delay_timer.data = (unsigned long) conf;
+	init_MUTEX(&conf->cache_sem);
 	atomic_set(&conf->active_stripes, 0);
 	conf->buffer_size = PAGE_SIZE; /* good default for rebuild */
 
@@ -1546,6 +1703,7 @@ static int raid5_run (mddev_t *mddev)
 	if (start_recovery)
 		md_recover_arrays();
 	print_raid5_conf(conf);
+	raid5_register_sysctl(conf, mdidx(mddev));
 
 	/* Ok, everything is just fine now */
 	return (0);
@@ -1603,6 +1761,9 @@ static int raid5_stop (mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	if (conf->ctl_header)
+		unregister_sysctl_table(conf->ctl_header);
+	del_timer_sync(&conf->delay_timer);
 	if (conf->resync_thread)
 		md_unregister_thread(conf->resync_thread);
 	md_unregister_thread(conf->thread);
@@ -118,6 +118,9 @@
    LK1.1.11 13 Nov 2000 andrewm
     - Dump MOD_INC/DEC_USE_COUNT, use SET_MODULE_OWNER
 
+    - Gather the page fragments of a packet into one download
+      descriptor and offload the TCP/UDP checksum on the 3c905C.
+
     - See http://www.uow.edu.au/~andrewm/linux/#3c59x-2.3 for more details.
     - Also see Documentation/networking/vortex.txt
 */
@@ -626,8 +629,10 @@ enum rx_desc_status {
 struct boom_tx_desc {
 	u32 next;					/* Last entry points to 0.   */
 	s32 status;					/* bits 0:12 length, others see below.  */
-	u32 addr;
-	s32 length;
+	struct {
+		u32 addr;
+		s32 length;
+	} frag[1+MAX_SKB_FRAGS];			/* Linear part, then the pages. */
 };
 
 /* Values for the Tx status entry. */
@@ -730,7 +735,8 @@ static void rx_oom_timer(unsigned long arg);
 static int vortex_start_xmit(struct sk_buff *skb, struct net_device *dev);
 static int boomerang_start_xmit(struct sk_buff *skb, struct net_device *dev);
 static int vortex_rx(struct net_device *dev);
-static int boomerang_rx(struct net_device *dev);
+static int boomerang_rx(struct net_device *dev, int limit);
+static int boomerang_poll(struct net_device *dev, int *budget);
 static void vortex_interrupt(int irq, void *dev_id, struct pt_regs *regs);
 static void boomerang_interrupt(int irq, void *dev_id, struct pt_regs *regs);
 static int vortex_close(struct net_device *dev);
@@ -1135,6 +1141,14 @@ static int __devinit vortex_probe1(struct pci_dev *pdev,
 	dev->set_multicast_list = set_rx_mode;
 	dev->tx_timeout = vortex_tx_timeout;
 	dev->watchdog_timeo = (watchdog * HZ) / 1000;
+	if (vp->full_bus_master_rx) {
+		dev->poll = boomerang_poll;
+		dev->weight = 16;
+	}
+	/* The 3c905C gathers the fragments of a packet from the download
+	 * descriptor and fills in the TCP and UDP checksums. */
+	if (vp->full_bus_master_tx && (vci->drv_flags & IS_TORNADO))
+		dev->features |= NETIF_F_SG|NETIF_F_IP_CSUM;
 
 	return 0;
 
@@ -1741,6 +1755,23 @@ vortex_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	return 0;
 }
 
+/* Unmap every Addr/Len pair of a download descriptor. */
+static void
+boomerang_unmap_tx(struct vortex_private *vp, int entry)
+{
+	struct boom_tx_desc *desc = &vp->tx_ring[entry];
+	int i;
+
+	for (i = 0; i <= MAX_SKB_FRAGS; i++) {
+		u32 length = le32_to_cpu(desc->frag[i].length);
+
+		pci_unmap_single(vp->pdev, le32_to_cpu(desc->frag[i].addr),
+				 length & 0x1fff, PCI_DMA_TODEVICE);
+		if (length & LAST_FRAG)
+			break;
+	}
+}
+
 static int
 boomerang_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
@@ -1766,9 +1797,33 @@ boomerang_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 	vp->tx_skbuff[entry] = skb;
 	vp->tx_ring[entry].next = 0;
-	vp->tx_ring[entry].addr = cpu_to_le32(pci_map_single(vp->pdev, skb->data, skb->len, PCI_DMA_TODEVICE));
-	vp->tx_ring[entry].length = cpu_to_le32(skb->len | LAST_FRAG);
-	vp->tx_ring[entry].status = cpu_to_le32(skb->len | TxIntrUploaded);
+	if (skb->ip_summed != CHECKSUM_HW)
+		vp->tx_ring[entry].status = cpu_to_le32(skb->len | TxIntrUploaded);
+	else
+		vp->tx_ring[entry].status = cpu_to_le32(skb->len | TxIntrUploaded | AddTCPChksum | AddUDPChksum);
+
+	if (!skb_shinfo(skb)->nr_frags) {
+		vp->tx_ring[entry].frag[0].addr = cpu_to_le32(pci_map_single(vp->pdev, skb->data, skb->len, PCI_DMA_TODEVICE));
+		vp->tx_ring[entry].frag[0].length = cpu_to_le32(skb->len | LAST_FRAG);
+	} else {
+		int i;
+
+		vp->tx_ring[entry].frag[0].addr = cpu_to_le32(pci_map_single(vp->pdev, skb->data, skb_headlen(skb), PCI_DMA_TODEVICE));
+		vp->tx_ring[entry].frag[0].length = cpu_to_le32(skb_headlen(skb));
+
+		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+			skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+			vp->tx_ring[entry].frag[i+1].addr =
+				cpu_to_le32(pci_map_single(vp->pdev,
+							   page_address(frag->page) + frag->page_offset,
+							   frag->size, PCI_DMA_TODEVICE));
+			if (i == skb_shinfo(skb)->nr_frags-1)
+				vp->tx_ring[entry].frag[i+1].length = cpu_to_le32(frag->size | LAST_FRAG);
+			else
+				vp->tx_ring[entry].frag[i+1].length = cpu_to_le32(frag->size);
+		}
+	}
 
 	spin_lock_irqsave(&vp->lock, flags);
 	/* Wait for the stall to complete. */
@@ -1948,9 +2003,13 @@ static void boomerang_interrupt(int irq, void *dev_id, struct pt_regs *regs)
 					   dev->name, status);
 		if (status & UpComplete) {
 			outw(AckIntr | UpComplete, ioaddr + EL3_CMD);
-			if (vortex_debug > 5)
-				printk(KERN_DEBUG "boomerang_interrupt->boomerang_rx\n");
-			boomerang_rx(dev);
+			/* Mask UpComplete and leave the Rx ring to boomerang_poll(). */
+			if (netif_rx_schedule_prep(dev)) {
+				if (vortex_debug > 5)
+					printk(KERN_DEBUG "boomerang_interrupt->boomerang_poll\n");
+				outw(vp->intr_enable & ~UpComplete, ioaddr + EL3_CMD);
+				__netif_rx_schedule(dev);
+			}
 		}
 
 		if (status & DownComplete) {
@@ -1971,8 +2030,7 @@ static void boomerang_interrupt(int irq, void *dev_id, struct pt_regs *regs)
 				if (vp->tx_skbuff[entry]) {
 					struct sk_buff *skb = vp->tx_skbuff[entry];
 					
-					pci_unmap_single(vp->pdev,
-						le32_to_cpu(vp->tx_ring[entry].addr), skb->len, PCI_DMA_TODEVICE);
+					boomerang_unmap_tx(vp, entry);
 					dev_kfree_skb_irq(skb);
 					vp->tx_skbuff[entry] = 0;
 				} else {
@@ -2091,14 +2149,20 @@ static int vortex_rx(struct net_device *dev)
 	return 0;
 }
 
+/* Pass up to limit received packets to the stack and refill the ring.
+   Returns the number of ring entries consumed. */
 static int
-boomerang_rx(struct net_device *dev)
+boomerang_rx(struct net_device *dev, int limit)
 {
 	struct vortex_private *vp = (struct vortex_private *)dev->priv;
 	int entry = vp->cur_rx % RX_RING_SIZE;
 	long ioaddr = dev->base_addr;
 	int rx_status;
 	int rx_work_limit = vp->dirty_rx + RX_RING_SIZE - vp->cur_rx;
+	int received = 0;
+
+	if (rx_work_limit > limit)
+		rx_work_limit = limit;
 
 	if (vortex_debug > 5)
 		printk(KERN_DEBUG "boomerang_rx(): status %4.4x\n", inw(ioaddr+EL3_STATUS));
@@ -2156,11 +2220,12 @@ boomerang_rx(struct net_device *dev)
 					rx_csumhits++;
 				}
 			}
-			netif_rx(skb);
+			netif_receive_skb(skb);
 			dev->last_rx = jiffies;
 			vp->stats.rx_packets++;
 		}
 		entry = (++vp->cur_rx) % RX_RING_SIZE;
+		received++;
 	}
 	/* Refill the Rx ring buffers. */
 	for (; vp->cur_rx - vp->dirty_rx > 0; vp->dirty_rx++) {
@@ -2186,6 +2251,40 @@ boomerang_rx(struct net_device *dev)
 		vp->rx_ring[entry].status = 0;	/* Clear complete bit. */
 		outw(UpUnstall, ioaddr + EL3_CMD);
 	}
+	return received;
+}
+
+/*
+ * Called from net_rx_action() with UpComplete masked.  The interrupt
+ * is unmasked again only when the ring is found empty after the last
+ * UpComplete was acknowledged, so no packet is left behind.
+ */
+static int
+boomerang_poll(struct net_device *dev, int *budget)
+{
+	struct vortex_private *vp = (struct vortex_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	int limit = *budget < dev->quota ? *budget : dev->quota;
+	int received = 0;
+	unsigned long flags;
+
+	do {
+		outw(AckIntr | UpComplete, ioaddr + EL3_CMD);
+		received += boomerang_rx(dev, limit - received);
+		if (received >= limit) {
+			dev->quota -= received;
+			*budget -= received;
+			return 1;
+		}
+	} while (inw(ioaddr + EL3_STATUS) & UpComplete);
+
+	dev->quota -= received;
+	*budget -= received;
+	netif_rx_complete(dev);
+
+	spin_lock_irqsave(&vp->lock, flags);
+	outw(vp->intr_enable, ioaddr + EL3_CMD);
+	spin_unlock_irqrestore(&vp->lock, flags);
 	return 0;
 }
 
@@ -2199,14 +2298,12 @@ rx_oom_timer(unsigned long arg)
 	struct net_device *dev = (struct net_device *)arg;
 	struct vortex_private *vp = (struct vortex_private *)dev->priv;
 
-	spin_lock_irq(&vp->lock);
+	/* The ring belongs to boomerang_poll(), which does the refill. */
 	if ((vp->cur_rx - vp->dirty_rx) == RX_RING_SIZE)	/* This test is redundant, but makes me feel good */
-		boomerang_rx(dev);
-	if (vortex_debug > 1) {
-		printk(KERN_DEBUG "%s: rx_oom_timer %s\n", dev->name,
-			((vp->cur_rx - vp->dirty_rx) != RX_RING_SIZE) ? "succeeded" : "retrying");
-	}
-	spin_unlock_irq(&vp->lock);
+		netif_rx_schedule(dev);
+	if (vortex_debug > 1)
+		printk(KERN_DEBUG "%s: rx_oom_timer rescheduling the receiver\n",
+			   dev->name);
 }
 
 static void
@@ -2277,7 +2374,7 @@ vortex_close(struct net_device *dev)
 			if (vp->tx_skbuff[i]) {
 				struct sk_buff *skb = vp->tx_skbuff[i];
 
-				pci_unmap_single(vp->pdev, le32_to_cpu(vp->tx_ring[i].addr), skb->len, PCI_DMA_TODEVICE);
+				boomerang_unmap_tx(vp, i);
 				dev_kfree_skb(skb);
 				vp->tx_skbuff[i] = 0;
 			}
@@ -2310,7 +2407,7 @@ dump_tx_ring(struct net_device *dev)
 			for (i = 0; i < TX_RING_SIZE; i++) {
 				printk(KERN_ERR "  %d: @%p  length %8.8x status %8.8x\n", i,
 					   &vp->tx_ring[i],
-					   le32_to_cpu(vp->tx_ring[i].length),
+					   le32_to_cpu(vp->tx_ring[i].frag[0].length),
 					   le32_to_cpu(vp->tx_ring[i].status));
 			}
 			if (!stalled)
@@ -208,6 +208,17 @@ static inline void *pci_alloc_consistent(struct pci_dev *hwdev, size_t size,
  * done by Aman Singla.
  */
 #define dev_kfree_skb_irq(a)			dev_kfree_skb(a)
+
+static inline void dev_kfree_skb_irq_list(struct sk_buff *skb)
+{
+	while (skb) {
+		struct sk_buff *next = skb->next;
+
+		skb->next = NULL;
+		dev_kfree_skb(skb);
+		skb = next;
+	}
+}
 #define netif_wake_queue(dev)			clear_bit(0, &dev->tbusy)
 #define netif_stop_queue(dev)			set_bit(0, &dev->tbusy)
 #define late_stop_netif_stop_queue(dev)		{do{} while(0);}
@@ -421,6 +432,10 @@ static inline void tasklet_init(struct tasklet_struct *tasklet,
  * we don't risk that the refilling is moved to another CPU when the
  * one running the interrupt handler just got the slab code hot in its
  * cache.
+ *
+ * The RX_*_SIZE values are only the defaults for the number of
+ * buffers kept in each ring; they can be changed per device at run
+ * time with ETHTOOL_SRINGPARAM, down to twice the panic threshold.
  */
 #define RX_RING_SIZE		72
 #define RX_MINI_SIZE		64
@@ -428,13 +443,13 @@ static inline void tasklet_init(struct tasklet_struct *tasklet,
 
 #define RX_PANIC_STD_THRES	16
 #define RX_PANIC_STD_REFILL	(3*RX_PANIC_STD_THRES)/2
-#define RX_LOW_STD_THRES	(3*RX_RING_SIZE)/4
+#define RX_LOW_STD_THRES(ap)	(3*(ap)->rx_std_size)/4
 #define RX_PANIC_MINI_THRES	12
 #define RX_PANIC_MINI_REFILL	(3*RX_PANIC_MINI_THRES)/2
-#define RX_LOW_MINI_THRES	(3*RX_MINI_SIZE)/4
+#define RX_LOW_MINI_THRES(ap)	(3*(ap)->rx_mini_size)/4
 #define RX_PANIC_JUMBO_THRES	6
 #define RX_PANIC_JUMBO_REFILL	(3*RX_PANIC_JUMBO_THRES)/2
-#define RX_LOW_JUMBO_THRES	(3*RX_JUMBO_SIZE)/4
+#define RX_LOW_JUMBO_THRES(ap)	(3*(ap)->rx_jumbo_size)/4
 
 
 /*
@@ -552,6 +567,9 @@ int __init acenic_probe (ACE_PROBE_ARG)
 		dev->irq = pdev->irq;
 		dev->open = &ace_open;
 		dev->hard_start_xmit = &ace_start_xmit;
+#ifdef HAVE_XMIT_BATCH
+		dev->hard_start_xmit_batch = &ace_start_xmit_batch;
+#endif
 		dev->stop = &ace_close;
 		dev->get_stats = &ace_get_stats;
 		dev->set_multicast_list = &ace_set_multicast_list;
@@ -674,6 +692,10 @@ int __init acenic_probe (ACE_PROBE_ARG)
 		ap->board_idx = BOARD_IDX_STATIC;
 #endif
 
+		ap->rx_std_size = RX_RING_SIZE;
+		ap->rx_mini_size = RX_MINI_SIZE;
+		ap->rx_jumbo_size = RX_JUMBO_SIZE;
+
 		if (ace_init(dev))
 			continue;
 
@@ -1524,13 +1546,13 @@ static int __init ace_init(struct net_device *dev)
 	 * firmware to wipe the ring without re-initializing it.
 	 */
 	if (!test_and_set_bit(0, &ap->std_refill_busy))
-		ace_load_std_rx_ring(ap, RX_RING_SIZE);
+		ace_load_std_rx_ring(ap, ap->rx_std_size);
 	else
 		printk(KERN_ERR "%s: Someone is busy refilling the RX ring\n",
 		       dev->name);
 	if (ap->version >= 2) {
 		if (!test_and_set_bit(0, &ap->mini_refill_busy))
-			ace_load_mini_rx_ring(ap, RX_MINI_SIZE);
+			ace_load_mini_rx_ring(ap, ap->rx_mini_size);
 		else
 			printk(KERN_ERR "%s: Someone is busy refilling "
 			       "the RX mini ring\n", dev->name);
@@ -1616,33 +1638,33 @@ static void ace_tasklet(unsigned long dev)
 	int cur_size;
 
 	cur_size = atomic_read(&ap->cur_rx_bufs);
-	if ((cur_size < RX_LOW_STD_THRES) &&
+	if ((cur_size < RX_LOW_STD_THRES(ap)) &&
 	    !test_and_set_bit(0, &ap->std_refill_busy)) {
 #if DEBUG
 		printk("refilling buffers (current %i)\n", cur_size);
 #endif
-		ace_load_std_rx_ring(ap, RX_RING_SIZE - cur_size);
+		ace_load_std_rx_ring(ap, ap->rx_std_size - cur_size);
 	}
 
 	if (ap->version >= 2) {
 		cur_size = atomic_read(&ap->cur_mini_bufs);
-		if ((cur_size < RX_LOW_MINI_THRES) &&
+		if ((cur_size < RX_LOW_MINI_THRES(ap)) &&
 		    !test_and_set_bit(0, &ap->mini_refill_busy)) {
 #if DEBUG
 			printk("refilling mini buffers (current %i)\n",
 			       cur_size);
 #endif
-			ace_load_mini_rx_ring(ap, RX_MINI_SIZE - cur_size);
+			ace_load_mini_rx_ring(ap, ap->rx_mini_size - cur_size);
 		}
 	}
 
 	cur_size = atomic_read(&ap->cur_jumbo_bufs);
-	if (ap->jumbo && (cur_size < RX_LOW_JUMBO_THRES) &&
+	if (ap->jumbo && (cur_size < RX_LOW_JUMBO_THRES(ap)) &&
 	    !test_and_set_bit(0, &ap->jumbo_refill_busy)) {
 #if DEBUG
 		printk("refilling jumbo buffers (current %i)\n", >cur_size);
 #endif
-		ace_load_jumbo_rx_ring(ap, RX_JUMBO_SIZE - cur_size);
+		ace_load_jumbo_rx_ring(ap, ap->rx_jumbo_size - cur_size);
 	}
 	ap->tasklet_pending = 0;
 }
@@ -2092,6 +2114,7 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 	 * Tell the card not to generate interrupts while we are in here.
 	 */
 	writel(1, &regs->Mb0Lo);
+	ap->irq_count++;
 
 	/*
 	 * There is no conflict between transmit handling in
@@ -2103,13 +2126,20 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 	rxretprd = *ap->rx_ret_prd;
 	rxretcsm = ap->cur_rx;
 
-	if (rxretprd != rxretcsm)
+	if (rxretprd != rxretcsm) {
+		ap->irq_rx_frames += (rxretprd - rxretcsm) %
+			RX_RETURN_RING_ENTRIES;
 		ace_rx_int(dev, rxretprd, rxretcsm);
+	}
 
 	txcsm = *ap->tx_csm;
 	idx = ap->tx_ret_csm;
 
 	if (txcsm != idx) {
+		struct sk_buff *done = NULL;
+
+		ap->irq_tx_frames += (txcsm - idx) % TX_RING_ENTRIES;
+
 		do {
 			struct sk_buff *skb;
 
@@ -2136,7 +2166,9 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 				ap->stats.tx_bytes += skb->len;
 				pci_unmap_single(ap->pdev, mapping, skb->len,
 						 PCI_DMA_TODEVICE);
-				dev_kfree_skb_irq(skb);
+				/* Freed all at once below */
+				skb->next = done;
+				done = skb;
 
 				ap->skb->tx_skbuff[idx].skb = NULL;
 			}
@@ -2156,6 +2188,8 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 			idx = (idx + 1) % TX_RING_ENTRIES;
 		} while (idx != txcsm);
 
+		dev_kfree_skb_irq_list(done);
+
 		/*
 		 * Once we actually get to this point the tx ring has
 		 * already been trimmed thus it cannot be full!
@@ -2198,21 +2232,21 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 		int run_tasklet = 0;
 
 		cur_size = atomic_read(&ap->cur_rx_bufs);
-		if (cur_size < RX_LOW_STD_THRES) {
+		if (cur_size < RX_LOW_STD_THRES(ap)) {
 			if ((cur_size < RX_PANIC_STD_THRES) &&
 			    !test_and_set_bit(0, &ap->std_refill_busy)) {
 #if DEBUG
 				printk("low on std buffers %i\n", cur_size);
 #endif
 				ace_load_std_rx_ring(ap,
-						     RX_RING_SIZE - cur_size);
+						     ap->rx_std_size - cur_size);
 			} else
 				run_tasklet = 1;
 		}
 
 		if (!ACE_IS_TIGON_I(ap)) {
 			cur_size = atomic_read(&ap->cur_mini_bufs);
-			if (cur_size < RX_LOW_MINI_THRES) {
+			if (cur_size < RX_LOW_MINI_THRES(ap)) {
 				if ((cur_size < RX_PANIC_MINI_THRES) &&
 				    !test_and_set_bit(0,
 						      &ap->mini_refill_busy)) {
@@ -2220,7 +2254,7 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 					printk("low on mini buffers %i\n",
 					       cur_size);
 #endif
-					ace_load_mini_rx_ring(ap, RX_MINI_SIZE - cur_size);
+					ace_load_mini_rx_ring(ap, ap->rx_mini_size - cur_size);
 				} else
 					run_tasklet = 1;
 			}
@@ -2228,7 +2262,7 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 
 		if (ap->jumbo) {
 			cur_size = atomic_read(&ap->cur_jumbo_bufs);
-			if (cur_size < RX_LOW_JUMBO_THRES) {
+			if (cur_size < RX_LOW_JUMBO_THRES(ap)) {
 				if ((cur_size < RX_PANIC_JUMBO_THRES) &&
 				    !test_and_set_bit(0,
 						      &ap->jumbo_refill_busy)){
@@ -2236,7 +2270,7 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *ptregs)
 					printk("low on jumbo buffers %i\n",
 					       cur_size);
 #endif
-					ace_load_jumbo_rx_ring(ap, RX_JUMBO_SIZE - cur_size);
+					ace_load_jumbo_rx_ring(ap, ap->rx_jumbo_size - cur_size);
 				} else
 					run_tasklet = 1;
 			}
@@ -2287,7 +2321,7 @@ static int ace_open(struct net_device *dev)
 
 	if (ap->jumbo &&
 	    !test_and_set_bit(0, &ap->jumbo_refill_busy))
-		ace_load_jumbo_rx_ring(ap, RX_JUMBO_SIZE);
+		ace_load_jumbo_rx_ring(ap, ap->rx_jumbo_size);
 
 	if (dev->flags & IFF_PROMISC) {
 		cmd.evt = C_SET_PROMISC_MODE;
@@ -2393,29 +2427,24 @@ static int ace_close(struct net_device *dev)
 }
 
 
-static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev)
+/*
+ * Free descriptors in the tx ring if the producer were at idx.
+ */
+static inline u32 ace_tx_space(struct ace_private *ap, u32 idx)
 {
-	struct ace_private *ap = dev->priv;
-	struct ace_regs *regs = ap->regs;
-	unsigned long addr;
-	u32 idx, flagsize;
-
-	/*
-	 * This only happens with pre-softnet, ie. 2.2.x kernels.
-	 */
-	if (early_stop_netif_stop_queue(dev))
-		return 1;
+	return (ap->tx_ret_csm + TX_RING_ENTRIES - idx - 1) % TX_RING_ENTRIES;
+}
 
-	idx = ap->tx_prd;
 
-	if ((idx + 1) % TX_RING_ENTRIES == ap->tx_ret_csm) {
-		ap->tx_full = 1;
-#if DEBUG
-		printk("%s: trying to transmit while the tx ring is full "
-		       "- this should not happen!\n", dev->name);
-#endif
-		return 1;
-	}
+/*
+ * Fill the descriptor at idx for skb; returns the next index.  The
+ * NIC is not told until ace_tx_kick().
+ */
+static inline u32 ace_queue_tx(struct ace_private *ap, struct sk_buff *skb,
+			       u32 idx)
+{
+	unsigned long addr;
+	u32 flagsize;
 
 	ap->skb->tx_skbuff[idx].skb = skb;
 	ap->skb->tx_skbuff[idx].mapping =
@@ -2425,9 +2454,21 @@ static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	flagsize = (skb->len << 16) | (BD_FLG_END) ;
 	set_aceaddr(&ap->tx_ring[idx].addr, addr);
 	ap->tx_ring[idx].flagsize = flagsize;
-	wmb();
-	idx = (idx + 1) % TX_RING_ENTRIES;
 
+	return (idx + 1) % TX_RING_ENTRIES;
+}
+
+
+/*
+ * Hand everything up to idx to the NIC and stop the queue if the
+ * ring is about to fill up.
+ */
+static void ace_tx_kick(struct net_device *dev, struct ace_private *ap,
+			u32 idx)
+{
+	struct ace_regs *regs = ap->regs;
+
+	wmb();
 	ap->tx_prd = idx;
 	ace_set_txprd(regs, ap, idx);
 
@@ -2435,7 +2476,7 @@ static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	 * tx_csm is set by the NIC whereas we set tx_ret_csm which
 	 * is always trying to catch tx_csm
 	 */
-	if ((idx + 2) % TX_RING_ENTRIES == ap->tx_ret_csm) {
+	if (ace_tx_space(ap, idx) <= 1) {
 		ap->tx_full = 1;
 		/*
 		 * Queue is full, add timer to detect whether the
@@ -2454,7 +2495,7 @@ static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		 * processor order would work too) but that's what lock-less
 		 * programming is all about
 		 */
-		if (((idx + 2) % TX_RING_ENTRIES != ap->tx_ret_csm)
+		if ((ace_tx_space(ap, idx) > 1)
 			&& xchg(&ap->tx_full, 0)) {
 			del_timer(&ap->timer);
 			/*
@@ -2471,10 +2512,73 @@ static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	dev->trans_start = jiffies;
+}
+
+
+static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct ace_private *ap = dev->priv;
+	u32 idx;
+
+	/*
+	 * This only happens with pre-softnet, ie. 2.2.x kernels.
+	 */
+	if (early_stop_netif_stop_queue(dev))
+		return 1;
+
+	idx = ap->tx_prd;
+
+	if (ace_tx_space(ap, idx) == 0) {
+		ap->tx_full = 1;
+#if DEBUG
+		printk("%s: trying to transmit while the tx ring is full "
+		       "- this should not happen!\n", dev->name);
+#endif
+		return 1;
+	}
+
+	idx = ace_queue_tx(ap, skb, idx);
+	ace_tx_kick(dev, ap, idx);
 	return 0;
 }
 
 
+#ifdef HAVE_XMIT_BATCH
+/*
+ * Fill the ring with as much of the chain as fits, leaving the last
+ * descriptor free as ace_start_xmit() does, and write the producer
+ * index once for all of it.
+ */
+static struct sk_buff *ace_start_xmit_batch(struct sk_buff *skb,
+					    struct net_device *dev)
+{
+	struct ace_private *ap = dev->priv;
+	u32 idx = ap->tx_prd;
+	int queued = 0;
+
+	while (skb) {
+		struct sk_buff *next;
+
+		if (ace_tx_space(ap, idx) <= (queued ? 1 : 0)) {
+			if (!queued)
+				ap->tx_full = 1;
+			break;
+		}
+
+		next = skb->next;
+		skb->next = NULL;
+		idx = ace_queue_tx(ap, skb, idx);
+		queued++;
+		skb = next;
+	}
+
+	if (queued)
+		ace_tx_kick(dev, ap, idx);
+	return skb;
+}
+#endif
+
+
 static int ace_change_mtu(struct net_device *dev, int new_mtu)
 {
 	struct ace_private *ap = dev->priv;
@@ -2492,7 +2596,7 @@ static int ace_change_mtu(struct net_device *dev, int new_mtu)
 			       "support\n", dev->name);
 			ap->jumbo = 1;
 			if (!test_and_set_bit(0, &ap->jumbo_refill_busy))
-				ace_load_jumbo_rx_ring(ap, RX_JUMBO_SIZE);
+				ace_load_jumbo_rx_ring(ap, ap->rx_jumbo_size);
 			ace_set_rxtx_parms(dev, 1);
 		}
 	} else {
@@ -2514,13 +2618,131 @@ static int ace_change_mtu(struct net_device *dev, int new_mtu)
 }
 
 
+#if defined(SIOCETHTOOL) && defined(ETHTOOL_GCOALESCE)
+static int ace_ethtool_coalesce(struct net_device *dev, void *useraddr,
+				u32 ethcmd)
+{
+	struct ace_private *ap = dev->priv;
+	struct ace_regs *regs = ap->regs;
+	struct ethtool_coalesce ecoal;
+
+	if (ethcmd == ETHTOOL_GCOALESCE) {
+		memset(&ecoal, 0, sizeof(ecoal));
+		ecoal.cmd = ethcmd;
+		ecoal.rx_coalesce_usecs = readl(&regs->TuneRxCoalTicks);
+		ecoal.rx_max_coalesced_frames = readl(&regs->TuneMaxRxDesc);
+		ecoal.tx_coalesce_usecs = readl(&regs->TuneTxCoalTicks);
+		ecoal.tx_max_coalesced_frames = readl(&regs->TuneMaxTxDesc);
+		ecoal.interrupts = ap->irq_count;
+		ecoal.rx_frames = ap->irq_rx_frames;
+		ecoal.tx_frames = ap->irq_tx_frames;
+
+		if (copy_to_user(useraddr, &ecoal, sizeof(ecoal)))
+			return -EFAULT;
+		return 0;
+	}
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&ecoal, useraddr, sizeof(ecoal)))
+		return -EFAULT;
+
+	/*
+	 * The coalescing clock ticks in microseconds, see the
+	 * tx_coal_tick module parameter; zero means the default for
+	 * the current MTU.  Like the defaults, the values end up
+	 * replaced by ace_set_rxtx_parms() when the MTU moves across
+	 * ACE_STD_MTU.
+	 */
+	if (!ecoal.rx_coalesce_usecs)
+		ecoal.rx_coalesce_usecs =
+			ap->jumbo ? DEF_JUMBO_RX_COAL : DEF_RX_COAL;
+	if (!ecoal.rx_max_coalesced_frames)
+		ecoal.rx_max_coalesced_frames =
+			ap->jumbo ? DEF_JUMBO_RX_MAX_DESC : DEF_RX_MAX_DESC;
+	if (!ecoal.tx_coalesce_usecs)
+		ecoal.tx_coalesce_usecs =
+			ap->jumbo ? DEF_JUMBO_TX_COAL : DEF_TX_COAL;
+	if (!ecoal.tx_max_coalesced_frames)
+		ecoal.tx_max_coalesced_frames =
+			ap->jumbo ? DEF_JUMBO_TX_MAX_DESC : DEF_TX_MAX_DESC;
+
+	writel(ecoal.rx_coalesce_usecs, &regs->TuneRxCoalTicks);
+	writel(ecoal.rx_max_coalesced_frames, &regs->TuneMaxRxDesc);
+	writel(ecoal.tx_coalesce_usecs, &regs->TuneTxCoalTicks);
+	writel(ecoal.tx_max_coalesced_frames, &regs->TuneMaxTxDesc);
+	wmb();
+	return 0;
+}
+
+
+/*
+ * The rings themselves are fixed by the firmware; what can be changed
+ * is how many buffers we keep posted in each of the rx rings.  A
+ * bigger value takes effect as the rings are refilled, a smaller one
+ * as the NIC uses up the surplus.
+ */
+static int ace_ethtool_ringparam(struct net_device *dev, void *useraddr,
+				 u32 ethcmd)
+{
+	struct ace_private *ap = dev->priv;
+	struct ethtool_ringparam ering;
+
+	if (ethcmd == ETHTOOL_GRINGPARAM) {
+		memset(&ering, 0, sizeof(ering));
+		ering.cmd = ethcmd;
+		ering.rx_max_pending = RX_STD_RING_ENTRIES - 1;
+		if (!ACE_IS_TIGON_I(ap))
+			ering.rx_mini_max_pending = RX_MINI_RING_ENTRIES - 1;
+		ering.rx_jumbo_max_pending = RX_JUMBO_RING_ENTRIES - 1;
+		ering.tx_max_pending = TX_RING_ENTRIES - 1;
+		ering.rx_pending = ap->rx_std_size;
+		if (!ACE_IS_TIGON_I(ap))
+			ering.rx_mini_pending = ap->rx_mini_size;
+		ering.rx_jumbo_pending = ap->rx_jumbo_size;
+		ering.tx_pending = TX_RING_ENTRIES - 1;
+
+		if (copy_to_user(useraddr, &ering, sizeof(ering)))
+			return -EFAULT;
+		return 0;
+	}
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&ering, useraddr, sizeof(ering)))
+		return -EFAULT;
+
+	if (ering.rx_pending < 2 * RX_PANIC_STD_THRES ||
+	    ering.rx_pending >= RX_STD_RING_ENTRIES)
+		return -EINVAL;
+	if (ACE_IS_TIGON_I(ap)) {
+		if (ering.rx_mini_pending)
+			return -EINVAL;
+	} else if (ering.rx_mini_pending < 2 * RX_PANIC_MINI_THRES ||
+		   ering.rx_mini_pending >= RX_MINI_RING_ENTRIES)
+		return -EINVAL;
+	if (ering.rx_jumbo_pending < 2 * RX_PANIC_JUMBO_THRES ||
+	    ering.rx_jumbo_pending >= RX_JUMBO_RING_ENTRIES)
+		return -EINVAL;
+	if (ering.tx_pending != TX_RING_ENTRIES - 1)
+		return -EINVAL;
+
+	ap->rx_std_size = ering.rx_pending;
+	if (!ACE_IS_TIGON_I(ap))
+		ap->rx_mini_size = ering.rx_mini_pending;
+	ap->rx_jumbo_size = ering.rx_jumbo_pending;
+	return 0;
+}
+#endif
+
+
 static int ace_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd)
 {
 #ifdef SIOCETHTOOL
 	struct ace_private *ap = dev->priv;
 	struct ace_regs *regs = ap->regs;
 	struct ethtool_cmd ecmd;
-	u32 link, speed;
+	u32 link, speed, ethcmd;
 
 #ifdef SPIN_DEBUG
 	if (cmd == (SIOCDEVPRIVATE+0x0e)) {
@@ -2539,6 +2761,20 @@ static int ace_ioctl(struct net_device *dev, struct ifreq *ifr, int cmd)
 #endif
 	if (cmd != SIOCETHTOOL)
 		return -EOPNOTSUPP;
+	if (copy_from_user(&ethcmd, ifr->ifr_data, sizeof(ethcmd)))
+		return -EFAULT;
+
+#ifdef ETHTOOL_GCOALESCE
+	switch (ethcmd) {
+	case ETHTOOL_GCOALESCE:
+	case ETHTOOL_SCOALESCE:
+		return ace_ethtool_coalesce(dev, ifr->ifr_data, ethcmd);
+	case ETHTOOL_GRINGPARAM:
+	case ETHTOOL_SRINGPARAM:
+		return ace_ethtool_ringparam(dev, ifr->ifr_data, ethcmd);
+	}
+#endif
+
 	if (copy_from_user(&ecmd, ifr->ifr_data, sizeof(ecmd)))
 		return -EFAULT;
 
@@ -630,6 +630,7 @@ struct ace_private
 
 	int			tasklet_pending, jumbo;
 	struct tasklet_struct	ace_tasklet;
+	int			rx_std_size, rx_mini_size, rx_jumbo_size;
 
 	struct event		*evt_ring;
 
@@ -648,6 +649,7 @@ struct ace_private
 	u16			pci_command;
 	u8			pci_latency;
 	char			name[48];
+	u32			irq_count, irq_rx_frames, irq_tx_frames;
 #ifdef INDEX_DEBUG
 	spinlock_t		debug_lock
 				__attribute__ ((aligned (SMP_CACHE_BYTES)));;
@@ -716,6 +718,10 @@ static void ace_interrupt(int irq, void *dev_id, struct pt_regs *regs);
 static int ace_load_firmware(struct net_device *dev);
 static int ace_open(struct net_device *dev);
 static int ace_start_xmit(struct sk_buff *skb, struct net_device *dev);
+#ifdef HAVE_XMIT_BATCH
+static struct sk_buff *ace_start_xmit_batch(struct sk_buff *skb,
+					    struct net_device *dev);
+#endif
 static int ace_close(struct net_device *dev);
 static void ace_timer(unsigned long data);
 static void ace_tasklet(unsigned long dev);
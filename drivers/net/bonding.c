@@ -28,20 +28,103 @@
  *
  * v0.1 - first working version.
  * v0.2 - changed stats to be calculated by summing slaves stats.
- * 
+ * v0.3 - transmit policies: besides round robin (mode=0), a hash of
+ *	  the MAC addresses, IP addresses or IP addresses and ports
+ *	  (xmit_hash_policy=0/1/2) can pick the slave, which keeps each
+ *	  flow on one link and in order (mode=1).  mode=2 does the same
+ *	  over the links aggregated with the switch by 802.3ad LACP.
+ *	  /proc/net/bonding shows the slaves and their counters.
+ *
+ * The 802.3ad support is the subset a switch needs to form one
+ * aggregate with us: all slaves share one key and are active LACP
+ * participants; the partner system heard on the first eligible slave
+ * selects the single aggregator, and a slave collects and distributes
+ * once the partner reports it in sync (a coupled mux).  Marker PDUs
+ * are answered.  Several aggregators, churn detection and standby
+ * links are not implemented.
  */
 
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/netdevice.h>
+#include <linux/etherdevice.h>
 #include <linux/init.h>
+#include <linux/timer.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/jhash.h>
+#include <linux/proc_fs.h>
+#include <linux/pkt_sched.h>
 #include <linux/if_bonding.h>
+#include <net/ip.h>
+
+#define BOND_MAX_SLAVES	32
+
+/* 802.3ad slow protocol frames, IEEE 802.3 clause 43 */
+#define SLOW_SUBTYPE_LACP	1
+#define SLOW_SUBTYPE_MARKER	2
+
+#define LACP_STATE_ACTIVITY	0x01
+#define LACP_STATE_TIMEOUT	0x02	/* Short timeout */
+#define LACP_STATE_AGGREGATION	0x04
+#define LACP_STATE_SYNC		0x08
+#define LACP_STATE_COLLECTING	0x10
+#define LACP_STATE_DISTRIBUTING	0x20
+#define LACP_STATE_DEFAULTED	0x40
+#define LACP_STATE_EXPIRED	0x80
+
+#define LACP_FAST_PERIOD	(1*HZ)
+#define LACP_SLOW_PERIOD	(30*HZ)
+#define LACP_TICK		(HZ/4)
+
+#define LACP_SYSTEM_PRIORITY	0xffff
+#define LACP_PORT_PRIORITY	0x00ff
+
+#define MARKER_TLV_INFO		1
+#define MARKER_TLV_RESPONSE	2
+
+struct lacp_info {
+	u16	system_priority;
+	u8	system[ETH_ALEN];
+	u16	key;
+	u16	port_priority;
+	u16	port;
+	u8	state;
+	u8	reserved[3];
+} __attribute__ ((packed));
+
+struct lacpdu {
+	u8	subtype;
+	u8	version;
+	u8	actor_tlv, actor_len;		/* 1, 20 */
+	struct lacp_info actor;
+	u8	partner_tlv, partner_len;	/* 2, 20 */
+	struct lacp_info partner;
+	u8	collector_tlv, collector_len;	/* 3, 16 */
+	u16	collector_max_delay;
+	u8	reserved1[12];
+	u8	terminator_tlv, terminator_len;	/* 0, 0 */
+	u8	reserved2[50];
+} __attribute__ ((packed));
+
+static u8 slow_proto_addr[ETH_ALEN] = { 0x01, 0x80, 0xc2, 0x00, 0x00, 0x02 };
 
 typedef struct slave
 {
 	struct slave *next;
 	struct slave *prev;
 	struct net_device *dev;
+
+	unsigned long tx_packets;	/* Sent through the bond */
+	unsigned long tx_bytes;
+
+	/* 802.3ad */
+	u8 actor_state;
+	int ntt;			/* Need to transmit a LACPDU */
+	unsigned long next_lacpdu;
+	struct lacp_info partner;	/* As last heard */
+	unsigned long partner_expires;	/* 0 when defaulted */
+	int partner_knows_us;		/* Its view of us is current */
 } slave_t;
 
 typedef struct bonding
@@ -52,17 +135,64 @@ typedef struct bonding
 
 	slave_t *current_slave;
 	struct net_device_stats stats;
+
+	int mode;
+	int xmit_hash_policy;
+
+	/* The slaves bond_xmit() hashes over, rebuilt under xmit_lock */
+	slave_t *xmit_slaves[BOND_MAX_SLAVES];
+	int xmit_count;
+	int slave_count;
+
+	/* 802.3ad: the partner of the one aggregator, if any */
+	int agg_valid;
+	u8 agg_system[ETH_ALEN];
+	u16 agg_key;
+	struct timer_list lacp_timer;
 } bonding_t;
 
+static int mode = BOND_MODE_ROUNDROBIN;
+static int xmit_hash_policy = BOND_XMIT_POLICY_LAYER2;
+static int lacp_rate;
+
+MODULE_PARM(mode, "i");
+MODULE_PARM_DESC(mode, "0 round robin, 1 hash, 2 802.3ad");
+MODULE_PARM(xmit_hash_policy, "i");
+MODULE_PARM_DESC(xmit_hash_policy, "0 MAC, 1 IP, 2 IP and ports");
+MODULE_PARM(lacp_rate, "i");
+MODULE_PARM_DESC(lacp_rate, "Ask the partner for LACPDUs every 0 30s, 1 1s");
 
 static int bond_xmit(struct sk_buff *skb, struct net_device *dev);
 static struct net_device_stats *bond_get_stats(struct net_device *dev);
 
 static struct net_device *this_bond;
 
+/* Caller holds master->xmit_lock */
+static void bond_update_xmit_slaves(bonding_t *bond)
+{
+	slave_t *slave;
+	int n = 0;
+
+	for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next) {
+		if (bond->mode == BOND_MODE_8023AD &&
+		    !(slave->actor_state & LACP_STATE_DISTRIBUTING))
+			continue;
+		bond->xmit_slaves[n++] = slave;
+	}
+	bond->xmit_count = n;
+}
+
+static void bond_lacp_timer(unsigned long data);
+
 static int bond_open(struct net_device *dev)
 {
+	bonding_t *bond = dev->priv;
+
 	MOD_INC_USE_COUNT;
+	if (bond->mode == BOND_MODE_8023AD) {
+		dev_mc_add(dev, slow_proto_addr, ETH_ALEN, 0);
+		mod_timer(&bond->lacp_timer, jiffies + LACP_TICK);
+	}
 	return 0;
 }
 
@@ -75,6 +205,11 @@ static void release_one_slave(struct net_device *master, slave_t *slave)
 		bond->current_slave = slave->next;
 	slave->next->prev = slave->prev;
 	slave->prev->next = slave->next;
+	bond->slave_count--;
+	bond_update_xmit_slaves(bond);
+	if (bond->agg_valid && bond->mode == BOND_MODE_8023AD &&
+	    bond->xmit_count == 0)
+		bond->agg_valid = 0;
 	spin_unlock_bh(&master->xmit_lock);
 
 	netdev_set_master(slave->dev, NULL);
@@ -89,6 +224,11 @@ static int bond_close(struct net_device *master)
 	bonding_t *bond = master->priv;
 	slave_t *slave;
 
+	if (bond->mode == BOND_MODE_8023AD) {
+		del_timer_sync(&bond->lacp_timer);
+		dev_mc_delete(master, slow_proto_addr, ETH_ALEN, 0);
+	}
+
 	while ((slave = bond->next) != (slave_t*)bond)
 		release_one_slave(master, slave);
 
@@ -118,10 +258,18 @@ static int bond_enslave(struct net_device *master, struct net_device *dev)
 	if (dev->type != master->type)
 		return -ENODEV;
 
+	if (bond->slave_count >= BOND_MAX_SLAVES)
+		return -ENOSPC;
+
 	if ((slave = kmalloc(sizeof(slave_t), GFP_KERNEL)) == NULL)
 		return -ENOMEM;
 
 	memset(slave, 0, sizeof(slave_t));
+	slave->actor_state = LACP_STATE_ACTIVITY | LACP_STATE_AGGREGATION |
+			     LACP_STATE_DEFAULTED;
+	if (lacp_rate)
+		slave->actor_state |= LACP_STATE_TIMEOUT;
+	slave->ntt = 1;
 
 	err = netdev_set_master(dev, master);
 	if (err) {
@@ -139,9 +287,15 @@ static int bond_enslave(struct net_device *master, struct net_device *dev)
 	slave->next = (slave_t*)bond;
 	slave->prev->next = slave;
 	slave->next->prev = slave;
+	bond->slave_count++;
+	bond_update_xmit_slaves(bond);
 
 	spin_unlock_bh(&master->xmit_lock);
 
+	/* The new slave has to hear the LACP group address */
+	if (bond->mode == BOND_MODE_8023AD)
+		dev_mc_upload(master);
+
 	MOD_INC_USE_COUNT;
 	return 0;
 }
@@ -191,6 +345,331 @@ static int bond_ioctl(struct net_device *master, struct ifreq *ifr, int cmd)
 	}
 }
 
+/*
+ * 802.3ad LACP.  Everything below runs under master->xmit_lock, the
+ * lock bond_xmit() is called with; from softirq context except for
+ * the slave list changes above.
+ */
+
+static void bond_lacp_actor(bonding_t *bond, slave_t *slave,
+			    struct lacp_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->system_priority = htons(LACP_SYSTEM_PRIORITY);
+	memcpy(info->system, bond->master->dev_addr, ETH_ALEN);
+	info->key = htons(bond->master->ifindex);
+	info->port_priority = htons(LACP_PORT_PRIORITY);
+	info->port = htons(slave->dev->ifindex);
+	info->state = slave->actor_state;
+}
+
+/* Slow protocol frames are all the same size as an LACPDU */
+static struct sk_buff *bond_slow_alloc(void)
+{
+	struct sk_buff *skb;
+
+	skb = dev_alloc_skb(ETH_HLEN + sizeof(struct lacpdu));
+	if (skb)
+		skb_reserve(skb, ETH_HLEN);
+	return skb;
+}
+
+static void bond_slow_xmit(slave_t *slave, struct sk_buff *skb)
+{
+	struct net_device *dev = slave->dev;
+	struct ethhdr *eth;
+
+	eth = (struct ethhdr *)skb_push(skb, ETH_HLEN);
+	memcpy(eth->h_dest, slow_proto_addr, ETH_ALEN);
+	memcpy(eth->h_source, dev->dev_addr, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_SLOW);
+
+	skb->mac.raw = skb->data;
+	skb->nh.raw = skb->data + ETH_HLEN;
+	skb->protocol = htons(ETH_P_SLOW);
+	skb->priority = TC_PRIO_CONTROL;
+	skb->dev = dev;
+	dev_queue_xmit(skb);
+}
+
+static void bond_lacp_send(bonding_t *bond, slave_t *slave)
+{
+	struct sk_buff *skb;
+	struct lacpdu *pdu;
+
+	if ((skb = bond_slow_alloc()) == NULL)
+		return;
+
+	pdu = (struct lacpdu *)skb_put(skb, sizeof(*pdu));
+	memset(pdu, 0, sizeof(*pdu));
+	pdu->subtype = SLOW_SUBTYPE_LACP;
+	pdu->version = 1;
+	pdu->actor_tlv = 1;
+	pdu->actor_len = 20;
+	bond_lacp_actor(bond, slave, &pdu->actor);
+	pdu->partner_tlv = 2;
+	pdu->partner_len = 20;
+	if (slave->partner_expires)
+		pdu->partner = slave->partner;
+	pdu->collector_tlv = 3;
+	pdu->collector_len = 16;
+
+	bond_slow_xmit(slave, skb);
+}
+
+static int bond_lacp_matches(bonding_t *bond, slave_t *slave)
+{
+	return slave->partner_expires &&
+	       (slave->partner.state & LACP_STATE_AGGREGATION) &&
+	       slave->partner.key == bond->agg_key &&
+	       memcmp(slave->partner.system, bond->agg_system, ETH_ALEN) == 0;
+}
+
+/*
+ * Selection and mux: the slaves whose partner is the aggregator's are
+ * in sync, and collect and distribute once the partner says the same.
+ * A slave whose state changed tells its partner at the next tick.
+ */
+static void bond_lacp_update(bonding_t *bond)
+{
+	slave_t *slave;
+	int changed = 0;
+
+	if (bond->agg_valid) {
+		bond->agg_valid = 0;
+		for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next)
+			if (bond_lacp_matches(bond, slave)) {
+				bond->agg_valid = 1;
+				break;
+			}
+	}
+	if (!bond->agg_valid) {
+		for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next)
+			if (slave->partner_expires &&
+			    (slave->partner.state & LACP_STATE_AGGREGATION)) {
+				memcpy(bond->agg_system, slave->partner.system,
+				       ETH_ALEN);
+				bond->agg_key = slave->partner.key;
+				bond->agg_valid = 1;
+				break;
+			}
+	}
+
+	for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next) {
+		u8 state = slave->actor_state &
+			~(LACP_STATE_SYNC | LACP_STATE_COLLECTING |
+			  LACP_STATE_DISTRIBUTING | LACP_STATE_DEFAULTED);
+
+		if (!slave->partner_expires)
+			state |= LACP_STATE_DEFAULTED;
+		else if (bond->agg_valid && bond_lacp_matches(bond, slave)) {
+			state |= LACP_STATE_SYNC;
+			if ((slave->partner.state & LACP_STATE_SYNC) &&
+			    slave->partner_knows_us)
+				state |= LACP_STATE_COLLECTING |
+					 LACP_STATE_DISTRIBUTING;
+		}
+
+		if (state != slave->actor_state) {
+			if ((state ^ slave->actor_state) & LACP_STATE_DISTRIBUTING)
+				changed = 1;
+			slave->actor_state = state;
+			slave->ntt = 1;
+		}
+	}
+
+	if (changed)
+		bond_update_xmit_slaves(bond);
+}
+
+static void bond_lacp_rcv(bonding_t *bond, slave_t *slave, struct lacpdu *pdu)
+{
+	struct lacp_info actor;
+	int same;
+
+	if (pdu->actor_tlv != 1 || pdu->partner_tlv != 2)
+		return;
+
+	slave->partner = pdu->actor;
+	slave->partner_expires = jiffies + 3 *
+		(pdu->actor.state & LACP_STATE_TIMEOUT ?
+		 LACP_FAST_PERIOD : LACP_SLOW_PERIOD);
+
+	bond_lacp_actor(bond, slave, &actor);
+	same = pdu->partner.port == actor.port &&
+	       pdu->partner.port_priority == actor.port_priority &&
+	       pdu->partner.system_priority == actor.system_priority &&
+	       pdu->partner.key == actor.key &&
+	       memcmp(pdu->partner.system, actor.system, ETH_ALEN) == 0;
+	slave->partner_knows_us = same &&
+		!((pdu->partner.state ^ actor.state) & LACP_STATE_AGGREGATION);
+	if (!same || ((pdu->partner.state ^ actor.state) &
+		      (LACP_STATE_ACTIVITY | LACP_STATE_TIMEOUT |
+		       LACP_STATE_AGGREGATION | LACP_STATE_SYNC)))
+		slave->ntt = 1;
+
+	bond_lacp_update(bond);
+}
+
+/* Answer a marker with the same PDU turned into a marker response */
+static void bond_marker_rcv(slave_t *slave, struct sk_buff *skb)
+{
+	struct sk_buff *nskb;
+	u8 *marker;
+
+	if ((nskb = bond_slow_alloc()) == NULL)
+		return;
+
+	marker = skb_put(nskb, sizeof(struct lacpdu));
+	if (skb_copy_bits(skb, 0, marker, sizeof(struct lacpdu)) ||
+	    marker[2] != MARKER_TLV_INFO) {
+		kfree_skb(nskb);
+		return;
+	}
+	marker[2] = MARKER_TLV_RESPONSE;
+
+	bond_slow_xmit(slave, nskb);
+}
+
+static int bond_slow_rcv(struct sk_buff *skb, struct net_device *master,
+			 struct packet_type *pt)
+{
+	bonding_t *bond = master->priv;
+	struct lacpdu pdu;
+	slave_t *slave;
+	u8 subtype;
+
+	if (skb->real_dev == NULL || skb_copy_bits(skb, 0, &subtype, 1))
+		goto out;
+
+	spin_lock(&master->xmit_lock);
+	for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next)
+		if (slave->dev == skb->real_dev)
+			break;
+	if (slave != (slave_t*)bond) {
+		if (subtype == SLOW_SUBTYPE_LACP) {
+			if (!skb_copy_bits(skb, 0, &pdu, sizeof(pdu)))
+				bond_lacp_rcv(bond, slave, &pdu);
+		} else if (subtype == SLOW_SUBTYPE_MARKER)
+			bond_marker_rcv(slave, skb);
+	}
+	spin_unlock(&master->xmit_lock);
+out:
+	kfree_skb(skb);
+	return 0;
+}
+
+static struct packet_type bond_slow_packet_type = {
+	__constant_htons(ETH_P_SLOW),
+	NULL,		/* Set to the bond device */
+	bond_slow_rcv,
+	(void*)1,
+	NULL
+};
+
+static void bond_lacp_timer(unsigned long data)
+{
+	bonding_t *bond = (bonding_t *)data;
+	struct net_device *master = bond->master;
+	slave_t *slave;
+
+	spin_lock(&master->xmit_lock);
+
+	for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next) {
+		if (!netif_running(slave->dev) ||
+		    !netif_carrier_ok(slave->dev) ||
+		    (slave->partner_expires &&
+		     time_after(jiffies, slave->partner_expires))) {
+			slave->partner_expires = 0;
+			slave->partner_knows_us = 0;
+		}
+	}
+
+	bond_lacp_update(bond);
+
+	for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next) {
+		if (!netif_running(slave->dev) || !netif_carrier_ok(slave->dev))
+			continue;
+		if (!slave->ntt && time_before(jiffies, slave->next_lacpdu))
+			continue;
+
+		bond_lacp_send(bond, slave);
+		slave->ntt = 0;
+		/* As often as the partner wants to hear from us */
+		slave->next_lacpdu = jiffies +
+			(!slave->partner_expires ||
+			 (slave->partner.state & LACP_STATE_TIMEOUT) ?
+			 LACP_FAST_PERIOD : LACP_SLOW_PERIOD);
+	}
+
+	spin_unlock(&master->xmit_lock);
+
+	if (netif_running(master))
+		mod_timer(&bond->lacp_timer, jiffies + LACP_TICK);
+}
+
+static int bond_get_info(char *buffer, char **start, off_t offset, int length)
+{
+	static const char *modes[] = { "round-robin", "hash", "802.3ad" };
+	static const char *policies[] = { "layer2", "layer3", "layer3+4" };
+	bonding_t *bond;
+	slave_t *slave;
+	int len;
+
+	if (this_bond == NULL)
+		return 0;
+	bond = this_bond->priv;
+
+	len = sprintf(buffer, "%s: mode %s, hash policy %s\n", this_bond->name,
+		      modes[bond->mode], policies[bond->xmit_hash_policy]);
+
+	spin_lock_bh(&this_bond->xmit_lock);
+	if (bond->mode == BOND_MODE_8023AD) {
+		if (bond->agg_valid)
+			len += sprintf(buffer + len, "aggregator partner "
+				       "%02x:%02x:%02x:%02x:%02x:%02x key %u\n",
+				       bond->agg_system[0], bond->agg_system[1],
+				       bond->agg_system[2], bond->agg_system[3],
+				       bond->agg_system[4], bond->agg_system[5],
+				       ntohs(bond->agg_key));
+		else
+			len += sprintf(buffer + len, "no aggregator\n");
+	}
+	len += sprintf(buffer + len, "Slave    Link  TxPackets    TxBytes  "
+		       "RxPackets    RxBytes%s\n",
+		       bond->mode == BOND_MODE_8023AD ? " Actor Partner" : "");
+	for (slave = bond->next; slave != (slave_t*)bond; slave = slave->next) {
+		struct net_device *dev = slave->dev;
+		struct net_device_stats *stats = NULL;
+
+		/* Received packets are counted by the slave only */
+		if (dev->get_stats)
+			stats = dev->get_stats(dev);
+		len += sprintf(buffer + len, "%-8s %-4s %10lu %10lu %10lu %10lu",
+			       dev->name,
+			       netif_running(dev) && netif_carrier_ok(dev) ?
+			       "up" : "down",
+			       slave->tx_packets, slave->tx_bytes,
+			       stats ? stats->rx_packets : 0,
+			       stats ? stats->rx_bytes : 0);
+		if (bond->mode == BOND_MODE_8023AD)
+			len += sprintf(buffer + len, "    %02x      %02x",
+				       slave->actor_state,
+				       slave->partner_expires ?
+				       slave->partner.state : 0);
+		len += sprintf(buffer + len, "\n");
+	}
+	spin_unlock_bh(&this_bond->xmit_lock);
+
+	if (offset >= len)
+		return 0;
+	*start = buffer + offset;
+	len -= offset;
+	if (len > length)
+		len = length;
+	return len;
+}
+
 static int bond_event(struct notifier_block *this, unsigned long event, void *ptr)
 {
 	struct net_device *slave = ptr;
@@ -230,6 +709,24 @@ static int __init bond_init(struct net_device *dev)
 	bond->current_slave = (slave_t*)bond;
 	dev->priv = bond;
 
+	if (mode < BOND_MODE_ROUNDROBIN || mode > BOND_MODE_8023AD) {
+		printk(KERN_WARNING "bonding: unknown mode %d, using round robin\n",
+		       mode);
+		mode = BOND_MODE_ROUNDROBIN;
+	}
+	if (xmit_hash_policy < BOND_XMIT_POLICY_LAYER2 ||
+	    xmit_hash_policy > BOND_XMIT_POLICY_LAYER34) {
+		printk(KERN_WARNING "bonding: unknown xmit_hash_policy %d, "
+		       "using layer2\n", xmit_hash_policy);
+		xmit_hash_policy = BOND_XMIT_POLICY_LAYER2;
+	}
+	bond->mode = mode;
+	bond->xmit_hash_policy = xmit_hash_policy;
+
+	init_timer(&bond->lacp_timer);
+	bond->lacp_timer.function = bond_lacp_timer;
+	bond->lacp_timer.data = (unsigned long)bond;
+
 	/* Initialize the device structure. */
 	dev->hard_start_xmit = bond_xmit;
 	dev->get_stats	= bond_get_stats;
@@ -248,6 +745,72 @@ static int __init bond_init(struct net_device *dev)
 
 	register_netdevice_notifier(&bond_netdev_notifier);
 
+	if (bond->mode == BOND_MODE_8023AD) {
+		bond_slow_packet_type.dev = dev;
+		dev_add_pack(&bond_slow_packet_type);
+	}
+	proc_net_create("bonding", 0, bond_get_info);
+
+	return 0;
+}
+
+/* A hash of the addresses, and ports, of the packet */
+static u32 bond_xmit_hash(bonding_t *bond, struct sk_buff *skb)
+{
+	struct ethhdr *eth = (struct ethhdr *)skb->data;
+	struct iphdr *iph;
+	u32 ports = 0;
+
+	if (bond->xmit_hash_policy == BOND_XMIT_POLICY_LAYER2 ||
+	    eth->h_proto != htons(ETH_P_IP) ||
+	    skb_headlen(skb) < ETH_HLEN + sizeof(struct iphdr))
+		return eth->h_dest[5] ^ eth->h_source[5];
+
+	iph = (struct iphdr *)(skb->data + ETH_HLEN);
+	if (bond->xmit_hash_policy == BOND_XMIT_POLICY_LAYER34 &&
+	    !(iph->frag_off & htons(IP_MF|IP_OFFSET)) &&
+	    (iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP) &&
+	    skb_headlen(skb) >= ETH_HLEN + iph->ihl*4 + 4)
+		memcpy(&ports, skb->data + ETH_HLEN + iph->ihl*4, 4);
+
+	return jhash_3words(iph->saddr, iph->daddr, ports, 0);
+}
+
+/* The hash picks the slave, so a flow stays on one link and in order.
+   Only if that link is down does the next one take over. */
+static int bond_xmit_hashed(struct sk_buff *skb, struct net_device *dev)
+{
+	bonding_t *bond = dev->priv;
+	int pkt_len = skb->len;
+	int count = bond->xmit_count;
+	int i, n;
+
+	if (count) {
+		i = bond_xmit_hash(bond, skb) % count;
+		for (n = 0; n < count; n++) {
+			slave_t *slave = bond->xmit_slaves[i];
+
+			if (++i == count)
+				i = 0;
+			if (!netif_running(slave->dev) ||
+			    !netif_carrier_ok(slave->dev))
+				continue;
+
+			skb->dev = slave->dev;
+			if (dev_queue_xmit(skb)) {
+				bond->stats.tx_dropped++;
+			} else {
+				bond->stats.tx_packets++;
+				bond->stats.tx_bytes += pkt_len;
+				slave->tx_packets++;
+				slave->tx_bytes += pkt_len;
+			}
+			return 0;
+		}
+	}
+
+	bond->stats.tx_dropped++;
+	kfree_skb(skb);
 	return 0;
 }
 
@@ -257,6 +820,9 @@ static int bond_xmit(struct sk_buff *skb, struct net_device *dev)
 	slave_t *slave, *start_at;
 	int pkt_len = skb->len;
 
+	if (bond->mode != BOND_MODE_ROUNDROBIN)
+		return bond_xmit_hashed(skb, dev);
+
 	slave = start_at = bond->current_slave;
 
 	do {
@@ -272,6 +838,8 @@ static int bond_xmit(struct sk_buff *skb, struct net_device *dev)
 			} else {
 				bond->stats.tx_packets++;
 				bond->stats.tx_bytes += pkt_len;
+				slave->tx_packets++;
+				slave->tx_bytes += pkt_len;
 			}
 			return 0;
 		}
@@ -311,6 +879,9 @@ static int __init bonding_init(void)
 
 static void __exit bonding_exit(void)
 {
+	proc_net_remove("bonding");
+	if (bond_slow_packet_type.dev)
+		dev_remove_pack(&bond_slow_packet_type);
 	unregister_netdevice_notifier(&bond_netdev_notifier);
 
 	unregister_netdev(&dev_bond);
@@ -42,11 +42,14 @@ static int txdmacount = 128;
 static int rxdmacount /* = 0 */;
 
 /* Set the copy breakpoint for the copy-only-tiny-buffer Rx method.
-   Lower values use more memory, but are faster. */
+   Lower values use more memory, but are faster.  Where allocation is
+   what holds us back, under a burst, copying is switched off. */
 #if defined(__alpha__) || defined(__sparc__)
 static int rx_copybreak = 1518;
+#define RX_COPY_ADAPTIVE 0		/* Copy to align the IP header. */
 #else
 static int rx_copybreak = 200;
+#define RX_COPY_ADAPTIVE 1
 #endif
 
 /* Maximum events (Rx packets, etc.) to handle at each interrupt. */
@@ -65,6 +68,8 @@ static int debug = -1;			/* The debug level */
 /* The ring sizes should be a power of two for efficiency. */
 #define TX_RING_SIZE	32
 #define RX_RING_SIZE	32
+/* Received buffers are put back in the ring in groups of this many. */
+#define RX_REFILL_BATCH	8
 /* How much slots multicast filter setup may take.
    Do not descrease without changing set_rx_mode() implementaion. */
 #define TX_MULTICAST_SIZE   2
@@ -113,6 +118,9 @@ static int debug = -1;			/* The debug level */
 #include <linux/etherdevice.h>
 #include <linux/skbuff.h>
 #include <linux/delay.h>
+#include <linux/prefetch.h>
+#include <linux/ethtool.h>
+#include <asm/uaccess.h>
 
 MODULE_AUTHOR("Maintainer: Andrey V. Savochkin <saw@saw.sw.com.sg>");
 MODULE_DESCRIPTION("Intel i82557/i82558/i82559 PCI EtherExpressPro driver");
@@ -441,6 +449,13 @@ enum Rx_ring_state_bits {
 	RrNoMem=1, RrPostponed=2, RrNoResources=4, RrOOMReported=8,
 };
 
+/* The interrupt sources left enabled in normal operation, and while the
+   receiver is being polled.  The per-source mask bits are only present
+   on the i82558 and later; the i82557 ignores them and keeps raising Rx
+   interrupts, which the handler then simply acknowledges. */
+#define SCBMaskNormal	(SCBMaskEarlyRx | SCBMaskFlowCtl)
+#define SCBMaskPoll		(SCBMaskNormal | SCBMaskRxDone | SCBMaskRxSuspend)
+
 /* Do not change the position (alignment) of the first few elements!
    The later elements are grouped for cache locality.
 
@@ -463,6 +478,8 @@ struct speedo_private {
 	struct RxFD *last_rxf;				/* Last filled RX buffer. */
 	dma_addr_t last_rxf_dma;
 	unsigned int cur_rx, dirty_rx;		/* The next free ring entry */
+	struct skb_recycle_pool *rx_pool;	/* Freed Rx buffers, for refills. */
+	int rx_copy_off;					/* Ignore rx_copybreak for now. */
 	long last_rx_time;			/* Last Rx, in jiffies, to handle Rx hang. */
 	const char *product_name;
 	struct net_device_stats stats;
@@ -485,6 +502,8 @@ struct speedo_private {
 	unsigned short phy[2];				/* PHY media interfaces available. */
 	unsigned short advertising;			/* Current PHY advertised caps. */
 	unsigned short partner;				/* Link partner caps. */
+	unsigned long irq_count;			/* Interrupts handled, */
+	unsigned long rx_frames, tx_frames;	/* ... and work done for them. */
 };
 
 /* The parameters for a CmdConfigure operation.
@@ -529,8 +548,9 @@ static void speedo_timer(unsigned long data);
 static void speedo_init_rx_ring(struct net_device *dev);
 static void speedo_tx_timeout(struct net_device *dev);
 static int speedo_start_xmit(struct sk_buff *skb, struct net_device *dev);
-static void speedo_refill_rx_buffers(struct net_device *dev, int force);
-static int speedo_rx(struct net_device *dev);
+static int speedo_refill_rx_buffers(struct net_device *dev, int force);
+static int speedo_rx(struct net_device *dev, int limit);
+static int speedo_poll(struct net_device *dev, int *budget);
 static void speedo_tx_buffer_gc(struct net_device *dev);
 static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs);
 static int speedo_close(struct net_device *dev);
@@ -826,6 +846,8 @@ static int speedo_found1(struct pci_dev *pdev,
 	dev->get_stats = &speedo_get_stats;
 	dev->set_multicast_list = &set_rx_mode;
 	dev->do_ioctl = &speedo_ioctl;
+	dev->poll = &speedo_poll;
+	dev->weight = 16;
 
 	return 0;
 }
@@ -950,6 +972,10 @@ speedo_open(struct net_device *dev)
 	}
 #endif
 
+	/* Buffers handed up the stack come back here when freed.  Without
+	   the pool we just allocate them afresh. */
+	sp->rx_pool = skb_recycle_pool_create(dev->name,
+					      PKT_BUF_SZ + sizeof(struct RxFD), RX_RING_SIZE);
 	speedo_init_rx_ring(dev);
 
 	/* Fire up the hardware. */
@@ -1049,7 +1075,7 @@ static void speedo_resume(struct net_device *dev)
 		 ioaddr + SCBPointer);
 	/* We are not ACK-ing FCP and ER in the interrupt handler yet so they should
 	   remain masked --Dragan */
-	outw(CUStart | SCBMaskEarlyRx | SCBMaskFlowCtl, ioaddr + SCBCmd);
+	outw(CUStart | SCBMaskNormal, ioaddr + SCBCmd);
 }
 
 /* Media monitoring and control. */
@@ -1164,7 +1190,7 @@ speedo_init_rx_ring(struct net_device *dev)
 
 	for (i = 0; i < RX_RING_SIZE; i++) {
 		struct sk_buff *skb;
-		skb = dev_alloc_skb(PKT_BUF_SZ + sizeof(struct RxFD));
+		skb = dev_alloc_skb_recycle(sp->rx_pool, PKT_BUF_SZ + sizeof(struct RxFD));
 		sp->rx_skbuff[i] = skb;
 		if (skb == NULL)
 			break;			/* OK.  Just initially short of Rx bufs. */
@@ -1401,6 +1427,7 @@ static void speedo_tx_buffer_gc(struct net_device *dev)
 		/* Free the original skb. */
 		if (sp->tx_skbuff[entry]) {
 			sp->stats.tx_packets++;	/* Count only user packets. */
+			sp->tx_frames++;
 			sp->stats.tx_bytes += sp->tx_skbuff[entry]->len;
 			pci_unmap_single(sp->pdev,
 					le32_to_cpu(sp->tx_ring[entry].tx_buf_addr0),
@@ -1435,8 +1462,8 @@ static void speedo_tx_buffer_gc(struct net_device *dev)
 	sp->dirty_tx = dirty_tx;
 }
 
-/* The interrupt handler does all of the Rx thread work and cleans up
-   after the Tx thread. */
+/* The interrupt handler cleans up after the Tx thread and hands the Rx
+   thread work to speedo_poll(). */
 static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 {
 	struct net_device *dev = (struct net_device *)dev_instance;
@@ -1464,6 +1491,8 @@ static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 	}
 #endif
 
+	sp->irq_count++;
+
 	do {
 		status = inw(ioaddr + SCBStatus);
 		/* Acknowledge all of the current interrupt sources ASAP. */
@@ -1478,77 +1507,16 @@ static void speedo_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 		if ((status & 0xfc00) == 0)
 			break;
 
-		/* Always check if all rx buffers are allocated.  --SAW */
-		speedo_refill_rx_buffers(dev, 0);
-
+		/* The receive ring belongs to speedo_poll(): mask further Rx
+		   interrupts and leave the packets to it. */
 		if ((status & 0x5000) ||	/* Packet received, or Rx error. */
-			(sp->rx_ring_state&(RrNoMem|RrPostponed)) == RrPostponed)
+			(sp->rx_ring_state&(RrNoMem|RrPostponed)) == RrPostponed ||
 									/* Need to gather the postponed packet. */
-			speedo_rx(dev);
-
-		if (status & 0x1000) {
-			spin_lock(&sp->lock);
-			if ((status & 0x003c) == 0x0028) {		/* No more Rx buffers. */
-				struct RxFD *rxf;
-				printk(KERN_WARNING "%s: card reports no RX buffers.\n",
-						dev->name);
-				rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
-				if (rxf == NULL) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: NULL cur_rx in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else if (rxf == sp->last_rxf) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: cur_rx is last in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else
-					outb(RxResumeNoResources, ioaddr + SCBCmd);
-			} else if ((status & 0x003c) == 0x0008) { /* No resources. */
-				struct RxFD *rxf;
-				printk(KERN_WARNING "%s: card reports no resources.\n",
-						dev->name);
-				rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
-				if (rxf == NULL) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: NULL cur_rx in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else if (rxf == sp->last_rxf) {
-					if (speedo_debug > 2)
-						printk(KERN_DEBUG
-								"%s: cur_rx is last in speedo_interrupt().\n",
-								dev->name);
-					sp->rx_ring_state |= RrNoMem|RrNoResources;
-				} else {
-					/* Restart the receiver. */
-					outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
-						 ioaddr + SCBPointer);
-					outb(RxStart, ioaddr + SCBCmd);
-				}
+			(sp->rx_ring_state&(RrNoMem|RrNoResources)) == RrNoResources) {
+			if (netif_rx_schedule_prep(dev)) {
+				outb(SCBMaskPoll >> 8, ioaddr + SCBCmd + 1);
+				__netif_rx_schedule(dev);
 			}
-			sp->stats.rx_errors++;
-			spin_unlock(&sp->lock);
-		}
-
-		if ((sp->rx_ring_state&(RrNoMem|RrNoResources)) == RrNoResources) {
-			printk(KERN_WARNING
-					"%s: restart the receiver after a possible hang.\n",
-					dev->name);
-			spin_lock(&sp->lock);
-			/* Restart the receiver.
-			   I'm not sure if it's always right to restart the receiver
-			   here but I don't know another way to prevent receiver hangs.
-			   1999/12/25 SAW */
-			outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
-				 ioaddr + SCBPointer);
-			outb(RxStart, ioaddr + SCBCmd);
-			sp->rx_ring_state &= ~RrNoResources;
-			spin_unlock(&sp->lock);
 		}
 
 		/* User interrupt, Command/Tx unit interrupt or CU not active. */
@@ -1589,7 +1557,7 @@ static inline struct RxFD *speedo_rx_alloc(struct net_device *dev, int entry)
 	struct RxFD *rxf;
 	struct sk_buff *skb;
 	/* Get a fresh skbuff to replace the consumed one. */
-	skb = dev_alloc_skb(PKT_BUF_SZ + sizeof(struct RxFD));
+	skb = dev_alloc_skb_recycle(sp->rx_pool, PKT_BUF_SZ + sizeof(struct RxFD));
 	sp->rx_skbuff[entry] = skb;
 	if (skb == NULL) {
 		sp->rx_ringp[entry] = NULL;
@@ -1607,22 +1575,8 @@ static inline struct RxFD *speedo_rx_alloc(struct net_device *dev, int entry)
 	return rxf;
 }
 
-static inline void speedo_rx_link(struct net_device *dev, int entry,
-								  struct RxFD *rxf, dma_addr_t rxf_dma)
-{
-	struct speedo_private *sp = (struct speedo_private *)dev->priv;
-	rxf->status = cpu_to_le32(0xC0000001); 	/* '1' for driver use only. */
-	rxf->link = 0;			/* None yet. */
-	rxf->count = cpu_to_le32(PKT_BUF_SZ << 16);
-	sp->last_rxf->link = cpu_to_le32(rxf_dma);
-	sp->last_rxf->status &= cpu_to_le32(~0xC0000000);
-	pci_dma_sync_single(sp->pdev, sp->last_rxf_dma,
-			sizeof(struct RxFD), PCI_DMA_TODEVICE);
-	sp->last_rxf = rxf;
-	sp->last_rxf_dma = rxf_dma;
-}
-
-static int speedo_refill_rx_buf(struct net_device *dev, int force)
+/* Find a buffer for the dirty_rx entry, which is not linked in yet. */
+static struct RxFD *speedo_rx_get_buf(struct net_device *dev, int force)
 {
 	struct speedo_private *sp = (struct speedo_private *)dev->priv;
 	int entry;
@@ -1641,45 +1595,94 @@ static int speedo_refill_rx_buf(struct net_device *dev, int force)
 				sp->rx_ring_state |= RrOOMReported;
 			}
 			if (!force)
-				return -1;	/* Better luck next time!  */
+				return NULL;	/* Better luck next time!  */
 			/* Borrow an skb from one of next entries. */
 			for (forw = sp->dirty_rx + 1; forw != sp->cur_rx; forw++)
 				if (sp->rx_skbuff[forw % RX_RING_SIZE] != NULL)
 					break;
 			if (forw == sp->cur_rx)
-				return -1;
+				return NULL;
 			forw_entry = forw % RX_RING_SIZE;
 			sp->rx_skbuff[entry] = sp->rx_skbuff[forw_entry];
 			sp->rx_skbuff[forw_entry] = NULL;
 			rxf = sp->rx_ringp[forw_entry];
 			sp->rx_ringp[forw_entry] = NULL;
 			sp->rx_ringp[entry] = rxf;
+			sp->rx_ring_dma[entry] = sp->rx_ring_dma[forw_entry];
 		}
 	} else {
 		rxf = sp->rx_ringp[entry];
 	}
-	speedo_rx_link(dev, entry, rxf, sp->rx_ring_dma[entry]);
-	sp->dirty_rx++;
-	sp->rx_ring_state &= ~(RrNoMem|RrOOMReported); /* Mark the progress. */
-	return 0;
+	return rxf;
 }
 
-static void speedo_refill_rx_buffers(struct net_device *dev, int force)
+/* Refill the RX ring.  The new descriptors are chained to each other
+   first and then handed to the chip in one go, so the end-of-list bit
+   on the descriptor the receiver may be sitting on is cleared once per
+   batch rather than once per buffer.  Returns -1 if the ring could not
+   be filled up. */
+static int speedo_refill_rx_buffers(struct net_device *dev, int force)
 {
 	struct speedo_private *sp = (struct speedo_private *)dev->priv;
+	struct RxFD *rxf, *first = NULL, *prev = NULL;
+	dma_addr_t rxf_dma, first_dma = 0, prev_dma = 0;
+	int ret = 0;
 
-	/* Refill the RX ring. */
-	while ((int)(sp->cur_rx - sp->dirty_rx) > 0 &&
-			speedo_refill_rx_buf(dev, force) != -1);
+	while ((int)(sp->cur_rx - sp->dirty_rx) > 0) {
+		int entry = sp->dirty_rx % RX_RING_SIZE;
+
+		rxf = speedo_rx_get_buf(dev, force);
+		if (rxf == NULL) {
+			ret = -1;
+			break;
+		}
+		rxf_dma = sp->rx_ring_dma[entry];
+		rxf->status = cpu_to_le32(0xC0000001); 	/* '1' for driver use only. */
+		rxf->link = 0;			/* None yet. */
+		rxf->count = cpu_to_le32(PKT_BUF_SZ << 16);
+		if (prev != NULL) {
+			prev->link = cpu_to_le32(rxf_dma);
+			prev->status = cpu_to_le32(0x00000001);
+			pci_dma_sync_single(sp->pdev, prev_dma,
+					sizeof(struct RxFD), PCI_DMA_TODEVICE);
+		} else {
+			first = rxf;
+			first_dma = rxf_dma;
+		}
+		prev = rxf;
+		prev_dma = rxf_dma;
+		sp->dirty_rx++;
+	}
+
+	if (first == NULL)
+		return ret;
+
+	pci_dma_sync_single(sp->pdev, prev_dma,
+			sizeof(struct RxFD), PCI_DMA_TODEVICE);
+	sp->last_rxf->link = cpu_to_le32(first_dma);
+	sp->last_rxf->status &= cpu_to_le32(~0xC0000000);
+	pci_dma_sync_single(sp->pdev, sp->last_rxf_dma,
+			sizeof(struct RxFD), PCI_DMA_TODEVICE);
+	sp->last_rxf = prev;
+	sp->last_rxf_dma = prev_dma;
+	sp->rx_ring_state &= ~(RrNoMem|RrOOMReported); /* Mark the progress. */
+	return ret;
 }
 
+/* Pass up to limit received packets to the stack, returning how many
+   ring entries were consumed. */
 static int
-speedo_rx(struct net_device *dev)
+speedo_rx(struct net_device *dev, int limit)
 {
 	struct speedo_private *sp = (struct speedo_private *)dev->priv;
 	int entry = sp->cur_rx % RX_RING_SIZE;
 	int rx_work_limit = sp->dirty_rx + RX_RING_SIZE - sp->cur_rx;
+	int received = 0;
 	int alloc_ok = 1;
+	int copybreak = RX_COPY_ADAPTIVE && sp->rx_copy_off ? 0 : rx_copybreak;
+
+	if (rx_work_limit > limit)
+		rx_work_limit = limit;
 
 	if (speedo_debug > 4)
 		printk(KERN_DEBUG " In speedo_rx().\n");
@@ -1696,6 +1699,11 @@ speedo_rx(struct net_device *dev)
 		if (!(status & RxComplete))
 			break;
 
+		/* Start on the next descriptor and on this packet's header
+		   while the checks below run. */
+		prefetch(sp->rx_ringp[(entry + 1) % RX_RING_SIZE]);
+		prefetch(sp->rx_ringp[entry] + 1);
+
 		if (--rx_work_limit < 0)
 			break;
 
@@ -1730,7 +1738,7 @@ speedo_rx(struct net_device *dev)
 
 			/* Check if the packet is long enough to just accept without
 			   copying to a properly sized skbuff. */
-			if (pkt_len < rx_copybreak
+			if (pkt_len < copybreak
 				&& (skb = dev_alloc_skb(pkt_len + 2)) != 0) {
 				skb->dev = dev;
 				skb_reserve(skb, 2);	/* Align IP on 16 byte boundaries */
@@ -1747,6 +1755,10 @@ speedo_rx(struct net_device *dev)
 					   pkt_len);
 #endif
 			} else {
+				/* An allocation failure turns copying off until the
+				   ring has been drained, see speedo_poll(). */
+				if (pkt_len < copybreak)
+					sp->rx_copy_off = 1;
 				/* Pass up the already-filled skbuff. */
 				skb = sp->rx_skbuff[entry];
 				if (skb == NULL) {
@@ -1761,15 +1773,17 @@ speedo_rx(struct net_device *dev)
 						PKT_BUF_SZ + sizeof(struct RxFD), PCI_DMA_FROMDEVICE);
 			}
 			skb->protocol = eth_type_trans(skb, dev);
-			netif_rx(skb);
+			netif_receive_skb(skb);
 			sp->stats.rx_packets++;
 			sp->stats.rx_bytes += pkt_len;
 		}
 		entry = (++sp->cur_rx) % RX_RING_SIZE;
+		received++;
 		sp->rx_ring_state &= ~RrPostponed;
-		/* Refill the recently taken buffers.
-		   Do it one-by-one to handle traffic bursts better. */
-		if (alloc_ok && speedo_refill_rx_buf(dev, 0) == -1)
+		/* Refill the recently taken buffers as we go, so that a long
+		   burst does not run the chip dry, but a batch at a time. */
+		if (alloc_ok && (int)(sp->cur_rx - sp->dirty_rx) >= RX_REFILL_BATCH
+			&& speedo_refill_rx_buffers(dev, 0) == -1)
 			alloc_ok = 0;
 	}
 
@@ -1778,6 +1792,85 @@ speedo_rx(struct net_device *dev)
 
 	sp->last_rx_time = jiffies;
 
+	return received;
+}
+
+/* Called with the receive interrupts masked, from net_rx_action(), to
+   pass up at most the quota of packets.  Also restarts the receiver when
+   it ran out of buffers, which the interrupt handler used to do. */
+static int speedo_poll(struct net_device *dev, int *budget)
+{
+	struct speedo_private *sp = (struct speedo_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	int limit = *budget < dev->quota ? *budget : dev->quota;
+	int received;
+	unsigned short status;
+	unsigned long flags;
+	struct RxFD *rxf;
+
+	/* Always check if all rx buffers are allocated.  --SAW */
+	speedo_refill_rx_buffers(dev, 0);
+
+	received = speedo_rx(dev, limit);
+	sp->rx_frames += received;
+	dev->quota -= received;
+	*budget -= received;
+	if (received >= limit) {
+		/* Packets arrive faster than we pass them up; an allocation
+		   and a copy per packet is the last thing we need now, and
+		   the ring buffers come back through the recycling pool. */
+		sp->rx_copy_off = 1;
+		return 1;	/* Not done, stay on the poll list. */
+	}
+	sp->rx_copy_off = 0;
+
+	spin_lock_irqsave(&sp->lock, flags);
+	status = inw(ioaddr + SCBStatus);
+	if ((status & 0x003c) == 0x0028 ||		/* No more Rx buffers. */
+		(status & 0x003c) == 0x0008) {		/* No resources. */
+		printk(KERN_WARNING "%s: card reports no %s.\n", dev->name,
+			   (status & 0x003c) == 0x0028 ? "RX buffers" : "resources");
+		rxf = sp->rx_ringp[sp->cur_rx % RX_RING_SIZE];
+		if (rxf == NULL) {
+			if (speedo_debug > 2)
+				printk(KERN_DEBUG "%s: NULL cur_rx in speedo_poll().\n",
+					   dev->name);
+			sp->rx_ring_state |= RrNoMem|RrNoResources;
+		} else if (rxf == sp->last_rxf) {
+			if (speedo_debug > 2)
+				printk(KERN_DEBUG "%s: cur_rx is last in speedo_poll().\n",
+					   dev->name);
+			sp->rx_ring_state |= RrNoMem|RrNoResources;
+		} else if ((status & 0x003c) == 0x0028)
+			outb(RxResumeNoResources, ioaddr + SCBCmd);
+		else {
+			/* Restart the receiver. */
+			outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
+				 ioaddr + SCBPointer);
+			outb(RxStart, ioaddr + SCBCmd);
+		}
+		sp->stats.rx_errors++;
+	}
+
+	if ((sp->rx_ring_state&(RrNoMem|RrNoResources)) == RrNoResources) {
+		printk(KERN_WARNING
+				"%s: restart the receiver after a possible hang.\n",
+				dev->name);
+		/* Restart the receiver.
+		   I'm not sure if it's always right to restart the receiver
+		   here but I don't know another way to prevent receiver hangs.
+		   1999/12/25 SAW */
+		outl(sp->rx_ring_dma[sp->cur_rx % RX_RING_SIZE],
+			 ioaddr + SCBPointer);
+		outb(RxStart, ioaddr + SCBCmd);
+		sp->rx_ring_state &= ~RrNoResources;
+	}
+	spin_unlock_irqrestore(&sp->lock, flags);
+
+	/* A packet that arrived meanwhile has its status bit set already and
+	   raises the interrupt again as soon as it is unmasked. */
+	netif_rx_complete(dev);
+	outb(SCBMaskNormal >> 8, ioaddr + SCBCmd + 1);
 	return 0;
 }
 
@@ -1819,6 +1912,10 @@ speedo_close(struct net_device *dev)
 			dev_kfree_skb(skb);
 		}
 	}
+	if (sp->rx_pool) {
+		skb_recycle_pool_destroy(sp->rx_pool);
+		sp->rx_pool = NULL;
+	}
 
 	for (i = 0; i < TX_RING_SIZE; i++) {
 		struct sk_buff *skb = sp->tx_skbuff[i];
@@ -1891,6 +1988,41 @@ speedo_get_stats(struct net_device *dev)
 	return &sp->stats;
 }
 
+/* The chip has no interrupt mitigation short of the i82558 microcode,
+   which this driver does not load, and the rings are sized at compile
+   time; so only the counters and the ring sizes can be read. */
+static int speedo_ethtool_ioctl(struct net_device *dev, void *useraddr)
+{
+	struct speedo_private *sp = (struct speedo_private *)dev->priv;
+	struct ethtool_coalesce ecoal;
+	struct ethtool_ringparam ering;
+	u32 ethcmd;
+
+	if (copy_from_user(&ethcmd, useraddr, sizeof(ethcmd)))
+		return -EFAULT;
+
+	switch (ethcmd) {
+	case ETHTOOL_GCOALESCE:
+		memset(&ecoal, 0, sizeof(ecoal));
+		ecoal.cmd = ethcmd;
+		ecoal.interrupts = sp->irq_count;
+		ecoal.rx_frames = sp->rx_frames;
+		ecoal.tx_frames = sp->tx_frames;
+		if (copy_to_user(useraddr, &ecoal, sizeof(ecoal)))
+			return -EFAULT;
+		return 0;
+	case ETHTOOL_GRINGPARAM:
+		memset(&ering, 0, sizeof(ering));
+		ering.cmd = ethcmd;
+		ering.rx_max_pending = ering.rx_pending = RX_RING_SIZE;
+		ering.tx_max_pending = ering.tx_pending = TX_QUEUE_LIMIT;
+		if (copy_to_user(useraddr, &ering, sizeof(ering)))
+			return -EFAULT;
+		return 0;
+	}
+	return -EOPNOTSUPP;
+}
+
 static int speedo_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 {
 	struct speedo_private *sp = (struct speedo_private *)dev->priv;
@@ -1925,6 +2057,8 @@ static int speedo_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 			add_timer(&sp->timer); /* may be set to the past  --SAW */
 		pci_set_power_state(sp->pdev, saved_acpi);
 		return 0;
+	case SIOCETHTOOL:
+		return speedo_ethtool_ioctl(dev, rq->ifr_data);
 	default:
 		return -EOPNOTSUPP;
 	}
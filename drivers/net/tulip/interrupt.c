@@ -16,9 +16,11 @@
 #include "tulip.h"
 #include <linux/etherdevice.h>
 #include <linux/pci.h>
+#include <linux/prefetch.h>
 
 
 int tulip_rx_copybreak;
+int tulip_rx_copy_adaptive;
 unsigned int tulip_max_interrupt_work;
 
 
@@ -36,7 +38,8 @@ static int tulip_refill_rx(struct net_device *dev)
 			struct sk_buff *skb;
 			dma_addr_t mapping;
 
-			skb = tp->rx_buffers[entry].skb = dev_alloc_skb(PKT_BUF_SZ);
+			skb = tp->rx_buffers[entry].skb =
+				dev_alloc_skb_recycle(tp->rx_pool, PKT_BUF_SZ);
 			if (skb == NULL)
 				break;
 
@@ -54,12 +57,17 @@ static int tulip_refill_rx(struct net_device *dev)
 }
 
 
-static int tulip_rx(struct net_device *dev)
+static int tulip_rx(struct net_device *dev, int limit)
 {
 	struct tulip_private *tp = (struct tulip_private *)dev->priv;
 	int entry = tp->cur_rx % RX_RING_SIZE;
 	int rx_work_limit = tp->dirty_rx + RX_RING_SIZE - tp->cur_rx;
 	int received = 0;
+	int copybreak = tulip_rx_copy_adaptive && tp->rx_copy_off ?
+		0 : tulip_rx_copybreak;
+
+	if (rx_work_limit > limit)
+		rx_work_limit = limit;
 
 	if (tulip_debug > 4)
 		printk(KERN_DEBUG " In tulip_rx(), entry %d %8.8x.\n", entry,
@@ -73,6 +81,13 @@ static int tulip_rx(struct net_device *dev)
 				   dev->name, entry, status);
 		if (--rx_work_limit < 0)
 			break;
+
+		/* Start on the next descriptor and on this packet's header
+		   while the checks below run. */
+		prefetch(&tp->rx_ring[(entry + 1) % RX_RING_SIZE]);
+		if (tp->rx_buffers[entry].skb)
+			prefetch(tp->rx_buffers[entry].skb->tail);
+
 		if ((status & 0x38008300) != 0x0300) {
 			if ((status & 0x38000300) != 0x0300) {
 				/* Ingore earlier buffers. */
@@ -109,7 +124,7 @@ static int tulip_rx(struct net_device *dev)
 #endif
 			/* Check if the packet is long enough to accept without copying
 			   to a minimally-sized skbuff. */
-			if (pkt_len < tulip_rx_copybreak
+			if (pkt_len < copybreak
 				&& (skb = dev_alloc_skb(pkt_len + 2)) != NULL) {
 				skb->dev = dev;
 				skb_reserve(skb, 2);	/* 16 byte align the IP header */
@@ -126,7 +141,13 @@ static int tulip_rx(struct net_device *dev)
 				       pkt_len);
 #endif
 			} else { 	/* Pass up the skb already on the Rx ring. */
-				char *temp = skb_put(skb = tp->rx_buffers[entry].skb,
+				char *temp;
+
+				/* An allocation failure turns copying off until
+				   the ring has been drained, see tulip_poll(). */
+				if (pkt_len < copybreak)
+					tp->rx_copy_off = 1;
+				temp = skb_put(skb = tp->rx_buffers[entry].skb,
 						     pkt_len);
 
 #ifndef final_version
@@ -148,7 +169,7 @@ static int tulip_rx(struct net_device *dev)
 				tp->rx_buffers[entry].mapping = 0;
 			}
 			skb->protocol = eth_type_trans(skb, dev);
-			netif_rx(skb);
+			netif_receive_skb(skb);
 			dev->last_rx = jiffies;
 			tp->stats.rx_packets++;
 			tp->stats.rx_bytes += pkt_len;
@@ -161,20 +182,84 @@ static int tulip_rx(struct net_device *dev)
 }
 
 
-/* The interrupt handler does all of the Rx thread work and cleans up
-   after the Tx thread. */
+/*
+ * Receive is polled from the NET_RX softirq: the interrupt handler
+ * masks the receive interrupts and schedules tulip_poll(), which
+ * passes up at most the quota it is given and unmasks them again once
+ * the ring is empty.  If the ring could not be refilled for lack of
+ * memory, the timer interrupt is used to retry later instead.
+ */
+int tulip_poll(struct net_device *dev, int *budget)
+{
+	struct tulip_private *tp = (struct tulip_private *)dev->priv;
+	long ioaddr = dev->base_addr;
+	int limit = *budget < dev->quota ? *budget : dev->quota;
+	int received = 0;
+	int entry;
+
+	for (;;) {
+		/* A packet that comes in after this raises them again */
+		outl(RxPollInt, ioaddr + CSR5);
+
+		received += tulip_rx(dev, limit - received);
+		tulip_refill_rx(dev);
+
+		if (received >= limit) {
+			/* Packets arrive faster than we pass them up; skip
+			   the allocation and copy per packet until the ring
+			   is drained, the ring buffers are recycled anyway. */
+			tp->rx_copy_off = 1;
+			tp->rx_frames += received;
+			dev->quota -= received;
+			*budget -= received;
+			return 1;
+		}
+		if (!(inl(ioaddr + CSR5) & RxPollInt))
+			break;
+	}
+
+	tp->rx_copy_off = 0;
+	tp->rx_frames += received;
+	dev->quota -= received;
+	*budget -= received;
+
+	netif_rx_complete(dev);
+
+	/* check if the card is in suspend mode */
+	entry = tp->dirty_rx % RX_RING_SIZE;
+	if (tp->rx_buffers[entry].skb == NULL) {
+		if (tulip_debug > 1)
+			printk(KERN_WARNING "%s: in rx suspend mode: (%lu) (tp->cur_rx = %u, ttimer = %d) go/stay in suspend mode\n", dev->name, tp->nir, tp->cur_rx, tp->ttimer);
+		outl(tulip_tbl[tp->chip_id].valid_intrs & ~RxPollInt, ioaddr + CSR7);
+		if (tp->ttimer == 0 || (inl(ioaddr + CSR11) & 0xffff) == 0) {
+			if (tulip_debug > 1)
+				printk(KERN_WARNING "%s: in rx suspend mode: (%lu) set timer\n", dev->name, tp->nir);
+			outl(tulip_tbl[tp->chip_id].valid_intrs | TimerInt,
+				ioaddr + CSR7);
+			outl(TimerInt, ioaddr + CSR5);
+			outl(tp->mit | 12, ioaddr + CSR11);
+			tp->ttimer = 1;
+		}
+		return 0;
+	}
+
+	outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR7);
+	return 0;
+}
+
+
+/* The interrupt handler schedules the Rx work for tulip_poll() and
+   cleans up after the Tx thread. */
 void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 {
 	struct net_device *dev = (struct net_device *)dev_instance;
 	struct tulip_private *tp = (struct tulip_private *)dev->priv;
 	long ioaddr = dev->base_addr;
 	int csr5;
-	int entry;
 	int missed;
-	int rx = 0;
+	int rxd = 0;
 	int tx = 0;
 	int oi = 0;
-	int maxrx = RX_RING_SIZE;
 	int maxtx = TX_RING_SIZE;
 	int maxoi = TX_RING_SIZE;
 	unsigned int work_count = tulip_max_interrupt_work;
@@ -195,9 +280,12 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 			printk(KERN_DEBUG "%s: interrupt  csr5=%#8.8x new csr5=%#8.8x.\n",
 				   dev->name, csr5, inl(dev->base_addr + CSR5));
 
-		if (csr5 & (RxIntr | RxNoBuf)) {
-			rx += tulip_rx(dev);
-			tulip_refill_rx(dev);
+		if (csr5 & RxPollInt) {
+			/* Mask them until tulip_poll() has emptied the ring */
+			outl(tulip_tbl[tp->chip_id].valid_intrs & ~RxPollInt,
+			     ioaddr + CSR7);
+			netif_rx_schedule(dev);
+			rxd++;
 		}
 
 		if (csr5 & (TxNoBuf | TxDied | TxIntr | TimerInt)) {
@@ -317,21 +405,25 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 			if (tulip_debug > 2)
 				printk(KERN_ERR "%s: Re-enabling interrupts, %8.8x.\n",
 					   dev->name, csr5);
-			outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR7);
+			/* Receive stays masked, tulip_poll() refills the ring */
+			outl(tulip_tbl[tp->chip_id].valid_intrs & ~RxPollInt,
+			     ioaddr + CSR7);
+			netif_rx_schedule(dev);
+			rxd++;
 			tp->ttimer = 0;
 			oi++;
 		}
-		if (tx > maxtx || rx > maxrx || oi > maxoi) {
+		if (tx > maxtx || oi > maxoi) {
 			if (tulip_debug > 1)
 				printk(KERN_WARNING "%s: Too much work during an interrupt, "
-					   "csr5=0x%8.8x. (%lu) (%d,%d,%d)\n", dev->name, csr5, tp->nir, tx, rx, oi);
+					   "csr5=0x%8.8x. (%lu) (%d,%d)\n", dev->name, csr5, tp->nir, tx, oi);
 
                        /* Acknowledge all interrupt sources. */
                         outl(0x8001ffff, ioaddr + CSR5);
                         if (tp->flags & HAS_INTR_MITIGATION) {
                      /* Josip Loncaric at ICASE did extensive experimentation
 			to develop a good interrupt mitigation setting.*/
-                                outl(0x8b240000, ioaddr + CSR11);
+                                outl(tp->mit ? : 0x8b240000, ioaddr + CSR11);
                         } else {
                           /* Mask all interrupting sources, set timer to
 				re-enable. */
@@ -346,25 +438,12 @@ void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs)
 			break;
 
 		csr5 = inl(ioaddr + CSR5);
-	} while ((csr5 & (NormalIntr|AbnormalIntr)) != 0);
-
-	tulip_refill_rx(dev);
+		/* Receive is tulip_poll()'s business now */
+		if (rxd)
+			csr5 &= ~RxPollInt;
+	} while ((csr5 & (TxNoBuf | TxDied | TxIntr | TimerInt | AbnormalIntr | RxPollInt)) != 0);
 
-	/* check if the card is in suspend mode */
-	entry = tp->dirty_rx % RX_RING_SIZE;
-	if (tp->rx_buffers[entry].skb == NULL) {
-		if (tulip_debug > 1)
-			printk(KERN_WARNING "%s: in rx suspend mode: (%lu) (tp->cur_rx = %u, ttimer = %d, rx = %d) go/stay in suspend mode\n", dev->name, tp->nir, tp->cur_rx, tp->ttimer, rx);
-		if (tp->ttimer == 0 || (inl(ioaddr + CSR11) & 0xffff) == 0) {
-			if (tulip_debug > 1)
-				printk(KERN_WARNING "%s: in rx suspend mode: (%lu) set timer\n", dev->name, tp->nir);
-			outl(tulip_tbl[tp->chip_id].valid_intrs | TimerInt,
-				ioaddr + CSR7);
-			outl(TimerInt, ioaddr + CSR5);
-			outl(12, ioaddr + CSR11);
-			tp->ttimer = 1;
-		}
-	}
+	tp->tx_frames += tx;
 
 	if ((missed = inl(ioaddr + CSR8) & 0x1ffff)) {
 		tp->stats.rx_dropped += missed & 0x10000 ? 0x10000 : missed;
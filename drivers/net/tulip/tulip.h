@@ -130,6 +130,9 @@ enum status_bits {
 	TxIntr = 0x01,
 };
 
+/* The receive interrupts, masked while tulip_poll() is scheduled */
+#define RxPollInt	(RxIntr | RxNoBuf)
+
 
 /* The Tulip Rx and Tx buffer descriptors. */
 struct tulip_rx_desc {
@@ -363,7 +366,11 @@ struct tulip_private {
 	struct pci_dev *pdev;
 	int ttimer;
 	int susp_rx;
-	unsigned long nir;
+	unsigned long nir;	/* Interrupts handled */
+	unsigned long rx_frames, tx_frames;	/* ... and work done in them */
+	u32 mit;		/* CSR11 mitigation bits, 0 for none */
+	struct skb_recycle_pool *rx_pool;	/* Freed Rx buffers, for refills. */
+	int rx_copy_off;	/* Ignore rx_copybreak for now. */
 	unsigned long base_addr;
 	int pad0, pad1;		/* Used for 8-byte alignment */
 };
@@ -391,7 +398,9 @@ int tulip_read_eeprom(long ioaddr, int location, int addr_len);
 /* interrupt.c */
 extern unsigned int tulip_max_interrupt_work;
 extern int tulip_rx_copybreak;
+extern int tulip_rx_copy_adaptive;
 void tulip_interrupt(int irq, void *dev_instance, struct pt_regs *regs);
+int tulip_poll(struct net_device *dev, int *budget);
 
 /* media.c */
 int tulip_mdio_read(struct net_device *dev, int phy_id, int location);
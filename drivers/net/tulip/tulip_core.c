@@ -25,7 +25,9 @@
 #include <linux/init.h>
 #include <linux/etherdevice.h>
 #include <linux/delay.h>
+#include <linux/ethtool.h>
 #include <asm/unaligned.h>
+#include <asm/uaccess.h>
 
 static char version[] __devinitdata =
 	"Linux Tulip driver version 0.9.12 (December 17, 2000)\n";
@@ -50,12 +52,16 @@ const char * const medianame[] = {
 	"10baseT(forced)", "MII 100baseTx", "MII 100baseTx-FD", "MII 100baseT4",
 };
 
-/* Set the copy breakpoint for the copy-only-tiny-buffer Rx structure. */
+/* Set the copy breakpoint for the copy-only-tiny-buffer Rx structure.
+   Where the copy is only an optimisation it is skipped under bursts,
+   when the allocation per packet is what holds us back. */
 #if defined(__alpha__) || defined(__arm__) || defined(__hppa__) \
 	|| defined(__sparc_) || defined(__ia64__)
 static int rx_copybreak = 1518;
+#define RX_COPY_ADAPTIVE 0	/* Copy to align the IP header. */
 #else
 static int rx_copybreak = 100;
+#define RX_COPY_ADAPTIVE 1
 #endif
 
 /*
@@ -388,6 +394,8 @@ media_picked:
 	/* Enable interrupts by setting the interrupt mask. */
 	outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR5);
 	outl(tulip_tbl[tp->chip_id].valid_intrs, ioaddr + CSR7);
+	if (tp->flags & HAS_INTR_MITIGATION)
+		outl(tp->mit, ioaddr + CSR11);
 	tulip_outl_csr(tp, tp->csr6 | csr6_st | csr6_sr, CSR6);
 	outl(0, ioaddr + CSR2);		/* Rx poll demand */
 
@@ -409,6 +417,7 @@ media_picked:
 static int
 tulip_open(struct net_device *dev)
 {
+	struct tulip_private *tp = (struct tulip_private *)dev->priv;
 	int retval;
 	MOD_INC_USE_COUNT;
 
@@ -417,6 +426,9 @@ tulip_open(struct net_device *dev)
 		return retval;
 	}
 
+	/* Buffers handed up the stack come back here when freed.  Without
+	   the pool we just allocate them afresh. */
+	tp->rx_pool = skb_recycle_pool_create(dev->name, PKT_BUF_SZ, RX_RING_SIZE);
 	tulip_init_ring (dev);
 
 	tulip_up (dev);
@@ -550,6 +562,8 @@ static void tulip_init_ring(struct net_device *dev)
 	tp->susp_rx = 0;
 	tp->ttimer = 0;
 	tp->nir = 0;
+	tp->rx_frames = tp->tx_frames = 0;
+	tp->rx_copy_off = 0;
 
 	for (i = 0; i < RX_RING_SIZE; i++) {
 		tp->rx_ring[i].status = 0x00000000;
@@ -568,7 +582,7 @@ static void tulip_init_ring(struct net_device *dev)
 		/* Note the receive buffer must be longword aligned.
 		   dev_alloc_skb() provides 16 byte alignment.  But do *not*
 		   use skb_reserve() to align the IP header! */
-		struct sk_buff *skb = dev_alloc_skb(PKT_BUF_SZ);
+		struct sk_buff *skb = dev_alloc_skb_recycle(tp->rx_pool, PKT_BUF_SZ);
 		tp->rx_buffers[i].skb = skb;
 		if (skb == NULL)
 			break;
@@ -708,6 +722,10 @@ static int tulip_close (struct net_device *dev)
 			dev_kfree_skb (skb);
 		}
 	}
+	if (tp->rx_pool) {
+		skb_recycle_pool_destroy(tp->rx_pool);
+		tp->rx_pool = NULL;
+	}
 	for (i = 0; i < TX_RING_SIZE; i++) {
 		struct sk_buff *skb = tp->tx_buffers[i].skb;
 
@@ -745,6 +763,76 @@ static struct net_device_stats *tulip_get_stats(struct net_device *dev)
 
 
 /* Provide ioctl() calls to examine the MII xcvr state. */
+/* CSR11 interrupt mitigation on the 21143.  With the cycle size bit set
+   the Rx timer counts in units of 5.12us and the Tx timer in units of
+   16 of those (at 100Mbit, ten times that at 10Mbit); the packet counts
+   go up to 7.  The timers are rounded up, the counts clamped. */
+#define MIT_CS		0x80000000
+#define MIT_TT_SHIFT	27
+#define MIT_NTP_SHIFT	24
+#define MIT_RT_SHIFT	20
+#define MIT_NRP_SHIFT	17
+
+static inline u32 mit_field(u32 val, u32 unit, u32 max)
+{
+	val = (val + unit - 1) / unit;
+	return val > max ? max : val;
+}
+
+static int tulip_ethtool_ioctl(struct net_device *dev, void *useraddr)
+{
+	struct tulip_private *tp = (struct tulip_private *)dev->priv;
+	struct ethtool_coalesce ecoal;
+	struct ethtool_ringparam ering;
+	u32 ethcmd, mit;
+
+	if (copy_from_user(&ethcmd, useraddr, sizeof(ethcmd)))
+		return -EFAULT;
+
+	switch (ethcmd) {
+	case ETHTOOL_GCOALESCE:
+		memset(&ecoal, 0, sizeof(ecoal));
+		ecoal.cmd = ethcmd;
+		mit = tp->mit;
+		ecoal.rx_coalesce_usecs = ((mit >> MIT_RT_SHIFT) & 15) * 512 / 100;
+		ecoal.rx_max_coalesced_frames = (mit >> MIT_NRP_SHIFT) & 7;
+		ecoal.tx_coalesce_usecs = ((mit >> MIT_TT_SHIFT) & 15) * 8192 / 100;
+		ecoal.tx_max_coalesced_frames = (mit >> MIT_NTP_SHIFT) & 7;
+		ecoal.interrupts = tp->nir;
+		ecoal.rx_frames = tp->rx_frames;
+		ecoal.tx_frames = tp->tx_frames;
+		if (copy_to_user(useraddr, &ecoal, sizeof(ecoal)))
+			return -EFAULT;
+		return 0;
+	case ETHTOOL_SCOALESCE:
+		if (!capable(CAP_NET_ADMIN))
+			return -EPERM;
+		if (!(tp->flags & HAS_INTR_MITIGATION))
+			return -EOPNOTSUPP;
+		if (copy_from_user(&ecoal, useraddr, sizeof(ecoal)))
+			return -EFAULT;
+		mit = mit_field(ecoal.rx_coalesce_usecs * 100, 512, 15) << MIT_RT_SHIFT
+			| mit_field(ecoal.rx_max_coalesced_frames, 1, 7) << MIT_NRP_SHIFT
+			| mit_field(ecoal.tx_coalesce_usecs * 100, 8192, 15) << MIT_TT_SHIFT
+			| mit_field(ecoal.tx_max_coalesced_frames, 1, 7) << MIT_NTP_SHIFT;
+		tp->mit = mit ? mit | MIT_CS : 0;
+		if (netif_running(dev))
+			outl(tp->mit, dev->base_addr + CSR11);
+		return 0;
+	case ETHTOOL_GRINGPARAM:
+		memset(&ering, 0, sizeof(ering));
+		ering.cmd = ethcmd;
+		ering.rx_max_pending = ering.rx_pending = RX_RING_SIZE;
+		ering.tx_max_pending = ering.tx_pending = TX_RING_SIZE;
+		if (copy_to_user(useraddr, &ering, sizeof(ering)))
+			return -EFAULT;
+		return 0;
+	}
+
+	/* The rings are sized at compile time, see tulip.h */
+	return -EOPNOTSUPP;
+}
+
 static int private_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 {
 	struct tulip_private *tp = (struct tulip_private *)dev->priv;
@@ -801,6 +889,8 @@ static int private_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 			spin_unlock_irqrestore(&tp->lock, flags);
 		}
 		return 0;
+	case SIOCETHTOOL:
+		return tulip_ethtool_ioctl(dev, rq->ifr_data);
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -1332,6 +1422,8 @@ static int __devinit tulip_init_one (struct pci_dev *pdev,
 	/* The Tulip-specific entries in the device structure. */
 	dev->open = tulip_open;
 	dev->hard_start_xmit = tulip_start_xmit;
+	dev->poll = tulip_poll;
+	dev->weight = 16;
 	dev->tx_timeout = tulip_tx_timeout;
 	dev->watchdog_timeo = TX_TIMEOUT;
 	dev->stop = tulip_close;
@@ -1426,6 +1518,7 @@ static void tulip_suspend (struct pci_dev *pdev)
 
 	if (dev && netif_device_present (dev)) {
 		netif_device_detach (dev);
+		netif_poll_disable (dev);
 		tulip_down (dev);
 	}
 //	pci_set_power_state(pdev, 3);
@@ -1439,6 +1532,7 @@ static void tulip_resume(struct pci_dev *pdev)
 	pci_enable_device(pdev);
 	if (dev && !netif_device_present (dev)) {
 		tulip_up (dev);
+		netif_poll_enable (dev);
 		netif_device_attach (dev);
 	}
 }
@@ -1481,6 +1575,7 @@ static int __init tulip_init (void)
 {
 	/* copy module parms into globals */
 	tulip_rx_copybreak = rx_copybreak;
+	tulip_rx_copy_adaptive = RX_COPY_ADAPTIVE;
 	tulip_max_interrupt_work = max_interrupt_work;
 
 	/* probe for and init boards */
@@ -4136,7 +4136,7 @@ aic7xxx_timer(struct aic7xxx_host *p)
   unsigned long cpu_flags = 0;
   struct aic7xxx_scb *scb;
 
-  spin_lock_irqsave(&io_request_lock, cpu_flags);
+  spin_lock_irqsave(p->host->host_lock, cpu_flags);
   p->dev_timer_active &= ~(0x01 << MAX_TARGETS);
   if ( (p->dev_timer_active & (0x01 << p->scsi_id)) &&
        time_after_eq(jiffies, p->dev_expires[p->scsi_id]) )
@@ -4193,7 +4193,7 @@ aic7xxx_timer(struct aic7xxx_host *p)
   }
 
   aic7xxx_run_waiting_queues(p);
-  spin_unlock_irqrestore(&io_request_lock, cpu_flags);
+  spin_unlock_irqrestore(p->host->host_lock, cpu_flags);
 }
 
 /*+F*************************************************************************
@@ -6986,10 +6986,10 @@ do_aic7xxx_isr(int irq, void *dev_id, struct pt_regs *regs)
   p = (struct aic7xxx_host *)dev_id;
   if(!p)
     return;
-  spin_lock_irqsave(&io_request_lock, cpu_flags);
+  spin_lock_irqsave(p->host->host_lock, cpu_flags);
   if(test_and_set_bit(AHC_IN_ISR_BIT, (void *)&p->flags))
   {
-    spin_unlock_irqrestore(&io_request_lock, cpu_flags);
+    spin_unlock_irqrestore(p->host->host_lock, cpu_flags);
     return;
   }
   do
@@ -6999,7 +6999,7 @@ do_aic7xxx_isr(int irq, void *dev_id, struct pt_regs *regs)
   aic7xxx_done_cmds_complete(p);
   aic7xxx_run_waiting_queues(p);
   clear_bit(AHC_IN_ISR_BIT, (void *)&p->flags);
-  spin_unlock_irqrestore(&io_request_lock, cpu_flags);
+  spin_unlock_irqrestore(p->host->host_lock, cpu_flags);
 }
 
 /*+F*************************************************************************
@@ -8838,6 +8838,12 @@ aic7xxx_alloc(Scsi_Host_Template *sht, struct aic7xxx_host *temp)
     memset(p, 0, sizeof(struct aic7xxx_host));
     *p = *temp;
     p->host = host;
+    /*
+     * Every entry point already serializes on the host lock, so give each
+     * controller a lock of its own rather than sharing io_request_lock
+     * with every other block device in the box.
+     */
+    host->host_lock = &host->default_lock;
 
     p->scb_data = kmalloc(sizeof(scb_data_type), GFP_ATOMIC);
     if (p->scb_data != NULL)
@@ -11336,7 +11342,7 @@ aic7xxx_panic_abort(struct aic7xxx_host *p, Scsi_Cmnd *cmd)
   disable_irq(p->irq);
   aic7xxx_print_card(p);
   aic7xxx_print_scratch_ram(p);
-  spin_unlock_irq(&io_request_lock);
+  spin_unlock_irq(p->host->host_lock);
   for(;;) barrier();
 }
 
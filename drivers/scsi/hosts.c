@@ -122,6 +122,7 @@ scsi_unregister(struct Scsi_Host * sh){
 	}
     }
     next_scsi_host--;
+    scsi_release_sg_pool(sh);
     kfree((char *) sh);
 }
 
@@ -188,6 +189,12 @@ struct Scsi_Host * scsi_register(Scsi_Host_Template * tpnt, int j){
     next_scsi_host++;
     retval->host_queue = NULL;
     init_waitqueue_head(&retval->host_wait);
+    /*
+     * Drivers that do their own locking point host_lock at default_lock
+     * in their detect routine; everybody else stays on io_request_lock.
+     */
+    spin_lock_init(&retval->default_lock);
+    retval->host_lock = &io_request_lock;
     retval->resetting = 0;
     retval->last_reset = 0;
     retval->irq = 0;
@@ -227,6 +234,7 @@ struct Scsi_Host * scsi_register(Scsi_Host_Template * tpnt, int j){
     retval->this_id = tpnt->this_id;
     retval->can_queue = tpnt->can_queue;
     retval->sg_tablesize = tpnt->sg_tablesize;
+    retval->max_sectors = tpnt->max_sectors;
     retval->cmd_per_lun = tpnt->cmd_per_lun;
     retval->unchecked_isa_dma = tpnt->unchecked_isa_dma;
     retval->use_clustering = tpnt->use_clustering;   
@@ -290,6 +290,14 @@ typedef struct	SHT
      */
     char *proc_name;
 
+    /*
+     * The largest request, in 512 byte sectors, that the host adapter
+     * can transfer with one command.  Leave this at 0 to get the block
+     * layer default (MAX_SECTORS).  Raising it only helps if the host
+     * also has an sg_tablesize to match.
+     */
+    unsigned short max_sectors;
+
 } Scsi_Host_Template;
 
 /*
@@ -325,6 +333,23 @@ struct Scsi_Host
     atomic_t                host_active; /* commands checked out */
     volatile unsigned short host_busy;   /* commands actually active on low-level */
     volatile unsigned short host_failed; /* commands that failed. */
+    spinlock_t              default_lock;
+    spinlock_t            * host_lock; /* Protects the host and the request
+                                          queues of its devices. */
+
+    /*
+     * Scatter-gather tables too large for scsi_malloc(), see scsi_dma.c.
+     */
+    void                  * sg_pool;        /* Free tables. */
+    unsigned int            sg_pool_tables; /* Tables allocated. */
+    unsigned int            sg_pool_order;  /* Pages per table (order). */
+
+    /*
+     * Commands from the request queues handed to the low-level driver,
+     * and the sectors they moved.  Shown in /proc/scsi/iostats.
+     */
+    unsigned long           io_commands;
+    unsigned long           io_sectors;
     
 /* public: */
     unsigned short extra_bytes;
@@ -379,6 +404,7 @@ struct Scsi_Host
     int can_queue;
     short cmd_per_lun;
     short unsigned int sg_tablesize;
+    unsigned short max_sectors;
 
     unsigned in_recovery:1;
     unsigned unchecked_isa_dma:1;
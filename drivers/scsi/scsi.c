@@ -58,6 +58,7 @@
 
 #include <linux/unistd.h>
 #include <linux/spinlock.h>
+#include <linux/smp_lock.h>
 
 #include <asm/system.h>
 #include <asm/irq.h>
@@ -78,6 +79,7 @@ struct proc_dir_entry *proc_scsi;
 
 #ifdef CONFIG_PROC_FS
 static int scsi_proc_info(char *buffer, char **start, off_t offset, int length);
+static int scsi_iostats_info(char *buffer, char **start, off_t offset, int length);
 static void scsi_dump_status(int level);
 #endif
 
@@ -179,6 +181,7 @@ extern void scsi_old_times_out(Scsi_Cmnd * SCpnt);
 void  scsi_initialize_queue(Scsi_Device * SDpnt, struct Scsi_Host * SHpnt) {
 	blk_init_queue(&SDpnt->request_queue, scsi_request_fn);
         blk_queue_headactive(&SDpnt->request_queue, 0);
+        blk_queue_lock(&SDpnt->request_queue, SHpnt->host_lock);
         SDpnt->request_queue.queuedata = (void *) SDpnt;
 }
 
@@ -610,7 +613,7 @@ int scsi_dispatch_cmd(Scsi_Cmnd * SCpnt)
 	unsigned long flags = 0;
 	unsigned long timeout;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 #if DEBUG
 	unsigned long *ret = 0;
@@ -676,41 +679,41 @@ int scsi_dispatch_cmd(Scsi_Cmnd * SCpnt)
 		 * passes a meaningful return value.
 		 */
 		if (host->hostt->use_new_eh_code) {
-                        spin_lock_irqsave(&io_request_lock, flags);
+                        spin_lock_irqsave(host->host_lock, flags);
 			rtn = host->hostt->queuecommand(SCpnt, scsi_done);
-                        spin_unlock_irqrestore(&io_request_lock, flags);
+                        spin_unlock_irqrestore(host->host_lock, flags);
 			if (rtn != 0) {
 				scsi_delete_timer(SCpnt);
 				scsi_mlqueue_insert(SCpnt, SCSI_MLQUEUE_HOST_BUSY);
                                 SCSI_LOG_MLQUEUE(3, printk("queuecommand : request rejected\n"));                                
 			}
 		} else {
-                        spin_lock_irqsave(&io_request_lock, flags);
+                        spin_lock_irqsave(host->host_lock, flags);
 			host->hostt->queuecommand(SCpnt, scsi_old_done);
-                        spin_unlock_irqrestore(&io_request_lock, flags);
+                        spin_unlock_irqrestore(host->host_lock, flags);
 		}
 	} else {
 		int temp;
 
 		SCSI_LOG_MLQUEUE(3, printk("command() :  routine at %p\n", host->hostt->command));
-                spin_lock_irqsave(&io_request_lock, flags);
+                spin_lock_irqsave(host->host_lock, flags);
 		temp = host->hostt->command(SCpnt);
 		SCpnt->result = temp;
 #ifdef DEBUG_DELAY
-                spin_unlock_irqrestore(&io_request_lock, flags);
+                spin_unlock_irqrestore(host->host_lock, flags);
 		clock = jiffies + 4 * HZ;
 		while (time_before(jiffies, clock))
 			barrier();
 		printk("done(host = %d, result = %04x) : routine at %p\n",
 		       host->host_no, temp, host->hostt->command);
-                spin_lock_irqsave(&io_request_lock, flags);
+                spin_lock_irqsave(host->host_lock, flags);
 #endif
 		if (host->hostt->use_new_eh_code) {
 			scsi_done(SCpnt);
 		} else {
 			scsi_old_done(SCpnt);
 		}
-                spin_unlock_irqrestore(&io_request_lock, flags);
+                spin_unlock_irqrestore(host->host_lock, flags);
 	}
 	SCSI_LOG_MLQUEUE(3, printk("leaving scsi_dispatch_cmnd()\n"));
 	return rtn;
@@ -778,7 +781,7 @@ void scsi_do_req(Scsi_Request * SRpnt, const void *cmnd,
 	Scsi_Device * SDpnt = SRpnt->sr_device;
 	struct Scsi_Host *host = SDpnt->host;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(host->host_lock, 0);
 
 	SCSI_LOG_MLQUEUE(4,
 			 {
@@ -877,7 +880,7 @@ void scsi_init_cmd_from_req(Scsi_Cmnd * SCpnt, Scsi_Request * SRpnt)
 {
 	struct Scsi_Host *host = SCpnt->host;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(host->host_lock, 0);
 
 	SCpnt->owner = SCSI_OWNER_MIDLEVEL;
 	SRpnt->sr_command = SCpnt;
@@ -967,7 +970,7 @@ void scsi_do_cmd(Scsi_Cmnd * SCpnt, const void *cmnd,
 {
 	struct Scsi_Host *host = SCpnt->host;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(host->host_lock, 0);
 
 	SCpnt->owner = SCSI_OWNER_MIDLEVEL;
 
@@ -1125,7 +1128,7 @@ void scsi_done(Scsi_Cmnd * SCpnt)
 	 * Scsi_Cmnds, as it happens pretty often scsi_done is called multiple times
 	 * before bh is serviced. -jj
 	 *
-	 * We already have the io_request_lock here, since we are called from the
+	 * We already have the host lock here, since we are called from the
 	 * interrupt handler or the error handler. (DB)
 	 *
 	 * This may be true at the moment, but I would like to wean all of the low
@@ -1159,7 +1162,7 @@ void scsi_done(Scsi_Cmnd * SCpnt)
  *              interrupt latency, stack depth, and reentrancy of the low-level
  *              drivers.
  *
- * The io_request_lock is required in all the routine. There was a subtle
+ * The host lock is required in all the routine. There was a subtle
  * race condition when scsi_done is called after a command has already
  * timed out but before the time out is processed by the error handler.
  * (DB)
@@ -1201,6 +1204,8 @@ void scsi_bottom_half_handler(void)
 						SCpnt->host->host_failed,
 							 SCpnt->result));
 
+				if (SCpnt->device->queue_limit < SCpnt->device->queue_depth)
+					scsi_track_queue_good(SCpnt->device);
 				scsi_finish_command(SCpnt);
 				break;
 			case NEEDS_RETRY:
@@ -1226,6 +1231,7 @@ void scsi_bottom_half_handler(void)
 				 */
 				SCSI_LOG_MLCOMPLETE(3, printk("Command rejected as device queue full, put on ml queue %p\n",
                                                               SCpnt));
+				scsi_track_queue_full(SCpnt->device);
 				scsi_mlqueue_insert(SCpnt, SCSI_MLQUEUE_DEVICE_BUSY);
 				break;
 			default:
@@ -1316,7 +1322,7 @@ void scsi_finish_command(Scsi_Cmnd * SCpnt)
 	Scsi_Request * SRpnt;
 	unsigned long flags;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 	host = SCpnt->host;
 	device = SCpnt->device;
@@ -1328,10 +1334,10 @@ void scsi_finish_command(Scsi_Cmnd * SCpnt)
          * one execution context, but the device and host structures are
          * shared.
          */
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(host->host_lock, flags);
 	host->host_busy--;	/* Indicate that we are free */
 	device->device_busy--;	/* Decrement device usage counter. */
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(host->host_lock, flags);
 
         /*
          * Clear the flags which say that the device/host is no longer
@@ -1403,9 +1409,33 @@ void scsi_release_commandblocks(Scsi_Device * SDpnt)
 	}
 	SDpnt->has_cmdblocks = 0;
 	SDpnt->queue_depth = 0;
+	SDpnt->queue_limit = 0;
 	spin_unlock_irqrestore(&device_request_lock, flags);
 }
 
+static void scsi_init_cmdblock(Scsi_Device * SDpnt, Scsi_Cmnd * SCpnt)
+{
+	memset(SCpnt, 0, sizeof(Scsi_Cmnd));
+	SCpnt->host = SDpnt->host;
+	SCpnt->device = SDpnt;
+	SCpnt->target = SDpnt->id;
+	SCpnt->lun = SDpnt->lun;
+	SCpnt->channel = SDpnt->channel;
+	SCpnt->request.rq_status = RQ_INACTIVE;
+	SCpnt->use_sg = 0;
+	SCpnt->old_use_sg = 0;
+	SCpnt->old_cmd_len = 0;
+	SCpnt->underflow = 0;
+	SCpnt->old_underflow = 0;
+	SCpnt->transfersize = 0;
+	SCpnt->resid = 0;
+	SCpnt->serial_number = 0;
+	SCpnt->serial_number_at_timeout = 0;
+	SCpnt->host_scribble = NULL;
+	SCpnt->state = SCSI_STATE_UNUSED;
+	SCpnt->owner = SCSI_OWNER_NOBODY;
+}
+
 /*
  * Function:    scsi_build_commandblocks()
  *
@@ -1443,27 +1473,9 @@ void scsi_build_commandblocks(Scsi_Device * SDpnt)
 				(host->unchecked_isa_dma ? GFP_DMA : 0));
 		if (NULL == SCpnt)
 			break;	/* If not, the next line will oops ... */
-		memset(SCpnt, 0, sizeof(Scsi_Cmnd));
-		SCpnt->host = host;
-		SCpnt->device = SDpnt;
-		SCpnt->target = SDpnt->id;
-		SCpnt->lun = SDpnt->lun;
-		SCpnt->channel = SDpnt->channel;
-		SCpnt->request.rq_status = RQ_INACTIVE;
-		SCpnt->use_sg = 0;
-		SCpnt->old_use_sg = 0;
-		SCpnt->old_cmd_len = 0;
-		SCpnt->underflow = 0;
-		SCpnt->old_underflow = 0;
-		SCpnt->transfersize = 0;
-		SCpnt->resid = 0;
-		SCpnt->serial_number = 0;
-		SCpnt->serial_number_at_timeout = 0;
-		SCpnt->host_scribble = NULL;
+		scsi_init_cmdblock(SDpnt, SCpnt);
 		SCpnt->next = SDpnt->device_queue;
 		SDpnt->device_queue = SCpnt;
-		SCpnt->state = SCSI_STATE_UNUSED;
-		SCpnt->owner = SCSI_OWNER_NOBODY;
 	}
 	if (j < SDpnt->queue_depth) {	/* low on space (D.Gilbert 990424) */
 		printk(KERN_WARNING "scsi_build_commandblocks: want=%d, space for=%d blocks\n",
@@ -1473,7 +1485,78 @@ void scsi_build_commandblocks(Scsi_Device * SDpnt)
 	} else {
 		SDpnt->has_cmdblocks = 1;
 	}
+	SDpnt->queue_limit = SDpnt->queue_depth;
+	SDpnt->queue_good = 0;
 	spin_unlock_irqrestore(&device_request_lock, flags);
+
+	/*
+	 * Keep enough requests queued to fill every tag.  The host device
+	 * of scsi_get_host_dev() gets its queue only after this.
+	 */
+	if (SDpnt->has_cmdblocks && SDpnt->request_queue.request_fn)
+		blk_queue_depth(&SDpnt->request_queue, SDpnt->queue_depth);
+}
+
+/*
+ * Function:    scsi_adjust_queue_depth()
+ *
+ * Purpose:     Change the queue depth of a device at run time.
+ *
+ * Arguments:   SDpnt   - device
+ *              depth   - new number of outstanding commands
+ *
+ * Returns:     The depth in effect, or -errno.
+ *
+ * Lock status: No locking assumed or required.  May sleep.
+ *
+ * Notes:       Command blocks are added when the device gets deeper,
+ *              but never freed until scsi_release_commandblocks(); a
+ *              shallower device simply leaves some of them unused.
+ *              The QUEUE FULL throttle starts over from the new depth.
+ */
+int scsi_adjust_queue_depth(Scsi_Device * SDpnt, int depth)
+{
+	struct Scsi_Host *host = SDpnt->host;
+	Scsi_Cmnd *SCpnt, *list = NULL;
+	unsigned long flags;
+	int j;
+
+	if (depth < 1 || depth > 255 || !SDpnt->has_cmdblocks)
+		return -EINVAL;
+
+	spin_lock_irqsave(&device_request_lock, flags);
+	for (j = 0, SCpnt = SDpnt->device_queue; SCpnt; SCpnt = SCpnt->next)
+		j++;
+	spin_unlock_irqrestore(&device_request_lock, flags);
+
+	for (; j < depth; j++) {
+		SCpnt = (Scsi_Cmnd *) kmalloc(sizeof(Scsi_Cmnd), GFP_KERNEL |
+				(host->unchecked_isa_dma ? GFP_DMA : 0));
+		if (NULL == SCpnt)
+			break;
+		scsi_init_cmdblock(SDpnt, SCpnt);
+		SCpnt->next = list;
+		list = SCpnt;
+	}
+	if (j < depth) {
+		printk(KERN_WARNING "scsi_adjust_queue_depth: want=%d, space for=%d blocks\n",
+		       depth, j);
+		depth = j;
+	}
+
+	spin_lock_irqsave(&device_request_lock, flags);
+	while ((SCpnt = list) != NULL) {
+		list = SCpnt->next;
+		SCpnt->next = SDpnt->device_queue;
+		SDpnt->device_queue = SCpnt;
+	}
+	SDpnt->queue_depth = depth;
+	SDpnt->queue_limit = depth;
+	SDpnt->queue_good = 0;
+	spin_unlock_irqrestore(&device_request_lock, flags);
+
+	blk_queue_depth(&SDpnt->request_queue, depth);
+	return depth;
 }
 
 static int proc_scsi_gen_write(struct file * file, const char * buf,
@@ -1556,6 +1639,45 @@ stop_output:
 	return (len);
 }
 
+/*
+ * /proc/scsi/iostats: one line per host with the number of commands
+ * taken off its request queues, the sectors they moved and the average
+ * command size, next to the limits that bound it.
+ */
+static int scsi_iostats_info(char *buffer, char **start, off_t offset, int length)
+{
+	struct Scsi_Host *HBA_ptr;
+	unsigned long commands, sectors;
+	int len = 0;
+	off_t begin = 0;
+	off_t pos = 0;
+
+	for (HBA_ptr = scsi_hostlist; HBA_ptr; HBA_ptr = HBA_ptr->next) {
+		commands = HBA_ptr->io_commands;
+		sectors = HBA_ptr->io_sectors;
+		len += sprintf(buffer + len, "scsi%d: commands %lu sectors %lu "
+			       "avg %lu sg_tablesize %u max_sectors %u\n",
+			       (int) HBA_ptr->host_no, commands, sectors,
+			       commands ? sectors / commands : 0,
+			       HBA_ptr->sg_tablesize,
+			       HBA_ptr->max_sectors ? HBA_ptr->max_sectors
+						    : MAX_SECTORS);
+		pos = begin + len;
+		if (pos < offset) {
+			len = 0;
+			begin = pos;
+		}
+		if (pos > offset + length)
+			break;
+	}
+
+	*start = buffer + (offset - begin);	/* Start of wanted data */
+	len -= (offset - begin);	/* Start slop */
+	if (len > length)
+		len = length;	/* Ending slop */
+	return (len);
+}
+
 static int proc_scsi_gen_write(struct file * file, const char * buf,
                               unsigned long length, void *data)
 {
@@ -1794,6 +1916,48 @@ static int proc_scsi_gen_write(struct file * file, const char * buf,
 		}
 		err = 0;
 	}
+	/*
+	 * Usage: echo "scsi queue-depth 0 1 2 3 32" >/proc/scsi/scsi
+	 * with  "0 1 2 3" replaced by your "Host Channel Id Lun", and 32
+	 * by the number of commands the device may have outstanding.
+	 */
+	else if (!strncmp("queue-depth", buffer + 5, 11)) {
+		int depth;
+
+		p = buffer + 17;
+
+		host = simple_strtoul(p, &p, 0);
+		channel = simple_strtoul(p + 1, &p, 0);
+		id = simple_strtoul(p + 1, &p, 0);
+		lun = simple_strtoul(p + 1, &p, 0);
+		depth = simple_strtoul(p + 1, &p, 0);
+
+		for (HBA_ptr = scsi_hostlist; HBA_ptr; HBA_ptr = HBA_ptr->next) {
+			if (HBA_ptr->host_no == host) {
+				break;
+			}
+		}
+		err = -ENODEV;
+		if (!HBA_ptr)
+			goto out;
+
+		for (scd = HBA_ptr->host_queue; scd; scd = scd->next) {
+			if ((scd->channel == channel
+			     && scd->id == id
+			     && scd->lun == lun)) {
+				break;
+			}
+		}
+		if (scd == NULL)
+			goto out;
+
+		err = scsi_adjust_queue_depth(scd, depth);
+		if (err < 0)
+			goto out;
+		printk(KERN_INFO "scsi%d (%d:%d:%d): queue depth set to %d\n",
+		       host, channel, id, lun, err);
+		err = length;
+	}
 out:
 	
 	free_page((unsigned long) buffer);
@@ -1801,6 +1965,87 @@ out:
 }
 #endif
 
+/*
+ * Every host of a driver is scanned by a thread of its own, so that the
+ * INQUIRY timeouts on empty target ids of one bus overlap with those of
+ * the others.  The threads run under the big kernel lock like the rest
+ * of the scan, which they only give up while waiting for a command.
+ * Devices are attached only after all the scans have finished, in host
+ * order, so disk names come out the same as with a serial scan.
+ */
+static int scsi_parallel_scan = 1;
+
+static int __init scsi_parallel_scan_setup(char *str)
+{
+	scsi_parallel_scan = simple_strtol(str, NULL, 0);
+	return 1;
+}
+
+__setup("scsi_parallel_scan=", scsi_parallel_scan_setup);
+
+struct scsi_scan_work {
+	struct Scsi_Host *shpnt;
+	struct semaphore *done;
+};
+
+static void scsi_scan_host(struct Scsi_Host *shpnt)
+{
+	scan_scsis(shpnt, 0, 0, 0, 0);
+	if (shpnt->select_queue_depths != NULL) {
+		(shpnt->select_queue_depths) (shpnt, shpnt->host_queue);
+	}
+}
+
+static int scsi_scan_thread(void *data)
+{
+	struct scsi_scan_work *work = data;
+
+	daemonize();
+	sprintf(current->comm, "scsi_scan_%d", work->shpnt->host_no);
+
+	lock_kernel();
+	scsi_scan_host(work->shpnt);
+	unlock_kernel();
+
+	up(work->done);
+	kfree(work);
+	return 0;
+}
+
+static void scsi_scan_hosts(Scsi_Host_Template * tpnt)
+{
+	DECLARE_MUTEX_LOCKED(done);
+	struct Scsi_Host *shpnt;
+	struct scsi_scan_work *work;
+	int nr_hosts = 0, threads = 0;
+
+	for (shpnt = scsi_hostlist; shpnt; shpnt = shpnt->next)
+		if (shpnt->hostt == tpnt)
+			nr_hosts++;
+
+	for (shpnt = scsi_hostlist; shpnt; shpnt = shpnt->next) {
+		if (shpnt->hostt != tpnt)
+			continue;
+		if (scsi_parallel_scan && nr_hosts > 1) {
+			work = kmalloc(sizeof(*work), GFP_KERNEL);
+			if (work) {
+				work->shpnt = shpnt;
+				work->done = &done;
+				if (kernel_thread(scsi_scan_thread, work,
+						  CLONE_FS | CLONE_FILES | CLONE_SIGHAND) >= 0) {
+					threads++;
+					continue;
+				}
+				kfree(work);
+			}
+		}
+		scsi_scan_host(shpnt);
+	}
+
+	while (threads--)
+		down(&done);
+}
+
 /*
  * This entry point should be called by a driver if it is trying
  * to add a low level scsi driver to the system.
@@ -1899,14 +2144,7 @@ static int scsi_register_host(Scsi_Host_Template * tpnt)
 		/* The next step is to call scan_scsis here.  This generates the
 		 * Scsi_Devices entries
 		 */
-		for (shpnt = scsi_hostlist; shpnt; shpnt = shpnt->next) {
-			if (shpnt->hostt == tpnt) {
-				scan_scsis(shpnt, 0, 0, 0, 0);
-				if (shpnt->select_queue_depths != NULL) {
-					(shpnt->select_queue_depths) (shpnt, shpnt->host_queue);
-				}
-			}
-		}
+		scsi_scan_hosts(tpnt);
 
 		for (sdtpnt = scsi_devicelist; sdtpnt; sdtpnt = sdtpnt->next) {
 			if (sdtpnt->init && sdtpnt->dev_noticed)
@@ -2528,6 +2766,8 @@ static int __init init_scsi(void)
 		return -ENOMEM;
 	}
 	generic->write_proc = proc_scsi_gen_write;
+	if (!create_proc_info_entry ("scsi/iostats", 0, 0, scsi_iostats_info))
+		printk (KERN_ERR "cannot init /proc/scsi/iostats\n");
 #endif
 
         scsi_devfs_handle = devfs_mk_dir (NULL, "scsi", NULL);
@@ -2562,6 +2802,7 @@ static void __exit exit_scsi(void)
 
 #ifdef CONFIG_PROC_FS
 	/* No, we're not here anymore. Don't show the /proc/scsi files. */
+	remove_proc_entry ("scsi/iostats", 0);
 	remove_proc_entry ("scsi/scsi", 0);
 	remove_proc_entry ("scsi", 0);
 #endif
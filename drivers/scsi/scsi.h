@@ -407,6 +407,7 @@ extern const char *const scsi_device_types[MAX_SCSI_DEVICE_CODE];
 typedef struct scsi_device Scsi_Device;
 typedef struct scsi_cmnd Scsi_Cmnd;
 typedef struct scsi_request Scsi_Request;
+struct Scsi_Host;
 
 #define SCSI_CMND_MAGIC 0xE25C23A5
 #define SCSI_REQ_MAGIC  0x75F6D354
@@ -454,6 +455,9 @@ void scsi_resize_dma_pool(void);
 int scsi_init_minimal_dma_pool(void);
 void *scsi_malloc(unsigned int);
 int scsi_free(void *, unsigned int);
+void *scsi_alloc_sgtable(struct Scsi_Host *, unsigned int);
+int scsi_free_sgtable(struct Scsi_Host *, void *, unsigned int);
+void scsi_release_sg_pool(struct Scsi_Host *);
 
 /*
  * Prototypes for functions in scsi_merge.c
@@ -465,6 +469,8 @@ extern void initialize_merge_fn(Scsi_Device * SDpnt);
  * Prototypes for functions in scsi_queue.c
  */
 extern int scsi_mlqueue_insert(Scsi_Cmnd * cmd, int reason);
+extern void scsi_track_queue_full(Scsi_Device * SDpnt);
+extern void scsi_track_queue_good(Scsi_Device * SDpnt);
 
 /*
  * Prototypes for functions in scsi_lib.c
@@ -488,6 +494,7 @@ extern int scsi_dispatch_cmd(Scsi_Cmnd * SCpnt);
 extern void scsi_bottom_half_handler(void);
 extern void scsi_release_commandblocks(Scsi_Device * SDpnt);
 extern void scsi_build_commandblocks(Scsi_Device * SDpnt);
+extern int scsi_adjust_queue_depth(Scsi_Device * SDpnt, int depth);
 extern void scsi_done(Scsi_Cmnd * SCpnt);
 extern void scsi_finish_command(Scsi_Cmnd *);
 extern int scsi_retry_command(Scsi_Cmnd *);
@@ -564,6 +571,10 @@ struct scsi_device {
 	request_queue_t request_queue;
         atomic_t                device_active; /* commands checked out for device */
 	volatile unsigned short device_busy;	/* commands actually active on low-level */
+	unsigned char queue_limit;	/* commands let through now, lowered
+					   on QUEUE FULL (scsi_queue.c) */
+	unsigned short queue_good;	/* completions at queue_limit since
+					   it last changed */
 	int (*scsi_init_io_fn) (Scsi_Cmnd *);	/* Used to initialize
 						   new request */
 	Scsi_Cmnd *device_queue;	/* queue of SCSI Command structures */
@@ -167,6 +167,166 @@ int scsi_free(void *obj, unsigned int len)
 	panic("scsi_free:Bad offset");
 }
 
+/*
+ * Hosts whose sg_tablesize gives a scatter-gather table larger than a
+ * page cannot get one from scsi_malloc().  They get a private pool of
+ * tables, one for each command their disks and cdroms can have
+ * outstanding, so that we never have to go to the system allocator
+ * for them in the I/O path either.  The free tables are chained
+ * through their first word.
+ */
+static spinlock_t sg_pool_lock = SPIN_LOCK_UNLOCKED;
+
+static inline unsigned int scsi_sg_table_size(struct Scsi_Host *host)
+{
+	return (host->sg_tablesize * sizeof(struct scatterlist) + 511) & ~511;
+}
+
+/*
+ * Function:    scsi_alloc_sgtable
+ *
+ * Purpose:     Allocate a scatter-gather table for a command on a host.
+ *
+ * Arguments:   host      - host the command is for.
+ *              len       - size of the table, a multiple of 512.
+ *
+ * Lock status: No locks assumed to be held.  This function is SMP-safe.
+ *
+ * Returns:     Pointer to the table, or NULL if none is free.
+ *
+ * Notes:       Tables of up to a page come from scsi_malloc(), larger
+ *              ones from the host's sg pool.
+ */
+void *scsi_alloc_sgtable(struct Scsi_Host *host, unsigned int len)
+{
+	unsigned long flags;
+	void **table;
+
+	if (len <= PAGE_SIZE)
+		return scsi_malloc(len);
+	if (len > (PAGE_SIZE << host->sg_pool_order))
+		return NULL;
+
+	spin_lock_irqsave(&sg_pool_lock, flags);
+	table = host->sg_pool;
+	if (table)
+		host->sg_pool = *table;
+	spin_unlock_irqrestore(&sg_pool_lock, flags);
+	return table;
+}
+
+/*
+ * Function:    scsi_free_sgtable
+ *
+ * Purpose:     Free a table obtained from scsi_alloc_sgtable().
+ *
+ * Arguments:   host      - host the table was allocated for.
+ *              table     - the table.
+ *              len       - size passed to scsi_alloc_sgtable().
+ *
+ * Lock status: No locks assumed to be held.  This function is SMP-safe.
+ *
+ * Returns:     Nothing
+ */
+int scsi_free_sgtable(struct Scsi_Host *host, void *table, unsigned int len)
+{
+	unsigned long flags;
+
+	if (len <= PAGE_SIZE)
+		return scsi_free(table, len);
+
+	spin_lock_irqsave(&sg_pool_lock, flags);
+	*(void **) table = host->sg_pool;
+	host->sg_pool = table;
+	spin_unlock_irqrestore(&sg_pool_lock, flags);
+	return 0;
+}
+
+/*
+ * Function:    scsi_grow_sg_pool
+ *
+ * Purpose:     Make sure a host has a large scatter-gather table for
+ *              every command its devices can queue.
+ *
+ * Arguments:   host      - host to size the pool for.
+ *
+ * Lock status: No locks assumed to be held.  This function is SMP-safe.
+ *
+ * Returns:     Nothing
+ *
+ * Notes:       Like the DMA pool, the sg pool is never shrunk while the
+ *              host is registered.  If we run out of memory the host
+ *              just keeps the tables it has; __init_io() falls back to
+ *              a single segment when none are free.
+ */
+static void scsi_grow_sg_pool(struct Scsi_Host *host)
+{
+	Scsi_Device *SDpnt;
+	unsigned int want = 0;
+	unsigned long flags;
+	void **table;
+	int gfp_mask = GFP_ATOMIC;
+
+	if (scsi_sg_table_size(host) <= PAGE_SIZE)
+		return;
+
+	for (SDpnt = host->host_queue; SDpnt; SDpnt = SDpnt->next)
+		if (SDpnt->type == TYPE_WORM || SDpnt->type == TYPE_ROM ||
+		    SDpnt->type == TYPE_DISK || SDpnt->type == TYPE_MOD)
+			want += SDpnt->queue_depth;
+
+	if (host->unchecked_isa_dma)
+		gfp_mask |= GFP_DMA;
+	host->sg_pool_order = get_order(scsi_sg_table_size(host));
+
+	while (host->sg_pool_tables < want) {
+		table = (void **) __get_free_pages(gfp_mask, host->sg_pool_order);
+		if (!table) {
+			printk("scsi%d: WARNING, only %u of %u scatter-gather "
+			       "tables allocated\n", host->host_no,
+			       host->sg_pool_tables, want);
+			break;
+		}
+		spin_lock_irqsave(&sg_pool_lock, flags);
+		*table = host->sg_pool;
+		host->sg_pool = table;
+		host->sg_pool_tables++;
+		spin_unlock_irqrestore(&sg_pool_lock, flags);
+	}
+}
+
+/*
+ * Function:    scsi_release_sg_pool
+ *
+ * Purpose:     Free a host's scatter-gather table pool.
+ *
+ * Arguments:   host      - host being unregistered.
+ *
+ * Lock status: No locks assumed to be held.  This function is SMP-safe.
+ *
+ * Returns:     Nothing
+ *
+ * Notes:       All of the host's commands must have completed.
+ */
+void scsi_release_sg_pool(struct Scsi_Host *host)
+{
+	unsigned long flags;
+	unsigned int freed = 0;
+	void **table;
+
+	spin_lock_irqsave(&sg_pool_lock, flags);
+	while ((table = host->sg_pool) != NULL) {
+		host->sg_pool = *table;
+		free_pages((unsigned long) table, host->sg_pool_order);
+		freed++;
+	}
+	spin_unlock_irqrestore(&sg_pool_lock, flags);
+
+	if (freed != host->sg_pool_tables)
+		panic("SCSI sg pool memory leak %u %u\n", freed,
+		      host->sg_pool_tables);
+	host->sg_pool_tables = 0;
+}
 
 /*
  * Function:    scsi_resize_dma_pool
@@ -199,6 +359,9 @@ void scsi_resize_dma_pool(void)
 	unsigned char **new_dma_malloc_pages = NULL;
 	int out_of_space = 0;
 
+	for (host = scsi_hostlist; host; host = host->next)
+		scsi_grow_sg_pool(host);
+
 	spin_lock_irqsave(&allocator_request_lock, flags);
 
 	if (!scsi_hostlist) {
@@ -253,9 +416,20 @@ void scsi_resize_dma_pool(void)
 				   which handle very few sg entries.  */
 				if (nents < 64) nents = 64;
 #endif
-				new_dma_sectors += ((nents *
-				sizeof(struct scatterlist) + 511) >> 9) *
-				 SDpnt->queue_depth;
+				/*
+				 * Tables bigger than a page come out of the
+				 * host's sg pool, unless we could not get
+				 * one, in which case __init_io() makes do
+				 * with a page.
+				 */
+				if (nents * sizeof(struct scatterlist) > PAGE_SIZE) {
+					if (!host->sg_pool_tables)
+						new_dma_sectors += SECTORS_PER_PAGE *
+						    SDpnt->queue_depth;
+				} else
+					new_dma_sectors += ((nents *
+					sizeof(struct scatterlist) + 511) >> 9) *
+					 SDpnt->queue_depth;
 				if (SDpnt->type == TYPE_WORM || SDpnt->type == TYPE_ROM)
 					new_dma_sectors += (2048 >> 9) * SDpnt->queue_depth;
 			} else if (SDpnt->type == TYPE_SCANNER ||
@@ -76,7 +76,7 @@ int scsi_insert_special_cmd(Scsi_Cmnd * SCpnt, int at_head)
 	unsigned long flags;
 	request_queue_t *q;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 	/*
 	 * The SCpnt already contains a request structure - we will doctor the
@@ -96,7 +96,7 @@ int scsi_insert_special_cmd(Scsi_Cmnd * SCpnt, int at_head)
 	 * head of the queue for things like a QUEUE_FULL message from a
 	 * device, or a host that is unable to accept a particular command.
 	 */
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(q->queue_lock, flags);
 
 	if (at_head) {
 		list_add(&SCpnt->request.queue, &q->queue_head);
@@ -118,7 +118,7 @@ int scsi_insert_special_cmd(Scsi_Cmnd * SCpnt, int at_head)
 	 * the host can queue it, then send it off.  
 	 */
 	q->request_fn(q);
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(q->queue_lock, flags);
 	return 0;
 }
 
@@ -147,7 +147,7 @@ int scsi_insert_special_req(Scsi_Request * SRpnt, int at_head)
 	unsigned long flags;
 	request_queue_t *q;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SRpnt->sr_host->host_lock, 0);
 
 	/*
 	 * The SCpnt already contains a request structure - we will doctor the
@@ -166,7 +166,7 @@ int scsi_insert_special_req(Scsi_Request * SRpnt, int at_head)
 	 * head of the queue for things like a QUEUE_FULL message from a
 	 * device, or a host that is unable to accept a particular command.
 	 */
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(q->queue_lock, flags);
 
 	if (at_head) {
 		list_add(&SRpnt->sr_request.queue, &q->queue_head);
@@ -188,7 +188,7 @@ int scsi_insert_special_req(Scsi_Request * SRpnt, int at_head)
 	 * the host can queue it, then send it off.  
 	 */
 	q->request_fn(q);
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(q->queue_lock, flags);
 	return 0;
 }
 
@@ -207,7 +207,7 @@ int scsi_insert_special_req(Scsi_Request * SRpnt, int at_head)
  */
 int scsi_init_cmd_errh(Scsi_Cmnd * SCpnt)
 {
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 	SCpnt->owner = SCSI_OWNER_MIDLEVEL;
 	SCpnt->reset_chain = NULL;
@@ -290,9 +290,9 @@ void scsi_queue_next_request(request_queue_t * q, Scsi_Cmnd * SCpnt)
 	Scsi_Device *SDpnt;
 	struct Scsi_Host *SHpnt;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(q->queue_lock, 0);
 
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(q->queue_lock, flags);
 	if (SCpnt != NULL) {
 
 		/*
@@ -368,7 +368,7 @@ void scsi_queue_next_request(request_queue_t * q, Scsi_Cmnd * SCpnt)
 			SHpnt->some_device_starved = 0;
 		}
 	}
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(q->queue_lock, flags);
 }
 
 /*
@@ -403,8 +403,9 @@ static Scsi_Cmnd *__scsi_end_request(Scsi_Cmnd * SCpnt,
 	struct request *req;
 	struct buffer_head *bh;
         Scsi_Device * SDpnt;
+	unsigned long flags;
 
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 	req = &SCpnt->request;
 	req->errors = 0;
@@ -462,6 +463,14 @@ static Scsi_Cmnd *__scsi_end_request(Scsi_Cmnd * SCpnt,
 	}
 	add_blkdev_randomness(MAJOR(req->rq_dev));
 
+	/*
+	 * The block layer let go of this request when we dispatched it,
+	 * so the disk statistics are ours to close out.
+	 */
+	spin_lock_irqsave(SCpnt->host->host_lock, flags);
+	req_finished_io(req);
+	spin_unlock_irqrestore(SCpnt->host->host_lock, flags);
+
         SDpnt = SCpnt->device;
 
 	/*
@@ -523,7 +532,7 @@ Scsi_Cmnd *scsi_end_request(Scsi_Cmnd * SCpnt, int uptodate, int sectors)
  */
 static void scsi_release_buffers(Scsi_Cmnd * SCpnt)
 {
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 	/*
 	 * Free up any indirection buffers we allocated for DMA purposes. 
@@ -539,7 +548,8 @@ static void scsi_release_buffers(Scsi_Cmnd * SCpnt)
 				scsi_free(sgpnt[i].address, sgpnt[i].length);
 			}
 		}
-		scsi_free(SCpnt->request_buffer, SCpnt->sglist_len);
+		scsi_free_sgtable(SCpnt->host, SCpnt->request_buffer,
+				  SCpnt->sglist_len);
 	} else {
 		if (SCpnt->request_buffer != SCpnt->request.buffer) {
 			scsi_free(SCpnt->request_buffer, SCpnt->request_bufflen);
@@ -593,7 +603,7 @@ void scsi_io_completion(Scsi_Cmnd * SCpnt, int good_sectors,
 	 *	would be used if we just wanted to retry, for example.
 	 *
 	 */
-	ASSERT_LOCK(&io_request_lock, 0);
+	ASSERT_LOCK(SCpnt->host->host_lock, 0);
 
 	/*
 	 * Free up any indirection buffers we allocated for DMA purposes. 
@@ -616,7 +626,7 @@ void scsi_io_completion(Scsi_Cmnd * SCpnt, int good_sectors,
 				scsi_free(sgpnt[i].address, sgpnt[i].length);
 			}
 		}
-		scsi_free(SCpnt->buffer, SCpnt->sglist_len);
+		scsi_free_sgtable(SCpnt->host, SCpnt->buffer, SCpnt->sglist_len);
 	} else {
 		if (SCpnt->buffer != SCpnt->request.buffer) {
 			if (SCpnt->request.cmd == READ) {
@@ -781,8 +791,8 @@ void scsi_io_completion(Scsi_Cmnd * SCpnt, int good_sectors,
  *
  * Arguments:   request   - I/O request we are preparing to queue.
  *
- * Lock status: No locks assumed to be held, but as it happens the
- *              io_request_lock is held when this is called.
+ * Lock status: No locks assumed to be held.  It is called both with
+ *              and without the queue lock, so there is nothing to assert.
  *
  * Returns:     Nothing
  *
@@ -796,8 +806,6 @@ struct Scsi_Device_Template *scsi_get_request_dev(struct request *req)
 	kdev_t dev = req->rq_dev;
 	int major = MAJOR(dev);
 
-	ASSERT_LOCK(&io_request_lock, 1);
-
 	for (spnt = scsi_devicelist; spnt; spnt = spnt->next) {
 		/*
 		 * Search for a block device driver that supports this
@@ -835,7 +843,7 @@ struct Scsi_Device_Template *scsi_get_request_dev(struct request *req)
  *
  * Returns:     Nothing
  *
- * Lock status: IO request lock assumed to be held when called.
+ * Lock status: Queue lock (the host lock) assumed to be held when called.
  *
  * Notes:       The theory is that this function is something which individual
  *              drivers could also supply if they wished to.   The problem
@@ -853,8 +861,9 @@ void scsi_request_fn(request_queue_t * q)
 	Scsi_Device *SDpnt;
 	struct Scsi_Host *SHpnt;
 	struct Scsi_Device_Template *STpnt;
+	unsigned int sectors;
 
-	ASSERT_LOCK(&io_request_lock, 1);
+	ASSERT_LOCK(q->queue_lock, 1);
 
 	SDpnt = (Scsi_Device *) q->queuedata;
 	if (!SDpnt) {
@@ -892,6 +901,13 @@ void scsi_request_fn(request_queue_t * q)
 		if (SDpnt->device_blocked) {
 			break;
 		}
+		/*
+		 * Nor more than it has recently shown it can take; see
+		 * scsi_track_queue_full().
+		 */
+		if (SDpnt->queue_limit && SDpnt->device_busy >= SDpnt->queue_limit) {
+			break;
+		}
 		if ((SHpnt->can_queue > 0 && (SHpnt->host_busy >= SHpnt->can_queue))
 		    || (SHpnt->host_blocked) 
 		    || (SHpnt->host_self_blocked)) {
@@ -931,9 +947,9 @@ void scsi_request_fn(request_queue_t * q)
 			 */
 			SDpnt->was_reset = 0;
 			if (SDpnt->removable && !in_interrupt()) {
-				spin_unlock_irq(&io_request_lock);
+				spin_unlock_irq(q->queue_lock);
 				scsi_ioctl(SDpnt, SCSI_IOCTL_DOORLOCK, 0);
-				spin_lock_irq(&io_request_lock);
+				spin_lock_irq(q->queue_lock);
 				continue;
 			}
 		}
@@ -1041,8 +1057,9 @@ void scsi_request_fn(request_queue_t * q)
 		 * another.  
 		 */
 		req = NULL;
-		spin_unlock_irq(&io_request_lock);
+		spin_unlock_irq(q->queue_lock);
 
+		sectors = 0;
 		if (SCpnt->request.cmd != SPECIAL) {
 			/*
 			 * This will do a couple of things:
@@ -1069,7 +1086,7 @@ void scsi_request_fn(request_queue_t * q)
 				{
 					panic("Should not have leftover blocks\n");
 				}
-				spin_lock_irq(&io_request_lock);
+				spin_lock_irq(q->queue_lock);
 				SHpnt->host_busy--;
 				SDpnt->device_busy--;
 				continue;
@@ -1085,11 +1102,12 @@ void scsi_request_fn(request_queue_t * q)
 				{
 					panic("Should not have leftover blocks\n");
 				}
-				spin_lock_irq(&io_request_lock);
+				spin_lock_irq(q->queue_lock);
 				SHpnt->host_busy--;
 				SDpnt->device_busy--;
 				continue;
 			}
+			sectors = SCpnt->request_bufflen >> 9;
 		}
 		/*
 		 * Finally, initialize any error handling parameters, and set up
@@ -1106,7 +1124,12 @@ void scsi_request_fn(request_queue_t * q)
 		 * Now we need to grab the lock again.  We are about to mess with
 		 * the request queue and try to find another command.
 		 */
-		spin_lock_irq(&io_request_lock);
+		spin_lock_irq(q->queue_lock);
+
+		if (sectors) {
+			SHpnt->io_commands++;
+			SHpnt->io_sectors += sectors;
+		}
 	}
 }
 
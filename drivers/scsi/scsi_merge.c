@@ -159,6 +159,16 @@ static void dma_exhausted(Scsi_Cmnd * SCpnt, int i)
 #define CLUSTERABLE_DEVICE(SH,SD) (SH->use_clustering && \
 				   SD->type != TYPE_MOD)
 
+/*
+ * The most segments __init_io() can build a scatter-gather table for.
+ * Tables of up to a page come from scsi_malloc(); hosts with a larger
+ * sg_tablesize have a pool of bigger tables (see scsi_dma.c) and are
+ * only limited by the host itself.  The max_segments the block layer
+ * passes in is its generic default, so this replaces it.
+ */
+#define SCSI_MAX_SEGMENTS(SH) ((SH)->sg_pool_tables ? (SH)->sg_tablesize : \
+			       (int) (PAGE_SIZE / sizeof(struct scatterlist)))
+
 /*
  * This entire source file deals with the new queueing code.
  */
@@ -317,8 +327,8 @@ static inline int scsi_new_mergeable(request_queue_t * q,
 	 * pci_map_sg will be able to merge these two
 	 * into a single hardware sg entry, check if
 	 * we'll have enough memory for the sg list.
-	 * scsi.c allocates for this purpose
-	 * min(64,sg_tablesize) entries.
+	 * __init_io allocates for this purpose
+	 * SCSI_MAX_SEGMENTS entries.
 	 */
 	if (req->nr_segments >= max_segments ||
 	    req->nr_segments >= SHpnt->sg_tablesize)
@@ -385,7 +395,7 @@ static inline int scsi_new_segment(request_queue_t * q,
  * Returns:     1 if it is OK to merge the block into the request.  0
  *              if it is not OK.
  *
- * Lock status: io_request_lock is assumed to be held here.
+ * Lock status: queue lock is assumed to be held here.
  *
  * Notes:       Some drivers have limited scatter-gather table sizes, and
  *              thus they cannot queue an infinitely large command.  This
@@ -417,8 +427,7 @@ __inline static int __scsi_back_merge_fn(request_queue_t * q,
 	SDpnt = (Scsi_Device *) q->queuedata;
 	SHpnt = SDpnt->host;
 
-	if (max_segments > 64)
-		max_segments = 64;
+	max_segments = SCSI_MAX_SEGMENTS(SHpnt);
 
 	if (use_clustering) {
 		/* 
@@ -471,8 +480,7 @@ __inline static int __scsi_front_merge_fn(request_queue_t * q,
 	SDpnt = (Scsi_Device *) q->queuedata;
 	SHpnt = SDpnt->host;
 
-	if (max_segments > 64)
-		max_segments = 64;
+	max_segments = SCSI_MAX_SEGMENTS(SHpnt);
 
 	if (use_clustering) {
 		/* 
@@ -522,7 +530,7 @@ __inline static int __scsi_front_merge_fn(request_queue_t * q,
  * Returns:     1 if it is OK to merge the block into the request.  0
  *              if it is not OK.
  *
- * Lock status: io_request_lock is assumed to be held here.
+ * Lock status: queue lock is assumed to be held here.
  *
  * Notes:       Optimized for different cases depending upon whether
  *              ISA DMA is in use and whether clustering should be used.
@@ -571,7 +579,7 @@ MERGEFCT(scsi_front_merge_fn_dc, front, 1, 1)
  * Returns:     1 if it is OK to merge the two requests.  0
  *              if it is not OK.
  *
- * Lock status: io_request_lock is assumed to be held here.
+ * Lock status: queue lock is assumed to be held here.
  *
  * Notes:       Some drivers have limited scatter-gather table sizes, and
  *              thus they cannot queue an infinitely large command.  This
@@ -601,8 +609,7 @@ __inline static int __scsi_merge_requests_fn(request_queue_t * q,
 	SDpnt = (Scsi_Device *) q->queuedata;
 	SHpnt = SDpnt->host;
 
-	if (max_segments > 64)
-		max_segments = 64;
+	max_segments = SCSI_MAX_SEGMENTS(SHpnt);
 
 #ifdef DMA_CHUNK_SIZE
 	/* If it would not fit into prepared memory space for sg chain,
@@ -722,7 +729,7 @@ __inline static int __scsi_merge_requests_fn(request_queue_t * q,
  * Returns:     1 if it is OK to merge the block into the request.  0
  *              if it is not OK.
  *
- * Lock status: io_request_lock is assumed to be held here.
+ * Lock status: queue lock is assumed to be held here.
  *
  * Notes:       Optimized for different cases depending upon whether
  *              ISA DMA is in use and whether clustering should be used.
@@ -846,12 +853,14 @@ __inline static int __init_io(Scsi_Cmnd * SCpnt,
 
 	/* 
 	 * Allocate the actual scatter-gather table itself.
-	 * scsi_malloc can only allocate in chunks of 512 bytes 
+	 * scsi_malloc can only allocate in chunks of 512 bytes,
+	 * and tables larger than a page come from the host's pool.
 	 */
 	SCpnt->sglist_len = (SCpnt->use_sg
 			     * sizeof(struct scatterlist) + 511) & ~511;
 
-	sgpnt = (struct scatterlist *) scsi_malloc(SCpnt->sglist_len);
+	sgpnt = (struct scatterlist *) scsi_alloc_sgtable(SCpnt->host,
+							   SCpnt->sglist_len);
 
 	/*
 	 * Now fill the scatter-gather table.
@@ -1006,7 +1015,7 @@ __inline static int __init_io(Scsi_Cmnd * SCpnt,
 	 */
 	SCpnt->request_bufflen = 0;
 	SCpnt->use_sg = 0;
-	scsi_free(SCpnt->request_buffer, SCpnt->sglist_len);
+	scsi_free_sgtable(SCpnt->host, SCpnt->request_buffer, SCpnt->sglist_len);
 
 	/*
 	 * Make an attempt to pick up as much as we reasonably can.
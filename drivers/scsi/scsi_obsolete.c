@@ -147,7 +147,7 @@ void scsi_old_times_out(Scsi_Cmnd * SCpnt)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(SCpnt->host->host_lock, flags);
 
 	/* Set the serial_number_at_timeout to the current serial_number */
 	SCpnt->serial_number_at_timeout = SCpnt->serial_number;
@@ -202,14 +202,14 @@ void scsi_old_times_out(Scsi_Cmnd * SCpnt)
 		break;
 
 	}
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(SCpnt->host->host_lock, flags);
 
 }
 
 /*
  *  From what I can find in scsi_obsolete.c, this function is only called
  *  by scsi_old_done and scsi_reset.  Both of these functions run with the
- *  io_request_lock already held, so we need do nothing here about grabbing
+ *  host lock already held, so we need do nothing here about grabbing
  *  any locks.
  */
 static void scsi_request_sense(Scsi_Cmnd * SCpnt)
@@ -237,9 +237,9 @@ static void scsi_request_sense(Scsi_Cmnd * SCpnt)
          * Ugly, ugly.  The newer interfaces all assume that the lock
          * isn't held.  Mustn't disappoint, or we deadlock the system.
          */
-        spin_unlock_irq(&io_request_lock);
+        spin_unlock_irq(SCpnt->host->host_lock);
 	scsi_dispatch_cmd(SCpnt);
-        spin_lock_irq(&io_request_lock);
+        spin_lock_irq(SCpnt->host->host_lock);
 }
 
 
@@ -645,9 +645,9 @@ void scsi_old_done(Scsi_Cmnd * SCpnt)
                          * assume that the lock isn't held.  Mustn't
                          * disappoint, or we deadlock the system.  
                          */
-                        spin_unlock_irq(&io_request_lock);
+                        spin_unlock_irq(SCpnt->host->host_lock);
 			scsi_dispatch_cmd(SCpnt);
-                        spin_lock_irq(&io_request_lock);
+                        spin_lock_irq(SCpnt->host->host_lock);
 		}
 		break;
 	default:
@@ -673,7 +673,7 @@ void scsi_old_done(Scsi_Cmnd * SCpnt)
                  * use, the upper code is run from a bottom half handler, so
                  * it isn't an issue.
                  */
-                spin_unlock_irq(&io_request_lock);
+                spin_unlock_irq(SCpnt->host->host_lock);
 		SRpnt = SCpnt->sc_request;
 		if( SRpnt != NULL ) {
 			SRpnt->sr_result = SRpnt->sr_command->result;
@@ -685,7 +685,7 @@ void scsi_old_done(Scsi_Cmnd * SCpnt)
 		}
 
 		SCpnt->done(SCpnt);
-                spin_lock_irq(&io_request_lock);
+                spin_lock_irq(SCpnt->host->host_lock);
 	}
 #undef CMD_FINISHED
 #undef REDO
@@ -724,10 +724,10 @@ static int scsi_abort(Scsi_Cmnd * SCpnt, int why)
 			return 0;
 		}
 		if (SCpnt->internal_timeout & IN_ABORT) {
-			spin_unlock_irq(&io_request_lock);
+			spin_unlock_irq(SCpnt->host->host_lock);
 			while (SCpnt->internal_timeout & IN_ABORT)
 				barrier();
-			spin_lock_irq(&io_request_lock);
+			spin_lock_irq(SCpnt->host->host_lock);
 		} else {
 			SCpnt->internal_timeout |= IN_ABORT;
 			oldto = update_timeout(SCpnt, ABORT_TIMEOUT);
@@ -907,10 +907,10 @@ static int scsi_reset(Scsi_Cmnd * SCpnt, unsigned int reset_flags)
 				return 0;
 			}
 		if (SCpnt->internal_timeout & IN_RESET) {
-			spin_unlock_irq(&io_request_lock);
+			spin_unlock_irq(SCpnt->host->host_lock);
 			while (SCpnt->internal_timeout & IN_RESET)
 				barrier();
-			spin_lock_irq(&io_request_lock);
+			spin_lock_irq(SCpnt->host->host_lock);
 		} else {
 			SCpnt->internal_timeout |= IN_RESET;
 			update_timeout(SCpnt, RESET_TIMEOUT);
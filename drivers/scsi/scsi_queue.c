@@ -137,10 +137,10 @@ int scsi_mlqueue_insert(Scsi_Cmnd * cmd, int reason)
 	 * Decrement the counters, since these commands are no longer
 	 * active on the host/device.
 	 */
-	spin_lock_irqsave(&io_request_lock, flags);
+	spin_lock_irqsave(cmd->host->host_lock, flags);
 	cmd->host->host_busy--;
 	cmd->device->device_busy--;
-	spin_unlock_irqrestore(&io_request_lock, flags);
+	spin_unlock_irqrestore(cmd->host->host_lock, flags);
 
 	/*
 	 * Insert this command at the head of the queue for it's device.
@@ -149,3 +149,75 @@ int scsi_mlqueue_insert(Scsi_Cmnd * cmd, int reason)
 	scsi_insert_special_cmd(cmd, 1);
 	return 0;
 }
+
+/*
+ * Number of commands which have to complete with the device at its
+ * throttled depth before we let it have one more.
+ */
+#define QUEUE_RAMP_UP	128
+
+/*
+ * Function:    scsi_track_queue_full()
+ *
+ * Purpose:     Throttle a device which returned QUEUE FULL.
+ *
+ * Arguments:   SDpnt   - device which refused a command.
+ *
+ * Returns:     Nothing
+ *
+ * Notes:       The device evidently holds no more than the commands it
+ *              still has outstanding, so that becomes its limit until
+ *              scsi_track_queue_good() raises it again.  This lets
+ *              scsi_request_fn() throttle every host, rather than each
+ *              low-level driver doing it on its own.
+ */
+void scsi_track_queue_full(Scsi_Device * SDpnt)
+{
+	struct Scsi_Host *host = SDpnt->host;
+	unsigned long flags;
+	int depth;
+
+	spin_lock_irqsave(host->host_lock, flags);
+	/* device_busy still counts the command which was refused */
+	depth = SDpnt->device_busy - 1;
+	if (depth < 1)
+		depth = 1;
+	SDpnt->queue_good = 0;
+	if (depth >= SDpnt->queue_limit) {
+		spin_unlock_irqrestore(host->host_lock, flags);
+		return;
+	}
+	SDpnt->queue_limit = depth;
+	spin_unlock_irqrestore(host->host_lock, flags);
+
+	printk(KERN_INFO "scsi%d (%d:%d:%d): QUEUE FULL, queue depth throttled to %d\n",
+	       host->host_no, SDpnt->channel, SDpnt->id, SDpnt->lun, depth);
+}
+
+/*
+ * Function:    scsi_track_queue_good()
+ *
+ * Purpose:     Let a throttled device have its queue depth back bit by bit.
+ *
+ * Arguments:   SDpnt   - device which completed a command.
+ *
+ * Returns:     Nothing
+ *
+ * Notes:       Only completions while the device is kept at its limit
+ *              count; a lightly loaded device tells us nothing about
+ *              whether it could take more.
+ */
+void scsi_track_queue_good(Scsi_Device * SDpnt)
+{
+	struct Scsi_Host *host = SDpnt->host;
+	unsigned long flags;
+
+	spin_lock_irqsave(host->host_lock, flags);
+	if (SDpnt->queue_limit < SDpnt->queue_depth
+	    && SDpnt->device_busy >= SDpnt->queue_limit
+	    && ++SDpnt->queue_good >= QUEUE_RAMP_UP) {
+		SDpnt->queue_limit++;
+		SDpnt->queue_good = 0;
+	}
+	spin_unlock_irqrestore(host->host_lock, flags);
+}
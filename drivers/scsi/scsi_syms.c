@@ -35,11 +35,14 @@ EXPORT_SYMBOL(scsi_register_module);
 EXPORT_SYMBOL(scsi_unregister_module);
 EXPORT_SYMBOL(scsi_free);
 EXPORT_SYMBOL(scsi_malloc);
+EXPORT_SYMBOL(scsi_alloc_sgtable);
+EXPORT_SYMBOL(scsi_free_sgtable);
 EXPORT_SYMBOL(scsi_register);
 EXPORT_SYMBOL(scsi_unregister);
 EXPORT_SYMBOL(scsicam_bios_param);
 EXPORT_SYMBOL(scsi_partsize);
 EXPORT_SYMBOL(scsi_allocate_device);
+EXPORT_SYMBOL(scsi_adjust_queue_depth);
 EXPORT_SYMBOL(scsi_do_cmd);
 EXPORT_SYMBOL(scsi_command_size);
 EXPORT_SYMBOL(scsi_ioctl);
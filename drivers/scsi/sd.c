@@ -84,6 +84,7 @@ static Scsi_Disk *rscsi_disks;
 static int *sd_sizes;
 static int *sd_blocksizes;
 static int *sd_hardsizes;	/* Hardware sector size */
+static int *sd_max_sectors;	/* Largest request the host takes */
 
 static int check_scsidisk_media_change(kdev_t);
 static int fop_revalidate_scsidisk(kdev_t);
@@ -1065,14 +1066,20 @@ static int sd_init()
 	if (!sd_hardsizes)
 		goto cleanup_blocksizes;
 
+	sd_max_sectors = kmalloc((sd_template.dev_max << 4) * sizeof(int), GFP_ATOMIC);
+	if (!sd_max_sectors)
+		goto cleanup_hardsizes;
+
 	for (i = 0; i < sd_template.dev_max << 4; i++) {
 		sd_blocksizes[i] = 1024;
 		sd_hardsizes[i] = 512;
+		sd_max_sectors[i] = MAX_SECTORS;
 	}
 
 	for (i = 0; i < N_USED_SD_MAJORS; i++) {
 		blksize_size[SD_MAJOR(i)] = sd_blocksizes + i * (SCSI_DISKS_PER_MAJOR << 4);
 		hardsect_size[SD_MAJOR(i)] = sd_hardsizes + i * (SCSI_DISKS_PER_MAJOR << 4);
+		max_sectors[SD_MAJOR(i)] = sd_max_sectors + i * (SCSI_DISKS_PER_MAJOR << 4);
 	}
 	sd = kmalloc((sd_template.dev_max << 4) *
 					  sizeof(struct hd_struct),
@@ -1125,6 +1132,8 @@ cleanup_gendisks_de_arr:
 cleanup_sd_gendisks:
 	kfree(sd);
 cleanup_sd:
+	kfree(sd_max_sectors);
+cleanup_hardsizes:
 	kfree(sd_hardsizes);
 cleanup_blocksizes:
 	kfree(sd_blocksizes);
@@ -1202,7 +1211,7 @@ static int sd_attach(Scsi_Device * SDp)
 {
         unsigned int devnum;
 	Scsi_Disk *dpnt;
-	int i;
+	int i, j;
 
 	if (SDp->type != TYPE_DISK && SDp->type != TYPE_MOD)
 		return 0;
@@ -1220,6 +1229,12 @@ static int sd_attach(Scsi_Device * SDp)
 
 	rscsi_disks[i].device = SDp;
 	rscsi_disks[i].has_part_table = 0;
+	/*
+	 * Let requests to this disk grow as large as its host can take.
+	 */
+	for (j = 0; j < 1 << 4; j++)
+		sd_max_sectors[(i << 4) + j] = SDp->host->max_sectors ?
+		    SDp->host->max_sectors : MAX_SECTORS;
 	sd_template.nr_dev++;
 	SD_GENDISK(i).nr_real++;
         devnum = i % SCSI_DISKS_PER_MAJOR;
@@ -1363,6 +1378,7 @@ static void __exit exit_sd(void)
 		kfree(sd_sizes);
 		kfree(sd_blocksizes);
 		kfree(sd_hardsizes);
+		kfree(sd_max_sectors);
 		kfree((char *) sd);
 
 		/*
@@ -1386,6 +1402,7 @@ static void __exit exit_sd(void)
 	for (i = 0; i < N_USED_SD_MAJORS; i++) {
 		blk_size[SD_MAJOR(i)] = NULL;
 		hardsect_size[SD_MAJOR(i)] = NULL;
+		max_sectors[SD_MAJOR(i)] = NULL;
 		read_ahead[SD_MAJOR(i)] = 0;
 	}
 	sd_template.dev_max = 0;
@@ -299,7 +299,7 @@ static int sr_scatter_pad(Scsi_Cmnd *SCpnt, int s_size)
 	}
 
 	SCpnt->sglist_len = ((sg_ent * sizeof(struct scatterlist)) + 511) & ~511;
-	if ((sg = scsi_malloc(SCpnt->sglist_len)) == NULL)
+	if ((sg = scsi_alloc_sgtable(SCpnt->host, SCpnt->sglist_len)) == NULL)
 		goto no_mem;
 
 	memset(sg, 0, SCpnt->sglist_len);
@@ -312,7 +312,8 @@ static int sr_scatter_pad(Scsi_Cmnd *SCpnt, int s_size)
 	}
 	if (old_sg) {
 		memcpy(sg + i, old_sg, SCpnt->use_sg * sizeof(struct scatterlist));
-		scsi_free(old_sg, ((SCpnt->use_sg * sizeof(struct scatterlist)) + 511) & ~511);
+		scsi_free_sgtable(SCpnt->host, old_sg,
+		    ((SCpnt->use_sg * sizeof(struct scatterlist)) + 511) & ~511);
 	} else {
 		sg[i].address = SCpnt->request_buffer;
 		sg[i].length = SCpnt->request_bufflen;
@@ -645,6 +645,10 @@ static int ncr_debug = SCSI_NCR_DEBUG_FLAGS;
 **	  more resistant to bugs or bad changes in the IO sub-system code.
 **	- A small advantage could be that the interrupt code is grained as 
 **	  wished (e.g.: threaded by controller).
+**
+**	Since linux-2.4, each host we register gets a host lock of its own 
+**	instead of 'io_request_lock'. The entry points are called with it 
+**	held and the mid-layer expects it held when we complete commands.
 */
 
 #if LINUX_VERSION_CODE >= LinuxVersionCode(2,1,93)
@@ -658,9 +662,9 @@ spinlock_t sym53c8xx_lock = SPIN_LOCK_UNLOCKED;
 #define	NCR_UNLOCK_NCB(np, flags)  spin_unlock_irqrestore(&np->smp_lock, flags)
 
 #define	NCR_LOCK_SCSI_DONE(np, flags) \
-		spin_lock_irqsave(&io_request_lock, flags)
+		spin_lock_irqsave((np)->host->host_lock, flags)
 #define	NCR_UNLOCK_SCSI_DONE(np, flags) \
-		spin_unlock_irqrestore(&io_request_lock, flags)
+		spin_unlock_irqrestore((np)->host->host_lock, flags)
 
 #else
 
@@ -2283,6 +2287,7 @@ struct ncb {
 					/* callback to be invoked.      */ 
 #if LINUX_VERSION_CODE >= LinuxVersionCode(2,1,93)
 	spinlock_t	smp_lock;	/* Lock for SMP threading       */
+	struct Scsi_Host *host;		/* Its host_lock serializes done() */
 #endif
 
 	/*----------------------------------------------------------------
@@ -5705,6 +5710,10 @@ ncr_attach (Scsi_Host_Template *tpnt, int unit, ncr_device *device)
 	np->pdev  = device->pdev;
 	np->p_ncb = vtobus(np);
 	host_data->ncb = np;
+#if LINUX_VERSION_CODE >= LinuxVersionCode(2,1,93)
+	np->host = instance;
+	instance->host_lock = &instance->default_lock;
+#endif
 
 	/*
 	**	Store input informations in the host data structure.
@@ -198,6 +198,12 @@ static int command_abort( Scsi_Cmnd *srb )
 		return SUCCESS;
 	}
 
+	/* likewise for a queued scatter-gather transfer */
+	if (usb_stor_cancel_sg(us)) {
+		down(&(us->notify));
+		return SUCCESS;
+	}
+
 	US_DEBUGP ("-- nothing to abort\n");
 	return FAILED;
 }
@@ -382,6 +388,7 @@ Scsi_Host_Template usb_stor_host_template = {
 	this_id:		-1,
 
 	sg_tablesize:		SG_ALL,
+	max_sectors:		512,
 	cmd_per_lun:		1,
 	present:		0,
 	unchecked_isa_dma:	FALSE,
@@ -515,6 +515,9 @@ int usb_stor_bulk_msg(struct us_data *us, void *data, int pipe,
  * timeout limit.  Thus we don't have to worry about it for individual
  * packets.
  */
+static int interpret_bulk_result(struct us_data *us, int pipe, int result,
+				 unsigned int partial, unsigned int length);
+
 int usb_stor_transfer_partial(struct us_data *us, char *buf, int length)
 {
 	int result;
@@ -533,6 +536,133 @@ int usb_stor_transfer_partial(struct us_data *us, char *buf, int length)
 	US_DEBUGP("usb_stor_bulk_msg() returned %d xferred %d/%d\n",
 		  result, partial, length);
 
+	return interpret_bulk_result(us, pipe, result, partial, length);
+}
+
+/*
+ * Completion for the URBs of a scatter-gather transfer.  The control
+ * thread is woken when the last one finishes, or at the first error so
+ * that it can cancel the ones still queued behind it.
+ */
+static void usb_stor_sg_completion(urb_t *urb)
+{
+	struct us_data *us = (struct us_data *)urb->context;
+
+	if (urb->status && !us->sg_status)
+		us->sg_status = urb->status;
+	if (atomic_dec_and_test(&us->sg_pending) || urb->status)
+		wake_up(&us->sg_wait);
+}
+
+/* Unlink the scatter-gather URBs, returns how many were submitted */
+int usb_stor_cancel_sg(struct us_data *us)
+{
+	int i, count;
+
+	down(&(us->current_urb_sem));
+	count = us->sg_count;
+	for (i = 0; i < count; i++)
+		usb_unlink_urb(&us->sg_urb[i]);
+	up(&(us->current_urb_sem));
+	return count;
+}
+
+/*
+ * Transfer a scatter-gather list via bulk transfer, with the URBs for up
+ * to US_SG_URBS segments queued on the endpoint at once so that the host
+ * controller goes straight on from one segment to the next.
+ *
+ * All but the final URB of a read treat a short packet as an error, so
+ * that a short transfer ends the data stage instead of letting the next
+ * URB pick up the status.
+ */
+int usb_stor_transfer_sg(struct us_data *us, struct scatterlist *sg,
+			 int use_sg, unsigned int length)
+{
+	unsigned int partial, total, xfer;
+	int i, count, result;
+	int pipe;
+
+	if (us->srb->sc_data_direction == SCSI_DATA_READ)
+		pipe = usb_rcvbulkpipe(us->pusb_dev, us->ep_in);
+	else
+		pipe = usb_sndbulkpipe(us->pusb_dev, us->ep_out);
+
+	while (length) {
+		/* fill the URBs for the next batch of segments */
+		total = 0;
+		for (count = 0; count < US_SG_URBS && count < use_sg && 
+		     total < length; count++) {
+			urb_t *urb = &us->sg_urb[count];
+
+			xfer = sg[count].length;
+			if (xfer > length - total)
+				xfer = length - total;
+			memset(urb, 0, sizeof(*urb));
+			spin_lock_init(&urb->lock);
+			FILL_BULK_URB(urb, us->pusb_dev, pipe, 
+				      sg[count].address, xfer,
+				      usb_stor_sg_completion, us);
+			urb->transfer_flags = USB_QUEUE_BULK | USB_ASYNC_UNLINK;
+			total += xfer;
+			if (usb_pipein(pipe) && total < length)
+				urb->transfer_flags |= USB_DISABLE_SPD;
+		}
+		US_DEBUGP("usb_stor_transfer_sg(): xfer %d bytes in %d URBs\n",
+			  total, count);
+
+		/* queue them all */
+		us->sg_status = 0;
+		atomic_set(&us->sg_pending, count);
+		down(&(us->current_urb_sem));
+		for (i = 0; i < count; i++) {
+			result = usb_submit_urb(&us->sg_urb[i]);
+			if (result) {
+				us->sg_status = result;
+				break;
+			}
+		}
+		us->sg_count = i;
+		up(&(us->current_urb_sem));
+
+		/* wait for them, cancelling the rest after an error */
+		if (i < count)
+			atomic_sub(count - i, &us->sg_pending);
+		wait_event(us->sg_wait, !atomic_read(&us->sg_pending) ||
+			   us->sg_status);
+		if (atomic_read(&us->sg_pending)) {
+			usb_stor_cancel_sg(us);
+			wait_event(us->sg_wait, 
+				   !atomic_read(&us->sg_pending));
+		}
+
+		down(&(us->current_urb_sem));
+		partial = 0;
+		for (i = 0; i < us->sg_count; i++)
+			partial += us->sg_urb[i].actual_length;
+		us->sg_count = 0;
+		up(&(us->current_urb_sem));
+		US_DEBUGP("usb_stor_transfer_sg(): status %d xferred %d/%d\n",
+			  us->sg_status, partial, total);
+
+		result = interpret_bulk_result(us, pipe, us->sg_status, 
+					       partial, total);
+		if (result != US_BULK_TRANSFER_GOOD)
+			return result;
+
+		sg += count;
+		use_sg -= count;
+		length -= total;
+		if (!use_sg)
+			break;
+	}
+	return US_BULK_TRANSFER_GOOD;
+}
+
+/* Turn the outcome of a bulk transfer into a US_BULK_TRANSFER_ code */
+static int interpret_bulk_result(struct us_data *us, int pipe, int result,
+				 unsigned int partial, unsigned int length)
+{
 	/* if we stall, we need to clear it before we go on */
 	if (result == -EPIPE) {
 		US_DEBUGP("clearing endpoint halt for pipe 0x%x\n", pipe);
@@ -554,11 +684,17 @@ int usb_stor_transfer_partial(struct us_data *us, char *buf, int length)
 		}
 
 		/* -ENOENT -- we canceled this transfer */
-		if (result == -ENOENT) {
+		if (result == -ENOENT || result == -ECONNRESET) {
 			US_DEBUGP("usb_stor_transfer_partial(): transfer aborted\n");
 			return US_BULK_TRANSFER_ABORTED;
 		}
 
+		/* -EREMOTEIO -- short packet before the last sg URB */
+		if (result == -EREMOTEIO) {
+			US_DEBUGP("usb_stor_transfer_partial(): short sg segment\n");
+			return US_BULK_TRANSFER_SHORT;
+		}
+
 		/* the catch-all case */
 		US_DEBUGP("usb_stor_transfer_partial(): unknown error\n");
 		return US_BULK_TRANSFER_FAILED;
@@ -573,16 +709,14 @@ int usb_stor_transfer_partial(struct us_data *us, char *buf, int length)
  * Transfer an entire SCSI command's worth of data payload over the bulk
  * pipe.
  *
- * Note that this uses usb_stor_transfer_partial to achieve it's goals -- this
- * function simply determines if we're going to use scatter-gather or not,
- * and acts appropriately.  For now, it also re-interprets the error codes.
+ * Note that this uses usb_stor_transfer_partial or usb_stor_transfer_sg to
+ * achieve it's goals -- this function simply determines if we're going to
+ * use scatter-gather or not, and acts appropriately.
  */
 static void us_transfer(Scsi_Cmnd *srb, struct us_data* us)
 {
-	int i;
 	int result = -1;
 	struct scatterlist *sg;
-	unsigned int total_transferred = 0;
 	unsigned int transfer_amount;
 
 	/* calculate how much we want to transfer */
@@ -596,28 +730,10 @@ static void us_transfer(Scsi_Cmnd *srb, struct us_data* us)
 	/* are we scatter-gathering? */
 	if (srb->use_sg) {
 
-		/* loop over all the scatter gather structures and 
-		 * make the appropriate requests for each, until done
-		 */
+		/* queue the segments and let them run back to back */
 		sg = (struct scatterlist *) srb->request_buffer;
-		for (i = 0; i < srb->use_sg; i++) {
-
-			/* transfer the lesser of the next buffer or the
-			 * remaining data */
-			if (transfer_amount - total_transferred >= 
-					sg[i].length) {
-				result = usb_stor_transfer_partial(us,
-						sg[i].address, sg[i].length);
-				total_transferred += sg[i].length;
-			} else
-				result = usb_stor_transfer_partial(us,
-						sg[i].address,
-						transfer_amount - total_transferred);
-
-			/* if we get an error, end the loop here */
-			if (result)
-				break;
-		}
+		result = usb_stor_transfer_sg(us, sg, srb->use_sg,
+					      transfer_amount);
 	}
 	else
 		/* no scatter-gather, just make the request */
@@ -139,6 +139,9 @@ extern int usb_stor_Bulk_reset(struct us_data*);
 extern unsigned int usb_stor_transfer_length(Scsi_Cmnd*);
 extern void usb_stor_invoke_transport(Scsi_Cmnd*, struct us_data*);
 extern int usb_stor_transfer_partial(struct us_data*, char*, int);
+extern int usb_stor_transfer_sg(struct us_data*, struct scatterlist*, int,
+		unsigned int);
+extern int usb_stor_cancel_sg(struct us_data*);
 extern int usb_stor_bulk_msg(struct us_data*, void*, int, unsigned int,
 		unsigned int*);
 extern int usb_stor_control_msg(struct us_data*, unsigned int, u8, u8,
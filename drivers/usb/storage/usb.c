@@ -180,6 +180,7 @@ static int usb_stor_control_thread(void * __us)
 	init_waitqueue_entry(&wait, current);
 	init_waitqueue_head(&(us->wqh));
 	add_wait_queue(&(us->wqh), &wait);
+	init_waitqueue_head(&(us->sg_wait));
 
 	/* signal that we've started the thread */
 	up(&(us->notify));
@@ -1097,6 +1098,9 @@ static void storage_disconnect(struct usb_device *dev, void *ptr)
 	}
 	up(&(ss->irq_urb_sem));
 
+	/* cancel any scatter-gather URBs; they are part of us_data */
+	usb_stor_cancel_sg(ss);
+
 	/* free up the main URB for this device */
 	US_DEBUGP("-- releasing main URB\n");
 	result = usb_unlink_urb(ss->current_urb);
@@ -109,6 +109,9 @@ struct us_unusual_dev {
 
 #define USB_STOR_STRING_LEN 32
 
+/* bulk URBs queued at once for a scatter-gather data stage */
+#define US_SG_URBS		16
+
 typedef int (*trans_cmnd)(Scsi_Cmnd*, struct us_data*);
 typedef int (*trans_reset)(struct us_data*);
 typedef void (*proto_cmnd)(Scsi_Cmnd*, struct us_data*);
@@ -172,6 +175,13 @@ struct us_data {
 	struct semaphore	current_urb_sem; /* to protect irq_urb	 */
 	struct urb		*current_urb;	 /* non-int USB requests */
 
+	/* scatter-gather data stage -- sg_count is under current_urb_sem */
+	struct urb		sg_urb[US_SG_URBS]; /* one per segment	 */
+	int			sg_count;	 /* URBs submitted	 */
+	atomic_t		sg_pending;	 /* not completed yet	 */
+	int			sg_status;	 /* first error		 */
+	wait_queue_head_t	sg_wait;	 /* for sg_pending	 */
+
 	/* the waitqueue for sleeping the control thread */
 	wait_queue_head_t	wqh;		 /* to sleep thread on   */
 
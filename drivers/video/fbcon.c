@@ -122,6 +122,24 @@ static unsigned long softback_in;
 static unsigned long softback_top, softback_end;
 static int softback_lines;
 
+/*
+ * Deferred drawing: while fbcon_defer (milliseconds) is non-zero the
+ * drawing operations of the foreground console only note that the
+ * screen is out of date, and defer_timer brings it up to date from
+ * the screen buffer.  defer_shadow holds the characters that are on
+ * the screen, so that only cells that changed get drawn; a burst of
+ * whole-screen scrolls is done as one hardware scroll first, where
+ * the driver can pan, wrap or blit.
+ */
+int fbcon_defer = 20;
+static int defer_unit = -1;		/* display with pending updates */
+static int defer_scroll;		/* lines scrolled up since the flush */
+static int defer_flushing;
+static int defer_valid;			/* defer_shadow matches the screen */
+static unsigned short *defer_shadow;
+static int defer_rows, defer_cols;
+static int hw_cursor_mode;		/* last mode given to dispsw->cursor */
+
 #define REFCOUNT(fd)	(((int *)(fd))[-1])
 #define FNTSIZE(fd)	(((int *)(fd))[-2])
 #define FNTCHARCNT(fd)	(((int *)(fd))[-3])
@@ -211,6 +229,9 @@ static __inline__ void ypan_down(int unit, struct vc_data *conp,
 				 struct display *p, int count);
 static void fbcon_bmove_rec(struct display *p, int sy, int sx, int dy, int dx,
 			    int height, int width, u_int y_break);
+static int fbcon_deferred(struct vc_data *conp);
+static void fbcon_defer_mark(struct vc_data *conp);
+static void fbcon_defer_reset(void);
 
 static int fbcon_show_logo(void);
 
@@ -460,6 +481,8 @@ static void fbcon_deinit(struct vc_data *conp)
     int unit = conp->vc_num;
     struct display *p = &fb_display[unit];
 
+    if (unit == defer_unit)
+	fbcon_defer_reset();
     fbcon_free_font(p);
     p->dispsw = &fbcon_dummy;
     p->conp = 0;
@@ -523,6 +546,8 @@ static void fbcon_setup(int con, int init, int logo)
     	logo = 0;
 
     p->var.xoffset = p->var.yoffset = p->yscroll = 0;  /* reset wrap/pan */
+    if (con == fg_console)
+	fbcon_defer_reset();
 
     if (con == fg_console && p->type != FB_TYPE_TEXT) {   
 	if (fbcon_softback_size) {
@@ -764,6 +789,11 @@ static void fbcon_clear(struct vc_data *conp, int sy, int sx, int height,
     if (!height || !width)
 	return;
 
+    if (fbcon_deferred(conp)) {
+	fbcon_defer_mark(conp);
+	return;
+    }
+
     if ((sy <= p->cursor_y) && (p->cursor_y < sy+height) &&
 	(sx <= p->cursor_x) && (p->cursor_x < sx+width)) {
 	cursor_undrawn();
@@ -797,6 +827,11 @@ static void fbcon_putc(struct vc_data *conp, int c, int ypos, int xpos)
     if (vt_cons[unit]->vc_mode != KD_TEXT)
     	    return;
 
+    if (fbcon_deferred(conp)) {
+	    fbcon_defer_mark(conp);
+	    return;
+    }
+
     if ((p->cursor_x == xpos) && (p->cursor_y == ypos)) {
 	    cursor_undrawn();
 	    redraw_cursor = 1;
@@ -822,6 +857,11 @@ static void fbcon_putcs(struct vc_data *conp, const unsigned short *s, int count
     if (vt_cons[unit]->vc_mode != KD_TEXT)
     	    return;
 
+    if (fbcon_deferred(conp)) {
+	    fbcon_defer_mark(conp);
+	    return;
+    }
+
     if ((p->cursor_y == ypos) && (xpos <= p->cursor_x) &&
 	(p->cursor_x < (xpos + count))) {
 	    cursor_undrawn();
@@ -854,6 +894,7 @@ static void fbcon_cursor(struct vc_data *conp, int mode)
     if (p->dispsw->cursor) {
 	p->cursor_x = conp->vc_x;
 	p->cursor_y = y;
+	hw_cursor_mode = mode;
 	p->dispsw->cursor(p, mode, p->cursor_x, real_y(p, p->cursor_y));
 	return;
     }
@@ -982,6 +1023,175 @@ static __inline__ void ypan_down(int unit, struct vc_data *conp,
     scrollback_current = 0;
 }
 
+static void defer_timer_handler(unsigned long dummy);
+
+static struct timer_list defer_timer = {
+    function: defer_timer_handler
+};
+
+/* Forget what is pending and what is on the screen */
+static void fbcon_defer_reset(void)
+{
+    defer_unit = -1;
+    defer_scroll = 0;
+    defer_valid = 0;
+}
+
+/*
+ * Move the picture up by the lines scrolled since the last flush, if
+ * the hardware can do that cheaply, and the shadow with it.
+ */
+static void fbcon_defer_scroll(int unit, struct vc_data *conp,
+			       struct display *p, int count)
+{
+    int rows = conp->vc_rows, cols = conp->vc_cols, i;
+
+    if (!defer_valid || count >= rows || logo_shown == unit)
+	return;
+
+    switch (p->scrollmode & __SCROLL_YMASK) {
+    case __SCROLL_YMOVE:
+	p->dispsw->bmove(p, count, 0, 0, 0, rows-count, cols);
+	p->dispsw->clear(conp, p, rows-count, 0, count, cols);
+	break;
+    case __SCROLL_YWRAP:
+	ywrap_up(unit, conp, p, count);
+	fbcon_clear(conp, rows-count, 0, count, cols);
+	break;
+    case __SCROLL_YPAN:
+	if (p->yscroll + count > 2 * (p->vrows - rows))
+	    return;
+	ypan_up(unit, conp, p, count);
+	fbcon_clear(conp, rows-count, 0, count, cols);
+	break;
+    default:
+	return;
+    }
+
+    memmove(defer_shadow, defer_shadow + count*cols,
+	    (rows-count) * cols * sizeof(unsigned short));
+    for (i = (rows-count) * cols; i < rows * cols; i++)
+	defer_shadow[i] = conp->vc_video_erase_char;
+}
+
+/* Draw the cells of row y that differ from the shadow, in runs of one attribute */
+static void fbcon_defer_row(struct vc_data *conp, struct display *p, int y)
+{
+    unsigned short *s = (unsigned short *)
+	(conp->vc_origin + conp->vc_size_row * y);
+    unsigned short *sh = defer_shadow ? defer_shadow + y * conp->vc_cols : NULL;
+    int cols = conp->vc_cols, x = 0, start;
+    unsigned short attr;
+
+    while (x < cols) {
+	if (defer_valid && scr_readw(s + x) == sh[x]) {
+	    x++;
+	    continue;
+	}
+	start = x;
+	attr = scr_readw(s + x) & 0xff00;
+	do {
+	    if (sh)
+		sh[x] = scr_readw(s + x);
+	    x++;
+	} while (x < cols && (!defer_valid || scr_readw(s + x) != sh[x]) &&
+		 (scr_readw(s + x) & 0xff00) == attr);
+	p->dispsw->putcs(conp, p, s + start, x - start, real_y(p, y), start);
+    }
+}
+
+/*
+ * Bring the screen up to date.  Runs from the drawing operations, or
+ * from defer_timer with console_lock held.
+ */
+static void fbcon_defer_flush(void)
+{
+    int unit = defer_unit, y, scrolled, yscroll;
+    struct display *p;
+    struct vc_data *conp;
+
+    if (unit < 0)
+	return;
+    p = &fb_display[unit];
+    conp = p->conp;
+    scrolled = defer_scroll;
+    defer_unit = -1;
+    defer_scroll = 0;
+
+    if (unit != fg_console || !conp || vt_cons[unit]->vc_mode != KD_TEXT ||
+	(!p->can_soft_blank && console_blanked)) {
+	defer_valid = 0;
+	return;
+    }
+
+    if (!defer_shadow || defer_rows != conp->vc_rows ||
+	defer_cols != conp->vc_cols) {
+	if (defer_shadow)
+	    kfree(defer_shadow);
+	defer_rows = conp->vc_rows;
+	defer_cols = conp->vc_cols;
+	defer_shadow = kmalloc(defer_rows * defer_cols *
+			       sizeof(unsigned short), GFP_ATOMIC);
+	defer_valid = 0;
+	if (!defer_shadow) {
+	    /* redraw everything once, then draw synchronously */
+	    fbcon_defer = 0;
+	    printk(KERN_WARNING "fbcon: no memory for deferred drawing\n");
+	}
+    }
+
+    defer_flushing = 1;
+    if (cursor_drawn && !p->dispsw->cursor && p->dispsw->revc) {
+	p->dispsw->revc(p, p->cursor_x, real_y(p, p->cursor_y));
+	cursor_undrawn();
+    }
+    yscroll = p->yscroll;
+    if (scrolled)
+	fbcon_defer_scroll(unit, conp, p, scrolled);
+    for (y = (logo_shown == unit) ? logo_lines : 0; y < conp->vc_rows; y++)
+	fbcon_defer_row(conp, p, y);
+    defer_valid = defer_shadow != NULL;
+    if (p->dispsw->cursor) {
+	/* the picture moved under a hardware cursor */
+	if (p->yscroll != yscroll)
+	    p->dispsw->cursor(p, hw_cursor_mode, p->cursor_x,
+			      real_y(p, p->cursor_y));
+    } else if (cursor_on)
+	vbl_cursor_cnt = CURSOR_DRAW_DELAY;
+    defer_flushing = 0;
+}
+
+static void defer_timer_handler(unsigned long dummy)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&console_lock, flags);
+    fbcon_defer_flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/*
+ * Whether a drawing operation on conp is to be deferred.  If not,
+ * whatever is still pending is drawn first, so that the operation
+ * finds the screen it expects.
+ */
+static int fbcon_deferred(struct vc_data *conp)
+{
+    if (defer_flushing)
+	return 0;
+    if (fbcon_defer && !oops_in_progress && conp->vc_num == fg_console)
+	return 1;
+    fbcon_defer_flush();
+    return 0;
+}
+
+static void fbcon_defer_mark(struct vc_data *conp)
+{
+    defer_unit = conp->vc_num;
+    if (!timer_pending(&defer_timer))
+	mod_timer(&defer_timer, jiffies + (fbcon_defer*HZ + 999) / 1000);
+}
+
 static void fbcon_redraw_softback(struct vc_data *conp, struct display *p, long delta)
 {
     unsigned short *d, *s;
@@ -1219,6 +1429,24 @@ static int fbcon_scroll(struct vc_data *conp, int t, int b, int dir,
     if (!count || vt_cons[unit]->vc_mode != KD_TEXT)
 	return 0;
 
+    /*
+     * Leave the screen buffer to console.c; whole-screen scrolls up
+     * are remembered so that the flush can start with one big
+     * hardware scroll.
+     */
+    if (fbcon_deferred(conp)) {
+	if (count > conp->vc_rows)
+	    count = conp->vc_rows;
+	if (dir == SM_UP) {
+	    if (softback_top)
+		fbcon_softback_note(conp, t, count);
+	    if (t == 0 && b == conp->vc_rows)
+		defer_scroll += count;
+	}
+	fbcon_defer_mark(conp);
+	return 0;
+    }
+
     fbcon_cursor(conp, CM_ERASE);
     
     /*
@@ -1366,6 +1594,11 @@ static void fbcon_bmove(struct vc_data *conp, int sy, int sx, int dy, int dx,
     if (!width || !height)
 	return;
 
+    if (fbcon_deferred(conp)) {
+	fbcon_defer_mark(conp);
+	return;
+    }
+
     if (((sy <= p->cursor_y) && (p->cursor_y < sy+height) &&
 	  (sx <= p->cursor_x) && (p->cursor_x < sx+width)) ||
 	 ((dy <= p->cursor_y) && (p->cursor_y < dy+height) &&
@@ -1420,6 +1653,8 @@ static int fbcon_switch(struct vc_data *conp)
     struct display *p = &fb_display[unit];
     struct fb_info *info = p->fb_info;
 
+    fbcon_defer_reset();
+
     if (softback_top) {
     	int l = fbcon_softback_size / conp->vc_size_row;
 	if (softback_lines)
@@ -1480,13 +1715,16 @@ static int fbcon_blank(struct vc_data *conp, int blank)
     struct display *p = &fb_display[conp->vc_num];
     struct fb_info *info = p->fb_info;
 
-    if (blank < 0)	/* Entering graphics mode */
+    if (blank < 0) {	/* Entering graphics mode */
+	fbcon_defer_reset();
 	return 0;
+    }
 
     fbcon_cursor(p->conp, blank ? CM_ERASE : CM_DRAW);
 
     if (!p->can_soft_blank) {
 	if (blank) {
+	    fbcon_defer_reset();
 	    if (p->visual == FB_VISUAL_MONO01) {
 		if (p->screen_base)
 		    fb_memset255(p->screen_base,
@@ -1987,9 +2225,12 @@ static int fbcon_scrolldelta(struct vc_data *conp, int lines)
     		}
 		logo_shown = -1;
 	}
+	/* The screen must show the buffer before, and won't after */
+	fbcon_defer_flush();
     	fbcon_cursor(conp, CM_ERASE|CM_SOFTBACK);
     	fbcon_redraw_softback(conp, p, lines);
     	fbcon_cursor(conp, CM_DRAW|CM_SOFTBACK);
+	fbcon_defer_reset();
     	return 0;
     }
 
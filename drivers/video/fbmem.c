@@ -293,6 +293,7 @@ static int num_pref_init_funcs __initdata = 0;
 struct fb_info *registered_fb[FB_MAX];
 int num_registered_fb;
 extern int fbcon_softback_size; 
+extern int fbcon_defer;
 
 static int first_fb_vc;
 static int last_fb_vc = MAX_NR_CONSOLES-1;
@@ -810,6 +811,14 @@ int __init video_setup(char *options)
 	        return 0;
     }
 
+    if (!strncmp(options, "defer:", 6)) {
+	    options += 6;
+	    fbcon_defer = simple_strtoul(options, &options, 0);
+	    if (*options != ',')
+		    return 0;
+	    options++;
+    }
+
     if (!strncmp(options, "map:", 4)) {
 	    options += 4;
 	    if (*options)
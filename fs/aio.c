@@ -0,0 +1,821 @@
+/*
+ *  linux/fs/aio.c
+ *
+ *  Asynchronous IO contexts, see linux/aio.h.
+ *
+ *  A file that can do a request without waiting for it queues kiobufs
+ *  from its aio_read/aio_write method: each one from aio_map_kiobuf(),
+ *  started with brw_kiovec_async() or with a direct_IO() that gets the
+ *  kiobuf's end_io. Anything else is done synchronously at submission.
+ *
+ *  The kiobufs complete from interrupts, and the last one moves the
+ *  request to the context's done list. Everything else - releasing the
+ *  pages and the file, posting the event - needs process context, and
+ *  is left to the reaper: io_getevents() and io_submit() run it
+ *  themselves, keventd runs it for whoever only watches the ring.
+ *
+ *  The ring has room for an event for every request that can be
+ *  active. If userspace doesn't take its events, the reaper leaves the
+ *  rest on the done list until there is room again, and io_submit()
+ *  gets -EAGAIN.
+ */
+
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/file.h>
+#include <linux/iobuf.h>
+#include <linux/dnotify.h>
+#include <linux/highmem.h>
+#include <linux/module.h>
+#include <linux/aio.h>
+
+#include <asm/uaccess.h>
+
+static kmem_cache_t *kioctx_cachep;
+static kmem_cache_t *kiocb_cachep;
+
+/* Events of all contexts, against /proc/sys/fs/aio-max-nr */
+int aio_nr;
+int aio_max_nr = 0x10000;
+static spinlock_t aio_nr_lock = SPIN_LOCK_UNLOCKED;
+
+/* For inode_dio_wait(), rarely anybody there */
+static DECLARE_WAIT_QUEUE_HEAD(dio_wait);
+
+/*
+ * The ring. We go by our own copy of tail, and check the head that
+ * userspace may have moved.
+ */
+static inline struct aio_ring *aio_ring_map(struct kioctx *ctx)
+{
+	return kmap_atomic(ctx->ring_iobuf->maplist[0], KM_USER0);
+}
+
+static inline void aio_ring_unmap(struct aio_ring *ring)
+{
+	kunmap_atomic(ring, KM_USER0);
+}
+
+/* Events never straddle a page, the header is as large as one */
+static inline struct io_event *aio_event_map(struct kioctx *ctx, unsigned nr)
+{
+	unsigned long pos = sizeof(struct aio_ring) + nr * sizeof(struct io_event);
+	char *kaddr = kmap_atomic(ctx->ring_iobuf->maplist[pos >> PAGE_SHIFT], KM_USER1);
+
+	return (struct io_event *) (kaddr + (pos & ~PAGE_MASK));
+}
+
+static inline void aio_event_unmap(struct io_event *event)
+{
+	kunmap_atomic((void *) ((unsigned long) event & PAGE_MASK), KM_USER1);
+}
+
+static inline unsigned aio_ring_head(struct kioctx *ctx, struct aio_ring *ring)
+{
+	return ring->head % ctx->ring_nr;
+}
+
+static int aio_ring_room(struct kioctx *ctx)
+{
+	struct aio_ring *ring;
+	int room;
+
+	spin_lock(&ctx->ring_lock);
+	ring = aio_ring_map(ctx);
+	room = (ctx->ring_tail + 1) % ctx->ring_nr != aio_ring_head(ctx, ring);
+	aio_ring_unmap(ring);
+	spin_unlock(&ctx->ring_lock);
+	return room;
+}
+
+static int aio_ring_empty(struct kioctx *ctx)
+{
+	struct aio_ring *ring;
+	int empty;
+
+	spin_lock(&ctx->ring_lock);
+	ring = aio_ring_map(ctx);
+	empty = ctx->ring_tail == aio_ring_head(ctx, ring);
+	aio_ring_unmap(ring);
+	spin_unlock(&ctx->ring_lock);
+	return empty;
+}
+
+/* Only the reaper posts, and it checked aio_ring_room() */
+static void aio_put_event(struct kioctx *ctx, struct io_event *ev)
+{
+	struct aio_ring *ring;
+	struct io_event *event;
+
+	spin_lock(&ctx->ring_lock);
+	event = aio_event_map(ctx, ctx->ring_tail);
+	*event = *ev;
+	aio_event_unmap(event);
+	smp_wmb();
+	ctx->ring_tail = (ctx->ring_tail + 1) % ctx->ring_nr;
+	ring = aio_ring_map(ctx);
+	ring->tail = ctx->ring_tail;
+	aio_ring_unmap(ring);
+	spin_unlock(&ctx->ring_lock);
+}
+
+static int aio_get_event(struct kioctx *ctx, struct io_event *ev)
+{
+	struct aio_ring *ring;
+	struct io_event *event;
+	unsigned head;
+	int ret = 0;
+
+	spin_lock(&ctx->ring_lock);
+	ring = aio_ring_map(ctx);
+	head = aio_ring_head(ctx, ring);
+	if (head != ctx->ring_tail) {
+		event = aio_event_map(ctx, head);
+		*ev = *event;
+		aio_event_unmap(event);
+		ring->head = (head + 1) % ctx->ring_nr;
+		ret = 1;
+	}
+	aio_ring_unmap(ring);
+	spin_unlock(&ctx->ring_lock);
+	return ret;
+}
+
+/*
+ * The request's IO is done: the kiobufs are released, and the result
+ * is what was done up to the first error.
+ */
+static ssize_t aio_finish(struct kiocb *iocb)
+{
+	ssize_t res = iocb->ki_res;
+	int i, err = 0;
+
+	if (iocb->ki_nr_iobufs) {
+		res = 0;
+		for (i = 0; i < iocb->ki_nr_iobufs; i++) {
+			struct kiobuf *iobuf = iocb->ki_iobufs[i];
+
+			if (!err) {
+				err = iobuf->errno;
+				if (!err)
+					res += iobuf->length;
+			}
+			if (iocb->ki_rw == READ)
+				mark_dirty_kiobuf(iobuf, iobuf->length);
+			brw_kiovec_done(iobuf);
+			unmap_kiobuf(iobuf);
+			free_kiovec(1, &iobuf);
+		}
+		if (!res)
+			res = err;
+	}
+	if (res > 0 && res > iocb->ki_limit)
+		res = iocb->ki_limit;
+	if (iocb->ki_done)
+		iocb->ki_done(iocb);
+	fput(iocb->ki_filp);
+	return res;
+}
+
+/* Turn the done requests into events, as long as they fit the ring */
+static void aio_reap(struct kioctx *ctx)
+{
+	struct kiocb *iocb;
+	struct io_event ev;
+	int reaped = 0;
+
+	down(&ctx->reap_sem);
+	for (;;) {
+		/* Only the reaper takes requests off the done list */
+		spin_lock_irq(&ctx->lock);
+		if (list_empty(&ctx->done_reqs)) {
+			spin_unlock_irq(&ctx->lock);
+			break;
+		}
+		iocb = list_entry(ctx->done_reqs.next, struct kiocb, ki_list);
+		spin_unlock_irq(&ctx->lock);
+
+		/* A dead context has nobody to read the events */
+		if (!ctx->dead && !aio_ring_room(ctx))
+			break;
+
+		spin_lock_irq(&ctx->lock);
+		list_del(&iocb->ki_list);
+		spin_unlock_irq(&ctx->lock);
+
+		ev.data = iocb->ki_user_data;
+		ev.obj = (unsigned long) iocb->ki_user_obj;
+		ev.res = aio_finish(iocb);
+		ev.res2 = 0;
+		if (!ctx->dead)
+			aio_put_event(ctx, &ev);
+		kmem_cache_free(kiocb_cachep, iocb);
+
+		spin_lock_irq(&ctx->lock);
+		ctx->reqs_active--;
+		spin_unlock_irq(&ctx->lock);
+		reaped++;
+	}
+	up(&ctx->reap_sem);
+
+	if (reaped)
+		wake_up(&ctx->wait);
+}
+
+static void aio_reap_task(void *data)
+{
+	aio_reap((struct kioctx *) data);
+}
+
+/* Drop a reference to the request's IO, the last one completes it */
+static void aio_put_pending(struct kiocb *iocb)
+{
+	struct kioctx *ctx = iocb->ki_ctx;
+	unsigned long flags;
+
+	if (!atomic_dec_and_test(&iocb->ki_pending))
+		return;
+
+	if (iocb->ki_dio_inode &&
+	    atomic_dec_and_test(&iocb->ki_dio_inode->i_dio_count))
+		wake_up(&dio_wait);
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	list_del(&iocb->ki_list);
+	list_add_tail(&iocb->ki_list, &ctx->done_reqs);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	schedule_task(&ctx->reap_task);
+	wake_up(&ctx->wait);
+}
+
+/* kiobuf->end_io of the aio kiobufs, may run from an interrupt */
+static void aio_end_io(struct kiobuf *iobuf)
+{
+	aio_put_pending((struct kiocb *) iobuf->private);
+}
+
+/**
+ * aio_map_kiobuf - get a kiobuf for a piece of a request
+ * @iocb: the request
+ * @rw: READ or WRITE
+ * @buf: user memory
+ * @len: no more than KIO_MAX_ATOMIC_BYTES
+ *
+ * Returns the kiobuf, mapped with its pages and with the aio end_io.
+ * The caller has to start IO on it, or hand it to aio_kiobuf_error();
+ * either way the request now waits for it, and takes care of it
+ * afterwards.
+ */
+struct kiobuf *aio_map_kiobuf(struct kiocb *iocb, int rw, char *buf, size_t len)
+{
+	struct kiobuf *iobuf;
+	int err;
+
+	if (iocb->ki_nr_iobufs == AIO_MAX_IOBUFS)
+		return ERR_PTR(-EINVAL);
+
+	err = alloc_kiovec(1, &iobuf);
+	if (err)
+		return ERR_PTR(err);
+	err = map_user_kiobuf(rw, iobuf, (unsigned long) buf, len);
+	if (err) {
+		free_kiovec(1, &iobuf);
+		return ERR_PTR(err);
+	}
+
+	iobuf->end_io = aio_end_io;
+	iobuf->private = iocb;
+	iocb->ki_iobufs[iocb->ki_nr_iobufs++] = iobuf;
+	atomic_inc(&iocb->ki_pending);
+	return iobuf;
+}
+
+/* The IO for a kiobuf from aio_map_kiobuf() could not be started */
+void aio_kiobuf_error(struct kiobuf *iobuf, int err)
+{
+	iobuf->errno = err;
+	aio_end_io(iobuf);
+}
+
+/*
+ * Wait for the requests that do O_DIRECT on the inode, before its
+ * blocks are freed under them.
+ */
+void inode_dio_wait(struct inode *inode)
+{
+	wait_event(dio_wait, !atomic_read(&inode->i_dio_count));
+}
+
+static inline void get_ioctx(struct kioctx *ctx)
+{
+	atomic_inc(&ctx->users);
+}
+
+static void put_ioctx(struct kioctx *ctx)
+{
+	if (!atomic_dec_and_test(&ctx->users))
+		return;
+
+	if (ctx->reqs_active)
+		BUG();
+	/* keventd may still be in the reaper */
+	flush_scheduled_tasks();
+
+	unmap_kiobuf(ctx->ring_iobuf);
+	free_kiovec(1, &ctx->ring_iobuf);
+
+	spin_lock(&aio_nr_lock);
+	aio_nr -= ctx->max_reqs;
+	spin_unlock(&aio_nr_lock);
+
+	kmem_cache_free(kioctx_cachep, ctx);
+}
+
+static struct kioctx *lookup_ioctx(aio_context_t ctx_id)
+{
+	struct mm_struct *mm = current->mm;
+	struct kioctx *ctx;
+
+	read_lock(&mm->ioctx_list_lock);
+	for (ctx = mm->ioctx_list; ctx; ctx = ctx->next) {
+		if (ctx->user_id == ctx_id) {
+			get_ioctx(ctx);
+			break;
+		}
+	}
+	read_unlock(&mm->ioctx_list_lock);
+	return ctx;
+}
+
+/*
+ * The context is off the mm's list. No new requests get in, and we
+ * wait for the ones that are active.
+ */
+static void kill_ioctx(struct kioctx *ctx)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	int active, done;
+
+	spin_lock_irq(&ctx->lock);
+	ctx->dead = 1;
+	spin_unlock_irq(&ctx->lock);
+	wake_up(&ctx->wait);
+
+	add_wait_queue(&ctx->wait, &wait);
+	for (;;) {
+		aio_reap(ctx);
+
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		spin_lock_irq(&ctx->lock);
+		active = ctx->reqs_active;
+		done = !list_empty(&ctx->done_reqs);
+		spin_unlock_irq(&ctx->lock);
+		if (!active)
+			break;
+		if (!done)
+			schedule();
+		set_current_state(TASK_RUNNING);
+	}
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(&ctx->wait, &wait);
+}
+
+/* Called from mmput(): nobody can submit any more */
+void exit_aio(struct mm_struct *mm)
+{
+	struct kioctx *ctx = mm->ioctx_list, *next;
+
+	mm->ioctx_list = NULL;
+	for (; ctx; ctx = next) {
+		next = ctx->next;
+		kill_ioctx(ctx);
+		put_ioctx(ctx);
+	}
+}
+
+/*
+ * A new context with a ring for nr_events events, mapped into the
+ * caller. The ring's pages are pinned for as long as the context is
+ * there, and don't go to children.
+ */
+static struct kioctx *ioctx_alloc(unsigned nr_events)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	struct kioctx *ctx;
+	struct aio_ring *ring;
+	unsigned long size, addr;
+	int err;
+
+	/* Keep the sizes sane even if aio-max-nr isn't */
+	if (!nr_events || nr_events > 0x1000000)
+		return ERR_PTR(-EINVAL);
+
+	spin_lock(&aio_nr_lock);
+	if (aio_nr + nr_events > aio_max_nr) {
+		spin_unlock(&aio_nr_lock);
+		return ERR_PTR(-EAGAIN);
+	}
+	aio_nr += nr_events;
+	spin_unlock(&aio_nr_lock);
+
+	err = -ENOMEM;
+	ctx = kmem_cache_alloc(kioctx_cachep, SLAB_KERNEL);
+	if (!ctx)
+		goto out_nr;
+	memset(ctx, 0, sizeof(*ctx));
+	atomic_set(&ctx->users, 1);
+	ctx->max_reqs = nr_events;
+	spin_lock_init(&ctx->lock);
+	spin_lock_init(&ctx->ring_lock);
+	INIT_LIST_HEAD(&ctx->active_reqs);
+	INIT_LIST_HEAD(&ctx->done_reqs);
+	init_waitqueue_head(&ctx->wait);
+	init_MUTEX(&ctx->reap_sem);
+	ctx->reap_task.routine = aio_reap_task;
+	ctx->reap_task.data = ctx;
+
+	/* One slot stays free, to tell a full ring from an empty one */
+	size = PAGE_ALIGN(sizeof(struct aio_ring) +
+			  (nr_events + 1) * sizeof(struct io_event));
+	ctx->ring_size = size;
+	ctx->ring_nr = (size - sizeof(struct aio_ring)) / sizeof(struct io_event);
+
+	err = alloc_kiovec(1, &ctx->ring_iobuf);
+	if (err)
+		goto out_free;
+
+	down(&mm->mmap_sem);
+	addr = do_mmap(NULL, 0, size, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (!(addr & ~PAGE_MASK)) {
+		vma = find_vma(mm, addr);
+		vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_RESERVED;
+	}
+	up(&mm->mmap_sem);
+	if (addr & ~PAGE_MASK) {
+		err = (long) addr;
+		goto out_iobuf;
+	}
+	ctx->user_id = addr;
+
+	/* The kernel writes the ring, pin it for that */
+	err = map_user_kiobuf(READ, ctx->ring_iobuf, addr, size);
+	if (err)
+		goto out_unmap;
+
+	ring = kmap(ctx->ring_iobuf->maplist[0]);
+	ring->id = ~0U;
+	ring->nr = ctx->ring_nr;
+	ring->head = ring->tail = 0;
+	ring->magic = AIO_RING_MAGIC;
+	ring->compat_features = AIO_RING_COMPAT_FEATURES;
+	ring->incompat_features = AIO_RING_INCOMPAT_FEATURES;
+	ring->header_length = sizeof(struct aio_ring);
+	kunmap(ctx->ring_iobuf->maplist[0]);
+	return ctx;
+
+out_unmap:
+	down(&mm->mmap_sem);
+	do_munmap(mm, addr, size);
+	up(&mm->mmap_sem);
+out_iobuf:
+	free_kiovec(1, &ctx->ring_iobuf);
+out_free:
+	kmem_cache_free(kioctx_cachep, ctx);
+out_nr:
+	spin_lock(&aio_nr_lock);
+	aio_nr -= nr_events;
+	spin_unlock(&aio_nr_lock);
+	return ERR_PTR(err);
+}
+
+static void ioctx_unmap(struct kioctx *ctx)
+{
+	struct mm_struct *mm = current->mm;
+
+	down(&mm->mmap_sem);
+	do_munmap(mm, ctx->user_id, ctx->ring_size);
+	up(&mm->mmap_sem);
+}
+
+/*
+ * io_setup: create a context for nr_events requests in flight. *ctxp
+ * must be 0, and gets the context.
+ */
+asmlinkage long sys_io_setup(unsigned nr_events, aio_context_t *ctxp)
+{
+	struct mm_struct *mm = current->mm;
+	struct kioctx *ctx;
+	aio_context_t ctx_id;
+
+	if (get_user(ctx_id, ctxp))
+		return -EFAULT;
+	if (ctx_id)
+		return -EINVAL;
+
+	ctx = ioctx_alloc(nr_events);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	if (put_user(ctx->user_id, ctxp)) {
+		ioctx_unmap(ctx);
+		put_ioctx(ctx);
+		return -EFAULT;
+	}
+
+	write_lock(&mm->ioctx_list_lock);
+	ctx->next = mm->ioctx_list;
+	mm->ioctx_list = ctx;
+	write_unlock(&mm->ioctx_list_lock);
+	return 0;
+}
+
+/*
+ * io_destroy: wait for the context's requests, then take the context
+ * and its ring away. The events that were not taken are lost.
+ */
+asmlinkage long sys_io_destroy(aio_context_t ctx_id)
+{
+	struct mm_struct *mm = current->mm;
+	struct kioctx *ctx, **p;
+
+	write_lock(&mm->ioctx_list_lock);
+	for (p = &mm->ioctx_list; (ctx = *p) != NULL; p = &ctx->next) {
+		if (ctx->user_id == ctx_id) {
+			*p = ctx->next;
+			break;
+		}
+	}
+	write_unlock(&mm->ioctx_list_lock);
+	if (!ctx)
+		return -EINVAL;
+
+	kill_ioctx(ctx);
+	ioctx_unmap(ctx);
+	put_ioctx(ctx);
+	return 0;
+}
+
+static int io_submit_one(struct kioctx *ctx, struct iocb *user_iocb,
+			 struct iocb *iocb)
+{
+	char *buf = (char *) (unsigned long) iocb->aio_buf;
+	size_t count = iocb->aio_nbytes;
+	loff_t pos = iocb->aio_offset;
+	struct kiocb *req;
+	struct file *file;
+	ssize_t ret;
+	int rw, mode;
+
+	/* Nothing is defined for these yet */
+	if (iocb->aio_key || iocb->aio_reserved1 || iocb->aio_reqprio ||
+	    iocb->aio_reserved2 || iocb->aio_reserved3)
+		return -EINVAL;
+	if ((unsigned long) buf != iocb->aio_buf ||
+	    count != iocb->aio_nbytes || (ssize_t) count < 0 || pos < 0)
+		return -EINVAL;
+
+	switch (iocb->aio_lio_opcode) {
+	case IOCB_CMD_PREAD:
+		rw = READ;
+		mode = FMODE_READ;
+		break;
+	case IOCB_CMD_PWRITE:
+		rw = WRITE;
+		mode = FMODE_WRITE;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	file = fget(iocb->aio_fildes);
+	if (!file)
+		return -EBADF;
+	ret = -EBADF;
+	if (!(file->f_mode & mode))
+		goto out_fput;
+	ret = -EINVAL;
+	if (!file->f_op || (rw == READ && !file->f_op->read) ||
+	    (rw == WRITE && !file->f_op->write))
+		goto out_fput;
+	ret = -EFAULT;
+	if (!access_ok(rw == READ ? VERIFY_WRITE : VERIFY_READ, buf, count))
+		goto out_fput;
+	ret = locks_verify_area(rw == READ ? FLOCK_VERIFY_READ : FLOCK_VERIFY_WRITE,
+				file->f_dentry->d_inode, file, pos, count);
+	if (ret)
+		goto out_fput;
+
+	ret = -ENOMEM;
+	req = kmem_cache_alloc(kiocb_cachep, SLAB_KERNEL);
+	if (!req)
+		goto out_fput;
+	memset(req, 0, sizeof(*req));
+	req->ki_ctx = ctx;
+	req->ki_filp = file;
+	req->ki_user_obj = user_iocb;
+	req->ki_user_data = iocb->aio_data;
+	req->ki_rw = rw;
+	req->ki_pos = pos;
+	req->ki_nbytes = req->ki_limit = count;
+	atomic_set(&req->ki_pending, 1);
+
+	spin_lock_irq(&ctx->lock);
+	if (ctx->dead || ctx->reqs_active >= ctx->max_reqs) {
+		ret = ctx->dead ? -EINVAL : -EAGAIN;
+		spin_unlock_irq(&ctx->lock);
+		kmem_cache_free(kiocb_cachep, req);
+		goto out_fput;
+	}
+	ctx->reqs_active++;
+	list_add_tail(&req->ki_list, &ctx->active_reqs);
+	spin_unlock_irq(&ctx->lock);
+
+	if (rw == READ) {
+		if (file->f_op->aio_read)
+			ret = file->f_op->aio_read(req, buf, count, pos);
+		else
+			ret = file->f_op->read(file, buf, count, &pos);
+	} else {
+		if (file->f_op->aio_write)
+			ret = file->f_op->aio_write(req, buf, count, pos);
+		else
+			ret = file->f_op->write(file, buf, count, &pos);
+		if (ret > 0 || ret == -EIOCBQUEUED)
+			inode_dir_notify_name(file->f_dentry->d_parent->d_inode,
+					      DN_MODIFY, &file->f_dentry->d_name);
+	}
+	if (ret != -EIOCBQUEUED)
+		req->ki_res = ret;
+
+	/* The file is the request's now, and the event reports any error */
+	aio_put_pending(req);
+	return 0;
+
+out_fput:
+	fput(file);
+	return ret;
+}
+
+/*
+ * io_submit: queue nr iocbs. Returns how many were queued, or the
+ * error for the first one if none was.
+ */
+asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
+			      struct iocb **iocbpp)
+{
+	struct kioctx *ctx;
+	long i;
+	int ret = 0;
+
+	if (nr < 0)
+		return -EINVAL;
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+
+	/* Make room for the new events, if they were taken from the ring */
+	aio_reap(ctx);
+
+	for (i = 0; i < nr; i++) {
+		struct iocb *user_iocb, tmp;
+
+		if (get_user(user_iocb, iocbpp + i) ||
+		    copy_from_user(&tmp, user_iocb, sizeof(tmp))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = io_submit_one(ctx, user_iocb, &tmp);
+		if (ret)
+			break;
+	}
+
+	put_ioctx(ctx);
+	return i ? i : ret;
+}
+
+/*
+ * io_cancel: the IO of a request is in the drivers' queues as soon as
+ * it is submitted, and can't be taken back from there. So a request
+ * that is still active gets -EAGAIN, and its event comes as usual.
+ * One that is not active any more, or never was, is -EINVAL.
+ */
+asmlinkage long sys_io_cancel(aio_context_t ctx_id, struct iocb *iocb,
+			      struct io_event *result)
+{
+	struct kioctx *ctx;
+	struct list_head *entry;
+	int ret = -EINVAL;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->lock);
+	list_for_each(entry, &ctx->active_reqs) {
+		if (list_entry(entry, struct kiocb, ki_list)->ki_user_obj == iocb) {
+			ret = -EAGAIN;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->lock);
+
+	put_ioctx(ctx);
+	return ret;
+}
+
+static int aio_events_ready(struct kioctx *ctx)
+{
+	int ready;
+
+	spin_lock_irq(&ctx->lock);
+	ready = !list_empty(&ctx->done_reqs);
+	spin_unlock_irq(&ctx->lock);
+	return ready || !aio_ring_empty(ctx);
+}
+
+/*
+ * io_getevents: take between min_nr and nr events, waiting up to
+ * timeout for min_nr of them. No timeout waits for as long as it
+ * takes. Returns the number of events taken.
+ */
+asmlinkage long sys_io_getevents(aio_context_t ctx_id, long min_nr, long nr,
+				 struct io_event *events,
+				 struct timespec *timeout)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	signed long expire = MAX_SCHEDULE_TIMEOUT;
+	struct kioctx *ctx;
+	struct io_event ev;
+	struct timespec ts;
+	long i = 0;
+	int ret = 0;
+
+	if (min_nr < 0 || nr < 0 || min_nr > nr)
+		return -EINVAL;
+	if (timeout) {
+		if (copy_from_user(&ts, timeout, sizeof(ts)))
+			return -EFAULT;
+		if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000L)
+			return -EINVAL;
+		expire = timespec_to_jiffies(&ts);
+	}
+
+	ctx = lookup_ioctx(ctx_id);
+	if (!ctx)
+		return -EINVAL;
+
+	add_wait_queue(&ctx->wait, &wait);
+	for (;;) {
+		aio_reap(ctx);
+		while (i < nr && aio_get_event(ctx, &ev)) {
+			if (copy_to_user(events + i, &ev, sizeof(ev))) {
+				ret = -EFAULT;
+				goto out;
+			}
+			i++;
+		}
+		if (i == nr)
+			break;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!aio_events_ready(ctx)) {
+			if (i >= min_nr || ctx->dead || !expire)
+				break;
+			if (signal_pending(current)) {
+				ret = -EINTR;
+				break;
+			}
+			expire = schedule_timeout(expire);
+		}
+		set_current_state(TASK_RUNNING);
+	}
+out:
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(&ctx->wait, &wait);
+	put_ioctx(ctx);
+	return i ? i : ret;
+}
+
+static int __init aio_setup(void)
+{
+	kioctx_cachep = kmem_cache_create("kioctx", sizeof(struct kioctx),
+					  0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	kiocb_cachep = kmem_cache_create("kiocb", sizeof(struct kiocb),
+					 0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!kioctx_cachep || !kiocb_cachep)
+		panic("Cannot create aio SLAB caches");
+	return 0;
+}
+
+module_init(aio_setup)
+
+EXPORT_SYMBOL(aio_map_kiobuf);
+EXPORT_SYMBOL(aio_kiobuf_error);
@@ -131,7 +131,8 @@ int notify_change(struct dentry * dentry, struct iattr * attr)
 	if (!error) {
 		unsigned long dn_mask = setattr_mask(ia_valid);
 		if (dn_mask)
-			inode_dir_notify(dentry->d_parent->d_inode, dn_mask);
+			inode_dir_notify_name(dentry->d_parent->d_inode,
+					      dn_mask, &dentry->d_name);
 	}
 	return error;
 }
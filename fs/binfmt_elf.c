@@ -40,6 +40,10 @@
 
 #include <linux/elf.h>
 
+#ifndef DLINFO_ARCH_ITEMS
+#define DLINFO_ARCH_ITEMS 0
+#endif
+
 static int load_elf_binary(struct linux_binprm * bprm, struct pt_regs * regs);
 static int load_elf_library(struct file*);
 static unsigned long elf_map (struct file *, unsigned long, struct elf_phdr *, int, int);
@@ -141,6 +145,7 @@ create_elf_tables(char *p, int argc, int envc,
 	sp = (elf_addr_t *)((~15UL & (unsigned long)(u_platform)) - 16UL);
 	csp = sp;
 	csp -= ((exec ? DLINFO_ITEMS*2 : 4) + (k_platform ? 2 : 0));
+	csp -= DLINFO_ARCH_ITEMS*2;
 	csp -= envc+1;
 	csp -= argc+1;
 	csp -= (!ibcs ? 3 : 1);	/* argc itself */
@@ -164,6 +169,10 @@ create_elf_tables(char *p, int argc, int envc,
 	NEW_AUX_ENT(0, AT_HWCAP, hwcap);
 	NEW_AUX_ENT(1, AT_PAGESZ, ELF_EXEC_PAGESIZE);
 	NEW_AUX_ENT(2, AT_CLKTCK, CLOCKS_PER_SEC);
+#ifdef ARCH_DLINFO
+	sp -= DLINFO_ARCH_ITEMS*2;
+	ARCH_DLINFO;
+#endif
 
 	if (exec) {
 		sp -= 10*2;
@@ -214,9 +223,11 @@ elf_map (struct file *filep, unsigned long addr, struct elf_phdr *eppnt, int pro
 {
 	unsigned long map_addr;
 
+	/* Map in what is cached now rather than take a fault per page */
 	down(&current->mm->mmap_sem);
 	map_addr = do_mmap(filep, ELF_PAGESTART(addr),
-			   eppnt->p_filesz + ELF_PAGEOFFSET(eppnt->p_vaddr), prot, type,
+			   eppnt->p_filesz + ELF_PAGEOFFSET(eppnt->p_vaddr), prot,
+			   type | MAP_POPULATE,
 			   eppnt->p_offset - ELF_PAGEOFFSET(eppnt->p_vaddr));
 	up(&current->mm->mmap_sem);
 	return(map_addr);
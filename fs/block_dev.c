@@ -7,12 +7,15 @@
 #include <linux/config.h>
 #include <linux/init.h>
 #include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
 #include <linux/locks.h>
 #include <linux/fcntl.h>
 #include <linux/malloc.h>
 #include <linux/kmod.h>
 #include <linux/devfs_fs_kernel.h>
 #include <linux/smp_lock.h>
+#include <linux/blkdev.h>
 
 #include <asm/uaccess.h>
 
@@ -350,7 +353,157 @@ static loff_t block_llseek(struct file *file, loff_t offset, int origin)
  
 static int block_fsync(struct file *filp, struct dentry *dentry, int datasync)
 {
-	return fsync_dev(dentry->d_inode->i_rdev);
+	struct address_space *mapping = dentry->d_inode->i_mapping;
+	int ret;
+
+	/* Pages dirtied through mmap() have no dirty buffers yet */
+	filemap_fdatasync(mapping);
+	ret = fsync_dev(dentry->d_inode->i_rdev);
+	filemap_fdatawait(mapping);
+	return ret;
+}
+
+/*
+ * The page cache of a block device belongs to bdev->bd_inode, whose
+ * mapping every device node of the device uses once it is opened.  So
+ * read(), write(), mmap() and sendfile() on a block device work like on
+ * a regular file, with the generic read-ahead.  The blocks of the page
+ * cache are the blocks of the device, of the size it had when the cache
+ * was empty.
+ *
+ * A filesystem mounted on the device, or swap on it, does its I/O
+ * through the buffer cache, which the page cache does not see.  So
+ * while bd_fs_users is held, read() and write() go through the buffer
+ * cache with block_read() and block_write(), and mmap() is refused;
+ * the page cache is written and dropped when the first user comes.
+ * Otherwise a block read into the page cache is still taken from the
+ * buffer cache when that has it, and a block written through the page
+ * cache updates the buffer cache copy too.  The cache is dropped on the
+ * last close, on a media change and on BLKFLSBUF.
+ */
+static int blkdev_get_block(struct inode * inode, long iblock, struct buffer_head * bh, int create)
+{
+	unsigned int size = 1 << inode->i_blkbits;
+	struct buffer_head * alias;
+
+	if (((loff_t) iblock << inode->i_blkbits) >= inode->i_size)
+		return -EIO;
+
+	bh->b_dev = inode->i_rdev;
+	bh->b_blocknr = iblock;
+	bh->b_state |= 1UL << BH_Mapped;
+
+	if (buffer_uptodate(bh) || Page_Uptodate(bh->b_page))
+		return 0;
+	alias = get_hash_table(inode->i_rdev, iblock, size);
+	if (alias) {
+		if (buffer_uptodate(alias)) {
+			memcpy(kmap(bh->b_page) + bh_offset(bh), alias->b_data, size);
+			kunmap(bh->b_page);
+			set_bit(BH_Uptodate, &bh->b_state);
+		}
+		brelse(alias);
+	}
+	return 0;
+}
+
+static int blkdev_readpage(struct file * file, struct page * page)
+{
+	return block_read_full_page(page, blkdev_get_block);
+}
+
+static int blkdev_writepage(struct page * page)
+{
+	return block_write_dirty_page(page, blkdev_get_block);
+}
+
+static int blkdev_prepare_write(struct file *file, struct page *page, unsigned from, unsigned to)
+{
+	return block_prepare_write(page, from, to, blkdev_get_block);
+}
+
+static int blkdev_prepare_write_pages(struct file *file, struct page **pages, int nr, unsigned from, unsigned to)
+{
+	return block_prepare_write_pages(pages, nr, from, to, blkdev_get_block);
+}
+
+/* Copy what was written into buffers of the same blocks, if any */
+static void blkdev_update_aliases(struct page *page, unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	unsigned int size = 1 << inode->i_blkbits;
+	struct buffer_head *bh = page->buffers, *alias;
+	char *kaddr = page_address(page);
+	unsigned int start = 0;
+
+	do {
+		if (start < to && start + size > from) {
+			alias = get_hash_table(inode->i_rdev, bh->b_blocknr, size);
+			if (alias) {
+				memcpy(alias->b_data, kaddr + start, size);
+				mark_buffer_uptodate(alias, 1);
+				brelse(alias);
+			}
+		}
+		start += size;
+		bh = bh->b_this_page;
+	} while (bh != page->buffers);
+}
+
+static int blkdev_commit_write(struct file *file, struct page *page, unsigned from, unsigned to)
+{
+	blkdev_update_aliases(page, from, to);
+	return generic_commit_write(file, page, from, to);
+}
+
+static int blkdev_commit_write_pages(struct file *file, struct page **pages, int nr, unsigned from, unsigned to)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		blkdev_update_aliases(pages[i], i ? 0 : from,
+				      i < nr - 1 ? PAGE_CACHE_SIZE : to);
+	return block_commit_write_pages(file, pages, nr, from, to);
+}
+
+static struct address_space_operations def_blk_aops = {
+	readpage:	blkdev_readpage,
+	writepage:	blkdev_writepage,
+	sync_page:	block_sync_page,
+	prepare_write:	blkdev_prepare_write,
+	commit_write:	blkdev_commit_write,
+	prepare_write_pages:	blkdev_prepare_write_pages,
+	commit_write_pages:	blkdev_commit_write_pages,
+};
+
+/*
+ * Called on every open.  The block size can only change while no page
+ * has buffers of the old one.
+ */
+static void bd_set_size(struct block_device *bdev)
+{
+	struct inode *inode = bdev->bd_inode;
+	kdev_t dev = to_kdev_t(bdev->bd_dev);
+	int size = BLOCK_SIZE, bits;
+
+	if (blk_size[MAJOR(dev)])
+		inode->i_size = (loff_t) blk_size[MAJOR(dev)][MINOR(dev)] << BLOCK_SIZE_BITS;
+	else
+		inode->i_size = (loff_t) INT_MAX << BLOCK_SIZE_BITS;
+
+	if (inode->i_mapping->nrpages)
+		return;
+	if (blksize_size[MAJOR(dev)] && blksize_size[MAJOR(dev)][MINOR(dev)])
+		size = blksize_size[MAJOR(dev)][MINOR(dev)];
+	if (size < get_hardsect_size(dev))
+		size = get_hardsect_size(dev);
+	bits = 0;
+	while ((1 << bits) < size)
+		bits++;
+	/* No block may stick out over the end of the device */
+	while (bits > 9 && (inode->i_size & ((1 << bits) - 1)))
+		bits--;
+	inode->i_blkbits = bits;
 }
 
 /*
@@ -426,10 +579,40 @@ static struct block_device *bdfind(dev_t dev, struct list_head *head)
 	return NULL;
 }
 
+/* For /proc/readahead */
+int get_readahead_stats(char *page)
+{
+	struct list_head *head, *p;
+	struct block_device *bdev;
+	int len;
+
+	len = sprintf(page, "major minor       hits     misses   thrashed\n");
+	spin_lock(&bdev_lock);
+	for (head = bdev_hashtable; head < bdev_hashtable + HASH_SIZE; head++) {
+		for (p = head->next; p != head; p = p->next) {
+			bdev = list_entry(p, struct block_device, bd_hash);
+			if (!bdev->bd_ra_hits && !bdev->bd_ra_misses &&
+			    !bdev->bd_ra_thrashed)
+				continue;
+			/* Don't overflow the proc page */
+			if (len > PAGE_SIZE - 80)
+				goto out;
+			len += sprintf(page + len, "%5d %5d %10lu %10lu %10lu\n",
+				       MAJOR(bdev->bd_dev), MINOR(bdev->bd_dev),
+				       bdev->bd_ra_hits, bdev->bd_ra_misses,
+				       bdev->bd_ra_thrashed);
+		}
+	}
+out:
+	spin_unlock(&bdev_lock);
+	return len;
+}
+
 struct block_device *bdget(dev_t dev)
 {
 	struct list_head * head = bdev_hashtable + hash(dev);
 	struct block_device *bdev, *new_bdev;
+	struct inode *inode;
 	spin_lock(&bdev_lock);
 	bdev = bdfind(dev, head);
 	spin_unlock(&bdev_lock);
@@ -438,9 +621,20 @@ struct block_device *bdget(dev_t dev)
 	new_bdev = alloc_bdev();
 	if (!new_bdev)
 		return NULL;
+	inode = get_empty_inode();
+	if (!inode) {
+		destroy_bdev(new_bdev);
+		return NULL;
+	}
+	inode->i_mode = S_IFBLK;
+	inode->i_rdev = to_kdev_t(dev);
+	inode->i_dev = inode->i_rdev;
+	inode->i_blkbits = BLOCK_SIZE_BITS;
+	inode->i_data.a_ops = &def_blk_aops;
 	atomic_set(&new_bdev->bd_count,1);
 	new_bdev->bd_dev = dev;
 	new_bdev->bd_op = NULL;
+	new_bdev->bd_inode = inode;
 	spin_lock(&bdev_lock);
 	bdev = bdfind(dev, head);
 	if (!bdev) {
@@ -449,6 +643,7 @@ struct block_device *bdget(dev_t dev)
 		return new_bdev;
 	}
 	spin_unlock(&bdev_lock);
+	iput(inode);
 	destroy_bdev(new_bdev);
 	return bdev;
 }
@@ -461,6 +656,8 @@ void bdput(struct block_device *bdev)
 			BUG();
 		list_del(&bdev->bd_hash);
 		spin_unlock(&bdev_lock);
+		truncate_inode_pages(bdev->bd_inode->i_mapping, 0);
+		iput(bdev->bd_inode);
 		destroy_bdev(bdev);
 	}
 }
@@ -553,6 +750,7 @@ int check_disk_change(kdev_t dev)
 {
 	int i;
 	const struct block_device_operations * bdops = NULL;
+	struct block_device * bdev;
 	struct super_block * sb;
 
 	i = MAJOR(dev);
@@ -580,6 +778,11 @@ int check_disk_change(kdev_t dev)
 		printk("VFS: busy inodes on changed media.\n");
 
 	destroy_buffers(dev);
+	bdev = bdget(kdev_t_to_nr(dev));
+	if (bdev) {
+		truncate_inode_pages(bdev->bd_inode->i_mapping, 0);
+		bdput(bdev);
+	}
 
 	if (bdops->revalidate)
 		bdops->revalidate(dev);
@@ -603,6 +806,43 @@ int ioctl_by_bdev(struct block_device *bdev, unsigned cmd, unsigned long arg)
 	return res;
 }
 
+/*
+ * A filesystem or swap starts using the device: from now on its
+ * buffer cache is the only copy, so write out and drop the page cache.
+ * Called under bd_sem.
+ */
+static void bd_claim_fs(struct block_device *bdev)
+{
+	struct address_space *mapping = bdev->bd_inode->i_mapping;
+
+	if (bdev->bd_fs_users++)
+		return;
+	filemap_fdatasync(mapping);
+	filemap_fdatawait(mapping);
+	truncate_inode_pages(mapping, 0);
+}
+
+static ssize_t blkdev_read(struct file * filp, char * buf, size_t count, loff_t *ppos)
+{
+	if (filp->f_dentry->d_inode->i_bdev->bd_fs_users)
+		return block_read(filp, buf, count, ppos);
+	return generic_file_read(filp, buf, count, ppos);
+}
+
+static ssize_t blkdev_write(struct file * filp, const char * buf, size_t count, loff_t *ppos)
+{
+	if (filp->f_dentry->d_inode->i_bdev->bd_fs_users)
+		return block_write(filp, buf, count, ppos);
+	return generic_file_write(filp, buf, count, ppos);
+}
+
+static int blkdev_mmap(struct file * filp, struct vm_area_struct * vma)
+{
+	if (filp->f_dentry->d_inode->i_bdev->bd_fs_users)
+		return -EBUSY;
+	return generic_file_mmap(filp, vma);
+}
+
 int blkdev_get(struct block_device *bdev, mode_t mode, unsigned flags, int kind)
 {
 	int ret = -ENODEV;
@@ -630,9 +870,12 @@ int blkdev_get(struct block_device *bdev, mode_t mode, unsigned flags, int kind)
 			ret = 0;
 			if (bdev->bd_op->open)
 				ret = bdev->bd_op->open(fake_inode, &fake_file);
-			if (!ret)
+			if (!ret) {
 				atomic_inc(&bdev->bd_openers);
-			else if (!atomic_read(&bdev->bd_openers))
+				bd_set_size(bdev);
+				if (kind == BDEV_FS || kind == BDEV_SWAP)
+					bd_claim_fs(bdev);
+			} else if (!atomic_read(&bdev->bd_openers))
 				bdev->bd_op = NULL;
 			iput(fake_inode);
 		}
@@ -653,9 +896,11 @@ int blkdev_open(struct inode * inode, struct file * filp)
 		ret = 0;
 		if (bdev->bd_op->open)
 			ret = bdev->bd_op->open(inode,filp);
-		if (!ret)
+		if (!ret) {
 			atomic_inc(&bdev->bd_openers);
-		else if (!atomic_read(&bdev->bd_openers))
+			bd_set_size(bdev);
+			inode->i_mapping = bdev->bd_inode->i_mapping;
+		} else if (!atomic_read(&bdev->bd_openers))
 			bdev->bd_op = NULL;
 	}	
 	unlock_kernel();
@@ -670,11 +915,17 @@ int blkdev_put(struct block_device *bdev, int kind)
 	down(&bdev->bd_sem);
 	/* syncing will go here */
 	lock_kernel();
-	if (kind == BDEV_FILE || kind == BDEV_FS)
+	if (kind == BDEV_FILE || kind == BDEV_FS) {
+		filemap_fdatasync(bdev->bd_inode->i_mapping);
 		fsync_dev(rdev);
+		filemap_fdatawait(bdev->bd_inode->i_mapping);
+	}
+	if (kind == BDEV_FS || kind == BDEV_SWAP)
+		bdev->bd_fs_users--;
 	if (atomic_dec_and_test(&bdev->bd_openers)) {
 		/* invalidating buffers will go here */
 		invalidate_buffers(rdev);
+		truncate_inode_pages(bdev->bd_inode->i_mapping, 0);
 	}
 	if (bdev->bd_op->release) {
 		struct inode * fake_inode = get_empty_inode();
@@ -701,17 +952,24 @@ static int blkdev_close(struct inode * inode, struct file * filp)
 static int blkdev_ioctl(struct inode *inode, struct file *file, unsigned cmd,
 			unsigned long arg)
 {
-	if (inode->i_bdev->bd_op->ioctl)
-		return inode->i_bdev->bd_op->ioctl(inode, file, cmd, arg);
-	return -EINVAL;
+	struct block_device *bdev = inode->i_bdev;
+	int ret = -EINVAL;
+
+	if (bdev->bd_op->ioctl)
+		ret = bdev->bd_op->ioctl(inode, file, cmd, arg);
+	/* The driver flushed the buffer cache, the page cache goes too */
+	if (cmd == BLKFLSBUF && !ret)
+		invalidate_inode_pages(bdev->bd_inode);
+	return ret;
 }
 
 struct file_operations def_blk_fops = {
 	open:		blkdev_open,
 	release:	blkdev_close,
 	llseek:		block_llseek,
-	read:		block_read,
-	write:		block_write,
+	read:		blkdev_read,
+	write:		blkdev_write,
+	mmap:		blkdev_mmap,
 	fsync:		block_fsync,
 	ioctl:		blkdev_ioctl,
 };
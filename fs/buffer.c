@@ -65,25 +65,109 @@ static char buffersize_index[65] =
 #define MAX_UNUSED_BUFFERS NR_RESERVED+20 /* don't ever have more than this 
 					     number of unused buffer heads */
 
-/* Anti-deadlock ordering:
- *	lru_list_lock > hash_table_lock > free_list_lock > unused_list_lock
+/*
+ * Each lru list has a lock of its own, covering the list and its
+ * counts. bh->b_list only changes with the lock of the list the buffer
+ * is on held, and refiling a buffer takes the locks of both lists.
+ * The inode buffer lists have another lock, and the hash chains one of
+ * BH_HASH_LOCKS locks each, picked by the chain.
+ *
+ * Anti-deadlock ordering:
+ *	lru list locks, in list order > inode_buffers_lock >
+ *	hash locks, in array order > free_list_lock > unused_list_lock
  */
 
 #define BH_ENTRY(list) list_entry((list), struct buffer_head, b_inode_buffers)
 
+/*
+ * The locks count how often they were taken and how often that had to
+ * spin, see /proc/buffer_locks. The counts only change with the lock
+ * held.
+ */
+struct bh_lock {
+	spinlock_t	lock;
+	unsigned long	taken;
+	unsigned long	contended;
+} ____cacheline_aligned;
+
+#define BH_LOCK_UNLOCKED	{ lock: SPIN_LOCK_UNLOCKED }
+
+static inline void bh_lock(struct bh_lock *l)
+{
+	int busy = !spin_trylock(&l->lock);
+
+	if (busy)
+		spin_lock(&l->lock);
+	l->taken++;
+	l->contended += busy;
+}
+
+static inline int bh_trylock(struct bh_lock *l)
+{
+	if (!spin_trylock(&l->lock))
+		return 0;
+	l->taken++;
+	return 1;
+}
+
+static inline void bh_unlock(struct bh_lock *l)
+{
+	spin_unlock(&l->lock);
+}
+
 /*
  * Hash table gook..
  */
 static unsigned int bh_hash_mask;
 static unsigned int bh_hash_shift;
 static struct buffer_head **hash_table;
-static rwlock_t hash_table_lock = RW_LOCK_UNLOCKED;
+
+#define BH_HASH_LOCKS	64
+static struct bh_lock bh_hash_locks[BH_HASH_LOCKS] =
+	{ [0 ... BH_HASH_LOCKS-1] = BH_LOCK_UNLOCKED };
 
 static struct buffer_head *lru_list[NR_LIST];
-static spinlock_t lru_list_lock = SPIN_LOCK_UNLOCKED;
+static struct bh_lock lru_locks[NR_LIST] =
+	{ [0 ... NR_LIST-1] = BH_LOCK_UNLOCKED };
 static int nr_buffers_type[NR_LIST];
 static unsigned long size_buffers_type[NR_LIST];
 
+#define lru_lock(blist)	(&lru_locks[blist])
+#define LRU_ALL		((1 << NR_LIST) - 1)
+
+static struct bh_lock inode_buffers_lock = BH_LOCK_UNLOCKED;
+
+/*
+ * Writeback state of a block device, see the bdflush support below.
+ * They are created when a device first gets dirty buffers and never
+ * go away. All of it is protected by the BUF_DIRTY list lock.
+ */
+struct wb_dev {
+	kdev_t			dev;
+	struct wb_dev		*hash_next;
+	struct wb_dev		*next;		/* all of them */
+	unsigned long		dirty;		/* bytes on the dirty list */
+	int			flushing;	/* a bdflush thread is on it */
+	unsigned int		age_pass;	/* last kupdate pass done */
+	unsigned long		bandwidth;	/* write throughput, kB/s */
+	wait_queue_head_t	wait;		/* throttled writers */
+};
+
+#define WB_HASH_SIZE	64
+#define wb_hashfn(dev)	((HASHDEV(dev) ^ (HASHDEV(dev) >> 6)) & (WB_HASH_SIZE - 1))
+
+static struct wb_dev *wb_hash[WB_HASH_SIZE];
+static int nr_wb_devs;
+static unsigned long wb_total_bandwidth;
+static unsigned int wb_age_pass;
+
+/* Stands in for the devices we could not allocate one for, matches all */
+static struct wb_dev wb_other = {
+	dev:	NODEV,
+	wait:	__WAIT_QUEUE_HEAD_INITIALIZER(wb_other.wait),
+};
+static struct wb_dev *wb_devs = &wb_other;
+
 static struct buffer_head * unused_list;
 static int nr_unused_buffer_heads;
 static spinlock_t unused_list_lock = SPIN_LOCK_UNLOCKED;
@@ -96,7 +180,7 @@ struct bh_free_head {
 static struct bh_free_head free_list[NR_SIZES];
 
 static int grow_buffers(int size);
-static void __refile_buffer(struct buffer_head *);
+static void __refile_buffer(struct buffer_head *, unsigned int);
 
 /* This is used by some architectures to estimate available memory. */
 atomic_t buffermem_pages = ATOMIC_INIT(0);
@@ -124,15 +208,16 @@ union bdflush_param {
 		int age_buffer;  /* Time for normal buffer to age before we flush it */
 		int nfract_sync; /* Percentage of buffer cache dirty to 
 				    activate bdflush synchronously */
-		int dummy2;    /* unused */
+		int npages;    /* Maximum number of dirty inode pages kupdate
+				  writes per wake-cycle */
 		int dummy3;    /* unused */
 	} b_un;
 	unsigned int data[N_PARAM];
-} bdf_prm = {{40, 500, 64, 256, 5*HZ, 30*HZ, 80, 0, 0}};
+} bdf_prm = {{40, 500, 64, 256, 5*HZ, 30*HZ, 80, 1024, 0}};
 
 /* These are the min and max parameter values that we will allow to be assigned */
-int bdflush_min[N_PARAM] = {  0,  10,    5,   25,  0,   1*HZ,   0, 0, 0};
-int bdflush_max[N_PARAM] = {100,50000, 20000, 20000,600*HZ, 6000*HZ, 100, 0, 0};
+int bdflush_min[N_PARAM] = {  0,  10,    5,   25,  0,   1*HZ,   0,    16, 0};
+int bdflush_max[N_PARAM] = {100,50000, 20000, 20000,600*HZ, 6000*HZ, 100, 1<<20, 0};
 
 /*
  * Rewrote the wait-routines to use the "new" wait-queue functionality,
@@ -189,10 +274,10 @@ static int sync_buffers(kdev_t dev, int wait)
 		 * there to be dirty buffers on any of the other lists.
 		 */
 repeat:
-		spin_lock(&lru_list_lock);
+		bh_lock(lru_lock(BUF_DIRTY));
 		bh = lru_list[BUF_DIRTY];
 		if (!bh)
-			goto repeat2;
+			goto dirty_done;
 
 		for (i = nr_buffers_type[BUF_DIRTY]*2 ; i-- > 0 ; bh = next) {
 			next = bh->b_next_free;
@@ -210,7 +295,7 @@ repeat:
 					continue;
 				}
 				atomic_inc(&bh->b_count);
-				spin_unlock(&lru_list_lock);
+				bh_unlock(lru_lock(BUF_DIRTY));
 				wait_on_buffer (bh);
 				atomic_dec(&bh->b_count);
 				goto repeat;
@@ -232,17 +317,20 @@ repeat:
 				continue;
 
 			atomic_inc(&bh->b_count);
-			spin_unlock(&lru_list_lock);
+			bh_unlock(lru_lock(BUF_DIRTY));
 			ll_rw_block(WRITE, 1, &bh);
 			atomic_dec(&bh->b_count);
 			retry = 1;
 			goto repeat;
 		}
+    dirty_done:
+		bh_unlock(lru_lock(BUF_DIRTY));
 
     repeat2:
+		bh_lock(lru_lock(BUF_LOCKED));
 		bh = lru_list[BUF_LOCKED];
 		if (!bh) {
-			spin_unlock(&lru_list_lock);
+			bh_unlock(lru_lock(BUF_LOCKED));
 			break;
 		}
 		for (i = nr_buffers_type[BUF_LOCKED]*2 ; i-- > 0 ; bh = next) {
@@ -261,14 +349,13 @@ repeat:
 					continue;
 				}
 				atomic_inc(&bh->b_count);
-				spin_unlock(&lru_list_lock);
+				bh_unlock(lru_lock(BUF_LOCKED));
 				wait_on_buffer (bh);
-				spin_lock(&lru_list_lock);
 				atomic_dec(&bh->b_count);
 				goto repeat2;
 			}
 		}
-		spin_unlock(&lru_list_lock);
+		bh_unlock(lru_lock(BUF_LOCKED));
 
 		/* If we are waiting for the sync to succeed, and if any dirty
 		 * blocks were written, then repeat; on the second pass, only
@@ -371,8 +458,10 @@ asmlinkage long sys_fsync(unsigned int fd)
 
 	/* We need to protect against concurrent writers.. */
 	down(&inode->i_sem);
+	current->flags |= PF_SYNCWRITE;
 	filemap_fdatasync(inode->i_mapping);
 	err = file->f_op->fsync(file, dentry, 0);
+	current->flags &= ~PF_SYNCWRITE;
 	filemap_fdatawait(inode->i_mapping);
 	up(&inode->i_sem);
 
@@ -402,8 +491,10 @@ asmlinkage long sys_fdatasync(unsigned int fd)
 		goto out_putf;
 
 	down(&inode->i_sem);
+	current->flags |= PF_SYNCWRITE;
 	filemap_fdatasync(inode->i_mapping);
 	err = file->f_op->fsync(file, dentry, 1);
+	current->flags &= ~PF_SYNCWRITE;
 	filemap_fdatawait(inode->i_mapping);
 	up(&inode->i_sem);
 
@@ -420,7 +511,9 @@ out:
 	((((dev)<<(bh_hash_shift - 6)) ^ ((dev)<<(bh_hash_shift - 9))) ^ \
 	 (((block)<<(bh_hash_shift - 6)) ^ ((block) >> 13) ^ \
 	  ((block) << (bh_hash_shift - 12))))
-#define hash(dev,block) hash_table[(_hashfn(HASHDEV(dev),block) & bh_hash_mask)]
+#define bh_hashfn(dev,block) (_hashfn(HASHDEV(dev),block) & bh_hash_mask)
+#define hash(dev,block) hash_table[bh_hashfn(dev,block)]
+#define bh_hash_lock(dev,block) (&bh_hash_locks[bh_hashfn(dev,block) & (BH_HASH_LOCKS-1)])
 
 static __inline__ void __hash_link(struct buffer_head *bh, struct buffer_head **head)
 {
@@ -440,10 +533,45 @@ static __inline__ void __hash_unlink(struct buffer_head *bh)
 	}
 }
 
+static struct wb_dev * __find_wb_dev(kdev_t dev)
+{
+	struct wb_dev *wbd;
+
+	for (wbd = wb_hash[wb_hashfn(dev)]; wbd; wbd = wbd->hash_next)
+		if (wbd->dev == dev)
+			return wbd;
+	return &wb_other;
+}
+
+static struct wb_dev * __get_wb_dev(kdev_t dev)
+{
+	struct wb_dev *wbd = __find_wb_dev(dev);
+	int h = wb_hashfn(dev);
+
+	if (wbd != &wb_other)
+		return wbd;
+	wbd = kmalloc(sizeof(*wbd), GFP_ATOMIC);
+	if (!wbd)
+		return &wb_other;
+	memset(wbd, 0, sizeof(*wbd));
+	wbd->dev = dev;
+	wbd->age_pass = wb_age_pass;
+	init_waitqueue_head(&wbd->wait);
+	wbd->hash_next = wb_hash[h];
+	wb_hash[h] = wbd;
+	wbd->next = wb_devs;
+	wb_devs = wbd;
+	nr_wb_devs++;
+	return wbd;
+}
+
 static void __insert_into_lru_list(struct buffer_head * bh, int blist)
 {
 	struct buffer_head **bhp = &lru_list[blist];
 
+	if (blist == BUF_DIRTY)
+		__get_wb_dev(bh->b_dev)->dirty += bh->b_size;
+
 	if(!*bhp) {
 		*bhp = bh;
 		bh->b_prev_free = bh;
@@ -468,6 +596,15 @@ static void __remove_from_lru_list(struct buffer_head * bh, int blist)
 		bh->b_next_free = bh->b_prev_free = NULL;
 		nr_buffers_type[blist]--;
 		size_buffers_type[blist] -= bh->b_size;
+		if (blist == BUF_DIRTY) {
+			/* May not be where it was counted, if that failed */
+			struct wb_dev *wbd = __find_wb_dev(bh->b_dev);
+
+			if (wbd->dirty >= bh->b_size)
+				wbd->dirty -= bh->b_size;
+			else
+				wbd->dirty = 0;
+		}
 	}
 }
 
@@ -484,8 +621,100 @@ static void __remove_from_free_list(struct buffer_head * bh, int index)
 	bh->b_next_free = bh->b_prev_free = NULL;
 }
 
-/* must be called with both the hash_table_lock and the lru_list_lock
-   held */
+/*
+ * Lock the lru lists in mask, a bit for each list, in list order.
+ */
+static void lock_lru_lists(unsigned int mask)
+{
+	int i;
+
+	for (i = 0; i < NR_LIST; i++)
+		if (mask & (1 << i))
+			bh_lock(lru_lock(i));
+}
+
+static void unlock_lru_lists(unsigned int mask)
+{
+	int i;
+
+	for (i = NR_LIST - 1; i >= 0; i--)
+		if (mask & (1 << i))
+			bh_unlock(lru_lock(i));
+}
+
+/* Lock the list a buffer is on, it can't move to another one then */
+static int lock_buffer_lru_list(struct buffer_head *bh)
+{
+	int blist;
+
+	for (;;) {
+		blist = bh->b_list;
+		bh_lock(lru_lock(blist));
+		if (bh->b_list == blist)
+			return blist;
+		bh_unlock(lru_lock(blist));
+	}
+}
+
+/*
+ * Lock the lists the buffers of a page are on, they can't move to
+ * another one then. Returns the mask for unlock_lru_lists().
+ */
+static unsigned int lock_page_lru_lists(struct buffer_head *head)
+{
+	unsigned int mask = 0, want;
+	struct buffer_head *bh;
+
+	for (;;) {
+		want = mask;
+		bh = head;
+		do {
+			want |= 1 << bh->b_list;
+			bh = bh->b_this_page;
+		} while (bh != head);
+		if (want == mask)
+			return mask;
+		/* Some moved meanwhile, or this is the first pass */
+		unlock_lru_lists(mask);
+		mask = want;
+		lock_lru_lists(mask);
+	}
+}
+
+/*
+ * The hash locks of the buffers of a page, for try_to_free_buffers().
+ * map has a bit for each lock, they are taken in array order.
+ */
+#define BH_HASH_MAP	((BH_HASH_LOCKS + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static void lock_page_hash(struct buffer_head *head, unsigned long *map)
+{
+	struct buffer_head *bh = head;
+	int i;
+
+	memset(map, 0, BH_HASH_MAP * sizeof(unsigned long));
+	do {
+		i = bh_hash_lock(bh->b_dev, bh->b_blocknr) - bh_hash_locks;
+		map[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	for (i = 0; i < BH_HASH_LOCKS; i++)
+		if (map[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG)))
+			bh_lock(&bh_hash_locks[i]);
+}
+
+static void unlock_page_hash(unsigned long *map)
+{
+	int i;
+
+	for (i = 0; i < BH_HASH_LOCKS; i++)
+		if (map[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG)))
+			bh_unlock(&bh_hash_locks[i]);
+}
+
+/* must be called with the hash lock of the buffer and the lock of
+   its lru list held */
 static void __remove_from_queues(struct buffer_head *bh)
 {
 	__hash_unlink(bh);
@@ -547,11 +776,12 @@ static inline struct buffer_head * __get_hash_table(kdev_t dev, int block, int s
 
 struct buffer_head * get_hash_table(kdev_t dev, int block, int size)
 {
+	struct bh_lock *lock = bh_hash_lock(dev, block);
 	struct buffer_head *bh;
 
-	read_lock(&hash_table_lock);
+	bh_lock(lock);
 	bh = __get_hash_table(dev, block, size);
-	read_unlock(&hash_table_lock);
+	bh_unlock(lock);
 
 	return bh;
 }
@@ -577,15 +807,15 @@ unsigned int get_hardblocksize(kdev_t dev)
 
 void buffer_insert_inode_queue(struct buffer_head *bh, struct inode *inode)
 {
-	spin_lock(&lru_list_lock);
+	bh_lock(&inode_buffers_lock);
 	if (bh->b_inode)
 		list_del(&bh->b_inode_buffers);
 	bh->b_inode = inode;
 	list_add(&bh->b_inode_buffers, &inode->i_dirty_buffers);
-	spin_unlock(&lru_list_lock);
+	bh_unlock(&inode_buffers_lock);
 }
 
-/* The caller must have the lru_list lock before calling the 
+/* The caller must have the inode_buffers_lock before calling the 
    remove_inode_queue functions.  */
 static void __remove_inode_queue(struct buffer_head *bh)
 {
@@ -603,9 +833,9 @@ int inode_has_buffers(struct inode *inode)
 {
 	int ret;
 	
-	spin_lock(&lru_list_lock);
+	bh_lock(&inode_buffers_lock);
 	ret = !list_empty(&inode->i_dirty_buffers);
-	spin_unlock(&lru_list_lock);
+	bh_unlock(&inode_buffers_lock);
 	
 	return ret;
 }
@@ -635,10 +865,11 @@ void __invalidate_buffers(kdev_t dev, int destroy_dirty_buffers)
 {
 	int i, nlist, slept;
 	struct buffer_head * bh, * bh_next;
+	struct bh_lock *hlock;
 
  retry:
 	slept = 0;
-	spin_lock(&lru_list_lock);
+	lock_lru_lists(LRU_ALL);
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
 		bh = lru_list[nlist];
 		if (!bh)
@@ -654,14 +885,16 @@ void __invalidate_buffers(kdev_t dev, int destroy_dirty_buffers)
 				continue;
 			if (buffer_locked(bh)) {
 				atomic_inc(&bh->b_count);
-				spin_unlock(&lru_list_lock);
+				unlock_lru_lists(LRU_ALL);
 				wait_on_buffer(bh);
 				slept = 1;
-				spin_lock(&lru_list_lock);
+				lock_lru_lists(LRU_ALL);
 				atomic_dec(&bh->b_count);
 			}
 
-			write_lock(&hash_table_lock);
+			hlock = bh_hash_lock(bh->b_dev, bh->b_blocknr);
+			bh_lock(&inode_buffers_lock);
+			bh_lock(hlock);
 			if (!atomic_read(&bh->b_count) &&
 			    (destroy_dirty_buffers || !buffer_dirty(bh))) {
 				remove_inode_queue(bh);
@@ -670,13 +903,14 @@ void __invalidate_buffers(kdev_t dev, int destroy_dirty_buffers)
 			}
 			/* else complain loudly? */
 
-			write_unlock(&hash_table_lock);
+			bh_unlock(hlock);
+			bh_unlock(&inode_buffers_lock);
 			if (slept)
 				goto out;
 		}
 	}
 out:
-	spin_unlock(&lru_list_lock);
+	unlock_lru_lists(LRU_ALL);
 	if (slept)
 		goto retry;
 }
@@ -686,6 +920,7 @@ void set_blocksize(kdev_t dev, int size)
 	extern int *blksize_size[];
 	int i, nlist, slept;
 	struct buffer_head * bh, * bh_next;
+	struct bh_lock *hlock;
 
 	if (!blksize_size[MAJOR(dev)])
 		return;
@@ -705,7 +940,7 @@ void set_blocksize(kdev_t dev, int size)
 
  retry:
 	slept = 0;
-	spin_lock(&lru_list_lock);
+	lock_lru_lists(LRU_ALL);
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
 		bh = lru_list[nlist];
 		if (!bh)
@@ -716,14 +951,16 @@ void set_blocksize(kdev_t dev, int size)
 				continue;
 			if (buffer_locked(bh)) {
 				atomic_inc(&bh->b_count);
-				spin_unlock(&lru_list_lock);
+				unlock_lru_lists(LRU_ALL);
 				wait_on_buffer(bh);
 				slept = 1;
-				spin_lock(&lru_list_lock);
+				lock_lru_lists(LRU_ALL);
 				atomic_dec(&bh->b_count);
 			}
 
-			write_lock(&hash_table_lock);
+			hlock = bh_hash_lock(bh->b_dev, bh->b_blocknr);
+			bh_lock(&inode_buffers_lock);
+			bh_lock(hlock);
 			if (!atomic_read(&bh->b_count)) {
 				if (buffer_dirty(bh))
 					printk(KERN_WARNING
@@ -732,9 +969,14 @@ void set_blocksize(kdev_t dev, int size)
 				remove_inode_queue(bh);
 				__remove_from_queues(bh);
 				put_last_free(bh);
+				bh_unlock(hlock);
+				bh_unlock(&inode_buffers_lock);
 			} else {
+				/* Refiling may need the inode_buffers_lock */
+				bh_unlock(hlock);
+				bh_unlock(&inode_buffers_lock);
 				if (atomic_set_buffer_clean(bh))
-					__refile_buffer(bh);
+					__refile_buffer(bh, LRU_ALL);
 				clear_bit(BH_Uptodate, &bh->b_state);
 				printk(KERN_WARNING
 				       "set_blocksize: "
@@ -742,13 +984,12 @@ void set_blocksize(kdev_t dev, int size)
 				       atomic_read(&bh->b_count), bdevname(bh->b_dev),
 				       bh->b_blocknr, __builtin_return_address(0));
 			}
-			write_unlock(&hash_table_lock);
 			if (slept)
 				goto out;
 		}
 	}
  out:
-	spin_unlock(&lru_list_lock);
+	unlock_lru_lists(LRU_ALL);
 	if (slept)
 		goto retry;
 }
@@ -859,7 +1100,7 @@ int fsync_inode_buffers(struct inode *inode)
 	
 	INIT_LIST_HEAD(&tmp.i_dirty_buffers);
 	
-	spin_lock(&lru_list_lock);
+	bh_lock(&inode_buffers_lock);
 
 	while (!list_empty(&inode->i_dirty_buffers)) {
 		bh = BH_ENTRY(inode->i_dirty_buffers.next);
@@ -871,10 +1112,10 @@ int fsync_inode_buffers(struct inode *inode)
 			list_add(&bh->b_inode_buffers, &tmp.i_dirty_buffers);
 			if (buffer_dirty(bh)) {
 				atomic_inc(&bh->b_count);
-				spin_unlock(&lru_list_lock);
+				bh_unlock(&inode_buffers_lock);
 				ll_rw_block(WRITE, 1, &bh);
 				brelse(bh);
-				spin_lock(&lru_list_lock);
+				bh_lock(&inode_buffers_lock);
 			}
 		}
 	}
@@ -883,15 +1124,15 @@ int fsync_inode_buffers(struct inode *inode)
 		bh = BH_ENTRY(tmp.i_dirty_buffers.prev);
 		remove_inode_queue(bh);
 		atomic_inc(&bh->b_count);
-		spin_unlock(&lru_list_lock);
+		bh_unlock(&inode_buffers_lock);
 		wait_on_buffer(bh);
 		if (!buffer_uptodate(bh))
 			err = -EIO;
 		brelse(bh);
-		spin_lock(&lru_list_lock);
+		bh_lock(&inode_buffers_lock);
 	}
 	
-	spin_unlock(&lru_list_lock);
+	bh_unlock(&inode_buffers_lock);
 	err2 = osync_inode_buffers(inode);
 
 	if (err)
@@ -918,7 +1159,7 @@ int osync_inode_buffers(struct inode *inode)
 	struct list_head *list;
 	int err = 0;
 
-	spin_lock(&lru_list_lock);
+	bh_lock(&inode_buffers_lock);
 	
  repeat:
 	
@@ -927,17 +1168,17 @@ int osync_inode_buffers(struct inode *inode)
 	     list = bh->b_inode_buffers.prev) {
 		if (buffer_locked(bh)) {
 			atomic_inc(&bh->b_count);
-			spin_unlock(&lru_list_lock);
+			bh_unlock(&inode_buffers_lock);
 			wait_on_buffer(bh);
 			if (!buffer_uptodate(bh))
 				err = -EIO;
 			brelse(bh);
-			spin_lock(&lru_list_lock);
+			bh_lock(&inode_buffers_lock);
 			goto repeat;
 		}
 	}
 
-	spin_unlock(&lru_list_lock);
+	bh_unlock(&inode_buffers_lock);
 	return err;
 }
 
@@ -951,14 +1192,14 @@ void invalidate_inode_buffers(struct inode *inode)
 {
 	struct list_head *list, *next;
 	
-	spin_lock(&lru_list_lock);
+	bh_lock(&inode_buffers_lock);
 	list = inode->i_dirty_buffers.next; 
 	while (list != &inode->i_dirty_buffers) {
 		next = list->next;
 		remove_inode_queue(BH_ENTRY(list));
 		list = next;
 	}
-	spin_unlock(&lru_list_lock);
+	bh_unlock(&inode_buffers_lock);
 }
 
 
@@ -974,12 +1215,21 @@ void invalidate_inode_buffers(struct inode *inode)
  */
 struct buffer_head * getblk(kdev_t dev, int block, int size)
 {
+	struct bh_lock *hlock = bh_hash_lock(dev, block);
 	struct buffer_head * bh;
 	int isize;
 
+	/* Most of the time it is there, that needs the hash lock only */
+	bh_lock(hlock);
+	bh = __get_hash_table(dev, block, size);
+	bh_unlock(hlock);
+	if (bh)
+		goto found;
+
 repeat:
-	spin_lock(&lru_list_lock);
-	write_lock(&hash_table_lock);
+	/* A new buffer goes on the clean list */
+	bh_lock(lru_lock(BUF_CLEAN));
+	bh_lock(hlock);
 	bh = __get_hash_table(dev, block, size);
 	if (bh)
 		goto out;
@@ -1007,8 +1257,9 @@ repeat:
 		/* Insert the buffer into the regular lists */
 		__insert_into_queues(bh);
 	out:
-		write_unlock(&hash_table_lock);
-		spin_unlock(&lru_list_lock);
+		bh_unlock(hlock);
+		bh_unlock(lru_lock(BUF_CLEAN));
+	found:
 		touch_buffer(bh);
 		return bh;
 	}
@@ -1017,26 +1268,56 @@ repeat:
 	 * If we block while refilling the free list, somebody may
 	 * create the buffer first ... search the hashes again.
 	 */
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	bh_unlock(hlock);
+	bh_unlock(lru_lock(BUF_CLEAN));
 	refill_freelist(size);
 	goto repeat;
 }
 
+/*
+ * How many pages of dirty buffers a device may have when limit percent
+ * of the tot pages may be dirty: its share of that by write bandwidth,
+ * but no less than a twentieth. Devices not measured yet get an equal
+ * share. Called with the BUF_DIRTY list lock held.
+ */
+static unsigned long wb_dirty_limit(struct wb_dev *wbd, unsigned long tot,
+	int limit)
+{
+	unsigned long share;
+
+	if (!wbd->bandwidth || !wb_total_bandwidth)
+		share = 100 / (nr_wb_devs ? nr_wb_devs : 1);
+	else
+		share = wbd->bandwidth * 100 / wb_total_bandwidth;
+	if (share < 5)
+		share = 5;
+	return tot * limit / 100 * share / 100;
+}
+
 /* -1 -> no need to flush
     0 -> async flush
-    1 -> sync flush (wait for I/O completation) */
+    1 -> sync flush (wait for I/O completation)
+   For NODEV this is about all dirty buffers, else about those of dev. */
 int balance_dirty_state(kdev_t dev)
 {
 	unsigned long dirty, tot, hard_dirty_limit, soft_dirty_limit;
 	int shortage;
 
-	dirty = size_buffers_type[BUF_DIRTY] >> PAGE_SHIFT;
 	tot = nr_free_buffer_pages();
 
-	dirty *= 100;
-	soft_dirty_limit = tot * bdf_prm.b_un.nfract;
-	hard_dirty_limit = tot * bdf_prm.b_un.nfract_sync;
+	bh_lock(lru_lock(BUF_DIRTY));
+	if (dev == NODEV) {
+		dirty = size_buffers_type[BUF_DIRTY] >> PAGE_SHIFT;
+		soft_dirty_limit = tot * bdf_prm.b_un.nfract / 100;
+		hard_dirty_limit = tot * bdf_prm.b_un.nfract_sync / 100;
+	} else {
+		struct wb_dev *wbd = __find_wb_dev(dev);
+
+		dirty = wbd->dirty >> PAGE_SHIFT;
+		soft_dirty_limit = wb_dirty_limit(wbd, tot, bdf_prm.b_un.nfract);
+		hard_dirty_limit = wb_dirty_limit(wbd, tot, bdf_prm.b_un.nfract_sync);
+	}
+	bh_unlock(lru_lock(BUF_DIRTY));
 
 	/* First, check for the "real" dirty limit. */
 	if (dirty > soft_dirty_limit) {
@@ -1058,12 +1339,13 @@ int balance_dirty_state(kdev_t dev)
 	return -1;
 }
 
+static void wb_throttle(kdev_t dev);
+
 /*
  * if a new dirty buffer is created we need to balance bdflush.
  *
- * in the future we might want to make bdflush aware of different
- * pressures on different devices - thus the (currently unused)
- * 'dev' parameter.
+ * A writer that is over the limit of its device waits for that
+ * device only, writers to other devices can go on.
  */
 void balance_dirty(kdev_t dev)
 {
@@ -1071,6 +1353,10 @@ void balance_dirty(kdev_t dev)
 
 	if (state < 0)
 		return;
+	if (state > 0 && dev != NODEV) {
+		wb_throttle(dev);
+		return;
+	}
 	wakeup_bdflush(state);
 }
 
@@ -1094,11 +1380,7 @@ void mark_buffer_dirty(struct buffer_head *bh)
 	balance_dirty(bh->b_dev);
 }
 
-/*
- * A buffer may need to be moved from one buffer list to another
- * (e.g. in case it is not shared any more). Handle this.
- */
-static void __refile_buffer(struct buffer_head *bh)
+static inline int buffer_dispose(struct buffer_head *bh)
 {
 	int dispose = BUF_CLEAN;
 	if (buffer_locked(bh))
@@ -1107,20 +1389,67 @@ static void __refile_buffer(struct buffer_head *bh)
 		dispose = BUF_DIRTY;
 	if (buffer_protected(bh))
 		dispose = BUF_PROTECTED;
-	if (dispose != bh->b_list) {
+	return dispose;
+}
+
+/*
+ * A buffer may need to be moved from one buffer list to another
+ * (e.g. in case it is not shared any more). Handle this.
+ *
+ * held are the lru locks we have, the one of the list the buffer is on
+ * among them. If the list it belongs on is not, the buffer stays: its
+ * state changed under us, and whoever changed it refiles it after us.
+ */
+static void __refile_buffer(struct buffer_head *bh, unsigned int held)
+{
+	int dispose = buffer_dispose(bh);
+
+	if (dispose != bh->b_list && (held & (1 << dispose))) {
 		__remove_from_lru_list(bh, bh->b_list);
 		bh->b_list = dispose;
-		if (dispose == BUF_CLEAN)
+		if (dispose == BUF_CLEAN) {
+			bh_lock(&inode_buffers_lock);
 			remove_inode_queue(bh);
+			bh_unlock(&inode_buffers_lock);
+		}
 		__insert_into_lru_list(bh, dispose);
 	}
 }
 
+/*
+ * For a buffer on a list whose lock is held, when the list it goes to
+ * may come first in the lock order. If that one is busy the buffer
+ * stays where it is for now.
+ */
+static void __try_refile_buffer(struct buffer_head *bh)
+{
+	int blist = bh->b_list, dispose = buffer_dispose(bh);
+
+	if (dispose == blist)
+		return;
+	if (dispose > blist)
+		bh_lock(lru_lock(dispose));
+	else if (!bh_trylock(lru_lock(dispose)))
+		return;
+	__refile_buffer(bh, (1 << blist) | (1 << dispose));
+	bh_unlock(lru_lock(dispose));
+}
+
 void refile_buffer(struct buffer_head *bh)
 {
-	spin_lock(&lru_list_lock);
-	__refile_buffer(bh);
-	spin_unlock(&lru_list_lock);
+	unsigned int mask;
+	int blist;
+
+	for (;;) {
+		blist = bh->b_list;
+		mask = (1 << blist) | (1 << buffer_dispose(bh));
+		lock_lru_lists(mask);
+		if (bh->b_list == blist)
+			break;
+		unlock_lru_lists(mask);
+	}
+	__refile_buffer(bh, mask);
+	unlock_lru_lists(mask);
 }
 
 /*
@@ -1143,22 +1472,28 @@ void __brelse(struct buffer_head * buf)
  */
 void __bforget(struct buffer_head * buf)
 {
+	struct bh_lock *hlock = bh_hash_lock(buf->b_dev, buf->b_blocknr);
+	int blist;
+
 	/* grab the lru lock here to block bdflush. */
-	spin_lock(&lru_list_lock);
-	write_lock(&hash_table_lock);
+	blist = lock_buffer_lru_list(buf);
+	bh_lock(&inode_buffers_lock);
+	bh_lock(hlock);
 	if (!atomic_dec_and_test(&buf->b_count) || buffer_locked(buf))
 		goto in_use;
 	__hash_unlink(buf);
 	remove_inode_queue(buf);
-	write_unlock(&hash_table_lock);
-	__remove_from_lru_list(buf, buf->b_list);
-	spin_unlock(&lru_list_lock);
+	bh_unlock(hlock);
+	bh_unlock(&inode_buffers_lock);
+	__remove_from_lru_list(buf, blist);
+	bh_unlock(lru_lock(blist));
 	put_last_free(buf);
 	return;
 
  in_use:
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	bh_unlock(hlock);
+	bh_unlock(&inode_buffers_lock);
+	bh_unlock(lru_lock(blist));
 }
 
 /*
@@ -1494,10 +1829,10 @@ static int __block_write_full_page(struct inode *inode, struct page *page, get_b
 		BUG();
 
 	if (!page->buffers)
-		create_empty_buffers(page, inode->i_dev, inode->i_sb->s_blocksize);
+		create_empty_buffers(page, inode->i_dev, 1 << inode->i_blkbits);
 	head = page->buffers;
 
-	block = page->index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
+	block = page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
 
 	bh = head;
 	i = 0;
@@ -1559,12 +1894,12 @@ static int __block_prepare_write(struct inode *inode, struct page *page,
 	struct buffer_head *bh, *head, *wait[2], **wait_bh=wait;
 	char *kaddr = kmap(page);
 
-	blocksize = inode->i_sb->s_blocksize;
+	blocksize = 1 << inode->i_blkbits;
 	if (!page->buffers)
 		create_empty_buffers(page, inode->i_dev, blocksize);
 	head = page->buffers;
 
-	bbits = inode->i_sb->s_blocksize_bits;
+	bbits = inode->i_blkbits;
 	block = page->index << (PAGE_CACHE_SHIFT - bbits);
 
 	for(bh = head, block_start = 0; bh != head || !block_start;
@@ -1619,15 +1954,19 @@ out:
 	return err;
 }
 
-static int __block_commit_write(struct inode *inode, struct page *page,
+/*
+ * Returns whether buffers were newly dirtied, and so whether the caller
+ * has to balance_dirty().
+ */
+static int __block_commit_buffers(struct inode *inode, struct page *page,
 		unsigned from, unsigned to)
 {
 	unsigned block_start, block_end;
-	int partial = 0, need_balance_dirty = 0;
+	int partial = 0, need_balance_dirty = 0, delayed = 0;
 	unsigned blocksize;
 	struct buffer_head *bh, *head;
 
-	blocksize = inode->i_sb->s_blocksize;
+	blocksize = 1 << inode->i_blkbits;
 
 	for(bh = head = page->buffers, block_start = 0;
 	    bh != head || !block_start;
@@ -1638,7 +1977,9 @@ static int __block_commit_write(struct inode *inode, struct page *page,
 				partial = 1;
 		} else {
 			set_bit(BH_Uptodate, &bh->b_state);
-			if (!atomic_set_buffer_dirty(bh)) {
+			if (buffer_delay(bh))
+				delayed = 1;
+			else if (!atomic_set_buffer_dirty(bh)) {
 				__mark_dirty(bh);
 				buffer_insert_inode_queue(bh, inode);
 				need_balance_dirty = 1;
@@ -1646,8 +1987,9 @@ static int __block_commit_write(struct inode *inode, struct page *page,
 		}
 	}
 
-	if (need_balance_dirty)
-		balance_dirty(bh->b_dev);
+	/* A delayed buffer has nowhere to go yet, the page is dirty instead */
+	if (delayed)
+		set_page_dirty(page);
 	/*
 	 * is this a partial write that happened to make all buffers
 	 * uptodate then we can optimize away a bogus readpage() for
@@ -1656,6 +1998,14 @@ static int __block_commit_write(struct inode *inode, struct page *page,
 	 */
 	if (!partial)
 		SetPageUptodate(page);
+	return need_balance_dirty;
+}
+
+static int __block_commit_write(struct inode *inode, struct page *page,
+		unsigned from, unsigned to)
+{
+	if (__block_commit_buffers(inode, page, from, to))
+		balance_dirty(page->buffers->b_dev);
 	return 0;
 }
 
@@ -1676,14 +2026,14 @@ int block_read_full_page(struct page *page, get_block_t *get_block)
 
 	if (!PageLocked(page))
 		PAGE_BUG(page);
-	blocksize = inode->i_sb->s_blocksize;
+	blocksize = 1 << inode->i_blkbits;
 	if (!page->buffers)
 		create_empty_buffers(page, inode->i_dev, blocksize);
 	head = page->buffers;
 
-	blocks = PAGE_CACHE_SIZE >> inode->i_sb->s_blocksize_bits;
-	iblock = page->index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
-	lblock = (inode->i_size+blocksize-1) >> inode->i_sb->s_blocksize_bits;
+	blocks = PAGE_CACHE_SIZE >> inode->i_blkbits;
+	iblock = page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	lblock = (inode->i_size+blocksize-1) >> inode->i_blkbits;
 	bh = head;
 	nr = 0;
 	i = 0;
@@ -1751,7 +2101,7 @@ int cont_prepare_write(struct page *page, unsigned offset, unsigned to, get_bloc
 	unsigned long pgpos;
 	long status;
 	unsigned zerofrom;
-	unsigned blocksize = inode->i_sb->s_blocksize;
+	unsigned blocksize = 1 << inode->i_blkbits;
 	char *kaddr;
 
 	while(page->index > (pgpos = *bytes>>PAGE_CACHE_SHIFT)) {
@@ -1836,6 +2186,143 @@ int block_prepare_write(struct page *page, unsigned from, unsigned to,
 	return err;
 }
 
+/*
+ * block_prepare_write() for consecutive locked pages, the write going
+ * from @from in the first page to @to in the last.  Returns the number
+ * of pages prepared, which may be fewer than @nr, or an error if not
+ * even the first one could be.
+ */
+int block_prepare_write_pages(struct page **pages, int nr, unsigned from,
+			unsigned to, get_block_t *get_block)
+{
+	struct inode *inode = pages[0]->mapping->host;
+	int i, err;
+
+	for (i = 0; i < nr; i++) {
+		err = __block_prepare_write(inode, pages[i], i ? 0 : from,
+				i < nr - 1 ? PAGE_CACHE_SIZE : to, get_block);
+		if (err) {
+			ClearPageUptodate(pages[i]);
+			kunmap(pages[i]);
+			return i ? i : err;
+		}
+	}
+	return nr;
+}
+
+/*
+ * block_prepare_write() for delayed allocation: a block that isn't on
+ * disk yet is not allocated here. reserve() makes sure the filesystem
+ * will have one for it, and the buffer is marked BH_Delay. The commit
+ * then dirties the page rather than the buffer, and it is up to the
+ * filesystem's writepage to get the delayed buffers their blocks, with
+ * block_map_delayed(), before they can be written.
+ */
+int block_prepare_write_delay(struct page *page, unsigned from, unsigned to,
+			get_block_t *get_block, int (*reserve)(struct inode *))
+{
+	struct inode *inode = page->mapping->host;
+	unsigned block_start, block_end;
+	unsigned long block;
+	int err = 0;
+	unsigned blocksize, bbits;
+	struct buffer_head *bh, *head, *wait[2], **wait_bh=wait;
+	char *kaddr = kmap(page);
+
+	blocksize = 1 << inode->i_blkbits;
+	if (!page->buffers)
+		create_empty_buffers(page, inode->i_dev, blocksize);
+	head = page->buffers;
+
+	bbits = inode->i_blkbits;
+	block = page->index << (PAGE_CACHE_SHIFT - bbits);
+
+	for(bh = head, block_start = 0; bh != head || !block_start;
+	    block++, block_start=block_end, bh = bh->b_this_page) {
+		block_end = block_start+blocksize;
+		if (block_end <= from)
+			continue;
+		if (block_start >= to)
+			break;
+		if (buffer_delay(bh))
+			continue;
+		if (!buffer_mapped(bh)) {
+			err = get_block(inode, block, bh, 0);
+			if (err)
+				goto out;
+			if (!buffer_mapped(bh)) {
+				err = reserve(inode);
+				if (err)
+					goto out;
+				set_bit(BH_Delay, &bh->b_state);
+				if (Page_Uptodate(page)) {
+					set_bit(BH_Uptodate, &bh->b_state);
+					continue;
+				}
+				if (block_end > to)
+					memset(kaddr+to, 0, block_end-to);
+				if (block_start < from)
+					memset(kaddr+block_start, 0, from-block_start);
+				if (block_end > to || block_start < from)
+					flush_dcache_page(page);
+				continue;
+			}
+		}
+		if (Page_Uptodate(page)) {
+			set_bit(BH_Uptodate, &bh->b_state);
+			continue; 
+		}
+		if (!buffer_uptodate(bh) &&
+		     (block_start < from || block_end > to)) {
+			ll_rw_block(READ, 1, &bh);
+			*wait_bh++=bh;
+		}
+	}
+	while(wait_bh > wait) {
+		wait_on_buffer(*--wait_bh);
+		err = -EIO;
+		if (!buffer_uptodate(*wait_bh))
+			goto out;
+	}
+	return 0;
+out:
+	ClearPageUptodate(page);
+	kunmap(page);
+	return err;
+}
+
+/*
+ * Allocate the blocks of the delayed buffers of a locked page, in file
+ * order. *nr is how many got one; after an error the rest stay delayed.
+ */
+int block_map_delayed(struct page *page, get_block_t *get_block, int *nr)
+{
+	struct inode *inode = page->mapping->host;
+	struct buffer_head *bh, *head = page->buffers;
+	unsigned long block;
+	int err = 0;
+
+	*nr = 0;
+	if (!head)
+		return 0;
+	block = page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	bh = head;
+	do {
+		if (buffer_delay(bh)) {
+			err = get_block(inode, block, bh, 1);
+			if (err)
+				break;
+			if (buffer_new(bh))
+				unmap_underlying_metadata(bh);
+			clear_bit(BH_Delay, &bh->b_state);
+			(*nr)++;
+		}
+		block++;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return err;
+}
+
 int generic_commit_write(struct file *file, struct page *page,
 		unsigned from, unsigned to)
 {
@@ -1850,6 +2337,31 @@ int generic_commit_write(struct file *file, struct page *page,
 	return 0;
 }
 
+/*
+ * generic_commit_write() for pages prepared by block_prepare_write_pages().
+ * The size is updated and the dirty buffers balanced once for all of them.
+ */
+int block_commit_write_pages(struct file *file, struct page **pages, int nr,
+		unsigned from, unsigned to)
+{
+	struct inode *inode = pages[0]->mapping->host;
+	loff_t pos = ((loff_t)pages[nr - 1]->index << PAGE_CACHE_SHIFT) + to;
+	int i, need_balance_dirty = 0;
+
+	for (i = 0; i < nr; i++) {
+		need_balance_dirty |= __block_commit_buffers(inode, pages[i],
+				i ? 0 : from, i < nr - 1 ? PAGE_CACHE_SIZE : to);
+		kunmap(pages[i]);
+	}
+	if (pos > inode->i_size) {
+		inode->i_size = pos;
+		mark_inode_dirty(inode);
+	}
+	if (need_balance_dirty)
+		balance_dirty(pages[0]->buffers->b_dev);
+	return 0;
+}
+
 int block_truncate_page(struct address_space *mapping, loff_t from, get_block_t *get_block)
 {
 	unsigned long index = from >> PAGE_CACHE_SHIFT;
@@ -1860,7 +2372,7 @@ int block_truncate_page(struct address_space *mapping, loff_t from, get_block_t
 	struct buffer_head *bh;
 	int err;
 
-	blocksize = inode->i_sb->s_blocksize;
+	blocksize = 1 << inode->i_blkbits;
 	length = offset & (blocksize - 1);
 
 	/* Block boundary? Nothing to do */
@@ -1868,7 +2380,7 @@ int block_truncate_page(struct address_space *mapping, loff_t from, get_block_t
 		return 0;
 
 	length = blocksize - length;
-	iblock = index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
+	iblock = index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
 	
 	page = grab_cache_page(mapping, index);
 	err = PTR_ERR(page);
@@ -1888,6 +2400,13 @@ int block_truncate_page(struct address_space *mapping, loff_t from, get_block_t
 	}
 
 	err = 0;
+	if (buffer_delay(bh)) {
+		/* Not on disk yet, the page is dirty already */
+		memset(kmap(page) + offset, 0, length);
+		flush_dcache_page(page);
+		kunmap(page);
+		goto unlock;
+	}
 	if (!buffer_mapped(bh)) {
 		/* Hole? Nothing to do */
 		if (buffer_uptodate(bh))
@@ -1959,6 +2478,59 @@ done:
 	goto done;
 }
 
+/*
+ * Like block_write_full_page(), but when some buffers of the page are
+ * dirty only those are written.  A page without dirty buffers was
+ * dirtied as a whole, through mmap(), and is written in full.  For the
+ * page cache of a block device, where a clean buffer may be older than
+ * what a filesystem wrote to the same block since.
+ */
+int block_write_dirty_page(struct page *page, get_block_t *get_block)
+{
+	struct buffer_head *bh, *head, *arr[MAX_BUF_PER_PAGE];
+	int nr, i;
+
+	if (!PageLocked(page))
+		BUG();
+
+	head = page->buffers;
+	if (!head)
+		return block_write_full_page(page, get_block);
+	bh = head;
+	do {
+		if (buffer_dirty(bh))
+			break;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	if (!buffer_dirty(bh))
+		return block_write_full_page(page, get_block);
+
+	nr = 0;
+	bh = head;
+	do {
+		if (buffer_dirty(bh) && buffer_mapped(bh)) {
+			lock_buffer(bh);
+			if (buffer_dirty(bh)) {
+				bh->b_end_io = end_buffer_io_async;
+				atomic_inc(&bh->b_count);
+				clear_bit(BH_Dirty, &bh->b_state);
+				arr[nr++] = bh;
+			} else
+				unlock_buffer(bh);
+		}
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	if (!nr) {
+		UnlockPage(page);
+		return 0;
+	}
+	/* Done - end_buffer_io_async will unlock */
+	for (i = 0; i < nr; i++)
+		submit_bh(WRITE, arr[i]);
+	return 0;
+}
+
 int generic_block_bmap(struct address_space *mapping, long block, get_block_t *get_block)
 {
 	struct buffer_head tmp;
@@ -1969,6 +2541,51 @@ int generic_block_bmap(struct address_space *mapping, long block, get_block_t *g
 	return tmp.b_blocknr;
 }
 
+/*
+ * direct_IO() for block filesystems: maps the blocks of the kiobuf
+ * with get_block, allocating them for a write, and does the IO on the
+ * user pages. The caller has made sure that no cached page of the
+ * range holds data newer than the disk.
+ *
+ * A kiobuf with an end_io only gets its IO started, see
+ * brw_kiovec_async().
+ */
+int generic_direct_IO(int rw, struct inode * inode, struct kiobuf * iobuf,
+	unsigned long blocknr, int blocksize, get_block_t * get_block)
+{
+	unsigned long blocks[KIO_MAX_SECTORS];
+	int i, nr_blocks, err;
+
+	nr_blocks = iobuf->length / blocksize;
+	if (nr_blocks > KIO_MAX_SECTORS)
+		BUG();
+	for (i = 0; i < nr_blocks; i++, blocknr++) {
+		struct buffer_head bh;
+
+		bh.b_state = 0;
+		bh.b_dev = inode->i_dev;
+		bh.b_size = blocksize;
+
+		err = get_block(inode, blocknr, &bh, rw == WRITE);
+		if (err)
+			return err;
+		if (!buffer_mapped(&bh)) {
+			if (rw == WRITE)
+				BUG();
+			blocks[i] = -1UL;
+			continue;
+		}
+		/* The buffer cache may still have the block's old user */
+		if (buffer_new(&bh))
+			unmap_underlying_metadata(&bh);
+		blocks[i] = bh.b_blocknr;
+	}
+
+	if (iobuf->end_io)
+		return brw_kiovec_async(rw, iobuf, inode->i_dev, blocks, blocksize);
+	return brw_kiovec(rw, 1, &iobuf, inode->i_dev, blocks, blocksize);
+}
+
 /*
  * IO completion routine for a buffer_head being used for kiobuf IO: we
  * can't dispatch the kiobuf callback until io_count reaches 0.  
@@ -2033,7 +2650,8 @@ static int wait_kio(int rw, int nr, struct buffer_head *bh[], int size)
  * maybe wait on page->wait.
  *
  * It is up to the caller to make sure that there are enough blocks
- * passed in to completely map the iobufs to disk.
+ * passed in to completely map the iobufs to disk. A block of -1UL is
+ * a hole, reading it gives zeroes.
  */
 
 int brw_kiovec(int rw, int nr, struct kiobuf *iovec[], 
@@ -2086,6 +2704,18 @@ int brw_kiovec(int rw, int nr, struct kiobuf *iovec[],
 			
 			while (length > 0) {
 				blocknr = b[bufind++];
+				if (blocknr == -1UL) {
+					/* A hole of a file, O_DIRECT reads zeroes */
+					if (rw != READ)
+						BUG();
+					memset(kmap(map) + offset, 0, size);
+					flush_dcache_page(map);
+					kunmap(map);
+					transferred += size;
+					length -= size;
+					offset += size;
+					goto next_block;
+				}
 				tmp = get_unused_buffer_head(0);
 				if (!tmp) {
 					err = -ENOMEM;
@@ -2125,7 +2755,7 @@ int brw_kiovec(int rw, int nr, struct kiobuf *iovec[],
 						goto finished;
 					bhind = 0;
 				}
-				
+			next_block:
 				if (offset >= PAGE_SIZE) {
 					offset = 0;
 					break;
@@ -2159,6 +2789,111 @@ int brw_kiovec(int rw, int nr, struct kiobuf *iovec[],
 	goto finished;
 }
 
+/*
+ * brw_kiovec() for one kiobuf, without waiting: the IO completes
+ * through iobuf->end_io, which may be called from an interrupt.
+ *
+ * An error is returned only if no IO was started. Otherwise end_io
+ * will be called, with iobuf->errno set if there was an error; the
+ * buffer_heads stay on the kiobuf until brw_kiovec_done().
+ */
+int brw_kiovec_async(int rw, struct kiobuf *iobuf,
+		     kdev_t dev, unsigned long b[], int size)
+{
+	int		length;
+	int		pageind;
+	int		bufind;
+	int		offset;
+	unsigned long	blocknr;
+	struct page *	map;
+	struct buffer_head *tmp;
+
+	if ((iobuf->offset & (size-1)) ||
+	    (iobuf->length & (size-1)))
+		return -EINVAL;
+	if (!iobuf->nr_pages)
+		panic("brw_kiovec_async: iobuf not initialised");
+	for (pageind = 0; pageind < iobuf->nr_pages; pageind++)
+		if (!iobuf->maplist[pageind])
+			return -EFAULT;
+
+	iobuf->errno = 0;
+	iobuf->bh_list = NULL;
+	/* Keep end_io from running before we are done submitting */
+	atomic_inc(&iobuf->io_count);
+
+	offset = iobuf->offset;
+	length = iobuf->length;
+	bufind = 0;
+	for (pageind = 0; pageind < iobuf->nr_pages; pageind++) {
+		map = iobuf->maplist[pageind];
+
+		while (length > 0) {
+			blocknr = b[bufind++];
+			if (blocknr == -1UL) {
+				/* A hole of a file, O_DIRECT reads zeroes */
+				if (rw != READ)
+					BUG();
+				memset(kmap(map) + offset, 0, size);
+				flush_dcache_page(map);
+				kunmap(map);
+			} else {
+				tmp = get_unused_buffer_head(0);
+				if (!tmp) {
+					iobuf->errno = -ENOMEM;
+					goto out;
+				}
+
+				tmp->b_dev = B_FREE;
+				tmp->b_size = size;
+				set_bh_page(tmp, map, offset);
+				tmp->b_this_page = tmp;
+
+				init_buffer(tmp, end_buffer_io_kiobuf, iobuf);
+				tmp->b_dev = dev;
+				tmp->b_blocknr = blocknr;
+				tmp->b_state = (1 << BH_Mapped) | (1 << BH_Lock) | (1 << BH_Req);
+
+				if (rw == WRITE) {
+					set_bit(BH_Uptodate, &tmp->b_state);
+					clear_bit(BH_Dirty, &tmp->b_state);
+				}
+
+				/* Temporary buffers are never hashed */
+				tmp->b_next = iobuf->bh_list;
+				iobuf->bh_list = tmp;
+
+				atomic_inc(&iobuf->io_count);
+				submit_bh(rw, tmp);
+			}
+			length -= size;
+			offset += size;
+			if (offset >= PAGE_SIZE) {
+				offset = 0;
+				break;
+			}
+		}
+	}
+
+ out:
+	end_kio_request(iobuf, 1);
+	return 0;
+}
+
+/* The IO of brw_kiovec_async() is done, free its buffer_heads */
+void brw_kiovec_done(struct kiobuf *iobuf)
+{
+	struct buffer_head *bh, *next;
+
+	spin_lock(&unused_list_lock);
+	for (bh = iobuf->bh_list; bh; bh = next) {
+		next = bh->b_next;
+		__put_unused_buffer_head(bh);
+	}
+	spin_unlock(&unused_list_lock);
+	iobuf->bh_list = NULL;
+}
+
 /*
  * Start I/O on a page.
  * This function expects the page to be locked and may return
@@ -2332,7 +3067,7 @@ static void sync_page_buffers(struct buffer_head *bh, int wait)
 /*
  * Can the buffer be thrown out?
  */
-#define BUFFER_BUSY_BITS	((1<<BH_Dirty) | (1<<BH_Lock) | (1<<BH_Protected))
+#define BUFFER_BUSY_BITS	((1<<BH_Dirty) | (1<<BH_Lock) | (1<<BH_Protected) | (1<<BH_Delay))
 #define buffer_busy(bh)		(atomic_read(&(bh)->b_count) | ((bh)->b_state & BUFFER_BUSY_BITS))
 
 /*
@@ -2351,10 +3086,13 @@ int try_to_free_buffers(struct page * page, int wait)
 	struct buffer_head * tmp, * bh = page->buffers;
 	int index = BUFSIZE_INDEX(bh->b_size);
 	int loop = 0;
+	unsigned long hash_map[BH_HASH_MAP];
+	unsigned int lists;
 
 cleaned_buffers_try_again:
-	spin_lock(&lru_list_lock);
-	write_lock(&hash_table_lock);
+	lists = lock_page_lru_lists(bh);
+	bh_lock(&inode_buffers_lock);
+	lock_page_hash(bh, hash_map);
 	spin_lock(&free_list[index].lock);
 	tmp = bh;
 	do {
@@ -2390,15 +3128,17 @@ cleaned_buffers_try_again:
 	page->buffers = NULL;
 	page_cache_release(page);
 	spin_unlock(&free_list[index].lock);
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	unlock_page_hash(hash_map);
+	bh_unlock(&inode_buffers_lock);
+	unlock_lru_lists(lists);
 	return 1;
 
 busy_buffer_page:
 	/* Uhhuh, start writeback so that we don't end up with all dirty pages */
 	spin_unlock(&free_list[index].lock);
-	write_unlock(&hash_table_lock);
-	spin_unlock(&lru_list_lock);
+	unlock_page_hash(hash_map);
+	bh_unlock(&inode_buffers_lock);
+	unlock_lru_lists(lists);
 	if (wait) {
 		sync_page_buffers(bh, wait);
 		/* We waited synchronously, so we can free the buffers. */
@@ -2412,6 +3152,8 @@ busy_buffer_page:
 
 /* ================== Debugging =================== */
 
+static char *buf_types[NR_LIST] = { "CLEAN", "LOCKED", "DIRTY", "PROTECTED", };
+
 void show_buffers(void)
 {
 #ifdef CONFIG_SMP
@@ -2419,15 +3161,17 @@ void show_buffers(void)
 	int found = 0, locked = 0, dirty = 0, used = 0, lastused = 0;
 	int protected = 0;
 	int nlist;
-	static char *buf_types[NR_LIST] = { "CLEAN", "LOCKED", "DIRTY", "PROTECTED", };
 #endif
 
 	printk("Buffer memory:   %6dkB\n",
 			atomic_read(&buffermem_pages) << (PAGE_SHIFT-10));
 
 #ifdef CONFIG_SMP /* trylock does nothing on UP and so we could deadlock */
-	if (!spin_trylock(&lru_list_lock))
-		return;
+	for (nlist = 0; nlist < NR_LIST; nlist++)
+		if (!bh_trylock(lru_lock(nlist))) {
+			unlock_lru_lists((1 << nlist) - 1);
+			return;
+		}
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
 		found = locked = dirty = used = lastused = protected = 0;
 		bh = lru_list[nlist];
@@ -2456,10 +3200,39 @@ void show_buffers(void)
 		       buf_types[nlist], found, size_buffers_type[nlist]>>10,
 		       used, lastused, locked, protected, dirty);
 	}
-	spin_unlock(&lru_list_lock);
+	{
+		struct wb_dev *wbd;
+
+		for (wbd = wb_devs; wbd; wbd = wbd->next)
+			printk("%9s: %lu kbyte dirty, %lu kB/s%s\n",
+			       wbd == &wb_other ? "other" : kdevname(wbd->dev),
+			       wbd->dirty >> 10, wbd->bandwidth,
+			       wbd->flushing ? ", flushing" : "");
+	}
+	unlock_lru_lists(LRU_ALL);
 #endif
 }
 
+/* For /proc/buffer_locks, the hash locks are summed up */
+int get_buffer_lock_info(char *buf)
+{
+	unsigned long taken = 0, contended = 0;
+	int len, i;
+
+	len = sprintf(buf, "%-16s %12s %12s\n", "lock", "taken", "contended");
+	for (i = 0; i < NR_LIST; i++)
+		len += sprintf(buf + len, "lru %-12s %12lu %12lu\n", buf_types[i],
+			       lru_locks[i].taken, lru_locks[i].contended);
+	len += sprintf(buf + len, "%-16s %12lu %12lu\n", "inode buffers",
+		       inode_buffers_lock.taken, inode_buffers_lock.contended);
+	for (i = 0; i < BH_HASH_LOCKS; i++) {
+		taken += bh_hash_locks[i].taken;
+		contended += bh_hash_locks[i].contended;
+	}
+	len += sprintf(buf + len, "%-16s %12lu %12lu\n", "hash", taken, contended);
+	return len;
+}
+
 /* ===================== Init ======================= */
 
 /*
@@ -2524,22 +3297,73 @@ void __init buffer_init(unsigned long mempages)
 
 /* ====================== bdflush support =================== */
 
-/* This is a simple kernel daemon, whose job it is to provide a dynamic
- * response to dirty buffers.  Once this process is activated, we write back
- * a limited number of buffers to the disks and then go back to sleep again.
+/*
+ * Dirty buffers are written out by a pool of bdflush threads. Each takes
+ * one device at a time and writes a batch of it; as no other thread
+ * touches that device meanwhile, a slow device ties up one thread only
+ * and the rest go on with the other devices.
+ *
+ * The write rate seen by the threads gives each device's bandwidth,
+ * and a device may have a share of the dirty limits in proportion to
+ * it. Writers over the hard limit of their device wait for that device
+ * only, see balance_dirty().
  */
+#define NR_BDFLUSH	8	/* threads in the pool */
+#define WB_BATCH	32	/* buffers per ll_rw_block() */
+#define WB_MIN_SAMPLE	(64*1024)	/* bytes to measure bandwidth on */
+
 static DECLARE_WAIT_QUEUE_HEAD(bdflush_done);
-struct task_struct *bdflush_tsk = 0;
+static struct task_struct *bdflush_tsks[NR_BDFLUSH];
+static int nr_bdflush;
+
+/* Interrupts can wake us, so the idle flags have a lock of their own */
+static spinlock_t bdflush_lock = SPIN_LOCK_UNLOCKED;
+static int bdflush_idle[NR_BDFLUSH];
+
+static int is_bdflush(struct task_struct *tsk)
+{
+	int i;
+
+	for (i = 0; i < nr_bdflush; i++)
+		if (bdflush_tsks[i] == tsk)
+			return 1;
+	return 0;
+}
+
+static void wakeup_bdflush_threads(int nr)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&bdflush_lock, flags);
+	for (i = 0; i < nr_bdflush && nr > 0; i++) {
+		if (bdflush_idle[i]) {
+			bdflush_idle[i] = 0;
+			wake_up_process(bdflush_tsks[i]);
+			nr--;
+		}
+	}
+	spin_unlock_irqrestore(&bdflush_lock, flags);
+}
+
+static void set_bdflush_idle(int id, int idle)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bdflush_lock, flags);
+	bdflush_idle[id] = idle;
+	spin_unlock_irqrestore(&bdflush_lock, flags);
+}
 
 void wakeup_bdflush(int block)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	if (current == bdflush_tsk)
+	if (is_bdflush(current))
 		return;
 
 	if (!block) {
-		wake_up_process(bdflush_tsk);
+		wakeup_bdflush_threads(1);
 		return;
 	}
 
@@ -2550,26 +3374,121 @@ void wakeup_bdflush(int block)
 	__set_current_state(TASK_UNINTERRUPTIBLE);
 	add_wait_queue(&bdflush_done, &wait);
 
-	wake_up_process(bdflush_tsk);
+	wakeup_bdflush_threads(1);
 	schedule();
 
 	remove_wait_queue(&bdflush_done, &wait);
 	__set_current_state(TASK_RUNNING);
 }
 
+/*
+ * Wait until a batch of dev has been written. The timeout covers the
+ * case where no thread thought it needed writing after all.
+ */
+static void wb_throttle(kdev_t dev)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	struct wb_dev *wbd;
+
+	if (is_bdflush(current))
+		return;
+
+	bh_lock(lru_lock(BUF_DIRTY));
+	wbd = __find_wb_dev(dev);
+	add_wait_queue(&wbd->wait, &wait);
+	__set_current_state(TASK_UNINTERRUPTIBLE);
+	if (!wbd->flushing)
+		wakeup_bdflush_threads(1);
+	bh_unlock(lru_lock(BUF_DIRTY));
+
+	schedule_timeout(HZ);
+	remove_wait_queue(&wbd->wait, &wait);
+}
+
+/*
+ * Pick a device for a bdflush thread and claim it: first one kupdate
+ * wants its old buffers written of, then the one furthest over its
+ * share of the dirty limit or, if memory is short, the one with the
+ * most dirty buffers. *age is set for a kupdate pass. Marks the thread
+ * idle if there is nothing to do, under the BUF_DIRTY list lock so that
+ * anybody who makes work for us later sees it.
+ */
+static struct wb_dev * wb_get_work(int id, int *age)
+{
+	unsigned long tot = nr_free_buffer_pages();
+	int shortage = free_shortage();
+	struct wb_dev *wbd, *best = NULL;
+	unsigned long dirty, limit, over, best_over = 0;
+
+	*age = 0;
+	bh_lock(lru_lock(BUF_DIRTY));
+	for (wbd = wb_devs; wbd; wbd = wbd->next) {
+		if (wbd->flushing || !wbd->dirty)
+			continue;
+		if (wbd->age_pass != wb_age_pass) {
+			wbd->age_pass = wb_age_pass;
+			best = wbd;
+			*age = 1;
+			goto found;
+		}
+		dirty = wbd->dirty >> PAGE_SHIFT;
+		limit = wb_dirty_limit(wbd, tot, bdf_prm.b_un.nfract);
+		over = dirty > limit ? dirty - limit : 0;
+		if (shortage)
+			over = dirty;
+		if (over > best_over) {
+			best = wbd;
+			best_over = over;
+		}
+	}
+	if (!best) {
+		set_bdflush_idle(id, 1);
+		bh_unlock(lru_lock(BUF_DIRTY));
+		return NULL;
+	}
+found:
+	best->flushing = 1;
+	set_bdflush_idle(id, 0);
+	bh_unlock(lru_lock(BUF_DIRTY));
+	return best;
+}
+
+/* Done with a batch of wbd that wrote written bytes in elapsed jiffies */
+static void wb_put_work(struct wb_dev *wbd, unsigned long written,
+	unsigned long elapsed)
+{
+	bh_lock(lru_lock(BUF_DIRTY));
+	wbd->flushing = 0;
+	/* A small batch goes out faster than the disk can take it */
+	if (written >= WB_MIN_SAMPLE) {
+		unsigned long old = wbd->bandwidth, kbs;
+
+		kbs = (written >> 10) * HZ / (elapsed ? elapsed : 1);
+		wbd->bandwidth = old ? (old * 3 + kbs) / 4 : kbs;
+		wb_total_bandwidth += wbd->bandwidth - old;
+	}
+	wake_up(&wbd->wait);
+	bh_unlock(lru_lock(BUF_DIRTY));
+}
+
 /* This is the _only_ function that deals with flushing async writes
    to disk.
    NOTENOTENOTENOTE: we _only_ need to browse the DIRTY lru list
    as all dirty buffers lives _only_ in the DIRTY lru list.
    As we never browse the LOCKED and CLEAN lru lists they are infact
-   completly useless. */
-static int flush_dirty_buffers(int check_flushtime)
+   completly useless.
+   Writes the buffers of wbd only, WB_BATCH at a time, and adds the
+   bytes submitted to *written. */
+static int flush_dirty_buffers(struct wb_dev *wbd, int check_flushtime,
+	unsigned long *written)
 {
 	struct buffer_head * bh, *next;
-	int flushed = 0, i;
+	struct buffer_head * batch[WB_BATCH];
+	int flushed = 0, nr, i;
 
  restart:
-	spin_lock(&lru_list_lock);
+	nr = 0;
+	bh_lock(lru_lock(BUF_DIRTY));
 	bh = lru_list[BUF_DIRTY];
 	if (!bh)
 		goto out_unlock;
@@ -2577,7 +3496,7 @@ static int flush_dirty_buffers(int check_flushtime)
 		next = bh->b_next_free;
 
 		if (!buffer_dirty(bh)) {
-			__refile_buffer(bh);
+			__try_refile_buffer(bh);
 			continue;
 		}
 		if (buffer_locked(bh))
@@ -2589,25 +3508,41 @@ static int flush_dirty_buffers(int check_flushtime)
 			   then also all the following bhs
 			   will be too young. */
 			if (time_before(jiffies, bh->b_flushtime))
-				goto out_unlock;
-		} else {
-			if (++flushed > bdf_prm.b_un.ndirty)
-				goto out_unlock;
+				break;
 		}
 
+		/* Only ours, and only what fits in one ll_rw_block() */
+		if (wbd != &wb_other && bh->b_dev != wbd->dev)
+			continue;
+		if (nr && (bh->b_dev != batch[0]->b_dev ||
+			   bh->b_size != batch[0]->b_size))
+			continue;
+
+		if (!check_flushtime && ++flushed > bdf_prm.b_un.ndirty)
+			break;
+
 		/* OK, now we are committed to write it out. */
 		atomic_inc(&bh->b_count);
-		spin_unlock(&lru_list_lock);
-		ll_rw_block(WRITE, 1, &bh);
-		atomic_dec(&bh->b_count);
-
-		if (current->need_resched)
-			schedule();
-		goto restart;
+		batch[nr++] = bh;
+		if (nr == WB_BATCH)
+			break;
 	}
  out_unlock:
-	spin_unlock(&lru_list_lock);
+	bh_unlock(lru_lock(BUF_DIRTY));
+	if (!nr)
+		return flushed;
+
+	ll_rw_block(WRITE, nr, batch);
+	for (i = 0; i < nr; i++) {
+		*written += batch[i]->b_size;
+		atomic_dec(&batch[i]->b_count);
+	}
 
+	if (current->need_resched)
+		schedule();
+	/* A short batch means we ran out of buffers, or of ndirty */
+	if (nr == WB_BATCH)
+		goto restart;
 	return flushed;
 }
 
@@ -2621,12 +3556,23 @@ static int flush_dirty_buffers(int check_flushtime)
 
 static int sync_old_buffers(void)
 {
+	struct wb_dev *wbd;
+	int nr = 0;
+
 	lock_kernel();
 	sync_supers(0);
-	sync_inodes(0);
+	writeback_inodes(bdf_prm.b_un.npages);
+	DQUOT_SYNC(NODEV);
 	unlock_kernel();
 
-	flush_dirty_buffers(1);
+	/* Have the bdflush threads write the old buffers of each device */
+	bh_lock(lru_lock(BUF_DIRTY));
+	wb_age_pass++;
+	for (wbd = wb_devs; wbd; wbd = wbd->next)
+		if (wbd->dirty)
+			nr++;
+	wakeup_bdflush_threads(nr);
+	bh_unlock(lru_lock(BUF_DIRTY));
 	/* must really sync all the active I/O request to disk here */
 	run_task_queue(&tq_disk);
 	return 0;
@@ -2695,11 +3641,15 @@ asmlinkage long sys_bdflush(int func, long data)
  * This is the actual bdflush daemon itself. It used to be started from
  * the syscall above, but now we launch it ourselves internally with
  * kernel_thread(...)  directly after the first thread in init/main.c
+ * There are NR_BDFLUSH of them, the first one also launders pages
+ * when memory is short.
  */
 int bdflush(void *sem)
 {
 	struct task_struct *tsk = current;
-	int flushed;
+	struct wb_dev *wbd;
+	unsigned long written, start;
+	int id, age;
 	/*
 	 *	We have a bare-bones task_struct, and really should fill
 	 *	in a few more things so "top" and /proc/2/{exe,root,cwd}
@@ -2708,8 +3658,10 @@ int bdflush(void *sem)
 
 	tsk->session = 1;
 	tsk->pgrp = 1;
-	strcpy(tsk->comm, "bdflush");
-	bdflush_tsk = tsk;
+	id = nr_bdflush;
+	sprintf(tsk->comm, "bdflush/%d", id);
+	bdflush_tsks[id] = tsk;
+	nr_bdflush++;
 
 	/* avoid getting signals */
 	spin_lock_irq(&tsk->sigmask_lock);
@@ -2721,34 +3673,43 @@ int bdflush(void *sem)
 	up((struct semaphore *)sem);
 
 	for (;;) {
-		CHECK_EMERGENCY_SYNC
-
-		flushed = flush_dirty_buffers(0);
-		if (free_shortage())
-			flushed += page_launder(GFP_BUFFER, 0);
-
-		/* If wakeup_bdflush will wakeup us
-		   after our bdflush_done wakeup, then
-		   we must make sure to not sleep
-		   in schedule_timeout otherwise
-		   wakeup_bdflush may wait for our
-		   bdflush_done wakeup that would never arrive
-		   (as we would be sleeping) and so it would
-		   deadlock in SMP. */
-		__set_current_state(TASK_INTERRUPTIBLE);
-		wake_up_all(&bdflush_done);
+		int laundered = 0;
+
+		if (id == 0) {
+			CHECK_EMERGENCY_SYNC
+
+			if (free_shortage())
+				laundered = page_launder(GFP_BUFFER, 0);
+		}
+
 		/*
-		 * If there are still a lot of dirty buffers around,
-		 * skip the sleep and flush some more. Otherwise, we
-		 * go to sleep waiting a wakeup.
+		 * If wakeup_bdflush will wakeup us after we were
+		 * marked idle, then we must make sure to not sleep
+		 * in schedule otherwise wakeup_bdflush may wait for
+		 * our bdflush_done wakeup that would never arrive
+		 * (as we would be sleeping) and so it would deadlock
+		 * in SMP.
 		 */
-		if (!flushed || balance_dirty_state(NODEV) < 0) {
-			run_task_queue(&tq_disk);
-			schedule();
+		__set_current_state(TASK_INTERRUPTIBLE);
+		wbd = wb_get_work(id, &age);
+		if (!wbd) {
+			wake_up_all(&bdflush_done);
+			if (!laundered) {
+				run_task_queue(&tq_disk);
+				schedule();
+			}
+			/* Remember to mark us as running otherwise
+			   the next schedule will block. */
+			__set_current_state(TASK_RUNNING);
+			continue;
 		}
-		/* Remember to mark us as running otherwise
-		   the next schedule will block. */
 		__set_current_state(TASK_RUNNING);
+
+		written = 0;
+		start = jiffies;
+		flush_dirty_buffers(wbd, age, &written);
+		wb_put_work(wbd, written, jiffies - start);
+		wake_up_all(&bdflush_done);
 	}
 }
 
@@ -2810,8 +3771,12 @@ int kupdate(void *sem)
 static int __init bdflush_init(void)
 {
 	DECLARE_MUTEX_LOCKED(sem);
-	kernel_thread(bdflush, &sem, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
-	down(&sem);
+	int i;
+
+	for (i = 0; i < NR_BDFLUSH; i++) {
+		kernel_thread(bdflush, &sem, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
+		down(&sem);
+	}
 	kernel_thread(kupdate, &sem, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
 	down(&sem);
 	return 0;
@@ -44,7 +44,14 @@ struct cramfs_super {
  */
 #define CRAMFS_SUPPORTED_FLAGS (0xff)
 
+/*
+ * Compressed input is staged in a per-CPU buffer this big before
+ * it is uncompressed; see uncompress.c.
+ */
+#define CRAMFS_SCRATCH_SIZE (2*PAGE_CACHE_SIZE)
+
 /* Uncompression interfaces to the underlying zlib */
+void *cramfs_uncompress_scratch(void);
 int cramfs_uncompress_block(void *dst, int dstlen, void *src, int srclen);
 int cramfs_uncompress_init(void);
 int cramfs_uncompress_exit(void);
@@ -9,8 +9,6 @@
 #include "infcodes.h"
 #include "infutil.h"
 
-struct inflate_codes_state {int dummy;}; /* for buggy compilers */
-
 /* simplify the use of the inflate_huft type with some defines */
 #define exop word.what.Exop
 #define bits word.what.Bits
@@ -89,13 +87,9 @@ check_func c;
 uInt w;
 {
   inflate_blocks_statef *s;
-  static struct inflate_blocks_state working_blocks_state;
-  static inflate_huft working_hufts[MANY];
-  static unsigned char working_window[1 << MAX_WBITS];
-
-  s = &working_blocks_state;
-  s->hufts = working_hufts;
-  s->window = working_window;
+  s = &WS(z)->working_blocks_state;
+  s->hufts = WS(z)->working_hufts;
+  s->window = WS(z)->working_window;
   s->end = s->window + w;
   s->checkfn = c;
   s->mode = TYPE;
@@ -157,7 +151,7 @@ int r;
           break;
         case 3:                         /* illegal */
           DUMPBITS(3)
-          s->mode = BAD;
+          s->mode = B_BAD;
           z->msg = (char*)"invalid block type";
           r = Z_DATA_ERROR;
           LEAVE
@@ -167,7 +161,7 @@ int r;
       NEEDBITS(32)
       if ((((~b) >> 16) & 0xffff) != (b & 0xffff))
       {
-        s->mode = BAD;
+        s->mode = B_BAD;
         z->msg = (char*)"invalid stored block lengths";
         r = Z_DATA_ERROR;
         LEAVE
@@ -196,16 +190,13 @@ int r;
 #ifndef PKZIP_BUG_WORKAROUND
       if ((t & 0x1f) > 29 || ((t >> 5) & 0x1f) > 29)
       {
-        s->mode = BAD;
+        s->mode = B_BAD;
         z->msg = (char*)"too many length or distance symbols";
         r = Z_DATA_ERROR;
         LEAVE
       }
 #endif
-      {
-      	static unsigned int working_blens [258 + 0x1f + 0x1f];
-      	s->sub.trees.blens = working_blens;
-      }
+      s->sub.trees.blens = WS(z)->working_blens;
       DUMPBITS(14)
       s->sub.trees.index = 0;
       s->mode = BTREE;
@@ -225,7 +216,7 @@ int r;
       {
         r = t;
         if (r == Z_DATA_ERROR)
-          s->mode = BAD;
+          s->mode = B_BAD;
         LEAVE
       }
       s->sub.trees.index = 0;
@@ -260,7 +251,7 @@ int r;
           if (i + j > 258 + (t & 0x1f) + ((t >> 5) & 0x1f) ||
               (c == 16 && i < 1))
           {
-            s->mode = BAD;
+            s->mode = B_BAD;
             z->msg = (char*)"invalid bit length repeat";
             r = Z_DATA_ERROR;
             LEAVE
@@ -287,7 +278,7 @@ int r;
         if (t != Z_OK)
         {
           if (t == (uInt)Z_DATA_ERROR)
-            s->mode = BAD;
+            s->mode = B_BAD;
           r = t;
           LEAVE
         }
@@ -316,11 +307,11 @@ int r;
       FLUSH
       if (s->read != s->write)
         LEAVE
-      s->mode = DONE;
-    case DONE:
+      s->mode = B_DONE;
+    case B_DONE:
       r = Z_STREAM_END;
       LEAVE
-    case BAD:
+    case B_BAD:
       r = Z_DATA_ERROR;
       LEAVE
     default:
@@ -10,8 +10,6 @@
 #include "infutil.h"
 #include "inffast.h"
 
-struct inflate_codes_state {int dummy;}; /* for buggy compilers */
-
 /* simplify the use of the inflate_huft type with some defines */
 #define exop word.what.Exop
 #define bits word.what.Bits
@@ -5,49 +5,14 @@
 
 #include "zutil.h"
 #include "infblock.h"
+#include "inftrees.h"
+#include "infcodes.h"
+#include "infutil.h"
 
-struct inflate_blocks_state {int dummy;}; /* for buggy compilers */
-
-typedef enum {
-      METHOD,   /* waiting for method byte */
-      FLAG,     /* waiting for flag byte */
-      DICT4,    /* four dictionary check bytes to go */
-      DICT3,    /* three dictionary check bytes to go */
-      DICT2,    /* two dictionary check bytes to go */
-      DICT1,    /* one dictionary check byte to go */
-      DICT0,    /* waiting for inflateSetDictionary */
-      BLOCKS,   /* decompressing blocks */
-      CHECK4,   /* four check bytes to go */
-      CHECK3,   /* three check bytes to go */
-      CHECK2,   /* two check bytes to go */
-      CHECK1,   /* one check byte to go */
-      DONE,     /* finished check, done */
-      BAD}      /* got an error--stay here */
-inflate_mode;
-
-/* inflate private state */
-struct internal_state {
-
-  /* mode */
-  inflate_mode  mode;   /* current inflate mode */
-
-  /* mode dependent information */
-  union {
-    uInt method;        /* if FLAGS, method byte */
-    struct {
-      uLong was;                /* computed check value */
-      uLong need;               /* stream check value */
-    } check;            /* if CHECK, check values to compare */
-    uInt marker;        /* if BAD, inflateSync's marker bytes count */
-  } sub;        /* submode */
-
-  /* mode independent information */
-  int  nowrap;          /* flag for no wrapper */
-  uInt wbits;           /* log2(window size)  (8..15, defaults to 15) */
-  inflate_blocks_statef 
-    *blocks;            /* current inflate_blocks state */
-
-};
+int ZEXPORT cramfs_inflate_workspacesize()
+{
+  return sizeof(struct inflate_workspace);
+}
 
 
 int ZEXPORT cramfs_inflateReset(z)
@@ -81,8 +46,6 @@ int w;
 const char *version;
 int stream_size;
 {
-  static struct internal_state internal_state;
-
   if (version == Z_NULL || version[0] != ZLIB_VERSION[0] ||
       stream_size != sizeof(z_stream))
       return Z_VERSION_ERROR;
@@ -91,7 +54,7 @@ int stream_size;
   if (z == Z_NULL)
     return Z_STREAM_ERROR;
   z->msg = Z_NULL;
-  z->state = &internal_state;
+  z->state = &WS(z)->internal_state;
   z->state->blocks = Z_NULL;
 
   /* handle undocumented nowrap option (no zlib header or check) */
@@ -5,6 +5,9 @@
 
 #include "zutil.h"
 #include "inftrees.h"
+#include "infblock.h"
+#include "infcodes.h"
+#include "infutil.h"
 
 static const char inflate_copyright[] =
    " inflate 1.1.3 Copyright 1995-1998 Mark Adler ";
@@ -14,8 +17,6 @@ static const char inflate_copyright[] =
   include such an acknowledgment, I would appreciate that you keep this
   copyright string in the executable of your product.
  */
-struct internal_state  {int dummy;}; /* for buggy compilers */
-
 /* simplify the use of the inflate_huft type with some defines */
 #define exop word.what.Exop
 #define bits word.what.Bits
@@ -297,9 +298,8 @@ z_streamp z;            /* for messages */
   int r;
   uInt hn = 0;          /* hufts used in space */
   uIntf *v;             /* work area for huft_build */
-  static unsigned int work_area[19];
 
-  v = work_area;
+  v = WS(z)->tree_work_area_1;
   r = huft_build(c, 19, 19, (uIntf*)Z_NULL, (uIntf*)Z_NULL,
                  tb, bb, hp, &hn, v);
   if (r == Z_DATA_ERROR)
@@ -326,10 +326,9 @@ z_streamp z;            /* for messages */
   int r;
   uInt hn = 0;          /* hufts used in space */
   uIntf *v;             /* work area for huft_build */
-  static unsigned int work_area[288];
 
   /* allocate work area */
-  v = work_area;
+  v = WS(z)->tree_work_area_2;
 
   /* build literal/length tree */
   r = huft_build(c, nl, 257, cplens, cplext, tl, bl, hp, &hn, v);
@@ -9,8 +9,6 @@
 #include "infcodes.h"
 #include "infutil.h"
 
-struct inflate_codes_state {int dummy;}; /* for buggy compilers */
-
 /* And'ing with mask[n] masks the lower n bits */
 uInt cramfs_inflate_mask[17] = {
     0x0000,
@@ -20,8 +20,8 @@ typedef enum {
       DTREE,    /* get length, distance trees for a dynamic block */
       CODES,    /* processing fixed or dynamic block */
       DRY,      /* output remaining window bytes */
-      DONE,     /* finished last block, done */
-      BAD}      /* got a data error--stuck here */
+      B_DONE,     /* finished last block, done */
+      B_BAD}      /* got a data error--stuck here */
 inflate_block_mode;
 
 /* inflate blocks semi-private state */
@@ -93,6 +93,63 @@ extern int cramfs_inflate_flush OF((
     z_streamp ,
     int));
 
-struct internal_state      {int dummy;}; /* for buggy compilers */
+typedef enum {
+      METHOD,   /* waiting for method byte */
+      FLAG,     /* waiting for flag byte */
+      DICT4,    /* four dictionary check bytes to go */
+      DICT3,    /* three dictionary check bytes to go */
+      DICT2,    /* two dictionary check bytes to go */
+      DICT1,    /* one dictionary check byte to go */
+      DICT0,    /* waiting for inflateSetDictionary */
+      BLOCKS,   /* decompressing blocks */
+      CHECK4,   /* four check bytes to go */
+      CHECK3,   /* three check bytes to go */
+      CHECK2,   /* two check bytes to go */
+      CHECK1,   /* one check byte to go */
+      DONE,     /* finished check, done */
+      BAD}      /* got an error--stay here */
+inflate_mode;
+
+/* inflate private state */
+struct internal_state {
+
+  /* mode */
+  inflate_mode  mode;   /* current inflate mode */
+
+  /* mode dependent information */
+  union {
+    uInt method;        /* if FLAGS, method byte */
+    struct {
+      uLong was;                /* computed check value */
+      uLong need;               /* stream check value */
+    } check;            /* if CHECK, check values to compare */
+    uInt marker;        /* if BAD, inflateSync's marker bytes count */
+  } sub;        /* submode */
+
+  /* mode independent information */
+  int  nowrap;          /* flag for no wrapper */
+  uInt wbits;           /* log2(window size)  (8..15, defaults to 15) */
+  inflate_blocks_statef 
+    *blocks;            /* current inflate_blocks state */
+
+};
+
+/*
+ * Everything inflate used to keep in static variables lives here, so
+ * that several streams can decompress at the same time as long as
+ * each has its own workspace (see cramfs_inflate_workspacesize()).
+ */
+struct inflate_workspace {
+  struct internal_state internal_state;
+  struct inflate_blocks_state working_blocks_state;
+  struct inflate_codes_state working_state;
+  uInt tree_work_area_1[19];
+  uInt tree_work_area_2[288];
+  uInt working_blens[258 + 0x1f + 0x1f];
+  inflate_huft working_hufts[MANY];
+  unsigned char working_window[1 << MAX_WBITS];
+};
+
+#define WS(z) ((struct inflate_workspace *)(z)->workspace)
 
 #endif
@@ -76,6 +76,7 @@ typedef struct z_stream_s {
 
     char     *msg;      /* last error message, NULL if no error */
     struct internal_state FAR *state; /* not visible by applications */
+    void     *workspace; /* memory for the state, see below */
 
     alloc_func nozalloc;  /* used to allocate the internal state */
     free_func  nozfree;   /* used to free the internal state */
@@ -391,6 +392,15 @@ ZEXTERN int ZEXPORT cramfs_inflateEnd OF((z_streamp strm));
    static string (which must not be deallocated).
 */
 
+ZEXTERN int ZEXPORT cramfs_inflate_workspacesize OF((void));
+/*
+     Returns the number of bytes the caller must allocate and hang off
+   strm->workspace before calling inflateInit.  This version of the
+   library never allocates anything itself; all of the state for one
+   stream lives in its workspace, so streams with separate workspaces
+   can be used concurrently.
+*/
+
                         /* Advanced functions */
 
 /*
@@ -17,6 +17,8 @@
 #include <linux/init.h>
 #include <linux/string.h>
 #include <linux/locks.h>
+#include <linux/slab.h>
+#include <linux/highmem.h>
 
 #include <asm/uaccess.h>
 
@@ -93,9 +95,16 @@ static unsigned buffer_blocknr[READ_BUFFERS];
 static struct super_block * buffer_dev[READ_BUFFERS];
 static int next_buffer;
 
+/*
+ * read_mutex protects the read buffers above. Pointers returned by
+ * cramfs_read() are only good while it is held.
+ */
+static DECLARE_MUTEX(read_mutex);
+
 /*
  * Returns a pointer to a buffer containing at least LEN bytes of
  * filesystem starting at byte offset OFFSET into the filesystem.
+ * Called with read_mutex held.
  */
 static void *cramfs_read(struct super_block *sb, unsigned int offset, unsigned int len)
 {
@@ -158,12 +167,14 @@ static struct super_block * cramfs_read_super(struct super_block *sb, void *data
 	sb->s_blocksize = PAGE_CACHE_SIZE;
 	sb->s_blocksize_bits = PAGE_CACHE_SHIFT;
 
+	down(&read_mutex);
 	/* Invalidate the read buffers on mount: think disk change.. */
 	for (i = 0; i < READ_BUFFERS; i++)
 		buffer_blocknr[i] = -1;
 
 	/* Read the first block and get the superblock from it */
 	memcpy(&super, cramfs_read(sb, 0, sizeof(super)), sizeof(super));
+	up(&read_mutex);
 
 	/* Do sanity checks on the superblock */
 	if (super.magic != CRAMFS_MAGIC) {
@@ -220,6 +231,7 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 	struct inode *inode = filp->f_dentry->d_inode;
 	struct super_block *sb = inode->i_sb;
 	unsigned int offset;
+	char *buf;
 	int copied;
 
 	/* Offset within the thing. */
@@ -230,13 +242,24 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 	if (offset & 3)
 		return -EINVAL;
 
+	/*
+	 * filldir() may fault on a page of this very filesystem, so the
+	 * name is copied out and read_mutex dropped before calling it.
+	 */
+	buf = kmalloc(256, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
 	copied = 0;
 	while (offset < inode->i_size) {
 		struct cramfs_inode *de;
 		unsigned long nextoffset;
 		char *name;
+		ino_t ino;
+		mode_t mode;
 		int namelen, error;
 
+		down(&read_mutex);
 		de = cramfs_read(sb, OFFSET(inode) + offset, sizeof(*de)+256);
 		name = (char *)(de+1);
 
@@ -246,15 +269,21 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 		 * with zeroes.
 		 */
 		namelen = de->namelen << 2;
+		memcpy(buf, name, namelen);
+		ino = CRAMINO(de);
+		mode = de->mode;
+		up(&read_mutex);
 		nextoffset = offset + sizeof(*de) + namelen;
 		for (;;) {
-			if (!namelen)
+			if (!namelen) {
+				kfree(buf);
 				return -EIO;
-			if (name[namelen-1])
+			}
+			if (buf[namelen-1])
 				break;
 			namelen--;
 		}
-		error = filldir(dirent, name, namelen, offset, CRAMINO(de), de->mode >> 12);
+		error = filldir(dirent, buf, namelen, offset, ino, mode >> 12);
 		if (error)
 			break;
 
@@ -262,6 +291,7 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 		filp->f_pos = offset;
 		copied++;
 	}
+	kfree(buf);
 	return 0;
 }
 
@@ -272,6 +302,7 @@ static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry)
 {
 	unsigned int offset = 0;
 
+	down(&read_mutex);
 	while (offset < dir->i_size) {
 		struct cramfs_inode *de;
 		char *name;
@@ -287,8 +318,10 @@ static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry)
 			continue;
 
 		for (;;) {
-			if (!namelen)
+			if (!namelen) {
+				up(&read_mutex);
 				return ERR_PTR(-EIO);
+			}
 			if (name[namelen-1])
 				break;
 			namelen--;
@@ -298,24 +331,37 @@ static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry)
 		if (memcmp(dentry->d_name.name, name, namelen))
 			continue;
 		d_add(dentry, get_cramfs_inode(dir->i_sb, de));
+		up(&read_mutex);
 		return NULL;
 	}
+	up(&read_mutex);
 	d_add(dentry, NULL);
 	return NULL;
 }
 
-static int cramfs_readpage(struct file *file, struct page * page)
+/*
+ * Uncompress one block into a locked page cache page.
+ *
+ * The compressed data is copied out of the read buffers into this
+ * CPU's scratch buffer under read_mutex, and uncompressed after the
+ * mutex is dropped, so readers on different CPUs only serialize on
+ * the copy.
+ */
+static void cramfs_fill_page(struct inode *inode, struct page *page)
 {
-	struct inode *inode = page->mapping->host;
 	u32 maxblock, bytes_filled;
+	char *pgdata;
 
+	pgdata = kmap(page);
 	maxblock = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	bytes_filled = 0;
 	if (page->index < maxblock) {
 		struct super_block *sb = inode->i_sb;
 		u32 blkptr_offset = OFFSET(inode) + page->index*4;
 		u32 start_offset, compr_len;
+		void *src;
 
+		down(&read_mutex);
 		start_offset = OFFSET(inode) + maxblock*4;
 		if (page->index)
 			start_offset = *(u32 *) cramfs_read(sb, blkptr_offset-4, 4);
@@ -323,16 +369,74 @@ static int cramfs_readpage(struct file *file, struct page * page)
 			     - start_offset);
 		if (compr_len == 0)
 			; /* hole */
-		else
-			bytes_filled = cramfs_uncompress_block(page_address(page),
-				 PAGE_CACHE_SIZE,
-				 cramfs_read(sb, start_offset, compr_len),
+		else if (compr_len > CRAMFS_SCRATCH_SIZE) {
+			/* Too big to stage: uncompress from the read buffer. */
+			src = cramfs_read(sb, start_offset, compr_len);
+			bytes_filled = cramfs_uncompress_block(pgdata,
+				 PAGE_CACHE_SIZE, src, compr_len);
+		} else {
+			src = cramfs_read(sb, start_offset, compr_len);
+			/* No sleeping from here on, we own this CPU's stream. */
+			memcpy(cramfs_uncompress_scratch(), src, compr_len);
+			up(&read_mutex);
+			bytes_filled = cramfs_uncompress_block(pgdata,
+				 PAGE_CACHE_SIZE, cramfs_uncompress_scratch(),
 				 compr_len);
+			goto filled;
+		}
+		up(&read_mutex);
 	}
-	memset(page_address(page) + bytes_filled, 0, PAGE_CACHE_SIZE - bytes_filled);
+filled:
+	memset(pgdata + bytes_filled, 0, PAGE_CACHE_SIZE - bytes_filled);
+	kunmap(page);
 	flush_dcache_page(page);
 	SetPageUptodate(page);
 	UnlockPage(page);
+}
+
+/*
+ * Blocks are small and usually read in sequence, so when we have to
+ * uncompress one we go on with the next few that are not cached yet.
+ * The page cache then doubles as the cache of uncompressed blocks.
+ */
+#define CRAMFS_READAHEAD	4
+
+static void cramfs_readahead(struct inode *inode, struct address_space *mapping,
+			     unsigned long index)
+{
+	unsigned long maxblock, end;
+	struct page *page;
+
+	maxblock = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	end = index + CRAMFS_READAHEAD;
+	if (end > maxblock)
+		end = maxblock;
+	for (; index < end; index++) {
+		page = find_get_page(mapping, index);
+		if (page) {
+			page_cache_release(page);
+			break;
+		}
+		page = page_cache_alloc();
+		if (!page)
+			break;
+		if (add_to_page_cache(page, mapping, index, GFP_KERNEL)) {
+			page_cache_free(page);
+			break;
+		}
+		cramfs_fill_page(inode, page);
+		page_cache_release(page);
+	}
+}
+
+static int cramfs_readpage(struct file *file, struct page * page)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	unsigned long index = page->index;
+
+	cramfs_fill_page(inode, page);
+	cramfs_readahead(inode, mapping, index + 1);
 	return 0;
 }
 
@@ -364,7 +468,9 @@ static DECLARE_FSTYPE_DEV(cramfs_fs_type, "cramfs", cramfs_read_super);
 
 static int __init init_cramfs_fs(void)
 {
-	cramfs_uncompress_init();
+	int err = cramfs_uncompress_init();
+	if (err)
+		return err;
 	return register_filesystem(&cramfs_fs_type);
 }
 
@@ -10,40 +10,64 @@
  *  - cramfs_uncompress_exit() - tell me when you're done
  *  - cramfs_uncompress_block() - uncompress a block.
  *
- * NOTE NOTE NOTE! The uncompression is entirely single-threaded. We
- * only have one stream, and we'll initialize it only once even if it
- * then is used by multiple filesystems.
+ * Every CPU has its own stream, with its own inflate workspace and a
+ * scratch buffer for the compressed input (cramfs_uncompress_scratch()),
+ * so blocks can be uncompressed on all CPUs at once. The caller must
+ * not sleep between picking up the scratch buffer and the end of
+ * cramfs_uncompress_block(): that is what keeps it on the same CPU.
  */
 
 #include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/pagemap.h>
 
+#include "cramfs.h"
 #include "inflate/zlib.h"
 
-static z_stream stream;
+struct cramfs_stream {
+	z_stream stream;
+	unsigned char scratch[CRAMFS_SCRATCH_SIZE];
+} ____cacheline_aligned;
+
+static struct cramfs_stream *streams;
 static int initialized;
 
+static inline struct cramfs_stream *this_stream(void)
+{
+	return streams + cpu_number_map(smp_processor_id());
+}
+
+void *cramfs_uncompress_scratch(void)
+{
+	return this_stream()->scratch;
+}
+
 /* Returns length of decompressed data. */
 int cramfs_uncompress_block(void *dst, int dstlen, void *src, int srclen)
 {
+	z_stream *stream = &this_stream()->stream;
 	int err;
 
-	stream.next_in = src;
-	stream.avail_in = srclen;
+	stream->next_in = src;
+	stream->avail_in = srclen;
 
-	stream.next_out = dst;
-	stream.avail_out = dstlen;
+	stream->next_out = dst;
+	stream->avail_out = dstlen;
 
-	err = cramfs_inflateReset(&stream);
+	err = cramfs_inflateReset(stream);
 	if (err != Z_OK) {
 		printk("cramfs_inflateReset error %d\n", err);
-		cramfs_inflateEnd(&stream);
-		cramfs_inflateInit(&stream);
+		cramfs_inflateEnd(stream);
+		cramfs_inflateInit(stream);
 	}
 
-	err = cramfs_inflate(&stream, Z_FINISH);
+	err = cramfs_inflate(stream, Z_FINISH);
 	if (err != Z_STREAM_END)
 		goto err;
-	return stream.total_out;
+	return stream->total_out;
 
 err:
 	printk("Error %d while decompressing!\n", err);
@@ -51,19 +75,53 @@ err:
 	return 0;
 }
 
+static void free_streams(void)
+{
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		if (!streams[i].stream.workspace)
+			continue;
+		cramfs_inflateEnd(&streams[i].stream);
+		vfree(streams[i].stream.workspace);
+	}
+	vfree(streams);
+	streams = NULL;
+}
+
 int cramfs_uncompress_init(void)
 {
-	if (!initialized++) {
-		stream.next_in = NULL;
-		stream.avail_in = 0;
-		cramfs_inflateInit(&stream);
+	int i;
+
+	if (initialized++)
+		return 0;
+
+	streams = vmalloc(smp_num_cpus * sizeof(struct cramfs_stream));
+	if (!streams)
+		goto nomem;
+	memset(streams, 0, smp_num_cpus * sizeof(struct cramfs_stream));
+	for (i = 0; i < smp_num_cpus; i++) {
+		z_stream *stream = &streams[i].stream;
+
+		stream->workspace = vmalloc(cramfs_inflate_workspacesize());
+		if (!stream->workspace)
+			goto nomem;
+		stream->next_in = NULL;
+		stream->avail_in = 0;
+		cramfs_inflateInit(stream);
 	}
 	return 0;
+
+nomem:
+	if (streams)
+		free_streams();
+	initialized = 0;
+	return -ENOMEM;
 }
 
 int cramfs_uncompress_exit(void)
 {
 	if (!--initialized)
-		cramfs_inflateEnd(&stream);
+		free_streams();
 	return 0;
 }
@@ -60,21 +60,66 @@ struct {
 	int dummy[2];
 } dentry_stat = {0, 0, 45, 0,};
 
+/*
+ * d_lookup() walks the hash chains without the dcache_lock, so it may
+ * be looking at a dentry that is being freed. Freed dentries therefore
+ * wait until every CPU has been through a quiescent state (see
+ * quiescent_snapshot()) before their memory goes. They wait a batch at
+ * a time; d_free() and shrink_dcache_memory() free the batch once the
+ * wait is over, and start the next one.
+ */
+static spinlock_t dentry_free_lock = SPIN_LOCK_UNLOCKED;
+static LIST_HEAD(dentry_freed);		/* the next batch */
+static LIST_HEAD(dentry_waiting);	/* the batch that is waiting */
+static unsigned long dentry_waiting_snap[NR_CPUS];
+
+static void d_free_deferred(void)
+{
+	struct list_head batch;
+
+	INIT_LIST_HEAD(&batch);
+	spin_lock(&dentry_free_lock);
+	if (!list_empty(&dentry_waiting)) {
+		if (!quiescent_passed(dentry_waiting_snap)) {
+			spin_unlock(&dentry_free_lock);
+			return;
+		}
+		list_splice(&dentry_waiting, &batch);
+		INIT_LIST_HEAD(&dentry_waiting);
+	}
+	if (!list_empty(&dentry_freed)) {
+		list_splice(&dentry_freed, &dentry_waiting);
+		INIT_LIST_HEAD(&dentry_freed);
+		quiescent_snapshot(dentry_waiting_snap);
+	}
+	spin_unlock(&dentry_free_lock);
+
+	while (!list_empty(&batch)) {
+		struct dentry *dentry = list_entry(batch.next, struct dentry, d_lru);
+
+		list_del(&dentry->d_lru);
+		if (dname_external(dentry)) 
+			kfree(dentry->d_name.name);
+		kmem_cache_free(dentry_cache, dentry); 
+	}
+}
+
 /* no dcache_lock, please */
 static inline void d_free(struct dentry *dentry)
 {
 	if (dentry->d_op && dentry->d_op->d_release)
 		dentry->d_op->d_release(dentry);
-	if (dname_external(dentry)) 
-		kfree(dentry->d_name.name);
-	kmem_cache_free(dentry_cache, dentry); 
 	dentry_stat.nr_dentry--;
+	spin_lock(&dentry_free_lock);
+	list_add(&dentry->d_lru, &dentry_freed);
+	spin_unlock(&dentry_free_lock);
+	d_free_deferred();
 }
 
 /*
  * Release the dentry's inode, using the fileystem
  * d_iput() operation if defined.
- * Called with dcache_lock held, drops it.
+ * Called with dcache_lock and the dentry's d_lock held, drops both.
  */
 static inline void dentry_iput(struct dentry * dentry)
 {
@@ -82,13 +127,16 @@ static inline void dentry_iput(struct dentry * dentry)
 	if (inode) {
 		dentry->d_inode = NULL;
 		list_del_init(&dentry->d_alias);
+		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
 		if (dentry->d_op && dentry->d_op->d_iput)
 			dentry->d_op->d_iput(dentry, inode);
 		else
 			iput(inode);
-	} else
+	} else {
+		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
+	}
 }
 
 /* 
@@ -106,6 +154,13 @@ static inline void dentry_iput(struct dentry * dentry)
  * This tail recursion is done by hand as we don't want to depend
  * on the compiler to always get this right (gcc generally doesn't).
  * Real recursion would eat up our stack space.
+ *
+ * d_lookup() takes references without the dcache_lock, so a dentry we
+ * dropped to zero may have been found again before we got the lock. It
+ * can only be found while it is hashed, and only under its d_lock,
+ * which is why the count is checked again under that lock before the
+ * dentry is killed. The unused list is lazy for the same reason: a
+ * dentry found that way stays on it until prune_dcache() notices.
  */
 
 /*
@@ -129,9 +184,6 @@ repeat:
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
-	/* dput on a free dentry? */
-	if (!list_empty(&dentry->d_lru))
-		BUG();
 	/*
 	 * AV: ->d_delete() is _NOT_ allowed to block now.
 	 */
@@ -142,8 +194,10 @@ repeat:
 	/* Unreachable? Get rid of it */
 	if (list_empty(&dentry->d_hash))
 		goto kill_it;
-	list_add(&dentry->d_lru, &dentry_unused);
-	dentry_stat.nr_unused++;
+	if (list_empty(&dentry->d_lru)) {
+		list_add(&dentry->d_lru, &dentry_unused);
+		dentry_stat.nr_unused++;
+	}
 	/*
 	 * Update the timestamp
 	 */
@@ -156,6 +210,17 @@ unhash_it:
 
 kill_it: {
 		struct dentry *parent;
+		spin_lock(&dentry->d_lock);
+		if (atomic_read(&dentry->d_count)) {
+			/* d_lookup() got it first, the last dput is theirs */
+			spin_unlock(&dentry->d_lock);
+			spin_unlock(&dcache_lock);
+			return;
+		}
+		if (!list_empty(&dentry->d_lru)) {
+			list_del(&dentry->d_lru);
+			dentry_stat.nr_unused--;
+		}
 		list_del(&dentry->d_child);
 		/* drops the lock, at that point nobody can reach this dentry */
 		dentry_iput(dentry);
@@ -299,7 +364,9 @@ restart:
  * Throw away a dentry - free the inode, dput the parent.
  * This requires that the LRU list has already been
  * removed.
- * Called with dcache_lock, drops it and then regains.
+ * Called with dcache_lock and the dentry's d_lock, having seen
+ * no references under the latter. Drops both, then regains
+ * the dcache_lock.
  */
 static inline void prune_one_dentry(struct dentry * dentry)
 {
@@ -343,9 +410,12 @@ void prune_dcache(int count)
 		list_del_init(tmp);
 		dentry = list_entry(tmp, struct dentry, d_lru);
 
-		/* Unused dentry with a count? */
-		if (atomic_read(&dentry->d_count))
-			BUG();
+		/* Found by d_lookup() since, dput() puts it back */
+		spin_lock(&dentry->d_lock);
+		if (atomic_read(&dentry->d_count)) {
+			spin_unlock(&dentry->d_lock);
+			continue;
+		}
 
 		prune_one_dentry(dentry);
 		if (!--count)
@@ -408,8 +478,11 @@ repeat:
 		dentry = list_entry(tmp, struct dentry, d_lru);
 		if (dentry->d_sb != sb)
 			continue;
-		if (atomic_read(&dentry->d_count))
+		spin_lock(&dentry->d_lock);
+		if (atomic_read(&dentry->d_count)) {
+			spin_unlock(&dentry->d_lock);
 			continue;
+		}
 		dentry_stat.nr_unused--;
 		list_del(tmp);
 		INIT_LIST_HEAD(tmp);
@@ -573,6 +646,7 @@ void shrink_dcache_memory(int priority, unsigned int gfp_mask)
 		count = dentry_stat.nr_unused / priority;
 
 	prune_dcache(count);
+	d_free_deferred();
 	kmem_cache_shrink(dentry_cache);
 }
 
@@ -610,6 +684,7 @@ struct dentry * d_alloc(struct dentry * parent, const struct qstr *name)
 	str[name->len] = 0;
 
 	atomic_set(&dentry->d_count, 1);
+	spin_lock_init(&dentry->d_lock);
 	dentry->d_flags = 0;
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
@@ -692,6 +767,77 @@ static inline struct list_head * d_hash(struct dentry * parent, unsigned long ha
 	return dentry_hashtable + (hash & D_HASHMASK);
 }
 
+/*
+ * d_lookup() walks a chain while it may be changing, so a dentry is put
+ * on one only once it is complete, and only its own d_hash is written.
+ */
+static inline void d_hash_add(struct list_head *new, struct list_head *head)
+{
+	new->next = head->next;
+	new->prev = head;
+	wmb();
+	head->next->prev = new;
+	head->next = new;
+}
+
+static inline int d_hash_head(struct list_head *entry)
+{
+	return entry >= dentry_hashtable && entry <= dentry_hashtable + D_HASHMASK;
+}
+
+#define D_LOOKUP_RETRY	((struct dentry *) 1)
+
+/*
+ * The lockless part of d_lookup(). Nothing we see here is freed under
+ * us, see d_free(), but a dentry may be unhashed, or moved to another
+ * chain, while we are on it. So a match is only taken under its d_lock,
+ * and if the walk leaves the chain or a match changes under us, we give
+ * up and d_lookup() does it under the dcache_lock.
+ */
+static struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
+{
+	unsigned int hash = name->hash;
+	struct list_head *head = d_hash(parent,hash);
+	struct list_head *tmp = head->next;
+
+	while (tmp != head) {
+		struct dentry * dentry = list_entry(tmp, struct dentry, d_hash);
+
+		if (d_hash_head(tmp))
+			return D_LOOKUP_RETRY;
+		tmp = tmp->next;
+		if (tmp == &dentry->d_hash)
+			return D_LOOKUP_RETRY;
+		if (dentry->d_name.hash != hash)
+			continue;
+		if (dentry->d_parent != parent)
+			continue;
+
+		spin_lock(&dentry->d_lock);
+		if (list_empty(&dentry->d_hash) ||
+		    dentry->d_name.hash != hash ||
+		    dentry->d_parent != parent) {
+			spin_unlock(&dentry->d_lock);
+			return D_LOOKUP_RETRY;
+		}
+		if (parent->d_op && parent->d_op->d_compare) {
+			if (parent->d_op->d_compare(parent, &dentry->d_name, name))
+				goto next;
+		} else {
+			if (dentry->d_name.len != name->len)
+				goto next;
+			if (memcmp(dentry->d_name.name, name->name, name->len))
+				goto next;
+		}
+		atomic_inc(&dentry->d_count);
+		spin_unlock(&dentry->d_lock);
+		return dentry;
+next:
+		spin_unlock(&dentry->d_lock);
+	}
+	return NULL;
+}
+
 /**
  * d_lookup - search for a dentry
  * @parent: parent dentry
@@ -710,6 +856,11 @@ struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
 	const unsigned char *str = name->name;
 	struct list_head *head = d_hash(parent,hash);
 	struct list_head *tmp;
+	struct dentry *found;
+
+	found = __d_lookup(parent, name);
+	if (found != D_LOOKUP_RETRY)
+		return found;
 
 	spin_lock(&dcache_lock);
 	tmp = head->next;
@@ -822,10 +973,12 @@ void d_delete(struct dentry * dentry)
 	 * Are we the only user?
 	 */
 	spin_lock(&dcache_lock);
+	spin_lock(&dentry->d_lock);
 	if (atomic_read(&dentry->d_count) == 1) {
 		dentry_iput(dentry);
 		return;
 	}
+	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
 
 	/*
@@ -846,7 +999,7 @@ void d_rehash(struct dentry * entry)
 {
 	struct list_head *list = d_hash(entry->d_parent, entry->d_name.hash);
 	spin_lock(&dcache_lock);
-	list_add(&entry->d_hash, list);
+	d_hash_add(&entry->d_hash, list);
 	spin_unlock(&dcache_lock);
 }
 
@@ -914,9 +1067,11 @@ void d_move(struct dentry * dentry, struct dentry * target)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
 	spin_lock(&dcache_lock);
+	spin_lock(&dentry->d_lock);
+	spin_lock(&target->d_lock);
 	/* Move the dentry to the target hash queue */
 	list_del(&dentry->d_hash);
-	list_add(&dentry->d_hash, &target->d_hash);
+	d_hash_add(&dentry->d_hash, &target->d_hash);
 
 	/* Unhash the target: dput() will then get rid of it */
 	list_del(&target->d_hash);
@@ -934,6 +1089,8 @@ void d_move(struct dentry * dentry, struct dentry * target)
 	/* And add them back to the (new) parent lists */
 	list_add(&target->d_child, &target->d_parent->d_subdirs);
 	list_add(&dentry->d_child, &dentry->d_parent->d_subdirs);
+	spin_unlock(&target->d_lock);
+	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
 }
 
@@ -1267,6 +1424,7 @@ void __init vfs_caches_init(unsigned long mempages)
 			SLAB_HWCACHE_ALIGN, NULL, NULL);
 	if(!filp_cachep)
 		panic("Cannot create filp SLAB cache");
+	files_init();
 
 #if defined (CONFIG_QUOTA)
 	dquot_cachep = kmem_cache_create("dquot", 
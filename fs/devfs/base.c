@@ -492,6 +492,8 @@
 #include <linux/wait.h>
 #include <linux/string.h>
 #include <linux/malloc.h>
+#include <linux/vmalloc.h>
+#include <linux/dcache.h>
 #include <linux/ioport.h>
 #include <linux/delay.h>
 #include <linux/ctype.h>
@@ -519,9 +521,12 @@
 
 #define DEVFS_NAME "devfs"
 
-#define INODE_TABLE_INC 250
+#define INODE_TABLE_MIN 256
 #define FIRST_INODE 1
 
+#define DIR_HASH_MIN 32    /*  Smaller directories are searched linearly  */
+#define DIR_HASH_MAX 8192
+
 #define STRING_LENGTH 256
 
 #define MIN_DEVNUM 36864  /*  Use major numbers 144   */
@@ -572,6 +577,9 @@ struct directory_type
     struct devfs_entry *first;
     struct devfs_entry *last;
     unsigned int num_removable;
+    unsigned int num_entries;
+    struct devfs_entry **hash;  /*  Children by name, NULL while small  */
+    unsigned int hash_size;     /*  A power of 2                        */
 };
 
 struct file_type
@@ -641,6 +649,7 @@ struct devfs_entry
     struct devfs_entry *prev;    /*  Previous entry in the parent directory  */
     struct devfs_entry *next;    /*  Next entry in the parent directory      */
     struct devfs_entry *parent;  /*  The parent directory                    */
+    struct devfs_entry *hash_next;  /*  Next in the parent's hash chain      */
     struct devfs_entry *slave;   /*  Another entry to unregister             */
     struct devfs_inode inode;
     umode_t mode;
@@ -747,7 +756,17 @@ static struct devfs_entry *search_for_entry_in_dir (struct devfs_entry *parent,
 	printk ("%s: entry is not a directory\n", DEVFS_NAME);
 	return NULL;
     }
-    for (curr = parent->u.dir.first; curr != NULL; curr = curr->next)
+    if (parent->u.dir.hash != NULL)
+    {
+	curr = parent->u.dir.hash[full_name_hash (name, namelen) &
+				  (parent->u.dir.hash_size - 1)];
+	for (; curr != NULL; curr = curr->hash_next)
+	{
+	    if (curr->namelen != namelen) continue;
+	    if (memcmp (curr->name, name, namelen) == 0) break;
+	}
+    }
+    else for (curr = parent->u.dir.first; curr != NULL; curr = curr->next)
     {
 	if (curr->namelen != namelen) continue;
 	if (memcmp (curr->name, name, namelen) == 0) break;
@@ -761,29 +780,105 @@ static struct devfs_entry *search_for_entry_in_dir (struct devfs_entry *parent,
 			     FALSE, FALSE, NULL, TRUE);
 }   /*  End Function search_for_entry_in_dir  */
 
+/**
+ *	dir_hash_grow - Build or double the hash table of a directory.
+ *	@dir: The directory.
+ *
+ *	If there is no memory the directory keeps its old table, or the list.
+ */
+
+static void dir_hash_grow (struct devfs_entry *dir)
+{
+    unsigned int size, i;
+    struct devfs_entry **hash, *de;
+
+    size = dir->u.dir.hash_size ? dir->u.dir.hash_size * 2 : DIR_HASH_MIN;
+    if ( ( hash = kmalloc (sizeof *hash * size, GFP_KERNEL) ) == NULL ) return;
+    memset (hash, 0, sizeof *hash * size);
+    for (de = dir->u.dir.first; de != NULL; de = de->next)
+    {
+	i = full_name_hash (de->name, de->namelen) & (size - 1);
+	de->hash_next = hash[i];
+	hash[i] = de;
+    }
+    if (dir->u.dir.hash) kfree (dir->u.dir.hash);
+    dir->u.dir.hash = hash;
+    dir->u.dir.hash_size = size;
+}   /*  End Function dir_hash_grow  */
+
+/*  Put a new entry at the end of its parent's list and into the hash table  */
+
+static void add_to_dir (struct devfs_entry *parent, struct devfs_entry *de)
+{
+    unsigned int i, limit;
+
+    de->prev = parent->u.dir.last;
+    if (parent->u.dir.first == NULL) parent->u.dir.first = de;
+    else parent->u.dir.last->next = de;
+    parent->u.dir.last = de;
+    ++parent->u.dir.num_entries;
+    limit = parent->u.dir.hash_size ? parent->u.dir.hash_size * 2
+				     : DIR_HASH_MIN;
+    if ( (parent->u.dir.num_entries >= limit) &&
+	 (parent->u.dir.hash_size < DIR_HASH_MAX) )
+    {
+	dir_hash_grow (parent);
+	return;
+    }
+    if (parent->u.dir.hash == NULL) return;
+    i = full_name_hash (de->name, de->namelen) & (parent->u.dir.hash_size - 1);
+    de->hash_next = parent->u.dir.hash[i];
+    parent->u.dir.hash[i] = de;
+}   /*  End Function add_to_dir  */
+
+static void remove_from_dir (struct devfs_entry *parent, struct devfs_entry *de)
+{
+    struct devfs_entry **p;
+
+    if (de->prev == NULL) parent->u.dir.first = de->next;
+    else de->prev->next = de->next;
+    if (de->next == NULL) parent->u.dir.last = de->prev;
+    else de->next->prev = de->prev;
+    --parent->u.dir.num_entries;
+    if (parent->u.dir.hash == NULL) return;
+    p = parent->u.dir.hash + (full_name_hash (de->name, de->namelen) &
+			      (parent->u.dir.hash_size - 1));
+    for (; *p != NULL; p = &(*p)->hash_next)
+    {
+	if (*p != de) continue;
+	*p = de->hash_next;
+	break;
+    }
+}   /*  End Function remove_from_dir  */
+
 static struct devfs_entry *create_entry (struct devfs_entry *parent,
 					 const char *name,unsigned int namelen)
 {
     struct devfs_entry *new, **table;
+    unsigned int size;
 
-    /*  First ensure table size is enough  */
+    /*  First ensure table size is enough. Doubling keeps boot linear  */
     if (fs_info.num_inodes >= fs_info.table_size)
     {
-	if ( ( table = kmalloc (sizeof *table *
-				(fs_info.table_size + INODE_TABLE_INC),
-				GFP_KERNEL) ) == NULL ) return NULL;
-	fs_info.table_size += INODE_TABLE_INC;
+	size = fs_info.table_size ? fs_info.table_size * 2 : INODE_TABLE_MIN;
+	if (sizeof *table * size > PAGE_SIZE)
+	    table = vmalloc (sizeof *table * size);
+	else table = kmalloc (sizeof *table * size, GFP_KERNEL);
+	if (table == NULL) return NULL;
 #ifdef CONFIG_DEVFS_DEBUG
 	if (devfs_debug & DEBUG_I_CREATE)
 	    printk ("%s: create_entry(): grew inode table to: %u entries\n",
-		    DEVFS_NAME, fs_info.table_size);
+		    DEVFS_NAME, size);
 #endif
 	if (fs_info.table)
 	{
 	    memcpy (table, fs_info.table, sizeof *table *fs_info.num_inodes);
-	    kfree (fs_info.table);
+	    if (sizeof *table * fs_info.table_size > PAGE_SIZE)
+		vfree (fs_info.table);
+	    else kfree (fs_info.table);
 	}
 	fs_info.table = table;
+	fs_info.table_size = size;
     }
     if ( name && (namelen < 1) ) namelen = strlen (name);
     if ( ( new = kmalloc (sizeof *new + namelen, GFP_KERNEL) ) == NULL )
@@ -799,11 +894,8 @@ static struct devfs_entry *create_entry (struct devfs_entry *parent,
     fs_info.table[fs_info.num_inodes] = new;
     ++fs_info.num_inodes;
     if (parent == NULL) return new;
-    new->prev = parent->u.dir.last;
     /*  Insert into the parent directory's list of children  */
-    if (parent->u.dir.first == NULL) parent->u.dir.first = new;
-    else parent->u.dir.last->next = new;
-    parent->u.dir.last = new;
+    add_to_dir (parent, new);
     return new;
 }   /*  End Function create_entry  */
 
@@ -1511,10 +1603,7 @@ int devfs_mk_symlink (devfs_handle_t dir, const char *name, unsigned int flags,
 
 	if (!is_new) return -ENOMEM;
 	/*  Have to clean up  */
-	if (de->prev == NULL) parent->u.dir.first = de->next;
-	else de->prev->next = de->next;
-	if (de->next == NULL) parent->u.dir.last = de->prev;
-	else de->next->prev = de->prev;
+	remove_from_dir (parent, de);
 	kfree (de);
 	return -ENOMEM;
     }
@@ -1575,6 +1664,9 @@ devfs_handle_t devfs_mk_dir (devfs_handle_t dir, const char *name, void *info)
 	/*  Transmogrifying an old entry  */
 	de->u.dir.first = NULL;
 	de->u.dir.last = NULL;
+	de->u.dir.num_entries = 0;
+	de->u.dir.hash = NULL;
+	de->u.dir.hash_size = 0;
     }
     de->mode = S_IFDIR | S_IRUGO | S_IXUGO;
     de->info = info;
@@ -2929,6 +3021,9 @@ static int devfs_mkdir (struct inode *dir, struct dentry *dentry, int mode)
 	/*  Transmogrifying an old entry  */
 	de->u.dir.first = NULL;
 	de->u.dir.last = NULL;
+	de->u.dir.num_entries = 0;
+	de->u.dir.hash = NULL;
+	de->u.dir.hash_size = 0;
     }
     de->mode = mode;
     de->u.dir.num_removable = 0;
@@ -38,6 +38,7 @@
 #include <linux/init.h>
 #include <linux/locks.h>
 #include <linux/kdev_t.h>
+#include <linux/string.h>
 #include <linux/devfs_fs_kernel.h>
 
 
@@ -145,6 +146,9 @@ EXPORT_SYMBOL(devfs_register_tape);
  *		field of the &file structure passed to the device driver. You can set
  *		this to whatever you like, and change it once the file is opened (the next
  *		file opened will not see this change).
+ *
+ *	If the "\%u" is in the last component of @format, the path to the
+ *	directory is only walked for the first entry.
  */
 
 void devfs_register_series (devfs_handle_t dir, const char *format,
@@ -154,12 +158,20 @@ void devfs_register_series (devfs_handle_t dir, const char *format,
 {
     unsigned int count;
     char devname[128];
+    const char *slash = strrchr (format, '/');
+    devfs_handle_t de;
 
+    if ( slash && (strchr (format, '%') < slash) ) slash = NULL;
     for (count = 0; count < num_entries; ++count)
     {
 	sprintf (devname, format, count);
-	devfs_register (dir, devname, flags, major, minor_start + count,
-			mode, ops, info);
+	de = devfs_register (dir, devname, flags, major, minor_start + count,
+			     mode, ops, info);
+	if ( (slash == NULL) || (de == NULL) ) continue;
+	/*  The rest go straight into the same directory  */
+	dir = devfs_get_parent (de);
+	format = slash + 1;
+	slash = NULL;
     }
 }   /*  End Function devfs_register_series  */
 EXPORT_SYMBOL(devfs_register_series);
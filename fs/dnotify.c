@@ -12,6 +12,11 @@
  * WITHOUT ANY WARRANTY; without even the implied warranty of
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
  * General Public License for more details.
+ *
+ * /dev/dnotify: instead of a signal that only says which directory
+ * changed, a watch made through a dnotify queue gets a record per event
+ * that also names the file.  Records that have not been read yet are
+ * not queued twice; see Documentation/dnotify.txt.
  */
 #include <linux/fs.h>
 #include <linux/sched.h>
@@ -19,14 +24,41 @@
 #include <linux/init.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/miscdevice.h>
+
+#include <asm/uaccess.h>
 
 extern void send_sigio(struct fown_struct *fown, int fd, int band);
 
 int dir_notify_enable = 1;
 
+/* The inodes' i_dnotify lists and the queues' watch lists */
 static rwlock_t dn_lock = RW_LOCK_UNLOCKED;
 static kmem_cache_t *dn_cache;
 
+#define DNOTIFY_MAX_EVENTS	16384	/* queued per queue, then DNQ_OVERFLOW */
+#define DNOTIFY_MAX_WATCHES	65536	/* per queue */
+#define DNOTIFY_COALESCE	16	/* queued records checked for a duplicate */
+
+struct dnotify_kevent {
+	struct list_head	list;
+	struct dnotify_event	ev;	/* the name follows */
+};
+
+struct dnotify_queue {
+	spinlock_t		lock;		/* the events */
+	struct list_head	events;
+	unsigned int		count;
+	unsigned int		bytes;		/* of the records on events */
+	wait_queue_head_t	wait;
+	struct dnotify_struct *	watches;	/* under dn_lock */
+	int			nwatches;
+	int			last_wd;
+	struct dnotify_kevent	overflow;	/* on events, or empty */
+};
+
 static void redo_inode_mask(struct inode *inode)
 {
 	unsigned long new_mask;
@@ -59,7 +91,7 @@ int fcntl_dirnotify(int fd, struct file *filp, unsigned long arg)
 	write_lock(&dn_lock);
 	prev = &inode->i_dnotify;
 	for (odn = *prev; odn != NULL; prev = &odn->dn_next, odn = *prev)
-		if (odn->dn_filp == filp)
+		if (odn->dn_filp == filp && !odn->dn_queue)
 			break;
 	if (odn != NULL) {
 		if (turning_off) {
@@ -82,6 +114,7 @@ int fcntl_dirnotify(int fd, struct file *filp, unsigned long arg)
 	dn->dn_mask = arg;
 	dn->dn_fd = fd;
 	dn->dn_filp = filp;
+	dn->dn_queue = NULL;
 	inode->i_dnotify_mask |= arg & ~DN_MULTISHOT;
 	dn->dn_next = inode->i_dnotify;
 	inode->i_dnotify = dn;
@@ -93,7 +126,64 @@ out_free:
 	goto out;
 }
 
-void __inode_dir_notify(struct inode *inode, unsigned long event)
+/* Called with dn_lock held for writing */
+static void dnotify_queue_event(struct dnotify_queue *q, int wd,
+				unsigned long event, struct qstr *name)
+{
+	struct dnotify_kevent *kev;
+	struct list_head *p;
+	unsigned int len = 0;
+	int i;
+
+	/* NUL terminated and padded to keep the next record aligned */
+	if (name)
+		len = (name->len + sizeof(int)) & ~(sizeof(int) - 1);
+
+	spin_lock(&q->lock);
+	for (p = q->events.prev, i = 0; p != &q->events && i < DNOTIFY_COALESCE;
+	     p = p->prev, i++) {
+		kev = list_entry(p, struct dnotify_kevent, list);
+		if (kev->ev.wd == wd && kev->ev.mask == event &&
+		    kev->ev.len == len && (!len ||
+		    (!memcmp(kev->ev.name, name->name, name->len) &&
+		     !kev->ev.name[name->len])))
+			goto out;
+	}
+
+	if (q->count >= DNOTIFY_MAX_EVENTS)
+		goto overflow;
+	kev = kmalloc(sizeof(*kev) + len, GFP_ATOMIC);
+	if (!kev)
+		goto overflow;
+	kev->ev.wd = wd;
+	kev->ev.mask = event;
+	kev->ev.len = len;
+	if (len) {
+		memcpy(kev->ev.name, name->name, name->len);
+		memset(kev->ev.name + name->len, 0, len - name->len);
+	}
+	list_add_tail(&kev->list, &q->events);
+	q->count++;
+	q->bytes += sizeof(kev->ev) + len;
+	goto wake;
+
+overflow:
+	if (!list_empty(&q->overflow.list))
+		goto out;
+	list_add_tail(&q->overflow.list, &q->events);
+	q->bytes += sizeof(q->overflow.ev);
+wake:
+	wake_up_interruptible(&q->wait);
+out:
+	spin_unlock(&q->lock);
+}
+
+/*
+ * Queues get the event for every matching watch; signals go out only
+ * if "signal" is set.
+ */
+static void dir_notify(struct inode *inode, unsigned long event,
+		       struct qstr *name, int signal)
 {
 	struct dnotify_struct *	dn;
 	struct dnotify_struct **prev;
@@ -104,7 +194,7 @@ void __inode_dir_notify(struct inode *inode, unsigned long event)
 	prev = &inode->i_dnotify;
 	while ((dn = *prev) != NULL) {
 		if (dn->dn_magic != DNOTIFY_MAGIC) {
-		        printk(KERN_ERR "__inode_dir_notify: bad magic "
+		        printk(KERN_ERR "dir_notify: bad magic "
 				"number in dnotify_struct!\n");
 		        goto out;
 		}
@@ -112,6 +202,16 @@ void __inode_dir_notify(struct inode *inode, unsigned long event)
 			prev = &dn->dn_next;
 			continue;
 		}
+		if (dn->dn_queue) {
+			dnotify_queue_event(dn->dn_queue, dn->dn_fd,
+					    event & dn->dn_mask, name);
+			prev = &dn->dn_next;
+			continue;
+		}
+		if (!signal) {
+			prev = &dn->dn_next;
+			continue;
+		}
 		fown = &dn->dn_filp->f_owner;
 		if (fown->pid)
 		        send_sigio(fown, dn->dn_fd, POLL_MSG);
@@ -129,12 +229,284 @@ out:
 	write_unlock(&dn_lock);
 }
 
+void __inode_dir_notify(struct inode *inode, unsigned long event,
+			struct qstr *name)
+{
+	dir_notify(inode, event, name, 1);
+}
+
+/*
+ * Within a directory a rename is a DN_RENAME record for each name, the
+ * old one first, and a single signal.  Across directories it is a
+ * delete from the old one and a create in the new one.
+ */
+void __inode_dir_notify_rename(struct inode *old_dir, struct qstr *old_name,
+			       struct inode *new_dir, struct qstr *new_name)
+{
+	if (old_dir == new_dir) {
+		if (old_dir->i_dnotify_mask & DN_RENAME) {
+			dir_notify(old_dir, DN_RENAME, old_name, 1);
+			dir_notify(old_dir, DN_RENAME, new_name, 0);
+		}
+		return;
+	}
+	if (old_dir->i_dnotify_mask & DN_DELETE)
+		dir_notify(old_dir, DN_DELETE, old_name, 1);
+	if (new_dir->i_dnotify_mask & DN_CREATE)
+		dir_notify(new_dir, DN_CREATE, new_name, 1);
+}
+
+/* Called with dn_lock held for writing */
+static void dnotify_unlink(struct dnotify_struct *dn)
+{
+	struct inode *inode = dn->dn_filp->f_dentry->d_inode;
+	struct dnotify_struct **prev;
+
+	for (prev = &inode->i_dnotify; *prev != dn; prev = &(*prev)->dn_next)
+		;
+	*prev = dn->dn_next;
+	redo_inode_mask(inode);
+}
+
+/* The watch keeps the directory open, which also keeps it mounted */
+static int dnotify_add_watch(struct dnotify_queue *q, int fd,
+			     unsigned long mask)
+{
+	struct dnotify_struct *dn;
+	struct file *filp;
+	struct inode *inode;
+	int wd;
+
+	mask &= ~DN_MULTISHOT;
+	if (!mask || !dir_notify_enable)
+		return -EINVAL;
+	filp = fget(fd);
+	if (!filp)
+		return -EBADF;
+	inode = filp->f_dentry->d_inode;
+	if (!S_ISDIR(inode->i_mode)) {
+		fput(filp);
+		return -ENOTDIR;
+	}
+	dn = kmem_cache_alloc(dn_cache, SLAB_KERNEL);
+	if (dn == NULL) {
+		fput(filp);
+		return -ENOMEM;
+	}
+
+	write_lock(&dn_lock);
+	if (q->nwatches >= DNOTIFY_MAX_WATCHES) {
+		write_unlock(&dn_lock);
+		kmem_cache_free(dn_cache, dn);
+		fput(filp);
+		return -ENOSPC;
+	}
+	wd = ++q->last_wd;
+	dn->dn_magic = DNOTIFY_MAGIC;
+	dn->dn_mask = mask;
+	dn->dn_fd = wd;
+	dn->dn_filp = filp;
+	dn->dn_queue = q;
+	inode->i_dnotify_mask |= mask;
+	dn->dn_next = inode->i_dnotify;
+	inode->i_dnotify = dn;
+	dn->dn_qnext = q->watches;
+	q->watches = dn;
+	q->nwatches++;
+	write_unlock(&dn_lock);
+	return wd;
+}
+
+static int dnotify_rm_watch(struct dnotify_queue *q, int wd)
+{
+	struct dnotify_struct *dn, **prev;
+
+	write_lock(&dn_lock);
+	for (prev = &q->watches; (dn = *prev) != NULL; prev = &dn->dn_qnext)
+		if (dn->dn_fd == wd)
+			break;
+	if (dn) {
+		*prev = dn->dn_qnext;
+		q->nwatches--;
+		dnotify_unlink(dn);
+	}
+	write_unlock(&dn_lock);
+	if (!dn)
+		return -EINVAL;
+	fput(dn->dn_filp);
+	kmem_cache_free(dn_cache, dn);
+	return 0;
+}
+
+static int dnotify_open(struct inode *inode, struct file *file)
+{
+	struct dnotify_queue *q;
+
+	q = kmalloc(sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return -ENOMEM;
+	memset(q, 0, sizeof(*q));
+	spin_lock_init(&q->lock);
+	INIT_LIST_HEAD(&q->events);
+	init_waitqueue_head(&q->wait);
+	INIT_LIST_HEAD(&q->overflow.list);
+	q->overflow.ev.wd = -1;
+	q->overflow.ev.mask = DNQ_OVERFLOW;
+	file->private_data = q;
+	return 0;
+}
+
+static int dnotify_release(struct inode *inode, struct file *file)
+{
+	struct dnotify_queue *q = file->private_data;
+	struct dnotify_struct *dn, *next;
+	struct dnotify_kevent *kev;
+
+	write_lock(&dn_lock);
+	for (dn = q->watches; dn != NULL; dn = dn->dn_qnext)
+		dnotify_unlink(dn);
+	dn = q->watches;
+	q->watches = NULL;
+	write_unlock(&dn_lock);
+
+	for (; dn != NULL; dn = next) {
+		next = dn->dn_qnext;
+		fput(dn->dn_filp);
+		kmem_cache_free(dn_cache, dn);
+	}
+	while (!list_empty(&q->events)) {
+		kev = list_entry(q->events.next, struct dnotify_kevent, list);
+		list_del(&kev->list);
+		if (kev != &q->overflow)
+			kfree(kev);
+	}
+	kfree(q);
+	return 0;
+}
+
+/*
+ * Returns as many whole records as fit.  They are taken off the queue
+ * before they are copied, so a bad buffer loses them.
+ */
+static ssize_t dnotify_read(struct file *file, char *buf, size_t count,
+			    loff_t *ppos)
+{
+	struct dnotify_queue *q = file->private_data;
+	struct dnotify_kevent *kev;
+	struct list_head batch;
+	size_t done, size, pos;
+	ssize_t ret;
+
+	if (ppos != &file->f_pos)
+		return -ESPIPE;
+
+	INIT_LIST_HEAD(&batch);
+	for (;;) {
+		if (list_empty(&q->events)) {
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			if (wait_event_interruptible(q->wait,
+						     !list_empty(&q->events)))
+				return -ERESTARTSYS;
+		}
+
+		done = 0;
+		spin_lock(&q->lock);
+		while (!list_empty(&q->events)) {
+			kev = list_entry(q->events.next, struct dnotify_kevent,
+					 list);
+			size = sizeof(kev->ev) + kev->ev.len;
+			if (done + size > count)
+				break;
+			list_del(&kev->list);
+			list_add_tail(&kev->list, &batch);
+			done += size;
+			q->bytes -= size;
+			if (kev != &q->overflow)
+				q->count--;
+		}
+		ret = list_empty(&q->events) ? 0 : -EINVAL;
+		spin_unlock(&q->lock);
+		if (done)
+			break;
+		if (ret)
+			return ret;	/* not even room for a record */
+	}
+
+	ret = done;
+	pos = 0;
+	while (!list_empty(&batch)) {
+		kev = list_entry(batch.next, struct dnotify_kevent, list);
+		size = sizeof(kev->ev) + kev->ev.len;
+		if (ret > 0 && copy_to_user(buf + pos, &kev->ev, size))
+			ret = -EFAULT;
+		pos += size;
+		if (kev == &q->overflow) {
+			spin_lock(&q->lock);
+			list_del_init(&kev->list);
+			spin_unlock(&q->lock);
+		} else {
+			list_del(&kev->list);
+			kfree(kev);
+		}
+	}
+	return ret;
+}
+
+static unsigned int dnotify_poll(struct file *file, poll_table *wait)
+{
+	struct dnotify_queue *q = file->private_data;
+
+	poll_wait(file, &q->wait, wait);
+	return list_empty(&q->events) ? 0 : POLLIN | POLLRDNORM;
+}
+
+static int dnotify_ioctl(struct inode *inode, struct file *file,
+			 unsigned int cmd, unsigned long arg)
+{
+	struct dnotify_queue *q = file->private_data;
+	struct dnotify_watch w;
+	int bytes;
+
+	switch (cmd) {
+	case DNOTIFY_WATCH:
+		if (copy_from_user(&w, (void *) arg, sizeof(w)))
+			return -EFAULT;
+		return dnotify_add_watch(q, w.fd, w.mask);
+	case DNOTIFY_UNWATCH:
+		return dnotify_rm_watch(q, (int) arg);
+	case FIONREAD:
+		spin_lock(&q->lock);
+		bytes = q->bytes;
+		spin_unlock(&q->lock);
+		return put_user(bytes, (int *) arg);
+	}
+	return -ENOTTY;
+}
+
+static struct file_operations dnotify_fops = {
+	read:		dnotify_read,
+	poll:		dnotify_poll,
+	ioctl:		dnotify_ioctl,
+	open:		dnotify_open,
+	release:	dnotify_release,
+};
+
+static struct miscdevice dnotify_dev = {
+	minor:	DNOTIFY_MINOR,
+	name:	"dnotify",
+	fops:	&dnotify_fops,
+};
+
 static int __init dnotify_init(void)
 {
 	dn_cache = kmem_cache_create("dnotify cache",
 		sizeof(struct dnotify_struct), 0, 0, NULL, NULL);
 	if (!dn_cache)
 		panic("cannot create dnotify slab cache");
+	if (misc_register(&dnotify_dev))
+		printk(KERN_WARNING "dnotify: can't misc_register on minor=%d\n",
+		       DNOTIFY_MINOR);
 	return 0;
 }
 
@@ -34,12 +34,17 @@
  *		Added check for bogus uid and fixed check for group in quotactl.
  *		Jan Kara, <jack@suse.cz>, sponsored by SuSE CR, 10-11/99
  *
+ *		Per-device hash tables sized by memory.  Modified dquots are
+ *		written back by kupdate and before reuse, not by the last dqput(),
+ *		and the quota file I/O no longer holds the dquot lock.
+ *
  * (C) Copyright 1994 - 1997 Marco van Wieringen 
  */
 
 #include <linux/errno.h>
 #include <linux/kernel.h>
 #include <linux/sched.h>
+#include <linux/mm.h>
 
 #include <linux/types.h>
 #include <linux/string.h>
@@ -85,13 +90,17 @@ static inline struct quota_mount_options *sb_dqopt(struct super_block *sb)
  * nr_free_dquots gives the number of dquots on the list.
  *
  * Dquots with a specific identity (device, type and id) are placed on
- * one of the dquot_hash[] hash chains. The provides an efficient search
- * mechanism to lcoate a specific dquot.
+ * one of the hash chains of their device, dqopt->hash[], which quota_on()
+ * allocates the first time and which stays with the super_block.  The
+ * provides an efficient search mechanism to locate a specific dquot.
+ *
+ * Unused dquots may still be modified (DQ_MOD).  They are written by
+ * sync_dquots(), which kupdate runs periodically, and get_empty_dquot()
+ * does not reuse them before that.
  */
 
 static struct dquot *inuse_list;
 static LIST_HEAD(free_dquots);
-static struct dquot *dquot_hash[NR_DQHASH];
 static int dquot_updating[NR_DQHASH];
 
 static struct dqstats dqstats;
@@ -117,25 +126,27 @@ static inline char sb_has_quota_enabled(struct super_block *sb, short type)
 	return is_enabled(sb_dqopt(sb), type);
 }
 
-static inline int const hashfn(kdev_t dev, unsigned int id, short type)
+static inline unsigned int hashfn(struct quota_mount_options *dqopt,
+				  unsigned int id, short type)
 {
-	return((HASHDEV(dev) ^ id) * (MAXQUOTAS - type)) % NR_DQHASH;
+	id ^= id >> 12;
+	return ((id << 1) | type) & dqopt->hash_mask;
 }
 
-static inline void insert_dquot_hash(struct dquot *dquot)
+static inline void insert_dquot_hash(struct dquot *dquot, unsigned int hashent)
 {
 	struct dquot **htable;
 
-	htable = &dquot_hash[hashfn(dquot->dq_dev, dquot->dq_id, dquot->dq_type)];
+	htable = &sb_dqopt(dquot->dq_sb)->hash[hashent];
 	if ((dquot->dq_hash_next = *htable) != NULL)
 		(*htable)->dq_hash_pprev = &dquot->dq_hash_next;
 	*htable = dquot;
 	dquot->dq_hash_pprev = htable;
 }
 
-static inline void hash_dquot(struct dquot *dquot)
+static inline void hash_dquot(struct dquot *dquot, unsigned int hashent)
 {
-	insert_dquot_hash(dquot);
+	insert_dquot_hash(dquot, hashent);
 }
 
 static inline void unhash_dquot(struct dquot *dquot)
@@ -148,16 +159,44 @@ static inline void unhash_dquot(struct dquot *dquot)
 	}
 }
 
-static inline struct dquot *find_dquot(unsigned int hashent, kdev_t dev, unsigned int id, short type)
+static inline struct dquot *find_dquot(struct quota_mount_options *dqopt, unsigned int hashent, unsigned int id, short type)
 {
 	struct dquot *dquot;
 
-	for (dquot = dquot_hash[hashent]; dquot; dquot = dquot->dq_hash_next)
-		if (dquot->dq_dev == dev && dquot->dq_id == id && dquot->dq_type == type)
+	for (dquot = dqopt->hash[hashent]; dquot; dquot = dquot->dq_hash_next)
+		if (dquot->dq_id == id && dquot->dq_type == type)
 			break;
 	return dquot;
 }
 
+/*
+ * One chain per 16 pages of memory, at most an order 4 block of them:
+ * a few hundred chains for a small box, 16k for one with a gigabyte.
+ */
+#define DQHASH_MAX_ORDER	4
+
+static int alloc_dquot_hash(struct quota_mount_options *dqopt)
+{
+	unsigned long want = num_physpages >> 4;
+	struct dquot **hash;
+	int order;
+
+	if (dqopt->hash)
+		return 0;
+	for (order = 0; order < DQHASH_MAX_ORDER; order++)
+		if ((PAGE_SIZE << order) / sizeof(struct dquot *) >= want)
+			break;
+	do {
+		hash = (struct dquot **) __get_free_pages(GFP_KERNEL, order);
+	} while (!hash && --order >= 0);
+	if (!hash)
+		return -ENOMEM;
+	memset(hash, 0, PAGE_SIZE << order);
+	dqopt->hash_mask = (PAGE_SIZE << order) / sizeof(struct dquot *) - 1;
+	dqopt->hash = hash;
+	return 0;
+}
+
 /* Add a dquot to the head of the free list */
 static inline void put_dquot_head(struct dquot *dquot)
 {
@@ -239,68 +278,84 @@ static inline void unlock_dquot(struct dquot *dquot)
 
 /*
  *	We don't have to be afraid of deadlocks as we never have quotas on quota files...
+ *
+ *	The dquot is copied under its lock and the copy written, so that
+ *	allocations don't wait for the quota file.  dqio_sem is taken first
+ *	and keeps the writes of one dquot in order.
  */
 static void write_dquot(struct dquot *dquot)
 {
-	short type = dquot->dq_type;
+	struct super_block *sb = dquot->dq_sb;
+	struct semaphore *sem;
+	struct dqblk dqb;
 	struct file *filp;
 	mm_segment_t fs;
 	loff_t offset;
 	ssize_t ret;
-	struct semaphore *sem = &dquot->dq_sb->s_dquot.dqio_sem;
+	short type;
 
+	if (!sb)	/* Invalidated quota? */
+		return;
+	sem = &sb->s_dquot.dqio_sem;
+	down(sem);
 	lock_dquot(dquot);
-	if (!dquot->dq_sb) {	/* Invalidated quota? */
+	if (dquot->dq_sb != sb) {	/* Invalidated or reused meanwhile? */
 		unlock_dquot(dquot);
+		up(sem);
 		return;
 	}
-	down(sem);
-	filp = dquot->dq_sb->s_dquot.files[type];
+	type = dquot->dq_type;
 	offset = dqoff(dquot->dq_id);
-	fs = get_fs();
-	set_fs(KERNEL_DS);
-
+	dqb = dquot->dq_dqb;
 	/*
 	 * Note: clear the DQ_MOD flag unconditionally,
 	 * so we don't loop forever on failure.
 	 */
 	dquot->dq_flags &= ~DQ_MOD;
+	unlock_dquot(dquot);
+
+	filp = sb->s_dquot.files[type];
+	fs = get_fs();
+	set_fs(KERNEL_DS);
 	ret = 0;
 	if (filp)
-		ret = filp->f_op->write(filp, (char *)&dquot->dq_dqb, 
+		ret = filp->f_op->write(filp, (char *)&dqb,
 					sizeof(struct dqblk), &offset);
 	if (ret != sizeof(struct dqblk))
 		printk(KERN_WARNING "VFS: dquota write failed on dev %s\n",
-			kdevname(dquot->dq_dev));
+			kdevname(sb->s_dev));
 
 	set_fs(fs);
 	up(sem);
-	unlock_dquot(dquot);
 
 	dqstats.writes++;
 }
 
 static void read_dquot(struct dquot *dquot)
 {
+	struct super_block *sb = dquot->dq_sb;
 	short type = dquot->dq_type;
 	struct file *filp;
 	mm_segment_t fs;
 	loff_t offset;
 
-	filp = dquot->dq_sb->s_dquot.files[type];
+	filp = sb->s_dquot.files[type];
 	if (filp == (struct file *)NULL)
 		return;
 
+	/* Same order as write_dquot() */
+	down(&sb->s_dquot.dqio_sem);
 	lock_dquot(dquot);
-	if (!dquot->dq_sb)	/* Invalidated quota? */
+	if (!dquot->dq_sb) {	/* Invalidated quota? */
+		up(&sb->s_dquot.dqio_sem);
 		goto out_lock;
+	}
 	/* Now we are sure filp is valid - the dquot isn't invalidated */
-	down(&dquot->dq_sb->s_dquot.dqio_sem);
 	offset = dqoff(dquot->dq_id);
 	fs = get_fs();
 	set_fs(KERNEL_DS);
 	filp->f_op->read(filp, (char *)&dquot->dq_dqb, sizeof(struct dqblk), &offset);
-	up(&dquot->dq_sb->s_dquot.dqio_sem);
+	up(&sb->s_dquot.dqio_sem);
 	set_fs(fs);
 
 	if (dquot->dq_bhardlimit == 0 && dquot->dq_bsoftlimit == 0 &&
@@ -396,6 +451,13 @@ restart:
 		if (!(dquot->dq_flags & (DQ_LOCKED | DQ_MOD)))
 			continue;
 
+		/* Unused ones are left modified by dqput() */
+		if (!dquot->dq_count) {
+			if (dquot->dq_flags & DQ_MOD)
+				write_dquot(dquot);
+			need_restart = 1;
+			continue;
+		}
 		if ((ddquot = dqduplicate(dquot)) == NODQUOT)
 			continue;
 		if (ddquot->dq_flags & DQ_MOD)
@@ -435,7 +497,6 @@ static void dqput(struct dquot *dquot)
 	 */
 	if (dquot->dq_sb)
 		dqstats.drops++;
-we_slept:
 	if (dquot->dq_count > 1) {
 		/* We have more than one user... We can simply decrement use count */
 		dquot->dq_count--;
@@ -445,10 +506,6 @@ we_slept:
 		printk(KERN_ERR "VFS: Locked quota to be put on the free list.\n");
 		dquot->dq_flags &= ~DQ_LOCKED;
 	}
-	if (dquot->dq_sb && dquot->dq_flags & DQ_MOD) {
-		write_dquot(dquot);
-		goto we_slept;
-	}
 
 	/* sanity check */
 	if (!list_empty(&dquot->dq_free)) {
@@ -457,7 +514,9 @@ we_slept:
 		return;
 	}
 	dquot->dq_count--;
-	dquot->dq_flags &= ~DQ_MOD;	/* Modified flag has no sense on free list */
+	/* A modified one stays so until sync_dquots() writes it */
+	if (!dquot->dq_sb)
+		dquot->dq_flags &= ~DQ_MOD;
 	/* Place at end of LRU free queue */
 	put_dquot_last(dquot);
 	wake_up(&dquot_wait);
@@ -513,12 +572,32 @@ static inline struct dquot *find_best_free(void)
 
 	while ((tmp = tmp->next) != &free_dquots && --limit) {
 		dquot = list_entry(tmp, struct dquot, dq_free);
-		if (dquot->dq_referenced == 0)
+		if (dquot->dq_referenced == 0 &&
+		    !(dquot->dq_flags & (DQ_LOCKED | DQ_MOD)))
 			return dquot;
 	}
 	return NULL;
 }
 
+/* Write the unused dquots that are still modified, so they can be reused */
+static int write_free_dquots(void)
+{
+	struct list_head *tmp;
+	struct dquot *dquot;
+	int written = 0;
+
+restart:
+	for (tmp = free_dquots.next; tmp != &free_dquots; tmp = tmp->next) {
+		dquot = list_entry(tmp, struct dquot, dq_free);
+		if (dquot->dq_sb && dquot->dq_flags & DQ_MOD) {
+			write_dquot(dquot);
+			written++;
+			goto restart;	/* We slept on IO */
+		}
+	}
+	return written;
+}
+
 struct dquot *get_empty_dquot(void)
 {
 	struct dquot *dquot;
@@ -549,6 +628,8 @@ pressure:
 	dquot = find_best_candidate_weighted();
 	if (dquot)
 		goto got_it;
+	if (write_free_dquots())
+		goto repeat;
 	/*
 	 * Try pruning the dcache to free up some dquots ...
 	 */
@@ -567,19 +648,21 @@ pressure:
 
 static struct dquot *dqget(struct super_block *sb, unsigned int id, short type)
 {
-	unsigned int hashent = hashfn(sb->s_dev, id, type);
-	struct dquot *dquot, *empty = NULL;
 	struct quota_mount_options *dqopt = sb_dqopt(sb);
+	unsigned int hashent, updating;
+	struct dquot *dquot, *empty = NULL;
 
         if (!is_enabled(dqopt, type))
                 return(NODQUOT);
+	hashent = hashfn(dqopt, id, type);
+	updating = hashent % NR_DQHASH;
 
 we_slept:
-	if ((dquot = find_dquot(hashent, sb->s_dev, id, type)) == NULL) {
+	if ((dquot = find_dquot(dqopt, hashent, id, type)) == NULL) {
 		if (empty == NULL) {
-			dquot_updating[hashent]++;
+			dquot_updating[updating]++;
 			empty = get_empty_dquot();
-			if (!--dquot_updating[hashent])
+			if (!--dquot_updating[updating])
 				wake_up(&update_wait);
 			goto we_slept;
 		}
@@ -589,7 +672,7 @@ we_slept:
         	dquot->dq_dev = sb->s_dev;
         	dquot->dq_sb = sb;
 		/* hash it first so it can be found */
-		hash_dquot(dquot);
+		hash_dquot(dquot, hashent);
         	read_dquot(dquot);
 	} else {
 		if (!dquot->dq_count++) {
@@ -601,7 +684,7 @@ we_slept:
 			dqput(empty);
 	}
 
-	while (dquot_updating[hashent])
+	while (dquot_updating[updating])
 		sleep_on(&update_wait);
 
 	if (!dquot->dq_sb) {	/* Has somebody invalidated entry under us? */
@@ -1348,7 +1431,9 @@ void __init dquot_init_hash(void)
 {
 	printk(KERN_NOTICE "VFS: Diskquotas version %s initialized\n", __DQUOT_VERSION__);
 
-	memset(dquot_hash, 0, sizeof(dquot_hash));
+	/* Room for the working set of a few thousand users per gigabyte */
+	if (max_dquots < (int) (num_physpages >> 5))
+		max_dquots = num_physpages >> 5;
 	memset((caddr_t)&dqstats, 0, sizeof(dqstats));
 }
 
@@ -1483,6 +1568,9 @@ static int quota_on(struct super_block *sb, short type, char *path)
 	error = -EINVAL;
 	if (inode->i_size == 0 || !check_quotafile_size(inode->i_size))
 		goto out_f;
+	error = alloc_dquot_hash(dqopt);
+	if (error)
+		goto out_f;
 	dquot_drop(inode);	/* We don't want quota on quota files */
 
 	set_enable_flags(dqopt, type);
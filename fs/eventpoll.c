@@ -0,0 +1,687 @@
+/*
+ *  linux/fs/eventpoll.c
+ *
+ *  Event poll sets, see linux/eventpoll.h.
+ *
+ *  An epoll file keeps the set of files it watches, registered once
+ *  with epoll_ctl(). Each of them gets an entry on the wait queues its
+ *  poll() hands out, as with select(), but the entry stays there, and
+ *  a wake up only calls ep_poll_callback(), which puts the item on the
+ *  ready list. epoll_wait() looks at the ready items alone, so what it
+ *  costs depends on what is ready, not on what is watched.
+ *
+ *  A wake up doesn't say what happened, so the ready items are polled
+ *  again, without a table, when they are reported. An item stays on
+ *  the ready list for as long as it is ready, unless it is edge
+ *  triggered (EPOLLET); then it is reported once per wake up.
+ *
+ *  Locking: ep->sem covers the set, that is the tree and the wait queue
+ *  entries of the items, and ep->lock, which the callbacks take with
+ *  interrupts off, the ready list. epsem is taken on top by the closing
+ *  of a watched file and of the epoll file, which can race.
+ */
+
+#include <linux/config.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/rbtree.h>
+#include <linux/eventpoll.h>
+
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
+
+#define EVENTPOLLFS_MAGIC	0x03111965
+
+/* So that the events always fit into an int worth of bytes */
+#define EP_MAX_EVENTS	(INT_MAX / sizeof(struct epoll_event))
+
+struct eventpoll {
+	struct semaphore	sem;
+	spinlock_t		lock;		/* rdllist, irq safe */
+	wait_queue_head_t	wq;		/* epoll_wait() */
+	wait_queue_head_t	poll_wait;	/* poll() of the epoll file */
+	struct list_head	rdllist;	/* the items that may be ready */
+	rb_root_t		rbr;		/* all items, by file and fd */
+};
+
+struct epitem {
+	rb_node_t		rbn;
+	struct list_head	rdllink;	/* on ep->rdllist, or empty */
+	int			rdlagain;	/* woken while being reported */
+	unsigned int		revents;	/* what it was reported with */
+	struct list_head	fllink;		/* on file->f_ep_links */
+	struct list_head	pwqlist;	/* its eppoll_entries */
+	int			nwait;		/* how many, -1 if one failed */
+	struct eventpoll	*ep;
+	struct file		*file;
+	int			fd;
+	struct epoll_event	event;
+};
+
+/* An item's entry on one wait queue */
+struct eppoll_entry {
+	struct list_head	llink;
+	struct epitem		*base;
+	wait_queue_t		wait;
+	wait_queue_head_t	*whead;
+};
+
+/* The poll table for registering an item */
+struct ep_pqueue {
+	poll_table		pt;
+	struct epitem		*epi;
+};
+
+static kmem_cache_t *epi_cachep;
+static kmem_cache_t *pwq_cachep;
+
+static DECLARE_MUTEX(epsem);
+static struct vfsmount *eventpoll_mnt;
+static struct file_operations eventpoll_fops;
+
+static inline int is_file_epoll(struct file *file)
+{
+	return file->f_op == &eventpoll_fops;
+}
+
+static inline int ep_cmp(struct file *file, int fd, struct epitem *epi)
+{
+	if (file != epi->file)
+		return file < epi->file ? -1 : 1;
+	return fd - epi->fd;
+}
+
+static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
+{
+	rb_node_t *rbp = ep->rbr.rb_node;
+	struct epitem *epi;
+	int cmp;
+
+	while (rbp) {
+		epi = rb_entry(rbp, struct epitem, rbn);
+		cmp = ep_cmp(file, fd, epi);
+		if (cmp < 0)
+			rbp = rbp->rb_left;
+		else if (cmp > 0)
+			rbp = rbp->rb_right;
+		else
+			return epi;
+	}
+	return NULL;
+}
+
+static void ep_rbtree_insert(struct eventpoll *ep, struct epitem *epi)
+{
+	rb_node_t **p = &ep->rbr.rb_node, *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (ep_cmp(epi->file, epi->fd,
+			   rb_entry(parent, struct epitem, rbn)) < 0)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&epi->rbn, parent, p);
+	rb_insert_color(&epi->rbn, &ep->rbr);
+}
+
+static void ep_wake(struct eventpoll *ep)
+{
+	wake_up(&ep->wq);
+	if (waitqueue_active(&ep->poll_wait))
+		wake_up(&ep->poll_wait);
+}
+
+/* Something happened to the file, under the lock of its wait queue */
+static void ep_poll_callback(wait_queue_t *wait)
+{
+	struct eppoll_entry *pwq = list_entry(wait, struct eppoll_entry, wait);
+	struct epitem *epi = pwq->base;
+	struct eventpoll *ep = epi->ep;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (list_empty(&epi->rdllink))
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+	else
+		epi->rdlagain = 1;
+	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_wake(ep);
+}
+
+static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
+				 poll_table *pt)
+{
+	struct epitem *epi = ((struct ep_pqueue *) pt)->epi;
+	struct eppoll_entry *pwq;
+
+	if (epi->nwait < 0)
+		return;
+	pwq = kmem_cache_alloc(pwq_cachep, SLAB_KERNEL);
+	if (!pwq) {
+		epi->nwait = -1;
+		return;
+	}
+	init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
+	pwq->whead = whead;
+	pwq->base = epi;
+	add_wait_queue(whead, &pwq->wait);
+	list_add_tail(&pwq->llink, &epi->pwqlist);
+	epi->nwait++;
+}
+
+/* Once this returns, no callback of the item is running any more */
+static void ep_unregister_pollwait(struct epitem *epi)
+{
+	struct eppoll_entry *pwq;
+
+	while (!list_empty(&epi->pwqlist)) {
+		pwq = list_entry(epi->pwqlist.next, struct eppoll_entry, llink);
+		list_del(&pwq->llink);
+		remove_wait_queue(pwq->whead, &pwq->wait);
+		kmem_cache_free(pwq_cachep, pwq);
+	}
+	epi->nwait = 0;
+}
+
+static void ep_queue_ready(struct eventpoll *ep, struct epitem *epi)
+{
+	unsigned long flags;
+	int wake = 0;
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (list_empty(&epi->rdllink)) {
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+		wake = 1;
+	}
+	spin_unlock_irqrestore(&ep->lock, flags);
+	if (wake)
+		ep_wake(ep);
+}
+
+static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
+		     struct file *tfile, int fd)
+{
+	struct epitem *epi;
+	struct ep_pqueue epq;
+	unsigned int revents;
+
+	epi = kmem_cache_alloc(epi_cachep, SLAB_KERNEL);
+	if (!epi)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&epi->rdllink);
+	INIT_LIST_HEAD(&epi->fllink);
+	INIT_LIST_HEAD(&epi->pwqlist);
+	epi->rdlagain = 0;
+	epi->revents = 0;
+	epi->nwait = 0;
+	epi->ep = ep;
+	epi->file = tfile;
+	epi->fd = fd;
+	epi->event = *event;
+
+	epq.epi = epi;
+	init_poll_funcptr(&epq.pt, ep_ptable_queue_proc);
+	revents = tfile->f_op->poll(tfile, &epq.pt);
+	if (epi->nwait < 0) {
+		ep_unregister_pollwait(epi);
+		spin_lock_irq(&ep->lock);
+		list_del(&epi->rdllink);
+		spin_unlock_irq(&ep->lock);
+		kmem_cache_free(epi_cachep, epi);
+		return -ENOMEM;
+	}
+
+	spin_lock(&tfile->f_ep_lock);
+	list_add_tail(&epi->fllink, &tfile->f_ep_links);
+	spin_unlock(&tfile->f_ep_lock);
+	ep_rbtree_insert(ep, epi);
+
+	if (revents & epi->event.events)
+		ep_queue_ready(ep, epi);
+	return 0;
+}
+
+static void ep_modify(struct eventpoll *ep, struct epitem *epi,
+		      struct epoll_event *event)
+{
+	epi->event = *event;
+	if (epi->file->f_op->poll(epi->file, NULL) & epi->event.events)
+		ep_queue_ready(ep, epi);
+}
+
+static void ep_remove(struct eventpoll *ep, struct epitem *epi)
+{
+	ep_unregister_pollwait(epi);
+
+	spin_lock(&epi->file->f_ep_lock);
+	list_del(&epi->fllink);
+	spin_unlock(&epi->file->f_ep_lock);
+	rb_erase(&epi->rbn, &ep->rbr);
+
+	spin_lock_irq(&ep->lock);
+	list_del(&epi->rdllink);
+	spin_unlock_irq(&ep->lock);
+	kmem_cache_free(epi_cachep, epi);
+}
+
+/*
+ * Report up to maxevents of the ready items, under ep->sem. The ready
+ * list is taken over first, since the copying can fault. Whatever is
+ * still ready and isn't edge triggered goes back on it, so does what
+ * was woken meanwhile and what there was no room for.
+ */
+static int ep_send_events(struct eventpoll *ep, struct epoll_event *events,
+			  int maxevents)
+{
+	LIST_HEAD(txlist);
+	struct list_head *p;
+	struct epitem *epi;
+	struct epoll_event ev;
+	int eventcnt = 0, nproc = 0, error = 0;
+
+	spin_lock_irq(&ep->lock);
+	list_splice(&ep->rdllist, &txlist);
+	INIT_LIST_HEAD(&ep->rdllist);
+	for (p = txlist.next; p != &txlist; p = p->next)
+		list_entry(p, struct epitem, rdllink)->rdlagain = 0;
+	spin_unlock_irq(&ep->lock);
+
+	for (p = txlist.next; p != &txlist && eventcnt < maxevents;
+	     p = p->next, nproc++) {
+		epi = list_entry(p, struct epitem, rdllink);
+		epi->revents = epi->file->f_op->poll(epi->file, NULL) &
+			       epi->event.events;
+		if (!epi->revents)
+			continue;
+		ev.events = epi->revents;
+		ev.data = epi->event.data;
+		if (__copy_to_user(&events[eventcnt], &ev, sizeof(ev))) {
+			error = -EFAULT;
+			break;
+		}
+		eventcnt++;
+	}
+
+	spin_lock_irq(&ep->lock);
+	while (!list_empty(&txlist)) {
+		epi = list_entry(txlist.next, struct epitem, rdllink);
+		list_del_init(&epi->rdllink);
+		if (nproc-- <= 0 || epi->rdlagain ||
+		    (epi->revents && !(epi->event.events & EPOLLET)))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+		epi->rdlagain = 0;
+	}
+	spin_unlock_irq(&ep->lock);
+
+	return eventcnt ? eventcnt : error;
+}
+
+static int ep_poll(struct eventpoll *ep, struct epoll_event *events,
+		   int maxevents, long timeout)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	int res;
+
+retry:
+	res = 0;
+	add_wait_queue_exclusive(&ep->wq, &wait);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!list_empty(&ep->rdllist) || !timeout)
+			break;
+		if (signal_pending(current)) {
+			res = -EINTR;
+			break;
+		}
+		timeout = schedule_timeout(timeout);
+	}
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(&ep->wq, &wait);
+
+	if (!res && !list_empty(&ep->rdllist)) {
+		down(&ep->sem);
+		res = ep_send_events(ep, events, maxevents);
+		up(&ep->sem);
+		/* It was ready when woken, but isn't any more */
+		if (!res && timeout)
+			goto retry;
+	}
+	return res;
+}
+
+static void ep_free(struct eventpoll *ep)
+{
+	rb_node_t *rbp;
+
+	down(&epsem);
+	down(&ep->sem);
+	while ((rbp = rb_first(&ep->rbr)) != NULL)
+		ep_remove(ep, rb_entry(rbp, struct epitem, rbn));
+	up(&ep->sem);
+	up(&epsem);
+	kfree(ep);
+}
+
+void eventpoll_release_file(struct file *file)
+{
+	struct epitem *epi;
+	struct eventpoll *ep;
+
+	down(&epsem);
+	while (!list_empty(&file->f_ep_links)) {
+		epi = list_entry(file->f_ep_links.next, struct epitem, fllink);
+		ep = epi->ep;
+		down(&ep->sem);
+		ep_remove(ep, epi);
+		up(&ep->sem);
+	}
+	up(&epsem);
+}
+
+static int ep_eventpoll_close(struct inode *inode, struct file *file)
+{
+	struct eventpoll *ep = file->private_data;
+
+	if (ep)
+		ep_free(ep);
+	return 0;
+}
+
+static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
+{
+	struct eventpoll *ep = file->private_data;
+
+	poll_wait(file, &ep->poll_wait, wait);
+	return list_empty(&ep->rdllist) ? 0 : POLLIN | POLLRDNORM;
+}
+
+static struct file_operations eventpoll_fops = {
+	release:	ep_eventpoll_close,
+	poll:		ep_eventpoll_poll,
+};
+
+static int eventpollfs_delete_dentry(struct dentry *dentry)
+{
+	return 1;
+}
+
+static struct dentry_operations eventpollfs_dentry_operations = {
+	d_delete:	eventpollfs_delete_dentry,
+};
+
+static struct inode *ep_eventpoll_inode(void)
+{
+	struct inode *inode = get_empty_inode();
+
+	if (!inode)
+		return NULL;
+	inode->i_fop = &eventpoll_fops;
+	inode->i_sb = eventpoll_mnt->mnt_sb;
+	/* Never to be put on the dirty list, as with pipes */
+	inode->i_state = I_DIRTY;
+	inode->i_mode = S_IRUSR | S_IWUSR;
+	inode->i_uid = current->fsuid;
+	inode->i_gid = current->fsgid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_blksize = PAGE_SIZE;
+	return inode;
+}
+
+/* An fd for ep, the way do_pipe() makes them */
+static int ep_getfd(struct eventpoll *ep)
+{
+	struct qstr this;
+	char name[32];
+	struct dentry *dentry;
+	struct inode *inode;
+	struct file *file;
+	int error, fd;
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto out;
+
+	inode = ep_eventpoll_inode();
+	if (!inode)
+		goto out_filp;
+
+	error = get_unused_fd();
+	if (error < 0)
+		goto out_inode;
+	fd = error;
+
+	error = -ENOMEM;
+	sprintf(name, "[%lu]", inode->i_ino);
+	this.name = name;
+	this.len = strlen(name);
+	this.hash = inode->i_ino;
+	dentry = d_alloc(eventpoll_mnt->mnt_sb->s_root, &this);
+	if (!dentry)
+		goto out_fd;
+	dentry->d_op = &eventpollfs_dentry_operations;
+	d_add(dentry, inode);
+	file->f_vfsmnt = mntget(eventpoll_mnt);
+	file->f_dentry = dentry;
+
+	file->f_pos = 0;
+	file->f_flags = O_RDONLY;
+	file->f_op = &eventpoll_fops;
+	file->f_mode = FMODE_READ;
+	file->f_version = 0;
+	file->private_data = ep;
+
+	fd_install(fd, file);
+	return fd;
+
+out_fd:
+	put_unused_fd(fd);
+out_inode:
+	iput(inode);
+out_filp:
+	put_filp(file);
+out:
+	return error;
+}
+
+/*
+ * size is what the caller expects to watch. The items don't come out
+ * of a table, so it is only checked.
+ */
+asmlinkage long sys_epoll_create(int size)
+{
+	struct eventpoll *ep;
+	int fd;
+
+	if (size <= 0)
+		return -EINVAL;
+	ep = kmalloc(sizeof(*ep), GFP_KERNEL);
+	if (!ep)
+		return -ENOMEM;
+	init_MUTEX(&ep->sem);
+	spin_lock_init(&ep->lock);
+	init_waitqueue_head(&ep->wq);
+	init_waitqueue_head(&ep->poll_wait);
+	INIT_LIST_HEAD(&ep->rdllist);
+	ep->rbr = RB_ROOT;
+
+	fd = ep_getfd(ep);
+	if (fd < 0)
+		kfree(ep);
+	return fd;
+}
+
+asmlinkage long sys_epoll_ctl(int epfd, int op, int fd,
+			      struct epoll_event *event)
+{
+	struct file *file, *tfile;
+	struct eventpoll *ep;
+	struct epitem *epi;
+	struct epoll_event epds;
+	int error;
+
+	if (op != EPOLL_CTL_DEL) {
+		if (copy_from_user(&epds, event, sizeof(epds)))
+			return -EFAULT;
+		/* These are always reported, as by poll() */
+		epds.events |= POLLERR | POLLHUP;
+	}
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+	tfile = fget(fd);
+	if (!tfile)
+		goto out_fput;
+
+	error = -EPERM;
+	if (!tfile->f_op || !tfile->f_op->poll)
+		goto out_tfput;
+	/* A set inside a set would have its callbacks call each other's */
+	error = -EINVAL;
+	if (!is_file_epoll(file) || is_file_epoll(tfile))
+		goto out_tfput;
+
+	ep = file->private_data;
+	down(&ep->sem);
+	epi = ep_find(ep, tfile, fd);
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		error = -EEXIST;
+		if (!epi)
+			error = ep_insert(ep, &epds, tfile, fd);
+		break;
+	case EPOLL_CTL_DEL:
+		error = -ENOENT;
+		if (epi) {
+			ep_remove(ep, epi);
+			error = 0;
+		}
+		break;
+	case EPOLL_CTL_MOD:
+		error = -ENOENT;
+		if (epi) {
+			ep_modify(ep, epi, &epds);
+			error = 0;
+		}
+		break;
+	}
+	up(&ep->sem);
+
+out_tfput:
+	fput(tfile);
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+/* timeout is in milliseconds, negative to wait for as long as it takes */
+asmlinkage long sys_epoll_wait(int epfd, struct epoll_event *events,
+			       int maxevents, int timeout)
+{
+	struct file *file;
+	long jtimeout;
+	int error;
+
+	if (maxevents <= 0 || maxevents > EP_MAX_EVENTS)
+		return -EINVAL;
+	if (verify_area(VERIFY_WRITE, events,
+			maxevents * sizeof(struct epoll_event)))
+		return -EFAULT;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+	error = -EINVAL;
+	if (!is_file_epoll(file))
+		goto out_fput;
+
+	if (timeout < 0 ||
+	    (unsigned long) timeout >= (MAX_SCHEDULE_TIMEOUT - 999) / HZ)
+		jtimeout = MAX_SCHEDULE_TIMEOUT;
+	else
+		jtimeout = ((long) timeout * HZ + 999) / 1000;
+
+	error = ep_poll(file->private_data, events, maxevents, jtimeout);
+
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+static int eventpollfs_statfs(struct super_block *sb, struct statfs *buf)
+{
+	buf->f_type = EVENTPOLLFS_MAGIC;
+	buf->f_bsize = 1024;
+	buf->f_namelen = 255;
+	return 0;
+}
+
+static struct super_operations eventpollfs_ops = {
+	statfs:		eventpollfs_statfs,
+};
+
+static struct super_block *eventpollfs_read_super(struct super_block *sb,
+						  void *data, int silent)
+{
+	struct inode *root = new_inode(sb);
+	if (!root)
+		return NULL;
+	root->i_mode = S_IFDIR | S_IRUSR | S_IWUSR;
+	root->i_uid = root->i_gid = 0;
+	root->i_atime = root->i_mtime = root->i_ctime = CURRENT_TIME;
+	sb->s_blocksize = 1024;
+	sb->s_blocksize_bits = 10;
+	sb->s_magic = EVENTPOLLFS_MAGIC;
+	sb->s_op = &eventpollfs_ops;
+	sb->s_root = d_alloc(NULL, &(const struct qstr) { "eventpoll:", 10, 0 });
+	if (!sb->s_root) {
+		iput(root);
+		return NULL;
+	}
+	sb->s_root->d_sb = sb;
+	sb->s_root->d_parent = sb->s_root;
+	d_instantiate(sb->s_root, root);
+	return sb;
+}
+
+static DECLARE_FSTYPE(eventpoll_fs_type, "eventpollfs", eventpollfs_read_super,
+	FS_NOMOUNT|FS_SINGLE);
+
+static int __init eventpoll_init(void)
+{
+	int err;
+
+	epi_cachep = kmem_cache_create("eventpoll_epi", sizeof(struct epitem),
+				       0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	pwq_cachep = kmem_cache_create("eventpoll_pwq",
+				       sizeof(struct eppoll_entry),
+				       0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!epi_cachep || !pwq_cachep)
+		panic("Cannot create eventpoll SLAB caches");
+
+	err = register_filesystem(&eventpoll_fs_type);
+	if (!err) {
+		eventpoll_mnt = kern_mount(&eventpoll_fs_type);
+		err = PTR_ERR(eventpoll_mnt);
+		if (IS_ERR(eventpoll_mnt))
+			unregister_filesystem(&eventpoll_fs_type);
+		else
+			err = 0;
+	}
+	return err;
+}
+
+module_init(eventpoll_init)
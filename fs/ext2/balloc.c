@@ -16,6 +16,8 @@
 #include <linux/ext2_fs.h>
 #include <linux/locks.h>
 #include <linux/quotaops.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 
 /*
  * balloc.c contains the blocks allocation and deallocation routines
@@ -70,181 +72,122 @@ struct ext2_group_desc * ext2_get_group_desc(struct super_block * sb,
 }
 
 /*
- * Read the bitmap for a given block_group, reading into the specified 
- * slot in the superblock's bitmap cache.
- *
- * Return >=0 on success or a -ve error code.
+ * The block and inode bitmaps are cached per filesystem, as many as
+ * ext2_read_super() sized the cache for.  A bitmap stays in its slot
+ * until it is the least recently used one and another is needed, so a
+ * slot number returned is good until the next load.
  */
-
-static int read_block_bitmap (struct super_block * sb,
-			       unsigned int block_group,
-			       unsigned long bitmap_nr)
+int ext2_alloc_bitmap_cache (struct super_block * sb,
+			     struct ext2_bitmap_cache * c, unsigned int slots)
 {
-	struct ext2_group_desc * gdp;
-	struct buffer_head * bh = NULL;
-	int retval = -EIO;
-	
-	gdp = ext2_get_group_desc (sb, block_group, NULL);
-	if (!gdp)
-		goto error_out;
-	retval = 0;
-	bh = bread (sb->s_dev, le32_to_cpu(gdp->bg_block_bitmap), sb->s_blocksize);
-	if (!bh) {
-		ext2_error (sb, "read_block_bitmap",
-			    "Cannot read block bitmap - "
-			    "block_group = %d, block_bitmap = %lu",
-			    block_group, (unsigned long) gdp->bg_block_bitmap);
-		retval = -EIO;
+	unsigned long groups = sb->u.ext2_sb.s_groups_count;
+
+	memset(c, 0, sizeof(*c));
+	c->group = kmalloc(slots * (2 * sizeof(unsigned long) +
+				    sizeof(struct buffer_head *)), GFP_KERNEL);
+	if (!c->group)
+		return -ENOMEM;
+	c->used = c->group + slots;
+	c->bh = (struct buffer_head **) (c->used + slots);
+	if (groups * sizeof(unsigned short) > PAGE_SIZE)
+		c->slot = vmalloc(groups * sizeof(unsigned short));
+	else
+		c->slot = kmalloc(groups * sizeof(unsigned short), GFP_KERNEL);
+	if (!c->slot) {
+		kfree(c->group);
+		return -ENOMEM;
 	}
-	/*
-	 * On IO error, just leave a zero in the superblock's block pointer for
-	 * this group.  The IO will be retried next time.
-	 */
-error_out:
-	sb->u.ext2_sb.s_block_bitmap_number[bitmap_nr] = block_group;
-	sb->u.ext2_sb.s_block_bitmap[bitmap_nr] = bh;
-	return retval;
+	memset(c->slot, 0, groups * sizeof(unsigned short));
+	c->nr_slots = slots;
+	return 0;
+}
+
+void ext2_free_bitmap_cache (struct super_block * sb,
+			     struct ext2_bitmap_cache * c)
+{
+	unsigned long groups = sb->u.ext2_sb.s_groups_count;
+	int i;
+
+	for (i = 0; i < c->nr_loaded; i++)
+		brelse(c->bh[i]);
+	kfree(c->group);
+	if (groups * sizeof(unsigned short) > PAGE_SIZE)
+		vfree(c->slot);
+	else
+		kfree(c->slot);
 }
 
 /*
- * load_block_bitmap loads the block bitmap for a blocks group
+ * ext2_load_bitmap loads the block or inode bitmap of a block group.
  *
- * It maintains a cache for the last bitmaps loaded.  This cache is managed
- * with a LRU algorithm.
- *
- * Notes:
- * 1/ There is one cache per mounted file system.
- * 2/ If the file system contains less than EXT2_MAX_GROUP_LOADED groups,
- *    this function reads the bitmap without maintaining a LRU cache.
- * 
- * Return the slot used to store the bitmap, or a -ve error code.
+ * Return the slot used to store the bitmap, or a -ve error code.  On
+ * IO error the slot keeps a NULL buffer and the read is retried the
+ * next time the group is asked for.
  */
-static int __load_block_bitmap (struct super_block * sb,
-			        unsigned int block_group)
+int ext2_load_bitmap (struct super_block * sb, struct ext2_bitmap_cache * c,
+		      unsigned int block_group, int inode_bitmap)
 {
-	int i, j, retval = 0;
-	unsigned long block_bitmap_number;
-	struct buffer_head * block_bitmap;
+	struct ext2_group_desc * gdp;
+	struct buffer_head * bh;
+	unsigned long block;
+	int i, slot;
 
 	if (block_group >= sb->u.ext2_sb.s_groups_count)
-		ext2_panic (sb, "load_block_bitmap",
+		ext2_panic (sb, "ext2_load_bitmap",
 			    "block_group >= groups_count - "
 			    "block_group = %d, groups_count = %lu",
 			    block_group, sb->u.ext2_sb.s_groups_count);
 
-	if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED) {
-		if (sb->u.ext2_sb.s_block_bitmap[block_group]) {
-			if (sb->u.ext2_sb.s_block_bitmap_number[block_group] ==
-			    block_group)
-				return block_group;
-			ext2_error (sb, "__load_block_bitmap",
-				    "block_group != block_bitmap_number");
+	slot = c->slot[block_group] - 1;
+	if (slot >= 0) {
+		c->used[slot] = ++sb->u.ext2_sb.s_bitmap_clock;
+		if (c->bh[slot]) {
+			c->hits++;
+			return slot;
 		}
-		retval = read_block_bitmap (sb, block_group, block_group);
-		if (retval < 0)
-			return retval;
-		return block_group;
-	}
-
-	for (i = 0; i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-		    sb->u.ext2_sb.s_block_bitmap_number[i] != block_group; i++)
-		;
-	if (i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-  	    sb->u.ext2_sb.s_block_bitmap_number[i] == block_group) {
-		block_bitmap_number = sb->u.ext2_sb.s_block_bitmap_number[i];
-		block_bitmap = sb->u.ext2_sb.s_block_bitmap[i];
-		for (j = i; j > 0; j--) {
-			sb->u.ext2_sb.s_block_bitmap_number[j] =
-				sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_block_bitmap[j] =
-				sb->u.ext2_sb.s_block_bitmap[j - 1];
-		}
-		sb->u.ext2_sb.s_block_bitmap_number[0] = block_bitmap_number;
-		sb->u.ext2_sb.s_block_bitmap[0] = block_bitmap;
-
-		/*
-		 * There's still one special case here --- if block_bitmap == 0
-		 * then our last attempt to read the bitmap failed and we have
-		 * just ended up caching that failure.  Try again to read it.
-		 */
-		if (!block_bitmap)
-			retval = read_block_bitmap (sb, block_group, 0);
 	} else {
-		if (sb->u.ext2_sb.s_loaded_block_bitmaps < EXT2_MAX_GROUP_LOADED)
-			sb->u.ext2_sb.s_loaded_block_bitmaps++;
-		else
-			brelse (sb->u.ext2_sb.s_block_bitmap[EXT2_MAX_GROUP_LOADED - 1]);
-		for (j = sb->u.ext2_sb.s_loaded_block_bitmaps - 1; j > 0;  j--) {
-			sb->u.ext2_sb.s_block_bitmap_number[j] =
-				sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_block_bitmap[j] =
-				sb->u.ext2_sb.s_block_bitmap[j - 1];
+		c->misses++;
+		if (c->nr_loaded < c->nr_slots)
+			slot = c->nr_loaded++;
+		else {
+			slot = 0;
+			for (i = 1; i < c->nr_slots; i++)
+				if (c->used[i] < c->used[slot])
+					slot = i;
+			c->slot[c->group[slot]] = 0;
+			brelse(c->bh[slot]);
 		}
-		retval = read_block_bitmap (sb, block_group, 0);
+		c->group[slot] = block_group;
+		c->bh[slot] = NULL;
+		c->slot[block_group] = slot + 1;
+		c->used[slot] = ++sb->u.ext2_sb.s_bitmap_clock;
 	}
-	return retval;
+
+	gdp = ext2_get_group_desc (sb, block_group, NULL);
+	if (!gdp)
+		return -EIO;
+	if (inode_bitmap)
+		block = le32_to_cpu(gdp->bg_inode_bitmap);
+	else
+		block = le32_to_cpu(gdp->bg_block_bitmap);
+	bh = bread (sb->s_dev, block, sb->s_blocksize);
+	if (!bh) {
+		ext2_error (sb, "ext2_load_bitmap",
+			    "Cannot read %s bitmap - "
+			    "block_group = %d, bitmap = %lu",
+			    inode_bitmap ? "inode" : "block",
+			    block_group, block);
+		return -EIO;
+	}
+	c->bh[slot] = bh;
+	return slot;
 }
 
-/*
- * Load the block bitmap for a given block group.  First of all do a couple
- * of fast lookups for common cases and then pass the request onto the guts
- * of the bitmap loader.
- *
- * Return the slot number of the group in the superblock bitmap cache's on
- * success, or a -ve error code.
- *
- * There is still one inconsistency here --- if the number of groups in this
- * filesystems is <= EXT2_MAX_GROUP_LOADED, then we have no way of 
- * differentiating between a group for which we have never performed a bitmap
- * IO request, and a group for which the last bitmap read request failed.
- */
 static inline int load_block_bitmap (struct super_block * sb,
 				     unsigned int block_group)
 {
-	int slot;
-	
-	/*
-	 * Do the lookup for the slot.  First of all, check if we're asking
-	 * for the same slot as last time, and did we succeed that last time?
-	 */
-	if (sb->u.ext2_sb.s_loaded_block_bitmaps > 0 &&
-	    sb->u.ext2_sb.s_block_bitmap_number[0] == block_group &&
-	    sb->u.ext2_sb.s_block_bitmap[0]) {
-		return 0;
-	}
-	/*
-	 * Or can we do a fast lookup based on a loaded group on a filesystem
-	 * small enough to be mapped directly into the superblock?
-	 */
-	else if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED && 
-		 sb->u.ext2_sb.s_block_bitmap_number[block_group] == block_group &&
-		 sb->u.ext2_sb.s_block_bitmap[block_group]) {
-		slot = block_group;
-	}
-	/*
-	 * If not, then do a full lookup for this block group.
-	 */
-	else {
-		slot = __load_block_bitmap (sb, block_group);
-	}
-
-	/*
-	 * <0 means we just got an error
-	 */
-	if (slot < 0)
-		return slot;
-	
-	/*
-	 * If it's a valid slot, we may still have cached a previous IO error,
-	 * in which case the bh in the superblock cache will be zero.
-	 */
-	if (!sb->u.ext2_sb.s_block_bitmap[slot])
-		return -EIO;
-	
-	/*
-	 * Must have been read in OK to get this far.
-	 */
-	return slot;
+	return ext2_load_bitmap (sb, &sb->u.ext2_sb.s_block_bitmaps,
+				 block_group, 0);
 }
 
 void ext2_free_blocks (const struct inode * inode, unsigned long block,
@@ -296,7 +239,7 @@ do_more:
 	if (bitmap_nr < 0)
 		goto error_return;
 	
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+	bh = sb->u.ext2_sb.s_block_bitmaps.bh[bitmap_nr];
 	gdp = ext2_get_group_desc (sb, block_group, &bh2);
 	if (!gdp)
 		goto error_return;
@@ -345,14 +288,254 @@ error_return:
 	return;
 }
 
+/*
+ * Block reservation windows.
+ *
+ * A regular file that is being written gets a window of blocks in one
+ * group, and takes its new blocks from the free ones in there. Windows
+ * don't overlap, so files written at the same time don't get their
+ * blocks interleaved. Nothing goes into the bitmaps: the windows only
+ * live in memory, in a tree per filesystem sorted by start block, and
+ * allocations that don't use a window may still take blocks from them.
+ *
+ * When a window is used up, the next one is twice the size, up to
+ * EXT2_MAX_RESERVE_BLOCKS, if at least half of its blocks went to the
+ * file; so a file written quickly gets long runs of blocks. A window
+ * lasts until the file is truncated, its last writer closes it, or the
+ * inode leaves the cache.
+ *
+ * The windows are changed with both the superblock locked and
+ * s_rsv_window_lock held, so that they can be discarded with only the
+ * latter.
+ */
+
+void ext2_init_reservation (struct inode * inode)
+{
+	struct ext2_reserve_window * rsv = &inode->u.ext2_i.i_rsv_window;
+
+	rsv->rsv_start = rsv->rsv_end = 0;
+	rsv->rsv_goal_size = EXT2_DEFAULT_RESERVE_BLOCKS;
+	rsv->rsv_alloc_hit = 0;
+}
+
+/* The first window that ends at or after block */
+static struct ext2_reserve_window * rsv_search (rb_root_t * root,
+						unsigned long block)
+{
+	rb_node_t * n = root->rb_node;
+	struct ext2_reserve_window * rsv, * found = NULL;
+
+	while (n) {
+		rsv = rb_entry(n, struct ext2_reserve_window, rsv_node);
+		if (rsv->rsv_end >= block) {
+			found = rsv;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+	return found;
+}
+
+static void rsv_window_add (struct super_block * sb,
+			    struct ext2_reserve_window * rsv)
+{
+	rb_root_t * root = &sb->u.ext2_sb.s_rsv_window_root;
+	rb_node_t ** p = &root->rb_node, * parent = NULL;
+	struct ext2_reserve_window * this;
+
+	while (*p) {
+		parent = *p;
+		this = rb_entry(parent, struct ext2_reserve_window, rsv_node);
+		if (rsv->rsv_start < this->rsv_start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&rsv->rsv_node, parent, p);
+	rb_insert_color(&rsv->rsv_node, root);
+}
+
+static void rsv_window_remove (struct super_block * sb,
+			       struct ext2_reserve_window * rsv)
+{
+	rb_erase(&rsv->rsv_node, &sb->u.ext2_sb.s_rsv_window_root);
+	rsv->rsv_start = rsv->rsv_end = 0;
+}
+
+void ext2_discard_reservation (struct inode * inode)
+{
+	struct ext2_reserve_window * rsv = &inode->u.ext2_i.i_rsv_window;
+	spinlock_t * lock = &inode->i_sb->u.ext2_sb.s_rsv_window_lock;
+
+	if (!rsv->rsv_end)
+		return;
+	spin_lock(lock);
+	if (rsv->rsv_end)
+		rsv_window_remove(inode->i_sb, rsv);
+	spin_unlock(lock);
+}
+
+/*
+ * Find a free block near goal in the window rsv, moving the window to
+ * goal if it isn't there or is full. Returns the group of the block,
+ * with its bit in *bit and the group's bitmap in *bhp, or -1 if goal's
+ * group has no room for a window. Called with the superblock locked.
+ */
+static int ext2_alloc_from_window (struct super_block * sb,
+				   struct ext2_reserve_window * rsv,
+				   unsigned long goal, int * bit,
+				   struct buffer_head ** bhp)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	spinlock_t * lock = &sb->u.ext2_sb.s_rsv_window_lock;
+	unsigned long first = le32_to_cpu(es->s_first_data_block);
+	unsigned long group_start, group_end, start, end, size;
+	struct ext2_reserve_window * next;
+	struct buffer_head * bh;
+	int group, bitmap_nr, j;
+
+	if (goal < first || goal >= le32_to_cpu(es->s_blocks_count))
+		goal = first;
+	group = (goal - first) / EXT2_BLOCKS_PER_GROUP(sb);
+	group_start = first + group * EXT2_BLOCKS_PER_GROUP(sb);
+	group_end = group_start + EXT2_BLOCKS_PER_GROUP(sb) - 1;
+	if (group_end >= le32_to_cpu(es->s_blocks_count))
+		group_end = le32_to_cpu(es->s_blocks_count) - 1;
+
+	bitmap_nr = load_block_bitmap (sb, group);
+	if (bitmap_nr < 0)
+		return -1;
+	bh = sb->u.ext2_sb.s_block_bitmaps.bh[bitmap_nr];
+
+	if (rsv->rsv_end) {
+		if (goal >= rsv->rsv_start && goal <= rsv->rsv_end) {
+			j = ext2_find_next_zero_bit(bh->b_data,
+						    rsv->rsv_end - group_start + 1,
+						    goal - group_start);
+			if (j <= rsv->rsv_end - group_start)
+				goto got_it;
+		}
+		/* Used up, or the file is being written elsewhere */
+		size = rsv->rsv_end - rsv->rsv_start + 1;
+		if (goal >= rsv->rsv_start && goal <= rsv->rsv_end + 1 &&
+		    rsv->rsv_alloc_hit >= size / 2) {
+			rsv->rsv_goal_size *= 2;
+			if (rsv->rsv_goal_size > EXT2_MAX_RESERVE_BLOCKS)
+				rsv->rsv_goal_size = EXT2_MAX_RESERVE_BLOCKS;
+		}
+		spin_lock(lock);
+		rsv_window_remove(sb, rsv);
+		spin_unlock(lock);
+	}
+
+	/*
+	 * A new window starts at a free block at or after goal, and must
+	 * keep out of the other windows. If there is just a bit of room
+	 * before the next one, skip past it rather than take that.
+	 */
+	size = rsv->rsv_goal_size;
+	j = goal - group_start;
+	spin_lock(lock);
+	for (;;) {
+		j = ext2_find_next_zero_bit(bh->b_data,
+					    group_end - group_start + 1, j);
+		if (j > group_end - group_start) {
+			spin_unlock(lock);
+			return -1;
+		}
+		start = group_start + j;
+		end = start + size - 1;
+		if (end > group_end)
+			end = group_end;
+		next = rsv_search(&sb->u.ext2_sb.s_rsv_window_root, start);
+		if (!next || next->rsv_start > end)
+			break;
+		if (next->rsv_start > start &&
+		    next->rsv_start - start >= size / 2) {
+			end = next->rsv_start - 1;
+			break;
+		}
+		j = next->rsv_end + 1 - group_start;
+	}
+	rsv->rsv_start = start;
+	rsv->rsv_end = end;
+	rsv->rsv_alloc_hit = 0;
+	rsv_window_add(sb, rsv);
+	spin_unlock(lock);
+
+got_it:
+	rsv->rsv_alloc_hit++;
+	*bit = j;
+	*bhp = bh;
+	return group;
+}
+
+/*
+ * With the delalloc mount option a file is only promised its blocks on
+ * write(), they are allocated when the data is written out. Promised
+ * blocks are counted here; other allocations have to leave that many
+ * free, and some room for the indirect blocks they will need. A file
+ * with delayed blocks of its own may use up the room, that is what it
+ * is there for.
+ */
+
+static inline unsigned long ext2_delayed_need (struct super_block * sb,
+					       unsigned long nr)
+{
+	return nr ? nr + nr / EXT2_ADDR_PER_BLOCK(sb) + 2 : 0;
+}
+
+static inline int ext2_may_use_reserved (struct super_block * sb)
+{
+	return sb->u.ext2_sb.s_resuid == current->fsuid ||
+	       (sb->u.ext2_sb.s_resgid != 0 &&
+		in_group_p (sb->u.ext2_sb.s_resgid)) ||
+	       capable(CAP_SYS_RESOURCE);
+}
+
+int ext2_reserve_delayed (struct inode * inode)
+{
+	struct super_block * sb = inode->i_sb;
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	unsigned long free = le32_to_cpu(es->s_free_blocks_count);
+	unsigned long r_blocks = le32_to_cpu(es->s_r_blocks_count);
+	int err = -ENOSPC;
+
+	if (!ext2_may_use_reserved (sb))
+		free = free > r_blocks ? free - r_blocks : 0;
+	spin_lock (&sb->u.ext2_sb.s_delayed_lock);
+	if (ext2_delayed_need (sb, sb->u.ext2_sb.s_delayed_blocks + 1) < free) {
+		sb->u.ext2_sb.s_delayed_blocks++;
+		inode->u.ext2_i.i_delayed_blocks++;
+		err = 0;
+	}
+	spin_unlock (&sb->u.ext2_sb.s_delayed_lock);
+	return err;
+}
+
+/* nr delayed blocks got allocated, or aren't wanted any more */
+void ext2_release_delayed (struct inode * inode, int nr)
+{
+	struct super_block * sb = inode->i_sb;
+
+	spin_lock (&sb->u.ext2_sb.s_delayed_lock);
+	sb->u.ext2_sb.s_delayed_blocks -= nr;
+	inode->u.ext2_i.i_delayed_blocks -= nr;
+	spin_unlock (&sb->u.ext2_sb.s_delayed_lock);
+}
+
 /*
  * ext2_new_block uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ *
+ * With a reservation window the block comes from in there, if the goal's
+ * group has any room for a window at all.
  */
 int ext2_new_block (const struct inode * inode, unsigned long goal,
+    struct ext2_reserve_window * rsv,
     u32 * prealloc_count, u32 * prealloc_block, int * err)
 {
 	struct buffer_head * bh;
@@ -376,14 +559,25 @@ int ext2_new_block (const struct inode * inode, unsigned long goal,
 	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	if (le32_to_cpu(es->s_free_blocks_count) <= le32_to_cpu(es->s_r_blocks_count) &&
-	    ((sb->u.ext2_sb.s_resuid != current->fsuid) &&
-	     (sb->u.ext2_sb.s_resgid == 0 ||
-	      !in_group_p (sb->u.ext2_sb.s_resgid)) && 
-	     !capable(CAP_SYS_RESOURCE)))
+	    !ext2_may_use_reserved (sb))
+		goto out;
+	if (!inode->u.ext2_i.i_delayed_blocks &&
+	    le32_to_cpu(es->s_free_blocks_count) <=
+	    ext2_delayed_need (sb, sb->u.ext2_sb.s_delayed_blocks))
 		goto out;
 
 	ext2_debug ("goal=%lu.\n", goal);
 
+	if (rsv) {
+		i = ext2_alloc_from_window (sb, rsv, goal, &j, &bh);
+		if (i >= 0) {
+			gdp = ext2_get_group_desc (sb, i, &bh2);
+			if (!gdp)
+				goto io_error;
+			goto got_block;
+		}
+	}
+
 repeat:
 	/*
 	 * First, test whether the goal block is free.
@@ -406,7 +600,7 @@ repeat:
 		if (bitmap_nr < 0)
 			goto io_error;
 		
-		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+		bh = sb->u.ext2_sb.s_block_bitmaps.bh[bitmap_nr];
 
 		ext2_debug ("goal is at %d:%d.\n", i, j);
 
@@ -484,7 +678,7 @@ repeat:
 	if (bitmap_nr < 0)
 		goto io_error;
 	
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+	bh = sb->u.ext2_sb.s_block_bitmaps.bh[bitmap_nr];
 	r = memscan(bh->b_data, 0, EXT2_BLOCKS_PER_GROUP(sb) >> 3);
 	j = (r - bh->b_data) << 3;
 	if (j < EXT2_BLOCKS_PER_GROUP(sb))
@@ -640,7 +834,7 @@ unsigned long ext2_count_free_blocks (struct super_block * sb)
 		if (bitmap_nr < 0)
 			continue;
 		
-		x = ext2_count_free (sb->u.ext2_sb.s_block_bitmap[bitmap_nr],
+		x = ext2_count_free (sb->u.ext2_sb.s_block_bitmaps.bh[bitmap_nr],
 				     sb->s_blocksize);
 		printk ("group %d: stored = %d, counted = %lu\n",
 			i, le16_to_cpu(gdp->bg_free_blocks_count), x);
@@ -740,7 +934,7 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 		if (bitmap_nr < 0)
 			continue;
 
-		bh = EXT2_SB(sb)->s_block_bitmap[bitmap_nr];
+		bh = EXT2_SB(sb)->s_block_bitmaps.bh[bitmap_nr];
 
 		if (ext2_bg_has_super(sb, i) && !ext2_test_bit(0, bh->b_data))
 			ext2_error(sb, __FUNCTION__,
@@ -74,8 +74,12 @@ static loff_t ext2_file_lseek(
  */
 static int ext2_release_file (struct inode * inode, struct file * filp)
 {
-	if (filp->f_mode & FMODE_WRITE)
+	if (filp->f_mode & FMODE_WRITE) {
 		ext2_discard_prealloc (inode);
+		/* the window is kept for as long as somebody may write */
+		if (atomic_read(&inode->i_writecount) == 1)
+			ext2_discard_reservation (inode);
+	}
 	return 0;
 }
 
@@ -106,6 +110,8 @@ struct file_operations ext2_file_operations = {
 	open:		ext2_open_file,
 	release:	ext2_release_file,
 	fsync:		ext2_sync_file,
+	aio_read:	generic_file_aio_read,
+	aio_write:	generic_file_aio_write,
 };
 
 struct inode_operations ext2_file_inode_operations = {
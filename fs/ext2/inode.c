@@ -89,6 +89,9 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal, int *err)
 #endif
 	unsigned long result;
 
+	if (S_ISREG(inode->i_mode) && test_opt(inode->i_sb, RESERVATION))
+		return ext2_new_block (inode, goal,
+				       &inode->u.ext2_i.i_rsv_window, 0, 0, err);
 
 #ifdef EXT2_PREALLOCATE
 	/* Writer: ->i_prealloc* */
@@ -110,14 +113,14 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal, int *err)
 			    alloc_hits, ++alloc_attempts);
 #endif
 		if (S_ISREG(inode->i_mode))
-			result = ext2_new_block (inode, goal, 
+			result = ext2_new_block (inode, goal, 0,
 				 &inode->u.ext2_i.i_prealloc_count,
 				 &inode->u.ext2_i.i_prealloc_block, err);
 		else
-			result = ext2_new_block (inode, goal, 0, 0, err);
+			result = ext2_new_block (inode, goal, 0, 0, 0, err);
 	}
 #else
-	result = ext2_new_block (inode, goal, 0, 0, err);
+	result = ext2_new_block (inode, goal, 0, 0, 0, err);
 #endif
 	return result;
 }
@@ -201,6 +204,44 @@ static int ext2_block_to_path(struct inode *inode, long i_block, int offsets[4])
 	return n;
 }
 
+/*
+ * Indirect blocks are read one at a time as the lookup reaches them, so
+ * a large file read sequentially stalls once per indirect block.  When
+ * the block being read is the one that followed the last readahead (or
+ * the last miss) in its parent, the access looks sequential and the
+ * next few siblings are read ahead with it.
+ */
+#define EXT2_IND_READAHEAD	16
+
+static void ext2_ind_readahead(struct inode *inode, Indirect *p)
+{
+	struct buffer_head *bhs[EXT2_IND_READAHEAD];
+	u32 *q = p->p + 1;
+	u32 *end = (u32 *)p->bh->b_data + EXT2_ADDR_PER_BLOCK(inode->i_sb);
+	int n = 0, i;
+
+	if (le32_to_cpu(p->key) == inode->u.ext2_i.i_ind_readahead) {
+		for (; q < end && n < EXT2_IND_READAHEAD; q++) {
+			struct buffer_head *bh;
+
+			if (!*q)
+				continue;
+			bh = getblk(inode->i_dev, le32_to_cpu(*q),
+				    inode->i_sb->s_blocksize);
+			if (buffer_uptodate(bh)) {
+				brelse(bh);
+				continue;
+			}
+			bhs[n++] = bh;
+		}
+		if (n)
+			ll_rw_block(READA, n, bhs);
+		for (i = 0; i < n; i++)
+			brelse(bhs[i]);
+	}
+	inode->u.ext2_i.i_ind_readahead = q < end ? le32_to_cpu(*q) : 0;
+}
+
 /**
  *	ext2_get_branch - read the chain of indirect blocks leading to data
  *	@inode: inode in question
@@ -247,9 +288,18 @@ static inline Indirect *ext2_get_branch(struct inode *inode,
 	if (!p->key)
 		goto no_block;
 	while (--depth) {
-		bh = bread(dev, le32_to_cpu(p->key), size);
-		if (!bh)
-			goto failure;
+		bh = getblk(dev, le32_to_cpu(p->key), size);
+		if (!buffer_uptodate(bh)) {
+			ll_rw_block(READ, 1, &bh);
+			/* Siblings only exist below an indirect block */
+			if (p->bh)
+				ext2_ind_readahead(inode, p);
+			wait_on_buffer(bh);
+			if (!buffer_uptodate(bh)) {
+				brelse(bh);
+				goto failure;
+			}
+		}
 		/* Reader: pointers */
 		if (!verify_chain(chain, p))
 			goto changed;
@@ -287,6 +337,7 @@ static inline unsigned long ext2_find_near(struct inode *inode, Indirect *ind)
 {
 	u32 *start = ind->bh ? (u32*) ind->bh->b_data : inode->u.ext2_i.i_data;
 	u32 *p;
+	unsigned long bg_start, colour;
 
 	/* Try to find previous block */
 	for (p = ind->p - 1; p >= start; p--)
@@ -299,11 +350,16 @@ static inline unsigned long ext2_find_near(struct inode *inode, Indirect *ind)
 
 	/*
 	 * It is going to be refered from inode itself? OK, just put it into
-	 * the same cylinder group then.
+	 * the same cylinder group then. Processes start at different
+	 * places in it, so that files written at the same time don't all
+	 * go for the same blocks.
 	 */
-	return (inode->u.ext2_i.i_block_group * 
-		EXT2_BLOCKS_PER_GROUP(inode->i_sb)) +
-	       le32_to_cpu(inode->i_sb->u.ext2_sb.s_es->s_first_data_block);
+	bg_start = (inode->u.ext2_i.i_block_group *
+		    EXT2_BLOCKS_PER_GROUP(inode->i_sb)) +
+		   le32_to_cpu(inode->i_sb->u.ext2_sb.s_es->s_first_data_block);
+	colour = (current->pid % 16) *
+		 (EXT2_BLOCKS_PER_GROUP(inode->i_sb) / 16);
+	return bg_start + colour;
 }
 
 /**
@@ -662,17 +718,196 @@ static int ext2_prepare_write(struct file *file, struct page *page, unsigned fro
 {
 	return block_prepare_write(page,from,to,ext2_get_block);
 }
+/* One big kernel lock round trip for the whole batch */
+static int ext2_prepare_write_pages(struct file *file, struct page **pages, int nr, unsigned from, unsigned to)
+{
+	int ret;
+
+	lock_kernel();
+	ret = block_prepare_write_pages(pages,nr,from,to,ext2_get_block);
+	unlock_kernel();
+	return ret;
+}
 static int ext2_bmap(struct address_space *mapping, long block)
 {
 	return generic_block_bmap(mapping,block,ext2_get_block);
 }
+static int ext2_direct_IO(int rw, struct inode *inode, struct kiobuf *iobuf, unsigned long blocknr, int blocksize)
+{
+	return generic_direct_IO(rw, inode, iobuf, blocknr, blocksize, ext2_get_block);
+}
 struct address_space_operations ext2_aops = {
 	readpage: ext2_readpage,
 	writepage: ext2_writepage,
 	sync_page: block_sync_page,
 	prepare_write: ext2_prepare_write,
 	commit_write: generic_commit_write,
-	bmap: ext2_bmap
+	prepare_write_pages: ext2_prepare_write_pages,
+	commit_write_pages: block_commit_write_pages,
+	bmap: ext2_bmap,
+	direct_IO: ext2_direct_IO
+};
+
+/*
+ * Delayed allocation. write() only reserves blocks for the holes it
+ * fills, they are allocated by writepage: for all the delayed buffers of
+ * the dirty pages around the one being written, in file order, so that a
+ * file written in one go gets its blocks in one run.
+ */
+
+#define EXT2_DA_MAX_RUN		256	/* pages allocated for by a writepage */
+
+static int ext2_da_prepare_write(struct file *file, struct page *page, unsigned from, unsigned to)
+{
+	return block_prepare_write_delay(page,from,to,ext2_get_block,ext2_reserve_delayed);
+}
+
+static int page_has_delayed(struct page *page)
+{
+	struct buffer_head *bh, *head = page->buffers;
+
+	if (!head)
+		return 0;
+	bh = head;
+	do {
+		if (buffer_delay(bh))
+			return 1;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return 0;
+}
+
+/* Forget the delayed buffers from offset on, and their reservations */
+static void ext2_da_forget(struct inode *inode, struct page *page, unsigned long offset)
+{
+	struct buffer_head *bh, *head = page->buffers;
+	unsigned long curr_off = 0;
+	int nr = 0;
+
+	if (!head)
+		return;
+	bh = head;
+	do {
+		if (offset <= curr_off && buffer_delay(bh)) {
+			clear_bit(BH_Delay, &bh->b_state);
+			clear_bit(BH_Uptodate, &bh->b_state);
+			nr++;
+		}
+		curr_off += bh->b_size;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	if (nr)
+		ext2_release_delayed(inode, nr);
+}
+
+/* Allocate the delayed blocks of a locked page */
+static int ext2_da_map_page(struct inode *inode, struct page *page)
+{
+	int nr, err;
+
+	err = block_map_delayed(page, ext2_get_block, &nr);
+	if (nr)
+		ext2_release_delayed(inode, nr);
+	return err;
+}
+
+/* The page at index, locked, if it has delayed buffers */
+static struct page *ext2_da_grab(struct address_space *mapping, unsigned long index)
+{
+	struct page *page = find_get_page(mapping, index);
+
+	if (!page)
+		return NULL;
+	if (TryLockPage(page))
+		goto out;
+	if (page->mapping == mapping && PageDirty(page) && page_has_delayed(page))
+		return page;
+	UnlockPage(page);
+out:
+	page_cache_release(page);
+	return NULL;
+}
+
+/*
+ * Allocate for the run of delayed pages page is in. Only page itself
+ * has to succeed, and it is locked already; the others are skipped if
+ * somebody else has them.
+ */
+static int ext2_da_alloc_run(struct inode *inode, struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	unsigned long start = page->index, index;
+	struct page *p;
+	int err;
+
+	while (start > 0 && page->index - start < EXT2_DA_MAX_RUN / 2) {
+		p = ext2_da_grab(mapping, start - 1);
+		if (!p)
+			break;
+		UnlockPage(p);
+		page_cache_release(p);
+		start--;
+	}
+
+	for (index = start; index < start + EXT2_DA_MAX_RUN; index++) {
+		if (index == page->index) {
+			if (ext2_da_map_page(inode, page))
+				break;
+			continue;
+		}
+		p = ext2_da_grab(mapping, index);
+		if (!p) {
+			if (index > page->index)
+				break;
+			continue;
+		}
+		err = ext2_da_map_page(inode, p);
+		UnlockPage(p);
+		page_cache_release(p);
+		if (err)
+			break;
+	}
+
+	/* A neighbour may have failed us before we got to page */
+	return ext2_da_map_page(inode, page);
+}
+
+static int ext2_da_writepage(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	int err;
+
+	err = ext2_da_alloc_run(inode, page);
+	if (err) {
+		/* As block_write_full_page() does, the data is lost */
+		ext2_da_forget(inode, page, 0);
+		ClearPageUptodate(page);
+		UnlockPage(page);
+		return err;
+	}
+	return block_write_full_page(page,ext2_get_block);
+}
+static int ext2_da_bmap(struct address_space *mapping, long block)
+{
+	/* Delayed blocks have no number yet */
+	filemap_fdatasync(mapping);
+	filemap_fdatawait(mapping);
+	return generic_block_bmap(mapping,block,ext2_get_block);
+}
+static int ext2_da_flushpage(struct page *page, unsigned long offset)
+{
+	ext2_da_forget(page->mapping->host, page, offset);
+	return block_flushpage(page, offset);
+}
+struct address_space_operations ext2_da_aops = {
+	readpage: ext2_readpage,
+	writepage: ext2_da_writepage,
+	sync_page: block_sync_page,
+	prepare_write: ext2_da_prepare_write,
+	commit_write: generic_commit_write,
+	bmap: ext2_da_bmap,
+	direct_IO: ext2_direct_IO,
+	flushpage: ext2_da_flushpage
 };
 
 /*
@@ -884,6 +1119,7 @@ void ext2_truncate (struct inode * inode)
 		return;
 
 	ext2_discard_prealloc(inode);
+	ext2_discard_reservation(inode);
 
 	blocksize = inode->i_sb->s_blocksize;
 	iblock = (inode->i_size + blocksize-1)
@@ -1048,6 +1284,7 @@ void ext2_read_inode (struct inode * inode)
 	}
 	inode->i_generation = le32_to_cpu(raw_inode->i_generation);
 	inode->u.ext2_i.i_block_group = block_group;
+	ext2_init_reservation(inode);
 
 	/*
 	 * NOTE! The in-memory inode i_data array is in little-endian order
@@ -1062,7 +1299,10 @@ void ext2_read_inode (struct inode * inode)
 	else if (S_ISREG(inode->i_mode)) {
 		inode->i_op = &ext2_file_inode_operations;
 		inode->i_fop = &ext2_file_operations;
-		inode->i_mapping->a_ops = &ext2_aops;
+		if (test_opt(inode->i_sb, DELALLOC))
+			inode->i_mapping->a_ops = &ext2_da_aops;
+		else
+			inode->i_mapping->a_ops = &ext2_aops;
 	} else if (S_ISDIR(inode->i_mode)) {
 		inode->i_op = &ext2_dir_inode_operations;
 		inode->i_fop = &ext2_dir_operations;
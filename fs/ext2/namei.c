@@ -22,6 +22,7 @@
 #include <linux/ext2_fs.h>
 #include <linux/locks.h>
 #include <linux/quotaops.h>
+#include <linux/slab.h>
 
 
 
@@ -49,6 +50,389 @@ static inline int ext2_match (int len, const char * const name,
 	return !memcmp(name, de->name, len);
 }
 
+/*
+ * Hashed directory index.
+ *
+ * With the dir_index feature a directory that outgrows its first block
+ * is turned into a hash-indexed one: block 0 keeps "." and ".." and,
+ * hidden behind the rec_len of "..", the root of the index, a sorted
+ * array of (hash, block) pairs. These point at the leaves, ordinary
+ * directory blocks holding the names of a hash range, or once the root
+ * is full, at index nodes which look like empty directory blocks and
+ * point at the leaves in turn. A lookup reads the root, maybe a node,
+ * and the one leaf.
+ *
+ * All of this is invisible to code that reads the directory linearly,
+ * so readdir() and old kernels see an ordinary directory. Old kernels
+ * clear EXT2_INDEX_FL, which used to be EXT2_BTREE_FL, when they change
+ * one, and we then go back to linear searches for it. So do we if the
+ * index looks damaged.
+ *
+ * Hash values are even; an index entry with the low bit set says that
+ * its leaf continues the hash of the leaf before it.
+ */
+
+#define DX_HASH_LEGACY		0
+
+/* Returned when the index can't be used, the directory is still fine */
+#define ERR_BAD_DX_DIR		-75000
+
+struct fake_dirent {
+	__u32	inode;
+	__u16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+struct dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
+/* The first entry of each index block holds a dx_countlimit for its hash */
+struct dx_entry {
+	__u32	hash;
+	__u32	block;
+};
+
+struct dx_root {
+	struct fake_dirent	dot;
+	char			dot_name[4];
+	struct fake_dirent	dotdot;
+	char			dotdot_name[4];
+	struct dx_root_info {
+		__u32	reserved_zero;
+		__u8	hash_version;
+		__u8	info_length;	/* 8 */
+		__u8	indirect_levels;
+		__u8	unused_flags;
+	} info;
+	struct dx_entry		entries[0];
+};
+
+struct dx_node {
+	struct fake_dirent	fake;
+	struct dx_entry		entries[0];
+};
+
+/* One level of the path from the root to a leaf */
+struct dx_frame {
+	struct buffer_head	*bh;
+	struct dx_entry		*entries;
+	struct dx_entry		*at;
+};
+
+/* Used to sort a leaf when it is split */
+struct dx_map_entry {
+	__u32	hash;
+	__u32	offs;
+};
+
+static inline int is_dx(struct inode *dir)
+{
+	return EXT2_HAS_COMPAT_FEATURE(dir->i_sb, EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+	       (dir->u.ext2_i.i_flags & EXT2_INDEX_FL);
+}
+
+static inline unsigned dx_get_block(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->block) & 0x00ffffff;
+}
+
+static inline void dx_set_block(struct dx_entry *entry, unsigned value)
+{
+	entry->block = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_hash(struct dx_entry *entry)
+{
+	return le32_to_cpu(entry->hash);
+}
+
+static inline void dx_set_hash(struct dx_entry *entry, unsigned value)
+{
+	entry->hash = cpu_to_le32(value);
+}
+
+static inline unsigned dx_get_count(struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->count);
+}
+
+static inline unsigned dx_get_limit(struct dx_entry *entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->limit);
+}
+
+static inline void dx_set_count(struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *) entries)->count = cpu_to_le16(value);
+}
+
+static inline void dx_set_limit(struct dx_entry *entries, unsigned value)
+{
+	((struct dx_countlimit *) entries)->limit = cpu_to_le16(value);
+}
+
+static inline unsigned dx_root_limit(struct inode *dir, unsigned infosize)
+{
+	unsigned entry_space = dir->i_sb->s_blocksize - EXT2_DIR_REC_LEN(1) -
+		EXT2_DIR_REC_LEN(2) - infosize;
+	return entry_space / sizeof(struct dx_entry);
+}
+
+static inline unsigned dx_node_limit(struct inode *dir)
+{
+	unsigned entry_space = dir->i_sb->s_blocksize - EXT2_DIR_REC_LEN(0);
+	return entry_space / sizeof(struct dx_entry);
+}
+
+/*
+ * The names are taken as signed chars whatever the architecture
+ * thinks, the hashes are on disk.
+ */
+static __u32 dx_hash(const char *name, int len)
+{
+	__u32 hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	const signed char *p = (const signed char *) name;
+
+	while (len--) {
+		__u32 hash = hash1 + (hash0 ^ (*p++ * 7152373));
+
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+/*
+ * Walk the index down to the leaf for hash, filling in one frame per
+ * level. Returns the last frame, or NULL with *err set; ERR_BAD_DX_DIR
+ * if the index makes no sense.
+ */
+static struct dx_frame *dx_probe(struct inode *dir, __u32 hash,
+				 struct dx_frame *frame_in, int *err)
+{
+	unsigned count, indirect, blocks;
+	struct dx_entry *at, *entries, *p, *q, *m;
+	struct dx_root *root;
+	struct buffer_head *bh;
+	struct dx_frame *frame = frame_in;
+
+	blocks = dir->i_size >> EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+	bh = ext2_bread(dir, 0, 0, err);
+	if (!bh) {
+		if (!*err)	/* a hole */
+			*err = ERR_BAD_DX_DIR;
+		return NULL;
+	}
+	root = (struct dx_root *) bh->b_data;
+	if (root->info.hash_version != DX_HASH_LEGACY ||
+	    root->info.reserved_zero || root->info.info_length < 8 ||
+	    root->info.info_length > dir->i_sb->s_blocksize / 2) {
+		ext2_warning(dir->i_sb, "dx_probe",
+			     "bad index root in directory #%lu", dir->i_ino);
+		goto fail;
+	}
+	indirect = root->info.indirect_levels;
+	if (indirect > 1) {
+		ext2_warning(dir->i_sb, "dx_probe",
+			     "unsupported index depth %u in directory #%lu",
+			     indirect, dir->i_ino);
+		goto fail;
+	}
+	entries = (struct dx_entry *) ((char *) &root->info +
+				       root->info.info_length);
+	if (dx_get_limit(entries) != dx_root_limit(dir, root->info.info_length))
+		goto bad_limit;
+
+	for (;;) {
+		count = dx_get_count(entries);
+		if (!count || count > dx_get_limit(entries))
+			goto bad_count;
+
+		/* The last entry with a hash no larger than ours */
+		p = entries + 1;
+		q = entries + count - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (dx_get_hash(m) > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		at = p - 1;
+		if (dx_get_block(at) == 0 || dx_get_block(at) >= blocks)
+			goto bad_block;
+
+		frame->bh = bh;
+		frame->entries = entries;
+		frame->at = at;
+		if (!indirect--)
+			return frame;
+
+		frame++;
+		bh = ext2_bread(dir, dx_get_block(at), 0, err);
+		if (!bh) {
+			if (!*err)
+				*err = ERR_BAD_DX_DIR;
+			goto fail_frames;
+		}
+		entries = ((struct dx_node *) bh->b_data)->entries;
+		if (dx_get_limit(entries) != dx_node_limit(dir))
+			goto bad_limit;
+	}
+
+bad_limit:
+	ext2_warning(dir->i_sb, "dx_probe",
+		     "bad index limit in directory #%lu", dir->i_ino);
+	goto fail;
+bad_count:
+	ext2_warning(dir->i_sb, "dx_probe",
+		     "bad index count in directory #%lu", dir->i_ino);
+	goto fail;
+bad_block:
+	ext2_warning(dir->i_sb, "dx_probe",
+		     "index points past the end of directory #%lu", dir->i_ino);
+fail:
+	brelse(bh);
+	*err = ERR_BAD_DX_DIR;
+fail_frames:
+	while (--frame >= frame_in)
+		brelse(frame->bh);
+	return NULL;
+}
+
+static void dx_release(struct dx_frame *frames)
+{
+	brelse(frames[0].bh);
+	brelse(frames[1].bh);
+}
+
+/*
+ * Entries with the hash we are after may go on in the next leaf, which
+ * is then marked by the low bit of its hash. If so, move the path over
+ * to that leaf and return 1; 0 if it isn't needed, or an error.
+ */
+static int dx_next_leaf(struct inode *dir, __u32 hash,
+			struct dx_frame *frame, struct dx_frame *frames)
+{
+	struct dx_frame *p = frame;
+	struct buffer_head *bh;
+	int err, num_frames = 0;
+
+	/* Find the lowest level that has an entry after ours */
+	for (;;) {
+		if (++p->at < p->entries + dx_get_count(p->entries))
+			break;
+		if (p == frames)
+			return 0;
+		num_frames++;
+		p--;
+	}
+	if (dx_get_hash(p->at) != (hash | 1))
+		return 0;
+
+	/* and go down its leftmost branch */
+	while (num_frames--) {
+		bh = ext2_bread(dir, dx_get_block(p->at), 0, &err);
+		if (!bh)
+			return err ? err : -EIO;
+		p++;
+		brelse(p->bh);
+		p->bh = bh;
+		p->at = p->entries = ((struct dx_node *) bh->b_data)->entries;
+	}
+	return 1;
+}
+
+/*
+ * Look for the name in one directory block. Returns 1 and the entry in
+ * *res_dir if it is there, 0 if not, -1 if the block is corrupted.
+ */
+static inline int search_dirblock(struct buffer_head * bh, struct inode * dir,
+				  const char * const name, int namelen,
+				  unsigned long offset,
+				  struct ext2_dir_entry_2 ** res_dir)
+{
+	struct ext2_dir_entry_2 * de;
+	char * dlimit;
+	int de_len;
+
+	de = (struct ext2_dir_entry_2 *) bh->b_data;
+	dlimit = bh->b_data + dir->i_sb->s_blocksize;
+	while ((char *) de < dlimit) {
+		/* this code is executed quadratically often */
+		/* do minimal checking `by hand' */
+		if ((char *) de + namelen <= dlimit &&
+		    ext2_match (namelen, name, de)) {
+			/* found a match -
+			   just to be sure, do a full check */
+			if (!ext2_check_dir_entry("ext2_find_entry",
+						  dir, de, bh, offset))
+				return -1;
+			*res_dir = de;
+			return 1;
+		}
+		/* prevent looping on a bad block */
+		de_len = le16_to_cpu(de->rec_len);
+		if (de_len <= 0)
+			return -1;
+		offset += de_len;
+		de = (struct ext2_dir_entry_2 *) ((char *) de + de_len);
+	}
+	return 0;
+}
+
+static struct buffer_head * ext2_dx_find_entry (struct inode * dir,
+						const char * const name, int namelen,
+						struct ext2_dir_entry_2 ** res_dir,
+						int * err)
+{
+	struct dx_frame frames[2], *frame;
+	struct buffer_head * bh;
+	unsigned long block;
+	__u32 hash = dx_hash(name, namelen);
+	int retval;
+
+	frames[0].bh = frames[1].bh = NULL;
+	frame = dx_probe(dir, hash, frames, err);
+	if (!frame)
+		return NULL;
+	do {
+		block = dx_get_block(frame->at);
+		bh = ext2_bread(dir, block, 0, err);
+		if (!bh) {
+			if (!*err)
+				*err = ERR_BAD_DX_DIR;
+			goto out;
+		}
+		retval = search_dirblock(bh, dir, name, namelen,
+					 block << EXT2_BLOCK_SIZE_BITS(dir->i_sb),
+					 res_dir);
+		if (retval == 1) {
+			dx_release(frames);
+			return bh;
+		}
+		brelse(bh);
+		if (retval < 0) {
+			*err = -EIO;
+			goto out;
+		}
+		retval = dx_next_leaf(dir, hash, frame, frames);
+		if (retval < 0) {
+			*err = retval;
+			goto out;
+		}
+	} while (retval == 1);
+	*err = -ENOENT;
+out:
+	dx_release(frames);
+	return NULL;
+}
+
 /*
  *	ext2_find_entry()
  *
@@ -73,6 +457,15 @@ static struct buffer_head * ext2_find_entry (struct inode * dir,
 	if (namelen > EXT2_NAME_LEN)
 		return NULL;
 
+	if (is_dx(dir)) {
+		struct buffer_head * bh;
+
+		bh = ext2_dx_find_entry(dir, name, namelen, res_dir, &err);
+		/* a bad index just means searching the blocks one by one */
+		if (bh || err != ERR_BAD_DX_DIR)
+			return bh;
+	}
+
 	memset (bh_use, 0, sizeof (bh_use));
 	toread = 0;
 	for (block = 0; block < NAMEI_RA_SIZE; ++block) {
@@ -88,8 +481,6 @@ static struct buffer_head * ext2_find_entry (struct inode * dir,
 
 	for (block = 0, offset = 0; offset < dir->i_size; block++) {
 		struct buffer_head * bh;
-		struct ext2_dir_entry_2 * de;
-		char * dlimit;
 
 		if ((block % NAMEI_RA_BLOCKS) == 0 && toread) {
 			ll_rw_block (READ, toread, bh_read);
@@ -113,35 +504,17 @@ static struct buffer_head * ext2_find_entry (struct inode * dir,
 			break;
 		}
 
-		de = (struct ext2_dir_entry_2 *) bh->b_data;
-		dlimit = bh->b_data + sb->s_blocksize;
-		while ((char *) de < dlimit) {
-			/* this code is executed quadratically often */
-			/* do minimal checking `by hand' */
-			int de_len;
-
-			if ((char *) de + namelen <= dlimit &&
-			    ext2_match (namelen, name, de)) {
-				/* found a match -
-				   just to be sure, do a full check */
-				if (!ext2_check_dir_entry("ext2_find_entry",
-							  dir, de, bh, offset))
-					goto failure;
-				for (i = 0; i < NAMEI_RA_SIZE; ++i) {
-					if (bh_use[i] != bh)
-						brelse (bh_use[i]);
-				}
-				*res_dir = de;
-				return bh;
+		i = search_dirblock(bh, dir, name, namelen, offset, res_dir);
+		if (i < 0)
+			goto failure;
+		if (i) {
+			for (i = 0; i < NAMEI_RA_SIZE; ++i) {
+				if (bh_use[i] != bh)
+					brelse (bh_use[i]);
 			}
-			/* prevent looping on a bad block */
-			de_len = le16_to_cpu(de->rec_len);
-			if (de_len <= 0)
-				goto failure;
-			offset += de_len;
-			de = (struct ext2_dir_entry_2 *)
-				((char *) de + de_len);
+			return bh;
 		}
+		offset += sb->s_blocksize;
 
 		brelse (bh);
 		if (((block + NAMEI_RA_SIZE) << EXT2_BLOCK_SIZE_BITS (sb)) >=
@@ -201,6 +574,443 @@ static inline void ext2_set_de_type(struct super_block *sb,
 		de->file_type = ext2_type_by_mode[(mode & S_IFMT)>>S_SHIFT];
 }
 
+/*
+ * An index is only kept up with the feature set; a kernel that doesn't
+ * have it might have changed the directory behind our back.
+ */
+static inline void ext2_update_dx_flag(struct inode *dir)
+{
+	if (!EXT2_HAS_COMPAT_FEATURE(dir->i_sb, EXT2_FEATURE_COMPAT_DIR_INDEX))
+		dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+}
+
+/*
+ * Put the entry into the directory block bh at offset, if it has the
+ * room; -ENOSPC if it hasn't. The caller still owns bh.
+ */
+static int add_dirent_to_buf(struct inode * dir, const char * name,
+			     int namelen, struct inode * inode,
+			     struct buffer_head * bh, unsigned long offset)
+{
+	unsigned short rec_len = EXT2_DIR_REC_LEN(namelen);
+	struct ext2_dir_entry_2 * de, * de1;
+	char * top = bh->b_data + dir->i_sb->s_blocksize;
+
+	de = (struct ext2_dir_entry_2 *) bh->b_data;
+	while ((char *) de < top) {
+		if (!ext2_check_dir_entry ("ext2_add_entry", dir, de, bh,
+					   offset))
+			return -ENOENT;
+		if (ext2_match (namelen, name, de))
+			return -EEXIST;
+		if ((le32_to_cpu(de->inode) == 0 && le16_to_cpu(de->rec_len) >= rec_len) ||
+		    (le16_to_cpu(de->rec_len) >= EXT2_DIR_REC_LEN(de->name_len) + rec_len))
+			goto found;
+		offset += le16_to_cpu(de->rec_len);
+		de = (struct ext2_dir_entry_2 *) ((char *) de + le16_to_cpu(de->rec_len));
+	}
+	return -ENOSPC;
+
+found:
+	if (le32_to_cpu(de->inode)) {
+		de1 = (struct ext2_dir_entry_2 *) ((char *) de +
+			EXT2_DIR_REC_LEN(de->name_len));
+		de1->rec_len = cpu_to_le16(le16_to_cpu(de->rec_len) -
+			EXT2_DIR_REC_LEN(de->name_len));
+		de->rec_len = cpu_to_le16(EXT2_DIR_REC_LEN(de->name_len));
+		de = de1;
+	}
+	de->file_type = EXT2_FT_UNKNOWN;
+	if (inode) {
+		de->inode = cpu_to_le32(inode->i_ino);
+		ext2_set_de_type(dir->i_sb, de, inode->i_mode);
+	} else
+		de->inode = 0;
+	de->name_len = namelen;
+	memcpy (de->name, name, namelen);
+	/*
+	 * XXX shouldn't update any times until successful
+	 * completion of syscall, but too many callers depend
+	 * on this.
+	 *
+	 * XXX similarly, too many callers depend on
+	 * ext2_new_inode() setting the times, but error
+	 * recovery deletes the inode, so the worst that can
+	 * happen is that the times are slightly out of date
+	 * and/or different from the directory change time.
+	 */
+	dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+	ext2_update_dx_flag(dir);
+	mark_inode_dirty(dir);
+	dir->i_version = ++event;
+	mark_buffer_dirty_inode(bh, dir);
+	if (IS_SYNC(dir)) {
+		ll_rw_block (WRITE, 1, &bh);
+		wait_on_buffer (bh);
+	}
+	return 0;
+}
+
+/* Add a block at the end of the directory, the caller fills it in */
+static struct buffer_head * ext2_append(struct inode * dir,
+					unsigned long * block, int * err)
+{
+	struct buffer_head * bh;
+
+	*block = dir->i_size >> EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+	bh = ext2_bread(dir, *block, 1, err);
+	if (bh) {
+		dir->i_size += dir->i_sb->s_blocksize;
+		mark_inode_dirty(dir);
+	} else if (!*err)
+		*err = -EIO;
+	return bh;
+}
+
+/* Returns the number of live entries in the leaf, -1 if it is corrupted */
+static int dx_make_map(struct inode *dir, struct buffer_head *bh,
+		       unsigned long offset, struct dx_map_entry *map)
+{
+	struct ext2_dir_entry_2 *de = (struct ext2_dir_entry_2 *) bh->b_data;
+	char *top = bh->b_data + dir->i_sb->s_blocksize;
+	int count = 0;
+
+	while ((char *) de < top) {
+		if (!ext2_check_dir_entry("ext2_dx_add_entry", dir, de, bh,
+					  offset + ((char *) de - bh->b_data)))
+			return -1;
+		if (de->inode && de->name_len) {
+			map[count].hash = dx_hash(de->name, de->name_len);
+			map[count].offs = (char *) de - bh->b_data;
+			count++;
+		}
+		de = (struct ext2_dir_entry_2 *) ((char *) de + le16_to_cpu(de->rec_len));
+	}
+	return count;
+}
+
+/* Comb sort, the maps hold a few hundred entries at most */
+static void dx_sort_map(struct dx_map_entry *map, int count)
+{
+	struct dx_map_entry tmp;
+	int gap = count, swapped, i;
+
+	do {
+		gap = gap * 10 / 13;
+		if (gap < 1)
+			gap = 1;
+		swapped = 0;
+		for (i = 0; i + gap < count; i++) {
+			if (map[i].hash > map[i + gap].hash) {
+				tmp = map[i];
+				map[i] = map[i + gap];
+				map[i + gap] = tmp;
+				swapped = 1;
+			}
+		}
+	} while (gap > 1 || swapped);
+}
+
+/*
+ * Copy the count entries of the map from one block to the start of
+ * another, and free them in the first. Returns the last one copied.
+ */
+static struct ext2_dir_entry_2 *dx_move_dirents(char *from, char *to,
+						struct dx_map_entry *map,
+						int count)
+{
+	struct ext2_dir_entry_2 *de, *de2 = NULL;
+	unsigned rec_len;
+
+	while (count--) {
+		de = (struct ext2_dir_entry_2 *) (from + map++->offs);
+		rec_len = EXT2_DIR_REC_LEN(de->name_len);
+		memcpy(to, de, rec_len);
+		de2 = (struct ext2_dir_entry_2 *) to;
+		de2->rec_len = cpu_to_le16(rec_len);
+		de->inode = 0;
+		to += rec_len;
+	}
+	return de2;
+}
+
+/* Squeeze the free space out of a block, returns the last entry left */
+static struct ext2_dir_entry_2 *dx_pack_dirents(char *base, int size)
+{
+	struct ext2_dir_entry_2 *de, *next, *to, *prev;
+	unsigned rec_len;
+
+	de = prev = to = (struct ext2_dir_entry_2 *) base;
+	while ((char *) de < base + size) {
+		next = (struct ext2_dir_entry_2 *) ((char *) de + le16_to_cpu(de->rec_len));
+		if (de->inode && de->name_len) {
+			rec_len = EXT2_DIR_REC_LEN(de->name_len);
+			if (de > to)
+				memmove(to, de, rec_len);
+			to->rec_len = cpu_to_le16(rec_len);
+			prev = to;
+			to = (struct ext2_dir_entry_2 *) ((char *) to + rec_len);
+		}
+		de = next;
+	}
+	return prev;
+}
+
+/* The index block of frame must have room for one more */
+static void dx_insert_block(struct dx_frame *frame, __u32 hash,
+			    unsigned long block)
+{
+	struct dx_entry *entries = frame->entries;
+	struct dx_entry *new = frame->at + 1;
+	int count = dx_get_count(entries);
+
+	memmove(new + 1, new, (char *) (entries + count) - (char *) new);
+	dx_set_hash(new, hash);
+	dx_set_block(new, block);
+	dx_set_count(entries, count + 1);
+}
+
+/*
+ * Split the full leaf bh, which frame->at points at, moving the upper
+ * half of its hashes to a new block. Returns the one of the two that
+ * the hash belongs in, and its number in *blockp; bh is released
+ * either way.
+ */
+static struct buffer_head * do_split(struct inode * dir,
+				     struct buffer_head * bh,
+				     struct dx_frame * frame, __u32 hash,
+				     unsigned long * blockp, int * err)
+{
+	unsigned blocksize = dir->i_sb->s_blocksize;
+	unsigned long block = dx_get_block(frame->at), newblock;
+	struct buffer_head * bh2 = NULL;
+	struct ext2_dir_entry_2 * de;
+	struct dx_map_entry *map;
+	int count, split, continued;
+	__u32 hash2;
+
+	map = kmalloc(blocksize / EXT2_DIR_REC_LEN(1) * sizeof(*map),
+		      GFP_KERNEL);
+	if (!map) {
+		*err = -ENOMEM;
+		goto out;
+	}
+	count = dx_make_map(dir, bh, block << EXT2_BLOCK_SIZE_BITS(dir->i_sb),
+			    map);
+	if (count < 2) {
+		/* only a corrupted leaf can be full without two names */
+		*err = count < 0 ? -ENOENT : -ENOSPC;
+		goto out;
+	}
+	bh2 = ext2_append(dir, &newblock, err);
+	if (!bh2)
+		goto out;
+
+	dx_sort_map(map, count);
+	split = count / 2;
+	hash2 = map[split].hash;
+	continued = hash2 == map[split - 1].hash;
+
+	de = dx_move_dirents(bh->b_data, bh2->b_data, map + split,
+			     count - split);
+	de->rec_len = cpu_to_le16(bh2->b_data + blocksize - (char *) de);
+	de = dx_pack_dirents(bh->b_data, blocksize);
+	de->rec_len = cpu_to_le16(bh->b_data + blocksize - (char *) de);
+	mark_buffer_dirty_inode(bh, dir);
+	mark_buffer_dirty_inode(bh2, dir);
+	dx_insert_block(frame, hash2 + continued, newblock);
+	mark_buffer_dirty_inode(frame->bh, dir);
+	kfree(map);
+
+	if (hash >= hash2) {
+		brelse(bh);
+		*blockp = newblock;
+		return bh2;
+	}
+	brelse(bh2);
+	*blockp = block;
+	return bh;
+
+out:
+	kfree(map);
+	brelse(bh);
+	return NULL;
+}
+
+/*
+ * bh, the only block of the directory, is full. Make it the root of an
+ * index over a single leaf with everything but "." and "..", and split
+ * that to add the entry. Returns ERR_BAD_DX_DIR, and nothing changed,
+ * if "." and ".." aren't where the root needs them.
+ */
+static int make_indexed_dir(struct inode * dir, const char * name,
+			    int namelen, struct inode * inode,
+			    struct buffer_head * bh)
+{
+	unsigned blocksize = dir->i_sb->s_blocksize;
+	struct dx_root *root = (struct dx_root *) bh->b_data;
+	struct dx_frame frames[2];
+	struct dx_entry *entries;
+	struct ext2_dir_entry_2 *de, *next;
+	struct buffer_head *bh2;
+	unsigned long block;
+	char *data, *top;
+	int retval;
+
+	if (le16_to_cpu(root->dot.rec_len) != EXT2_DIR_REC_LEN(1) ||
+	    root->dot.name_len != 1 || root->dot_name[0] != '.' ||
+	    root->dotdot.name_len != 2 || root->dotdot_name[0] != '.' ||
+	    root->dotdot_name[1] != '.')
+		return ERR_BAD_DX_DIR;
+	data = (char *) &root->dotdot + le16_to_cpu(root->dotdot.rec_len);
+	top = bh->b_data + blocksize;
+	if (data < (char *) &root->info || data >= top)
+		return ERR_BAD_DX_DIR;
+
+	bh2 = ext2_append(dir, &block, &retval);
+	if (!bh2)
+		return retval;
+
+	/* Everything after ".." moves to the leaf */
+	memcpy(bh2->b_data, data, top - data);
+	de = (struct ext2_dir_entry_2 *) bh2->b_data;
+	top = bh2->b_data + (top - data);
+	while ((char *) (next = (struct ext2_dir_entry_2 *)
+			 ((char *) de + le16_to_cpu(de->rec_len))) < top)
+		de = next;
+	de->rec_len = cpu_to_le16(bh2->b_data + blocksize - (char *) de);
+	mark_buffer_dirty_inode(bh2, dir);
+
+	root->dotdot.rec_len = cpu_to_le16(blocksize - EXT2_DIR_REC_LEN(1));
+	memset(&root->info, 0, sizeof(root->info));
+	root->info.info_length = sizeof(root->info);
+	root->info.hash_version = DX_HASH_LEGACY;
+	entries = root->entries;
+	dx_set_block(entries, block);
+	dx_set_count(entries, 1);
+	dx_set_limit(entries, dx_root_limit(dir, sizeof(root->info)));
+	mark_buffer_dirty_inode(bh, dir);
+	dir->u.ext2_i.i_flags |= EXT2_INDEX_FL;
+	mark_inode_dirty(dir);
+
+	frames[0].bh = bh;
+	frames[0].entries = frames[0].at = entries;
+	bh2 = do_split(dir, bh2, frames, dx_hash(name, namelen), &block,
+		       &retval);
+	if (!bh2)
+		return retval;
+	retval = add_dirent_to_buf(dir, name, namelen, inode, bh2,
+				   block << EXT2_BLOCK_SIZE_BITS(dir->i_sb));
+	brelse(bh2);
+	return retval;
+}
+
+static int ext2_dx_add_entry(struct inode * dir, const char * name,
+			     int namelen, struct inode * inode)
+{
+	struct super_block * sb = dir->i_sb;
+	struct dx_frame frames[2], *frame;
+	struct dx_entry *entries, *at;
+	struct buffer_head * bh = NULL;
+	unsigned long block;
+	__u32 hash = dx_hash(name, namelen);
+	int err;
+
+	frames[0].bh = frames[1].bh = NULL;
+	frame = dx_probe(dir, hash, frames, &err);
+	if (!frame)
+		return err;
+	entries = frame->entries;
+	at = frame->at;
+
+	block = dx_get_block(at);
+	bh = ext2_bread(dir, block, 0, &err);
+	if (!bh) {
+		if (!err)
+			err = ERR_BAD_DX_DIR;
+		goto out;
+	}
+	err = add_dirent_to_buf(dir, name, namelen, inode, bh,
+				block << EXT2_BLOCK_SIZE_BITS(sb));
+	if (err != -ENOSPC)
+		goto out;
+
+	/* The leaf has to be split, make room in its index block first */
+	if (dx_get_count(entries) == dx_get_limit(entries)) {
+		unsigned icount = dx_get_count(entries);
+		struct dx_entry *entries2;
+		struct dx_node *node2;
+		struct buffer_head *bh2;
+		unsigned long newblock;
+
+		if (frame > frames &&
+		    dx_get_count(frames[0].entries) == dx_get_limit(frames[0].entries)) {
+			ext2_warning(sb, "ext2_dx_add_entry",
+				     "directory #%lu index full", dir->i_ino);
+			err = -ENOSPC;
+			goto out;
+		}
+		bh2 = ext2_append(dir, &newblock, &err);
+		if (!bh2)
+			goto out;
+		node2 = (struct dx_node *) bh2->b_data;
+		memset(&node2->fake, 0, sizeof(node2->fake));
+		node2->fake.rec_len = cpu_to_le16(sb->s_blocksize);
+		entries2 = node2->entries;
+
+		if (frame > frames) {
+			/* Split the node, the upper half goes to the new one */
+			unsigned icount1 = icount / 2, icount2 = icount - icount1;
+			__u32 hash2 = dx_get_hash(entries + icount1);
+
+			memcpy(entries2, entries + icount1,
+			       icount2 * sizeof(struct dx_entry));
+			dx_set_count(entries, icount1);
+			dx_set_count(entries2, icount2);
+			dx_set_limit(entries2, dx_node_limit(dir));
+			mark_buffer_dirty_inode(frame->bh, dir);
+			mark_buffer_dirty_inode(bh2, dir);
+
+			if (at - entries >= icount1) {
+				struct buffer_head *tmp = frame->bh;
+
+				frame->at = at = at - entries - icount1 + entries2;
+				frame->entries = entries = entries2;
+				frame->bh = bh2;
+				bh2 = tmp;
+			}
+			dx_insert_block(frames, hash2, newblock);
+			mark_buffer_dirty_inode(frames[0].bh, dir);
+			brelse(bh2);
+		} else {
+			/* The root is full, its entries move down a level */
+			struct dx_root *root = (struct dx_root *) frames[0].bh->b_data;
+
+			memcpy(entries2, entries, icount * sizeof(struct dx_entry));
+			dx_set_limit(entries2, dx_node_limit(dir));
+			dx_set_count(entries, 1);
+			dx_set_block(entries, newblock);
+			root->info.indirect_levels = 1;
+			mark_buffer_dirty_inode(frames[0].bh, dir);
+			mark_buffer_dirty_inode(bh2, dir);
+
+			frame = frames + 1;
+			frame->at = at = at - entries + entries2;
+			frame->entries = entries = entries2;
+			frame->bh = bh2;
+		}
+	}
+	bh = do_split(dir, bh, frame, hash, &block, &err);
+	if (!bh)
+		goto out;
+	err = add_dirent_to_buf(dir, name, namelen, inode, bh,
+				block << EXT2_BLOCK_SIZE_BITS(sb));
+out:
+	brelse(bh);
+	dx_release(frames);
+	return err;
+}
+
 /*
  *	ext2_add_entry()
  *
@@ -209,10 +1019,9 @@ static inline void ext2_set_de_type(struct super_block *sb,
 int ext2_add_entry (struct inode * dir, const char * name, int namelen,
 		    struct inode *inode)
 {
-	unsigned long offset;
-	unsigned short rec_len;
+	unsigned long offset, block, blocks;
 	struct buffer_head * bh;
-	struct ext2_dir_entry_2 * de, * de1;
+	struct ext2_dir_entry_2 * de;
 	struct super_block * sb;
 	int	retval;
 
@@ -220,97 +1029,51 @@ int ext2_add_entry (struct inode * dir, const char * name, int namelen,
 
 	if (!namelen)
 		return -EINVAL;
-	bh = ext2_bread (dir, 0, 0, &retval);
-	if (!bh)
-		return retval;
-	rec_len = EXT2_DIR_REC_LEN(namelen);
-	offset = 0;
-	de = (struct ext2_dir_entry_2 *) bh->b_data;
-	while (1) {
-		if ((char *)de >= sb->s_blocksize + bh->b_data) {
-			brelse (bh);
-			bh = NULL;
-			bh = ext2_bread (dir, offset >> EXT2_BLOCK_SIZE_BITS(sb), 1, &retval);
-			if (!bh)
-				return retval;
-			if (dir->i_size <= offset) {
-				if (dir->i_size == 0) {
-					return -ENOENT;
-				}
-
-				ext2_debug ("creating next block\n");
-
-				de = (struct ext2_dir_entry_2 *) bh->b_data;
-				de->inode = 0;
-				de->rec_len = le16_to_cpu(sb->s_blocksize);
-				dir->i_size = offset + sb->s_blocksize;
-				dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-				mark_inode_dirty(dir);
-			} else {
-
-				ext2_debug ("skipping to next block\n");
-
-				de = (struct ext2_dir_entry_2 *) bh->b_data;
-			}
-		}
-		if (!ext2_check_dir_entry ("ext2_add_entry", dir, de, bh,
-					   offset)) {
-			brelse (bh);
-			return -ENOENT;
-		}
-		if (ext2_match (namelen, name, de)) {
-				brelse (bh);
-				return -EEXIST;
+	if (!dir->i_size)
+		return -ENOENT;
+	if (is_dx(dir)) {
+		retval = ext2_dx_add_entry(dir, name, namelen, inode);
+		if (retval != ERR_BAD_DX_DIR)
+			return retval;
+		/* go on without the index, and don't trust it again */
+		dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+		mark_inode_dirty(dir);
+	}
+	blocks = dir->i_size >> EXT2_BLOCK_SIZE_BITS(sb);
+	for (block = 0, offset = 0; block < blocks;
+	     block++, offset += sb->s_blocksize) {
+		bh = ext2_bread (dir, block, 1, &retval);
+		if (!bh)
+			return retval;
+		retval = add_dirent_to_buf(dir, name, namelen, inode, bh,
+					   offset);
+		if (retval != -ENOSPC) {
+			brelse(bh);
+			return retval;
 		}
-		if ((le32_to_cpu(de->inode) == 0 && le16_to_cpu(de->rec_len) >= rec_len) ||
-		    (le16_to_cpu(de->rec_len) >= EXT2_DIR_REC_LEN(de->name_len) + rec_len)) {
-			offset += le16_to_cpu(de->rec_len);
-			if (le32_to_cpu(de->inode)) {
-				de1 = (struct ext2_dir_entry_2 *) ((char *) de +
-					EXT2_DIR_REC_LEN(de->name_len));
-				de1->rec_len = cpu_to_le16(le16_to_cpu(de->rec_len) -
-					EXT2_DIR_REC_LEN(de->name_len));
-				de->rec_len = cpu_to_le16(EXT2_DIR_REC_LEN(de->name_len));
-				de = de1;
-			}
-			de->file_type = EXT2_FT_UNKNOWN;
-			if (inode) {
-				de->inode = cpu_to_le32(inode->i_ino);
-				ext2_set_de_type(dir->i_sb, de, inode->i_mode);
-			} else
-				de->inode = 0;
-			de->name_len = namelen;
-			memcpy (de->name, name, namelen);
-			/*
-			 * XXX shouldn't update any times until successful
-			 * completion of syscall, but too many callers depend
-			 * on this.
-			 *
-			 * XXX similarly, too many callers depend on
-			 * ext2_new_inode() setting the times, but error
-			 * recovery deletes the inode, so the worst that can
-			 * happen is that the times are slightly out of date
-			 * and/or different from the directory change time.
-			 */
-			dir->i_mtime = dir->i_ctime = CURRENT_TIME;
-			dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-			mark_inode_dirty(dir);
-			dir->i_version = ++event;
-			mark_buffer_dirty_inode(bh, dir);
-			if (IS_SYNC(dir)) {
-				ll_rw_block (WRITE, 1, &bh);
-				wait_on_buffer (bh);
+		if (blocks == 1 && EXT2_HAS_COMPAT_FEATURE(sb,
+					EXT2_FEATURE_COMPAT_DIR_INDEX)) {
+			retval = make_indexed_dir(dir, name, namelen, inode, bh);
+			if (retval != ERR_BAD_DX_DIR) {
+				brelse(bh);
+				return retval;
 			}
-			brelse(bh);
-			return 0;
 		}
-		offset += le16_to_cpu(de->rec_len);
-		de = (struct ext2_dir_entry_2 *) ((char *) de + le16_to_cpu(de->rec_len));
+		brelse(bh);
 	}
-	brelse (bh);
-	return -ENOSPC;
-}
 
+	ext2_debug ("creating next block\n");
+
+	bh = ext2_append(dir, &block, &retval);
+	if (!bh)
+		return retval;
+	de = (struct ext2_dir_entry_2 *) bh->b_data;
+	de->inode = 0;
+	de->rec_len = cpu_to_le16(sb->s_blocksize);
+	retval = add_dirent_to_buf(dir, name, namelen, inode, bh, offset);
+	brelse(bh);
+	return retval;
+}
 /*
  * ext2_delete_entry deletes a directory entry by merging it with the
  * previous entry
@@ -368,7 +1131,10 @@ static int ext2_create (struct inode * dir, struct dentry * dentry, int mode)
 
 	inode->i_op = &ext2_file_inode_operations;
 	inode->i_fop = &ext2_file_operations;
-	inode->i_mapping->a_ops = &ext2_aops;
+	if (test_opt(inode->i_sb, DELALLOC))
+		inode->i_mapping->a_ops = &ext2_da_aops;
+	else
+		inode->i_mapping->a_ops = &ext2_aops;
 	inode->i_mode = mode;
 	mark_inode_dirty(inode);
 	err = ext2_add_entry (dir, dentry->d_name.name, dentry->d_name.len, 
@@ -458,7 +1224,7 @@ static int ext2_mkdir(struct inode * dir, struct dentry * dentry, int mode)
 	if (err)
 		goto out_no_entry;
 	dir->i_nlink++;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(dir);
 	mark_inode_dirty(dir);
 	d_instantiate(dentry, inode);
 	return 0;
@@ -568,7 +1334,7 @@ static int ext2_rmdir (struct inode * dir, struct dentry *dentry)
 	mark_inode_dirty(inode);
 	dir->i_nlink--;
 	inode->i_ctime = dir->i_ctime = dir->i_mtime = CURRENT_TIME;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(dir);
 	mark_inode_dirty(dir);
 
 end_rmdir:
@@ -605,7 +1371,7 @@ static int ext2_unlink(struct inode * dir, struct dentry *dentry)
 	if (retval)
 		goto end_unlink;
 	dir->i_ctime = dir->i_mtime = CURRENT_TIME;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(dir);
 	mark_inode_dirty(dir);
 	inode->i_nlink--;
 	mark_inode_dirty(inode);
@@ -782,7 +1548,7 @@ static int ext2_rename (struct inode * old_dir, struct dentry *old_dentry,
 		mark_inode_dirty(new_inode);
 	}
 	old_dir->i_ctime = old_dir->i_mtime = CURRENT_TIME;
-	old_dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+	ext2_update_dx_flag(old_dir);
 	mark_inode_dirty(old_dir);
 	if (dir_bh) {
 		PARENT_INO(dir_bh->b_data) = le32_to_cpu(new_dir->i_ino);
@@ -794,7 +1560,7 @@ static int ext2_rename (struct inode * old_dir, struct dentry *old_dentry,
 			mark_inode_dirty(new_inode);
 		} else {
 			new_dir->i_nlink++;
-			new_dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
+			ext2_update_dx_flag(new_dir);
 			mark_inode_dirty(new_dir);
 		}
 	}
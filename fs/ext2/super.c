@@ -22,6 +22,7 @@
 #include <linux/fs.h>
 #include <linux/ext2_fs.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/init.h>
 #include <linux/locks.h>
 #include <asm/uaccess.h>
@@ -134,12 +135,16 @@ void ext2_put_super (struct super_block * sb)
 		if (sb->u.ext2_sb.s_group_desc[i])
 			brelse (sb->u.ext2_sb.s_group_desc[i]);
 	kfree(sb->u.ext2_sb.s_group_desc);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_inode_bitmap[i])
-			brelse (sb->u.ext2_sb.s_inode_bitmap[i]);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_block_bitmap[i])
-			brelse (sb->u.ext2_sb.s_block_bitmap[i]);
+	if (test_opt (sb, DEBUG))
+		printk ("EXT2-fs: %u bitmap slots, block bitmaps %lu hits "
+			"%lu misses, inode bitmaps %lu hits %lu misses\n",
+			sb->u.ext2_sb.s_block_bitmaps.nr_slots,
+			sb->u.ext2_sb.s_block_bitmaps.hits,
+			sb->u.ext2_sb.s_block_bitmaps.misses,
+			sb->u.ext2_sb.s_inode_bitmaps.hits,
+			sb->u.ext2_sb.s_inode_bitmaps.misses);
+	ext2_free_bitmap_cache (sb, &sb->u.ext2_sb.s_inode_bitmaps);
+	ext2_free_bitmap_cache (sb, &sb->u.ext2_sb.s_block_bitmaps);
 	brelse (sb->u.ext2_sb.s_sbh);
 
 	return;
@@ -154,6 +159,7 @@ static struct super_operations ext2_sops = {
 	write_super:	ext2_write_super,
 	statfs:		ext2_statfs,
 	remount_fs:	ext2_remount,
+	clear_inode:	ext2_discard_reservation,
 };
 
 /*
@@ -178,6 +184,18 @@ static int parse_options (char * options, unsigned long * sb_block,
 		else if (!strcmp (this_char, "nouid32")) {
 			set_opt (*mount_options, NO_UID32);
 		}
+		else if (!strcmp (this_char, "oldalloc"))
+			set_opt (*mount_options, OLDALLOC);
+		else if (!strcmp (this_char, "orlov"))
+			clear_opt (*mount_options, OLDALLOC);
+		else if (!strcmp (this_char, "reservation"))
+			set_opt (*mount_options, RESERVATION);
+		else if (!strcmp (this_char, "noreservation"))
+			clear_opt (*mount_options, RESERVATION);
+		else if (!strcmp (this_char, "delalloc"))
+			set_opt (*mount_options, DELALLOC);
+		else if (!strcmp (this_char, "nodelalloc"))
+			clear_opt (*mount_options, DELALLOC);
 		else if (!strcmp (this_char, "check")) {
 			if (!value || !*value || !strcmp (value, "none"))
 				clear_opt (*mount_options, CHECK);
@@ -395,6 +413,7 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	int blocksize = BLOCK_SIZE;
 	int hblock;
 	int db_count;
+	unsigned long slots;
 	int i, j;
 
 	/*
@@ -411,6 +430,7 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	  }
 
 	sb->u.ext2_sb.s_mount_opt = 0;
+	set_opt (sb->u.ext2_sb.s_mount_opt, RESERVATION);
 	if (!parse_options ((char *) data, &sb_block, &resuid, &resgid,
 	    &sb->u.ext2_sb.s_mount_opt)) {
 		return NULL;
@@ -418,6 +438,11 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 
 	set_blocksize (dev, blocksize);
 
+	spin_lock_init(&sb->u.ext2_sb.s_rsv_window_lock);
+	sb->u.ext2_sb.s_rsv_window_root = RB_ROOT;
+	spin_lock_init(&sb->u.ext2_sb.s_delayed_lock);
+	sb->u.ext2_sb.s_delayed_blocks = 0;
+
 	/*
 	 * If the superblock doesn't start on a sector boundary,
 	 * calculate the offset.  FIXME(eric) this doesn't make sense
@@ -591,11 +616,15 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 				       EXT2_BLOCKS_PER_GROUP(sb);
 	db_count = (sb->u.ext2_sb.s_groups_count + EXT2_DESC_PER_BLOCK(sb) - 1) /
 		   EXT2_DESC_PER_BLOCK(sb);
-	sb->u.ext2_sb.s_group_desc = kmalloc (db_count * sizeof (struct buffer_head *), GFP_KERNEL);
+	/* The directory allocation debts of the groups go at the end */
+	sb->u.ext2_sb.s_group_desc = kmalloc (db_count * sizeof (struct buffer_head *) +
+					      sb->u.ext2_sb.s_groups_count, GFP_KERNEL);
 	if (sb->u.ext2_sb.s_group_desc == NULL) {
 		printk ("EXT2-fs: not enough memory\n");
 		goto failed_mount;
 	}
+	sb->u.ext2_sb.s_debts = (__u8 *) (sb->u.ext2_sb.s_group_desc + db_count);
+	memset(sb->u.ext2_sb.s_debts, 0, sb->u.ext2_sb.s_groups_count);
 	for (i = 0; i < db_count; i++) {
 		sb->u.ext2_sb.s_group_desc[i] = bread (dev, logic_sb_block + i + 1,
 						       sb->s_blocksize);
@@ -614,14 +643,30 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 		printk ("EXT2-fs: group descriptors corrupted !\n");
 		goto failed_mount;
 	}
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++) {
-		sb->u.ext2_sb.s_inode_bitmap_number[i] = 0;
-		sb->u.ext2_sb.s_inode_bitmap[i] = NULL;
-		sb->u.ext2_sb.s_block_bitmap_number[i] = 0;
-		sb->u.ext2_sb.s_block_bitmap[i] = NULL;
+	/*
+	 * Keep up to 1/128 of memory in bitmaps per filesystem, half of
+	 * it block bitmaps and half inode bitmaps.
+	 */
+	slots = ((num_physpages >> 7) << PAGE_SHIFT >>
+		 EXT2_BLOCK_SIZE_BITS(sb)) / 2;
+	if (slots > EXT2_MAX_BITMAP_SLOTS)
+		slots = EXT2_MAX_BITMAP_SLOTS;
+	if (slots > sb->u.ext2_sb.s_groups_count)
+		slots = sb->u.ext2_sb.s_groups_count;
+	if (slots < EXT2_MAX_GROUP_LOADED)
+		slots = EXT2_MAX_GROUP_LOADED;
+	if (ext2_alloc_bitmap_cache (sb, &sb->u.ext2_sb.s_block_bitmaps, slots))
+		goto failed_bitmaps;
+	if (ext2_alloc_bitmap_cache (sb, &sb->u.ext2_sb.s_inode_bitmaps, slots)) {
+		ext2_free_bitmap_cache (sb, &sb->u.ext2_sb.s_block_bitmaps);
+failed_bitmaps:
+		for (j = 0; j < db_count; j++)
+			brelse (sb->u.ext2_sb.s_group_desc[j]);
+		kfree(sb->u.ext2_sb.s_group_desc);
+		printk ("EXT2-fs: not enough memory for the bitmap cache\n");
+		goto failed_mount;
 	}
-	sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
-	sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
+	sb->u.ext2_sb.s_bitmap_clock = 0;
 	sb->u.ext2_sb.s_gdb_count = db_count;
 	/*
 	 * set up enough so that it can read an inode
@@ -633,6 +678,8 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 			if (sb->u.ext2_sb.s_group_desc[i])
 				brelse (sb->u.ext2_sb.s_group_desc[i]);
 		kfree(sb->u.ext2_sb.s_group_desc);
+		ext2_free_bitmap_cache (sb, &sb->u.ext2_sb.s_inode_bitmaps);
+		ext2_free_bitmap_cache (sb, &sb->u.ext2_sb.s_block_bitmaps);
 		brelse (bh);
 		printk ("EXT2-fs: get root inode failed\n");
 		return NULL;
@@ -774,6 +821,11 @@ int ext2_statfs (struct super_block * sb, struct statfs * buf)
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32_to_cpu(sb->u.ext2_sb.s_es->s_blocks_count) - overhead;
 	buf->f_bfree = ext2_count_free_blocks (sb);
+	/* Blocks promised to delayed allocations are as good as gone */
+	if (buf->f_bfree > sb->u.ext2_sb.s_delayed_blocks)
+		buf->f_bfree -= sb->u.ext2_sb.s_delayed_blocks;
+	else
+		buf->f_bfree = 0;
 	buf->f_bavail = buf->f_bfree - le32_to_cpu(sb->u.ext2_sb.s_es->s_r_blocks_count);
 	if (buf->f_bfree < le32_to_cpu(sb->u.ext2_sb.s_es->s_r_blocks_count))
 		buf->f_bavail = 0;
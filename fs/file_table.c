@@ -11,17 +11,105 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/smp_lock.h>
+#include <linux/cache.h>
+#include <linux/sysctl.h>
+#include <linux/eventpoll.h>
 
 /* sysctl tunables... */
 struct files_stat_struct files_stat = {0, 0, NR_FILE};
 
-/* Here the new files go */
-static LIST_HEAD(anon_list);
-/* And here the free ones sit */
-static LIST_HEAD(free_list);
+/*
+ * Open files are on the list of their super block, or tty, under the
+ * files_lock. Anonymous ones, sockets and pipes, are on no list at all
+ * and never take the lock.
+ */
 /* public *and* exported. Not pretty! */
 spinlock_t files_lock = SPIN_LOCK_UNLOCKED;
 
+/*
+ * Free files sit on the list of the CPU that freed them, so that opening
+ * and closing doesn't bounce a global lock around. Past FILP_CACHE_NR,
+ * they go to the global free list, under the files_lock, which keeps
+ * NR_RESERVED_FILES for root.
+ */
+#define FILP_CACHE_NR	64
+
+static struct filp_cache {
+	spinlock_t		lock;
+	int			nr;
+	struct list_head	list;
+} ____cacheline_aligned filp_caches[NR_CPUS];
+
+static LIST_HEAD(free_list);
+static int nr_free_list;	/* under the files_lock */
+
+static struct file * filp_cache_get(struct filp_cache *fc)
+{
+	struct file * f = NULL;
+
+	spin_lock(&fc->lock);
+	if (fc->nr) {
+		f = list_entry(fc->list.next, struct file, f_list);
+		list_del(&f->f_list);
+		fc->nr--;
+	}
+	spin_unlock(&fc->lock);
+	return f;
+}
+
+/*
+ * Only the file's own users move it onto a list, so a file that is on
+ * none when we let it go can't be put on one behind our back.
+ */
+static inline void file_unlist(struct file * f)
+{
+	if (list_empty(&f->f_list))
+		return;
+	file_list_lock();
+	list_del_init(&f->f_list);
+	file_list_unlock();
+}
+
+/* Called for a file that is on no list any more */
+static void file_free(struct file * f)
+{
+	struct filp_cache *fc = &filp_caches[smp_processor_id()];
+
+	spin_lock(&fc->lock);
+	if (fc->nr < FILP_CACHE_NR) {
+		list_add(&f->f_list, &fc->list);
+		fc->nr++;
+		f = NULL;
+	}
+	spin_unlock(&fc->lock);
+	if (f) {
+		file_list_lock();
+		list_add(&f->f_list, &free_list);
+		nr_free_list++;
+		file_list_unlock();
+	}
+}
+
+/* Take a file off the global free list, or off another CPU's */
+static struct file * get_free_filp(void)
+{
+	struct file * f = NULL;
+	int i;
+
+	file_list_lock();
+	if (nr_free_list > NR_RESERVED_FILES ||
+	    (nr_free_list && !current->euid)) {
+		f = list_entry(free_list.next, struct file, f_list);
+		list_del(&f->f_list);
+		nr_free_list--;
+	}
+	file_list_unlock();
+
+	for (i = 0; !f && i < smp_num_cpus; i++)
+		f = filp_cache_get(&filp_caches[cpu_logical_map(i)]);
+	return f;
+}
+
 /* Find an unused file structure and return a pointer to it.
  * Returns NULL, if there are no more free file structures or
  * we run out of memory.
@@ -33,49 +121,76 @@ struct file * get_empty_filp(void)
 	static int old_max = 0;
 	struct file * f;
 
-	file_list_lock();
-	if (files_stat.nr_free_files > NR_RESERVED_FILES) {
-	used_one:
-		f = list_entry(free_list.next, struct file, f_list);
-		list_del(&f->f_list);
-		files_stat.nr_free_files--;
+	f = filp_cache_get(&filp_caches[smp_processor_id()]);
+	if (f) {
 	new_one:
 		memset(f, 0, sizeof(*f));
+		INIT_LIST_HEAD(&f->f_list);
+		eventpoll_init_file(f);
 		atomic_set(&f->f_count,1);
 		f->f_version = ++event;
 		f->f_uid = current->fsuid;
 		f->f_gid = current->fsgid;
-		list_add(&f->f_list, &anon_list);
-		file_list_unlock();
 		return f;
 	}
-	/*
-	 * Use a reserved one if we're the superuser
-	 */
-	if (files_stat.nr_free_files && !current->euid)
-		goto used_one;
 	/*
 	 * Allocate a new one if we're below the limit.
 	 */
+	file_list_lock();
 	if (files_stat.nr_files < files_stat.max_files) {
+		files_stat.nr_files++;
 		file_list_unlock();
 		f = kmem_cache_alloc(filp_cachep, SLAB_KERNEL);
-		file_list_lock();
-		if (f) {
-			files_stat.nr_files++;
+		if (f)
 			goto new_one;
-		}
+		file_list_lock();
+		files_stat.nr_files--;
+		file_list_unlock();
 		/* Big problems... */
 		printk("VFS: filp allocation failed\n");
+		return NULL;
+	}
+	file_list_unlock();
+	/*
+	 * Reuse a free one from elsewhere, it may be one of the
+	 * reserved ones if we're the superuser.
+	 */
+	f = get_free_filp();
+	if (f)
+		goto new_one;
 
-	} else if (files_stat.max_files > old_max) {
+	if (files_stat.max_files > old_max) {
 		printk("VFS: file-max limit %d reached\n", files_stat.max_files);
 		old_max = files_stat.max_files;
 	}
-	file_list_unlock();
 	return NULL;
 }
 
+/* file-nr: the free files are counted up when it is read */
+int proc_nr_files(ctl_table *table, int write, struct file *filp,
+		  void *buffer, size_t *lenp)
+{
+	int i, nr;
+
+	file_list_lock();
+	nr = nr_free_list;
+	file_list_unlock();
+	for (i = 0; i < smp_num_cpus; i++)
+		nr += filp_caches[cpu_logical_map(i)].nr;
+	files_stat.nr_free_files = nr;
+	return proc_dointvec(table, write, filp, buffer, lenp);
+}
+
+void __init files_init(void)
+{
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		spin_lock_init(&filp_caches[i].lock);
+		INIT_LIST_HEAD(&filp_caches[i].list);
+	}
+}
+
 /*
  * Clear and initialize a (private) struct file for the given dentry,
  * and call the open function (if any).  The caller must verify that
@@ -84,6 +199,7 @@ struct file * get_empty_filp(void)
 int init_private_file(struct file *filp, struct dentry *dentry, int mode)
 {
 	memset(filp, 0, sizeof(*filp));
+	eventpoll_init_file(filp);
 	filp->f_mode   = mode;
 	atomic_set(&filp->f_count, 1);
 	filp->f_dentry = dentry;
@@ -103,6 +219,7 @@ void fput(struct file * file)
 	struct inode * inode = dentry->d_inode;
 
 	if (atomic_dec_and_test(&file->f_count)) {
+		eventpoll_release(file);
 		locks_remove_flock(file);
 		if (file->f_op && file->f_op->release)
 			file->f_op->release(inode, file);
@@ -114,11 +231,8 @@ void fput(struct file * file)
 		dput(dentry);
 		if (mnt)
 			mntput(mnt);
-		file_list_lock();
-		list_del(&file->f_list);
-		list_add(&file->f_list, &free_list);
-		files_stat.nr_free_files++;
-		file_list_unlock();
+		file_unlist(file);
+		file_free(file);
 	}
 }
 
@@ -135,16 +249,39 @@ struct file * fget(unsigned int fd)
 	return file;
 }
 
+/*
+ * The fd table of a single-threaded process can't change while it is
+ * in a system call, so when nobody shares it the lookup needs neither
+ * the file_lock nor a reference; *fput_needed tells fput_light()
+ * whether one was taken. Only for a file that is used and let go of
+ * within one system call.
+ */
+struct file * fget_light(unsigned int fd, int *fput_needed)
+{
+	struct file * file;
+	struct files_struct *files = current->files;
+
+	*fput_needed = 0;
+	if (atomic_read(&files->count) == 1)
+		return fcheck_files(files, fd);
+
+	read_lock(&files->file_lock);
+	file = fcheck_files(files, fd);
+	if (file) {
+		get_file(file);
+		*fput_needed = 1;
+	}
+	read_unlock(&files->file_lock);
+	return file;
+}
+
 /* Here. put_filp() is SMP-safe now. */
 
 void put_filp(struct file *file)
 {
 	if(atomic_dec_and_test(&file->f_count)) {
-		file_list_lock();
-		list_del(&file->f_list);
-		list_add(&file->f_list, &free_list);
-		files_stat.nr_free_files++;
-		file_list_unlock();
+		file_unlist(file);
+		file_free(file);
 	}
 }
 
@@ -13,6 +13,7 @@
 #include <linux/quotaops.h>
 #include <linux/slab.h>
 #include <linux/cache.h>
+#include <linux/low-latency.h>
 
 /*
  * New inode.c implementation.
@@ -49,6 +50,8 @@ static unsigned int i_hash_shift;
  *
  * A "dirty" list is maintained for each super block,
  * allowing for low-overhead inode sync() operations.
+ * While a pass writes them back, the dirty inodes of a
+ * super block sit on its "io" list instead.
  */
 
 static LIST_HEAD(inode_in_use);
@@ -108,6 +111,8 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 		sema_init(&inode->i_sem, 1);
 		sema_init(&inode->i_zombie, 1);
 		spin_lock_init(&inode->i_data.i_shared_lock);
+		INIT_RADIX_TREE(&inode->i_data.page_tree);
+		spin_lock_init(&inode->i_data.page_lock);
 	}
 }
 
@@ -138,6 +143,9 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 	if (sb) {
 		spin_lock(&inode_lock);
 		if ((inode->i_state & flags) != flags) {
+			if ((flags & I_DIRTY_ATIME) &&
+			    !(inode->i_state & I_DIRTY_ATIME))
+				inode->i_atime_dirtied = jiffies;
 			inode->i_state |= flags;
 			/* Only add valid (ie hashed) inodes to the dirty list */
 			if (!list_empty(&inode->i_hash)) {
@@ -184,14 +192,20 @@ static inline void __iget(struct inode * inode)
 		return;
 	}
 	atomic_inc(&inode->i_count);
-	if (!(inode->i_state & I_DIRTY)) {
+	if (!(inode->i_state & I_DIRTY_ALL)) {
 		list_del(&inode->i_list);
 		list_add(&inode->i_list, &inode_in_use);
 	}
 	inodes_stat.nr_unused--;
 }
 
-static inline void sync_one(struct inode *inode, int sync)
+/*
+ * With nr_pages, at most that many pages are written, and *nr_pages is
+ * decremented by what was; nothing is waited for then. An inode that
+ * is left with dirty pages goes back on the dirty list, and so does one
+ * whose only change is an atime younger than atime_interval.
+ */
+static inline void sync_one(struct inode *inode, int sync, long *nr_pages)
 {
 	if (inode->i_state & I_LOCK) {
 		__iget(inode);
@@ -200,38 +214,99 @@ static inline void sync_one(struct inode *inode, int sync)
 		iput(inode);
 		spin_lock(&inode_lock);
 	} else {
+		struct address_space *mapping = inode->i_mapping;
 		unsigned dirty;
 
+		if (nr_pages &&
+		    (inode->i_state & I_DIRTY_ALL) == I_DIRTY_ATIME &&
+		    time_before(jiffies, inode->i_atime_dirtied +
+					 atime_interval * HZ)) {
+			list_del(&inode->i_list);
+			list_add(&inode->i_list, &inode->i_sb->s_dirty);
+			return;
+		}
+
 		list_del(&inode->i_list);
 		list_add(&inode->i_list, atomic_read(&inode->i_count)
 							? &inode_in_use
 							: &inode_unused);
-		/* Set I_LOCK, reset I_DIRTY */
-		dirty = inode->i_state & I_DIRTY;
+		/* Set I_LOCK, reset I_DIRTY_ALL */
+		dirty = inode->i_state & I_DIRTY_ALL;
 		inode->i_state |= I_LOCK;
-		inode->i_state &= ~I_DIRTY;
+		inode->i_state &= ~I_DIRTY_ALL;
 		spin_unlock(&inode_lock);
 
-		filemap_fdatasync(inode->i_mapping);
+		if (nr_pages)
+			*nr_pages -= filemap_fdatasync_nr(mapping, *nr_pages);
+		else
+			filemap_fdatasync(mapping);
 
 		/* Don't write the inode if only I_DIRTY_PAGES was set */
-		if (dirty & (I_DIRTY_SYNC | I_DIRTY_DATASYNC))
+		if (dirty & (I_DIRTY_SYNC | I_DIRTY_DATASYNC | I_DIRTY_ATIME))
 			write_inode(inode, sync);
 
-		filemap_fdatawait(inode->i_mapping);
+		if (!nr_pages)
+			filemap_fdatawait(mapping);
 
 		spin_lock(&inode_lock);
 		inode->i_state &= ~I_LOCK;
+		if (!list_empty(&mapping->dirty_pages) &&
+		    !(inode->i_state & I_DIRTY_PAGES) &&
+		    !list_empty(&inode->i_hash)) {
+			inode->i_state |= I_DIRTY_PAGES;
+			list_del(&inode->i_list);
+			list_add(&inode->i_list, &inode->i_sb->s_dirty);
+		}
 		wake_up(&inode->i_wait);
 	}
 }
 
-static inline void sync_list(struct list_head *head)
+/*
+ * Write back the dirty inodes of a super block, oldest first. The dirty
+ * list is taken over as a whole to begin with, so whatever gets dirtied
+ * meanwhile is left for the next pass, and a pass ends however busy the
+ * filesystem is. Called with the inode_lock held.
+ */
+static void sync_sb_inodes(struct super_block *sb, long *nr_pages)
 {
 	struct list_head * tmp;
 
-	while ((tmp = head->prev) != head)
-		sync_one(list_entry(tmp, struct inode, i_list), 0);
+	list_splice(&sb->s_dirty, &sb->s_io);
+	INIT_LIST_HEAD(&sb->s_dirty);
+
+	while ((tmp = sb->s_io.prev) != &sb->s_io) {
+		if (nr_pages && *nr_pages <= 0)
+			break;
+		sync_one(list_entry(tmp, struct inode, i_list), 0, nr_pages);
+		if (conditional_schedule_needed()) {
+			spin_unlock(&inode_lock);
+			unconditional_schedule();
+			spin_lock(&inode_lock);
+		}
+	}
+}
+
+/**
+ *	sync_inodes_sb - write back the dirty inodes of a filesystem
+ *	@sb: super block to write back
+ *	@nr_pages: if not %NULL, write at most this many pages
+ *
+ *	Without @nr_pages everything is written and waited for. A limited
+ *	pass only starts the writeout, it takes away what it wrote from
+ *	*@nr_pages, and gives up at once if the filesystem is being written
+ *	back already. Either way the other filesystems aren't held up.
+ */
+void sync_inodes_sb(struct super_block *sb, long *nr_pages)
+{
+	if (nr_pages) {
+		if (down_trylock(&sb->s_sync_sem))
+			return;
+	} else
+		down(&sb->s_sync_sem);
+	spin_lock(&inode_lock);
+	sync_sb_inodes(sb, nr_pages);
+	spin_unlock(&inode_lock);
+	up(&sb->s_sync_sem);
 }
 
 /**
@@ -240,6 +315,7 @@ static inline void sync_list(struct list_head *head)
  *
  *	sync_inodes goes through the super block's dirty list, 
  *	writes them out, and puts them back on the normal list.
+ *	With a zero @dev all the filesystems are synced.
  */
  
 void sync_inodes(kdev_t dev)
@@ -249,19 +325,54 @@ void sync_inodes(kdev_t dev)
 	/*
 	 * Search the super_blocks array for the device(s) to sync.
 	 */
-	spin_lock(&inode_lock);
 	for (; sb != sb_entry(&super_blocks); sb = sb_entry(sb->s_list.next)) {
 		if (!sb->s_dev)
 			continue;
 		if (dev && sb->s_dev != dev)
 			continue;
 
-		sync_list(&sb->s_dirty);
+		sync_inodes_sb(sb, NULL);
 
 		if (dev)
 			break;
 	}
+}
+
+/**
+ *	writeback_inodes - write back some dirty inode pages
+ *	@nr_pages: how many pages to write
+ *
+ *	This is kupdate's pass: rather than everything at once, it writes
+ *	about @nr_pages pages, shared out between the filesystems that
+ *	have dirty inodes.
+ */
+
+void writeback_inodes(long nr_pages)
+{
+	struct super_block * sb;
+	long share;
+	int nr = 0;
+
+	spin_lock(&inode_lock);
+	for (sb = sb_entry(super_blocks.next);
+	     sb != sb_entry(&super_blocks);
+	     sb = sb_entry(sb->s_list.next)) {
+		if (sb->s_dev &&
+		    (!list_empty(&sb->s_dirty) || !list_empty(&sb->s_io)))
+			nr++;
+	}
 	spin_unlock(&inode_lock);
+	if (!nr)
+		return;
+
+	for (sb = sb_entry(super_blocks.next);
+	     sb != sb_entry(&super_blocks);
+	     sb = sb_entry(sb->s_list.next)) {
+		if (!sb->s_dev)
+			continue;
+		share = nr_pages / nr + 1;
+		sync_inodes_sb(sb, &share);
+	}
 }
 
 /*
@@ -273,7 +384,7 @@ static void sync_all_inodes(void)
 	for (; sb != sb_entry(&super_blocks); sb = sb_entry(sb->s_list.next)) {
 		if (!sb->s_dev)
 			continue;
-		sync_list(&sb->s_dirty);
+		sync_sb_inodes(sb, NULL);
 	}
 }
 
@@ -293,7 +404,7 @@ void write_inode_now(struct inode *inode, int sync)
 	if (sb) {
 		spin_lock(&inode_lock);
 		while (inode->i_state & I_DIRTY)
-			sync_one(inode, sync);
+			sync_one(inode, sync, NULL);
 		spin_unlock(&inode_lock);
 	}
 	else
@@ -311,7 +422,7 @@ void write_inode_now(struct inode *inode, int sync)
 
 int generic_osync_inode(struct inode *inode, int datasync)
 {
-	int err;
+	int err, sync;
 	
 	/* 
 	 * WARNING
@@ -334,11 +445,19 @@ int generic_osync_inode(struct inode *inode, int datasync)
 	 * every O_SYNC write, not just the synchronous I/Os.  --sct
 	 */
 
+	/* Our writes are waited for, they go ahead of background writeout */
+	sync = current->flags & PF_SYNCWRITE;
+	current->flags |= PF_SYNCWRITE;
+
+	/* Delayed allocation keeps data on dirty pages, not buffers */
+	filemap_fdatasync(inode->i_mapping);
+
 #ifdef WRITERS_QUEUE_IO
 	err = osync_inode_buffers(inode);
 #else
 	err = fsync_inode_buffers(inode);
 #endif
+	filemap_fdatawait(inode->i_mapping);
 
 	spin_lock(&inode_lock);
 	if (!(inode->i_state & I_DIRTY))
@@ -347,10 +466,13 @@ int generic_osync_inode(struct inode *inode, int datasync)
 		goto out;
 	spin_unlock(&inode_lock);
 	write_inode_now(inode, 1);
-	return err;
+	goto done;
 
  out:
 	spin_unlock(&inode_lock);
+ done:
+	if (!sync)
+		current->flags &= ~PF_SYNCWRITE;
 	return err;
 }
 
@@ -416,11 +538,22 @@ static int invalidate_list(struct list_head *head, struct super_block * sb, stru
 	struct list_head *next;
 	int busy = 0, count = 0;
 
+restart:
 	next = head->next;
 	for (;;) {
 		struct list_head * tmp = next;
 		struct inode * inode;
 
+		/*
+		 * Inodes we have already dealt with are off this list,
+		 * so after dropping the lock we can simply start over.
+		 */
+		if (conditional_schedule_needed()) {
+			spin_unlock(&inode_lock);
+			unconditional_schedule();
+			spin_lock(&inode_lock);
+			goto restart;
+		}
 		next = next->next;
 		if (tmp == head)
 			break;
@@ -470,6 +603,7 @@ int invalidate_inodes(struct super_block * sb)
 	busy = invalidate_list(&inode_in_use, sb, &throw_away);
 	busy |= invalidate_list(&inode_unused, sb, &throw_away);
 	busy |= invalidate_list(&sb->s_dirty, sb, &throw_away);
+	busy |= invalidate_list(&sb->s_io, sb, &throw_away);
 	spin_unlock(&inode_lock);
 
 	dispose_list(&throw_away);
@@ -600,7 +734,9 @@ static void clean_inode(struct inode *inode)
 	inode->i_fop = &empty_fops;
 	inode->i_nlink = 1;
 	atomic_set(&inode->i_writecount, 0);
+	atomic_set(&inode->i_dio_count, 0);
 	inode->i_size = 0;
+	inode->i_blkbits = inode->i_sb ? inode->i_sb->s_blocksize_bits : 0;
 	inode->i_generation = 0;
 	memset(&inode->i_dquot, 0, sizeof(inode->i_dquot));
 	inode->i_pipe = NULL;
@@ -869,7 +1005,7 @@ void iput(struct inode *inode)
 				BUG();
 		} else {
 			if (!list_empty(&inode->i_hash)) {
-				if (!(inode->i_state & I_DIRTY)) {
+				if (!(inode->i_state & I_DIRTY_ALL)) {
 					list_del(&inode->i_list);
 					list_add(&inode->i_list,
 						 &inode_unused);
@@ -981,15 +1117,32 @@ void __init inode_init(unsigned long mempages)
  *	Update the accessed time on an inode and mark it for writeback.
  *	This function automatically handles read only file systems and media,
  *	as well as the "noatime" flag and inode specific "noatime" markers.
+ *	On a "relatime" mount the atime is only moved on when it is not
+ *	newer than mtime or ctime, or is atime_interval seconds old.
+ *
+ *	An atime change alone doesn't make the inode dirty for fsync: it
+ *	is written with the next other change to the inode, by sync, or by
+ *	kupdate once it has waited atime_interval seconds.
  */
- 
+
+int atime_interval = 24 * 60 * 60;
+
 void update_atime (struct inode *inode)
 {
+	time_t now;
+
 	if ( IS_NOATIME (inode) ) return;
 	if ( IS_NODIRATIME (inode) && S_ISDIR (inode->i_mode) ) return;
 	if ( IS_RDONLY (inode) ) return;
-	inode->i_atime = CURRENT_TIME;
-	mark_inode_dirty_sync (inode);
+	now = CURRENT_TIME;
+	if (inode->i_atime == now)
+		return;
+	if (IS_RELATIME(inode) && inode->i_atime > inode->i_mtime &&
+	    inode->i_atime > inode->i_ctime &&
+	    now - inode->i_atime < atime_interval)
+		return;
+	inode->i_atime = now;
+	mark_inode_dirty_atime (inode);
 }   /*  End Function update_atime  */
 
 
@@ -1033,6 +1186,12 @@ void remove_dquot_ref(kdev_t dev, short type)
 			continue;
   		remove_inode_dquot_ref(inode, type, &tofree_head);
 	}
+	for (act_head = sb->s_io.next; act_head != &sb->s_io; act_head = act_head->next) {
+		inode = list_entry(act_head, struct inode, i_list);
+		if (!IS_QUOTAINIT(inode))
+			continue;
+  		remove_inode_dquot_ref(inode, type, &tofree_head);
+	}
 	spin_unlock(&inode_lock);
 
 	put_dquot_list(&tofree_head);
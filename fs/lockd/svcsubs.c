@@ -156,7 +156,7 @@ nlm_traverse_locks(struct nlm_host *host, struct nlm_file *file, int action)
 
 again:
 	file->f_locks = 0;
-	for (fl = inode->i_flock; fl; fl = fl->fl_next) {
+	for (fl = posix_first_lock(inode); fl; fl = posix_next_lock(fl)) {
 		if (!(fl->fl_flags & FL_LOCKD))
 			continue;
 
@@ -129,7 +129,23 @@ int leases_enable = 1;
 int lease_break_time = 45;
 
 LIST_HEAD(file_lock_list);
-static LIST_HEAD(blocked_list);
+
+/*
+ * Blocked waiters, hashed by owner and pid so that deadlock detection
+ * only looks at the waiters of the owner it is following.
+ */
+#define BLOCKED_HASH_BITS	7
+#define BLOCKED_HASH_SIZE	(1 << BLOCKED_HASH_BITS)
+static struct list_head blocked_hash[BLOCKED_HASH_SIZE];
+
+static inline struct list_head *blocked_hashfn(fl_owner_t owner, unsigned int pid)
+{
+	unsigned long hash = (unsigned long) owner;
+
+	hash ^= (hash >> BLOCKED_HASH_BITS) ^ (hash >> (2 * BLOCKED_HASH_BITS));
+	hash ^= pid;
+	return blocked_hash + (hash & (BLOCKED_HASH_SIZE - 1));
+}
 
 static kmem_cache_t *filelock_cache;
 
@@ -420,7 +436,7 @@ static void locks_insert_block(struct file_lock *blocker,
 	}
 	list_add_tail(&waiter->fl_block, &blocker->fl_block);
 	waiter->fl_next = blocker;
-	list_add(&waiter->fl_link, &blocked_list);
+	list_add(&waiter->fl_link, blocked_hashfn(waiter->fl_owner, waiter->fl_pid));
 }
 
 static inline
@@ -473,18 +489,136 @@ static void locks_insert_lock(struct file_lock **pos, struct file_lock *fl)
 		fl->fl_insert(fl);
 }
 
-/* Delete a lock and then free it.
- * Remove our lock from the lock lists, wake up processes that are blocked
- * waiting for this lock, notify the FS that the lock has been cleared and
- * finally free the lock.
+/*
+ * An inode's POSIX locks are kept in i_posix_locks, a red-black tree
+ * sorted by fl_start in which every lock also records the largest
+ * fl_end of its subtree.  That finds the locks overlapping a range
+ * without walking the others, however many locks the file has.
  */
-static void locks_delete_lock(struct file_lock **thisfl_p, unsigned int wait)
+static void posix_rb_augment(rb_node_t *rb_node)
 {
-	struct file_lock *fl = *thisfl_p;
+	struct file_lock *fl = rb_entry(rb_node, struct file_lock, fl_rb);
+	loff_t end = fl->fl_end, sub;
 
-	*thisfl_p = fl->fl_next;
-	fl->fl_next = NULL;
+	if (rb_node->rb_left) {
+		sub = rb_entry(rb_node->rb_left, struct file_lock, fl_rb)->fl_rb_end;
+		if (sub > end)
+			end = sub;
+	}
+	if (rb_node->rb_right) {
+		sub = rb_entry(rb_node->rb_right, struct file_lock, fl_rb)->fl_rb_end;
+		if (sub > end)
+			end = sub;
+	}
+	fl->fl_rb_end = end;
+}
+
+/* The lock's fl_end changed, fix up the tree. */
+static void posix_end_update(struct file_lock *fl)
+{
+	rb_node_t *rb_node;
+
+	for (rb_node = &fl->fl_rb; rb_node; rb_node = rb_node->rb_parent)
+		posix_rb_augment(rb_node);
+}
+
+static void posix_link_lock(struct inode *inode, struct file_lock *fl)
+{
+	rb_node_t **p = &inode->i_posix_locks.rb_node;
+	rb_node_t *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (fl->fl_start < rb_entry(parent, struct file_lock, fl_rb)->fl_start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	fl->fl_rb_end = fl->fl_end;
+	rb_link_node(&fl->fl_rb, parent, p);
+	rb_insert_augmented(&fl->fl_rb, &inode->i_posix_locks, posix_rb_augment);
+}
+
+static inline void posix_unlink_lock(struct inode *inode, struct file_lock *fl)
+{
+	rb_erase_augmented(&fl->fl_rb, &inode->i_posix_locks, posix_rb_augment);
+}
+
+/* The first lock in the subtree at rb_node that overlaps start..end */
+static struct file_lock *posix_subtree_overlap(rb_node_t *rb_node,
+					       loff_t start, loff_t end)
+{
+	while (rb_node) {
+		struct file_lock *fl = rb_entry(rb_node, struct file_lock, fl_rb);
+
+		if (fl->fl_rb_end < start)
+			return NULL;
+		if (rb_node->rb_left &&
+		    rb_entry(rb_node->rb_left, struct file_lock, fl_rb)->fl_rb_end >= start) {
+			rb_node = rb_node->rb_left;
+			continue;
+		}
+		if (fl->fl_start > end)
+			return NULL;
+		if (fl->fl_end >= start)
+			return fl;
+		rb_node = rb_node->rb_right;
+	}
+	return NULL;
+}
+
+static inline struct file_lock *posix_first_overlap(struct inode *inode,
+						    loff_t start, loff_t end)
+{
+	return posix_subtree_overlap(inode->i_posix_locks.rb_node, start, end);
+}
+
+/* The next lock after fl, in fl_start order, that overlaps start..end */
+static struct file_lock *posix_next_overlap(struct file_lock *fl,
+					    loff_t start, loff_t end)
+{
+	rb_node_t *rb_node = &fl->fl_rb;
+	struct file_lock *next;
+
+	next = posix_subtree_overlap(rb_node->rb_right, start, end);
+	if (next)
+		return next;
+	while (rb_node->rb_parent) {
+		rb_node_t *parent = rb_node->rb_parent;
+
+		if (rb_node == parent->rb_left) {
+			next = rb_entry(parent, struct file_lock, fl_rb);
+			if (next->fl_start > end)
+				return NULL;
+			if (next->fl_end >= start)
+				return next;
+			next = posix_subtree_overlap(parent->rb_right, start, end);
+			if (next)
+				return next;
+		}
+		rb_node = parent;
+	}
+	return NULL;
+}
+
+/* Add a POSIX lock to the inode's tree and the global file lock list. */
+static void posix_insert_lock(struct inode *inode, struct file_lock *fl)
+{
+	list_add(&fl->fl_link, &file_lock_list);
+
+	posix_link_lock(inode, fl);
+
+	if (fl->fl_insert)
+		fl->fl_insert(fl);
+}
 
+/* Free a lock that has been taken off its inode.
+ * Remove our lock from the global lock list, wake up processes that are
+ * blocked waiting for this lock, notify the FS that the lock has been
+ * cleared and finally free the lock.
+ */
+static void locks_release_lock(struct file_lock *fl, unsigned int wait)
+{
 	list_del(&fl->fl_link);
 	INIT_LIST_HEAD(&fl->fl_link);
 
@@ -501,14 +635,32 @@ static void locks_delete_lock(struct file_lock **thisfl_p, unsigned int wait)
 	locks_free_lock(fl);
 }
 
+/* Delete a flock lock or lease from the inode's list and free it. */
+static void locks_delete_lock(struct file_lock **thisfl_p, unsigned int wait)
+{
+	struct file_lock *fl = *thisfl_p;
+
+	*thisfl_p = fl->fl_next;
+	fl->fl_next = NULL;
+
+	locks_release_lock(fl, wait);
+}
+
+/* Delete a POSIX lock from the inode's tree and free it. */
+static void posix_delete_lock(struct inode *inode, struct file_lock *fl,
+			      unsigned int wait)
+{
+	posix_unlink_lock(inode, fl);
+	locks_release_lock(fl, wait);
+}
+
 /*
  * Call back client filesystem in order to get it to unregister a lock,
  * then delete lock. Essentially useful only in locks_remove_*().
  * Note: this must be called with the semaphore already held!
  */
-static inline void locks_unlock_delete(struct file_lock **thisfl_p)
+static inline void locks_unlock_delete(struct inode *inode, struct file_lock *fl)
 {
-	struct file_lock *fl = *thisfl_p;
 	int (*lock)(struct file *, int, struct file_lock *);
 
 	if (fl->fl_file->f_op &&
@@ -516,7 +668,7 @@ static inline void locks_unlock_delete(struct file_lock **thisfl_p)
 		fl->fl_type = F_UNLCK;
 		lock(fl->fl_file, F_SETLK, fl);
 	}
-	locks_delete_lock(thisfl_p, 0);
+	posix_delete_lock(inode, fl, 0);
 }
 
 /* Determine if lock sys_fl blocks lock caller_fl. Common functionality
@@ -616,12 +768,13 @@ static int locks_block_on_timeout(struct file_lock *blocker, struct file_lock *w
 struct file_lock *
 posix_test_lock(struct file *filp, struct file_lock *fl)
 {
+	struct inode *inode = filp->f_dentry->d_inode;
 	struct file_lock *cfl;
 
 	lock_kernel();
-	for (cfl = filp->f_dentry->d_inode->i_flock; cfl; cfl = cfl->fl_next) {
-		if (!(cfl->fl_flags & FL_POSIX))
-			continue;
+	for (cfl = posix_first_overlap(inode, fl->fl_start, fl->fl_end);
+	     cfl != NULL;
+	     cfl = posix_next_overlap(cfl, fl->fl_start, fl->fl_end)) {
 		if (posix_locks_conflict(cfl, fl))
 			break;
 	}
@@ -659,7 +812,7 @@ static int posix_locks_deadlock(struct file_lock *caller_fl,
 next_task:
 	if (caller_owner == blocked_owner && caller_pid == blocked_pid)
 		return 1;
-	list_for_each(tmp, &blocked_list) {
+	list_for_each(tmp, blocked_hashfn(blocked_owner, blocked_pid)) {
 		struct file_lock *fl = list_entry(tmp, struct file_lock, fl_link);
 		if ((fl->fl_owner == blocked_owner)
 		    && (fl->fl_pid == blocked_pid)) {
@@ -681,9 +834,7 @@ int locks_mandatory_locked(struct inode *inode)
 	 * Search the lock list for this inode for any POSIX locks.
 	 */
 	lock_kernel();
-	for (fl = inode->i_flock; fl != NULL; fl = fl->fl_next) {
-		if (!(fl->fl_flags & FL_POSIX))
-			continue;
+	for (fl = posix_first_lock(inode); fl != NULL; fl = posix_next_lock(fl)) {
 		if (fl->fl_owner != owner)
 			break;
 	}
@@ -714,11 +865,9 @@ repeat:
 	/* Search the lock list for this inode for locks that conflict with
 	 * the proposed read/write.
 	 */
-	for (fl = inode->i_flock; fl != NULL; fl = fl->fl_next) {
-		if (!(fl->fl_flags & FL_POSIX))
-			continue;
-		if (fl->fl_start > new_fl->fl_end)
-			break;
+	for (fl = posix_first_overlap(inode, new_fl->fl_start, new_fl->fl_end);
+	     fl != NULL;
+	     fl = posix_next_overlap(fl, new_fl->fl_start, new_fl->fl_end)) {
 		if (posix_locks_conflict(new_fl, fl)) {
 			error = -EAGAIN;
 			if (filp && (filp->f_flags & O_NONBLOCK))
@@ -747,7 +896,7 @@ repeat:
 
 /* Try to create a FLOCK lock on filp. We always insert new FLOCK locks
  * at the head of the list, but that's secret knowledge known only to
- * flock_lock_file and posix_lock_file.
+ * flock_lock_file.
  */
 static int flock_lock_file(struct file *filp, unsigned int lock_type,
 			   unsigned int wait)
@@ -820,6 +969,30 @@ out:
 	return error;
 }
 
+/* Find a lock of the caller's owner that overlaps start..end, of the
+ * caller's type only if same_type is set.
+ */
+static struct file_lock *posix_owner_overlap(struct inode *inode,
+					     struct file_lock *caller,
+					     loff_t start, loff_t end,
+					     int same_type)
+{
+	struct file_lock *fl;
+
+	for (fl = posix_first_overlap(inode, start, end); fl != NULL;
+	     fl = posix_next_overlap(fl, start, end)) {
+		/* locks_unlock_delete() may hand us a lock still in the tree */
+		if (fl == caller)
+			continue;
+		if (!locks_same_owner(caller, fl))
+			continue;
+		if (same_type && fl->fl_type != caller->fl_type)
+			continue;
+		return fl;
+	}
+	return NULL;
+}
+
 /**
  *	posix_lock_file:
  *	@filp: The file to apply the lock to
@@ -827,15 +1000,9 @@ out:
  *	@wait: 1 to retry automatically, 0 to return -EAGAIN
  *
  * Add a POSIX style lock to a file.
- * We merge adjacent locks whenever possible. POSIX locks are sorted by owner
- * task, then by starting address
- *
- * Kai Petzke writes:
- * To make freeing a lock much faster, we keep a pointer to the lock before the
- * actual one. But the real gain of the new coding was, that lock_it() and
- * unlock_it() became one function.
- *
- * To all purists: Yes, I use a few goto's. Just pass on to the next function.
+ * We merge adjacent locks whenever possible. POSIX locks are kept in
+ * the inode's lock tree, so only the locks overlapping the new one are
+ * looked at.  A task's own locks never overlap each other.
  */
 
 int posix_lock_file(struct file *filp, struct file_lock *caller,
@@ -843,11 +1010,9 @@ int posix_lock_file(struct file *filp, struct file_lock *caller,
 {
 	struct file_lock *fl;
 	struct file_lock *new_fl, *new_fl2;
-	struct file_lock *left = NULL;
-	struct file_lock *right = NULL;
-	struct file_lock **before;
 	struct inode * inode = filp->f_dentry->d_inode;
-	int error, added = 0;
+	loff_t start, end;
+	int error;
 
 	/*
 	 * We may need two file_lock structures for this operation,
@@ -862,9 +1027,9 @@ int posix_lock_file(struct file *filp, struct file_lock *caller,
 	lock_kernel();
 	if (caller->fl_type != F_UNLCK) {
   repeat:
-		for (fl = inode->i_flock; fl != NULL; fl = fl->fl_next) {
-			if (!(fl->fl_flags & FL_POSIX))
-				continue;
+		for (fl = posix_first_overlap(inode, caller->fl_start, caller->fl_end);
+		     fl != NULL;
+		     fl = posix_next_overlap(fl, caller->fl_start, caller->fl_end)) {
 			if (!posix_locks_conflict(caller, fl))
 				continue;
 			error = -EAGAIN;
@@ -885,124 +1050,67 @@ int posix_lock_file(struct file *filp, struct file_lock *caller,
 	 * We've allocated the new locks in advance, so there are no
 	 * errors possible (and no blocking operations) from here on.
 	 * 
-	 * Find the first old lock with the same owner as the new lock.
-	 */
-	
-	before = &inode->i_flock;
-
-	/* First skip locks owned by other processes.
+	 * First fold our locks of the same type that overlap or adjoin
+	 * the new one into it.
 	 */
-	while ((fl = *before) && (!(fl->fl_flags & FL_POSIX) ||
-				  !locks_same_owner(caller, fl))) {
-		before = &fl->fl_next;
+	error = 0;
+	start = caller->fl_start;
+	end = caller->fl_end;
+	if (caller->fl_type != F_UNLCK) {
+		while ((fl = posix_owner_overlap(inode, caller, start - 1,
+				end < OFFSET_MAX ? end + 1 : end, 1)) != NULL) {
+			/* Nothing to do if one lock already covers it all. */
+			if (fl->fl_start <= start && fl->fl_end >= end)
+				goto out;
+			if (fl->fl_start < start)
+				start = fl->fl_start;
+			if (fl->fl_end > end)
+				end = fl->fl_end;
+			posix_delete_lock(inode, fl, 0);
+		}
 	}
 
-	/* Process locks with this owner.
+	/*
+	 * Then cut the range out of our locks of other types, keeping
+	 * whatever lies outside it.  Wake up anybody waiting for them,
+	 * as the change might satisfy their needs.
 	 */
-	while ((fl = *before) && locks_same_owner(caller, fl)) {
-		/* Detect adjacent or overlapping regions (if same lock type)
-		 */
-		if (caller->fl_type == fl->fl_type) {
-			if (fl->fl_end < caller->fl_start - 1)
-				goto next_lock;
-			/* If the next lock in the list has entirely bigger
-			 * addresses than the new one, insert the lock here.
-			 */
-			if (fl->fl_start > caller->fl_end + 1)
-				break;
-
-			/* If we come here, the new and old lock are of the
-			 * same type and adjacent or overlapping. Make one
-			 * lock yielding from the lower start address of both
-			 * locks to the higher end address.
-			 */
-			if (fl->fl_start > caller->fl_start)
-				fl->fl_start = caller->fl_start;
-			else
-				caller->fl_start = fl->fl_start;
-			if (fl->fl_end < caller->fl_end)
-				fl->fl_end = caller->fl_end;
-			else
-				caller->fl_end = fl->fl_end;
-			if (added) {
-				locks_delete_lock(before, 0);
-				continue;
-			}
-			caller = fl;
-			added = 1;
-		}
-		else {
-			/* Processing for different lock types is a bit
-			 * more complex.
+	while ((fl = posix_owner_overlap(inode, caller, start, end, 0)) != NULL) {
+		if (fl->fl_start < start && fl->fl_end > end) {
+			/* The new lock breaks the old one in two pieces,
+			 * so we have to use the second new lock.
 			 */
-			if (fl->fl_end < caller->fl_start)
-				goto next_lock;
-			if (fl->fl_start > caller->fl_end)
-				break;
-			if (caller->fl_type == F_UNLCK)
-				added = 1;
-			if (fl->fl_start < caller->fl_start)
-				left = fl;
-			/* If the next lock in the list has a higher end
-			 * address than the new one, insert the new one here.
+			locks_copy_lock(new_fl2, fl);
+			new_fl2->fl_start = end + 1;
+			posix_insert_lock(inode, new_fl2);
+			new_fl2 = NULL;
+			fl->fl_end = start - 1;
+			posix_end_update(fl);
+		} else if (fl->fl_start < start) {
+			fl->fl_end = start - 1;
+			posix_end_update(fl);
+		} else if (fl->fl_end > end) {
+			/* fl_start is the key, so move the lock. */
+			posix_unlink_lock(inode, fl);
+			fl->fl_start = end + 1;
+			posix_link_lock(inode, fl);
+		} else {
+			/* The new lock completely replaces an old one
+			 * (This may happen several times).
 			 */
-			if (fl->fl_end > caller->fl_end) {
-				right = fl;
-				break;
-			}
-			if (fl->fl_start >= caller->fl_start) {
-				/* The new lock completely replaces an old
-				 * one (This may happen several times).
-				 */
-				if (added) {
-					locks_delete_lock(before, 0);
-					continue;
-				}
-				/* Replace the old lock with the new one.
-				 * Wake up anybody waiting for the old one,
-				 * as the change in lock type might satisfy
-				 * their needs.
-				 */
-				locks_wake_up_blocks(fl, 0);	/* This cannot schedule()! */
-				fl->fl_start = caller->fl_start;
-				fl->fl_end = caller->fl_end;
-				fl->fl_type = caller->fl_type;
-				fl->fl_u = caller->fl_u;
-				caller = fl;
-				added = 1;
-			}
+			posix_delete_lock(inode, fl, 0);
+			continue;
 		}
-		/* Go on to next lock.
-		 */
-	next_lock:
-		before = &fl->fl_next;
+		locks_wake_up_blocks(fl, 0);	/* This cannot schedule()! */
 	}
 
-	error = 0;
-	if (!added) {
-		if (caller->fl_type == F_UNLCK)
-			goto out;
+	if (caller->fl_type != F_UNLCK) {
 		locks_copy_lock(new_fl, caller);
-		locks_insert_lock(before, new_fl);
+		new_fl->fl_start = start;
+		new_fl->fl_end = end;
+		posix_insert_lock(inode, new_fl);
 		new_fl = NULL;
 	}
-	if (right) {
-		if (left == right) {
-			/* The new lock breaks the old one in two pieces,
-			 * so we have to use the second new lock.
-			 */
-			left = new_fl2;
-			new_fl2 = NULL;
-			locks_copy_lock(left, right);
-			locks_insert_lock(before, left);
-		}
-		right->fl_start = caller->fl_end + 1;
-		locks_wake_up_blocks(right, 0);
-	}
-	if (left) {
-		left->fl_end = caller->fl_start - 1;
-		locks_wake_up_blocks(left, 0);
-	}
 out:
 	unlock_kernel();
 	/*
@@ -1640,13 +1748,12 @@ out:
 void locks_remove_posix(struct file *filp, fl_owner_t owner)
 {
 	struct inode * inode = filp->f_dentry->d_inode;
-	struct file_lock *fl;
-	struct file_lock **before;
+	struct file_lock *fl, *next;
 
 	/*
 	 * For POSIX locks we free all locks on this file for the given task.
 	 */
-	if (!inode->i_flock) {
+	if (!inode->i_posix_locks.rb_node) {
 		/*
 		 * Notice that something might be grabbing a lock right now.
 		 * Consider it as a race won by us - event is async, so even if
@@ -1656,13 +1763,16 @@ void locks_remove_posix(struct file *filp, fl_owner_t owner)
 		return;
 	}
 	lock_kernel();
-	before = &inode->i_flock;
-	while ((fl = *before) != NULL) {
-		if ((fl->fl_flags & FL_POSIX) && fl->fl_owner == owner) {
-			locks_unlock_delete(before);
+	for (fl = posix_first_lock(inode); fl != NULL; fl = next) {
+		next = posix_next_lock(fl);
+		if (fl->fl_owner != owner)
 			continue;
-		}
-		before = &fl->fl_next;
+		if (fl->fl_file->f_op && fl->fl_file->f_op->lock) {
+			/* The filesystem may sleep, start over afterwards. */
+			locks_unlock_delete(inode, fl);
+			next = posix_first_lock(inode);
+		} else
+			posix_delete_lock(inode, fl, 0);
 	}
 	unlock_kernel();
 }
@@ -1854,22 +1964,26 @@ int lock_may_read(struct inode *inode, loff_t start, unsigned long len)
 	struct file_lock *fl;
 	int result = 1;
 	lock_kernel();
+	for (fl = posix_first_overlap(inode, start, start + len); fl != NULL;
+	     fl = posix_next_overlap(fl, start, start + len)) {
+		if (fl->fl_flags != FL_POSIX)
+			continue;
+		if (fl->fl_type == F_RDLCK)
+			continue;
+		result = 0;
+		goto out;
+	}
 	for (fl = inode->i_flock; fl != NULL; fl = fl->fl_next) {
-		if (fl->fl_flags == FL_POSIX) {
-			if (fl->fl_type == F_RDLCK)
-				continue;
-			if ((fl->fl_end < start) || (fl->fl_start > (start + len)))
-				continue;
-		} else if (fl->fl_flags == FL_FLOCK) {
-			if (!(fl->fl_type & LOCK_MAND))
-				continue;
-			if (fl->fl_type & LOCK_READ)
-				continue;
-		} else
+		if (fl->fl_flags != FL_FLOCK)
+			continue;
+		if (!(fl->fl_type & LOCK_MAND))
+			continue;
+		if (fl->fl_type & LOCK_READ)
 			continue;
 		result = 0;
 		break;
 	}
+out:
 	unlock_kernel();
 	return result;
 }
@@ -1892,20 +2006,24 @@ int lock_may_write(struct inode *inode, loff_t start, unsigned long len)
 	struct file_lock *fl;
 	int result = 1;
 	lock_kernel();
+	for (fl = posix_first_overlap(inode, start, start + len); fl != NULL;
+	     fl = posix_next_overlap(fl, start, start + len)) {
+		if (fl->fl_flags != FL_POSIX)
+			continue;
+		result = 0;
+		goto out;
+	}
 	for (fl = inode->i_flock; fl != NULL; fl = fl->fl_next) {
-		if (fl->fl_flags == FL_POSIX) {
-			if ((fl->fl_end < start) || (fl->fl_start > (start + len)))
-				continue;
-		} else if (fl->fl_flags == FL_FLOCK) {
-			if (!(fl->fl_type & LOCK_MAND))
-				continue;
-			if (fl->fl_type & LOCK_WRITE)
-				continue;
-		} else
+		if (fl->fl_flags != FL_FLOCK)
+			continue;
+		if (!(fl->fl_type & LOCK_MAND))
+			continue;
+		if (fl->fl_type & LOCK_WRITE)
 			continue;
 		result = 0;
 		break;
 	}
+out:
 	unlock_kernel();
 	return result;
 }
@@ -1913,6 +2031,11 @@ int lock_may_write(struct inode *inode, loff_t start, unsigned long len)
 
 static int __init filelock_init(void)
 {
+	int i;
+
+	for (i = 0; i < BLOCKED_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&blocked_hash[i]);
+
 	filelock_cache = kmem_cache_create("file lock cache",
 			sizeof(struct file_lock), 0, 0, init_once, NULL);
 	if (!filelock_cache)
@@ -918,7 +918,7 @@ int vfs_create(struct inode *dir, struct dentry *dentry, int mode)
 exit_lock:
 	up(&dir->i_zombie);
 	if (!error)
-		inode_dir_notify(dir, DN_CREATE);
+		inode_dir_notify_name(dir, DN_CREATE, &dentry->d_name);
 	return error;
 }
 
@@ -1198,7 +1198,7 @@ int vfs_mknod(struct inode *dir, struct dentry *dentry, int mode, dev_t dev)
 exit_lock:
 	up(&dir->i_zombie);
 	if (!error)
-		inode_dir_notify(dir, DN_CREATE);
+		inode_dir_notify_name(dir, DN_CREATE, &dentry->d_name);
 	return error;
 }
 
@@ -1267,7 +1267,7 @@ int vfs_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 exit_lock:
 	up(&dir->i_zombie);
 	if (!error)
-		inode_dir_notify(dir, DN_CREATE);
+		inode_dir_notify_name(dir, DN_CREATE, &dentry->d_name);
 	return error;
 }
 
@@ -1357,7 +1357,7 @@ int vfs_rmdir(struct inode *dir, struct dentry *dentry)
 	}
 	double_up(&dir->i_zombie, &dentry->d_inode->i_zombie);
 	if (!error) {
-		inode_dir_notify(dir, DN_DELETE);
+		inode_dir_notify_name(dir, DN_DELETE, &dentry->d_name);
 		d_delete(dentry);
 	}
 	dput(dentry);
@@ -1430,7 +1430,7 @@ int vfs_unlink(struct inode *dir, struct dentry *dentry)
 	}
 	up(&dir->i_zombie);
 	if (!error)
-		inode_dir_notify(dir, DN_DELETE);
+		inode_dir_notify_name(dir, DN_DELETE, &dentry->d_name);
 	return error;
 }
 
@@ -1498,7 +1498,7 @@ int vfs_symlink(struct inode *dir, struct dentry *dentry, const char *oldname)
 exit_lock:
 	up(&dir->i_zombie);
 	if (!error)
-		inode_dir_notify(dir, DN_CREATE);
+		inode_dir_notify_name(dir, DN_CREATE, &dentry->d_name);
 	return error;
 }
 
@@ -1572,7 +1572,7 @@ int vfs_link(struct dentry *old_dentry, struct inode *dir, struct dentry *new_de
 exit_lock:
 	up(&dir->i_zombie);
 	if (!error)
-		inode_dir_notify(dir, DN_CREATE);
+		inode_dir_notify_name(dir, DN_CREATE, &new_dentry->d_name);
 	return error;
 }
 
@@ -1785,12 +1785,14 @@ int vfs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	else
 		error = vfs_rename_other(old_dir,old_dentry,new_dir,new_dentry);
 	if (!error) {
-		if (old_dir == new_dir)
-			inode_dir_notify(old_dir, DN_RENAME);
-		else {
-			inode_dir_notify(old_dir, DN_DELETE);
-			inode_dir_notify(new_dir, DN_CREATE);
-		}
+		/* d_move() has swapped the names of the two dentries */
+		if (S_ISDIR(old_dentry->d_inode->i_mode) ||
+		    !(old_dir->i_sb->s_type->fs_flags & FS_ODD_RENAME))
+			inode_dir_notify_rename(old_dir, &new_dentry->d_name,
+						new_dir, &old_dentry->d_name);
+		else
+			inode_dir_notify_rename(old_dir, &old_dentry->d_name,
+						new_dir, &new_dentry->d_name);
 	}
 	return error;
 }
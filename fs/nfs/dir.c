@@ -72,6 +72,7 @@ typedef u32 * (*decode_dirent_t)(u32 *, struct nfs_entry *, int);
 typedef struct {
 	struct file	*file;
 	struct page	*page;
+	struct page	*fresh_page;	/* just read from the server */
 	unsigned long	page_index;
 	unsigned	page_offset;
 	u64		target;
@@ -116,6 +117,7 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
 	}
 	if (error < 0)
 		goto error;
+	desc->fresh_page = page;
 	SetPageUptodate(page);
 	kunmap(page);
 	/* Ensure consistent page alignment of the data.
@@ -244,6 +246,57 @@ int readdir_search_pagecache(nfs_readdir_descriptor_t *desc)
 	return res;
 }
 
+static void nfs_renew_times(struct dentry *);
+
+/*
+ * READDIRPLUS hands us the file handle and attributes of every entry.
+ * Use them to instantiate or refresh the children, which saves the
+ * LOOKUP and GETATTR that a stat() of each of them would cost. Called
+ * with the directory's i_sem held, as lookups are.
+ */
+static void nfs_prime_dcache(struct dentry *parent, struct nfs_entry *entry)
+{
+	struct dentry	*dentry;
+	struct inode	*inode;
+	struct qstr	name;
+
+	if (!(entry->fattr.valid & NFS_ATTR_FATTR))
+		return;
+	name.name = entry->name;
+	name.len = entry->len;
+	if (name.name[0] == '.' &&
+	    (name.len == 1 || (name.len == 2 && name.name[1] == '.')))
+		return;
+	name.hash = full_name_hash(name.name, name.len);
+
+	dentry = d_lookup(parent, &name);
+	if (dentry) {
+		inode = dentry->d_inode;
+		if (!inode) {
+			/* The server has the name we thought was missing */
+			d_drop(dentry);
+		} else if (NFS_FSID(inode) == entry->fattr.fsid &&
+			   NFS_FILEID(inode) == entry->fattr.fileid &&
+			   !memcmp(NFS_FH(inode), &entry->fh, sizeof(entry->fh))) {
+			nfs_refresh_inode(inode, &entry->fattr);
+			nfs_renew_times(dentry);
+		}
+		dput(dentry);
+		return;
+	}
+
+	dentry = d_alloc(parent, &name);
+	if (!dentry)
+		return;
+	dentry->d_op = &nfs_dentry_operations;
+	inode = nfs_fhget(dentry, &entry->fh, &entry->fattr);
+	if (inode) {
+		d_add(dentry, inode);
+		nfs_renew_times(dentry);
+	}
+	dput(dentry);
+}
+
 /*
  * Once we've found the start of the dirent within a page: fill 'er up...
  */
@@ -256,12 +309,16 @@ int nfs_do_filldir(nfs_readdir_descriptor_t *desc, void *dirent,
 	char		*start = kmap(desc->page),
 			*p = start + desc->page_offset;
 	unsigned long	fileid;
-	int		loop_count = 0,
+	int		prime = desc->plus && desc->page == desc->fresh_page,
+			loop_count = 0,
 			res = 0;
 
 	dfprintk(VFS, "NFS: nfs_do_filldir() filling starting @ cookie %Lu\n", (long long)desc->target);
 
 	for(;;) {
+		/* Cached pages may hold old attributes; only trust new ones */
+		if (prime)
+			nfs_prime_dcache(file->f_dentry, entry);
 		/* Note: entry->prev_cookie contains the cookie for
 		 *	 retrieving the current dirent on the server */
 		fileid = nfs_fileid_to_ino_t(entry->ino);
@@ -343,6 +400,7 @@ int uncached_readdir(nfs_readdir_descriptor_t *desc, void *dirent,
 	desc->page_index = 0;
 	desc->page_offset = 0;
 	desc->page = page;
+	desc->plus = 0;
 	status = nfs_do_filldir(desc, dirent, filldir);
 
 	/* Reset read descriptor so it searches the page cache from
@@ -421,55 +479,23 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 
 /*
  * Whenever an NFS operation succeeds, we know that the dentry
- * is valid, so we update the revalidation timestamp.
+ * is valid, so we stamp it with the directory's change attribute.
  */
-static inline void nfs_renew_times(struct dentry * dentry)
+static void nfs_renew_times(struct dentry * dentry)
 {
-	dentry->d_time = jiffies;
-}
-
-static inline int nfs_dentry_force_reval(struct dentry *dentry, int flags)
-{
-	struct inode *inode = dentry->d_inode;
-	unsigned long timeout = NFS_ATTRTIMEO(inode);
-
-	/*
-	 * If it's the last lookup in a series, we use a stricter
-	 * cache consistency check by looking at the parent mtime.
-	 *
-	 * If it's been modified in the last hour, be really strict.
-	 * (This still means that we can avoid doing unnecessary
-	 * work on directories like /usr/share/bin etc which basically
-	 * never change).
-	 */
-	if (!(flags & LOOKUP_CONTINUE)) {
-		long diff = CURRENT_TIME - dentry->d_parent->d_inode->i_mtime;
-
-		if (diff < 15*60)
-			timeout = 0;
-	}
-	
-	return time_after(jiffies,dentry->d_time + timeout);
+	dentry->d_time = NFS_CACHE_CHANGE(dentry->d_parent->d_inode);
 }
 
 /*
- * We judge how long we want to trust negative
- * dentries by looking at the parent inode mtime.
- *
- * If mtime is close to present time, we revalidate
- * more often.
+ * A dentry, positive or negative, stays valid for as long as its
+ * directory is unchanged. That takes one GETATTR on the directory,
+ * at most once per attribute timeout, for all the names in it.
  */
-#define NFS_REVALIDATE_NEGATIVE (1 * HZ)
-static inline int nfs_neg_need_reval(struct dentry *dentry)
+static inline int nfs_check_verifier(struct inode *dir, struct dentry *dentry)
 {
-	struct inode *dir = dentry->d_parent->d_inode;
-	unsigned long timeout = NFS_ATTRTIMEO(dir);
-	long diff = CURRENT_TIME - dir->i_mtime;
-
-	if (diff < 5*60 && timeout > NFS_REVALIDATE_NEGATIVE)
-		timeout = NFS_REVALIDATE_NEGATIVE;
-
-	return time_after(jiffies, dentry->d_time + timeout);
+	if (nfs_revalidate_inode(NFS_SERVER(dir), dir) < 0)
+		return 0;
+	return dentry->d_time == NFS_CACHE_CHANGE(dir);
 }
 
 /*
@@ -480,9 +506,9 @@ static inline int nfs_neg_need_reval(struct dentry *dentry)
  * NOTE! The hit can be a negative hit too, don't assume
  * we have an inode!
  *
- * If the dentry is older than the revalidation interval, 
- * we do a new lookup and verify that the dentry is still
- * correct.
+ * If the directory has changed since the dentry was last
+ * checked, we do a new lookup and verify that the dentry is
+ * still correct.
  */
 static int nfs_lookup_revalidate(struct dentry * dentry, int flags)
 {
@@ -496,12 +522,11 @@ static int nfs_lookup_revalidate(struct dentry * dentry, int flags)
 	dir = dentry->d_parent->d_inode;
 	inode = dentry->d_inode;
 	/*
-	 * If we don't have an inode, let's look at the parent
-	 * directory mtime to get a hint about how often we
-	 * should validate things..
+	 * A negative dentry is trusted until the directory changes;
+	 * then we look the name up again.
 	 */
 	if (!inode) {
-		if (nfs_neg_need_reval(dentry))
+		if (!nfs_check_verifier(dir, dentry))
 			goto out_bad;
 		goto out_valid;
 	}
@@ -512,14 +537,14 @@ static int nfs_lookup_revalidate(struct dentry * dentry, int flags)
 		goto out_bad;
 	}
 
-	if (!nfs_dentry_force_reval(dentry, flags))
-		goto out_valid;
-
 	if (IS_ROOT(dentry)) {
-		__nfs_revalidate_inode(NFS_SERVER(inode), inode);
-		goto out_valid_renew;
+		nfs_revalidate_inode(NFS_SERVER(inode), inode);
+		goto out_valid;
 	}
 
+	if (nfs_check_verifier(dir, dentry))
+		goto out_valid;
+
 	/*
 	 * Do a new lookup and check the dentry attributes.
 	 */
@@ -539,7 +564,6 @@ static int nfs_lookup_revalidate(struct dentry * dentry, int flags)
 	if (nfs_inode_is_stale(inode, &fhandle, &fattr))
 		goto out_bad;
 
- out_valid_renew:
 	nfs_renew_times(dentry);
 out_valid:
 	unlock_kernel();
@@ -265,6 +265,8 @@ nfs_read_super(struct super_block *sb, void *raw_data, int silent)
 			root->size = NFS2_FHSIZE;
 			memcpy(root->data, data->old_root.data, NFS2_FHSIZE);
 		}
+		if (data->version < 5)
+			data->window = 0;
 	}
 
 	/* We now require that the mount process passes the remote address */
@@ -280,6 +282,9 @@ nfs_read_super(struct super_block *sb, void *raw_data, int silent)
 	server->rsize    = nfs_block_size(data->rsize, NULL);
 	server->wsize    = nfs_block_size(data->wsize, NULL);
 	server->flags    = data->flags & NFS_MOUNT_FLAGMASK;
+	server->window   = data->window ? data->window : NFS_DEF_RPC_WINDOW;
+	if (server->window > RPC_MAXCONG)
+		server->window = RPC_MAXCONG;
 
 	if (data->flags & NFS_MOUNT_NOAC) {
 		data->acregmin = data->acregmax = 0;
@@ -409,6 +414,13 @@ nfs_read_super(struct super_block *sb, void *raw_data, int silent)
 		server->rsize = fsinfo.rtmax;
 	if (server->wsize > fsinfo.wtmax)
 		server->wsize = fsinfo.wtmax;
+	/* A READ reply or WRITE call has to fit in one datagram */
+	if (!tcp) {
+		if (server->rsize > NFS_MAX_UDP_IO_BUFFER_SIZE)
+			server->rsize = NFS_MAX_UDP_IO_BUFFER_SIZE;
+		if (server->wsize > NFS_MAX_UDP_IO_BUFFER_SIZE)
+			server->wsize = NFS_MAX_UDP_IO_BUFFER_SIZE;
+	}
 
 	server->rpages = (server->rsize + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	if (server->rpages > NFS_READ_MAXIOV) {
@@ -422,6 +434,9 @@ nfs_read_super(struct super_block *sb, void *raw_data, int silent)
                 server->wsize = server->wpages << PAGE_CACHE_SHIFT;
 	}
 
+	/* Read ahead far enough to keep the whole window of READs going */
+	sb->s_max_readahead = server->window * server->rpages;
+
 	server->dtsize = nfs_block_size(fsinfo.dtpref, NULL);
 	if (server->dtsize > PAGE_CACHE_SIZE)
 		server->dtsize = PAGE_CACHE_SIZE;
@@ -527,6 +542,7 @@ nfs_zap_caches(struct inode *inode)
 {
 	NFS_ATTRTIMEO(inode) = NFS_MINATTRTIMEO(inode);
 	NFS_ATTRTIMEO_UPDATE(inode) = jiffies;
+	NFS_CACHE_CHANGE(inode) = jiffies;
 
 	invalidate_inode_pages(inode);
 
@@ -571,6 +587,8 @@ nfs_fill_inode(struct inode *inode, struct nfs_fh *fh, struct nfs_fattr *fattr)
 		} else if (S_ISDIR(inode->i_mode)) {
 			inode->i_op = &nfs_dir_inode_operations;
 			inode->i_fop = &nfs_dir_operations;
+			if (NFS_PROTO(inode)->version == 3)
+				NFS_FLAGS(inode) |= NFS_INO_ADVISE_RDPLUS;
 		} else if (S_ISLNK(inode->i_mode))
 			inode->i_op = &nfs_symlink_inode_operations;
 		else
@@ -589,6 +607,7 @@ nfs_fill_inode(struct inode *inode, struct nfs_fh *fh, struct nfs_fattr *fattr)
 		NFS_CACHE_ISIZE(inode) = fattr->size;
 		NFS_ATTRTIMEO(inode) = NFS_MINATTRTIMEO(inode);
 		NFS_ATTRTIMEO_UPDATE(inode) = jiffies;
+		NFS_CACHE_CHANGE(inode) = jiffies;
 		memcpy(&inode->u.nfs_i.fh, fh, sizeof(inode->u.nfs_i.fh));
 	}
 	nfs_refresh_inode(inode, fattr);
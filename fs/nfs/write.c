@@ -78,6 +78,7 @@ static atomic_t	nfs_nr_requests = ATOMIC_INIT(0);
 struct nfs_write_data {
 	struct rpc_task		task;
 	struct inode		*inode;
+	struct nfs_server	*server;	/* counts WRITEs in flight */
 	struct rpc_cred		*cred;
 	struct nfs_writeargs	args;		/* argument struct */
 	struct nfs_writeres	res;		/* result struct */
@@ -146,6 +147,13 @@ static void nfs_writedata_release(struct rpc_task *task)
 	nfs_writedata_free(wdata);
 }
 
+static void nfs_writeback_release(struct rpc_task *task)
+{
+	struct nfs_write_data	*wdata = (struct nfs_write_data *)task->tk_calldata;
+	atomic_dec(&wdata->server->writes);
+	nfs_writedata_free(wdata);
+}
+
 /*
  * This function will be used to simulate weak cache consistency
  * under NFSv2 when the NFSv3 attribute patch is included.
@@ -313,8 +321,8 @@ region_locked(struct inode *inode, struct nfs_page *req)
 
 	rqstart = page_offset(req->wb_page) + req->wb_offset;
 	rqend = rqstart + req->wb_bytes;
-	for (fl = inode->i_flock; fl; fl = fl->fl_next) {
-		if (fl->fl_owner == current->files && (fl->fl_flags & FL_POSIX)
+	for (fl = posix_first_lock(inode); fl; fl = posix_next_lock(fl)) {
+		if (fl->fl_owner == current->files
 		    && fl->fl_type == F_WRLCK
 		    && fl->fl_start <= rqstart && rqend <= fl->fl_end) {
 			return 1;
@@ -939,37 +947,36 @@ nfs_update_request(struct file* file, struct inode *inode, struct page *page,
  *
  * We never submit more requests than we think the remote can handle.
  * For UDP sockets, we make sure we don't exceed the congestion window;
- * for TCP, we limit the number of requests to 8.
- *
- * NFS_STRATEGY_PAGES gives the minimum number of requests for NFSv2 that
- * should be sent out in one go. This is for the benefit of NFSv2 servers
- * that perform write gathering.
+ * on top of that no more than the mount's window of WRITEs is kept in
+ * flight, and only full-sized ones are sent from here (FLUSH_GATHER).
  *
- * FIXME: Different servers may have different sweet spots.
- * Record the average congestion window in server struct?
+ * For NFSv2 we wait until a whole window of requests can go out in one
+ * go. This is for the benefit of NFSv2 servers that perform write
+ * gathering. NFSv3 WRITEs are unstable, so they are sent as soon as a
+ * full one is ready, and committed a window's worth at a time.
  */
-#define NFS_STRATEGY_PAGES      8
 static void
 nfs_strategy(struct inode *inode)
 {
-	unsigned int	dirty, wpages;
+	unsigned int	dirty, wpages, window;
 
 	dirty  = inode->u.nfs_i.ndirty;
 	wpages = NFS_SERVER(inode)->wpages;
+	window = NFS_SERVER(inode)->window;
 #ifdef CONFIG_NFS_V3
 	if (NFS_PROTO(inode)->version == 2) {
-		if (dirty >= NFS_STRATEGY_PAGES * wpages)
-			nfs_flush_file(inode, NULL, 0, 0, 0);
+		if (dirty >= window * wpages)
+			nfs_flush_file(inode, NULL, 0, 0, FLUSH_GATHER);
 	} else {
 		if (dirty >= wpages)
-			nfs_flush_file(inode, NULL, 0, 0, 0);
-		if (inode->u.nfs_i.ncommit > NFS_STRATEGY_PAGES * wpages &&
+			nfs_flush_file(inode, NULL, 0, 0, FLUSH_GATHER);
+		if (inode->u.nfs_i.ncommit > window * wpages &&
 		    atomic_read(&nfs_nr_requests) > MAX_REQUEST_SOFT)
 			nfs_commit_file(inode, NULL, 0, 0, 0);
 	}
 #else
-	if (dirty >= NFS_STRATEGY_PAGES * wpages)
-		nfs_flush_file(inode, NULL, 0, 0, 0);
+	if (dirty >= window * wpages)
+		nfs_flush_file(inode, NULL, 0, 0, FLUSH_GATHER);
 #endif
 	/*
 	 * If we're running out of free requests, flush out everything
@@ -1153,7 +1160,9 @@ nfs_flush_one(struct list_head *head, struct inode *inode, int how)
 	rpc_init_task(task, clnt, nfs_writeback_done, flags);
 	task->tk_calldata = data;
 	/* Release requests */
-	task->tk_release = nfs_writedata_release;
+	task->tk_release = nfs_writeback_release;
+	data->server = NFS_SERVER(inode);
+	atomic_inc(&data->server->writes);
 
 #ifdef CONFIG_NFS_V3
 	msg.rpc_proc = (NFS_PROTO(inode)->version == 3) ? NFS3PROC_WRITE : NFSPROC_WRITE;
@@ -1185,17 +1194,35 @@ nfs_flush_one(struct list_head *head, struct inode *inode, int how)
 	return -ENOMEM;
 }
 
+/*
+ * With FLUSH_GATHER only WRITEs of the full wsize go out, and only while
+ * fewer than the mount's window of them are in flight; the rest is left
+ * dirty to be gathered with what comes next, or sent when it times out.
+ */
 static int
 nfs_flush_list(struct inode *inode, struct list_head *head, int how)
 {
 	LIST_HEAD(one_request);
+	struct nfs_server	*server = NFS_SERVER(inode);
 	struct nfs_page		*req;
 	int			error = 0;
-	unsigned int		pages = 0,
-				wpages = NFS_SERVER(inode)->wpages;
+	unsigned int		n,
+				pages = 0,
+				wpages = server->wpages;
 
 	while (!list_empty(head)) {
-		pages += nfs_coalesce_requests(head, &one_request, wpages);
+		n = nfs_coalesce_requests(head, &one_request, wpages);
+		if ((how & FLUSH_GATHER) &&
+		    (n < wpages || atomic_read(&server->writes) >= server->window)) {
+			while (!list_empty(&one_request)) {
+				req = nfs_list_entry(one_request.next);
+				nfs_list_remove_request(req);
+				nfs_mark_request_dirty(req);
+				nfs_unlock_request(req);
+			}
+			continue;
+		}
+		pages += n;
 		req = nfs_list_entry(one_request.next);
 		error = nfs_flush_one(&one_request, req->wb_inode, how);
 		if (error < 0)
@@ -578,7 +578,9 @@ nfs3svc_encode_readres(struct svc_rqst *rqstp, u32 *p,
 		*p++ = htonl(resp->count);
 		*p++ = htonl(resp->eof);
 		*p++ = htonl(resp->count);	/* xdr opaque count */
-		p += XDR_QUADLEN(resp->count);
+		/* Data in the page cache is sent after the reply buffer */
+		if (!rqstp->rq_resbuf.nrpages)
+			p += XDR_QUADLEN(resp->count);
 	}
 	return xdr_ressize_check(rqstp, p);
 }
@@ -13,7 +13,11 @@
 #include <linux/kernel.h>
 #include <linux/sched.h>
 #include <linux/malloc.h>
+#include <linux/vmalloc.h>
 #include <linux/string.h>
+#include <linux/spinlock.h>
+#include <asm/uaccess.h>
+#include <asm/checksum.h>
 
 #include <linux/sunrpc/svc.h>
 #include <linux/nfsd/nfsd.h>
@@ -24,72 +28,90 @@
  * 4.4BSD:	256
  * Solaris2:	1024
  * DEC Unix:	512-4096
+ *
+ * A busy server sees many thousands of calls in the time it takes a
+ * client to retransmit, so we size the cache to memory: one entry per
+ * CACHE_PAGES pages, within CACHESIZE_MIN and CACHESIZE_MAX.
  */
-#define CACHESIZE		1024
-#define HASHSIZE		64
-#define REQHASH(xid)		((((xid) >> 24) ^ (xid)) & (HASHSIZE-1))
+#define CACHE_PAGES		16
+#define CACHESIZE_MIN		1024
+#define CACHESIZE_MAX		65536
+
+/* Entries per hash bucket */
+#define HASHDEPTH		8
+#define REQHASH(xid)		((((xid) >> 24) ^ (xid)) & hash_mask)
 
+/*
+ * A hash bucket owns a fixed share of the cache entries, kept on an
+ * LRU list under the bucket's lock. A call only ever looks at its own
+ * bucket, so there is no global cache lock.
+ */
 struct nfscache_head {
-	struct svc_cacherep *	next;
-	struct svc_cacherep *	prev;
+	spinlock_t		lock;
+	struct svc_cacherep *	lru_head;
+	struct svc_cacherep *	lru_tail;
 };
 
 static struct nfscache_head *	hash_list;
-static struct svc_cacherep *	lru_head;
-static struct svc_cacherep *	lru_tail;
 static struct svc_cacherep *	nfscache;
+static unsigned int		cache_size;
+static unsigned int		hash_mask;
 static int			cache_initialized;
 static int			cache_disabled = 1;
 
-static int	nfsd_cache_append(struct svc_rqst *rqstp, struct svc_buf *data);
+static int	nfsd_cache_append(struct svc_rqst *rqstp, u32 *data, int len);
 
 void
 nfsd_cache_init(void)
 {
 	struct svc_cacherep	*rp;
 	struct nfscache_head	*rh;
-	size_t			i;
-	unsigned long		order;
+	unsigned int		hashsize, i, j;
 
 	if (cache_initialized)
 		return;
 
-	i = CACHESIZE * sizeof (struct svc_cacherep);
-	for (order = 0; (PAGE_SIZE << order) < i; order++)
-		;
-	nfscache = (struct svc_cacherep *)
-		__get_free_pages(GFP_KERNEL, order);
+	hashsize = 1;
+	while (hashsize * HASHDEPTH * CACHE_PAGES < num_physpages &&
+	       hashsize * HASHDEPTH < CACHESIZE_MAX)
+		hashsize <<= 1;
+	while (hashsize * HASHDEPTH < CACHESIZE_MIN)
+		hashsize <<= 1;
+	cache_size = hashsize * HASHDEPTH;
+	hash_mask = hashsize - 1;
+
+	i = cache_size * sizeof (struct svc_cacherep);
+	nfscache = (struct svc_cacherep *) vmalloc(i);
 	if (!nfscache) {
-		printk (KERN_ERR "nfsd: cannot allocate %Zd bytes for reply cache\n", i);
+		printk (KERN_ERR "nfsd: cannot allocate %u bytes for reply cache\n", i);
 		return;
 	}
 	memset(nfscache, 0, i);
 
-	i = HASHSIZE * sizeof (struct nfscache_head);
+	i = hashsize * sizeof (struct nfscache_head);
 	hash_list = kmalloc (i, GFP_KERNEL);
 	if (!hash_list) {
-		free_pages ((unsigned long)nfscache, order);
+		vfree (nfscache);
 		nfscache = NULL;
-		printk (KERN_ERR "nfsd: cannot allocate %Zd bytes for hash list\n", i);
+		printk (KERN_ERR "nfsd: cannot allocate %u bytes for hash list\n", i);
 		return;
 	}
 
-	for (i = 0, rh = hash_list; i < HASHSIZE; i++, rh++)
-		rh->next = rh->prev = (struct svc_cacherep *) rh;
-
-	for (i = 0, rp = nfscache; i < CACHESIZE; i++, rp++) {
-		rp->c_state = RC_UNUSED;
-		rp->c_type = RC_NOCACHE;
-		rp->c_hash_next =
-		rp->c_hash_prev = rp;
-		rp->c_lru_next = rp + 1;
-		rp->c_lru_prev = rp - 1;
+	for (i = 0, rh = hash_list, rp = nfscache; i < hashsize; i++, rh++) {
+		spin_lock_init(&rh->lock);
+		rh->lru_head = rp;
+		for (j = 0; j < HASHDEPTH; j++, rp++) {
+			rp->c_state = RC_UNUSED;
+			rp->c_type = RC_NOCACHE;
+			rp->c_lru_next = rp + 1;
+			rp->c_lru_prev = rp - 1;
+		}
+		rh->lru_tail = rp - 1;
+		rh->lru_head->c_lru_prev = NULL;
+		rh->lru_tail->c_lru_next = NULL;
 	}
-	lru_head = nfscache;
-	lru_tail = nfscache + CACHESIZE - 1;
-	lru_head->c_lru_prev = NULL;
-	lru_tail->c_lru_next = NULL;
 
+	printk(KERN_INFO "nfsd: reply cache of %u entries\n", cache_size);
 	cache_initialized = 1;
 	cache_disabled = 0;
 }
@@ -99,12 +121,11 @@ nfsd_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
 	size_t			i;
-	unsigned long		order;
 
 	if (!cache_initialized)
 		return;
 
-	for (rp = lru_head; rp; rp = rp->c_lru_next) {
+	for (i = 0, rp = nfscache; i < cache_size; i++, rp++) {
 		if (rp->c_state == RC_DONE && rp->c_type == RC_REPLBUFF)
 			kfree(rp->c_replbuf.buf);
 	}
@@ -112,20 +133,18 @@ nfsd_cache_shutdown(void)
 	cache_initialized = 0;
 	cache_disabled = 1;
 
-	i = CACHESIZE * sizeof (struct svc_cacherep);
-	for (order = 0; (PAGE_SIZE << order) < i; order++)
-		;
-	free_pages ((unsigned long)nfscache, order);
+	vfree (nfscache);
 	nfscache = NULL;
 	kfree (hash_list);
 	hash_list = NULL;
 }
 
 /*
- * Move cache entry to front of LRU list
+ * Move cache entry to front of its bucket's LRU list.
+ * Must be called with the bucket locked.
  */
 static void
-lru_put_front(struct svc_cacherep *rp)
+lru_put_front(struct nfscache_head *rh, struct svc_cacherep *rp)
 {
 	struct svc_cacherep	*prev = rp->c_lru_prev,
 				*next = rp->c_lru_next;
@@ -133,52 +152,51 @@ lru_put_front(struct svc_cacherep *rp)
 	if (prev)
 		prev->c_lru_next = next;
 	else
-		lru_head = next;
+		rh->lru_head = next;
 	if (next)
 		next->c_lru_prev = prev;
 	else
-		lru_tail = prev;
+		rh->lru_tail = prev;
 
-	rp->c_lru_next = lru_head;
+	rp->c_lru_next = rh->lru_head;
 	rp->c_lru_prev = NULL;
-	if (lru_head)
-		lru_head->c_lru_prev = rp;
-	lru_head = rp;
+	if (rh->lru_head)
+		rh->lru_head->c_lru_prev = rp;
+	rh->lru_head = rp;
 }
 
 /*
- * Move a cache entry from one hash list to another
+ * Checksum the start of the call arguments.
  */
-static void
-hash_refile(struct svc_cacherep *rp)
+static inline u32
+nfsd_cache_csum(struct svc_buf *argp, unsigned int *lenp)
 {
-	struct svc_cacherep	*prev = rp->c_hash_prev,
-				*next = rp->c_hash_next;
-	struct nfscache_head	*head = hash_list + REQHASH(rp->c_xid);
-
-	prev->c_hash_next = next;
-	next->c_hash_prev = prev;
+	unsigned int	len = argp->len << 2;
 
-	rp->c_hash_next = head->next;
-	rp->c_hash_prev = (struct svc_cacherep *) head;
-	head->next->c_hash_prev = rp;
-	head->next = rp;
+	*lenp = len;
+	if (len > RC_CSUMLEN)
+		len = RC_CSUMLEN;
+	return csum_partial((unsigned char *) argp->buf, len, 0);
 }
 
 /*
  * Try to find an entry matching the current call in the cache. When none
- * is found, we grab the oldest unlocked entry off the LRU list.
+ * is found, we grab the oldest unlocked entry off the bucket's LRU list.
  * Note that no operation within the loop may sleep.
  */
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 {
-	struct svc_cacherep	*rh, *rp;
+	struct nfscache_head	*rh;
+	struct svc_cacherep	*rp;
 	u32			xid = rqstp->rq_xid,
 				proto =  rqstp->rq_prot,
 				vers = rqstp->rq_vers,
-				proc = rqstp->rq_proc;
+				proc = rqstp->rq_proc,
+				csum;
+	unsigned int		len;
 	unsigned long		age;
+	int			rtn;
 
 	rqstp->rq_cacherep = NULL;
 	if (cache_disabled || type == RC_NOCACHE) {
@@ -186,11 +204,15 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 		return RC_DOIT;
 	}
 
-	rp = rh = (struct svc_cacherep *) &hash_list[REQHASH(xid)];
-	while ((rp = rp->c_hash_next) != rh) {
+	csum = nfsd_cache_csum(&rqstp->rq_argbuf, &len);
+
+	rh = &hash_list[REQHASH(xid)];
+	spin_lock(&rh->lock);
+	for (rp = rh->lru_head; rp; rp = rp->c_lru_next) {
 		if (rp->c_state != RC_UNUSED &&
 		    xid == rp->c_xid && proc == rp->c_proc &&
 		    proto == rp->c_prot && vers == rp->c_vers &&
+		    len == rp->c_len && csum == rp->c_csum &&
 		    time_before(jiffies, rp->c_timestamp + 120*HZ) &&
 		    memcmp((char*)&rqstp->rq_addr, (char*)&rp->c_addr, rqstp->rq_addrlen)==0) {
 			nfsdstats.rchits++;
@@ -199,29 +221,14 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	}
 	nfsdstats.rcmisses++;
 
-	/* This loop shouldn't take more than a few iterations normally */
-	{
-	int	safe = 0;
-	for (rp = lru_tail; rp; rp = rp->c_lru_prev) {
+	for (rp = rh->lru_tail; rp; rp = rp->c_lru_prev) {
 		if (rp->c_state != RC_INPROG)
 			break;
-		if (safe++ > CACHESIZE) {
-			printk("nfsd: loop in repcache LRU list\n");
-			cache_disabled = 1;
-			return RC_DOIT;
-		}
-	}
 	}
 
-	/* This should not happen */
+	/* Every entry of the bucket is busy; just don't cache this one */
 	if (rp == NULL) {
-		static int	complaints;
-
-		printk(KERN_WARNING "nfsd: all repcache entries locked!\n");
-		if (++complaints > 5) {
-			printk(KERN_WARNING "nfsd: disabling repcache.\n");
-			cache_disabled = 1;
-		}
+		spin_unlock(&rh->lock);
 		return RC_DOIT;
 	}
 
@@ -232,9 +239,11 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	rp->c_addr = rqstp->rq_addr;
 	rp->c_prot = proto;
 	rp->c_vers = vers;
+	rp->c_csum = csum;
+	rp->c_len = len;
 	rp->c_timestamp = jiffies;
 
-	hash_refile(rp);
+	lru_put_front(rh, rp);
 
 	/* release any buffer */
 	if (rp->c_type == RC_REPLBUFF) {
@@ -243,41 +252,48 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	}
 	rp->c_type = RC_NOCACHE;
 
+	spin_unlock(&rh->lock);
 	return RC_DOIT;
 
 found_entry:
 	/* We found a matching entry which is either in progress or done. */
 	age = jiffies - rp->c_timestamp;
 	rp->c_timestamp = jiffies;
-	lru_put_front(rp);
+	lru_put_front(rh, rp);
 
+	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
 	if (rp->c_state == RC_INPROG || age < RC_DELAY)
-		return RC_DROPIT;
+		goto out;
 
 	/* From the hall of fame of impractical attacks:
 	 * Is this a user who tries to snoop on the cache? */
+	rtn = RC_DOIT;
 	if (!rqstp->rq_secure && rp->c_secure)
-		return RC_DOIT;
+		goto out;
 
 	/* Compose RPC reply header */
 	switch (rp->c_type) {
 	case RC_NOCACHE:
-		return RC_DOIT;
+		break;
 	case RC_REPLSTAT:
 		svc_putlong(&rqstp->rq_resbuf, rp->c_replstat);
+		rtn = RC_REPLY;
 		break;
 	case RC_REPLBUFF:
-		if (!nfsd_cache_append(rqstp, &rp->c_replbuf))
-			return RC_DOIT;	/* should not happen */
+		if (!nfsd_cache_append(rqstp, rp->c_replbuf.buf,
+					rp->c_replbuf.len))
+			goto out;	/* should not happen */
+		rtn = RC_REPLY;
 		break;
 	default:
 		printk(KERN_WARNING "nfsd: bad repcache type %d\n", rp->c_type);
 		rp->c_state = RC_UNUSED;
-		return RC_DOIT;
 	}
 
-	return RC_REPLY;
+out:
+	spin_unlock(&rh->lock);
+	return rtn;
 }
 
 /*
@@ -299,21 +315,36 @@ found_entry:
 void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
 {
+	struct nfscache_head *rh;
 	struct svc_cacherep *rp;
-	struct svc_buf	*resp = &rqstp->rq_resbuf, *cachp;
+	struct svc_buf	*resp = &rqstp->rq_resbuf;
+	u32		*buf = NULL;
 	int		len;
 
 	if (!(rp = rqstp->rq_cacherep) || cache_disabled)
 		return;
 
 	len = resp->len - (statp - resp->base);
-	
+
+	/* The entry is ours while it is in progress, but the LRU list
+	 * it sits on is shared with the rest of the bucket. */
+	rh = &hash_list[REQHASH(rp->c_xid)];
+
 	/* Don't cache excessive amounts of data and XDR failures */
 	if (!statp || len > (256 >> 2)) {
+		spin_lock(&rh->lock);
 		rp->c_state = RC_UNUSED;
+		spin_unlock(&rh->lock);
 		return;
 	}
 
+	if (cachetype == RC_REPLBUFF) {
+		buf = (u32 *) kmalloc(len << 2, GFP_KERNEL);
+		if (buf)
+			memcpy(buf, statp, len << 2);
+	}
+
+	spin_lock(&rh->lock);
 	switch (cachetype) {
 	case RC_REPLSTAT:
 		if (len != 1)
@@ -321,22 +352,22 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
 		rp->c_replstat = *statp;
 		break;
 	case RC_REPLBUFF:
-		cachp = &rp->c_replbuf;
-		cachp->buf = (u32 *) kmalloc(len << 2, GFP_KERNEL);
-		if (!cachp->buf) {
+		if (!buf) {
 			rp->c_state = RC_UNUSED;
+			spin_unlock(&rh->lock);
 			return;
 		}
-		cachp->len = len;
-		memcpy(cachp->buf, statp, len << 2);
+		rp->c_replbuf.buf = buf;
+		rp->c_replbuf.len = len;
 		break;
 	}
 
-	lru_put_front(rp);
+	lru_put_front(rh, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
 	rp->c_timestamp = jiffies;
+	spin_unlock(&rh->lock);
 
 	return;
 }
@@ -345,17 +376,17 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
  * Copy cached reply to current reply buffer. Should always fit.
  */
 static int
-nfsd_cache_append(struct svc_rqst *rqstp, struct svc_buf *data)
+nfsd_cache_append(struct svc_rqst *rqstp, u32 *data, int len)
 {
 	struct svc_buf	*resp = &rqstp->rq_resbuf;
 
-	if (resp->len + data->len > resp->buflen) {
+	if (resp->len + len > resp->buflen) {
 		printk(KERN_WARNING "nfsd: cached reply too large (%d).\n",
-				data->len);
+				len);
 		return 0;
 	}
-	memcpy(resp->buf, data->buf, data->len << 2);
-	resp->buf += data->len;
-	resp->len += data->len;
+	memcpy(resp->buf, data, len << 2);
+	resp->buf += len;
+	resp->len += len;
 	return 1;
 }
@@ -72,11 +72,11 @@ nfsd_svc(unsigned short port, int nrservs)
 		nrservs = NFSD_MAXSERVS;
 	
 	/* Readahead param cache - will no-op if it already exists */
-	error =	nfsd_racache_init(2*nrservs);
+	error =	nfsd_racache_init(nrservs);
 	if (error<0)
 		goto out;
 	if (!nfsd_serv) {
-		nfsd_serv = svc_create(&nfsd_program, NFSD_BUFSIZE, NFSSVC_XDRSIZE);
+		nfsd_serv = svc_create_pooled(&nfsd_program, NFSD_BUFSIZE, NFSSVC_XDRSIZE);
 		if (nfsd_serv == NULL)
 			goto out;
 		error = svc_makesock(nfsd_serv, IPPROTO_UDP, port);
@@ -157,6 +157,9 @@ nfsd(struct svc_rqst *rqstp)
 
 	current->rlim[RLIMIT_FSIZE].rlim_cur = RLIM_INFINITY; 
 
+	/* Run on the CPU whose pool we serve */
+	svc_bind_pool(rqstp);
+
 	nfsdstats.th_cnt++;
 	/* Let svc_process check client's authentication. */
 	rqstp->rq_auth = 1;
@@ -361,7 +361,9 @@ nfssvc_encode_readres(struct svc_rqst *rqstp, u32 *p,
 	if (!(p = encode_fattr(rqstp, p, resp->fh.fh_dentry->d_inode)))
 		return 0;
 	*p++ = htonl(resp->count);
-	p += XDR_QUADLEN(resp->count);
+	/* Data in the page cache is sent after the reply buffer */
+	if (!rqstp->rq_resbuf.nrpages)
+		p += XDR_QUADLEN(resp->count);
 
 	return xdr_ressize_check(rqstp, p);
 }
@@ -30,11 +30,14 @@
 #include <linux/net.h>
 #include <linux/unistd.h>
 #include <linux/malloc.h>
+#include <linux/vmalloc.h>
+#include <linux/pagemap.h>
 #include <linux/in.h>
 #define __NO_VERSION__
 #include <linux/module.h>
 
 #include <linux/sunrpc/svc.h>
+#include <linux/sunrpc/svcsock.h>
 #include <linux/nfsd/nfsd.h>
 #ifdef CONFIG_NFSD_V3
 #include <linux/nfs3.h>
@@ -59,23 +62,32 @@
  * This is a cache of readahead params that help us choose the proper
  * readahead strategy. Initially, we set all readahead parameters to 0
  * and let the VFS handle things.
- * If you increase the number of cached files very much, you'll need to
- * add a hash table here.
+ * The cache is hashed by file. Each bucket has RAPARM_HASH_DEPTH entries
+ * of its own on a move-to-front list under the bucket lock. There are
+ * enough entries for two per nfsd thread, which may be in use at the
+ * same time, plus RAPARM_FILES files being read sequentially.
  */
 struct raparms {
 	struct raparms		*p_next;
 	unsigned int		p_count;
 	ino_t			p_ino;
 	dev_t			p_dev;
-	unsigned long		p_reada,
-				p_ramax,
-				p_raend,
-				p_ralen,
-				p_rawin;
+	unsigned long		p_reada;
+	struct file_ra_state	p_ra;
 };
 
+struct raparm_hbucket {
+	struct raparms		*pb_head;
+	spinlock_t		pb_lock;
+};
+
+#define RAPARM_HASH_DEPTH	4
+#define RAPARM_FILES		1024
+#define RAPARM_HASH(dev, ino)	(((ino) ^ ((ino) >> 8) ^ (dev)) & raparm_hash_mask)
+
 static struct raparms *		raparml;
-static struct raparms *		raparm_cache;
+static struct raparm_hbucket *	raparm_hash;
+static unsigned int		raparm_hash_mask;
 
 /*
  * Look up one component of a pathname.
@@ -550,42 +562,95 @@ nfsd_sync_dir(struct dentry *dp)
 /*
  * Obtain the readahead parameters for the file
  * specified by (dev, ino).
+ * ra_depth[0-9] count lookups that found the file, by how deep into
+ * its bucket, and ra_depth[10] those that did not.
  */
 static inline struct raparms *
 nfsd_get_raparms(dev_t dev, ino_t ino)
 {
+	struct raparm_hbucket *rab = &raparm_hash[RAPARM_HASH(dev, ino)];
 	struct raparms	*ra, **rap, **frap = NULL;
 	int depth = 0;
 	
-	for (rap = &raparm_cache; (ra = *rap); rap = &ra->p_next) {
+	spin_lock(&rab->pb_lock);
+	for (rap = &rab->pb_head; (ra = *rap); rap = &ra->p_next) {
 		if (ra->p_ino == ino && ra->p_dev == dev)
 			goto found;
 		depth++;
 		if (ra->p_count == 0)
 			frap = rap;
 	}
-	depth = nfsdstats.ra_size*11/10;
-	if (!frap)
+	nfsdstats.ra_depth[10]++;
+	if (!frap) {
+		spin_unlock(&rab->pb_lock);
 		return NULL;
+	}
 	rap = frap;
 	ra = *frap;
 	memset(ra, 0, sizeof(*ra));
 	ra->p_dev = dev;
 	ra->p_ino = ino;
+	goto move_front;
 found:
-	if (rap != &raparm_cache) {
+	nfsdstats.ra_depth[depth*10/RAPARM_HASH_DEPTH]++;
+move_front:
+	if (rap != &rab->pb_head) {
 		*rap = ra->p_next;
-		ra->p_next   = raparm_cache;
-		raparm_cache = ra;
+		ra->p_next   = rab->pb_head;
+		rab->pb_head = ra;
 	}
 	ra->p_count++;
-	nfsdstats.ra_depth[depth*10/nfsdstats.ra_size]++;
+	spin_unlock(&rab->pb_lock);
 	return ra;
 }
 
+/*
+ * Save the readahead parameters of the file and release the entry.
+ */
+static inline void
+nfsd_put_raparms(struct raparms *ra, struct file *file)
+{
+	struct raparm_hbucket *rab = &raparm_hash[RAPARM_HASH(ra->p_dev, ra->p_ino)];
+
+	dprintk("nfsd: raparms %ld %ld\n",
+		file->f_reada, file->f_ra.stamp);
+	spin_lock(&rab->pb_lock);
+	ra->p_reada = file->f_reada;
+	ra->p_ra = file->f_ra;
+	ra->p_count -= 1;
+	spin_unlock(&rab->pb_lock);
+}
+
+/*
+ * Take a reference to each page cache page of the data to be read and
+ * hang it off the reply buffer, instead of copying the data.
+ */
+static int
+nfsd_read_actor(read_descriptor_t *desc, struct page *page,
+			unsigned long offset, unsigned long size)
+{
+	struct svc_buf	*bufp = (struct svc_buf *) desc->buf;
+	unsigned long	count = desc->count;
+
+	if (size > count)
+		size = count;
+	if (bufp->nrpages == RPCSVC_MAXPAGES)
+		return 0;
+	if (bufp->nrpages == 0)
+		bufp->pgbase = offset;
+	page_cache_get(page);
+	bufp->pages[bufp->nrpages++] = page;
+	bufp->pglen += size;
+	desc->count = count - size;
+	desc->written += size;
+	return size;
+}
+
 /*
  * Read data from a file. count must contain the requested read count
  * on entry. On return, *count contains the number of bytes actually read.
+ * Files read through the page cache are not copied to buf; the pages
+ * are attached to the reply instead, see nfsd_read_actor.
  * N.B. After this call fhp needs an fh_put
  */
 int
@@ -613,29 +678,32 @@ nfsd_read(struct svc_rqst *rqstp, struct svc_fh *fhp, loff_t offset,
 	ra = nfsd_get_raparms(fhp->fh_export->ex_dev, fhp->fh_dentry->d_inode->i_ino);
 	if (ra) {
 		file.f_reada = ra->p_reada;
-		file.f_ramax = ra->p_ramax;
-		file.f_raend = ra->p_raend;
-		file.f_ralen = ra->p_ralen;
-		file.f_rawin = ra->p_rawin;
+		file.f_ra = ra->p_ra;
 	}
 	file.f_pos = offset;
 
-	oldfs = get_fs(); set_fs(KERNEL_DS);
-	err = file.f_op->read(&file, buf, *count, &file.f_pos);
-	set_fs(oldfs);
+	if (file.f_op->read == generic_file_read) {
+		read_descriptor_t desc;
+
+		desc.written = 0;
+		desc.count = *count;
+		desc.buf = (char *) &rqstp->rq_resbuf;
+		desc.error = 0;
+		do_generic_file_read(&file, &file.f_pos, &desc, nfsd_read_actor);
+		err = desc.written;
+		if (!err && desc.error) {
+			err = desc.error;
+			svc_release_pages(rqstp);
+		}
+	} else {
+		oldfs = get_fs(); set_fs(KERNEL_DS);
+		err = file.f_op->read(&file, buf, *count, &file.f_pos);
+		set_fs(oldfs);
+	}
 
 	/* Write back readahead params */
-	if (ra != NULL) {
-		dprintk("nfsd: raparms %ld %ld %ld %ld %ld\n",
-			file.f_reada, file.f_ramax, file.f_raend,
-			file.f_ralen, file.f_rawin);
-		ra->p_reada = file.f_reada;
-		ra->p_ramax = file.f_ramax;
-		ra->p_raend = file.f_raend;
-		ra->p_ralen = file.f_ralen;
-		ra->p_rawin = file.f_rawin;
-		ra->p_count -= 1;
-	}
+	if (ra != NULL)
+		nfsd_put_raparms(ra, &file);
 
 	if (err >= 0) {
 		nfsdstats.io_read += err;
@@ -1566,37 +1634,57 @@ nfsd_permission(struct svc_export *exp, struct dentry *dentry, int acc)
 void
 nfsd_racache_shutdown(void)
 {
-	if (!raparm_cache)
+	if (!raparml)
 		return;
 	dprintk("nfsd: freeing readahead buffers.\n");
-	kfree(raparml);
-	raparm_cache = raparml = NULL;
+	vfree(raparml);
+	kfree(raparm_hash);
+	raparml = NULL;
+	raparm_hash = NULL;
 }
 /*
- * Initialize readahead param cache
+ * Initialize readahead param cache for nthreads server threads
  */
 int
-nfsd_racache_init(int cache_size)
+nfsd_racache_init(int nthreads)
 {
-	int	i;
+	struct raparms	*ra;
+	int	hashsize, cache_size, i, j;
 
-	if (raparm_cache)
+	if (raparml)
 		return 0;
-	raparml = kmalloc(sizeof(struct raparms) * cache_size, GFP_KERNEL);
-
-	if (raparml != NULL) {
-		dprintk("nfsd: allocating %d readahead buffers.\n",
-			cache_size);
-		memset(raparml, 0, sizeof(struct raparms) * cache_size);
-		for (i = 0; i < cache_size - 1; i++) {
-			raparml[i].p_next = raparml + i + 1;
-		}
-		raparm_cache = raparml;
-	} else {
+
+	for (hashsize = 1; hashsize * RAPARM_HASH_DEPTH <
+				2 * nthreads + RAPARM_FILES; hashsize <<= 1)
+		;
+	cache_size = hashsize * RAPARM_HASH_DEPTH;
+
+	raparml = vmalloc(sizeof(struct raparms) * cache_size);
+	raparm_hash = kmalloc(sizeof(struct raparm_hbucket) * hashsize,
+				GFP_KERNEL);
+	if (raparml == NULL || raparm_hash == NULL) {
 		printk(KERN_WARNING
 		       "nfsd: Could not allocate memory read-ahead cache.\n");
+		if (raparml)
+			vfree(raparml);
+		if (raparm_hash)
+			kfree(raparm_hash);
+		raparml = NULL;
+		raparm_hash = NULL;
 		return -ENOMEM;
 	}
+
+	dprintk("nfsd: allocating %d readahead buffers.\n",
+		cache_size);
+	memset(raparml, 0, sizeof(struct raparms) * cache_size);
+	for (i = 0, ra = raparml; i < hashsize; i++) {
+		raparm_hash[i].pb_head = ra;
+		spin_lock_init(&raparm_hash[i].pb_lock);
+		for (j = 0; j < RAPARM_HASH_DEPTH - 1; j++, ra++)
+			ra->p_next = ra + 1;
+		ra++;
+	}
+	raparm_hash_mask = hashsize - 1;
 	nfsdstats.ra_size = cache_size;
 	return 0;
 }
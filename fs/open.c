@@ -655,6 +655,9 @@ struct file *dentry_open(struct dentry *dentry, struct vfsmount *mnt, int flags)
 	f->f_op = fops_get(inode->i_fop);
 	if (inode->i_sb)
 		file_move(f, &inode->i_sb->s_files);
+	error = -EINVAL;
+	if ((flags & O_DIRECT) && !inode->i_mapping->a_ops->direct_IO)
+		goto cleanup_all;
 	if (f->f_op && f->f_op->open) {
 		error = f->f_op->open(inode,f);
 		if (error)
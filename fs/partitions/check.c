@@ -19,6 +19,8 @@
 #include <linux/blk.h>
 #include <linux/init.h>
 #include <linux/raid/md.h>
+#include <linux/malloc.h>
+#include <linux/smp_lock.h>
 
 #include "check.h"
 
@@ -411,11 +413,83 @@ void register_disk(struct gendisk *gdev, kdev_t dev, unsigned minors,
 	grok_partitions(gdev, MINOR(dev)>>gdev->minor_shift, minors, size);
 }
 
+/*
+ * Until the root filesystem is mounted, partition tables are read by a
+ * kernel thread for each disk, so that all the disks of a big box seek
+ * at once instead of one after the other.  Whoever needs the partitions
+ * before that calls wait_for_partitions(); mount_root() waits and
+ * switches back to reading them synchronously, which is what ioctls and
+ * modules loaded later expect.
+ */
+static int async_partitions = 1;
+static atomic_t partition_readers = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(partition_wait);
+
+static int __init async_partitions_setup(char *str)
+{
+	async_partitions = simple_strtol(str, NULL, 0);
+	return 1;
+}
+
+__setup("async_partitions=", async_partitions_setup);
+
+struct partition_read {
+	struct gendisk *dev;
+	int first_minor;
+};
+
+static void read_partitions(struct gendisk *dev, int first_minor)
+{
+	int i;
+	int end_minor = first_minor + dev->max_p;
+
+	check_partition(dev, MKDEV(dev->major, first_minor), 1 + first_minor);
+
+ 	/*
+ 	 * We need to set the sizes array before we will be able to access
+ 	 * any of the partitions on this device.
+ 	 */
+	if (dev->sizes != NULL) {	/* optional safeguard in ll_rw_blk.c */
+		for (i = first_minor; i < end_minor; i++)
+			dev->sizes[i] = dev->part[i].nr_sects >> (BLOCK_SIZE_BITS - 9);
+		blk_size[dev->major] = dev->sizes;
+	}
+}
+
+static int partition_thread(void *data)
+{
+	struct partition_read *pr = data;
+
+	daemonize();
+	sprintf(current->comm, "partition/%02x", pr->dev->major);
+
+	lock_kernel();
+	read_partitions(pr->dev, pr->first_minor);
+	unlock_kernel();
+	kfree(pr);
+
+	if (atomic_dec_and_test(&partition_readers))
+		wake_up(&partition_wait);
+	return 0;
+}
+
+void wait_for_partitions(void)
+{
+	wait_event(partition_wait, !atomic_read(&partition_readers));
+}
+
+void partition_check_sync(void)
+{
+	async_partitions = 0;
+	wait_for_partitions();
+}
+
 void grok_partitions(struct gendisk *dev, int drive, unsigned minors, long size)
 {
 	int i;
 	int first_minor	= drive << dev->minor_shift;
 	int end_minor	= first_minor + dev->max_p;
+	struct partition_read *pr;
 
 	if(!dev->sizes)
 		blk_size[dev->major] = NULL;
@@ -425,24 +499,41 @@ void grok_partitions(struct gendisk *dev, int drive, unsigned minors, long size)
 	if (!size || minors == 1)
 		return;
 
-	blk_size[dev->major] = NULL;
-	check_partition(dev, MKDEV(dev->major, first_minor), 1 + first_minor);
+	/*
+	 * While the table is read only the whole disk is valid.  Other
+	 * disks of this major may be in use, or have their own tables
+	 * read at the same time, so leave their sizes alone.
+	 */
+	if (dev->sizes != NULL) {
+		dev->sizes[first_minor] = size >> (BLOCK_SIZE_BITS - 9);
+		for (i = first_minor + 1; i < end_minor; i++)
+			dev->sizes[i] = 0;
+	} else
+		blk_size[dev->major] = NULL;
 
- 	/*
- 	 * We need to set the sizes array before we will be able to access
- 	 * any of the partitions on this device.
- 	 */
-	if (dev->sizes != NULL) {	/* optional safeguard in ll_rw_blk.c */
-		for (i = first_minor; i < end_minor; i++)
-			dev->sizes[i] = dev->part[i].nr_sects >> (BLOCK_SIZE_BITS - 9);
-		blk_size[dev->major] = dev->sizes;
+	if (async_partitions) {
+		pr = kmalloc(sizeof(*pr), GFP_KERNEL);
+		if (pr) {
+			pr->dev = dev;
+			pr->first_minor = first_minor;
+			atomic_inc(&partition_readers);
+			if (kernel_thread(partition_thread, pr,
+					  CLONE_FS | CLONE_FILES | CLONE_SIGHAND) >= 0)
+				return;
+			atomic_dec(&partition_readers);
+			kfree(pr);
+		}
 	}
+	read_partitions(dev, first_minor);
 }
 
 int __init partition_setup(void)
 {
 	device_init();
 
+	/* the RAM disk image may come from a disk partition */
+	wait_for_partitions();
+
 #ifdef CONFIG_BLK_DEV_RAM
 #ifdef CONFIG_BLK_DEV_INITRD
 	if (initrd_start && mount_initrd) initrd_load();
@@ -10,13 +10,14 @@
 #include <linux/malloc.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
 
 #include <asm/uaccess.h>
 
 /*
- * We use a start+len construction, which provides full use of the 
- * allocated memory.
- * -- Florian Coosmann (FGC)
+ * The pipe is a ring of PIPE_BUFFERS page buffers.  write() copies into
+ * private pages, splice() hands page references around without copying.
  * 
  * Reads with count = 0 should always return 0.
  * -- Julian Bradfield 1999-06-07.
@@ -35,11 +36,48 @@ void pipe_wait(struct inode * inode)
 	down(PIPE_SEM(*inode));
 }
 
+/* The n'th buffer after the current one */
+static inline struct pipe_buffer *pipe_buf(struct inode *inode, unsigned int n)
+{
+	return PIPE_BUFS(*inode) + ((PIPE_CURBUF(*inode) + n) & (PIPE_BUFFERS-1));
+}
+
+/* How much write() can put into the pipe without waiting */
+static inline ssize_t pipe_free(struct inode *inode)
+{
+	ssize_t free = (PIPE_BUFFERS - PIPE_NRBUFS(*inode)) * PAGE_SIZE;
+
+	if (PIPE_NRBUFS(*inode)) {
+		struct pipe_buffer *buf = pipe_buf(inode, PIPE_NRBUFS(*inode) - 1);
+		if (buf->flags & PIPE_BUF_MERGE)
+			free += PAGE_SIZE - (buf->offset + buf->len);
+	}
+	return free;
+}
+
+/*
+ * Drop the current buffer.  Cache behaviour optimization: one private
+ * page is kept back for the next write instead of being freed.
+ */
+static void pipe_consume(struct inode *inode)
+{
+	struct pipe_buffer *buf = PIPE_BUFS(*inode) + PIPE_CURBUF(*inode);
+	struct page *page = buf->page;
+
+	buf->page = NULL;
+	if ((buf->flags & PIPE_BUF_MERGE) && !PIPE_TMPPAGE(*inode))
+		PIPE_TMPPAGE(*inode) = page;
+	else
+		page_cache_release(page);
+	PIPE_CURBUF(*inode) = (PIPE_CURBUF(*inode) + 1) & (PIPE_BUFFERS-1);
+	PIPE_NRBUFS(*inode)--;
+}
+
 static ssize_t
 pipe_read(struct file *filp, char *buf, size_t count, loff_t *ppos)
 {
 	struct inode *inode = filp->f_dentry->d_inode;
-	ssize_t size, read, ret;
+	ssize_t read, ret;
 
 	/* Seeks are not allowed on pipes.  */
 	ret = -ESPIPE;
@@ -84,30 +122,31 @@ do_more_read:
 
 	/* Read what data is available.  */
 	ret = -EFAULT;
-	while (count > 0 && (size = PIPE_LEN(*inode))) {
-		char *pipebuf = PIPE_BASE(*inode) + PIPE_START(*inode);
-		ssize_t chars = PIPE_MAX_RCHUNK(*inode);
+	while (count > 0 && PIPE_NRBUFS(*inode)) {
+		struct pipe_buffer *pbuf = PIPE_BUFS(*inode) + PIPE_CURBUF(*inode);
+		ssize_t chars = pbuf->len;
+		char *addr;
+		int error;
 
 		if (chars > count)
 			chars = count;
-		if (chars > size)
-			chars = size;
 
-		if (copy_to_user(buf, pipebuf, chars))
+		addr = kmap(pbuf->page);
+		error = copy_to_user(buf, addr + pbuf->offset, chars);
+		kunmap(pbuf->page);
+		if (error)
 			goto out;
 
 		read += chars;
-		PIPE_START(*inode) += chars;
-		PIPE_START(*inode) &= (PIPE_SIZE - 1);
+		pbuf->offset += chars;
+		pbuf->len -= chars;
 		PIPE_LEN(*inode) -= chars;
 		count -= chars;
 		buf += chars;
+		if (!pbuf->len)
+			pipe_consume(inode);
 	}
 
-	/* Cache behaviour optimization */
-	if (!PIPE_LEN(*inode))
-		PIPE_START(*inode) = 0;
-
 	if (count && PIPE_WAITING_WRITERS(*inode) && !(filp->f_flags & O_NONBLOCK)) {
 		/*
 		 * We know that we are going to sleep: signal
@@ -162,10 +201,10 @@ pipe_write(struct file *filp, const char *buf, size_t count, loff_t *ppos)
 	/* Wait, or check for, available space.  */
 	if (filp->f_flags & O_NONBLOCK) {
 		ret = -EAGAIN;
-		if (PIPE_FREE(*inode) < free)
+		if (pipe_free(inode) < free)
 			goto out;
 	} else {
-		while (PIPE_FREE(*inode) < free) {
+		while (pipe_free(inode) < free) {
 			PIPE_WAITING_WRITERS(*inode)++;
 			pipe_wait(inode);
 			PIPE_WAITING_WRITERS(*inode)--;
@@ -181,47 +220,87 @@ pipe_write(struct file *filp, const char *buf, size_t count, loff_t *ppos)
 	/* Copy into available space.  */
 	ret = -EFAULT;
 	while (count > 0) {
-		int space;
-		char *pipebuf = PIPE_BASE(*inode) + PIPE_END(*inode);
-		ssize_t chars = PIPE_MAX_WCHUNK(*inode);
-
-		if ((space = PIPE_FREE(*inode)) != 0) {
-			if (chars > count)
-				chars = count;
-			if (chars > space)
-				chars = space;
-
-			if (copy_from_user(pipebuf, buf, chars))
-				goto out;
+		struct pipe_buffer *pbuf;
+		ssize_t chars;
+		char *addr;
+		int error;
+
+		if (!pipe_free(inode)) {
+			ret = written;
+			if (filp->f_flags & O_NONBLOCK)
+				break;
 
-			written += chars;
-			PIPE_LEN(*inode) += chars;
-			count -= chars;
-			buf += chars;
-			space = PIPE_FREE(*inode);
+			do {
+				/*
+				 * Synchronous wake-up: it knows that this process
+				 * is going to give up this CPU, so it doesnt have
+				 * to do idle reschedules.
+				 */
+				wake_up_interruptible_sync(PIPE_WAIT(*inode));
+				PIPE_WAITING_WRITERS(*inode)++;
+				pipe_wait(inode);
+				PIPE_WAITING_WRITERS(*inode)--;
+				if (signal_pending(current))
+					goto out;
+				if (!PIPE_READERS(*inode))
+					goto sigpipe;
+			} while (!pipe_free(inode));
+			ret = -EFAULT;
 			continue;
 		}
 
-		ret = written;
-		if (filp->f_flags & O_NONBLOCK)
-			break;
+		/* Append to the last buffer if we own its page.  */
+		if (PIPE_NRBUFS(*inode)) {
+			pbuf = pipe_buf(inode, PIPE_NRBUFS(*inode) - 1);
+			chars = PAGE_SIZE - (pbuf->offset + pbuf->len);
+			if ((pbuf->flags & PIPE_BUF_MERGE) && chars) {
+				if (chars > count)
+					chars = count;
+
+				addr = kmap(pbuf->page);
+				error = copy_from_user(addr + pbuf->offset + pbuf->len, buf, chars);
+				kunmap(pbuf->page);
+				if (error)
+					goto out;
+
+				pbuf->len += chars;
+				goto copied;
+			}
+		}
 
-		do {
-			/*
-			 * Synchronous wake-up: it knows that this process
-			 * is going to give up this CPU, so it doesnt have
-			 * to do idle reschedules.
-			 */
-			wake_up_interruptible_sync(PIPE_WAIT(*inode));
-			PIPE_WAITING_WRITERS(*inode)++;
-			pipe_wait(inode);
-			PIPE_WAITING_WRITERS(*inode)--;
-			if (signal_pending(current))
+		/*
+		 * Otherwise fill a fresh page.  It only goes into the ring
+		 * once the copy worked, so a fault leaves no empty buffer.
+		 */
+		if (!PIPE_TMPPAGE(*inode)) {
+			PIPE_TMPPAGE(*inode) = alloc_page(GFP_HIGHUSER);
+			if (!PIPE_TMPPAGE(*inode)) {
+				ret = -ENOMEM;
 				goto out;
-			if (!PIPE_READERS(*inode))
-				goto sigpipe;
-		} while (!PIPE_FREE(*inode));
-		ret = -EFAULT;
+			}
+		}
+		chars = PAGE_SIZE;
+		if (chars > count)
+			chars = count;
+
+		addr = kmap(PIPE_TMPPAGE(*inode));
+		error = copy_from_user(addr, buf, chars);
+		kunmap(PIPE_TMPPAGE(*inode));
+		if (error)
+			goto out;
+
+		pbuf = pipe_buf(inode, PIPE_NRBUFS(*inode));
+		pbuf->page = PIPE_TMPPAGE(*inode);
+		pbuf->offset = 0;
+		pbuf->len = chars;
+		pbuf->flags = PIPE_BUF_MERGE;
+		PIPE_TMPPAGE(*inode) = NULL;
+		PIPE_NRBUFS(*inode)++;
+copied:
+		written += chars;
+		PIPE_LEN(*inode) += chars;
+		count -= chars;
+		buf += chars;
 	}
 
 	/* Signal readers asynchronously that there is more data.  */
@@ -285,9 +364,11 @@ pipe_poll(struct file *filp, poll_table *wait)
 	poll_wait(filp, PIPE_WAIT(*inode), wait);
 
 	/* Reading only -- no need for acquiring the semaphore.  */
-	mask = POLLIN | POLLRDNORM;
-	if (PIPE_EMPTY(*inode))
-		mask = POLLOUT | POLLWRNORM;
+	mask = 0;
+	if (!PIPE_EMPTY(*inode))
+		mask = POLLIN | POLLRDNORM;
+	if (!PIPE_FULL(*inode))
+		mask |= POLLOUT | POLLWRNORM;
 	if (!PIPE_WRITERS(*inode) && filp->f_version != PIPE_WCOUNTER(*inode))
 		mask |= POLLHUP;
 	if (!PIPE_READERS(*inode))
@@ -306,10 +387,7 @@ pipe_release(struct inode *inode, int decr, int decw)
 	PIPE_READERS(*inode) -= decr;
 	PIPE_WRITERS(*inode) -= decw;
 	if (!PIPE_READERS(*inode) && !PIPE_WRITERS(*inode)) {
-		struct pipe_inode_info *info = inode->i_pipe;
-		inode->i_pipe = NULL;
-		free_page((unsigned long) info->base);
-		kfree(info);
+		free_pipe_info(inode);
 	} else {
 		wake_up_interruptible(PIPE_WAIT(*inode));
 	}
@@ -439,29 +517,35 @@ struct file_operations rdwr_pipe_fops = {
 	release:	pipe_rdwr_release,
 };
 
+/* Pages are allocated as the pipe fills, not up front */
 struct inode* pipe_new(struct inode* inode)
 {
-	unsigned long page;
-
-	page = __get_free_page(GFP_USER);
-	if (!page)
-		return NULL;
-
 	inode->i_pipe = kmalloc(sizeof(struct pipe_inode_info), GFP_KERNEL);
 	if (!inode->i_pipe)
-		goto fail_page;
+		return NULL;
 
 	init_waitqueue_head(PIPE_WAIT(*inode));
-	PIPE_BASE(*inode) = (char*) page;
-	PIPE_START(*inode) = PIPE_LEN(*inode) = 0;
+	PIPE_NRBUFS(*inode) = PIPE_CURBUF(*inode) = 0;
+	PIPE_TMPPAGE(*inode) = NULL;
+	PIPE_LEN(*inode) = 0;
 	PIPE_READERS(*inode) = PIPE_WRITERS(*inode) = 0;
 	PIPE_WAITING_READERS(*inode) = PIPE_WAITING_WRITERS(*inode) = 0;
 	PIPE_RCOUNTER(*inode) = PIPE_WCOUNTER(*inode) = 1;
 
 	return inode;
-fail_page:
-	free_page(page);
-	return NULL;
+}
+
+/* Drop whatever is still in the pipe; called with the last reference */
+void free_pipe_info(struct inode* inode)
+{
+	struct pipe_inode_info *info = inode->i_pipe;
+
+	while (PIPE_NRBUFS(*inode))
+		pipe_consume(inode);
+	if (info->tmp_page)
+		page_cache_release(info->tmp_page);
+	inode->i_pipe = NULL;
+	kfree(info);
 }
 
 static struct vfsmount *pipe_mnt;
@@ -576,9 +660,7 @@ close_f12_inode_i_j:
 close_f12_inode_i:
 	put_unused_fd(i);
 close_f12_inode:
-	free_page((unsigned long) PIPE_BASE(*inode));
-	kfree(inode->i_pipe);
-	inode->i_pipe = NULL;
+	free_pipe_info(inode);
 	iput(inode);
 close_f12:
 	put_filp(f2);
@@ -588,6 +670,307 @@ no_files:
 	return error;	
 }
 
+/*
+ * splice() moves data between a pipe and a file, socket or another
+ * pipe without copying it through user space.  Page cache pages go
+ * into the pipe by reference, and a pipe's pages are handed to the
+ * output file's write method from their kernel mapping.  A page that
+ * the pipe borrowed from the page cache shows later writes to the file.
+ */
+
+/* Wait for data, with the pipe semaphore held.  0 means end of file. */
+static int pipe_wait_readable(struct inode *inode, unsigned int flags)
+{
+	while (PIPE_EMPTY(*inode)) {
+		if (!PIPE_WRITERS(*inode))
+			return 0;
+		if (flags & SPLICE_F_NONBLOCK)
+			return -EAGAIN;
+		PIPE_WAITING_READERS(*inode)++;
+		pipe_wait(inode);
+		PIPE_WAITING_READERS(*inode)--;
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+	}
+	return 1;
+}
+
+/* Wait for a free buffer, with the pipe semaphore held */
+static int pipe_wait_writable(struct inode *inode, unsigned int flags)
+{
+	for (;;) {
+		if (!PIPE_READERS(*inode)) {
+			send_sig(SIGPIPE, current, 0);
+			return -EPIPE;
+		}
+		if (!PIPE_FULL(*inode))
+			return 1;
+		if (flags & SPLICE_F_NONBLOCK)
+			return -EAGAIN;
+		PIPE_WAITING_WRITERS(*inode)++;
+		pipe_wait(inode);
+		PIPE_WAITING_WRITERS(*inode)--;
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+	}
+}
+
+static int pipe_splice_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size)
+{
+	struct inode *inode = (struct inode *) desc->buf;
+	struct pipe_buffer *buf;
+
+	if (PIPE_FULL(*inode))
+		return 0;
+	if (size > desc->count)
+		size = desc->count;
+
+	page_cache_get(page);
+	buf = pipe_buf(inode, PIPE_NRBUFS(*inode));
+	buf->page = page;
+	buf->offset = offset;
+	buf->len = size;
+	buf->flags = 0;
+	PIPE_NRBUFS(*inode)++;
+	PIPE_LEN(*inode) += size;
+
+	desc->count -= size;
+	desc->written += size;
+	return size;
+}
+
+static ssize_t splice_to_pipe(struct file *in, struct inode *pipe, size_t len, unsigned int flags)
+{
+	struct inode *inode = in->f_dentry->d_inode;
+	read_descriptor_t desc;
+	ssize_t ret;
+
+	ret = -EINVAL;
+	if (!inode->i_mapping->a_ops->readpage)
+		return ret;
+	ret = locks_verify_area(FLOCK_VERIFY_READ, inode, in, in->f_pos, len);
+	if (ret)
+		return ret;
+
+	if (down_interruptible(PIPE_SEM(*pipe)))
+		return -ERESTARTSYS;
+	ret = pipe_wait_writable(pipe, flags);
+	if (ret < 0)
+		goto out;
+
+	desc.written = 0;
+	desc.count = len;
+	desc.buf = (char *) pipe;
+	desc.error = 0;
+	do_generic_file_read(in, &in->f_pos, &desc, pipe_splice_actor);
+
+	ret = desc.written;
+	if (!ret)
+		ret = desc.error;
+	if (ret > 0)
+		wake_up_interruptible(PIPE_WAIT(*pipe));
+out:
+	up(PIPE_SEM(*pipe));
+	return ret;
+}
+
+static ssize_t splice_from_pipe(struct inode *pipe, struct file *out, size_t len, unsigned int flags)
+{
+	struct inode *inode = out->f_dentry->d_inode;
+	ssize_t ret;
+
+	ret = -EINVAL;
+	if (!out->f_op || !out->f_op->write)
+		return ret;
+	ret = locks_verify_area(FLOCK_VERIFY_WRITE, inode, out, out->f_pos, len);
+	if (ret)
+		return ret;
+
+	if (down_interruptible(PIPE_SEM(*pipe)))
+		return -ERESTARTSYS;
+	ret = pipe_wait_readable(pipe, flags);
+	if (ret <= 0)
+		goto out;
+
+	ret = 0;
+	while (len && PIPE_NRBUFS(*pipe)) {
+		struct pipe_buffer *buf = PIPE_BUFS(*pipe) + PIPE_CURBUF(*pipe);
+		size_t chars = buf->len;
+		ssize_t written;
+
+		if (chars > len)
+			chars = len;
+		written = file_write_page(out, buf->page, buf->offset, chars);
+		if (written <= 0) {
+			if (!ret)
+				ret = written;
+			break;
+		}
+
+		ret += written;
+		len -= written;
+		buf->offset += written;
+		buf->len -= written;
+		PIPE_LEN(*pipe) -= written;
+		if (!buf->len)
+			pipe_consume(pipe);
+		if (written < chars)
+			break;
+	}
+	wake_up_interruptible(PIPE_WAIT(*pipe));
+out:
+	up(PIPE_SEM(*pipe));
+	return ret;
+}
+
+/*
+ * Pipe to pipe moves whole buffers and splits the last one if needed.
+ * Each side is waited for on its own; both semaphores are then taken
+ * in address order and the conditions checked again.
+ */
+static ssize_t splice_pipe_to_pipe(struct inode *ipipe, struct inode *opipe, size_t len, unsigned int flags)
+{
+	struct inode *first = ipipe, *second = opipe;
+	ssize_t ret;
+
+	if (ipipe == opipe)
+		return -EINVAL;
+	if (first > second) {
+		first = opipe;
+		second = ipipe;
+	}
+
+	for (;;) {
+		if (down_interruptible(PIPE_SEM(*ipipe)))
+			return -ERESTARTSYS;
+		ret = pipe_wait_readable(ipipe, flags);
+		up(PIPE_SEM(*ipipe));
+		if (ret <= 0)
+			return ret;
+
+		if (down_interruptible(PIPE_SEM(*opipe)))
+			return -ERESTARTSYS;
+		ret = pipe_wait_writable(opipe, flags);
+		up(PIPE_SEM(*opipe));
+		if (ret < 0)
+			return ret;
+
+		down(PIPE_SEM(*first));
+		down(PIPE_SEM(*second));
+		if (!PIPE_EMPTY(*ipipe) && !PIPE_FULL(*opipe) && PIPE_READERS(*opipe))
+			break;
+		up(PIPE_SEM(*second));
+		up(PIPE_SEM(*first));
+	}
+
+	ret = 0;
+	while (len && PIPE_NRBUFS(*ipipe) && !PIPE_FULL(*opipe)) {
+		struct pipe_buffer *ibuf = PIPE_BUFS(*ipipe) + PIPE_CURBUF(*ipipe);
+		struct pipe_buffer *obuf = pipe_buf(opipe, PIPE_NRBUFS(*opipe));
+		size_t chars = ibuf->len;
+
+		*obuf = *ibuf;
+		if (chars <= len) {
+			/* The page reference moves with the buffer */
+			ibuf->page = NULL;
+			PIPE_CURBUF(*ipipe) = (PIPE_CURBUF(*ipipe) + 1) & (PIPE_BUFFERS-1);
+			PIPE_NRBUFS(*ipipe)--;
+		} else {
+			/* Both pipes now hold the page, neither may append to it */
+			chars = len;
+			page_cache_get(ibuf->page);
+			ibuf->flags &= ~PIPE_BUF_MERGE;
+			obuf->flags &= ~PIPE_BUF_MERGE;
+			obuf->len = chars;
+			ibuf->offset += chars;
+			ibuf->len -= chars;
+		}
+		PIPE_NRBUFS(*opipe)++;
+		PIPE_LEN(*ipipe) -= chars;
+		PIPE_LEN(*opipe) += chars;
+		len -= chars;
+		ret += chars;
+	}
+	wake_up_interruptible(PIPE_WAIT(*ipipe));
+	wake_up_interruptible(PIPE_WAIT(*opipe));
+
+	up(PIPE_SEM(*second));
+	up(PIPE_SEM(*first));
+	return ret;
+}
+
+/*
+ * A socket into a regular file needs no pipe in between: the protocol
+ * copies its receive queue straight into the file's page cache.
+ */
+static ssize_t splice_sock_to_file(struct file *in, struct file *out, size_t len, unsigned int flags)
+{
+	struct inode *inode = out->f_dentry->d_inode;
+	ssize_t ret;
+
+	if (!S_ISREG(inode->i_mode) || !inode->i_mapping->a_ops->prepare_write)
+		return -EINVAL;
+	if (out->f_flags & O_DIRECT)
+		return -EINVAL;
+	ret = locks_verify_area(FLOCK_VERIFY_WRITE, inode, out, out->f_pos, len);
+	if (ret)
+		return ret;
+
+	return sock_receive_file(in, out, len,
+				 (flags & SPLICE_F_NONBLOCK) ? MSG_DONTWAIT : 0);
+}
+
+/*
+ * At least one of fd_in and fd_out has to be a pipe, unless fd_in is a
+ * socket and fd_out a file.
+ */
+asmlinkage ssize_t sys_splice(int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+	struct file *in, *out;
+	struct inode *ipipe, *opipe;
+	ssize_t ret;
+
+	ret = -EBADF;
+	in = fget(fd_in);
+	if (!in)
+		goto out;
+	if (!(in->f_mode & FMODE_READ))
+		goto fput_in;
+	out = fget(fd_out);
+	if (!out)
+		goto fput_in;
+	if (!(out->f_mode & FMODE_WRITE))
+		goto fput_out;
+
+	ret = 0;
+	if (!len)
+		goto fput_out;
+
+	ipipe = in->f_dentry->d_inode;
+	if (!ipipe->i_pipe)
+		ipipe = NULL;
+	opipe = out->f_dentry->d_inode;
+	if (!opipe->i_pipe)
+		opipe = NULL;
+
+	ret = -EINVAL;
+	if (ipipe && opipe)
+		ret = splice_pipe_to_pipe(ipipe, opipe, len, flags);
+	else if (ipipe)
+		ret = splice_from_pipe(ipipe, out, len, flags);
+	else if (opipe)
+		ret = splice_to_pipe(in, opipe, len, flags);
+	else if (in->f_dentry->d_inode->i_sock)
+		ret = splice_sock_to_file(in, out, len, flags);
+
+fput_out:
+	fput(out);
+fput_in:
+	fput(in);
+out:
+	return ret;
+}
+
 /*
  * pipefs should _never_ be mounted by userland - too much of security hassle,
  * no real gain from having the whole whorehouse mounted. So we don't need
@@ -70,6 +70,8 @@
 #include <linux/smp.h>
 #include <linux/signal.h>
 #include <linux/highmem.h>
+#include <linux/bigpages.h>
+#include <linux/taskstats.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -206,12 +208,14 @@ static inline char * task_mem(struct mm_struct *mm, char *buffer)
 		"VmData:\t%8lu kB\n"
 		"VmStk:\t%8lu kB\n"
 		"VmExe:\t%8lu kB\n"
-		"VmLib:\t%8lu kB\n",
+		"VmLib:\t%8lu kB\n"
+		"VmCache:\t%lu hits %lu misses\n",
 		mm->total_vm << (PAGE_SHIFT-10),
 		mm->locked_vm << (PAGE_SHIFT-10),
 		mm->rss << (PAGE_SHIFT-10),
 		data - stack, stack,
-		exec - lib, lib);
+		exec - lib, lib,
+		mm->mmap_cache_hits, mm->mmap_cache_misses);
 	up(&mm->mmap_sem);
 	return buffer;
 }
@@ -404,6 +408,18 @@ static inline void statm_pte_range(pmd_t * pmd, unsigned long address, unsigned
 
 	if (pmd_none(*pmd))
 		return;
+	if (pmd_big(*pmd)) {
+		/* A shared big page, always present */
+		address &= ~PMD_MASK;
+		end = address + size;
+		if (end > PMD_SIZE)
+			end = PMD_SIZE;
+		size = (end - address) >> PAGE_SHIFT;
+		*total += size;
+		*pages += size;
+		*shared += size;
+		return;
+	}
 	if (pmd_bad(*pmd)) {
 		pmd_ERROR(*pmd);
 		pmd_clear(pmd);
@@ -696,4 +712,114 @@ int proc_pid_cpu(struct task_struct *task, char * buffer)
 
 	return len;
 }
+
+int proc_pid_affinity(struct task_struct *task, char * buffer)
+{
+	return sprintf(buffer, "%08lx\n", task->cpus_allowed);
+}
 #endif
+
+/*
+ * /proc/taskstats, see <linux/taskstats.h>.  The records are built in a
+ * kernel buffer under the tasklist lock and copied out after it, and
+ * the file position is the number of tasks to skip, as for the pid
+ * directories in base.c.
+ */
+#define TASKSTATS_ORDER	2
+
+static int fill_taskstats(unsigned long index, struct taskstat *ts, int max)
+{
+	struct task_struct *p;
+	struct mm_struct *mm;
+	int n = 0;
+
+	read_lock(&tasklist_lock);
+	for_each_task(p) {
+		if (!p->pid)
+			continue;
+		if (index) {
+			index--;
+			continue;
+		}
+		if (n == max)
+			break;
+
+		ts->size = sizeof(*ts);
+		ts->pid = p->pid;
+		ts->ppid = p->p_opptr->pid;
+		ts->uid = p->uid;
+		ts->processor = p->processor;
+		ts->nice = p->nice;
+		ts->flags = p->flags;
+		ts->utime = p->times.tms_utime;
+		ts->stime = p->times.tms_stime;
+		ts->cutime = p->times.tms_cutime;
+		ts->cstime = p->times.tms_cstime;
+		ts->start_time = p->start_time;
+		ts->min_flt = p->min_flt;
+		ts->maj_flt = p->maj_flt;
+		ts->cmin_flt = p->cmin_flt;
+		ts->cmaj_flt = p->cmaj_flt;
+		ts->nswap = p->nswap;
+		ts->cnswap = p->cnswap;
+		ts->vsize = ts->rss = 0;
+		task_lock(p);
+		mm = p->mm;
+		if (mm) {
+			ts->vsize = mm->total_vm << PAGE_SHIFT;
+			ts->rss = mm->rss;
+		}
+		task_unlock(p);
+		ts->state = *get_task_state(p);
+		memcpy(ts->comm, p->comm, sizeof(ts->comm));
+#ifdef CONFIG_TSC_ACCOUNTING
+		task_cputime(p, &ts->utime_ns, &ts->stime_ns);
+#else
+		ts->utime_ns = (unsigned long long) ts->utime * (1000000000 / HZ);
+		ts->stime_ns = (unsigned long long) ts->stime * (1000000000 / HZ);
+#endif
+		ts++;
+		n++;
+	}
+	read_unlock(&tasklist_lock);
+	return n;
+}
+
+static ssize_t taskstats_read(struct file *file, char *buf, size_t count,
+			      loff_t *ppos)
+{
+	struct taskstat *ts;
+	unsigned long index = *ppos;
+	size_t done = 0, want;
+	int n;
+
+	if (count < sizeof(*ts))
+		return -EINVAL;
+	ts = (struct taskstat *) __get_free_pages(GFP_KERNEL, TASKSTATS_ORDER);
+	if (!ts)
+		return -ENOMEM;
+
+	while ((want = (count - done) / sizeof(*ts)) != 0) {
+		if (want > (PAGE_SIZE << TASKSTATS_ORDER) / sizeof(*ts))
+			want = (PAGE_SIZE << TASKSTATS_ORDER) / sizeof(*ts);
+		n = fill_taskstats(index, ts, want);
+		if (!n)
+			break;
+		if (copy_to_user(buf + done, ts, n * sizeof(*ts))) {
+			if (!done)
+				done = -EFAULT;
+			break;
+		}
+		done += n * sizeof(*ts);
+		index += n;
+		if (n < want)
+			break;
+	}
+	free_pages((unsigned long) ts, TASKSTATS_ORDER);
+	*ppos = index;
+	return done;
+}
+
+struct file_operations proc_taskstats_operations = {
+	read:		taskstats_read,
+};
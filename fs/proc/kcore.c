@@ -244,7 +244,8 @@ static void elf_kcore_store_hdr(char *bufp, int num_vma, int dataoff)
 
 	/* setup ELF PT_LOAD program header for every vmalloc'd area */
 	for (m=vmlist; m; m=m->next) {
-		if (m->flags & VM_IOREMAP) /* don't dump ioremap'd stuff! (TA) */
+		/* don't dump ioremap'd stuff! (TA) */
+		if (m->flags & (VM_IOREMAP | VM_LAZYFREE))
 			continue;
 
 		phdr = (struct elf_phdr *) bufp;
@@ -420,7 +421,7 @@ static ssize_t read_kcore(struct file *file, char *buffer, size_t buflen, loff_t
 				curstart = vmstart + vmsize;
 				cursize -= vmsize;
 				/* don't dump ioremap'd stuff! (TA) */
-				if (m->flags & VM_IOREMAP)
+				if (m->flags & (VM_IOREMAP | VM_LAZYFREE))
 					continue;
 				memcpy(elf_buf + (vmstart - start),
 					(char *)vmstart, vmsize);
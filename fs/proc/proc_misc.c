@@ -35,6 +35,7 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/smp_lock.h>
+#include <linux/bigpages.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -61,6 +62,7 @@ extern int get_ksyms_list(char *, char **, off_t, int);
 #endif
 extern int get_device_list(char *);
 extern int get_partition_list(char *, char **, off_t, int);
+extern int get_disk_stats_list(char *, char **, off_t, int);
 extern int get_filesystem_list(char *);
 extern int get_filesystem_info(char *);
 extern int get_exec_domain_list(char *);
@@ -68,6 +70,12 @@ extern int get_irq_list(char *);
 extern int get_dma_list(char *);
 extern int get_locks_status (char *, char **, off_t, int);
 extern int get_swaparea_info (char *);
+extern int get_pageset_info(char *);
+extern int get_pgt_cache_info(char *);
+extern int get_buffer_lock_info(char *);
+#ifdef CONFIG_NUMA
+extern int get_numastat_info(char *);
+#endif
 #ifdef CONFIG_SGI_DS1286
 extern int get_ds1286_status(char *);
 #endif
@@ -92,11 +100,11 @@ static int loadavg_read_proc(char *page, char **start, off_t off,
 	a = avenrun[0] + (FIXED_1/200);
 	b = avenrun[1] + (FIXED_1/200);
 	c = avenrun[2] + (FIXED_1/200);
-	len = sprintf(page,"%d.%02d %d.%02d %d.%02d %d/%d %d\n",
+	len = sprintf(page,"%d.%02d %d.%02d %d.%02d %ld/%d %d\n",
 		LOAD_INT(a), LOAD_FRAC(a),
 		LOAD_INT(b), LOAD_FRAC(b),
 		LOAD_INT(c), LOAD_FRAC(c),
-		nr_running, nr_threads, last_pid);
+		nr_running(), nr_threads, last_pid);
 	return proc_calc_metrics(page, start, off, count, eof, len);
 }
 
@@ -191,6 +199,7 @@ static int meminfo_read_proc(char *page, char **start, off_t off,
                 K(i.freeram-i.freehigh),
                 K(i.totalswap),
                 K(i.freeswap));
+	len += get_bigpage_info(page+len);
 
 	return proc_calc_metrics(page, start, off, count, eof, len);
 #undef B
@@ -340,6 +349,13 @@ static int devices_read_proc(char *page, char **start, off_t off,
 	return proc_calc_metrics(page, start, off, count, eof, len);
 }
 
+static int readahead_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_readahead_stats(page);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
 static int partitions_read_proc(char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
 {
@@ -348,6 +364,14 @@ static int partitions_read_proc(char *page, char **start, off_t off,
 	return len;
 }
 
+static int diskstats_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_disk_stats_list(page, start, off, count);
+	if (len < count) *eof = 1;
+	return len;
+}
+
 #if !defined(CONFIG_ARCH_S390)
 static int interrupts_read_proc(char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
@@ -430,6 +454,43 @@ static int swaps_read_proc(char *page, char **start, off_t off,
 	return proc_calc_metrics(page, start, off, count, eof, len);
 }
 
+static int pagesets_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_pageset_info(page);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
+static int pgtcache_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_pgt_cache_info(page);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
+static int vmstat_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_vmstat_info(page);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
+static int buffer_locks_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_buffer_lock_info(page);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+
+#ifdef CONFIG_NUMA
+static int numastat_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_numastat_info(page);
+	return proc_calc_metrics(page, start, off, count, eof, len);
+}
+#endif
+
 static int memory_read_proc(char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
 {
@@ -512,6 +573,13 @@ void __init proc_misc_init(void)
 		{"loadavg",     loadavg_read_proc},
 		{"uptime",	uptime_read_proc},
 		{"meminfo",	meminfo_read_proc},
+		{"pagesets",	pagesets_read_proc},
+		{"pgtcache",	pgtcache_read_proc},
+		{"vmstat",	vmstat_read_proc},
+		{"buffer_locks",	buffer_locks_read_proc},
+#ifdef CONFIG_NUMA
+		{"numastat",	numastat_read_proc},
+#endif
 		{"version",	version_read_proc},
 		{"cpuinfo",	cpuinfo_read_proc},
 #ifdef CONFIG_PROC_HARDWARE
@@ -530,6 +598,8 @@ void __init proc_misc_init(void)
 		{"stat",	kstat_read_proc},
 		{"devices",	devices_read_proc},
 		{"partitions",	partitions_read_proc},
+		{"diskstats",	diskstats_read_proc},
+		{"readahead",	readahead_read_proc},
 #if !defined(CONFIG_ARCH_S390)
 		{"interrupts",	interrupts_read_proc},
 #endif
@@ -554,6 +624,9 @@ void __init proc_misc_init(void)
 	entry = create_proc_entry("kmsg", S_IRUSR, &proc_root);
 	if (entry)
 		entry->proc_fops = &proc_kmsg_operations;
+	entry = create_proc_entry("taskstats", S_IRUGO, NULL);
+	if (entry)
+		entry->proc_fops = &proc_taskstats_operations;
 	proc_root_kcore = create_proc_entry("kcore", S_IRUSR, NULL);
 	if (proc_root_kcore) {
 		proc_root_kcore->proc_fops = &proc_kcore_operations;
@@ -579,4 +652,8 @@ void __init proc_misc_init(void)
 				       slabinfo_read_proc, NULL);
 	if (entry)
 		entry->write_proc = slabinfo_write_proc;
+	entry = create_proc_read_entry("schedstat", S_IWUSR | S_IRUGO, NULL,
+				       schedstat_read_proc, NULL);
+	if (entry)
+		entry->write_proc = schedstat_write_proc;
 }
@@ -119,9 +119,10 @@ asmlinkage ssize_t sys_read(unsigned int fd, char * buf, size_t count)
 {
 	ssize_t ret;
 	struct file * file;
+	int fput_needed;
 
 	ret = -EBADF;
-	file = fget(fd);
+	file = fget_light(fd, &fput_needed);
 	if (file) {
 		if (file->f_mode & FMODE_READ) {
 			ret = locks_verify_area(FLOCK_VERIFY_READ, file->f_dentry->d_inode,
@@ -134,9 +135,9 @@ asmlinkage ssize_t sys_read(unsigned int fd, char * buf, size_t count)
 			}
 		}
 		if (ret > 0)
-			inode_dir_notify(file->f_dentry->d_parent->d_inode,
-				DN_ACCESS);
-		fput(file);
+			inode_dir_notify_name(file->f_dentry->d_parent->d_inode,
+				DN_ACCESS, &file->f_dentry->d_name);
+		fput_light(file, fput_needed);
 	}
 	return ret;
 }
@@ -145,9 +146,10 @@ asmlinkage ssize_t sys_write(unsigned int fd, const char * buf, size_t count)
 {
 	ssize_t ret;
 	struct file * file;
+	int fput_needed;
 
 	ret = -EBADF;
-	file = fget(fd);
+	file = fget_light(fd, &fput_needed);
 	if (file) {
 		if (file->f_mode & FMODE_WRITE) {
 			struct inode *inode = file->f_dentry->d_inode;
@@ -161,9 +163,9 @@ asmlinkage ssize_t sys_write(unsigned int fd, const char * buf, size_t count)
 			}
 		}
 		if (ret > 0)
-			inode_dir_notify(file->f_dentry->d_parent->d_inode,
-				DN_MODIFY);
-		fput(file);
+			inode_dir_notify_name(file->f_dentry->d_parent->d_inode,
+				DN_MODIFY, &file->f_dentry->d_name);
+		fput_light(file, fput_needed);
 	}
 	return ret;
 }
@@ -266,8 +268,9 @@ out:
 out_nofree:
 	/* VERIFY_WRITE actually means a read, as we write to user space */
 	if ((ret + (type == VERIFY_WRITE)) > 0)
-		inode_dir_notify(file->f_dentry->d_parent->d_inode,
-			(type == VERIFY_WRITE) ? DN_MODIFY : DN_ACCESS);
+		inode_dir_notify_name(file->f_dentry->d_parent->d_inode,
+			(type == VERIFY_WRITE) ? DN_MODIFY : DN_ACCESS,
+			&file->f_dentry->d_name);
 	return ret;
 }
 
@@ -275,17 +278,18 @@ asmlinkage ssize_t sys_readv(unsigned long fd, const struct iovec * vector,
 			     unsigned long count)
 {
 	struct file * file;
+	int fput_needed;
 	ssize_t ret;
 
 
 	ret = -EBADF;
-	file = fget(fd);
+	file = fget_light(fd, &fput_needed);
 	if (!file)
 		goto bad_file;
 	if (file->f_op && (file->f_mode & FMODE_READ) &&
 	    (file->f_op->readv || file->f_op->read))
 		ret = do_readv_writev(VERIFY_WRITE, file, vector, count);
-	fput(file);
+	fput_light(file, fput_needed);
 
 bad_file:
 	return ret;
@@ -295,17 +299,18 @@ asmlinkage ssize_t sys_writev(unsigned long fd, const struct iovec * vector,
 			      unsigned long count)
 {
 	struct file * file;
+	int fput_needed;
 	ssize_t ret;
 
 
 	ret = -EBADF;
-	file = fget(fd);
+	file = fget_light(fd, &fput_needed);
 	if (!file)
 		goto bad_file;
 	if (file->f_op && (file->f_mode & FMODE_WRITE) &&
 	    (file->f_op->writev || file->f_op->write))
 		ret = do_readv_writev(VERIFY_READ, file, vector, count);
-	fput(file);
+	fput_light(file, fput_needed);
 
 bad_file:
 	return ret;
@@ -320,10 +325,11 @@ asmlinkage ssize_t sys_pread(unsigned int fd, char * buf,
 {
 	ssize_t ret;
 	struct file * file;
+	int fput_needed;
 	ssize_t (*read)(struct file *, char *, size_t, loff_t *);
 
 	ret = -EBADF;
-	file = fget(fd);
+	file = fget_light(fd, &fput_needed);
 	if (!file)
 		goto bad_file;
 	if (!(file->f_mode & FMODE_READ))
@@ -339,9 +345,10 @@ asmlinkage ssize_t sys_pread(unsigned int fd, char * buf,
 		goto out;
 	ret = read(file, buf, count, &pos);
 	if (ret > 0)
-		inode_dir_notify(file->f_dentry->d_parent->d_inode, DN_ACCESS);
+		inode_dir_notify_name(file->f_dentry->d_parent->d_inode,
+				      DN_ACCESS, &file->f_dentry->d_name);
 out:
-	fput(file);
+	fput_light(file, fput_needed);
 bad_file:
 	return ret;
 }
@@ -351,10 +358,11 @@ asmlinkage ssize_t sys_pwrite(unsigned int fd, const char * buf,
 {
 	ssize_t ret;
 	struct file * file;
+	int fput_needed;
 	ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
 
 	ret = -EBADF;
-	file = fget(fd);
+	file = fget_light(fd, &fput_needed);
 	if (!file)
 		goto bad_file;
 	if (!(file->f_mode & FMODE_WRITE))
@@ -371,9 +379,10 @@ asmlinkage ssize_t sys_pwrite(unsigned int fd, const char * buf,
 
 	ret = write(file, buf, count, &pos);
 	if (ret > 0)
-		inode_dir_notify(file->f_dentry->d_parent->d_inode, DN_MODIFY);
+		inode_dir_notify_name(file->f_dentry->d_parent->d_inode,
+				      DN_MODIFY, &file->f_dentry->d_name);
 out:
-	fput(file);
+	fput_light(file, fput_needed);
 bad_file:
 	return ret;
 }
@@ -10,6 +10,7 @@
 #include <linux/stat.h>
 #include <linux/file.h>
 #include <linux/smp_lock.h>
+#include <linux/dirent.h>
 
 #include <asm/uaccess.h>
 
@@ -325,3 +326,146 @@ out_putf:
 out:
 	return error;
 }
+
+/*
+ * getdents_stat() saves the lstat() that a tree walker does after every
+ * entry.  The entries are collected first and given their attributes
+ * afterwards, from the dentries the directory has in the dcache: looking
+ * names up from within a filesystem's readdir could deadlock on its own
+ * locks.  With GETDENTS_STAT_READ names that are not cached are looked
+ * up, which reads their inodes in.  NFSv3 needs no help here, its
+ * READDIRPLUS replies put the entries in the dcache as they are read.
+ */
+#define GETDENTS_STAT_ORDER	2	/* at most 16k of entries per call */
+
+struct getdents_stat_callback {
+	struct dirent_stat * current_dir;
+	struct dirent_stat * previous;
+	int count;
+	int error;
+};
+
+static int filldir_stat(void * __buf, const char * name, int namlen, off_t offset,
+			ino_t ino, unsigned int d_type)
+{
+	struct dirent_stat * dirent;
+	struct getdents_stat_callback * buf = (struct getdents_stat_callback *) __buf;
+	int reclen = ROUND_UP64(NAME_OFFSET(dirent) + namlen + 1);
+
+	buf->error = -EINVAL;	/* only used if we fail.. */
+	if (reclen > buf->count)
+		return -EINVAL;
+	dirent = buf->previous;
+	if (dirent)
+		dirent->d_off = offset;
+	dirent = buf->current_dir;
+	buf->previous = dirent;
+	memset(dirent, 0, NAME_OFFSET(dirent));
+	dirent->d_ino = ino;
+	dirent->d_reclen = reclen;
+	dirent->d_type = d_type;
+	memcpy(dirent->d_name, name, namlen);
+	dirent->d_name[namlen] = 0;
+	((char *) dirent) += reclen;
+	buf->current_dir = dirent;
+	buf->count -= reclen;
+	return 0;
+}
+
+/* Called with the directory's i_sem held */
+static void dirent_stat_lookup(struct dentry * parent, struct dirent_stat * d,
+			       unsigned int flags)
+{
+	struct dentry * dentry;
+	struct qstr this;
+
+	this.name = (const unsigned char *) d->d_name;
+	this.len = strlen(d->d_name);
+	if (this.len == 1 && this.name[0] == '.')
+		dentry = dget(parent);
+	else if (this.len == 2 && this.name[0] == '.' && this.name[1] == '.') {
+		/* the parent of a mount root is in another filesystem */
+		if (IS_ROOT(parent))
+			return;
+		spin_lock(&dcache_lock);
+		dentry = dget(parent->d_parent);
+		spin_unlock(&dcache_lock);
+	} else {
+		this.hash = full_name_hash(this.name, this.len);
+		if (parent->d_op && parent->d_op->d_hash &&
+		    parent->d_op->d_hash(parent, &this) < 0)
+			return;
+		if (flags & GETDENTS_STAT_READ) {
+			dentry = lookup_hash(&this, parent);
+			if (IS_ERR(dentry))
+				return;
+		} else {
+			dentry = d_lookup(parent, &this);
+			if (!dentry)
+				return;
+		}
+	}
+	if (dentry->d_inode && dentry->d_inode->i_ino == d->d_ino)
+		vfs_dirent_stat(dentry, d);
+	dput(dentry);
+}
+
+asmlinkage long sys_getdents_stat(unsigned int fd, void * dirent, unsigned int count,
+				  unsigned int flags)
+{
+	struct file * file;
+	struct dentry * dentry;
+	struct inode * inode;
+	struct getdents_stat_callback buf;
+	struct dirent_stat * d;
+	char * page, * end;
+	int error;
+
+	error = -EINVAL;
+	if (flags & ~GETDENTS_STAT_READ)
+		goto out;
+	error = -EBADF;
+	file = fget(fd);
+	if (!file)
+		goto out;
+	error = -ENOMEM;
+	page = (char *) __get_free_pages(GFP_KERNEL, GETDENTS_STAT_ORDER);
+	if (!page)
+		goto out_putf;
+
+	buf.current_dir = (struct dirent_stat *) page;
+	buf.previous = NULL;
+	buf.count = count;
+	if (buf.count > (PAGE_SIZE << GETDENTS_STAT_ORDER))
+		buf.count = PAGE_SIZE << GETDENTS_STAT_ORDER;
+	buf.error = 0;
+
+	error = vfs_readdir(file, filldir_stat, &buf);
+	if (error < 0)
+		goto out_free;
+	error = buf.error;
+	if (!buf.previous)
+		goto out_free;
+	buf.previous->d_off = file->f_pos;
+	end = (char *) buf.current_dir;
+
+	dentry = file->f_dentry;
+	inode = dentry->d_inode;
+	down(&inode->i_sem);
+	if (!IS_DEADDIR(inode))
+		for (d = (struct dirent_stat *) page; (char *) d < end;
+		     ((char *) d) += d->d_reclen)
+			dirent_stat_lookup(dentry, d, flags);
+	up(&inode->i_sem);
+
+	error = -EFAULT;
+	if (!copy_to_user(dirent, page, end - page))
+		error = end - page;
+
+out_free:
+	free_pages((unsigned long) page, GETDENTS_STAT_ORDER);
+out_putf:
+	fput(file);
+out:
+	return error;
+}
@@ -21,7 +21,6 @@
 
 #include <asm/uaccess.h>
 
-#define ROUND_UP(x,y) (((x)+(y)-1)/(y))
 #define DEFAULT_POLLMASK (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM)
 
 struct poll_table_entry {
@@ -160,11 +159,30 @@ get_max:
 #define POLLOUT_SET (POLLWRBAND | POLLWRNORM | POLLOUT | POLLERR)
 #define POLLEX_SET (POLLPRI)
 
-int do_select(int n, fd_set_bits *fds, long *timeout)
+/*
+ * A NULL timeout means wait forever, a zero one not at all.
+ */
+static inline int timeout_expired(struct timespec *timeout)
+{
+	return timeout && !timeout->tv_sec && !timeout->tv_nsec;
+}
+
+/*
+ * Sleep until woken up or the timeout runs out, leaving the time
+ * that is left in *timeout.
+ */
+static inline void poll_schedule(struct timespec *timeout)
+{
+	if (timeout)
+		schedule_hrtimeout(timeout);
+	else
+		schedule();
+}
+
+static int __do_select(int n, fd_set_bits *fds, struct timespec *timeout)
 {
 	poll_table table, *wait;
 	int retval, i, off;
-	long __timeout = *timeout;
 
  	read_lock(&current->files->file_lock);
 	retval = max_select_fd(n, fds);
@@ -176,7 +194,7 @@ int do_select(int n, fd_set_bits *fds, long *timeout)
 
 	poll_initwait(&table);
 	wait = &table;
-	if (!__timeout)
+	if (timeout_expired(timeout))
 		wait = NULL;
 	retval = 0;
 	for (;;) {
@@ -214,22 +232,34 @@ int do_select(int n, fd_set_bits *fds, long *timeout)
 			}
 		}
 		wait = NULL;
-		if (retval || !__timeout || signal_pending(current))
+		if (retval || timeout_expired(timeout) || signal_pending(current))
 			break;
 		if(table.error) {
 			retval = table.error;
 			break;
 		}
-		__timeout = schedule_timeout(__timeout);
+		poll_schedule(timeout);
 	}
 	current->state = TASK_RUNNING;
 
 	poll_freewait(&table);
+	return retval;
+}
 
-	/*
-	 * Up-to-date the caller timeout.
-	 */
-	*timeout = __timeout;
+/*
+ * For the 32-bit emulation layers, which still count in jiffies.
+ */
+int do_select(int n, fd_set_bits *fds, long *timeout)
+{
+	struct timespec ts;
+	int retval;
+
+	if (*timeout == MAX_SCHEDULE_TIMEOUT)
+		return __do_select(n, fds, NULL);
+
+	jiffies_to_timespec(*timeout, &ts);
+	retval = __do_select(n, fds, &ts);
+	*timeout = timeout_expired(&ts) ? 0 : timespec_to_jiffies(&ts);
 	return retval;
 }
 
@@ -259,10 +289,10 @@ sys_select(int n, fd_set *inp, fd_set *outp, fd_set *exp, struct timeval *tvp)
 {
 	fd_set_bits fds;
 	char *bits;
-	long timeout;
+	struct timespec ts, *timeout;
 	int ret, size;
 
-	timeout = MAX_SCHEDULE_TIMEOUT;
+	timeout = NULL;
 	if (tvp) {
 		time_t sec, usec;
 
@@ -276,8 +306,9 @@ sys_select(int n, fd_set *inp, fd_set *outp, fd_set *exp, struct timeval *tvp)
 			goto out_nofds;
 
 		if ((unsigned long) sec < MAX_SELECT_SECONDS) {
-			timeout = ROUND_UP(usec, 1000000/HZ);
-			timeout += sec * (unsigned long) HZ;
+			ts.tv_sec = sec + usec / 1000000;
+			ts.tv_nsec = (usec % 1000000) * 1000;
+			timeout = &ts;
 		}
 	}
 
@@ -313,17 +344,11 @@ sys_select(int n, fd_set *inp, fd_set *outp, fd_set *exp, struct timeval *tvp)
 	zero_fd_set(n, fds.res_out);
 	zero_fd_set(n, fds.res_ex);
 
-	ret = do_select(n, &fds, &timeout);
+	ret = __do_select(n, &fds, timeout);
 
-	if (tvp && !(current->personality & STICKY_TIMEOUTS)) {
-		time_t sec = 0, usec = 0;
-		if (timeout) {
-			sec = timeout / HZ;
-			usec = timeout % HZ;
-			usec *= (1000000/HZ);
-		}
-		put_user(sec, &tvp->tv_sec);
-		put_user(usec, &tvp->tv_usec);
+	if (timeout && !(current->personality & STICKY_TIMEOUTS)) {
+		put_user(ts.tv_sec, &tvp->tv_sec);
+		put_user(ts.tv_nsec / 1000, &tvp->tv_usec);
 	}
 
 	if (ret < 0)
@@ -380,7 +405,7 @@ static void do_pollfd(unsigned int num, struct pollfd * fdpage,
 }
 
 static int do_poll(unsigned int nfds, unsigned int nchunks, unsigned int nleft, 
-	struct pollfd *fds[], poll_table *wait, long timeout)
+	struct pollfd *fds[], poll_table *wait, struct timespec *timeout)
 {
 	int count;
 	poll_table* pt = wait;
@@ -395,12 +420,12 @@ static int do_poll(unsigned int nfds, unsigned int nchunks, unsigned int nleft,
 		if (nleft)
 			do_pollfd(nleft, fds[nchunks], &pt, &count);
 		pt = NULL;
-		if (count || !timeout || signal_pending(current))
+		if (count || timeout_expired(timeout) || signal_pending(current))
 			break;
 		count = wait->error;
 		if (count)
 			break;
-		timeout = schedule_timeout(timeout);
+		poll_schedule(timeout);
 	}
 	current->state = TASK_RUNNING;
 	return count;
@@ -412,22 +437,22 @@ asmlinkage long sys_poll(struct pollfd * ufds, unsigned int nfds, long timeout)
 	struct pollfd **fds;
 	poll_table table, *wait;
 	int nchunks, nleft;
+	struct timespec ts, *tsp;
 
 	/* Do a sanity check on nfds ... */
 	if (nfds > current->files->max_fds)
 		return -EINVAL;
 
-	if (timeout) {
-		/* Careful about overflow in the intermediate values */
-		if ((unsigned long) timeout < MAX_SCHEDULE_TIMEOUT / HZ)
-			timeout = (unsigned long)(timeout*HZ+999)/1000+1;
-		else /* Negative or overflow */
-			timeout = MAX_SCHEDULE_TIMEOUT;
+	tsp = NULL;
+	if (timeout >= 0) {	/* negative means forever */
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		tsp = &ts;
 	}
 
 	poll_initwait(&table);
 	wait = &table;
-	if (!timeout)
+	if (timeout_expired(tsp))
 		wait = NULL;
 
 	err = -ENOMEM;
@@ -465,7 +490,7 @@ asmlinkage long sys_poll(struct pollfd * ufds, unsigned int nfds, long timeout)
 			goto out_fds1;
 	}
 
-	fdcount = do_poll(nfds, nchunks, nleft, fds, wait, timeout);
+	fdcount = do_poll(nfds, nchunks, nleft, fds, wait, tsp);
 
 	/* OK, now copy the revents fields back to user space. */
 	for(i=0; i < nchunks; i++)
@@ -32,52 +32,78 @@ smb_fsync(struct file *file, struct dentry * dentry, int datasync)
 	return 0;
 }
 
+/*
+ * Most pages read at once: the page asked for and those after it that
+ * are not cached yet, so that sequential reads and readahead keep
+ * several large requests in flight.
+ */
+#define SMB_READ_PAGES	32
+
 /*
  * Read a page synchronously.
  */
 static int
 smb_readpage_sync(struct dentry *dentry, struct page *page)
 {
-	char *buffer = page_address(page);
+	struct inode *inode = dentry->d_inode;
+	struct page *pages[SMB_READ_PAGES], *next;
+	char *vec[SMB_READ_PAGES];
 	unsigned long offset = page->index << PAGE_CACHE_SHIFT;
-	int rsize = smb_get_rsize(server_from_dentry(dentry));
-	int count = PAGE_SIZE;
-	int result;
-
-	VERBOSE("file %s/%s, count=%d@%ld, rsize=%d\n",
-		DENTRY_PATH(dentry), count, offset, rsize);
+	unsigned long end_index;
+	int nr, i, count, result;
 
 	result = smb_open(dentry, SMB_O_RDONLY);
 	if (result < 0) {
 		PARANOIA("%s/%s open failed, error=%d\n",
 			 DENTRY_PATH(dentry), result);
-		goto io_error;
+		UnlockPage(page);
+		return result;
 	}
 
-	do {
-		if (count < rsize)
-			rsize = count;
-
-		result = smb_proc_read(dentry->d_inode, offset, rsize, buffer);
-		if (result < 0)
-			goto io_error;
-
-		count -= result;
-		offset += result;
-		buffer += result;
-		dentry->d_inode->i_atime = CURRENT_TIME;
-		if (result < rsize)
+	end_index = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	pages[0] = page;
+	for (nr = 1; nr < SMB_READ_PAGES && page->index + nr < end_index; nr++) {
+		next = find_get_page(inode->i_mapping, page->index + nr);
+		if (next) {
+			page_cache_release(next);
 			break;
-	} while (count);
-
-	memset(buffer, 0, count);
-	flush_dcache_page(page);
-	SetPageUptodate(page);
-	result = 0;
-
-io_error:
-	UnlockPage(page);
-	return result;
+		}
+		next = grab_cache_page(inode->i_mapping, page->index + nr);
+		if (!next)
+			break;
+		if (Page_Uptodate(next)) {
+			UnlockPage(next);
+			page_cache_release(next);
+			break;
+		}
+		pages[nr] = next;
+	}
+	for (i = 0; i < nr; i++)
+		vec[i] = kmap(pages[i]);
+
+	VERBOSE("file %s/%s, count=%d@%ld\n",
+		DENTRY_PATH(dentry), nr << PAGE_CACHE_SHIFT, offset);
+
+	result = smb_proc_readv(inode, offset, nr << PAGE_CACHE_SHIFT, vec, 0);
+	if (result >= 0)
+		inode->i_atime = CURRENT_TIME;
+
+	for (i = 0; i < nr; i++) {
+		if (result >= 0) {
+			count = result - (i << PAGE_CACHE_SHIFT);
+			if (count < 0)
+				count = 0;
+			if (count < PAGE_CACHE_SIZE)
+				memset(vec[i] + count, 0, PAGE_CACHE_SIZE - count);
+			flush_dcache_page(pages[i]);
+			SetPageUptodate(pages[i]);
+		}
+		kunmap(pages[i]);
+		UnlockPage(pages[i]);
+		if (i)
+			page_cache_release(pages[i]);
+	}
+	return result < 0 ? result : 0;
 }
 
 /*
@@ -272,11 +298,72 @@ static int smb_commit_write(struct file *file, struct page *page,
 	return status;
 }
 
+/* Most pages written at once, 64K with 4K pages */
+#define SMB_WRITE_PAGES	16
+
+static int smb_prepare_write_pages(struct file *file, struct page **pages,
+				   int nr, unsigned from, unsigned to)
+{
+	int i;
+
+	if (nr > SMB_WRITE_PAGES)
+		nr = SMB_WRITE_PAGES;
+	for (i = 0; i < nr; i++)
+		kmap(pages[i]);
+	return nr;
+}
+
+/*
+ * Write the consecutive pages with as few requests as the server allows,
+ * rather than page by page.
+ */
+static int smb_commit_write_pages(struct file *file, struct page **pages,
+				  int nr, unsigned from, unsigned to)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	unsigned long offset = (pages[0]->index << PAGE_CACHE_SHIFT) + from;
+	int count = ((nr - 1) << PAGE_CACHE_SHIFT) + to - from;
+	char *vec[SMB_WRITE_PAGES];
+	int i, result;
+
+	for (i = 0; i < nr; i++)
+		vec[i] = page_address(pages[i]);
+
+	VERBOSE("file ino=%ld, fileid=%d, count=%d@%ld, pages=%d\n",
+		inode->i_ino, inode->u.smbfs_i.fileid, count, offset, nr);
+
+	lock_kernel();
+	result = smb_proc_writev(inode, offset, count, vec, from);
+	if (result > 0) {
+		/*
+		 * Update the inode now rather than waiting for a refresh.
+		 */
+		inode->i_mtime = inode->i_atime = CURRENT_TIME;
+		if (offset + result > inode->i_size)
+			inode->i_size = offset + result;
+		inode->u.smbfs_i.cache_valid |= SMB_F_LOCALWRITE;
+	}
+	unlock_kernel();
+
+	for (i = 0; i < nr; i++) {
+		/* The pages in between were written whole */
+		if ((i || !from) && (i < nr - 1 || to == PAGE_CACHE_SIZE) &&
+		    result == count)
+			SetPageUptodate(pages[i]);
+		kunmap(pages[i]);
+	}
+	if (result < 0)
+		return result;
+	return result < count ? -EIO : 0;
+}
+
 struct address_space_operations smb_file_aops = {
 	readpage: smb_readpage,
 	writepage: smb_writepage,
 	prepare_write: smb_prepare_write,
-	commit_write: smb_commit_write
+	commit_write: smb_commit_write,
+	prepare_write_pages: smb_prepare_write_pages,
+	commit_write_pages: smb_commit_write_pages,
 };
 
 /* 
@@ -796,20 +796,15 @@ out_putf:
 	goto out;
 }
 
-/* smb_setup_header: We completely set up the packet. You only have to
-   insert the command-specific fields */
+/* smb_setup_header_buf: set up the header of a request in buf, the
+   length includes bcc bytes following the parameter words */
 
-__u8 *
-smb_setup_header(struct smb_sb_info * server, __u8 command, __u16 wct, __u16 bcc)
+static __u8 *
+smb_setup_header_buf(struct smb_sb_info * server, __u8 *buf, __u8 command,
+		     __u16 wct, __u16 bcc)
 {
 	__u32 xmit_len = SMB_HEADER_LEN + wct * sizeof(__u16) + bcc + 2;
-	__u8 *p = server->packet;
-	__u8 *buf = server->packet;
-
-	if (xmit_len > server->packet_size)
-		printk(KERN_DEBUG "smb_setup_header: "
-		       "Aieee, xmit len > packet! len=%d, size=%d\n",
-		       xmit_len, server->packet_size);
+	__u8 *p = buf;
 
 	p = smb_encode_smb_length(p, xmit_len - 4);
 
@@ -839,6 +834,22 @@ smb_setup_header(struct smb_sb_info * server, __u8 command, __u16 wct, __u16 bcc
 	return p + 2;
 }
 
+/* smb_setup_header: We completely set up the packet. You only have to
+   insert the command-specific fields */
+
+__u8 *
+smb_setup_header(struct smb_sb_info * server, __u8 command, __u16 wct, __u16 bcc)
+{
+	__u32 xmit_len = SMB_HEADER_LEN + wct * sizeof(__u16) + bcc + 2;
+
+	if (xmit_len > server->packet_size)
+		printk(KERN_DEBUG "smb_setup_header: "
+		       "Aieee, xmit len > packet! len=%d, size=%d\n",
+		       xmit_len, server->packet_size);
+
+	return smb_setup_header_buf(server, server->packet, command, wct, bcc);
+}
+
 static void
 smb_setup_bcc(struct smb_sb_info *server, __u8 * p)
 {
@@ -1150,6 +1161,187 @@ smb_proc_write(struct inode *inode, off_t offset, int count, const char *data)
 	return result;
 }
 
+/*
+ * Large reads and writes.  With LANMAN1 and later we use ReadX and
+ * WriteX, with up to SMB_BATCH_MAX of them in flight (no more than the
+ * server's maxmux), and the data goes between the socket and the pages
+ * without passing through the packet.  Servers with the large ReadX and
+ * WriteX capabilities take SMB_RQ_DATA bytes per request, others are
+ * limited by max_xmit.
+ *
+ * The data is given as PAGE_SIZE buffers, starting voff bytes into
+ * vec[0].  Both return the number of bytes transferred, which is less
+ * than count only at the end of the file or when the disk is full.
+ */
+static int
+smb_batch_max(struct smb_sb_info *server)
+{
+	int max = server->opt.maxmux;
+
+	if (max > SMB_BATCH_MAX)
+		max = SMB_BATCH_MAX;
+	if (max < 1)
+		max = 1;
+	return max;
+}
+
+static int
+smb_batch_size(struct smb_sb_info *server, int cap)
+{
+	int size = server->opt.max_xmit - (SMB_HEADER_LEN + 12*2 + 2 + 1);
+
+	if ((server->opt.capabilities & cap) || size > SMB_RQ_DATA)
+		size = SMB_RQ_DATA;
+	return size;
+}
+
+static int
+smb_batch_result(struct smb_sb_info *server, struct smb_batch_req *rq)
+{
+	int result;
+
+	if (rq->rq_rcls == 0)
+		return rq->rq_result;
+	server->rcls = rq->rq_rcls;
+	server->err = rq->rq_err;
+	result = -smb_errno(server);
+	return result ? result : -EIO;
+}
+
+static void
+smb_setup_readx(struct smb_sb_info *server, struct inode *inode,
+		struct smb_batch_req *rq, off_t offset, int count)
+{
+	__u8 *buf = rq->rq_header;
+
+	smb_setup_header_buf(server, buf, SMBreadX, 10, 0);
+	WSET(buf, smb_vwv0, 0x00ff);	/* no AndX command */
+	WSET(buf, smb_vwv1, 0);
+	WSET(buf, smb_vwv2, inode->u.smbfs_i.fileid);
+	DSET(buf, smb_vwv3, offset);
+	WSET(buf, smb_vwv5, count & 0xffff);
+	WSET(buf, smb_vwv6, count & 0xffff);
+	DSET(buf, smb_vwv7, count >> 16);	/* MaxCountHigh */
+	WSET(buf, smb_vwv9, 0);
+	rq->rq_dlen = count;
+}
+
+static void
+smb_setup_writex(struct smb_sb_info *server, struct inode *inode,
+		 struct smb_batch_req *rq, off_t offset, int count)
+{
+	__u8 *buf = rq->rq_header;
+
+	smb_setup_header_buf(server, buf, SMBwriteX, 12, count);
+	WSET(buf, smb_vwv0, 0x00ff);	/* no AndX command */
+	WSET(buf, smb_vwv1, 0);
+	WSET(buf, smb_vwv2, inode->u.smbfs_i.fileid);
+	DSET(buf, smb_vwv3, offset);
+	DSET(buf, smb_vwv5, 0);
+	WSET(buf, smb_vwv7, 0);
+	WSET(buf, smb_vwv8, 0);
+	WSET(buf, smb_vwv9, count >> 16);	/* DataLengthHigh */
+	WSET(buf, smb_vwv10, count & 0xffff);
+	WSET(buf, smb_vwv11, SMB_HEADER_LEN + 12*2 + 2 - 4);
+	rq->rq_dlen = count;
+}
+
+/* Before LANMAN1, one request at a time and within a page */
+static int
+smb_proc_rw_core(struct inode *inode, off_t offset, int count, char **vec,
+		 int voff, int writing)
+{
+	struct smb_sb_info *server = server_from_inode(inode);
+	int size = writing ? smb_get_wsize(server) : smb_get_rsize(server);
+	int done = 0, len, result;
+	char *data;
+
+	while (done < count) {
+		len = PAGE_SIZE - ((voff + done) & ~PAGE_MASK);
+		if (len > count - done)
+			len = count - done;
+		if (len > size)
+			len = size;
+		data = vec[(voff + done) >> PAGE_SHIFT] +
+		       ((voff + done) & ~PAGE_MASK);
+		if (writing)
+			result = smb_proc_write(inode, offset + done, len, data);
+		else
+			result = smb_proc_read(inode, offset + done, len, data);
+		if (result < 0)
+			return result;
+		done += result;
+		if (result < len)
+			break;
+	}
+	return done;
+}
+
+static int
+smb_proc_rw(struct inode *inode, off_t offset, int count, char **vec,
+	    int voff, int writing)
+{
+	struct smb_sb_info *server = server_from_inode(inode);
+	struct smb_batch_req req[SMB_BATCH_MAX];
+	int size, max, pos, len, n, i, done = 0, result = 0;
+
+	if (server->opt.protocol < SMB_PROTOCOL_LANMAN1)
+		return smb_proc_rw_core(inode, offset, count, vec, voff,
+					writing);
+
+	smb_lock_server(server);
+	size = smb_batch_size(server, writing ? SMB_CAP_LARGE_WRITEX :
+						SMB_CAP_LARGE_READX);
+	max = smb_batch_max(server);
+	while (done < count) {
+		for (n = 0, pos = done; n < max && pos < count; n++, pos += len) {
+			len = count - pos;
+			if (len > size)
+				len = size;
+			req[n].rq_vec = vec;
+			req[n].rq_voff = voff + pos;
+			if (writing)
+				smb_setup_writex(server, inode, &req[n],
+						 offset + pos, len);
+			else
+				smb_setup_readx(server, inode, &req[n],
+						offset + pos, len);
+		}
+
+		result = smb_request_batch(server, req, n, !writing);
+		if (result < 0)
+			goto out;
+		for (i = 0; i < n; i++) {
+			result = smb_batch_result(server, &req[i]);
+			if (result < 0)
+				goto out;
+			done += result;
+			if (result < req[i].rq_dlen)
+				goto out;
+		}
+	}
+out:
+	VERBOSE("ino=%ld, fileid=%d, count=%d@%ld, done=%d, result=%d\n",
+		inode->i_ino, inode->u.smbfs_i.fileid, count, offset,
+		done, result);
+	smb_unlock_server(server);
+	return result < 0 ? result : done;
+}
+
+int
+smb_proc_readv(struct inode *inode, off_t offset, int count, char **vec,
+	       int voff)
+{
+	return smb_proc_rw(inode, offset, count, vec, voff, 0);
+}
+
+int
+smb_proc_writev(struct inode *inode, off_t offset, int count, char **vec,
+		int voff)
+{
+	return smb_proc_rw(inode, offset, count, vec, voff, 1);
+}
+
 int
 smb_proc_create(struct dentry *dentry, __u16 attr, time_t ctime, __u16 *fileid)
 {
@@ -707,6 +707,250 @@ bad_no_conn:
 	goto out;
 }
 
+/*
+ * Read and throw away len bytes, using the packet as scratch space.
+ */
+static int
+smb_discard(struct smb_sb_info *server, int len)
+{
+	int chunk, result;
+
+	while (len > 0)
+	{
+		chunk = len < server->packet_size ? len : server->packet_size;
+		result = smb_receive_raw(server_sock(server), server->packet,
+					 chunk);
+		if (result < 0)
+			return result;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Send one request of a batch, with the data of a WriteX straight from
+ * the pages.
+ */
+static int
+smb_send_batch_req(struct socket *sock, struct smb_batch_req *rq,
+		   int reading)
+{
+	struct iovec iov[SMB_RQ_DATA / PAGE_SIZE + 2];
+	struct scm_cookie scm;
+	struct msghdr msg;
+	int len, off, end, chunk, n, err;
+
+	len = SMB_HEADER_LEN + 2 * rq->rq_header[smb_wct] + 2;
+	iov[0].iov_base = (void *) rq->rq_header;
+	iov[0].iov_len = len;
+	n = 1;
+	if (!reading)
+	{
+		end = rq->rq_voff + rq->rq_dlen;
+		for (off = rq->rq_voff; off < end; off += chunk)
+		{
+			chunk = PAGE_SIZE - (off & ~PAGE_MASK);
+			if (chunk > end - off)
+				chunk = end - off;
+			iov[n].iov_base = rq->rq_vec[off >> PAGE_SHIFT] +
+					  (off & ~PAGE_MASK);
+			iov[n].iov_len = chunk;
+			n++;
+		}
+		len += rq->rq_dlen;
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_namelen = 0;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	msg.msg_flags = 0;
+
+	err = scm_send(sock, &msg, &scm);
+	if (err >= 0)
+	{
+		err = sock->ops->sendmsg(sock, &msg, len, &scm);
+		scm_destroy(&scm);
+	}
+	return err;
+}
+
+/*
+ * Receive the next reply of a batch, whichever request it belongs to.
+ * The data of a ReadX goes straight into the pages of the request.
+ */
+static int
+smb_receive_batch_reply(struct smb_sb_info *server,
+			struct smb_batch_req *req, int count, int reading)
+{
+	struct socket *sock = server_sock(server);
+	unsigned char header[SMB_RQ_HEADER];
+	struct smb_batch_req *rq;
+	int len, got, mid, wct, skip, dlen, off, chunk, result;
+
+	result = smb_get_length(sock, header);
+	if (result < 0)
+		return result;
+	len = result + 4;
+	if (len < SMB_HEADER_LEN + 2)
+		goto bad_reply;
+
+	got = SMB_HEADER_LEN;
+	result = smb_receive_raw(sock, header + 4, got - 4);
+	if (result < 0)
+		return result;
+
+	mid = WVAL(header, smb_mid);
+	wct = header[smb_wct];
+	if (mid < 1 || mid > count || req[mid - 1].rq_result != -EINPROGRESS)
+		goto bad_reply;
+	if (SMB_HEADER_LEN + 2 * wct + 2 > SMB_RQ_HEADER ||
+	    SMB_HEADER_LEN + 2 * wct + 2 > len)
+		goto bad_reply;
+	rq = &req[mid - 1];
+
+	result = smb_receive_raw(sock, header + got,
+				 SMB_HEADER_LEN + 2 * wct + 2 - got);
+	if (result < 0)
+		return result;
+	got = SMB_HEADER_LEN + 2 * wct + 2;
+	memcpy(rq->rq_header, header, got);
+	rq->rq_rcls = *(header + smb_rcls);
+	rq->rq_err  = WVAL(header, smb_err);
+	rq->rq_result = -EIO;
+
+	if (rq->rq_rcls == 0 && reading && wct >= 12)
+	{
+		dlen = WVAL(header, smb_vwv5);
+		if (server->opt.capabilities & SMB_CAP_LARGE_READX)
+			dlen |= WVAL(header, smb_vwv7) << 16;
+		skip = WVAL(header, smb_vwv6) + 4 - got;
+		if (skip < 0 || dlen > rq->rq_dlen || got + skip + dlen > len)
+			goto bad_reply;
+		result = smb_discard(server, skip);
+		if (result < 0)
+			return result;
+		got += skip;
+
+		for (off = rq->rq_voff; off < rq->rq_voff + dlen; off += chunk)
+		{
+			chunk = PAGE_SIZE - (off & ~PAGE_MASK);
+			if (chunk > rq->rq_voff + dlen - off)
+				chunk = rq->rq_voff + dlen - off;
+			result = smb_receive_raw(sock,
+				rq->rq_vec[off >> PAGE_SHIFT] + (off & ~PAGE_MASK),
+				chunk);
+			if (result < 0)
+				return result;
+		}
+		got += dlen;
+		rq->rq_result = dlen;
+	}
+	else if (rq->rq_rcls == 0 && !reading && wct >= 6)
+	{
+		rq->rq_result = WVAL(header, smb_vwv2);
+		if (server->opt.capabilities & SMB_CAP_LARGE_WRITEX)
+			rq->rq_result |= WVAL(header, smb_vwv4) << 16;
+	}
+	return smb_discard(server, len - got);
+
+bad_reply:
+	PARANOIA("invalid reply, len=%d, mid=%d, wct=%d\n",
+		 len, WVAL(header, smb_mid), header[smb_wct]);
+	return -EIO;
+}
+
+/*
+ * Send a batch of ReadX (reading) or WriteX requests, then collect the
+ * replies.  The server may answer them in any order; a reply is matched
+ * to its request by the MID, which is the index of the request plus one.
+ *
+ * Returns 0, with the outcome of each request in its rq_result and error
+ * codes, or an error after which the connection is invalid.
+ */
+int
+smb_request_batch(struct smb_sb_info *server, struct smb_batch_req *req,
+		  int count, int reading)
+{
+	unsigned long flags, sigpipe;
+	mm_segment_t fs;
+	sigset_t old_set;
+	int i, result;
+
+	result = -EBADF;
+	if (!server->packet)
+		goto bad_no_packet;
+
+	result = -EIO;
+	if (server->state != CONN_VALID)
+		goto bad_no_conn;
+
+	if ((result = smb_dont_catch_keepalive(server)) != 0)
+		goto bad_conn;
+
+	DEBUG1("count = %d, reading = %d\n", count, reading);
+
+	spin_lock_irqsave(&current->sigmask_lock, flags);
+	sigpipe = sigismember(&current->pending.signal, SIGPIPE);
+	old_set = current->blocked;
+	siginitsetinv(&current->blocked, sigmask(SIGKILL)|sigmask(SIGSTOP));
+	recalc_sigpending(current);
+	spin_unlock_irqrestore(&current->sigmask_lock, flags);
+
+	fs = get_fs();
+	set_fs(get_ds());
+
+	for (i = 0; i < count; i++)
+	{
+		WSET(req[i].rq_header, smb_mid, i + 1);
+		req[i].rq_result = -EINPROGRESS;
+		result = smb_send_batch_req(server_sock(server), &req[i],
+					    reading);
+		if (result < 0)
+			break;
+	}
+	for (i = 0; result >= 0 && i < count; i++)
+		result = smb_receive_batch_reply(server, req, count, reading);
+
+	/* read/write errors are handled by errno */
+	spin_lock_irqsave(&current->sigmask_lock, flags);
+	if (result == -EPIPE && !sigpipe)
+		sigdelset(&current->pending.signal, SIGPIPE);
+	current->blocked = old_set;
+	recalc_sigpending(current);
+	spin_unlock_irqrestore(&current->sigmask_lock, flags);
+
+	set_fs(fs);
+
+	if (result >= 0)
+	{
+		result = smb_catch_keepalive(server);
+		if (result < 0)
+			printk(KERN_ERR "smb_request_batch: catch keepalive failed\n");
+	}
+	if (result < 0)
+		goto bad_conn;
+
+out:
+	DEBUG1("result = %d\n", result);
+	return result;
+
+bad_conn:
+	PARANOIA("result %d, setting invalid\n", result);
+	server->state = CONN_INVALID;
+	smb_invalidate_inodes(server);
+	goto out;
+bad_no_packet:
+	printk(KERN_ERR "smb_request_batch: no packet!\n");
+	goto out;
+bad_no_conn:
+	printk(KERN_ERR "smb_request_batch: connection %d not valid!\n",
+	       server->state);
+	goto out;
+}
+
 #define ROUND_UP(x) (((x)+3) & ~3)
 static int
 smb_send_trans2(struct smb_sb_info *server, __u16 trans2_command,
@@ -9,6 +9,7 @@
 #include <linux/file.h>
 #include <linux/smp_lock.h>
 #include <linux/highuid.h>
+#include <linux/dirent.h>
 
 #include <asm/uaccess.h>
 
@@ -24,6 +25,41 @@ do_revalidate(struct dentry *dentry)
 	return 0;
 }
 
+/*
+ * st_blocks and st_blksize are approximated with a simple algorithm if
+ * they aren't supported directly by the filesystem. The minix and msdos
+ * filesystems don't keep track of blocks, so they would either have to
+ * be counted explicitly (by delving into the file itself), or by using
+ * this simple algorithm to get a reasonable (although not 100% accurate)
+ * value.
+ */
+
+/*
+ * Use minix fs values for the number of direct and indirect blocks.  The
+ * count is now exact for the minix fs except that it counts zero blocks.
+ * Everything is in units of BLOCK_SIZE until the return, which is in
+ * 512 byte units.
+ */
+#define D_B   7
+#define I_B   (BLOCK_SIZE / sizeof(unsigned short))
+
+static unsigned long approx_blocks(loff_t size)
+{
+	unsigned int blocks, indirect;
+
+	blocks = (size + BLOCK_SIZE - 1) >> BLOCK_SIZE_BITS;
+	if (blocks > D_B) {
+		indirect = (blocks - D_B + I_B - 1) / I_B;
+		blocks += indirect;
+		if (indirect > 1) {
+			indirect = (indirect - 1 + I_B - 1) / I_B;
+			blocks += indirect;
+			if (indirect > 1)
+				blocks++;
+		}
+	}
+	return (BLOCK_SIZE / 512) * blocks;
+}
 
 #if !defined(__alpha__) && !defined(__sparc__) && !defined(__ia64__) && !defined(__s390__) && !defined(__hppa__)
 
@@ -68,7 +104,6 @@ static int cp_old_stat(struct inode * inode, struct __old_kernel_stat * statbuf)
 static int cp_new_stat(struct inode * inode, struct stat * statbuf)
 {
 	struct stat tmp;
-	unsigned int blocks, indirect;
 
 	memset(&tmp, 0, sizeof(tmp));
 	tmp.st_dev = kdev_t_to_nr(inode->i_dev);
@@ -86,37 +121,8 @@ static int cp_new_stat(struct inode * inode, struct stat * statbuf)
 	tmp.st_atime = inode->i_atime;
 	tmp.st_mtime = inode->i_mtime;
 	tmp.st_ctime = inode->i_ctime;
-/*
- * st_blocks and st_blksize are approximated with a simple algorithm if
- * they aren't supported directly by the filesystem. The minix and msdos
- * filesystems don't keep track of blocks, so they would either have to
- * be counted explicitly (by delving into the file itself), or by using
- * this simple algorithm to get a reasonable (although not 100% accurate)
- * value.
- */
-
-/*
- * Use minix fs values for the number of direct and indirect blocks.  The
- * count is now exact for the minix fs except that it counts zero blocks.
- * Everything is in units of BLOCK_SIZE until the assignment to
- * tmp.st_blksize.
- */
-#define D_B   7
-#define I_B   (BLOCK_SIZE / sizeof(unsigned short))
-
 	if (!inode->i_blksize) {
-		blocks = (tmp.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-		if (blocks > D_B) {
-			indirect = (blocks - D_B + I_B - 1) / I_B;
-			blocks += indirect;
-			if (indirect > 1) {
-				indirect = (indirect - 1 + I_B - 1) / I_B;
-				blocks += indirect;
-				if (indirect > 1)
-					blocks++;
-			}
-		}
-		tmp.st_blocks = (BLOCK_SIZE / 512) * blocks;
+		tmp.st_blocks = approx_blocks(tmp.st_size);
 		tmp.st_blksize = BLOCK_SIZE;
 	} else {
 		tmp.st_blocks = inode->i_blocks;
@@ -242,6 +248,41 @@ asmlinkage long sys_newfstat(unsigned int fd, struct stat * statbuf)
 	return err;
 }
 
+/*
+ * The attributes of a getdents_stat() entry.  Called with the parent
+ * directory's i_sem held.
+ */
+int vfs_dirent_stat(struct dentry * dentry, struct dirent_stat * d)
+{
+	struct inode * inode = dentry->d_inode;
+	int error;
+
+	error = do_revalidate(dentry);
+	if (error)
+		return error;
+
+	d->st_size = inode->i_size;
+	if (!inode->i_blksize) {
+		d->st_blocks = approx_blocks(inode->i_size);
+		d->st_blksize = BLOCK_SIZE;
+	} else {
+		d->st_blocks = inode->i_blocks;
+		d->st_blksize = inode->i_blksize;
+	}
+	d->st_atime = inode->i_atime;
+	d->st_mtime = inode->i_mtime;
+	d->st_ctime = inode->i_ctime;
+	d->st_uid = inode->i_uid;
+	d->st_gid = inode->i_gid;
+	d->st_nlink = inode->i_nlink;
+	d->st_rdev = kdev_t_to_nr(inode->i_rdev);
+	d->st_mode = inode->i_mode;
+	if (d->d_type == DT_UNKNOWN)
+		d->d_type = (inode->i_mode >> 12) & 15;
+	d->d_flags |= DIRENT_STAT_VALID;
+	return 0;
+}
+
 asmlinkage long sys_readlink(const char * path, char * buf, int bufsiz)
 {
 	struct nameidata nd;
@@ -272,7 +313,6 @@ asmlinkage long sys_readlink(const char * path, char * buf, int bufsiz)
 static long cp_new_stat64(struct inode * inode, struct stat64 * statbuf)
 {
 	struct stat64 tmp;
-	unsigned int blocks, indirect;
 
 	memset(&tmp, 0, sizeof(tmp));
 	tmp.st_dev = kdev_t_to_nr(inode->i_dev);
@@ -289,37 +329,8 @@ static long cp_new_stat64(struct inode * inode, struct stat64 * statbuf)
 	tmp.st_mtime = inode->i_mtime;
 	tmp.st_ctime = inode->i_ctime;
 	tmp.st_size = inode->i_size;
-/*
- * st_blocks and st_blksize are approximated with a simple algorithm if
- * they aren't supported directly by the filesystem. The minix and msdos
- * filesystems don't keep track of blocks, so they would either have to
- * be counted explicitly (by delving into the file itself), or by using
- * this simple algorithm to get a reasonable (although not 100% accurate)
- * value.
- */
-
-/*
- * Use minix fs values for the number of direct and indirect blocks.  The
- * count is now exact for the minix fs except that it counts zero blocks.
- * Everything is in units of BLOCK_SIZE until the assignment to
- * tmp.st_blksize.
- */
-#define D_B   7
-#define I_B   (BLOCK_SIZE / sizeof(unsigned short))
-
 	if (!inode->i_blksize) {
-		blocks = (tmp.st_size + BLOCK_SIZE - 1) >> BLOCK_SIZE_BITS;
-		if (blocks > D_B) {
-			indirect = (blocks - D_B + I_B - 1) / I_B;
-			blocks += indirect;
-			if (indirect > 1) {
-				indirect = (indirect - 1 + I_B - 1) / I_B;
-				blocks += indirect;
-				if (indirect > 1)
-					blocks++;
-			}
-		}
-		tmp.st_blocks = (BLOCK_SIZE / 512) * blocks;
+		tmp.st_blocks = approx_blocks(tmp.st_size);
 		tmp.st_blksize = BLOCK_SIZE;
 	} else {
 		tmp.st_blocks = inode->i_blocks;
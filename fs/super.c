@@ -30,6 +30,7 @@
 #include <linux/init.h>
 #include <linux/quotaops.h>
 #include <linux/acct.h>
+#include <linux/genhd.h>
 
 #include <asm/uaccess.h>
 
@@ -465,6 +466,7 @@ static struct proc_fs_info {
 	{ MS_MANDLOCK, ",mand" },
 	{ MS_NOATIME, ",noatime" },
 	{ MS_NODIRATIME, ",nodiratime" },
+	{ MS_RELATIME, ",relatime" },
 #ifdef MS_NOSUB			/* Can't find this except in mount.c */
 	{ MS_NOSUB, ",nosub" },
 #endif
@@ -710,6 +712,8 @@ struct super_block *get_empty_super(void)
 		nr_super_blocks++;
 		memset(s, 0, sizeof(struct super_block));
 		INIT_LIST_HEAD(&s->s_dirty);
+		INIT_LIST_HEAD(&s->s_io);
+		sema_init(&s->s_sync_sem, 1);
 		list_add (&s->s_list, super_blocks.prev);
 		init_waitqueue_head(&s->s_wait);
 		INIT_LIST_HEAD(&s->s_files);
@@ -730,6 +734,7 @@ static struct super_block * read_super(kdev_t dev, struct block_device *bdev,
 	s->s_bdev = bdev;
 	s->s_flags = flags;
 	s->s_dirt = 0;
+	s->s_max_readahead = 0;
 	sema_init(&s->s_vfs_rename_sem,1);
 	sema_init(&s->s_nfsd_free_path_sem,1);
 	s->s_type = type;
@@ -1471,6 +1476,9 @@ void __init mount_root(void)
 	char path[64];
 	int path_start = -1;
 
+	/* the root device may be a partition still being looked for */
+	partition_check_sync();
+
 #ifdef CONFIG_ROOT_NFS
 	void *data;
 	if (MAJOR(ROOT_DEV) != UNNAMED_MAJOR)
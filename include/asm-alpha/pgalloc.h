@@ -2,6 +2,7 @@
 #define _ALPHA_PGALLOC_H
 
 #include <linux/config.h>
+#include <linux/pgtcache.h>
 
 #ifndef __EXTERN_INLINE
 #define __EXTERN_INLINE extern inline
@@ -328,7 +329,12 @@ extern void __bad_pmd(pgd_t *pgd);
 #define pmd_free_kernel(pmd)	free_pmd_fast(pmd)
 #define pmd_free(pmd)		free_pmd_fast(pmd)
 #define pgd_free(pgd)		free_pgd_fast(pgd)
-#define pgd_alloc()		get_pgd_fast()
+
+static inline pgd_t *pgd_alloc(void)
+{
+	pgt_cache_count(pgd_quicklist != NULL);
+	return get_pgd_fast();
+}
 
 static inline pte_t * pte_alloc(pmd_t *pmd, unsigned long address)
 {
@@ -336,6 +342,7 @@ static inline pte_t * pte_alloc(pmd_t *pmd, unsigned long address)
 	if (pmd_none(*pmd)) {
 		pte_t *page = get_pte_fast();
 		
+		pgt_cache_count(page != NULL);
 		if (!page)
 			return get_pte_slow(pmd, address);
 		pmd_set(pmd, page);
@@ -354,6 +361,7 @@ static inline pmd_t * pmd_alloc(pgd_t *pgd, unsigned long address)
 	if (pgd_none(*pgd)) {
 		pmd_t *page = get_pmd_fast();
 		
+		pgt_cache_count(page != NULL);
 		if (!page)
 			return get_pmd_slow(pgd, address);
 		pgd_set(pgd, page);
@@ -71,7 +71,7 @@ struct thread_struct {
 	vm_mm:		&init_mm,			\
 	vm_page_prot:	PAGE_SHARED,			\
 	vm_flags:	VM_READ | VM_WRITE | VM_EXEC,	\
-	vm_avl_height:	1,				\
+	vm_rb:		{ rb_color: RB_BLACK },	\
 }
 
 #define INIT_THREAD  {					\
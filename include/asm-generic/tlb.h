@@ -0,0 +1,103 @@
+/*
+ * linux/include/asm-generic/tlb.h
+ *
+ * Batched TLB shootdown for page table teardown.
+ *
+ * While ptes are cleared, the pages they mapped are queued in an
+ * mmu_gather instead of being freed. Another CPU may still be using a
+ * stale translation for them, so the TLBs are flushed once for the
+ * whole batch, and only then do the pages go. A gather that fills up
+ * is flushed early.
+ *
+ * If no other CPU can have the mm loaded there is nobody to race
+ * with, and the pages are freed right away.  That is decided from the
+ * users of the mm, not from cpu_vm_mask: another thread of the mm can
+ * be scheduled onto another CPU while the range is being torn down.
+ */
+
+#ifndef _ASM_GENERIC_TLB_H
+#define _ASM_GENERIC_TLB_H
+
+#include <linux/config.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <asm/pgalloc.h>
+
+/* Sized so that a gather is about a page */
+#define FREE_PTE_NR	1000
+
+/* Flushing more than this many pages as a range costs more than a full flush */
+#define TLB_FLUSH_ALL_NR	64
+
+typedef struct mmu_gather {
+	struct mm_struct *	mm;
+	unsigned long		start, end;	/* the range being torn down */
+	unsigned int		nr;		/* pages queued */
+	unsigned int		fast;		/* free the pages right away */
+	unsigned int		need_flush;	/* a present pte was cleared */
+	unsigned int		dead;		/* nobody can use the mm any more */
+	struct page *		pages[FREE_PTE_NR];
+} mmu_gather_t;
+
+/* One per CPU, only used under the page_table_lock of tlb->mm */
+extern mmu_gather_t mmu_gathers[NR_CPUS];
+
+static inline mmu_gather_t *tlb_gather_mmu(struct mm_struct *mm,
+	unsigned long start, unsigned long end)
+{
+	mmu_gather_t *tlb = &mmu_gathers[smp_processor_id()];
+
+	tlb->mm = mm;
+	tlb->start = start;
+	tlb->end = end;
+	tlb->nr = 0;
+	tlb->need_flush = 0;
+	/* exit_mmap(): there are no users left to have it loaded */
+	tlb->dead = !atomic_read(&mm->mm_users);
+	/* or we are its only user, so it cannot run anywhere else */
+	tlb->fast = tlb->dead || smp_num_cpus == 1 ||
+		(atomic_read(&mm->mm_users) == 1 && mm == current->mm);
+	return tlb;
+}
+
+static inline void tlb_flush_mmu(mmu_gather_t *tlb)
+{
+	unsigned int i;
+
+	if (tlb->need_flush) {
+		if (((tlb->end - tlb->start) >> PAGE_SHIFT) > TLB_FLUSH_ALL_NR)
+			flush_tlb_mm(tlb->mm);
+		else
+			flush_tlb_range(tlb->mm, tlb->start, tlb->end);
+		tlb->need_flush = 0;
+	}
+	for (i = 0; i < tlb->nr; i++)
+		free_page_and_swap_cache(tlb->pages[i]);
+	tlb->nr = 0;
+}
+
+/* A present pte for address has been cleared */
+static inline void tlb_remove_tlb_entry(mmu_gather_t *tlb, unsigned long address)
+{
+	if (!tlb->dead)
+		tlb->need_flush = 1;
+}
+
+/* Drop the reference a cleared pte held on page, once it is safe to */
+static inline void tlb_remove_page(mmu_gather_t *tlb, struct page *page)
+{
+	if (tlb->fast) {
+		free_page_and_swap_cache(page);
+		return;
+	}
+	tlb->pages[tlb->nr++] = page;
+	if (tlb->nr == FREE_PTE_NR)
+		tlb_flush_mmu(tlb);
+}
+
+static inline void tlb_finish_mmu(mmu_gather_t *tlb)
+{
+	tlb_flush_mmu(tlb);
+}
+
+#endif /* _ASM_GENERIC_TLB_H */
@@ -47,6 +47,10 @@ typedef struct user_fxsr_struct elf_fpxregset_t;
 	_r->eax = 0; \
 } while (0)
 
+/* Where to call for a system call, see arch/i386/kernel/sysenter.c */
+#define DLINFO_ARCH_ITEMS	1
+#define ARCH_DLINFO		NEW_AUX_ENT(0, AT_SYSINFO, VSYSCALL_BASE)
+
 #define USE_ELF_CORE_DUMP
 #define ELF_EXEC_PAGESIZE	4096
 
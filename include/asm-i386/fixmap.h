@@ -48,6 +48,7 @@
  * fix-mapped?
  */
 enum fixed_addresses {
+	FIX_VSYSCALL,	/* system call entry page, readable by user mode */
 #ifdef CONFIG_X86_LOCAL_APIC
 	FIX_APIC_BASE,	/* local (CPU) APIC) -- required for SMP or not */
 #endif
@@ -91,6 +92,13 @@ extern void __set_fixmap (enum fixed_addresses idx,
 
 #define __fix_to_virt(x)	(FIXADDR_TOP - ((x) << PAGE_SHIFT))
 
+/*
+ * User mode calls the stub at VSYSCALL_BASE instead of doing int $0x80
+ * itself, and gets SYSENTER where the CPU has it (sysenter.c).  entry.S
+ * knows the address too.
+ */
+#define VSYSCALL_BASE		__fix_to_virt(FIX_VSYSCALL)
+
 extern void __this_fixmap_does_not_exist(void);
 
 /*
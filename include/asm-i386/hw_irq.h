@@ -60,6 +60,9 @@
 extern int irq_vector[NR_IRQS];
 #define IO_APIC_VECTOR(irq)	irq_vector[irq]
 
+/* Set through /proc/irq/N/smp_affinity, ~0UL if never set */
+extern unsigned long irq_affinity[NR_IRQS];
+
 /*
  * Various low-level irq details needed by irq.c, process.c,
  * time.c, io_apic.c and smp.c
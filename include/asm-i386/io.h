@@ -160,6 +160,12 @@ extern void iounmap(void *addr);
 #define virt_to_bus virt_to_phys
 #define bus_to_virt phys_to_virt
 
+/*
+ * A highmem page has no virtual address to pass to virt_to_phys(),
+ * and with PAE it can be above 4GB.
+ */
+#define page_to_phys(page)	((dma64_addr_t) ((page) - mem_map) << PAGE_SHIFT)
+
 /*
  * readX/writeX() are used to access memory mapped devices. On some
  * architectures the memory mapped IO stuff needs to be accessed
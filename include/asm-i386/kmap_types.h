@@ -4,6 +4,8 @@
 enum km_type {
 	KM_BOUNCE_READ,
 	KM_BOUNCE_WRITE,
+	KM_USER0,
+	KM_USER1,
 	KM_TYPE_NR
 };
 
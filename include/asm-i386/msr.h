@@ -34,3 +34,13 @@
 #define MSR_IA32_PLATFORM_ID	0x17
 #define MSR_IA32_UCODE_WRITE	0x79
 #define MSR_IA32_UCODE_REV	0x8B
+
+#define MSR_IA32_SYSENTER_CS	0x174
+#define MSR_IA32_SYSENTER_ESP	0x175
+#define MSR_IA32_SYSENTER_EIP	0x176
+
+#define MSR_P6_PERFCTR0		0xc1
+#define MSR_P6_EVNTSEL0		0x186
+
+#define MSR_K7_EVNTSEL0		0xc0010000
+#define MSR_K7_PERFCTR0		0xc0010004
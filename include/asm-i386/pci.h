@@ -77,6 +77,28 @@ extern inline void pci_unmap_single(struct pci_dev *hwdev, dma_addr_t dma_addr,
 	/* Nothing to do */
 }
 
+/* Map a single page, or part of it, for DMA in streaming mode.  The
+ * page need not have a kernel virtual address, so this can be used for
+ * highmem.  It has to be below the device's dma_mask, which for a block
+ * device is what blk_queue_bounce_limit() ensures.
+ */
+extern inline dma_addr_t pci_map_page(struct pci_dev *hwdev, struct page *page,
+				      unsigned long offset, size_t size,
+				      int direction)
+{
+	if (direction == PCI_DMA_NONE)
+		BUG();
+	return (dma_addr_t) page_to_phys(page) + offset;
+}
+
+extern inline void pci_unmap_page(struct pci_dev *hwdev, dma_addr_t dma_address,
+				  size_t size, int direction)
+{
+	if (direction == PCI_DMA_NONE)
+		BUG();
+	/* Nothing to do */
+}
+
 /* Map a set of buffers described by scatterlist in streaming
  * mode for DMA.  This is the scather-gather version of the
  * above pci_map_single interface.  Here the scatter gather list
@@ -155,13 +177,52 @@ extern inline int pci_dma_supported(struct pci_dev *hwdev, dma_addr_t mask)
 	return 1;
 }
 
+/* Devices that drive all 64 address bits with PCI dual address
+ * cycles can reach every page directly, PAE highmem above 4GB too.
+ * Such a device checks pci_dac_dma_supported() and then uses these
+ * in place of pci_map_page()/pci_unmap_page(); there is nothing to
+ * map or unmap.
+ */
+extern inline int pci_dac_dma_supported(struct pci_dev *hwdev, u64 mask)
+{
+	return mask == 0xffffffffffffffffULL;
+}
+
+extern inline dma64_addr_t pci_dac_page_to_dma(struct pci_dev *hwdev,
+					       struct page *page,
+					       unsigned long offset,
+					       int direction)
+{
+	return page_to_phys(page) + offset;
+}
+
+extern inline struct page *pci_dac_dma_to_page(struct pci_dev *hwdev,
+					       dma64_addr_t dma_addr)
+{
+	return mem_map + (unsigned long) (dma_addr >> PAGE_SHIFT);
+}
+
+extern inline unsigned long pci_dac_dma_to_offset(struct pci_dev *hwdev,
+						  dma64_addr_t dma_addr)
+{
+	return (unsigned long) dma_addr & ~PAGE_MASK;
+}
+
+extern inline void pci_dac_dma_sync_single(struct pci_dev *hwdev,
+					   dma64_addr_t dma_addr,
+					   size_t len, int direction)
+{
+	/* Nothing to do */
+}
+
 /* These macros should be used after a pci_map_sg call has been done
  * to get bus addresses of each of the SG entries and their lengths.
  * You should only work with the number of sg entries pci_map_sg
  * returns, or alternatively stop on the first sg_dma_len(sg) which
  * is 0.
  */
-#define sg_dma_address(sg)	(virt_to_bus((sg)->address))
+#define sg_dma_address(sg)	((sg)->address ? virt_to_bus((sg)->address) : \
+				 (dma_addr_t) page_to_phys((sg)->page) + (sg)->offset)
 #define sg_dma_len(sg)		((sg)->length)
 
 #endif /* __KERNEL__ */
@@ -0,0 +1,55 @@
+#ifndef _ASM_I386_PERFPROF_H
+#define _ASM_I386_PERFPROF_H
+
+/*
+ * Performance counter sampling profiler, /dev/cpu/perfprof.
+ * See arch/i386/kernel/perfprof.c.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PERFPROF_COUNTERS	4	/* P6 has 2, the Athlon 4 */
+#define PERFPROF_MIN_COUNT	10000	/* fewer events per sample is a lockup */
+
+/* perfprof_counter.flags */
+#define PERFPROF_USER		0x01	/* count in user mode */
+#define PERFPROF_KERNEL		0x02	/* count in kernel mode */
+
+struct perfprof_counter {
+	unsigned int	event;		/* event select; count 0: unused */
+	unsigned int	unit_mask;
+	unsigned int	count;		/* events between samples */
+	unsigned int	flags;
+};
+
+struct perfprof_config {
+	struct perfprof_counter	counter[PERFPROF_COUNTERS];
+};
+
+/* perfprof_sample.flags */
+#define PERFPROF_SAMPLE_USER	0x01	/* eip is a user address */
+
+struct perfprof_sample {
+	unsigned long	eip;
+	pid_t		pid;
+	unsigned short	event;		/* event | unit_mask << 8 */
+	unsigned char	cpu;
+	unsigned char	flags;
+};
+
+struct perfprof_stats {
+	unsigned long	samples;	/* taken */
+	unsigned long	lost;		/* dropped, the buffer was full */
+};
+
+#define PERFPROF_START	_IOW(0xB4, 0, struct perfprof_config)
+#define PERFPROF_STOP	_IO(0xB4, 1)
+#define PERFPROF_STATS	_IOR(0xB4, 2, struct perfprof_stats)
+
+#ifdef __KERNEL__
+struct pt_regs;
+extern int perfprof_nmi(struct pt_regs *regs);
+#endif
+
+#endif /* _ASM_I386_PERFPROF_H */
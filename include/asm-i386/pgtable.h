@@ -205,6 +205,7 @@ extern unsigned long empty_zero_page[1024];
 #define PAGE_KERNEL MAKE_GLOBAL(__PAGE_KERNEL)
 #define PAGE_KERNEL_RO MAKE_GLOBAL(__PAGE_KERNEL_RO)
 #define PAGE_KERNEL_NOCACHE MAKE_GLOBAL(__PAGE_KERNEL_NOCACHE)
+#define PAGE_KERNEL_VSYSCALL MAKE_GLOBAL(__PAGE_KERNEL_RO | _PAGE_USER)
 
 /*
  * The i386 can't do page protection for execute, and considers that
@@ -253,6 +254,23 @@ extern void __handle_bad_pmd_kernel(pmd_t * pmd);
 #define pmd_clear(xp)	do { set_pmd(xp, __pmd(0)); } while (0)
 #define	pmd_bad(x)	((pmd_val(x) & (~PAGE_MASK & ~_PAGE_USER)) != _KERNPG_TABLE)
 
+#ifdef CONFIG_BIGPAGES
+/*
+ * Big pages for user space, see linux/bigpages.h: one PSE pmd entry
+ * maps 4MB, or 2MB with PAE.
+ */
+#define BIGPAGE_SHIFT	PMD_SHIFT
+#define BIGPAGE_SIZE	(1UL << BIGPAGE_SHIFT)
+#define BIGPAGE_MASK	(~(BIGPAGE_SIZE-1))
+#define BIGPAGE_ORDER	(BIGPAGE_SHIFT - PAGE_SHIFT)
+
+#define pmd_big(x)	(pmd_val(x) & _PAGE_PSE)
+#define pmd_big_page(x)	(mem_map + (unsigned long) (pmd_val(x) >> PAGE_SHIFT))
+#define mk_pmd_big(page, pgprot) \
+	__pmd(((unsigned long long) ((page) - mem_map) << PAGE_SHIFT) | \
+	      pgprot_val(pgprot) | _PAGE_PSE)
+#endif
+
 /*
  * Permanent address of a page. Obviously must never be
  * called on a highmem page.
@@ -350,9 +350,11 @@ struct tss_struct {
 	unsigned short	trace, bitmap;
 	unsigned long	io_bitmap[IO_BITMAP_SIZE+1];
 	/*
-	 * pads the TSS to be cacheline-aligned (size is 0x100)
+	 * pads the TSS to be cacheline-aligned (size is 0x200). SYSENTER
+	 * arrives with %esp at the end of this, and an NMI or debug trap
+	 * in its first instruction uses it as stack, see entry.S.
 	 */
-	unsigned long __cacheline_filler[5];
+	unsigned long	sysenter_stack[69];
 };
 
 struct thread_struct {
@@ -387,7 +389,7 @@ struct thread_struct {
 }
 
 #define INIT_MMAP \
-{ &init_mm, 0, 0, NULL, PAGE_SHARED, VM_READ | VM_WRITE | VM_EXEC, 1, NULL, NULL }
+{ &init_mm, 0, 0, NULL, PAGE_SHARED, VM_READ | VM_WRITE | VM_EXEC, { NULL, RB_BLACK, NULL, NULL } }
 
 #define INIT_TSS  {						\
 	0,0, /* back_link, __blh */				\
@@ -472,4 +474,31 @@ extern inline void rep_nop(void)
 	__asm__ __volatile__("rep;nop");
 }
 
+/* Prefetch instructions for Pentium III/4 and AMD Athlon, see
+   <linux/prefetch.h> */
+#if defined(CONFIG_M686FXSR) || defined(CONFIG_MPENTIUM4)
+
+#define ARCH_HAS_PREFETCH
+extern inline void prefetch(const void *x)
+{
+	__asm__ __volatile__ ("prefetcht0 (%0)" : : "r"(x));
+}
+
+#elif defined(CONFIG_X86_USE_3DNOW)
+
+#define ARCH_HAS_PREFETCH
+#define ARCH_HAS_PREFETCHW
+
+extern inline void prefetch(const void *x)
+{
+	__asm__ __volatile__ ("prefetch (%0)" : : "r"(x));
+}
+
+extern inline void prefetchw(const void *x)
+{
+	__asm__ __volatile__ ("prefetchw (%0)" : : "r"(x));
+}
+
+#endif
+
 #endif /* __ASM_I386_PROCESSOR_H */
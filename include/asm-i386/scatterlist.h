@@ -2,9 +2,12 @@
 #define _I386_SCATTERLIST_H
 
 struct scatterlist {
-    char *  address;    /* Location data is to be transferred to */
+    char *  address;    /* Location data is to be transferred to,
+			 * NULL for a page without a kernel mapping */
     char * alt_address; /* Location of actual if address is a 
 			 * dma indirect buffer.  NULL otherwise */
+    struct page * page; /* Location, if address is NULL (highmem) */
+    unsigned int offset;/* into page */
     unsigned int length;
 };
 
@@ -1,6 +1,7 @@
 #ifndef __ASM_SPINLOCK_H
 #define __ASM_SPINLOCK_H
 
+#include <linux/config.h>
 #include <asm/atomic.h>
 #include <asm/rwlock.h>
 #include <asm/page.h>
@@ -14,6 +15,23 @@ extern int printk(const char * fmt, ...)
  */
 #define SPINLOCK_DEBUG	0
 
+#ifdef CONFIG_LOCKMETER
+/*
+ * Lock metering, see arch/i386/kernel/lockmeter.c.  While it is switched
+ * on the lock operations go through out of line versions which account
+ * each acquisition to the lock and the place it was taken from.  A lock
+ * taken for writing remembers that place until it is released.
+ */
+struct lockmeter_stat;
+extern int lockmeter_enabled;
+
+#define LOCKMETER_FIELDS \
+	struct lockmeter_stat *meter;	/* taken while metering, from here */ \
+	unsigned int held_since;	/* TSC */
+#else
+#define LOCKMETER_FIELDS
+#endif
+
 /*
  * Your basic SMP spinlocks, allowing only a single CPU anywhere
  */
@@ -23,6 +41,7 @@ typedef struct {
 #if SPINLOCK_DEBUG
 	unsigned magic;
 #endif
+	LOCKMETER_FIELDS
 } spinlock_t;
 
 #define SPINLOCK_MAGIC	0xdead4ead
@@ -65,7 +84,7 @@ typedef struct {
 #define spin_unlock_string \
 	"movb $1,%0"
 
-static inline int spin_trylock(spinlock_t *lock)
+static inline int __raw_spin_trylock(spinlock_t *lock)
 {
 	char oldval;
 	__asm__ __volatile__(
@@ -75,7 +94,7 @@ static inline int spin_trylock(spinlock_t *lock)
 	return oldval > 0;
 }
 
-static inline void spin_lock(spinlock_t *lock)
+static inline void __raw_spin_lock(spinlock_t *lock)
 {
 #if SPINLOCK_DEBUG
 	__label__ here;
@@ -90,7 +109,7 @@ printk("eip: %p\n", &&here);
 		:"=m" (lock->lock) : : "memory");
 }
 
-static inline void spin_unlock(spinlock_t *lock)
+static inline void __raw_spin_unlock(spinlock_t *lock)
 {
 #if SPINLOCK_DEBUG
 	if (lock->magic != SPINLOCK_MAGIC)
@@ -103,6 +122,39 @@ static inline void spin_unlock(spinlock_t *lock)
 		:"=m" (lock->lock) : : "memory");
 }
 
+#ifdef CONFIG_LOCKMETER
+extern int _metered_spin_trylock(spinlock_t *lock);
+extern void _metered_spin_lock(spinlock_t *lock);
+extern void _metered_spin_unlock(spinlock_t *lock);
+
+static inline int spin_trylock(spinlock_t *lock)
+{
+	if (lockmeter_enabled)
+		return _metered_spin_trylock(lock);
+	return __raw_spin_trylock(lock);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	if (lockmeter_enabled)
+		_metered_spin_lock(lock);
+	else
+		__raw_spin_lock(lock);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	if (lock->meter)
+		_metered_spin_unlock(lock);
+	else
+		__raw_spin_unlock(lock);
+}
+#else
+#define spin_trylock(lock)	__raw_spin_trylock(lock)
+#define spin_lock(lock)		__raw_spin_lock(lock)
+#define spin_unlock(lock)	__raw_spin_unlock(lock)
+#endif
+
 /*
  * Read-write spinlocks, allowing multiple readers
  * but only one writer.
@@ -118,6 +170,7 @@ typedef struct {
 #if SPINLOCK_DEBUG
 	unsigned magic;
 #endif
+	LOCKMETER_FIELDS	/* writers only */
 } rwlock_t;
 
 #define RWLOCK_MAGIC	0xdeaf1eed
@@ -143,7 +196,7 @@ typedef struct {
  */
 /* the spinlock helpers are in arch/i386/kernel/semaphore.c */
 
-static inline void read_lock(rwlock_t *rw)
+static inline void __raw_read_lock(rwlock_t *rw)
 {
 #if SPINLOCK_DEBUG
 	if (rw->magic != RWLOCK_MAGIC)
@@ -152,7 +205,7 @@ static inline void read_lock(rwlock_t *rw)
 	__build_read_lock(rw, "__read_lock_failed");
 }
 
-static inline void write_lock(rwlock_t *rw)
+static inline void __raw_write_lock(rwlock_t *rw)
 {
 #if SPINLOCK_DEBUG
 	if (rw->magic != RWLOCK_MAGIC)
@@ -162,9 +215,9 @@ static inline void write_lock(rwlock_t *rw)
 }
 
 #define read_unlock(rw)		asm volatile("lock ; incl %0" :"=m" ((rw)->lock) : : "memory")
-#define write_unlock(rw)	asm volatile("lock ; addl $" RW_LOCK_BIAS_STR ",%0":"=m" ((rw)->lock) : : "memory")
+#define __raw_write_unlock(rw)	asm volatile("lock ; addl $" RW_LOCK_BIAS_STR ",%0":"=m" ((rw)->lock) : : "memory")
 
-static inline int write_trylock(rwlock_t *lock)
+static inline int __raw_write_trylock(rwlock_t *lock)
 {
 	atomic_t *count = (atomic_t *)lock;
 	if (atomic_sub_and_test(RW_LOCK_BIAS, count))
@@ -173,4 +226,47 @@ static inline int write_trylock(rwlock_t *lock)
 	return 0;
 }
 
+#ifdef CONFIG_LOCKMETER
+extern void _metered_read_lock(rwlock_t *rw);
+extern void _metered_write_lock(rwlock_t *rw);
+extern int _metered_write_trylock(rwlock_t *rw);
+extern void _metered_write_unlock(rwlock_t *rw);
+
+static inline void read_lock(rwlock_t *rw)
+{
+	if (lockmeter_enabled)
+		_metered_read_lock(rw);
+	else
+		__raw_read_lock(rw);
+}
+
+static inline void write_lock(rwlock_t *rw)
+{
+	if (lockmeter_enabled)
+		_metered_write_lock(rw);
+	else
+		__raw_write_lock(rw);
+}
+
+static inline int write_trylock(rwlock_t *rw)
+{
+	if (lockmeter_enabled)
+		return _metered_write_trylock(rw);
+	return __raw_write_trylock(rw);
+}
+
+static inline void write_unlock(rwlock_t *rw)
+{
+	if (rw->meter)
+		_metered_write_unlock(rw);
+	else
+		__raw_write_unlock(rw);
+}
+#else
+#define read_lock(rw)		__raw_read_lock(rw)
+#define write_lock(rw)		__raw_write_lock(rw)
+#define write_trylock(rw)	__raw_write_trylock(rw)
+#define write_unlock(rw)	__raw_write_unlock(rw)
+#endif
+
 #endif /* __ASM_SPINLOCK_H */
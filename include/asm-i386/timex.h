@@ -45,4 +45,8 @@ static inline cycles_t get_cycles (void)
 #endif
 }
 
+#ifdef CONFIG_TSC_ACCOUNTING
+extern unsigned long long cycles_to_ns(cycles_t cycles);
+#endif
+
 #endif
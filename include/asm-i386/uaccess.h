@@ -288,12 +288,21 @@ do {									\
 		: "memory");						\
 } while (0)
 
+/* Copies of copy_user_nt_threshold bytes or more go to the routine
+ * picked at boot, see arch/i386/lib/usercopy.c.
+ */
+extern unsigned long copy_user_nt_threshold;
+unsigned long __copy_to_user_large(void *to, const void *from, unsigned long n);
+unsigned long __copy_from_user_large(void *to, const void *from, unsigned long n);
+
 /* We let the __ versions of copy_from/to_user inline, because they're often
  * used in fast paths and have only a small space overhead.
  */
 static inline unsigned long
 __generic_copy_from_user_nocheck(void *to, const void *from, unsigned long n)
 {
+	if (n >= copy_user_nt_threshold)
+		return __copy_from_user_large(to,from,n);
 	__copy_user_zeroing(to,from,n);
 	return n;
 }
@@ -301,6 +310,8 @@ __generic_copy_from_user_nocheck(void *to, const void *from, unsigned long n)
 static inline unsigned long
 __generic_copy_to_user_nocheck(void *to, const void *from, unsigned long n)
 {
+	if (n >= copy_user_nt_threshold)
+		return __copy_to_user_large(to,from,n);
 	__copy_user(to,from,n);
 	return n;
 }
@@ -227,6 +227,27 @@
 #define __NR_madvise1		219	/* delete when C lib stub is removed */
 #define __NR_getdents64		220
 #define __NR_fcntl64		221
+#define __NR_sched_setaffinity	223
+#define __NR_sched_getaffinity	224
+#define __NR_fadvise64		225
+#define __NR_io_setup		226
+#define __NR_io_destroy		227
+#define __NR_io_getevents	228
+#define __NR_io_submit		229
+#define __NR_io_cancel		230
+#define __NR_epoll_create	231
+#define __NR_epoll_ctl		232
+#define __NR_epoll_wait		233
+#define __NR_rt_sigtimedwait4	234
+#define __NR_splice		235
+#define __NR_futex		236
+#define __NR_mq_open		237
+#define __NR_mq_unlink		238
+#define __NR_mq_timedsend	239
+#define __NR_mq_timedreceive	240
+#define __NR_mq_notify		241
+#define __NR_mq_getsetattr	242
+#define __NR_getdents_stat	243
 
 /* user-visible error numbers are in the range -1 - -124: see <asm-i386/errno.h> */
 
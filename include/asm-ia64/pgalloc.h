@@ -16,6 +16,7 @@
 #include <linux/config.h>
 
 #include <linux/threads.h>
+#include <linux/pgtcache.h>
 
 #include <asm/mmu_context.h>
 #include <asm/processor.h>
@@ -60,6 +61,7 @@ pgd_alloc (void)
 	pgd_t *pgd;
 
 	pgd = get_pgd_fast();
+	pgt_cache_count(pgd != NULL);
 	if (!pgd)
 		pgd = get_pgd_slow();
 	return pgd;
@@ -151,6 +153,7 @@ pte_alloc (pmd_t *pmd, unsigned long vmaddr)
 	if (pmd_none(*pmd)) {
 		pte_t *pte_page = get_pte_fast();
 
+		pgt_cache_count(pte_page != NULL);
 		if (!pte_page)
 			return get_pte_slow(pmd, offset);
 		pmd_set(pmd, pte_page);
@@ -172,6 +175,7 @@ pmd_alloc (pgd_t *pgd, unsigned long vmaddr)
 	if (pgd_none(*pgd)) {
 		pmd_t *pmd_page = get_pmd_fast();
 
+		pgt_cache_count(pmd_page != NULL);
 		if (!pmd_page)
 			pmd_page = get_pmd_slow();
 		if (pmd_page) {
@@ -318,7 +318,7 @@ struct thread_struct {
 
 #define INIT_MMAP {								\
 	&init_mm, PAGE_OFFSET, PAGE_OFFSET + 0x10000000, NULL, PAGE_SHARED,	\
-        VM_READ | VM_WRITE | VM_EXEC, 1, NULL, NULL				\
+        VM_READ | VM_WRITE | VM_EXEC, { NULL, RB_BLACK, NULL, NULL }				\
 }
 
 #define INIT_THREAD {					\
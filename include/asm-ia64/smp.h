@@ -105,8 +105,6 @@ hard_smp_processor_id(void)
 }
 
 #define NO_PROC_ID		(-1)
-#define PROC_CHANGE_PENALTY	20
-
 extern void __init init_smp_config (void);
 extern void smp_do_timer (struct pt_regs *regs);
 
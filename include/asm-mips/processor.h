@@ -153,7 +153,7 @@ struct thread_struct {
 #endif /* !defined (_LANGUAGE_ASSEMBLY) */
 
 #define INIT_MMAP { &init_mm, KSEG0, KSEG1, NULL, PAGE_SHARED, \
-                    VM_READ | VM_WRITE | VM_EXEC, 1, NULL, NULL }
+                    VM_READ | VM_WRITE | VM_EXEC, { NULL, RB_BLACK, NULL, NULL } }
 
 #define INIT_THREAD  { \
         /* \
@@ -30,6 +30,9 @@ extern plat_pg_data_t *plat_node_data[];
 		(((p) - PLAT_NODE_DATA(n)->gendata.node_start_paddr) >> PAGE_SHIFT)
 
 #define numa_node_id()	cputocnode(current->processor)
+#ifdef CONFIG_NUMA
+#define MAX_NUMNODES	MAX_COMPACT_NODES
+#endif
 
 #ifdef CONFIG_DISCONTIGMEM
 
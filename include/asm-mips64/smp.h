@@ -27,8 +27,6 @@ extern struct cpuinfo_mips cpu_data[NR_CPUS];
 
 #define smp_processor_id()	(current->processor)
 
-#define PROC_CHANGE_PENALTY	20
-
 /* Map from cpu id to sequential logical cpu number.  This will only
    not be idempotent when cpus failed to come on-line.  */
 extern int __cpu_number_map[NR_CPUS];
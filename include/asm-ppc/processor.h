@@ -663,7 +663,7 @@ struct thread_struct {
  */
 #define INIT_MMAP { &init_mm, 0, 0x1000, NULL, \
 		    PAGE_SHARED, VM_READ | VM_WRITE | VM_EXEC, \
-		    1, NULL, NULL }
+		    { NULL, RB_BLACK, NULL, NULL } }
 
 /*
  * Return saved PC of a blocked thread. For now, this is the "user" PC
@@ -32,8 +32,6 @@ struct pt_regs;
 extern void smp_message_recv(int, struct pt_regs *);
 
 #define NO_PROC_ID		0xFF            /* No processor magic marker */
-#define PROC_CHANGE_PENALTY	20
-
 /* 1 to 1 mapping on PPC -- Cort */
 #define cpu_logical_map(cpu) (cpu)
 #define cpu_number_map(x) (x)
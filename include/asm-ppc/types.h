@@ -43,6 +43,7 @@ typedef __vector128 vector128;
 
 /* DMA addresses are 32-bits wide */
 typedef u32 dma_addr_t;
+typedef u64 dma64_addr_t;
 
 typedef unsigned short umode_t;
 
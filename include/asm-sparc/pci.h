@@ -26,8 +26,10 @@ extern inline void pcibios_penalize_isa_irq(int irq)
  */
 
 #include <asm/scatterlist.h>
+#include <asm/page.h>
 
 struct pci_dev;
+struct page;
 
 /* Allocate and map kernel buffer using consistent mode DMA for a device.
  * hwdev should be valid struct pci_dev pointer for PCI devices.
@@ -113,6 +115,44 @@ extern inline int pci_dma_supported(struct pci_dev *hwdev, dma_addr_t mask)
 	return 1;
 }
 
+/* No dual address cycle DMA: highmem is bounced for every device,
+ * and the rest of the pci_dac_ interface must not be called.
+ */
+extern inline int pci_dac_dma_supported(struct pci_dev *hwdev, u64 mask)
+{
+	return 0;
+}
+
+extern inline dma64_addr_t pci_dac_page_to_dma(struct pci_dev *hwdev,
+					       struct page *page,
+					       unsigned long offset,
+					       int direction)
+{
+	BUG();
+	return 0;
+}
+
+extern inline struct page *pci_dac_dma_to_page(struct pci_dev *hwdev,
+					       dma64_addr_t dma_addr)
+{
+	BUG();
+	return NULL;
+}
+
+extern inline unsigned long pci_dac_dma_to_offset(struct pci_dev *hwdev,
+						  dma64_addr_t dma_addr)
+{
+	BUG();
+	return 0;
+}
+
+extern inline void pci_dac_dma_sync_single(struct pci_dev *hwdev,
+					   dma64_addr_t dma_addr,
+					   size_t len, int direction)
+{
+	BUG();
+}
+
 #endif /* __KERNEL__ */
 
 #endif /* __SPARC_PCI_H */
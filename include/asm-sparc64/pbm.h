@@ -33,6 +33,16 @@ struct pci_controller_info;
 /* This contains the software state necessary to drive a PCI
  * controller's IOMMU.
  */
+/* Deferred streaming buffer flushes, see pci_iommu.c */
+#define PCI_FLUSH_BATCH	32
+
+struct pci_flush_pending {
+	struct pci_strbuf	*strbuf;
+	u32			vaddr;
+	u32			npages;
+	unsigned long		ctx;
+};
+
 struct pci_iommu {
 	/* This protects the controller's IOMMU and all
 	 * streaming buffers underneath.
@@ -90,6 +100,12 @@ struct pci_iommu {
 	 * 	(device_mask & dma_addr_mask) == dma_addr_mask
 	 */
 	u32 dma_addr_mask;
+
+	/* Streaming buffer flushes of unmapped PCI_DMA_TODEVICE
+	 * mappings, not yet done.
+	 */
+	int			flush_npending;
+	struct pci_flush_pending flush_pending[PCI_FLUSH_BATCH];
 };
 
 /* This describes a PCI bus module's streaming buffer. */
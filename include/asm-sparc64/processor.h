@@ -88,7 +88,7 @@ struct thread_struct {
 #define FAULT_CODE_WINFIXUP	0x08	/* Miss happened during spill/fill	*/
 
 #define INIT_MMAP { &init_mm, 0xfffff80000000000, 0xfffff80001000000, \
-		    NULL, PAGE_SHARED , VM_READ | VM_WRITE | VM_EXEC, 1, NULL, NULL }
+		    NULL, PAGE_SHARED , VM_READ | VM_WRITE | VM_EXEC, { NULL, RB_BLACK, NULL, NULL } }
 
 #define INIT_THREAD  {					\
 /* ksp, wstate, cwp, flags, current_ds, */ 		\
@@ -0,0 +1,136 @@
+#ifndef _LINUX_AIO_H
+#define _LINUX_AIO_H
+
+/*
+ * Asynchronous IO, see fs/aio.c.
+ *
+ * io_setup() creates a context and maps its completion ring into the
+ * process; the context is named by the ring's address. io_submit()
+ * queues iocbs, io_getevents() waits for and takes completions, and
+ * the ring can also be read directly: new events go in at tail, and
+ * whoever takes them moves head.
+ */
+
+#include <linux/types.h>
+
+typedef unsigned long	aio_context_t;
+
+#define IOCB_CMD_PREAD		0
+#define IOCB_CMD_PWRITE		1
+
+/* What userspace hands to io_submit() */
+struct iocb {
+	__u64	aio_data;		/* returned in the event */
+	__u32	aio_key;		/* must be 0 */
+	__u32	aio_reserved1;
+	__u16	aio_lio_opcode;		/* IOCB_CMD_* */
+	__s16	aio_reqprio;		/* must be 0 */
+	__u32	aio_fildes;
+	__u64	aio_buf;
+	__u64	aio_nbytes;
+	__s64	aio_offset;
+	__u64	aio_reserved2;
+	__u64	aio_reserved3;
+};
+
+/* A completion */
+struct io_event {
+	__u64	data;			/* aio_data of the iocb */
+	__u64	obj;			/* the iocb itself */
+	__s64	res;			/* bytes done, or -errno */
+	__s64	res2;
+};
+
+#define AIO_RING_MAGIC			0xa10a10a1
+#define AIO_RING_COMPAT_FEATURES	1
+#define AIO_RING_INCOMPAT_FEATURES	0
+
+/* The start of the ring, the events follow it */
+struct aio_ring {
+	unsigned	id;
+	unsigned	nr;		/* number of io_events */
+	unsigned	head;
+	unsigned	tail;
+
+	unsigned	magic;
+	unsigned	compat_features;
+	unsigned	incompat_features;
+	unsigned	header_length;	/* size of aio_ring */
+
+	struct io_event	io_events[0];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/tqueue.h>
+#include <linux/spinlock.h>
+#include <asm/atomic.h>
+#include <asm/semaphore.h>
+
+struct file;
+struct inode;
+struct kiobuf;
+struct mm_struct;
+
+/*
+ * A request moves at most this many kiobufs, of KIO_MAX_ATOMIC_BYTES
+ * each, directly. A larger one is short, like a short read.
+ */
+#define AIO_MAX_IOBUFS		16
+
+struct kioctx {
+	atomic_t		users;
+	int			dead;
+	struct kioctx		*next;		/* on mm->ioctx_list */
+	aio_context_t		user_id;	/* address of the ring */
+
+	spinlock_t		lock;		/* the lists and reqs_active, irq safe */
+	int			reqs_active;	/* submitted, no event posted yet */
+	int			max_reqs;
+	struct list_head	active_reqs;
+	struct list_head	done_reqs;	/* IO done, waiting to be reaped */
+	wait_queue_head_t	wait;		/* for completions and events */
+
+	struct semaphore	reap_sem;	/* one reaper at a time */
+	struct tq_struct	reap_task;	/* keventd runs the reaper */
+
+	spinlock_t		ring_lock;
+	unsigned		ring_nr;	/* events the ring has room for */
+	unsigned		ring_tail;	/* ours, userspace may scribble on the ring */
+	unsigned long		ring_size;	/* bytes mapped */
+	struct kiobuf		*ring_iobuf;	/* pins the ring pages */
+};
+
+struct kiocb {
+	struct list_head	ki_list;
+	struct kioctx		*ki_ctx;
+	struct file		*ki_filp;
+	struct iocb		*ki_user_obj;
+	__u64			ki_user_data;
+	int			ki_rw;
+	loff_t			ki_pos;
+	size_t			ki_nbytes;
+	size_t			ki_limit;	/* the result is no larger */
+	ssize_t			ki_res;		/* if no kiobufs were queued */
+
+	/* Run in process context once the IO is done, before the event */
+	void			(*ki_done)(struct kiocb *);
+	struct inode		*ki_dio_inode;	/* holds an i_dio_count */
+
+	atomic_t		ki_pending;	/* kiobufs in flight, +1 while submitting */
+	int			ki_nr_iobufs;
+	struct kiobuf		*ki_iobufs[AIO_MAX_IOBUFS];
+};
+
+extern int aio_nr, aio_max_nr;
+
+extern struct kiobuf *aio_map_kiobuf(struct kiocb *iocb, int rw, char *buf, size_t len);
+extern void aio_kiobuf_error(struct kiobuf *iobuf, int err);
+extern void inode_dio_wait(struct inode *inode);
+extern void exit_aio(struct mm_struct *mm);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_AIO_H */
@@ -0,0 +1,55 @@
+/*
+ * linux/include/linux/bigpages.h
+ *
+ * Big pages are physically contiguous, aligned blocks of BIGPAGE_SIZE
+ * that the MMU maps with a single pmd entry, set aside at boot with
+ * "bigpages=". Areas mapping them are marked VM_BIGPAGE; their pages
+ * are never on the LRU lists, in the page cache or in swap.
+ */
+
+#ifndef _LINUX_BIGPAGES_H
+#define _LINUX_BIGPAGES_H
+
+#include <linux/config.h>
+#include <linux/mm.h>
+
+#ifdef CONFIG_BIGPAGES
+
+#define BIGPAGE_NR	(1UL << BIGPAGE_ORDER)	/* small pages per big page */
+
+extern unsigned long nr_bigpages, nr_free_bigpages;
+
+extern void bigpage_add(struct page *);
+extern struct page * alloc_bigpage(void);
+extern void free_bigpage(struct page *);
+extern int bigpage_fault(struct mm_struct *, struct vm_area_struct *,
+			 unsigned long);
+extern int get_bigpage_info(char *);
+
+/* The small page at address, within the big page pmd maps */
+static inline struct page * bigpage_follow(pmd_t pmd, unsigned long address)
+{
+	return pmd_big_page(pmd) + ((address & ~BIGPAGE_MASK) >> PAGE_SHIFT);
+}
+
+/* Unmap a big page, returns the number of small pages it mapped */
+static inline int zap_bigpage(pmd_t * pmd)
+{
+	pmd_clear(pmd);
+	return BIGPAGE_NR;
+}
+
+#else
+
+#define nr_free_bigpages		0UL
+#define pmd_big(pmd)			0
+#define bigpage_follow(pmd, address)	((struct page *) NULL)
+#define zap_bigpage(pmd)		0
+#define alloc_bigpage()			((struct page *) NULL)
+#define free_bigpage(page)		do { } while (0)
+#define bigpage_fault(mm, vma, address)	(-1)
+#define get_bigpage_info(buf)		0
+
+#endif /* CONFIG_BIGPAGES */
+
+#endif /* _LINUX_BIGPAGES_H */
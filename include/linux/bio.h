@@ -0,0 +1,64 @@
+/*
+ * bio.h
+ *
+ * A block I/O described as a vector of page pieces instead of a chain
+ * of block sized buffer_heads.
+ */
+
+#ifndef __LINUX_BIO_H
+#define __LINUX_BIO_H
+
+#include <linux/kdev_t.h>
+#include <linux/mm.h>
+#include <asm/atomic.h>
+
+/*
+ * One piece of the I/O, which never crosses a page boundary.  Offset
+ * and length are multiples of 512 bytes.
+ */
+struct bio_vec {
+	struct page *	bv_page;
+	unsigned int	bv_len;
+	unsigned int	bv_offset;
+};
+
+struct bio;
+typedef void (bio_end_io_t) (struct bio *, int uptodate);
+
+/*
+ * The bio covers bi_size bytes starting at bi_sector of bi_dev, in
+ * the order of its vector.  bi_end_io is called once, when all of it
+ * has completed.
+ *
+ * Queues that know about bios take them whole through their
+ * make_bio_fn.  For all others submit_bio() cuts the bio into
+ * buffer_heads, as large as the alignment of each piece allows, and
+ * feeds them to generic_make_request(); drivers see no difference.
+ */
+struct bio {
+	kdev_t		bi_dev;
+	unsigned long	bi_sector;	/* first 512 byte sector */
+	unsigned int	bi_size;	/* total bytes */
+
+	unsigned short	bi_vcnt;	/* pieces in use */
+	unsigned short	bi_max;		/* pieces allocated */
+	struct bio_vec *bi_io_vec;
+
+	unsigned long	bi_flags;
+	atomic_t	bi_remaining;	/* pieces still in flight, for the shim */
+
+	bio_end_io_t *	bi_end_io;
+	void *		bi_private;	/* for bi_end_io */
+};
+
+#define BIO_UPTODATE	0	/* cleared by the first failed piece */
+
+/* drivers/block/ll_rw_blk.c */
+
+struct bio *	bio_alloc(int gfp_mask, int nr_vecs);
+void		bio_put(struct bio *bio);
+int		bio_add_page(struct bio *bio, struct page *page,
+			     unsigned int len, unsigned int offset);
+void		submit_bio(int rw, struct bio *bio);
+
+#endif /* __LINUX_BIO_H */
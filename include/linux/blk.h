@@ -9,7 +9,9 @@
 /*
  * Spinlock for protecting the request queue which
  * is mucked around with in interrupts on potentially
- * multiple CPU's..
+ * multiple CPU's..  Queues that were given a lock of
+ * their own with blk_queue_lock() use q->queue_lock
+ * instead.
  */
 extern spinlock_t io_request_lock;
 
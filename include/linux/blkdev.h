@@ -11,6 +11,7 @@ struct request_queue;
 typedef struct request_queue request_queue_t;
 struct elevator_s;
 typedef struct elevator_s elevator_t;
+struct bio;
 
 /*
  * Ok, this is an expanded form so that we can use the same
@@ -35,6 +36,7 @@ struct request {
 	kdev_t rq_dev;
 	int cmd;		/* READ or WRITE */
 	int errors;
+	int sync;		/* synchronous writes, queued ahead of the rest */
 	unsigned long sector;
 	unsigned long nr_sectors;
 	unsigned long hard_sector, hard_nr_sectors;
@@ -48,6 +50,7 @@ struct request {
 	struct buffer_head * bhtail;
 	request_queue_t *q;
 	elevator_t *e;
+	unsigned long start_time;	/* jiffies when queued, for disk stats */
 };
 
 #include <linux/elevator.h>
@@ -63,13 +66,16 @@ typedef int (merge_requests_fn) (request_queue_t *q,
 typedef void (request_fn_proc) (request_queue_t *q);
 typedef request_queue_t * (queue_proc) (kdev_t dev);
 typedef int (make_request_fn) (request_queue_t *q, int rw, struct buffer_head *bh);
+typedef int (make_bio_fn) (request_queue_t *q, int rw, struct bio *bio);
 typedef void (plug_device_fn) (request_queue_t *q, kdev_t device);
 typedef void (unplug_device_fn) (void *q);
 
 /*
- * Default nr free requests per queue
+ * Max nr of requests per queue.  The default is picked from the amount
+ * of memory at boot; drivers that can keep more commands in flight grow
+ * their pool with blk_queue_depth().
  */
-#define QUEUE_NR_REQUESTS	256
+#define BLKDEV_MAX_RQ		1024
 
 struct request_queue
 {
@@ -77,6 +83,7 @@ struct request_queue
 	 * the queue request freelist, one for reads and one for writes
 	 */
 	struct list_head	request_freelist[2];
+	int			free_requests[2];
 
 	/*
 	 * Together with queue_head for cacheline sharing
@@ -90,6 +97,11 @@ struct request_queue
 	merge_requests_fn	* merge_requests_fn;
 	make_request_fn		* make_request_fn;
 	plug_device_fn		* plug_device_fn;
+	/*
+	 * Set by drivers that take whole bios, NULL for the others:
+	 * submit_bio() then hands them buffer_heads.
+	 */
+	make_bio_fn		* make_bio_fn;
 	/*
 	 * The queue owner gets to use this for whatever they like.
 	 * ll_rw_blk doesn't touch it.
@@ -113,15 +125,35 @@ struct request_queue
 	char			head_active;
 
 	/*
-	 * Is meant to protect the queue in the future instead of
-	 * io_request_lock
+	 * Protects the request lists and the elevator.  queue_lock points
+	 * at io_request_lock unless the driver hands the queue a lock of
+	 * its own with blk_queue_lock(); request_lock is there for drivers
+	 * that just want one lock per queue.
 	 */
 	spinlock_t		request_lock;
+	spinlock_t		* queue_lock;
+
+	/*
+	 * Size of the request pool.  Half of it is kept for reads: writes
+	 * only ever take from their own free list, reads may also take
+	 * from the write list.
+	 */
+	int			nr_requests;
 
 	/*
-	 * Tasks wait here for free request
+	 * Tasks wait here for free request, one queue per direction.
+	 * They are only woken once batch_requests are free again, so
+	 * they don't take turns at getting a single request each.
 	 */
-	wait_queue_head_t	wait_for_request;
+	int			batch_requests;
+	wait_queue_head_t	wait_for_request[2];
+
+	/*
+	 * Highest page the device can do DMA to, see
+	 * blk_queue_bounce_limit().  Buffers in highmem above it
+	 * are copied through a bounce buffer in low memory.
+	 */
+	unsigned long		bounce_pfn;
 };
 
 struct blk_dev_struct {
@@ -160,8 +192,22 @@ extern void blkdev_release_request(struct request *);
 extern void blk_init_queue(request_queue_t *, request_fn_proc *);
 extern void blk_cleanup_queue(request_queue_t *);
 extern void blk_queue_headactive(request_queue_t *, int);
+extern void blk_queue_lock(request_queue_t *, spinlock_t *);
+extern void blk_queue_depth(request_queue_t *, int);
 extern void blk_queue_pluggable(request_queue_t *, plug_device_fn *);
 extern void blk_queue_make_request(request_queue_t *, make_request_fn *);
+extern void blk_queue_make_bio(request_queue_t *, make_bio_fn *);
+extern void blk_queue_bounce_limit(request_queue_t *, u64);
+
+/*
+ * Limits for blk_queue_bounce_limit(): the default bounces all of
+ * highmem, for drivers that use b_data or req->buffer.
+ */
+extern unsigned long blk_max_low_pfn;
+
+#define BLK_BOUNCE_HIGH		((u64) blk_max_low_pfn << PAGE_SHIFT)
+#define BLK_BOUNCE_4G		0xffffffffULL
+#define BLK_BOUNCE_ANY		0xffffffffffffffffULL
 
 extern int * blk_size[MAX_BLKDEV];
 
@@ -191,8 +237,22 @@ extern int * max_segments[MAX_BLKDEV];
 #define blkdev_next_request(req) blkdev_entry_to_request((req)->queue.next)
 #define blkdev_prev_request(req) blkdev_entry_to_request((req)->queue.prev)
 
+/*
+ * Requests with synchronous writes sit at the front of the queue,
+ * after @head.  Returns the last of them, which is where the elevator
+ * has to start sorting in everything else.
+ */
+static inline struct list_head *blk_sync_tail(request_queue_t *q, struct list_head *head)
+{
+	while (head->next != &q->queue_head &&
+	       blkdev_entry_next_request(head)->sync)
+		head = head->next;
+	return head;
+}
+
 extern void drive_stat_acct (kdev_t dev, int rw,
 					unsigned long nr_sectors, int new_io);
+extern void req_finished_io(struct request *);
 
 static inline int get_hardsect_size(kdev_t dev)
 {
@@ -34,6 +34,8 @@
 enum brlock_indices {
 	BR_GLOBALIRQ_LOCK,
 	BR_NETPROTO_LOCK,
+	BR_FDB_LOCK,		/* bridge forwarding databases */
+	BR_RT6_LOCK,		/* IPv6 routing tree */
 
 	__BR_END
 };
@@ -42,6 +44,8 @@ enum brlock_indices {
 
 #ifdef CONFIG_SMP
 
+#include <linux/threads.h>
+#include <linux/smp.h>
 #include <linux/cache.h>
 #include <linux/spinlock.h>
 
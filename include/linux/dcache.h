@@ -4,6 +4,7 @@
 #ifdef __KERNEL__
 
 #include <asm/atomic.h>
+#include <linux/spinlock.h>
 #include <linux/mount.h>
 
 /*
@@ -58,6 +59,7 @@ static __inline__ unsigned int full_name_hash(const unsigned char * name, unsign
 
 struct dentry {
 	atomic_t d_count;
+	spinlock_t d_lock;		/* d_lookup() against killing and d_move() */
 	unsigned int d_flags;
 	struct inode  * d_inode;	/* Where the name belongs to - NULL is negative */
 	struct dentry * d_parent;	/* parent directory */
@@ -97,7 +99,7 @@ locking rules:
 		big lock	dcache_lock	may block
 d_revalidate:	no		no		yes
 d_hash		no		no		yes
-d_compare:	no		yes		no
+d_compare:	no		yes (or d_lock)	no
 d_delete:	no		yes		no
 d_release:	no		no		yes
 d_iput:		no		no		yes
@@ -16,4 +16,36 @@ struct dirent64 {
 	char		d_name[256];
 };
 
+/*
+ * getdents_stat() records: a dirent64 with the entry's attributes, which
+ * are filled in when the kernel has them cached, or can read them in
+ * with GETDENTS_STAT_READ.  The entries are on the directory's device,
+ * so there is no st_dev.
+ */
+struct dirent_stat {
+	__u64		d_ino;
+	__s64		d_off;
+	__u64		st_size;
+	__u32		st_blocks;
+	__u32		st_blksize;
+	__u32		st_atime;
+	__u32		st_mtime;
+	__u32		st_ctime;
+	__u32		st_uid;
+	__u32		st_gid;
+	__u32		st_nlink;
+	__u32		st_rdev;
+	__u16		st_mode;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	unsigned char	d_flags;
+	char		d_name[256];
+};
+
+/* dirent_stat.d_flags */
+#define DIRENT_STAT_VALID	0x01	/* the st_ fields are filled in */
+
+/* getdents_stat() flags */
+#define GETDENTS_STAT_READ	0x01	/* read in inodes that are not cached */
+
 #endif
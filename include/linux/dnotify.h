@@ -1,25 +1,81 @@
+#ifndef _LINUX_DNOTIFY_H
+#define _LINUX_DNOTIFY_H
+
 /*
  * Directory notification for Linux
  *
  * Copyright 2000 (C) Stephen Rothwell
  */
 
+#include <linux/ioctl.h>
+
+/*
+ * /dev/dnotify: event records queued on a file descriptor.  See
+ * Documentation/dnotify.txt.
+ */
+struct dnotify_watch {
+	int		fd;		/* directory to watch */
+	unsigned int	mask;		/* DN_* events, see linux/fcntl.h */
+};
+
+struct dnotify_event {
+	int		wd;		/* watch, -1 for DNQ_OVERFLOW */
+	unsigned int	mask;		/* DN_* events that happened */
+	unsigned int	len;		/* bytes of name[], NUL padded */
+	char		name[0];	/* file in the directory, or empty */
+};
+
+#define DNQ_OVERFLOW	0x40000000	/* events were lost */
+
+#define DNOTIFY_WATCH	_IOW(0xB5, 0, struct dnotify_watch)	/* returns wd */
+#define DNOTIFY_UNWATCH	_IO(0xB5, 1)				/* arg is wd */
+
+#ifdef __KERNEL__
+
+struct dnotify_queue;
+struct qstr;
+
 struct dnotify_struct {
 	struct dnotify_struct *	dn_next;
 	int			dn_magic;
 	unsigned long		dn_mask;	/* Events to be notified
 						   see linux/fcntl.h */
-	int			dn_fd;
+	int			dn_fd;		/* or wd if dn_queue */
 	struct file *		dn_filp;
+	struct dnotify_queue *	dn_queue;	/* NULL: signal dn_filp's owner */
+	struct dnotify_struct *	dn_qnext;	/* watches of dn_queue */
 };
 
 #define DNOTIFY_MAGIC	0x444E4F54
 
-extern void __inode_dir_notify(struct inode *, unsigned long);
+extern void __inode_dir_notify(struct inode *, unsigned long, struct qstr *);
+extern void __inode_dir_notify_rename(struct inode *, struct qstr *,
+				      struct inode *, struct qstr *);
 extern int fcntl_dirnotify(int, struct file *, unsigned long);
 
-static inline void inode_dir_notify(struct inode *inode, unsigned long event)
+/* name is the file in the directory that changed, if known */
+static inline void inode_dir_notify_name(struct inode *inode,
+					 unsigned long event, struct qstr *name)
 {
 	if ((inode)->i_dnotify_mask & (event))
-		__inode_dir_notify(inode, event);
+		__inode_dir_notify(inode, event, name);
+}
+
+static inline void inode_dir_notify(struct inode *inode, unsigned long event)
+{
+	inode_dir_notify_name(inode, event, NULL);
 }
+
+static inline void inode_dir_notify_rename(struct inode *old_dir,
+					   struct qstr *old_name,
+					   struct inode *new_dir,
+					   struct qstr *new_name)
+{
+	if ((old_dir->i_dnotify_mask | new_dir->i_dnotify_mask) &
+	    (DN_RENAME | DN_DELETE | DN_CREATE))
+		__inode_dir_notify_rename(old_dir, old_name, new_dir, new_name);
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_DNOTIFY_H */
@@ -28,6 +28,9 @@ struct elevator_s
 	elevator_dequeue_fn *dequeue_fn;
 
 	unsigned int queue_ID;
+
+	int fifo_batch;				/* deadline: requests moved per expiry */
+	unsigned long last_expire_check;	/* deadline: jiffies of last scan */
 };
 
 void elevator_noop(struct request *, elevator_t *, struct list_head *, struct list_head *, int);
@@ -35,19 +38,33 @@ int elevator_noop_merge(request_queue_t *, struct request **, struct buffer_head
 void elevator_noop_dequeue(struct request *);
 void elevator_linus(struct request *, elevator_t *, struct list_head *, struct list_head *, int);
 int elevator_linus_merge(request_queue_t *, struct request **, struct buffer_head *, int, int *, int *);
+void elevator_deadline(struct request *, elevator_t *, struct list_head *, struct list_head *, int);
+int elevator_deadline_merge(request_queue_t *, struct request **, struct buffer_head *, int, int *, int *);
 
 typedef struct blkelv_ioctl_arg_s {
 	int queue_ID;
 	int read_latency;
 	int write_latency;
-	int max_bomb_segments;
+	int max_bomb_segments;	/* BLKELV_* elevator type, see below */
 } blkelv_ioctl_arg_t;
 
+/*
+ * Bomb segments are long gone, so the last field of the ioctl argument
+ * now names the elevator. BLKELVGET reports the current one; BLKELVSET
+ * switches to the given one (0 keeps it), in which case the new
+ * elevator starts with its default latencies and the ones passed along
+ * are ignored. For the deadline elevator the latencies are request
+ * expiry times in milliseconds; for linus they are passover counts.
+ */
+#define BLKELV_NOOP	1
+#define BLKELV_LINUS	2
+#define BLKELV_DEADLINE	3
+
 #define BLKELVGET   _IOR(0x12,106,sizeof(blkelv_ioctl_arg_t))
 #define BLKELVSET   _IOW(0x12,107,sizeof(blkelv_ioctl_arg_t))
 
 extern int blkelvget_ioctl(elevator_t *, blkelv_ioctl_arg_t *);
-extern int blkelvset_ioctl(elevator_t *, const blkelv_ioctl_arg_t *);
+extern int blkelvset_ioctl(request_queue_t *, const blkelv_ioctl_arg_t *);
 
 extern void elevator_init(elevator_t *, elevator_t);
 
@@ -112,4 +129,32 @@ static inline int elevator_request_latency(elevator_t * elevator, int rw)
 	elevator_noop_dequeue,		/* dequeue_fn */	\
 	})
 
+/*
+ * The deadline elevator keeps the queue sorted like linus does, but
+ * gives every request an expiry time instead of a passover count, and
+ * uses req->elevator_sequence to hold it (in jiffies, truncated to an
+ * int). Once the oldest read (or, failing that, write) has expired it
+ * is moved to the front of the queue together with up to fifo_batch-1
+ * requests of the same direction that follow it in sector order.
+ */
+#define ELEVATOR_DEADLINE					\
+((elevator_t) {							\
+	0,				/* not used */		\
+								\
+	HZ / 2,				/* read expiry */	\
+	5 * HZ,				/* write expiry */	\
+	0,				/* max_bomb_segments */	\
+								\
+	0,				/* not used */		\
+	0,				/* not used */		\
+								\
+	elevator_deadline,		/* elevator_fn */	\
+	elevator_deadline_merge,	/* elevator_merge_fn */ \
+	elevator_noop_dequeue,		/* dequeue_fn */	\
+								\
+	0,				/* queue_ID */		\
+	16,				/* fifo_batch */	\
+	0,				/* last_expire_check */	\
+	})
+
 #endif
@@ -166,6 +166,7 @@ typedef __u64	Elf64_Word;
 #define AT_PLATFORM 15  /* string identifying CPU for optimizations */
 #define AT_HWCAP  16    /* arch dependent hints at CPU capabilities */
 #define AT_CLKTCK 17	/* frequency at which times() increments */
+#define AT_SYSINFO 32	/* entry point of the system call stub (i386) */
 
 typedef struct dynamic{
   Elf32_Sword d_tag;
@@ -24,10 +24,48 @@ struct ethtool_cmd {
 	u32	reserved[4];
 };
 
+/* Interrupt coalescing.  An rx (tx) interrupt is raised once
+ * rx_coalesce_usecs have passed since the first packet not yet
+ * signalled, or once rx_max_coalesced_frames have arrived, whichever
+ * comes first; zero means the driver or chip default.  The counters
+ * at the end are filled in by ETHTOOL_GCOALESCE and ignored by
+ * ETHTOOL_SCOALESCE; frames per interrupt is rx_frames / interrupts.
+ */
+struct ethtool_coalesce {
+	u32	cmd;
+	u32	rx_coalesce_usecs;
+	u32	rx_max_coalesced_frames;
+	u32	tx_coalesce_usecs;
+	u32	tx_max_coalesced_frames;
+	u32	interrupts;		/* Interrupts handled */
+	u32	rx_frames;		/* Packets received */
+	u32	tx_frames;		/* Transmit completions reaped */
+	u32	reserved[4];
+};
+
+/* Ring sizes.  The *_max_pending values are read-only; a ring the
+ * device does not have reads as zero and must be left at zero.
+ */
+struct ethtool_ringparam {
+	u32	cmd;
+	u32	rx_max_pending;
+	u32	rx_mini_max_pending;
+	u32	rx_jumbo_max_pending;
+	u32	tx_max_pending;
+	u32	rx_pending;		/* Buffers kept posted */
+	u32	rx_mini_pending;
+	u32	rx_jumbo_pending;
+	u32	tx_pending;
+};
+
 
 /* CMDs currently supported */
 #define ETHTOOL_GSET		0x00000001 /* Get settings, non-privileged. */
 #define ETHTOOL_SSET		0x00000002 /* Set settings, privileged. */
+#define ETHTOOL_GCOALESCE	0x00000003 /* Get coalesce config. */
+#define ETHTOOL_SCOALESCE	0x00000004 /* Set coalesce config, priv. */
+#define ETHTOOL_GRINGPARAM	0x00000005 /* Get ring parameters. */
+#define ETHTOOL_SRINGPARAM	0x00000006 /* Set ring parameters, priv. */
 
 /* compatibility with older code */
 #define SPARC_ETH_GSET		ETHTOOL_GSET
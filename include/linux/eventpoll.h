@@ -0,0 +1,51 @@
+#ifndef _LINUX_EVENTPOLL_H
+#define _LINUX_EVENTPOLL_H
+
+/*
+ * Event poll sets, see fs/eventpoll.c.
+ *
+ * epoll_create() makes an epoll file, epoll_ctl() adds, changes and
+ * removes the files it watches, and epoll_wait() takes the events of
+ * those that are ready. The events are the poll() ones.
+ */
+
+#include <linux/types.h>
+#include <asm/poll.h>
+
+#define EPOLL_CTL_ADD	1
+#define EPOLL_CTL_DEL	2
+#define EPOLL_CTL_MOD	3
+
+/* Reported once for each time the file becomes ready, not while it is */
+#define EPOLLET		(1U << 31)
+
+struct epoll_event {
+	__u32	events;			/* POLL*, and EPOLLET for epoll_ctl() */
+	__u64	data;			/* returned with the events */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+struct file;
+
+static inline void eventpoll_init_file(struct file *file)
+{
+	INIT_LIST_HEAD(&file->f_ep_links);
+	spin_lock_init(&file->f_ep_lock);
+}
+
+extern void eventpoll_release_file(struct file *file);
+
+/* Called by fput(), nobody can add the file to a set any more */
+static inline void eventpoll_release(struct file *file)
+{
+	if (!list_empty(&file->f_ep_links))
+		eventpoll_release_file(file);
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_EVENTPOLL_H */
@@ -33,6 +33,13 @@
 #define EXT2_PREALLOCATE
 #define EXT2_DEFAULT_PREALLOC_BLOCKS	8
 
+/*
+ * Sizes of the block reservation windows of regular files, which
+ * replace preallocation for them unless mounted with noreservation
+ */
+#define EXT2_DEFAULT_RESERVE_BLOCKS	8
+#define EXT2_MAX_RESERVE_BLOCKS		1024
+
 /*
  * The second extended file system version
  */
@@ -198,6 +205,7 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */	
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			0x00001000 /* hash-indexed directory */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -314,6 +322,9 @@ struct ext2_inode {
 #define EXT2_MOUNT_ERRORS_PANIC		0x0040	/* Panic on errors */
 #define EXT2_MOUNT_MINIX_DF		0x0080	/* Mimics the Minix statfs */
 #define EXT2_MOUNT_NO_UID32		0x0200  /* Disable 32-bit UIDs */
+#define EXT2_MOUNT_RESERVATION		0x0400	/* Reservation windows for files */
+#define EXT2_MOUNT_OLDALLOC		0x0800	/* Spread all directories out */
+#define EXT2_MOUNT_DELALLOC		0x1000	/* Allocate file blocks at writeback */
 
 #define clear_opt(o, opt)		o &= ~EXT2_MOUNT_##opt
 #define set_opt(o, opt)			o |= EXT2_MOUNT_##opt
@@ -448,6 +459,7 @@ struct ext2_super_block {
 	EXT2_SB(sb)->s_es->s_feature_incompat &= ~cpu_to_le32(mask)
 
 #define EXT2_FEATURE_COMPAT_DIR_PREALLOC	0x0001
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
 
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -456,7 +468,7 @@ struct ext2_super_block {
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
 
-#define EXT2_FEATURE_COMPAT_SUPP	0
+#define EXT2_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_DIR_INDEX
 #define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
@@ -536,10 +548,21 @@ struct ext2_dir_entry_2 {
 extern int ext2_permission (struct inode *, int);
 
 /* balloc.c */
+extern int ext2_alloc_bitmap_cache (struct super_block *,
+				    struct ext2_bitmap_cache *, unsigned int);
+extern void ext2_free_bitmap_cache (struct super_block *,
+				    struct ext2_bitmap_cache *);
+extern int ext2_load_bitmap (struct super_block *,
+			     struct ext2_bitmap_cache *, unsigned int, int);
 extern int ext2_bg_has_super(struct super_block *sb, int group);
 extern unsigned long ext2_bg_num_gdb(struct super_block *sb, int group);
 extern int ext2_new_block (const struct inode *, unsigned long,
+			   struct ext2_reserve_window *,
 			   __u32 *, __u32 *, int *);
+extern void ext2_init_reservation (struct inode *);
+extern void ext2_discard_reservation (struct inode *);
+extern int ext2_reserve_delayed (struct inode *);
+extern void ext2_release_delayed (struct inode *, int);
 extern void ext2_free_blocks (const struct inode *, unsigned long,
 			      unsigned long);
 extern unsigned long ext2_count_free_blocks (struct super_block *);
@@ -622,6 +645,7 @@ extern struct file_operations ext2_file_operations;
 extern struct inode_operations ext2_fast_symlink_inode_operations;
 
 extern struct address_space_operations ext2_aops;
+extern struct address_space_operations ext2_da_aops;
 
 #endif	/* __KERNEL__ */
 
@@ -16,6 +16,19 @@
 #ifndef _LINUX_EXT2_FS_I
 #define _LINUX_EXT2_FS_I
 
+#include <linux/rbtree.h>
+
+/*
+ * A block reservation window, see balloc.c
+ */
+struct ext2_reserve_window {
+	rb_node_t	rsv_node;	/* in the filesystem's tree, by start */
+	__u32		rsv_start;	/* first block of the window */
+	__u32		rsv_end;	/* last block, 0 if there is no window */
+	__u32		rsv_goal_size;	/* blocks the next window should have */
+	__u32		rsv_alloc_hit;	/* blocks the file got from this one */
+};
+
 /*
  * second extended file system inode data in memory
  */
@@ -36,6 +49,9 @@ struct ext2_inode_info {
 	__u32	i_prealloc_block;
 	__u32	i_prealloc_count;
 	__u32	i_high_size;
+	struct ext2_reserve_window i_rsv_window;
+	__u32	i_delayed_blocks;	/* reserved for delayed buffers */
+	__u32	i_ind_readahead;	/* indirect block a sequential read wants next */
 	int	i_new_inode:1;	/* Is a freshly allocated inode */
 };
 
@@ -22,7 +22,26 @@
  */
 /* #define EXT2_MAX_GROUP_DESC	8 */
 
+/*
+ * Bounds on the number of block (and of inode) bitmaps kept per
+ * filesystem.  Within them it is sized from memory at mount time.
+ */
 #define EXT2_MAX_GROUP_LOADED	8
+#define EXT2_MAX_BITMAP_SLOTS	2048
+
+/*
+ * A cache of bitmap buffers, replaced least recently used first.
+ */
+struct ext2_bitmap_cache {
+	unsigned int nr_slots;
+	unsigned int nr_loaded;		/* slots in use */
+	unsigned long *group;		/* group of each slot */
+	struct buffer_head **bh;	/* NULL: the last read failed */
+	unsigned long *used;		/* when each slot was last used */
+	unsigned short *slot;		/* per group: slot + 1, 0 if none */
+	unsigned long hits;
+	unsigned long misses;
+};
 
 /*
  * second extended-fs super-block data in memory
@@ -41,12 +60,10 @@ struct ext2_sb_info {
 	struct buffer_head * s_sbh;	/* Buffer containing the super block */
 	struct ext2_super_block * s_es;	/* Pointer to the super block in the buffer */
 	struct buffer_head ** s_group_desc;
-	unsigned short s_loaded_inode_bitmaps;
-	unsigned short s_loaded_block_bitmaps;
-	unsigned long s_inode_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_inode_bitmap[EXT2_MAX_GROUP_LOADED];
-	unsigned long s_block_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_block_bitmap[EXT2_MAX_GROUP_LOADED];
+	__u8 * s_debts;			/* directories made in a group less files */
+	struct ext2_bitmap_cache s_inode_bitmaps;
+	struct ext2_bitmap_cache s_block_bitmaps;
+	unsigned long s_bitmap_clock;	/* LRU clock of both caches */
 	unsigned long  s_mount_opt;
 	uid_t s_resuid;
 	gid_t s_resgid;
@@ -56,6 +73,10 @@ struct ext2_sb_info {
 	int s_desc_per_block_bits;
 	int s_inode_size;
 	int s_first_ino;
+	spinlock_t s_rsv_window_lock;	/* protects the tree below */
+	rb_root_t s_rsv_window_root;	/* reservation windows by start */
+	spinlock_t s_delayed_lock;	/* protects the counts of delayed blocks */
+	unsigned long s_delayed_blocks;	/* reserved, not yet allocated */
 };
 
 #endif	/* _LINUX_EXT2_FS_SB */
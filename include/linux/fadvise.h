@@ -0,0 +1,12 @@
+#ifndef _LINUX_FADVISE_H
+#define _LINUX_FADVISE_H
+
+/* Advice for fadvise64(), see mm/filemap.c */
+#define POSIX_FADV_NORMAL	0	/* no further special treatment */
+#define POSIX_FADV_RANDOM	1	/* expect random page references */
+#define POSIX_FADV_SEQUENTIAL	2	/* expect sequential page references */
+#define POSIX_FADV_WILLNEED	3	/* will need these pages */
+#define POSIX_FADV_DONTNEED	4	/* don't need these pages */
+#define POSIX_FADV_NOREUSE	5	/* data will be accessed once */
+
+#endif /* _LINUX_FADVISE_H */
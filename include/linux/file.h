@@ -7,6 +7,13 @@
 
 extern void FASTCALL(fput(struct file *));
 extern struct file * FASTCALL(fget(unsigned int fd));
+extern struct file * fget_light(unsigned int fd, int *fput_needed);
+
+static inline void fput_light(struct file *file, int fput_needed)
+{
+	if (fput_needed)
+		fput(file);
+}
  
 static inline int get_close_on_exec(unsigned int fd)
 {
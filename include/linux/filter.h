@@ -31,10 +31,19 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 };
 
 #ifdef __KERNEL__
+#include <linux/config.h>
+
+struct sk_buff;
+
 struct sk_filter
 {
 	atomic_t		refcnt;
         unsigned int         	len;	/* Number of filter blocks */
+#ifdef CONFIG_BPF_JIT
+	/* Native code for insns, or NULL to interpret them */
+	unsigned int		(*bpf_func)(struct sk_buff *skb,
+					    struct sock_filter *filter);
+#endif
         struct sock_filter     	insns[0];
 };
 
@@ -135,6 +144,22 @@ static inline unsigned int sk_filter_len(struct sk_filter *fp)
 #ifdef __KERNEL__
 extern int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int flen);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
+extern int sk_filter_load(struct sk_buff *skb, int k, int size, __u32 *val);
+
+#ifdef CONFIG_BPF_JIT
+extern void bpf_jit_compile(struct sk_filter *fp);
+extern void bpf_jit_free(struct sk_filter *fp);
+
+#define SK_RUN_FILTER(FILTER, SKB) \
+	((FILTER)->bpf_func ? (FILTER)->bpf_func(SKB, (FILTER)->insns) : \
+	 sk_run_filter(SKB, (FILTER)->insns, (FILTER)->len))
+#else
+static inline void bpf_jit_compile(struct sk_filter *fp) { }
+static inline void bpf_jit_free(struct sk_filter *fp) { }
+
+#define SK_RUN_FILTER(FILTER, SKB) \
+	sk_run_filter(SKB, (FILTER)->insns, (FILTER)->len)
+#endif
 #endif /* __KERNEL__ */
 
 #endif /* __LINUX_FILTER_H__ */
@@ -21,6 +21,8 @@
 #include <linux/cache.h>
 #include <linux/stddef.h>
 #include <linux/string.h>
+#include <linux/radix-tree.h>
+#include <linux/rbtree.h>
 
 #include <asm/atomic.h>
 #include <asm/bitops.h>
@@ -55,6 +57,7 @@ struct files_stat_struct {
 extern struct files_stat_struct files_stat;
 extern int max_super_blocks, nr_super_blocks;
 extern int leases_enable, dir_notify_enable, lease_break_time;
+extern int atime_interval;
 
 #define NR_FILE  8192	/* this can well be larger on a larger system */
 #define NR_RESERVED_FILES 10 /* reserved for root */
@@ -106,12 +109,14 @@ extern int leases_enable, dir_notify_enable, lease_break_time;
 #define MS_NOATIME	1024	/* Do not update access times. */
 #define MS_NODIRATIME	2048	/* Do not update directory access times */
 #define MS_BIND		4096
+#define MS_RELATIME	8192	/* Update atime only when it is stale */
 
 /*
  * Flags that can be altered by MS_REMOUNT
  */
 #define MS_RMT_MASK	(MS_RDONLY|MS_NOSUID|MS_NODEV|MS_NOEXEC|\
-			MS_SYNCHRONOUS|MS_MANDLOCK|MS_NOATIME|MS_NODIRATIME)
+			MS_SYNCHRONOUS|MS_MANDLOCK|MS_NOATIME|MS_NODIRATIME|\
+			MS_RELATIME)
 
 /*
  * Magic mount flag number. Has to be or-ed to the flag values.
@@ -155,6 +160,7 @@ extern int leases_enable, dir_notify_enable, lease_break_time;
 #define IS_IMMUTABLE(inode)	((inode)->i_flags & S_IMMUTABLE)
 #define IS_NOATIME(inode)	(__IS_FLG(inode, MS_NOATIME) || ((inode)->i_flags & S_NOATIME))
 #define IS_NODIRATIME(inode)	__IS_FLG(inode, MS_NODIRATIME)
+#define IS_RELATIME(inode)	__IS_FLG(inode, MS_RELATIME)
 
 #define IS_DEADDIR(inode)	((inode)->i_flags & S_DEAD)
 
@@ -196,6 +202,7 @@ extern void update_atime (struct inode *);
 
 extern void buffer_init(unsigned long);
 extern void inode_init(unsigned long);
+extern void files_init(void);
 
 /* bh state bits */
 #define BH_Uptodate	0	/* 1 if the buffer contains valid data */
@@ -205,6 +212,8 @@ extern void inode_init(unsigned long);
 #define BH_Mapped	4	/* 1 if the buffer has a disk mapping */
 #define BH_New		5	/* 1 if the buffer is new and not yet written out */
 #define BH_Protected	6	/* 1 if the buffer is protected */
+#define BH_Delay	7	/* 1 if the buffer has a block reserved, not allocated */
+#define BH_Sync		8	/* 1 if a synchronous caller waits for this write */
 
 /*
  * Try to keep the most commonly used fields in single cache lines (16
@@ -260,6 +269,7 @@ void init_buffer(struct buffer_head *, bh_end_io_t *, void *);
 #define buffer_mapped(bh)	__buffer_state(bh,Mapped)
 #define buffer_new(bh)		__buffer_state(bh,New)
 #define buffer_protected(bh)	__buffer_state(bh,Protected)
+#define buffer_delay(bh)	__buffer_state(bh,Delay)
 
 #define bh_offset(bh)		((unsigned long)(bh)->b_data & ~PAGE_MASK)
 
@@ -351,6 +361,8 @@ struct iattr {
  */
 struct page;
 struct address_space;
+struct kiobuf;
+struct kiocb;
 
 struct address_space_operations {
 	int (*writepage)(struct page *);
@@ -360,6 +372,17 @@ struct address_space_operations {
 	int (*commit_write)(struct file *, struct page *, unsigned, unsigned);
 	/* Unfortunately this kludge is needed for FIBMAP. Don't use it */
 	int (*bmap)(struct address_space *, long);
+	/* O_DIRECT: the kiobuf from block blocknr on, blocks of size */
+	int (*direct_IO)(int, struct inode *, struct kiobuf *, unsigned long, int);
+	/* Truncate: drop buffers from offset on, block_flushpage() if NULL */
+	int (*flushpage)(struct page *, unsigned long);
+	/*
+	 * Optional, prepare_write/commit_write for consecutive locked pages,
+	 * from @from in the first to @to in the last.  prepare returns the
+	 * number of pages prepared or an error.
+	 */
+	int (*prepare_write_pages)(struct file *, struct page **, int, unsigned, unsigned);
+	int (*commit_write_pages)(struct file *, struct page **, int, unsigned, unsigned);
 };
 
 struct address_space {
@@ -372,16 +395,23 @@ struct address_space {
 	struct vm_area_struct	*i_mmap;	/* list of private mappings */
 	struct vm_area_struct	*i_mmap_shared; /* list of shared mappings */
 	spinlock_t		i_shared_lock;  /* and spinlock protecting it */
+	struct radix_tree_root	page_tree;	/* index of all the pages */
+	spinlock_t		page_lock;	/* protects page_tree and the lists */
 };
 
 struct block_device {
 	struct list_head	bd_hash;
 	atomic_t		bd_count;
-/*	struct address_space	bd_data; */
+	struct inode *		bd_inode;	/* page cache of the device */
+	int			bd_fs_users;	/* mounts and swap, under bd_sem */
 	dev_t			bd_dev;  /* not a kdev_t - it's a search key */
 	atomic_t		bd_openers;
 	const struct block_device_operations *bd_op;
 	struct semaphore	bd_sem;	/* open/close mutex */
+	/* how well file readahead is doing on this device, see filemap.c */
+	unsigned long		bd_ra_hits;	/* page was read ahead in time */
+	unsigned long		bd_ra_misses;	/* sequential, but not read ahead */
+	unsigned long		bd_ra_thrashed;	/* read ahead, then evicted */
 };
 
 struct inode {
@@ -404,6 +434,7 @@ struct inode {
 	time_t			i_mtime;
 	time_t			i_ctime;
 	unsigned long		i_blksize;
+	unsigned int		i_blkbits;	/* block size of the page cache */
 	unsigned long		i_blocks;
 	unsigned long		i_version;
 	struct semaphore	i_sem;
@@ -412,7 +443,8 @@ struct inode {
 	struct file_operations	*i_fop;	/* former ->i_op->default_file_ops */
 	struct super_block	*i_sb;
 	wait_queue_head_t	i_wait;
-	struct file_lock	*i_flock;
+	struct file_lock	*i_flock;	/* flock() locks and leases */
+	rb_root_t		i_posix_locks;	/* POSIX locks by fl_start */
 	struct address_space	*i_mapping;
 	struct address_space	i_data;	
 	struct dquot		*i_dquot[MAXQUOTAS];
@@ -423,11 +455,13 @@ struct inode {
 	struct dnotify_struct	*i_dnotify; /* for directory notifications */
 
 	unsigned long		i_state;
+	unsigned long		i_atime_dirtied; /* jiffies, see I_DIRTY_ATIME */
 
 	unsigned int		i_flags;
 	unsigned char		i_sock;
 
 	atomic_t		i_writecount;
+	atomic_t		i_dio_count;	/* aio O_DIRECT requests in flight */
 	unsigned int		i_attr_flags;
 	__u32			i_generation;
 	union {
@@ -467,8 +501,10 @@ struct inode {
 #define I_LOCK			8
 #define I_FREEING		16
 #define I_CLEAR			32
+#define I_DIRTY_ATIME		64 /* Only atime changed, written lazily */
 
 #define I_DIRTY (I_DIRTY_SYNC | I_DIRTY_DATASYNC | I_DIRTY_PAGES)
+#define I_DIRTY_ALL (I_DIRTY | I_DIRTY_ATIME)
 
 extern void __mark_inode_dirty(struct inode *, int);
 static inline void mark_inode_dirty(struct inode *inode)
@@ -483,6 +519,12 @@ static inline void mark_inode_dirty_sync(struct inode *inode)
 		__mark_inode_dirty(inode, I_DIRTY_SYNC);
 }
 
+static inline void mark_inode_dirty_atime(struct inode *inode)
+{
+	if (!(inode->i_state & (I_DIRTY_SYNC | I_DIRTY_ATIME)))
+		__mark_inode_dirty(inode, I_DIRTY_ATIME);
+}
+
 static inline void mark_inode_dirty_pages(struct inode *inode)
 {
 	if (inode && !(inode->i_state & I_DIRTY_PAGES))
@@ -495,6 +537,26 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * Read-ahead state, see generic_file_readahead(). A file can be read
+ * sequentially at a few places at once, each of those is a stream.
+ * All zero is a valid state: one stream starting at the first page.
+ */
+#define RA_STREAMS	4
+
+struct file_ra_stream {
+	unsigned long		next;	/* page we expect to be read next */
+	unsigned long		ahead;	/* first page not read ahead yet */
+	unsigned long		size;	/* current read-ahead window, in pages */
+	unsigned long		stamp;	/* when it was last used */
+};
+
+struct file_ra_state {
+	struct file_ra_stream	streams[RA_STREAMS];
+	unsigned long		stamp;
+	int			advice;	/* POSIX_FADV_*, from fadvise64() */
+};
+
 struct file {
 	struct list_head	f_list;
 	struct dentry		*f_dentry;
@@ -504,7 +566,8 @@ struct file {
 	unsigned int 		f_flags;
 	mode_t			f_mode;
 	loff_t			f_pos;
-	unsigned long 		f_reada, f_ramax, f_raend, f_ralen, f_rawin;
+	unsigned long 		f_reada;
+	struct file_ra_state	f_ra;
 	struct fown_struct	f_owner;
 	unsigned int		f_uid, f_gid;
 	int			f_error;
@@ -513,6 +576,10 @@ struct file {
 
 	/* needed for tty driver, and maybe others */
 	void			*private_data;
+
+	/* the event poll sets watching us, see fs/eventpoll.c */
+	struct list_head	f_ep_links;
+	spinlock_t		f_ep_lock;
 };
 extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
@@ -541,6 +608,8 @@ typedef struct files_struct *fl_owner_t;
 
 struct file_lock {
 	struct file_lock *fl_next;	/* singly linked list for this inode  */
+	rb_node_t fl_rb;		/* POSIX locks: node in i_posix_locks */
+	loff_t fl_rb_end;		/* largest fl_end in this subtree */
 	struct list_head fl_link;	/* doubly linked list of all locks */
 	struct list_head fl_block;	/* circular list of blocked processes */
 	fl_owner_t fl_owner;
@@ -572,6 +641,19 @@ struct file_lock {
 
 extern struct list_head file_lock_list;
 
+/* Walk an inode's POSIX locks in order of fl_start */
+static inline struct file_lock *posix_first_lock(struct inode *inode)
+{
+	rb_node_t *node = rb_first(&inode->i_posix_locks);
+	return node ? rb_entry(node, struct file_lock, fl_rb) : NULL;
+}
+
+static inline struct file_lock *posix_next_lock(struct file_lock *fl)
+{
+	rb_node_t *node = rb_next(&fl->fl_rb);
+	return node ? rb_entry(node, struct file_lock, fl_rb) : NULL;
+}
+
 #include <linux/fcntl.h>
 
 extern int fcntl_getlk(unsigned int, struct flock *);
@@ -630,6 +712,8 @@ struct quota_mount_options
 	time_t inode_expire[MAXQUOTAS];		/* expiretime for inode-quota */
 	time_t block_expire[MAXQUOTAS];		/* expiretime for block-quota */
 	char rsquash[MAXQUOTAS];		/* for quotas threat root as any other user */
+	struct dquot **hash;			/* dquots of this device */
+	unsigned int hash_mask;
 };
 
 /*
@@ -674,10 +758,13 @@ struct super_block {
 	struct dquot_operations	*dq_op;
 	unsigned long		s_flags;
 	unsigned long		s_magic;
+	unsigned long		s_max_readahead; /* pages, 0: by device */
 	struct dentry		*s_root;
 	wait_queue_head_t	s_wait;
 
 	struct list_head	s_dirty;	/* dirty inodes */
+	struct list_head	s_io;		/* dirty inodes being written back */
+	struct semaphore	s_sync_sem;	/* one writeback pass at a time */
 	struct list_head	s_files;
 
 	struct block_device	*s_bdev;
@@ -787,6 +874,11 @@ struct file_operations {
 	int (*lock) (struct file *, int, struct file_lock *);
 	ssize_t (*readv) (struct file *, const struct iovec *, unsigned long, loff_t *);
 	ssize_t (*writev) (struct file *, const struct iovec *, unsigned long, loff_t *);
+	/* Return -EIOCBQUEUED if the request completes later, see fs/aio.c */
+	ssize_t (*aio_read) (struct kiocb *, char *, size_t, loff_t);
+	ssize_t (*aio_write) (struct kiocb *, const char *, size_t, loff_t);
+	/* Send part of a page without copying it through user space */
+	ssize_t (*sendpage) (struct file *, struct page *, int, size_t, loff_t *);
 };
 
 struct inode_operations {
@@ -907,7 +999,7 @@ static inline int locks_verify_area(int read_write, struct inode *inode,
 				    struct file *filp, loff_t offset,
 				    size_t count)
 {
-	if (inode->i_flock && MANDATORY_LOCK(inode))
+	if (inode->i_posix_locks.rb_node && MANDATORY_LOCK(inode))
 		return locks_mandatory_area(read_write, inode, filp, offset, count);
 	return 0;
 }
@@ -916,7 +1008,7 @@ static inline int locks_verify_truncate(struct inode *inode,
 				    struct file *filp,
 				    loff_t size)
 {
-	if (inode->i_flock && MANDATORY_LOCK(inode))
+	if (inode->i_posix_locks.rb_node && MANDATORY_LOCK(inode))
 		return locks_mandatory_area(
 			FLOCK_VERIFY_WRITE, inode, filp,
 			size < inode->i_size ? size : inode->i_size,
@@ -955,6 +1047,7 @@ extern int register_blkdev(unsigned int, const char *, struct block_device_opera
 extern int unregister_blkdev(unsigned int, const char *);
 extern struct block_device *bdget(dev_t);
 extern void bdput(struct block_device *);
+extern int get_readahead_stats(char *);
 extern int blkdev_open(struct inode *, struct file *);
 extern struct file_operations def_blk_fops;
 extern struct file_operations def_fifo_fops;
@@ -1067,6 +1160,8 @@ extern void invalidate_inode_buffers(struct inode *);
 #define destroy_buffers(dev)	__invalidate_buffers((dev), 1)
 extern void __invalidate_buffers(kdev_t dev, int);
 extern void sync_inodes(kdev_t);
+extern void sync_inodes_sb(struct super_block *, long *);
+extern void writeback_inodes(long);
 extern void write_inode_now(struct inode *, int);
 extern void sync_dev(kdev_t);
 extern int fsync_dev(kdev_t);
@@ -1074,6 +1169,7 @@ extern int fsync_inode_buffers(struct inode *);
 extern int osync_inode_buffers(struct inode *);
 extern int inode_has_buffers(struct inode *);
 extern void filemap_fdatasync(struct address_space *);
+extern long filemap_fdatasync_nr(struct address_space *, long);
 extern void filemap_fdatawait(struct address_space *);
 extern void sync_supers(kdev_t);
 extern int bmap(struct inode *, int);
@@ -1195,6 +1291,7 @@ static inline struct inode * new_inode(struct super_block *sb)
 	if (inode) {
 		inode->i_sb = sb;
 		inode->i_dev = sb->s_dev;
+		inode->i_blkbits = sb->s_blocksize_bits;
 	}
 	return inode;
 }
@@ -1234,20 +1331,30 @@ typedef int (get_block_t)(struct inode*,long,struct buffer_head*,int);
 extern int block_flushpage(struct page *, unsigned long);
 extern int block_symlink(struct inode *, const char *, int);
 extern int block_write_full_page(struct page*, get_block_t*);
+extern int block_write_dirty_page(struct page*, get_block_t*);
 extern int block_read_full_page(struct page*, get_block_t*);
 extern int block_prepare_write(struct page*, unsigned, unsigned, get_block_t*);
+extern int block_prepare_write_delay(struct page*, unsigned, unsigned, get_block_t*, int (*)(struct inode *));
+extern int block_prepare_write_pages(struct page**, int, unsigned, unsigned, get_block_t*);
+extern int block_map_delayed(struct page*, get_block_t*, int *);
 extern int cont_prepare_write(struct page*, unsigned, unsigned, get_block_t*,
 				unsigned long *);
 extern int block_sync_page(struct page *);
 
 int generic_block_bmap(struct address_space *, long, get_block_t *);
 int generic_commit_write(struct file *, struct page *, unsigned, unsigned);
+int block_commit_write_pages(struct file *, struct page **, int, unsigned, unsigned);
 int block_truncate_page(struct address_space *, loff_t, get_block_t *);
+int generic_direct_IO(int, struct inode *, struct kiobuf *, unsigned long, int, get_block_t *);
 
 extern int generic_file_mmap(struct file *, struct vm_area_struct *);
 extern ssize_t generic_file_read(struct file *, char *, size_t, loff_t *);
 extern ssize_t generic_file_write(struct file *, const char *, size_t, loff_t *);
+extern ssize_t generic_file_aio_read(struct kiocb *, char *, size_t, loff_t);
+extern ssize_t generic_file_aio_write(struct kiocb *, const char *, size_t, loff_t);
 extern void do_generic_file_read(struct file *, loff_t *, read_descriptor_t *, read_actor_t);
+extern void do_generic_file_fill(struct file *, loff_t *, read_descriptor_t *, read_actor_t);
+extern ssize_t file_write_page(struct file *, struct page *, unsigned long, unsigned long);
 
 extern ssize_t generic_read_dir(struct file *, char *, size_t, loff_t *);
 
@@ -1261,6 +1368,8 @@ extern struct inode_operations page_symlink_inode_operations;
 
 extern int vfs_readdir(struct file *, filldir_t, void *);
 extern int dcache_readdir(struct file *, void *, filldir_t);
+struct dirent_stat;
+extern int vfs_dirent_stat(struct dentry *, struct dirent_stat *);
 
 extern struct file_system_type *get_fs_type(const char *name);
 extern struct super_block *get_super(kdev_t);
@@ -0,0 +1,19 @@
+#ifndef _LINUX_FUTEX_H
+#define _LINUX_FUTEX_H
+
+/*
+ * Fast userspace mutexes.  The lock word lives in user memory and is
+ * manipulated with atomic instructions there; the kernel is entered
+ * only to sleep while it is contended, and to wake the sleepers.
+ */
+
+#define FUTEX_WAIT	0	/* sleep if *uaddr == val */
+#define FUTEX_WAKE	1	/* wake up to val sleepers on uaddr */
+
+#ifdef __KERNEL__
+#include <linux/time.h>
+
+asmlinkage long sys_futex(int *uaddr, int op, int val, struct timespec *utime);
+#endif
+
+#endif /* _LINUX_FUTEX_H */
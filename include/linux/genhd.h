@@ -51,6 +51,27 @@ struct hd_struct {
 	long start_sect;
 	long nr_sects;
 	devfs_handle_t de;              /* primary (master) devfs entry  */
+
+	/*
+	 * I/O statistics, kept by ll_rw_blk.c under the queue lock and
+	 * shown in /proc/diskstats.  Times are in jiffies; aveq is the
+	 * number of requests in flight integrated over time, so that
+	 * aveq / io_ticks is the average queue depth while busy.
+	 */
+	unsigned int ios_in_flight;
+	unsigned int io_ticks;
+	unsigned int last_idle_time;
+	unsigned int last_queue_change;
+	unsigned int aveq;
+
+	unsigned int rd_ios;		/* reads completed */
+	unsigned int rd_merges;		/* reads merged into queued requests */
+	unsigned int rd_sectors;	/* sectors read */
+	unsigned int rd_ticks;		/* queue + service time of reads */
+	unsigned int wr_ios;
+	unsigned int wr_merges;
+	unsigned int wr_sectors;
+	unsigned int wr_ticks;
 };
 
 #define GENHD_FL_REMOVABLE  1
@@ -225,12 +246,18 @@ struct unixware_disklabel {
 
 #ifdef __KERNEL__
 extern struct gendisk *gendisk_head;	/* linked list of disks */
+extern struct gendisk *get_gendisk(kdev_t dev);
+extern void disk_round_stats(struct hd_struct *hd);
 
 char *disk_name (struct gendisk *hd, int minor, char *buf);
 
 extern void devfs_register_partitions (struct gendisk *dev, int minor,
 				       int unregister);
 
+/* partition tables are read in the background until the root fs is up */
+extern void wait_for_partitions(void);
+extern void partition_check_sync(void);
+
 
 
 /*
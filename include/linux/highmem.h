@@ -26,6 +26,21 @@ static inline void bh_kunmap(struct buffer_head *bh)
 	kunmap(bh->b_page);
 }
 
+/*
+ * Physical address of a buffer's data.  In highmem b_data is only
+ * the offset into the page.
+ */
+#define bh_phys(bh)	(((u64) ((bh)->b_page - mem_map) << PAGE_SHIFT) + \
+			 bh_offset(bh))
+
+/* Whether the data of B2 directly follows that of B1 in memory */
+static inline int bh_contig(struct buffer_head *b1, struct buffer_head *b2)
+{
+	if (!PageHighMem(b1->b_page) && !PageHighMem(b2->b_page))
+		return b1->b_data + b1->b_size == b2->b_data;
+	return bh_phys(b1) + b1->b_size == bh_phys(b2);
+}
+
 #else /* CONFIG_HIGHMEM */
 
 static inline unsigned int nr_free_highpages(void) { return 0; }
@@ -40,19 +55,29 @@ static inline void *kmap(struct page *page) { return page_address(page); }
 #define bh_kmap(bh)	((bh)->b_data)
 #define bh_kunmap(bh)	do { } while (0);
 
+#define bh_contig(b1, b2)	((b1)->b_data + (b1)->b_size == (b2)->b_data)
+
 #endif /* CONFIG_HIGHMEM */
 
-/* when CONFIG_HIGHMEM is not set these will be plain clear/copy_page */
+/*
+ * when CONFIG_HIGHMEM is not set these will be plain clear/copy_page.
+ * None of them can sleep, so they use the per-CPU atomic kmaps rather
+ * than the shared pool.
+ */
 static inline void clear_user_highpage(struct page *page, unsigned long vaddr)
 {
-	clear_user_page(kmap(page), vaddr);
-	kunmap(page);
+	void *kaddr = kmap_atomic(page, KM_USER0);
+
+	clear_user_page(kaddr, vaddr);
+	kunmap_atomic(kaddr, KM_USER0);
 }
 
 static inline void clear_highpage(struct page *page)
 {
-	clear_page(kmap(page));
-	kunmap(page);
+	void *kaddr = kmap_atomic(page, KM_USER0);
+
+	clear_page(kaddr);
+	kunmap_atomic(kaddr, KM_USER0);
 }
 
 static inline void memclear_highpage(struct page *page, unsigned int offset, unsigned int size)
@@ -61,9 +86,9 @@ static inline void memclear_highpage(struct page *page, unsigned int offset, uns
 
 	if (offset + size > PAGE_SIZE)
 		BUG();
-	kaddr = kmap(page);
+	kaddr = kmap_atomic(page, KM_USER0);
 	memset(kaddr + offset, 0, size);
-	kunmap(page);
+	kunmap_atomic(kaddr, KM_USER0);
 }
 
 /*
@@ -75,32 +100,32 @@ static inline void memclear_highpage_flush(struct page *page, unsigned int offse
 
 	if (offset + size > PAGE_SIZE)
 		BUG();
-	kaddr = kmap(page);
+	kaddr = kmap_atomic(page, KM_USER0);
 	memset(kaddr + offset, 0, size);
 	flush_page_to_ram(page);
-	kunmap(page);
+	kunmap_atomic(kaddr, KM_USER0);
 }
 
 static inline void copy_user_highpage(struct page *to, struct page *from, unsigned long vaddr)
 {
 	char *vfrom, *vto;
 
-	vfrom = kmap(from);
-	vto = kmap(to);
+	vfrom = kmap_atomic(from, KM_USER0);
+	vto = kmap_atomic(to, KM_USER1);
 	copy_user_page(vto, vfrom, vaddr);
-	kunmap(from);
-	kunmap(to);
+	kunmap_atomic(vfrom, KM_USER0);
+	kunmap_atomic(vto, KM_USER1);
 }
 
 static inline void copy_highpage(struct page *to, struct page *from)
 {
 	char *vfrom, *vto;
 
-	vfrom = kmap(from);
-	vto = kmap(to);
+	vfrom = kmap_atomic(from, KM_USER0);
+	vto = kmap_atomic(to, KM_USER1);
 	copy_page(vto, vfrom);
-	kunmap(from);
-	kunmap(to);
+	kunmap_atomic(vfrom, KM_USER0);
+	kunmap_atomic(vto, KM_USER1);
 }
 
 #endif /* _LINUX_HIGHMEM_H */
@@ -0,0 +1,85 @@
+#ifndef _LINUX_HRTIMER_H
+#define _LINUX_HRTIMER_H
+
+#include <linux/config.h>
+#include <linux/list.h>
+#include <linux/time.h>
+#include <linux/timer.h>
+
+/*
+ * High resolution timers.
+ *
+ * Time is kept as a jiffy count plus the nanoseconds since that
+ * jiffy started, so that all the arithmetic stays in longs and
+ * wraps the same way jiffies do. Like the normal timers, a
+ * hrtimer is queued on the CPU that added it and its handler runs
+ * there, but from hard interrupt context.
+ *
+ * With CONFIG_HIGH_RES_TIMERS the architecture reads the time
+ * between two ticks and programs a one-shot interrupt for the next
+ * expiry. Without it the handlers run from the tick, which gives
+ * the same resolution as the timer wheel.
+ */
+#define NSEC_PER_JIFFY	(1000000000L / HZ)
+
+struct hrtime {
+	unsigned long tick;
+	unsigned long nsec;
+};
+
+struct hrtimer_base;
+
+struct hrtimer {
+	struct list_head list;
+	struct hrtime expires;
+	unsigned long data;
+	void (*function)(unsigned long);
+	struct hrtimer_base *base;
+};
+
+static inline void init_hrtimer(struct hrtimer * timer)
+{
+	timer->list.next = timer->list.prev = NULL;
+	timer->base = NULL;
+}
+
+static inline int hrtimer_pending(const struct hrtimer * timer)
+{
+	return timer->list.next != NULL;
+}
+
+static inline int hrtime_before(const struct hrtime *a, const struct hrtime *b)
+{
+	if (a->tick != b->tick)
+		return time_before(a->tick, b->tick);
+	return a->nsec < b->nsec;
+}
+
+extern void hrtimer_get_time(struct hrtime *now);
+extern void hrtime_add(struct hrtime *t, const struct timespec *delta);
+extern void hrtime_sub(const struct hrtime *a, const struct hrtime *b,
+		       struct timespec *delta);
+
+extern void add_hrtimer(struct hrtimer * timer);
+extern int del_hrtimer(struct hrtimer * timer);
+#ifdef CONFIG_SMP
+extern int del_hrtimer_sync(struct hrtimer * timer);
+#else
+#define del_hrtimer_sync(t)	del_hrtimer(t)
+#endif
+
+extern void hrtimer_run_queues(void);
+extern long hrtimer_next_event(void);
+extern int schedule_hrtimeout(struct timespec *timeout);
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * Provided by the architecture: the nanoseconds since the last
+ * tick, and a call to make this CPU's next interrupt come no later
+ * than hrtimer_next_event() says. Called with interrupts off.
+ */
+extern unsigned long arch_hrtimer_offset(void);
+extern void arch_hrtimer_reprogram(void);
+#endif
+
+#endif
@@ -276,6 +276,19 @@ typedef union {
 	} b;
 } special_t;
 
+/*
+ * Tagged command queueing state of a drive, see ide-tcq.c
+ */
+#define IDE_MAX_TAG	32		/* the tag is five bits wide */
+
+typedef struct ide_tag_info_s {
+	unsigned long	tag_mask;		/* tags in use */
+	struct request	*tag_rq[IDE_MAX_TAG];	/* request owning each tag */
+	int		queued;			/* commands held by the drive */
+	int		active_tag;		/* tag of the transfer under way */
+	unsigned long	last_service;		/* time of the last completion */
+} ide_tag_info_t;
+
 typedef struct ide_drive_s {
 	request_queue_t		 queue;	/* request queue */
 	struct ide_drive_s 	*next;	/* circular list of hwgroup drives */
@@ -349,6 +362,9 @@ typedef struct ide_drive_s {
 	byte		init_speed;	/* transfer rate set at boot */
 	byte		current_speed;	/* current transfer rate set */
 	byte		dn;		/* now wide spread use */
+	byte		using_tcq;	/* disk is using queued dma for read/write */
+	byte		queue_depth;	/* max tagged commands at the drive */
+	ide_tag_info_t	*tcq;		/* tag table, allocated on first use */
 } ide_drive_t;
 
 /*
@@ -367,7 +383,8 @@ typedef enum {	ide_dma_read,	ide_dma_write,		ide_dma_begin,
 		ide_dma_off,	ide_dma_off_quietly,	ide_dma_test_irq,
 		ide_dma_bad_drive,			ide_dma_good_drive,
 		ide_dma_verbose,			ide_dma_retune,
-		ide_dma_lostirq,			ide_dma_timeout
+		ide_dma_lostirq,			ide_dma_timeout,
+		ide_dma_read_queued,			ide_dma_write_queued
 } ide_dma_action_t;
 
 typedef int (ide_dmaproc_t)(ide_dma_action_t, ide_drive_t *);
@@ -457,6 +474,7 @@ typedef struct hwif_s {
 	unsigned	reset      : 1;	/* reset after probe */
 	unsigned	autodma    : 1;	/* automatically try to enable DMA at boot */
 	unsigned	udma_four  : 1;	/* 1=ATA-66 capable, 0=default */
+	unsigned	tcq_capable: 1;	/* 1=copes with queued DMA, 0=default */
 	byte		channel;	/* for dual-port chips: 0=primary, 1=secondary */
 #ifdef CONFIG_BLK_DEV_IDEPCI
 	struct pci_dev	*pci_dev;	/* for pci chipsets */
@@ -898,6 +916,23 @@ void ide_setup_dma (ide_hwif_t *hwif, unsigned long dmabase, unsigned int num_po
 unsigned long ide_get_or_set_dma_base (ide_hwif_t *hwif, int extra, const char *name) __init;
 #endif
 
+#ifdef CONFIG_BLK_DEV_IDE_TCQ
+ide_startstop_t ide_tcq_do_rw (ide_drive_t *drive, struct request *rq);
+ide_startstop_t ide_tcq_intr (ide_drive_t *drive);
+ide_startstop_t ide_tcq_dma_intr (ide_drive_t *drive);
+ide_startstop_t ide_tcq_idle (ide_drive_t *drive);
+int ide_tcq_set (ide_drive_t *drive, int on);
+int ide_tcq_set_depth (ide_drive_t *drive, int depth);
+/* the drive has released the bus and we wait for its service interrupt */
+#define IDE_TCQ_IDLE(hwgroup)	((hwgroup)->handler == &ide_tcq_intr)
+#define IDE_TCQ_HANDLER(h)	((h) == &ide_tcq_intr || (h) == &ide_tcq_dma_intr)
+#define IDE_TCQ_QUEUED(drive)	((drive)->tcq && (drive)->tcq->queued)
+#else
+#define IDE_TCQ_IDLE(hwgroup)	0
+#define IDE_TCQ_HANDLER(h)	0
+#define IDE_TCQ_QUEUED(drive)	0
+#endif /* CONFIG_BLK_DEV_IDE_TCQ */
+
 void hwif_unregister (ide_hwif_t *hwif);
 
 #endif /* _IDE_H */
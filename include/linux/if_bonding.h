@@ -20,6 +20,16 @@
 #define BOND_RELEASE     (SIOCDEVPRIVATE + 1)
 #define BOND_SETHWADDR   (SIOCDEVPRIVATE + 2)
 
+/* Transmit policies, the "mode" module parameter */
+#define BOND_MODE_ROUNDROBIN	0	/* Each packet to the next slave */
+#define BOND_MODE_XOR		1	/* A hash of the packet picks the slave */
+#define BOND_MODE_8023AD	2	/* As 1, over the links LACP aggregated */
+
+/* What the hash covers, the "xmit_hash_policy" module parameter */
+#define BOND_XMIT_POLICY_LAYER2		0	/* MAC addresses */
+#define BOND_XMIT_POLICY_LAYER3		1	/* IP addresses */
+#define BOND_XMIT_POLICY_LAYER34	2	/* IP addresses and ports */
+
 #endif /* _LINUX_BOND_H */
 
 /*
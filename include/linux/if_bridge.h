@@ -38,6 +38,7 @@
 #define BRCTL_SET_PORT_PRIORITY 16
 #define BRCTL_SET_PATH_COST 17
 #define BRCTL_GET_FDB_ENTRIES 18
+#define BRCTL_SET_FDB_HASH_BITS 19
 
 #define BR_STATE_DISABLED 0
 #define BR_STATE_LISTENING 1
@@ -39,6 +39,13 @@ struct sockaddr_ll
 #define PACKET_RX_RING			5
 #define PACKET_STATISTICS		6
 #define PACKET_COPY_THRESH		7
+#define PACKET_TX_RING			8
+#define PACKET_FANOUT			9
+
+/* PACKET_FANOUT argument: group id in the low 16 bits, mode above */
+#define PACKET_FANOUT_HASH		0
+#define PACKET_FANOUT_LB		1
+#define PACKET_FANOUT_CPU		2
 
 struct tpacket_stats
 {
@@ -53,6 +60,11 @@ struct tpacket_hdr
 #define TP_STATUS_USER		1
 #define TP_STATUS_COPY		2
 #define TP_STATUS_LOSING	4
+/* TX ring */
+#define TP_STATUS_AVAILABLE	0	/* Free, the user may fill it	*/
+#define TP_STATUS_SEND_REQUEST	1	/* Filled, waiting for send()	*/
+#define TP_STATUS_SENDING	2	/* Being copied out		*/
+#define TP_STATUS_WRONG_FORMAT	4	/* Refused, user must reset it	*/
 	unsigned int	tp_len;
 	unsigned int	tp_snaplen;
 	unsigned short	tp_mac;
@@ -64,6 +76,7 @@ struct tpacket_hdr
 #define TPACKET_ALIGNMENT	16
 #define TPACKET_ALIGN(x)	(((x)+TPACKET_ALIGNMENT-1)&~(TPACKET_ALIGNMENT-1))
 #define TPACKET_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket_hdr)) + sizeof(struct sockaddr_ll))
+#define TPACKET_TX_HDRLEN	TPACKET_ALIGN(sizeof(struct tpacket_hdr))
 
 /*
    Frame structure:
@@ -76,6 +89,17 @@ struct tpacket_hdr
    - Start+tp_mac: [ Optional MAC header ]
    - Start+tp_net: Packet data, aligned to TPACKET_ALIGNMENT=16.
    - Pad to align to TPACKET_ALIGNMENT=16
+
+   TX ring frame:
+
+   - Start. Frame must be aligned to TPACKET_ALIGNMENT=16
+   - struct tpacket_hdr; only tp_status and tp_len are used
+   - Start+TPACKET_TX_HDRLEN: tp_len bytes of packet data, with
+     the MAC header for SOCK_RAW, without it for SOCK_DGRAM.
+
+   The user fills frames in ring order and sets TP_STATUS_SEND_REQUEST;
+   send() then transmits every ready frame from the current position
+   on and gives each back as TP_STATUS_AVAILABLE.
  */
 
 struct tpacket_req
@@ -77,9 +77,7 @@ struct igmphdr
 
 #ifdef __KERNEL__
 
-/* ip_mc_socklist is real list now. Speed is not argument;
-   this list never used in fast path code
- */
+/* A socket's memberships are hashed by group, see ip_mc_hashfn() */
 
 struct ip_mc_socklist
 {
@@ -93,6 +91,8 @@ struct ip_mc_list
 	struct in_device	*interface;
 	unsigned long		multiaddr;
 	struct ip_mc_list	*next;
+	struct ip_mc_list	**pprev;	/* in the mc_list */
+	struct ip_mc_list	*next_hash;
 	struct timer_list	timer;
 	int			users;
 	atomic_t		refcnt;
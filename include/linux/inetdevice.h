@@ -22,6 +22,12 @@ struct ipv4_devconf
 
 extern struct ipv4_devconf ipv4_devconf;
 
+#define IP_MC_HASH_SIZE		64
+
+/* Groups differ in the low bits; the address is in network order */
+#define ip_mc_hashfn(addr) \
+	((ntohl(addr) ^ (ntohl(addr) >> 6)) & (IP_MC_HASH_SIZE - 1))
+
 struct in_device
 {
 	struct net_device		*dev;
@@ -30,6 +36,7 @@ struct in_device
 	int			dead;
 	struct in_ifaddr	*ifa_list;	/* IP ifaddr chain		*/
 	struct ip_mc_list	*mc_list;	/* IP multicast filter chain    */
+	struct ip_mc_list	*mc_hash[IP_MC_HASH_SIZE];
 	unsigned long		mr_v1_seen;
 	struct neigh_parms	*arp_parms;
 	struct ipv4_devconf	cnf;
@@ -53,6 +53,18 @@ extern initcall_t __initcall_start, __initcall_end;
 #define __exitcall(fn)								\
 	static exitcall_t __exitcall_##fn __exit_call = fn
 
+/*
+ * An initcall that nothing after it depends on can be started in a
+ * thread of its own at its place in the initcall order, so that the
+ * ones after it run while it waits for its hardware.  All of them are
+ * finished before the root filesystem is mounted.
+ */
+extern int initcall_async(initcall_t fn);
+
+#define __initcall_async(fn)							\
+	static int __init __async_##fn(void) { return initcall_async(fn); }	\
+	__initcall(__async_##fn)
+
 /*
  * Used for kernel command line parameter setup
  */
@@ -87,6 +99,7 @@ extern struct kernel_param __setup_start, __setup_end;
 #define __INITDATA	.section	".data.init","aw"
 
 #define module_init(x)	__initcall(x);
+#define module_init_async(x)	__initcall_async(x);
 #define module_exit(x)	__exitcall(x);
 
 #else
@@ -116,6 +129,7 @@ typedef void (*__cleanup_module_func_t)(void);
 	void cleanup_module(void) __attribute__((alias(#x))); \
 	extern inline __cleanup_module_func_t __cleanup_module_inline(void) \
 	{ return x; }
+#define module_init_async(x)	module_init(x)
 
 #define __setup(str,func) /* nothing */
 
@@ -58,7 +58,8 @@ enum
 	HI_SOFTIRQ=0,
 	NET_TX_SOFTIRQ,
 	NET_RX_SOFTIRQ,
-	TASKLET_SOFTIRQ
+	TASKLET_SOFTIRQ,
+	TIMER_SOFTIRQ
 };
 
 /* softirq mask and active fields moved to irq_cpustat_t in
@@ -90,6 +91,7 @@ static inline void raise_softirq(int nr)
 	local_irq_restore(flags);
 }
 
+extern void cpu_raise_softirq_remote(int cpu, int nr);
 extern void softirq_init(void);
 
 
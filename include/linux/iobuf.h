@@ -55,6 +55,9 @@ struct kiobuf
 	int		errno;		/* Status of completed IO */
 	void		(*end_io) (struct kiobuf *); /* Completion callback */
 	wait_queue_head_t wait_queue;
+
+	void *		private;	/* For end_io */
+	struct buffer_head *bh_list;	/* Left by brw_kiovec_async() */
 };
 
 
@@ -62,6 +65,7 @@ struct kiobuf
 
 int	map_user_kiobuf(int rw, struct kiobuf *, unsigned long va, size_t len);
 void	unmap_kiobuf(struct kiobuf *iobuf);
+void	mark_dirty_kiobuf(struct kiobuf *iobuf, int bytes);
 int	lock_kiovec(int nr, struct kiobuf *iovec[], int wait);
 int	unlock_kiovec(int nr, struct kiobuf *iovec[]);
 
@@ -80,5 +84,8 @@ void	kiobuf_wait_for_io(struct kiobuf *);
 
 int	brw_kiovec(int rw, int nr, struct kiobuf *iovec[], 
 		   kdev_t dev, unsigned long b[], int size);
+int	brw_kiovec_async(int rw, struct kiobuf *iobuf,
+			 kdev_t dev, unsigned long b[], int size);
+void	brw_kiovec_done(struct kiobuf *iobuf);
 
 #endif /* __LINUX_IOBUF_H */
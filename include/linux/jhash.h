@@ -0,0 +1,51 @@
+#ifndef _LINUX_JHASH_H
+#define _LINUX_JHASH_H
+
+/* Bob Jenkins' hash, lookup2.c, May 1996: a few fixed size variants
+ * for hash tables which are keyed with a random initval, so that
+ * nobody outside can predict the chains.
+ *
+ * http://burtleburtle.net/bob/hash/
+ */
+
+#include <linux/types.h>
+
+/* Mix three 32-bit values reversibly. */
+#define __jhash_mix(a, b, c) \
+do { \
+	a -= b; a -= c; a ^= (c>>13); \
+	b -= c; b -= a; b ^= (a<<8); \
+	c -= a; c -= b; c ^= (b>>13); \
+	a -= b; a -= c; a ^= (c>>12); \
+	b -= c; b -= a; b ^= (a<<16); \
+	c -= a; c -= b; c ^= (b>>5); \
+	a -= b; a -= c; a ^= (c>>3); \
+	b -= c; b -= a; b ^= (a<<10); \
+	c -= a; c -= b; c ^= (b>>15); \
+} while (0)
+
+/* The golden ratio: an arbitrary value. */
+#define JHASH_GOLDEN_RATIO	0x9e3779b9
+
+static inline u32 jhash_3words(u32 a, u32 b, u32 c, u32 initval)
+{
+	a += JHASH_GOLDEN_RATIO;
+	b += JHASH_GOLDEN_RATIO;
+	c += initval;
+
+	__jhash_mix(a, b, c);
+
+	return c;
+}
+
+static inline u32 jhash_2words(u32 a, u32 b, u32 initval)
+{
+	return jhash_3words(a, b, 0, initval);
+}
+
+static inline u32 jhash_1word(u32 a, u32 initval)
+{
+	return jhash_3words(a, 0, 0, initval);
+}
+
+#endif /* _LINUX_JHASH_H */
@@ -72,6 +72,7 @@ asmlinkage int printk(const char * fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
 
 extern int console_loglevel;
+extern int oops_in_progress;	/* printk() writes to the consoles itself */
 
 static inline void console_silent(void)
 {
@@ -16,7 +16,18 @@
 #define LO_KEY_SIZE	32
 
 #ifdef __KERNEL__
-       
+
+#include <linux/spinlock.h>
+#include <asm/atomic.h>
+#include <asm/semaphore.h>
+
+/* Possible states of device */
+enum {
+	Lo_unbound,
+	Lo_bound,
+	Lo_rundown,
+};
+
 struct loop_device {
 	int		lo_number;
 	struct dentry	*lo_dentry;
@@ -39,6 +50,19 @@ struct loop_device {
 	struct file *	lo_backing_file;
 	void		*key_data; 
 	char		key_reserved[48]; /* for use by the filter modules */
+
+	int		lo_blkbits;	/* block size of the backing file */
+	int		*lo_bmap;	/* cached file -> device block map */
+	int		lo_bmap_size;
+
+	/* buffers for the loop thread, per direction */
+	spinlock_t		lo_lock;
+	struct buffer_head	*lo_bh[2];
+	struct buffer_head	*lo_bhtail[2];
+	int			lo_state;
+	struct semaphore	lo_sem;		/* thread start/exit */
+	struct semaphore	lo_bh_mutex;	/* buffers queued */
+	atomic_t		lo_pending;
 };
 
 typedef	int (* transfer_proc_t)(struct loop_device *, int cmd,
@@ -52,6 +76,7 @@ typedef	int (* transfer_proc_t)(struct loop_device *, int cmd,
  */
 #define LO_FLAGS_DO_BMAP	0x00000001
 #define LO_FLAGS_READ_ONLY	0x00000002
+#define LO_FLAGS_BH_REMAP	0x00000004
 
 /* 
  * Note that this structure gets the wrong offsets when directly used
@@ -0,0 +1,42 @@
+#ifndef _LINUX_LOW_LATENCY_H
+#define _LINUX_LOW_LATENCY_H
+
+/*
+ * Voluntary reschedule points for long-running kernel loops.
+ *
+ * Code that walks a long list or a large range of page tables can
+ * check conditional_schedule_needed() between items, and if it is
+ * set drop whatever spinlocks it holds, call unconditional_schedule()
+ * and pick the locks up again. Loops that hold no spinlock can just
+ * use conditional_schedule().
+ *
+ * Without CONFIG_LOLAT all of this compiles away.
+ */
+
+#ifdef CONFIG_LOLAT
+
+#include <linux/sched.h>
+
+#define conditional_schedule_needed()	(current->need_resched)
+
+#define unconditional_schedule()			\
+	do {						\
+		__set_current_state(TASK_RUNNING);	\
+		schedule();				\
+	} while (0)
+
+#define conditional_schedule()				\
+	do {						\
+		if (conditional_schedule_needed())	\
+			unconditional_schedule();	\
+	} while (0)
+
+#else
+
+#define conditional_schedule_needed()	0
+#define unconditional_schedule()	do { } while (0)
+#define conditional_schedule()		do { } while (0)
+
+#endif
+
+#endif /* _LINUX_LOW_LATENCY_H */
@@ -684,6 +684,8 @@ typedef struct lv_v4 {
 	ulong lv_snapshot_hash_table_size;
 	ulong lv_snapshot_hash_mask;
 	struct page *lv_COW_table_page;
+	struct kiobuf *lv_COW_table_iobuf;
+	ulong *lv_COW_blocks;
 	wait_queue_head_t lv_snapshot_wait;
 	int	lv_snapshot_use_rate;
 	void	*vg;
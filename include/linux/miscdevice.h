@@ -21,6 +21,8 @@
 #define NVRAM_MINOR 144
 #define I2O_MINOR 166
 #define MICROCODE_MINOR		184
+#define PERFPROF_MINOR		185
+#define DNOTIFY_MINOR		202
 #define MISC_DYNAMIC_MINOR 255
 
 #define SGI_GRAPHICS_MINOR   146
@@ -9,12 +9,17 @@
 #include <linux/config.h>
 #include <linux/string.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/mmzone.h>
 
 extern unsigned long max_mapnr;
 extern unsigned long num_physpages;
 extern void * high_memory;
 extern int page_cluster;
+extern int fault_around_pages;
+#define FAULT_AROUND_MAX	64	/* limit for fault_around_pages */
+extern unsigned int page_colours;
+extern int sysctl_page_colouring;
 /* The inactive_clean lists are per zone. */
 extern struct list_head active_list;
 extern struct list_head inactive_dirty_list;
@@ -49,10 +54,9 @@ struct vm_area_struct {
 	pgprot_t vm_page_prot;
 	unsigned long vm_flags;
 
-	/* AVL tree of VM areas per task, sorted by address */
-	short vm_avl_height;
-	struct vm_area_struct * vm_avl_left;
-	struct vm_area_struct * vm_avl_right;
+	/* red-black tree of VM areas per task, sorted by address */
+	rb_node_t vm_rb;
+	unsigned long vm_rb_gap;	/* largest hole after a VMA of this subtree */
 
 	/* For areas with an address space and backing store,
 	 * one of the address_space->i_mmap{,shared} lists,
@@ -96,6 +100,8 @@ struct vm_area_struct {
 #define VM_DONTCOPY	0x00020000      /* Do not copy this vma on fork */
 #define VM_DONTEXPAND	0x00040000	/* Cannot expand with mremap() */
 #define VM_RESERVED	0x00080000	/* Don't unmap it from swap_out */
+#define VM_BIGPAGE	0x00100000	/* Mapped by big pages, see bigpages.h */
+#define VM_ANONPAGES	0x00200000	/* Has had private copies faulted in */
 
 #define VM_STACK_FLAGS	0x00000177
 
@@ -121,8 +127,12 @@ struct vm_operations_struct {
 	void (*open)(struct vm_area_struct * area);
 	void (*close)(struct vm_area_struct * area);
 	struct page * (*nopage)(struct vm_area_struct * area, unsigned long address, int write_access);
+	/* map what is cheap to map around address, after a read fault */
+	void (*fault_around)(struct vm_area_struct * area, unsigned long address, pte_t * page_table);
 };
 
+struct pte_chain;
+
 /*
  * Try to keep the most commonly accessed fields in single cache lines
  * here (16 bytes or greater).  This ordering should be particularly
@@ -145,6 +155,7 @@ typedef struct page {
 	struct buffer_head * buffers;
 	void *virtual; /* non-NULL if kmapped */
 	struct zone_struct *zone;
+	struct pte_chain *pte_chain;	/* ptes mapping this page, see mm/rmap.c */
 } mem_map_t;
 
 #define get_page(p)		atomic_inc(&(p)->count)
@@ -298,9 +309,10 @@ static inline void set_page_dirty(struct page * page)
  * All pages belonging to an inode make up a doubly linked list
  * inode->i_pages, using the fields page->next and page->prev. (These
  * fields are also used for freelist management when page->count==0.)
- * There is also a hash table mapping (inode,offset) to the page
- * in memory if present. The lists for this hash table use the fields
- * page->next_hash and page->pprev_hash.
+ * The mapping also indexes its pages by offset in a radix tree,
+ * mapping->page_tree. page->next_hash and page->pprev_hash are no
+ * longer used by the page cache; some architectures use them to keep
+ * their own lists of page table pages.
  *
  * All process pages can do I/O:
  * - inode pages may need to be read from disk,
@@ -317,7 +329,7 @@ static inline void set_page_dirty(struct page * page)
  *
  * For choosing which pages to swap out, inode pages carry a
  * PG_referenced bit, which is set any time the system accesses
- * that page through the (inode,offset) hash table.
+ * that page through the page cache index.
  *
  * PG_skip is used on sparc/sparc64 architectures to "skip" certain
  * parts of the address space.
@@ -356,6 +368,8 @@ extern struct page * alloc_pages(int gfp_mask, unsigned long order);
 
 #define alloc_page(gfp_mask) alloc_pages(gfp_mask, 0)
 
+extern struct page * alloc_user_page(int gfp_mask, unsigned long address);
+
 extern unsigned long FASTCALL(__get_free_pages(int gfp_mask, unsigned long order));
 extern unsigned long FASTCALL(get_zeroed_page(int gfp_mask));
 
@@ -375,6 +389,8 @@ extern unsigned long FASTCALL(get_zeroed_page(int gfp_mask));
  */
 extern void FASTCALL(__free_pages(struct page *page, unsigned long order));
 extern void FASTCALL(free_pages(unsigned long addr, unsigned long order));
+extern void FASTCALL(free_cold_page(struct page *page));
+extern void drain_local_pages(void);
 
 #define __free_page(page) __free_pages((page), 0)
 #define free_page(addr) free_pages((addr),0)
@@ -388,19 +404,23 @@ struct page * shmem_nopage(struct vm_area_struct * vma, unsigned long address, i
 struct file *shmem_file_setup(char * name, loff_t size);
 extern int shmem_zero_setup(struct vm_area_struct *);
 
-extern void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size);
+/* zap_page_range() actions */
+#define ZPR_COND_RESCHED	1	/* may reschedule, no spinlock is held */
+
+extern void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size, int actions);
 extern int copy_page_range(struct mm_struct *dst, struct mm_struct *src, struct vm_area_struct *vma);
 extern int remap_page_range(unsigned long from, unsigned long to, unsigned long size, pgprot_t prot);
 extern int zeromap_page_range(unsigned long from, unsigned long size, pgprot_t prot);
 
 extern void vmtruncate(struct inode * inode, loff_t offset);
 extern int handle_mm_fault(struct mm_struct *mm,struct vm_area_struct *vma, unsigned long address, int write_access);
+extern struct page * follow_page(unsigned long address);
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 extern int ptrace_readdata(struct task_struct *tsk, unsigned long src, char *dst, int len);
 extern int ptrace_writedata(struct task_struct *tsk, char * src, unsigned long dst, int len);
 
-extern int pgt_cache_water[2];
+extern int pgt_cache_water[3];
 extern int check_pgt_cache(void);
 
 extern void free_area_init(unsigned long * zones_size);
@@ -417,7 +437,9 @@ extern void lock_vma_mappings(struct vm_area_struct *);
 extern void unlock_vma_mappings(struct vm_area_struct *);
 extern void insert_vm_struct(struct mm_struct *, struct vm_area_struct *);
 extern void __insert_vm_struct(struct mm_struct *, struct vm_area_struct *);
-extern void build_mmap_avl(struct mm_struct *);
+extern void __vma_link_rb(struct mm_struct *, struct vm_area_struct *,
+			  struct vm_area_struct *, rb_node_t **, rb_node_t *);
+extern void vma_gap_update(struct vm_area_struct *);
 extern void exit_mmap(struct mm_struct *);
 extern unsigned long get_unmapped_area(unsigned long, unsigned long);
 
@@ -451,6 +473,7 @@ extern void truncate_inode_pages(struct address_space *, loff_t);
 /* generic vm_area_ops exported for stackable file systems */
 extern int filemap_sync(struct vm_area_struct *, unsigned long,	size_t, unsigned int);
 extern struct page *filemap_nopage(struct vm_area_struct *, unsigned long, int);
+extern void filemap_populate(struct vm_area_struct *, unsigned long, unsigned long);
 
 /*
  * GFP bitmasks..
@@ -464,6 +487,7 @@ extern struct page *filemap_nopage(struct vm_area_struct *, unsigned long, int);
 #else
 #define __GFP_HIGHMEM	0x0 /* noop */
 #endif
+#define __GFP_COLD	0x20	/* cache-cold page, e.g. for DMA */
 
 
 #define GFP_BUFFER	(__GFP_HIGH | __GFP_WAIT)
@@ -6,4 +6,8 @@
 #define MREMAP_MAYMOVE	1
 #define MREMAP_FIXED	2
 
+#ifndef MAP_POPULATE
+#define MAP_POPULATE	0
+#endif
+
 #endif /* _LINUX_MMAN_H */
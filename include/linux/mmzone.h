@@ -7,6 +7,9 @@
 #include <linux/config.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/threads.h>
+#include <linux/cache.h>
+#include <linux/wait.h>
 
 /*
  * Free memory management - zoned buddy allocator.
@@ -19,6 +22,31 @@ typedef struct free_area_struct {
 	unsigned int		*map;
 } free_area_t;
 
+/*
+ * Per-CPU lists of single free pages, so that most order-0
+ * allocations and frees need not take zone->lock. They are refilled
+ * from and given back to the buddy lists @batch pages at a time.
+ * Recently freed pages go to the hot list and are handed out first;
+ * __GFP_COLD allocations and free_cold_page() use the cold one, so
+ * pages a device is about to write into do not use up cache-warm
+ * ones. Pages on these lists are not counted in zone->free_pages.
+ */
+struct per_cpu_pages {
+	int count;		/* pages on the list */
+	int low;		/* refill when we get down to this */
+	int high;		/* give back a batch above this */
+	int batch;
+	struct list_head list;
+	unsigned long allocs, refills, frees, flushes;
+};
+
+#define PCP_HOT		0
+#define PCP_COLD	1
+
+struct per_cpu_pageset {
+	struct per_cpu_pages pcp[2];
+} ____cacheline_aligned;
+
 struct pglist_data;
 
 typedef struct zone_struct {
@@ -38,6 +66,8 @@ typedef struct zone_struct {
 	struct list_head	inactive_clean_list;
 	free_area_t		free_area[MAX_ORDER];
 
+	struct per_cpu_pageset	pageset[NR_CPUS];
+
 	/*
 	 * rarely used fields:
 	 */
@@ -50,6 +80,14 @@ typedef struct zone_struct {
 	unsigned long		zone_start_paddr;
 	unsigned long		zone_start_mapnr;
 	struct page		*zone_mem_map;
+
+	/*
+	 * Reclaim statistics for /proc/vmstat, updates may race.
+	 */
+	unsigned long		pgscan;		/* LRU pages looked at */
+	unsigned long		pgsteal;	/* pages reclaimed */
+	unsigned long		pgwrite;	/* pages written by reclaim */
+	unsigned long		allocstall;	/* allocations that had to wait */
 } zone_t;
 
 #define ZONE_DMA		0
@@ -67,9 +105,18 @@ typedef struct zone_struct {
  * modify it apart from boot-up, and only a few indices are used,
  * so despite the zonelist table being relatively big, the cache
  * footprint of this construct is very small.
+ *
+ * On NUMA the zones of the local node come first, followed by those
+ * of up to ZONELIST_NODES-1 other nodes, nearest first.
  */
+#ifdef CONFIG_NUMA
+#define ZONELIST_NODES		8
+#else
+#define ZONELIST_NODES		1
+#endif
+
 typedef struct zonelist_struct {
-	zone_t * zones [MAX_NR_ZONES+1]; // NULL delimited
+	zone_t * zones [MAX_NR_ZONES*ZONELIST_NODES+1]; // NULL delimited
 	int gfp_mask;
 } zonelist_t;
 
@@ -87,6 +134,13 @@ typedef struct pglist_data {
 	unsigned long node_size;
 	int node_id;
 	struct pglist_data *node_next;
+	wait_queue_head_t kreclaimd_wait;	/* this node's kreclaimd */
+#ifdef CONFIG_NUMA
+	/* Allocation statistics, updates may race */
+	unsigned long numa_hit;		/* wanted here, got it here */
+	unsigned long numa_miss;	/* wanted elsewhere, got it here */
+	unsigned long numa_foreign;	/* wanted here, got it elsewhere */
+#endif
 } pg_data_t;
 
 extern int numnodes;
@@ -119,6 +173,24 @@ extern pg_data_t contig_page_data;
 
 #endif /* !CONFIG_DISCONTIGMEM */
 
+/*
+ * A NUMA architecture provides numa_node_id() and MAX_NUMNODES in
+ * asm/mmzone.h, and may provide node_distance() to order the fallback
+ * nodes in the zonelists.
+ */
+#ifdef CONFIG_NUMA
+#ifndef node_distance
+#define node_distance(from, to)	((from) == (to) ? 10 : 20)
+#endif
+extern void build_all_zonelists(void);
+#else
+#define MAX_NUMNODES		1
+#ifndef numa_node_id
+#define numa_node_id()		0
+#endif
+#define build_all_zonelists()	do { } while (0)
+#endif
+
 #define MAP_ALIGN(x)	((((x) % sizeof(mem_map_t)) == 0) ? (x) : ((x) + \
 		sizeof(mem_map_t) - ((x) % sizeof(mem_map_t))))
 
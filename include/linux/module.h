@@ -118,6 +118,24 @@ struct module_info
 #define QM_REFS		3
 #define QM_SYMBOLS	4
 #define QM_INFO		5
+#define QM_RESOLVE	6
+
+/*
+ * QM_RESOLVE looks up a list of symbols instead of copying out whole
+ * symbol tables.  buf starts with the number of entries, followed by
+ * that many struct module_resolve, whose name is the offset in buf of
+ * a null terminated symbol name.  The kernel fills in the value and
+ * the address of the defining module, 0 for the kernel itself; both
+ * are left 0 for a name that is not found.  With a module name only
+ * that module is searched, without one the kernel and every module.
+ * *ret is set to the number of names found.
+ */
+struct module_resolve
+{
+	unsigned long value;
+	unsigned long module;
+	unsigned long name;
+};
 
 /* Can the module be queried? */
 #define MOD_CAN_QUERY(mod) (((mod)->flags & (MOD_RUNNING | MOD_INITIALIZING)) && !((mod)->flags & MOD_DELETED))
@@ -0,0 +1,46 @@
+#ifndef _LINUX_MQUEUE_H
+#define _LINUX_MQUEUE_H
+
+/*
+ * POSIX message queues, see ipc/mqueue.c.
+ *
+ * mq_open() returns a file descriptor, which poll(), select() and
+ * epoll report readable while the queue holds messages and writable
+ * while it has room for more.
+ */
+
+#define MQ_PRIO_MAX	32	/* priorities are 0 .. MQ_PRIO_MAX-1 */
+
+#define MQ_MAXMSG_DEFAULT	10
+#define MQ_MSGSIZE_DEFAULT	8192
+#define MQ_MAXMSG_MAX		4096
+#define MQ_MSGSIZE_MAX		65536
+
+struct mq_attr {
+	long	mq_flags;	/* O_NONBLOCK */
+	long	mq_maxmsg;	/* maximum number of messages */
+	long	mq_msgsize;	/* maximum message size */
+	long	mq_curmsgs;	/* messages currently queued */
+	long	__reserved[4];
+};
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/time.h>
+#include <asm/siginfo.h>
+
+asmlinkage long sys_mq_open(const char *name, int oflag, mode_t mode,
+			    struct mq_attr *attr);
+asmlinkage long sys_mq_unlink(const char *name);
+asmlinkage long sys_mq_timedsend(int mqdes, const char *msg_ptr,
+				 size_t msg_len, unsigned int msg_prio,
+				 const struct timespec *abs_timeout);
+asmlinkage ssize_t sys_mq_timedreceive(int mqdes, char *msg_ptr,
+				       size_t msg_len, unsigned int *msg_prio,
+				       const struct timespec *abs_timeout);
+asmlinkage long sys_mq_notify(int mqdes, const struct sigevent *notification);
+asmlinkage long sys_mq_getsetattr(int mqdes, const struct mq_attr *mqstat,
+				  struct mq_attr *omqstat);
+#endif
+
+#endif /* _LINUX_MQUEUE_H */
@@ -16,6 +16,7 @@
 #define NBD_PRINT_DEBUG	_IO( 0xab, 6 )
 #define NBD_SET_SIZE_BLOCKS	_IO( 0xab, 7 )
 #define NBD_DISCONNECT  _IO( 0xab, 8 )
+#define NBD_ADD_SOCK	_IO( 0xab, 9 )
 
 #ifdef MAJOR_NR
 
@@ -31,38 +32,38 @@ extern int requests_in;
 extern int requests_out;
 #endif
 
-static int 
+/*
+ * Requests travel whole, so they are completed whole.
+ */
+static void
 nbd_end_request(struct request *req)
 {
 	unsigned long flags;
-	int ret = 0;
+	int uptodate = !req->errors;
 
 #ifdef PARANOIA
 	requests_out++;
 #endif
-	/*
-	 * This is a very dirty hack that we have to do to handle
-	 * merged requests because end_request stuff is a bit
-	 * broken. The fact we have to do this only if there
-	 * aren't errors looks even more silly.
-	 */
-	if (!req->errors) {
-		req->sector += req->current_nr_sectors;
-		req->nr_sectors -= req->current_nr_sectors;
-	}
-
 	spin_lock_irqsave(&io_request_lock, flags);
-	if (end_that_request_first( req, !req->errors, "nbd" ))
-		goto out;
-	ret = 1;
+	while (end_that_request_first( req, uptodate, "nbd" ))
+		;
 	end_that_request_last( req );
-
-out:
 	spin_unlock_irqrestore(&io_request_lock, flags);
-	return ret;
 }
 
 #define MAX_NBD 128
+#define NBD_MAX_CONN 8		/* connections one device stripes over	*/
+
+struct nbd_device;
+
+struct nbd_conn {
+	struct nbd_device * lo;
+	struct socket * sock;
+	struct file * file;
+	int dead;			/* socket failed, send nothing more	*/
+	struct list_head inflight;	/* Sent, waiting for their reply	*/
+	struct semaphore tx_sem;	/* One sender on the socket at a time	*/
+};
 
 struct nbd_device {
 	int refcnt;	
@@ -70,11 +71,17 @@ struct nbd_device {
 	int harderror;		/* Code of hard error			*/
 #define NBD_READ_ONLY 0x0001
 #define NBD_WRITE_NOCHK 0x0002
-	struct socket * sock;
-	struct file * file; 		/* If == NULL, device is not ready, yet	*/
 	int magic;			/* FIXME: not if debugging is off	*/
+	int nconn;			/* If == 0, device is not ready, yet	*/
+	struct nbd_conn conn[NBD_MAX_CONN];
+	int next_conn;			/* round robin striping			*/
+	spinlock_t lock;		/* queue_head, inflight lists, counts	*/
 	struct list_head queue_head;	/* Requests are added here...			*/
-	struct semaphore queue_lock;
+	int nlive;			/* receiver threads still running	*/
+	int sender_stop;
+	wait_queue_head_t send_wait;	/* wakes the sender thread		*/
+	wait_queue_head_t recv_wait;	/* receivers exiting			*/
+	struct semaphore sender_sem;	/* sender thread start/exit		*/
 };
 #endif
 
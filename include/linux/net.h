@@ -44,6 +44,8 @@ struct poll_table_struct;
 #define SYS_GETSOCKOPT	15		/* sys_getsockopt(2)		*/
 #define SYS_SENDMSG	16		/* sys_sendmsg(2)		*/
 #define SYS_RECVMSG	17		/* sys_recvmsg(2)		*/
+#define SYS_RECVMMSG	18		/* sys_recvmmsg(2)		*/
+#define SYS_SENDMMSG	19		/* sys_sendmmsg(2)		*/
 
 
 typedef enum {
@@ -82,6 +84,7 @@ struct socket
 
 struct scm_cookie;
 struct vm_area_struct;
+struct page;
 
 struct proto_ops {
   int	family;
@@ -108,6 +111,8 @@ struct proto_ops {
   int   (*sendmsg)	(struct socket *sock, struct msghdr *m, int total_len, struct scm_cookie *scm);
   int   (*recvmsg)	(struct socket *sock, struct msghdr *m, int total_len, int flags, struct scm_cookie *scm);
   int	(*mmap)		(struct file *file, struct socket *sock, struct vm_area_struct * vma);
+  ssize_t (*sendpage)	(struct socket *sock, struct page *page, int offset, size_t size, int flags);
+  ssize_t (*receive_file) (struct socket *sock, struct file *file, size_t size, int flags);
 };
 
 struct net_proto_family 
@@ -135,6 +140,7 @@ extern int	sock_create(int family, int type, int proto, struct socket **);
 extern void	sock_release(struct socket *);
 extern int   	sock_sendmsg(struct socket *, struct msghdr *m, int len);
 extern int	sock_recvmsg(struct socket *, struct msghdr *m, int len, int flags);
+extern ssize_t	sock_receive_file(struct file *, struct file *, size_t, int);
 extern int	sock_readv_writev(int type, struct inode * inode, struct file * file,
 				  const struct iovec * iov, long count, long size);
 
@@ -158,6 +158,8 @@ struct netif_rx_stats
 	unsigned fastroute_deferred_out;
 	unsigned fastroute_latency_reduction;
 	unsigned cpu_collision;
+	unsigned rps_steered;		/* handed to the backlog of another CPU */
+	unsigned rps_kicks;		/* ... which had to be woken up for it */
 } __attribute__ ((__aligned__(SMP_CACHE_BYTES)));
 
 extern struct netif_rx_stats netdev_rx_stat[];
@@ -174,8 +176,12 @@ struct dev_mc_list
 	unsigned char		dmi_addrlen;
 	int			dmi_users;
 	int			dmi_gusers;
+	struct dev_mc_list	**pprev;	/* in the mc_list */
+	struct dev_mc_list	*hash_next;
 };
 
+#define DEV_MC_HASH_SIZE	64
+
 struct hh_cache
 {
 	struct hh_cache *hh_next;	/* Next entry			     */
@@ -199,7 +205,8 @@ enum netdev_state_t
 	__LINK_STATE_START,
 	__LINK_STATE_PRESENT,
 	__LINK_STATE_SCHED,
-	__LINK_STATE_NOCARRIER
+	__LINK_STATE_NOCARRIER,
+	__LINK_STATE_RX_SCHED
 };
 
 
@@ -278,6 +285,17 @@ struct net_device
 	 * will (read: may be cleaned up at will).
 	 */
 
+	/*
+	 * Polled receive: a device with a poll method is put on the
+	 * poll_list of a CPU by netif_rx_schedule() and polled from
+	 * net_rx_action() for at most quota packets per round, quota
+	 * being refilled with weight.
+	 */
+	struct list_head	poll_list;
+	int			quota;
+	int			weight;
+	int			(*poll)(struct net_device *dev, int *budget);
+
 	/* These may be needed for future network-power-down code. */
 	unsigned long		trans_start;	/* Time (in jiffies) of last Tx	*/
 	unsigned long		last_rx;	/* Time of last Rx	*/
@@ -301,6 +319,7 @@ struct net_device
 
 	struct dev_mc_list	*mc_list;	/* Multicast mac addresses	*/
 	int			mc_count;	/* Number of installed mcasts	*/
+	struct dev_mc_list	*mc_hash[DEV_MC_HASH_SIZE];
 	int			promiscuity;
 	int			allmulti;
 
@@ -342,6 +361,7 @@ struct net_device
 #define NETIF_F_HW_CSUM		8	/* Can checksum all the packets. */
 #define NETIF_F_DYNALLOC	16	/* Self-dectructable device. */
 #define NETIF_F_HIGHDMA		32	/* Can DMA to high memory. */
+#define NETIF_F_TSO		64	/* Can cut TCP/IPv4 frames into segments. */
 #define NETIF_F_FRAGLIST	1	/* Scatter/gather IO. */
 
 	/* Called after device is detached from network. */
@@ -354,6 +374,12 @@ struct net_device
 	int			(*stop)(struct net_device *dev);
 	int			(*hard_start_xmit) (struct sk_buff *skb,
 						    struct net_device *dev);
+	/* Optional: take a chain of skbs linked through skb->next.
+	 * Returns the part of the chain not taken, NULL if all was.
+	 */
+	struct sk_buff *	(*hard_start_xmit_batch) (struct sk_buff *skb,
+							  struct net_device *dev);
+#define HAVE_XMIT_BATCH
 	int			(*hard_header) (struct sk_buff *skb,
 						struct net_device *dev,
 						unsigned short type,
@@ -439,6 +465,7 @@ extern int		dev_alloc_name(struct net_device *dev, const char *name);
 extern int		dev_open(struct net_device *dev);
 extern int		dev_close(struct net_device *dev);
 extern int		dev_queue_xmit(struct sk_buff *skb);
+extern void		skb_checksum_help(struct sk_buff *skb);
 extern int		register_netdevice(struct net_device *dev);
 extern int		unregister_netdevice(struct net_device *dev);
 extern int 		register_netdevice_notifier(struct notifier_block *nb);
@@ -466,8 +493,15 @@ struct softnet_data
 	int			cng_level;
 	int			avg_blog;
 	struct sk_buff_head	input_pkt_queue;
+	struct list_head	poll_list;
 	struct net_device	*output_queue;
 	struct sk_buff		*completion_queue;
+
+	/* Polls input_pkt_queue, for the drivers using netif_rx() */
+	struct net_device	backlog_dev;
+
+	/* Packets steered here by other CPUs, locked by its own lock */
+	struct sk_buff_head	rps_queue;
 } __attribute__((__aligned__(SMP_CACHE_BYTES)));
 
 
@@ -538,6 +572,39 @@ static inline void dev_kfree_skb_irq(struct sk_buff *skb)
 	}
 }
 
+/* The same for a chain of skbs linked through skb->next, such as a
+ * driver collects while reaping its TX ring: the ones to be freed are
+ * handed to net_tx_action() with a single touch of the completion
+ * queue.  Only interrupt context.
+ */
+static inline void dev_kfree_skb_irq_list(struct sk_buff *skb)
+{
+	struct sk_buff *head = NULL;
+	struct sk_buff **tail = &head;
+
+	while (skb != NULL) {
+		struct sk_buff *next = skb->next;
+
+		if (atomic_dec_and_test(&skb->users)) {
+			*tail = skb;
+			tail = &skb->next;
+		} else
+			skb->next = NULL;
+		skb = next;
+	}
+
+	if (head != NULL) {
+		int cpu = smp_processor_id();
+		unsigned long flags;
+
+		local_irq_save(flags);
+		*tail = softnet_data[cpu].completion_queue;
+		softnet_data[cpu].completion_queue = head;
+		__cpu_raise_softirq(cpu, NET_TX_SOFTIRQ);
+		local_irq_restore(flags);
+	}
+}
+
 /* Use this variant in places where it could be invoked
  * either from interrupt or non-interrupt context.
  */
@@ -552,6 +619,12 @@ static inline void dev_kfree_skb_any(struct sk_buff *skb)
 extern void		net_call_rx_atomic(void (*fn)(void));
 #define HAVE_NETIF_RX 1
 extern int		netif_rx(struct sk_buff *skb);
+#define HAVE_NETIF_RECEIVE_SKB 1
+extern int		netif_receive_skb(struct sk_buff *skb);
+#ifdef CONFIG_SMP
+extern int		netdev_rps;
+extern void		netdev_rps_record(u32 raddr, u32 laddr, u16 rport, u16 lport);
+#endif
 extern int		dev_ioctl(unsigned int cmd, void *);
 extern int		dev_change_flags(struct net_device *, unsigned);
 extern void		dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev);
@@ -623,6 +696,103 @@ static inline void netif_device_attach(struct net_device *dev)
 	}
 }
 
+/*
+ * Polled receive.  Instead of calling netif_rx() for every packet from
+ * its interrupt handler, a driver with a poll method masks its receive
+ * interrupts and calls netif_rx_schedule().  Its poll method is then
+ * called from the NET_RX softirq with a budget; it passes at most
+ * min(*budget, dev->quota) packets to netif_receive_skb(), subtracts
+ * them from both and returns 1 if there is more work.  Otherwise it
+ * calls netif_rx_complete(), unmasks its interrupts and returns 0.
+ * Under overload the packets that cannot be handled are left on the
+ * receive ring for the hardware to drop, before any work is done on
+ * them.
+ */
+
+/* Test if receive needs to be scheduled */
+static inline int netif_rx_schedule_prep(struct net_device *dev)
+{
+	return netif_running(dev) &&
+		!test_and_set_bit(__LINK_STATE_RX_SCHED, &dev->state);
+}
+
+/* Add the device to the poll list of this CPU, after a successful
+ * netif_rx_schedule_prep().
+ */
+static inline void __netif_rx_schedule(struct net_device *dev)
+{
+	unsigned long flags;
+	int cpu = smp_processor_id();
+
+	local_irq_save(flags);
+	dev_hold(dev);
+	list_add_tail(&dev->poll_list, &softnet_data[cpu].poll_list);
+	if (dev->quota < 0)
+		dev->quota += dev->weight;
+	else
+		dev->quota = dev->weight;
+	__cpu_raise_softirq(cpu, NET_RX_SOFTIRQ);
+	local_irq_restore(flags);
+}
+
+/* Try to reschedule poll. Called by an irq handler. */
+static inline void netif_rx_schedule(struct net_device *dev)
+{
+	if (netif_rx_schedule_prep(dev))
+		__netif_rx_schedule(dev);
+}
+
+/* Try to reschedule poll. Called by dev->poll() after netif_rx_complete(),
+ * when more work turned up before the interrupts were unmasked.
+ */
+static inline int netif_rx_reschedule(struct net_device *dev, int undo)
+{
+	if (netif_rx_schedule_prep(dev)) {
+		unsigned long flags;
+		int cpu = smp_processor_id();
+
+		dev->quota += undo;
+
+		local_irq_save(flags);
+		list_add_tail(&dev->poll_list, &softnet_data[cpu].poll_list);
+		__cpu_raise_softirq(cpu, NET_RX_SOFTIRQ);
+		local_irq_restore(flags);
+		return 1;
+	}
+	return 0;
+}
+
+/* Remove the device from the poll list.  Called by dev->poll(), with
+ * the receive interrupts of the device still masked.
+ */
+static inline void netif_rx_complete(struct net_device *dev)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (!test_bit(__LINK_STATE_RX_SCHED, &dev->state))
+		BUG();
+	list_del(&dev->poll_list);
+	smp_mb__before_clear_bit();
+	clear_bit(__LINK_STATE_RX_SCHED, &dev->state);
+	local_irq_restore(flags);
+}
+
+/* Keep dev->poll() from being scheduled, e.g. while the ring is reset */
+static inline void netif_poll_disable(struct net_device *dev)
+{
+	while (test_and_set_bit(__LINK_STATE_RX_SCHED, &dev->state)) {
+		/* No hurry. */
+		current->state = TASK_INTERRUPTIBLE;
+		schedule_timeout(1);
+	}
+}
+
+static inline void netif_poll_enable(struct net_device *dev)
+{
+	clear_bit(__LINK_STATE_RX_SCHED, &dev->state);
+}
+
 /* These functions live elsewhere (drivers/net/net_init.c, but related) */
 
 extern void		ether_setup(struct net_device *dev);
@@ -1,5 +1,7 @@
 #ifndef _IP_CONNTRACK_CORE_H
 #define _IP_CONNTRACK_CORE_H
+#include <linux/threads.h>
+#include <linux/cache.h>
 #include <linux/netfilter_ipv4/lockhelp.h>
 
 /* This header is used to share core functionality between the
@@ -39,6 +41,45 @@ void ip_conntrack_confirm(struct ip_conntrack *ct);
 extern unsigned int ip_conntrack_htable_size;
 extern struct list_head *ip_conntrack_hash;
 extern struct list_head expect_list;
+
+/* ip_conntrack_lock covers the protocol, helper and expectation
+   lists.  Hash bucket n is covered by ip_conntrack_hash_lock[n %
+   IP_CT_HASH_LOCKS].  Take ip_conntrack_lock first, then bucket
+   locks in ascending order. */
+#define IP_CT_HASH_LOCKS 256
+#define IP_CT_BUCKET_LOCK(n) \
+	(&ip_conntrack_hash_lock[(n) & (IP_CT_HASH_LOCKS - 1)])
+
 DECLARE_RWLOCK_EXTERN(ip_conntrack_lock);
+DECLARE_RWLOCK_ARRAY_EXTERN(ip_conntrack_hash_lock, IP_CT_HASH_LOCKS);
+
+#ifdef CONFIG_NETFILTER_DEBUG
+/* Which lock covers a list, for ASSERT_READ_LOCK and friends. */
+static inline struct rwlock_debug *
+ip_conntrack_list_lock(const struct list_head *head)
+{
+	if (head >= ip_conntrack_hash
+	    && head < ip_conntrack_hash + ip_conntrack_htable_size)
+		return IP_CT_BUCKET_LOCK(head - ip_conntrack_hash);
+	return &ip_conntrack_lock;
+}
+#endif
+
+/* Per-CPU, so that counting does not bounce a cache line. */
+struct ip_conntrack_stat
+{
+	unsigned int searched;		/* chain entries looked at */
+	unsigned int found;
+	unsigned int new;
+	unsigned int invalid;
+	unsigned int delete;
+	unsigned int insert_failed;
+	unsigned int drop;
+	unsigned int early_drop;
+	unsigned int expect_new;
+} ____cacheline_aligned;
+
+extern struct ip_conntrack_stat ip_conntrack_stat[NR_CPUS];
+#define IP_CT_STAT_INC(count) (ip_conntrack_stat[smp_processor_id()].count++)
 #endif /* _IP_CONNTRACK_CORE_H */
 
@@ -50,9 +50,18 @@ struct ip_nat_multi_range
 #include <linux/list.h>
 #include <linux/netfilter_ipv4/lockhelp.h>
 
-/* Protects NAT hash tables, and NAT-private part of conntracks. */
+/* Protects the protocol, helper and expectation lists.  Setting up a
+   binding holds it for reading; packets look at the lists under
+   BR_NETPROTO_LOCK, so changing them takes that too. */
 DECLARE_RWLOCK_EXTERN(ip_nat_lock);
 
+/* The NAT-private part of a conntrack is protected by the lock its
+   address picks.  Take ip_nat_lock before it. */
+#define IP_NAT_INFO_LOCKS 256
+#define IP_NAT_INFO_LOCK(ct) \
+	(&ip_nat_info_lock[((unsigned long)(ct) >> 8) & (IP_NAT_INFO_LOCKS-1)])
+DECLARE_RWLOCK_ARRAY_EXTERN(ip_nat_info_lock, IP_NAT_INFO_LOCKS);
+
 /* Hashes for by-source and IP/protocol. */
 struct ip_nat_hash
 {
@@ -60,6 +69,9 @@ struct ip_nat_hash
 
 	/* conntrack we're embedded in: NULL if not in hash. */
 	struct ip_conntrack *conntrack;
+
+	/* Chain we're on, while in hash. */
+	unsigned int hash;
 };
 
 /* Worst case: local-out manip + 1 post-routing, and reverse dirn. */
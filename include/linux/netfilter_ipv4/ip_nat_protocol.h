@@ -54,4 +54,12 @@ extern int init_protocols(void) __init;
 extern void cleanup_protocols(void);
 extern struct ip_nat_protocol *find_nat_proto(u_int16_t protonum);
 
+/* For unique_tuple: set *portptr (in tuple) to a port in
+   [min, min + range_size) which makes tuple unique. */
+extern int ip_nat_unique_port(struct ip_conntrack_tuple *tuple,
+			      u_int16_t *portptr,
+			      unsigned int min,
+			      unsigned int range_size,
+			      const struct ip_conntrack *conntrack);
+
 #endif /*_IP_NAT_PROTO_H*/
@@ -149,7 +149,9 @@ struct ipt_entry
 
 #define IPT_SO_SET_REPLACE	(IPT_BASE_CTL)
 #define IPT_SO_SET_ADD_COUNTERS	(IPT_BASE_CTL + 1)
-#define IPT_SO_SET_MAX		IPT_SO_SET_ADD_COUNTERS
+#define IPT_SO_SET_INSERT	(IPT_BASE_CTL + 2)
+#define IPT_SO_SET_DELETE	(IPT_BASE_CTL + 3)
+#define IPT_SO_SET_MAX		IPT_SO_SET_DELETE
 
 #define IPT_SO_GET_INFO		(IPT_BASE_CTL)
 #define IPT_SO_GET_ENTRIES	(IPT_BASE_CTL + 1)
@@ -270,6 +272,39 @@ struct ipt_counters_info
 	struct ipt_counters counters[0];
 };
 
+/* The argument to IPT_SO_SET_INSERT. */
+struct ipt_insert
+{
+	/* Which table. */
+	char name[IPT_TABLE_MAXNAMELEN];
+
+	/* Number of entries the table has now, as for num_counters. */
+	unsigned int num_entries;
+
+	/* Offset of the entry the new one goes in front of. */
+	unsigned int offset;
+
+	/* Size of the new entry */
+	unsigned int size;
+
+	/* The new entry (hangs off end).  A jump in it is an offset in
+	   the table as it is now. */
+	struct ipt_entry entry[0];
+};
+
+/* The argument to IPT_SO_SET_DELETE. */
+struct ipt_delete
+{
+	/* Which table. */
+	char name[IPT_TABLE_MAXNAMELEN];
+
+	/* Number of entries the table has now, as for num_counters. */
+	unsigned int num_entries;
+
+	/* Offset of the entry to delete. */
+	unsigned int offset;
+};
+
 /* The argument to IPT_SO_GET_ENTRIES. */
 struct ipt_get_entries
 {
@@ -0,0 +1,58 @@
+#ifndef _IPT_SET_H
+#define _IPT_SET_H
+
+/* Sets of addresses (or address/port pairs) kept in the kernel, so
+   that one rule can test membership in a large list, and the list can
+   be changed without touching the ruleset. */
+
+#define IPT_SET_MAXNAMELEN	32
+
+/* Set types. */
+#define IPT_SET_IPHASH		1	/* addresses, hashed */
+#define IPT_SET_IPPORTHASH	2	/* address/port pairs, hashed */
+#define IPT_SET_IPMAP		3	/* addresses in one network, a bit each */
+
+/* Socket options, on a raw IPv4 socket like those of ip_tables.
+   All of them take a struct ipt_set_req. */
+#define IPT_SET_BASE_CTL	80	/* clear of ip_tables' 64..67 */
+
+#define IPT_SET_SO_CREATE	(IPT_SET_BASE_CTL)
+#define IPT_SET_SO_DESTROY	(IPT_SET_BASE_CTL + 1)
+#define IPT_SET_SO_FLUSH	(IPT_SET_BASE_CTL + 2)
+#define IPT_SET_SO_ADD		(IPT_SET_BASE_CTL + 3)
+#define IPT_SET_SO_DEL		(IPT_SET_BASE_CTL + 4)
+#define IPT_SET_SO_MAX		IPT_SET_SO_DEL
+
+/* Largest hash and bitmap; a bitmap of this many bits is a /12. */
+#define IPT_SET_MAXSIZE		(1 << 20)
+
+struct ipt_set_req {
+	char name[IPT_SET_MAXNAMELEN];
+
+	/* CREATE: the type, and for hashes the number of buckets
+	   (0 for the default), for IPT_SET_IPMAP the network. */
+	u_int32_t type;
+	u_int32_t hashsize;
+
+	/* Network byte order.  ADD and DEL take ip (and port); CREATE
+	   of an IPT_SET_IPMAP takes ip and mask. */
+	u_int32_t ip;
+	u_int32_t mask;
+	u_int16_t port;
+};
+
+/* Which address, and which port, of the packet to look up. */
+#define IPT_SET_SRC		0x01
+#define IPT_SET_SRCPORT		0x02
+
+struct ipt_set;
+
+struct ipt_set_info {
+	char name[IPT_SET_MAXNAMELEN];
+	u_int8_t flags;
+	u_int8_t invert;
+
+	/* Used internally by the kernel */
+	struct ipt_set *set;
+};
+#endif /*_IPT_SET_H*/
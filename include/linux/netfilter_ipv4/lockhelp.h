@@ -31,6 +31,10 @@ extern struct spinlock_debug l
 struct rwlock_debug l = { RW_LOCK_UNLOCKED, 0, 0 }
 #define DECLARE_RWLOCK_EXTERN(l)		\
 extern struct rwlock_debug l
+#define DECLARE_RWLOCK_ARRAY(l, n)					\
+struct rwlock_debug l[n] = { [0 ... (n)-1] = { RW_LOCK_UNLOCKED, 0, 0 } }
+#define DECLARE_RWLOCK_ARRAY_EXTERN(l, n)	\
+extern struct rwlock_debug l[n]
 
 #define MUST_BE_LOCKED(l)						\
 do { if (atomic_read(&(l)->locked_by) != smp_processor_id())		\
@@ -110,6 +114,9 @@ do {								\
 #define DECLARE_LOCK_EXTERN(l) extern spinlock_t l
 #define DECLARE_RWLOCK(l) rwlock_t l = RW_LOCK_UNLOCKED
 #define DECLARE_RWLOCK_EXTERN(l) extern rwlock_t l
+#define DECLARE_RWLOCK_ARRAY(l, n) \
+rwlock_t l[n] = { [0 ... (n)-1] = RW_LOCK_UNLOCKED }
+#define DECLARE_RWLOCK_ARRAY_EXTERN(l, n) extern rwlock_t l[n]
 
 #define MUST_BE_LOCKED(l)
 #define MUST_BE_UNLOCKED(l)
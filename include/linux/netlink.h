@@ -108,6 +108,7 @@ extern int netlink_unicast(struct sock *ssk, struct sk_buff *skb, __u32 pid, int
 extern void netlink_broadcast(struct sock *ssk, struct sk_buff *skb, __u32 pid,
 			      __u32 group, int allocation);
 extern void netlink_set_err(struct sock *ssk, __u32 pid, __u32 group, int code);
+extern int netlink_has_listeners(struct sock *ssk, __u32 pid, __u32 group);
 
 /*
  *	skb should fit one page. This choice is good for headerless malloc.
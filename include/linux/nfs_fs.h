@@ -39,9 +39,16 @@
  */
 #define NFS_MAX_DIRCACHE		16
 
-#define NFS_MAX_FILE_IO_BUFFER_SIZE	32768
+#define NFS_MAX_FILE_IO_BUFFER_SIZE	65536
+#define NFS_MAX_UDP_IO_BUFFER_SIZE	32768
 #define NFS_DEF_FILE_IO_BUFFER_SIZE	4096
 
+/*
+ * How many READ or WRITE calls a mount keeps going at once, unless
+ * the mount says otherwise. The RPC slot table caps it at RPC_MAXCONG.
+ */
+#define NFS_DEF_RPC_WINDOW		8
+
 /*
  * The upper limit on timeouts for the exponential backoff algorithm.
  */
@@ -77,6 +84,7 @@
 #define NFS_CACHE_ATIME(inode)		((inode)->u.nfs_i.read_cache_atime)
 #define NFS_CACHE_ISIZE(inode)		((inode)->u.nfs_i.read_cache_isize)
 #define NFS_NEXTSCAN(inode)		((inode)->u.nfs_i.nextscan)
+#define NFS_CACHE_CHANGE(inode)		((inode)->u.nfs_i.cache_change_attribute)
 #define NFS_CACHEINV(inode) \
 do { \
 	NFS_READTIME(inode) = jiffies - NFS_MAXATTRTIMEO(inode) - 1; \
@@ -119,6 +127,7 @@ do { \
 #define FLUSH_SYNC		1	/* file being synced, or contention */
 #define FLUSH_WAIT		2	/* wait for completion */
 #define FLUSH_STABLE		4	/* commit to stable storage */
+#define FLUSH_GATHER		8	/* only full-sized writes, within the window */
 
 static inline
 loff_t page_offset(struct page *page)
@@ -50,6 +50,13 @@ struct nfs_inode_info {
 	unsigned long		attrtimeo;
 	unsigned long		attrtimeo_timestamp;
 
+	/*
+	 * For directories: the jiffies when the contents were last seen
+	 * to change. A dentry whose d_time matches it was valid then,
+	 * and needs no LOOKUP as long as the directory stays unchanged.
+	 */
+	unsigned long		cache_change_attribute;
+
 	/*
 	 * This is the cookie verifier used for NFSv3 readdir
 	 * operations
@@ -62,7 +62,7 @@ struct nfs_fsinfo {
 /* Arguments to the read call.
  * Note that NFS_READ_MAXIOV must be <= (MAX_IOVEC-2) from sunrpc/xprt.h
  */
-#define NFS_READ_MAXIOV 8
+#define NFS_READ_MAXIOV 16
 
 struct nfs_readargs {
 	struct nfs_fh *		fh;
@@ -81,7 +81,7 @@ struct nfs_readres {
 /* Arguments to the write call.
  * Note that NFS_WRITE_MAXIOV must be <= (MAX_IOVEC-2) from sunrpc/xprt.h
  */
-#define NFS_WRITE_MAXIOV        8
+#define NFS_WRITE_MAXIOV        16
 struct nfs_writeargs {
 	struct nfs_fh *		fh;
 	__u32			offset;
@@ -14,12 +14,10 @@
 #include <linux/sched.h>
 
 /*
- * Representation of a reply cache entry. The first two members *must*
- * be hash_next and hash_prev.
+ * Representation of a reply cache entry. Each entry belongs to one
+ * hash bucket for good, and sits on the LRU list of that bucket.
  */
 struct svc_cacherep {
-	struct svc_cacherep *	c_hash_next;
-	struct svc_cacherep *	c_hash_prev;
 	struct svc_cacherep *	c_lru_next;
 	struct svc_cacherep *	c_lru_prev;
 	unsigned char		c_state,	/* unused, inprog, done */
@@ -30,9 +28,14 @@ struct svc_cacherep {
 	u32			c_prot;
 	u32			c_proc;
 	u32			c_vers;
+	u32			c_csum;		/* checksum of the arguments */
+	unsigned int		c_len;		/* length of the arguments */
 	unsigned long		c_timestamp;
 	union {
-		struct svc_buf	u_buffer;
+		struct {
+			u32 *	buf;
+			int	len;
+		}		u_buffer;
 		u32		u_status;
 	}			c_u;
 };
@@ -72,6 +75,12 @@ enum {
  */
 #define RC_DELAY		(HZ/5)
 
+/*
+ * Number of bytes of the call arguments that are checksummed to tell
+ * a retransmission from a new call that happens to reuse the XID.
+ */
+#define RC_CSUMLEN		256
+
 void	nfsd_cache_init(void);
 void	nfsd_cache_shutdown(void);
 int	nfsd_cache_lookup(struct svc_rqst *, int);
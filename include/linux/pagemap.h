@@ -30,6 +30,7 @@
 
 #define page_cache_get(x)	get_page(x)
 #define page_cache_alloc()	alloc_pages(GFP_HIGHUSER, 0)
+#define page_cache_alloc_cold()	alloc_pages(GFP_HIGHUSER | __GFP_COLD, 0)
 #define page_cache_free(x)	__free_page(x)
 #define page_cache_release(x)	__free_page(x)
 
@@ -38,47 +39,25 @@
  */
 #define page_cache_entry(x)	virt_to_page(x)
 
-extern unsigned int page_hash_bits;
-#define PAGE_HASH_BITS (page_hash_bits)
-#define PAGE_HASH_SIZE (1 << PAGE_HASH_BITS)
-
-extern atomic_t page_cache_size; /* # of pages currently in the hash table */
-extern struct page **page_hash_table;
-
-extern void page_cache_init(unsigned long);
+extern atomic_t page_cache_size; /* # of pages currently in the page cache */
 
 /*
- * We use a power-of-two hash table to avoid a modulus,
- * and get a reasonable hash by knowing roughly how the
- * inode pointer and indexes are distributed (ie, we
- * roughly know which bits are "significant")
- *
- * For the time being it will work for struct address_space too (most of
- * them sitting inside the inodes). We might want to change it later.
+ * The pages of a mapping are indexed by mapping->page_tree, under
+ * mapping->page_lock.
  */
-extern inline unsigned long _page_hashfn(struct address_space * mapping, unsigned long index)
-{
-#define i (((unsigned long) mapping)/(sizeof(struct inode) & ~ (sizeof(struct inode) - 1)))
-#define s(x) ((x)+((x)>>PAGE_HASH_BITS))
-	return s(i+index) & (PAGE_HASH_SIZE-1);
-#undef i
-#undef s
-}
-
-#define page_hash(mapping,index) (page_hash_table+_page_hashfn(mapping,index))
-
-extern struct page * __find_get_page(struct address_space *mapping,
-				     unsigned long offset, struct page **hash);
-extern struct page * __find_lock_page (struct address_space * mapping,
-				unsigned long index, struct page **hash);
+extern struct page * find_get_page(struct address_space *mapping,
+				   unsigned long index);
+extern struct page * find_lock_page(struct address_space *mapping,
+				    unsigned long index);
+extern unsigned int find_get_pages(struct address_space *mapping,
+				   unsigned long start, unsigned int nr_pages,
+				   struct page **pages);
 extern void lock_page(struct page *page);
-#define find_lock_page(mapping, index) \
-		__find_lock_page(mapping, index, page_hash(mapping, index))
-
-extern void __add_page_to_hash_queue(struct page * page, struct page **p);
 
-extern void add_to_page_cache(struct page * page, struct address_space *mapping, unsigned long index);
-extern void add_to_page_cache_locked(struct page * page, struct address_space *mapping, unsigned long index);
+extern int add_to_page_cache(struct page * page, struct address_space *mapping,
+			     unsigned long index, int gfp_mask);
+extern int add_to_page_cache_locked(struct page * page, struct address_space *mapping,
+				    unsigned long index, int gfp_mask);
 
 extern void ___wait_on_page(struct page *);
 
@@ -0,0 +1,40 @@
+#ifndef _LINUX_PGTCACHE_H
+#define _LINUX_PGTCACHE_H
+
+/*
+ * Per-CPU page table cache ("quicklist") statistics and water marks.
+ *
+ * The quicklists themselves are arch private; architectures that keep
+ * them count a hit or a miss of the cache on every page table
+ * allocation, and check_pgt_cache() sizes each CPU's low and high
+ * water marks from its recent allocation rate.  See mm/memory.c.
+ */
+
+#include <linux/threads.h>
+#include <linux/cache.h>
+#include <linux/smp.h>
+
+struct pgt_cache_stat {
+	unsigned long hits;	/* allocations served from the quicklist */
+	unsigned long misses;	/* allocations that went to the page allocator */
+	unsigned long trimmed;	/* pages given back by check_pgt_cache() */
+	unsigned long last;	/* hits + misses at the last adjustment */
+	unsigned long stamp;	/* jiffies at the last adjustment */
+	int low, high;		/* current water marks */
+} ____cacheline_aligned;
+
+extern struct pgt_cache_stat pgt_cache_stat[NR_CPUS];
+
+static inline void pgt_cache_count(int hit)
+{
+	struct pgt_cache_stat *s = &pgt_cache_stat[smp_processor_id()];
+
+	if (hit)
+		s->hits++;
+	else
+		s->misses++;
+}
+
+extern int get_pgt_cache_info(char *);
+
+#endif /* _LINUX_PGTCACHE_H */
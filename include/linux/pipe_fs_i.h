@@ -2,10 +2,29 @@
 #define _LINUX_PIPE_FS_I_H
 
 #define PIPEFS_MAGIC 0x50495045
+
+/* Number of page buffers in a pipe, must be a power of two */
+#define PIPE_BUFFERS		16
+
+/*
+ * A pipe buffer is a piece of one page.  The page is either private
+ * to the pipe (write() copied into it) or borrowed from the page cache
+ * or another pipe by splice().  Only a private page that nobody else
+ * holds may be appended to; PIPE_BUF_MERGE marks those.
+ */
+struct pipe_buffer {
+	struct page *page;
+	unsigned int offset, len;
+	unsigned int flags;
+};
+
+#define PIPE_BUF_MERGE		1
+
 struct pipe_inode_info {
 	wait_queue_head_t wait;
-	char *base;
-	unsigned int start;
+	unsigned int nrbufs, curbuf;
+	struct pipe_buffer bufs[PIPE_BUFFERS];
+	struct page *tmp_page;
 	unsigned int readers;
 	unsigned int writers;
 	unsigned int waiting_readers;
@@ -14,14 +33,12 @@ struct pipe_inode_info {
 	unsigned int w_counter;
 };
 
-/* Differs from PIPE_BUF in that PIPE_SIZE is the length of the actual
-   memory allocation, whereas PIPE_BUF makes atomicity guarantees.  */
-#define PIPE_SIZE		PAGE_SIZE
-
 #define PIPE_SEM(inode)		(&(inode).i_sem)
 #define PIPE_WAIT(inode)	(&(inode).i_pipe->wait)
-#define PIPE_BASE(inode)	((inode).i_pipe->base)
-#define PIPE_START(inode)	((inode).i_pipe->start)
+#define PIPE_NRBUFS(inode)	((inode).i_pipe->nrbufs)
+#define PIPE_CURBUF(inode)	((inode).i_pipe->curbuf)
+#define PIPE_BUFS(inode)	((inode).i_pipe->bufs)
+#define PIPE_TMPPAGE(inode)	((inode).i_pipe->tmp_page)
 #define PIPE_LEN(inode)		((inode).i_size)
 #define PIPE_READERS(inode)	((inode).i_pipe->readers)
 #define PIPE_WRITERS(inode)	((inode).i_pipe->writers)
@@ -31,15 +48,15 @@ struct pipe_inode_info {
 #define PIPE_WCOUNTER(inode)	((inode).i_pipe->w_counter)
 
 #define PIPE_EMPTY(inode)	(PIPE_LEN(inode) == 0)
-#define PIPE_FULL(inode)	(PIPE_LEN(inode) == PIPE_SIZE)
-#define PIPE_FREE(inode)	(PIPE_SIZE - PIPE_LEN(inode))
-#define PIPE_END(inode)	((PIPE_START(inode) + PIPE_LEN(inode)) & (PIPE_SIZE-1))
-#define PIPE_MAX_RCHUNK(inode)	(PIPE_SIZE - PIPE_START(inode))
-#define PIPE_MAX_WCHUNK(inode)	(PIPE_SIZE - PIPE_END(inode))
+#define PIPE_FULL(inode)	(PIPE_NRBUFS(inode) == PIPE_BUFFERS)
+
+/* splice() flags */
+#define SPLICE_F_NONBLOCK	1	/* don't block on the pipe */
 
 /* Drop the inode semaphore and wait for a pipe event, atomically */
 void pipe_wait(struct inode * inode);
 
 struct inode* pipe_new(struct inode* inode);
+void free_pipe_info(struct inode* inode);
 
 #endif
@@ -164,15 +164,17 @@ struct tc_sfq_qopt
 	__u32		limit;		/* Maximal packets in queue */
 	unsigned	divisor;	/* Hash divisor  */
 	unsigned	flows;		/* Maximal number of flows  */
+	unsigned	depth;		/* Maximal packets in one flow */
 };
 
 /*
- *  NOTE: limit, divisor and flows are hardwired to code at the moment.
+ *  NOTE: limit, divisor, flows and depth are fixed when the qdisc is
+ *	created; zero selects the default.
  *
- *	limit=flows=128, divisor=1024;
+ *	limit=127, flows=depth=128, divisor=1024;
  *
- *	The only reason for this is efficiency, it is possible
- *	to change these parameters in compile time.
+ *	divisor must be a power of 2. depth may be left out by
+ *	old tools.
  */
 
 /* RED section */
@@ -248,6 +250,54 @@ struct tc_gred_sopt
        __u8            grio;
 };
 
+/* HTB section */
+
+#define TC_HTB_NUMPRIO		8
+#define TC_HTB_MAXDEPTH		8
+#define TC_HTB_PROTOVER		3	/* the same as HTB and TC's major */
+
+struct tc_htb_opt
+{
+	struct tc_ratespec	rate;
+	struct tc_ratespec	ceil;
+	__u32		buffer;
+	__u32		cbuffer;
+	__u32		quantum;
+	__u32		level;		/* out only */
+	__u32		prio;
+};
+
+struct tc_htb_glob
+{
+	__u32		version;	/* to match HTB/TC */
+	__u32		rate2quantum;	/* bps->quantum divisor */
+	__u32		defcls;		/* default class number */
+	__u32		debug;		/* unused */
+
+	/* stats */
+	__u32		direct_pkts;	/* count of non shaped packets */
+};
+
+enum
+{
+	TCA_HTB_UNSPEC,
+	TCA_HTB_PARMS,
+	TCA_HTB_INIT,
+	TCA_HTB_CTAB,
+	TCA_HTB_RTAB,
+};
+
+#define TCA_HTB_MAX	TCA_HTB_RTAB
+
+struct tc_htb_xstats
+{
+	__u32		lends;
+	__u32		borrows;
+	__u32		giants;		/* too big packets (rate will not be accurate) */
+	__s32		tokens;
+	__s32		ctokens;
+};
+
 /* CBQ section */
 
 #define TC_CBQ_MAXPRIO		8
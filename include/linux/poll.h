@@ -11,8 +11,13 @@
 #include <asm/uaccess.h>
 
 struct poll_table_page;
+struct poll_table_struct;
+
+/* What poll_wait() does with each wait queue a file's poll() hands it */
+typedef void (*poll_queue_proc)(struct file *, wait_queue_head_t *, struct poll_table_struct *);
 
 typedef struct poll_table_struct {
+	poll_queue_proc qproc;
 	int error;
 	struct poll_table_page * table;
 } poll_table;
@@ -22,14 +27,20 @@ extern void __pollwait(struct file * filp, wait_queue_head_t * wait_address, pol
 extern inline void poll_wait(struct file * filp, wait_queue_head_t * wait_address, poll_table *p)
 {
 	if (p && wait_address)
-		__pollwait(filp, wait_address, p);
+		p->qproc(filp, wait_address, p);
 }
 
-static inline void poll_initwait(poll_table* pt)
+static inline void init_poll_funcptr(poll_table *pt, poll_queue_proc qproc)
 {
+	pt->qproc = qproc;
 	pt->error = 0;
 	pt->table = NULL;
 }
+
+static inline void poll_initwait(poll_table* pt)
+{
+	init_poll_funcptr(pt, __pollwait);
+}
 extern void poll_freewait(poll_table* pt);
 
 
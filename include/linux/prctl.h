@@ -20,4 +20,8 @@
 #define PR_GET_KEEPCAPS   7
 #define PR_SET_KEEPCAPS   8
 
+/* Get/set whether anonymous memory gets pages of consecutive cache colours */
+#define PR_GET_PAGE_COLOUR 9
+#define PR_SET_PAGE_COLOUR 10
+
 #endif /* _LINUX_PRCTL_H */
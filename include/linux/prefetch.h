@@ -0,0 +1,27 @@
+/*
+ *  Generic cache management functions. Everything is arch-specific,
+ *  but this header exists to make sure the defines/functions can be
+ *  used in a generic way.
+ *
+ *  prefetch(x)  	- prefetches the cacheline at "x" for read
+ *  prefetchw(x)	- prefetches the cacheline at "x" for write
+ *
+ *  They are hints only: they never fault, so they may be given any
+ *  address, NULL included.  Architectures without the instructions
+ *  get empty functions.
+ */
+
+#ifndef _LINUX_PREFETCH_H
+#define _LINUX_PREFETCH_H
+
+#include <asm/processor.h>
+
+#ifndef ARCH_HAS_PREFETCH
+static inline void prefetch(const void *x) {;}
+#endif
+
+#ifndef ARCH_HAS_PREFETCHW
+static inline void prefetchw(const void *x) {;}
+#endif
+
+#endif /* _LINUX_PREFETCH_H */
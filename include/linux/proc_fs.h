@@ -112,6 +112,7 @@ extern struct dentry *proc_lookup(struct inode *, struct dentry *);
 
 extern struct file_operations proc_kcore_operations;
 extern struct file_operations proc_kmsg_operations;
+extern struct file_operations proc_taskstats_operations;
 extern struct file_operations ppc_htab_operations;
 
 /*
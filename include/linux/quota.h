@@ -85,7 +85,7 @@ extern int nr_dquots, nr_free_dquots;
 extern int max_dquots;
 extern int dquot_root_squash;
 
-#define NR_DQHASH 43            /* Just an arbitrary number */
+#define NR_DQHASH 43            /* Chains sharing a dqget() update count */
 #define NR_DQUOTS 1024          /* Maximum number of quotas active at one time (Configurable from /proc/sys/fs) */
 
 /*
@@ -0,0 +1,47 @@
+/*
+ * linux/include/linux/radix-tree.h
+ *
+ * A radix tree maps unsigned long indices to pointers. Every level
+ * decodes RADIX_TREE_MAP_SHIFT bits of the index, and the tree is only
+ * as high as the largest index in it requires, so small files need a
+ * single node and lookups never touch more than a few cache lines.
+ *
+ * The tree does no locking of its own: lookups, insertions and
+ * deletions have to be serialised by the user.
+ */
+
+#ifndef _LINUX_RADIX_TREE_H
+#define _LINUX_RADIX_TREE_H
+
+struct radix_tree_node;
+
+struct radix_tree_root {
+	unsigned int		height;		/* levels of nodes */
+	struct radix_tree_node	*rnode;
+};
+
+#define RADIX_TREE_INIT()	{ 0, NULL }
+#define INIT_RADIX_TREE(root)			\
+do {						\
+	(root)->height = 0;			\
+	(root)->rnode = NULL;			\
+} while (0)
+
+extern int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
+extern void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
+extern void *radix_tree_delete(struct radix_tree_root *, unsigned long);
+extern unsigned int radix_tree_gang_lookup(struct radix_tree_root *,
+			void **results, unsigned long first_index,
+			unsigned int max_items);
+
+/*
+ * Insertions normally run under a spinlock and so allocate their nodes
+ * atomically. radix_tree_preload() fills a per-CPU reserve beforehand,
+ * with a mask that may sleep, so that an insertion done right after it
+ * cannot run out of memory. Don't sleep between the two.
+ */
+extern int radix_tree_preload(int gfp_mask);
+
+extern void radix_tree_init(void);
+
+#endif	/* _LINUX_RADIX_TREE_H */
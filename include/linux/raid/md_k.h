@@ -200,6 +200,12 @@ struct mddev_s
 	unsigned long			curr_resync;	/* blocks scheduled */
 	unsigned long			resync_mark;	/* a recent timestamp */
 	unsigned long			resync_mark_cnt;/* blocks written at resync_mark */
+	unsigned long			recovery_cp;	/* resync restarts here */
+	int				sync_speed_min;	/* KB/sec, 0: system wide */
+	int				sync_speed_max;
+	char				ctl_name[8];	/* /proc/sys/dev/raid/mdN */
+	ctl_table			ctl_table[3], ctl_md[2], ctl_raid[2], ctl_root[2];
+	struct ctl_table_header		*ctl_header;
 	char				*name;
 	int				recovery_running;
 	struct semaphore		reconfig_sem;
@@ -135,7 +135,8 @@ typedef struct mdp_superblock_s {
 	__u32 events_lo;	/*  7 low-order of superblock update count    */
 	__u32 events_hi;	/*  8 high-order of superblock update count   */
 #endif
-	__u32 gstate_sreserved[MD_SB_GENERIC_STATE_WORDS - 9];
+	__u32 recovery_cp;	/*  9 resync checkpoint, blocks in sync below */
+	__u32 gstate_sreserved[MD_SB_GENERIC_STATE_WORDS - 10];
 
 	/*
 	 * Personality information
@@ -7,8 +7,9 @@ struct mirror_info {
 	int		number;
 	int		raid_disk;
 	kdev_t		dev;
-	int		sect_limit;
 	int		head_position;
+	atomic_t	nr_pending;	/* reads outstanding */
+	unsigned long	reads;		/* reads issued, for /proc/mdstat */
 
 	/*
 	 * State bits:
@@ -28,7 +29,6 @@ struct raid1_private_data {
 	int			working_disks;
 	int			last_used;
 	unsigned long		next_sect;
-	int			sect_count;
 	mdk_thread_t		*thread, *resync_thread;
 	int			resync_mirrors;
 	struct mirror_info	*spare;
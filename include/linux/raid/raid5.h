@@ -3,6 +3,8 @@
 
 #include <linux/raid/md.h>
 #include <linux/raid/xor.h>
+#include <linux/sysctl.h>
+#include <linux/timer.h>
 
 /*
  *
@@ -155,6 +157,8 @@ struct stripe_head {
 #define STRIPE_HANDLE		2
 #define	STRIPE_SYNCING		3
 #define	STRIPE_INSYNC		4
+#define	STRIPE_DELAYED		5	/* partial write, waiting for the rest */
+#define	STRIPE_PREREAD_ACTIVE	6	/* waited long enough, read and write */
 
 struct disk_info {
 	kdev_t	dev;
@@ -177,8 +181,16 @@ struct raid5_private_data {
 	int			raid_disks, working_disks, failed_disks;
 	int			resync_parity;
 	int			max_nr_stripes;
+	struct semaphore	cache_sem;   /* serializes cache resizing */
 
 	struct list_head	handle_list; /* stripes needing handling */
+	/*
+	 * Partial-stripe writes wait a little on delayed_list, so that
+	 * the rest of the stripe can arrive and parity be computed
+	 * without reading anything.
+	 */
+	struct list_head	delayed_list;
+	struct timer_list	delay_timer;
 	/*
 	 * Free stripes pool
 	 */
@@ -187,6 +199,16 @@ struct raid5_private_data {
 	md_wait_queue_head_t	wait_for_stripe;
 
 	md_spinlock_t		device_lock;
+
+	/*
+	 * Statistics, and their /proc/sys/dev/raid/mdN directory
+	 */
+	atomic_t		rmw_writes;	/* read-modify-write */
+	atomic_t		rcw_writes;	/* reconstruct, some blocks read */
+	atomic_t		full_writes;	/* whole stripe written, no reads */
+	char			ctl_name[8];
+	ctl_table		ctl_table[6], ctl_md[2], ctl_raid[2], ctl_root[2];
+	struct ctl_table_header	*ctl_header;
 };
 
 typedef struct raid5_private_data raid5_conf_t;
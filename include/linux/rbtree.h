@@ -0,0 +1,70 @@
+/*
+ * linux/include/linux/rbtree.h
+ *
+ * Red-black trees.
+ *
+ * The tree code only does the rebalancing; searching and inserting
+ * are left to the user, who knows how the keys compare. To insert a
+ * node, walk down from root->rb_node to the leaf position, then do
+ *
+ *	rb_link_node(&new->node, parent, link);
+ *	rb_insert_color(&new->node, root);
+ *
+ * where link is &parent->rb_left or &parent->rb_right (or
+ * &root->rb_node for an empty tree).
+ *
+ * Augmented trees keep a value in each node that is computed from the
+ * node itself and its two children, e.g. the largest gap anywhere in
+ * the subtree. rb_insert_augmented() and rb_erase_augmented() call the
+ * augment function on every node whose subtree changed, children
+ * before parents, so that the value is right everywhere afterwards.
+ */
+
+#ifndef _LINUX_RBTREE_H
+#define _LINUX_RBTREE_H
+
+#include <linux/kernel.h>
+#include <linux/stddef.h>
+
+typedef struct rb_node_s
+{
+	struct rb_node_s * rb_parent;
+	int rb_color;
+#define	RB_RED		0
+#define	RB_BLACK	1
+	struct rb_node_s * rb_right;
+	struct rb_node_s * rb_left;
+} rb_node_t;
+
+typedef struct rb_root_s
+{
+	struct rb_node_s * rb_node;
+} rb_root_t;
+
+#define RB_ROOT	(rb_root_t) { NULL, }
+#define	rb_entry(ptr, type, member)					\
+	((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
+
+typedef void (*rb_augment_f)(rb_node_t *);
+
+extern void rb_insert_color(rb_node_t *, rb_root_t *);
+extern void rb_erase(rb_node_t *, rb_root_t *);
+extern void rb_insert_augmented(rb_node_t *, rb_root_t *, rb_augment_f);
+extern void rb_erase_augmented(rb_node_t *, rb_root_t *, rb_augment_f);
+
+/* In-order iteration, all O(log n) worst case. */
+extern rb_node_t * rb_first(rb_root_t *);
+extern rb_node_t * rb_last(rb_root_t *);
+extern rb_node_t * rb_next(rb_node_t *);
+extern rb_node_t * rb_prev(rb_node_t *);
+
+static inline void rb_link_node(rb_node_t * node, rb_node_t * parent, rb_node_t ** rb_link)
+{
+	node->rb_parent = parent;
+	node->rb_color = RB_RED;
+	node->rb_left = node->rb_right = NULL;
+
+	*rb_link = node;
+}
+
+#endif	/* _LINUX_RBTREE_H */
@@ -280,9 +280,11 @@ enum
 #define RTAX_ADVMSS RTAX_ADVMSS
 	RTAX_REORDERING,
 #define RTAX_REORDERING RTAX_REORDERING
+	RTAX_MAXRATE,
+#define RTAX_MAXRATE RTAX_MAXRATE
 };
 
-#define RTAX_MAX RTAX_REORDERING
+#define RTAX_MAX RTAX_MAXRATE
 
 
 
@@ -70,14 +70,18 @@ extern unsigned long avenrun[];		/* Load averages */
 #define CT_TO_SECS(x)	((x) / HZ)
 #define CT_TO_USECS(x)	(((x) % HZ) * 1000000/HZ)
 
-extern int nr_running, nr_threads;
+extern int nr_threads;
 extern int last_pid;
+extern int pid_max;
 
 #include <linux/fs.h>
 #include <linux/time.h>
 #include <linux/param.h>
 #include <linux/resource.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/seqlock.h>
+#include <linux/rbtree.h>
 
 #include <asm/processor.h>
 
@@ -129,14 +133,13 @@ struct sched_param {
 #include <linux/spinlock.h>
 
 /*
- * This serializes "schedule()" and also protects
- * the run-queue from deletions/modifications (but
- * _adding_ to the beginning of the run-queue has
- * a separate lock).
+ * The tasklist_lock protects the list of all processes. The
+ * run-queues are per-CPU and have their own locks, which nest
+ * inside the tasklist_lock.
  */
 extern rwlock_t tasklist_lock;
-extern spinlock_t runqueue_lock;
 
+extern unsigned long nr_running(void);
 extern void sched_init(void);
 extern void init_idle(void);
 extern void show_state(void);
@@ -145,6 +148,15 @@ extern void trap_init(void);
 extern void update_process_times(int user);
 extern void update_one_process(struct task_struct *p, unsigned long user,
 			       unsigned long system, int cpu);
+extern void scheduler_tick(struct task_struct *p);
+extern void set_user_nice(struct task_struct *p, long nice);
+extern void set_cpus_allowed(struct task_struct *p, unsigned long new_mask);
+extern void quiescent_snapshot(unsigned long *snap);
+extern int quiescent_passed(unsigned long *snap);
+extern int schedstat_read_proc(char *page, char **start, off_t off,
+			       int count, int *eof, void *data);
+extern int schedstat_write_proc(struct file *file, const char *buffer,
+				unsigned long count, void *data);
 
 #define	MAX_SCHEDULE_TIMEOUT	LONG_MAX
 extern signed long FASTCALL(schedule_timeout(signed long timeout));
@@ -152,7 +164,6 @@ asmlinkage void schedule(void);
 
 extern int schedule_task(struct tq_struct *task);
 extern void flush_scheduled_tasks(void);
-extern int start_context_thread(void);
 extern int current_is_keventd(void);
 
 /*
@@ -196,13 +207,11 @@ struct files_struct {
 /* Maximum number of active map areas.. This is a random (large) number */
 #define MAX_MAP_COUNT	(65536)
 
-/* Number of map areas at which the AVL tree is activated. This is arbitrary. */
-#define AVL_MIN_MAP_COUNT	32
-
 struct mm_struct {
 	struct vm_area_struct * mmap;		/* list of VMAs */
-	struct vm_area_struct * mmap_avl;	/* tree of VMAs */
+	rb_root_t mm_rb;			/* tree of VMAs */
 	struct vm_area_struct * mmap_cache;	/* last find_vma result */
+	unsigned long mmap_cache_hits, mmap_cache_misses;
 	pgd_t * pgd;
 	atomic_t mm_users;			/* How many users with user space? */
 	atomic_t mm_count;			/* How many references to "struct mm_struct" (users count as 1) */
@@ -220,12 +229,16 @@ struct mm_struct {
 
 	/* Architecture-specific MM context */
 	mm_context_t context;
+
+	/* aio contexts, see fs/aio.c */
+	rwlock_t ioctx_list_lock;
+	struct kioctx *ioctx_list;
 };
 
 #define INIT_MM(name) \
 {			 				\
 	mmap:		&init_mmap, 			\
-	mmap_avl:	NULL, 				\
+	mm_rb:		{ &init_mmap.vm_rb }, 		\
 	mmap_cache:	NULL, 				\
 	pgd:		swapper_pg_dir, 		\
 	mm_users:	ATOMIC_INIT(2), 		\
@@ -233,6 +246,7 @@ struct mm_struct {
 	map_count:	1, 				\
 	mmap_sem:	__MUTEX_INITIALIZER(name.mmap_sem), \
 	page_table_lock: SPIN_LOCK_UNLOCKED, 		\
+	ioctx_list_lock: RW_LOCK_UNLOCKED,		\
 }
 
 struct signal_struct {
@@ -253,7 +267,8 @@ struct signal_struct {
  */
 struct user_struct {
 	atomic_t __count;	/* reference count */
-	atomic_t processes;	/* How many processes does this user have? */
+	atomic_t processes;	/* How many processes does this user have,
+				   less what is batched per CPU? */
 	atomic_t files;		/* How many open files does this user have? */
 
 	/* Hash table maintenance information */
@@ -288,8 +303,8 @@ struct task_struct {
 
 /*
  * offset 32 begins here on 32-bit platforms. We keep
- * all fields in a single cacheline that are needed for
- * the goodness() loop in schedule().
+ * all fields in a single cacheline that are needed by
+ * schedule() and the wakeup path.
  */
 	long counter;
 	long nice;
@@ -303,6 +318,10 @@ struct task_struct {
 	 */
 	struct list_head run_list;
 	unsigned long sleep_time;
+	int prio;			/* priority array slot */
+	struct prio_array *array;	/* NULL if not runnable */
+	cycles_t wake_stamp;		/* when last woken, for schedstat */
+	cycles_t last_run;		/* when last switched out (SMP) */
 
 	struct task_struct *next_task, *prev_task;
 	struct mm_struct *active_mm;
@@ -338,14 +357,21 @@ struct task_struct {
 	struct semaphore *vfork_sem;		/* for vfork() */
 	unsigned long rt_priority;
 	unsigned long it_real_value, it_prof_value, it_virt_value;
-	unsigned long it_real_incr, it_prof_incr, it_virt_incr;
-	struct timer_list real_timer;
+	unsigned long it_prof_incr, it_virt_incr;
+	struct timespec it_real_incr;
+	struct hrtimer real_timer;
 	struct tms times;
 	unsigned long start_time;
+#ifdef CONFIG_TSC_ACCOUNTING
+	cycles_t acct_stamp;		/* TSC when last switched in */
+	cycles_t acct_cycles;		/* cycles run before that */
+	unsigned long long acct_cutime, acct_cstime;	/* ns, of waited-for children */
+#endif
 	long per_cpu_utime[NR_CPUS], per_cpu_stime[NR_CPUS];
 /* mm fault and swap info: this can arguably be seen as either mm-specific or thread-specific */
 	unsigned long min_flt, maj_flt, nswap, cmin_flt, cmaj_flt, cnswap;
 	int swappable:1;
+	unsigned long page_colour;	/* colour + 1 for the page being allocated */
 /* process credentials */
 	uid_t uid,euid,suid,fsuid;
 	gid_t gid,egid,sgid,fsgid;
@@ -363,7 +389,7 @@ struct task_struct {
 	struct tty_struct *tty; /* NULL if no tty */
 	unsigned int locks; /* How many file locks are being held */
 /* ipc stuff */
-	struct sem_undo *semundo;
+	struct sem_undo **semundo;	/* SEMUNDO_HASH chains, or NULL */
 	struct sem_queue *semsleeping;
 /* CPU-specific state of this task */
 	struct thread_struct thread;
@@ -404,6 +430,9 @@ struct task_struct {
 #define PF_SIGNALED	0x00000400	/* killed by a signal */
 #define PF_MEMALLOC	0x00000800	/* Allocating memory */
 #define PF_VFORK	0x00001000	/* Wake up parent in mm_release */
+#define PF_ATOMICCOPY	0x00002000	/* User faults fail instead of sleeping */
+#define PF_PAGECOLOUR	0x00004000	/* Colour anonymous pages */
+#define PF_SYNCWRITE	0x00008000	/* Writes are waited for (fsync), queue them first */
 
 #define PF_USEDFPU	0x00100000	/* task used FPU this quantum (SMP) */
 
@@ -522,6 +551,11 @@ static inline struct task_struct *find_task_by_pid(int pid)
 /* per-UID process charging. */
 extern struct user_struct * alloc_uid(uid_t);
 extern void free_uid(struct user_struct *);
+#ifdef CONFIG_TSC_ACCOUNTING
+extern void task_cputime(struct task_struct *, unsigned long long *, unsigned long long *);
+#endif
+extern void user_processes_add(struct user_struct *, int);
+extern int user_processes_over(struct user_struct *, unsigned long);
 
 #include <asm/current.h>
 
@@ -529,6 +563,7 @@ extern unsigned long volatile jiffies;
 extern unsigned long itimer_ticks;
 extern unsigned long itimer_next;
 extern struct timeval xtime;
+extern seqcount_t xtime_seq;
 extern void do_timer(struct pt_regs *);
 
 extern unsigned int * prof_buffer;
@@ -565,6 +600,7 @@ extern void block_all_signals(int (*notifier)(void *priv), void *priv,
 			      sigset_t *mask);
 extern void unblock_all_signals(void);
 extern int send_sig_info(int, struct siginfo *, struct task_struct *);
+extern int send_sig_poll(int, struct siginfo *, struct task_struct *);
 extern int force_sig_info(int, struct siginfo *, struct task_struct *);
 extern int kill_pg_info(int, struct siginfo *, pid_t);
 extern int kill_sl_info(int, struct siginfo *, pid_t);
@@ -822,25 +858,23 @@ do {									\
 #define next_thread(p) \
 	list_entry((p)->thread_group.next, struct task_struct, thread_group)
 
-static inline void del_from_runqueue(struct task_struct * p)
-{
-	nr_running--;
-	p->sleep_time = jiffies;
-	list_del(&p->run_list);
-	p->run_list.next = NULL;
-}
+extern void del_from_runqueue(struct task_struct * p);
 
 static inline int task_on_runqueue(struct task_struct *p)
 {
 	return (p->run_list.next != NULL);
 }
 
+extern void free_pid(int nr);
+extern void reserve_pgrp(int nr);
+
 static inline void unhash_process(struct task_struct *p)
 {
 	if (task_on_runqueue(p)) BUG();
 	write_lock_irq(&tasklist_lock);
 	nr_threads--;
 	unhash_pid(p);
+	free_pid(p->pid);
 	REMOVE_LINKS(p);
 	list_del(&p->thread_group);
 	write_unlock_irq(&tasklist_lock);
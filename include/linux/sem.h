@@ -111,12 +111,15 @@ struct sem_queue {
 	int			alter;	 /* operation will alter semaphore */
 };
 
-/* Each task has a list of undo requests. They are executed automatically
- * when the process exits.
+/* Each task has a hash of undo requests, by semid. They are executed
+ * automatically when the process exits.
  */
+#define SEMUNDO_HASH	16	/* chains per task, power of 2 */
+
 struct sem_undo {
-	struct sem_undo *	proc_next;	/* next entry on this process */
+	struct sem_undo *	proc_next;	/* next entry on this hash chain */
 	struct sem_undo *	id_next;	/* next entry on this semaphore set */
+	struct sem_undo **	id_pprev;	/* *id_pprev == this entry */
 	int			semid;		/* semaphore set identifier */
 	short *			semadj;		/* array of adjustments, one per semaphore */
 };
@@ -0,0 +1,62 @@
+#ifndef __LINUX_SEQLOCK_H
+#define __LINUX_SEQLOCK_H
+
+/*
+ * Sequence counters: lets readers take a consistent snapshot of data
+ * that is written rarely, without writing to any shared cache line.
+ *
+ * Writers must already be serialised against each other (usually by
+ * a spinlock) and bump the counter before and after the update, so
+ * that it is odd while the data is inconsistent. Readers do
+ *
+ *	do {
+ *		seq = read_seqcount_begin(&foo_seq);
+ *		... copy the data ...
+ *	} while (read_seqcount_retry(&foo_seq, seq));
+ *
+ * A reader must not be able to interrupt a writer on the same CPU,
+ * or it would spin forever: writers that can be interrupted by one
+ * have to disable interrupts around the update.
+ */
+
+#include <asm/system.h>
+#include <asm/processor.h>
+
+typedef struct {
+	volatile unsigned int sequence;
+} seqcount_t;
+
+#define SEQCNT_ZERO	{ 0 }
+
+static inline unsigned int read_seqcount_begin(const seqcount_t *s)
+{
+	unsigned int ret;
+
+	for (;;) {
+		ret = s->sequence;
+		rmb();
+		if (!(ret & 1))
+			return ret;
+		barrier();
+	}
+}
+
+static inline int read_seqcount_retry(const seqcount_t *s, unsigned int start)
+{
+	rmb();
+	return s->sequence != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t *s)
+{
+	s->sequence++;
+	wmb();
+}
+
+static inline void write_seqcount_end(seqcount_t *s)
+{
+	wmb();
+	s->sequence++;
+}
+
+#endif /* __LINUX_SEQLOCK_H */
@@ -40,6 +40,7 @@ struct shmid_ds {
 #define SHM_W		0200	/* or S_IWUGO from <linux/stat.h> */
 
 /* mode for attach */
+#define	SHM_BIGPAGES	004000	/* shmget: back the segment with big pages */
 #define	SHM_RDONLY	010000	/* read-only access */
 #define	SHM_RND		020000	/* round attach address to SHMLBA boundary */
 #define	SHM_REMAP	040000	/* take-over region on attach */
@@ -20,7 +20,7 @@ typedef struct {
 struct shmem_inode_info {
 	spinlock_t	lock;
 	swp_entry_t	i_direct[SHMEM_NR_DIRECT]; /* for the first blocks */
-	swp_entry_t   **i_indirect; /* doubly indirect blocks */
+	swp_entry_t   **i_indirect; /* single and double indirect blocks */
 	unsigned long	swapped;
 	int		locked;     /* into memory */
 	struct list_head	list;
@@ -11,12 +11,19 @@
 
 struct sigqueue {
 	struct sigqueue *next;
+	struct sigqueue *poll_next;	/* in sigpending->poll_hash */
+	int poll;			/* an I/O event, see send_sig_poll() */
 	siginfo_t info;
 };
 
+/* The queued I/O events, by signal and fd */
+#define SIGQUEUE_POLL_HASH	16
+
 struct sigpending {
 	struct sigqueue *head, **tail;
 	sigset_t signal;
+	int count;			/* entries queued */
+	struct sigqueue *poll_hash[SIGQUEUE_POLL_HASH];
 };
 
 /*
@@ -216,6 +223,8 @@ static inline void init_sigpending(struct sigpending *sig)
 	sigemptyset(&sig->signal);
 	sig->head = NULL;
 	sig->tail = &sig->head;
+	sig->count = 0;
+	memset(sig->poll_hash, 0, sizeof(sig->poll_hash));
 }
 
 extern long do_sigpending(void *, unsigned long);
@@ -57,6 +57,37 @@ struct sk_buff_head {
 	spinlock_t	lock;
 };
 
+struct page;
+struct skb_recycle_pool;
+
+/* Enough for a 64K TCP frame which the device segments */
+#define MAX_SKB_FRAGS (65536/PAGE_SIZE + 2)
+
+typedef struct skb_frag_struct skb_frag_t;
+
+struct skb_frag_struct
+{
+	struct page *page;	/* always a low memory page */
+	__u16 page_offset;
+	__u16 size;
+};
+
+/* This data is invariant across clones and lives at the end of the
+ * header data, ie. at skb->end.  The page fragments hold the last
+ * skb->data_len bytes of the packet, after the linear part.  A TCP
+ * frame larger than the MSS carries tso_size, the size of the segments
+ * it is to be cut into by the device, and their number in tso_segs.
+ * A data area taken from a driver's recycling pool points back to it.
+ */
+struct skb_shared_info {
+	atomic_t	dataref;
+	unsigned int	nr_frags;
+	unsigned short	tso_size;
+	unsigned short	tso_segs;
+	struct skb_recycle_pool *pool;
+	skb_frag_t	frags[MAX_SKB_FRAGS];
+};
+
 struct sk_buff {
 	/* These two members must be first. */
 	struct sk_buff	* next;			/* Next buffer in list 				*/
@@ -66,6 +97,7 @@ struct sk_buff {
 	struct sock	*sk;			/* Socket we are owned by 			*/
 	struct timeval	stamp;			/* Time we arrived				*/
 	struct net_device	*dev;		/* Device we arrived on/are leaving by		*/
+	struct net_device	*real_dev;	/* For a bonding slave, dev is the master	*/
 
 	/* Transport layer header */
 	union
@@ -107,6 +139,7 @@ struct sk_buff {
 	char		cb[48];	 
 
 	unsigned int 	len;			/* Length of actual data			*/
+	unsigned int	data_len;		/* Part of len in page fragments		*/
 	unsigned int	csum;			/* Checksum 					*/
 	volatile char 	used;			/* Data moved to user and not MSG_PEEK		*/
 	unsigned char	cloned, 		/* head may be cloned (check refcnt to be sure). */
@@ -167,6 +200,22 @@ extern struct sk_buff *		skb_copy_expand(const struct sk_buff *skb,
 						int newheadroom,
 						int newtailroom,
 						int priority);
+extern int			pskb_expand_head(struct sk_buff *skb,
+						 int nhead, int ntail,
+						 int priority);
+extern int			skb_linearize(struct sk_buff *skb, int priority);
+extern void			___pskb_trim(struct sk_buff *skb, unsigned int len);
+extern int			skb_copy_bits(const struct sk_buff *skb, int offset,
+					      void *to, int len);
+extern unsigned int		skb_checksum(const struct sk_buff *skb, int offset,
+					     int len, unsigned int csum);
+extern struct sk_buff *		skb_tso_segment(struct sk_buff *skb, int gfp_mask);
+extern struct skb_recycle_pool *	skb_recycle_pool_create(const char *name,
+						unsigned int length,
+						unsigned int max);
+extern void			skb_recycle_pool_destroy(struct skb_recycle_pool *pool);
+extern struct sk_buff *		alloc_skb_recycle(struct skb_recycle_pool *pool,
+						  unsigned int size, int priority);
 #define dev_kfree_skb(a)	kfree_skb(a)
 extern void	skb_over_panic(struct sk_buff *skb, int len, void *here);
 extern void	skb_under_panic(struct sk_buff *skb, int len, void *here);
@@ -175,11 +224,26 @@ extern void	skb_under_panic(struct sk_buff *skb, int len, void *here);
 #define skb_realloc_headroom(skb, nhr) skb_copy_expand(skb, nhr, skb_tailroom(skb), GFP_ATOMIC)
 
 /* Internal */
+#define skb_shinfo(SKB)		((struct skb_shared_info *)((SKB)->end))
+
 static inline atomic_t *skb_datarefp(struct sk_buff *skb)
 {
-	return (atomic_t *)(skb->end);
+	return &skb_shinfo(skb)->dataref;
 }
 
+static inline int skb_is_nonlinear(const struct sk_buff *skb)
+{
+	return skb->data_len;
+}
+
+/* Bytes in the linear part, between skb->data and skb->tail */
+static inline unsigned int skb_headlen(const struct sk_buff *skb)
+{
+	return skb->len - skb->data_len;
+}
+
+#define SKB_LINEAR_ASSERT(skb) do { if (skb_is_nonlinear(skb)) BUG(); } while (0)
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -686,6 +750,7 @@ static inline struct sk_buff *skb_dequeue_tail(struct sk_buff_head *list)
 static inline unsigned char *__skb_put(struct sk_buff *skb, unsigned int len)
 {
 	unsigned char *tmp=skb->tail;
+	SKB_LINEAR_ASSERT(skb);
 	skb->tail+=len;
 	skb->len+=len;
 	return tmp;
@@ -704,6 +769,7 @@ static inline unsigned char *__skb_put(struct sk_buff *skb, unsigned int len)
 static inline unsigned char *skb_put(struct sk_buff *skb, unsigned int len)
 {
 	unsigned char *tmp=skb->tail;
+	SKB_LINEAR_ASSERT(skb);
 	skb->tail+=len;
 	skb->len+=len;
 	if(skb->tail>skb->end) {
@@ -784,7 +850,7 @@ static inline int skb_headroom(const struct sk_buff *skb)
 
 static inline int skb_tailroom(const struct sk_buff *skb)
 {
-	return skb->end-skb->tail;
+	return skb_is_nonlinear(skb) ? 0 : skb->end-skb->tail;
 }
 
 /**
@@ -805,6 +871,10 @@ static inline void skb_reserve(struct sk_buff *skb, unsigned int len)
 
 static inline void __skb_trim(struct sk_buff *skb, unsigned int len)
 {
+	if (skb->data_len) {
+		___pskb_trim(skb, len);
+		return;
+	}
 	skb->len = len;
 	skb->tail = skb->data+len;
 }
@@ -825,6 +895,30 @@ static inline void skb_trim(struct sk_buff *skb, unsigned int len)
 	}
 }
 
+/**
+ *	skb_add_frag - append a page fragment to a buffer
+ *	@skb: buffer to use
+ *	@page: low memory page holding the data
+ *	@off: offset of the data in the page
+ *	@size: bytes of data
+ *
+ *	Adds the data as the next page fragment, the caller having taken
+ *	a reference to the page for the buffer and checked that there is
+ *	a free fragment slot.
+ */
+
+static inline void skb_add_frag(struct sk_buff *skb, struct page *page,
+				int off, int size)
+{
+	skb_frag_t *frag = &skb_shinfo(skb)->frags[skb_shinfo(skb)->nr_frags++];
+
+	frag->page = page;
+	frag->page_offset = off;
+	frag->size = size;
+	skb->len += size;
+	skb->data_len += size;
+}
+
 /**
  *	skb_orphan - orphan a buffer
  *	@skb: buffer to orphan
@@ -900,6 +994,28 @@ static inline struct sk_buff *dev_alloc_skb(unsigned int length)
 	return skb;
 }
 
+/**
+ *	dev_alloc_skb_recycle - allocate a receive buffer from a pool
+ *	@pool: pool made by skb_recycle_pool_create(), or %NULL
+ *	@length: length to allocate
+ *
+ *	Like dev_alloc_skb(), but the buffer comes from the pool's cache
+ *	for this CPU when it has one, and kfree_skb() puts it back there
+ *	if nobody cloned it.  @length should be the one the pool was made
+ *	for.  Without a pool this is plain dev_alloc_skb().
+ */
+
+static inline struct sk_buff *dev_alloc_skb_recycle(struct skb_recycle_pool *pool,
+						    unsigned int length)
+{
+	struct sk_buff *skb;
+
+	skb = alloc_skb_recycle(pool, length+16, GFP_ATOMIC);
+	if (skb)
+		skb_reserve(skb,16);
+	return skb;
+}
+
 /**
  *	skb_cow - copy a buffer if need be
  *	@skb: buffer to copy
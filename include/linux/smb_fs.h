@@ -87,6 +87,7 @@ smb_vfree(void *obj)
 #define SMB_CAP_NT_FIND          0x0200
 #define SMB_CAP_DFS              0x1000
 #define SMB_CAP_LARGE_READX      0x4000
+#define SMB_CAP_LARGE_WRITEX     0x8000
 
 
 /* linux/fs/smbfs/mmap.c */
@@ -128,6 +129,8 @@ int smb_close_fileid(struct dentry *, __u16);
 int smb_open(struct dentry *, int);
 int smb_proc_read(struct inode *, off_t, int, char *);
 int smb_proc_write(struct inode *, off_t, int, const char *);
+int smb_proc_readv(struct inode *, off_t, int, char **, int);
+int smb_proc_writev(struct inode *, off_t, int, char **, int);
 int smb_proc_create(struct dentry *, __u16, time_t, __u16 *);
 int smb_proc_mv(struct dentry *, struct dentry *);
 int smb_proc_mkdir(struct dentry *);
@@ -150,6 +153,24 @@ smb_is_open(struct inode *i)
 	return (i->u.smbfs_i.open == SMB_SERVER(i)->generation);
 }
 
+/*
+ * One ReadX or WriteX request of a batch, see smb_request_batch().  The
+ * data is in PAGE_SIZE pieces, starting rq_voff bytes into rq_vec[0].
+ */
+#define SMB_BATCH_MAX	8		/* requests in flight */
+#define SMB_RQ_HEADER	64		/* up to 12 parameter words */
+#define SMB_RQ_DATA	(60 * 1024)	/* most data in one request */
+
+struct smb_batch_req {
+	unsigned char	rq_header[SMB_RQ_HEADER]; /* request, then reply */
+	char		**rq_vec;
+	int		rq_voff;
+	int		rq_dlen;	/* data to send, or room for data read */
+	int		rq_result;	/* bytes transferred, or -errno */
+	unsigned short	rq_rcls;	/* error codes of the reply */
+	unsigned short	rq_err;
+};
+
 /* linux/fs/smbfs/sock.c */
 int smb_round_length(int);
 int smb_valid_socket(struct inode *);
@@ -157,6 +178,7 @@ void smb_close_socket(struct smb_sb_info *);
 int smb_release(struct smb_sb_info *server);
 int smb_connect(struct smb_sb_info *server);
 int smb_request(struct smb_sb_info *server);
+int smb_request_batch(struct smb_sb_info *, struct smb_batch_req *, int, int);
 int smb_request_read_raw(struct smb_sb_info *, unsigned char *, int);
 int smb_request_write_raw(struct smb_sb_info *, unsigned const char *, int);
 int smb_catch_keepalive(struct smb_sb_info *server);
@@ -42,10 +42,12 @@ struct rpc_cred {
 /*
  * Client authentication handle
  */
-#define RPC_CREDCACHE_NR	8
+#define RPC_CREDCACHE_NR	256
 #define RPC_CREDCACHE_MASK	(RPC_CREDCACHE_NR - 1)
+#define rpcauth_credhash(uid)	(((uid) ^ ((uid) >> 8)) & RPC_CREDCACHE_MASK)
 struct rpc_auth {
 	struct rpc_cred *	au_credcache[RPC_CREDCACHE_NR];
+	spinlock_t		au_credlock[RPC_CREDCACHE_NR];
 	unsigned long		au_expire;	/* cache expiry interval */
 	unsigned long		au_nextgc;	/* next garbage collection */
 	unsigned int		au_cslack;	/* call cred size estimate */
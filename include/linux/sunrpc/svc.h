@@ -11,23 +11,37 @@
 #define SUNRPC_SVC_H
 
 #include <linux/in.h>
+#include <linux/cache.h>
 #include <linux/sunrpc/types.h>
 #include <linux/sunrpc/xdr.h>
 #include <linux/sunrpc/svcauth.h>
 
+/*
+ * A pool of server threads. A multithreaded service has one per CPU,
+ * each with its own lists of idle threads and of sockets waiting for
+ * one, so that a socket is mostly served on the CPU that took its
+ * network interrupt, by threads that stay on that CPU.
+ */
+struct svc_pool {
+	spinlock_t		sp_lock;
+	struct svc_rqst *	sp_threads;	/* idle server threads */
+	struct svc_sock *	sp_sockets;	/* pending sockets */
+	unsigned int		sp_cpu;		/* logical CPU of the pool */
+} ____cacheline_aligned;
+
 /*
  * RPC service.
  *
  * An RPC service is a ``daemon,'' possibly multithreaded, which
  * receives and processes incoming RPC messages.
- * It has one or more transport sockets associated with it, and maintains
- * a list of idle threads waiting for input.
+ * It has one or more transport sockets associated with it, and keeps
+ * its idle threads waiting for input in one or more pools.
  *
  * We currently do not support more than one RPC program per daemon.
  */
 struct svc_serv {
-	struct svc_rqst *	sv_threads;	/* idle server threads */
-	struct svc_sock *	sv_sockets;	/* pending sockets */
+	struct svc_pool *	sv_pools;	/* thread pools */
+	unsigned int		sv_nrpools;	/* # of pools */
 	struct svc_program *	sv_program;	/* RPC program */
 	struct svc_stat *	sv_stats;	/* RPC statistics */
 	spinlock_t		sv_lock;
@@ -63,11 +77,17 @@ struct svc_serv {
  * do something about READLINK and READDIR. It might be worthwhile
  * to implement some generic readdir cache in the VFS layer...
  *
+ * NFS READ does this with the array of pages: it holds references to
+ * the page cache pages of the file data, which go out on the wire right
+ * after the reply buffer, followed by the XDR padding. The reply buffer
+ * itself then ends with the opaque byte count.
+ *
  * On the receiving end of the RPC server, the iovec may be used to hold
  * the list of IP fragments once we get to process fragmented UDP
  * datagrams directly.
  */
-#define RPCSVC_MAXIOV		((RPCSVC_MAXPAYLOAD+PAGE_SIZE-1)/PAGE_SIZE + 1)
+#define RPCSVC_MAXPAGES		((RPCSVC_MAXPAYLOAD+PAGE_SIZE-1)/PAGE_SIZE + 1)
+#define RPCSVC_MAXIOV		(RPCSVC_MAXPAGES + 2)
 struct svc_buf {
 	u32 *			area;	/* allocated memory */
 	u32 *			base;	/* base of RPC datagram */
@@ -78,6 +98,12 @@ struct svc_buf {
 	/* iovec for zero-copy NFS READs */
 	struct iovec		iov[RPCSVC_MAXIOV];
 	int			nriov;
+
+	/* page cache data following the buffer */
+	struct page *		pages[RPCSVC_MAXPAGES];
+	int			nrpages;
+	unsigned int		pgbase;	/* offset of data in first page */
+	unsigned int		pglen;	/* length of data in pages */
 };
 #define svc_getlong(argp, val)	{ (val) = *(argp)->buf++; (argp)->len--; }
 #define svc_putlong(resp, val)	{ *(resp)->buf++ = (val); (resp)->len++; }
@@ -95,6 +121,7 @@ struct svc_rqst {
 	int			rq_addrlen;
 
 	struct svc_serv *	rq_server;	/* RPC service definition */
+	struct svc_pool *	rq_pool;	/* thread pool */
 	struct svc_procedure *	rq_procinfo;	/* procedure info */
 	struct svc_cred		rq_cred;	/* auth info */
 	struct sk_buff *	rq_skbuff;	/* fast recv inet buffer */
@@ -173,7 +200,10 @@ typedef void		(*svc_thread_fn)(struct svc_rqst *);
  * Function prototypes.
  */
 struct svc_serv *  svc_create(struct svc_program *, unsigned int, unsigned int);
+struct svc_serv *  svc_create_pooled(struct svc_program *, unsigned int,
+				unsigned int);
 int		   svc_create_thread(svc_thread_fn, struct svc_serv *);
+void		   svc_bind_pool(struct svc_rqst *);
 void		   svc_exit_thread(struct svc_rqst *);
 void		   svc_destroy(struct svc_serv *);
 int		   svc_process(struct svc_serv *, struct svc_rqst *);
@@ -17,7 +17,7 @@
 /*
  * Maximum number of iov's we use.
  */
-#define MAX_IOVEC	10
+#define MAX_IOVEC	18
 
 /*
  * The transport code maintains an estimate on the maximum number of out-
@@ -153,7 +153,6 @@ struct rpc_xprt {
 	unsigned int		tcp_reclen,	/* fragment length */
 				tcp_offset,	/* fragment offset */
 				tcp_copied;	/* copied to request */
-	struct list_head	rx_pending;	/* receive pending list */
 
 	/*
 	 * Send stuff
@@ -185,9 +184,6 @@ int			xprt_adjust_timeout(struct rpc_timeout *);
 void			xprt_release(struct rpc_task *);
 void			xprt_reconnect(struct rpc_task *);
 int			xprt_clear_backlog(struct rpc_xprt *);
-void			__rpciod_tcp_dispatcher(void);
-
-extern struct list_head	rpc_xprt_pending;
 
 #define XPRT_WSPACE	0
 #define XPRT_CONNECT	1
@@ -201,19 +197,6 @@ extern struct list_head	rpc_xprt_pending;
 #define xprt_test_and_set_connected(xp)	(test_and_set_bit(XPRT_CONNECT, &(xp)->sockstate))
 #define xprt_clear_connected(xp)	(clear_bit(XPRT_CONNECT, &(xp)->sockstate))
 
-static inline
-int xprt_tcp_pending(void)
-{
-	return !list_empty(&rpc_xprt_pending);
-}
-
-static inline
-void rpciod_tcp_dispatcher(void)
-{
-	if (xprt_tcp_pending())
-		__rpciod_tcp_dispatcher();
-}
-
 #endif /* __KERNEL__*/
 
 #endif /* _LINUX_SUNRPC_XPRT_H */
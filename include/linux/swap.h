@@ -46,6 +46,16 @@ union swap_header {
 #define SWAP_MAP_MAX	0x7fff
 #define SWAP_MAP_BAD	0x8000
 
+/*
+ * A run of swap file pages whose blocks are contiguous on the disk, so
+ * that swap I/O needs no bmap().
+ */
+struct swap_extent {
+	unsigned long start_page;
+	unsigned long nr_pages;
+	unsigned long start_block;	/* in filesystem blocks */
+};
+
 struct swap_info_struct {
 	unsigned int flags;
 	kdev_t swap_device;
@@ -53,6 +63,8 @@ struct swap_info_struct {
 	struct dentry * swap_file;
 	struct vfsmount *swap_vfsmnt;
 	unsigned short * swap_map;
+	struct swap_extent * extents;	/* swap files only, sorted */
+	int nr_extents;
 	unsigned int lowest_bit;
 	unsigned int highest_bit;
 	unsigned int cluster_next;
@@ -73,7 +85,6 @@ extern atomic_t nr_async_pages;
 extern struct address_space swapper_space;
 extern atomic_t page_cache_size;
 extern atomic_t buffermem_pages;
-extern spinlock_t pagecache_lock;
 extern void __remove_inode_page(struct page *);
 
 /* Incomplete types for prototype declarations: */
@@ -103,12 +114,23 @@ extern void swap_setup(void);
 /* linux/mm/vmscan.c */
 extern struct page * reclaim_page(zone_t *);
 extern wait_queue_head_t kswapd_wait;
-extern wait_queue_head_t kreclaimd_wait;
 extern int page_launder(int, int);
 extern int free_shortage(void);
 extern int inactive_shortage(void);
 extern void wakeup_kswapd(int);
 extern int try_to_free_pages(unsigned int gfp_mask);
+extern int get_vmstat_info(char *);
+
+/* linux/mm/rmap.c */
+#define SWAP_SUCCESS	0
+#define SWAP_AGAIN	1
+#define SWAP_FAIL	2
+extern void page_add_rmap(struct page *, struct mm_struct *, unsigned long);
+extern void page_remove_rmap(struct page *, struct mm_struct *, unsigned long);
+extern int page_mapcount(struct page *);
+extern int page_referenced(struct page *);
+extern int try_to_unmap(struct page *);
+extern void pte_chain_init(void);
 
 /* linux/mm/page_io.c */
 extern void rw_swap_page(int, struct page *, int);
@@ -118,7 +140,7 @@ extern void rw_swap_page_nolock(int, swp_entry_t, char *, int);
 
 /* linux/mm/swap_state.c */
 extern void show_swap_cache_info(void);
-extern void add_to_swap_cache(struct page *, swp_entry_t);
+extern int add_to_swap_cache(struct page *, swp_entry_t, int);
 extern int swap_check_entry(unsigned long);
 extern struct page * lookup_swap_cache(swp_entry_t);
 extern struct page * read_swap_cache_async(swp_entry_t, int);
@@ -144,6 +166,7 @@ extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t __get_swap_page(unsigned short);
 extern void get_swaphandle_info(swp_entry_t, unsigned long *, kdev_t *, 
 					struct inode **);
+extern unsigned long swap_extent_block(swp_entry_t);
 extern int swap_duplicate(swp_entry_t);
 extern int swap_count(struct page *);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
@@ -117,6 +117,9 @@ enum
 	KERN_OVERFLOWGID=47,	/* int: overflow GID */
 	KERN_SHMPATH=48,	/* string: path to shm fs */
 	KERN_HOTPLUG=49,	/* string: path to hotplug policy agent */
+	KERN_PIDMAX=50,		/* int: highest pid + 1 */
+	KERN_RTSIGPROCMAX=51,	/* int: Max queuable per process */
+	KERN_ACCT_DROPPED=52,	/* int: acct records lost to low disk space */
 };
 
 
@@ -132,7 +135,9 @@ enum
 	VM_PAGECACHE=7,		/* struct: Set cache memory thresholds */
 	VM_PAGERDAEMON=8,	/* struct: Control kswapd behaviour */
 	VM_PGT_CACHE=9,		/* struct: Set page table cache parameters */
-	VM_PAGE_CLUSTER=10	/* int: set number of pages to swap together */
+	VM_PAGE_CLUSTER=10,	/* int: set number of pages to swap together */
+	VM_FAULT_AROUND=11,	/* int: pages to map around a file fault */
+	VM_PAGE_COLOURING=12	/* int: colour anonymous pages */
 };
 
 
@@ -195,7 +200,9 @@ enum
 	NET_CORE_NO_CONG_THRESH=13,
 	NET_CORE_NO_CONG=14,
 	NET_CORE_LO_CONG=15,
-	NET_CORE_MOD_CONG=16
+	NET_CORE_MOD_CONG=16,
+	NET_CORE_RPS=17,
+	NET_CORE_TX_BATCH=18
 };
 
 /* /proc/sys/net/ethernet */
@@ -279,6 +286,9 @@ enum
 	NET_TCP_APP_WIN=86,
 	NET_TCP_ADV_WIN_SCALE=87,
 	NET_IPV4_NONLOCAL_BIND=88,
+	NET_TCP_MODERATE_RCVBUF=89,
+	NET_TCP_PACING=90,
+	NET_IPV4_EARLY_DEMUX=91,
 };
 
 enum {
@@ -480,7 +490,10 @@ enum {
 	NET_KHTTPD_DYNAMICSTRING= 10,
 	NET_KHTTPD_SLOPPYMIME   = 11,
 	NET_KHTTPD_THREADS	= 12,
-	NET_KHTTPD_MAXCONNECT	= 13
+	NET_KHTTPD_MAXCONNECT	= 13,
+	NET_KHTTPD_KEEPALIVE	= 14,
+	NET_KHTTPD_CACHEHITS	= 15,
+	NET_KHTTPD_CACHEMISSES	= 16
 };
 
 /* /proc/sys/net/decnet/conf/<dev> */
@@ -526,6 +539,9 @@ enum
 	FS_LEASES=13,	/* int: leases enabled */
 	FS_DIR_NOTIFY=14,	/* int: directory notification enabled */
 	FS_LEASE_TIME=15,	/* int: maximum time to wait for a lease break */
+	FS_AIO_NR=16,	/* int: events of all aio contexts */
+	FS_AIO_MAX_NR=17,	/* int: maximum of aio-nr */
+	FS_ATIME_INTERVAL=18,	/* int: seconds an atime may go stale */
 };
 
 /* CTL_DEBUG names: */
@@ -557,7 +573,23 @@ enum {
 /* /proc/sys/dev/raid */
 enum {
 	DEV_RAID_SPEED_LIMIT_MIN=1,
-	DEV_RAID_SPEED_LIMIT_MAX=2
+	DEV_RAID_SPEED_LIMIT_MAX=2,
+	DEV_RAID_MD_BASE=64		/* /proc/sys/dev/raid/mdN is MD_BASE+N */
+};
+
+/* /proc/sys/dev/raid/mdN, for all arrays */
+enum {
+	DEV_RAID_MD_SYNC_SPEED_MIN=32,
+	DEV_RAID_MD_SYNC_SPEED_MAX=33
+};
+
+/* /proc/sys/dev/raid/mdN, for RAID-4/5 arrays */
+enum {
+	DEV_RAID5_STRIPE_CACHE_SIZE=1,
+	DEV_RAID5_STRIPE_CACHE_ACTIVE=2,
+	DEV_RAID5_RMW_WRITES=3,
+	DEV_RAID5_RCW_WRITES=4,
+	DEV_RAID5_FULL_WRITES=5
 };
 
 /* /proc/sys/dev/parport/default */
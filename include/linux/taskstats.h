@@ -0,0 +1,46 @@
+#ifndef _LINUX_TASKSTATS_H
+#define _LINUX_TASKSTATS_H
+
+/*
+ * /proc/taskstats: the numbers of /proc/<pid>/stat for every task, as
+ * fixed size binary records.  A read returns as many whole records as
+ * fit, the file position counts tasks, so the next read carries on
+ * where the last one stopped.  Tasks that fork or exit in between may
+ * be missed or seen twice, as with reading /proc itself.
+ *
+ * size is sizeof(struct taskstat) of the running kernel; fields are
+ * only ever added at the end.  Times are in jiffies, vsize in bytes
+ * and rss in pages.  utime_ns and stime_ns are measured with the TSC
+ * if the kernel has CONFIG_TSC_ACCOUNTING, otherwise they are the
+ * tick counts converted; they do not include the current time slice
+ * of a task running on another CPU.
+ */
+
+struct taskstat {
+	unsigned int	size;
+	int		pid;
+	int		ppid;
+	unsigned int	uid;
+	int		processor;
+	long		nice;
+	unsigned long	flags;
+	unsigned long	utime;
+	unsigned long	stime;
+	unsigned long	cutime;
+	unsigned long	cstime;
+	unsigned long	start_time;
+	unsigned long	min_flt;
+	unsigned long	maj_flt;
+	unsigned long	cmin_flt;
+	unsigned long	cmaj_flt;
+	unsigned long	nswap;
+	unsigned long	cnswap;
+	unsigned long	vsize;
+	unsigned long	rss;
+	char		state;		/* as in /proc/<pid>/stat */
+	char		comm[16];
+	unsigned long long utime_ns;
+	unsigned long long stime_ns;
+};
+
+#endif /* _LINUX_TASKSTATS_H */
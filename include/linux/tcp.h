@@ -126,6 +126,8 @@ enum {
 #define TCP_DEFER_ACCEPT	9	/* Wake up listener only when data arrive */
 #define TCP_WINDOW_CLAMP	10	/* Bound advertised window */
 #define TCP_INFO		11	/* Information about this connection. */
+#define TCP_PACING		12	/* Spread cwnd over the RTT */
+#define TCP_MAXRATE		13	/* Pace to at most this many bytes/sec */
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
@@ -17,8 +17,15 @@
 #define MIN_THREADS_LEFT_FOR_ROOT 4
 
 /*
- * This controls the maximum pid allocated to a process
+ * This controls the default maximum pid allocated to a process,
+ * see /proc/sys/kernel/pid_max. Booting with pid_max= can raise it
+ * up to PID_MAX_LIMIT: /proc uses the pid as the high 16 bits of
+ * its inode numbers, so 32-bit machines cannot go beyond 64k.
  */
 #define PID_MAX 0x8000
+#define PID_MAX_LIMIT (sizeof(long) > 4 ? 4*1024*1024 : 0x10000)
+
+/* pids below this are not reused when we wrap around */
+#define RESERVED_PIDS 300
 
 #endif
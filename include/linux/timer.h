@@ -16,16 +16,25 @@
  * The "data" field is in case you want to use the same
  * timeout function for several timeouts. You can use this
  * to distinguish between the different invocations.
+ *
+ * Every CPU has its own set of timer lists, a timer is queued on
+ * the lists of the CPU that added it and runs there. "base" points
+ * to the set the timer was last queued on and is private to
+ * kernel/timer.c.
  */
+struct timer_base;
+
 struct timer_list {
 	struct list_head list;
 	unsigned long expires;
 	unsigned long data;
 	void (*function)(unsigned long);
+	struct timer_base *base;
 };
 
 extern void add_timer(struct timer_list * timer);
 extern int del_timer(struct timer_list * timer);
+extern void bust_timer_locks(void);
 
 #ifdef CONFIG_SMP
 extern int del_timer_sync(struct timer_list * timer);
@@ -49,6 +58,7 @@ extern void it_real_fn(unsigned long);
 static inline void init_timer(struct timer_list * timer)
 {
 	timer->list.next = timer->list.prev = NULL;
+	timer->base = NULL;
 }
 
 static inline int timer_pending (const struct timer_list * timer)
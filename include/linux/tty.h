@@ -133,8 +133,12 @@ extern struct screen_info screen_info;
  * This is the flip buffer used for the tty driver.  The buffer is
  * located in the tty structure, and is used as a high speed interface
  * between the tty driver and the tty line discipline.
+ *
+ * Fast lines get a larger one, see tty_flip_buffer_grow().  Drivers
+ * should check count against size rather than TTY_FLIPBUF_SIZE.
  */
 #define TTY_FLIPBUF_SIZE 512
+#define TTY_FLIPBUF_MAX	4096
 
 struct tty_flip_buffer {
 	struct tq_struct tqueue;
@@ -143,6 +147,9 @@ struct tty_flip_buffer {
 	unsigned char	*flag_buf_ptr;
 	int		count;
 	int		buf_num;
+	int		size;		/* of each half */
+	unsigned char	*char_base;	/* char_buf or allocated, two halves */
+	char		*flag_base;
 	unsigned char	char_buf[2*TTY_FLIPBUF_SIZE];
 	char		flag_buf[2*TTY_FLIPBUF_SIZE];
 	unsigned char	slop[4]; /* N.B. bug overwrites buffer by 1 */
@@ -392,6 +399,7 @@ extern int tty_hung_up_p(struct file * filp);
 extern void do_SAK(struct tty_struct *tty);
 extern void disassociate_ctty(int priv);
 extern void tty_flip_buffer_push(struct tty_struct *tty);
+extern void tty_flip_buffer_grow(struct tty_struct *tty);
 extern int tty_get_baud_rate(struct tty_struct *tty);
 
 /* n_tty.c */
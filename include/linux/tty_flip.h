@@ -10,7 +10,7 @@
 _INLINE_ void tty_insert_flip_char(struct tty_struct *tty,
 				   unsigned char ch, char flag)
 {
-	if (tty->flip.count < TTY_FLIPBUF_SIZE) {
+	if (tty->flip.count < tty->flip.size) {
 		tty->flip.count++;
 		*tty->flip.flag_buf_ptr++ = flag;
 		*tty->flip.char_buf_ptr++ = ch;
@@ -4,21 +4,26 @@
 #include <linux/sched.h>
 #include <linux/mm.h>
 #include <linux/spinlock.h>
+#include <linux/rbtree.h>
 
 #include <asm/pgtable.h>
 
 /* bits in vm_struct->flags */
 #define VM_IOREMAP	0x00000001	/* ioremap() and friends */
 #define VM_ALLOC	0x00000002	/* vmalloc() */
+#define VM_LAZYFREE	0x00000004	/* freed, unmapped, TLB not flushed yet */
 
 struct vm_struct {
 	unsigned long flags;
 	void * addr;
 	unsigned long size;
 	struct vm_struct * next;
+	rb_node_t rb;
+	unsigned long rb_gap;	/* largest hole after an area of the subtree */
 };
 
 extern struct vm_struct * get_vm_area (unsigned long size, unsigned long flags);
+extern void vm_area_register_early(struct vm_struct *area);
 extern void vfree(void * addr);
 extern void * __vmalloc (unsigned long size, int gfp_mask, pgprot_t prot);
 extern long vread(char *buf, char *addr, unsigned long count);
@@ -56,6 +61,7 @@ static inline void * vmalloc_32(unsigned long size)
 /*
  * vmlist_lock is a read-write spinlock that protects vmlist
  * Used in mm/vmalloc.c (get_vm_area() and vfree()) and fs/proc/kcore.c.
+ * Areas marked VM_LAZYFREE are on the list but have nothing mapped.
  */
 extern rwlock_t vmlist_lock;
 
@@ -47,6 +47,7 @@ struct __wait_queue {
 	unsigned int flags;
 #define WQ_FLAG_EXCLUSIVE	0x01
 	struct task_struct * task;
+	void (*func)(struct __wait_queue *);	/* called instead of waking task */
 	struct list_head task_list;
 #if WAITQUEUE_DEBUG
 	long __magic;
@@ -110,7 +111,7 @@ typedef struct __wait_queue_head wait_queue_head_t;
 #endif
 
 #define __WAITQUEUE_INITIALIZER(name,task) \
-	{ 0x0, task, { NULL, NULL } __WAITQUEUE_DEBUG_INIT(name)}
+	{ 0x0, task, NULL, { NULL, NULL } __WAITQUEUE_DEBUG_INIT(name)}
 #define DECLARE_WAITQUEUE(name,task) \
 	wait_queue_t name = __WAITQUEUE_INITIALIZER(name,task)
 
@@ -144,6 +145,23 @@ static inline void init_waitqueue_entry(wait_queue_t *q,
 #endif
 	q->flags = 0;
 	q->task = p;
+	q->func = NULL;
+#if WAITQUEUE_DEBUG
+	q->__magic = (long)&q->__magic;
+#endif
+}
+
+/*
+ * An entry that has func called, under the wait queue lock and with
+ * interrupts off, by every wake up of the queue, whatever the mode.
+ * It is never exclusive.
+ */
+static inline void init_waitqueue_func_entry(wait_queue_t *q,
+				 void (*func)(wait_queue_t *))
+{
+	q->flags = 0;
+	q->task = NULL;
+	q->func = func;
 #if WAITQUEUE_DEBUG
 	q->__magic = (long)&q->__magic;
 #endif
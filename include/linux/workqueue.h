@@ -0,0 +1,86 @@
+/*
+ * workqueue.h --- work queue handling for Linux.
+ *
+ * A workqueue has one worker thread per CPU.  Work is run by the thread
+ * of the CPU that queued it, in the order it was queued.  See
+ * kernel/workqueue.c.
+ */
+
+#ifndef _LINUX_WORKQUEUE_H
+#define _LINUX_WORKQUEUE_H
+
+#include <linux/timer.h>
+#include <linux/list.h>
+#include <asm/bitops.h>
+
+struct workqueue_struct;
+
+/*
+ * The first four members are laid out like a tq_struct, so that
+ * schedule_task() can put a tq_struct on keventd's list.
+ */
+struct work_struct {
+	struct list_head entry;
+	unsigned long pending;		/* bit 0: queued or timer running */
+	void (*func)(void *);
+	void *data;
+	void *wq_data;			/* private to kernel/workqueue.c */
+	struct timer_list timer;	/* for queue_delayed_work() */
+};
+
+#define __WORK_INITIALIZER(n, f, d) {				\
+	entry:	{ &(n).entry, &(n).entry },			\
+	func:	(f),						\
+	data:	(d),						\
+	}
+
+#define DECLARE_WORK(n, f, d)					\
+	struct work_struct n = __WORK_INITIALIZER(n, f, d)
+
+/* Set up a work_struct that is not queued, leaving the rest alone */
+#define PREPARE_WORK(_work, _func, _data)			\
+	do {							\
+		(_work)->func = _func;				\
+		(_work)->data = _data;				\
+	} while (0)
+
+/* Set up a work_struct from scratch */
+#define INIT_WORK(_work, _func, _data)				\
+	do {							\
+		INIT_LIST_HEAD(&(_work)->entry);		\
+		(_work)->pending = 0;				\
+		PREPARE_WORK((_work), (_func), (_data));	\
+		init_timer(&(_work)->timer);			\
+	} while (0)
+
+extern struct workqueue_struct *create_workqueue(const char *name);
+extern void destroy_workqueue(struct workqueue_struct *wq);
+
+extern int queue_work(struct workqueue_struct *wq, struct work_struct *work);
+extern int queue_delayed_work(struct workqueue_struct *wq,
+			      struct work_struct *work, unsigned long delay);
+extern void flush_workqueue(struct workqueue_struct *wq);
+
+/* The shared keventd queue */
+extern int schedule_work(struct work_struct *work);
+extern int schedule_delayed_work(struct work_struct *work, unsigned long delay);
+extern void flush_scheduled_work(void);
+
+extern void init_workqueues(void);
+
+/*
+ * Kill the timer of delayed work.  Returns non-zero if it was pending;
+ * if it had already fired the work may be queued or running, and
+ * flush_workqueue() is needed to wait for it.
+ */
+static inline int cancel_delayed_work(struct work_struct *work)
+{
+	int ret;
+
+	ret = del_timer_sync(&work->timer);
+	if (ret)
+		clear_bit(0, &work->pending);
+	return ret;
+}
+
+#endif /* _LINUX_WORKQUEUE_H */
@@ -45,6 +45,7 @@ struct dst_entry
 	unsigned		cwnd;
 	unsigned		advmss;
 	unsigned		reordering;
+	unsigned		maxrate;	/* TCP pacing cap, bytes/sec */
 
 	unsigned long		rate_last;	/* rate limiting for ICMP */
 	unsigned long		rate_tokens;
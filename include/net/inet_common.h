@@ -26,6 +26,12 @@ extern int			inet_recvmsg(struct socket *sock,
 extern int			inet_sendmsg(struct socket *sock, 
 					     struct msghdr *msg, 
 					     int size, struct scm_cookie *scm);
+extern ssize_t			inet_sendpage(struct socket *sock,
+					      struct page *page, int offset,
+					      size_t size, int flags);
+extern ssize_t			inet_receive_file(struct socket *sock,
+						  struct file *file,
+						  size_t size, int flags);
 extern int			inet_shutdown(struct socket *sock, int how);
 extern unsigned int		inet_poll(struct file * file, struct socket *sock, struct poll_table_struct *wait);
 extern int			inet_setsockopt(struct socket *sock, int level,
@@ -157,6 +157,7 @@ extern struct linux_mib	net_statistics[NR_CPUS*2];
 
 extern int sysctl_local_port_range[2];
 extern int sysctl_ip_default_ttl;
+extern int sysctl_ip_early_demux;
 
 #ifdef CONFIG_INET
 static inline int ip_send(struct sk_buff *skb)
@@ -222,8 +223,9 @@ extern int	ip_call_ra_chain(struct sk_buff *skb);
  */
  
 struct sk_buff *ip_defrag(struct sk_buff *skb);
-extern int ip_frag_nqueues;
-extern atomic_t ip_frag_mem;
+extern int ip_frag_nqueues(void);
+extern int ip_frag_mem(void);
+extern void ipfrag_init(void);
 
 /*
  *	Functions provided by ip_forward.c
@@ -87,7 +87,7 @@ extern int inet6_rtm_getroute(struct sk_buff *skb, struct nlmsghdr* nlh, void *a
 extern void rt6_ifdown(struct net_device *dev);
 extern void rt6_mtu_change(struct net_device *dev, unsigned mtu);
 
-extern rwlock_t rt6_lock;
+/* The routing tree is protected by the BR_RT6_LOCK big reader lock. */
 
 /*
  *	Store a destination cache entry in a socket
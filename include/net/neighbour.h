@@ -128,7 +128,7 @@ struct pneigh_entry
 	u8			key[0];
 };
 
-#define NEIGH_HASHMASK		0x1F
+#define NEIGH_HASH_MIN		32	/* Initial and smallest number of buckets */
 #define PNEIGH_HASHMASK		0xF
 
 /*
@@ -142,6 +142,7 @@ struct neigh_table
 	int			family;
 	int			entry_size;
 	int			key_len;
+	/* Unmasked hash of pkey and dev, keyed with hash_rnd */
 	__u32			(*hash)(const void *pkey, const struct net_device *);
 	int			(*constructor)(struct neighbour *);
 	int			(*pconstructor)(struct pneigh_entry *);
@@ -165,11 +166,17 @@ struct neigh_table
 	kmem_cache_t		*kmem_cachep;
 	struct tasklet_struct	gc_task;
 	struct neigh_statistics	stats;
-	struct neighbour	*hash_buckets[NEIGH_HASHMASK+1];
+	/* The table grows with the number of entries and shrinks back;
+	   hash_buckets, hash_mask and hash_rnd change under lock. */
+	struct neighbour	**hash_buckets;
+	unsigned int		hash_mask;
+	__u32			hash_rnd;
+	unsigned int		hash_chain_gc;	/* Next bucket for periodic GC */
 	struct pneigh_entry	*phash_buckets[PNEIGH_HASHMASK+1];
 };
 
 extern void			neigh_table_init(struct neigh_table *tbl);
+extern void			neigh_hash_init(struct neigh_table *tbl);
 extern int			neigh_table_clear(struct neigh_table *tbl);
 extern struct neighbour *	neigh_lookup(struct neigh_table *tbl,
 					     const void *pkey,
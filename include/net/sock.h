@@ -207,7 +207,8 @@ struct inet_opt
 	__u8			pmtudisc;
 	int			mc_index;		/* Multicast device index */
 	__u32			mc_addr;
-	struct ip_mc_socklist	*mc_list;		/* Group array */
+	struct ip_mc_socklist	**mc_hash;		/* Groups, IP_MC_HASH_SIZE chains */
+	int			mc_count;
 };
 #endif
 
@@ -298,6 +299,10 @@ struct tcp_opt {
 	__u8	queue_shrunk;	/* Write queue has been shrunk recently.*/
 	__u8	defer_accept;	/* User waits for some data after accept() */
 
+/* Charged to rmem_alloc/wmem_alloc ahead of use, see tcp_set_owner_r() */
+	int	rmem_fwd;
+	int	wmem_fwd;
+
 /* RTT measurement */
 	__u8	backoff;	/* backoff				*/
 	__u32	srtt;		/* smothed round trip time << 3		*/
@@ -375,6 +380,7 @@ struct tcp_opt {
 	__u32	sacked_out;	/* SACK'd packets			*/
 	__u32	fackets_out;	/* FACK'd packets			*/
 	__u32	high_seq;	/* snd_nxt at onset of congestion	*/
+	__u32	lost_retrans_low; /* snd_nxt when the oldest retransmit in flight was sent */
 
 	__u32	retrans_stamp;	/* Timestamp of the last retransmit,
 				 * also used in SYN-SENT to remember stamp of
@@ -389,28 +395,50 @@ struct tcp_opt {
 	__u8	urg_mode;	/* In urgent mode		*/
 	__u32	snd_up;		/* Urgent pointer		*/
 
-	/* The syn_wait_lock is necessary only to avoid tcp_get_info having
-	 * to grab the main lock sock while browsing the listening hash
-	 * (otherwise it's deadlock prone).
-	 * This lock is acquired in read mode only from tcp_get_info() and
-	 * it's acquired in write mode _only_ from code that is actively
-	 * changing the syn_wait_queue. All readers that are holding
-	 * the master sock lock don't need to grab this lock in read mode
-	 * too as the syn_wait_queue writes are always protected from
-	 * the main sock lock.
+	/* The syn_wait_lock guards the listen_opt of a listening socket:
+	 * its SYN queue, its accept queues and ack_backlog.  Segments for
+	 * a listener are processed under it in write mode, without the
+	 * main sock lock, so that SYNs need not wait for accept() or be
+	 * pushed to the backlog.  tcp_get_info() takes it in read mode.
 	 */
 	rwlock_t		syn_wait_lock;
 	struct tcp_listen_opt	*listen_opt;
 
-	/* FIFO of established children */
-	struct open_request	*accept_queue;
-	struct open_request	*accept_queue_tail;
-
 	int			write_pending;	/* A write to socket waits to start. */
 
 	unsigned int		keepalive_time;	  /* time before keep alive takes place */
 	unsigned int		keepalive_intvl;  /* time interval between keep alive probes */
 	int			linger2;
+
+	/* Receiver side RTT estimate, for receive buffer tuning */
+	struct {
+		__u32	rtt;		/* smoothed rtt << 3			*/
+		__u32	seq;		/* window edge of the current sample	*/
+		__u32	time;		/* when the sample was started		*/
+	} rcv_rtt_est;
+
+	/* Data consumed by the application per receiver rtt */
+	struct {
+		int	space;		/* largest amount seen per rtt, x2	*/
+		__u32	seq;		/* copied_seq when measurement started	*/
+		__u32	time;		/* when measurement started		*/
+	} rcvq_space;
+
+	/* Transmit pacing, see tcp_pace_test() */
+	struct {
+		__u8		on;	/* spread cwnd over srtt		*/
+		__u32		maxrate;/* user cap, bytes/sec, 0 = none	*/
+		int		credit;	/* bytes we may send before waiting	*/
+		unsigned long	stamp;	/* jiffies of the last credit update	*/
+		struct timer_list timer;
+	} pacing;
+
+	struct dst_entry	*rx_dst;	/* input route, for early demux	*/
+
+	/* SACK scoreboard hints, see tcp_sacktag_write_queue() */
+	struct tcp_sack_block	recv_sack_cache[4]; /* blocks of the last SACK	*/
+	struct sk_buff		*sack_skb_hint;	/* where its walk stopped	*/
+	int			sack_cnt_hint;	/* fack_count up to there	*/
 };
 
  	
@@ -508,6 +536,9 @@ struct sock {
 	wait_queue_head_t	*sleep;		/* Sock wait queue			*/
 	struct dst_entry	*dst_cache;	/* Destination cache			*/
 	rwlock_t		dst_lock;
+	int			route_caps;	/* NETIF_F_* of the route's device	*/
+	struct page		*sndmsg_page;	/* Partly filled page of sent data	*/
+	int			sndmsg_off;	/* Where it is free			*/
 	atomic_t		rmem_alloc;	/* Receive queue bytes committed	*/
 	struct sk_buff_head	receive_queue;	/* Incoming packets			*/
 	atomic_t		wmem_alloc;	/* Transmit queue bytes committed	*/
@@ -707,6 +738,11 @@ struct proto {
 					int *option);  	 
 	int			(*sendmsg)(struct sock *sk, struct msghdr *msg,
 					   int len);
+	ssize_t			(*sendpage)(struct sock *sk, struct page *page,
+					int offset, size_t size, int flags);
+	ssize_t			(*receive_file)(struct sock *sk,
+					struct file *file, size_t size,
+					int noblock);
 	int			(*recvmsg)(struct sock *sk, struct msghdr *msg,
 					int len, int noblock, int flags, 
 					int *addr_len);
@@ -877,6 +913,10 @@ extern int                      sock_no_recvmsg(struct socket *,
 extern int			sock_no_mmap(struct file *file,
 					     struct socket *sock,
 					     struct vm_area_struct *vma);
+extern ssize_t			sock_no_sendpage(struct socket *sock,
+						struct page *page,
+						int offset, size_t size, 
+						int flags);
 
 /*
  *	Default socket callbacks and setup code
@@ -909,7 +949,7 @@ static inline int sk_filter(struct sk_buff *skb, struct sk_filter *filter)
 {
 	int pkt_len;
 
-        pkt_len = sk_run_filter(skb, filter->insns, filter->len);
+        pkt_len = SK_RUN_FILTER(filter, skb);
         if(!pkt_len)
                 return 1;	/* Toss Packet */
         else
@@ -932,8 +972,10 @@ static inline void sk_filter_release(struct sock *sk, struct sk_filter *fp)
 
 	atomic_sub(size, &sk->omem_alloc);
 
-	if (atomic_dec_and_test(&fp->refcnt))
+	if (atomic_dec_and_test(&fp->refcnt)) {
+		bpf_jit_free(fp);
 		kfree(fp);
+	}
 }
 
 static inline void sk_filter_charge(struct sock *sk, struct sk_filter *fp)
@@ -191,12 +191,26 @@ struct tcp_tw_bucket {
 	struct tcp_tw_bucket	**pprev_death;
 
 #if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	/* Must be last: IPv4 buckets are allocated without them. */
 	struct in6_addr		v6_daddr;
 	struct in6_addr		v6_rcv_saddr;
 #endif
 };
 
 extern kmem_cache_t *tcp_timewait_cachep;
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+extern kmem_cache_t *tcp6_timewait_cachep;
+#endif
+
+/* Buckets of each family come from a cache of their own size. */
+static inline kmem_cache_t *tcp_tw_cachep(int family)
+{
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	if (family == PF_INET6)
+		return tcp6_timewait_cachep;
+#endif
+	return tcp_timewait_cachep;
+}
 
 static inline void tcp_tw_put(struct tcp_tw_bucket *tw)
 {
@@ -204,7 +218,7 @@ static inline void tcp_tw_put(struct tcp_tw_bucket *tw)
 #ifdef INET_REFCNT_DEBUG
 		printk(KERN_DEBUG "tw_bucket %p released\n", tw);
 #endif
-		kmem_cache_free(tcp_timewait_cachep, tw);
+		kmem_cache_free(tcp_tw_cachep(tw->family), tw);
 	}
 }
 
@@ -355,6 +369,7 @@ static __inline__ int tcp_sk_listen_hashfn(struct sock *sk)
 /* TIME_WAIT reaping mechanism. */
 #define TCP_TWKILL_SLOTS	8	/* Please keep this a power of 2. */
 #define TCP_TWKILL_PERIOD	(TCP_TIMEWAIT_LEN/TCP_TWKILL_SLOTS)
+#define TCP_TWKILL_QUOTA	100	/* Buckets killed per timer run */
 
 #define TCP_SYNQ_INTERVAL	(HZ/5)	/* Period of SYNACK timer */
 #define TCP_SYNQ_HSIZE		64	/* Size of SYNACK hash table */
@@ -464,6 +479,8 @@ extern int sysctl_tcp_wmem[3];
 extern int sysctl_tcp_rmem[3];
 extern int sysctl_tcp_app_win;
 extern int sysctl_tcp_adv_win_scale;
+extern int sysctl_tcp_moderate_rcvbuf;
+extern int sysctl_tcp_pacing;
 
 extern atomic_t tcp_memory_allocated;
 extern atomic_t tcp_sockets_allocated;
@@ -637,6 +654,8 @@ extern void			tcp_v4_err(struct sk_buff *skb,
 
 extern void			tcp_shutdown (struct sock *sk, int how);
 
+extern void			tcp_v4_early_demux(struct sk_buff *skb);
+
 extern int			tcp_v4_rcv(struct sk_buff *skb,
 					   unsigned short len);
 
@@ -645,6 +664,11 @@ extern int			tcp_v4_remember_stamp(struct sock *sk);
 extern int		    	tcp_v4_tw_remember_stamp(struct tcp_tw_bucket *tw);
 
 extern int			tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size);
+extern ssize_t			tcp_sendpage(struct sock *sk, struct page *page, int offset, size_t size, int flags);
+
+typedef int (*sk_read_actor_t)(read_descriptor_t *, struct sk_buff *, char *, size_t);
+extern int			tcp_read_sock(struct sock *sk, read_descriptor_t *desc, sk_read_actor_t recv_actor);
+extern ssize_t			tcp_receive_file(struct sock *sk, struct file *file, size_t size, int noblock);
 
 extern int			tcp_ioctl(struct sock *sk, 
 					  int cmd, 
@@ -686,6 +710,7 @@ static __inline__ void tcp_dec_quickack_mode(struct tcp_opt *tp)
 }
 
 extern void tcp_enter_quickack_mode(struct tcp_opt *tp);
+extern void tcp_rcv_space_adjust(struct sock *sk);
 
 static __inline__ void tcp_delack_init(struct tcp_opt *tp)
 {
@@ -800,6 +825,7 @@ extern __u32 cookie_v4_init_sequence(struct sock *sk, struct sk_buff *skb,
 /* tcp_output.c */
 
 extern int tcp_write_xmit(struct sock *);
+extern int tcp_pace_test(struct sock *, struct tcp_opt *, struct sk_buff *);
 extern int tcp_retransmit_skb(struct sock *, struct sk_buff *);
 extern void tcp_xmit_retransmit_queue(struct sock *);
 extern void tcp_simple_retransmit(struct sock *);
@@ -812,6 +838,7 @@ extern void tcp_send_active_reset(struct sock *sk, int priority);
 extern int  tcp_send_synack(struct sock *);
 extern int  tcp_transmit_skb(struct sock *, struct sk_buff *);
 extern void tcp_send_skb(struct sock *, struct sk_buff *, int force_queue, unsigned mss_now);
+extern void tcp_set_skb_tso_segs(struct sk_buff *skb, unsigned int mss_std);
 extern void tcp_send_ack(struct sock *sk);
 extern void tcp_send_delayed_ack(struct sock *sk);
 
@@ -1019,12 +1046,27 @@ struct tcp_skb_cb {
 
 #define TCP_SKB_CB(__skb)	((struct tcp_skb_cb *)&((__skb)->cb[0]))
 
+/* Segments a sent frame counts for in packets_out and the other
+ * scoreboard counters: more than one for a frame the route segments
+ * itself (NETIF_F_TSO).
+ */
+static inline int tcp_skb_pcount(const struct sk_buff *skb)
+{
+	return skb_shinfo(skb)->tso_segs > 1 ? skb_shinfo(skb)->tso_segs : 1;
+}
+
 #define for_retrans_queue(skb, sk, tp) \
 		for (skb = (sk)->write_queue.next;			\
 		     (skb != (tp)->send_head) &&			\
 		     (skb != (struct sk_buff *)&(sk)->write_queue);	\
 		     skb=skb->next)
 
+/* The retransmit queue changed under the SACK scoreboard hints. */
+static inline void tcp_clear_sack_hints(struct tcp_opt *tp)
+{
+	tp->sack_skb_hint = NULL;
+	memset(tp->recv_sack_cache, 0, sizeof(tp->recv_sack_cache));
+}
 
 #include <net/tcp_ecn.h>
 
@@ -1482,6 +1524,15 @@ static inline void tcp_select_initial_window(int space, __u32 mss,
 	(*rcv_wnd) = min(space, MAX_TCP_WINDOW);
 	(*rcv_wscale) = 0;
 	if (wscale_ok) {
+		/* The receive buffer may be grown later by
+		 * tcp_rcv_space_adjust(), so pick the scale for the
+		 * largest buffer this socket can ever get.
+		 */
+		if (sysctl_tcp_moderate_rcvbuf) {
+			space = max(sysctl_tcp_rmem[2], sysctl_rmem_max);
+			space = min(*window_clamp, space);
+		}
+
 		/* See RFC1323 for an explanation of the limit to 14 */
 		while (space > 65535 && (*rcv_wscale) < 14) {
 			space >>= 1;
@@ -1516,10 +1567,21 @@ static inline int tcp_win_from_space(int space)
 		space - (space>>sysctl_tcp_adv_win_scale);
 }
 
+/* Receive and send memory in use, without what is charged ahead */
+static inline int tcp_rmem_alloc(struct sock *sk)
+{
+	return atomic_read(&sk->rmem_alloc) - sk->tp_pinfo.af_tcp.rmem_fwd;
+}
+
+static inline int tcp_wmem_alloc(struct sock *sk)
+{
+	return atomic_read(&sk->wmem_alloc) - sk->tp_pinfo.af_tcp.wmem_fwd;
+}
+
 /* Note: caller must be prepared to deal with negative returns */ 
 static inline int tcp_space(struct sock *sk)
 {
-	return tcp_win_from_space(sk->rcvbuf - atomic_read(&sk->rmem_alloc));
+	return tcp_win_from_space(sk->rcvbuf - tcp_rmem_alloc(sk));
 } 
 
 static inline int tcp_full_space( struct sock *sk)
@@ -1542,31 +1604,71 @@ static inline int tcp_acceptq_is_full(struct sock *sk)
 	return sk->ack_backlog > sk->max_ack_backlog;
 }
 
+/* FIFO of established children */
+struct tcp_accept_queue
+{
+	struct open_request	*head;
+	struct open_request	*tail;
+};
+
+struct tcp_listen_opt
+{
+	u8			max_qlen_log;	/* log_2 of maximal queued SYNs */
+	int			qlen;
+	int			qlen_young;
+	int			clock_hand;
+	struct open_request	*syn_table[TCP_SYNQ_HSIZE];
+	/* Children are queued on the CPU which completed their handshake
+	 * and accepted preferably from there.
+	 */
+	struct tcp_accept_queue	accept_queue[NR_CPUS];
+};
+
+/* The SYN and accept queues of a listener are under its syn_wait_lock,
+ * held in write mode by everything below.
+ */
+
 static inline void tcp_acceptq_queue(struct sock *sk, struct open_request *req,
 					 struct sock *child)
 {
-	struct tcp_opt *tp = &sk->tp_pinfo.af_tcp;
+	struct tcp_listen_opt *lopt = sk->tp_pinfo.af_tcp.listen_opt;
+	struct tcp_accept_queue *q = &lopt->accept_queue[smp_processor_id()];
 
 	req->sk = child;
 	tcp_acceptq_added(sk);
 
-	if (!tp->accept_queue_tail) {
-		tp->accept_queue = req;
+	if (!q->tail) {
+		q->head = req;
 	} else {
-		tp->accept_queue_tail->dl_next = req;
+		q->tail->dl_next = req;
 	}
-	tp->accept_queue_tail = req;
+	q->tail = req;
 	req->dl_next = NULL;
 }
 
-struct tcp_listen_opt
+static inline struct open_request *__tcp_acceptq_dequeue(struct tcp_accept_queue *q)
 {
-	u8			max_qlen_log;	/* log_2 of maximal queued SYNs */
-	int			qlen;
-	int			qlen_young;
-	int			clock_hand;
-	struct open_request	*syn_table[TCP_SYNQ_HSIZE];
-};
+	struct open_request *req = q->head;
+
+	if (req && (q->head = req->dl_next) == NULL)
+		q->tail = NULL;
+	return req;
+}
+
+/* Oldest child completed on this CPU, or failing that on any other. */
+static inline struct open_request *tcp_acceptq_dequeue(struct sock *sk)
+{
+	struct tcp_listen_opt *lopt = sk->tp_pinfo.af_tcp.listen_opt;
+	struct open_request *req;
+	int i;
+
+	req = __tcp_acceptq_dequeue(&lopt->accept_queue[smp_processor_id()]);
+	for (i = 0; req == NULL && i < smp_num_cpus; i++)
+		req = __tcp_acceptq_dequeue(&lopt->accept_queue[cpu_logical_map(i)]);
+	if (req)
+		tcp_acceptq_removed(sk);
+	return req;
+}
 
 static inline void
 tcp_synq_removed(struct sock *sk, struct open_request *req)
@@ -1606,9 +1708,7 @@ static inline int tcp_synq_is_full(struct sock *sk)
 static inline void tcp_synq_unlink(struct tcp_opt *tp, struct open_request *req,
 				       struct open_request **prev)
 {
-	write_lock(&tp->syn_wait_lock);
 	*prev = req->dl_next;
-	write_unlock(&tp->syn_wait_lock);
 }
 
 static inline void tcp_synq_drop(struct sock *sk, struct open_request *req,
@@ -1704,14 +1804,53 @@ static inline void tcp_writequeue_purge(struct sock *sk)
 
 extern void tcp_rfree(struct sk_buff *skb);
 
+/*
+ * Charging every skb to rmem_alloc and wmem_alloc costs two locked
+ * operations per packet.  Instead the socket charges them a quantum
+ * ahead, and skbs take their share of that with plain arithmetic under
+ * the socket lock.  tcp_rfree() gives received skbs back to rmem_fwd and
+ * returns the excess in one go; transmitted clones are freed from
+ * anywhere, so sock_wfree() still uncharges them one by one.
+ */
 static inline void tcp_set_owner_r(struct sk_buff *skb, struct sock *sk)
 {
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+
 	skb->sk = sk;
 	skb->destructor = tcp_rfree;
-	atomic_add(skb->truesize, &sk->rmem_alloc);
+	if (tp->rmem_fwd < (int)skb->truesize) {
+		atomic_add(skb->truesize + TCP_MEM_QUANTUM, &sk->rmem_alloc);
+		tp->rmem_fwd += skb->truesize + TCP_MEM_QUANTUM;
+	}
+	tp->rmem_fwd -= skb->truesize;
 	sk->forward_alloc -= skb->truesize;
 }
 
+static inline void tcp_set_owner_w(struct sk_buff *skb, struct sock *sk)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+
+	sock_hold(sk);
+	skb->sk = sk;
+	skb->destructor = sock_wfree;
+	if (tp->wmem_fwd < (int)skb->truesize) {
+		atomic_add(skb->truesize + TCP_MEM_QUANTUM, &sk->wmem_alloc);
+		tp->wmem_fwd += skb->truesize + TCP_MEM_QUANTUM;
+	}
+	tp->wmem_fwd -= skb->truesize;
+}
+
+/* Give back what was charged ahead, when the socket is done with it */
+static inline void tcp_release_fwd(struct sock *sk)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+
+	atomic_sub(tp->rmem_fwd, &sk->rmem_alloc);
+	tp->rmem_fwd = 0;
+	atomic_sub(tp->wmem_fwd, &sk->wmem_alloc);
+	tp->wmem_fwd = 0;
+}
+
 extern void tcp_listen_wlock(void);
 
 /* - We may sleep inside this lock.
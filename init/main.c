@@ -27,9 +27,12 @@
 #include <linux/hdreg.h>
 #include <linux/iobuf.h>
 #include <linux/bootmem.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include <asm/io.h>
 #include <asm/bugs.h>
+#include <asm/uaccess.h>
 
 #ifdef CONFIG_PCI
 #include <linux/pci.h>
@@ -86,6 +89,7 @@ extern void init_IRQ(void);
 extern void init_modules(void);
 extern void sock_init(void);
 extern void fork_init(unsigned long);
+extern void pte_chain_init(void);
 extern void mca_init(void);
 extern void sbus_init(void);
 extern void ppc_init(void);
@@ -529,6 +533,7 @@ asmlinkage void __init start_kernel(void)
 	lock_kernel();
 	printk(linux_banner);
 	setup_arch(&command_line);
+	build_all_zonelists();
 	printk("Kernel command line: %s\n", saved_command_line);
 	parse_options(command_line);
 	trap_init();
@@ -581,7 +586,8 @@ asmlinkage void __init start_kernel(void)
 	proc_caches_init();
 	vfs_caches_init(mempages);
 	buffer_init(mempages);
-	page_cache_init(mempages);
+	radix_tree_init();
+	pte_chain_init();
 	kiobuf_setup();
 	signals_init();
 	bdev_init();
@@ -624,15 +630,187 @@ static int do_linuxrc(void * shell)
 
 struct task_struct *child_reaper = &init_task;
 
+/*
+ * "initcall_debug" times every initcall and prints how long it took.
+ * The times stay in /proc/initcalls, one line per initcall in the order
+ * they were started: its address, which System.map turns into a name,
+ * the microseconds it took and whether it ran in its own thread.  While
+ * asynchronous initcalls are running the times of the others include
+ * whatever those did in the meantime.
+ *
+ * "initcall_sync" runs the asynchronous initcalls in line like the rest.
+ */
+struct initcall_time {
+	initcall_t	fn;
+	long		usecs;
+	int		async;
+};
+
+static int initcall_debug __initdata;
+static int initcall_sync __initdata;
+
+static struct initcall_time *initcall_times;
+static int initcall_count;
+static struct initcall_time *initcall_current __initdata;
+static int initcall_async_running __initdata;
+
+static int __init initcall_debug_setup(char *str)
+{
+	initcall_debug = 1;
+	return 1;
+}
+
+static int __init initcall_sync_setup(char *str)
+{
+	initcall_sync = 1;
+	return 1;
+}
+
+__setup("initcall_debug", initcall_debug_setup);
+__setup("initcall_sync", initcall_sync_setup);
+
+static int __init do_one_initcall(initcall_t fn, struct initcall_time *t)
+{
+	struct timeval start, end;
+	int ret;
+
+	if (!t)
+		return fn();
+
+	do_gettimeofday(&start);
+	ret = fn();
+	do_gettimeofday(&end);
+
+	/* An asynchronous one is timed in its thread, not by its stub */
+	if (!t->fn)
+		t->fn = fn;
+	if (t->fn == fn) {
+		t->usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+			   end.tv_usec - start.tv_usec;
+		printk(KERN_DEBUG "initcall %p: %ld usecs%s, returned %d\n",
+		       fn, t->usecs, t->async ? " (async)" : "", ret);
+	}
+	return ret;
+}
+
+struct async_initcall {
+	initcall_t		fn;
+	struct initcall_time	*t;
+};
+
+static int __init async_initcall_thread(void *data)
+{
+	struct async_initcall *a = data;
+
+	lock_kernel();
+	sprintf(current->comm, "initcall");
+	do_one_initcall(a->fn, a->t);
+	unlock_kernel();
+	kfree(a);
+	return 0;
+}
+
+int __init initcall_async(initcall_t fn)
+{
+	struct async_initcall *a;
+
+	if (initcall_sync)
+		return do_one_initcall(fn, initcall_current);
+
+	a = kmalloc(sizeof(*a), GFP_KERNEL);
+	if (!a)
+		return do_one_initcall(fn, initcall_current);
+	a->fn = fn;
+	a->t = initcall_current;
+	if (a->t) {
+		a->t->fn = fn;
+		a->t->async = 1;
+	}
+	if (kernel_thread(async_initcall_thread, a, CLONE_FS | CLONE_FILES | SIGCHLD) < 0) {
+		kfree(a);
+		if (initcall_current)
+			initcall_current->async = 0;
+		return do_one_initcall(fn, initcall_current);
+	}
+	initcall_async_running++;
+	return 0;
+}
+
+/* f_pos counts lines, like /proc/lockmeter */
+static ssize_t initcalls_read(struct file *file, char *buf, size_t count,
+			      loff_t *ppos)
+{
+	char line[48];
+	struct initcall_time *t;
+	unsigned int pos = *ppos;
+	size_t done = 0;
+	int len;
+
+	if (*ppos > initcall_count)
+		return 0;
+	while (pos <= initcall_count) {
+		if (pos == 0)
+			len = sprintf(line, "# initcall usecs\n");
+		else {
+			t = initcall_times + pos - 1;
+			len = sprintf(line, "%p %ld%s\n", t->fn, t->usecs,
+				      t->async ? " async" : "");
+		}
+		if (done + len > count)
+			break;
+		if (copy_to_user(buf + done, line, len))
+			return done ? done : -EFAULT;
+		done += len;
+		pos++;
+	}
+	if (!done && pos <= initcall_count)
+		return -EINVAL;
+	*ppos = pos;
+	return done;
+}
+
+static struct file_operations initcalls_fops = {
+	read:		initcalls_read,
+};
+
 static void __init do_initcalls(void)
 {
+	struct proc_dir_entry *entry;
+	struct initcall_time *t = NULL;
 	initcall_t *call;
+	int status;
+
+	if (initcall_debug) {
+		initcall_count = &__initcall_end - &__initcall_start;
+		initcall_times = kmalloc(initcall_count * sizeof(*t), GFP_KERNEL);
+		if (initcall_times) {
+			memset(initcall_times, 0, initcall_count * sizeof(*t));
+			t = initcall_times;
+		}
+	}
 
 	call = &__initcall_start;
 	do {
-		(*call)();
+		initcall_current = t;
+		do_one_initcall(*call, t);
+		if (t)
+			t++;
 		call++;
 	} while (call < &__initcall_end);
+	initcall_current = NULL;
+
+	/* The asynchronous ones are our only SIGCHLD children yet */
+	while (initcall_async_running > 0) {
+		if (wait(&status) < 0)
+			break;
+		initcall_async_running--;
+	}
+
+	if (initcall_times) {
+		entry = create_proc_entry("initcalls", S_IRUGO, NULL);
+		if (entry)
+			entry->proc_fops = &initcalls_fops;
+	}
 }
 
 /*
@@ -716,7 +894,7 @@ static void __init do_basic_setup(void)
 	else mount_initrd =0;
 #endif
 
-	start_context_thread();
+	init_workqueues();
 	do_initcalls();
 
 	/* .. filesystems .. */
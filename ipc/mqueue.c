@@ -0,0 +1,697 @@
+/*
+ * linux/ipc/mqueue.c
+ *
+ * POSIX message queues.
+ *
+ * A queue is named "/name" in a flat namespace of its own and lives
+ * until it is unlinked and its last descriptor is closed. The
+ * descriptors are files on an internal filesystem, as epoll's are,
+ * so they can be polled.
+ *
+ * The messages of each priority are a FIFO list of their own, and a
+ * bitmap tells which lists are not empty: sending is O(1), receiving
+ * is bounded by MQ_PRIO_MAX however long the queue is.
+ *
+ * SIGEV_THREAD notification is left to the thread library, which
+ * turns it into SIGEV_SIGNAL (see asm/siginfo.h).
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/malloc.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/init.h>
+#include <linux/mqueue.h>
+#include <asm/uaccess.h>
+
+#define MQUEUEFS_MAGIC	0x19800202
+
+struct mq_msg {
+	struct list_head list;
+	size_t len;
+	/* the text follows */
+};
+
+struct mqueue {
+	struct list_head name_list;	/* on mq_names while it has a name */
+	char name[NAME_MAX+1];
+	atomic_t count;			/* the name and the open files */
+
+	uid_t uid;
+	gid_t gid;
+	mode_t mode;
+
+	spinlock_t lock;		/* everything below */
+	long maxmsg;
+	long msgsize;
+	long curmsgs;
+	unsigned long prio_map;		/* bit p set: msgs[p] not empty */
+	struct list_head msgs[MQ_PRIO_MAX];
+	int receivers;			/* blocked in mq_timedreceive() */
+	wait_queue_head_t wait_recv;	/* for messages */
+	wait_queue_head_t wait_send;	/* for room */
+
+	pid_t notify_pid;		/* 0 if nobody is registered */
+	struct sigevent notify;
+};
+
+static LIST_HEAD(mq_names);
+static DECLARE_MUTEX(mq_names_sem);
+
+static struct vfsmount *mqueue_mnt;
+static struct file_operations mqueue_fops;
+
+static void mq_put(struct mqueue *mq)
+{
+	int p;
+
+	if (!atomic_dec_and_test(&mq->count))
+		return;
+	for (p = 0; p < MQ_PRIO_MAX; p++) {
+		while (!list_empty(&mq->msgs[p])) {
+			struct mq_msg *msg = list_entry(mq->msgs[p].next,
+							struct mq_msg, list);
+			list_del(&msg->list);
+			kfree(msg);
+		}
+	}
+	kfree(mq);
+}
+
+/* Names are "/" and at least one more character, with no other "/" */
+static char *mq_getname(const char *uname)
+{
+	char *name = getname(uname);
+
+	if (IS_ERR(name))
+		return name;
+	if (name[0] != '/' || name[1] == '\0' || strchr(name + 1, '/') ||
+	    strlen(name) > NAME_MAX) {
+		putname(name);
+		return ERR_PTR(-EINVAL);
+	}
+	return name;
+}
+
+/* Called with mq_names_sem held */
+static struct mqueue *mq_find(const char *name)
+{
+	struct list_head *tmp;
+
+	list_for_each(tmp, &mq_names) {
+		struct mqueue *mq = list_entry(tmp, struct mqueue, name_list);
+		if (strcmp(mq->name, name) == 0)
+			return mq;
+	}
+	return NULL;
+}
+
+/* Called with mq_names_sem held */
+static struct mqueue *mq_create(const char *name, mode_t mode,
+				struct mq_attr *attr)
+{
+	struct mqueue *mq;
+	int p;
+
+	if (attr) {
+		if (attr->mq_maxmsg <= 0 || attr->mq_maxmsg > MQ_MAXMSG_MAX ||
+		    attr->mq_msgsize <= 0 || attr->mq_msgsize > MQ_MSGSIZE_MAX)
+			return ERR_PTR(-EINVAL);
+	}
+
+	mq = kmalloc(sizeof(*mq), GFP_KERNEL);
+	if (!mq)
+		return ERR_PTR(-ENOMEM);
+	memset(mq, 0, sizeof(*mq));
+	strcpy(mq->name, name);
+	atomic_set(&mq->count, 1);
+	mq->uid = current->fsuid;
+	mq->gid = current->fsgid;
+	mq->mode = mode & S_IRWXUGO & ~current->fs->umask;
+
+	spin_lock_init(&mq->lock);
+	mq->maxmsg = attr ? attr->mq_maxmsg : MQ_MAXMSG_DEFAULT;
+	mq->msgsize = attr ? attr->mq_msgsize : MQ_MSGSIZE_DEFAULT;
+	for (p = 0; p < MQ_PRIO_MAX; p++)
+		INIT_LIST_HEAD(&mq->msgs[p]);
+	init_waitqueue_head(&mq->wait_recv);
+	init_waitqueue_head(&mq->wait_send);
+
+	list_add(&mq->name_list, &mq_names);
+	return mq;
+}
+
+static int mq_permission(struct mqueue *mq, int oflag)
+{
+	int mode = mq->mode;
+	int want;
+
+	switch (oflag & O_ACCMODE) {
+	case O_RDONLY:
+		want = S_IROTH;
+		break;
+	case O_WRONLY:
+		want = S_IWOTH;
+		break;
+	default:
+		want = S_IROTH | S_IWOTH;
+	}
+	if (current->fsuid == mq->uid)
+		mode >>= 6;
+	else if (in_group_p(mq->gid))
+		mode >>= 3;
+	if ((mode & want) == want || capable(CAP_DAC_OVERRIDE))
+		return 0;
+	return -EACCES;
+}
+
+static int mqueuefs_delete_dentry(struct dentry *dentry)
+{
+	return 1;
+}
+
+static struct dentry_operations mqueuefs_dentry_operations = {
+	d_delete:	mqueuefs_delete_dentry,
+};
+
+/* An fd for mq, the way ep_getfd() makes them */
+static int mq_getfd(struct mqueue *mq, int oflag)
+{
+	struct qstr this;
+	struct dentry *dentry;
+	struct inode *inode;
+	struct file *file;
+	int error, fd;
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto out;
+
+	inode = get_empty_inode();
+	if (!inode)
+		goto out_filp;
+	inode->i_fop = &mqueue_fops;
+	inode->i_sb = mqueue_mnt->mnt_sb;
+	/* Never to be put on the dirty list, as with pipes */
+	inode->i_state = I_DIRTY;
+	inode->i_mode = mq->mode;
+	inode->i_uid = mq->uid;
+	inode->i_gid = mq->gid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_blksize = PAGE_SIZE;
+
+	error = get_unused_fd();
+	if (error < 0)
+		goto out_inode;
+	fd = error;
+
+	error = -ENOMEM;
+	this.name = mq->name + 1;
+	this.len = strlen(this.name);
+	this.hash = inode->i_ino;
+	dentry = d_alloc(mqueue_mnt->mnt_sb->s_root, &this);
+	if (!dentry)
+		goto out_fd;
+	dentry->d_op = &mqueuefs_dentry_operations;
+	d_add(dentry, inode);
+	file->f_vfsmnt = mntget(mqueue_mnt);
+	file->f_dentry = dentry;
+
+	file->f_pos = 0;
+	file->f_flags = oflag & (O_ACCMODE | O_NONBLOCK);
+	file->f_op = &mqueue_fops;
+	file->f_mode = (oflag & O_ACCMODE) == O_WRONLY ? FMODE_WRITE :
+		       (oflag & O_ACCMODE) == O_RDONLY ? FMODE_READ :
+		       FMODE_READ | FMODE_WRITE;
+	file->f_version = 0;
+	file->private_data = mq;
+
+	fd_install(fd, file);
+	return fd;
+
+out_fd:
+	put_unused_fd(fd);
+out_inode:
+	iput(inode);
+out_filp:
+	put_filp(file);
+out:
+	return error;
+}
+
+static struct file *mq_fget(int mqdes, mode_t fmode)
+{
+	struct file *file = fget(mqdes);
+
+	if (file && (file->f_op != &mqueue_fops ||
+		     (file->f_mode & fmode) != fmode)) {
+		fput(file);
+		file = NULL;
+	}
+	return file;
+}
+
+/* An absolute CLOCK_REALTIME timeout, in jiffies from now */
+static long mq_timeout(const struct timespec *u_timeout)
+{
+	struct timespec ts;
+	struct timeval now;
+
+	if (!u_timeout)
+		return MAX_SCHEDULE_TIMEOUT;
+	if (copy_from_user(&ts, u_timeout, sizeof(ts)))
+		return -EFAULT;
+	if (ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000L)
+		return -EINVAL;
+
+	do_gettimeofday(&now);
+	ts.tv_sec -= now.tv_sec;
+	ts.tv_nsec -= now.tv_usec * 1000;
+	if (ts.tv_nsec < 0) {
+		ts.tv_nsec += 1000000000L;
+		ts.tv_sec--;
+	}
+	if (ts.tv_sec < 0)
+		return 0;
+	return timespec_to_jiffies(&ts) + 1;
+}
+
+/*
+ * Wait until there is a message (send == 0) or room for one.  Called
+ * and returns with mq->lock held.
+ */
+static int mq_wait(struct mqueue *mq, wait_queue_head_t *wq, int send,
+		   long *timeout)
+{
+	DECLARE_WAITQUEUE(wait, current);
+	int err = 0;
+
+	add_wait_queue_exclusive(wq, &wait);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (send ? mq->curmsgs < mq->maxmsg : mq->curmsgs > 0)
+			break;
+		if (signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		if (!*timeout) {
+			err = -ETIMEDOUT;
+			break;
+		}
+		spin_unlock(&mq->lock);
+		*timeout = schedule_timeout(*timeout);
+		spin_lock(&mq->lock);
+	}
+	set_current_state(TASK_RUNNING);
+	remove_wait_queue(wq, &wait);
+	return err;
+}
+
+asmlinkage long sys_mq_open(const char *u_name, int oflag, mode_t mode,
+			    struct mq_attr *u_attr)
+{
+	struct mq_attr attr, *pattr = NULL;
+	struct mqueue *mq;
+	char *name;
+	long fd;
+
+	if ((oflag & O_ACCMODE) == O_ACCMODE)
+		return -EINVAL;
+	if ((oflag & O_CREAT) && u_attr) {
+		if (copy_from_user(&attr, u_attr, sizeof(attr)))
+			return -EFAULT;
+		pattr = &attr;
+	}
+
+	name = mq_getname(u_name);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	down(&mq_names_sem);
+	mq = mq_find(name);
+	if (mq) {
+		fd = -EEXIST;
+		if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+			goto out;
+		fd = mq_permission(mq, oflag);
+		if (fd)
+			goto out;
+	} else {
+		fd = -ENOENT;
+		if (!(oflag & O_CREAT))
+			goto out;
+		mq = mq_create(name, mode, pattr);
+		fd = PTR_ERR(mq);
+		if (IS_ERR(mq))
+			goto out;
+	}
+
+	atomic_inc(&mq->count);
+	fd = mq_getfd(mq, oflag);
+	if (fd < 0)
+		mq_put(mq);
+out:
+	up(&mq_names_sem);
+	putname(name);
+	return fd;
+}
+
+asmlinkage long sys_mq_unlink(const char *u_name)
+{
+	struct mqueue *mq;
+	char *name;
+	long err;
+
+	name = mq_getname(u_name);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	down(&mq_names_sem);
+	mq = mq_find(name);
+	err = -ENOENT;
+	if (!mq)
+		goto out;
+	err = -EACCES;
+	if (current->fsuid != mq->uid && !capable(CAP_FOWNER))
+		goto out;
+	list_del(&mq->name_list);
+	mq_put(mq);
+	err = 0;
+out:
+	up(&mq_names_sem);
+	putname(name);
+	return err;
+}
+
+asmlinkage long sys_mq_timedsend(int mqdes, const char *u_msg, size_t msg_len,
+				 unsigned int msg_prio,
+				 const struct timespec *u_timeout)
+{
+	struct file *file;
+	struct mqueue *mq;
+	struct mq_msg *msg;
+	struct siginfo info;
+	pid_t notify_pid = 0;
+	long timeout;
+	long err;
+
+	if (msg_prio >= MQ_PRIO_MAX)
+		return -EINVAL;
+	timeout = mq_timeout(u_timeout);
+	if (timeout < 0)
+		return timeout;
+
+	file = mq_fget(mqdes, FMODE_WRITE);
+	if (!file)
+		return -EBADF;
+	mq = file->private_data;
+
+	err = -EMSGSIZE;
+	if (msg_len > mq->msgsize)
+		goto out_fput;
+	err = -ENOMEM;
+	msg = kmalloc(sizeof(*msg) + msg_len, GFP_KERNEL);
+	if (!msg)
+		goto out_fput;
+	err = -EFAULT;
+	if (copy_from_user(msg + 1, u_msg, msg_len))
+		goto out_free;
+	msg->len = msg_len;
+
+	spin_lock(&mq->lock);
+	if (mq->curmsgs >= mq->maxmsg) {
+		err = -EAGAIN;
+		if (file->f_flags & O_NONBLOCK)
+			goto out_unlock;
+		err = mq_wait(mq, &mq->wait_send, 1, &timeout);
+		if (err)
+			goto out_unlock;
+	}
+
+	list_add_tail(&msg->list, &mq->msgs[msg_prio]);
+	mq->prio_map |= 1UL << msg_prio;
+
+	/* Notify only if nobody is already waiting for the message */
+	if (mq->curmsgs++ == 0 && mq->notify_pid && !mq->receivers) {
+		if (mq->notify.sigev_notify == SIGEV_SIGNAL) {
+			notify_pid = mq->notify_pid;
+			memset(&info, 0, sizeof(info));
+			info.si_signo = mq->notify.sigev_signo;
+			info.si_code = SI_MESGQ;
+			info.si_value = mq->notify.sigev_value;
+			info.si_pid = current->pid;
+			info.si_uid = current->uid;
+		}
+		mq->notify_pid = 0;
+	}
+	wake_up(&mq->wait_recv);
+	spin_unlock(&mq->lock);
+
+	if (notify_pid)
+		kill_proc_info(info.si_signo, &info, notify_pid);
+	fput(file);
+	return 0;
+
+out_unlock:
+	spin_unlock(&mq->lock);
+out_free:
+	kfree(msg);
+out_fput:
+	fput(file);
+	return err;
+}
+
+asmlinkage ssize_t sys_mq_timedreceive(int mqdes, char *u_msg, size_t msg_len,
+				       unsigned int *u_prio,
+				       const struct timespec *u_timeout)
+{
+	struct file *file;
+	struct mqueue *mq;
+	struct mq_msg *msg;
+	unsigned int prio;
+	long timeout;
+	ssize_t err;
+
+	timeout = mq_timeout(u_timeout);
+	if (timeout < 0)
+		return timeout;
+
+	file = mq_fget(mqdes, FMODE_READ);
+	if (!file)
+		return -EBADF;
+	mq = file->private_data;
+
+	err = -EMSGSIZE;
+	if (msg_len < mq->msgsize)
+		goto out_fput;
+
+	spin_lock(&mq->lock);
+	if (mq->curmsgs == 0) {
+		err = -EAGAIN;
+		if (file->f_flags & O_NONBLOCK)
+			goto out_unlock;
+		mq->receivers++;
+		err = mq_wait(mq, &mq->wait_recv, 0, &timeout);
+		mq->receivers--;
+		if (err)
+			goto out_unlock;
+	}
+
+	/* The oldest message of the highest priority */
+	for (prio = MQ_PRIO_MAX - 1; !(mq->prio_map & (1UL << prio)); prio--)
+		;
+	msg = list_entry(mq->msgs[prio].next, struct mq_msg, list);
+	list_del(&msg->list);
+	if (list_empty(&mq->msgs[prio]))
+		mq->prio_map &= ~(1UL << prio);
+	mq->curmsgs--;
+	wake_up(&mq->wait_send);
+	spin_unlock(&mq->lock);
+
+	err = msg->len;
+	if (copy_to_user(u_msg, msg + 1, msg->len) ||
+	    (u_prio && put_user(prio, u_prio)))
+		err = -EFAULT;
+	kfree(msg);
+	fput(file);
+	return err;
+
+out_unlock:
+	spin_unlock(&mq->lock);
+out_fput:
+	fput(file);
+	return err;
+}
+
+asmlinkage long sys_mq_notify(int mqdes, const struct sigevent *u_notification)
+{
+	struct sigevent notify;
+	struct file *file;
+	struct mqueue *mq;
+	long err;
+
+	if (u_notification) {
+		if (copy_from_user(&notify, u_notification, sizeof(notify)))
+			return -EFAULT;
+		if (notify.sigev_notify != SIGEV_SIGNAL &&
+		    notify.sigev_notify != SIGEV_NONE)
+			return -EINVAL;
+		if (notify.sigev_notify == SIGEV_SIGNAL &&
+		    (notify.sigev_signo <= 0 || notify.sigev_signo > _NSIG))
+			return -EINVAL;
+	}
+
+	file = mq_fget(mqdes, 0);
+	if (!file)
+		return -EBADF;
+	mq = file->private_data;
+
+	err = 0;
+	spin_lock(&mq->lock);
+	if (u_notification) {
+		if (mq->notify_pid)
+			err = -EBUSY;
+		else {
+			mq->notify_pid = current->pid;
+			mq->notify = notify;
+		}
+	} else if (mq->notify_pid == current->pid)
+		mq->notify_pid = 0;
+	spin_unlock(&mq->lock);
+
+	fput(file);
+	return err;
+}
+
+asmlinkage long sys_mq_getsetattr(int mqdes, const struct mq_attr *u_mqstat,
+				  struct mq_attr *u_omqstat)
+{
+	struct mq_attr mqstat, omqstat;
+	struct file *file;
+	struct mqueue *mq;
+
+	if (u_mqstat && copy_from_user(&mqstat, u_mqstat, sizeof(mqstat)))
+		return -EFAULT;
+
+	file = mq_fget(mqdes, 0);
+	if (!file)
+		return -EBADF;
+	mq = file->private_data;
+
+	memset(&omqstat, 0, sizeof(omqstat));
+	spin_lock(&mq->lock);
+	omqstat.mq_flags = file->f_flags & O_NONBLOCK;
+	omqstat.mq_maxmsg = mq->maxmsg;
+	omqstat.mq_msgsize = mq->msgsize;
+	omqstat.mq_curmsgs = mq->curmsgs;
+	spin_unlock(&mq->lock);
+
+	/* Only O_NONBLOCK can be changed */
+	if (u_mqstat) {
+		if (mqstat.mq_flags & O_NONBLOCK)
+			file->f_flags |= O_NONBLOCK;
+		else
+			file->f_flags &= ~O_NONBLOCK;
+	}
+	fput(file);
+
+	if (u_omqstat && copy_to_user(u_omqstat, &omqstat, sizeof(omqstat)))
+		return -EFAULT;
+	return 0;
+}
+
+static unsigned int mqueue_poll(struct file *file, poll_table *wait)
+{
+	struct mqueue *mq = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &mq->wait_recv, wait);
+	poll_wait(file, &mq->wait_send, wait);
+
+	spin_lock(&mq->lock);
+	if (mq->curmsgs)
+		mask |= POLLIN | POLLRDNORM;
+	if (mq->curmsgs < mq->maxmsg)
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock(&mq->lock);
+	return mask;
+}
+
+static int mqueue_release(struct inode *inode, struct file *file)
+{
+	struct mqueue *mq = file->private_data;
+
+	spin_lock(&mq->lock);
+	if (mq->notify_pid == current->pid)
+		mq->notify_pid = 0;
+	spin_unlock(&mq->lock);
+
+	mq_put(mq);
+	return 0;
+}
+
+static struct file_operations mqueue_fops = {
+	release:	mqueue_release,
+	poll:		mqueue_poll,
+};
+
+static int mqueuefs_statfs(struct super_block *sb, struct statfs *buf)
+{
+	buf->f_type = MQUEUEFS_MAGIC;
+	buf->f_bsize = 1024;
+	buf->f_namelen = NAME_MAX;
+	return 0;
+}
+
+static struct super_operations mqueuefs_ops = {
+	statfs:		mqueuefs_statfs,
+};
+
+static struct super_block *mqueuefs_read_super(struct super_block *sb,
+					       void *data, int silent)
+{
+	struct inode *root = new_inode(sb);
+	if (!root)
+		return NULL;
+	root->i_mode = S_IFDIR | S_IRUSR | S_IWUSR;
+	root->i_uid = root->i_gid = 0;
+	root->i_atime = root->i_mtime = root->i_ctime = CURRENT_TIME;
+	sb->s_blocksize = 1024;
+	sb->s_blocksize_bits = 10;
+	sb->s_magic = MQUEUEFS_MAGIC;
+	sb->s_op = &mqueuefs_ops;
+	sb->s_root = d_alloc(NULL, &(const struct qstr) { "mqueue:", 7, 0 });
+	if (!sb->s_root) {
+		iput(root);
+		return NULL;
+	}
+	sb->s_root->d_sb = sb;
+	sb->s_root->d_parent = sb->s_root;
+	d_instantiate(sb->s_root, root);
+	return sb;
+}
+
+static DECLARE_FSTYPE(mqueue_fs_type, "mqueuefs", mqueuefs_read_super,
+	FS_NOMOUNT|FS_SINGLE);
+
+static int __init mqueue_init(void)
+{
+	int err;
+
+	err = register_filesystem(&mqueue_fs_type);
+	if (!err) {
+		mqueue_mnt = kern_mount(&mqueue_fs_type);
+		err = PTR_ERR(mqueue_mnt);
+		if (IS_ERR(mqueue_mnt))
+			unregister_filesystem(&mqueue_fs_type);
+		else
+			err = 0;
+	}
+	return err;
+}
+
+__initcall(mqueue_init);
@@ -13,6 +13,9 @@
  * mostly rewritten, threaded and wake-one semantics added
  * MSGMAX limit removed, sysctl's added
  * (c) 1999 Manfred Spraul <manfreds@colorfullife.com>
+ *
+ * large messages are copied straight into the buffer of a waiting
+ * receiver, per queue statistics
  */
 
 #include <linux/config.h>
@@ -22,6 +25,8 @@
 #include <linux/init.h>
 #include <linux/proc_fs.h>
 #include <linux/list.h>
+#include <linux/iobuf.h>
+#include <linux/highmem.h>
 #include <asm/uaccess.h>
 #include "util.h"
 
@@ -40,8 +45,24 @@ struct msg_receiver {
 	long r_maxsize;
 
 	struct msg_msg* volatile r_msg;
+
+	/* Pinned buffer for a direct transfer, see direct_send() */
+	struct kiobuf* r_iobuf;
+	long r_type;
+	int r_size;
 };
 
+/*
+ * Messages of at least MSG_DIRECT_MIN bytes are not queued when a
+ * receiver already waits for them: the sender copies the text from
+ * its own buffer straight into the pinned buffer of the receiver,
+ * which saves the allocation and the second copy.  While it does,
+ * r_msg is MSG_DIRECT_BUSY and the receiver must not go away.
+ */
+#define MSG_DIRECT_MIN		(2*PAGE_SIZE)
+#define MSG_DIRECT_BUSY		((struct msg_msg*)1)
+#define MSG_DIRECT_DONE		((struct msg_msg*)2)
+
 /* one msg_sender for each sleeping sender */
 struct msg_sender {
 	struct list_head list;
@@ -76,6 +97,11 @@ struct msg_queue {
 	pid_t q_lspid;			/* pid of last msgsnd */
 	pid_t q_lrpid;			/* last receive pid */
 
+	unsigned long q_snd_msgs;	/* messages sent */
+	unsigned long q_snd_bytes;	/* bytes sent */
+	unsigned long q_snd_direct;	/* of these, copied straight to a receiver */
+	unsigned long q_snd_waits;	/* times a sender blocked on a full queue */
+
 	struct list_head q_messages;
 	struct list_head q_receivers;
 	struct list_head q_senders;
@@ -135,6 +161,8 @@ static int newque (key_t key, int msgflg)
 	msq->q_cbytes = msq->q_qnum = 0;
 	msq->q_qbytes = msg_ctlmnb;
 	msq->q_lspid = msq->q_lrpid = 0;
+	msq->q_snd_msgs = msq->q_snd_bytes = 0;
+	msq->q_snd_direct = msq->q_snd_waits = 0;
 	INIT_LIST_HEAD(&msq->q_messages);
 	INIT_LIST_HEAD(&msq->q_receivers);
 	INIT_LIST_HEAD(&msq->q_senders);
@@ -575,22 +603,22 @@ out_unlock:
 	return err;
 }
 
-static int testmsg(struct msg_msg* msg,long type,int mode)
+static int testmsg(long m_type,long type,int mode)
 {
 	switch(mode)
 	{
 		case SEARCH_ANY:
 			return 1;
 		case SEARCH_LESSEQUAL:
-			if(msg->m_type <=type)
+			if(m_type <=type)
 				return 1;
 			break;
 		case SEARCH_EQUAL:
-			if(msg->m_type == type)
+			if(m_type == type)
 				return 1;
 			break;
 		case SEARCH_NOTEQUAL:
-			if(msg->m_type != type)
+			if(m_type != type)
 				return 1;
 			break;
 	}
@@ -606,7 +634,7 @@ int inline pipelined_send(struct msg_queue* msq, struct msg_msg* msg)
 		struct msg_receiver* msr;
 		msr = list_entry(tmp,struct msg_receiver,r_list);
 		tmp = tmp->next;
-		if(testmsg(msg,msr->r_msgtype,msr->r_mode)) {
+		if(testmsg(msg->m_type,msr->r_msgtype,msr->r_mode)) {
 			list_del(&msr->r_list);
 			if(msr->r_maxsize < msg->m_ts) {
 				msr->r_msg = ERR_PTR(-E2BIG);
@@ -623,6 +651,107 @@ int inline pipelined_send(struct msg_queue* msq, struct msg_msg* msg)
 	return 0;
 }
 
+static int copy_to_kiobuf(struct kiobuf* iobuf, void* src, int len)
+{
+	int i = 0, offset = iobuf->offset;
+
+	while (len > 0) {
+		struct page* page = iobuf->maplist[i++];
+		int n = PAGE_SIZE - offset;
+		char* kaddr;
+		unsigned long left;
+
+		if (page == NULL)
+			return -EFAULT;
+		if (n > len)
+			n = len;
+		kaddr = kmap(page);
+		left = copy_from_user(kaddr + offset, src, n);
+		kunmap(page);
+		if (left)
+			return -EFAULT;
+		src = ((char*)src)+n;
+		len -= n;
+		offset = 0;
+	}
+	return 0;
+}
+
+/*
+ * Hand a large message to a receiver that waits for it with a pinned
+ * buffer.  Returns 1 if the message was delivered, 0 if there was no
+ * such receiver and the message has to take the normal path, or an
+ * error.
+ */
+static int direct_send(int msqid, long mtype, void* src, size_t msgsz)
+{
+	struct msg_queue *msq;
+	struct msg_receiver *msr = NULL;
+	struct task_struct *tsk;
+	struct list_head *tmp;
+	int size;
+
+	msq = msg_lock(msqid);
+	if(msq==NULL)
+		return -EINVAL;
+	if (msg_checkid(msq,msqid)) {
+		msg_unlock(msqid);
+		return -EIDRM;
+	}
+	if (ipcperms(&msq->q_perm, S_IWUGO)) {
+		msg_unlock(msqid);
+		return -EACCES;
+	}
+
+	for (tmp = msq->q_receivers.next; tmp != &msq->q_receivers;
+	     tmp = tmp->next) {
+		msr = list_entry(tmp,struct msg_receiver,r_list);
+		if (msr->r_iobuf != NULL && msr->r_maxsize >= msgsz &&
+		    testmsg(mtype,msr->r_msgtype,msr->r_mode))
+			break;
+		msr = NULL;
+	}
+	if (msr == NULL) {
+		msg_unlock(msqid);
+		return 0;
+	}
+
+	list_del(&msr->r_list);
+	msr->r_msg = MSG_DIRECT_BUSY;
+	tsk = msr->r_tsk;
+	msq->q_lspid = current->pid;
+	msq->q_lrpid = tsk->pid;
+	msq->q_stime = msq->q_rtime = CURRENT_TIME;
+	msq->q_snd_msgs++;
+	msq->q_snd_bytes += msgsz;
+	msq->q_snd_direct++;
+	msg_unlock(msqid);
+
+	size = msgsz;
+	if (size > msr->r_iobuf->length)
+		size = msr->r_iobuf->length;	/* MSG_NOERROR */
+	if (copy_to_kiobuf(msr->r_iobuf, src, size)) {
+		/* Put the receiver back, it waits for another message */
+		msq = msg_lock(msqid);
+		if (msq != NULL && !msg_checkid(msq,msqid)) {
+			list_add_tail(&msr->r_list,&msq->q_receivers);
+			msr->r_msg = ERR_PTR(-EAGAIN);
+		} else
+			msr->r_msg = ERR_PTR(-EIDRM);
+		if (msq != NULL)
+			msg_unlock(msqid);
+		wake_up_process(tsk);
+		return -EFAULT;
+	}
+
+	msr->r_type = mtype;
+	msr->r_size = size;
+	wmb();
+	msr->r_msg = MSG_DIRECT_DONE;
+	wake_up_process(tsk);
+	return 1;
+}
+
 asmlinkage long sys_msgsnd (int msqid, struct msgbuf *msgp, size_t msgsz, int msgflg)
 {
 	struct msg_queue *msq;
@@ -637,6 +766,12 @@ asmlinkage long sys_msgsnd (int msqid, struct msgbuf *msgp, size_t msgsz, int ms
 	if (mtype < 1)
 		return -EINVAL;
 
+	if (msgsz >= MSG_DIRECT_MIN) {
+		err = direct_send(msqid, mtype, msgp->mtext, msgsz);
+		if (err)
+			return err < 0 ? err : 0;
+	}
+
 	msg = load_msg(msgp->mtext, msgsz);
 	if(IS_ERR(msg))
 		return PTR_ERR(msg);
@@ -666,6 +801,7 @@ retry:
 			goto out_unlock_free;
 		}
 		ss_add(msq, &s);
+		msq->q_snd_waits++;
 		msg_unlock(msqid);
 		schedule();
 		current->state= TASK_RUNNING;
@@ -696,6 +832,8 @@ retry:
 	msg = NULL;
 	msq->q_lspid = current->pid;
 	msq->q_stime = CURRENT_TIME;
+	msq->q_snd_msgs++;
+	msq->q_snd_bytes += msgsz;
 
 out_unlock_free:
 	msg_unlock(msqid);
@@ -724,6 +862,38 @@ int inline convert_mode(long* msgtyp, int msgflg)
 	return SEARCH_EQUAL;
 }
 
+static struct kiobuf* pin_rcv_buffer(void* dest, size_t len)
+{
+	struct kiobuf* iobuf;
+
+	if (alloc_kiovec(1, &iobuf))
+		return NULL;
+	if (map_user_kiobuf(READ, iobuf, (unsigned long)dest, len)) {
+		free_kiovec(1, &iobuf);
+		return NULL;
+	}
+	return iobuf;
+}
+
+static void release_rcv_buffer(struct kiobuf* iobuf)
+{
+	unmap_kiobuf(iobuf);
+	free_kiovec(1, &iobuf);
+}
+
+/* Wait until a sender copying into our buffer is done */
+static struct msg_msg* wait_direct(struct msg_receiver* msr)
+{
+	while (msr->r_msg == MSG_DIRECT_BUSY) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (msr->r_msg == MSG_DIRECT_BUSY)
+			schedule();
+		set_current_state(TASK_RUNNING);
+	}
+	rmb();
+	return msr->r_msg;
+}
+
 asmlinkage long sys_msgrcv (int msqid, struct msgbuf *msgp, size_t msgsz,
 			    long msgtyp, int msgflg)
 {
@@ -731,12 +901,15 @@ asmlinkage long sys_msgrcv (int msqid, struct msgbuf *msgp, size_t msgsz,
 	struct msg_receiver msr_d;
 	struct list_head* tmp;
 	struct msg_msg* msg, *found_msg;
+	struct kiobuf* iobuf = NULL;
+	int direct;
 	int err;
 	int mode;
 
 	if (msqid < 0 || (long) msgsz < 0)
 		return -EINVAL;
 	mode = convert_mode(&msgtyp,msgflg);
+	direct = msgsz >= MSG_DIRECT_MIN;
 
 	msq = msg_lock(msqid);
 	if(msq==NULL)
@@ -750,7 +923,7 @@ retry:
 	found_msg=NULL;
 	while (tmp != &msq->q_messages) {
 		msg = list_entry(tmp,struct msg_msg,m_list);
-		if(testmsg(msg,msgtyp,mode)) {
+		if(testmsg(msg->m_type,msgtyp,mode)) {
 			found_msg = msg;
 			if(mode == SEARCH_LESSEQUAL && msg->m_type != 1) {
 				found_msg=msg;
@@ -778,12 +951,21 @@ retry:
 		ss_wakeup(&msq->q_senders,0);
 		msg_unlock(msqid);
 out_success:
-		msgsz = (msgsz > msg->m_ts) ? msg->m_ts : msgsz;
-		if (put_user (msg->m_type, &msgp->mtype) ||
-		    store_msg(msgp->mtext, msg, msgsz)) {
-			    msgsz = -EFAULT;
+		if (msg == MSG_DIRECT_DONE) {
+			mark_dirty_kiobuf(iobuf, msr_d.r_size);
+			msgsz = msr_d.r_size;
+			if (put_user (msr_d.r_type, &msgp->mtype))
+				msgsz = -EFAULT;
+		} else {
+			msgsz = (msgsz > msg->m_ts) ? msg->m_ts : msgsz;
+			if (put_user (msg->m_type, &msgp->mtype) ||
+			    store_msg(msgp->mtext, msg, msgsz)) {
+				    msgsz = -EFAULT;
+			}
+			free_msg(msg);
 		}
-		free_msg(msg);
+		if (iobuf)
+			release_rcv_buffer(iobuf);
 		return msgsz;
 	} else
 	{
@@ -795,6 +977,19 @@ out_success:
 			err=-ENOMSG;
 			goto out_unlock;
 		}
+		if (direct) {
+			/* Pin the buffer for the sender, then look again */
+			direct = 0;
+			msg_unlock(msqid);
+			iobuf = pin_rcv_buffer(msgp->mtext, msgsz);
+			msq = msg_lock(msqid);
+			if (msq == NULL) {
+				err = -EIDRM;
+				msqid = -1;
+				goto out_unlock;
+			}
+			goto retry;
+		}
 		list_add_tail(&msr_d.r_list,&msq->q_receivers);
 		msr_d.r_tsk = current;
 		msr_d.r_msgtype = msgtyp;
@@ -804,17 +999,25 @@ out_success:
 		 else
 		 	msr_d.r_maxsize = msgsz;
 		msr_d.r_msg = ERR_PTR(-EAGAIN);
+		msr_d.r_iobuf = iobuf;
 		current->state = TASK_INTERRUPTIBLE;
 		msg_unlock(msqid);
 
 		schedule();
 		current->state = TASK_RUNNING;
 
-		msg = (struct msg_msg*) msr_d.r_msg;
-		if(!IS_ERR(msg)) 
-			goto out_success;
+		for (;;) {
+			msg = wait_direct(&msr_d);
+			if(!IS_ERR(msg)) 
+				goto out_success;
 
-		t = msg_lock(msqid);
+			/* No sender may start copying while we hold the lock */
+			t = msg_lock(msqid);
+			if (msr_d.r_msg != MSG_DIRECT_BUSY)
+				break;
+			if (t != NULL)
+				msg_unlock(msqid);
+		}
 		if(t==NULL)
 			msqid=-1;
 		msg = (struct msg_msg*)msr_d.r_msg;
@@ -840,6 +1043,8 @@ out_success:
 out_unlock:
 	if(msqid!=-1)
 		msg_unlock(msqid);
+	if (iobuf)
+		release_rcv_buffer(iobuf);
 	return err;
 }
 
@@ -851,13 +1056,13 @@ static int sysvipc_msg_read_proc(char *buffer, char **start, off_t offset, int l
 	int i, len = 0;
 
 	down(&msg_ids.sem);
-	len += sprintf(buffer, "       key      msqid perms      cbytes       qnum lspid lrpid   uid   gid  cuid  cgid      stime      rtime      ctime\n");
+	len += sprintf(buffer, "       key      msqid perms      cbytes       qnum lspid lrpid   uid   gid  cuid  cgid      stime      rtime      ctime    sndmsgs   sndbytes     direct   sndwaits\n");
 
 	for(i = 0; i <= msg_ids.max_id; i++) {
 		struct msg_queue * msq;
 		msq = msg_lock(i);
 		if(msq != NULL) {
-			len += sprintf(buffer + len, "%10d %10d  %4o  %10lu %10lu %5u %5u %5u %5u %5u %5u %10lu %10lu %10lu\n",
+			len += sprintf(buffer + len, "%10d %10d  %4o  %10lu %10lu %5u %5u %5u %5u %5u %5u %10lu %10lu %10lu %10lu %10lu %10lu %10lu\n",
 				msq->q_perm.key,
 				msg_buildid(i,msq->q_perm.seq),
 				msq->q_perm.mode,
@@ -871,7 +1076,11 @@ static int sysvipc_msg_read_proc(char *buffer, char **start, off_t offset, int l
 				msq->q_perm.cgid,
 				msq->q_stime,
 				msq->q_rtime,
-				msq->q_ctime);
+				msq->q_ctime,
+				msq->q_snd_msgs,
+				msq->q_snd_bytes,
+				msq->q_snd_direct,
+				msq->q_snd_waits);
 			msg_unlock(i);
 
 			pos += len;
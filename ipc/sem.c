@@ -84,10 +84,11 @@ static int sysvipc_sem_read_proc(char *buffer, char **start, off_t offset, int l
 
 /*
  * linked list protection:
- *	sem_undo.id_next,
+ *	sem_undo.id_next, sem_undo.id_pprev,
  *	sem_array.sem_pending{,last},
  *	sem_array.sem_undo: sem_lock() for read/write
- *	sem_undo.proc_next: only "current" is allowed to read/write that field.
+ *	sem_undo.proc_next, current->semundo: only "current" is allowed to
+ *		read/write these fields.
  *	
  */
 
@@ -387,7 +388,7 @@ static void freeary (int id)
 
 	/* Invalidate the existing undo structures for this semaphore set.
 	 * (They will be freed without any further action in sem_exit()
-	 * or during the next semop.)
+	 * or by the next semop that searches their hash chain.)
 	 */
 	for (un = sma->undo; un; un = un->id_next)
 		un->semid = -1;
@@ -775,21 +776,31 @@ asmlinkage long sys_semctl (int semid, int semnum, int cmd, union semun arg)
 	}
 }
 
-static struct sem_undo* freeundos(struct sem_array *sma, struct sem_undo* un)
+#define semundo_chain(semid)	(&current->semundo[(semid) & (SEMUNDO_HASH-1)])
+
+/*
+ * Find the undo structure of current for semid.  Entries of arrays
+ * that have been removed meanwhile are freed on the way.
+ */
+static struct sem_undo* find_undo(int semid)
 {
 	struct sem_undo* u;
 	struct sem_undo** up;
 
-	for(up = &current->semundo;(u=*up);up=&u->proc_next) {
-		if(un==u) {
-			un=u->proc_next;
-			*up=un;
+	if (current->semundo == NULL)
+		return NULL;
+
+	up = semundo_chain(semid);
+	while ((u = *up) != NULL) {
+		if (u->semid == semid)
+			return u;
+		if (u->semid == -1) {
+			*up = u->proc_next;
 			kfree(u);
-			return un;
-		}
+		} else
+			up = &u->proc_next;
 	}
-	printk ("freeundos undo list error id=%d\n", un->semid);
-	return un->proc_next;
+	return NULL;
 }
 
 /* returns without sem_lock on error! */
@@ -797,11 +808,21 @@ static int alloc_undo(struct sem_array *sma, struct sem_undo** unp, int semid, i
 {
 	int size, nsems, error;
 	struct sem_undo *un;
+	struct sem_undo **up;
 
 	nsems = sma->sem_nsems;
 	size = sizeof(struct sem_undo) + sizeof(short)*nsems;
 	sem_unlock(semid);
 
+	if (current->semundo == NULL) {
+		size_t hsize = sizeof(struct sem_undo *) * SEMUNDO_HASH;
+
+		current->semundo = kmalloc(hsize, GFP_KERNEL);
+		if (!current->semundo)
+			return -ENOMEM;
+		memset(current->semundo, 0, hsize);
+	}
+
 	un = (struct sem_undo *) kmalloc(size, GFP_KERNEL);
 	if (!un)
 		return -ENOMEM;
@@ -815,9 +836,13 @@ static int alloc_undo(struct sem_array *sma, struct sem_undo** unp, int semid, i
 
 	un->semadj = (short *) &un[1];
 	un->semid = semid;
-	un->proc_next = current->semundo;
-	current->semundo = un;
+	up = semundo_chain(semid);
+	un->proc_next = *up;
+	*up = un;
 	un->id_next = sma->undo;
+	if (un->id_next)
+		un->id_next->id_pprev = &un->id_next;
+	un->id_pprev = &sma->undo;
 	sma->undo = un;
 	*unp = un;
 	return 0;
@@ -873,15 +898,7 @@ asmlinkage long sys_semop (int semid, struct sembuf *tsops, unsigned nsops)
 		/* Make sure we have an undo structure
 		 * for this process and this semaphore set.
 		 */
-		un=current->semundo;
-		while(un != NULL) {
-			if(un->semid==semid)
-				break;
-			if(un->semid==-1)
-				un=freeundos(sma,un);
-			 else
-				un=un->proc_next;
-		}
+		un = find_undo(semid);
 		if (!un) {
 			error = alloc_undo(sma,&un,semid,alter);
 			if(error)
@@ -978,9 +995,9 @@ out_free:
 void sem_exit (void)
 {
 	struct sem_queue *q;
-	struct sem_undo *u, *un = NULL, **up, **unp;
+	struct sem_undo *u, **chains;
 	struct sem_array *sma;
-	int nsems, i;
+	int nsems, i, h;
 
 	/* If the current process was sleeping for a semaphore,
 	 * remove it from the queue.
@@ -999,7 +1016,13 @@ void sem_exit (void)
 			sem_unlock(semid);
 	}
 
-	for (up = &current->semundo; (u = *up); *up = u->proc_next, kfree(u)) {
+	chains = current->semundo;
+	if (chains == NULL)
+		return;
+	current->semundo = NULL;
+
+	for (h = 0; h < SEMUNDO_HASH; h++)
+	for (; (u = chains[h]); chains[h] = u->proc_next, kfree(u)) {
 		int semid = u->semid;
 		if(semid == -1)
 			continue;
@@ -1014,14 +1037,9 @@ void sem_exit (void)
 			goto next_entry;
 
 		/* remove u from the sma->undo list */
-		for (unp = &sma->undo; (un = *unp); unp = &un->id_next) {
-			if (u == un)
-				goto found;
-		}
-		printk ("sem_exit undo list error id=%d\n", u->semid);
-		goto next_entry;
-found:
-		*unp = un->id_next;
+		*u->id_pprev = u->id_next;
+		if (u->id_next)
+			u->id_next->id_pprev = u->id_pprev;
 		/* perform adjustments registered in u */
 		nsems = sma->sem_nsems;
 		for (i = 0; i < nsems; i++) {
@@ -1037,7 +1055,7 @@ found:
 next_entry:
 		sem_unlock(semid);
 	}
-	current->semundo = NULL;
+	kfree(chains);
 }
 
 #ifdef CONFIG_PROC_FS
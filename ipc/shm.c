@@ -22,6 +22,7 @@
 #include <linux/file.h>
 #include <linux/mman.h>
 #include <linux/proc_fs.h>
+#include <linux/bigpages.h>
 #include <asm/uaccess.h>
 
 #include "util.h"
@@ -38,12 +39,18 @@ struct shmid_kernel /* private to the kernel */
 	time_t			shm_ctim;
 	pid_t			shm_cprid;
 	pid_t			shm_lprid;
+	struct page **		shm_bigpages;	/* SHM_BIGPAGES segments only */
+	unsigned long		shm_nbigpages;
 };
 
 #define shm_flags	shm_perm.mode
 
 static struct file_operations shm_file_operations;
 static struct vm_operations_struct shm_vm_ops;
+#ifdef CONFIG_BIGPAGES
+static struct file_operations shm_bigpage_file_operations;
+static struct vm_operations_struct shm_bigpage_vm_ops;
+#endif
 
 static struct ipc_ids shm_ids;
 
@@ -58,6 +65,7 @@ static struct ipc_ids shm_ids;
 static int newseg (key_t key, int shmflg, size_t size);
 static void shm_open (struct vm_area_struct *shmd);
 static void shm_close (struct vm_area_struct *shmd);
+static void shm_free_bigpages (struct shmid_kernel *shp);
 #ifdef CONFIG_PROC_FS
 static int sysvipc_shm_read_proc(char *buffer, char **start, off_t offset, int length, int *eof, void *data);
 #endif
@@ -122,6 +130,7 @@ static void shm_destroy (struct shmid_kernel *shp)
 	shm_tot -= (shp->shm_segsz + PAGE_SIZE - 1) >> PAGE_SHIFT;
 	shm_rmid (shp->id);
 	fput (shp->shm_file);
+	shm_free_bigpages (shp);
 	kfree (shp);
 }
 
@@ -170,11 +179,120 @@ static struct vm_operations_struct shm_vm_ops = {
 	nopage:	shmem_nopage,
 };
 
+#ifdef CONFIG_BIGPAGES
+/*
+ * SHM_BIGPAGES segments are backed by big pages from the pool, which
+ * are all allocated when the segment is created and only go back when
+ * it is destroyed. The shmem file is still there for the name and the
+ * size, but none of its pages are ever used.
+ */
+static int shm_alloc_bigpages (struct shmid_kernel *shp, size_t size)
+{
+	unsigned long i, nr = size >> BIGPAGE_SHIFT;
+
+	if (nr > nr_free_bigpages)
+		return -ENOMEM;
+	shp->shm_bigpages = (struct page **) kmalloc (nr * sizeof (struct page *), GFP_USER);
+	if (!shp->shm_bigpages)
+		return -ENOMEM;
+	for (i = 0; i < nr; i++) {
+		shp->shm_bigpages[i] = alloc_bigpage();
+		if (!shp->shm_bigpages[i]) {
+			shp->shm_nbigpages = i;
+			shm_free_bigpages (shp);
+			return -ENOMEM;
+		}
+	}
+	shp->shm_nbigpages = nr;
+	return 0;
+}
+
+static void shm_free_bigpages (struct shmid_kernel *shp)
+{
+	unsigned long i;
+
+	if (!shp->shm_bigpages)
+		return;
+	for (i = 0; i < shp->shm_nbigpages; i++)
+		free_bigpage (shp->shm_bigpages[i]);
+	kfree (shp->shm_bigpages);
+	shp->shm_bigpages = NULL;
+	shp->shm_nbigpages = 0;
+}
+
+/* Big page segments can only be mapped in whole, aligned big pages */
+static int shm_bigpage_mmap(struct file * file, struct vm_area_struct * vma)
+{
+	if ((vma->vm_start | vma->vm_end) & ~BIGPAGE_MASK)
+		return -EINVAL;
+	if (vma->vm_pgoff & (BIGPAGE_NR - 1))
+		return -EINVAL;
+	UPDATE_ATIME(file->f_dentry->d_inode);
+	vma->vm_ops = &shm_bigpage_vm_ops;
+	vma->vm_flags |= VM_BIGPAGE | VM_RESERVED | VM_DONTEXPAND;
+	shm_inc(file->f_dentry->d_inode->i_ino);
+	return 0;
+}
+
+/* Returns the big page for address, bigpage_fault() maps it */
+static struct page * shm_bigpage_nopage(struct vm_area_struct * vma,
+	unsigned long address, int no_share)
+{
+	int id = vma->vm_file->f_dentry->d_inode->i_ino;
+	struct shmid_kernel *shp;
+	struct page *page = NULL;
+	unsigned long idx;
+
+	idx = ((address - vma->vm_start) >> BIGPAGE_SHIFT) +
+		(vma->vm_pgoff >> BIGPAGE_ORDER);
+	if(!(shp = shm_lock(id)))
+		BUG();
+	if (idx < shp->shm_nbigpages)
+		page = shp->shm_bigpages[idx];
+	shm_unlock(id);
+	return page;
+}
+
+/*
+ * Big page segments have to be attached at a BIGPAGE_SIZE boundary,
+ * so we look for room for one more big page and align that. Called
+ * with the mmap_sem held.
+ */
+static unsigned long shm_bigpage_addr (unsigned long addr, unsigned long size,
+	int shmflg, unsigned long *flags)
+{
+	if (addr) {
+		if (shmflg & SHM_RND)
+			addr &= BIGPAGE_MASK;
+		return addr;
+	}
+	addr = get_unmapped_area(0, size + BIGPAGE_SIZE);
+	if (!addr)
+		return -ENOMEM;
+	*flags |= MAP_FIXED;
+	return (addr + BIGPAGE_SIZE - 1) & BIGPAGE_MASK;
+}
+
+static struct file_operations shm_bigpage_file_operations = {
+	mmap:	shm_bigpage_mmap
+};
+
+static struct vm_operations_struct shm_bigpage_vm_ops = {
+	open:	shm_open,
+	close:	shm_close,
+	nopage:	shm_bigpage_nopage,
+};
+#else
+#define shm_alloc_bigpages(shp, size)	(-EINVAL)
+#define shm_bigpage_addr(addr, size, shmflg, flags)	(addr)
+static inline void shm_free_bigpages (struct shmid_kernel *shp) { }
+#endif
+
 static int newseg (key_t key, int shmflg, size_t size)
 {
 	int error;
 	struct shmid_kernel *shp;
-	int numpages = (size + PAGE_SIZE -1) >> PAGE_SHIFT;
+	int numpages;
 	struct file * file;
 	char name[13];
 	int id;
@@ -182,14 +300,37 @@ static int newseg (key_t key, int shmflg, size_t size)
 	if (size < SHMMIN || size > shm_ctlmax)
 		return -EINVAL;
 
+#ifdef CONFIG_BIGPAGES
+	if (shmflg & SHM_BIGPAGES)
+		size = (size + BIGPAGE_SIZE - 1) & BIGPAGE_MASK;
+#endif
+	numpages = (size + PAGE_SIZE -1) >> PAGE_SHIFT;
 	if (shm_tot + numpages >= shm_ctlall)
 		return -ENOSPC;
 
 	shp = (struct shmid_kernel *) kmalloc (sizeof (*shp), GFP_USER);
 	if (!shp)
 		return -ENOMEM;
+	shp->shm_bigpages = NULL;
+	shp->shm_nbigpages = 0;
 	sprintf (name, "SYSV%08x", key);
-	file = shmem_file_setup(name, size);
+	if (shmflg & SHM_BIGPAGES) {
+		error = shm_alloc_bigpages(shp, size);
+		if (error)
+			goto no_file;
+		/* The memory is already there, don't account it again */
+		file = shmem_file_setup(name, 0);
+		if (!IS_ERR(file)) {
+			file->f_dentry->d_inode->i_size = size;
+#ifdef CONFIG_BIGPAGES
+			file->f_op = &shm_bigpage_file_operations;
+#endif
+		}
+	} else {
+		file = shmem_file_setup(name, size);
+		if (!IS_ERR(file))
+			file->f_op = &shm_file_operations;
+	}
 	error = PTR_ERR(file);
 	if (IS_ERR(file))
 		goto no_file;
@@ -209,7 +350,6 @@ static int newseg (key_t key, int shmflg, size_t size)
 	shp->id = shm_buildid(id,shp->shm_perm.seq);
 	shp->shm_file = file;
 	file->f_dentry->d_inode->i_ino = shp->id;
-	file->f_op = &shm_file_operations;
 	shm_tot += numpages;
 	shm_unlock (id);
 	return shp->id;
@@ -217,6 +357,7 @@ static int newseg (key_t key, int shmflg, size_t size)
 no_id:
 	fput(file);
 no_file:
+	shm_free_bigpages(shp);
 	kfree(shp);
 	return error;
 }
@@ -358,6 +499,9 @@ static void shm_get_stat (unsigned long *rss, unsigned long *swp)
 		if(shp == NULL)
 			continue;
 		inode = shp->shm_file->f_dentry->d_inode;
+#ifdef CONFIG_BIGPAGES
+		*rss += shp->shm_nbigpages * BIGPAGE_NR;
+#endif
 		spin_lock (&inode->u.shmem_i.lock);
 		*rss += inode->i_mapping->nrpages;
 		*swp += inode->u.shmem_i.swapped;
@@ -559,6 +703,7 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 	unsigned long addr;
 	struct file * file;
 	int    err;
+	int    big;
 	unsigned long flags;
 	unsigned long prot;
 	unsigned long o_flags;
@@ -601,11 +746,18 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 		return -EACCES;
 	}
 	file = shp->shm_file;
+	big = shp->shm_nbigpages != 0;
 	shp->shm_nattch++;
 	shm_unlock(shmid);
 
 	down(&current->mm->mmap_sem);
-	user_addr = (void *) do_mmap (file, addr, file->f_dentry->d_inode->i_size, prot, flags, 0);
+	if (big)
+		addr = shm_bigpage_addr(addr, file->f_dentry->d_inode->i_size,
+					shmflg, &flags);
+	if (IS_ERR((void *) addr))
+		user_addr = (void *) addr;
+	else
+		user_addr = (void *) do_mmap (file, addr, file->f_dentry->d_inode->i_size, prot, flags, 0);
 	up(&current->mm->mmap_sem);
 
 	down (&shm_ids.sem);
@@ -626,6 +778,15 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 
 }
 
+static inline int shm_vma(struct vm_area_struct *vma)
+{
+#ifdef CONFIG_BIGPAGES
+	if (vma->vm_ops == &shm_bigpage_vm_ops)
+		return 1;
+#endif
+	return vma->vm_ops == &shm_vm_ops;
+}
+
 /*
  * detach and kill segment if marked destroyed.
  * The work is done in shm_close.
@@ -638,7 +799,7 @@ asmlinkage long sys_shmdt (char *shmaddr)
 	down(&mm->mmap_sem);
 	for (shmd = mm->mmap; shmd; shmd = shmdnext) {
 		shmdnext = shmd->vm_next;
-		if (shmd->vm_ops == &shm_vm_ops
+		if (shm_vma(shmd)
 		    && shmd->vm_start - (shmd->vm_pgoff << PAGE_SHIFT) == (ulong) shmaddr)
 			do_munmap(mm, shmd->vm_start, shmd->vm_end - shmd->vm_start);
 	}
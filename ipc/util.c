@@ -8,6 +8,7 @@
  *            Chris Evans, <chris@ferret.lmh.ox.ac.uk>
  * Nov 1999 - ipc helper functions, unified SMP locking
  *	      Manfred Spraul <manfreds@colorfullife.com>
+ * Oct 2001 - hashed per id locks instead of one lock per identifier set
  */
 
 #include <linux/config.h>
@@ -74,7 +75,8 @@ void __init ipc_init_ids(struct ipc_ids* ids, int size)
 		printk(KERN_ERR "ipc_init_ids() failed, ipc service disabled.\n");
 		ids->size = 0;
 	}
-	ids->ary = SPIN_LOCK_UNLOCKED;
+	for(i=0;i<IPC_LOCKS;i++)
+		spin_lock_init(&ids->locks[i].lock);
 	for(i=0;i<size;i++)
 		ids->entries[i].p = NULL;
 }
@@ -120,13 +122,13 @@ static int grow_ary(struct ipc_ids* ids, int newsize)
 	for(i=ids->size;i<newsize;i++) {
 		new[i].p = NULL;
 	}
-	spin_lock(&ids->ary);
+	ipc_lockall(ids);
 
 	old = ids->entries;
 	ids->entries = new;
 	i = ids->size;
 	ids->size = newsize;
-	spin_unlock(&ids->ary);
+	ipc_unlockall(ids);
 	ipc_free(old, sizeof(struct ipc_id)*i);
 	return ids->size;
 }
@@ -139,8 +141,8 @@ static int grow_ary(struct ipc_ids* ids, int newsize)
  *
  *	Add an entry 'new' to the IPC arrays. The permissions object is
  *	initialised and the first free entry is set up and the id assigned
- *	is returned. The list is returned in a locked state on success.
- *	On failure the list is not locked and -1 is returned.
+ *	is returned. The id is returned in a locked state on success.
+ *	On failure nothing is locked and -1 is returned.
  */
  
 int ipc_addid(struct ipc_ids* ids, struct kern_ipc_perm* new, int size)
@@ -165,7 +167,7 @@ found:
 	if(ids->seq > ids->seq_max)
 		ids->seq = 0;
 
-	spin_lock(&ids->ary);
+	spin_lock(ipc_id_lock(ids, id));
 	ids->entries[id].p = new;
 	return id;
 }
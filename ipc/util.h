@@ -12,6 +12,18 @@ void sem_init (void);
 void msg_init (void);
 void shm_init (void);
 
+/*
+ * There is no lock for the whole set: an id is locked by one of
+ * IPC_LOCKS spinlocks, picked by its slot, so operations on different
+ * objects do not bounce a common cacheline.  Growing the entries array
+ * takes all of them.
+ */
+#define IPC_LOCKS	128	/* Must be a power of 2 */
+
+struct ipc_id_lock {
+	spinlock_t lock;
+} ____cacheline_aligned;
+
 struct ipc_ids {
 	int size;
 	int in_use;
@@ -19,8 +31,8 @@ struct ipc_ids {
 	unsigned short seq;
 	unsigned short seq_max;
 	struct semaphore sem;	
-	spinlock_t ary;
 	struct ipc_id* entries;
+	struct ipc_id_lock locks[IPC_LOCKS];
 };
 
 struct ipc_id {
@@ -34,7 +46,7 @@ void __init ipc_init_ids(struct ipc_ids* ids, int size);
 int ipc_findkey(struct ipc_ids* ids, key_t key);
 int ipc_addid(struct ipc_ids* ids, struct kern_ipc_perm* new, int size);
 
-/* must be called with both locks acquired. */
+/* must be called with ids->sem and the lock of the id acquired. */
 struct kern_ipc_perm* ipc_rmid(struct ipc_ids* ids, int id);
 
 int ipcperms (struct kern_ipc_perm *ipcp, short flg);
@@ -45,9 +57,16 @@ int ipcperms (struct kern_ipc_perm *ipcp, short flg);
 void* ipc_alloc(int size);
 void ipc_free(void* ptr, int size);
 
+extern inline spinlock_t* ipc_id_lock(struct ipc_ids* ids, int lid)
+{
+	return &ids->locks[lid & (IPC_LOCKS-1)].lock;
+}
+
 extern inline void ipc_lockall(struct ipc_ids* ids)
 {
-	spin_lock(&ids->ary);
+	int i;
+	for(i = 0; i < IPC_LOCKS; i++)
+		spin_lock(&ids->locks[i].lock);
 }
 
 extern inline struct kern_ipc_perm* ipc_get(struct ipc_ids* ids, int id)
@@ -63,25 +82,30 @@ extern inline struct kern_ipc_perm* ipc_get(struct ipc_ids* ids, int id)
 
 extern inline void ipc_unlockall(struct ipc_ids* ids)
 {
-	spin_unlock(&ids->ary);
+	int i;
+	for(i = IPC_LOCKS-1; i >= 0; i--)
+		spin_unlock(&ids->locks[i].lock);
 }
 extern inline struct kern_ipc_perm* ipc_lock(struct ipc_ids* ids, int id)
 {
 	struct kern_ipc_perm* out;
 	int lid = id % SEQ_MULTIPLIER;
-	if(lid > ids->size)
-		return NULL;
+	spinlock_t* lock = ipc_id_lock(ids, lid);
 
-	spin_lock(&ids->ary);
+	spin_lock(lock);
+	if(lid >= ids->size) {
+		spin_unlock(lock);
+		return NULL;
+	}
 	out = ids->entries[lid].p;
 	if(out==NULL)
-		spin_unlock(&ids->ary);
+		spin_unlock(lock);
 	return out;
 }
 
 extern inline void ipc_unlock(struct ipc_ids* ids, int id)
 {
-	spin_unlock(&ids->ary);
+	spin_unlock(ipc_id_lock(ids, id % SEQ_MULTIPLIER));
 }
 
 extern inline int ipc_buildid(struct ipc_ids* ids, int id, int seq)
@@ -41,6 +41,9 @@
  *	Oh, fsck... Oopsable SMP race in do_process_acct() - we must hold
  * ->mmap_sem to walk the vma list of current->mm. Nasty, since it leaks
  * a struct file opened for write. Fixed. 2/6/2000, AV.
+ *
+ *  Records are no longer written by the exiting process.  They are kept
+ *  per CPU and written in batches, in order of exit, by kacctd.
  */
 
 #include <linux/config.h>
@@ -53,6 +56,10 @@
 #include <linux/acct.h>
 #include <linux/smp_lock.h>
 #include <linux/file.h>
+#include <linux/init.h>
+#include <linux/notifier.h>
+#include <linux/reboot.h>
+#include <linux/workqueue.h>
 
 #include <asm/uaccess.h>
 
@@ -76,7 +83,39 @@ static volatile int acct_active;
 static volatile int acct_needcheck;
 static struct file *acct_file;
 static struct timer_list acct_timer;
-static void do_acct_process(long, struct file *);
+
+int acct_dropped;		/* records not written while paused */
+
+/*
+ * An exiting process only adds its record to its CPU's buffer.  A flush
+ * takes the records of all CPUs, swapping in each CPU's other buffer,
+ * and writes them ordered by exit time with a write per page.  The
+ * exiting process flushes when it fills its buffer, and otherwise a
+ * record waits at most ACCT_FLUSH_DELAY for kacctd to write it.
+ */
+#define ACCT_BATCH		16	/* records per CPU buffer */
+#define ACCT_FLUSH_DELAY	HZ
+
+struct acct_buf {
+	int		count;
+	unsigned long	exit_time[ACCT_BATCH];	/* jiffies */
+	struct acct	ac[ACCT_BATCH];
+};
+
+struct acct_cpu {
+	spinlock_t		lock;		/* cur */
+	struct acct_buf		*cur;
+	struct acct_buf		buf[2];
+	struct work_struct	work;		/* delayed flush */
+} ____cacheline_aligned;
+
+static struct acct_cpu acct_cpu[NR_CPUS];
+static DECLARE_MUTEX(acct_flush_sem);
+static struct workqueue_struct *acct_wq;
+
+static int acct_start_flush(void);
+static void acct_flush(void);
+static void acct_write_current(long, struct file *);
 
 /*
  * Called whenever the timer says to check the free space.
@@ -181,6 +220,16 @@ asmlinkage long sys_acct(const char *name)
 			goto out_err;
 	}
 
+	if (name && !acct_wq) {
+		error = acct_start_flush();
+		if (error)
+			goto out_err;
+	}
+
+	/* What has been buffered goes to the file it was recorded for */
+	if (acct_wq)
+		acct_flush();
+
 	error = 0;
 	lock_kernel();
 	if (acct_file) {
@@ -202,7 +251,8 @@ asmlinkage long sys_acct(const char *name)
 	}
 	unlock_kernel();
 	if (old_acct) {
-		do_acct_process(0,old_acct);
+		if (name)
+			acct_write_current(0, old_acct);
 		filp_close(old_acct, NULL);
 	}
 out:
@@ -260,30 +310,13 @@ static comp_t encode_comp_t(unsigned long value)
 }
 
 /*
- *  Write an accounting entry for an exiting process
- *
- *  The acct_process() call is the workhorse of the process
- *  accounting system. The struct acct is built here and then written
- *  into the accounting file. This function should only be called from
- *  do_exit().
+ *  Build the accounting entry for the current process.
  */
-
-/*
- *  do_acct_process does all actual work. Caller holds the reference to file.
- */
-static void do_acct_process(long exitcode, struct file *file)
+static void fill_acct(struct acct *acp, long exitcode)
 {
 	struct acct ac;
-	mm_segment_t fs;
 	unsigned long vsize;
 
-	/*
-	 * First check to see if there is enough free_space to continue
-	 * the process accounting system.
-	 */
-	if (!check_free_space(file))
-		return;
-
 	/*
 	 * Fill the accounting struct with the needed info as recorded
 	 * by the different kernel functions.
@@ -331,35 +364,189 @@ static void do_acct_process(long exitcode, struct file *file)
 	ac.ac_swaps = encode_comp_t(current->nswap);
 	ac.ac_exitcode = exitcode;
 
-	/*
-         * Kernel segment override to datasegment and write it
-         * to the accounting file.
-         */
+	*acp = ac;
+}
+
+/*
+ * Kernel segment override to datasegment and write the records
+ * to the accounting file.  Caller holds the reference to file.
+ */
+static void acct_write(struct file *file, char *buf, size_t len)
+{
+	mm_segment_t fs;
+
 	fs = get_fs();
 	set_fs(KERNEL_DS);
-	file->f_op->write(file, (char *)&ac,
-			       sizeof(struct acct), &file->f_pos);
+	file->f_op->write(file, buf, len, &file->f_pos);
 	set_fs(fs);
 }
 
-/*
- * acct_process - now just a wrapper around do_acct_process
- */
-int acct_process(long exitcode)
+static void acct_write_current(long exitcode, struct file *file)
+{
+	struct acct ac;
+
+	if (!check_free_space(file))
+		return;
+	fill_acct(&ac, exitcode);
+	acct_write(file, (char *)&ac, sizeof(struct acct));
+}
+
+static void acct_flush(void)
 {
-	struct file *file = NULL;
+	struct acct_buf *full[NR_CPUS];
+	int pos[NR_CPUS];
+	struct acct_cpu *c;
+	struct file *file;
+	char *page = NULL;
+	size_t len = 0;
+	int i, best;
+
+	down(&acct_flush_sem);
+	for (i = 0; i < smp_num_cpus; i++) {
+		c = acct_cpu + cpu_logical_map(i);
+		spin_lock(&c->lock);
+		full[i] = c->cur;
+		c->cur = (c->cur == c->buf) ? c->buf + 1 : c->buf;
+		spin_unlock(&c->lock);
+		pos[i] = 0;
+	}
+
 	lock_kernel();
-	if (acct_file) {
-		file = acct_file;
+	file = acct_file;
+	if (file)
 		get_file(file);
-		unlock_kernel();
-		do_acct_process(exitcode, acct_file);
+	unlock_kernel();
+
+	/*
+	 * Records buffered while accounting is paused are dropped here,
+	 * and counted.  Those of a file that has been closed just go.
+	 */
+	if (file && check_free_space(file))
+		page = (char *) __get_free_page(GFP_KERNEL);
+
+	/* Each CPU's records are in order of exit already */
+	for (;;) {
+		best = -1;
+		for (i = 0; i < smp_num_cpus; i++)
+			if (pos[i] < full[i]->count &&
+			    (best < 0 ||
+			     time_before(full[i]->exit_time[pos[i]],
+					 full[best]->exit_time[pos[best]])))
+				best = i;
+		if (best < 0)
+			break;
+		if (page) {
+			memcpy(page + len, &full[best]->ac[pos[best]],
+			       sizeof(struct acct));
+			len += sizeof(struct acct);
+			if (len + sizeof(struct acct) > PAGE_SIZE) {
+				acct_write(file, page, len);
+				len = 0;
+			}
+		} else if (file)
+			acct_dropped++;
+		pos[best]++;
+	}
+	if (len)
+		acct_write(file, page, len);
+
+	for (i = 0; i < smp_num_cpus; i++)
+		full[i]->count = 0;
+	if (page)
+		free_page((unsigned long) page);
+	if (file)
 		fput(file);
-	} else
-		unlock_kernel();
+	up(&acct_flush_sem);
+}
+
+static void acct_flush_work(void *unused)
+{
+	acct_flush();
+}
+
+static int acct_start_flush(void)
+{
+	struct workqueue_struct *wq;
+	struct acct_cpu *c;
+	int i;
+
+	down(&acct_flush_sem);
+	if (acct_wq)
+		goto out;
+	for (i = 0; i < smp_num_cpus; i++) {
+		c = acct_cpu + cpu_logical_map(i);
+		spin_lock_init(&c->lock);
+		c->cur = c->buf;
+		INIT_WORK(&c->work, acct_flush_work, NULL);
+	}
+	wq = create_workqueue("kacctd");
+	if (!wq) {
+		up(&acct_flush_sem);
+		return -ENOMEM;
+	}
+	acct_wq = wq;
+out:
+	up(&acct_flush_sem);
 	return 0;
 }
 
+/*
+ * acct_process - buffer the accounting record of the exiting process
+ *
+ * This function should only be called from do_exit().
+ */
+int acct_process(long exitcode)
+{
+	struct acct_cpu *c;
+	struct acct_buf *b;
+	struct acct ac;
+	int stored, full;
+
+	if (!acct_file)
+		return 0;
+
+	fill_acct(&ac, exitcode);
+	do {
+		c = acct_cpu + smp_processor_id();
+		spin_lock(&c->lock);
+		b = c->cur;
+		stored = b->count < ACCT_BATCH;
+		if (stored) {
+			b->exit_time[b->count] = jiffies;
+			b->ac[b->count++] = ac;
+		}
+		full = b->count == ACCT_BATCH;
+		spin_unlock(&c->lock);
+		if (full)
+			acct_flush();
+	} while (!stored);
+
+	if (!full)
+		queue_delayed_work(acct_wq, &c->work, ACCT_FLUSH_DELAY);
+	return 0;
+}
+
+/* Write out what is buffered before the disks go away */
+static int acct_reboot(struct notifier_block *nb, unsigned long event,
+		       void *unused)
+{
+	if (acct_wq)
+		acct_flush();
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block acct_reboot_nb = {
+	notifier_call:	acct_reboot,
+};
+
+static int __init acct_init(void)
+{
+	register_reboot_notifier(&acct_reboot_nb);
+	return 0;
+}
+
+__initcall(acct_init);
+
 #else
 /*
  * Dummy system call when BSD process accounting is not configured
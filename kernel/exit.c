@@ -41,7 +41,7 @@ static void release_task(struct task_struct * p)
 		}
 		task_unlock(p);
 #endif
-		atomic_dec(&p->user->processes);
+		user_processes_add(p->user, -1);
 		free_uid(p->user);
 		unhash_process(p);
 
@@ -431,7 +431,7 @@ NORET_TYPE void do_exit(long code)
 	if (tsk->pid == 1)
 		panic("Attempted to kill init!");
 	tsk->flags |= PF_EXITING;
-	del_timer_sync(&tsk->real_timer);
+	del_hrtimer_sync(&tsk->real_timer);
 
 fake_volatile:
 #ifdef CONFIG_BSD_PROCESS_ACCT
@@ -535,6 +535,15 @@ repeat:
 			case TASK_ZOMBIE:
 				current->times.tms_cutime += p->times.tms_utime + p->times.tms_cutime;
 				current->times.tms_cstime += p->times.tms_stime + p->times.tms_cstime;
+#ifdef CONFIG_TSC_ACCOUNTING
+				{
+					unsigned long long utime, stime;
+
+					task_cputime(p, &utime, &stime);
+					current->acct_cutime += utime + p->acct_cutime;
+					current->acct_cstime += stime + p->acct_cstime;
+				}
+#endif
 				read_unlock(&tasklist_lock);
 				retval = ru ? getrusage(p, RUSAGE_BOTH, ru) : 0;
 				if (!retval && stat_addr)
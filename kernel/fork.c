@@ -18,6 +18,7 @@
 #include <linux/smp_lock.h>
 #include <linux/module.h>
 #include <linux/vmalloc.h>
+#include <linux/aio.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -26,7 +27,6 @@
 
 /* The idle threads do not count.. */
 int nr_threads;
-int nr_running;
 
 int max_threads;
 unsigned long total_forks;	/* Handle normal Linux uptimes. */
@@ -63,6 +63,51 @@ void remove_wait_queue(wait_queue_head_t *q, wait_queue_t * wait)
 	wq_write_unlock_irqrestore(&q->lock, flags);
 }
 
+/*
+ * PIDs in use are kept in pid_map. A pid that has been handed out as
+ * a process group or session id can still be referenced after its
+ * task is gone, so those are also set in pgrp_map and we keep them
+ * until the next time we wrap around, where one pass over the task
+ * list finds out which of them are still used.
+ *
+ * The bits only change with atomic bitops. pgrp_map only ever holds
+ * ids that are also set in pid_map, and it is only cleared with the
+ * tasklist_lock held for writing.
+ */
+int pid_max = PID_MAX;
+int pid_max_limit = PID_MAX;
+static unsigned long *pid_map, *pgrp_map, *pgrp_scan;
+
+#define PID_MAP_BYTES(n) \
+	((((n) + BITS_PER_LONG - 1) / BITS_PER_LONG) * sizeof(long))
+
+static int __init pid_max_setup(char *str)
+{
+	int n = simple_strtoul(str, NULL, 0);
+
+	if (n > PID_MAX_LIMIT)
+		n = PID_MAX_LIMIT;
+	if (n > RESERVED_PIDS)
+		pid_max = pid_max_limit = n;
+	return 1;
+}
+
+__setup("pid_max=", pid_max_setup);
+
+static void __init pid_map_init(void)
+{
+	int size = PID_MAP_BYTES(pid_max_limit);
+
+	pid_map = vmalloc(size);
+	pgrp_map = vmalloc(size);
+	pgrp_scan = vmalloc(size);
+	if (!pid_map || !pgrp_map || !pgrp_scan)
+		panic("Failed to allocate the pid maps\n");
+	memset(pid_map, 0, size);
+	memset(pgrp_map, 0, size);
+	set_bit(0, pid_map);		/* the idle tasks */
+}
+
 void __init fork_init(unsigned long mempages)
 {
 	/*
@@ -74,69 +119,115 @@ void __init fork_init(unsigned long mempages)
 
 	init_task.rlim[RLIMIT_NPROC].rlim_cur = max_threads/2;
 	init_task.rlim[RLIMIT_NPROC].rlim_max = max_threads/2;
+
+	pid_map_init();
 }
 
-/* Protects next_safe and last_pid. */
+/*
+ * Called when a process group or session gets the id @nr, with the
+ * tasklist_lock held.
+ */
+void reserve_pgrp(int nr)
+{
+	set_bit(nr, pgrp_map);
+}
+
+/*
+ * Called when the task owning @nr is unhashed, with the tasklist_lock
+ * held for writing.
+ */
+void free_pid(int nr)
+{
+	if (nr && !test_bit(nr, pgrp_map))
+		clear_bit(nr, pid_map);
+}
+
+/*
+ * Give back the group and session ids nobody uses anymore. We hold
+ * the tasklist_lock for writing so that setpgid() and setsid() cannot
+ * hand out one that we have just found unused.
+ */
+static void reclaim_pgrp_ids(void)
+{
+	struct task_struct *p;
+	int i, nr, words = PID_MAP_BYTES(pid_max_limit) / sizeof(long);
+
+	write_lock_irq(&tasklist_lock);
+	memset(pgrp_scan, 0, words * sizeof(long));
+	for_each_task(p) {
+		set_bit(p->pgrp, pgrp_scan);
+		set_bit(p->session, pgrp_scan);
+	}
+	for (i = 0; i < words; i++) {
+		unsigned long stale = pgrp_map[i] & ~pgrp_scan[i];
+
+		for (nr = i * BITS_PER_LONG; stale; stale >>= 1, nr++) {
+			if (!(stale & 1))
+				continue;
+			clear_bit(nr, pgrp_map);
+			if (!find_task_by_pid(nr))
+				clear_bit(nr, pid_map);
+		}
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
+/* Protects last_pid. */
 spinlock_t lastpid_lock = SPIN_LOCK_UNLOCKED;
 
+/*
+ * Returns the next free pid after last_pid, or -1 if all of them are
+ * in use.
+ */
 static int get_pid(unsigned long flags)
 {
-	static int next_safe = PID_MAX;
-	struct task_struct *p;
+	int nr, wrapped = 0;
 
 	if (flags & CLONE_PID)
 		return current->pid;
 
 	spin_lock(&lastpid_lock);
-	if((++last_pid) & 0xffff8000) {
-		last_pid = 300;		/* Skip daemons etc. */
-		goto inside;
-	}
-	if(last_pid >= next_safe) {
-inside:
-		next_safe = PID_MAX;
-		read_lock(&tasklist_lock);
-	repeat:
-		for_each_task(p) {
-			if(p->pid == last_pid	||
-			   p->pgrp == last_pid	||
-			   p->session == last_pid) {
-				if(++last_pid >= next_safe) {
-					if(last_pid & 0xffff8000)
-						last_pid = 300;
-					next_safe = PID_MAX;
-				}
-				goto repeat;
+	nr = last_pid + 1;
+	for (;;) {
+		if (nr >= pid_max) {
+			if (wrapped++) {
+				nr = -1;
+				break;
 			}
-			if(p->pid > last_pid && next_safe > p->pid)
-				next_safe = p->pid;
-			if(p->pgrp > last_pid && next_safe > p->pgrp)
-				next_safe = p->pgrp;
-			if(p->session > last_pid && next_safe > p->session)
-				next_safe = p->session;
+			reclaim_pgrp_ids();
+			nr = RESERVED_PIDS;	/* Skip daemons etc. */
+		}
+		nr = find_next_zero_bit(pid_map, pid_max, nr);
+		if (nr < pid_max && !test_and_set_bit(nr, pid_map)) {
+			last_pid = nr;
+			break;
 		}
-		read_unlock(&tasklist_lock);
 	}
 	spin_unlock(&lastpid_lock);
 
-	return last_pid;
+	return nr;
 }
 
 static inline int dup_mmap(struct mm_struct * mm)
 {
-	struct vm_area_struct * mpnt, *tmp, **pprev;
+	struct vm_area_struct * mpnt, *tmp, *prev, **pprev;
+	rb_node_t **rb_link, *rb_parent;
 	int retval;
 
 	flush_cache_mm(current->mm);
 	mm->locked_vm = 0;
 	mm->mmap = NULL;
-	mm->mmap_avl = NULL;
+	mm->mm_rb = RB_ROOT;
 	mm->mmap_cache = NULL;
+	mm->mmap_cache_hits = mm->mmap_cache_misses = 0;
 	mm->map_count = 0;
 	mm->cpu_vm_mask = 0;
 	mm->swap_cnt = 0;
 	mm->swap_address = 0;
 	pprev = &mm->mmap;
+	prev = NULL;
+	rb_link = &mm->mm_rb.rb_node;
+	rb_parent = NULL;
 	for (mpnt = current->mm->mmap ; mpnt ; mpnt = mpnt->vm_next) {
 		struct file *file;
 
@@ -176,16 +267,22 @@ static inline int dup_mmap(struct mm_struct * mm)
 		/*
 		 * Link in the new vma even if an error occurred,
 		 * so that exit_mmap() can clean up the mess.
+		 * The pages we just copied are on their pte chains
+		 * already, so page reclaim may look at the tree.
 		 */
+		spin_lock(&mm->page_table_lock);
 		*pprev = tmp;
+		__vma_link_rb(mm, tmp, prev, rb_link, rb_parent);
+		spin_unlock(&mm->page_table_lock);
 		pprev = &tmp->vm_next;
+		prev = tmp;
+		rb_link = &tmp->vm_rb.rb_right;
+		rb_parent = &tmp->vm_rb;
 
 		if (retval)
 			goto fail_nomem;
 	}
 	retval = 0;
-	if (mm->map_count >= AVL_MIN_MAP_COUNT)
-		build_mmap_avl(mm);
 
 fail_nomem:
 	flush_tlb_mm(current->mm);
@@ -201,6 +298,8 @@ static struct mm_struct * mm_init(struct mm_struct * mm)
 	atomic_set(&mm->mm_count, 1);
 	init_MUTEX(&mm->mmap_sem);
 	mm->page_table_lock = SPIN_LOCK_UNLOCKED;
+	mm->ioctx_list_lock = RW_LOCK_UNLOCKED;
+	mm->ioctx_list = NULL;
 	mm->pgd = pgd_alloc();
 	if (mm->pgd)
 		return mm;
@@ -243,6 +342,7 @@ inline void __mmdrop(struct mm_struct *mm)
 void mmput(struct mm_struct *mm)
 {
 	if (atomic_dec_and_test(&mm->mm_users)) {
+		exit_aio(mm);
 		exit_mmap(mm);
 		mmdrop(mm);
 	}
@@ -560,10 +660,10 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 	*p = *current;
 
 	retval = -EAGAIN;
-	if (atomic_read(&p->user->processes) >= p->rlim[RLIMIT_NPROC].rlim_cur)
+	if (user_processes_over(p->user, p->rlim[RLIMIT_NPROC].rlim_cur))
 		goto bad_fork_free;
 	atomic_inc(&p->user->__count);
-	atomic_inc(&p->user->processes);
+	user_processes_add(p->user, 1);
 
 	/*
 	 * Counter increases are protected by
@@ -584,9 +684,14 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 
 	copy_flags(clone_flags, p);
 	p->pid = get_pid(clone_flags);
+	if (p->pid < 0)
+		goto bad_fork_cleanup_exec;
 
 	p->run_list.next = NULL;
 	p->run_list.prev = NULL;
+	p->array = NULL;
+	p->sleep_time = jiffies;
+	p->wake_stamp = 0;
 
 	if ((clone_flags & CLONE_VFORK) || !(clone_flags & CLONE_PARENT)) {
 		p->p_opptr = current;
@@ -602,14 +707,19 @@ int do_fork(unsigned long clone_flags, unsigned long stack_start,
 	init_sigpending(&p->pending);
 
 	p->it_real_value = p->it_virt_value = p->it_prof_value = 0;
-	p->it_real_incr = p->it_virt_incr = p->it_prof_incr = 0;
-	init_timer(&p->real_timer);
+	p->it_virt_incr = p->it_prof_incr = 0;
+	p->it_real_incr.tv_sec = p->it_real_incr.tv_nsec = 0;
+	init_hrtimer(&p->real_timer);
 	p->real_timer.data = (unsigned long) p;
 
 	p->leader = 0;		/* session leadership doesn't inherit */
 	p->tty_old_pgrp = 0;
 	p->times.tms_utime = p->times.tms_stime = 0;
 	p->times.tms_cutime = p->times.tms_cstime = 0;
+#ifdef CONFIG_TSC_ACCOUNTING
+	p->acct_cycles = 0;
+	p->acct_cutime = p->acct_cstime = 0;
+#endif
 #ifdef CONFIG_SMP
 	{
 		int i;
@@ -697,11 +807,13 @@ bad_fork_cleanup_fs:
 bad_fork_cleanup_files:
 	exit_files(p); /* blocking */
 bad_fork_cleanup:
+	free_pid(p->pid);
+bad_fork_cleanup_exec:
 	put_exec_domain(p->exec_domain);
 	if (p->binfmt && p->binfmt->module)
 		__MOD_DEC_USE_COUNT(p->binfmt->module);
 bad_fork_cleanup_count:
-	atomic_dec(&p->user->processes);
+	user_processes_add(p->user, -1);
 	free_uid(p->user);
 bad_fork_free:
 	free_task_struct(p);
@@ -0,0 +1,208 @@
+/*
+ *  linux/kernel/futex.c
+ *
+ *  Fast userspace mutexes: sleep on a user address while it holds an
+ *  expected value, and wake up the sleepers on an address.
+ *
+ *  A sleeper is keyed by the page the address lies in and the offset
+ *  within it, not by the virtual address, so that processes sharing
+ *  a mapping find each other wherever it is mapped.  The page stays
+ *  pinned while anybody sleeps on it, so the key cannot be reused by
+ *  another page meanwhile.  The sleepers are hashed by that key.
+ */
+
+#include <linux/config.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/init.h>
+#include <linux/jhash.h>
+#include <linux/futex.h>
+#include <asm/uaccess.h>
+
+#define FUTEX_HASHBITS	8
+
+struct futex_q {
+	struct list_head list;
+	struct task_struct *task;
+	struct page *page;
+	unsigned int offset;
+};
+
+struct futex_hash_bucket {
+	spinlock_t lock;
+	struct list_head chain;
+} ____cacheline_aligned;
+
+static struct futex_hash_bucket futex_queues[1 << FUTEX_HASHBITS];
+
+static inline struct futex_hash_bucket *hash_futex(struct page *page,
+						   unsigned int offset)
+{
+	u32 h = jhash_2words((u32)(unsigned long)page, offset, 0);
+
+	return &futex_queues[h & ((1 << FUTEX_HASHBITS) - 1)];
+}
+
+/*
+ * Fault in the page of uaddr and take a reference to it.
+ */
+static struct page *pin_page(unsigned long uaddr)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+
+	down(&mm->mmap_sem);
+	vma = find_vma(mm, uaddr);
+	if (!vma || vma->vm_start > uaddr || !(vma->vm_flags & VM_READ))
+		goto out;
+
+	for (;;) {
+		spin_lock(&mm->page_table_lock);
+		page = follow_page(uaddr);
+		if (page && VALID_PAGE(page)) {
+			get_page(page);
+			spin_unlock(&mm->page_table_lock);
+			break;
+		}
+		spin_unlock(&mm->page_table_lock);
+		page = NULL;
+		if (handle_mm_fault(mm, vma, uaddr, 0) <= 0)
+			break;
+	}
+out:
+	up(&mm->mmap_sem);
+	return page;
+}
+
+static int futex_wake(struct page *page, unsigned int offset, int num)
+{
+	struct futex_hash_bucket *bh = hash_futex(page, offset);
+	struct list_head *i, *next;
+	int woken = 0;
+
+	spin_lock(&bh->lock);
+	for (i = bh->chain.next; i != &bh->chain; i = next) {
+		struct futex_q *q = list_entry(i, struct futex_q, list);
+
+		next = i->next;
+		if (q->page == page && q->offset == offset) {
+			list_del_init(i);
+			wake_up_process(q->task);
+			if (++woken >= num)
+				break;
+		}
+	}
+	spin_unlock(&bh->lock);
+	return woken;
+}
+
+/* Returns 1 if we were still queued, 0 if a waker took us off */
+static int unqueue_me(struct futex_hash_bucket *bh, struct futex_q *q)
+{
+	int ret = 0;
+
+	spin_lock(&bh->lock);
+	if (!list_empty(&q->list)) {
+		list_del(&q->list);
+		ret = 1;
+	}
+	spin_unlock(&bh->lock);
+	return ret;
+}
+
+static int futex_wait(int *uaddr, struct page *page, unsigned int offset,
+		      int val, unsigned long timeout)
+{
+	struct futex_hash_bucket *bh = hash_futex(page, offset);
+	struct futex_q q;
+	int curval;
+
+	q.task = current;
+	q.page = page;
+	q.offset = offset;
+
+	/*
+	 * Queue first and check the value after: a waker that changes
+	 * it after our check is then sure to find us.
+	 */
+	set_current_state(TASK_INTERRUPTIBLE);
+	spin_lock(&bh->lock);
+	list_add_tail(&q.list, &bh->chain);
+	spin_unlock(&bh->lock);
+
+	if (get_user(curval, uaddr) != 0) {
+		set_current_state(TASK_RUNNING);
+		if (unqueue_me(bh, &q))
+			return -EFAULT;
+		return 0;
+	}
+	if (curval != val) {
+		set_current_state(TASK_RUNNING);
+		if (unqueue_me(bh, &q))
+			return -EWOULDBLOCK;
+		return 0;
+	}
+
+	timeout = schedule_timeout(timeout);
+	set_current_state(TASK_RUNNING);
+
+	if (!unqueue_me(bh, &q))
+		return 0;
+	if (timeout == 0)
+		return -ETIMEDOUT;
+	return -EINTR;
+}
+
+asmlinkage long sys_futex(int *uaddr, int op, int val, struct timespec *utime)
+{
+	unsigned long addr = (unsigned long)uaddr;
+	unsigned long timeout = MAX_SCHEDULE_TIMEOUT;
+	struct page *page;
+	int ret;
+
+	if (utime) {
+		struct timespec t;
+
+		if (copy_from_user(&t, utime, sizeof(t)))
+			return -EFAULT;
+		if (t.tv_nsec < 0 || t.tv_nsec >= 1000000000L || t.tv_sec < 0)
+			return -EINVAL;
+		timeout = timespec_to_jiffies(&t) + 1;
+	}
+
+	/* Must be naturally aligned, so it cannot straddle two pages */
+	if (addr & (sizeof(int) - 1))
+		return -EINVAL;
+
+	page = pin_page(addr);
+	if (!page)
+		return -EFAULT;
+
+	switch (op) {
+	case FUTEX_WAIT:
+		ret = futex_wait(uaddr, page, addr & ~PAGE_MASK, val, timeout);
+		break;
+	case FUTEX_WAKE:
+		ret = futex_wake(page, addr & ~PAGE_MASK, val);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+
+	put_page(page);
+	return ret;
+}
+
+static int __init init_futex(void)
+{
+	int i;
+
+	for (i = 0; i < (1 << FUTEX_HASHBITS); i++) {
+		spin_lock_init(&futex_queues[i].lock);
+		INIT_LIST_HEAD(&futex_queues[i].chain);
+	}
+	return 0;
+}
+
+__initcall(init_futex);
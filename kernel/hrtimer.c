@@ -0,0 +1,352 @@
+/*
+ *  linux/kernel/hrtimer.c
+ *
+ *  High resolution timers, used by nanosleep(), the ITIMER_REAL
+ *  interval timer and the poll()/select() timeouts.
+ *
+ *  The queues are simple sorted lists, one per CPU. There are
+ *  rarely more than a handful of these timers pending at a time,
+ *  so the cost of the insertion sort is of no concern and it makes
+ *  finding the next expiry trivial.
+ */
+
+#include <linux/config.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+#include <linux/init.h>
+#include <linux/hrtimer.h>
+
+struct hrtimer_base {
+	spinlock_t lock;
+	struct list_head timers;
+#ifdef CONFIG_SMP
+	struct hrtimer *running_timer;
+#endif
+} ____cacheline_aligned;
+
+static struct hrtimer_base hrtimer_bases[NR_CPUS] __cacheline_aligned;
+
+void __init init_hrtimers(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		spin_lock_init(&hrtimer_bases[cpu].lock);
+		INIT_LIST_HEAD(&hrtimer_bases[cpu].timers);
+	}
+}
+
+/*
+ * The current time. We cannot take xtime_lock here, the tick calls
+ * us with it held on some architectures, so we just retry if a
+ * tick came in while we were reading the offset. Without a clock
+ * between ticks we return the end of the current tick, so that a
+ * timer armed from this can never expire early.
+ */
+void hrtimer_get_time(struct hrtime *now)
+{
+#ifdef CONFIG_HIGH_RES_TIMERS
+	unsigned long tick, nsec;
+
+	do {
+		tick = jiffies;
+		nsec = arch_hrtimer_offset();
+	} while (tick != jiffies);
+	while (nsec >= NSEC_PER_JIFFY) {
+		nsec -= NSEC_PER_JIFFY;
+		tick++;
+	}
+	now->tick = tick;
+	now->nsec = nsec;
+#else
+	now->tick = jiffies;
+	now->nsec = NSEC_PER_JIFFY - 1;
+#endif
+}
+
+void hrtime_add(struct hrtime *t, const struct timespec *delta)
+{
+	unsigned long sec = delta->tv_sec;
+	unsigned long nsec = delta->tv_nsec;
+
+	if (sec >= (MAX_JIFFY_OFFSET / HZ)) {
+		t->tick += MAX_JIFFY_OFFSET;
+		return;
+	}
+	t->tick += HZ * sec + nsec / NSEC_PER_JIFFY;
+	t->nsec += nsec % NSEC_PER_JIFFY;
+	if (t->nsec >= NSEC_PER_JIFFY) {
+		t->nsec -= NSEC_PER_JIFFY;
+		t->tick++;
+	}
+}
+
+/*
+ * delta = a - b, or zero if a is not after b.
+ */
+void hrtime_sub(const struct hrtime *a, const struct hrtime *b,
+		struct timespec *delta)
+{
+	unsigned long ticks;
+	long nsec;
+
+	if (!hrtime_before(b, a)) {
+		delta->tv_sec = delta->tv_nsec = 0;
+		return;
+	}
+	ticks = a->tick - b->tick;
+	nsec = a->nsec - b->nsec;
+	if (nsec < 0) {
+		nsec += NSEC_PER_JIFFY;
+		ticks--;
+	}
+	delta->tv_sec = ticks / HZ;
+	nsec += (ticks % HZ) * NSEC_PER_JIFFY;
+	if (nsec >= 1000000000L) {
+		nsec -= 1000000000L;
+		delta->tv_sec++;
+	}
+	delta->tv_nsec = nsec;
+}
+
+#ifdef CONFIG_SMP
+#define hrtimer_enter(base, t) do { (base)->running_timer = t; mb(); } while (0)
+#define hrtimer_exit(base) do { (base)->running_timer = NULL; } while (0)
+
+static int hrtimer_is_running(struct hrtimer *timer)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (hrtimer_bases[cpu].running_timer == timer)
+			return 1;
+	return 0;
+}
+#else
+#define hrtimer_enter(base, t)	do { } while (0)
+#define hrtimer_exit(base)	do { } while (0)
+#endif
+
+/*
+ * Same rules as for the timer wheel in kernel/timer.c: timer->base
+ * only changes under the lock of the base it points to, and when a
+ * timer moves both locks are held, taken in address order.
+ */
+static struct hrtimer_base *lock_hrtimer_bases(struct hrtimer *timer,
+					       struct hrtimer_base *new_base)
+{
+	struct hrtimer_base *old_base;
+
+	for (;;) {
+		old_base = timer->base;
+		if (!old_base || old_base == new_base) {
+			spin_lock(&new_base->lock);
+			if (timer->base == old_base)
+				return old_base;
+			spin_unlock(&new_base->lock);
+			continue;
+		}
+		if (old_base < new_base) {
+			spin_lock(&old_base->lock);
+			spin_lock(&new_base->lock);
+		} else {
+			spin_lock(&new_base->lock);
+			spin_lock(&old_base->lock);
+		}
+		if (timer->base == old_base)
+			return old_base;
+		spin_unlock(&new_base->lock);
+		spin_unlock(&old_base->lock);
+	}
+}
+
+/*
+ * Returns 1 if the timer went to the front of the queue, in which
+ * case the next interrupt may have to come earlier.
+ */
+static int internal_add_hrtimer(struct hrtimer_base *base,
+				struct hrtimer *timer)
+{
+	struct list_head *pos;
+
+	/* Most timers go in at the end, so search from there. */
+	for (pos = base->timers.prev; pos != &base->timers; pos = pos->prev) {
+		struct hrtimer *tmp = list_entry(pos, struct hrtimer, list);
+
+		if (!hrtime_before(&timer->expires, &tmp->expires))
+			break;
+	}
+	list_add(&timer->list, pos);
+	timer->base = base;
+	return pos == &base->timers;
+}
+
+void add_hrtimer(struct hrtimer *timer)
+{
+	struct hrtimer_base *old_base, *new_base;
+	unsigned long flags;
+	int first = 0;
+
+	local_irq_save(flags);
+	new_base = hrtimer_bases + smp_processor_id();
+	old_base = lock_hrtimer_bases(timer, new_base);
+	if (hrtimer_pending(timer))
+		printk("bug: hrtimer added twice at %p.\n",
+			__builtin_return_address(0));
+	else
+		first = internal_add_hrtimer(new_base, timer);
+	if (old_base && old_base != new_base)
+		spin_unlock(&old_base->lock);
+	spin_unlock(&new_base->lock);
+#ifdef CONFIG_HIGH_RES_TIMERS
+	if (first)
+		arch_hrtimer_reprogram();
+#endif
+	local_irq_restore(flags);
+}
+
+int del_hrtimer(struct hrtimer *timer)
+{
+	struct hrtimer_base *base;
+	unsigned long flags;
+	int ret = 0;
+
+	for (;;) {
+		base = timer->base;
+		if (!base)
+			break;
+		spin_lock_irqsave(&base->lock, flags);
+		if (base == timer->base) {
+			if (hrtimer_pending(timer)) {
+				list_del(&timer->list);
+				ret = 1;
+			}
+			timer->list.next = timer->list.prev = NULL;
+			spin_unlock_irqrestore(&base->lock, flags);
+			return ret;
+		}
+		spin_unlock_irqrestore(&base->lock, flags);
+	}
+	timer->list.next = timer->list.prev = NULL;
+	return ret;
+}
+
+#ifdef CONFIG_SMP
+/*
+ * Like del_timer_sync(): on return the timer is not queued and its
+ * handler is not running anywhere.
+ */
+int del_hrtimer_sync(struct hrtimer *timer)
+{
+	int ret = 0;
+
+	for (;;) {
+		ret += del_hrtimer(timer);
+		if (!hrtimer_is_running(timer))
+			break;
+		while (hrtimer_is_running(timer))
+			barrier();
+	}
+	return ret;
+}
+#endif
+
+/*
+ * Run the expired timers of this CPU. Called from the tick and, with
+ * CONFIG_HIGH_RES_TIMERS, from the architecture's one-shot interrupt.
+ */
+void hrtimer_run_queues(void)
+{
+	struct hrtimer_base *base = hrtimer_bases + smp_processor_id();
+	struct hrtime now;
+	unsigned long flags;
+
+	if (list_empty(&base->timers))
+		return;
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+	hrtimer_get_time(&now);
+#else
+	/* we are called from the tick, so this is exact */
+	now.tick = jiffies;
+	now.nsec = 0;
+#endif
+	spin_lock_irqsave(&base->lock, flags);
+	while (!list_empty(&base->timers)) {
+		struct hrtimer *timer;
+		void (*fn)(unsigned long);
+		unsigned long data;
+
+		timer = list_entry(base->timers.next, struct hrtimer, list);
+		if (hrtime_before(&now, &timer->expires))
+			break;
+		fn = timer->function;
+		data = timer->data;
+		list_del(&timer->list);
+		timer->list.next = timer->list.prev = NULL;
+		hrtimer_enter(base, timer);
+		spin_unlock(&base->lock);
+		fn(data);
+		spin_lock(&base->lock);
+		hrtimer_exit(base);
+	}
+	spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/*
+ * Nanoseconds until the first timer of this CPU expires, capped at a
+ * second, or -1 if there is none. Called with interrupts off.
+ */
+long hrtimer_next_event(void)
+{
+	struct hrtimer_base *base = hrtimer_bases + smp_processor_id();
+	struct hrtime now;
+	struct timespec delta;
+
+	if (list_empty(&base->timers))
+		return -1;
+
+	hrtimer_get_time(&now);
+	spin_lock(&base->lock);
+	if (list_empty(&base->timers)) {
+		spin_unlock(&base->lock);
+		return -1;
+	}
+	hrtime_sub(&list_entry(base->timers.next, struct hrtimer, list)->expires,
+		   &now, &delta);
+	spin_unlock(&base->lock);
+	if (delta.tv_sec)
+		return 1000000000L;
+	return delta.tv_nsec;
+}
+
+static void hrtimer_wakeup(unsigned long __data)
+{
+	wake_up_process((struct task_struct *) __data);
+}
+
+/*
+ * The high resolution version of schedule_timeout(): the caller sets
+ * current->state, we sleep for at most *timeout and leave the time
+ * that was left in there. Returns non-zero if we woke up early.
+ */
+int schedule_hrtimeout(struct timespec *timeout)
+{
+	struct hrtimer timer;
+	struct hrtime now;
+
+	init_hrtimer(&timer);
+	hrtimer_get_time(&timer.expires);
+	hrtime_add(&timer.expires, timeout);
+	timer.data = (unsigned long) current;
+	timer.function = hrtimer_wakeup;
+
+	add_hrtimer(&timer);
+	schedule();
+	del_hrtimer_sync(&timer);
+
+	hrtimer_get_time(&now);
+	hrtime_sub(&timer.expires, &now, timeout);
+	return timeout->tv_sec || timeout->tv_nsec;
+}
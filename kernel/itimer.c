@@ -40,25 +40,54 @@ static void jiffiestotv(unsigned long jiffies, struct timeval *value)
 	value->tv_sec = jiffies / HZ;
 }
 
+/*
+ * ITIMER_REAL runs off a high resolution timer, so it keeps its
+ * values as timespecs. Same unsigned treatment as above.
+ */
+static void tvtots(struct timeval *value, struct timespec *ts)
+{
+	unsigned long sec = (unsigned) value->tv_sec;
+	unsigned long usec = (unsigned) value->tv_usec;
+
+	ts->tv_sec = sec + usec / 1000000;
+	ts->tv_nsec = (usec % 1000000) * 1000;
+}
+
+static void tstotv(struct timespec *ts, struct timeval *value)
+{
+	value->tv_sec = ts->tv_sec;
+	value->tv_usec = (ts->tv_nsec + 999) / 1000;
+	if (value->tv_usec >= 1000000) {
+		value->tv_usec -= 1000000;
+		value->tv_sec++;
+	}
+}
+
 int do_getitimer(int which, struct itimerval *value)
 {
 	register unsigned long val, interval;
 
 	switch (which) {
-	case ITIMER_REAL:
-		interval = current->it_real_incr;
-		val = 0;
+	case ITIMER_REAL: {
+		struct timespec left = { 0, 0 };
+
 		/* 
 		 * FIXME! This needs to be atomic, in case the kernel timer happens!
 		 */
-		if (timer_pending(&current->real_timer)) {
-			val = current->real_timer.expires - jiffies;
+		if (hrtimer_pending(&current->real_timer)) {
+			struct hrtime now;
+
+			hrtimer_get_time(&now);
+			hrtime_sub(&current->real_timer.expires, &now, &left);
 
 			/* look out for negative/zero itimer.. */
-			if ((long) val <= 0)
-				val = 1;
+			if (!left.tv_sec && !left.tv_nsec)
+				left.tv_nsec = 1;
 		}
-		break;
+		tstotv(&left, &value->it_value);
+		tstotv(&current->it_real_incr, &value->it_interval);
+		return 0;
+	}
 	case ITIMER_VIRTUAL:
 		val = current->it_virt_value;
 		interval = current->it_virt_incr;
@@ -93,15 +122,21 @@ asmlinkage long sys_getitimer(int which, struct itimerval *value)
 void it_real_fn(unsigned long __data)
 {
 	struct task_struct * p = (struct task_struct *) __data;
-	unsigned long interval;
+	struct hrtime now;
 
 	send_sig(SIGALRM, p, 1);
-	interval = p->it_real_incr;
-	if (interval) {
-		if (interval > (unsigned long) LONG_MAX)
-			interval = LONG_MAX;
-		p->real_timer.expires = jiffies + interval;
-		add_timer(&p->real_timer);
+	if (p->it_real_incr.tv_sec || p->it_real_incr.tv_nsec) {
+		/*
+		 * Keep the period exact, unless we have fallen so far
+		 * behind that the next expiry is already over.
+		 */
+		hrtime_add(&p->real_timer.expires, &p->it_real_incr);
+		hrtimer_get_time(&now);
+		if (!hrtime_before(&now, &p->real_timer.expires)) {
+			p->real_timer.expires = now;
+			hrtime_add(&p->real_timer.expires, &p->it_real_incr);
+		}
+		add_hrtimer(&p->real_timer);
 	}
 }
 
@@ -115,18 +150,20 @@ int do_setitimer(int which, struct itimerval *value, struct itimerval *ovalue)
 	if (ovalue && (k = do_getitimer(which, ovalue)) < 0)
 		return k;
 	switch (which) {
-		case ITIMER_REAL:
-			del_timer_sync(&current->real_timer);
+		case ITIMER_REAL: {
+			struct timespec ts;
+
+			del_hrtimer_sync(&current->real_timer);
 			current->it_real_value = j;
-			current->it_real_incr = i;
+			tvtots(&value->it_interval, &current->it_real_incr);
 			if (!j)
 				break;
-			if (j > (unsigned long) LONG_MAX)
-				j = LONG_MAX;
-			i = j + jiffies;
-			current->real_timer.expires = i;
-			add_timer(&current->real_timer);
+			tvtots(&value->it_value, &ts);
+			hrtimer_get_time(&current->real_timer.expires);
+			hrtime_add(&current->real_timer.expires, &ts);
+			add_hrtimer(&current->real_timer);
 			break;
+		}
 		case ITIMER_VIRTUAL:
 			if (j)
 				j++;
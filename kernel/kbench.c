@@ -0,0 +1,372 @@
+/*
+ *  linux/kernel/kbench.c
+ *
+ *  Microbenchmarks of core kernel primitives.
+ *
+ *  Each write to /proc/kbench names one test, its argument and a loop
+ *  count, e.g. "kmalloc 256 10000".  The test is run right away, in
+ *  the context and on the CPU of the writer, KBENCH_ROUNDS times; the
+ *  result line is appended to a buffer private to the open file and
+ *  can be read back from it.  Pinning the writer with
+ *  sched_setaffinity() gives per-CPU numbers.
+ *
+ *  Result lines are "test arg cpu loops mean best", where mean and
+ *  best are cycles per operation over all rounds and in the fastest
+ *  round.  See Documentation/kbench.txt and scripts/kbench.c.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include <linux/skbuff.h>
+#include <linux/proc_fs.h>
+#include <linux/string.h>
+
+#include <asm/timex.h>
+#include <asm/div64.h>
+#include <asm/semaphore.h>
+#include <asm/uaccess.h>
+
+#define KBENCH_ROUNDS	8
+#define KBENCH_CMD	256
+#define KBENCH_BUF	PAGE_SIZE
+
+struct kbench_arg {
+	unsigned long		arg;
+	char			*path;
+	kmem_cache_t		*cache;
+	struct nameidata	nd;
+};
+
+struct kbench_test {
+	const char	*name;
+	int		(*setup)(struct kbench_arg *);
+	int		(*run)(struct kbench_arg *, int loops);
+	void		(*cleanup)(struct kbench_arg *);
+};
+
+struct kbench_buf {
+	int		len;
+	char		data[KBENCH_BUF - sizeof(int)];
+};
+
+/* One test at a time, so that runs do not disturb each other */
+static DECLARE_MUTEX(kbench_sem);
+
+static int kbench_kmalloc(struct kbench_arg *a, int loops)
+{
+	void *p;
+
+	while (loops--) {
+		p = kmalloc(a->arg, GFP_KERNEL);
+		if (p == NULL)
+			return -ENOMEM;
+		kfree(p);
+	}
+	return 0;
+}
+
+static int kbench_cache_setup(struct kbench_arg *a)
+{
+	if (a->arg == 0 || a->arg > 128*1024)
+		return -EINVAL;
+	a->cache = kmem_cache_create("kbench", a->arg, 0, 0, NULL, NULL);
+	return a->cache ? 0 : -ENOMEM;
+}
+
+static int kbench_cache(struct kbench_arg *a, int loops)
+{
+	void *p;
+
+	while (loops--) {
+		p = kmem_cache_alloc(a->cache, GFP_KERNEL);
+		if (p == NULL)
+			return -ENOMEM;
+		kmem_cache_free(a->cache, p);
+	}
+	return 0;
+}
+
+static void kbench_cache_cleanup(struct kbench_arg *a)
+{
+	kmem_cache_destroy(a->cache);
+}
+
+static int kbench_pages_setup(struct kbench_arg *a)
+{
+	return a->arg < MAX_ORDER ? 0 : -EINVAL;
+}
+
+static int kbench_pages(struct kbench_arg *a, int loops)
+{
+	struct page *page;
+
+	while (loops--) {
+		page = alloc_pages(GFP_KERNEL, a->arg);
+		if (page == NULL)
+			return -ENOMEM;
+		__free_pages(page, a->arg);
+	}
+	return 0;
+}
+
+static int kbench_skb(struct kbench_arg *a, int loops)
+{
+	struct sk_buff *skb;
+
+	while (loops--) {
+		skb = alloc_skb(a->arg, GFP_KERNEL);
+		if (skb == NULL)
+			return -ENOMEM;
+		kfree_skb(skb);
+	}
+	return 0;
+}
+
+static int kbench_path_setup(struct kbench_arg *a)
+{
+	return a->path ? 0 : -EINVAL;
+}
+
+static int kbench_path_walk(struct kbench_arg *a, int loops)
+{
+	struct nameidata nd;
+	int err;
+
+	while (loops--) {
+		err = 0;
+		if (path_init(a->path, LOOKUP_FOLLOW, &nd))
+			err = path_walk(a->path, &nd);
+		if (err)
+			return err;
+		path_release(&nd);
+	}
+	return 0;
+}
+
+/* d_lookup of the last component, in its already looked up parent */
+static int kbench_dlookup_setup(struct kbench_arg *a)
+{
+	int err = 0;
+
+	if (a->path == NULL)
+		return -EINVAL;
+	if (path_init(a->path, LOOKUP_PARENT, &a->nd))
+		err = path_walk(a->path, &a->nd);
+	if (err)
+		return err;
+	if (a->nd.last_type != LAST_NORM) {
+		path_release(&a->nd);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int kbench_dlookup(struct kbench_arg *a, int loops)
+{
+	struct dentry *dentry;
+
+	while (loops--) {
+		dentry = d_lookup(a->nd.dentry, &a->nd.last);
+		if (dentry == NULL)
+			return -ENOENT;
+		dput(dentry);
+	}
+	return 0;
+}
+
+static void kbench_dlookup_cleanup(struct kbench_arg *a)
+{
+	path_release(&a->nd);
+}
+
+static struct kbench_test kbench_tests[] = {
+	{ "kmalloc",	NULL,			kbench_kmalloc,		NULL },
+	{ "kmem_cache",	kbench_cache_setup,	kbench_cache,		kbench_cache_cleanup },
+	{ "alloc_pages", kbench_pages_setup,	kbench_pages,		NULL },
+	{ "skb",	NULL,			kbench_skb,		NULL },
+	{ "path_walk",	kbench_path_setup,	kbench_path_walk,	NULL },
+	{ "d_lookup",	kbench_dlookup_setup,	kbench_dlookup,		kbench_dlookup_cleanup },
+	{ NULL }
+};
+
+/* For path tests the argument shown is the depth of the path */
+static unsigned long kbench_depth(const char *path)
+{
+	unsigned long depth = 0;
+
+	while (*path) {
+		while (*path == '/')
+			path++;
+		if (*path == 0)
+			break;
+		depth++;
+		while (*path && *path != '/')
+			path++;
+	}
+	return depth;
+}
+
+static int kbench_run(struct kbench_test *t, struct kbench_arg *a, int loops,
+		      struct kbench_buf *b)
+{
+	unsigned long long total = 0, best = ~0ULL, c;
+	cycles_t t0;
+	int cpu = smp_processor_id();
+	int err, r;
+
+	if (t->setup) {
+		err = t->setup(a);
+		if (err)
+			return err;
+	}
+
+	for (r = 0; r < KBENCH_ROUNDS; r++) {
+		t0 = get_cycles();
+		err = t->run(a, loops);
+		c = get_cycles() - t0;
+		if (err)
+			break;
+		total += c;
+		if (c < best)
+			best = c;
+		if (current->need_resched)
+			schedule();
+	}
+
+	if (t->cleanup)
+		t->cleanup(a);
+	if (err)
+		return err;
+
+	do_div(total, KBENCH_ROUNDS * loops);
+	do_div(best, loops);
+	b->len += sprintf(b->data + b->len, "%s %lu %d %d %lu %lu\n",
+			  t->name, a->path ? kbench_depth(a->path) : a->arg,
+			  cpu, loops, (unsigned long) total,
+			  (unsigned long) best);
+	return 0;
+}
+
+static int kbench_open(struct inode *inode, struct file *file)
+{
+	struct kbench_buf *b;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	b = kmalloc(sizeof(struct kbench_buf), GFP_KERNEL);
+	if (b == NULL)
+		return -ENOMEM;
+	b->len = 0;
+	file->private_data = b;
+	return 0;
+}
+
+static int kbench_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static ssize_t kbench_read(struct file *file, char *buf, size_t count,
+			   loff_t *ppos)
+{
+	struct kbench_buf *b = file->private_data;
+	loff_t pos = *ppos;
+
+	if (pos >= b->len)
+		return 0;
+	if (count > b->len - pos)
+		count = b->len - pos;
+	if (copy_to_user(buf, b->data + pos, count))
+		return -EFAULT;
+	*ppos = pos + count;
+	return count;
+}
+
+/* "test arg loops"; path tests take a path name as argument */
+static ssize_t kbench_write(struct file *file, const char *buf, size_t count,
+			    loff_t *ppos)
+{
+	struct kbench_buf *b = file->private_data;
+	struct kbench_test *t;
+	struct kbench_arg a;
+	char cmd[KBENCH_CMD], *p, *arg;
+	long loops;
+	int len = count, err;
+
+	if (count > sizeof(cmd) - 1)
+		return -EINVAL;
+	if (copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	cmd[len] = 0;
+
+	/* Split into name, argument and loop count */
+	p = cmd;
+	while (*p && *p != ' ')
+		p++;
+	if (*p == 0)
+		return -EINVAL;
+	*p++ = 0;
+	arg = p;
+	while (*p && *p != ' ')
+		p++;
+	if (*p == 0)
+		return -EINVAL;
+	*p++ = 0;
+	loops = simple_strtol(p, NULL, 0);
+	if (loops <= 0 || loops > 100000000)
+		return -EINVAL;
+
+	for (t = kbench_tests; t->name; t++)
+		if (!strcmp(t->name, cmd))
+			break;
+	if (t->name == NULL)
+		return -ENOENT;
+
+	memset(&a, 0, sizeof(a));
+	if (*arg == '/')
+		a.path = arg;
+	else
+		a.arg = simple_strtoul(arg, NULL, 0);
+
+	if (b->len + KBENCH_CMD > sizeof(b->data))
+		return -ENOSPC;
+
+	down(&kbench_sem);
+	err = kbench_run(t, &a, loops, b);
+	up(&kbench_sem);
+	return err ? err : count;
+}
+
+static struct file_operations kbench_fops = {
+	owner:		THIS_MODULE,
+	open:		kbench_open,
+	read:		kbench_read,
+	write:		kbench_write,
+	release:	kbench_release,
+};
+
+static int __init kbench_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("kbench", S_IWUSR | S_IRUSR, NULL);
+	if (entry == NULL)
+		return -ENOMEM;
+	entry->proc_fops = &kbench_fops;
+	return 0;
+}
+
+static void __exit kbench_exit(void)
+{
+	remove_proc_entry("kbench", NULL);
+}
+
+module_init(kbench_init);
+module_exit(kbench_exit);
@@ -115,8 +115,8 @@ int exec_usermodehelper(char *program_path, char *argv[], char *envp[])
 		struct user_struct *user = curtask->user;
 		curtask->user = INIT_USER;
 		atomic_inc(&INIT_USER->__count);
-		atomic_inc(&INIT_USER->processes);
-		atomic_dec(&user->processes);
+		user_processes_add(INIT_USER, 1);
+		user_processes_add(user, -1);
 		free_uid(user);
 	}
 
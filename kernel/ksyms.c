@@ -45,6 +45,7 @@
 #include <linux/highuid.h>
 #include <linux/brlock.h>
 #include <linux/fs.h>
+#include <linux/hrtimer.h>
 
 #if defined(CONFIG_PROC_FS)
 #include <linux/proc_fs.h>
@@ -132,6 +133,7 @@ EXPORT_SYMBOL(getname);
 EXPORT_SYMBOL(names_cachep);
 EXPORT_SYMBOL(fput);
 EXPORT_SYMBOL(fget);
+EXPORT_SYMBOL(fget_light);
 EXPORT_SYMBOL(igrab);
 EXPORT_SYMBOL(iunique);
 EXPORT_SYMBOL(iget4);
@@ -194,19 +196,25 @@ EXPORT_SYMBOL(___wait_on_page);
 EXPORT_SYMBOL(block_write_full_page);
 EXPORT_SYMBOL(block_read_full_page);
 EXPORT_SYMBOL(block_prepare_write);
+EXPORT_SYMBOL(block_prepare_write_delay);
+EXPORT_SYMBOL(block_prepare_write_pages);
+EXPORT_SYMBOL(block_map_delayed);
 EXPORT_SYMBOL(block_sync_page);
 EXPORT_SYMBOL(cont_prepare_write);
 EXPORT_SYMBOL(generic_commit_write);
+EXPORT_SYMBOL(block_commit_write_pages);
 EXPORT_SYMBOL(block_truncate_page);
 EXPORT_SYMBOL(generic_block_bmap);
+EXPORT_SYMBOL(generic_direct_IO);
 EXPORT_SYMBOL(generic_file_read);
 EXPORT_SYMBOL(do_generic_file_read);
+EXPORT_SYMBOL(do_generic_file_fill);
 EXPORT_SYMBOL(generic_file_write);
+EXPORT_SYMBOL(generic_file_aio_read);
+EXPORT_SYMBOL(generic_file_aio_write);
 EXPORT_SYMBOL(generic_file_mmap);
 EXPORT_SYMBOL(generic_ro_fops);
 EXPORT_SYMBOL(generic_buffer_fdatasync);
-EXPORT_SYMBOL(page_hash_bits);
-EXPORT_SYMBOL(page_hash_table);
 EXPORT_SYMBOL(file_lock_list);
 EXPORT_SYMBOL(locks_init_lock);
 EXPORT_SYMBOL(locks_copy_lock);
@@ -238,7 +246,9 @@ EXPORT_SYMBOL(generic_read_dir);
 EXPORT_SYMBOL(__pollwait);
 EXPORT_SYMBOL(poll_freewait);
 EXPORT_SYMBOL(ROOT_DEV);
-EXPORT_SYMBOL(__find_lock_page);
+EXPORT_SYMBOL(find_get_page);
+EXPORT_SYMBOL(find_lock_page);
+EXPORT_SYMBOL(find_get_pages);
 EXPORT_SYMBOL(grab_cache_page);
 EXPORT_SYMBOL(read_cache_page);
 EXPORT_SYMBOL(vfs_readlink);
@@ -344,6 +354,11 @@ EXPORT_SYMBOL(proc_doulongvec_minmax);
 /* interrupt handling */
 EXPORT_SYMBOL(add_timer);
 EXPORT_SYMBOL(del_timer);
+EXPORT_SYMBOL(add_hrtimer);
+EXPORT_SYMBOL(del_hrtimer);
+EXPORT_SYMBOL(hrtimer_get_time);
+EXPORT_SYMBOL(hrtime_add);
+EXPORT_SYMBOL(hrtime_sub);
 EXPORT_SYMBOL(request_irq);
 EXPORT_SYMBOL(free_irq);
 #if !defined(CONFIG_ARCH_S390)
@@ -364,6 +379,7 @@ EXPORT_SYMBOL(probe_irq_off);
 
 #ifdef CONFIG_SMP
 EXPORT_SYMBOL(del_timer_sync);
+EXPORT_SYMBOL(del_hrtimer_sync);
 #endif
 EXPORT_SYMBOL(mod_timer);
 EXPORT_SYMBOL(tq_timer);
@@ -391,9 +407,12 @@ EXPORT_SYMBOL(expand_kiobuf);
 
 EXPORT_SYMBOL(map_user_kiobuf);
 EXPORT_SYMBOL(unmap_kiobuf);
+EXPORT_SYMBOL(mark_dirty_kiobuf);
 EXPORT_SYMBOL(lock_kiovec);
 EXPORT_SYMBOL(unlock_kiovec);
 EXPORT_SYMBOL(brw_kiovec);
+EXPORT_SYMBOL(brw_kiovec_async);
+EXPORT_SYMBOL(brw_kiovec_done);
 
 /* dma handling */
 EXPORT_SYMBOL(request_dma);
@@ -425,6 +444,7 @@ EXPORT_SYMBOL(interruptible_sleep_on);
 EXPORT_SYMBOL(interruptible_sleep_on_timeout);
 EXPORT_SYMBOL(schedule);
 EXPORT_SYMBOL(schedule_timeout);
+EXPORT_SYMBOL(schedule_hrtimeout);
 EXPORT_SYMBOL(jiffies);
 EXPORT_SYMBOL(xtime);
 EXPORT_SYMBOL(do_gettimeofday);
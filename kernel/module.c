@@ -55,16 +55,41 @@ struct module *module_list = &kernel_module;
 
 #endif	/* defined(CONFIG_MODULES) || defined(CONFIG_KALLSYMS) */
 
+static inline unsigned long symbol_hash(const char *name)
+{
+	unsigned long hash = 0;
+
+	while (*name)
+		hash = (hash << 5) + hash + (unsigned char) *name++;
+	return hash ^ (hash >> 10) ^ (hash >> 20);
+}
+
 /* inter_module functions are always available, even when the kernel is
  * compiled without modules.  Consumers of inter_module_xxx routines
  * will always work, even when both are built into the kernel, this
  * approach removes lots of #ifdefs in mainline code.
  */
 
-static struct list_head ime_list = LIST_HEAD_INIT(ime_list);
+#define IME_HASH_SIZE	32	/* must be a power of two */
+
+static struct list_head ime_hash[IME_HASH_SIZE];
+static int ime_hash_ready;
 static spinlock_t ime_lock = SPIN_LOCK_UNLOCKED;
 static int kmalloc_failed;
 
+/* Called with ime_lock held */
+static struct list_head *ime_bucket(const char *im_name)
+{
+	int i;
+
+	if (!ime_hash_ready) {
+		for (i = 0; i < IME_HASH_SIZE; i++)
+			INIT_LIST_HEAD(ime_hash + i);
+		ime_hash_ready = 1;
+	}
+	return ime_hash + (symbol_hash(im_name) & (IME_HASH_SIZE - 1));
+}
+
 /**
  * inter_module_register - register a new set of inter module data.
  * @im_name: an arbitrary string to identify the data, must be unique
@@ -77,7 +102,7 @@ static int kmalloc_failed;
  */
 void inter_module_register(const char *im_name, struct module *owner, const void *userdata)
 {
-	struct list_head *tmp;
+	struct list_head *tmp, *bucket;
 	struct inter_module_entry *ime, *ime_new;
 
 	if (!(ime_new = kmalloc(sizeof(*ime), GFP_KERNEL))) {
@@ -94,7 +119,8 @@ void inter_module_register(const char *im_name, struct module *owner, const void
 	ime_new->userdata = userdata;
 
 	spin_lock(&ime_lock);
-	list_for_each(tmp, &ime_list) {
+	bucket = ime_bucket(im_name);
+	list_for_each(tmp, bucket) {
 		ime = list_entry(tmp, struct inter_module_entry, list);
 		if (strcmp(ime->im_name, im_name) == 0) {
 			spin_unlock(&ime_lock);
@@ -104,7 +130,7 @@ void inter_module_register(const char *im_name, struct module *owner, const void
 			BUG();
 		}
 	}
-	list_add(&(ime_new->list), &ime_list);
+	list_add(&(ime_new->list), bucket);
 	spin_unlock(&ime_lock);
 }
 
@@ -118,11 +144,12 @@ void inter_module_register(const char *im_name, struct module *owner, const void
  */
 void inter_module_unregister(const char *im_name)
 {
-	struct list_head *tmp;
+	struct list_head *tmp, *bucket;
 	struct inter_module_entry *ime;
 
 	spin_lock(&ime_lock);
-	list_for_each(tmp, &ime_list) {
+	bucket = ime_bucket(im_name);
+	list_for_each(tmp, bucket) {
 		ime = list_entry(tmp, struct inter_module_entry, list);
 		if (strcmp(ime->im_name, im_name) == 0) {
 			list_del(&(ime->list));
@@ -156,12 +183,13 @@ void inter_module_unregister(const char *im_name)
  */
 const void *inter_module_get(const char *im_name)
 {
-	struct list_head *tmp;
+	struct list_head *tmp, *bucket;
 	struct inter_module_entry *ime;
 	const void *result = NULL;
 
 	spin_lock(&ime_lock);
-	list_for_each(tmp, &ime_list) {
+	bucket = ime_bucket(im_name);
+	list_for_each(tmp, bucket) {
 		ime = list_entry(tmp, struct inter_module_entry, list);
 		if (strcmp(ime->im_name, im_name) == 0) {
 			if (try_inc_mod_count(ime->owner))
@@ -199,11 +227,12 @@ const void *inter_module_get_request(const char *im_name, const char *modname)
  */
 void inter_module_put(const char *im_name)
 {
-	struct list_head *tmp;
+	struct list_head *tmp, *bucket;
 	struct inter_module_entry *ime;
 
 	spin_lock(&ime_lock);
-	list_for_each(tmp, &ime_list) {
+	bucket = ime_bucket(im_name);
+	list_for_each(tmp, bucket) {
 		ime = list_entry(tmp, struct inter_module_entry, list);
 		if (strcmp(ime->im_name, im_name) == 0) {
 			if (ime->owner)
@@ -225,6 +254,130 @@ static void put_mod_name(char *buf);
 struct module *find_module(const char *name);
 void free_module(struct module *, int tag_freed);
 
+/*
+ * Hash of the exported symbols of the kernel and of every module, so
+ * that QM_RESOLVE does not have to walk each symbol table.  A module's
+ * entries are added when it is initialized and removed when it is
+ * freed; the kernel's are added on first use.  Everything here runs
+ * under the big kernel lock, like the rest of the module code.  If
+ * memory for a table cannot be found lookups fall back to a walk.
+ */
+#define KSYM_HASH_SIZE	1024	/* must be a power of two */
+
+struct ksym_entry {
+	struct ksym_entry *next;
+	const struct module_symbol *sym;
+	struct module *mod;
+};
+
+struct ksym_table {
+	struct ksym_table *next;
+	struct module *mod;
+	unsigned long size;
+	unsigned nsyms;
+	struct ksym_entry entry[0];
+};
+
+static struct ksym_entry *ksym_hash[KSYM_HASH_SIZE];
+static struct ksym_table *ksym_tables;
+static int ksym_kernel_hashed;
+static int ksym_hash_incomplete;
+
+static void ksym_hash_module(struct module *mod)
+{
+	struct ksym_table *t;
+	struct ksym_entry *e;
+	unsigned long size, h;
+	unsigned i;
+
+	if (!mod->nsyms)
+		return;
+	size = sizeof(*t) + mod->nsyms * sizeof(*e);
+	t = size > PAGE_SIZE ? vmalloc(size) : kmalloc(size, GFP_KERNEL);
+	if (!t) {
+		printk(KERN_WARNING "module: no memory to hash the symbols "
+		       "of `%s'\n", mod->name);
+		ksym_hash_incomplete = 1;
+		return;
+	}
+	t->mod = mod;
+	t->size = size;
+	t->nsyms = mod->nsyms;
+	for (i = 0, e = t->entry; i < mod->nsyms; i++, e++) {
+		e->sym = mod->syms + i;
+		e->mod = mod;
+		h = symbol_hash(e->sym->name) & (KSYM_HASH_SIZE - 1);
+		e->next = ksym_hash[h];
+		ksym_hash[h] = e;
+	}
+	t->next = ksym_tables;
+	ksym_tables = t;
+}
+
+static void ksym_unhash_module(struct module *mod)
+{
+	struct ksym_table *t, **tp;
+	struct ksym_entry *e, **ep;
+	unsigned long h;
+	unsigned i;
+
+	for (tp = &ksym_tables; (t = *tp) != NULL; tp = &t->next)
+		if (t->mod == mod)
+			break;
+	if (!t)
+		return;
+	*tp = t->next;
+
+	for (i = 0; i < t->nsyms; i++) {
+		h = symbol_hash(t->entry[i].sym->name) & (KSYM_HASH_SIZE - 1);
+		for (ep = ksym_hash + h; (e = *ep) != NULL; ep = &e->next)
+			if (e == t->entry + i) {
+				*ep = e->next;
+				break;
+			}
+	}
+	if (t->size > PAGE_SIZE)
+		vfree(t);
+	else
+		kfree(t);
+}
+
+/* Find an exported symbol, in @only if that is not NULL */
+static const struct module_symbol *
+ksym_lookup(const char *name, struct module *only, struct module **modp)
+{
+	struct ksym_entry *e;
+	struct module *mod;
+	unsigned i;
+
+	if (!ksym_kernel_hashed) {
+		ksym_kernel_hashed = 1;
+		ksym_hash_module(&kernel_module);
+	}
+
+	for (e = ksym_hash[symbol_hash(name) & (KSYM_HASH_SIZE - 1)]; e; e = e->next) {
+		if ((only && e->mod != only) || !MOD_CAN_QUERY(e->mod))
+			continue;
+		if (!strcmp(e->sym->name, name)) {
+			*modp = e->mod;
+			return e->sym;
+		}
+	}
+	if (!ksym_hash_incomplete)
+		return NULL;
+
+	for (mod = module_list; mod; mod = mod->next) {
+		if ((only && mod != only) || !MOD_CAN_QUERY(mod))
+			continue;
+		for (i = 0; i < mod->nsyms; i++)
+			if (!strcmp(mod->syms[i].name, name)) {
+				*modp = mod;
+				return mod->syms + i;
+			}
+	}
+	return NULL;
+}
+
 
 /*
  * Called at boot time
@@ -538,6 +691,10 @@ sys_init_module(const char *name_user, struct module *mod_user)
 	put_mod_name(n_name);
 	put_mod_name(name);
 
+	/* Its symbols can be resolved against from here on.  */
+	ksym_unhash_module(mod);
+	ksym_hash_module(mod);
+
 	/* Initialize the module.  */
 	mod->flags |= MOD_INITIALIZING;
 	atomic_set(&mod->uc.usecount,1);
@@ -844,6 +1001,60 @@ calc_space_needed:
 		return -ENOSPC;
 }
 
+static int
+qm_resolve(struct module *only, char *buf, size_t bufsize, size_t *ret)
+{
+	struct module_resolve *r = (struct module_resolve *)(buf + sizeof(long));
+	const struct module_symbol *sym;
+	struct module *mod;
+	unsigned long i, n, name, found = 0;
+	char *kname;
+	long len;
+	int error = 0;
+
+	if (bufsize < sizeof(long) || get_user(n, (unsigned long *)buf))
+		return -EFAULT;
+	if (n > (bufsize - sizeof(long)) / sizeof(*r))
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, r, n * sizeof(*r)))
+		return -EFAULT;
+	if (!(kname = (char *)__get_free_page(GFP_KERNEL)))
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++, r++) {
+		error = -EFAULT;
+		if (__get_user(name, &r->name))
+			goto out;
+		error = -EINVAL;
+		if (name >= bufsize)
+			goto out;
+		len = strncpy_from_user(kname, buf + name, PAGE_SIZE);
+		if (len <= 0 || len >= PAGE_SIZE) {
+			error = len < 0 ? len : -EINVAL;
+			goto out;
+		}
+
+		sym = ksym_lookup(kname, only, &mod);
+		if (sym) {
+			found++;
+			error = __put_user(sym->value, &r->value) ||
+				__put_user(mod == &kernel_module ? 0 :
+					   (unsigned long)mod, &r->module);
+		} else
+			error = __put_user(0, &r->value) ||
+				__put_user(0, &r->module);
+		if (error) {
+			error = -EFAULT;
+			goto out;
+		}
+	}
+
+	error = put_user(found, ret) ? -EFAULT : 0;
+out:
+	free_page((unsigned long)kname);
+	return error;
+}
+
 static int
 qm_info(struct module *mod, char *buf, size_t bufsize, size_t *ret)
 {
@@ -919,6 +1130,10 @@ sys_query_module(const char *name_user, int which, char *buf, size_t bufsize,
 	case QM_INFO:
 		err = qm_info(mod, buf, bufsize, ret);
 		break;
+	case QM_RESOLVE:
+		err = qm_resolve(mod == &kernel_module ? NULL : mod,
+				 buf, bufsize, ret);
+		break;
 	default:
 		err = -EINVAL;
 		break;
@@ -1052,6 +1267,7 @@ free_module(struct module *mod, int tag_freed)
 
 	/* And free the memory.  */
 
+	ksym_unhash_module(mod);
 	module_unmap(mod);
 }
 
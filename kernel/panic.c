@@ -51,6 +51,7 @@ NORET_TYPE void panic(const char * fmt, ...)
         unsigned long caller = (unsigned long) __builtin_return_address(0);
 #endif
 
+	oops_in_progress = 1;
 	va_start(args, fmt);
 	vsprintf(buf, fmt, args);
 	va_end(args);
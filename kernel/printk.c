@@ -19,13 +19,24 @@
 #include <linux/smp_lock.h>
 #include <linux/console.h>
 #include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/bootmem.h>
 
 #include <asm/uaccess.h>
 
-#define LOG_BUF_LEN	(16384)
-#define LOG_BUF_MASK	(LOG_BUF_LEN-1)
+/*
+ * printk() does not write to the consoles itself: a message is formatted
+ * into a buffer of the CPU it runs on, with interrupts off but without
+ * taking any lock, and a tasklet moves it into log_buf from where the
+ * kconsoled thread writes it out.  Messages from different CPUs are put
+ * back in order by a stamp taken when they are complete.  Until the
+ * thread runs, and while an oops or panic is being printed, printk()
+ * flushes everything out synchronously as it always did.
+ */
+#define LOG_BUF_LEN	(16384)		/* default, see log_buf_len= */
 
-static char buf[1024];
+#define PRINTK_MSG_LEN	1024		/* longest message */
+#define PRINTK_CPU_BUF	4096		/* per CPU, a power of 2 */
 
 /* printk's without a loglevel use this.. */
 #define DEFAULT_MESSAGE_LOGLEVEL 4 /* KERN_WARNING */
@@ -43,15 +54,76 @@ int default_message_loglevel = DEFAULT_MESSAGE_LOGLEVEL;
 int minimum_console_loglevel = MINIMUM_CONSOLE_LOGLEVEL;
 int default_console_loglevel = DEFAULT_CONSOLE_LOGLEVEL;
 
+int oops_in_progress;
+
+/* console_lock serializes the console drivers, logbuf_lock log_buf */
 spinlock_t console_lock = SPIN_LOCK_UNLOCKED;
+static spinlock_t logbuf_lock = SPIN_LOCK_UNLOCKED;
 
 struct console *console_drivers;
-static char log_buf[LOG_BUF_LEN];
-static unsigned long log_start;
+static char __log_buf[LOG_BUF_LEN];
+static char *log_buf = __log_buf;
+static unsigned long log_buf_len = LOG_BUF_LEN;
+static unsigned long log_start;		/* next char for syslog() */
+static unsigned long con_start;		/* next char for the consoles */
+static unsigned long log_end;		/* next char to be logged */
 static unsigned long logged_chars;
 struct console_cmdline console_cmdline[MAX_CMDLINECONSOLES];
 static int preferred_console = -1;
 
+#define LOG_BUF(idx)	(log_buf[(idx) & (log_buf_len-1)])
+
+struct printk_hdr {
+	unsigned int	stamp;
+	unsigned int	len;
+};
+
+struct printk_cpu {
+	unsigned int	head;		/* moved by printk() on this CPU only */
+	unsigned int	tail;		/* moved with logbuf_lock held only */
+	int		busy;
+	unsigned long	dropped;	/* messages that did not fit */
+	unsigned long	reported;
+	char		text[PRINTK_MSG_LEN];
+	char		ring[PRINTK_CPU_BUF];
+} ____cacheline_aligned;
+
+static struct printk_cpu printk_cpu[NR_CPUS];
+static atomic_t printk_stamp = ATOMIC_INIT(0);
+
+static struct task_struct *console_task;
+static DECLARE_WAIT_QUEUE_HEAD(console_wait);
+
+static void printk_tasklet_fn(unsigned long);
+static DECLARE_TASKLET(printk_tasklet, printk_tasklet_fn, 0);
+
+/*
+ *	Make the log buffer larger than the built in one.
+ *	The bootmem allocator is up when the options are parsed.
+ */
+static int __init log_buf_len_setup(char *str)
+{
+	unsigned long size = memparse(str, &str), idx, flags;
+	char *buf;
+
+	while (size & (size - 1))
+		size += size & -size;
+	if (size <= log_buf_len)
+		return 1;
+
+	buf = alloc_bootmem(size);
+	spin_lock_irqsave(&logbuf_lock, flags);
+	idx = log_end > log_buf_len ? log_end - log_buf_len : 0;
+	for (; idx != log_end; idx++)
+		buf[idx & (size-1)] = LOG_BUF(idx);
+	log_buf = buf;
+	log_buf_len = size;
+	spin_unlock_irqrestore(&logbuf_lock, flags);
+	return 1;
+}
+
+__setup("log_buf_len=", log_buf_len_setup);
+
 /*
  *	Setup a list of consoles. Called from init/main.c
  */
@@ -147,18 +219,18 @@ int do_syslog(int type, char * buf, int len)
 		if (error)
 			goto out;
 		i = 0;
-		spin_lock_irq(&console_lock);
+		spin_lock_irq(&logbuf_lock);
 		while (log_size && i < len) {
-			c = log_buf[log_start & LOG_BUF_MASK];
+			c = LOG_BUF(log_start);
 			log_start++;
 			log_size--;
-			spin_unlock_irq(&console_lock);
+			spin_unlock_irq(&logbuf_lock);
 			__put_user(c,buf);
 			buf++;
 			i++;
-			spin_lock_irq(&console_lock);
+			spin_lock_irq(&logbuf_lock);
 		}
-		spin_unlock_irq(&console_lock);
+		spin_unlock_irq(&logbuf_lock);
 		error = i;
 		break;
 	case 4:		/* Read/clear last kernel messages */
@@ -175,9 +247,9 @@ int do_syslog(int type, char * buf, int len)
 		if (error)
 			goto out;
 		count = len;
-		if (count > LOG_BUF_LEN)
-			count = LOG_BUF_LEN;
-		spin_lock_irq(&console_lock);
+		if (count > log_buf_len)
+			count = log_buf_len;
+		spin_lock_irq(&logbuf_lock);
 		if (count > logged_chars)
 			count = logged_chars;
 		if (do_clear)
@@ -191,14 +263,14 @@ int do_syslog(int type, char * buf, int len)
 		 */
 		for(i=0;i < count;i++) {
 			j = limit-1-i;
-			if (j+LOG_BUF_LEN < log_start+log_size)
+			if (j+log_buf_len < log_start+log_size)
 				break;
-			c = log_buf[ j  & LOG_BUF_MASK ];
-			spin_unlock_irq(&console_lock);
+			c = LOG_BUF(j);
+			spin_unlock_irq(&logbuf_lock);
 			__put_user(c,&buf[count-1-i]);
-			spin_lock_irq(&console_lock);
+			spin_lock_irq(&logbuf_lock);
 		}
-		spin_unlock_irq(&console_lock);
+		spin_unlock_irq(&logbuf_lock);
 		error = i;
 		if(i != count) {
 			int offset = count-error;
@@ -211,9 +283,9 @@ int do_syslog(int type, char * buf, int len)
 
 		break;
 	case 5:		/* Clear ring buffer */
-		spin_lock_irq(&console_lock);
+		spin_lock_irq(&logbuf_lock);
 		logged_chars = 0;
-		spin_unlock_irq(&console_lock);
+		spin_unlock_irq(&logbuf_lock);
 		break;
 	case 6:		/* Disable logging to console */
 		spin_lock_irq(&console_lock);
@@ -251,67 +323,283 @@ asmlinkage long sys_syslog(int type, char * buf, int len)
 	return do_syslog(type, buf, len);
 }
 
-asmlinkage int printk(const char *fmt, ...)
+static void emit_log_char(char c)
 {
-	va_list args;
-	int i;
-	char *msg, *p, *buf_end;
-	int line_feed;
-	static signed char msg_level = -1;
-	long flags;
+	LOG_BUF(log_end) = c;
+	log_end++;
+	if (log_size < log_buf_len)
+		log_size++;
+	else
+		log_start++;
+	logged_chars++;
+}
 
-	spin_lock_irqsave(&console_lock, flags);
-	va_start(args, fmt);
-	i = vsprintf(buf + 3, fmt, args); /* hopefully i < sizeof(buf)-4 */
-	buf_end = buf + 3 + i;
-	va_end(args);
-	for (p = buf + 3; p < buf_end; p++) {
-		msg = p;
-		if (msg_level < 0) {
-			if (
-				p[0] != '<' ||
-				p[1] < '0' || 
-				p[1] > '7' ||
-				p[2] != '>'
-			) {
-				p -= 3;
-				p[0] = '<';
-				p[1] = default_message_loglevel + '0';
-				p[2] = '>';
-			} else
-				msg += 3;
-			msg_level = p[1] - '0';
-		}
-		line_feed = 0;
-		for (; p < buf_end; p++) {
-			log_buf[(log_start+log_size) & LOG_BUF_MASK] = *p;
-			if (log_size < LOG_BUF_LEN)
-				log_size++;
-			else
-				log_start++;
-
-			logged_chars++;
-			if (*p == '\n') {
-				line_feed = 1;
-				break;
+/*
+ * Append a message to log_buf, starting each line with its loglevel.
+ * Called with logbuf_lock held.
+ */
+static void log_text(const char *p, int len)
+{
+	static int line_start = 1;
+	const char *end = p + len;
+
+	for (; p < end; p++) {
+		if (line_start) {
+			line_start = 0;
+			if (end - p < 3 || p[0] != '<' ||
+			    p[1] < '0' || p[1] > '7' || p[2] != '>') {
+				emit_log_char('<');
+				emit_log_char(default_message_loglevel + '0');
+				emit_log_char('>');
 			}
 		}
-		if (msg_level < console_loglevel && console_drivers) {
-			struct console *c = console_drivers;
-			while(c) {
-				if ((c->flags & CON_ENABLED) && c->write)
-					c->write(c, msg, p - msg + line_feed);
-				c = c->next;
+		emit_log_char(*p);
+		if (*p == '\n')
+			line_start = 1;
+	}
+}
+
+static void stage_copy(struct printk_cpu *pc, unsigned int pos, char *to,
+		       const char *from, int len)
+{
+	while (len--) {
+		if (to)
+			*to++ = pc->ring[pos++ & (PRINTK_CPU_BUF-1)];
+		else
+			pc->ring[pos++ & (PRINTK_CPU_BUF-1)] = *from++;
+	}
+}
+
+/*
+ * Move the messages waiting in the per-CPU buffers to log_buf, oldest
+ * stamp first.  Called with logbuf_lock held.
+ */
+static void printk_drain(void)
+{
+	static char text[PRINTK_MSG_LEN];
+	struct printk_cpu *pc, *oldest;
+	struct printk_hdr hdr, first;
+	int cpu, len;
+
+	for (;;) {
+		oldest = NULL;
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			pc = printk_cpu + cpu;
+			if (pc->tail == pc->head)
+				continue;
+			rmb();
+			stage_copy(pc, pc->tail, (char *) &hdr, NULL, sizeof(hdr));
+			if (!oldest || (int) (hdr.stamp - first.stamp) < 0) {
+				oldest = pc;
+				first = hdr;
 			}
 		}
-		if (line_feed)
-			msg_level = -1;
+		if (!oldest)
+			break;
+
+		pc = oldest;
+		stage_copy(pc, pc->tail + sizeof(hdr), text, NULL, first.len);
+		mb();
+		pc->tail += sizeof(hdr) + first.len;
+		log_text(text, first.len);
 	}
-	spin_unlock_irqrestore(&console_lock, flags);
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		pc = printk_cpu + cpu;
+		if (pc->dropped != pc->reported) {
+			len = sprintf(text, KERN_WARNING "printk: %lu messages dropped\n",
+				      pc->dropped - pc->reported);
+			pc->reported += pc->dropped - pc->reported;
+			log_text(text, len);
+		}
+	}
+}
+
+static void write_console(unsigned long start, unsigned long end)
+{
+	struct console *c;
+	unsigned long n;
+	char *p;
+
+	while (start != end) {
+		p = &LOG_BUF(start);
+		n = end - start;
+		if (n > (unsigned long) (log_buf + log_buf_len - p))
+			n = log_buf + log_buf_len - p;
+		for (c = console_drivers; c; c = c->next)
+			if ((c->flags & CON_ENABLED) && c->write)
+				c->write(c, p, n);
+		start += n;
+	}
+}
+
+/*
+ * Write the next line, or as much of it as has been logged, to the
+ * consoles.  Called with console_lock held; returns 0 when there was
+ * nothing left to write.
+ */
+static int emit_console_line(void)
+{
+	static int con_level = -1;
+	unsigned long start, end;
+	int newline = 0;
+
+	spin_lock(&logbuf_lock);
+	if (log_end - con_start > log_buf_len) {
+		/* it was overwritten before we got to it */
+		con_start = log_end - log_buf_len;
+		con_level = default_message_loglevel;
+	}
+	if (con_start == log_end) {
+		spin_unlock(&logbuf_lock);
+		return 0;
+	}
+	if (con_level < 0) {
+		con_level = LOG_BUF(con_start + 1) - '0';
+		con_start += 3;
+	}
+	start = end = con_start;
+	while (end != log_end)
+		if (LOG_BUF(end++) == '\n') {
+			newline = 1;
+			break;
+		}
+	con_start = end;
+	spin_unlock(&logbuf_lock);
+
+	if (con_level < console_loglevel)
+		write_console(start, end);
+	if (newline)
+		con_level = -1;
+	return 1;
+}
+
+#define console_pending()	(con_start != log_end)
+
+/*
+ * Write everything out now, unless somebody else is at it: they will
+ * see what we logged before they let go of console_lock.
+ */
+static void printk_flush(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&logbuf_lock, flags);
+	printk_drain();
+	spin_unlock_irqrestore(&logbuf_lock, flags);
+
+	do {
+		local_irq_save(flags);
+		if (!spin_trylock(&console_lock)) {
+			local_irq_restore(flags);
+			break;
+		}
+		while (emit_console_line())
+			;
+		spin_unlock(&console_lock);
+		local_irq_restore(flags);
+	} while (console_pending());
+	wake_up_interruptible(&log_wait);
+}
+
+static void printk_tasklet_fn(unsigned long unused)
+{
+	spin_lock_irq(&logbuf_lock);
+	printk_drain();
+	spin_unlock_irq(&logbuf_lock);
+
 	wake_up_interruptible(&log_wait);
-	return i;
+	if (console_pending())
+		wake_up_interruptible(&console_wait);
+}
+
+asmlinkage int printk(const char *fmt, ...)
+{
+	va_list args;
+	struct printk_cpu *pc;
+	struct printk_hdr hdr;
+	unsigned long flags;
+	int len;
+
+	local_irq_save(flags);
+	pc = printk_cpu + smp_processor_id();
+	if (pc->busy && !oops_in_progress) {
+		/* an NMI came in the middle of a printk() */
+		pc->dropped++;
+		local_irq_restore(flags);
+		return 0;
+	}
+	pc->busy = 1;
+
+	va_start(args, fmt);
+	len = vsprintf(pc->text, fmt, args); /* hopefully len < PRINTK_MSG_LEN */
+	va_end(args);
+	if (len > PRINTK_MSG_LEN)
+		len = PRINTK_MSG_LEN;
+
+	if (PRINTK_CPU_BUF - (pc->head - pc->tail) < sizeof(hdr) + len)
+		pc->dropped++;
+	else {
+		stage_copy(pc, pc->head + sizeof(hdr), NULL, pc->text, len);
+		atomic_inc(&printk_stamp);
+		hdr.stamp = atomic_read(&printk_stamp);
+		hdr.len = len;
+		stage_copy(pc, pc->head, NULL, (char *) &hdr, sizeof(hdr));
+		wmb();
+		pc->head += sizeof(hdr) + len;
+	}
+
+	pc->busy = 0;
+	local_irq_restore(flags);
+
+	if (!console_task || oops_in_progress)
+		printk_flush();
+	else
+		tasklet_schedule(&printk_tasklet);
+	return len;
+}
+
+/*
+ * kconsoled writes the log to the consoles a line at a time, so that
+ * interrupts are only held off for the line being written and the
+ * printk() callers never wait for a slow serial console.
+ */
+static int console_thread(void *unused)
+{
+	struct task_struct *tsk = current;
+	unsigned long flags;
+	int more;
+
+	daemonize();
+	strcpy(tsk->comm, "kconsoled");
+	sigfillset(&tsk->blocked);
+	console_task = tsk;
+
+	/* whatever was staged while console_lock was busy */
+	spin_lock_irqsave(&logbuf_lock, flags);
+	printk_drain();
+	spin_unlock_irqrestore(&logbuf_lock, flags);
+
+	for (;;) {
+		wait_event_interruptible(console_wait, console_pending());
+		do {
+			spin_lock_irqsave(&console_lock, flags);
+			more = emit_console_line();
+			spin_unlock_irqrestore(&console_lock, flags);
+			if (tsk->need_resched)
+				schedule();
+		} while (more);
+	}
 }
 
+static int __init console_thread_init(void)
+{
+	kernel_thread(console_thread, NULL, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
+	return 0;
+}
+
+__initcall(console_thread_init);
+
 void console_print(const char *s)
 {
 	struct console *c;
@@ -415,11 +703,12 @@ void register_console(struct console * console)
 	/*
 	 *	Print out buffered log messages.
 	 */
-	p = log_start & LOG_BUF_MASK;
+	spin_lock(&logbuf_lock);
+	p = log_start & (log_buf_len-1);
 
 	for (i=0,j=0; i < log_size; i++) {
 		buf[j++] = log_buf[p];
-		p = (p+1) & LOG_BUF_MASK;
+		p = (p+1) & (log_buf_len-1);
 		if (buf[j-1] != '\n' && i < log_size - 1 && j < sizeof(buf)-1)
 			continue;
 		buf[j] = 0;
@@ -444,6 +733,7 @@ void register_console(struct console * console)
 			msg_level = -1;
 		j = 0;
 	}
+	spin_unlock(&logbuf_lock);
 done:
 	spin_unlock_irqrestore(&console_lock, flags);
 }
@@ -11,6 +11,7 @@
 #include <linux/errno.h>
 #include <linux/mm.h>
 #include <linux/highmem.h>
+#include <linux/bigpages.h>
 #include <linux/smp_lock.h>
 
 #include <asm/pgtable.h>
@@ -36,6 +37,12 @@ repeat:
 	pgmiddle = pmd_offset(pgdir, addr);
 	if (pmd_none(*pgmiddle))
 		goto fault_in_page;
+	if (pmd_big(*pgmiddle)) {
+		if (write && !(vma->vm_flags & VM_WRITE))
+			return 0;
+		page = bigpage_follow(*pgmiddle, addr);
+		goto got_page;
+	}
 	if (pmd_bad(*pgmiddle))
 		goto bad_pmd;
 	pgtable = pte_offset(pgmiddle, addr);
@@ -50,6 +57,7 @@ repeat:
 		if ((!VALID_PAGE(page)) || PageReserved(page))
 			return 0;
 	}
+got_page:
 	flush_cache_page(vma, addr);
 
 	if (write) {
@@ -28,6 +28,7 @@
 
 #include <asm/uaccess.h>
 #include <asm/mmu_context.h>
+#include <asm/div64.h>
 
 extern void timer_bh(void);
 extern void tqueue_bh(void);
@@ -66,50 +67,122 @@ extern void mem_use(void);
 
 #define NICE_TO_TICKS(nice)	(TICK_SCALE(20-(nice))+1)
 
+/*
+ * Priority levels. Realtime tasks use 0..MAX_RT_PRIO-1 (lower
+ * is better, rt_priority 99 maps to 0), SCHED_OTHER tasks are
+ * spread over the 40 levels above them according to their nice
+ * value, minus a small bonus for unused timeslice that plays the
+ * role the 'counter' term used to play in goodness().
+ */
+#define MAX_RT_PRIO		100
+#define MAX_PRIO		(MAX_RT_PRIO + 40)
+#define NICE_TO_PRIO(nice)	(MAX_RT_PRIO + (nice) + 20)
+#define MAX_COUNTER_BONUS	5
+
+#define BITMAP_SIZE	((MAX_PRIO + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+#define rt_task(p)	((p)->policy & (SCHED_FIFO | SCHED_RR))
 
 /*
- *	Init task must be ok at boot for the ix86 as we will check its signals
- *	via the SMP irq return path.
+ * How often (in ticks) an idle resp. a busy CPU looks at the
+ * other runqueues to see whether it should pull work over.
  */
- 
-struct task_struct * init_tasks[NR_CPUS] = {&init_task, };
+#define IDLE_REBALANCE_TICK	(HZ/1000 ?: 1)
+#define BUSY_REBALANCE_TICK	(HZ/5 ?: 1)
 
 /*
- * The tasklist_lock protects the linked list of processes.
- *
- * The runqueue_lock locks the parts that actually access
- * and change the run-queues, and have to be interrupt-safe.
- *
- * If both locks are to be concurrently held, the runqueue_lock
- * nests inside the tasklist_lock.
+ * A priority array: one list per priority level, plus a bitmap
+ * of the non-empty lists so that the best task can be found in
+ * constant time.
  */
-spinlock_t runqueue_lock __cacheline_aligned = SPIN_LOCK_UNLOCKED;  /* inner */
-rwlock_t tasklist_lock __cacheline_aligned = RW_LOCK_UNLOCKED;	/* outer */
+struct prio_array {
+	int nr_active;
+	unsigned long bitmap[BITMAP_SIZE];
+	struct list_head queue[MAX_PRIO];
+};
 
-static LIST_HEAD(runqueue_head);
+/*
+ * Per-CPU scheduler statistics, exported through /proc/schedstat.
+ * Wakeup latency is the time (in get_cycles() units) between a task
+ * being put on a runqueue by a wakeup and it actually getting the
+ * CPU; slot n counts the events with latency in [2^n, 2^(n+1)).
+ * The runqueue length is sampled on every schedule(), slot n counts
+ * lengths in [2^(n-1), 2^n). These live in the runqueue, so apart
+ * from reading and resetting nobody touches another CPU's counters.
+ * max_lat is the worst wakeup latency seen and max_lat_ip the place
+ * whose call to schedule() finally ended it, which is usually the
+ * code that had been hogging the CPU.
+ */
+#define SCHEDSTAT_LAT_SLOTS	32
+#define SCHEDSTAT_LEN_SLOTS	10
+
+struct sched_stat {
+	unsigned long wakeups;
+	unsigned long switches;
+	unsigned long wakeup_lat[SCHEDSTAT_LAT_SLOTS];
+	unsigned long rq_len[SCHEDSTAT_LEN_SLOTS];
+	unsigned long max_lat;
+	void *max_lat_ip;
+};
 
 /*
- * We align per-CPU scheduling data on cacheline boundaries,
- * to prevent cacheline ping-pong.
+ * The per-CPU runqueue. Runnable tasks that still have timeslice
+ * left sit in the 'active' array, those that used it up wait in
+ * 'expired' until the active array runs dry, at which point the
+ * two are simply swapped. This replaces the old recalculation
+ * loop over every task in the system.
+ *
+ * Each runqueue is protected by its own lock. If two runqueue
+ * locks have to be held at once they are taken in address order,
+ * and both nest inside the tasklist_lock.
  */
-static union {
-	struct schedule_data {
-		struct task_struct * curr;
-		cycles_t last_schedule;
-	} schedule_data;
-	char __pad [SMP_CACHE_BYTES];
-} aligned_data [NR_CPUS] __cacheline_aligned = { {{&init_task,0}}};
+struct runqueue {
+	spinlock_t lock;
+	unsigned long nr_running;
+	struct task_struct *curr, *idle;
+	cycles_t last_schedule;
+	unsigned long quiescent;	/* times through schedule() */
+	struct prio_array *active, *expired, arrays[2];
+	struct sched_stat stat;
+} ____cacheline_aligned;
+
+static struct runqueue runqueues[NR_CPUS] __cacheline_aligned;
+
+#define cpu_rq(cpu)		(runqueues + (cpu))
+#define this_rq()		cpu_rq(smp_processor_id())
+#define task_rq(p)		cpu_rq((p)->processor)
+#define cpu_curr(cpu)		(cpu_rq(cpu)->curr)
+#define last_schedule(cpu)	(cpu_rq(cpu)->last_schedule)
 
-#define cpu_curr(cpu) aligned_data[(cpu)].schedule_data.curr
-#define last_schedule(cpu) aligned_data[(cpu)].schedule_data.last_schedule
+/*
+ *	Init task must be ok at boot for the ix86 as we will check its signals
+ *	via the SMP irq return path.
+ */
+
+struct task_struct * init_tasks[NR_CPUS] = {&init_task, };
+
+/*
+ * The tasklist_lock protects the linked list of processes.
+ * The run-queues have per-CPU locks, see struct runqueue.
+ */
+rwlock_t tasklist_lock __cacheline_aligned = RW_LOCK_UNLOCKED;	/* outer */
 
 struct kernel_stat kstat;
 
 #ifdef CONFIG_SMP
 
-#define idle_task(cpu) (init_tasks[cpu_number_map(cpu)])
-#define can_schedule(p,cpu) ((!(p)->has_cpu) && \
-				((p)->cpus_allowed & (1 << cpu)))
+#define idle_task(cpu) (cpu_rq(cpu)->idle)
+#define can_schedule(p,cpu) ((p)->cpus_allowed & (1UL << (cpu)))
+
+/*
+ * A task is considered cache-hot on the CPU it last ran on until
+ * cacheflush_time cycles after it got off it. The architecture
+ * code estimates this at boot from the L2 size, it is roughly the
+ * time it takes a memory-bound task to replace the whole cache
+ * (see smp_tune_scheduling() on x86). Without a TSC it is zero,
+ * which makes every task cold.
+ */
+#define task_hot(p,now) ((cycles_t) ((now) - (p)->last_run) < cacheflush_time)
 
 #else
 
@@ -121,202 +194,241 @@ struct kernel_stat kstat;
 void scheduling_functions_start_here(void) { }
 
 /*
- * This is the function that decides how desirable a process is..
- * You can weigh different processes against each other depending
- * on what CPU they've run on lately etc to try to handle cache
- * and TLB miss penalties.
- *
- * Return values:
- *	 -1000: never select this
- *	     0: out of time, recalculate counters (but it might still be
- *		selected)
- *	   +ve: "goodness" value (the larger, the better)
- *	 +1000: realtime process, select this.
+ * Lock the runqueue a given task is queued on (or would be queued
+ * on if it were runnable). The task may change CPUs while we spin,
+ * so re-check after getting the lock.
  */
+static inline struct runqueue *task_rq_lock(struct task_struct *p, unsigned long *flags)
+{
+	struct runqueue *rq;
+
+repeat:
+	local_irq_save(*flags);
+	rq = task_rq(p);
+	spin_lock(&rq->lock);
+	if (rq != task_rq(p)) {
+		spin_unlock_irqrestore(&rq->lock, *flags);
+		goto repeat;
+	}
+	return rq;
+}
 
-static inline int goodness(struct task_struct * p, int this_cpu, struct mm_struct *this_mm)
+static inline void task_rq_unlock(struct runqueue *rq, unsigned long *flags)
 {
-	int weight;
+	spin_unlock_irqrestore(&rq->lock, *flags);
+}
 
-	/*
-	 * select the current process after every other
-	 * runnable process, but before the idle thread.
-	 * Also, dont trigger a counter recalculation.
-	 */
-	weight = -1;
-	if (p->policy & SCHED_YIELD)
-		goto out;
+static inline int sched_find_first_bit(unsigned long *b)
+{
+	int i;
 
-	/*
-	 * Non-RT process - normal case first.
-	 */
-	if (p->policy == SCHED_OTHER) {
-		/*
-		 * Give the process a first-approximation goodness value
-		 * according to the number of clock-ticks it has left.
-		 *
-		 * Don't do any other calculations if the time slice is
-		 * over..
-		 */
-		weight = p->counter;
-		if (!weight)
-			goto out;
-			
-#ifdef CONFIG_SMP
-		/* Give a largish advantage to the same processor...   */
-		/* (this is equivalent to penalizing other processors) */
-		if (p->processor == this_cpu)
-			weight += PROC_CHANGE_PENALTY;
-#endif
+	for (i = 0; i < BITMAP_SIZE; i++)
+		if (b[i])
+			return i * BITS_PER_LONG + ffz(~b[i]);
+	return MAX_PRIO;
+}
 
-		/* .. and a slight advantage to the current MM */
-		if (p->mm == this_mm || !p->mm)
-			weight += 1;
-		weight += 20 - p->nice;
-		goto out;
+/*
+ * Index of the highest set bit plus one, ie. 0 for 0, 1 for 1,
+ * 2 for 2-3, 3 for 4-7 and so on, clamped to 'slots - 1'.
+ */
+static inline int schedstat_slot(unsigned long long val, int slots)
+{
+	int slot = 0;
+
+	while (val && slot < slots - 1) {
+		val >>= 1;
+		slot++;
 	}
+	return slot;
+}
 
-	/*
-	 * Realtime process, select the first one on the
-	 * runqueue (taking priorities within processes
-	 * into account).
-	 */
-	weight = 1000 + p->rt_priority;
-out:
-	return weight;
+static inline void dequeue_task(struct task_struct *p, struct prio_array *array)
+{
+	array->nr_active--;
+	list_del(&p->run_list);
+	if (list_empty(array->queue + p->prio))
+		clear_bit(p->prio, array->bitmap);
+}
+
+static inline void enqueue_task(struct task_struct *p, struct prio_array *array)
+{
+	list_add_tail(&p->run_list, array->queue + p->prio);
+	set_bit(p->prio, array->bitmap);
+	array->nr_active++;
+	p->array = array;
 }
 
 /*
- * the 'goodness value' of replacing a process on a given CPU.
- * positive value means 'replace', zero or negative means 'dont'.
+ * This is the function that decides how desirable a process is,
+ * expressed as the priority level it gets queued at. It takes the
+ * place of the old goodness() weight: realtime tasks go strictly
+ * by rt_priority, everyone else by nice level, with tasks that
+ * still have most of their timeslice left (typically ones that
+ * have been sleeping) getting up to MAX_COUNTER_BONUS levels of
+ * advantage.
  */
-static inline int preemption_goodness(struct task_struct * prev, struct task_struct * p, int cpu)
+static inline int effective_prio(struct task_struct *p)
 {
-	return goodness(p, cpu, prev->active_mm) - goodness(prev, cpu, prev->active_mm);
+	int prio, bonus;
+
+	if (rt_task(p))
+		return MAX_RT_PRIO - 1 - p->rt_priority;
+
+	prio = NICE_TO_PRIO(p->nice);
+	if (p->counter > 0) {
+		bonus = (p->counter * MAX_COUNTER_BONUS) /
+				(2 * NICE_TO_TICKS(p->nice));
+		if (bonus > MAX_COUNTER_BONUS)
+			bonus = MAX_COUNTER_BONUS;
+		prio -= bonus;
+	}
+	if (prio < MAX_RT_PRIO)
+		prio = MAX_RT_PRIO;
+	if (prio > MAX_PRIO - 1)
+		prio = MAX_PRIO - 1;
+	return prio;
 }
 
 /*
- * This is ugly, but reschedule_idle() is very timing-critical.
- * We are called with the runqueue spinlock held and we must
- * not claim the tasklist_lock.
+ * Put a task on a runqueue. A task that has been asleep for longer
+ * than one timeslice gets the same credit the old global counter
+ * recalculation used to hand out to sleepers: half of what it had
+ * left plus a fresh slice.
  */
-static FASTCALL(void reschedule_idle(struct task_struct * p));
+static inline void activate_task(struct task_struct *p, struct runqueue *rq)
+{
+	unsigned long ticks = NICE_TO_TICKS(p->nice);
 
-static void reschedule_idle(struct task_struct * p)
+	if (p->policy == SCHED_OTHER && jiffies - p->sleep_time > ticks)
+		p->counter = (p->counter >> 1) + ticks;
+	p->prio = effective_prio(p);
+	enqueue_task(p, rq->active);
+	rq->nr_running++;
+}
+
+static inline void deactivate_task(struct task_struct *p, struct runqueue *rq)
+{
+	rq->nr_running--;
+	p->sleep_time = jiffies;
+	dequeue_task(p, p->array);
+	p->array = NULL;
+	p->run_list.next = NULL;
+}
+
+/*
+ * Tell a CPU that its current task should be rescheduled. If
+ * need_resched == -1 then we can skip sending the IPI altogether,
+ * tsk->need_resched is actively watched by the idle thread.
+ */
+static inline void resched_task(struct task_struct *p)
 {
 #ifdef CONFIG_SMP
-	int this_cpu = smp_processor_id();
-	struct task_struct *tsk, *target_tsk;
-	int cpu, best_cpu, i, max_prio;
-	cycles_t oldest_idle;
+	int need_resched;
 
-	/*
-	 * shortcut if the woken up task's last CPU is
-	 * idle now.
-	 */
-	best_cpu = p->processor;
-	if (can_schedule(p, best_cpu)) {
-		tsk = idle_task(best_cpu);
-		if (cpu_curr(best_cpu) == tsk) {
-			int need_resched;
-send_now_idle:
-			/*
-			 * If need_resched == -1 then we can skip sending
-			 * the IPI altogether, tsk->need_resched is
-			 * actively watched by the idle thread.
-			 */
-			need_resched = tsk->need_resched;
-			tsk->need_resched = 1;
-			if ((best_cpu != this_cpu) && !need_resched)
-				smp_send_reschedule(best_cpu);
-			return;
-		}
-	}
+	need_resched = p->need_resched;
+	p->need_resched = 1;
+	if (!need_resched && (p->processor != smp_processor_id()))
+		smp_send_reschedule(p->processor);
+#else
+	p->need_resched = 1;
+#endif
+}
 
-	/*
-	 * We know that the preferred CPU has a cache-affine current
-	 * process, lets try to find a new idle CPU for the woken-up
-	 * process. Select the least recently active idle CPU. (that
-	 * one will have the least active cache context.) Also find
-	 * the executing process which has the least priority.
-	 */
-	oldest_idle = (cycles_t) -1;
-	target_tsk = NULL;
-	max_prio = 1;
+/*
+ * Remove a task from whatever runqueue it is on. Only the SMP
+ * boot code uses this, to take a freshly forked idle thread off
+ * the boot CPU's queue - at which point ->processor may already
+ * point to the new CPU, hence the search.
+ */
+void del_from_runqueue(struct task_struct * p)
+{
+	unsigned long flags;
+	int i;
 
-	for (i = 0; i < smp_num_cpus; i++) {
-		cpu = cpu_logical_map(i);
-		if (!can_schedule(p, cpu))
-			continue;
-		tsk = cpu_curr(cpu);
-		/*
-		 * We use the first available idle CPU. This creates
-		 * a priority list between idle CPUs, but this is not
-		 * a problem.
-		 */
-		if (tsk == idle_task(cpu)) {
-			if (last_schedule(cpu) < oldest_idle) {
-				oldest_idle = last_schedule(cpu);
-				target_tsk = tsk;
-			}
-		} else {
-			if (oldest_idle == -1ULL) {
-				int prio = preemption_goodness(tsk, p, cpu);
+	for (i = 0; i < NR_CPUS; i++) {
+		struct runqueue *rq = cpu_rq(i);
 
-				if (prio > max_prio) {
-					max_prio = prio;
-					target_tsk = tsk;
-				}
-			}
-		}
-	}
-	tsk = target_tsk;
-	if (tsk) {
-		if (oldest_idle != -1ULL) {
-			best_cpu = tsk->processor;
-			goto send_now_idle;
+		spin_lock_irqsave(&rq->lock, flags);
+		if (p->array == rq->active || p->array == rq->expired) {
+			deactivate_task(p, rq);
+			spin_unlock_irqrestore(&rq->lock, flags);
+			return;
 		}
-		tsk->need_resched = 1;
-		if (tsk->processor != this_cpu)
-			smp_send_reschedule(tsk->processor);
+		spin_unlock_irqrestore(&rq->lock, flags);
 	}
-	return;
-		
+}
 
-#else /* UP */
-	int this_cpu = smp_processor_id();
-	struct task_struct *tsk;
+/*
+ * Number of runnable tasks in the system. This is only a snapshot,
+ * the runqueues are summed up without locking.
+ */
+unsigned long nr_running(void)
+{
+	unsigned long sum = 0;
+	int i;
 
-	tsk = cpu_curr(this_cpu);
-	if (preemption_goodness(tsk, p, this_cpu) > 1)
-		tsk->need_resched = 1;
-#endif
+	for (i = 0; i < smp_num_cpus; i++)
+		sum += cpu_rq(cpu_logical_map(i))->nr_running;
+	return sum;
 }
 
+#ifdef CONFIG_SMP
 /*
- * Careful!
+ * Pick the CPU a woken-up task should be queued on:
  *
- * This has to add the process to the _beginning_ of the
- * run-queue, not the end. See the comment about "This is
- * subtle" in the scheduler proper..
+ *  - the CPU it last ran on, if that is idle now;
+ *  - for a synchronous wakeup (the waker is about to sleep, eg. on
+ *    a pipe or a unix socket), the waker's CPU, which has the data
+ *    that was just handed over in its cache - unless the wakee's
+ *    own cache is still hot on its old CPU, in which case it stays;
+ *  - the old CPU if the task is still cache-hot there, queueing
+ *    for a short while is cheaper than refilling the cache;
+ *  - otherwise the least recently active idle CPU, since that has
+ *    the least valuable cache contents.
+ *
+ * This is called with p's runqueue locked, but only peeks at the
+ * other runqueues - a stale answer merely costs some balancing.
  */
-static inline void add_to_runqueue(struct task_struct * p)
+static int wake_up_cpu(struct task_struct * p, int synchronous)
 {
-	list_add(&p->run_list, &runqueue_head);
-	nr_running++;
-}
+	int cpu, best_cpu, this_cpu, i;
+	cycles_t oldest_idle, now;
 
-static inline void move_last_runqueue(struct task_struct * p)
-{
-	list_del(&p->run_list);
-	list_add_tail(&p->run_list, &runqueue_head);
-}
+	best_cpu = p->processor;
+	if (can_schedule(p, best_cpu)) {
+		if (cpu_curr(best_cpu) == idle_task(best_cpu))
+			return best_cpu;
+		now = get_cycles();
+		if (synchronous) {
+			this_cpu = smp_processor_id();
+			if (best_cpu != this_cpu && can_schedule(p, this_cpu) &&
+					!task_hot(p, now))
+				return this_cpu;
+			return best_cpu;
+		}
+		if (task_hot(p, now))
+			return best_cpu;
+	} else
+		best_cpu = -1;
 
-static inline void move_first_runqueue(struct task_struct * p)
-{
-	list_del(&p->run_list);
-	list_add(&p->run_list, &runqueue_head);
+	oldest_idle = (cycles_t) -1;
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpu = cpu_logical_map(i);
+		if (!can_schedule(p, cpu))
+			continue;
+		if (best_cpu < 0)
+			best_cpu = cpu;
+		if (cpu_curr(cpu) != idle_task(cpu))
+			continue;
+		if (last_schedule(cpu) < oldest_idle) {
+			oldest_idle = last_schedule(cpu);
+			best_cpu = cpu;
+		}
+	}
+	return best_cpu < 0 ? p->processor : best_cpu;
 }
+#endif
 
 /*
  * Wake up a process. Put it on the run-queue if it's not
@@ -325,38 +437,58 @@ static inline void move_first_runqueue(struct task_struct * p)
  * progress), and as such you're allowed to do the simpler
  * "current->state = TASK_RUNNING" to mark yourself runnable
  * without the overhead of this.
+ *
+ * A sleeping task that is not on any CPU can be moved to a
+ * different runqueue by just changing ->processor while holding
+ * its current runqueue lock; task_rq_lock() notices and we go
+ * round again to lock the new one.
  */
-inline void wake_up_process(struct task_struct * p)
+static inline void try_to_wake_up(struct task_struct * p, int synchronous)
 {
 	unsigned long flags;
+	struct runqueue *rq;
+#ifdef CONFIG_SMP
+	int cpu, moved = 0;
+#endif
 
-	/*
-	 * We want the common case fall through straight, thus the goto.
-	 */
-	spin_lock_irqsave(&runqueue_lock, flags);
+repeat:
+	rq = task_rq_lock(p, &flags);
 	p->state = TASK_RUNNING;
 	if (task_on_runqueue(p))
 		goto out;
-	add_to_runqueue(p);
-	reschedule_idle(p);
+#ifdef CONFIG_SMP
+	if (!moved && !p->has_cpu) {
+		cpu = wake_up_cpu(p, synchronous);
+		if (cpu != p->processor) {
+			p->processor = cpu;
+			moved = 1;
+			task_rq_unlock(rq, &flags);
+			goto repeat;
+		}
+	}
+#endif
+	activate_task(p, rq);
+	p->wake_stamp = get_cycles();
+	rq->stat.wakeups++;
+	/*
+	 * A synchronous waker is going to schedule() itself soon, so
+	 * only a remote CPU needs to be told.
+	 */
+	if (p->prio < rq->curr->prio &&
+			(!synchronous || rq != this_rq()))
+		resched_task(rq->curr);
 out:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	task_rq_unlock(rq, &flags);
 }
 
-static inline void wake_up_process_synchronous(struct task_struct * p)
+inline void wake_up_process(struct task_struct * p)
 {
-	unsigned long flags;
+	try_to_wake_up(p, 0);
+}
 
-	/*
-	 * We want the common case fall through straight, thus the goto.
-	 */
-	spin_lock_irqsave(&runqueue_lock, flags);
-	p->state = TASK_RUNNING;
-	if (task_on_runqueue(p))
-		goto out;
-	add_to_runqueue(p);
-out:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+static inline void wake_up_process_synchronous(struct task_struct * p)
+{
+	try_to_wake_up(p, 1);
 }
 
 static void process_timeout(unsigned long __data)
@@ -418,6 +550,148 @@ signed long schedule_timeout(signed long timeout)
 	return timeout < 0 ? 0 : timeout;
 }
 
+#ifdef CONFIG_SMP
+/*
+ * Lock a second runqueue while already holding this_rq->lock,
+ * keeping to the address ordering rule. This might drop and
+ * retake this_rq->lock.
+ */
+static inline void double_lock_balance(struct runqueue *this_rq, struct runqueue *busiest)
+{
+	if (!spin_trylock(&busiest->lock)) {
+		if (busiest < this_rq) {
+			spin_unlock(&this_rq->lock);
+			spin_lock(&busiest->lock);
+			spin_lock(&this_rq->lock);
+		} else
+			spin_lock(&busiest->lock);
+	}
+}
+
+/*
+ * Move tasks from the busiest runqueue to this one, if it is
+ * sufficiently busier than we are. An idle CPU pulls as soon as
+ * there is something to pull, a busy one only corrects imbalances
+ * of 25% or more. Expired tasks are preferred (their cache state
+ * is the coldest), and within an array the lowest priority ones.
+ * Tasks that are running, still cache-hot, or that may not run on
+ * this CPU are left alone.
+ *
+ * Called with this_rq locked and interrupts disabled.
+ */
+static void load_balance(struct runqueue *this_rq, int idle)
+{
+	int this_cpu = this_rq - runqueues;
+	int i, idx, imbalance, max_load, nr_running;
+	cycles_t now = get_cycles();
+	struct runqueue *busiest, *rq_src;
+	struct prio_array *array;
+	struct list_head *head, *curr;
+	struct task_struct *tmp;
+
+	busiest = NULL;
+	max_load = 1;
+	for (i = 0; i < smp_num_cpus; i++) {
+		rq_src = cpu_rq(cpu_logical_map(i));
+		if (rq_src == this_rq)
+			continue;
+		if ((int) rq_src->nr_running > max_load) {
+			max_load = rq_src->nr_running;
+			busiest = rq_src;
+		}
+	}
+	if (!busiest)
+		return;
+	nr_running = this_rq->nr_running;
+	imbalance = (max_load - nr_running) / 2;
+	if (imbalance < 1 || (!idle && imbalance < (max_load + 3) / 4))
+		return;
+
+	double_lock_balance(this_rq, busiest);
+	/* things might have changed while we did not hold our lock */
+	imbalance = ((int) busiest->nr_running - (int) this_rq->nr_running) / 2;
+	if (imbalance < 1)
+		goto out_unlock;
+
+	array = busiest->expired->nr_active ? busiest->expired : busiest->active;
+	idx = MAX_PRIO;
+	while (imbalance > 0) {
+		if (--idx < 0) {
+			if (array == busiest->active)
+				break;
+			array = busiest->active;
+			idx = MAX_PRIO - 1;
+		}
+		if (!test_bit(idx, array->bitmap))
+			continue;
+		head = array->queue + idx;
+		curr = head->prev;
+		while (curr != head && imbalance > 0) {
+			tmp = list_entry(curr, struct task_struct, run_list);
+			curr = curr->prev;
+			if (tmp == busiest->curr || tmp->has_cpu ||
+					task_hot(tmp, now) ||
+					!can_schedule(tmp, this_cpu))
+				continue;
+			dequeue_task(tmp, array);
+			busiest->nr_running--;
+			tmp->processor = this_cpu;
+			enqueue_task(tmp, this_rq->active);
+			this_rq->nr_running++;
+			if (!idle && tmp->prio < this_rq->curr->prio)
+				this_rq->curr->need_resched = 1;
+			imbalance--;
+		}
+	}
+out_unlock:
+	spin_unlock(&busiest->lock);
+}
+#endif /* CONFIG_SMP */
+
+/*
+ * Called from the timer interrupt on every tick, with the task
+ * that was running. Charges the tick against its timeslice and
+ * keeps its queue position in line with effective_prio(), and
+ * every now and then checks whether the CPUs need balancing.
+ */
+void scheduler_tick(struct task_struct *p)
+{
+	int cpu = smp_processor_id();
+	struct runqueue *rq = cpu_rq(cpu);
+	unsigned long flags;
+	int prio;
+
+	spin_lock_irqsave(&rq->lock, flags);
+	if (!p->pid) {
+#ifdef CONFIG_SMP
+		if (!(jiffies % IDLE_REBALANCE_TICK))
+			load_balance(rq, 1);
+#endif
+		if (rq->nr_running)
+			p->need_resched = 1;
+		goto out_unlock;
+	}
+	if (--p->counter <= 0) {
+		p->counter = 0;
+		p->need_resched = 1;
+	} else if (p->policy == SCHED_OTHER && p->array) {
+		prio = effective_prio(p);
+		if (prio != p->prio) {
+			dequeue_task(p, p->array);
+			p->prio = prio;
+			enqueue_task(p, p->array);
+			if (sched_find_first_bit(rq->active->bitmap) < prio)
+				p->need_resched = 1;
+		}
+	}
+#ifdef CONFIG_SMP
+	if (!(jiffies % BUSY_REBALANCE_TICK))
+		load_balance(rq, 0);
+#endif
+out_unlock:
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
 /*
  * schedule_tail() is getting called from the fork return path. This
  * cleans up all remaining scheduler things, without impacting the
@@ -443,48 +717,22 @@ static inline void __schedule_tail(struct task_struct *prev)
 	wmb();
 
 	/*
-	 * fast path falls through. We have to clear has_cpu before
-	 * checking prev->state to avoid a wakeup race - thus we
-	 * also have to protect against the task exiting early.
+	 * We have to protect against the task exiting early. There
+	 * is no need to look for another CPU for prev any more: it
+	 * stays on this runqueue and load_balance() moves it if
+	 * this CPU gets overloaded.
 	 */
 	task_lock(prev);
 	prev->has_cpu = 0;
-	mb();
-	if (prev->state == TASK_RUNNING)
-		goto needs_resched;
-
-out_unlock:
 	task_unlock(prev);	/* Synchronise here with release_task() if prev is TASK_ZOMBIE */
-	return;
 
 	/*
-	 * Slow path - we 'push' the previous process and
-	 * reschedule_idle() will attempt to find a new
-	 * processor for it. (but it might preempt the
-	 * current process as well.) We must take the runqueue
-	 * lock and re-check prev->state to be correct. It might
-	 * still happen that this process has a preemption
-	 * 'in progress' already - but this is not a problem and
-	 * might happen in other circumstances as well.
+	 * A runnable task that schedule() evicted because it may no
+	 * longer run on this CPU: the wakeup path picks an allowed one.
 	 */
-needs_resched:
-	{
-		unsigned long flags;
-
-		/*
-		 * Avoid taking the runqueue lock in cases where
-		 * no preemption-check is necessery:
-		 */
-		if ((prev == idle_task(smp_processor_id())) ||
-						(policy & SCHED_YIELD))
-			goto out_unlock;
-
-		spin_lock_irqsave(&runqueue_lock, flags);
-		if (prev->state == TASK_RUNNING)
-			reschedule_idle(prev);
-		spin_unlock_irqrestore(&runqueue_lock, flags);
-		goto out_unlock;
-	}
+	if (prev->state == TASK_RUNNING && !task_on_runqueue(prev) &&
+			!can_schedule(prev, smp_processor_id()))
+		wake_up_process(prev);
 #else
 	prev->policy &= ~SCHED_YIELD;
 #endif /* CONFIG_SMP */
@@ -495,6 +743,42 @@ void schedule_tail(struct task_struct *prev)
 	__schedule_tail(prev);
 }
 
+#ifdef CONFIG_TSC_ACCOUNTING
+/*
+ * schedule() adds up the cycles each task ran in acct_cycles.  The
+ * ticks update_process_times() charges now only decide how that is
+ * split between user and system time.  Only for current is the time
+ * since it was switched in included.
+ */
+void task_cputime(struct task_struct *p, unsigned long long *utime,
+		  unsigned long long *stime)
+{
+	unsigned long u = p->times.tms_utime, s = p->times.tms_stime;
+	unsigned long long total, frac;
+	cycles_t cycles = p->acct_cycles;
+
+	if (p == current)
+		cycles += get_cycles() - p->acct_stamp;
+	total = cycles_to_ns(cycles);
+
+	if (!total) {		/* the TSC could not be calibrated */
+		*utime = (unsigned long long) u * (1000000000 / HZ);
+		*stime = (unsigned long long) s * (1000000000 / HZ);
+		return;
+	}
+	if (!s)
+		*stime = 0;
+	else if (!u)
+		*stime = total;
+	else {
+		frac = (unsigned long long) s << 16;
+		do_div(frac, u + s);
+		*stime = (total >> 16) * frac + (((total & 0xffff) * frac) >> 16);
+	}
+	*utime = total - *stime;
+}
+#endif
+
 /*
  *  'schedule()' is the scheduler function. It's a very simple and nice
  * scheduler: it's not perfect, but certainly works for most things.
@@ -507,10 +791,10 @@ void schedule_tail(struct task_struct *prev)
  */
 asmlinkage void schedule(void)
 {
-	struct schedule_data * sched_data;
-	struct task_struct *prev, *next, *p;
-	struct list_head *tmp;
-	int this_cpu, c;
+	struct task_struct *prev, *next;
+	struct runqueue *rq;
+	struct prio_array *array;
+	int this_cpu, idx;
 
 	if (!current->active_mm) BUG();
 need_resched_back:
@@ -527,18 +811,9 @@ need_resched_back:
 		goto handle_softirq;
 handle_softirq_back:
 
-	/*
-	 * 'sched_data' is protected by the fact that we can run
-	 * only one process per CPU.
-	 */
-	sched_data = & aligned_data[this_cpu].schedule_data;
-
-	spin_lock_irq(&runqueue_lock);
-
-	/* move an exhausted RR process to be last.. */
-	if (prev->policy == SCHED_RR)
-		goto move_rr_last;
-move_rr_back:
+	rq = cpu_rq(this_cpu);
+	spin_lock_irq(&rq->lock);
+	rq->quiescent++;
 
 	switch (prev->state) {
 		case TASK_INTERRUPTIBLE:
@@ -547,71 +822,99 @@ move_rr_back:
 				break;
 			}
 		default:
-			del_from_runqueue(prev);
+			if (prev->array)
+				deactivate_task(prev, rq);
 		case TASK_RUNNING:
 	}
 	prev->need_resched = 0;
 
+#ifdef CONFIG_SMP
 	/*
-	 * this is the scheduler proper:
+	 * If our CPU was taken out of prev's cpus_allowed, take it off
+	 * this runqueue; __schedule_tail() finds it a new one once it
+	 * is no longer running here.
 	 */
+	if (prev->array && !can_schedule(prev, this_cpu))
+		deactivate_task(prev, rq);
+#endif
+
+	/*
+	 * Requeue a task that used up its timeslice or wants to yield.
+	 * Realtime tasks stay in the active array (a SCHED_RR one goes
+	 * to the end of its list), everybody else has to wait until
+	 * the expired array is switched in.
+	 */
+	if (prev->array && (!prev->counter || (prev->policy & SCHED_YIELD)))
+		goto requeue_prev;
+requeue_prev_back:
 
-repeat_schedule:
 	/*
-	 * Default process to select..
+	 * this is the scheduler proper:
 	 */
-	next = idle_task(this_cpu);
-	c = -1000;
-	if (prev->state == TASK_RUNNING)
-		goto still_running;
-
-still_running_back:
-	list_for_each(tmp, &runqueue_head) {
-		p = list_entry(tmp, struct task_struct, run_list);
-		if (can_schedule(p, this_cpu)) {
-			int weight = goodness(p, this_cpu, prev->active_mm);
-			if (weight > c)
-				c = weight, next = p;
+	if (!rq->nr_running)
+		goto empty_runqueue;
+empty_runqueue_back:
+	array = rq->active;
+	if (!array->nr_active) {
+		/*
+		 * Switch the active and expired arrays.
+		 */
+		rq->active = rq->expired;
+		rq->expired = array;
+		array = rq->active;
+	}
+	idx = sched_find_first_bit(array->bitmap);
+	next = list_entry(array->queue[idx].next, struct task_struct, run_list);
+
+switch_tasks:
+	rq->stat.rq_len[schedstat_slot(rq->nr_running, SCHEDSTAT_LEN_SLOTS)]++;
+	if (next->wake_stamp) {
+		cycles_t delta = get_cycles() - next->wake_stamp;
+
+		/* shifted so that slot n starts at 2^n, not 2^(n-1) */
+		rq->stat.wakeup_lat[schedstat_slot(delta >> 1, SCHEDSTAT_LAT_SLOTS)]++;
+		if (delta > rq->stat.max_lat) {
+			rq->stat.max_lat = delta;
+			rq->stat.max_lat_ip = __builtin_return_address(0);
 		}
+		next->wake_stamp = 0;
 	}
 
-	/* Do we need to re-calculate counters? */
-	if (!c)
-		goto recalculate;
 	/*
 	 * from this point on nothing can prevent us from
 	 * switching to the next task, save this fact in
-	 * sched_data.
+	 * the runqueue.
 	 */
-	sched_data->curr = next;
+	rq->curr = next;
 #ifdef CONFIG_SMP
  	next->has_cpu = 1;
-	next->processor = this_cpu;
 #endif
-	spin_unlock_irq(&runqueue_lock);
+	spin_unlock_irq(&rq->lock);
 
 	if (prev == next)
 		goto same_process;
 
 #ifdef CONFIG_SMP
  	/*
- 	 * maintain the per-process 'last schedule' value.
+ 	 * maintain the per-CPU 'last schedule' value.
  	 * (this has to be recalculated even if we reschedule to
  	 * the same process) Currently this is only used on SMP,
 	 * and it's approximate, so we do not have to maintain
 	 * it while holding the runqueue spinlock.
  	 */
- 	sched_data->last_schedule = get_cycles();
+ 	rq->last_schedule = get_cycles();
+	prev->last_run = rq->last_schedule;
 
 	/*
-	 * We drop the scheduler lock early (it's a global spinlock),
-	 * thus we have to lock the previous process from getting
-	 * rescheduled during switch_to().
+	 * We drop the runqueue lock early, thus we have to lock
+	 * the previous process from getting rescheduled during
+	 * switch_to().
 	 */
 
 #endif /* CONFIG_SMP */
 
 	kstat.context_swtch++;
+	rq->stat.switches++;
 	/*
 	 * there are 3 processes which are affected by a context switch:
 	 *
@@ -621,6 +924,14 @@ still_running_back:
 	 * but prev is set to (the just run) 'last' process by switch_to().
 	 * This might sound slightly confusing but makes tons of sense.
 	 */
+#ifdef CONFIG_TSC_ACCOUNTING
+	{
+		cycles_t now = get_cycles();
+
+		prev->acct_cycles += now - prev->acct_stamp;
+		next->acct_stamp = now;
+	}
+#endif
 	prepare_to_switch();
 	{
 		struct mm_struct *mm = next->mm;
@@ -655,34 +966,32 @@ same_process:
 
 	return;
 
-recalculate:
-	{
-		struct task_struct *p;
-		spin_unlock_irq(&runqueue_lock);
-		read_lock(&tasklist_lock);
-		for_each_task(p)
-			p->counter = (p->counter >> 1) + NICE_TO_TICKS(p->nice);
-		read_unlock(&tasklist_lock);
-		spin_lock_irq(&runqueue_lock);
-	}
-	goto repeat_schedule;
+empty_runqueue:
+#ifdef CONFIG_SMP
+	load_balance(rq, 1);
+	if (rq->nr_running)
+		goto empty_runqueue_back;
+#endif
+	next = rq->idle;
+	goto switch_tasks;
 
-still_running:
-	c = goodness(prev, this_cpu, prev->active_mm);
-	next = prev;
-	goto still_running_back;
+requeue_prev:
+	if (!prev->counter)
+		prev->counter = NICE_TO_TICKS(prev->nice);
+	if (prev->policy == SCHED_FIFO)
+		goto requeue_prev_back;
+	dequeue_task(prev, prev->array);
+	prev->prio = effective_prio(prev);
+	if (rt_task(prev))
+		enqueue_task(prev, rq->active);
+	else
+		enqueue_task(prev, rq->expired);
+	goto requeue_prev_back;
 
 handle_softirq:
 	do_softirq();
 	goto handle_softirq_back;
 
-move_rr_last:
-	if (!prev->counter) {
-		prev->counter = NICE_TO_TICKS(prev->nice);
-		move_last_runqueue(prev);
-	}
-	goto move_rr_back;
-
 scheduling_in_interrupt:
 	printk("Scheduling in interrupt\n");
 	BUG();
@@ -724,6 +1033,10 @@ static inline void __wake_up_common (wait_queue_head_t *q, unsigned int mode,
 #if WAITQUEUE_DEBUG
 		CHECK_MAGIC(curr->__magic);
 #endif
+		if (curr->func) {
+			curr->func(curr);
+			continue;
+		}
 		p = curr->task;
 		state = p->state;
 		if (state & mode) {
@@ -838,6 +1151,81 @@ long sleep_on_timeout(wait_queue_head_t *q, long timeout)
 
 void scheduling_functions_end_here(void) { }
 
+/*
+ * /proc/schedstat: one block per CPU with the wakeup and context
+ * switch counts, followed by the wakeup latency and runqueue length
+ * histograms described above struct sched_stat.
+ */
+int schedstat_read_proc(char *page, char **start, off_t off,
+			int count, int *eof, void *data)
+{
+	int i, j, len;
+
+	len = sprintf(page, "version 2\n");
+	for (i = 0; i < smp_num_cpus; i++) {
+		int cpu = cpu_logical_map(i);
+		struct sched_stat *st = &cpu_rq(cpu)->stat;
+
+		if (len > PAGE_SIZE - 1024)
+			break;
+		len += sprintf(page + len, "cpu%d wakeups %lu switches %lu\n"
+			"maxlat %lu %p\nlat", i, st->wakeups, st->switches,
+			st->max_lat, st->max_lat_ip);
+		for (j = 0; j < SCHEDSTAT_LAT_SLOTS; j++)
+			len += sprintf(page + len, " %lu", st->wakeup_lat[j]);
+		len += sprintf(page + len, "\nrqlen");
+		for (j = 0; j < SCHEDSTAT_LEN_SLOTS; j++)
+			len += sprintf(page + len, " %lu", st->rq_len[j]);
+		len += sprintf(page + len, "\n");
+	}
+
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+
+/*
+ * Any write to /proc/schedstat clears all the counters. This is
+ * not synchronised against CPUs updating them, an event or two
+ * might survive the reset.
+ */
+int schedstat_write_proc(struct file *file, const char *buffer,
+			 unsigned long count, void *data)
+{
+	int i;
+
+	for (i = 0; i < NR_CPUS; i++)
+		memset(&cpu_rq(i)->stat, 0, sizeof(struct sched_stat));
+	return count;
+}
+
+/*
+ * Change the nice level of a task, moving it to its new priority
+ * level right away if it is queued.
+ */
+void set_user_nice(struct task_struct *p, long nice)
+{
+	struct prio_array *array;
+	struct runqueue *rq;
+	unsigned long flags;
+
+	rq = task_rq_lock(p, &flags);
+	array = p->array;
+	if (array)
+		dequeue_task(p, array);
+	p->nice = nice;
+	p->prio = effective_prio(p);
+	if (array) {
+		enqueue_task(p, array);
+		if (p == rq->curr || p->prio < rq->curr->prio)
+			resched_task(rq->curr);
+	}
+	task_rq_unlock(rq, &flags);
+}
+
 #ifndef __alpha__
 
 /*
@@ -869,7 +1257,7 @@ asmlinkage long sys_nice(int increment)
 		newprio = -20;
 	if (newprio > 19)
 		newprio = 19;
-	current->nice = newprio;
+	set_user_nice(current, newprio);
 	return 0;
 }
 
@@ -889,6 +1277,9 @@ static int setscheduler(pid_t pid, int policy,
 {
 	struct sched_param lp;
 	struct task_struct *p;
+	struct prio_array *array;
+	struct runqueue *rq;
+	unsigned long flags;
 	int retval;
 
 	retval = -EINVAL;
@@ -903,7 +1294,6 @@ static int setscheduler(pid_t pid, int policy,
 	 * We play safe to avoid deadlocks.
 	 */
 	read_lock_irq(&tasklist_lock);
-	spin_lock(&runqueue_lock);
 
 	p = find_process_by_pid(pid);
 
@@ -939,15 +1329,22 @@ static int setscheduler(pid_t pid, int policy,
 		goto out_unlock;
 
 	retval = 0;
+	rq = task_rq_lock(p, &flags);
+	array = p->array;
+	if (array)
+		dequeue_task(p, array);
 	p->policy = policy;
 	p->rt_priority = lp.sched_priority;
-	if (task_on_runqueue(p))
-		move_first_runqueue(p);
+	p->prio = effective_prio(p);
+	if (array) {
+		enqueue_task(p, rt_task(p) ? rq->active : array);
+		resched_task(rq->curr);
+	}
+	task_rq_unlock(rq, &flags);
 
 	current->need_resched = 1;
 
 out_unlock:
-	spin_unlock(&runqueue_lock);
 	read_unlock_irq(&tasklist_lock);
 
 out_nounlock:
@@ -1019,27 +1416,17 @@ out_unlock:
 asmlinkage long sys_sched_yield(void)
 {
 	/*
-	 * Trick. sched_yield() first counts the number of truly 
-	 * 'pending' runnable processes, then returns if it's
-	 * only the current processes. (This test does not have
+	 * Trick. sched_yield() first checks whether anything else
+	 * is runnable on this CPU's runqueue, and returns if it's
+	 * only the current process. (This test does not have
 	 * to be atomic.) In threaded applications this optimization
 	 * gets triggered quite often.
 	 */
 
-	int nr_pending = nr_running;
+	// this process is on the runqueue as well
+	int nr_pending = this_rq()->nr_running - 1;
 
-#if CONFIG_SMP
-	int i;
-
-	// Substract non-idle processes running on other CPUs.
-	for (i = 0; i < smp_num_cpus; i++)
-		if (aligned_data[i].schedule_data.curr != idle_task(i))
-			nr_pending--;
-#else
-	// on UP this process is on the runqueue as well
-	nr_pending--;
-#endif
-	if (nr_pending) {
+	if (nr_pending > 0) {
 		/*
 		 * This process can only be rescheduled by us,
 		 * so this is safe without any locking.
@@ -1082,6 +1469,137 @@ asmlinkage long sys_sched_get_priority_min(int policy)
 	return ret;
 }
 
+/*
+ * Quiescent states, for freeing what lockless readers may still be
+ * looking at. Such readers don't sleep, so once every other CPU has been
+ * through schedule(), or is idle, nobody looks at anything that was
+ * unreachable when the snapshot was taken.
+ */
+void quiescent_snapshot(unsigned long *snap)
+{
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		snap[i] = cpu_rq(cpu_logical_map(i))->quiescent;
+}
+
+int quiescent_passed(unsigned long *snap)
+{
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		int cpu = cpu_logical_map(i);
+		struct runqueue *rq = cpu_rq(cpu);
+
+		if (cpu == smp_processor_id())
+			continue;
+		if (rq->quiescent == snap[i] && rq->curr != rq->idle)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Change the set of CPUs a task may run on. A sleeping task is
+ * moved by its next wakeup, a queued one right away, and a running
+ * one gets rescheduled so that schedule() evicts it.
+ */
+void set_cpus_allowed(struct task_struct *p, unsigned long new_mask)
+{
+	struct runqueue *rq;
+	unsigned long flags;
+
+	rq = task_rq_lock(p, &flags);
+	p->cpus_allowed = new_mask;
+	if (can_schedule(p, p->processor))
+		goto out;
+	if (p->has_cpu) {
+		resched_task(p);
+		goto out;
+	}
+	if (p->array) {
+		deactivate_task(p, rq);
+		task_rq_unlock(rq, &flags);
+		wake_up_process(p);
+		return;
+	}
+out:
+	task_rq_unlock(rq, &flags);
+}
+
+static unsigned long cpu_present_mask(void)
+{
+	unsigned long mask = 0;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		mask |= 1UL << cpu_logical_map(i);
+	return mask;
+}
+
+/*
+ * The masks are plain unsigned longs, one bit per (logical) CPU
+ * number. The user buffer has to be at least that large; on
+ * success getaffinity returns the number of bytes it copied.
+ */
+asmlinkage long sys_sched_setaffinity(pid_t pid, unsigned int len,
+				      unsigned long *user_mask_ptr)
+{
+	unsigned long new_mask;
+	struct task_struct *p;
+	int retval;
+
+	if (len < sizeof(new_mask))
+		return -EINVAL;
+	if (copy_from_user(&new_mask, user_mask_ptr, sizeof(new_mask)))
+		return -EFAULT;
+
+	new_mask &= cpu_present_mask();
+	if (!new_mask)
+		return -EINVAL;
+
+	read_lock(&tasklist_lock);
+	p = find_process_by_pid(pid);
+	retval = -ESRCH;
+	if (!p)
+		goto out_unlock;
+
+	retval = -EPERM;
+	if ((current->euid != p->euid) && (current->euid != p->uid) &&
+	    !capable(CAP_SYS_NICE))
+		goto out_unlock;
+
+	retval = 0;
+	set_cpus_allowed(p, new_mask);
+
+out_unlock:
+	read_unlock(&tasklist_lock);
+	return retval;
+}
+
+asmlinkage long sys_sched_getaffinity(pid_t pid, unsigned int len,
+				      unsigned long *user_mask_ptr)
+{
+	unsigned long mask;
+	struct task_struct *p;
+
+	if (len < sizeof(mask))
+		return -EINVAL;
+
+	read_lock(&tasklist_lock);
+	p = find_process_by_pid(pid);
+	if (!p) {
+		read_unlock(&tasklist_lock);
+		return -ESRCH;
+	}
+	mask = p->cpus_allowed & cpu_present_mask();
+	read_unlock(&tasklist_lock);
+
+	if (copy_to_user(user_mask_ptr, &mask, sizeof(mask)))
+		return -EFAULT;
+	return sizeof(mask);
+}
+
 asmlinkage long sys_sched_rr_get_interval(pid_t pid, struct timespec *interval)
 {
 	struct timespec t;
@@ -1231,19 +1749,23 @@ void daemonize(void)
 
 void __init init_idle(void)
 {
-	struct schedule_data * sched_data;
-	sched_data = &aligned_data[smp_processor_id()].schedule_data;
+	struct runqueue *rq = this_rq();
+	unsigned long flags;
 
 	if (current != &init_task && task_on_runqueue(current)) {
 		printk("UGH! (%d:%d) was on the runqueue, removing.\n",
 			smp_processor_id(), current->pid);
 		del_from_runqueue(current);
 	}
-	sched_data->curr = current;
-	sched_data->last_schedule = get_cycles();
+	spin_lock_irqsave(&rq->lock, flags);
+	current->prio = MAX_PRIO;
+	rq->curr = rq->idle = current;
+	rq->last_schedule = get_cycles();
+	spin_unlock_irqrestore(&rq->lock, flags);
 }
 
 extern void init_timervecs (void);
+extern void init_hrtimers (void);
 
 void __init sched_init(void)
 {
@@ -1252,14 +1774,36 @@ void __init sched_init(void)
 	 * process right in SMP mode.
 	 */
 	int cpu = smp_processor_id();
-	int nr;
+	int i, j, nr;
 
 	init_task.processor = cpu;
+	init_task.prio = MAX_PRIO;
+
+	/*
+	 * Until a CPU runs init_idle() its runqueue pretends to be
+	 * running the boot idle thread.
+	 */
+	for (i = 0; i < NR_CPUS; i++) {
+		struct runqueue *rq = cpu_rq(i);
+
+		spin_lock_init(&rq->lock);
+		rq->active = rq->arrays;
+		rq->expired = rq->arrays + 1;
+		rq->curr = rq->idle = &init_task;
+		for (j = 0; j < 2; j++) {
+			struct prio_array *array = rq->arrays + j;
+
+			for (nr = 0; nr < MAX_PRIO; nr++)
+				INIT_LIST_HEAD(array->queue + nr);
+			memset(array->bitmap, 0, sizeof(array->bitmap));
+		}
+	}
 
 	for(nr = 0; nr < PIDHASH_SZ; nr++)
 		pidhash[nr] = NULL;
 
 	init_timervecs();
+	init_hrtimers();
 
 	init_bh(TIMER_BH, timer_bh);
 	init_bh(TQUEUE_BH, tqueue_bh);
@@ -32,6 +32,8 @@ static kmem_cache_t *sigqueue_cachep;
 
 atomic_t nr_queued_signals;
 int max_queued_signals = 1024;
+/* How many one process can have queued */
+int max_queued_signals_proc = 1024;
 
 void __init signals_init(void)
 {
@@ -81,6 +83,28 @@ next_signal(struct task_struct *tsk, sigset_t *mask)
 	return sig;
 }
 
+static inline unsigned int sigqueue_hashfn(int sig, int fd)
+{
+	return (sig ^ fd) & (SIGQUEUE_POLL_HASH - 1);
+}
+
+/* q is off the queue already */
+static void sigqueue_free(struct sigpending *list, struct sigqueue *q)
+{
+	if (q->poll) {
+		struct sigqueue **pp;
+
+		pp = &list->poll_hash[sigqueue_hashfn(q->info.si_signo,
+						      q->info.si_fd)];
+		while (*pp != q)
+			pp = &(*pp)->poll_next;
+		*pp = q->poll_next;
+	}
+	list->count--;
+	kmem_cache_free(sigqueue_cachep, q);
+	atomic_dec(&nr_queued_signals);
+}
+
 static void flush_sigqueue(struct sigpending *queue)
 {
 	struct sigqueue *q, *n;
@@ -89,6 +113,8 @@ static void flush_sigqueue(struct sigpending *queue)
 	q = queue->head;
 	queue->head = NULL;
 	queue->tail = &queue->head;
+	queue->count = 0;
+	memset(queue->poll_hash, 0, sizeof(queue->poll_hash));
 
 	while (q) {
 		n = q->next;
@@ -205,8 +231,7 @@ found_it:
 
 		/* Copy the sigqueue information and free the queue entry */
 		copy_siginfo(info, &q->info);
-		kmem_cache_free(sigqueue_cachep,q);
-		atomic_dec(&nr_queued_signals);
+		sigqueue_free(list, q);
 
 		/* Non-RT signals can exist multiple times.. */
 		if (sig >= SIGRTMIN) {
@@ -282,8 +307,7 @@ static int rm_from_queue(int sig, struct sigpending *s)
 		if (q->info.si_signo == sig) {
 			if ((*pp = q->next) == NULL)
 				s->tail = pp;
-			kmem_cache_free(sigqueue_cachep,q);
-			atomic_dec(&nr_queued_signals);
+			sigqueue_free(s, q);
 			continue;
 		}
 		pp = &q->next;
@@ -399,10 +423,33 @@ static void handle_stop_signal(int sig, struct task_struct *t)
 	}
 }
 
-static int send_signal(int sig, struct siginfo *info, struct sigpending *signals)
+/*
+ * An I/O event for an fd that has one queued already only adds its band
+ * to that one: the queue holds one entry per ready fd, however often
+ * it became ready.
+ */
+static int coalesce_signal(int sig, struct siginfo *info, struct sigpending *signals)
+{
+	struct sigqueue * q;
+
+	q = signals->poll_hash[sigqueue_hashfn(sig, info->si_fd)];
+	for (; q; q = q->poll_next) {
+		if (q->info.si_signo == sig && q->info.si_fd == info->si_fd) {
+			q->info.si_band |= info->si_band;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int send_signal(int sig, struct siginfo *info, struct sigpending *signals,
+		       int poll)
 {
 	struct sigqueue * q = NULL;
 
+	if (poll && coalesce_signal(sig, info, signals))
+		return 0;
+
 	/* Real-time signals must be queued if sent by sigqueue, or
 	   some other real-time mechanism.  It is implementation
 	   defined whether kill() does so.  We attempt to do so, on
@@ -411,15 +458,25 @@ static int send_signal(int sig, struct siginfo *info, struct sigpending *signals
 	   make sure at least one signal gets delivered and don't
 	   pass on the info struct.  */
 
-	if (atomic_read(&nr_queued_signals) < max_queued_signals) {
+	if (atomic_read(&nr_queued_signals) < max_queued_signals &&
+	    signals->count < max_queued_signals_proc) {
 		q = kmem_cache_alloc(sigqueue_cachep, GFP_ATOMIC);
 	}
 
 	if (q) {
 		atomic_inc(&nr_queued_signals);
+		signals->count++;
 		q->next = NULL;
 		*signals->tail = q;
 		signals->tail = &q->next;
+		q->poll = 0;
+		if (poll) {
+			unsigned int h = sigqueue_hashfn(sig, info->si_fd);
+
+			q->poll = 1;
+			q->poll_next = signals->poll_hash[h];
+			signals->poll_hash[h] = q;
+		}
 		switch ((unsigned long) info) {
 			case 0:
 				q->info.si_signo = sig;
@@ -483,16 +540,15 @@ static inline void signal_wake_up(struct task_struct *t)
 	 * process of changing - but no harm is done by that
 	 * other than doing an extra (lightweight) IPI interrupt.
 	 */
-	spin_lock(&runqueue_lock);
 	if (t->has_cpu && t->processor != smp_processor_id())
 		smp_send_reschedule(t->processor);
-	spin_unlock(&runqueue_lock);
 #endif /* CONFIG_SMP */
 }
 
-static int deliver_signal(int sig, struct siginfo *info, struct task_struct *t)
+static int deliver_signal(int sig, struct siginfo *info, struct task_struct *t,
+			  int poll)
 {
-	int retval = send_signal(sig, info, &t->pending);
+	int retval = send_signal(sig, info, &t->pending, poll);
 
 	if (!retval && !sigismember(&t->blocked, sig))
 		signal_wake_up(t);
@@ -500,8 +556,8 @@ static int deliver_signal(int sig, struct siginfo *info, struct task_struct *t)
 	return retval;
 }
 
-int
-send_sig_info(int sig, struct siginfo *info, struct task_struct *t)
+static int
+__send_sig_info(int sig, struct siginfo *info, struct task_struct *t, int poll)
 {
 	unsigned long flags;
 	int ret;
@@ -541,7 +597,7 @@ printk("SIG queue (%s:%d): %d ", t->comm, t->pid, sig);
 	if (sig < SIGRTMIN && sigismember(&t->pending.signal, sig))
 		goto out;
 
-	ret = deliver_signal(sig, info, t);
+	ret = deliver_signal(sig, info, t, poll);
 out:
 	spin_unlock_irqrestore(&t->sigmask_lock, flags);
 	if ((t->state & TASK_INTERRUPTIBLE) && signal_pending(t))
@@ -554,6 +610,22 @@ printk(" %d -> %d\n", signal_pending(t), ret);
 	return ret;
 }
 
+int
+send_sig_info(int sig, struct siginfo *info, struct task_struct *t)
+{
+	return __send_sig_info(sig, info, t, 0);
+}
+
+/*
+ * An I/O event for info->si_fd, from send_sigio(). A realtime signal
+ * for the same fd that is still queued takes it, see coalesce_signal().
+ */
+int
+send_sig_poll(int sig, struct siginfo *info, struct task_struct *t)
+{
+	return __send_sig_info(sig, info, t, sig >= SIGRTMIN);
+}
+
 /*
  * Force a signal that the process can't ignore: if necessary
  * we unblock the signal and change any SIG_IGN to SIG_DFL.
@@ -810,6 +882,7 @@ EXPORT_SYMBOL(notify_parent);
 EXPORT_SYMBOL(recalc_sigpending);
 EXPORT_SYMBOL(send_sig);
 EXPORT_SYMBOL(send_sig_info);
+EXPORT_SYMBOL(send_sig_poll);
 EXPORT_SYMBOL(block_all_signals);
 EXPORT_SYMBOL(unblock_all_signals);
 
@@ -980,6 +1053,55 @@ sys_rt_sigtimedwait(const sigset_t *uthese, siginfo_t *uinfo,
 	return ret;
 }
 
+/* Taken off the queue at a time, on the stack */
+#define SIGWAIT_BATCH	4
+
+/*
+ * rt_sigtimedwait() for up to nr signals: waits for the first one as
+ * that does, then takes whatever else is pending in the set without
+ * waiting. Returns how many siginfos it stored.
+ */
+asmlinkage long
+sys_rt_sigtimedwait4(const sigset_t *uthese, siginfo_t *uinfo, int nr,
+		     const struct timespec *uts, size_t sigsetsize)
+{
+	siginfo_t info[SIGWAIT_BATCH];
+	sigset_t these;
+	long ret;
+	int count, n, i;
+
+	if (nr <= 0 || nr > INT_MAX / sizeof(siginfo_t))
+		return -EINVAL;
+	if (!uinfo || verify_area(VERIFY_WRITE, uinfo, nr * sizeof(siginfo_t)))
+		return -EFAULT;
+
+	ret = sys_rt_sigtimedwait(uthese, uinfo, uts, sigsetsize);
+	if (ret <= 0)
+		return ret;
+
+	/* That checked and copied these already */
+	__copy_from_user(&these, uthese, sizeof(these));
+	sigdelsetmask(&these, sigmask(SIGKILL)|sigmask(SIGSTOP));
+	signotset(&these);
+
+	for (count = 1; count < nr; count += n) {
+		spin_lock_irq(&current->sigmask_lock);
+		for (n = 0; n < SIGWAIT_BATCH && count + n < nr; n++)
+			if (!dequeue_signal(&these, &info[n]))
+				break;
+		spin_unlock_irq(&current->sigmask_lock);
+
+		for (i = 0; i < n; i++)
+			if (copy_siginfo_to_user(uinfo + count + i, &info[i]))
+				return -EFAULT;
+		if (n < SIGWAIT_BATCH) {
+			count += n;
+			break;
+		}
+	}
+	return count;
+}
+
 asmlinkage long
 sys_kill(int pid, int sig)
 {
@@ -38,6 +38,12 @@
      is invisible to common code.
    - Tasklets: serialized wrt itself.
    - Bottom halves: globally serialized, grr...
+
+   do_softirq() runs every pending softirq at most once. Whatever is
+   raised again while it runs (NET_RX under a packet flood, say) is
+   left to a per-CPU ksoftirqd thread instead of being picked up on
+   the next irq_exit() over and over again, so that a softirq storm
+   cannot lock user space out of the CPU.
  */
 
 /* No separate irq_stat for s390, it is part of PSA */
@@ -47,6 +53,40 @@ irq_cpustat_t irq_stat[NR_CPUS];
 
 static struct softirq_action softirq_vec[32] __cacheline_aligned;
 
+static struct task_struct * ksoftirqd_task[NR_CPUS];
+
+/* Softirqs raised for a CPU by another one.  softirq_active is only
+   ever touched by its own CPU, so these are kept apart and folded in
+   by the CPU itself at the start of do_softirq(). */
+static struct {
+	unsigned long pending;
+} ____cacheline_aligned softirq_remote[NR_CPUS];
+
+static inline void wakeup_softirqd(int cpu)
+{
+	struct task_struct * tsk = ksoftirqd_task[cpu];
+
+	if (tsk && tsk->state != TASK_RUNNING)
+		wake_up_process(tsk);
+}
+
+static inline void fold_remote_softirqs(int cpu)
+{
+	if (softirq_remote[cpu].pending)
+		softirq_active(cpu) |= xchg(&softirq_remote[cpu].pending, 0);
+}
+
+/*
+ * Raise softirq nr on another CPU.  It runs there at the next irq_exit(),
+ * or in its ksoftirqd, whose wakeup sends the reschedule IPI if the CPU
+ * is idle or busy in user space.
+ */
+void cpu_raise_softirq_remote(int cpu, int nr)
+{
+	if (!test_and_set_bit(nr, &softirq_remote[cpu].pending))
+		wakeup_softirqd(cpu);
+}
+
 asmlinkage void do_softirq()
 {
 	int cpu = smp_processor_id();
@@ -58,6 +98,7 @@ asmlinkage void do_softirq()
 	local_bh_disable();
 
 	local_irq_disable();
+	fold_remote_softirqs(cpu);
 	mask = softirq_mask(cpu);
 	active = softirq_active(cpu) & mask;
 
@@ -85,6 +126,8 @@ restart:
 		active = softirq_active(cpu);
 		if ((active &= mask) != 0)
 			goto retry;
+		if (softirq_active(cpu) & softirq_mask(cpu))
+			wakeup_softirqd(cpu);
 	}
 
 	local_bh_enable();
@@ -289,6 +332,66 @@ void __init softirq_init()
 	open_softirq(HI_SOFTIRQ, tasklet_hi_action, NULL);
 }
 
+static int ksoftirqd(void * __bind_cpu)
+{
+	int bind_cpu = (long) __bind_cpu;
+	int cpu = cpu_logical_map(bind_cpu);
+
+	daemonize();
+	set_user_nice(current, 19);
+	sigfillset(&current->blocked);
+
+	/* Migrate to the right CPU */
+	set_cpus_allowed(current, 1UL << cpu);
+	while (smp_processor_id() != cpu)
+		schedule();
+
+	sprintf(current->comm, "ksoftirqd_CPU%d", bind_cpu);
+
+	__set_current_state(TASK_INTERRUPTIBLE);
+	mb();
+
+	ksoftirqd_task[cpu] = current;
+
+	for (;;) {
+		if (!(softirq_active(cpu) & softirq_mask(cpu)) &&
+		    !softirq_remote[cpu].pending)
+			schedule();
+
+		__set_current_state(TASK_RUNNING);
+
+		while ((softirq_active(cpu) & softirq_mask(cpu)) ||
+		       softirq_remote[cpu].pending) {
+			do_softirq();
+			if (current->need_resched)
+				schedule();
+		}
+
+		__set_current_state(TASK_INTERRUPTIBLE);
+	}
+}
+
+static __init int spawn_ksoftirqd(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		if (kernel_thread(ksoftirqd, (void *) (long) cpu,
+				  CLONE_FS | CLONE_FILES | CLONE_SIGNAL) < 0)
+			printk("spawn_ksoftirqd() failed for cpu %d\n", cpu);
+		else {
+			while (!ksoftirqd_task[cpu_logical_map(cpu)]) {
+				current->policy |= SCHED_YIELD;
+				schedule();
+			}
+		}
+	}
+
+	return 0;
+}
+
+__initcall(spawn_ksoftirqd);
+
 void __run_task_queue(task_queue *list)
 {
 	struct list_head head, *next;
@@ -17,6 +17,7 @@
 
 #include <asm/uaccess.h>
 #include <asm/io.h>
+#include <asm/div64.h>
 
 /*
  * this is where the system-wide overflow UID and GID are defined, for
@@ -222,7 +223,7 @@ asmlinkage long sys_setpriority(int which, int who, int niceval)
 		if (niceval < p->nice && !capable(CAP_SYS_NICE))
 			error = -EACCES;
 		else
-			p->nice = niceval;
+			set_user_nice(p, niceval);
 	}
 	read_unlock(&tasklist_lock);
 
@@ -476,8 +477,8 @@ static int set_user(uid_t new_ruid)
 	if (!new_user)
 		return -EAGAIN;
 	old_user = current->user;
-	atomic_dec(&old_user->processes);
-	atomic_inc(&new_user->processes);
+	user_processes_add(old_user, -1);
+	user_processes_add(new_user, 1);
 
 	current->uid = new_ruid;
 	current->user = new_user;
@@ -734,6 +735,22 @@ asmlinkage long sys_setfsgid(gid_t gid)
 	return old_fsgid;
 }
 
+#ifdef CONFIG_TSC_ACCOUNTING
+static clock_t ns_to_clock_t(unsigned long long ns)
+{
+	do_div(ns, 1000000000 / HZ);
+	return ns;
+}
+
+static void ns_to_timeval(unsigned long long ns, struct timeval *tv)
+{
+	unsigned long rem = do_div(ns, 1000000000);
+
+	tv->tv_sec = ns;
+	tv->tv_usec = rem / 1000;
+}
+#endif
+
 asmlinkage long sys_times(struct tms * tbuf)
 {
 	/*
@@ -742,9 +759,23 @@ asmlinkage long sys_times(struct tms * tbuf)
 	 *	atomically safe type this is just fine. Conceptually its
 	 *	as if the syscall took an instant longer to occur.
 	 */
-	if (tbuf)
+	if (tbuf) {
+#ifdef CONFIG_TSC_ACCOUNTING
+		struct tms tms;
+		unsigned long long utime, stime;
+
+		task_cputime(current, &utime, &stime);
+		tms.tms_utime = ns_to_clock_t(utime);
+		tms.tms_stime = ns_to_clock_t(stime);
+		tms.tms_cutime = ns_to_clock_t(current->acct_cutime);
+		tms.tms_cstime = ns_to_clock_t(current->acct_cstime);
+		if (copy_to_user(tbuf, &tms, sizeof(struct tms)))
+			return -EFAULT;
+#else
 		if (copy_to_user(tbuf, &current->times, sizeof(struct tms)))
 			return -EFAULT;
+#endif
+	}
 	return jiffies;
 }
 
@@ -806,6 +837,7 @@ asmlinkage long sys_setpgid(pid_t pid, pid_t pgid)
 	}
 
 ok_pgid:
+	reserve_pgrp(pgid);
 	p->pgrp = pgid;
 	err = 0;
 out:
@@ -870,6 +902,7 @@ asmlinkage long sys_setsid(void)
 	}
 
 	current->leader = 1;
+	reserve_pgrp(current->pid);
 	current->session = current->pgrp = current->pid;
 	current->tty = NULL;
 	current->tty_old_pgrp = 0;
@@ -1100,6 +1133,9 @@ asmlinkage long sys_setrlimit(unsigned int resource, struct rlimit *rlim)
 int getrusage(struct task_struct *p, int who, struct rusage *ru)
 {
 	struct rusage r;
+#ifdef CONFIG_TSC_ACCOUNTING
+	unsigned long long utime, stime;
+#endif
 
 	memset((char *) &r, 0, sizeof(r));
 	switch (who) {
@@ -1131,6 +1167,17 @@ int getrusage(struct task_struct *p, int who, struct rusage *ru)
 			r.ru_nswap = p->nswap + p->cnswap;
 			break;
 	}
+#ifdef CONFIG_TSC_ACCOUNTING
+	utime = stime = 0;
+	if (who != RUSAGE_CHILDREN)
+		task_cputime(p, &utime, &stime);
+	if (who != RUSAGE_SELF) {
+		utime += p->acct_cutime;
+		stime += p->acct_cstime;
+	}
+	ns_to_timeval(utime, &r.ru_utime);
+	ns_to_timeval(stime, &r.ru_stime);
+#endif
 	return copy_to_user(ru, &r, sizeof(r)) ? -EFAULT : 0;
 }
 
@@ -1203,6 +1250,20 @@ asmlinkage long sys_prctl(int option, unsigned long arg2, unsigned long arg3,
 			}
 			current->keep_capabilities = arg2;
 			break;
+		case PR_GET_PAGE_COLOUR:
+			if (current->flags & PF_PAGECOLOUR)
+				error = 1;
+			break;
+		case PR_SET_PAGE_COLOUR:
+			if (arg2 != 0 && arg2 != 1) {
+				error = -EINVAL;
+				break;
+			}
+			if (arg2)
+				current->flags |= PF_PAGECOLOUR;
+			else
+				current->flags &= ~PF_PAGECOLOUR;
+			break;
 		default:
 			error = -EINVAL;
 			break;
@@ -45,13 +45,21 @@ extern int C_A_D;
 extern int bdf_prm[], bdflush_min[], bdflush_max[];
 extern int sysctl_overcommit_memory;
 extern int max_threads;
-extern int nr_queued_signals, max_queued_signals;
+extern int pid_max_limit;
+extern int nr_queued_signals, max_queued_signals, max_queued_signals_proc;
+extern int aio_nr, aio_max_nr;
+extern int proc_nr_files(ctl_table *, int, struct file *, void *, size_t *);
 extern int sysrq_enabled;
 
 /* this is needed for the proc_dointvec_minmax for [fs_]overflow UID and GID */
 static int maxolduid = 65535;
 static int minolduid;
 
+static int minpidmax = RESERVED_PIDS + 1;
+
+static int min_fault_around;
+static int max_fault_around = FAULT_AROUND_MAX;
+
 #ifdef CONFIG_KMOD
 extern char modprobe_path[];
 #endif
@@ -83,6 +91,7 @@ int proc_dol2crvec(ctl_table *table, int write, struct file *filp,
 
 #ifdef CONFIG_BSD_PROCESS_ACCT
 extern int acct_parm[];
+extern int acct_dropped;
 #endif
 
 extern int pgt_cache_water[];
@@ -202,11 +211,15 @@ static ctl_table kern_table[] = {
 #ifdef CONFIG_BSD_PROCESS_ACCT
 	{KERN_ACCT, "acct", &acct_parm, 3*sizeof(int),
 	0644, NULL, &proc_dointvec},
+	{KERN_ACCT_DROPPED, "acct-dropped", &acct_dropped, sizeof(int),
+	 0444, NULL, &proc_dointvec},
 #endif
 	{KERN_RTSIGNR, "rtsig-nr", &nr_queued_signals, sizeof(int),
 	 0444, NULL, &proc_dointvec},
 	{KERN_RTSIGMAX, "rtsig-max", &max_queued_signals, sizeof(int),
 	 0644, NULL, &proc_dointvec},
+	{KERN_RTSIGPROCMAX, "rtsig-proc-max", &max_queued_signals_proc,
+	 sizeof(int), 0644, NULL, &proc_dointvec},
 #ifdef CONFIG_SYSVIPC
 	{KERN_SHMMAX, "shmmax", &shm_ctlmax, sizeof (size_t),
 	 0644, NULL, &proc_doulongvec_minmax},
@@ -229,6 +242,9 @@ static ctl_table kern_table[] = {
 #endif	 
 	{KERN_MAX_THREADS, "threads-max", &max_threads, sizeof(int),
 	 0644, NULL, &proc_dointvec},
+	{KERN_PIDMAX, "pid_max", &pid_max, sizeof(int), 0644, NULL,
+	 &proc_dointvec_minmax, &sysctl_intvec, NULL,
+	 &minpidmax, &pid_max_limit},
 	{KERN_RANDOM, "random", NULL, 0, 0555, random_table},
 	{KERN_OVERFLOWUID, "overflowuid", &overflowuid, sizeof(int), 0644, NULL,
 	 &proc_dointvec_minmax, &sysctl_intvec, NULL,
@@ -254,9 +270,14 @@ static ctl_table vm_table[] = {
 	{VM_PAGERDAEMON, "kswapd",
 	 &pager_daemon, sizeof(pager_daemon_t), 0644, NULL, &proc_dointvec},
 	{VM_PGT_CACHE, "pagetable_cache", 
-	 &pgt_cache_water, 2*sizeof(int), 0644, NULL, &proc_dointvec},
+	 &pgt_cache_water, 3*sizeof(int), 0644, NULL, &proc_dointvec},
 	{VM_PAGE_CLUSTER, "page-cluster", 
 	 &page_cluster, sizeof(int), 0644, NULL, &proc_dointvec},
+	{VM_FAULT_AROUND, "fault_around",
+	 &fault_around_pages, sizeof(int), 0644, NULL, &proc_dointvec_minmax,
+	 &sysctl_intvec, NULL, &min_fault_around, &max_fault_around},
+	{VM_PAGE_COLOURING, "page_colouring",
+	 &sysctl_page_colouring, sizeof(int), 0644, NULL, &proc_dointvec},
 	{0}
 };
 
@@ -270,7 +291,7 @@ static ctl_table fs_table[] = {
 	{FS_STATINODE, "inode-state", &inodes_stat, 7*sizeof(int),
 	 0444, NULL, &proc_dointvec},
 	{FS_NRFILE, "file-nr", &files_stat, 3*sizeof(int),
-	 0444, NULL, &proc_dointvec},
+	 0444, NULL, &proc_nr_files},
 	{FS_MAXFILE, "file-max", &files_stat.max_files, sizeof(int),
 	 0644, NULL, &proc_dointvec},
 	{FS_NRSUPER, "super-nr", &nr_super_blocks, sizeof(int),
@@ -295,6 +316,11 @@ static ctl_table fs_table[] = {
 	 sizeof(int), 0644, NULL, &proc_dointvec},
 	{FS_LEASE_TIME, "lease-break-time", &lease_break_time, sizeof(int),
 	 0644, NULL, &proc_dointvec},
+	{FS_AIO_NR, "aio-nr", &aio_nr, sizeof(int), 0444, NULL, &proc_dointvec},
+	{FS_AIO_MAX_NR, "aio-max-nr", &aio_max_nr, sizeof(int), 0644, NULL,
+	 &proc_dointvec},
+	{FS_ATIME_INTERVAL, "atime-interval", &atime_interval, sizeof(int),
+	 0644, NULL, &proc_dointvec},
 	{0}
 };
 
@@ -98,12 +98,14 @@ asmlinkage long sys_stime(int * tptr)
 	if (get_user(value, tptr))
 		return -EFAULT;
 	write_lock_irq(&xtime_lock);
+	write_seqcount_begin(&xtime_seq);
 	xtime.tv_sec = value;
 	xtime.tv_usec = 0;
 	time_adjust = 0;	/* stop active adjtime() */
 	time_status |= STA_UNSYNC;
 	time_maxerror = NTP_PHASE_LIMIT;
 	time_esterror = NTP_PHASE_LIMIT;
+	write_seqcount_end(&xtime_seq);
 	write_unlock_irq(&xtime_lock);
 	return 0;
 }
@@ -144,7 +146,9 @@ asmlinkage long sys_gettimeofday(struct timeval *tv, struct timezone *tz)
 inline static void warp_clock(void)
 {
 	write_lock_irq(&xtime_lock);
+	write_seqcount_begin(&xtime_seq);
 	xtime.tv_sec += sys_tz.tz_minuteswest * 60;
+	write_seqcount_end(&xtime_seq);
 	write_unlock_irq(&xtime_lock);
 }
 
@@ -245,6 +249,7 @@ int do_adjtimex(struct timex *txc)
 			return -EINVAL;
 
 	write_lock_irq(&xtime_lock);
+	write_seqcount_begin(&xtime_seq);
 	result = time_state;	/* mostly `TIME_OK' */
 
 	/* Save for later - semantics of adjtime is to return old value */
@@ -399,6 +404,7 @@ leave:	if ((time_status & (STA_UNSYNC|STA_CLOCKERR)) != 0
 	txc->calcnt	   = pps_calcnt;
 	txc->errcnt	   = pps_errcnt;
 	txc->stbcnt	   = pps_stbcnt;
+	write_seqcount_end(&xtime_seq);
 	write_unlock_irq(&xtime_lock);
 	do_gettimeofday(&txc->time);
 	return(result);
@@ -22,6 +22,7 @@
 #include <linux/smp_lock.h>
 #include <linux/interrupt.h>
 #include <linux/kernel_stat.h>
+#include <linux/hrtimer.h>
 
 #include <asm/uaccess.h>
 
@@ -91,63 +92,88 @@ struct timer_vec_root {
 	struct list_head vec[TVR_SIZE];
 };
 
-static struct timer_vec tv5;
-static struct timer_vec tv4;
-static struct timer_vec tv3;
-static struct timer_vec tv2;
-static struct timer_vec_root tv1;
+#define NOOF_TVECS 5
 
-static struct timer_vec * const tvecs[] = {
-	(struct timer_vec *)&tv1, &tv2, &tv3, &tv4, &tv5
-};
+/*
+ * Each CPU has its own timer wheel, protected by its own lock, so
+ * that adding and deleting timers does not bounce a global lock
+ * around. A timer runs on the CPU whose wheel it is queued on,
+ * which is the CPU that last added or modified it. timer_jiffies
+ * is the next jiffy this wheel has not been run for yet.
+ */
+struct timer_base {
+	spinlock_t lock;
+	unsigned long timer_jiffies;
+#ifdef CONFIG_SMP
+	struct timer_list *running_timer;
+#endif
+	struct timer_vec * tvecs[NOOF_TVECS];
+	struct timer_vec_root tv1;
+	struct timer_vec tv2;
+	struct timer_vec tv3;
+	struct timer_vec tv4;
+	struct timer_vec tv5;
+} ____cacheline_aligned;
 
-#define NOOF_TVECS (sizeof(tvecs) / sizeof(tvecs[0]))
+static struct timer_base timer_bases[NR_CPUS] __cacheline_aligned;
+
+static void run_timer_softirq(struct softirq_action *h);
 
 void init_timervecs (void)
 {
-	int i;
-
-	for (i = 0; i < TVN_SIZE; i++) {
-		INIT_LIST_HEAD(tv5.vec + i);
-		INIT_LIST_HEAD(tv4.vec + i);
-		INIT_LIST_HEAD(tv3.vec + i);
-		INIT_LIST_HEAD(tv2.vec + i);
+	int cpu, i;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct timer_base *base = timer_bases + cpu;
+
+		spin_lock_init(&base->lock);
+		base->tvecs[0] = (struct timer_vec *)&base->tv1;
+		base->tvecs[1] = &base->tv2;
+		base->tvecs[2] = &base->tv3;
+		base->tvecs[3] = &base->tv4;
+		base->tvecs[4] = &base->tv5;
+		for (i = 0; i < TVN_SIZE; i++) {
+			INIT_LIST_HEAD(base->tv5.vec + i);
+			INIT_LIST_HEAD(base->tv4.vec + i);
+			INIT_LIST_HEAD(base->tv3.vec + i);
+			INIT_LIST_HEAD(base->tv2.vec + i);
+		}
+		for (i = 0; i < TVR_SIZE; i++)
+			INIT_LIST_HEAD(base->tv1.vec + i);
 	}
-	for (i = 0; i < TVR_SIZE; i++)
-		INIT_LIST_HEAD(tv1.vec + i);
+	open_softirq(TIMER_SOFTIRQ, run_timer_softirq, NULL);
 }
 
-static unsigned long timer_jiffies;
-
-static inline void internal_add_timer(struct timer_list *timer)
+static inline void internal_add_timer(struct timer_base *base,
+				      struct timer_list *timer)
 {
 	/*
-	 * must be cli-ed when calling this
+	 * must be called with base->lock held and irqs off
 	 */
 	unsigned long expires = timer->expires;
-	unsigned long idx = expires - timer_jiffies;
+	unsigned long idx = expires - base->timer_jiffies;
 	struct list_head * vec;
 
 	if (idx < TVR_SIZE) {
 		int i = expires & TVR_MASK;
-		vec = tv1.vec + i;
+		vec = base->tv1.vec + i;
 	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
 		int i = (expires >> TVR_BITS) & TVN_MASK;
-		vec = tv2.vec + i;
+		vec = base->tv2.vec + i;
 	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
 		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
-		vec =  tv3.vec + i;
+		vec =  base->tv3.vec + i;
 	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
 		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
-		vec = tv4.vec + i;
+		vec = base->tv4.vec + i;
 	} else if ((signed long) idx < 0) {
 		/* can happen if you add a timer with expires == jiffies,
 		 * or you set a timer to go off in the past
 		 */
-		vec = tv1.vec + tv1.index;
+		vec = base->tv1.vec + base->tv1.index;
 	} else if (idx <= 0xffffffffUL) {
 		int i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
-		vec = tv5.vec + i;
+		vec = base->tv5.vec + i;
 	} else {
 		/* Can only get here on architectures with 64-bit jiffies */
 		INIT_LIST_HEAD(&timer->list);
@@ -157,34 +183,114 @@ static inline void internal_add_timer(struct timer_list *timer)
 	 * Timers are FIFO!
 	 */
 	list_add(&timer->list, vec->prev);
+	timer->base = base;
 }
 
-/* Initialize both explicitly - let's try to have them in the same cache line */
-spinlock_t timerlist_lock = SPIN_LOCK_UNLOCKED;
-
 #ifdef CONFIG_SMP
-volatile struct timer_list * volatile running_timer;
-#define timer_enter(t) do { running_timer = t; mb(); } while (0)
-#define timer_exit() do { running_timer = NULL; } while (0)
-#define timer_is_running(t) (running_timer == t)
+#define timer_enter(base, t) do { (base)->running_timer = t; mb(); } while (0)
+#define timer_exit(base) do { (base)->running_timer = NULL; } while (0)
+
+/*
+ * A timer that was re-armed from its own handler on another CPU
+ * can still be running on its old wheel, so look at all of them.
+ */
+static int timer_is_running(struct timer_list *timer)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (timer_bases[cpu].running_timer == timer)
+			return 1;
+	return 0;
+}
+
 #define timer_synchronize(t) while (timer_is_running(t)) barrier()
 #else
-#define timer_enter(t)		do { } while (0)
-#define timer_exit()		do { } while (0)
+#define timer_enter(base, t)	do { } while (0)
+#define timer_exit(base)	do { } while (0)
 #endif
 
+/*
+ * Lock the wheel a timer is queued on. timer->base only changes
+ * under the lock of the wheel it points to, so if it is still the
+ * same once we hold that lock it is the right one. A timer that
+ * was never added has no wheel and NULL is returned.
+ */
+static struct timer_base *lock_timer_base(struct timer_list *timer,
+					  unsigned long *flags)
+{
+	struct timer_base *base;
+
+	for (;;) {
+		base = timer->base;
+		if (!base)
+			return NULL;
+		spin_lock_irqsave(&base->lock, *flags);
+		if (base == timer->base)
+			return base;
+		spin_unlock_irqrestore(&base->lock, *flags);
+	}
+}
+
+/*
+ * Adding a timer moves it over to the wheel of the calling CPU,
+ * which needs the lock of the wheel it was last queued on as well.
+ * The two locks are always taken in address order. Must be called
+ * with irqs off; returns the old wheel, unlock it with
+ * unlock_old_base() before dropping the lock of the new one.
+ */
+static struct timer_base *lock_timer_bases(struct timer_list *timer,
+					   struct timer_base *new_base)
+{
+	struct timer_base *old_base;
+
+	for (;;) {
+		old_base = timer->base;
+		if (!old_base || old_base == new_base) {
+			spin_lock(&new_base->lock);
+			if (timer->base == old_base)
+				return old_base;
+			spin_unlock(&new_base->lock);
+			continue;
+		}
+		if (old_base < new_base) {
+			spin_lock(&old_base->lock);
+			spin_lock(&new_base->lock);
+		} else {
+			spin_lock(&new_base->lock);
+			spin_lock(&old_base->lock);
+		}
+		if (timer->base == old_base)
+			return old_base;
+		spin_unlock(&new_base->lock);
+		spin_unlock(&old_base->lock);
+	}
+}
+
+static inline void unlock_old_base(struct timer_base *old_base,
+				   struct timer_base *new_base)
+{
+	if (old_base && old_base != new_base)
+		spin_unlock(&old_base->lock);
+}
+
 void add_timer(struct timer_list *timer)
 {
+	struct timer_base *old_base, *new_base;
 	unsigned long flags;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
+	local_irq_save(flags);
+	new_base = timer_bases + smp_processor_id();
+	old_base = lock_timer_bases(timer, new_base);
 	if (timer_pending(timer))
 		goto bug;
-	internal_add_timer(timer);
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	internal_add_timer(new_base, timer);
+	unlock_old_base(old_base, new_base);
+	spin_unlock_irqrestore(&new_base->lock, flags);
 	return;
 bug:
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	unlock_old_base(old_base, new_base);
+	spin_unlock_irqrestore(&new_base->lock, flags);
 	printk("bug: kernel timer added twice at %p.\n",
 			__builtin_return_address(0));
 }
@@ -199,29 +305,50 @@ static inline int detach_timer (struct timer_list *timer)
 
 int mod_timer(struct timer_list *timer, unsigned long expires)
 {
-	int ret;
+	struct timer_base *old_base, *new_base;
 	unsigned long flags;
+	int ret;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
+	local_irq_save(flags);
+	new_base = timer_bases + smp_processor_id();
+	old_base = lock_timer_bases(timer, new_base);
 	timer->expires = expires;
 	ret = detach_timer(timer);
-	internal_add_timer(timer);
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	internal_add_timer(new_base, timer);
+	unlock_old_base(old_base, new_base);
+	spin_unlock_irqrestore(&new_base->lock, flags);
 	return ret;
 }
 
 int del_timer(struct timer_list * timer)
 {
-	int ret;
+	struct timer_base *base;
 	unsigned long flags;
+	int ret;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
+	base = lock_timer_base(timer, &flags);
+	if (!base) {
+		timer->list.next = timer->list.prev = NULL;
+		return 0;
+	}
 	ret = detach_timer(timer);
 	timer->list.next = timer->list.prev = NULL;
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	spin_unlock_irqrestore(&base->lock, flags);
 	return ret;
 }
 
+/*
+ * Called from the oops path: the console unblank code takes the
+ * timer locks, and this CPU may already have been holding one.
+ */
+void bust_timer_locks(void)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		spin_lock_init(&timer_bases[cpu].lock);
+}
+
 #ifdef CONFIG_SMP
 void sync_timers(void)
 {
@@ -241,16 +368,8 @@ int del_timer_sync(struct timer_list * timer)
 	int ret = 0;
 
 	for (;;) {
-		unsigned long flags;
-		int running;
-
-		spin_lock_irqsave(&timerlist_lock, flags);
-		ret += detach_timer(timer);
-		timer->list.next = timer->list.prev = 0;
-		running = timer_is_running(timer);
-		spin_unlock_irqrestore(&timerlist_lock, flags);
-
-		if (!running)
+		ret += del_timer(timer);
+		if (!timer_is_running(timer))
 			break;
 
 		timer_synchronize(timer);
@@ -261,7 +380,7 @@ int del_timer_sync(struct timer_list * timer)
 #endif
 
 
-static inline void cascade_timers(struct timer_vec *tv)
+static inline void cascade_timers(struct timer_base *base, struct timer_vec *tv)
 {
 	/* cascade all the timers from tv up one level */
 	struct list_head *head, *curr, *next;
@@ -278,26 +397,26 @@ static inline void cascade_timers(struct timer_vec *tv)
 		tmp = list_entry(curr, struct timer_list, list);
 		next = curr->next;
 		list_del(curr); // not needed
-		internal_add_timer(tmp);
+		internal_add_timer(base, tmp);
 		curr = next;
 	}
 	INIT_LIST_HEAD(head);
 	tv->index = (tv->index + 1) & TVN_MASK;
 }
 
-static inline void run_timer_list(void)
+static inline void run_timer_list(struct timer_base *base)
 {
-	spin_lock_irq(&timerlist_lock);
-	while ((long)(jiffies - timer_jiffies) >= 0) {
+	spin_lock_irq(&base->lock);
+	while ((long)(jiffies - base->timer_jiffies) >= 0) {
 		struct list_head *head, *curr;
-		if (!tv1.index) {
+		if (!base->tv1.index) {
 			int n = 1;
 			do {
-				cascade_timers(tvecs[n]);
-			} while (tvecs[n]->index == 1 && ++n < NOOF_TVECS);
+				cascade_timers(base, base->tvecs[n]);
+			} while (base->tvecs[n]->index == 1 && ++n < NOOF_TVECS);
 		}
 repeat:
-		head = tv1.vec + tv1.index;
+		head = base->tv1.vec + base->tv1.index;
 		curr = head->next;
 		if (curr != head) {
 			struct timer_list *timer;
@@ -310,17 +429,52 @@ repeat:
 
 			detach_timer(timer);
 			timer->list.next = timer->list.prev = NULL;
-			timer_enter(timer);
-			spin_unlock_irq(&timerlist_lock);
+			timer_enter(base, timer);
+			spin_unlock_irq(&base->lock);
 			fn(data);
-			spin_lock_irq(&timerlist_lock);
-			timer_exit();
+			spin_lock_irq(&base->lock);
+			timer_exit(base);
 			goto repeat;
 		}
-		++timer_jiffies; 
-		tv1.index = (tv1.index + 1) & TVR_MASK;
+		++base->timer_jiffies; 
+		base->tv1.index = (base->tv1.index + 1) & TVR_MASK;
 	}
-	spin_unlock_irq(&timerlist_lock);
+	spin_unlock_irq(&base->lock);
+}
+
+/*
+ * Raised on every CPU from its local timer tick, see
+ * update_process_times().
+ *
+ * Timer handlers have always run from TIMER_BH and a good many of
+ * them rely on being serialised against each other and against the
+ * other bottom halves, so they still run under global_bh_lock, the
+ * way bh_action() runs a BH. Only adding and deleting timers is
+ * per-CPU.
+ */
+static void run_timer_softirq(struct softirq_action *h)
+{
+	int cpu = smp_processor_id();
+	struct timer_base *base = timer_bases + cpu;
+
+	if ((long)(jiffies - base->timer_jiffies) < 0)
+		return;
+
+	if (!spin_trylock(&global_bh_lock))
+		goto resched;
+	if (!hardirq_trylock(cpu))
+		goto resched_unlock;
+
+	run_timer_list(base);
+
+	hardirq_endlock(cpu);
+	spin_unlock(&global_bh_lock);
+	return;
+
+resched_unlock:
+	spin_unlock(&global_bh_lock);
+resched:
+	raise_softirq(TIMER_SOFTIRQ);
 }
 
 spinlock_t tqueue_lock = SPIN_LOCK_UNLOCKED;
@@ -582,11 +736,10 @@ void update_process_times(int user_tick)
 	int cpu = smp_processor_id(), system = user_tick ^ 1;
 
 	update_one_process(p, user_tick, system, cpu);
+	scheduler_tick(p);
+	hrtimer_run_queues();
+	raise_softirq(TIMER_SOFTIRQ);
 	if (p->pid) {
-		if (--p->counter <= 0) {
-			p->counter = 0;
-			p->need_resched = 1;
-		}
 		if (p->nice > 0)
 			kstat.per_cpu_nice[cpu] += user_tick;
 		else
@@ -645,6 +798,15 @@ unsigned long wall_jiffies;
  */
 rwlock_t xtime_lock = RW_LOCK_UNLOCKED;
 
+/*
+ * Bumped around every update of xtime, wall_jiffies and whatever the
+ * architecture interpolates from between ticks, always with
+ * xtime_lock held for writing and interrupts off. Readers that can
+ * cope with retrying use it instead of read_lock(&xtime_lock), so a
+ * gettimeofday() never dirties a shared cache line.
+ */
+seqcount_t xtime_seq = SEQCNT_ZERO;
+
 static inline void update_times(void)
 {
 	unsigned long ticks;
@@ -655,12 +817,14 @@ static inline void update_times(void)
 	 * need to save/restore the flags of the local CPU here. -arca
 	 */
 	write_lock_irq(&xtime_lock);
+	write_seqcount_begin(&xtime_seq);
 
 	ticks = jiffies - wall_jiffies;
 	if (ticks) {
 		wall_jiffies += ticks;
 		update_wall_time(ticks);
 	}
+	write_seqcount_end(&xtime_seq);
 	write_unlock_irq(&xtime_lock);
 	calc_load(ticks);
 }
@@ -668,7 +832,6 @@ static inline void update_times(void)
 void timer_bh(void)
 {
 	update_times();
-	run_timer_list();
 }
 
 void do_timer(struct pt_regs *regs)
@@ -797,7 +960,6 @@ asmlinkage long sys_getegid(void)
 asmlinkage long sys_nanosleep(struct timespec *rqtp, struct timespec *rmtp)
 {
 	struct timespec t;
-	unsigned long expire;
 
 	if(copy_from_user(&t, rqtp, sizeof(struct timespec)))
 		return -EFAULT;
@@ -805,7 +967,7 @@ asmlinkage long sys_nanosleep(struct timespec *rqtp, struct timespec *rmtp)
 	if (t.tv_nsec >= 1000000000L || t.tv_nsec < 0 || t.tv_sec < 0)
 		return -EINVAL;
 
-
+#ifndef CONFIG_HIGH_RES_TIMERS
 	if (t.tv_sec == 0 && t.tv_nsec <= 2000000L &&
 	    current->policy != SCHED_OTHER)
 	{
@@ -818,15 +980,11 @@ asmlinkage long sys_nanosleep(struct timespec *rqtp, struct timespec *rmtp)
 		udelay((t.tv_nsec + 999) / 1000);
 		return 0;
 	}
-
-	expire = timespec_to_jiffies(&t) + (t.tv_sec || t.tv_nsec);
+#endif
 
 	current->state = TASK_INTERRUPTIBLE;
-	expire = schedule_timeout(expire);
-
-	if (expire) {
+	if (schedule_hrtimeout(&t)) {
 		if (rmtp) {
-			jiffies_to_timespec(expire, &t);
 			if (copy_to_user(rmtp, &t, sizeof(struct timespec)))
 				return -EFAULT;
 		}
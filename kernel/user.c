@@ -11,21 +11,116 @@
 #include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/smp.h>
 
 /*
  * UID task count cache, to get fast user lookup in "alloc_uid"
- * when changing user ID's (ie setuid() and friends).
+ * when changing user ID's (ie setuid() and friends).  It is sized
+ * by the amount of memory at boot, between 256 and 16k chains.
  */
-#define UIDHASH_BITS		8
-#define UIDHASH_SZ		(1 << UIDHASH_BITS)
+static unsigned int uidhash_bits;
+#define UIDHASH_SZ		(1 << uidhash_bits)
 #define UIDHASH_MASK		(UIDHASH_SZ - 1)
-#define __uidhashfn(uid)	(((uid >> UIDHASH_BITS) ^ uid) & UIDHASH_MASK)
+#define __uidhashfn(uid)	(((uid >> uidhash_bits) ^ uid) & UIDHASH_MASK)
 #define uidhashentry(uid)	(uidhash_table + __uidhashfn(uid))
 
 static kmem_cache_t *uid_cachep;
-static struct user_struct *uidhash_table[UIDHASH_SZ];
+static struct user_struct **uidhash_table;
 static spinlock_t uidhash_lock = SPIN_LOCK_UNLOCKED;
 
+/*
+ * Process counts.  fork() and exit() do not touch the user's counter
+ * but a small direct mapped cache of per-user deltas on their CPU,
+ * which is only folded into user->processes when a delta gets larger
+ * than UID_PROC_BATCH or the slot is wanted for another user.  So the
+ * exact count is user->processes plus what the CPUs hold for it, which
+ * only has to be added up when a fork comes close to RLIMIT_NPROC.
+ *
+ * A slot only ever points to a user that somebody holds a reference
+ * to: free_uid() clears the slots of a user before it is freed.
+ */
+#define UID_PROC_SLOTS		8	/* per CPU, a power of 2 */
+#define UID_PROC_BATCH		16
+
+struct uid_proc_slot {
+	struct user_struct *user;
+	int delta;
+};
+
+static struct uid_proc_cache {
+	spinlock_t lock;
+	struct uid_proc_slot slot[UID_PROC_SLOTS];
+} uid_proc_cache[NR_CPUS] __cacheline_aligned =
+	{ [0 ... NR_CPUS-1] = { lock: SPIN_LOCK_UNLOCKED } };
+
+static inline struct uid_proc_slot *uid_proc_slot(int cpu, struct user_struct *up)
+{
+	unsigned long h = (unsigned long) up / L1_CACHE_BYTES;
+
+	return uid_proc_cache[cpu].slot + ((h ^ (h >> 8)) & (UID_PROC_SLOTS - 1));
+}
+
+void user_processes_add(struct user_struct *up, int n)
+{
+	int cpu = smp_processor_id();
+	struct uid_proc_slot *s = uid_proc_slot(cpu, up);
+
+	spin_lock(&uid_proc_cache[cpu].lock);
+	if (s->user != up) {
+		if (s->user)
+			atomic_add(s->delta, &s->user->processes);
+		s->user = up;
+		s->delta = 0;
+	}
+	s->delta += n;
+	if (s->delta > UID_PROC_BATCH || s->delta < -UID_PROC_BATCH) {
+		atomic_add(s->delta, &up->processes);
+		s->delta = 0;
+	}
+	spin_unlock(&uid_proc_cache[cpu].lock);
+}
+
+/*
+ * Does the user have @limit processes or more?  Nothing needs adding
+ * up unless the count could be within reach of the limit.
+ */
+int user_processes_over(struct user_struct *up, unsigned long limit)
+{
+	struct uid_proc_slot *s;
+	long count = atomic_read(&up->processes);
+	int cpu;
+
+	if (limit == RLIM_INFINITY || limit > INT_MAX)
+		return 0;
+	if (count + smp_num_cpus * UID_PROC_BATCH < (long) limit)
+		return 0;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		s = uid_proc_slot(cpu, up);
+		spin_lock(&uid_proc_cache[cpu].lock);
+		if (s->user == up)
+			count += s->delta;
+		spin_unlock(&uid_proc_cache[cpu].lock);
+	}
+	return count >= (long) limit;
+}
+
+/* Called with the uidhash lock held, for a user nobody refers to */
+static void uid_proc_flush(struct user_struct *up)
+{
+	struct uid_proc_slot *s;
+	int cpu;
+
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		s = uid_proc_slot(cpu, up);
+		spin_lock(&uid_proc_cache[cpu].lock);
+		if (s->user == up)
+			s->user = NULL;
+		spin_unlock(&uid_proc_cache[cpu].lock);
+	}
+}
+
 struct user_struct root_user = {
 	__count:	ATOMIC_INIT(1),
 	processes:	ATOMIC_INIT(1),
@@ -77,6 +172,7 @@ void free_uid(struct user_struct *up)
 {
 	if (up && atomic_dec_and_lock(&up->__count, &uidhash_lock)) {
 		uid_hash_remove(up);
+		uid_proc_flush(up);
 		kmem_cache_free(uid_cachep, up);
 		spin_unlock(&uidhash_lock);
 	}
@@ -123,6 +219,21 @@ struct user_struct * alloc_uid(uid_t uid)
 
 static int __init uid_cache_init(void)
 {
+	unsigned long size;
+	int order;
+
+	/* One chain per 128 pages of memory */
+	for (uidhash_bits = 8; uidhash_bits < 14; uidhash_bits++)
+		if ((num_physpages >> 7) <= (1UL << uidhash_bits))
+			break;
+	size = UIDHASH_SZ * sizeof(struct user_struct *);
+	for (order = 0; (PAGE_SIZE << order) < size; order++)
+		;
+	uidhash_table = (struct user_struct **) __get_free_pages(GFP_KERNEL, order);
+	if (!uidhash_table)
+		panic("Cannot allocate the uid hash table\n");
+	memset(uidhash_table, 0, size);
+
 	uid_cachep = kmem_cache_create("uid_cache", sizeof(struct user_struct),
 				       0,
 				       SLAB_HWCACHE_ALIGN, NULL, NULL);
@@ -0,0 +1,434 @@
+/*
+ * linux/kernel/workqueue.c
+ *
+ * Worker threads for work that has to be done in process context.
+ *
+ * A workqueue has one thread per CPU, and work is run by the thread of
+ * the CPU that queued it, so work queued from an interrupt runs where
+ * its data is cache hot.  A subsystem whose work can sleep for a long
+ * time creates its own queue, so that it does not hold up anyone else;
+ * the rest share keventd, which is just another workqueue.
+ *
+ * schedule_task() and flush_scheduled_tasks() are kept for tq_struct
+ * users and queue on keventd.
+ *
+ * Based on kernel/context.c:
+ *	dwmw2@redhat.com:		Genesis
+ *	andrewm@uow.edu.au:		2.4.0-test12
+ */
+
+#define __KERNEL_SYSCALLS__
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/init.h>
+#include <linux/unistd.h>
+#include <linux/signal.h>
+#include <linux/slab.h>
+#include <linux/stddef.h>
+#include <linux/workqueue.h>
+
+/*
+ * Work is added at insert_sequence and done at remove_sequence, so a
+ * flush only has to wait for what was there when it started.
+ */
+struct cpu_workqueue_struct {
+	spinlock_t		lock;
+	long			remove_sequence;
+	long			insert_sequence;
+	struct list_head	worklist;
+	wait_queue_head_t	more_work;
+	wait_queue_head_t	work_done;
+	struct workqueue_struct	*wq;
+	struct task_struct	*thread;
+	int			run_depth;	/* flushes from work functions */
+	int			exit;
+} ____cacheline_aligned;
+
+struct workqueue_struct {
+	struct cpu_workqueue_struct	cpu_wq[NR_CPUS];
+	const char			*name;
+};
+
+/*
+ * The work_struct may be a tq_struct from schedule_task(): nothing past
+ * ->data may be touched here.
+ */
+static void __queue_work(struct cpu_workqueue_struct *cwq,
+			 struct work_struct *work)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cwq->lock, flags);
+	list_add_tail(&work->entry, &cwq->worklist);
+	cwq->insert_sequence++;
+	wake_up(&cwq->more_work);
+	spin_unlock_irqrestore(&cwq->lock, flags);
+}
+
+/**
+ * queue_work - queue work on a workqueue
+ * @wq: the workqueue
+ * @work: the work, set up with INIT_WORK() or DECLARE_WORK()
+ *
+ * May be called from interrupt context.  The work is run by the worker
+ * thread of the current CPU.  Returns zero if @work was already queued,
+ * non-zero otherwise.
+ */
+int queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	int ret = 0;
+
+	if (!test_and_set_bit(0, &work->pending)) {
+		__queue_work(wq->cpu_wq + smp_processor_id(), work);
+		ret = 1;
+	}
+	return ret;
+}
+
+/* Timers run on the CPU that added them, so this stays there too */
+static void delayed_work_timer_fn(unsigned long __data)
+{
+	struct work_struct *work = (struct work_struct *) __data;
+	struct workqueue_struct *wq = work->wq_data;
+
+	__queue_work(wq->cpu_wq + smp_processor_id(), work);
+}
+
+/**
+ * queue_delayed_work - queue work on a workqueue after a delay
+ * @wq: the workqueue
+ * @work: the work
+ * @delay: number of jiffies to wait
+ *
+ * As queue_work(), but the work is queued when @delay has passed.  The
+ * work counts as pending from now on.
+ */
+int queue_delayed_work(struct workqueue_struct *wq, struct work_struct *work,
+		       unsigned long delay)
+{
+	struct timer_list *timer = &work->timer;
+	int ret = 0;
+
+	if (!test_and_set_bit(0, &work->pending)) {
+		if (timer_pending(timer))
+			BUG();
+		work->wq_data = wq;
+		timer->expires = jiffies + delay;
+		timer->data = (unsigned long) work;
+		timer->function = delayed_work_timer_fn;
+		add_timer(timer);
+		ret = 1;
+	}
+	return ret;
+}
+
+static void run_workqueue(struct cpu_workqueue_struct *cwq)
+{
+	struct work_struct *work;
+	void (*f)(void *);
+	void *data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cwq->lock, flags);
+	if (++cwq->run_depth > 3)
+		printk(KERN_ERR "%s: recursion depth %d in flush_workqueue()\n",
+		       cwq->wq->name, cwq->run_depth);
+	while (!list_empty(&cwq->worklist)) {
+		work = list_entry(cwq->worklist.next, struct work_struct, entry);
+		f = work->func;
+		data = work->data;
+		list_del_init(&work->entry);
+		spin_unlock_irqrestore(&cwq->lock, flags);
+
+		/* From here on it may be queued again, or freed */
+		wmb();
+		clear_bit(0, &work->pending);
+		if (f)
+			f(data);
+
+		spin_lock_irqsave(&cwq->lock, flags);
+		cwq->remove_sequence++;
+		wake_up(&cwq->work_done);
+	}
+	cwq->run_depth--;
+	spin_unlock_irqrestore(&cwq->lock, flags);
+}
+
+static int worker_thread(void *__cwq)
+{
+	struct cpu_workqueue_struct *cwq = __cwq;
+	int cpu = cwq - cwq->wq->cpu_wq;
+	DECLARE_WAITQUEUE(wait, current);
+	struct k_sigaction sa;
+
+	daemonize();
+	sprintf(current->comm, "%s/%d", cwq->wq->name, cpu_number_map(cpu));
+
+	/* keventd starts the call_usermodehelper() children, and reaps them */
+	spin_lock_irq(&current->sigmask_lock);
+	siginitsetinv(&current->blocked, sigmask(SIGCHLD));
+	recalc_sigpending(current);
+	spin_unlock_irq(&current->sigmask_lock);
+
+	/* Install a handler so SIGCLD is delivered */
+	sa.sa.sa_handler = SIG_IGN;
+	sa.sa.sa_flags = 0;
+	siginitset(&sa.sa.sa_mask, sigmask(SIGCHLD));
+	do_sigaction(SIGCHLD, &sa, (struct k_sigaction *)0);
+
+	/* Migrate to the right CPU */
+	set_cpus_allowed(current, 1UL << cpu);
+	while (smp_processor_id() != cpu)
+		schedule();
+
+	cwq->thread = current;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		add_wait_queue(&cwq->more_work, &wait);
+		if (list_empty(&cwq->worklist) && !cwq->exit)
+			schedule();
+		else
+			__set_current_state(TASK_RUNNING);
+		remove_wait_queue(&cwq->more_work, &wait);
+
+		if (!list_empty(&cwq->worklist))
+			run_workqueue(cwq);
+		if (signal_pending(current)) {
+			while (waitpid(-1, (unsigned int *)0, __WALL|WNOHANG) > 0)
+				;
+			flush_signals(current);
+			recalc_sigpending(current);
+		}
+		if (cwq->exit && list_empty(&cwq->worklist))
+			break;
+	}
+
+	/* destroy_workqueue() frees cwq once it sees this */
+	mb();
+	cwq->thread = NULL;
+	return 0;
+}
+
+/**
+ * flush_workqueue - wait for queued work to complete
+ * @wq: the workqueue
+ *
+ * Blocks until all work that was queued on @wq when it was called has
+ * run.  Work queued later, and delayed work whose timer has not fired
+ * yet, is not waited for.  Called from one of @wq's own work functions
+ * it runs the rest of that CPU's queue itself.
+ *
+ * The caller should hold no spinlocks and should hold no semaphores
+ * which could cause the queued work to block.
+ */
+void flush_workqueue(struct workqueue_struct *wq)
+{
+	struct cpu_workqueue_struct *cwq;
+	DECLARE_WAITQUEUE(wait, current);
+	long sequence_needed;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cwq = wq->cpu_wq + cpu_logical_map(i);
+
+		if (cwq->thread == current) {
+			run_workqueue(cwq);
+			continue;
+		}
+
+		spin_lock_irq(&cwq->lock);
+		sequence_needed = cwq->insert_sequence;
+		add_wait_queue(&cwq->work_done, &wait);
+		while (sequence_needed - cwq->remove_sequence > 0) {
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			spin_unlock_irq(&cwq->lock);
+			schedule();
+			spin_lock_irq(&cwq->lock);
+		}
+		remove_wait_queue(&cwq->work_done, &wait);
+		__set_current_state(TASK_RUNNING);
+		spin_unlock_irq(&cwq->lock);
+	}
+}
+
+static void stop_workqueue_threads(struct workqueue_struct *wq)
+{
+	struct cpu_workqueue_struct *cwq;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cwq = wq->cpu_wq + cpu_logical_map(i);
+		if (!cwq->thread)
+			continue;
+		spin_lock_irq(&cwq->lock);
+		cwq->exit = 1;
+		wake_up(&cwq->more_work);
+		spin_unlock_irq(&cwq->lock);
+		while (cwq->thread) {
+			current->policy |= SCHED_YIELD;
+			schedule();
+		}
+	}
+}
+
+/**
+ * create_workqueue - create a workqueue and its worker threads
+ * @name: name of the threads, at most 10 characters
+ *
+ * The threads are called "@name/N", N being the CPU they run on.
+ * Returns NULL if out of memory or processes.  Must be called from
+ * process context.
+ */
+struct workqueue_struct *create_workqueue(const char *name)
+{
+	struct workqueue_struct *wq;
+	struct cpu_workqueue_struct *cwq;
+	int i;
+
+	wq = kmalloc(sizeof(*wq), GFP_KERNEL);
+	if (!wq)
+		return NULL;
+	memset(wq, 0, sizeof(*wq));
+	wq->name = name;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cwq = wq->cpu_wq + cpu_logical_map(i);
+		spin_lock_init(&cwq->lock);
+		INIT_LIST_HEAD(&cwq->worklist);
+		init_waitqueue_head(&cwq->more_work);
+		init_waitqueue_head(&cwq->work_done);
+		cwq->wq = wq;
+
+		if (kernel_thread(worker_thread, cwq,
+				  CLONE_FS | CLONE_FILES | CLONE_SIGHAND) < 0) {
+			printk(KERN_ERR "create_workqueue(%s) failed for cpu %d\n",
+			       name, i);
+			stop_workqueue_threads(wq);
+			kfree(wq);
+			return NULL;
+		}
+		while (!cwq->thread) {
+			current->policy |= SCHED_YIELD;
+			schedule();
+		}
+	}
+	return wq;
+}
+
+/**
+ * destroy_workqueue - run the queued work and stop the worker threads
+ * @wq: the workqueue
+ *
+ * Delayed work must have been cancelled first.
+ */
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	flush_workqueue(wq);
+	stop_workqueue_threads(wq);
+	kfree(wq);
+}
+
+static struct workqueue_struct *keventd_wq;
+
+static int need_keventd(const char *who)
+{
+	if (!keventd_wq)
+		printk(KERN_ERR "%s(): keventd has not started\n", who);
+	return keventd_wq != NULL;
+}
+
+int current_is_keventd(void)
+{
+	int i;
+
+	if (!need_keventd(__FUNCTION__))
+		return 0;
+	for (i = 0; i < smp_num_cpus; i++)
+		if (keventd_wq->cpu_wq[cpu_logical_map(i)].thread == current)
+			return 1;
+	return 0;
+}
+
+/**
+ * schedule_work - queue work on keventd
+ * @work: the work
+ *
+ * If it can sleep, the work function should do so for the minimum
+ * possible time, as it stalls all other work on keventd for its CPU.
+ * Work that sleeps for long belongs on its own workqueue.
+ */
+int schedule_work(struct work_struct *work)
+{
+	if (!need_keventd(__FUNCTION__))
+		return 0;
+	return queue_work(keventd_wq, work);
+}
+
+int schedule_delayed_work(struct work_struct *work, unsigned long delay)
+{
+	if (!need_keventd(__FUNCTION__))
+		return 0;
+	return queue_delayed_work(keventd_wq, work, delay);
+}
+
+void flush_scheduled_work(void)
+{
+	if (need_keventd(__FUNCTION__))
+		flush_workqueue(keventd_wq);
+}
+
+/**
+ * schedule_task - schedule a function for subsequent execution in process context.
+ * @task: pointer to a &tq_struct which defines the function to be scheduled.
+ *
+ * May be called from interrupt context.  The scheduled function is run
+ * by keventd, as schedule_work() runs a work_struct.
+ *
+ * schedule_task() returns non-zero if the task was successfully scheduled.
+ * If @task is already residing on a task queue then schedule_task() fails
+ * to schedule your task and returns zero.
+ */
+int schedule_task(struct tq_struct *task)
+{
+	return schedule_work((struct work_struct *) task);
+}
+
+/**
+ * flush_scheduled_tasks - ensure that any scheduled tasks have run to completion.
+ *
+ * Blocks until everything queued on keventd with schedule_task() or
+ * schedule_work() has run.  This is typically used in driver shutdown
+ * handlers; the rules of flush_workqueue() apply.
+ */
+void flush_scheduled_tasks(void)
+{
+	flush_scheduled_work();
+}
+
+void __init init_workqueues(void)
+{
+	/* schedule_task() hands tq_structs to the work_struct code */
+	if (offsetof(struct work_struct, entry) != offsetof(struct tq_struct, list) ||
+	    offsetof(struct work_struct, pending) != offsetof(struct tq_struct, sync) ||
+	    offsetof(struct work_struct, func) != offsetof(struct tq_struct, routine) ||
+	    offsetof(struct work_struct, data) != offsetof(struct tq_struct, data))
+		BUG();
+
+	keventd_wq = create_workqueue("keventd");
+	if (!keventd_wq)
+		panic("init_workqueues: cannot start keventd");
+}
+
+EXPORT_SYMBOL(create_workqueue);
+EXPORT_SYMBOL(destroy_workqueue);
+EXPORT_SYMBOL(queue_work);
+EXPORT_SYMBOL(queue_delayed_work);
+EXPORT_SYMBOL(flush_workqueue);
+EXPORT_SYMBOL(schedule_work);
+EXPORT_SYMBOL(schedule_delayed_work);
+EXPORT_SYMBOL(flush_scheduled_work);
+EXPORT_SYMBOL(schedule_task);
+EXPORT_SYMBOL(flush_scheduled_tasks);
@@ -225,6 +225,16 @@ STATIC const ush mask_bits[] = {
 #define NEEDBITS(n) {while(k<(n)){b|=((ulg)NEXTBYTE())<<k;k+=8;}}
 #define DUMPBITS(n) {b>>=(n);k-=(n);}
 
+/* FILLBITS tops the bit buffer up to a full ulg straight out of inbuf
+   when there is that much input left in it, instead of going through
+   get_byte() for every byte.  It never calls fill_inbuf(), so all the
+   lookahead it takes comes from the current buffer and the "undo too
+   much lookahead" step in inflate() still works.  The NEEDBITS that
+   follow it are then almost always no-ops. */
+#define BB_BITS     (8 * sizeof(ulg))
+#define FILLBITS()  {if(inptr+sizeof(ulg)<=insize)\
+                       while(k<=BB_BITS-8){b|=((ulg)inbuf[inptr++])<<k;k+=8;}}
+
 
 /*
    Huffman code decoding is performed using a multi-level table lookup.
@@ -256,11 +266,22 @@ STATIC const ush mask_bits[] = {
    about one bit more than those, so lbits is 8+1 and dbits is 5+1.
    The optimum values may differ though from machine to machine, and
    possibly even between compilers.  Your mileage may vary.
+
+   Bigger first level tables mean fewer lookups in the subtables, at
+   the cost of memory.  The boot decompressors only have a few K of
+   heap, so they get the defaults; an includer with a real malloc()
+   can define INFLATE_LBITS and INFLATE_DBITS to something larger.
  */
 
+#ifndef INFLATE_LBITS
+#define INFLATE_LBITS 9
+#endif
+#ifndef INFLATE_DBITS
+#define INFLATE_DBITS 6
+#endif
 
-STATIC const int lbits = 9;          /* bits in base literal/length lookup table */
-STATIC const int dbits = 6;          /* bits in base distance lookup table */
+STATIC const int lbits = INFLATE_LBITS; /* bits in base literal/length lookup table */
+STATIC const int dbits = INFLATE_DBITS; /* bits in base distance lookup table */
 
 
 /* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
@@ -535,6 +556,7 @@ int bl, bd;             /* number of bits decoded by tl[] and td[] */
   md = mask_bits[bd];
   for (;;)                      /* do until end of block */
   {
+    FILLBITS()
     NEEDBITS((unsigned)bl)
     if ((e = (t = tl + ((unsigned)b & ml))->e) > 16)
       do {
@@ -549,6 +571,14 @@ int bl, bd;             /* number of bits decoded by tl[] and td[] */
     {
       slide[w++] = (uch)t->v.n;
       Tracevv((stderr, "%c", slide[w-1]));
+      /* literals come in runs, and if the next one is a short code
+         that is already in the bit buffer, take it right away */
+      if (w < WSIZE && (t = tl + ((unsigned)b & ml))->e == 16 && t->b <= k)
+      {
+        DUMPBITS(t->b)
+        slide[w++] = (uch)t->v.n;
+        Tracevv((stderr, "%c", slide[w-1]));
+      }
       if (w == WSIZE)
       {
         flush_output(w);
@@ -567,6 +597,7 @@ int bl, bd;             /* number of bits decoded by tl[] and td[] */
       DUMPBITS(e);
 
       /* decode distance of block to copy */
+      FILLBITS()
       NEEDBITS((unsigned)bd)
       if ((e = (t = td + ((unsigned)b & md))->e) > 16)
         do {
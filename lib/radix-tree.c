@@ -0,0 +1,375 @@
+/*
+ * linux/lib/radix-tree.c
+ *
+ * Radix trees, see linux/radix-tree.h.
+ *
+ * The nodes come from their own slab cache. A node is kept as long as
+ * one of its slots is in use; deleting the last entry of a node frees
+ * it and, if that empties its parent, the parent as well.
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file COPYING for more details.
+ */
+
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/radix-tree.h>
+#include <linux/cache.h>
+#include <linux/smp.h>
+
+#include <asm/hardirq.h>
+
+#define RADIX_TREE_MAP_SHIFT	6
+#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
+
+#define RADIX_TREE_INDEX_BITS	(8 * sizeof(unsigned long))
+#define RADIX_TREE_MAX_PATH	((RADIX_TREE_INDEX_BITS + RADIX_TREE_MAP_SHIFT - 1) \
+				 / RADIX_TREE_MAP_SHIFT)
+
+struct radix_tree_node {
+	unsigned int	count;		/* slots in use */
+	void		*slots[RADIX_TREE_MAP_SIZE];
+};
+
+struct radix_tree_path {
+	struct radix_tree_node *node;
+	void **slot;
+};
+
+static kmem_cache_t *radix_tree_node_cachep;
+
+/*
+ * The per-CPU reserve filled by radix_tree_preload(). One insertion
+ * needs at most one new node per level.
+ */
+struct radix_tree_preload {
+	int nr;
+	struct radix_tree_node *nodes[RADIX_TREE_MAX_PATH];
+} ____cacheline_aligned;
+
+static struct radix_tree_preload radix_tree_preloads[NR_CPUS];
+
+static struct radix_tree_node *radix_tree_node_alloc(void)
+{
+	if (!in_interrupt()) {
+		struct radix_tree_preload *rtp = &radix_tree_preloads[smp_processor_id()];
+
+		if (rtp->nr)
+			return rtp->nodes[--rtp->nr];
+	}
+	return kmem_cache_alloc(radix_tree_node_cachep, SLAB_ATOMIC);
+}
+
+/* The node is empty again, which is what the constructor left it as. */
+static inline void radix_tree_node_free(struct radix_tree_node *node)
+{
+	kmem_cache_free(radix_tree_node_cachep, node);
+}
+
+/**
+ * radix_tree_preload - make sure the next insertion won't need memory
+ * @gfp_mask: how to allocate the nodes
+ *
+ * Does nothing for a mask that can't sleep, those callers have to live
+ * with atomic allocations. Returns -ENOMEM if the reserve could not be
+ * filled.
+ */
+int radix_tree_preload(int gfp_mask)
+{
+	struct radix_tree_preload *rtp;
+	struct radix_tree_node *node;
+
+	if (!(gfp_mask & __GFP_WAIT))
+		return 0;
+
+	rtp = &radix_tree_preloads[smp_processor_id()];
+	while (rtp->nr < RADIX_TREE_MAX_PATH) {
+		node = kmem_cache_alloc(radix_tree_node_cachep,
+					gfp_mask & SLAB_LEVEL_MASK);
+		if (!node)
+			return -ENOMEM;
+		/* We may have slept and come back on another CPU. */
+		rtp = &radix_tree_preloads[smp_processor_id()];
+		if (rtp->nr < RADIX_TREE_MAX_PATH)
+			rtp->nodes[rtp->nr++] = node;
+		else
+			radix_tree_node_free(node);
+	}
+	return 0;
+}
+
+static inline unsigned long radix_tree_maxindex(unsigned int height)
+{
+	unsigned int shift = height * RADIX_TREE_MAP_SHIFT;
+
+	if (shift >= RADIX_TREE_INDEX_BITS)
+		return ~0UL;
+	return (1UL << shift) - 1;
+}
+
+/* Add levels on top until index fits. */
+static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_node *node;
+	unsigned int height;
+
+	height = root->height ? root->height : 1;
+	while (index > radix_tree_maxindex(height))
+		height++;
+
+	if (!root->rnode) {
+		root->height = height;
+		return 0;
+	}
+
+	do {
+		node = radix_tree_node_alloc();
+		if (!node)
+			return -ENOMEM;
+		node->slots[0] = root->rnode;
+		node->count = 1;
+		root->rnode = node;
+		root->height++;
+	} while (height > root->height);
+	return 0;
+}
+
+/**
+ * radix_tree_insert - insert an item into the tree
+ * @root: the tree
+ * @index: where to put it
+ * @item: what to put there, must not be NULL
+ *
+ * Returns -EEXIST if the slot is taken and -ENOMEM if a node could
+ * not be allocated.
+ */
+int radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+		      void *item)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH + 1], *pathp = path;
+	unsigned int height, shift;
+	int error;
+
+	if (!root->height || index > radix_tree_maxindex(root->height)) {
+		error = radix_tree_extend(root, index);
+		if (error)
+			return error;
+	}
+
+	height = root->height;
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	pathp->node = NULL;
+	pathp->slot = (void **) &root->rnode;
+	while (height > 0) {
+		if (!*pathp->slot) {
+			*pathp->slot = radix_tree_node_alloc();
+			if (!*pathp->slot)
+				goto nomem;
+			if (pathp->node)
+				pathp->node->count++;
+		}
+		pathp[1].node = *pathp->slot;
+		pathp[1].slot = pathp[1].node->slots +
+			((index >> shift) & RADIX_TREE_MAP_MASK);
+		pathp++;
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	if (*pathp->slot)
+		return -EEXIST;
+	pathp->node->count++;
+	*pathp->slot = item;
+	return 0;
+
+nomem:
+	/* Don't leave the nodes we just added behind, they are empty. */
+	while (pathp->node && !pathp->node->count) {
+		pathp--;
+		*pathp->slot = NULL;
+		if (pathp->node)
+			pathp->node->count--;
+		radix_tree_node_free(pathp[1].node);
+	}
+	if (!root->rnode)
+		root->height = 0;
+	return -ENOMEM;
+}
+
+/**
+ * radix_tree_lookup - find an item in the tree
+ * @root: the tree
+ * @index: the index to look up
+ *
+ * Returns the item, or NULL if there is none.
+ */
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_node *node = root->rnode;
+	unsigned int height = root->height, shift;
+
+	if (!height || index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	while (node && --height > 0) {
+		node = node->slots[(index >> shift) & RADIX_TREE_MAP_MASK];
+		shift -= RADIX_TREE_MAP_SHIFT;
+	}
+	if (!node)
+		return NULL;
+	return node->slots[index & RADIX_TREE_MAP_MASK];
+}
+
+/**
+ * radix_tree_delete - remove an item from the tree
+ * @root: the tree
+ * @index: the index of the item
+ *
+ * Returns the item that was removed, or NULL if there was none.
+ */
+void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH + 1], *pathp = path;
+	unsigned int height = root->height, shift;
+	void *item;
+
+	if (!height || index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	pathp->node = NULL;
+	pathp->slot = (void **) &root->rnode;
+	while (height > 0) {
+		if (!*pathp->slot)
+			return NULL;
+		pathp[1].node = *pathp->slot;
+		pathp[1].slot = pathp[1].node->slots +
+			((index >> shift) & RADIX_TREE_MAP_MASK);
+		pathp++;
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	item = *pathp->slot;
+	if (!item)
+		return NULL;
+	*pathp->slot = NULL;
+
+	/* Free the nodes that have become empty, bottom up. */
+	while (pathp->node && !--pathp->node->count) {
+		pathp--;
+		*pathp->slot = NULL;
+		radix_tree_node_free(pathp[1].node);
+	}
+	if (!root->rnode)
+		root->height = 0;
+	return item;
+}
+
+/*
+ * Collect up to max_items items from the leaf that holds index or, if
+ * that has none left, the next leaf that has any. *next_index is set
+ * to the first index that was not looked at, 0 once we wrapped around.
+ */
+static unsigned int __lookup(struct radix_tree_root *root, void **results,
+			     unsigned long index, unsigned int max_items,
+			     unsigned long *next_index)
+{
+	struct radix_tree_node *node = root->rnode;
+	unsigned int height = root->height, shift;
+	unsigned int nr_found = 0;
+	unsigned long i;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	for (;;) {
+		if (height == 1) {
+			for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
+				index++;
+				if (node->slots[i]) {
+					results[nr_found++] = node->slots[i];
+					if (nr_found == max_items)
+						break;
+				}
+			}
+			break;
+		}
+
+		/* Skip the empty subtrees, each covers 1 << shift indices. */
+		for (i = (index >> shift) & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
+			if (node->slots[i])
+				break;
+			index &= ~((1UL << shift) - 1);
+			index += 1UL << shift;
+			if (!index)
+				goto out;
+		}
+		if (i == RADIX_TREE_MAP_SIZE)
+			break;
+		node = node->slots[i];
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+out:
+	*next_index = index;
+	return nr_found;
+}
+
+/**
+ * radix_tree_gang_lookup - find a number of items in index order
+ * @root: the tree
+ * @results: where to put the items
+ * @first_index: start looking here
+ * @max_items: put no more than this many items into @results
+ *
+ * Returns the number of items found: the ones with the lowest indices
+ * at or above @first_index, in ascending order of index.
+ */
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+				    unsigned long first_index,
+				    unsigned int max_items)
+{
+	unsigned long max_index = radix_tree_maxindex(root->height);
+	unsigned long index = first_index;
+	unsigned int ret = 0;
+
+	if (!root->rnode)
+		return 0;
+
+	while (ret < max_items && index <= max_index) {
+		unsigned long next_index;
+
+		ret += __lookup(root, results + ret, index, max_items - ret,
+				&next_index);
+		if (!next_index)
+			break;
+		index = next_index;
+	}
+	return ret;
+}
+
+static void radix_tree_node_ctor(void *node, kmem_cache_t *cachep,
+				 unsigned long flags)
+{
+	memset(node, 0, sizeof(struct radix_tree_node));
+}
+
+void __init radix_tree_init(void)
+{
+	radix_tree_node_cachep = kmem_cache_create("radix_tree_node",
+			sizeof(struct radix_tree_node), 0,
+			SLAB_HWCACHE_ALIGN, radix_tree_node_ctor, NULL);
+	if (!radix_tree_node_cachep)
+		panic("Cannot create radix_tree_node SLAB cache");
+}
+
+EXPORT_SYMBOL(radix_tree_insert);
+EXPORT_SYMBOL(radix_tree_lookup);
+EXPORT_SYMBOL(radix_tree_delete);
+EXPORT_SYMBOL(radix_tree_gang_lookup);
+EXPORT_SYMBOL(radix_tree_preload);
@@ -0,0 +1,419 @@
+/*
+ * linux/lib/rbtree.c
+ *
+ * Red-black tree rebalancing, see linux/rbtree.h.
+ *
+ * The rules: every node is red or black, the root is black, a red
+ * node has no red children, and every path from a node down to its
+ * leaves has the same number of black nodes. That keeps the longest
+ * path at most twice the shortest, i.e. the tree height below
+ * 2*log2(n+1).
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file COPYING for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/rbtree.h>
+
+/*
+ * With an augmented tree the rotations keep the two nodes they move
+ * up to date: the one that went down first, it is now the child.
+ */
+static void __rb_rotate_left(rb_node_t * node, rb_root_t * root,
+			     rb_augment_f augment)
+{
+	rb_node_t * right = node->rb_right;
+
+	if ((node->rb_right = right->rb_left))
+		right->rb_left->rb_parent = node;
+	right->rb_left = node;
+
+	if ((right->rb_parent = node->rb_parent))
+	{
+		if (node == node->rb_parent->rb_left)
+			node->rb_parent->rb_left = right;
+		else
+			node->rb_parent->rb_right = right;
+	}
+	else
+		root->rb_node = right;
+	node->rb_parent = right;
+
+	if (augment)
+	{
+		augment(node);
+		augment(right);
+	}
+}
+
+static void __rb_rotate_right(rb_node_t * node, rb_root_t * root,
+			      rb_augment_f augment)
+{
+	rb_node_t * left = node->rb_left;
+
+	if ((node->rb_left = left->rb_right))
+		left->rb_right->rb_parent = node;
+	left->rb_right = node;
+
+	if ((left->rb_parent = node->rb_parent))
+	{
+		if (node == node->rb_parent->rb_right)
+			node->rb_parent->rb_right = left;
+		else
+			node->rb_parent->rb_left = left;
+	}
+	else
+		root->rb_node = left;
+	node->rb_parent = left;
+
+	if (augment)
+	{
+		augment(node);
+		augment(left);
+	}
+}
+
+/* Recompute the augmented value from node up to the root. */
+static inline void __rb_augment_path(rb_node_t * node, rb_augment_f augment)
+{
+	for (; node; node = node->rb_parent)
+		augment(node);
+}
+
+static void __rb_insert_color(rb_node_t * node, rb_root_t * root,
+			      rb_augment_f augment)
+{
+	rb_node_t * parent, * gparent;
+
+	while ((parent = node->rb_parent) && parent->rb_color == RB_RED)
+	{
+		gparent = parent->rb_parent;
+
+		if (parent == gparent->rb_left)
+		{
+			{
+				register rb_node_t * uncle = gparent->rb_right;
+				if (uncle && uncle->rb_color == RB_RED)
+				{
+					uncle->rb_color = RB_BLACK;
+					parent->rb_color = RB_BLACK;
+					gparent->rb_color = RB_RED;
+					node = gparent;
+					continue;
+				}
+			}
+
+			if (parent->rb_right == node)
+			{
+				register rb_node_t * tmp;
+				__rb_rotate_left(parent, root, augment);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			__rb_rotate_right(gparent, root, augment);
+		} else {
+			{
+				register rb_node_t * uncle = gparent->rb_left;
+				if (uncle && uncle->rb_color == RB_RED)
+				{
+					uncle->rb_color = RB_BLACK;
+					parent->rb_color = RB_BLACK;
+					gparent->rb_color = RB_RED;
+					node = gparent;
+					continue;
+				}
+			}
+
+			if (parent->rb_left == node)
+			{
+				register rb_node_t * tmp;
+				__rb_rotate_right(parent, root, augment);
+				tmp = parent;
+				parent = node;
+				node = tmp;
+			}
+
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			__rb_rotate_left(gparent, root, augment);
+		}
+	}
+
+	root->rb_node->rb_color = RB_BLACK;
+}
+
+static void __rb_erase_color(rb_node_t * node, rb_node_t * parent,
+			     rb_root_t * root, rb_augment_f augment)
+{
+	rb_node_t * other;
+
+	while ((!node || node->rb_color == RB_BLACK) && node != root->rb_node)
+	{
+		if (parent->rb_left == node)
+		{
+			other = parent->rb_right;
+			if (other->rb_color == RB_RED)
+			{
+				other->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				__rb_rotate_left(parent, root, augment);
+				other = parent->rb_right;
+			}
+			if ((!other->rb_left ||
+			     other->rb_left->rb_color == RB_BLACK)
+			    && (!other->rb_right ||
+				other->rb_right->rb_color == RB_BLACK))
+			{
+				other->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+			}
+			else
+			{
+				if (!other->rb_right ||
+				    other->rb_right->rb_color == RB_BLACK)
+				{
+					register rb_node_t * o_left;
+					if ((o_left = other->rb_left))
+						o_left->rb_color = RB_BLACK;
+					other->rb_color = RB_RED;
+					__rb_rotate_right(other, root, augment);
+					other = parent->rb_right;
+				}
+				other->rb_color = parent->rb_color;
+				parent->rb_color = RB_BLACK;
+				if (other->rb_right)
+					other->rb_right->rb_color = RB_BLACK;
+				__rb_rotate_left(parent, root, augment);
+				node = root->rb_node;
+				break;
+			}
+		}
+		else
+		{
+			other = parent->rb_left;
+			if (other->rb_color == RB_RED)
+			{
+				other->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				__rb_rotate_right(parent, root, augment);
+				other = parent->rb_left;
+			}
+			if ((!other->rb_left ||
+			     other->rb_left->rb_color == RB_BLACK)
+			    && (!other->rb_right ||
+				other->rb_right->rb_color == RB_BLACK))
+			{
+				other->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+			}
+			else
+			{
+				if (!other->rb_left ||
+				    other->rb_left->rb_color == RB_BLACK)
+				{
+					register rb_node_t * o_right;
+					if ((o_right = other->rb_right))
+						o_right->rb_color = RB_BLACK;
+					other->rb_color = RB_RED;
+					__rb_rotate_left(other, root, augment);
+					other = parent->rb_left;
+				}
+				other->rb_color = parent->rb_color;
+				parent->rb_color = RB_BLACK;
+				if (other->rb_left)
+					other->rb_left->rb_color = RB_BLACK;
+				__rb_rotate_right(parent, root, augment);
+				node = root->rb_node;
+				break;
+			}
+		}
+	}
+	if (node)
+		node->rb_color = RB_BLACK;
+}
+
+static void __rb_erase(rb_node_t * node, rb_root_t * root,
+		       rb_augment_f augment)
+{
+	rb_node_t * child, * parent;
+	int color;
+
+	if (!node->rb_left)
+		child = node->rb_right;
+	else if (!node->rb_right)
+		child = node->rb_left;
+	else
+	{
+		/* Two children: the successor takes over our place. */
+		rb_node_t * old = node, * left;
+
+		node = node->rb_right;
+		while ((left = node->rb_left))
+			node = left;
+		child = node->rb_right;
+		parent = node->rb_parent;
+		color = node->rb_color;
+
+		if (parent == old)
+			parent = node;
+		else
+		{
+			if (child)
+				child->rb_parent = parent;
+			parent->rb_left = child;
+		}
+
+		node->rb_parent = old->rb_parent;
+		node->rb_color = old->rb_color;
+		node->rb_left = old->rb_left;
+		if (node != old->rb_right)
+		{
+			node->rb_right = old->rb_right;
+			old->rb_right->rb_parent = node;
+		}
+
+		if (old->rb_parent)
+		{
+			if (old->rb_parent->rb_left == old)
+				old->rb_parent->rb_left = node;
+			else
+				old->rb_parent->rb_right = node;
+		} else
+			root->rb_node = node;
+
+		old->rb_left->rb_parent = node;
+		goto color;
+	}
+
+	parent = node->rb_parent;
+	color = node->rb_color;
+
+	if (child)
+		child->rb_parent = parent;
+	if (parent)
+	{
+		if (parent->rb_left == node)
+			parent->rb_left = child;
+		else
+			parent->rb_right = child;
+	}
+	else
+		root->rb_node = child;
+
+ color:
+	/*
+	 * Everything from parent up has lost a node. Fix the augmented
+	 * values before rebalancing, the rotations rely on them.
+	 */
+	if (augment)
+		__rb_augment_path(parent, augment);
+	if (color == RB_BLACK)
+		__rb_erase_color(child, parent, root, augment);
+}
+
+void rb_insert_color(rb_node_t * node, rb_root_t * root)
+{
+	__rb_insert_color(node, root, NULL);
+}
+
+void rb_erase(rb_node_t * node, rb_root_t * root)
+{
+	__rb_erase(node, root, NULL);
+}
+
+/**
+ * rb_insert_augmented - rebalance after an insertion, keeping node values
+ * @node: the node just linked in with rb_link_node()
+ * @root: the tree
+ * @augment: recomputes one node's value from itself and its children
+ */
+void rb_insert_augmented(rb_node_t * node, rb_root_t * root,
+			 rb_augment_f augment)
+{
+	__rb_augment_path(node, augment);
+	__rb_insert_color(node, root, augment);
+}
+
+/**
+ * rb_erase_augmented - remove a node, keeping node values
+ * @node: the node to remove
+ * @root: the tree
+ * @augment: recomputes one node's value from itself and its children
+ */
+void rb_erase_augmented(rb_node_t * node, rb_root_t * root,
+			rb_augment_f augment)
+{
+	__rb_erase(node, root, augment);
+}
+
+rb_node_t * rb_first(rb_root_t * root)
+{
+	rb_node_t * n = root->rb_node;
+
+	if (!n)
+		return NULL;
+	while (n->rb_left)
+		n = n->rb_left;
+	return n;
+}
+
+rb_node_t * rb_last(rb_root_t * root)
+{
+	rb_node_t * n = root->rb_node;
+
+	if (!n)
+		return NULL;
+	while (n->rb_right)
+		n = n->rb_right;
+	return n;
+}
+
+rb_node_t * rb_next(rb_node_t * node)
+{
+	rb_node_t * parent;
+
+	/* Down once to the right, then all the way to the left. */
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return node;
+	}
+
+	/* Otherwise up until we come from a left child. */
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+	return parent;
+}
+
+rb_node_t * rb_prev(rb_node_t * node)
+{
+	rb_node_t * parent;
+
+	if (node->rb_left) {
+		node = node->rb_left;
+		while (node->rb_right)
+			node = node->rb_right;
+		return node;
+	}
+
+	while ((parent = node->rb_parent) && node == parent->rb_left)
+		node = parent;
+	return parent;
+}
+
+EXPORT_SYMBOL(rb_insert_color);
+EXPORT_SYMBOL(rb_erase);
+EXPORT_SYMBOL(rb_insert_augmented);
+EXPORT_SYMBOL(rb_erase_augmented);
+EXPORT_SYMBOL(rb_first);
+EXPORT_SYMBOL(rb_last);
+EXPORT_SYMBOL(rb_next);
+EXPORT_SYMBOL(rb_prev);
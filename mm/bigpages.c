@@ -0,0 +1,118 @@
+/*
+ *  linux/mm/bigpages.c
+ *
+ *  The big page pool, see linux/bigpages.h.
+ *
+ *  The architecture hands the pool its big pages at boot, from memory
+ *  that never went to the page allocator. Every small page in a big
+ *  page keeps a count of one for the pool, so that kiobufs and the like
+ *  can take and drop references without ever freeing it; only the head
+ *  page's list is used, to queue free big pages.
+ *
+ *  Big pages are handed out zeroed and mapped one pmd at a time, from
+ *  bigpage_fault(). Nothing ever pages them out: the areas are
+ *  VM_RESERVED, and the pages are not on the LRU lists.
+ */
+
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/highmem.h>
+#include <linux/spinlock.h>
+#include <linux/bigpages.h>
+
+#include <asm/pgalloc.h>
+
+static spinlock_t bigpages_lock = SPIN_LOCK_UNLOCKED;
+static LIST_HEAD(free_bigpages);
+
+unsigned long nr_bigpages, nr_free_bigpages;
+
+/* Give BIGPAGE_SIZE of aligned, unused memory starting at page to the pool */
+void __init bigpage_add(struct page * page)
+{
+	unsigned long i;
+
+	for (i = 0; i < BIGPAGE_NR; i++) {
+		ClearPageReserved(page + i);
+		set_page_count(page + i, 1);
+	}
+	list_add(&page->list, &free_bigpages);
+	nr_bigpages++;
+	nr_free_bigpages++;
+}
+
+/*
+ * Returns a zeroed big page, or NULL if the pool is empty. Can sleep,
+ * clearing it takes a while.
+ */
+struct page * alloc_bigpage(void)
+{
+	struct page * page = NULL;
+	unsigned long i;
+
+	spin_lock(&bigpages_lock);
+	if (!list_empty(&free_bigpages)) {
+		page = list_entry(free_bigpages.next, struct page, list);
+		list_del(&page->list);
+		nr_free_bigpages--;
+	}
+	spin_unlock(&bigpages_lock);
+
+	if (page) {
+		for (i = 0; i < BIGPAGE_NR; i++) {
+			clear_highpage(page + i);
+			if (current->need_resched)
+				schedule();
+		}
+	}
+	return page;
+}
+
+/* The page must not be mapped anywhere any more */
+void free_bigpage(struct page * page)
+{
+	spin_lock(&bigpages_lock);
+	list_add(&page->list, &free_bigpages);
+	nr_free_bigpages++;
+	spin_unlock(&bigpages_lock);
+}
+
+/*
+ * handle_mm_fault() for VM_BIGPAGE areas. Their nopage() returns the
+ * head page of the big page for an address, which we map with a pmd.
+ * The area owns the big page, so the mapping takes no reference.
+ */
+int bigpage_fault(struct mm_struct * mm, struct vm_area_struct * vma,
+	unsigned long address)
+{
+	struct page * page;
+	pmd_t * pmd;
+
+	address &= BIGPAGE_MASK;
+	page = vma->vm_ops->nopage(vma, address, 0);
+	if (!page)	/* SIGBUS */
+		return 0;
+	if (page == NOPAGE_OOM)
+		return -1;
+
+	pmd = pmd_alloc(pgd_offset(mm, address), address);
+	if (!pmd)
+		return -1;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_none(*pmd)) {
+		set_pmd(pmd, mk_pmd_big(page, vma->vm_page_prot));
+		mm->rss += BIGPAGE_NR;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return 1;
+}
+
+int get_bigpage_info(char * buf)
+{
+	return sprintf(buf,
+		"BigPagesTotal: %5lu\n"
+		"BigPagesFree:  %5lu\n"
+		"BigPageSize:   %5lu kB\n",
+		nr_bigpages, nr_free_bigpages, BIGPAGE_SIZE >> 10);
+}
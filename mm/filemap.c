@@ -22,6 +22,9 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/mm.h>
+#include <linux/fadvise.h>
+#include <linux/iobuf.h>
+#include <linux/aio.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -42,12 +45,13 @@
  */
 
 atomic_t page_cache_size = ATOMIC_INIT(0);
-unsigned int page_hash_bits;
-struct page **page_hash_table;
 
-spinlock_t pagecache_lock = SPIN_LOCK_UNLOCKED;
 /*
- * NOTE: to avoid deadlocking you must never acquire the pagecache_lock with
+ * Every address_space indexes its pages in its own radix tree,
+ * mapping->page_tree. The tree and the clean/dirty/locked lists of
+ * the mapping are protected by mapping->page_lock.
+ *
+ * NOTE: to avoid deadlocking you must never acquire a page_lock with
  *       the pagemap_lru_lock held.
  */
 spinlock_t pagemap_lru_lock = SPIN_LOCK_UNLOCKED;
@@ -55,20 +59,6 @@ spinlock_t pagemap_lru_lock = SPIN_LOCK_UNLOCKED;
 #define CLUSTER_PAGES		(1 << page_cluster)
 #define CLUSTER_OFFSET(x)	(((x) >> page_cluster) << page_cluster)
 
-static void add_page_to_hash_queue(struct page * page, struct page **p)
-{
-	struct page *next = *p;
-
-	*p = page;
-	page->next_hash = next;
-	page->pprev_hash = p;
-	if (next)
-		next->pprev_hash = &page->next_hash;
-	if (page->buffers)
-		PAGE_BUG(page);
-	atomic_inc(&page_cache_size);
-}
-
 static inline void add_page_to_inode_queue(struct address_space *mapping, struct page * page)
 {
 	struct list_head *head = &mapping->clean_pages;
@@ -87,39 +77,29 @@ static inline void remove_page_from_inode_queue(struct page * page)
 	page->mapping = NULL;
 }
 
-static inline void remove_page_from_hash_queue(struct page * page)
-{
-	struct page *next = page->next_hash;
-	struct page **pprev = page->pprev_hash;
-
-	if (next)
-		next->pprev_hash = pprev;
-	*pprev = next;
-	page->pprev_hash = NULL;
-	atomic_dec(&page_cache_size);
-}
-
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
- * is safe.
+ * is safe. The mapping's page_lock must be held.
  */
 void __remove_inode_page(struct page *page)
 {
 	if (PageDirty(page)) BUG();
+	radix_tree_delete(&page->mapping->page_tree, page->index);
 	remove_page_from_inode_queue(page);
-	remove_page_from_hash_queue(page);
-	page->mapping = NULL;
+	atomic_dec(&page_cache_size);
 }
 
 void remove_inode_page(struct page *page)
 {
+	struct address_space *mapping = page->mapping;
+
 	if (!PageLocked(page))
 		PAGE_BUG(page);
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	__remove_inode_page(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 static inline int sync_page(struct page *page)
@@ -138,10 +118,10 @@ void __set_page_dirty(struct page *page)
 {
 	struct address_space *mapping = page->mapping;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	list_del(&page->list);
 	list_add(&page->list, &mapping->dirty_pages);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	mark_inode_dirty_pages(mapping->host);
 }
@@ -156,12 +136,13 @@ void __set_page_dirty(struct page *page)
 
 void invalidate_inode_pages(struct inode * inode)
 {
+	struct address_space *mapping = inode->i_mapping;
 	struct list_head *head, *curr;
 	struct page * page;
 
-	head = &inode->i_mapping->clean_pages;
+	head = &mapping->clean_pages;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	spin_lock(&pagemap_lru_lock);
 	curr = head->next;
 
@@ -188,7 +169,17 @@ void invalidate_inode_pages(struct inode * inode)
 	}
 
 	spin_unlock(&pagemap_lru_lock);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
+}
+
+static inline int do_flushpage(struct page *page, unsigned long offset)
+{
+	int (*flushpage) (struct page *, unsigned long);
+
+	flushpage = page->mapping->a_ops->flushpage;
+	if (flushpage)
+		return (*flushpage)(page, offset);
+	return block_flushpage(page, offset);
 }
 
 static inline void truncate_partial_page(struct page *page, unsigned partial)
@@ -196,14 +187,14 @@ static inline void truncate_partial_page(struct page *page, unsigned partial)
 	memclear_highpage_flush(page, partial, PAGE_CACHE_SIZE-partial);
 				
 	if (page->buffers)
-		block_flushpage(page, partial);
+		do_flushpage(page, partial);
 
 }
 
 static inline void truncate_complete_page(struct page *page)
 {
 	/* Leave it on the LRU if it gets converted into anonymous buffers */
-	if (!page->buffers || block_flushpage(page, 0))
+	if (!page->buffers || do_flushpage(page, 0))
 		lru_cache_del(page);
 
 	/*
@@ -219,55 +210,8 @@ static inline void truncate_complete_page(struct page *page)
 	page_cache_release(page);
 }
 
-void truncate_list_pages(struct list_head *head, unsigned long start, unsigned partial)
-{
-	struct list_head *curr;
-	struct page * page;
-
-repeat:
-	spin_lock(&pagecache_lock);
-	curr = head->next;
-	while (curr != head) {
-		unsigned long offset;
-
-		page = list_entry(curr, struct page, list);
-		curr = curr->next;
-		offset = page->index;
-
-		/* Is one of the pages to truncate? */
-		if ((offset >= start) || (partial && (offset + 1) == start)) {
-			if (TryLockPage(page)) {
-				page_cache_get(page);
-				spin_unlock(&pagecache_lock);
-				wait_on_page(page);
-				page_cache_release(page);
-				goto repeat;
-			}
-			page_cache_get(page);
-			spin_unlock(&pagecache_lock);
-
-			if (partial && (offset + 1) == start) {
-				truncate_partial_page(page, partial);
-				partial = 0;
-			} else 
-				truncate_complete_page(page);
-
-			UnlockPage(page);
-			page_cache_release(page);
-
-			/*
-			 * We have done things without the pagecache lock,
-			 * so we'll have to repeat the scan.
-			 * It's not possible to deadlock here because
-			 * we are guaranteed to make progress. (ie. we have
-			 * just removed a page)
-			 */
-			goto repeat;
-		}
-	}
-	spin_unlock(&pagecache_lock);
-}
-
+/* How many pages truncate_inode_pages() looks up at a time. */
+#define TRUNCATE_BATCH	16
 
 /**
  * truncate_inode_pages - truncate *all* the pages from an offset
@@ -277,40 +221,60 @@ repeat:
  * Truncate the page cache at a set offset, removing the pages
  * that are beyond that offset (and zeroing out partial pages).
  * If any page is locked we wait for it to become unlocked.
+ *
+ * The pages are looked up in index order, a batch at a time, so
+ * this only ever visits the pages that are actually removed.
  */
-void truncate_inode_pages(struct address_space * mapping, loff_t lstart) 
+void truncate_inode_pages(struct address_space * mapping, loff_t lstart)
 {
 	unsigned long start = (lstart + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
+	struct page *pages[TRUNCATE_BATCH];
+	unsigned long next = start;
+	unsigned int i, nr;
+
+	while ((nr = find_get_pages(mapping, next, TRUNCATE_BATCH, pages)) != 0) {
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+
+			next = page->index + 1;
+			lock_page(page);
+			/* Somebody else may have removed it while we slept */
+			if (page->mapping == mapping)
+				truncate_complete_page(page);
+			UnlockPage(page);
+			page_cache_release(page);
+		}
+		/* Wrapped around after the last possible index */
+		if (!next)
+			break;
+	}
 
-	truncate_list_pages(&mapping->clean_pages, start, partial);
-	truncate_list_pages(&mapping->dirty_pages, start, partial);
-	truncate_list_pages(&mapping->locked_pages, start, partial);
+	if (partial) {
+		struct page *page = find_lock_page(mapping, start - 1);
+
+		if (page) {
+			truncate_partial_page(page, partial);
+			UnlockPage(page);
+			page_cache_release(page);
+		}
+	}
 }
 
-static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset, struct page *page)
+static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset)
 {
-	goto inside;
+	struct page *page = radix_tree_lookup(&mapping->page_tree, offset);
 
-	for (;;) {
-		page = page->next_hash;
-inside:
-		if (!page)
-			goto not_found;
-		if (page->mapping != mapping)
-			continue;
-		if (page->index == offset)
-			break;
+	if (page) {
+		/*
+		 * Touching the page may move it to the active list.
+		 * If we end up with too few inactive pages, we wake
+		 * up kswapd.
+		 */
+		age_page_up(page);
+		if (inactive_shortage() > inactive_target / 2 && free_shortage())
+				wakeup_kswapd(0);
 	}
-	/*
-	 * Touching the page may move it to the active list.
-	 * If we end up with too few inactive pages, we wake
-	 * up kswapd.
-	 */
-	age_page_up(page);
-	if (inactive_shortage() > inactive_target / 2 && free_shortage())
-			wakeup_kswapd(0);
-not_found:
 	return page;
 }
 
@@ -349,13 +313,13 @@ static int waitfor_one_page(struct page *page)
 	return error;
 }
 
-static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsigned long end, int (*fn)(struct page *))
+static int do_buffer_fdatasync(struct address_space *mapping, struct list_head *head, unsigned long start, unsigned long end, int (*fn)(struct page *))
 {
 	struct list_head *curr;
 	struct page *page;
 	int retval = 0;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	curr = head->next;
 	while (curr != head) {
 		page = list_entry(curr, struct page, list);
@@ -368,7 +332,7 @@ static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsi
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 		lock_page(page);
 
 		/* The buffers could have been free'd while we waited for the page lock */
@@ -376,11 +340,11 @@ static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsi
 			retval |= fn(page);
 
 		UnlockPage(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 		curr = page->list.next;
 		page_cache_release(page);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	return retval;
 }
@@ -391,35 +355,39 @@ static int do_buffer_fdatasync(struct list_head *head, unsigned long start, unsi
  */
 int generic_buffer_fdatasync(struct inode *inode, unsigned long start_idx, unsigned long end_idx)
 {
+	struct address_space *mapping = inode->i_mapping;
 	int retval;
 
 	/* writeout dirty buffers on pages from both clean and dirty lists */
-	retval = do_buffer_fdatasync(&inode->i_mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->clean_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->locked_pages, start_idx, end_idx, writeout_one_page);
+	retval = do_buffer_fdatasync(mapping, &mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->clean_pages, start_idx, end_idx, writeout_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->locked_pages, start_idx, end_idx, writeout_one_page);
 
 	/* now wait for locked buffers on pages from both clean and dirty lists */
-	retval |= do_buffer_fdatasync(&inode->i_mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->clean_pages, start_idx, end_idx, waitfor_one_page);
-	retval |= do_buffer_fdatasync(&inode->i_mapping->locked_pages, start_idx, end_idx, waitfor_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->dirty_pages, start_idx, end_idx, writeout_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->clean_pages, start_idx, end_idx, waitfor_one_page);
+	retval |= do_buffer_fdatasync(mapping, &mapping->locked_pages, start_idx, end_idx, waitfor_one_page);
 
 	return retval;
 }
 
 /**
- *      filemap_fdatasync - walk the list of dirty pages of the given address space
- *     	and writepage() all of them.
+ *      filemap_fdatasync_nr - walk the list of dirty pages of the given address space
+ *     	and writepage() up to nr_pages of them.
  * 
  *      @mapping: address space structure to write
+ *      @nr_pages: how many pages to write at most
  *
+ *      Returns the number of pages written. The rest stay dirty.
  */
-void filemap_fdatasync(struct address_space * mapping)
+long filemap_fdatasync_nr(struct address_space * mapping, long nr_pages)
 {
 	int (*writepage)(struct page *) = mapping->a_ops->writepage;
+	long written = 0;
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 
-        while (!list_empty(&mapping->dirty_pages)) {
+        while (!list_empty(&mapping->dirty_pages) && written < nr_pages) {
 		struct page *page = list_entry(mapping->dirty_pages.next, struct page, list);
 
 		list_del(&page->list);
@@ -429,20 +397,34 @@ void filemap_fdatasync(struct address_space * mapping)
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		lock_page(page);
 
 		if (PageDirty(page)) {
 			ClearPageDirty(page);
 			writepage(page);
+			written++;
 		} else
 			UnlockPage(page);
 
 		page_cache_release(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
+	return written;
+}
+
+/**
+ *      filemap_fdatasync - walk the list of dirty pages of the given address space
+ *     	and writepage() all of them.
+ * 
+ *      @mapping: address space structure to write
+ *
+ */
+void filemap_fdatasync(struct address_space * mapping)
+{
+	filemap_fdatasync_nr(mapping, LONG_MAX);
 }
 
 /**
@@ -454,7 +436,7 @@ void filemap_fdatasync(struct address_space * mapping)
  */
 void filemap_fdatawait(struct address_space * mapping)
 {
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 
         while (!list_empty(&mapping->locked_pages)) {
 		struct page *page = list_entry(mapping->locked_pages.next, struct page, list);
@@ -466,83 +448,90 @@ void filemap_fdatawait(struct address_space * mapping)
 			continue;
 
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		___wait_on_page(page);
 
 		page_cache_release(page);
-		spin_lock(&pagecache_lock);
+		spin_lock(&mapping->page_lock);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 /*
- * Add a page to the inode page cache.
- *
- * The caller must have locked the page and 
- * set all the page flags correctly..
+ * Insert a page into the mapping, with the page_lock held. Fails with
+ * -EEXIST if there already is a page at index, and with -ENOMEM if the
+ * tree could not grow; radix_tree_preload() beforehand prevents that.
  */
-void add_to_page_cache_locked(struct page * page, struct address_space *mapping, unsigned long index)
+static int __add_to_page_cache(struct page * page,
+	struct address_space *mapping, unsigned long index)
 {
-	if (!PageLocked(page))
-		BUG();
+	int error;
 
+	if (page->buffers)
+		PAGE_BUG(page);
+	error = radix_tree_insert(&mapping->page_tree, index, page);
+	if (error)
+		return error;
 	page_cache_get(page);
-	spin_lock(&pagecache_lock);
 	page->index = index;
 	add_page_to_inode_queue(mapping, page);
-	add_page_to_hash_queue(page, page_hash(mapping, index));
+	atomic_inc(&page_cache_size);
 	lru_cache_add(page);
-	spin_unlock(&pagecache_lock);
+	return 0;
 }
 
 /*
- * This adds a page to the page cache, starting out as locked,
- * owned by us, but unreferenced, not uptodate and with no errors.
+ * Add a page to the inode page cache.
+ *
+ * The caller must have locked the page and
+ * set all the page flags correctly..
  */
-static inline void __add_to_page_cache(struct page * page,
-	struct address_space *mapping, unsigned long offset,
-	struct page **hash)
+int add_to_page_cache_locked(struct page * page, struct address_space *mapping,
+	unsigned long index, int gfp_mask)
 {
-	unsigned long flags;
+	int error;
 
-	if (PageLocked(page))
+	if (!PageLocked(page))
 		BUG();
 
-	flags = page->flags & ~((1 << PG_uptodate) | (1 << PG_error) | (1 << PG_dirty) | (1 << PG_referenced) | (1 << PG_arch_1));
-	page->flags = flags | (1 << PG_locked);
-	page_cache_get(page);
-	page->index = offset;
-	add_page_to_inode_queue(mapping, page);
-	add_page_to_hash_queue(page, hash);
-	lru_cache_add(page);
-}
-
-void add_to_page_cache(struct page * page, struct address_space * mapping, unsigned long offset)
-{
-	spin_lock(&pagecache_lock);
-	__add_to_page_cache(page, mapping, offset, page_hash(mapping, offset));
-	spin_unlock(&pagecache_lock);
+	error = radix_tree_preload(gfp_mask);
+	if (!error) {
+		spin_lock(&mapping->page_lock);
+		error = __add_to_page_cache(page, mapping, index);
+		spin_unlock(&mapping->page_lock);
+	}
+	return error;
 }
 
-static int add_to_page_cache_unique(struct page * page,
-	struct address_space *mapping, unsigned long offset,
-	struct page **hash)
+/*
+ * This adds a page to the page cache, starting out as locked,
+ * owned by us, but unreferenced, not uptodate and with no errors.
+ * gfp_mask tells how to allocate the index nodes it may need.
+ *
+ * Returns 0, or -EEXIST if somebody else was faster, or -ENOMEM.
+ */
+int add_to_page_cache(struct page * page, struct address_space * mapping,
+	unsigned long index, int gfp_mask)
 {
-	int err;
-	struct page *alias;
+	unsigned long flags;
+	int error;
 
-	spin_lock(&pagecache_lock);
-	alias = __find_page_nolock(mapping, offset, *hash);
+	if (PageLocked(page))
+		BUG();
 
-	err = 1;
-	if (!alias) {
-		__add_to_page_cache(page,mapping,offset,hash);
-		err = 0;
-	}
+	error = radix_tree_preload(gfp_mask);
+	if (error)
+		return error;
 
-	spin_unlock(&pagecache_lock);
-	return err;
+	spin_lock(&mapping->page_lock);
+	flags = page->flags;
+	page->flags = (flags & ~((1 << PG_uptodate) | (1 << PG_error) | (1 << PG_dirty) | (1 << PG_referenced) | (1 << PG_arch_1))) | (1 << PG_locked);
+	error = __add_to_page_cache(page, mapping, index);
+	if (error)
+		page->flags = flags;
+	spin_unlock(&mapping->page_lock);
+	return error;
 }
 
 /*
@@ -553,30 +542,33 @@ static inline int page_cache_read(struct file * file, unsigned long offset)
 {
 	struct inode *inode = file->f_dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
-	struct page **hash = page_hash(mapping, offset);
-	struct page *page; 
+	struct page *page;
+	int error;
 
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash); 
-	spin_unlock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
+	spin_unlock(&mapping->page_lock);
 	if (page)
 		return 0;
 
-	page = page_cache_alloc();
+	/* The device will fill it, there is no point in a cache-hot page. */
+	page = page_cache_alloc_cold();
 	if (!page)
 		return -ENOMEM;
 
-	if (!add_to_page_cache_unique(page, mapping, offset, hash)) {
-		int error = mapping->a_ops->readpage(file, page);
+	error = add_to_page_cache(page, mapping, offset, GFP_KERNEL);
+	if (!error) {
+		error = mapping->a_ops->readpage(file, page);
 		page_cache_release(page);
 		return error;
 	}
 	/*
-	 * We arrive here in the unlikely event that someone 
-	 * raced with us and added our page to the cache first.
+	 * We arrive here in the unlikely event that someone
+	 * raced with us and added our page to the cache first,
+	 * or if we could not get the memory to index it.
 	 */
 	page_cache_free(page);
-	return 0;
+	return error == -EEXIST ? 0 : error;
 }
 
 /*
@@ -662,48 +654,38 @@ void lock_page(struct page *page)
 
 /*
  * a rather lightweight function, finding and getting a reference to a
- * hashed page atomically, waiting for it if it's locked.
+ * page cache page atomically.
  */
-struct page * __find_get_page(struct address_space *mapping,
-			      unsigned long offset, struct page **hash)
+struct page * find_get_page(struct address_space *mapping, unsigned long offset)
 {
 	struct page *page;
 
-	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
-	 */
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page)
 		page_cache_get(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return page;
 }
 
 /*
  * Get the lock to a page atomically.
  */
-struct page * __find_lock_page (struct address_space *mapping,
-				unsigned long offset, struct page **hash)
+struct page * find_lock_page(struct address_space *mapping, unsigned long offset)
 {
 	struct page *page;
 
-	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
-	 */
 repeat:
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page) {
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		lock_page(page);
 
-		/* Is the page still hashed? Ok, good.. */
-		if (page->mapping)
+		/* Is the page still in this mapping? Ok, good.. */
+		if (page->mapping == mapping && page->index == offset)
 			return page;
 
 		/* Nope: we raced. Release and try again.. */
@@ -711,14 +693,65 @@ repeat:
 		page_cache_release(page);
 		goto repeat;
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return NULL;
 }
 
-#if 0
-#define PROFILE_READAHEAD
-#define DEBUG_READAHEAD
-#endif
+/**
+ * find_get_pages - look up a range of page cache pages
+ * @mapping: the mapping to look in
+ * @start: the first index to consider
+ * @nr_pages: the size of @pages
+ * @pages: where to put the pages
+ *
+ * Fills @pages with the pages at or after @start, in ascending order
+ * of index, and gets a reference on each. Returns how many it found,
+ * which is only less than @nr_pages if the mapping has no more pages
+ * after @start. The pages are not marked as accessed.
+ */
+unsigned int find_get_pages(struct address_space *mapping, unsigned long start,
+			    unsigned int nr_pages, struct page **pages)
+{
+	unsigned int i, nr;
+
+	spin_lock(&mapping->page_lock);
+	nr = radix_tree_gang_lookup(&mapping->page_tree, (void **) pages,
+				    start, nr_pages);
+	for (i = 0; i < nr; i++)
+		page_cache_get(pages[i]);
+	spin_unlock(&mapping->page_lock);
+	return nr;
+}
+
+/*
+ * Remove a clean page that nobody else uses from the page cache, for
+ * the fadvise64() hints. The caller holds a reference, which it still
+ * has to drop.
+ */
+static void invalidate_unused_page(struct page * page)
+{
+	struct address_space *mapping = page->mapping;
+
+	if (!mapping || PageDirty(page) || TryLockPage(page))
+		return;
+	if (page->mapping != mapping)
+		goto out;
+	if (page->buffers && !try_to_free_buffers(page, 0))
+		goto out;
+
+	spin_lock(&mapping->page_lock);
+	spin_lock(&pagemap_lru_lock);
+	/* Only the page cache and the caller? */
+	if (page_count(page) == 2 && !PageDirty(page)) {
+		__lru_cache_del(page);
+		__remove_inode_page(page);
+		page_cache_release(page);
+	}
+	spin_unlock(&pagemap_lru_lock);
+	spin_unlock(&mapping->page_lock);
+out:
+	UnlockPage(page);
+}
 
 /*
  * We combine this with read-ahead to deactivate pages when we
@@ -727,17 +760,16 @@ repeat:
  * but just move them to the inactive list.
  *
  * TODO:
- * - make the readahead code smarter
  * - move readahead to the VMA level so we can do the same
  *   trick with mmap()
  *
  * Rik van Riel, 2000
  */
-static void drop_behind(struct file * file, unsigned long index)
+static void drop_behind(struct file * file, unsigned long index,
+			unsigned long window)
 {
 	struct inode *inode = file->f_dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
-	struct page **hash;
 	struct page *page;
 	unsigned long start;
 
@@ -745,8 +777,8 @@ static void drop_behind(struct file * file, unsigned long index)
 	if (!index)
 		return;
 
-	if (index > file->f_rawin)
-		start = index - file->f_rawin;
+	if (index > window)
+		start = index - window;
 	else
 		start = 0;
 
@@ -756,255 +788,166 @@ static void drop_behind(struct file * file, unsigned long index)
 	 * been increased since the last time we were called, we
 	 * stop when the page isn't there.
 	 */
-	spin_lock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
 	while (--index >= start) {
-		hash = page_hash(mapping, index);
-		page = __find_page_nolock(mapping, index, *hash);
+		page = radix_tree_lookup(&mapping->page_tree, index);
 		if (!page)
 			break;
 		deactivate_page(page);
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
-/*
- * Read-ahead profiling information
- * --------------------------------
- * Every PROFILE_MAXREADCOUNT, the following information is written 
- * to the syslog:
- *   Percentage of asynchronous read-ahead.
- *   Average of read-ahead fields context value.
- * If DEBUG_READAHEAD is defined, a snapshot of these fields is written 
- * to the syslog.
- */
-
-#ifdef PROFILE_READAHEAD
-
-#define PROFILE_MAXREADCOUNT 1000
-
-static unsigned long total_reada;
-static unsigned long total_async;
-static unsigned long total_ramax;
-static unsigned long total_ralen;
-static unsigned long total_rawin;
-
-static void profile_readahead(int async, struct file *filp)
-{
-	unsigned long flags;
-
-	++total_reada;
-	if (async)
-		++total_async;
-
-	total_ramax	+= filp->f_ramax;
-	total_ralen	+= filp->f_ralen;
-	total_rawin	+= filp->f_rawin;
-
-	if (total_reada > PROFILE_MAXREADCOUNT) {
-		save_flags(flags);
-		cli();
-		if (!(total_reada > PROFILE_MAXREADCOUNT)) {
-			restore_flags(flags);
-			return;
-		}
-
-		printk("Readahead average:  max=%ld, len=%ld, win=%ld, async=%ld%%\n",
-			total_ramax/total_reada,
-			total_ralen/total_reada,
-			total_rawin/total_reada,
-			(total_async*100)/total_reada);
-#ifdef DEBUG_READAHEAD
-		printk("Readahead snapshot: max=%ld, len=%ld, win=%ld, raend=%Ld\n",
-			filp->f_ramax, filp->f_ralen, filp->f_rawin, filp->f_raend);
-#endif
-
-		total_reada	= 0;
-		total_async	= 0;
-		total_ramax	= 0;
-		total_ralen	= 0;
-		total_rawin	= 0;
-
-		restore_flags(flags);
-	}
-}
-#endif  /* defined PROFILE_READAHEAD */
-
 /*
  * Read-ahead context:
  * -------------------
- * The read ahead context fields of the "struct file" are the following:
- * - f_raend : position of the first byte after the last page we tried to
- *	       read ahead.
- * - f_ramax : current read-ahead maximum size.
- * - f_ralen : length of the current IO read block we tried to read-ahead.
- * - f_rawin : length of the current read-ahead window.
- *		if last read-ahead was synchronous then
- *			f_rawin = f_ralen
- *		otherwise (was asynchronous)
- *			f_rawin = previous value of f_ralen + f_ralen
+ * Every struct file carries RA_STREAMS read-ahead streams. A read of
+ * page "index" continues the stream whose next page it is; if there is
+ * none, the least recently used stream is restarted at index without
+ * reading ahead, so random reads cost nothing and a file that is read
+ * at several places at once (think of a diff or a multi-threaded
+ * server) keeps one window for each of them.
+ *
+ * For each stream:
+ * - next  : the page a sequential reader reads next.
+ * - ahead : the first page after the ones we already read ahead.
+ * - size  : the read-ahead window in pages, 0 until the stream has
+ *	     been read sequentially.
+ *
+ * Once the reader is within half a window of "ahead", the window is
+ * doubled, up to the maximum of the device, and the next window worth
+ * of pages is read asynchronously. So the window grows as long as the
+ * reads stay sequential and the IO overlaps the reader.
+ *
+ * If a page within the read-ahead window is not in the page cache when
+ * the reader gets there, the VM threw it out before it could be used:
+ * we read ahead more than the memory can hold. Halve the window then
+ * instead of growing it.
  *
  * Read-ahead limits:
  * ------------------
  * MIN_READAHEAD   : minimum read-ahead size when read-ahead.
  * MAX_READAHEAD   : maximum read-ahead size when read-ahead.
  *
- * Synchronous read-ahead benefits:
- * --------------------------------
- * Using reasonable IO xfer length from peripheral devices increase system 
- * performances.
- * Reasonable means, in this context, not too large but not too small.
- * The actual maximum value is:
- *	MAX_READAHEAD + PAGE_CACHE_SIZE = 76k is CONFIG_READA_SMALL is undefined
- *      and 32K if defined (4K page size assumed).
- *
- * Asynchronous read-ahead benefits:
- * ---------------------------------
- * Overlapping next read request and user process execution increase system 
- * performance.
- *
- * Read-ahead risks:
- * -----------------
- * We have to guess which further data are needed by the user process.
- * If these data are often not really needed, it's bad for system 
- * performances.
- * However, we know that files are often accessed sequentially by 
- * application programs and it seems that it is possible to have some good 
- * strategy in that guessing.
- * We only try to read-ahead files that seems to be read sequentially.
- *
- * Asynchronous read-ahead risks:
- * ------------------------------
- * In order to maximize overlapping, we must start some asynchronous read 
- * request from the device, as soon as possible.
- * We must be very careful about:
- * - The number of effective pending IO read requests.
- *   ONE seems to be the only reasonable value.
- * - The total memory pool usage for the file access stream.
- *   This maximum memory usage is implicitly 2 IO read chunks:
- *   2*(MAX_READAHEAD + PAGE_CACHE_SIZE) = 156K if CONFIG_READA_SMALL is undefined,
- *   64k if defined (4K page size assumed).
+ * How often read-ahead was in time, was missing or thrashed is counted
+ * for each block device, see /proc/readahead.
  */
 
 static inline int get_max_readahead(struct inode * inode)
 {
+	if (inode->i_sb && inode->i_sb->s_max_readahead)
+		return inode->i_sb->s_max_readahead;
 	if (!inode->i_dev || !max_readahead[MAJOR(inode->i_dev)])
 		return MAX_READAHEAD;
 	return max_readahead[MAJOR(inode->i_dev)][MINOR(inode->i_dev)];
 }
 
-static void generic_file_readahead(int reada_ok,
-	struct file * filp, struct inode * inode,
-	struct page * page)
-{
-	unsigned long end_index = inode->i_size >> PAGE_CACHE_SHIFT;
-	unsigned long index = page->index;
-	unsigned long max_ahead, ahead;
-	unsigned long raend;
-	int max_readahead = get_max_readahead(inode);
-
-	raend = filp->f_raend;
-	max_ahead = 0;
-
 /*
- * The current page is locked.
- * If the current position is inside the previous read IO request, do not
- * try to reread previously read ahead pages.
- * Otherwise decide or not to read ahead some pages synchronously.
- * If we are not going to read ahead, set the read ahead context for this 
- * page only.
+ * Called for every page that do_generic_file_read() gets to, with
+ * cached telling whether the page was in the page cache. More than
+ * one call for the same page doesn't hurt.
  */
-	if (PageLocked(page)) {
-		if (!filp->f_ralen || index >= raend || index + filp->f_rawin < raend) {
-			raend = index;
-			if (raend < end_index)
-				max_ahead = filp->f_ramax;
-			filp->f_rawin = 0;
-			filp->f_ralen = 1;
-			if (!max_ahead) {
-				filp->f_raend  = index + filp->f_ralen;
-				filp->f_rawin += filp->f_ralen;
-			}
+static void generic_file_readahead(struct file * filp, struct inode * inode,
+				   unsigned long index, int cached)
+{
+	struct file_ra_state *ra = &filp->f_ra;
+	struct file_ra_stream *s, *lru;
+	struct block_device *bdev = NULL;
+	unsigned long last, ahead, end;
+	int i;
+
+	if (ra->advice == POSIX_FADV_RANDOM)
+		return;
+	if (inode->i_sb)
+		bdev = inode->i_sb->s_bdev;
+
+	lru = s = ra->streams;
+	for (i = 0; i < RA_STREAMS; i++, s++) {
+		/* Another read from the page we just had */
+		if (s->next == index + 1) {
+			s->stamp = ++ra->stamp;
+			return;
 		}
+		if (s->next == index)
+			goto sequential;
+		if (s->stamp < lru->stamp)
+			lru = s;
 	}
-/*
- * The current page is not locked.
- * If we were reading ahead and,
- * if the current max read ahead size is not zero and,
- * if the current position is inside the last read-ahead IO request,
- *   it is the moment to try to read ahead asynchronously.
- * We will later force unplug device in order to force asynchronous read IO.
- */
-	else if (reada_ok && filp->f_ramax && raend >= 1 &&
-		 index <= raend && index + filp->f_ralen >= raend) {
-/*
- * Add ONE page to max_ahead in order to try to have about the same IO max size
- * as synchronous read-ahead (MAX_READAHEAD + 1)*PAGE_CACHE_SIZE.
- * Compute the position of the last page we have tried to read in order to 
- * begin to read ahead just at the next page.
- */
-		raend -= 1;
-		if (raend < end_index)
-			max_ahead = filp->f_ramax + 1;
-
-		if (max_ahead) {
-			filp->f_rawin = filp->f_ralen;
-			filp->f_ralen = 0;
-			reada_ok      = 2;
-		}
+
+	/* Random access, or a new stream. Wait and see. */
+	lru->next = index + 1;
+	lru->ahead = index + 1;
+	lru->size = 0;
+	lru->stamp = ++ra->stamp;
+	if (ra->advice != POSIX_FADV_SEQUENTIAL)
+		return;
+
+	/* Unless we were told it is sequential, then go all the way. */
+	s = lru;
+	s->size = get_max_readahead(inode);
+	goto read_ahead;
+
+sequential:
+	s->next = index + 1;
+	s->stamp = ++ra->stamp;
+	if (index >= s->ahead) {
+		/* We are past the window, or there was none yet */
+		if (bdev && !cached)
+			bdev->bd_ra_misses++;
+		s->ahead = index + 1;
+	} else if (cached) {
+		if (bdev)
+			bdev->bd_ra_hits++;
+	} else {
+		/* We did read it ahead, but it got evicted again. */
+		if (bdev)
+			bdev->bd_ra_thrashed++;
+		s->size >>= 1;
+		if (s->size < MIN_READAHEAD)
+			s->size = MIN_READAHEAD;
+		s->ahead = index + 1;
+		goto read_ahead;
 	}
+
+	/* Enough read ahead still in front of us? */
+	if (s->ahead - (index + 1) > s->size / 2)
+		return;
+
+	if (!s->size)
+		s->size = MIN_READAHEAD;
+	else
+		s->size <<= 1;
+	if (s->size > get_max_readahead(inode))
+		s->size = get_max_readahead(inode);
+
 /*
  * Try to read ahead pages.
  * We hope that ll_rw_blk() plug/unplug, coalescence, requests sort and the
  * scheduler, will work enough for us to avoid too bad actuals IO requests.
  */
-	ahead = 0;
-	while (ahead < max_ahead) {
-		ahead ++;
-		if ((raend + ahead) >= end_index)
-			break;
-		if (page_cache_read(filp, raend + ahead) < 0)
+read_ahead:
+	last = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	end = s->ahead + s->size;
+	if (end > last)
+		end = last;
+	for (ahead = s->ahead; ahead < end; ahead++) {
+		if (page_cache_read(filp, ahead) < 0)
 			break;
 	}
-/*
- * If we tried to read ahead some pages,
- * If we tried to read ahead asynchronously,
- *   Try to force unplug of the device in order to start an asynchronous
- *   read IO request.
- * Update the read-ahead context.
- * Store the length of the current read-ahead window.
- * Double the current max read ahead size.
- *   That heuristic avoid to do some large IO for files that are not really
- *   accessed sequentially.
- */
-	if (ahead) {
-		if (reada_ok == 2) {
-			run_task_queue(&tq_disk);
-		}
-
-		filp->f_ralen += ahead;
-		filp->f_rawin += filp->f_ralen;
-		filp->f_raend = raend + ahead + 1;
-
-		filp->f_ramax += filp->f_ramax;
-
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
-
-		/*
-		 * Move the pages that have already been passed
-		 * to the inactive list.
-		 */
-		drop_behind(filp, index);
+	if (ahead == s->ahead)
+		return;
+	s->ahead = ahead;
 
-#ifdef PROFILE_READAHEAD
-		profile_readahead((reada_ok == 2), filp);
-#endif
-	}
+	/* Start the IO now, the reader will get to it soon enough. */
+	run_task_queue(&tq_disk);
 
-	return;
+	/*
+	 * Move the pages that have already been passed
+	 * to the inactive list.
+	 */
+	drop_behind(filp, index, s->size);
 }
 
-
 /*
  * This is a generic file read routine, and uses the
  * inode->i_op->readpage() function for the actual low-level
@@ -1015,59 +958,18 @@ static void generic_file_readahead(int reada_ok,
  */
 void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t * desc, read_actor_t actor)
 {
-	struct inode *inode = filp->f_dentry->d_inode;
-	struct address_space *mapping = inode->i_mapping;
+	struct address_space *mapping = filp->f_dentry->d_inode->i_mapping;
+	struct inode *inode = mapping->host;
 	unsigned long index, offset;
 	struct page *cached_page;
-	int reada_ok;
 	int error;
-	int max_readahead = get_max_readahead(inode);
 
 	cached_page = NULL;
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
 
-/*
- * If the current position is outside the previous read-ahead window, 
- * we reset the current read-ahead context and set read ahead max to zero
- * (will be set to just needed value later),
- * otherwise, we assume that the file accesses are sequential enough to
- * continue read-ahead.
- */
-	if (index > filp->f_raend || index + filp->f_rawin < filp->f_raend) {
-		reada_ok = 0;
-		filp->f_raend = 0;
-		filp->f_ralen = 0;
-		filp->f_ramax = 0;
-		filp->f_rawin = 0;
-	} else {
-		reada_ok = 1;
-	}
-/*
- * Adjust the current value of read-ahead max.
- * If the read operation stay in the first half page, force no readahead.
- * Otherwise try to increase read ahead max just enough to do the read request.
- * Then, at least MIN_READAHEAD if read ahead is ok,
- * and at most MAX_READAHEAD in all cases.
- */
-	if (!index && offset + desc->count <= (PAGE_CACHE_SIZE >> 1)) {
-		filp->f_ramax = 0;
-	} else {
-		unsigned long needed;
-
-		needed = ((offset + desc->count) >> PAGE_CACHE_SHIFT) + 1;
-
-		if (filp->f_ramax < needed)
-			filp->f_ramax = needed;
-
-		if (reada_ok && filp->f_ramax < MIN_READAHEAD)
-				filp->f_ramax = MIN_READAHEAD;
-		if (filp->f_ramax > max_readahead)
-			filp->f_ramax = max_readahead;
-	}
-
 	for (;;) {
-		struct page *page, **hash;
+		struct page *page;
 		unsigned long end_index, nr;
 
 		end_index = inode->i_size >> PAGE_CACHE_SHIFT;
@@ -1085,19 +987,16 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 		/*
 		 * Try to find the data in the page cache..
 		 */
-		hash = page_hash(mapping, index);
-
-		spin_lock(&pagecache_lock);
-		page = __find_page_nolock(mapping, index, *hash);
+		spin_lock(&mapping->page_lock);
+		page = __find_page_nolock(mapping, index);
 		if (!page)
 			goto no_cached_page;
-found_page:
 		page_cache_get(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
+		generic_file_readahead(filp, inode, index, 1);
 		if (!Page_Uptodate(page))
 			goto page_not_up_to_date;
-		generic_file_readahead(reada_ok, filp, inode, page);
 page_ok:
 		/* If users can be writing to this page using arbitrary
 		 * virtual addresses, take care about potential aliasing
@@ -1119,6 +1018,10 @@ page_ok:
 		nr = actor(desc, page, offset, nr);
 		offset += nr;
 		index += offset >> PAGE_CACHE_SHIFT;
+		/* Done with the page, and it won't be read again? */
+		if ((offset >> PAGE_CACHE_SHIFT) &&
+		    filp->f_ra.advice == POSIX_FADV_NOREUSE)
+			invalidate_unused_page(page);
 		offset &= ~PAGE_CACHE_MASK;
 	
 		page_cache_release(page);
@@ -1130,8 +1033,6 @@ page_ok:
  * Ok, the page was not immediately readable, so let's try to read ahead while we're at it..
  */
 page_not_up_to_date:
-		generic_file_readahead(reada_ok, filp, inode, page);
-
 		if (Page_Uptodate(page))
 			goto page_ok;
 
@@ -1159,8 +1060,8 @@ readpage:
 			if (Page_Uptodate(page))
 				goto page_ok;
 
-			/* Again, try some read-ahead while waiting for the page to finish.. */
-			generic_file_readahead(reada_ok, filp, inode, page);
+			/* Try some read-ahead while waiting for the page to finish.. */
+			generic_file_readahead(filp, inode, index, 0);
 			wait_on_page(page);
 			if (Page_Uptodate(page))
 				goto page_ok;
@@ -1177,32 +1078,30 @@ no_cached_page:
 		 * Ok, it wasn't cached, so we need to create a new
 		 * page..
 		 *
-		 * We get here with the page cache lock held.
+		 * We get here with the page_lock held.
 		 */
+		spin_unlock(&mapping->page_lock);
 		if (!cached_page) {
-			spin_unlock(&pagecache_lock);
 			cached_page = page_cache_alloc();
 			if (!cached_page) {
 				desc->error = -ENOMEM;
 				break;
 			}
-
-			/*
-			 * Somebody may have added the page while we
-			 * dropped the page cache lock. Check for that.
-			 */
-			spin_lock(&pagecache_lock);
-			page = __find_page_nolock(mapping, index, *hash);
-			if (page)
-				goto found_page;
 		}
 
 		/*
-		 * Ok, add the new page to the hash-queues...
+		 * Ok, add the new page to the page cache. If somebody
+		 * added the page while we dropped the page_lock, go
+		 * back and use theirs.
 		 */
+		error = add_to_page_cache(cached_page, mapping, index, GFP_KERNEL);
+		if (error) {
+			if (error == -EEXIST)
+				continue;
+			desc->error = error;
+			break;
+		}
 		page = cached_page;
-		__add_to_page_cache(page, mapping, index, hash);
-		spin_unlock(&pagecache_lock);
 		cached_page = NULL;
 
 		goto readpage;
@@ -1212,29 +1111,295 @@ no_cached_page:
 	filp->f_reada = 1;
 	if (cached_page)
 		page_cache_free(cached_page);
+	UPDATE_ATIME(filp->f_dentry->d_inode);
+}
+
+/*
+ * Copy part of a page to user space. A highmem page is tried through
+ * the atomic kmap first, which does not touch the shared kmap pool: we
+ * must not sleep holding it, so a fault on the user buffer fails the
+ * copy instead of being handled, and the rest is copied through kmap().
+ * Returns what could not be copied, like copy_to_user().
+ */
+static inline unsigned long copy_page_to_user(char *to, struct page *page,
+	unsigned long offset, unsigned long size)
+{
+	unsigned long left;
+	char *kaddr;
+
+#ifdef CONFIG_HIGHMEM
+	if (PageHighMem(page)) {
+		unsigned long done;
+
+		kaddr = kmap_atomic(page, KM_USER0);
+		current->flags |= PF_ATOMICCOPY;
+		left = __copy_to_user(to, kaddr + offset, size);
+		current->flags &= ~PF_ATOMICCOPY;
+		kunmap_atomic(kaddr, KM_USER0);
+		if (!left)
+			return 0;
+		done = size - left;
+		to += done;
+		offset += done;
+		size = left;
+	}
+#endif
+	kaddr = kmap(page);
+	left = __copy_to_user(to, kaddr + offset, size);
+	kunmap(page);
+	return left;
+}
+
+static int file_read_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size)
+{
+	unsigned long left, count = desc->count;
+
+	if (size > count)
+		size = count;
+
+	left = copy_page_to_user(desc->buf, page, offset, size);
+
+	if (left) {
+		size -= left;
+		desc->error = -EFAULT;
+	}
+	desc->count = count - size;
+	desc->written += size;
+	desc->buf += size;
+	return size;
+}
+
+/*
+ * The cached pages of a range the disk was written under by O_DIRECT
+ * are stale. Drop them or, if they are in use, make the next read go
+ * to the disk. Pages with dirty data stay, that is newer still.
+ */
+static void invalidate_direct_range(struct address_space * mapping,
+	unsigned long start, unsigned long end)
+{
+	struct page *pages[TRUNCATE_BATCH];
+	unsigned int i, nr;
+
+	while (start <= end) {
+		nr = find_get_pages(mapping, start, TRUNCATE_BATCH, pages);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+			struct buffer_head *bh;
+
+			start = page->index + 1;
+			if (page->index > end)
+				goto release;
+			invalidate_unused_page(page);
+			lock_page(page);
+			if (page->mapping != mapping || PageDirty(page))
+				goto unlock;
+			bh = page->buffers;
+			if (bh) {
+				do {
+					if (buffer_dirty(bh))
+						goto unlock;
+					bh = bh->b_this_page;
+				} while (bh != page->buffers);
+				do_flushpage(page, 0);
+			}
+			ClearPageUptodate(page);
+unlock:
+			UnlockPage(page);
+release:
+			page_cache_release(page);
+		}
+		/* Wrapped around after the last possible index? */
+		if (!start)
+			break;
+	}
+}
+
+/* The disk must not be older than the cache on the range */
+static int direct_IO_sync_range(struct inode * inode,
+	unsigned long start, unsigned long end)
+{
+	struct address_space * mapping = inode->i_mapping;
+	int err;
+
+	filemap_fdatasync(mapping);
+	err = generic_buffer_fdatasync(inode, start, end + 1);
+	filemap_fdatawait(mapping);
+	return err;
+}
+
+/*
+ * O_DIRECT reads and writes go between the disk and the user pages,
+ * without the page cache. offset and count must be multiples of the
+ * block size, and buf of the hardware sector size.
+ */
+static ssize_t generic_file_direct_IO(int rw, struct file * filp, char * buf,
+	size_t count, loff_t offset)
+{
+	struct inode * inode = filp->f_dentry->d_inode;
+	struct address_space * mapping = inode->i_mapping;
+	int blocksize = inode->i_sb->s_blocksize;
+	int blocksize_bits = inode->i_sb->s_blocksize_bits;
+	unsigned long start, end;
+	struct kiobuf * iobuf;
+	ssize_t progress = 0;
+	int iosize, err;
+
+	if ((offset & (blocksize - 1)) || (count & (blocksize - 1)))
+		return -EINVAL;
+	if (!mapping->a_ops->direct_IO)
+		return -EINVAL;
+	if (!count)
+		return 0;
+
+	start = offset >> PAGE_CACHE_SHIFT;
+	end = (offset + count - 1) >> PAGE_CACHE_SHIFT;
+	err = direct_IO_sync_range(inode, start, end);
+	if (err)
+		return err;
+
+	err = alloc_kiovec(1, &iobuf);
+	if (err)
+		return err;
+
+	while (count > 0) {
+		iosize = KIO_MAX_ATOMIC_BYTES;
+		if (count < iosize)
+			iosize = count;
+
+		err = map_user_kiobuf(rw, iobuf, (unsigned long) buf, iosize);
+		if (err)
+			break;
+		err = mapping->a_ops->direct_IO(rw, inode, iobuf,
+				(offset + progress) >> blocksize_bits, blocksize);
+		if (rw == READ && err > 0)
+			mark_dirty_kiobuf(iobuf, err);
+		unmap_kiobuf(iobuf);
+
+		if (err > 0) {
+			count -= err;
+			buf += err;
+			progress += err;
+		}
+		if (err != iosize)
+			break;
+	}
+	free_kiovec(1, &iobuf);
+
+	if (rw == WRITE && progress)
+		invalidate_direct_range(mapping, start, end);
+	return progress ? progress : err;
+}
+
+/*
+ * generic_file_direct_IO() for aio: the kiobufs' IO is only started,
+ * and the request completes once it is all done. Truncate waits for
+ * it, see inode_dio_wait().
+ */
+static ssize_t generic_file_aio_direct_IO(int rw, struct kiocb * iocb,
+	char * buf, size_t count, loff_t offset)
+{
+	struct inode * inode = iocb->ki_filp->f_dentry->d_inode;
+	struct address_space * mapping = inode->i_mapping;
+	int blocksize = inode->i_sb->s_blocksize;
+	int blocksize_bits = inode->i_sb->s_blocksize_bits;
+	struct kiobuf * iobuf;
+	int iosize, err;
+
+	if ((offset & (blocksize - 1)) || (count & (blocksize - 1)))
+		return -EINVAL;
+	if (!mapping->a_ops->direct_IO)
+		return -EINVAL;
+	if (!count)
+		return 0;
+
+	err = direct_IO_sync_range(inode, offset >> PAGE_CACHE_SHIFT,
+			(offset + count - 1) >> PAGE_CACHE_SHIFT);
+	if (err)
+		return err;
+
+	/* Dropped when the request's IO is done */
+	atomic_inc(&inode->i_dio_count);
+	iocb->ki_dio_inode = inode;
+
+	while (count > 0) {
+		iosize = KIO_MAX_ATOMIC_BYTES;
+		if (count < iosize)
+			iosize = count;
+
+		iobuf = aio_map_kiobuf(iocb, rw, buf, iosize);
+		if (IS_ERR(iobuf)) {
+			err = PTR_ERR(iobuf);
+			break;
+		}
+		err = mapping->a_ops->direct_IO(rw, inode, iobuf,
+				offset >> blocksize_bits, blocksize);
+		if (err) {
+			aio_kiobuf_error(iobuf, err);
+			break;
+		}
+		count -= iosize;
+		buf += iosize;
+		offset += iosize;
+	}
+	return iocb->ki_nr_iobufs ? -EIOCBQUEUED : err;
+}
+
+/* read() with O_DIRECT. The last block of the file is read whole. */
+static ssize_t generic_file_direct_read(struct file * filp, char * buf,
+	size_t count, loff_t *ppos)
+{
+	struct inode * inode = filp->f_dentry->d_inode;
+	loff_t pos = *ppos, size = inode->i_size;
+	ssize_t retval = 0;
+
+	if (pos < size) {
+		if (count > size - pos) {
+			loff_t mask = inode->i_sb->s_blocksize - 1;
+			loff_t tail = (size - pos + mask) & ~mask;
+
+			if (tail < count)
+				count = tail;
+		}
+		retval = generic_file_direct_IO(READ, filp, buf, count, pos);
+		if (retval > size - pos)
+			retval = size - pos;
+		if (retval > 0)
+			*ppos = pos + retval;
+	}
 	UPDATE_ATIME(inode);
+	return retval;
 }
 
-static int file_read_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size)
+/*
+ * aio_read() for the page cache filesystems. O_DIRECT reads are
+ * queued, the others are done right away.
+ */
+ssize_t generic_file_aio_read(struct kiocb * iocb, char * buf, size_t count, loff_t pos)
 {
-	char *kaddr;
-	unsigned long left, count = desc->count;
+	struct file * filp = iocb->ki_filp;
+	struct inode * inode = filp->f_dentry->d_inode;
+	loff_t size = inode->i_size;
+	ssize_t retval = 0;
 
-	if (size > count)
-		size = count;
+	if (!(filp->f_flags & O_DIRECT))
+		return generic_file_read(filp, buf, count, &pos);
 
-	kaddr = kmap(page);
-	left = __copy_to_user(desc->buf, kaddr + offset, size);
-	kunmap(page);
-	
-	if (left) {
-		size -= left;
-		desc->error = -EFAULT;
+	/* As in generic_file_direct_read() */
+	if (pos < size) {
+		if (count > size - pos) {
+			loff_t mask = inode->i_sb->s_blocksize - 1;
+			loff_t tail = (size - pos + mask) & ~mask;
+
+			if (tail < count)
+				count = tail;
+			iocb->ki_limit = size - pos;
+		}
+		retval = generic_file_aio_direct_IO(READ, iocb, buf, count, pos);
 	}
-	desc->count = count - size;
-	desc->written += size;
-	desc->buf += size;
-	return size;
+	UPDATE_ATIME(inode);
+	return retval;
 }
 
 /*
@@ -1249,7 +1414,9 @@ ssize_t generic_file_read(struct file * filp, char * buf, size_t count, loff_t *
 	if (access_ok(VERIFY_WRITE, buf, count)) {
 		retval = 0;
 
-		if (count) {
+		if (count && (filp->f_flags & O_DIRECT))
+			retval = generic_file_direct_read(filp, buf, count, ppos);
+		else if (count) {
 			read_descriptor_t desc;
 
 			desc.written = 0;
@@ -1266,16 +1433,20 @@ ssize_t generic_file_read(struct file * filp, char * buf, size_t count, loff_t *
 	return retval;
 }
 
-static int file_send_actor(read_descriptor_t * desc, struct page *page, unsigned long offset , unsigned long size)
+/*
+ * Hand part of a page to a file's sendpage method or, failing that,
+ * to its write method straight from the kernel mapping, with no copy
+ * through user space.  Used by sendfile() and by splice() out of a pipe.
+ */
+ssize_t file_write_page(struct file *file, struct page *page, unsigned long offset, unsigned long size)
 {
 	char *kaddr;
 	ssize_t written;
-	unsigned long count = desc->count;
-	struct file *file = (struct file *) desc->buf;
 	mm_segment_t old_fs;
 
-	if (size > count)
-		size = count;
+	if (file->f_op->sendpage)
+		return file->f_op->sendpage(file, page, offset, size, &file->f_pos);
+
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
 
@@ -1283,6 +1454,18 @@ static int file_send_actor(read_descriptor_t * desc, struct page *page, unsigned
 	written = file->f_op->write(file, kaddr + offset, size, &file->f_pos);
 	kunmap(page);
 	set_fs(old_fs);
+	return written;
+}
+
+static int file_send_actor(read_descriptor_t * desc, struct page *page, unsigned long offset , unsigned long size)
+{
+	ssize_t written;
+	unsigned long count = desc->count;
+	struct file *file = (struct file *) desc->buf;
+
+	if (size > count)
+		size = count;
+	written = file_write_page(file, page, offset, size);
 	if (written < 0) {
 		desc->error = written;
 		written = 0;
@@ -1436,9 +1619,9 @@ struct page * filemap_nopage(struct vm_area_struct * area,
 {
 	int error;
 	struct file *file = area->vm_file;
-	struct inode *inode = file->f_dentry->d_inode;
-	struct address_space *mapping = inode->i_mapping;
-	struct page *page, **hash, *old_page;
+	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
+	struct inode *inode = mapping->host;
+	struct page *page, *old_page;
 	unsigned long size, pgoff;
 
 	pgoff = ((address - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
@@ -1455,9 +1638,8 @@ retry_all:
 	/*
 	 * Do we have something in the page cache already?
 	 */
-	hash = page_hash(mapping, pgoff);
 retry_find:
-	page = __find_get_page(mapping, pgoff, hash);
+	page = find_get_page(mapping, pgoff);
 	if (!page)
 		goto no_cached_page;
 
@@ -1582,6 +1764,95 @@ page_not_uptodate:
 	return NULL;
 }
 
+/*
+ * Fault-around: once a read fault on a file mapping has been served,
+ * also map the pages of the fault_around_pages sized window around it
+ * that are up to date in the page cache already. Starting a large
+ * binary or scanning a mapped file then takes one fault per window
+ * instead of one per page. Pages under IO and ones that are already
+ * mapped are left alone, and 0 or 1 turns it off.
+ *
+ * Like in do_no_page(), the mm semaphore keeps other faults out, and
+ * kswapd only ever takes present ptes away.
+ */
+int fault_around_pages = 16;
+
+/*
+ * Map the up to date page cache pages of [start, end), which lie within
+ * one page table and at most FAULT_AROUND_MAX pages; page_table is the
+ * pte for start.
+ */
+static void filemap_map_cached(struct vm_area_struct * area,
+	unsigned long start, unsigned long end, pte_t * page_table)
+{
+	struct mm_struct *mm = area->vm_mm;
+	struct file *file = area->vm_file;
+	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
+	struct page *pages[FAULT_AROUND_MAX];
+	unsigned long pgoff, size, addr;
+	unsigned int i, nr;
+
+	pgoff = ((start - area->vm_start) >> PAGE_SHIFT) + area->vm_pgoff;
+	size = (mapping->host->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	nr = find_get_pages(mapping, pgoff, (end - start) >> PAGE_SHIFT, pages);
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+		pte_t *pte, entry;
+
+		addr = start + ((page->index - pgoff) << PAGE_SHIFT);
+		if (addr >= end || page->index >= size)
+			goto skip;
+		pte = page_table + ((addr - start) >> PAGE_SHIFT);
+		if (!pte_none(*pte))
+			goto skip;
+		if (!Page_Uptodate(page) || PageLocked(page) ||
+		    page->mapping != mapping)
+			goto skip;
+
+		/* The reference from find_get_pages() is the pte's now */
+		++mm->rss;
+		flush_page_to_ram(page);
+		flush_icache_page(area, page);
+		entry = pte_mkold(mk_pte(page, area->vm_page_prot));
+		if (!(area->vm_flags & VM_SHARED))
+			entry = pte_wrprotect(entry);
+		set_pte(pte, entry);
+		page_add_rmap(page, mm, addr);
+		update_mmu_cache(area, addr, entry);
+		continue;
+skip:
+		page_cache_release(page);
+	}
+}
+
+static void filemap_fault_around(struct vm_area_struct * area,
+	unsigned long address, pte_t * page_table)
+{
+	unsigned long window = fault_around_pages;
+	unsigned long start, end;
+
+	if (window <= 1 || window > FAULT_AROUND_MAX || VM_RandomReadHint(area))
+		return;
+
+	/* An aligned window, cut to the vma and to this page table */
+	address &= PAGE_MASK;
+	start = address - ((address >> PAGE_SHIFT) % window) * PAGE_SIZE;
+	end = start + window * PAGE_SIZE;
+	if (start < area->vm_start)
+		start = area->vm_start;
+	if (start < (address & PMD_MASK))
+		start = address & PMD_MASK;
+	if (end > area->vm_end || end < start)
+		end = area->vm_end;
+	if (end > (address & PMD_MASK) + PMD_SIZE)
+		end = (address & PMD_MASK) + PMD_SIZE;
+
+	/* the faulting page itself is mapped already */
+	filemap_map_cached(area, start, end,
+		page_table - ((address - start) >> PAGE_SHIFT));
+}
+
 /* Called with mm->page_table_lock held to protect against other
  * threads/the swapper from ripping pte's out from under us.
  */
@@ -1693,6 +1964,7 @@ int filemap_sync(struct vm_area_struct * vma, unsigned long address,
  */
 static struct vm_operations_struct file_shared_mmap = {
 	nopage:		filemap_nopage,
+	fault_around:	filemap_fault_around,
 };
 
 /*
@@ -1703,6 +1975,7 @@ static struct vm_operations_struct file_shared_mmap = {
  */
 static struct vm_operations_struct file_private_mmap = {
 	nopage:		filemap_nopage,
+	fault_around:	filemap_fault_around,
 };
 
 /* This is used for a general mmap of a disk file */
@@ -1718,7 +1991,7 @@ int generic_file_mmap(struct file * file, struct vm_area_struct * vma)
 			return -EINVAL;
 		ops = &file_shared_mmap;
 	}
-	if (!inode->i_sb || !S_ISREG(inode->i_mode))
+	if (!inode->i_sb || !(S_ISREG(inode->i_mode) || S_ISBLK(inode->i_mode)))
 		return -EACCES;
 	if (!inode->i_mapping->a_ops->readpage)
 		return -ENOEXEC;
@@ -1735,6 +2008,9 @@ static int msync_interval(struct vm_area_struct * vma,
 	unsigned long start, unsigned long end, int flags)
 {
 	struct file * file = vma->vm_file;
+	/* Big pages have no backing store to write to */
+	if (vma->vm_flags & VM_BIGPAGE)
+		return 0;
 	if (file && (vma->vm_flags & VM_SHARED)) {
 		int error;
 		error = filemap_sync(vma, start, end-start, flags);
@@ -1960,7 +2236,7 @@ static long madvise_willneed(struct vm_area_struct * vma,
 	if (!vma->vm_file)
 		return error;
 	file = vma->vm_file;
-	size = (file->f_dentry->d_inode->i_size + PAGE_CACHE_SIZE - 1) >>
+	size = (file->f_dentry->d_inode->i_mapping->host->i_size + PAGE_CACHE_SIZE - 1) >>
 							PAGE_CACHE_SHIFT;
 
 	start = ((start - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
@@ -2001,6 +2277,50 @@ static long madvise_willneed(struct vm_area_struct * vma,
 	return error;
 }
 
+/*
+ * Set up the page tables of a new file mapping (MAP_POPULATE, and the
+ * ELF loader): start reading what is not in the page cache, and map
+ * what is up to date in it already, so that a large program does not
+ * take a minor fault for every page it touches.  Pages still under IO
+ * are left to fault as usual.  The caller holds the mm semaphore.
+ */
+void filemap_populate(struct vm_area_struct * vma,
+	unsigned long start, unsigned long end)
+{
+	unsigned long next;
+	pgd_t *pgd;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	if (!vma->vm_file || !vma->vm_ops ||
+	    vma->vm_ops->nopage != filemap_nopage)
+		return;
+	if (start < vma->vm_start)
+		start = vma->vm_start;
+	if (end > vma->vm_end)
+		end = vma->vm_end;
+
+	madvise_willneed(vma, start, end);
+
+	while (start < end) {
+		next = (start & PMD_MASK) + PMD_SIZE;
+		if (next > start + FAULT_AROUND_MAX * PAGE_SIZE)
+			next = start + FAULT_AROUND_MAX * PAGE_SIZE;
+		if (next > end || next < start)
+			next = end;
+
+		pgd = pgd_offset(vma->vm_mm, start);
+		pmd = pmd_alloc(pgd, start);
+		if (!pmd)
+			break;
+		pte = pte_alloc(pmd, start);
+		if (!pte)
+			break;
+		filemap_map_cached(vma, start, next, pte);
+		start = next;
+	}
+}
+
 /*
  * Application no longer needs these pages.  If the pages are dirty,
  * it's OK to just throw them away.  The app will be more careful about
@@ -2027,8 +2347,7 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 		return -EINVAL;
 
 	flush_cache_range(vma->vm_mm, start, end);
-	zap_page_range(vma->vm_mm, start, end - start);
-	flush_tlb_range(vma->vm_mm, start, end);
+	zap_page_range(vma->vm_mm, start, end - start, ZPR_COND_RESCHED);
 	return 0;
 }
 
@@ -2037,6 +2356,10 @@ static long madvise_vma(struct vm_area_struct * vma, unsigned long start,
 {
 	long error = -EBADF;
 
+	/* Neither splitting nor zapping part of a big page area works */
+	if (vma->vm_flags & VM_BIGPAGE)
+		return -EINVAL;
+
 	switch (behavior) {
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
@@ -2156,6 +2479,144 @@ out:
 	return error;
 }
 
+/*
+ * Start reading the pages from start to end, but don't wait for them.
+ * One call may not take more than half of the free memory.
+ */
+static long fadvise_willneed(struct file * file, unsigned long start,
+	unsigned long end)
+{
+	struct inode *inode = file->f_dentry->d_inode->i_mapping->host;
+	unsigned long size, max;
+	int error = 0;
+
+	if (!inode->i_mapping->a_ops->readpage)
+		return -EINVAL;
+
+	size = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	if (start >= size)
+		return 0;
+	if (end >= size)
+		end = size - 1;
+	max = nr_free_pages() / 2;
+	if (end - start >= max)
+		end = start + max - 1;
+
+	for (; start <= end && max; start++) {
+		error = page_cache_read(file, start);
+		if (error < 0)
+			break;
+	}
+	run_task_queue(&tq_disk);
+	return error < 0 ? error : 0;
+}
+
+/*
+ * Drop the clean and unused pages from start to end out of the page
+ * cache. Dirty, mapped or otherwise busy pages stay.
+ */
+static void fadvise_dontneed(struct address_space * mapping,
+	unsigned long start, unsigned long end)
+{
+	struct page *pages[TRUNCATE_BATCH];
+	unsigned int i, nr;
+
+	while (start <= end) {
+		nr = find_get_pages(mapping, start, TRUNCATE_BATCH, pages);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+
+			start = page->index + 1;
+			if (page->index <= end)
+				invalidate_unused_page(page);
+			page_cache_release(page);
+		}
+		/* Wrapped around after the last possible index? */
+		if (!start)
+			break;
+	}
+}
+
+/*
+ * The fadvise64(2) system call.
+ *
+ * The file descriptor counterpart of madvise(): tells the page cache
+ * how the file will be read. POSIX_FADV_NORMAL, _RANDOM, _SEQUENTIAL
+ * and _NOREUSE set the read-ahead behaviour of the whole file, not
+ * just of the range:
+ *  POSIX_FADV_NORMAL - the default, adaptive read-ahead.
+ *  POSIX_FADV_RANDOM - never read ahead.
+ *  POSIX_FADV_SEQUENTIAL - read ahead the maximum right away.
+ *  POSIX_FADV_NOREUSE - like the default, but pages that read() is
+ *		done with are dropped from the page cache, so a
+ *		streaming reader does not push everybody else out.
+ *  POSIX_FADV_WILLNEED - start reading the range.
+ *  POSIX_FADV_DONTNEED - drop the clean pages of the range from the
+ *		page cache.
+ *
+ * A len of zero means up to the end of the file.
+ *
+ * return values:
+ *  zero    - success
+ *  -EBADF  - fd isn't a valid file descriptor.
+ *  -ESPIPE - fd is a pipe or FIFO.
+ *  -EINVAL - offset or advice is invalid, or pages of this file can't
+ *		be read ahead.
+ */
+asmlinkage long sys_fadvise64(int fd, loff_t offset, size_t len, int advice)
+{
+	struct file * file;
+	struct inode * inode;
+	unsigned long start, end;
+	long error = -EBADF;
+
+	file = fget(fd);
+	if (!file)
+		goto out;
+
+	inode = file->f_dentry->d_inode;
+	error = -ESPIPE;
+	if (S_ISFIFO(inode->i_mode))
+		goto out_fput;
+
+	error = -EINVAL;
+	if (offset < 0 || !inode->i_mapping)
+		goto out_fput;
+	start = offset >> PAGE_CACHE_SHIFT;
+	end = ~0UL;
+	if (len && ((offset + len - 1) >> PAGE_CACHE_SHIFT) < end)
+		end = (offset + len - 1) >> PAGE_CACHE_SHIFT;
+
+	error = 0;
+	switch (advice) {
+	case POSIX_FADV_NORMAL:
+	case POSIX_FADV_RANDOM:
+	case POSIX_FADV_SEQUENTIAL:
+	case POSIX_FADV_NOREUSE:
+		file->f_ra.advice = advice;
+		break;
+
+	case POSIX_FADV_WILLNEED:
+		error = fadvise_willneed(file, start, end);
+		break;
+
+	case POSIX_FADV_DONTNEED:
+		fadvise_dontneed(inode->i_mapping, start, end);
+		break;
+
+	default:
+		error = -EINVAL;
+		break;
+	}
+
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
 /*
  * Later we can get more picky about what "in core" means precisely.
  * For now, simply check to see if the page is in the page cache,
@@ -2167,13 +2628,13 @@ static unsigned char mincore_page(struct vm_area_struct * vma,
 {
 	unsigned char present = 0;
 	struct address_space * as = &vma->vm_file->f_dentry->d_inode->i_data;
-	struct page * page, ** hash = page_hash(as, pgoff);
+	struct page * page;
 
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(as, pgoff, *hash);
+	spin_lock(&as->page_lock);
+	page = __find_page_nolock(as, pgoff);
 	if ((page) && (Page_Uptodate(page)))
 		present = 1;
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&as->page_lock);
 
 	return present;
 }
@@ -2316,11 +2777,10 @@ struct page *__read_cache_page(struct address_space *mapping,
 				int (*filler)(void *,struct page*),
 				void *data)
 {
-	struct page **hash = page_hash(mapping, index);
 	struct page *page, *cached_page = NULL;
 	int err;
 repeat:
-	page = __find_get_page(mapping, index, hash);
+	page = find_get_page(mapping, index);
 	if (!page) {
 		if (!cached_page) {
 			cached_page = page_cache_alloc();
@@ -2328,8 +2788,13 @@ repeat:
 				return ERR_PTR(-ENOMEM);
 		}
 		page = cached_page;
-		if (add_to_page_cache_unique(page, mapping, index, hash))
+		err = add_to_page_cache(page, mapping, index, GFP_KERNEL);
+		if (err == -EEXIST)
 			goto repeat;
+		if (err < 0) {
+			page_cache_free(cached_page);
+			return ERR_PTR(err);
+		}
 		cached_page = NULL;
 		err = filler(data, page);
 		if (err < 0) {
@@ -2381,9 +2846,10 @@ retry:
 static inline struct page * __grab_cache_page(struct address_space *mapping,
 				unsigned long index, struct page **cached_page)
 {
-	struct page *page, **hash = page_hash(mapping, index);
+	struct page *page;
+	int err;
 repeat:
-	page = __find_lock_page(mapping, index, hash);
+	page = find_lock_page(mapping, index);
 	if (!page) {
 		if (!*cached_page) {
 			*cached_page = page_cache_alloc();
@@ -2391,8 +2857,11 @@ repeat:
 				return NULL;
 		}
 		page = *cached_page;
-		if (add_to_page_cache_unique(page, mapping, index, hash))
+		err = add_to_page_cache(page, mapping, index, GFP_KERNEL);
+		if (err == -EEXIST)
 			goto repeat;
+		if (err < 0)
+			return NULL;
 		*cached_page = NULL;
 	}
 	return page;
@@ -2426,6 +2895,98 @@ static inline void remove_suid(struct inode *inode)
 	}
 }
 
+/*
+ * Write up to WRITE_BATCH_PAGES pages through the address_space's
+ * prepare_write_pages and commit_write_pages.  Returns the number of
+ * bytes written or an error if nothing was.
+ */
+#define WRITE_BATCH_PAGES	16
+
+static long generic_file_write_pages(struct file *file,
+	struct address_space *mapping, loff_t pos, const char *buf,
+	size_t count, struct page **cached_page)
+{
+	struct page *pages[WRITE_BATCH_PAGES];
+	unsigned long index = pos >> PAGE_CACHE_SHIFT;
+	unsigned from = pos & (PAGE_CACHE_SIZE - 1), to, len;
+	unsigned long done, bytes;
+	int nr, prepared, copied, i;
+	long status;
+
+	nr = (from + count + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	if (nr > WRITE_BATCH_PAGES)
+		nr = WRITE_BATCH_PAGES;
+
+	/* Bring in the source pages first, see generic_file_write() */
+	bytes = ((unsigned long) nr << PAGE_CACHE_SHIFT) - from;
+	if (bytes > count)
+		bytes = count;
+	{ volatile unsigned char dummy;
+		for (done = 0; done < bytes; done += PAGE_SIZE)
+			__get_user(dummy, buf+done);
+		__get_user(dummy, buf+bytes-1);
+	}
+
+	for (i = 0; i < nr; i++) {
+		pages[i] = __grab_cache_page(mapping, index + i, cached_page);
+		if (!pages[i])
+			break;
+	}
+	nr = i;
+	status = -ENOMEM;
+	if (!nr)
+		return status;
+
+	bytes = ((unsigned long) nr << PAGE_CACHE_SHIFT) - from;
+	if (bytes > count)
+		bytes = count;
+	to = from + bytes - ((nr - 1) << PAGE_CACHE_SHIFT);
+	prepared = mapping->a_ops->prepare_write_pages(file, pages, nr, from, to);
+	if (prepared <= 0) {
+		status = prepared;
+		goto unlock;
+	}
+	/* The last page prepared is whole if it isn't the last one grabbed */
+	if (prepared < nr)
+		to = PAGE_CACHE_SIZE;
+
+	done = 0;
+	for (copied = 0; copied < prepared; copied++) {
+		char *kaddr = page_address(pages[copied]);
+		unsigned off = copied ? 0 : from;
+
+		len = (copied < prepared - 1 ? PAGE_CACHE_SIZE : to) - off;
+		status = __copy_from_user(kaddr + off, buf + done, len);
+		flush_dcache_page(pages[copied]);
+		if (status)
+			break;
+		done += len;
+	}
+	if (copied < prepared) {
+		/* As for a single page: that one has to be read again */
+		ClearPageUptodate(pages[copied]);
+		for (i = copied; i < prepared; i++)
+			kunmap(pages[i]);
+		status = -EFAULT;
+		if (copied)
+			to = PAGE_CACHE_SIZE;
+	}
+	if (copied) {
+		status = mapping->a_ops->commit_write_pages(file, pages,
+							    copied, from, to);
+		if (!status)
+			status = done;
+	}
+
+unlock:
+	for (i = 0; i < nr; i++) {
+		UnlockPage(pages[i]);
+		deactivate_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	return status;
+}
+
 /*
  * Write to a file through the page cache. 
  *
@@ -2444,8 +3005,8 @@ static inline void remove_suid(struct inode *inode)
 ssize_t
 generic_file_write(struct file *file,const char *buf,size_t count,loff_t *ppos)
 {
-	struct inode	*inode = file->f_dentry->d_inode; 
-	struct address_space *mapping = inode->i_mapping;
+	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
+	struct inode	*inode = mapping->host;
 	unsigned long	limit = current->rlim[RLIMIT_FSIZE].rlim_cur;
 	loff_t		pos;
 	struct page	*page, *cached_page;
@@ -2477,7 +3038,7 @@ generic_file_write(struct file *file,const char *buf,size_t count,loff_t *ppos)
 	 * Check whether we've reached the file size limit.
 	 */
 	err = -EFBIG;
-	if (limit != RLIM_INFINITY) {
+	if (!S_ISBLK(inode->i_mode) && limit != RLIM_INFINITY) {
 		if (pos >= limit) {
 			send_sig(SIGXFSZ, current, 0);
 			goto out;
@@ -2488,6 +3049,17 @@ generic_file_write(struct file *file,const char *buf,size_t count,loff_t *ppos)
 		}
 	}
 
+	/* A block device does not grow */
+	if (S_ISBLK(inode->i_mode)) {
+		err = -ENOSPC;
+		if (pos >= inode->i_size) {
+			if (count || pos > inode->i_size)
+				goto out;
+		}
+		if (count > inode->i_size - pos)
+			count = inode->i_size - pos;
+	}
+
 	status  = 0;
 	if (count) {
 		remove_suid(inode);
@@ -2495,6 +3067,26 @@ generic_file_write(struct file *file,const char *buf,size_t count,loff_t *ppos)
 		mark_inode_dirty_sync(inode);
 	}
 
+	if (file->f_flags & O_DIRECT) {
+		if (count)
+			status = generic_file_direct_IO(WRITE, file, (char *) buf,
+							count, pos);
+		if (status > 0) {
+			written = status;
+			pos += written;
+			if (pos > inode->i_size) {
+				inode->i_size = pos;
+				mark_inode_dirty(inode);
+			}
+			*ppos = pos;
+			/* The data is on disk, the metadata may not be yet */
+			if (file->f_flags & O_SYNC)
+				status = generic_osync_inode(inode, 1);
+		}
+		err = written ? written : status;
+		goto out;
+	}
+
 	while (count) {
 		unsigned long bytes, index, offset;
 		char *kaddr;
@@ -2509,6 +3101,19 @@ generic_file_write(struct file *file,const char *buf,size_t count,loff_t *ppos)
 		if (bytes > count)
 			bytes = count;
 
+		/* More than a page to go: do several at a time if we can */
+		if (bytes < count && mapping->a_ops->prepare_write_pages) {
+			status = generic_file_write_pages(file, mapping, pos,
+						buf, count, &cached_page);
+			if (status < 0)
+				break;
+			written += status;
+			count -= status;
+			pos += status;
+			buf += status;
+			continue;
+		}
+
 		/*
 		 * Bring in the user page that we will copy from _first_.
 		 * Otherwise there's a nasty deadlock on copying from the
@@ -2579,29 +3184,136 @@ fail_write:
 	goto unlock;
 }
 
-void __init page_cache_init(unsigned long mempages)
+/*
+ * The write side of the read_descriptor_t/actor pattern: for kernel
+ * sources, like a socket's receive queue, that can copy straight into
+ * the page cache.  The actor fills 'size' bytes of the page at 'offset',
+ * accounts for them in desc as the read actors do, and returns how many
+ * it did; anything short of 'size' is an error, which it leaves in
+ * desc->error.  The caller must be able to supply
+ * desc->count bytes.  Block devices and O_DIRECT are not handled.
+ */
+void do_generic_file_fill(struct file * file, loff_t *ppos, read_descriptor_t * desc, read_actor_t actor)
 {
-	unsigned long htable_size, order;
+	struct address_space *mapping = file->f_dentry->d_inode->i_mapping;
+	struct inode	*inode = mapping->host;
+	unsigned long	limit = current->rlim[RLIMIT_FSIZE].rlim_cur;
+	struct page	*page, *cached_page = NULL;
+	loff_t		pos;
+	int		status = 0;
 
-	htable_size = mempages;
-	htable_size *= sizeof(struct page *);
-	for(order = 0; (PAGE_SIZE << order) < htable_size; order++)
-		;
+	down(&inode->i_sem);
 
-	do {
-		unsigned long tmp = (PAGE_SIZE << order) / sizeof(struct page *);
+	pos = *ppos;
+	if (file->f_flags & O_APPEND)
+		pos = inode->i_size;
+
+	if (limit != RLIM_INFINITY) {
+		if (pos >= limit) {
+			send_sig(SIGXFSZ, current, 0);
+			desc->error = -EFBIG;
+			goto out;
+		}
+		if (desc->count > limit - pos) {
+			send_sig(SIGXFSZ, current, 0);
+			desc->count = limit - pos;
+		}
+	}
+
+	if (desc->count) {
+		remove_suid(inode);
+		inode->i_ctime = inode->i_mtime = CURRENT_TIME;
+		mark_inode_dirty_sync(inode);
+	}
+
+	while (desc->count) {
+		unsigned long bytes, index, offset;
+
+		offset = pos & (PAGE_CACHE_SIZE-1);
+		index = pos >> PAGE_CACHE_SHIFT;
+		bytes = PAGE_CACHE_SIZE - offset;
+		if (bytes > desc->count)
+			bytes = desc->count;
+
+		status = -ENOMEM;
+		page = __grab_cache_page(mapping, index, &cached_page);
+		if (!page)
+			break;
+
+		status = mapping->a_ops->prepare_write(file, page, offset, offset+bytes);
+		if (status)
+			goto unlock;
+		if (actor(desc, page, offset, bytes) != bytes) {
+			ClearPageUptodate(page);
+			kunmap(page);
+			status = desc->error ? desc->error : -EIO;
+			goto unlock;
+		}
+		flush_dcache_page(page);
+		status = mapping->a_ops->commit_write(file, page, offset, offset+bytes);
+		if (!status)
+			pos += bytes;
+unlock:
+		UnlockPage(page);
+		deactivate_page(page);
+		page_cache_release(page);
+
+		if (status < 0)
+			break;
+	}
+	*ppos = pos;
+
+	if (cached_page)
+		page_cache_free(cached_page);
+
+	if (status >= 0 && (file->f_flags & O_SYNC))
+		status = generic_osync_inode(inode, 1);
+	if (status < 0)
+		desc->error = status;
+out:
+	up(&inode->i_sem);
+}
+
+/* The cached pages of the range are stale once the disk has the data */
+static void generic_file_aio_write_done(struct kiocb * iocb)
+{
+	struct address_space * mapping = iocb->ki_filp->f_dentry->d_inode->i_mapping;
 
-		page_hash_bits = 0;
-		while((tmp >>= 1UL) != 0UL)
-			page_hash_bits++;
+	invalidate_direct_range(mapping, iocb->ki_pos >> PAGE_CACHE_SHIFT,
+		(iocb->ki_pos + iocb->ki_nbytes - 1) >> PAGE_CACHE_SHIFT);
+}
+
+/*
+ * aio_write() for the page cache filesystems. An O_DIRECT write within
+ * the file is queued. Anything else, and a write that extends the file
+ * or has to be O_SYNC or O_APPEND, goes through generic_file_write().
+ */
+ssize_t generic_file_aio_write(struct kiocb * iocb, const char * buf, size_t count, loff_t pos)
+{
+	struct file * file = iocb->ki_filp;
+	struct inode * inode = file->f_dentry->d_inode;
+	unsigned long limit = current->rlim[RLIMIT_FSIZE].rlim_cur;
+	ssize_t retval;
 
-		page_hash_table = (struct page **)
-			__get_free_pages(GFP_ATOMIC, order);
-	} while(page_hash_table == NULL && --order > 0);
+	if (!(file->f_flags & O_DIRECT) || (file->f_flags & (O_SYNC | O_APPEND)))
+		return generic_file_write(file, buf, count, &pos);
+
+	down(&inode->i_sem);
+	if (pos + count > inode->i_size || file->f_error ||
+	    (limit != RLIM_INFINITY && pos + count > limit)) {
+		up(&inode->i_sem);
+		return generic_file_write(file, buf, count, &pos);
+	}
 
-	printk("Page-cache hash table entries: %d (order: %ld, %ld bytes)\n",
-	       (1 << page_hash_bits), order, (PAGE_SIZE << order));
-	if (!page_hash_table)
-		panic("Failed to allocate page hash table\n");
-	memset((void *)page_hash_table, 0, PAGE_HASH_SIZE * sizeof(struct page *));
+	if (count) {
+		remove_suid(inode);
+		inode->i_ctime = inode->i_mtime = CURRENT_TIME;
+		mark_inode_dirty_sync(inode);
+	}
+	retval = generic_file_aio_direct_IO(WRITE, iocb, (char *) buf, count, pos);
+	/* io_submit() still holds the request, it can't be done yet */
+	if (retval == -EIOCBQUEUED)
+		iocb->ki_done = generic_file_aio_write_done;
+	up(&inode->i_sem);
+	return retval;
 }
@@ -29,11 +29,31 @@
  *  1 means that there are no users, but it has been mapped
  *    since the last TLB flush - so we can't use it.
  *  n means that there are (n-1) current users of it.
+ *
+ * kmap_lock covers handing out entries and taking them back, that is
+ * the 0 <-> 1 transitions, and page->virtual being set or cleared.
+ * Taking and dropping users of a mapped page, n <-> n+1 for n >= 1,
+ * only needs the hashed lock of the page, so mapping pages that are
+ * mapped already does not serialize on kmap_lock. Both are needed to
+ * take an entry back; kmap_lock nests outside the hashed locks.
  */
 static int pkmap_count[LAST_PKMAP];
 static unsigned int last_pkmap_nr;
 static spinlock_t kmap_lock = SPIN_LOCK_UNLOCKED;
 
+#define PKMAP_HASH_SIZE	64
+#define PKMAP_HASH(page) (((unsigned long) (page) / sizeof(struct page)) & (PKMAP_HASH_SIZE-1))
+
+static struct pkmap_hash_lock {
+	spinlock_t lock;
+} ____cacheline_aligned pkmap_hash_locks[PKMAP_HASH_SIZE] =
+	{ [0 ... PKMAP_HASH_SIZE-1] = { SPIN_LOCK_UNLOCKED } };
+
+static inline spinlock_t *pkmap_lock(struct page *page)
+{
+	return &pkmap_hash_locks[PKMAP_HASH(page)].lock;
+}
+
 pte_t * pkmap_page_table;
 
 static DECLARE_WAIT_QUEUE_HEAD(pkmap_map_wait);
@@ -55,16 +75,25 @@ static void flush_all_zero_pkmaps(void)
 		 */
 		if (pkmap_count[i] != 1)
 			continue;
-		pkmap_count[i] = 0;
-		pte = ptep_get_and_clear(pkmap_page_table+i);
-		if (pte_none(pte))
-			BUG();
-		page = pte_page(pte);
-		page->virtual = NULL;
+		page = pte_page(pkmap_page_table[i]);
+		spin_lock(pkmap_lock(page));
+		/* Somebody may have started using it again */
+		if (pkmap_count[i] == 1) {
+			pkmap_count[i] = 0;
+			pte = ptep_get_and_clear(pkmap_page_table+i);
+			if (pte_none(pte))
+				BUG();
+			page->virtual = NULL;
+		}
+		spin_unlock(pkmap_lock(page));
 	}
 	flush_tlb_all();
 }
 
+/*
+ * Called with kmap_lock held, returns with it and the hashed lock of
+ * the page held.
+ */
 static inline unsigned long map_new_virtual(struct page *page)
 {
 	unsigned long vaddr;
@@ -98,8 +127,10 @@ start:
 			spin_lock(&kmap_lock);
 
 			/* Somebody else might have mapped it while we slept */
+			spin_lock(pkmap_lock(page));
 			if (page->virtual)
 				return (unsigned long) page->virtual;
+			spin_unlock(pkmap_lock(page));
 
 			/* Re-start */
 			goto start;
@@ -108,6 +139,7 @@ start:
 	vaddr = PKMAP_ADDR(last_pkmap_nr);
 	set_pte(&(pkmap_page_table[last_pkmap_nr]), mk_pte(page, kmap_prot));
 
+	spin_lock(pkmap_lock(page));
 	pkmap_count[last_pkmap_nr] = 1;
 	page->virtual = (void *) vaddr;
 
@@ -124,14 +156,23 @@ void *kmap_high(struct page *page)
 	 *
 	 * We cannot call this from interrupts, as it may block
 	 */
-	spin_lock(&kmap_lock);
+	spin_lock(pkmap_lock(page));
 	vaddr = (unsigned long) page->virtual;
-	if (!vaddr)
-		vaddr = map_new_virtual(page);
+	if (!vaddr) {
+		spin_unlock(pkmap_lock(page));
+		spin_lock(&kmap_lock);
+		spin_lock(pkmap_lock(page));
+		vaddr = (unsigned long) page->virtual;
+		if (!vaddr) {
+			spin_unlock(pkmap_lock(page));
+			vaddr = map_new_virtual(page);
+		}
+		spin_unlock(&kmap_lock);
+	}
 	pkmap_count[PKMAP_NR(vaddr)]++;
 	if (pkmap_count[PKMAP_NR(vaddr)] < 2)
 		BUG();
-	spin_unlock(&kmap_lock);
+	spin_unlock(pkmap_lock(page));
 	return (void*) vaddr;
 }
 
@@ -140,7 +181,7 @@ void kunmap_high(struct page *page)
 	unsigned long vaddr;
 	unsigned long nr;
 
-	spin_lock(&kmap_lock);
+	spin_lock(pkmap_lock(page));
 	vaddr = (unsigned long) page->virtual;
 	if (!vaddr)
 		BUG();
@@ -156,7 +197,7 @@ void kunmap_high(struct page *page)
 	case 1:
 		wake_up(&pkmap_map_wait);
 	}
-	spin_unlock(&kmap_lock);
+	spin_unlock(pkmap_lock(page));
 }
 
 /*
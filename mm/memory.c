@@ -44,8 +44,13 @@
 #include <linux/iobuf.h>
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
+#include <asm/tlb.h>
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
+#include <linux/low-latency.h>
+#include <linux/bigpages.h>
+#include <linux/aio.h>
+#include <linux/pgtcache.h>
 
 
 unsigned long max_mapnr;
@@ -108,15 +113,75 @@ static inline void free_one_pgd(pgd_t * dir)
 	pmd_free(pmd);
 }
 
-/* Low and high watermarks for page table cache.
-   The system should try to have pgt_water[0] <= cache elements <= pgt_water[1]
+/*
+ * Low and high watermarks for the page table cache.
+ *
+ * pgt_cache_water[0] and [1] are the smallest low and high marks a CPU
+ * will use, pgt_cache_water[2] caps the high mark.  Between the two,
+ * each CPU follows a decaying average of the page tables it allocated
+ * over the last second: a CPU busy with fork and exit keeps the tables
+ * freed by one exit around for the next fork, while an idle CPU gives
+ * its cache back within a few seconds.  Architectures which do not
+ * count hits and misses (pgt_cache_count) stay at the floor.
  */
-int pgt_cache_water[2] = { 25, 50 };
+int pgt_cache_water[3] = { 25, 50, 1024 };
+
+struct pgt_cache_stat pgt_cache_stat[NR_CPUS] __cacheline_aligned;
+
+static void pgt_cache_adjust(struct pgt_cache_stat *s)
+{
+	unsigned long allocs = s->hits + s->misses - s->last;
+	int high, low;
+
+	s->last += allocs;
+	s->stamp = jiffies;
+
+	if (allocs > pgt_cache_water[2])
+		allocs = pgt_cache_water[2];
+	high = (3 * s->high + (int) allocs) / 4;
+	if (high > pgt_cache_water[2])
+		high = pgt_cache_water[2];
+	if (high < pgt_cache_water[1])
+		high = pgt_cache_water[1];
+	low = high / 2;
+	if (low < pgt_cache_water[0])
+		low = pgt_cache_water[0];
+
+	s->high = high;
+	s->low = low;
+}
 
 /* Returns the number of pages freed */
 int check_pgt_cache(void)
 {
-	return do_check_pgt_cache(pgt_cache_water[0], pgt_cache_water[1]);
+	struct pgt_cache_stat *s = &pgt_cache_stat[smp_processor_id()];
+	int freed;
+
+	if (jiffies - s->stamp >= HZ || s->high < pgt_cache_water[1])
+		pgt_cache_adjust(s);
+	freed = do_check_pgt_cache(s->low, s->high);
+	s->trimmed += freed;
+	return freed;
+}
+
+/*
+ * The per-CPU page table caches, for /proc/pgtcache.
+ */
+int get_pgt_cache_info(char *page)
+{
+	int i, len = 0;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		struct pgt_cache_stat *s = &pgt_cache_stat[cpu_logical_map(i)];
+
+		if (len > PAGE_SIZE - 120)
+			break;
+		len += sprintf(page + len, "cpu%-2d low %4d high %4d "
+			       "hit %lu miss %lu trim %lu\n",
+			       i, s->low, s->high,
+			       s->hits, s->misses, s->trimmed);
+	}
+	return len;
 }
 
 
@@ -157,6 +222,23 @@ int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
 	unsigned long end = vma->vm_end;
 	unsigned long cow = (vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
 
+	/* The child faults its big pages in when it needs them */
+	if (vma->vm_flags & VM_BIGPAGE)
+		return 0;
+
+	/*
+	 * Nor do the page tables of an area that only maps the pages
+	 * of its file or shared memory object have to be copied: the
+	 * child finds them again in the page cache, fault_around a
+	 * cluster at a time, and most children exec or exit long before
+	 * touching them.  Anonymous areas and private ones that have
+	 * had pages copied into them must be copied, the ptes are all
+	 * there is to find those pages by.
+	 */
+	if (vma->vm_ops && vma->vm_ops->nopage &&
+	    !(vma->vm_flags & (VM_ANONPAGES | VM_IO | VM_RESERVED)))
+		return 0;
+
 	src_pgd = pgd_offset(src, address)-1;
 	dst_pgd = pgd_offset(dst, address)-1;
 	
@@ -236,6 +318,9 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 					pte = pte_mkclean(pte);
 				pte = pte_mkold(pte);
 				get_page(ptepage);
+				set_pte(dst_pte, pte);
+				page_add_rmap(ptepage, dst, address);
+				goto cont_copy_pte_range_noset;
 
 cont_copy_pte_range:		set_pte(dst_pte, pte);
 cont_copy_pte_range_noset:	address += PAGE_SIZE;
@@ -245,7 +330,8 @@ cont_copy_pte_range_noset:	address += PAGE_SIZE;
 				dst_pte++;
 			} while ((unsigned long)src_pte & PTE_TABLE_MASK);
 		
-cont_copy_pmd_range:	src_pmd++;
+cont_copy_pmd_range:	conditional_schedule();
+			src_pmd++;
 			dst_pmd++;
 		} while ((unsigned long)src_pmd & PMD_TABLE_MASK);
 	}
@@ -256,52 +342,73 @@ nomem:
 	return -ENOMEM;
 }
 
+mmu_gather_t mmu_gathers[NR_CPUS];
+
 /*
- * Return indicates whether a page was freed so caller can adjust rss
+ * Return indicates whether a page was freed so caller can adjust rss.
+ * Without a gather the page is freed right away, the caller has to
+ * know that no TLB can still be using it.
  */
-static inline int free_pte(pte_t pte)
+static inline int free_pte(mmu_gather_t *tlb, struct mm_struct *mm, unsigned long address, pte_t pte)
 {
 	if (pte_present(pte)) {
 		struct page *page = pte_page(pte);
+		if (tlb)
+			tlb_remove_tlb_entry(tlb, address);
 		if ((!VALID_PAGE(page)) || PageReserved(page))
 			return 0;
+		page_remove_rmap(page, mm, address);
 		/* 
 		 * free_page() used to be able to clear swap cache
 		 * entries.  We may now have to do it manually.  
 		 */
 		if (pte_dirty(pte) && page->mapping)
 			set_page_dirty(page);
-		free_page_and_swap_cache(page);
+		if (tlb)
+			tlb_remove_page(tlb, page);
+		else
+			free_page_and_swap_cache(page);
 		return 1;
 	}
 	swap_free(pte_to_swp_entry(pte));
 	return 0;
 }
 
+/*
+ * We do not know the mm here, so a tracked page keeps a stale entry
+ * in its pte chain, which try_to_unmap() will drop. This does not
+ * happen unless something else is already broken.
+ */
 static inline void forget_pte(pte_t page)
 {
 	if (!pte_none(page)) {
 		printk("forget_pte: old mapping existed!\n");
-		free_pte(page);
+		free_pte(NULL, NULL, 0, page);
 	}
 }
 
-static inline int zap_pte_range(struct mm_struct *mm, pmd_t * pmd, unsigned long address, unsigned long size)
+static inline int zap_pte_range(mmu_gather_t *tlb, pmd_t * pmd, unsigned long address, unsigned long size)
 {
 	pte_t * pte;
+	unsigned long offset;
 	int freed;
 
 	if (pmd_none(*pmd))
 		return 0;
+	/* Big page areas are only ever unmapped as a whole */
+	if (pmd_big(*pmd)) {
+		tlb_remove_tlb_entry(tlb, address);
+		return zap_bigpage(pmd);
+	}
 	if (pmd_bad(*pmd)) {
 		pmd_ERROR(*pmd);
 		pmd_clear(pmd);
 		return 0;
 	}
 	pte = pte_offset(pmd, address);
-	address &= ~PMD_MASK;
-	if (address + size > PMD_SIZE)
-		size = PMD_SIZE - address;
+	offset = address & ~PMD_MASK;
+	if (offset + size > PMD_SIZE)
+		size = PMD_SIZE - offset;
 	size >>= PAGE_SHIFT;
 	freed = 0;
 	for (;;) {
@@ -311,14 +418,15 @@ static inline int zap_pte_range(struct mm_struct *mm, pmd_t * pmd, unsigned long
 		page = ptep_get_and_clear(pte);
 		pte++;
 		size--;
+		address += PAGE_SIZE;
 		if (pte_none(page))
 			continue;
-		freed += free_pte(page);
+		freed += free_pte(tlb, tlb->mm, address - PAGE_SIZE, page);
 	}
 	return freed;
 }
 
-static inline int zap_pmd_range(struct mm_struct *mm, pgd_t * dir, unsigned long address, unsigned long size)
+static inline int zap_pmd_range(mmu_gather_t *tlb, pgd_t * dir, unsigned long address, unsigned long size)
 {
 	pmd_t * pmd;
 	unsigned long end;
@@ -338,7 +446,7 @@ static inline int zap_pmd_range(struct mm_struct *mm, pgd_t * dir, unsigned long
 		end = PGDIR_SIZE;
 	freed = 0;
 	do {
-		freed += zap_pte_range(mm, pmd, address, end - address);
+		freed += zap_pte_range(tlb, pmd, address, end - address);
 		address = (address + PMD_SIZE) & PMD_MASK; 
 		pmd++;
 	} while (address < end);
@@ -346,12 +454,16 @@ static inline int zap_pmd_range(struct mm_struct *mm, pgd_t * dir, unsigned long
 }
 
 /*
- * remove user pages in a given range.
+ * remove user pages in a given range, and flush the TLBs for it.
+ * With ZPR_COND_RESCHED the walk may reschedule between page
+ * directories; callers holding a spinlock (vmtruncate() holds
+ * i_shared_lock) must not pass it.
  */
-void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size)
+void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long size, int actions)
 {
+	mmu_gather_t *tlb;
 	pgd_t * dir;
-	unsigned long end = address + size;
+	unsigned long start = address, end = address + size;
 	int freed = 0;
 
 	dir = pgd_offset(mm, address);
@@ -366,11 +478,21 @@ void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long s
 	if (address >= end)
 		BUG();
 	spin_lock(&mm->page_table_lock);
+	tlb = tlb_gather_mmu(mm, start, end);
 	do {
-		freed += zap_pmd_range(mm, dir, address, end - address);
+		freed += zap_pmd_range(tlb, dir, address, end - address);
 		address = (address + PGDIR_SIZE) & PGDIR_MASK;
 		dir++;
+		if ((actions & ZPR_COND_RESCHED) && conditional_schedule_needed()) {
+			/* The gather is per-CPU, empty it before we sleep */
+			tlb_finish_mmu(tlb);
+			spin_unlock(&mm->page_table_lock);
+			unconditional_schedule();
+			spin_lock(&mm->page_table_lock);
+			tlb = tlb_gather_mmu(mm, start, end);
+		}
 	} while (address && (address < end));
+	tlb_finish_mmu(tlb);
 	spin_unlock(&mm->page_table_lock);
 	/*
 	 * Update rss for the mm_struct (not necessarily current->mm)
@@ -384,9 +506,10 @@ void zap_page_range(struct mm_struct *mm, unsigned long address, unsigned long s
 
 
 /*
- * Do a quick page-table lookup for a single page. 
+ * Do a quick page-table lookup for a single page of current->mm.
+ * The caller holds its page_table_lock.
  */
-static struct page * follow_page(unsigned long address) 
+struct page * follow_page(unsigned long address) 
 {
 	pgd_t *pgd;
 	pmd_t *pmd;
@@ -394,7 +517,11 @@ static struct page * follow_page(unsigned long address)
 	pgd = pgd_offset(current->mm, address);
 	pmd = pmd_offset(pgd, address);
 	if (pmd) {
-		pte_t * pte = pte_offset(pmd, address);
+		pte_t * pte;
+
+		if (pmd_big(*pmd))
+			return bigpage_follow(*pmd, address);
+		pte = pte_offset(pmd, address);
 		if (pte && pte_present(*pte))
 			return pte_page(*pte);
 	}
@@ -529,6 +656,28 @@ void unmap_kiobuf (struct kiobuf *iobuf)
 	iobuf->locked = 0;
 }
 
+/*
+ * The first bytes of the kiobuf were read into behind the page tables'
+ * back. A page of the page or swap cache that was written out or is
+ * being written meanwhile must go out again, so dirty them.
+ */
+void mark_dirty_kiobuf(struct kiobuf *iobuf, int bytes)
+{
+	int i, remaining = bytes;
+	struct page *map;
+
+	if (remaining > iobuf->length)
+		remaining = iobuf->length;
+	remaining += iobuf->offset;
+
+	for (i = 0; i < iobuf->nr_pages && remaining > 0; i++) {
+		map = iobuf->maplist[i];
+		if (map && !PageReserved(map) && map->mapping)
+			set_page_dirty(map);
+		remaining -= PAGE_SIZE;
+	}
+}
+
 
 /*
  * Lock down all of the pages of a kiovec for IO.
@@ -861,7 +1010,7 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 	 * Ok, we need to copy. Oh, well..
 	 */
 	spin_unlock(&mm->page_table_lock);
-	new_page = page_cache_alloc();
+	new_page = alloc_user_page(GFP_HIGHUSER, address);
 	if (!new_page)
 		return -1;
 	spin_lock(&mm->page_table_lock);
@@ -873,6 +1022,9 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct * vma,
 		if (PageReserved(old_page))
 			++mm->rss;
 		break_cow(vma, old_page, new_page, address, page_table);
+		vma->vm_flags |= VM_ANONPAGES;
+		page_remove_rmap(old_page, mm, address);
+		page_add_rmap(new_page, mm, address);
 
 		/* Free the old page.. */
 		new_page = old_page;
@@ -900,8 +1052,7 @@ static void vmtruncate_list(struct vm_area_struct *mpnt,
 		/* mapping wholly truncated? */
 		if (mpnt->vm_pgoff >= pgoff) {
 			flush_cache_range(mm, start, end);
-			zap_page_range(mm, start, len);
-			flush_tlb_range(mm, start, end);
+			zap_page_range(mm, start, len, 0);
 			continue;
 		}
 
@@ -915,8 +1066,7 @@ static void vmtruncate_list(struct vm_area_struct *mpnt,
 		start += diff << PAGE_SHIFT;
 		len = (len - diff) << PAGE_SHIFT;
 		flush_cache_range(mm, start, end);
-		zap_page_range(mm, start, len);
-		flush_tlb_range(mm, start, end);
+		zap_page_range(mm, start, len, 0);
 	} while ((mpnt = mpnt->vm_next_share) != NULL);
 }
 			      
@@ -938,6 +1088,8 @@ void vmtruncate(struct inode * inode, loff_t offset)
 	if (inode->i_size < offset)
 		goto do_expand;
 	inode->i_size = offset;
+	/* Queued O_DIRECT IO may still be on the blocks we are freeing */
+	inode_dio_wait(inode);
 	truncate_inode_pages(mapping, offset);
 	spin_lock(&mapping->i_shared_lock);
 	if (!mapping->i_mmap && !mapping->i_mmap_shared)
@@ -985,6 +1137,8 @@ out:
  * (1 << page_cluster) entries in the swap area. This method is chosen
  * because it doesn't cost us any seek time.  We also make sure to queue
  * the 'original' request together with the readahead ones...  
+ * Only used for shmem now, faults in process memory use
+ * swapin_readahead_vma() below.
  */
 void swapin_readahead(swp_entry_t entry)
 {
@@ -1014,6 +1168,64 @@ void swapin_readahead(swp_entry_t entry)
 	return;
 }
 
+/*
+ * Swap readahead for process memory follows the address space instead:
+ * read in the other swapped out pages of the aligned block of
+ * (1 << page_cluster) pages around the fault, as far as they are in the
+ * vma. Those are the pages most likely to be wanted next, and as they
+ * went out together, swap clustering mostly put them next to each
+ * other on disk too. Neighbouring swap slots can belong to anyone.
+ */
+#define SWAP_RA_MAX	32
+
+static void swapin_readahead_vma(struct mm_struct * mm,
+	struct vm_area_struct * vma, unsigned long address,
+	pte_t * page_table)
+{
+	swp_entry_t entries[SWAP_RA_MAX];
+	unsigned long size, start, end, addr;
+	struct page *new_page;
+	pte_t *pte;
+	int i, nr = 0;
+
+	size = PAGE_SIZE << page_cluster;
+	if (size > SWAP_RA_MAX * PAGE_SIZE)
+		size = SWAP_RA_MAX * PAGE_SIZE;
+	address &= PAGE_MASK;
+	start = address & ~(size - 1);
+	end = start + size;
+	if (start < vma->vm_start)
+		start = vma->vm_start;
+	if (end > vma->vm_end)
+		end = vma->vm_end;
+
+	/* The block never crosses a page table */
+	pte = page_table - ((address - start) >> PAGE_SHIFT);
+	spin_lock(&mm->page_table_lock);
+	for (addr = start; addr < end; addr += PAGE_SIZE, pte++) {
+		pte_t entry = *pte;
+
+		if (addr == address || pte_none(entry) || pte_present(entry))
+			continue;
+		/* Hold on to the slot, the pte can change once we unlock */
+		entries[nr] = pte_to_swp_entry(entry);
+		if (swap_duplicate(entries[nr]))
+			nr++;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	for (i = 0; i < nr; i++) {
+		/* Don't block on I/O for read-ahead */
+		if (atomic_read(&nr_async_pages) < pager_daemon.swap_cluster
+				* (1 << page_cluster)) {
+			new_page = read_swap_cache_async(entries[i], 0);
+			if (new_page != NULL)
+				page_cache_release(new_page);
+		}
+		swap_free(entries[i]);
+	}
+}
+
 static int do_swap_page(struct mm_struct * mm,
 	struct vm_area_struct * vma, unsigned long address,
 	pte_t * page_table, swp_entry_t entry, int write_access)
@@ -1023,7 +1235,9 @@ static int do_swap_page(struct mm_struct * mm,
 
 	if (!page) {
 		lock_kernel();
-		swapin_readahead(entry);
+		/* Neighbouring pages are no use to a random reader */
+		if (!VM_RandomReadHint(vma))
+			swapin_readahead_vma(mm, vma, address, page_table);
 		page = read_swap_cache(entry);
 		unlock_kernel();
 		if (!page)
@@ -1048,7 +1262,9 @@ static int do_swap_page(struct mm_struct * mm,
 		pte = pte_mkwrite(pte_mkdirty(pte));
 	UnlockPage(page);
 
+	vma->vm_flags |= VM_ANONPAGES;
 	set_pte(page_table, pte);
+	page_add_rmap(page, mm, address);
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, address, pte);
 	return 1;	/* Minor fault */
@@ -1062,7 +1278,7 @@ static int do_anonymous_page(struct mm_struct * mm, struct vm_area_struct * vma,
 	struct page *page = NULL;
 	pte_t entry = pte_wrprotect(mk_pte(ZERO_PAGE(addr), vma->vm_page_prot));
 	if (write_access) {
-		page = alloc_page(GFP_HIGHUSER);
+		page = alloc_user_page(GFP_HIGHUSER, addr);
 		if (!page)
 			return -1;
 		clear_user_highpage(page, addr);
@@ -1071,6 +1287,8 @@ static int do_anonymous_page(struct mm_struct * mm, struct vm_area_struct * vma,
 		flush_page_to_ram(page);
 	}
 	set_pte(page_table, entry);
+	if (page)
+		page_add_rmap(page, mm, addr);
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, addr, entry);
 	return 1;	/* Minor fault */
@@ -1122,12 +1340,17 @@ static int do_no_page(struct mm_struct * mm, struct vm_area_struct * vma,
 	entry = mk_pte(new_page, vma->vm_page_prot);
 	if (write_access) {
 		entry = pte_mkwrite(pte_mkdirty(entry));
+		if (!(vma->vm_flags & VM_SHARED))
+			vma->vm_flags |= VM_ANONPAGES;
 	} else if (page_count(new_page) > 1 &&
 		   !(vma->vm_flags & VM_SHARED))
 		entry = pte_wrprotect(entry);
 	set_pte(page_table, entry);
+	page_add_rmap(new_page, mm, address);
 	/* no need to invalidate: a not-present page shouldn't be cached */
 	update_mmu_cache(vma, address, entry);
+	if (!write_access && vma->vm_ops->fault_around)
+		vma->vm_ops->fault_around(vma, address, page_table);
 	return 2;	/* Major fault */
 }
 
@@ -1195,6 +1418,9 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct * vma,
 	pgd_t *pgd;
 	pmd_t *pmd;
 
+	if (vma->vm_flags & VM_BIGPAGE)
+		return bigpage_fault(mm, vma, address);
+
 	pgd = pgd_offset(mm, address);
 	pmd = pmd_alloc(pgd, address);
 
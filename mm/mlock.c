@@ -121,6 +121,9 @@ static int mlock_fixup(struct vm_area_struct * vma,
 
 	if (newflags == vma->vm_flags)
 		return 0;
+	/* Big pages never leave memory anyway */
+	if (vma->vm_flags & VM_BIGPAGE)
+		return 0;
 
 	if (start == vma->vm_start) {
 		if (end == vma->vm_end)
@@ -12,6 +12,7 @@
 #include <linux/smp_lock.h>
 #include <linux/init.h>
 #include <linux/file.h>
+#include <linux/low-latency.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -191,6 +192,7 @@ unsigned long do_mmap_pgoff(struct file * file, unsigned long addr, unsigned lon
 	struct mm_struct * mm = current->mm;
 	struct vm_area_struct * vma;
 	int correct_wcount = 0;
+	int populate = flags & MAP_POPULATE;
 	int error;
 
 	if (file && (!file->f_op || !file->f_op->mmap))
@@ -354,7 +356,8 @@ unsigned long do_mmap_pgoff(struct file * file, unsigned long addr, unsigned lon
 	if (flags & VM_LOCKED) {
 		mm->locked_vm += len >> PAGE_SHIFT;
 		make_pages_present(addr, addr + len);
-	}
+	} else if (populate && file)
+		filemap_populate(vma, addr, addr + len);
 	return addr;
 
 unmap_and_free_vma:
@@ -364,13 +367,78 @@ unmap_and_free_vma:
 	fput(file);
 	/* Undo any partial mapping done by a device driver. */
 	flush_cache_range(mm, vma->vm_start, vma->vm_end);
-	zap_page_range(mm, vma->vm_start, vma->vm_end - vma->vm_start);
-	flush_tlb_range(mm, vma->vm_start, vma->vm_end);
+	zap_page_range(mm, vma->vm_start, vma->vm_end - vma->vm_start, ZPR_COND_RESCHED);
 free_vma:
 	kmem_cache_free(vm_area_cachep, vma);
 	return error;
 }
 
+/*
+ * The VMAs are kept in a red-black tree as well as in the list. Each
+ * node also remembers the largest hole following any VMA of its
+ * subtree, so that get_unmapped_area() can skip whole subtrees that
+ * have no room for the mapping.
+ *
+ * A vm_rb_gap that is too large only costs get_unmapped_area() some
+ * extra steps, since it checks the real hole before using it; one
+ * that is too small would hide free space. So anything that makes a
+ * hole grow has to go through the tree, while expand_stack() may
+ * shrink one behind our back. The tree is changed with both mmap_sem
+ * and page_table_lock held.
+ */
+static inline unsigned long vma_gap(struct vm_area_struct * vma)
+{
+	if (!vma->vm_next)
+		return 0;
+	return vma->vm_next->vm_start - vma->vm_end;
+}
+
+static void vma_rb_augment(rb_node_t * rb_node)
+{
+	struct vm_area_struct * vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+	unsigned long gap = vma_gap(vma), sub;
+
+	if (rb_node->rb_left) {
+		sub = rb_entry(rb_node->rb_left, struct vm_area_struct, vm_rb)->vm_rb_gap;
+		if (sub > gap)
+			gap = sub;
+	}
+	if (rb_node->rb_right) {
+		sub = rb_entry(rb_node->rb_right, struct vm_area_struct, vm_rb)->vm_rb_gap;
+		if (sub > gap)
+			gap = sub;
+	}
+	vma->vm_rb_gap = gap;
+}
+
+/* The hole after vma changed size, fix up the tree. */
+void vma_gap_update(struct vm_area_struct * vma)
+{
+	rb_node_t * rb_node;
+
+	for (rb_node = &vma->vm_rb; rb_node; rb_node = rb_node->rb_parent)
+		vma_rb_augment(rb_node);
+}
+
+/*
+ * Link vma into the tree at the place found by the caller, after it
+ * has been put on the list behind prev (NULL if it comes first).
+ */
+void __vma_link_rb(struct mm_struct * mm, struct vm_area_struct * vma,
+		   struct vm_area_struct * prev,
+		   rb_node_t ** rb_link, rb_node_t * rb_parent)
+{
+	rb_link_node(&vma->vm_rb, rb_parent, rb_link);
+	rb_insert_augmented(&vma->vm_rb, &mm->mm_rb, vma_rb_augment);
+	if (prev)
+		vma_gap_update(prev);
+}
+
+static void __vma_unlink_rb(struct mm_struct * mm, struct vm_area_struct * vma)
+{
+	rb_erase_augmented(&vma->vm_rb, &mm->mm_rb, vma_rb_augment);
+}
+
 /* Get an address range which is currently unmapped.
  * For mmap() without MAP_FIXED and shmat() with addr=0.
  * Return value 0 means ENOMEM.
@@ -378,29 +446,76 @@ free_vma:
 #ifndef HAVE_ARCH_UNMAPPED_AREA
 unsigned long get_unmapped_area(unsigned long addr, unsigned long len)
 {
-	struct vm_area_struct * vmm;
+	struct mm_struct * mm = current->mm;
+	struct vm_area_struct * vma;
+	rb_node_t * rb_node;
 
 	if (len > TASK_SIZE)
 		return 0;
 	if (!addr)
 		addr = TASK_UNMAPPED_BASE;
 	addr = PAGE_ALIGN(addr);
+	if (TASK_SIZE - len < addr)
+		return 0;
+
+	/* Room below the first mapping? */
+	vma = mm->mmap;
+	if (!vma || addr + len <= vma->vm_start)
+		return addr;
 
-	for (vmm = find_vma(current->mm, addr); ; vmm = vmm->vm_next) {
-		/* At this point:  (!vmm || addr < vmm->vm_end). */
-		if (TASK_SIZE - len < addr)
-			return 0;
-		if (!vmm || addr + len <= vmm->vm_start)
-			return addr;
-		addr = vmm->vm_end;
+	/*
+	 * Look for the lowest hole between two VMAs that ends at or
+	 * above addr+len and is at least len long. The holes in the
+	 * left subtree all end at or below vm_start, so we only go
+	 * there if that leaves enough room.
+	 */
+	rb_node = mm->mm_rb.rb_node;
+	if (rb_entry(rb_node, struct vm_area_struct, vm_rb)->vm_rb_gap < len)
+		goto check_highest;
+
+	for (;;) {
+		rb_node_t * sub;
+
+		vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		sub = rb_node->rb_left;
+		if (sub && vma->vm_start >= addr + len &&
+		    rb_entry(sub, struct vm_area_struct, vm_rb)->vm_rb_gap >= len) {
+			rb_node = sub;
+			continue;
+		}
+check_current:
+		if (vma_gap(vma) >= len && vma->vm_next->vm_start >= addr + len)
+			return vma->vm_end > addr ? vma->vm_end : addr;
+
+		sub = rb_node->rb_right;
+		if (sub && rb_entry(sub, struct vm_area_struct, vm_rb)->vm_rb_gap >= len) {
+			rb_node = sub;
+			continue;
+		}
+
+		/* Back up until we return from a left subtree. */
+		for (;;) {
+			sub = rb_node;
+			rb_node = rb_node->rb_parent;
+			if (!rb_node)
+				goto check_highest;
+			if (sub == rb_node->rb_left) {
+				vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+				goto check_current;
+			}
+		}
 	}
+
+check_highest:
+	vma = rb_entry(rb_last(&mm->mm_rb), struct vm_area_struct, vm_rb);
+	if (vma->vm_end > addr)
+		addr = vma->vm_end;
+	if (TASK_SIZE - len < addr)
+		return 0;
+	return addr;
 }
 #endif
 
-#define vm_avl_empty	(struct vm_area_struct *) NULL
-
-#include "mmap_avl.c"
-
 /* Look up the first VMA which satisfies  addr < vm_end,  NULL if none. */
 struct vm_area_struct * find_vma(struct mm_struct * mm, unsigned long addr)
 {
@@ -410,27 +525,24 @@ struct vm_area_struct * find_vma(struct mm_struct * mm, unsigned long addr)
 		/* Check the cache first. */
 		/* (Cache hit rate is typically around 35%.) */
 		vma = mm->mmap_cache;
-		if (!(vma && vma->vm_end > addr && vma->vm_start <= addr)) {
-			if (!mm->mmap_avl) {
-				/* Go through the linear list. */
-				vma = mm->mmap;
-				while (vma && vma->vm_end <= addr)
-					vma = vma->vm_next;
-			} else {
-				/* Then go through the AVL tree quickly. */
-				struct vm_area_struct * tree = mm->mmap_avl;
-				vma = NULL;
-				for (;;) {
-					if (tree == vm_avl_empty)
+		if (vma && vma->vm_end > addr && vma->vm_start <= addr) {
+			mm->mmap_cache_hits++;
+		} else {
+			rb_node_t * rb_node = mm->mm_rb.rb_node;
+
+			mm->mmap_cache_misses++;
+			vma = NULL;
+			while (rb_node) {
+				struct vm_area_struct * vma_tmp;
+
+				vma_tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+				if (vma_tmp->vm_end > addr) {
+					vma = vma_tmp;
+					if (vma_tmp->vm_start <= addr)
 						break;
-					if (tree->vm_end > addr) {
-						vma = tree;
-						if (tree->vm_start <= addr)
-							break;
-						tree = tree->vm_avl_left;
-					} else
-						tree = tree->vm_avl_right;
-				}
+					rb_node = rb_node->rb_left;
+				} else
+					rb_node = rb_node->rb_right;
 			}
 			if (vma)
 				mm->mmap_cache = vma;
@@ -444,48 +556,25 @@ struct vm_area_struct * find_vma_prev(struct mm_struct * mm, unsigned long addr,
 				      struct vm_area_struct **pprev)
 {
 	if (mm) {
-		if (!mm->mmap_avl) {
-			/* Go through the linear list. */
-			struct vm_area_struct * prev = NULL;
-			struct vm_area_struct * vma = mm->mmap;
-			while (vma && vma->vm_end <= addr) {
-				prev = vma;
-				vma = vma->vm_next;
-			}
-			*pprev = prev;
-			return vma;
-		} else {
-			/* Go through the AVL tree quickly. */
-			struct vm_area_struct * vma = NULL;
-			struct vm_area_struct * last_turn_right = NULL;
-			struct vm_area_struct * prev = NULL;
-			struct vm_area_struct * tree = mm->mmap_avl;
-			for (;;) {
-				if (tree == vm_avl_empty)
+		/* The last VMA that ends at or below addr is prev. */
+		rb_node_t * rb_node = mm->mm_rb.rb_node;
+		struct vm_area_struct * prev = NULL;
+
+		while (rb_node) {
+			struct vm_area_struct * vma_tmp;
+
+			vma_tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+			if (addr < vma_tmp->vm_end)
+				rb_node = rb_node->rb_left;
+			else {
+				prev = vma_tmp;
+				if (!prev->vm_next || addr < prev->vm_next->vm_end)
 					break;
-				if (tree->vm_end > addr) {
-					vma = tree;
-					prev = last_turn_right;
-					if (tree->vm_start <= addr)
-						break;
-					tree = tree->vm_avl_left;
-				} else {
-					last_turn_right = tree;
-					tree = tree->vm_avl_right;
-				}
-			}
-			if (vma) {
-				if (vma->vm_avl_left != vm_avl_empty) {
-					prev = vma->vm_avl_left;
-					while (prev->vm_avl_right != vm_avl_empty)
-						prev = prev->vm_avl_right;
-				}
-				if ((prev ? prev->vm_next : mm->mmap) != vma)
-					printk("find_vma_prev: tree inconsistent with list\n");
-				*pprev = prev;
-				return vma;
+				rb_node = rb_node->rb_right;
 			}
 		}
+		*pprev = prev;
+		return prev ? prev->vm_next : mm->mmap;
 	}
 	*pprev = NULL;
 	return NULL;
@@ -689,6 +778,13 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len)
 	if (mpnt->vm_start >= addr+len)
 		return 0;
 
+	/* Big page areas can't be split, they go as a whole or not at all */
+	for (free = mpnt; free && free->vm_start < addr+len; free = free->vm_next) {
+		if ((free->vm_flags & VM_BIGPAGE) &&
+		    (free->vm_start < addr || free->vm_end > addr+len))
+			return -EINVAL;
+	}
+
 	/* If we'll make "hole", check the vm areas limit */
 	if ((mpnt->vm_start < addr && mpnt->vm_end > addr+len)
 	    && mm->map_count >= MAX_MAP_COUNT)
@@ -709,9 +805,10 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len)
 		*npp = mpnt->vm_next;
 		mpnt->vm_next = free;
 		free = mpnt;
-		if (mm->mmap_avl)
-			avl_remove(mpnt, &mm->mmap_avl);
+		__vma_unlink_rb(mm, mpnt);
 	}
+	if (prev)
+		vma_gap_update(prev);
 	mm->mmap_cache = NULL;	/* Kill the cache. */
 	spin_unlock(&mm->page_table_lock);
 
@@ -741,8 +838,7 @@ int do_munmap(struct mm_struct *mm, unsigned long addr, size_t len)
 		mm->map_count--;
 
 		flush_cache_range(mm, st, end);
-		zap_page_range(mm, st, size);
-		flush_tlb_range(mm, st, end);
+		zap_page_range(mm, st, size, ZPR_COND_RESCHED);
 
 		/*
 		 * Fix the mapping, and free the old area if it wasn't reused.
@@ -826,7 +922,10 @@ unsigned long do_brk(unsigned long addr, unsigned long len)
 		struct vm_area_struct * vma = find_vma(mm, addr-1);
 		if (vma && vma->vm_end == addr && !vma->vm_file && 
 		    vma->vm_flags == flags) {
+			spin_lock(&mm->page_table_lock);
 			vma->vm_end = addr + len;
+			vma_gap_update(vma);
+			spin_unlock(&mm->page_table_lock);
 			goto out;
 		}
 	}	
@@ -860,16 +959,6 @@ out:
 	return addr;
 }
 
-/* Build the AVL tree corresponding to the VMA list. */
-void build_mmap_avl(struct mm_struct * mm)
-{
-	struct vm_area_struct * vma;
-
-	mm->mmap_avl = NULL;
-	for (vma = mm->mmap; vma; vma = vma->vm_next)
-		avl_insert(vma, &mm->mmap_avl);
-}
-
 /* Release all mmaps. */
 void exit_mmap(struct mm_struct * mm)
 {
@@ -878,7 +967,8 @@ void exit_mmap(struct mm_struct * mm)
 	release_segments(mm);
 	spin_lock(&mm->page_table_lock);
 	mpnt = mm->mmap;
-	mm->mmap = mm->mmap_avl = mm->mmap_cache = NULL;
+	mm->mmap = mm->mmap_cache = NULL;
+	mm->mm_rb = RB_ROOT;
 	spin_unlock(&mm->page_table_lock);
 	mm->rss = 0;
 	mm->total_vm = 0;
@@ -896,11 +986,12 @@ void exit_mmap(struct mm_struct * mm)
 		mm->map_count--;
 		remove_shared_vm_struct(mpnt);
 		flush_cache_range(mm, start, end);
-		zap_page_range(mm, start, size);
+		zap_page_range(mm, start, size, ZPR_COND_RESCHED);
 		if (mpnt->vm_file)
 			fput(mpnt->vm_file);
 		kmem_cache_free(vm_area_cachep, mpnt);
 		mpnt = next;
+		conditional_schedule();
 	}
 
 	/* This is just debugging */
@@ -916,26 +1007,29 @@ void exit_mmap(struct mm_struct * mm)
  */
 void __insert_vm_struct(struct mm_struct *mm, struct vm_area_struct *vmp)
 {
-	struct vm_area_struct **pprev;
+	struct vm_area_struct *prev = NULL, **pprev;
+	rb_node_t **rb_link, *rb_parent = NULL;
 	struct file * file;
 
-	if (!mm->mmap_avl) {
-		pprev = &mm->mmap;
-		while (*pprev && (*pprev)->vm_start <= vmp->vm_start)
-			pprev = &(*pprev)->vm_next;
-	} else {
-		struct vm_area_struct *prev, *next;
-		avl_insert_neighbours(vmp, &mm->mmap_avl, &prev, &next);
-		pprev = (prev ? &prev->vm_next : &mm->mmap);
-		if (*pprev != next)
-			printk("insert_vm_struct: tree inconsistent with list\n");
+	rb_link = &mm->mm_rb.rb_node;
+	while (*rb_link) {
+		struct vm_area_struct *vma;
+
+		rb_parent = *rb_link;
+		vma = rb_entry(rb_parent, struct vm_area_struct, vm_rb);
+		if (vmp->vm_start < vma->vm_start)
+			rb_link = &rb_parent->rb_left;
+		else {
+			prev = vma;
+			rb_link = &rb_parent->rb_right;
+		}
 	}
+	pprev = (prev ? &prev->vm_next : &mm->mmap);
 	vmp->vm_next = *pprev;
 	*pprev = vmp;
+	__vma_link_rb(mm, vmp, prev, rb_link, rb_parent);
 
 	mm->map_count++;
-	if (mm->map_count >= AVL_MIN_MAP_COUNT && !mm->mmap_avl)
-		build_mmap_avl(mm);
 
 	file = vmp->vm_file;
 	if (file) {
@@ -207,6 +207,9 @@ static int mprotect_fixup(struct vm_area_struct * vma,
 
 	if (newflags == vma->vm_flags)
 		return 0;
+	/* No ptes to change, and the area can't be split */
+	if (vma->vm_flags & VM_BIGPAGE)
+		return -EINVAL;
 	newprot = protection_map[newflags & 0xf];
 	if (start == vma->vm_start) {
 		if (end == vma->vm_end)
@@ -57,7 +57,8 @@ static inline pte_t *alloc_one_pte(struct mm_struct *mm, unsigned long addr)
 	return pte;
 }
 
-static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
+static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst,
+	unsigned long old_addr, unsigned long new_addr)
 {
 	int error = 0;
 	pte_t pte;
@@ -71,6 +72,12 @@ static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
 			error++;
 		}
 		set_pte(dst, pte);
+		if (dst != src && pte_present(pte)) {
+			struct page *page = pte_page(pte);
+
+			page_remove_rmap(page, mm, old_addr);
+			page_add_rmap(page, mm, new_addr);
+		}
 	}
 	spin_unlock(&mm->page_table_lock);
 	return error;
@@ -83,7 +90,8 @@ static int move_one_page(struct mm_struct *mm, unsigned long old_addr, unsigned
 
 	src = get_one_pte(mm, old_addr);
 	if (src)
-		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr));
+		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr),
+				     old_addr, new_addr);
 	return error;
 }
 
@@ -118,8 +126,7 @@ oops_we_failed:
 	flush_cache_range(mm, new_addr, new_addr + len);
 	while ((offset += PAGE_SIZE) < len)
 		move_one_page(mm, new_addr + offset, old_addr + offset);
-	zap_page_range(mm, new_addr, len);
-	flush_tlb_range(mm, new_addr, new_addr + len);
+	zap_page_range(mm, new_addr, len, ZPR_COND_RESCHED);
 	return -1;
 }
 
@@ -176,6 +183,11 @@ unsigned long do_mremap(unsigned long addr,
 	if (addr & ~PAGE_MASK)
 		goto out;
 
+	/* Big page areas can be neither resized nor moved */
+	vma = find_vma(current->mm, addr);
+	if (vma && vma->vm_start <= addr && (vma->vm_flags & VM_BIGPAGE))
+		goto out;
+
 	old_len = PAGE_ALIGN(old_len);
 	new_len = PAGE_ALIGN(new_len);
 
@@ -257,6 +269,7 @@ unsigned long do_mremap(unsigned long addr,
 			int pages = (new_len - old_len) >> PAGE_SHIFT;
 			spin_lock(&vma->vm_mm->page_table_lock);
 			vma->vm_end = addr + new_len;
+			vma_gap_update(vma);
 			spin_unlock(&vma->vm_mm->page_table_lock);
 			current->mm->total_vm += pages;
 			if (vma->vm_flags & VM_LOCKED) {
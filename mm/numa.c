@@ -89,8 +89,10 @@ static struct page * alloc_pages_pgdat(pg_data_t *pgdat, int gfp_mask,
 }
 
 /*
- * This can be refined. Currently, tries to do round robin, instead
- * should do concentratic circle search, starting from current node.
+ * Without NUMA the nodes are used round robin. With it, the zonelists
+ * of the local node already fall back to the nearest other nodes, see
+ * build_all_zonelists(); the walk below only matters once all of those
+ * are out of memory.
  */
 struct page * alloc_pages(int gfp_mask, unsigned long order)
 {
@@ -60,28 +60,14 @@ struct list_head inactive_dirty_list;
  * Hint: -mask = 1+~mask
  */
 
-static void FASTCALL(__free_pages_ok (struct page *page, unsigned long order));
-static void __free_pages_ok (struct page *page, unsigned long order)
+static inline void free_pages_check(struct page *page)
 {
-	unsigned long index, page_idx, mask, flags;
-	free_area_t *area;
-	struct page *base;
-	zone_t *zone;
-
-	/*
-	 * Subtle. We do not want to test this in the inlined part of
-	 * __free_page() - it's a rare condition and just increases
-	 * cache footprint unnecesserily. So we do an 'incorrect'
-	 * decrement on page->count for reserved pages, but this part
-	 * makes it safe.
-	 */
-	if (PageReserved(page))
-		return;
-
 	if (page->buffers)
 		BUG();
 	if (page->mapping)
 		BUG();
+	if (page->pte_chain)
+		BUG();
 	if (!VALID_PAGE(page))
 		BUG();
 	if (PageSwapCache(page))
@@ -99,8 +85,17 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 
 	page->flags &= ~((1<<PG_referenced) | (1<<PG_dirty));
 	page->age = PAGE_AGE_START;
-	
-	zone = page->zone;
+}
+
+/*
+ * Give a block back to the buddy lists. Called with zone->lock held.
+ */
+static inline void __free_one_page(zone_t *zone, struct page *page,
+				   unsigned long order)
+{
+	unsigned long index, page_idx, mask;
+	free_area_t *area;
+	struct page *base;
 
 	mask = (~0UL) << order;
 	base = mem_map + zone->offset;
@@ -111,8 +106,6 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 
 	area = zone->free_area + order;
 
-	spin_lock_irqsave(&zone->lock, flags);
-
 	zone->free_pages -= mask;
 
 	while (mask + (1 << (MAX_ORDER-1))) {
@@ -142,7 +135,29 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 		page_idx &= mask;
 	}
 	memlist_add_head(&(base + page_idx)->list, &area->free_list);
+}
+
+static void FASTCALL(__free_pages_ok (struct page *page, unsigned long order));
+static void __free_pages_ok (struct page *page, unsigned long order)
+{
+	unsigned long flags;
+	zone_t *zone;
+
+	/*
+	 * Subtle. We do not want to test this in the inlined part of
+	 * __free_page() - it's a rare condition and just increases
+	 * cache footprint unnecesserily. So we do an 'incorrect'
+	 * decrement on page->count for reserved pages, but this part
+	 * makes it safe.
+	 */
+	if (PageReserved(page))
+		return;
+
+	free_pages_check(page);
+	zone = page->zone;
 
+	spin_lock_irqsave(&zone->lock, flags);
+	__free_one_page(zone, page, order);
 	spin_unlock_irqrestore(&zone->lock, flags);
 
 	/*
@@ -154,6 +169,108 @@ static void __free_pages_ok (struct page *page, unsigned long order)
 		memory_pressure--;
 }
 
+/*
+ * Move @count pages from the tail of a per-CPU list, where the
+ * coldest ones are, back to the buddy lists.
+ */
+static int free_pages_bulk(zone_t *zone, int count, struct list_head *list)
+{
+	int ret = 0;
+
+	spin_lock(&zone->lock);
+	while (ret < count && !list_empty(list)) {
+		struct page *page = list_entry(list->prev, struct page, list);
+
+		list_del(&page->list);
+		__free_one_page(zone, page, 0);
+		ret++;
+	}
+	spin_unlock(&zone->lock);
+	return ret;
+}
+
+static void FASTCALL(free_hot_cold_page(struct page *page, int cold));
+static void free_hot_cold_page(struct page *page, int cold)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+	zone_t *zone;
+
+	if (PageReserved(page))
+		return;
+
+	free_pages_check(page);
+	zone = page->zone;
+	pcp = &zone->pageset[smp_processor_id()].pcp[cold];
+
+	local_irq_save(flags);
+	if (pcp->count >= pcp->high) {
+		pcp->count -= free_pages_bulk(zone, pcp->batch, &pcp->list);
+		pcp->flushes++;
+	}
+	list_add(&page->list, &pcp->list);
+	pcp->count++;
+	pcp->frees++;
+	local_irq_restore(flags);
+
+	if (memory_pressure > NR_CPUS)
+		memory_pressure--;
+}
+
+/*
+ * For pages nobody has touched for a while, for example the ones
+ * kswapd takes off the inactive_clean lists.
+ */
+void free_cold_page(struct page *page)
+{
+	if (put_page_testzero(page))
+		free_hot_cold_page(page, PCP_COLD);
+}
+
+/*
+ * Give all of this CPU's list pages back to the buddy allocator, so
+ * that they can merge into larger blocks again.
+ */
+void drain_local_pages(void)
+{
+	pg_data_t *pgdat;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+	for (pgdat = pgdat_list; pgdat; pgdat = pgdat->node_next) {
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			zone_t *zone = pgdat->node_zones + i;
+			struct per_cpu_pageset *pset;
+
+			if (!zone->size)
+				continue;
+			pset = &zone->pageset[smp_processor_id()];
+			pset->pcp[PCP_HOT].count -= free_pages_bulk(zone,
+				pset->pcp[PCP_HOT].count, &pset->pcp[PCP_HOT].list);
+			pset->pcp[PCP_COLD].count -= free_pages_bulk(zone,
+				pset->pcp[PCP_COLD].count, &pset->pcp[PCP_COLD].list);
+		}
+	}
+	local_irq_restore(flags);
+}
+
+#ifdef CONFIG_SMP
+static void drain_pages_ipi(void *unused)
+{
+	drain_local_pages();
+}
+#endif
+
+/*
+ * Can only be called from process context with interrupts enabled.
+ */
+static void drain_all_pages(void)
+{
+	smp_call_function(drain_pages_ipi, NULL, 0, 1);
+	drain_local_pages();
+}
+
 #define MARK_USED(index, order, area) \
 	change_bit((index) >> (1+(order)), (area)->map)
 
@@ -178,16 +295,16 @@ static inline struct page * expand (zone_t *zone, struct page *page,
 	return page;
 }
 
-static FASTCALL(struct page * rmqueue(zone_t *zone, unsigned long order));
-static struct page * rmqueue(zone_t *zone, unsigned long order)
+/*
+ * Take a block off the buddy lists. Called with zone->lock held.
+ */
+static struct page * __rmqueue(zone_t *zone, unsigned long order)
 {
 	free_area_t * area = zone->free_area + order;
 	unsigned long curr_order = order;
 	struct list_head *head, *curr;
-	unsigned long flags;
 	struct page *page;
 
-	spin_lock_irqsave(&zone->lock, flags);
 	do {
 		head = &area->free_list;
 		curr = memlist_next(head);
@@ -204,22 +321,177 @@ static struct page * rmqueue(zone_t *zone, unsigned long order)
 			zone->free_pages -= 1 << order;
 
 			page = expand(zone, page, index, order, curr_order, area);
-			spin_unlock_irqrestore(&zone->lock, flags);
-
-			set_page_count(page, 1);
 			if (BAD_RANGE(zone,page))
 				BUG();
-			DEBUG_ADD_PAGE
-			return page;	
+			return page;
 		}
 		curr_order++;
 		area++;
 	} while (curr_order < MAX_ORDER);
-	spin_unlock_irqrestore(&zone->lock, flags);
 
 	return NULL;
 }
 
+/*
+ * Page colouring: with page_colours > 1, the L2 cache is made of that
+ * many page sized sets of lines, and a physical page always lands in
+ * the same one. Anonymous pages of processes that asked for it, or of
+ * all processes with the page_colouring sysctl, are then allocated so
+ * that consecutive virtual pages get consecutive colours and can't
+ * throw each other out of the cache. The architecture sets
+ * page_colours, it must be a power of two.
+ */
+unsigned int page_colours = 1;
+int sysctl_page_colouring;
+
+#define page_colour(page)	(((page) - mem_map) & (page_colours - 1))
+
+/* Blocks of each order looked at for a page of the right colour */
+#define COLOUR_SCAN	16
+
+/*
+ * Take a single page of the given colour off the buddy lists, splitting
+ * the smallest block found to hold one. Called with zone->lock held.
+ */
+static struct page * __rmqueue_colour(zone_t *zone, unsigned long colour)
+{
+	free_area_t * area = zone->free_area;
+	unsigned long order, off, size;
+	struct list_head *head, *curr;
+	struct page *page;
+	unsigned int index;
+	int scan;
+
+	for (order = 0; order < MAX_ORDER; order++, area++) {
+		head = &area->free_list;
+		curr = memlist_next(head);
+		for (scan = COLOUR_SCAN; curr != head && scan; scan--) {
+			page = memlist_entry(curr, struct page, list);
+			off = (colour - page_colour(page)) & (page_colours - 1);
+			if (off < (1UL << order))
+				goto found;
+			curr = memlist_next(curr);
+		}
+	}
+	return NULL;
+
+found:
+	if (BAD_RANGE(zone,page))
+		BUG();
+	memlist_del(curr);
+	index = (page - mem_map) - zone->offset;
+	MARK_USED(index, order, area);
+	zone->free_pages--;
+
+	/* Give back the halves that don't hold our page */
+	size = 1UL << order;
+	while (order) {
+		area--;
+		order--;
+		size >>= 1;
+		if (off >= size) {
+			memlist_add_head(&page->list, &area->free_list);
+			MARK_USED(index, order, area);
+			index += size;
+			page += size;
+			off -= size;
+		} else {
+			memlist_add_head(&page[size].list, &area->free_list);
+			MARK_USED(index + size, order, area);
+		}
+	}
+	return page;
+}
+
+/*
+ * A page of the given colour from the per-CPU list, or failing that from
+ * the buddy lists. NULL if there is none close at hand.
+ */
+static struct page * rmqueue_colour(zone_t *zone, unsigned long colour,
+	int gfp_mask)
+{
+	struct per_cpu_pages *pcp;
+	struct list_head *curr;
+	struct page *page;
+	unsigned long flags;
+
+	pcp = &zone->pageset[smp_processor_id()].pcp[!!(gfp_mask & __GFP_COLD)];
+	local_irq_save(flags);
+	list_for_each(curr, &pcp->list) {
+		page = list_entry(curr, struct page, list);
+		if (page_colour(page) == colour) {
+			list_del(&page->list);
+			pcp->count--;
+			pcp->allocs++;
+			local_irq_restore(flags);
+			return page;
+		}
+	}
+	local_irq_restore(flags);
+
+	spin_lock_irqsave(&zone->lock, flags);
+	page = __rmqueue_colour(zone, colour);
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return page;
+}
+
+/*
+ * Put up to @count single pages on the end of @list.
+ */
+static int rmqueue_bulk(zone_t *zone, int count, struct list_head *list)
+{
+	int i;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < count; i++) {
+		struct page *page = __rmqueue(zone, 0);
+
+		if (!page)
+			break;
+		list_add_tail(&page->list, list);
+	}
+	spin_unlock(&zone->lock);
+	return i;
+}
+
+static FASTCALL(struct page * rmqueue(zone_t *zone, unsigned long order, int gfp_mask));
+static struct page * rmqueue(zone_t *zone, unsigned long order, int gfp_mask)
+{
+	struct page *page = NULL;
+	unsigned long flags;
+
+	if (order == 0 && current->page_colour && !in_interrupt())
+		page = rmqueue_colour(zone, current->page_colour - 1, gfp_mask);
+	if (!page && order == 0) {
+		struct per_cpu_pages *pcp;
+
+		pcp = &zone->pageset[smp_processor_id()].pcp[!!(gfp_mask & __GFP_COLD)];
+		local_irq_save(flags);
+		if (pcp->count <= pcp->low) {
+			pcp->count += rmqueue_bulk(zone, pcp->batch, &pcp->list);
+			pcp->refills++;
+		}
+		if (pcp->count) {
+			page = list_entry(pcp->list.next, struct page, list);
+			list_del(&page->list);
+			pcp->count--;
+			pcp->allocs++;
+		}
+		local_irq_restore(flags);
+	}
+	if (!page) {
+		spin_lock_irqsave(&zone->lock, flags);
+		page = __rmqueue(zone, order);
+		spin_unlock_irqrestore(&zone->lock, flags);
+		if (!page)
+			return NULL;
+	}
+
+	set_page_count(page, 1);
+	DEBUG_ADD_PAGE
+	return page;
+}
+
 #define PAGES_MIN	0
 #define PAGES_LOW	1
 #define PAGES_HIGH	2
@@ -266,7 +538,7 @@ static struct page * __alloc_pages_limit(zonelist_t *zonelist,
 				page = reclaim_page(z);
 			/* If that fails, fall back to rmqueue. */
 			if (!page)
-				page = rmqueue(z, order);
+				page = rmqueue(z, order, zonelist->gfp_mask);
 			if (page)
 				return page;
 		}
@@ -280,7 +552,8 @@ static struct page * __alloc_pages_limit(zonelist_t *zonelist,
 /*
  * This is the 'heart' of the zoned buddy allocator:
  */
-struct page * __alloc_pages(zonelist_t *zonelist, unsigned long order)
+static inline struct page * __alloc_pages_core(zonelist_t *zonelist,
+						unsigned long order)
 {
 	zone_t **zone;
 	int direct_reclaim = 0;
@@ -339,12 +612,12 @@ try_again:
 			BUG();
 
 		if (z->free_pages >= z->pages_low) {
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, gfp_mask);
 			if (page)
 				return page;
 		} else if (z->free_pages < z->pages_min &&
-					waitqueue_active(&kreclaimd_wait)) {
-				wake_up_interruptible(&kreclaimd_wait);
+			   waitqueue_active(&z->zone_pgdat->kreclaimd_wait)) {
+				wake_up_interruptible(&z->zone_pgdat->kreclaimd_wait);
 		}
 	}
 
@@ -426,7 +699,9 @@ try_again:
 		 */
 		if (order > 0 && (gfp_mask & __GFP_WAIT)) {
 			zone = zonelist->zones;
-			/* First, clean some dirty pages. */
+			/* Let the per-CPU pages merge back first. */
+			drain_all_pages();
+			/* Then, clean some dirty pages. */
 			page_launder(gfp_mask, 1);
 			for (;;) {
 				zone_t *z = *(zone++);
@@ -440,9 +715,10 @@ try_again:
 					page = reclaim_page(z);
 					if (!page)
 						break;
-					__free_page(page);
+					if (put_page_testzero(page))
+						__free_pages_ok(page, 0);
 					/* Try if the allocation succeeds. */
-					page = rmqueue(z, order);
+					page = rmqueue(z, order, gfp_mask);
 					if (page)
 						return page;
 				}
@@ -462,6 +738,7 @@ try_again:
 		 * of memory *ever*.
 		 */
 		if ((gfp_mask & (__GFP_WAIT|__GFP_IO)) == (__GFP_WAIT|__GFP_IO)) {
+			zonelist->zones[0]->allocstall++;
 			wakeup_kswapd(1);
 			memory_pressure++;
 			if (!order)
@@ -475,6 +752,7 @@ try_again:
 		 * free ourselves...
 		 */
 		} else if (gfp_mask & __GFP_WAIT) {
+			zonelist->zones[0]->allocstall++;
 			try_to_free_pages(gfp_mask);
 			memory_pressure++;
 			if (!order)
@@ -518,7 +796,7 @@ try_again:
 		if (z->free_pages < z->pages_min / 4 &&
 				!(current->flags & PF_MEMALLOC))
 			continue;
-		page = rmqueue(z, order);
+		page = rmqueue(z, order, gfp_mask);
 		if (page)
 			return page;
 	}
@@ -528,6 +806,45 @@ try_again:
 	return NULL;
 }
 
+/*
+ * Allocate a page for the user address of the current process, of the
+ * colour that goes with it if colouring is on. Allocations that have
+ * to wait or to fall back to another zone may still get another one.
+ */
+struct page * alloc_user_page(int gfp_mask, unsigned long address)
+{
+	struct page * page;
+
+	if (page_colours == 1 ||
+	    !(sysctl_page_colouring || (current->flags & PF_PAGECOLOUR)))
+		return alloc_page(gfp_mask);
+
+	current->page_colour = ((address >> PAGE_SHIFT) & (page_colours - 1)) + 1;
+	page = alloc_page(gfp_mask);
+	current->page_colour = 0;
+	return page;
+}
+
+struct page * __alloc_pages(zonelist_t *zonelist, unsigned long order)
+{
+	struct page * page = __alloc_pages_core(zonelist, order);
+
+#ifdef CONFIG_NUMA
+	if (page) {
+		pg_data_t *want = zonelist->zones[0]->zone_pgdat;
+		pg_data_t *got = page->zone->zone_pgdat;
+
+		if (got == want)
+			got->numa_hit++;
+		else {
+			got->numa_miss++;
+			want->numa_foreign++;
+		}
+	}
+#endif
+	return page;
+}
+
 /*
  * Common helper functions.
  */
@@ -556,8 +873,12 @@ unsigned long get_zeroed_page(int gfp_mask)
 
 void __free_pages(struct page *page, unsigned long order)
 {
-	if (put_page_testzero(page))
+	if (!put_page_testzero(page))
+		return;
+	if (order)
 		__free_pages_ok(page, order);
+	else
+		free_hot_cold_page(page, PCP_HOT);
 }
 
 void free_pages(unsigned long addr, unsigned long order)
@@ -710,55 +1031,178 @@ void show_free_areas(void)
 	show_free_areas_core(pgdat_list);
 }
 
+/*
+ * The per-CPU page lists, for /proc/pagesets.
+ */
+int get_pageset_info(char *page)
+{
+	static char *list_names[2] = { "hot", "cold" };
+	pg_data_t *pgdat;
+	int i, j, k, len = 0;
+
+	for (pgdat = pgdat_list; pgdat; pgdat = pgdat->node_next) {
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			zone_t *zone = pgdat->node_zones + i;
+
+			if (!zone->size)
+				continue;
+			for (j = 0; j < smp_num_cpus; j++) {
+				int cpu = cpu_logical_map(j);
+
+				for (k = 0; k < 2; k++) {
+					struct per_cpu_pages *pcp;
+
+					if (len > PAGE_SIZE - 160)
+						return len;
+					pcp = &zone->pageset[cpu].pcp[k];
+					len += sprintf(page + len, "%-8s cpu%-2d %-4s "
+						"count %4d low %4d high %4d batch %3d "
+						"alloc %lu refill %lu free %lu flush %lu\n",
+						zone->name, j, list_names[k],
+						pcp->count, pcp->low, pcp->high,
+						pcp->batch, pcp->allocs, pcp->refills,
+						pcp->frees, pcp->flushes);
+				}
+			}
+		}
+	}
+	return len;
+}
+
+#ifdef CONFIG_NUMA
+int get_numastat_info(char *page)
+{
+	pg_data_t *pgdat;
+	int len = 0;
+
+	for (pgdat = pgdat_list; pgdat; pgdat = pgdat->node_next) {
+		if (len > PAGE_SIZE - 80)
+			break;
+		len += sprintf(page + len, "node%-3d hit %lu miss %lu foreign %lu\n",
+			pgdat->node_id, pgdat->numa_hit, pgdat->numa_miss,
+			pgdat->numa_foreign);
+	}
+	return len;
+}
+#endif
+
+/* The highest zone a gfp_mask may allocate from */
+static inline int gfp_zone(int gfp_mask)
+{
+	if (gfp_mask & __GFP_DMA)
+		return ZONE_DMA;
+	if (gfp_mask & __GFP_HIGHMEM)
+		return ZONE_HIGHMEM;
+	return ZONE_NORMAL;
+}
+
+/*
+ * Append the zones of pgdat from zone k down to zonelist->zones[j],
+ * returns the new end of the list.
+ */
+static int __init build_zonelists_node(pg_data_t *pgdat, zonelist_t *zonelist,
+	int j, int k)
+{
+	zone_t *zone;
+
+	switch (k) {
+		default:
+			BUG();
+		/*
+		 * fallthrough:
+		 */
+		case ZONE_HIGHMEM:
+			zone = pgdat->node_zones + ZONE_HIGHMEM;
+			if (zone->size) {
+#ifndef CONFIG_HIGHMEM
+				BUG();
+#endif
+				zonelist->zones[j++] = zone;
+			}
+		case ZONE_NORMAL:
+			zone = pgdat->node_zones + ZONE_NORMAL;
+			if (zone->size)
+				zonelist->zones[j++] = zone;
+		case ZONE_DMA:
+			zone = pgdat->node_zones + ZONE_DMA;
+			if (zone->size)
+				zonelist->zones[j++] = zone;
+	}
+	return j;
+}
+
 /*
  * Builds allocation fallback zone lists.
  */
-static inline void build_zonelists(pg_data_t *pgdat)
+static void __init build_zonelists(pg_data_t *pgdat)
 {
-	int i, j, k;
+	int i, j;
 
 	for (i = 0; i < NR_GFPINDEX; i++) {
 		zonelist_t *zonelist;
-		zone_t *zone;
 
 		zonelist = pgdat->node_zonelists + i;
 		memset(zonelist, 0, sizeof(*zonelist));
 
 		zonelist->gfp_mask = i;
-		j = 0;
-		k = ZONE_NORMAL;
-		if (i & __GFP_HIGHMEM)
-			k = ZONE_HIGHMEM;
-		if (i & __GFP_DMA)
-			k = ZONE_DMA;
-
-		switch (k) {
-			default:
-				BUG();
-			/*
-			 * fallthrough:
-			 */
-			case ZONE_HIGHMEM:
-				zone = pgdat->node_zones + ZONE_HIGHMEM;
-				if (zone->size) {
-#ifndef CONFIG_HIGHMEM
-					BUG();
-#endif
-					zonelist->zones[j++] = zone;
-				}
-			case ZONE_NORMAL:
-				zone = pgdat->node_zones + ZONE_NORMAL;
-				if (zone->size)
-					zonelist->zones[j++] = zone;
-			case ZONE_DMA:
-				zone = pgdat->node_zones + ZONE_DMA;
-				if (zone->size)
-					zonelist->zones[j++] = zone;
-		}
+		j = build_zonelists_node(pgdat, zonelist, 0, gfp_zone(i));
 		zonelist->zones[j++] = NULL;
 	} 
 }
 
+#ifdef CONFIG_NUMA
+/*
+ * Once all nodes are up, append the zones of the nearest other nodes
+ * to every zonelist, so that an allocation that can't be satisfied
+ * locally takes remote memory in order of distance before it has to
+ * reclaim. Equally distant nodes are taken in turn after the local
+ * one, which spreads the overflow of the nodes across the others.
+ */
+static void __init build_numa_zonelists(pg_data_t *pgdat)
+{
+	int order[ZONELIST_NODES];
+	char used[MAX_NUMNODES];
+	int local = pgdat->node_id;
+	int i, j, n, nr, node;
+
+	memset(used, 0, sizeof(used));
+	used[local] = 1;
+	for (nr = 0; nr < ZONELIST_NODES - 1 && nr < numnodes - 1; nr++) {
+		int best = -1;
+
+		for (i = 1; i < numnodes; i++) {
+			node = (local + i) % numnodes;
+			if (used[node])
+				continue;
+			if (best < 0 || node_distance(local, node) <
+					node_distance(local, best))
+				best = node;
+		}
+		used[best] = 1;
+		order[nr] = best;
+	}
+
+	for (i = 0; i < NR_GFPINDEX; i++) {
+		zonelist_t *zonelist = pgdat->node_zonelists + i;
+
+		for (j = 0; zonelist->zones[j]; j++)
+			;
+		for (n = 0; n < nr; n++)
+			j = build_zonelists_node(NODE_DATA(order[n]), zonelist,
+						 j, gfp_zone(i));
+		zonelist->zones[j] = NULL;
+	}
+}
+
+void __init build_all_zonelists(void)
+{
+	int nid;
+
+	for (nid = 0; nid < numnodes; nid++)
+		build_numa_zonelists(NODE_DATA(nid));
+}
+#endif /* CONFIG_NUMA */
+
 #define LONG_ALIGN(x) (((x)+(sizeof(long))-1)&~((sizeof(long))-1))
 
 /*
@@ -776,6 +1220,7 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 	unsigned long map_size;
 	unsigned long totalpages, offset, realtotalpages;
 	unsigned int cumulative = 0;
+	int batch, cpu;
 
 	totalpages = 0;
 	for (i = 0; i < MAX_NR_ZONES; i++) {
@@ -809,6 +1254,7 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 	pgdat->node_size = totalpages;
 	pgdat->node_start_paddr = zone_start_paddr;
 	pgdat->node_start_mapnr = (lmem_map - mem_map);
+	init_waitqueue_head(&pgdat->kreclaimd_wait);
 
 	/*
 	 * Initially all pages are reserved - free ones are freed
@@ -820,6 +1266,7 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 		SetPageReserved(p);
 		init_waitqueue_head(&p->wait);
 		memlist_init(&p->list);
+		p->pte_chain = NULL;
 	}
 
 	offset = lmem_map - mem_map;	
@@ -844,6 +1291,33 @@ void __init free_area_init_core(int nid, pg_data_t *pgdat, struct page **gmap,
 		if (!size)
 			continue;
 
+		/*
+		 * A quarter of the pages per 1024 in the zone, up to
+		 * 256kB worth, go on a per-CPU list at a time.
+		 */
+		batch = realsize / 1024;
+		if (batch * PAGE_SIZE > 256 * 1024)
+			batch = (256 * 1024) / PAGE_SIZE;
+		batch /= 4;
+		if (batch < 1)
+			batch = 1;
+		memset(zone->pageset, 0, sizeof(zone->pageset));
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			struct per_cpu_pages *pcp;
+
+			pcp = &zone->pageset[cpu].pcp[PCP_HOT];
+			pcp->low = 2 * batch;
+			pcp->high = 6 * batch;
+			pcp->batch = batch;
+			INIT_LIST_HEAD(&pcp->list);
+
+			pcp = &zone->pageset[cpu].pcp[PCP_COLD];
+			pcp->low = 0;
+			pcp->high = 2 * batch;
+			pcp->batch = batch;
+			INIT_LIST_HEAD(&pcp->list);
+		}
+
 		zone->offset = offset;
 		cumulative += size;
 		mask = (realsize / zone_balance_ratio[j]);
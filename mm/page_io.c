@@ -62,13 +62,18 @@ static int rw_swap_page_base(int rw, swp_entry_t entry, struct page *page, int w
 		int i, j;
 		unsigned int block = offset
 			<< (PAGE_SHIFT - swapf->i_sb->s_blocksize_bits);
+		unsigned long first = swap_extent_block(entry);
 
+		/* The extent map saves going through the filesystem */
 		block_size = swapf->i_sb->s_blocksize;
-		for (i=0, j=0; j< PAGE_SIZE ; i++, j += block_size)
-			if (!(zones[i] = bmap(swapf,block++))) {
+		for (i=0, j=0; j< PAGE_SIZE ; i++, j += block_size) {
+			if (first)
+				zones[i] = first + i;
+			else if (!(zones[i] = bmap(swapf,block++))) {
 				printk("rw_swap_page: bad swap file\n");
 				return 0;
 			}
+		}
 		zones_used = i;
 		dev = swapf->i_dev;
 	} else {
@@ -0,0 +1,298 @@
+/*
+ *  linux/mm/rmap.c
+ *
+ *  Reverse mappings: every page that is mapped into a process keeps
+ *  a chain of the (mm, address) pairs it is mapped at, so the page
+ *  reclaim code can find and unmap it directly from the inactive
+ *  lists instead of scanning the page tables of every process.
+ *
+ *  Only pages that are VALID_PAGE() and not reserved are tracked.
+ *  If we run out of memory for a chain entry the mapping is simply
+ *  not tracked, which costs nothing but makes the page look busy to
+ *  the reclaim code until it is unmapped the normal way.
+ *
+ *  Locking: the chains are protected by a small array of hashed
+ *  spinlocks, which nest inside mm->page_table_lock, the
+ *  pagemap_lru_lock and the mapping's page_lock. Code that holds one of
+ *  the chain locks only ever does a trylock on a page_table_lock.
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/init.h>
+
+#include <asm/pgalloc.h>
+
+struct pte_chain {
+	struct pte_chain *next;
+	struct mm_struct *mm;
+	unsigned long address;
+};
+
+static kmem_cache_t *pte_chain_cache;
+
+#define RMAP_LOCKS	64	/* must be a power of two */
+
+static spinlock_t rmap_locks[RMAP_LOCKS] __cacheline_aligned;
+
+static inline spinlock_t *rmap_lock(struct page *page)
+{
+	unsigned long nr = (unsigned long) page / sizeof(struct page);
+
+	return rmap_locks + ((nr ^ (nr >> 6)) & (RMAP_LOCKS - 1));
+}
+
+static inline int page_tracked(struct page *page)
+{
+	return VALID_PAGE(page) && !PageReserved(page);
+}
+
+/**
+ * page_add_rmap - record a new mapping of a page
+ * @page: the page that got mapped
+ * @mm: the mm it is mapped into
+ * @address: the user address of the pte
+ *
+ * Called after the pte has been set up.
+ */
+void page_add_rmap(struct page *page, struct mm_struct *mm,
+		   unsigned long address)
+{
+	struct pte_chain *pc;
+	spinlock_t *lock;
+
+	if (!page_tracked(page))
+		return;
+	pc = kmem_cache_alloc(pte_chain_cache, SLAB_ATOMIC);
+	if (!pc)
+		return;
+	pc->mm = mm;
+	pc->address = address & PAGE_MASK;
+
+	lock = rmap_lock(page);
+	spin_lock(lock);
+	pc->next = page->pte_chain;
+	page->pte_chain = pc;
+	spin_unlock(lock);
+}
+
+/**
+ * page_remove_rmap - forget about a mapping of a page
+ * @page: the page that got unmapped
+ * @mm: the mm it was mapped into
+ * @address: the user address of the pte
+ */
+void page_remove_rmap(struct page *page, struct mm_struct *mm,
+		      unsigned long address)
+{
+	struct pte_chain *pc, **pprev;
+	spinlock_t *lock;
+
+	if (!page_tracked(page))
+		return;
+	address &= PAGE_MASK;
+
+	lock = rmap_lock(page);
+	spin_lock(lock);
+	for (pprev = &page->pte_chain; (pc = *pprev) != NULL; pprev = &pc->next) {
+		if (pc->mm == mm && pc->address == address) {
+			*pprev = pc->next;
+			spin_unlock(lock);
+			kmem_cache_free(pte_chain_cache, pc);
+			return;
+		}
+	}
+	spin_unlock(lock);
+}
+
+/**
+ * page_mapcount - the number of tracked mappings of a page
+ * @page: the page to look at
+ */
+int page_mapcount(struct page *page)
+{
+	struct pte_chain *pc;
+	spinlock_t *lock;
+	int count = 0;
+
+	if (!page->pte_chain)
+		return 0;
+	lock = rmap_lock(page);
+	spin_lock(lock);
+	for (pc = page->pte_chain; pc; pc = pc->next)
+		count++;
+	spin_unlock(lock);
+	return count;
+}
+
+static pte_t * rmap_pte(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		return NULL;
+	pmd = pmd_offset(pgd, address);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		return NULL;
+	return pte_offset(pmd, address);
+}
+
+/**
+ * page_referenced - test and clear the accessed bits of a page's ptes
+ * @page: the page to look at
+ *
+ * Returns the number of ptes that had been accessed since the last
+ * call. Page tables whose lock we cannot get right away are skipped.
+ */
+int page_referenced(struct page *page)
+{
+	struct pte_chain *pc;
+	spinlock_t *lock;
+	int referenced = 0;
+
+	if (!page->pte_chain)
+		return 0;
+	lock = rmap_lock(page);
+	spin_lock(lock);
+	for (pc = page->pte_chain; pc; pc = pc->next) {
+		struct mm_struct *mm = pc->mm;
+		pte_t *ptep;
+
+		if (!spin_trylock(&mm->page_table_lock))
+			continue;
+		ptep = rmap_pte(mm, pc->address);
+		if (ptep && pte_present(*ptep) && pte_page(*ptep) == page &&
+		    ptep_test_and_clear_young(ptep))
+			referenced++;
+		spin_unlock(&mm->page_table_lock);
+	}
+	spin_unlock(lock);
+	return referenced;
+}
+
+/*
+ * Unmap one pte of the page. Called with the chain lock held; the
+ * caller unlinks the chain entry if we return SWAP_SUCCESS.
+ */
+static int try_to_unmap_one(struct page *page, struct pte_chain *pc,
+			    int *dirty)
+{
+	struct mm_struct *mm = pc->mm;
+	unsigned long address = pc->address;
+	struct vm_area_struct *vma;
+	pte_t *ptep, pte;
+	int ret = SWAP_AGAIN;
+
+	if (!spin_trylock(&mm->page_table_lock))
+		return SWAP_AGAIN;
+
+	/* mremap() moves the ptes before the vma exists, come back later */
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start)
+		goto out_unlock;
+	if (vma->vm_flags & (VM_LOCKED|VM_RESERVED)) {
+		ret = SWAP_FAIL;
+		goto out_unlock;
+	}
+
+	ptep = rmap_pte(mm, address);
+	if (!ptep || !pte_present(*ptep) || pte_page(*ptep) != page) {
+		/* A stale entry, the mapping is gone already. */
+		ret = SWAP_SUCCESS;
+		goto out_unlock;
+	}
+
+	/* Recently used by this process? Then leave it alone. */
+	if (ptep_test_and_clear_young(ptep)) {
+		ret = SWAP_FAIL;
+		goto out_unlock;
+	}
+
+	flush_cache_page(vma, address);
+	pte = ptep_get_and_clear(ptep);
+	flush_tlb_page(vma, address);
+
+	if (PageSwapCache(page)) {
+		swp_entry_t entry;
+
+		entry.val = page->index;
+		swap_duplicate(entry);
+		set_pte(ptep, swp_entry_to_pte(entry));
+	}
+	if (pte_dirty(pte))
+		*dirty = 1;
+	mm->rss--;
+	page_cache_release(page);
+	ret = SWAP_SUCCESS;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/**
+ * try_to_unmap - remove all mappings of a page
+ * @page: the page to unmap
+ *
+ * The caller holds the page lock and a reference on the page, and
+ * not the pagemap_lru_lock. Only pages in the page cache or the
+ * swap cache can be unmapped, since a pte has to be able to find
+ * the page again.
+ *
+ * Returns SWAP_SUCCESS if all mappings are gone, SWAP_AGAIN if some
+ * page tables were busy and SWAP_FAIL if the page is in use or
+ * locked into memory.
+ */
+int try_to_unmap(struct page *page)
+{
+	struct pte_chain *pc, **pprev;
+	spinlock_t *lock;
+	int ret = SWAP_SUCCESS, dirty = 0;
+
+	if (!PageLocked(page))
+		BUG();
+	if (!page->mapping)
+		return SWAP_FAIL;
+
+	lock = rmap_lock(page);
+	spin_lock(lock);
+	pprev = &page->pte_chain;
+	while ((pc = *pprev) != NULL) {
+		switch (try_to_unmap_one(page, pc, &dirty)) {
+		case SWAP_SUCCESS:
+			*pprev = pc->next;
+			kmem_cache_free(pte_chain_cache, pc);
+			continue;
+		case SWAP_AGAIN:
+			ret = SWAP_AGAIN;
+			break;
+		case SWAP_FAIL:
+			ret = SWAP_FAIL;
+			goto out;
+		}
+		pprev = &pc->next;
+	}
+out:
+	spin_unlock(lock);
+
+	/* set_page_dirty() takes the page_lock, see above */
+	if (dirty)
+		set_page_dirty(page);
+	return ret;
+}
+
+void __init pte_chain_init(void)
+{
+	int i;
+
+	for (i = 0; i < RMAP_LOCKS; i++)
+		spin_lock_init(&rmap_locks[i]);
+	pte_chain_cache = kmem_cache_create("pte_chain",
+		sizeof(struct pte_chain), 0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!pte_chain_cache)
+		panic("Cannot create pte_chain SLAB cache");
+}
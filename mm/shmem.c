@@ -33,8 +33,19 @@
 
 #define SHMEM_MAGIC	0x01021994
 
+/*
+ * Swap entries past the direct ones are found through i_indirect, a page
+ * of pointers.  Its first half points to pages of swap entries, its
+ * second half to pages of pointers to pages of swap entries.  All index
+ * pages are single pages, allocated when a page below them is first
+ * touched.
+ */
 #define ENTRIES_PER_PAGE (PAGE_SIZE/sizeof(unsigned long))
-#define NR_SINGLE (ENTRIES_PER_PAGE + SHMEM_NR_DIRECT)
+#define ENTRIES_PER_PAGEPAGE (ENTRIES_PER_PAGE*ENTRIES_PER_PAGE)
+#define SHMEM_NR_SINGLE (ENTRIES_PER_PAGE/2 * ENTRIES_PER_PAGE)
+#define SHMEM_NR_DOUBLE (ENTRIES_PER_PAGE/2 * ENTRIES_PER_PAGEPAGE)
+#define SHMEM_MAX_INDEX (SHMEM_NR_DIRECT + SHMEM_NR_SINGLE + SHMEM_NR_DOUBLE)
+#define SHMEM_MAX_BYTES ((loff_t) SHMEM_MAX_INDEX << PAGE_CACHE_SHIFT)
 
 static struct super_operations shmem_ops;
 static struct address_space_operations shmem_aops;
@@ -50,11 +61,13 @@ static spinlock_t shmem_ilock = SPIN_LOCK_UNLOCKED;
 
 static swp_entry_t * shmem_swp_entry (struct shmem_inode_info *info, unsigned long index) 
 {
+	swp_entry_t **dir;
+
 	if (index < SHMEM_NR_DIRECT)
 		return info->i_direct+index;
 
 	index -= SHMEM_NR_DIRECT;
-	if (index >= ENTRIES_PER_PAGE*ENTRIES_PER_PAGE)
+	if (index >= SHMEM_NR_SINGLE + SHMEM_NR_DOUBLE)
 		return NULL;
 
 	if (!info->i_indirect) {
@@ -62,13 +75,26 @@ static swp_entry_t * shmem_swp_entry (struct shmem_inode_info *info, unsigned lo
 		if (!info->i_indirect)
 			return NULL;
 	}
-	if(!(info->i_indirect[index/ENTRIES_PER_PAGE])) {
-		info->i_indirect[index/ENTRIES_PER_PAGE] = (swp_entry_t *) get_zeroed_page(GFP_USER);
-		if (!info->i_indirect[index/ENTRIES_PER_PAGE])
+	dir = info->i_indirect;
+	if (index < SHMEM_NR_SINGLE)
+		dir += index/ENTRIES_PER_PAGE;
+	else {
+		index -= SHMEM_NR_SINGLE;
+		dir += ENTRIES_PER_PAGE/2 + index/ENTRIES_PER_PAGEPAGE;
+		if (!*dir) {
+			*dir = (swp_entry_t *) get_zeroed_page(GFP_USER);
+			if (!*dir)
+				return NULL;
+		}
+		dir = (swp_entry_t **) *dir + (index%ENTRIES_PER_PAGEPAGE)/ENTRIES_PER_PAGE;
+	}
+	if (!*dir) {
+		*dir = (swp_entry_t *) get_zeroed_page(GFP_USER);
+		if (!*dir)
 			return NULL;
 	}
 	
-	return info->i_indirect[index/ENTRIES_PER_PAGE]+index%ENTRIES_PER_PAGE;
+	return *dir + index%ENTRIES_PER_PAGE;
 }
 
 static int shmem_free_swp(swp_entry_t *dir, unsigned int count)
@@ -117,34 +143,67 @@ shmem_truncate_part (swp_entry_t * dir, unsigned long size,
 	return 0;
 }
 
+/*
+ * shmem_truncate_dir - free the swap entries from @start on below a page
+ * of @count pointers to pages of swap entries, and the pages which
+ * become empty.
+ */
+static void
+shmem_truncate_dir (swp_entry_t **dir, unsigned long count,
+		    unsigned long start, unsigned long *freed)
+{
+	swp_entry_t **ptr;
+	unsigned long offset;
+
+	for (ptr = dir + start/ENTRIES_PER_PAGE; ptr < dir + count; ptr++) {
+		if (!*ptr)
+			continue;
+		offset = 0;
+		if (ptr == dir + start/ENTRIES_PER_PAGE)
+			offset = start%ENTRIES_PER_PAGE;
+		*freed += shmem_free_swp (*ptr + offset, ENTRIES_PER_PAGE - offset);
+		if (offset)
+			continue;
+		free_page ((unsigned long) *ptr);
+		*ptr = 0;
+	}
+}
+
 static void shmem_truncate (struct inode * inode)
 {
 	int clear_base;
-	unsigned long start;
+	unsigned long start, offset;
 	unsigned long mmfreed, freed = 0;
 	swp_entry_t **base, **ptr;
 	struct shmem_inode_info * info = &inode->u.shmem_i;
 
 	spin_lock (&info->lock);
 	start = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	clear_base = start <= SHMEM_NR_DIRECT;
 
 	start = shmem_truncate_part (info->i_direct, SHMEM_NR_DIRECT, start, inode, &freed);
 
 	if (!(base = info->i_indirect))
-		goto out;;
-
-	clear_base = 1;
-	for (ptr = base; ptr < base + ENTRIES_PER_PAGE; ptr++) {
-		if (!start) {
-			if (!*ptr)
-				continue;
-			freed += shmem_free_swp (*ptr, ENTRIES_PER_PAGE);
-			free_page ((unsigned long) *ptr);
-			*ptr = 0;
+		goto out;
+
+	if (start < SHMEM_NR_SINGLE) {
+		shmem_truncate_dir (base, ENTRIES_PER_PAGE/2, start, &freed);
+		start = 0;
+	} else
+		start -= SHMEM_NR_SINGLE;
+
+	for (ptr = base + ENTRIES_PER_PAGE/2 + start/ENTRIES_PER_PAGEPAGE;
+	     ptr < base + ENTRIES_PER_PAGE; ptr++) {
+		if (!*ptr)
 			continue;
-		}
-		clear_base = 0;
-		start = shmem_truncate_part (*ptr, ENTRIES_PER_PAGE, start, inode, &freed);
+		offset = 0;
+		if (ptr == base + ENTRIES_PER_PAGE/2 + start/ENTRIES_PER_PAGEPAGE)
+			offset = start%ENTRIES_PER_PAGEPAGE;
+		shmem_truncate_dir ((swp_entry_t **) *ptr, ENTRIES_PER_PAGE, offset, &freed);
+		if (offset)
+			continue;
+		free_page ((unsigned long) *ptr);
+		*ptr = 0;
 	}
 
 	if (!clear_base) 
@@ -206,6 +265,11 @@ static int shmem_writepage(struct page * page)
 	swap = __get_swap_page(2);
 	if (!swap.val)
 		return 1;
+	/* The swap cache insertion below must not fail, nor sleep */
+	if (radix_tree_preload(GFP_BUFFER)) {
+		__swap_free(swap, 2);
+		return 1;
+	}
 
 	spin_lock(&info->lock);
 	entry = shmem_swp_entry (info, page->index);
@@ -223,8 +287,8 @@ static int shmem_writepage(struct page * page)
 	lru_cache_del(page);
 	remove_inode_page(page);
 
-	/* Add it to the swap cache */
-	add_to_swap_cache(page, swap);
+	/* Add it to the swap cache, its index is preloaded */
+	add_to_swap_cache(page, swap, GFP_ATOMIC);
 	page_cache_release(page);
 	set_page_dirty(page);
 	info->swapped++;
@@ -261,7 +325,7 @@ struct page * shmem_nopage(struct vm_area_struct * vma, unsigned long address, i
 		goto out;
 
 	/* retry, we may have slept */
-	page = __find_lock_page(mapping, idx, page_hash (mapping, idx));
+	page = find_lock_page(mapping, idx);
 	if (page)
 		goto cached_page;
 
@@ -284,14 +348,23 @@ struct page * shmem_nopage(struct vm_area_struct * vma, unsigned long address, i
 		}
 
 		/* We have to this with page locked to prevent races */
+		lock_page(page);
+		/*
+		 * Once it is out of the swap cache the page has to go
+		 * into ours, so make sure that doesn't need memory.
+		 */
+		if (radix_tree_preload(GFP_KERNEL)) {
+			UnlockPage(page);
+			page_cache_release(page);
+			goto oom;
+		}
 		spin_lock (&info->lock);
 		swap_free(*entry);
-		lock_page(page);
 		delete_from_swap_cache_nolock(page);
 		*entry = (swp_entry_t) {0};
 		flags = page->flags & ~((1 << PG_uptodate) | (1 << PG_error) | (1 << PG_referenced) | (1 << PG_arch_1));
 		page->flags = flags | (1 << PG_dirty);
-		add_to_page_cache_locked(page, mapping, idx);
+		add_to_page_cache_locked(page, mapping, idx, GFP_ATOMIC);
 		info->swapped--;
 		spin_unlock (&info->lock);
 	} else {
@@ -303,10 +376,13 @@ struct page * shmem_nopage(struct vm_area_struct * vma, unsigned long address, i
 		/* Ok, get a new page */
 		page = page_cache_alloc();
 		if (!page)
-			goto oom;
+			goto oom_free_block;
+		if (add_to_page_cache (page, mapping, idx, GFP_KERNEL)) {
+			page_cache_free(page);
+			goto oom_free_block;
+		}
 		clear_user_highpage(page, address);
 		inode->i_blocks++;
-		add_to_page_cache (page, mapping, idx);
 	}
 	/* We have the page */
 	SetPageUptodate (page);
@@ -329,6 +405,9 @@ cached_page:
 
 	flush_page_to_ram (page);
 	return(page);
+oom_free_block:
+	spin_lock (&inode->i_sb->u.shmem_sb.stat_lock);
+	inode->i_sb->u.shmem_sb.free_blocks++;
 no_space:
 	spin_unlock (&inode->i_sb->u.shmem_sb.stat_lock);
 oom:
@@ -730,46 +809,67 @@ static void __exit exit_shmem_fs(void)
 module_init(init_shmem_fs)
 module_exit(exit_shmem_fs)
 
-static int shmem_clear_swp (swp_entry_t entry, swp_entry_t *ptr, int size) {
+static int shmem_find_swp (swp_entry_t entry, swp_entry_t *ptr, int size) {
 	swp_entry_t *test;
 
 	for (test = ptr; test < ptr + size; test++) {
-		if (test->val == entry.val) {
-			swap_free (entry);
-			*test = (swp_entry_t) {0};
+		if (test->val == entry.val)
 			return test - ptr;
-		}
 	}
 	return -1;
 }
 
 static int shmem_unuse_inode (struct inode *inode, swp_entry_t entry, struct page *page)
 {
-	swp_entry_t **base, **ptr;
+	swp_entry_t **base, **ptr, **ptr2, *dir;
 	unsigned long idx;
 	int offset;
 	struct shmem_inode_info *info = &inode->u.shmem_i;
 	
 	idx = 0;
 	spin_lock (&info->lock);
-	if ((offset = shmem_clear_swp (entry,info->i_direct, SHMEM_NR_DIRECT)) >= 0)
+	dir = info->i_direct;
+	if ((offset = shmem_find_swp (entry, dir, SHMEM_NR_DIRECT)) >= 0)
 		goto found;
 
 	idx = SHMEM_NR_DIRECT;
 	if (!(base = info->i_indirect))
 		goto out;
 
-	for (ptr = base; ptr < base + ENTRIES_PER_PAGE; ptr++) {
-		if (*ptr &&
-		    (offset = shmem_clear_swp (entry, *ptr, ENTRIES_PER_PAGE)) >= 0)
+	for (ptr = base; ptr < base + ENTRIES_PER_PAGE/2; ptr++) {
+		dir = *ptr;
+		if (dir &&
+		    (offset = shmem_find_swp (entry, dir, ENTRIES_PER_PAGE)) >= 0)
 			goto found;
 		idx += ENTRIES_PER_PAGE;
 	}
+
+	for (; ptr < base + ENTRIES_PER_PAGE; ptr++) {
+		if (!*ptr) {
+			idx += ENTRIES_PER_PAGEPAGE;
+			continue;
+		}
+		for (ptr2 = (swp_entry_t **) *ptr;
+		     ptr2 < (swp_entry_t **) *ptr + ENTRIES_PER_PAGE; ptr2++) {
+			dir = *ptr2;
+			if (dir &&
+			    (offset = shmem_find_swp (entry, dir, ENTRIES_PER_PAGE)) >= 0)
+				goto found;
+			idx += ENTRIES_PER_PAGE;
+		}
+	}
 out:
 	spin_unlock (&info->lock);
 	return 0;
 found:
-	add_to_page_cache(page, inode->i_mapping, offset + idx);
+	/*
+	 * Keep the swap entry until the page is in our cache. If
+	 * we are out of memory, swapoff will come back for it.
+	 */
+	if (add_to_page_cache(page, inode->i_mapping, offset + idx, GFP_ATOMIC))
+		goto out;
+	swap_free(entry);
+	dir[offset] = (swp_entry_t) {0};
 	set_page_dirty(page);
 	SetPageUptodate(page);
 	UnlockPage(page);
@@ -786,6 +886,8 @@ void shmem_unuse(swp_entry_t entry, struct page *page)
 	struct list_head *p;
 	struct inode * inode;
 
+	/* We can't sleep once we found the inode */
+	radix_tree_preload(GFP_KERNEL);
 	spin_lock (&shmem_ilock);
 	list_for_each(p, &shmem_inodes) {
 		inode = list_entry(p, struct inode, u.shmem_i.list);
@@ -813,6 +915,9 @@ struct file *shmem_file_setup(char * name, loff_t size)
 	struct qstr this;
 	int vm_enough_memory(long pages);
 
+	if (size > SHMEM_MAX_BYTES)
+		return ERR_PTR(-EINVAL);
+
 	error = -ENOMEM;
 	if (!vm_enough_memory((size) >> PAGE_SHIFT))
 		goto out;
@@ -35,6 +35,10 @@
  * If partial slabs exist, then new allocations come from these slabs,
  * otherwise from empty slabs or new slabs are allocated.
  *
+ * On NUMA each node has its own list of slabs, grown from its own
+ * memory. Allocations are served from the list of the node the CPU is
+ * on, and a freed object is returned to the list of its slab.
+ *
  * kmem_cache_destroy() CAN CRASH if you try to allocate from the cache
  * during kmem_cache_destroy(). The caller must prevent concurrent allocs.
  *
@@ -72,6 +76,8 @@
 #include	<linux/slab.h>
 #include	<linux/interrupt.h>
 #include	<linux/init.h>
+#include	<linux/timer.h>
+#include	<linux/tqueue.h>
 #include	<asm/uaccess.h>
 
 /*
@@ -95,6 +101,15 @@
 #define REAP_SCANLEN	10
 #define REAP_PERFECT	10
 
+/*
+ * Parameters for the cpucache autotuning: a cache whose cpucaches
+ * were refilled more than TUNE_REFILLS times in a TUNE_INTERVAL gets
+ * its limit doubled, up to TUNE_MAX_SCALE times the default.
+ */
+#define TUNE_INTERVAL	(2*HZ)
+#define TUNE_REFILLS	64
+#define TUNE_MAX_SCALE	4
+
 /* Shouldn't this be in a header file somewhere? */
 #define	BYTES_PER_WORD		sizeof(void *)
 
@@ -149,8 +164,19 @@ typedef struct slab_s {
 	void			*s_mem;		/* including colour offset */
 	unsigned int		inuse;		/* num of objs active in slab */
 	kmem_bufctl_t		free;
+#ifdef CONFIG_NUMA
+	unsigned int		nodeid;		/* the node list it is on */
+#endif
 } slab_t;
 
+#ifdef CONFIG_NUMA
+#define slab_nodeid(slabp)	((slabp)->nodeid)
+#define nr_slab_nodes		numnodes
+#else
+#define slab_nodeid(slabp)	0
+#define nr_slab_nodes		1
+#endif
+
 #define slab_bufctl(slabp) \
 	((kmem_bufctl_t *)(((slab_t*)slabp)+1))
 
@@ -159,17 +185,37 @@ typedef struct slab_s {
  *
  * Per cpu structures
  * The limit is stored in the per-cpu structure to reduce the data cache
- * footprint.
+ * footprint. So are the statistics, which then need no atomic ops;
+ * they are only ever touched by their CPU, with interrupts disabled.
  */
 typedef struct cpucache_s {
 	unsigned int avail;
 	unsigned int limit;
+	unsigned long allochit;		/* allocs served from the array */
+	unsigned long allocmiss;	/* allocs that found it empty */
+	unsigned long refill;		/* batches moved in from the slabs */
+	unsigned long freehit;		/* frees that had room */
+	unsigned long drain;		/* batches moved back to the slabs */
 } cpucache_t;
 
 #define cc_entry(cpucache) \
 	((void **)(((cpucache_t*)cpucache)+1))
 #define cc_data(cachep) \
 	((cachep)->cpudata[smp_processor_id()])
+/*
+ * kmem_list_t
+ *
+ * The slabs of a cache on one node, protected by the cache-lock.
+ */
+typedef struct kmem_list_s {
+	/* full, partial first, then free */
+	struct list_head	slabs;
+	struct list_head	*firstnotfull;
+} kmem_list_t;
+
+#define slab_list(cachep, slabp) \
+	((cachep)->lists + slab_nodeid(slabp))
+
 /*
  * kmem_cache_t
  *
@@ -180,9 +226,7 @@ typedef struct cpucache_s {
 
 struct kmem_cache_s {
 /* 1) each alloc & free */
-	/* full, partial first, then free */
-	struct list_head	slabs;
-	struct list_head	*firstnotfull;
+	kmem_list_t		lists[MAX_NUMNODES];
 	unsigned int		objsize;
 	unsigned int	 	flags;	/* constant flags */
 	unsigned int		num;	/* # of objs per slab */
@@ -219,6 +263,8 @@ struct kmem_cache_s {
 #ifdef CONFIG_SMP
 /* 4) per-cpu data */
 	cpucache_t		*cpudata[NR_CPUS];
+	unsigned int		autotune;	/* limit not set by the admin */
+	unsigned long		last_refill;	/* refills at the last tuning */
 #endif
 #if STATS
 	unsigned long		num_active;
@@ -227,12 +273,6 @@ struct kmem_cache_s {
 	unsigned long		grown;
 	unsigned long		reaped;
 	unsigned long 		errors;
-#ifdef CONFIG_SMP
-	atomic_t		allochit;
-	atomic_t		allocmiss;
-	atomic_t		freehit;
-	atomic_t		freemiss;
-#endif
 #endif
 };
 
@@ -267,18 +307,6 @@ struct kmem_cache_s {
 #define	STATS_INC_ERR(x)	do { } while (0)
 #endif
 
-#if STATS && defined(CONFIG_SMP)
-#define STATS_INC_ALLOCHIT(x)	atomic_inc(&(x)->allochit)
-#define STATS_INC_ALLOCMISS(x)	atomic_inc(&(x)->allocmiss)
-#define STATS_INC_FREEHIT(x)	atomic_inc(&(x)->freehit)
-#define STATS_INC_FREEMISS(x)	atomic_inc(&(x)->freemiss)
-#else
-#define STATS_INC_ALLOCHIT(x)	do { } while (0)
-#define STATS_INC_ALLOCMISS(x)	do { } while (0)
-#define STATS_INC_FREEHIT(x)	do { } while (0)
-#define STATS_INC_FREEMISS(x)	do { } while (0)
-#endif
-
 #if DEBUG
 /* Magic nums for obj red zoning.
  * Placed in the first word before and the first word after an obj.
@@ -345,8 +373,6 @@ static cache_sizes_t cache_sizes[] = {
 
 /* internal cache of cache description objs */
 static kmem_cache_t cache_cache = {
-	slabs:		LIST_HEAD_INIT(cache_cache.slabs),
-	firstnotfull:	&cache_cache.slabs,
 	objsize:	sizeof(kmem_cache_t),
 	flags:		SLAB_NO_REAP,
 	spinlock:	SPIN_LOCK_UNLOCKED,
@@ -371,6 +397,7 @@ static int g_cpucache_up;
 
 static void enable_cpucache (kmem_cache_t *cachep);
 static void enable_all_cpucaches (void);
+static void start_cpucache_tuning (void);
 #endif
 
 /* Cal the num objs, wastage, and bytes left over for a given slab size. */
@@ -402,12 +429,25 @@ static void kmem_cache_estimate (unsigned long gfporder, size_t size,
 }
 
 /* Initialisation - setup the `cache' cache. */
+static void kmem_lists_init(kmem_cache_t *cachep)
+{
+	int node;
+
+	for (node = 0; node < MAX_NUMNODES; node++) {
+		kmem_list_t *l = cachep->lists + node;
+
+		INIT_LIST_HEAD(&l->slabs);
+		l->firstnotfull = &l->slabs;
+	}
+}
+
 void __init kmem_cache_init(void)
 {
 	size_t left_over;
 
 	init_MUTEX(&cache_chain_sem);
 	INIT_LIST_HEAD(&cache_chain);
+	kmem_lists_init(&cache_cache);
 
 	kmem_cache_estimate(0, cache_cache.objsize, 0,
 			&left_over, &cache_cache.num);
@@ -464,6 +504,7 @@ int __init kmem_cpucache_init(void)
 #ifdef CONFIG_SMP
 	g_cpucache_up = 1;
 	enable_all_cpucaches();
+	start_cpucache_tuning();
 #endif
 	return 0;
 }
@@ -472,7 +513,8 @@ __initcall(kmem_cpucache_init);
 
 /* Interface to system's page allocator. No need to hold the cache-lock.
  */
-static inline void * kmem_getpages (kmem_cache_t *cachep, unsigned long flags)
+static inline void * kmem_getpages (kmem_cache_t *cachep, unsigned long flags,
+	int nodeid)
 {
 	void	*addr;
 
@@ -482,7 +524,16 @@ static inline void * kmem_getpages (kmem_cache_t *cachep, unsigned long flags)
 	 * would be relatively rare and ignorable.
 	 */
 	flags |= cachep->gfpflags;
+#ifdef CONFIG_NUMA
+	{
+		struct page *page;
+
+		page = alloc_pages_node(nodeid, flags, cachep->gfporder);
+		addr = page ? page_address(page) : NULL;
+	}
+#else
 	addr = (void*) __get_free_pages(flags, cachep->gfporder);
+#endif
 	/* Assume that now we have the pages no one else can legally
 	 * messes with the 'struct page's.
 	 * However vm_scan() might try to test the structure to see if
@@ -777,8 +828,7 @@ next:
 		cachep->gfpflags |= GFP_DMA;
 	spin_lock_init(&cachep->spinlock);
 	cachep->objsize = size;
-	INIT_LIST_HEAD(&cachep->slabs);
-	cachep->firstnotfull = &cachep->slabs;
+	kmem_lists_init(cachep);
 
 	if (flags & CFLGS_OFF_SLAB)
 		cachep->slabp_cache = kmem_find_general_cachep(slab_size,0);
@@ -859,8 +909,17 @@ static void do_ccupdate_local(void *info)
 {
 	ccupdate_struct_t *new = (ccupdate_struct_t *)info;
 	cpucache_t *old = cc_data(new->cachep);
-	
-	cc_data(new->cachep) = new->new[smp_processor_id()];
+	cpucache_t *cc = new->new[smp_processor_id()];
+
+	/* A resized array keeps the statistics */
+	if (old && cc) {
+		cc->allochit = old->allochit;
+		cc->allocmiss = old->allocmiss;
+		cc->refill = old->refill;
+		cc->freehit = old->freehit;
+		cc->drain = old->drain;
+	}
+	cc_data(new->cachep) = cc;
 	new->new[smp_processor_id()] = old;
 }
 
@@ -895,36 +954,52 @@ static void drain_cpu_caches(kmem_cache_t *cachep)
 #define drain_cpu_caches(cachep)	do { } while (0)
 #endif
 
+/*
+ * Unlinks a free slab from the end of the list, if there is one.
+ * Called with the cache-lock held.
+ */
+static inline slab_t * kmem_list_get_free(kmem_list_t *l)
+{
+	slab_t *slabp;
+
+	if (l->slabs.prev == &l->slabs)
+		return NULL;
+	slabp = list_entry(l->slabs.prev, slab_t, list);
+	if (slabp->inuse)
+		return NULL;
+
+	list_del(&slabp->list);
+	if (l->firstnotfull == &slabp->list)
+		l->firstnotfull = &l->slabs;
+	return slabp;
+}
+
 static int __kmem_cache_shrink(kmem_cache_t *cachep)
 {
 	slab_t *slabp;
-	int ret;
+	int node, ret;
 
 	drain_cpu_caches(cachep);
 
 	spin_lock_irq(&cachep->spinlock);
 
 	/* If the cache is growing, stop shrinking. */
-	while (!cachep->growing) {
-		struct list_head *p;
-
-		p = cachep->slabs.prev;
-		if (p == &cachep->slabs)
-			break;
-
-		slabp = list_entry(cachep->slabs.prev, slab_t, list);
-		if (slabp->inuse)
-			break;
-
-		list_del(&slabp->list);
-		if (cachep->firstnotfull == &slabp->list)
-			cachep->firstnotfull = &cachep->slabs;
+	node = 0;
+	while (!cachep->growing && node < nr_slab_nodes) {
+		slabp = kmem_list_get_free(cachep->lists + node);
+		if (!slabp) {
+			node++;
+			continue;
+		}
 
 		spin_unlock_irq(&cachep->spinlock);
 		kmem_slab_destroy(cachep, slabp);
 		spin_lock_irq(&cachep->spinlock);
 	}
-	ret = !list_empty(&cachep->slabs);
+	ret = 0;
+	for (node = 0; node < nr_slab_nodes; node++)
+		if (!list_empty(&cachep->lists[node].slabs))
+			ret = 1;
 	spin_unlock_irq(&cachep->spinlock);
 	return ret;
 }
@@ -1076,6 +1151,8 @@ static int kmem_cache_grow (kmem_cache_t * cachep, int flags)
 	unsigned int	 i, local_flags;
 	unsigned long	 ctor_flags;
 	unsigned long	 save_flags;
+	kmem_list_t	*l;
+	int		 nodeid = numa_node_id();
 
 	/* Be lazy and only check for valid flags here,
  	 * keeping it out of the critical path in kmem_cache_alloc().
@@ -1127,7 +1204,7 @@ static int kmem_cache_grow (kmem_cache_t * cachep, int flags)
 	 */
 
 	/* Get mem for the objs. */
-	if (!(objp = kmem_getpages(cachep, flags)))
+	if (!(objp = kmem_getpages(cachep, flags, nodeid)))
 		goto failed;
 
 	/* Get slab management. */
@@ -1145,14 +1222,22 @@ static int kmem_cache_grow (kmem_cache_t * cachep, int flags)
 	} while (--i);
 
 	kmem_cache_init_objs(cachep, slabp, ctor_flags);
+#ifdef CONFIG_NUMA
+	/*
+	 * Even if the pages came from another node, this is where they
+	 * were wanted, and where the allocation that grew us will look.
+	 */
+	slabp->nodeid = nodeid;
+#endif
 
 	spin_lock_irqsave(&cachep->spinlock, save_flags);
 	cachep->growing--;
 
 	/* Make slab active. */
-	list_add_tail(&slabp->list,&cachep->slabs);
-	if (cachep->firstnotfull == &cachep->slabs)
-		cachep->firstnotfull = &slabp->list;
+	l = slab_list(cachep, slabp);
+	list_add_tail(&slabp->list,&l->slabs);
+	if (l->firstnotfull == &l->slabs)
+		l->firstnotfull = &slabp->list;
 	STATS_INC_GROWN(cachep);
 	cachep->failures = 0;
 
@@ -1224,7 +1309,7 @@ static inline void * kmem_cache_alloc_one_tail (kmem_cache_t *cachep,
 
 	if (slabp->free == BUFCTL_END)
 		/* slab now full: move to next slab for next alloc */
-		cachep->firstnotfull = slabp->list.next;
+		slab_list(cachep, slabp)->firstnotfull = slabp->list.next;
 #if DEBUG
 	if (cachep->flags & SLAB_POISON)
 		if (kmem_check_poison_obj(cachep, objp))
@@ -1254,8 +1339,9 @@ static inline void * kmem_cache_alloc_one_tail (kmem_cache_t *cachep,
 								\
 	/* Get slab alloc is to come from. */			\
 	{							\
-		struct list_head* p = cachep->firstnotfull;	\
-		if (p == &cachep->slabs)			\
+		kmem_list_t *l = cachep->lists + numa_node_id();\
+		struct list_head* p = l->firstnotfull;		\
+		if (p == &l->slabs)				\
 			goto alloc_new_slab;			\
 		slabp = list_entry(p,slab_t, list);	\
 	}							\
@@ -1267,14 +1353,15 @@ void* kmem_cache_alloc_batch(kmem_cache_t* cachep, int flags)
 {
 	int batchcount = cachep->batchcount;
 	cpucache_t* cc = cc_data(cachep);
+	kmem_list_t *l = cachep->lists + numa_node_id();
 
 	spin_lock(&cachep->spinlock);
 	while (batchcount--) {
 		/* Get slab alloc is to come from. */
-		struct list_head *p = cachep->firstnotfull;
+		struct list_head *p = l->firstnotfull;
 		slab_t *slabp;
 
-		if (p == &cachep->slabs)
+		if (p == &l->slabs)
 			break;
 		slabp = list_entry(p,slab_t, list);
 		cc_entry(cc)[cc->avail++] =
@@ -1282,8 +1369,10 @@ void* kmem_cache_alloc_batch(kmem_cache_t* cachep, int flags)
 	}
 	spin_unlock(&cachep->spinlock);
 
-	if (cc->avail)
+	if (cc->avail) {
+		cc->refill++;
 		return cc_entry(cc)[--cc->avail];
+	}
 	return NULL;
 }
 #endif
@@ -1302,10 +1391,10 @@ try_again:
 
 		if (cc) {
 			if (cc->avail) {
-				STATS_INC_ALLOCHIT(cachep);
+				cc->allochit++;
 				objp = cc_entry(cc)[--cc->avail];
 			} else {
-				STATS_INC_ALLOCMISS(cachep);
+				cc->allocmiss++;
 				objp = kmem_cache_alloc_batch(cachep,flags);
 				if (!objp)
 					goto alloc_new_slab_nolock;
@@ -1421,9 +1510,10 @@ moveslab_partial:
 	 * slabp: there are no partial slabs in this case
 	 */
 	{
-		struct list_head *t = cachep->firstnotfull;
+		kmem_list_t *l = slab_list(cachep, slabp);
+		struct list_head *t = l->firstnotfull;
 
-		cachep->firstnotfull = &slabp->list;
+		l->firstnotfull = &slabp->list;
 		if (slabp->list.next == t)
 			return;
 		list_del(&slabp->list);
@@ -1437,12 +1527,13 @@ moveslab_free:
 	 * FIXME: optimize
 	 */
 	{
-		struct list_head *t = cachep->firstnotfull->prev;
+		kmem_list_t *l = slab_list(cachep, slabp);
+		struct list_head *t = l->firstnotfull->prev;
 
 		list_del(&slabp->list);
-		list_add_tail(&slabp->list, &cachep->slabs);
-		if (cachep->firstnotfull == &slabp->list)
-			cachep->firstnotfull = t->next;
+		list_add_tail(&slabp->list, &l->slabs);
+		if (l->firstnotfull == &slabp->list)
+			l->firstnotfull = t->next;
 		return;
 	}
 }
@@ -1476,11 +1567,11 @@ static inline void __kmem_cache_free (kmem_cache_t *cachep, void* objp)
 	if (cc) {
 		int batchcount;
 		if (cc->avail < cc->limit) {
-			STATS_INC_FREEHIT(cachep);
+			cc->freehit++;
 			cc_entry(cc)[cc->avail++] = objp;
 			return;
 		}
-		STATS_INC_FREEMISS(cachep);
+		cc->drain++;
 		batchcount = cachep->batchcount;
 		cc->avail -= batchcount;
 		free_block(cachep,
@@ -1659,25 +1750,127 @@ oom:
 	return -ENOMEM;
 }
 
+/* The limit a cache starts out with, 0 for no cpucache */
+static int cpucache_default_limit (kmem_cache_t *cachep)
+{
+	/* FIXME: optimize */
+	if (cachep->objsize > PAGE_SIZE)
+		return 0;
+	if (cachep->objsize > 1024)
+		return 60;
+	if (cachep->objsize > 256)
+		return 124;
+	return 252;
+}
+
 static void enable_cpucache (kmem_cache_t *cachep)
 {
 	int err;
 	int limit;
 
-	/* FIXME: optimize */
-	if (cachep->objsize > PAGE_SIZE)
+	limit = cpucache_default_limit(cachep);
+	if (!limit)
 		return;
-	if (cachep->objsize > 1024)
-		limit = 60;
-	else if (cachep->objsize > 256)
-		limit = 124;
-	else
-		limit = 252;
 
 	err = kmem_tune_cpucache(cachep, limit, limit/2);
 	if (err)
 		printk(KERN_ERR "enable_cpucache failed for %s, error %d.\n",
 					cachep->name, -err);
+	else
+		cachep->autotune = 1;
+}
+
+static unsigned long cpucache_refills (kmem_cache_t *cachep)
+{
+	unsigned long refill = 0;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpucache_t *cc = cachep->cpudata[cpu_logical_map(i)];
+
+		if (cc)
+			refill += cc->refill;
+	}
+	return refill;
+}
+
+/*
+ * Caches that keep running their cpucaches dry, like the skbuff and
+ * dentry caches under load, get bigger ones. kmem_cache_reap() takes
+ * that back when memory gets short.
+ */
+static void tune_cpucaches (void *dummy);
+static void tune_cpucaches_timer (unsigned long dummy);
+
+static struct tq_struct cpucache_tune_task = {
+	routine:	tune_cpucaches,
+};
+
+static struct timer_list cpucache_tune_timer = {
+	function:	tune_cpucaches_timer,
+};
+
+static void tune_cpucaches_timer (unsigned long dummy)
+{
+	schedule_task(&cpucache_tune_task);
+}
+
+static void tune_cpucaches (void *dummy)
+{
+	struct list_head* p;
+
+	down(&cache_chain_sem);
+	list_for_each(p,&cache_chain) {
+		kmem_cache_t *cachep = list_entry(p, kmem_cache_t, next);
+		unsigned long refill;
+		int limit, max;
+
+		if (!cachep->autotune || !cc_data(cachep))
+			continue;
+		refill = cpucache_refills(cachep);
+		if (refill - cachep->last_refill > TUNE_REFILLS) {
+			limit = cc_data(cachep)->limit;
+			max = TUNE_MAX_SCALE * cpucache_default_limit(cachep);
+			if (limit < max) {
+				limit *= 2;
+				if (limit > max)
+					limit = max;
+				kmem_tune_cpucache(cachep, limit, limit/2);
+			}
+		}
+		/* The resized arrays carry over the old counters */
+		cachep->last_refill = cpucache_refills(cachep);
+	}
+	up(&cache_chain_sem);
+
+	mod_timer(&cpucache_tune_timer, jiffies + TUNE_INTERVAL);
+}
+
+static void __init start_cpucache_tuning (void)
+{
+	init_timer(&cpucache_tune_timer);
+	cpucache_tune_timer.expires = jiffies + TUNE_INTERVAL;
+	add_timer(&cpucache_tune_timer);
+}
+
+/*
+ * Undo the autotuning of a cache, called with its spinlock held. The
+ * arrays keep their size, only their limit goes down: lowering the
+ * batchcount first means no CPU ever gets to free a batch larger
+ * than what its array holds.
+ */
+static void shrink_cpucache (kmem_cache_t *cachep)
+{
+	int i, limit;
+
+	limit = cpucache_default_limit(cachep);
+	if (!cachep->autotune || !cc_data(cachep) ||
+	    cc_data(cachep)->limit <= limit)
+		return;
+	cachep->batchcount = limit/2;
+	wmb();
+	for (i = 0; i < smp_num_cpus; i++)
+		cachep->cpudata[cpu_logical_map(i)]->limit = limit;
 }
 
 static void enable_all_cpucaches (void)
@@ -1712,6 +1905,7 @@ void kmem_cache_reap (int gfp_mask)
 	unsigned int best_pages;
 	unsigned int best_len;
 	unsigned int scan;
+	int node;
 
 	if (gfp_mask & __GFP_WAIT)
 		down(&cache_chain_sem);
@@ -1745,18 +1939,24 @@ void kmem_cache_reap (int gfp_mask)
 			if (cc && cc->avail) {
 				__free_block(searchp, cc_entry(cc), cc->avail);
 				cc->avail = 0;
+				cc->drain++;
 			}
+			shrink_cpucache(searchp);
 		}
 #endif
 
 		full_free = 0;
-		p = searchp->slabs.prev;
-		while (p != &searchp->slabs) {
-			slabp = list_entry(p, slab_t, list);
-			if (slabp->inuse)
-				break;
-			full_free++;
-			p = p->prev;
+		for (node = 0; node < nr_slab_nodes; node++) {
+			kmem_list_t *l = searchp->lists + node;
+
+			p = l->slabs.prev;
+			while (p != &l->slabs) {
+				slabp = list_entry(p, slab_t, list);
+				if (slabp->inuse)
+					break;
+				full_free++;
+				p = p->prev;
+			}
 		}
 
 		/*
@@ -1795,20 +1995,15 @@ next:
 perfect:
 	/* free only 80% of the free slabs */
 	best_len = (best_len*4 + 1)/5;
+	node = 0;
 	for (scan = 0; scan < best_len; scan++) {
-		struct list_head *p;
-
 		if (best_cachep->growing)
 			break;
-		p = best_cachep->slabs.prev;
-		if (p == &best_cachep->slabs)
+		while (node < nr_slab_nodes &&
+		       !(slabp = kmem_list_get_free(best_cachep->lists + node)))
+			node++;
+		if (node == nr_slab_nodes)
 			break;
-		slabp = list_entry(p,slab_t,list);
-		if (slabp->inuse)
-			break;
-		list_del(&slabp->list);
-		if (best_cachep->firstnotfull == &slabp->list)
-			best_cachep->firstnotfull = &best_cachep->slabs;
 		STATS_INC_REAPED(best_cachep);
 
 		/* Safe to drop the lock. The slab is no longer linked to the
@@ -1869,19 +2064,22 @@ static int proc_getdata (char*page, char**start, off_t off, int count)
 		unsigned long	num_objs;
 		unsigned long	active_slabs = 0;
 		unsigned long	num_slabs;
+		int		node;
 		cachep = list_entry(p, kmem_cache_t, next);
 
 		spin_lock_irq(&cachep->spinlock);
 		active_objs = 0;
 		num_slabs = 0;
-		list_for_each(q,&cachep->slabs) {
-			slabp = list_entry(q, slab_t, list);
-			active_objs += slabp->inuse;
-			num_objs += cachep->num;
-			if (slabp->inuse)
-				active_slabs++;
-			else
-				num_slabs++;
+		for (node = 0; node < nr_slab_nodes; node++) {
+			list_for_each(q,&cachep->lists[node].slabs) {
+				slabp = list_entry(q, slab_t, list);
+				active_objs += slabp->inuse;
+				num_objs += cachep->num;
+				if (slabp->inuse)
+					active_slabs++;
+				else
+					num_slabs++;
+			}
 		}
 		num_slabs+=active_slabs;
 		num_objs = num_slabs*cachep->num;
@@ -1914,15 +2112,25 @@ static int proc_getdata (char*page, char**start, off_t off, int count)
 			len += sprintf(page+len, " : %4u %4u",
 					limit, batchcount);
 		}
-#endif
-#if STATS && defined(CONFIG_SMP)
 		{
-			unsigned long allochit = atomic_read(&cachep->allochit);
-			unsigned long allocmiss = atomic_read(&cachep->allocmiss);
-			unsigned long freehit = atomic_read(&cachep->freehit);
-			unsigned long freemiss = atomic_read(&cachep->freemiss);
-			len += sprintf(page+len, " : %6lu %6lu %6lu %6lu",
-					allochit, allocmiss, freehit, freemiss);
+			unsigned long allochit = 0, allocmiss = 0, refill = 0;
+			unsigned long freehit = 0, drain = 0;
+			int i;
+
+			for (i = 0; i < smp_num_cpus; i++) {
+				cpucache_t *cc = cachep->cpudata[cpu_logical_map(i)];
+
+				if (!cc)
+					continue;
+				allochit += cc->allochit;
+				allocmiss += cc->allocmiss;
+				refill += cc->refill;
+				freehit += cc->freehit;
+				drain += cc->drain;
+			}
+			len += sprintf(page+len, " : %8lu %6lu %6lu %8lu %6lu",
+					allochit, allocmiss, refill,
+					freehit, drain);
 		}
 #endif
 		len += sprintf(page+len,"\n");
@@ -2008,6 +2216,9 @@ int slabinfo_write_proc (struct file *file, const char *buffer,
 
 		if (!strcmp(cachep->name, kbuf)) {
 			res = kmem_tune_cpucache(cachep, limit, batchcount);
+			/* The admin knows better, leave it alone */
+			if (!res)
+				cachep->autotune = 0;
 			break;
 		}
 	}
@@ -166,13 +166,14 @@ void deactivate_page_nolock(struct page * page)
 {
 	/*
 	 * One for the cache, one for the extra reference the
-	 * caller has and (maybe) one for the buffers.
+	 * caller has, (maybe) one for the buffers and one for
+	 * each pte page_launder() can unmap.
 	 *
 	 * This isn't perfect, but works for just about everything.
 	 * Besides, as long as we don't move unfreeable pages to the
 	 * inactive_clean list it doesn't need to be perfect...
 	 */
-	int maxcount = (page->buffers ? 3 : 2);
+	int maxcount = (page->buffers ? 3 : 2) + page_mapcount(page);
 	page->age = 0;
 	ClearPageReferenced(page);
 
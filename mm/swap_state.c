@@ -34,6 +34,12 @@ struct address_space swapper_space = {
 	LIST_HEAD_INIT(swapper_space.locked_pages),
 	0,				/* nrpages	*/
 	&swap_aops,
+	NULL,				/* host		*/
+	NULL,				/* i_mmap	*/
+	NULL,				/* i_mmap_shared */
+	SPIN_LOCK_UNLOCKED,		/* i_shared_lock */
+	RADIX_TREE_INIT(),		/* page_tree	*/
+	SPIN_LOCK_UNLOCKED,		/* page_lock	*/
 };
 
 #ifdef SWAP_CACHE_INFO
@@ -51,22 +57,33 @@ void show_swap_cache_info(void)
 }
 #endif
 
-void add_to_swap_cache(struct page *page, swp_entry_t entry)
+/*
+ * Returns -EEXIST if the entry is in the swap cache already, or
+ * -ENOMEM. The page is left as it was in that case.
+ */
+int add_to_swap_cache(struct page *page, swp_entry_t entry, int gfp_mask)
 {
 	unsigned long flags;
+	int error;
 
-#ifdef SWAP_CACHE_INFO
-	swap_cache_add_total++;
-#endif
 	if (!PageLocked(page))
 		BUG();
 	if (PageTestandSetSwapCache(page))
 		BUG();
 	if (page->mapping)
 		BUG();
-	flags = page->flags & ~((1 << PG_error) | (1 << PG_arch_1));
-	page->flags = flags | (1 << PG_uptodate);
-	add_to_page_cache_locked(page, &swapper_space, entry.val);
+	flags = page->flags;
+	page->flags = (flags & ~((1 << PG_error) | (1 << PG_arch_1))) | (1 << PG_uptodate);
+	error = add_to_page_cache_locked(page, &swapper_space, entry.val, gfp_mask);
+	if (error) {
+		page->flags = flags;
+		PageClearSwapCache(page);
+		return error;
+	}
+#ifdef SWAP_CACHE_INFO
+	swap_cache_add_total++;
+#endif
+	return 0;
 }
 
 static inline void remove_from_swap_cache(struct page *page)
@@ -112,10 +129,10 @@ void delete_from_swap_cache_nolock(struct page *page)
 	if (block_flushpage(page, 0))
 		lru_cache_del(page);
 
-	spin_lock(&pagecache_lock);
+	spin_lock(&swapper_space.page_lock);
 	ClearPageDirty(page);
 	__delete_from_swap_cache(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&swapper_space.page_lock);
 	page_cache_release(page);
 }
 
@@ -242,7 +259,12 @@ struct page * read_swap_cache_async(swp_entry_t entry, int wait)
 	 * Add it to the swap cache and read its contents.
 	 */
 	lock_page(new_page);
-	add_to_swap_cache(new_page, entry);
+	if (add_to_swap_cache(new_page, entry, GFP_USER)) {
+		/* Somebody else was faster, or we are out of memory. */
+		UnlockPage(new_page);
+		found_page = lookup_swap_cache(entry);
+		goto out_free_page;
+	}
 	rw_swap_page(READ, new_page, wait);
 	return new_page;
 
@@ -36,7 +36,9 @@ static inline int scan_swap_map(struct swap_info_struct *si, unsigned short coun
 	 * first-free allocation, starting a new cluster.  This
 	 * prevents us from scattering swap pages all over the entire
 	 * swap partition, so that we reduce overall disk seek times
-	 * between swap pages.  -- sct */
+	 * between swap pages.  -- sct
+	 * Devices of equal priority are only rotated between clusters,
+	 * see __get_swap_page(). */
 	if (si->cluster_nr) {
 		while (si->cluster_next <= si->highest_bit) {
 			offset = si->cluster_next++;
@@ -107,6 +109,13 @@ swp_entry_t __get_swap_page(unsigned short count)
 			swap_device_unlock(p);
 			if (offset) {
 				entry = SWP_ENTRY(type,offset);
+				/*
+				 * Stay on this device until its cluster is
+				 * used up, so that pages swapped out together
+				 * stay together on disk.
+				 */
+				if (p->cluster_nr)
+					goto out;
 				type = swap_info[type].next;
 				if (type < 0 ||
 					p->prio != swap_info[type].prio) {
@@ -231,6 +240,7 @@ static inline void unuse_pte(struct vm_area_struct * vma, unsigned long address,
 	set_pte(dir, pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
 	swap_free(entry);
 	get_page(page);
+	page_add_rmap(page, vma->vm_mm, address);
 	++vma->vm_mm->rss;
 }
 
@@ -255,7 +265,7 @@ static inline void unuse_pmd(struct vm_area_struct * vma, pmd_t *dir,
 	if (end > PMD_SIZE)
 		end = PMD_SIZE;
 	do {
-		unuse_pte(vma, offset+address-vma->vm_start, pte, entry, page);
+		unuse_pte(vma, offset + address, pte, entry, page);
 		address += PAGE_SIZE;
 		pte++;
 	} while (address && (address < end));
@@ -298,6 +308,9 @@ static void unuse_vma(struct vm_area_struct * vma, pgd_t *pgdir,
 
 	if (start >= end)
 		BUG();
+	/* Big pages are never swapped */
+	if (vma->vm_flags & VM_BIGPAGE)
+		return;
 	do {
 		unuse_pgd(vma, pgdir, start, end - start, entry, page);
 		start = (start + PGDIR_SIZE) & PGDIR_MASK;
@@ -476,6 +489,10 @@ asmlinkage long sys_swapoff(const char * specialfile)
 	p->swap_device = 0;
 	vfree(p->swap_map);
 	p->swap_map = NULL;
+	if (p->extents)
+		vfree(p->extents);
+	p->extents = NULL;
+	p->nr_extents = 0;
 	p->flags = 0;
 	err = 0;
 
@@ -537,6 +554,78 @@ int is_swap_partition(kdev_t dev) {
 	return 0;
 }
 
+/*
+ * Walk the block map of a swap file and find the runs of pages that are
+ * contiguous on the disk.  The first pass only counts them; the second
+ * fills in @extents and marks bad the pages which can't be used, those
+ * with a hole or whose blocks are not contiguous.  Returns the number
+ * of extents.
+ */
+static int swap_extent_scan(struct swap_info_struct *p, struct inode *inode,
+			    struct swap_extent *extents, int *nr_good_pages)
+{
+	int blkbits = inode->i_sb->s_blocksize_bits;
+	int per_page = 1 << (PAGE_SHIFT - blkbits);
+	struct swap_extent e = { 0, 0, 0 };
+	unsigned long page, block, first;
+	int i, nr = 0;
+
+	for (page = 1; page < p->max; page++) {
+		if (p->swap_map[page] == SWAP_MAP_BAD)
+			continue;
+		block = page << (PAGE_SHIFT - blkbits);
+		first = bmap(inode, block);
+		for (i = 1; i < per_page && first; i++)
+			if (bmap(inode, block + i) != first + i)
+				first = 0;
+		if (!first) {
+			if (extents) {
+				p->swap_map[page] = SWAP_MAP_BAD;
+				(*nr_good_pages)--;
+			}
+			continue;
+		}
+		if (nr && page == e.start_page + e.nr_pages &&
+		    first == e.start_block + e.nr_pages * per_page) {
+			e.nr_pages++;
+		} else {
+			e.start_page = page;
+			e.nr_pages = 1;
+			e.start_block = first;
+			nr++;
+		}
+		if (extents)
+			extents[nr - 1] = e;
+	}
+	return nr;
+}
+
+/*
+ * First filesystem block of a page of a swap file.  0 if the file has
+ * no extent map yet, as while swapon reads the header.
+ */
+unsigned long swap_extent_block(swp_entry_t entry)
+{
+	struct swap_info_struct *p = swap_info + SWP_TYPE(entry);
+	unsigned long offset = SWP_OFFSET(entry);
+	struct swap_extent *e;
+	int lo = 0, hi = p->nr_extents;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		e = p->extents + mid;
+		if (offset < e->start_page)
+			hi = mid;
+		else if (offset >= e->start_page + e->nr_pages)
+			lo = mid + 1;
+		else
+			return e->start_block + ((offset - e->start_page)
+				<< (PAGE_SHIFT - p->swap_file->d_inode->i_sb->s_blocksize_bits));
+	}
+	return 0;
+}
+
 /*
  * Written 01/25/92 by Simmule Turner, heavily changed by Linus.
  *
@@ -575,6 +664,8 @@ asmlinkage long sys_swapon(const char * specialfile, int swap_flags)
 	p->swap_vfsmnt = NULL;
 	p->swap_device = 0;
 	p->swap_map = NULL;
+	p->extents = NULL;
+	p->nr_extents = 0;
 	p->lowest_bit = 0;
 	p->highest_bit = 0;
 	p->cluster_nr = 0;
@@ -738,6 +829,26 @@ asmlinkage long sys_swapon(const char * specialfile, int swap_flags)
 		error = -EINVAL;
 		goto bad_swap;
 	}
+	if (!p->swap_device) {
+		struct swap_extent *extents = NULL;
+		int nr;
+
+		/* The block map must not change between the two passes */
+		down(&swap_inode->i_sem);
+		nr = swap_extent_scan(p, swap_inode, NULL, NULL);
+		if (nr) {
+			extents = vmalloc(nr * sizeof(struct swap_extent));
+			if (!extents) {
+				up(&swap_inode->i_sem);
+				error = -ENOMEM;
+				goto bad_swap;
+			}
+		}
+		nr = swap_extent_scan(p, swap_inode, extents, &nr_good_pages);
+		up(&swap_inode->i_sem);
+		p->extents = extents;
+		p->nr_extents = nr;
+	}
 	if (!nr_good_pages) {
 		printk(KERN_WARNING "Empty swap-file\n");
 		error = -EINVAL;
@@ -774,6 +885,10 @@ bad_swap:
 bad_swap_2:
 	if (p->swap_map)
 		vfree(p->swap_map);
+	if (p->extents)
+		vfree(p->extents);
+	p->extents = NULL;
+	p->nr_extents = 0;
 	nd.mnt = p->swap_vfsmnt;
 	nd.dentry = p->swap_file;
 	p->swap_device = 0;
@@ -10,6 +10,8 @@
 #include <linux/vmalloc.h>
 #include <linux/spinlock.h>
 #include <linux/smp_lock.h>
+#include <linux/init.h>
+#include <linux/proc_fs.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -17,6 +19,173 @@
 rwlock_t vmlist_lock = RW_LOCK_UNLOCKED;
 struct vm_struct * vmlist;
 
+/*
+ * The areas are kept in a red-black tree by address as well as on the
+ * sorted vmlist, and like the VMAs in mm/mmap.c every node remembers
+ * the largest hole following an area of its subtree, so that finding
+ * room and finding the area to vfree() are both logarithmic.
+ *
+ * vfree() unmaps and frees the pages at once but leaves the area on
+ * the list, marked VM_LAZYFREE, and does not flush the TLBs: stale
+ * entries can only be for addresses nobody may use any more, and
+ * nobody can get those addresses again before the flush.  Once
+ * VM_LAZY_MAX pages have piled up, or when get_vm_area() finds no
+ * room, a single flush_tlb_all() retires all of them.
+ */
+static rb_root_t vm_rb;
+static unsigned long vm_lazy_pages;
+
+#define VM_LAZY_MAX	((16 << 20) >> PAGE_SHIFT)
+
+static inline unsigned long vm_area_end(struct vm_struct *area)
+{
+	return (unsigned long) area->addr + area->size;
+}
+
+static inline unsigned long vm_area_gap(struct vm_struct *area)
+{
+	if (area->next)
+		return (unsigned long) area->next->addr - vm_area_end(area);
+	return VMALLOC_END - vm_area_end(area);
+}
+
+static void vm_rb_augment(rb_node_t *rb_node)
+{
+	struct vm_struct *area = rb_entry(rb_node, struct vm_struct, rb);
+	unsigned long gap = vm_area_gap(area), sub;
+
+	if (rb_node->rb_left) {
+		sub = rb_entry(rb_node->rb_left, struct vm_struct, rb)->rb_gap;
+		if (sub > gap)
+			gap = sub;
+	}
+	if (rb_node->rb_right) {
+		sub = rb_entry(rb_node->rb_right, struct vm_struct, rb)->rb_gap;
+		if (sub > gap)
+			gap = sub;
+	}
+	area->rb_gap = gap;
+}
+
+static void vm_gap_update(struct vm_struct *area)
+{
+	rb_node_t *rb_node;
+
+	for (rb_node = &area->rb; rb_node; rb_node = rb_node->rb_parent)
+		vm_rb_augment(rb_node);
+}
+
+/* Put area on the list after prev (NULL: first) and into the tree */
+static void vm_area_link(struct vm_struct *area, struct vm_struct *prev)
+{
+	rb_node_t **link = &vm_rb.rb_node, *parent = NULL;
+
+	if (prev) {
+		area->next = prev->next;
+		prev->next = area;
+	} else {
+		area->next = vmlist;
+		vmlist = area;
+	}
+
+	while (*link) {
+		parent = *link;
+		if (area->addr < rb_entry(parent, struct vm_struct, rb)->addr)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&area->rb, parent, link);
+	rb_insert_augmented(&area->rb, &vm_rb, vm_rb_augment);
+	if (prev)
+		vm_gap_update(prev);
+}
+
+static void vm_area_unlink(struct vm_struct *area)
+{
+	rb_node_t *prev_node = rb_prev(&area->rb);
+	struct vm_struct *prev = NULL;
+
+	if (prev_node) {
+		prev = rb_entry(prev_node, struct vm_struct, rb);
+		prev->next = area->next;
+	} else
+		vmlist = area->next;
+	rb_erase_augmented(&area->rb, &vm_rb, vm_rb_augment);
+	if (prev)
+		vm_gap_update(prev);
+}
+
+static struct vm_struct *vm_area_find(void *addr)
+{
+	rb_node_t *rb_node = vm_rb.rb_node;
+	struct vm_struct *area;
+
+	while (rb_node) {
+		area = rb_entry(rb_node, struct vm_struct, rb);
+		if (addr == area->addr)
+			return area;
+		rb_node = addr < area->addr ? rb_node->rb_left : rb_node->rb_right;
+	}
+	return NULL;
+}
+
+/*
+ * The lowest hole of at least size bytes: its start, and in *prevp the
+ * area before it.  0 if there is none.
+ */
+static unsigned long vm_area_hole(unsigned long size, struct vm_struct **prevp)
+{
+	rb_node_t *rb_node = vm_rb.rb_node, *sub;
+	struct vm_struct *area;
+
+	*prevp = NULL;
+	if (!vmlist || (unsigned long) vmlist->addr - VMALLOC_START >= size)
+		return VMALLOC_END - VMALLOC_START >= size ? VMALLOC_START : 0;
+	if (rb_entry(rb_node, struct vm_struct, rb)->rb_gap < size)
+		return 0;
+
+	for (;;) {
+		area = rb_entry(rb_node, struct vm_struct, rb);
+		sub = rb_node->rb_left;
+		if (sub && rb_entry(sub, struct vm_struct, rb)->rb_gap >= size) {
+			rb_node = sub;
+			continue;
+		}
+		if (vm_area_gap(area) >= size) {
+			*prevp = area;
+			return vm_area_end(area);
+		}
+		rb_node = rb_node->rb_right;
+		if (!rb_node)
+			BUG();		/* the gaps are wrong */
+	}
+}
+
+/* Flush the TLBs and forget the areas vfree() left behind */
+static void vm_purge_lazy(void)
+{
+	struct vm_struct *area, *next, *dead = NULL;
+
+	if (!vm_lazy_pages)
+		return;
+	flush_tlb_all();
+	for (area = vmlist; area; area = next) {
+		next = area->next;
+		if (area->flags & VM_LAZYFREE) {
+			vm_area_unlink(area);
+			area->next = dead;
+			dead = area;
+		}
+	}
+	vm_lazy_pages = 0;
+
+	while ((area = dead) != NULL) {
+		dead = area->next;
+		kfree(area);
+	}
+}
+
 static inline void free_area_pte(pmd_t * pmd, unsigned long address, unsigned long size)
 {
 	pte_t * pte;
@@ -75,7 +244,7 @@ static inline void free_area_pmd(pgd_t * dir, unsigned long address, unsigned lo
 	} while (address < end);
 }
 
-void vmfree_area_pages(unsigned long address, unsigned long size)
+static void __vmfree_area_pages(unsigned long address, unsigned long size)
 {
 	pgd_t * dir;
 	unsigned long end = address + size;
@@ -87,6 +256,11 @@ void vmfree_area_pages(unsigned long address, unsigned long size)
 		address = (address + PGDIR_SIZE) & PGDIR_MASK;
 		dir++;
 	} while (address && (address < end));
+}
+
+void vmfree_area_pages(unsigned long address, unsigned long size)
+{
+	__vmfree_area_pages(address, size);
 	flush_tlb_all();
 }
 
@@ -168,41 +342,50 @@ inline int vmalloc_area_pages (unsigned long address, unsigned long size,
 struct vm_struct * get_vm_area(unsigned long size, unsigned long flags)
 {
 	unsigned long addr;
-	struct vm_struct **p, *tmp, *area;
+	struct vm_struct *prev, *area;
 
 	area = (struct vm_struct *) kmalloc(sizeof(*area), GFP_KERNEL);
 	if (!area)
 		return NULL;
 	size += PAGE_SIZE;
-	addr = VMALLOC_START;
+	if (size < PAGE_SIZE) {
+		kfree(area);
+		return NULL;
+	}
 	write_lock(&vmlist_lock);
-	for (p = &vmlist; (tmp = *p) ; p = &tmp->next) {
-		if ((size + addr) < addr) {
-			write_unlock(&vmlist_lock);
-			kfree(area);
-			return NULL;
-		}
-		if (size + addr < (unsigned long) tmp->addr)
-			break;
-		addr = tmp->size + (unsigned long) tmp->addr;
-		if (addr > VMALLOC_END-size) {
-			write_unlock(&vmlist_lock);
-			kfree(area);
-			return NULL;
-		}
+	addr = vm_area_hole(size, &prev);
+	if (!addr && vm_lazy_pages) {
+		vm_purge_lazy();
+		addr = vm_area_hole(size, &prev);
+	}
+	if (!addr) {
+		write_unlock(&vmlist_lock);
+		kfree(area);
+		return NULL;
 	}
 	area->flags = flags;
 	area->addr = (void *)addr;
 	area->size = size;
-	area->next = *p;
-	*p = area;
+	vm_area_link(area, prev);
 	write_unlock(&vmlist_lock);
 	return area;
 }
 
+/* For architectures that map something into the area before kmalloc works */
+void __init vm_area_register_early(struct vm_struct *area)
+{
+	struct vm_struct *prev = NULL, *tmp;
+
+	write_lock(&vmlist_lock);
+	for (tmp = vmlist; tmp && tmp->addr < area->addr; tmp = tmp->next)
+		prev = tmp;
+	vm_area_link(area, prev);
+	write_unlock(&vmlist_lock);
+}
+
 void vfree(void * addr)
 {
-	struct vm_struct **p, *tmp;
+	struct vm_struct *tmp;
 
 	if (!addr)
 		return;
@@ -211,14 +394,15 @@ void vfree(void * addr)
 		return;
 	}
 	write_lock(&vmlist_lock);
-	for (p = &vmlist ; (tmp = *p) ; p = &tmp->next) {
-		if (tmp->addr == addr) {
-			*p = tmp->next;
-			vmfree_area_pages(VMALLOC_VMADDR(tmp->addr), tmp->size);
-			write_unlock(&vmlist_lock);
-			kfree(tmp);
-			return;
-		}
+	tmp = vm_area_find(addr);
+	if (tmp && !(tmp->flags & VM_LAZYFREE)) {
+		__vmfree_area_pages(VMALLOC_VMADDR(tmp->addr), tmp->size);
+		tmp->flags |= VM_LAZYFREE;
+		vm_lazy_pages += tmp->size >> PAGE_SHIFT;
+		if (vm_lazy_pages > VM_LAZY_MAX)
+			vm_purge_lazy();
+		write_unlock(&vmlist_lock);
+		return;
 	}
 	write_unlock(&vmlist_lock);
 	printk(KERN_ERR "Trying to vfree() nonexistent vm area (%p)\n", addr);
@@ -257,6 +441,8 @@ long vread(char *buf, char *addr, unsigned long count)
 
 	read_lock(&vmlist_lock);
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
+		if (tmp->flags & VM_LAZYFREE)
+			continue;
 		vaddr = (char *) tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE)
 			continue;
@@ -282,3 +468,89 @@ finished:
 	read_unlock(&vmlist_lock);
 	return buf - buf_start;
 }
+
+/*
+ * /proc/vmallocinfo: a summary line, then one line per area.  f_pos
+ * counts lines.
+ */
+static ssize_t vmallocinfo_read(struct file *file, char *buf, size_t count,
+				loff_t *ppos)
+{
+	char line[96];
+	struct vm_struct *area = NULL;
+	unsigned long used, lazy, free, hole, largest, holes;
+	unsigned int pos = *ppos, i;
+	size_t done = 0;
+	int len;
+
+	read_lock(&vmlist_lock);
+	for (;;) {
+		if (pos == 0) {
+			used = lazy = largest = holes = 0;
+			hole = vmlist ? (unsigned long) vmlist->addr - VMALLOC_START
+				      : VMALLOC_END - VMALLOC_START;
+			free = hole;
+			if (hole) {
+				holes++;
+				largest = hole;
+			}
+			for (area = vmlist; area; area = area->next) {
+				if (area->flags & VM_LAZYFREE)
+					lazy += area->size;
+				else
+					used += area->size;
+				hole = vm_area_gap(area);
+				if (!hole)
+					continue;
+				holes++;
+				free += hole;
+				if (hole > largest)
+					largest = hole;
+			}
+			len = sprintf(line, "# used %lukB lazy %lukB free %lukB "
+				      "in %lu holes, largest %lukB\n",
+				      used >> 10, lazy >> 10, free >> 10,
+				      holes, largest >> 10);
+		} else {
+			for (i = 1, area = vmlist; area && i < pos; i++)
+				area = area->next;
+			if (!area)
+				break;
+			len = sprintf(line, "0x%08lx-0x%08lx %8lu %s\n",
+				      (unsigned long) area->addr,
+				      vm_area_end(area), area->size,
+				      area->flags & VM_LAZYFREE ? "lazy" :
+				      area->flags & VM_IOREMAP ? "ioremap" :
+				      "vmalloc");
+		}
+		if (done + len > count)
+			break;
+		read_unlock(&vmlist_lock);
+		if (copy_to_user(buf + done, line, len))
+			return done ? done : -EFAULT;
+		done += len;
+		pos++;
+		read_lock(&vmlist_lock);
+	}
+	read_unlock(&vmlist_lock);
+	if (!done && (pos == 0 || area))
+		return -EINVAL;		/* not even room for a line */
+	*ppos = pos;
+	return done;
+}
+
+static struct file_operations vmallocinfo_fops = {
+	read:		vmallocinfo_read,
+};
+
+static int __init vmallocinfo_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("vmallocinfo", S_IRUSR, NULL);
+	if (entry)
+		entry->proc_fops = &vmallocinfo_fops;
+	return 0;
+}
+
+__initcall(vmallocinfo_init);
@@ -21,8 +21,10 @@
 #include <linux/init.h>
 #include <linux/highmem.h>
 #include <linux/file.h>
+#include <linux/low-latency.h>
 
 #include <asm/pgalloc.h>
+#include <asm/tlb.h>
 
 /*
  * The swap-out functions return 1 if they successfully
@@ -35,7 +37,7 @@
  * using a process that no longer actually exists (it might
  * have died while we slept).
  */
-static int try_to_swap_out(struct mm_struct * mm, struct vm_area_struct* vma, unsigned long address, pte_t * page_table, int gfp_mask)
+static int try_to_swap_out(mmu_gather_t * tlb, struct mm_struct * mm, struct vm_area_struct* vma, unsigned long address, pte_t * page_table, int gfp_mask)
 {
 	pte_t pte;
 	swp_entry_t entry;
@@ -52,6 +54,14 @@ static int try_to_swap_out(struct mm_struct * mm, struct vm_area_struct* vma, un
 	if (mm->swap_cnt)
 		mm->swap_cnt--;
 
+	/*
+	 * Pages in the page or swap cache are unmapped through their
+	 * pte chains when page_launder() gets to them, we only need
+	 * to look at anonymous memory here.
+	 */
+	if (page->mapping && page->pte_chain)
+		goto out_failed;
+
 	onlist = PageActive(page);
 	/* Don't look at this pte if it's been accessed recently. */
 	if (ptep_test_and_clear_young(page_table)) {
@@ -96,11 +106,13 @@ set_swap_pte:
 		swap_duplicate(entry);
 		set_pte(page_table, swp_entry_to_pte(entry));
 drop_pte:
+		page_remove_rmap(page, mm, address);
 		UnlockPage(page);
 		mm->rss--;
-		flush_tlb_page(vma, address);
+		/* swap_out_mm() flushes the TLBs and drops our reference */
+		tlb_remove_tlb_entry(tlb, address);
 		deactivate_page(page);
-		page_cache_release(page);
+		tlb_remove_page(tlb, page);
 out_failed:
 		return 0;
 	}
@@ -143,8 +155,14 @@ out_failed:
 	if (!entry.val)
 		goto out_unlock_restore; /* No swap space left */
 
-	/* Add it to the swap cache and mark it dirty */
-	add_to_swap_cache(page, entry);
+	/*
+	 * Add it to the swap cache and mark it dirty. We hold the
+	 * page_table_lock, so the index may only allocate atomically.
+	 */
+	if (add_to_swap_cache(page, entry, GFP_ATOMIC)) {
+		swap_free(entry);
+		goto out_unlock_restore;
+	}
 	set_page_dirty(page);
 	goto set_swap_pte;
 
@@ -168,7 +186,7 @@ out_unlock_restore:
  * (C) 1993 Kai Petzke, wpp@marie.physik.tu-berlin.de
  */
 
-static inline int swap_out_pmd(struct mm_struct * mm, struct vm_area_struct * vma, pmd_t *dir, unsigned long address, unsigned long end, int gfp_mask)
+static inline int swap_out_pmd(mmu_gather_t * tlb, struct mm_struct * mm, struct vm_area_struct * vma, pmd_t *dir, unsigned long address, unsigned long end, int gfp_mask)
 {
 	pte_t * pte;
 	unsigned long pmd_end;
@@ -190,7 +208,7 @@ static inline int swap_out_pmd(struct mm_struct * mm, struct vm_area_struct * vm
 	do {
 		int result;
 		mm->swap_address = address + PAGE_SIZE;
-		result = try_to_swap_out(mm, vma, address, pte, gfp_mask);
+		result = try_to_swap_out(tlb, mm, vma, address, pte, gfp_mask);
 		if (result)
 			return result;
 		if (!mm->swap_cnt)
@@ -201,7 +219,7 @@ static inline int swap_out_pmd(struct mm_struct * mm, struct vm_area_struct * vm
 	return 0;
 }
 
-static inline int swap_out_pgd(struct mm_struct * mm, struct vm_area_struct * vma, pgd_t *dir, unsigned long address, unsigned long end, int gfp_mask)
+static inline int swap_out_pgd(mmu_gather_t * tlb, struct mm_struct * mm, struct vm_area_struct * vma, pgd_t *dir, unsigned long address, unsigned long end, int gfp_mask)
 {
 	pmd_t * pmd;
 	unsigned long pgd_end;
@@ -221,7 +239,7 @@ static inline int swap_out_pgd(struct mm_struct * mm, struct vm_area_struct * vm
 		end = pgd_end;
 	
 	do {
-		int result = swap_out_pmd(mm, vma, pmd, address, end, gfp_mask);
+		int result = swap_out_pmd(tlb, mm, vma, pmd, address, end, gfp_mask);
 		if (result)
 			return result;
 		if (!mm->swap_cnt)
@@ -232,7 +250,7 @@ static inline int swap_out_pgd(struct mm_struct * mm, struct vm_area_struct * vm
 	return 0;
 }
 
-static int swap_out_vma(struct mm_struct * mm, struct vm_area_struct * vma, unsigned long address, int gfp_mask)
+static int swap_out_vma(mmu_gather_t * tlb, struct mm_struct * mm, struct vm_area_struct * vma, unsigned long address, int gfp_mask)
 {
 	pgd_t *pgdir;
 	unsigned long end;
@@ -247,7 +265,7 @@ static int swap_out_vma(struct mm_struct * mm, struct vm_area_struct * vma, unsi
 	if (address >= end)
 		BUG();
 	do {
-		int result = swap_out_pgd(mm, vma, pgdir, address, end, gfp_mask);
+		int result = swap_out_pgd(tlb, mm, vma, pgdir, address, end, gfp_mask);
 		if (result)
 			return result;
 		if (!mm->swap_cnt)
@@ -260,8 +278,10 @@ static int swap_out_vma(struct mm_struct * mm, struct vm_area_struct * vma, unsi
 
 static int swap_out_mm(struct mm_struct * mm, int gfp_mask)
 {
+	mmu_gather_t *tlb;
 	unsigned long address;
 	struct vm_area_struct* vma;
+	int result = 0;
 
 	/*
 	 * Go through process' page directory.
@@ -273,15 +293,20 @@ static int swap_out_mm(struct mm_struct * mm, int gfp_mask)
 	 * and ptes.
 	 */
 	spin_lock(&mm->page_table_lock);
+	/*
+	 * The ptes we clear are all over the address space, so the
+	 * TLBs get one flush of the whole mm at the end of the scan.
+	 */
+	tlb = tlb_gather_mmu(mm, 0, TASK_SIZE);
 	vma = find_vma(mm, address);
 	if (vma) {
 		if (address < vma->vm_start)
 			address = vma->vm_start;
 
 		for (;;) {
-			int result = swap_out_vma(mm, vma, address, gfp_mask);
+			result = swap_out_vma(tlb, mm, vma, address, gfp_mask);
 			if (result)
-				return result;
+				goto out_unlock;
 			if (!mm->swap_cnt)
 				goto out_unlock;
 			vma = vma->vm_next;
@@ -295,10 +320,10 @@ static int swap_out_mm(struct mm_struct * mm, int gfp_mask)
 	mm->swap_cnt = 0;
 
 out_unlock:
+	tlb_finish_mmu(tlb);
 	spin_unlock(&mm->page_table_lock);
 
-	/* We didn't find anything for the process */
-	return 0;
+	return result;
 }
 
 /*
@@ -400,21 +425,22 @@ out:
  */
 struct page * reclaim_page(zone_t * zone)
 {
+	struct address_space * mapping;
 	struct page * page = NULL;
 	struct list_head * page_lru;
 	int maxscan;
 
 	/*
-	 * We only need the pagemap_lru_lock if we don't reclaim the page,
-	 * but we have to grab the pagecache_lock before the pagemap_lru_lock
-	 * to avoid deadlocks and most of the time we'll succeed anyway.
+	 * The page_lock of a mapping nests outside the pagemap_lru_lock,
+	 * so we can only try for it once we have found a page. If that
+	 * fails the page is busy anyway, and we look at the next one.
 	 */
-	spin_lock(&pagecache_lock);
 	spin_lock(&pagemap_lru_lock);
 	maxscan = zone->inactive_clean_pages;
 	while ((page_lru = zone->inactive_clean_list.prev) !=
 			&zone->inactive_clean_list && maxscan--) {
 		page = list_entry(page_lru, struct page, lru);
+		zone->pgscan++;
 
 		/* Wrong page on list?! (list corruption, should not happen) */
 		if (!PageInactiveClean(page)) {
@@ -440,13 +466,19 @@ struct page * reclaim_page(zone_t * zone)
 		}
 
 		/* OK, remove the page from the caches. */
-                if (PageSwapCache(page)) {
-			__delete_from_swap_cache(page);
-			goto found_page;
-		}
-
-		if (page->mapping) {
-			__remove_inode_page(page);
+		mapping = page->mapping;
+		if (mapping) {
+			if (!spin_trylock(&mapping->page_lock)) {
+				UnlockPage(page);
+				list_del(page_lru);
+				list_add(page_lru, &zone->inactive_clean_list);
+				continue;
+			}
+			if (PageSwapCache(page))
+				__delete_from_swap_cache(page);
+			else
+				__remove_inode_page(page);
+			spin_unlock(&mapping->page_lock);
 			goto found_page;
 		}
 
@@ -463,13 +495,13 @@ struct page * reclaim_page(zone_t * zone)
 found_page:
 	del_page_from_inactive_clean_list(page);
 	UnlockPage(page);
+	zone->pgsteal++;
 	page->age = PAGE_AGE_START;
 	if (page_count(page) != 1)
 		printk("VM: reclaim_page, found page with count %d!\n",
 				page_count(page));
 out:
 	spin_unlock(&pagemap_lru_lock);
-	spin_unlock(&pagecache_lock);
 	memory_pressure++;
 	return page;
 }
@@ -516,7 +548,18 @@ dirty_page_rescan:
 	maxscan = nr_inactive_dirty_pages;
 	while ((page_lru = inactive_dirty_list.prev) != &inactive_dirty_list &&
 				maxscan-- > 0) {
+		/*
+		 * We always restart from the tail of the list, so the
+		 * lock can be dropped here if we are allowed to sleep.
+		 */
+		if ((gfp_mask & __GFP_WAIT) && conditional_schedule_needed()) {
+			spin_unlock(&pagemap_lru_lock);
+			unconditional_schedule();
+			spin_lock(&pagemap_lru_lock);
+			continue;
+		}
 		page = list_entry(page_lru, struct page, lru);
+		page->zone->pgscan++;
 
 		/* Wrong page on list?! (list corruption, should not happen) */
 		if (!PageInactiveDirty(page)) {
@@ -527,9 +570,15 @@ dirty_page_rescan:
 			continue;
 		}
 
-		/* Page is or was in use?  Move it to the active list. */
+		/*
+		 * Page is or was in use?  Move it to the active list.
+		 * The references from the page tables don't count, we
+		 * can get rid of those.
+		 */
 		if (PageTestandClearReferenced(page) || page->age > 0 ||
-				(!page->buffers && page_count(page) > 1) ||
+				page_referenced(page) ||
+				(!page->buffers && page_count(page) >
+					1 + page_mapcount(page)) ||
 				page_ramdisk(page)) {
 			del_page_from_inactive_dirty_list(page);
 			add_page_to_active_list(page);
@@ -546,6 +595,32 @@ dirty_page_rescan:
 			continue;
 		}
 
+		/*
+		 * Still mapped? Take it out of the page tables first,
+		 * after that it is cleaned and freed like any other
+		 * cache page. We have to drop the lru lock for this,
+		 * see mm/rmap.c.
+		 */
+		if (page->pte_chain) {
+			int unmapped;
+
+			del_page_from_inactive_dirty_list(page);
+			page_cache_get(page);
+			spin_unlock(&pagemap_lru_lock);
+
+			unmapped = try_to_unmap(page);
+
+			spin_lock(&pagemap_lru_lock);
+			if (unmapped == SWAP_FAIL) {
+				add_page_to_active_list(page);
+			} else {
+				add_page_to_inactive_dirty_list(page);
+			}
+			UnlockPage(page);
+			page_cache_release(page);
+			continue;
+		}
+
 		/*
 		 * Dirty swap-cache page? Write it out if
 		 * last copy..
@@ -569,6 +644,7 @@ dirty_page_rescan:
 			ClearPageDirty(page);
 			page_cache_get(page);
 			spin_unlock(&pagemap_lru_lock);
+			page->zone->pgwrite++;
 
 			result = writepage(page);
 			page_cache_release(page);
@@ -612,6 +688,8 @@ dirty_page_rescan:
 				wait = 0;	/* No IO */
 
 			/* Try to free the page buffers. */
+			if (wait)
+				page->zone->pgwrite++;
 			clearedbuf = try_to_free_buffers(page, wait);
 
 			/*
@@ -630,6 +708,7 @@ dirty_page_rescan:
 				atomic_dec(&buffermem_pages);
 				freed_page = 1;
 				cleaned_pages++;
+				page->zone->pgsteal++;
 
 			/* The page has more users besides the cache and us. */
 			} else if (page_count(page) > 2) {
@@ -728,6 +807,7 @@ int refill_inactive_scan(unsigned int priority, int oneshot)
 	maxscan = nr_active_pages >> priority;
 	while (maxscan-- > 0 && (page_lru = active_list.prev) != &active_list) {
 		page = list_entry(page_lru, struct page, lru);
+		page->zone->pgscan++;
 
 		/* Wrong page on list?! (list corruption, should not happen) */
 		if (!PageActive(page)) {
@@ -738,7 +818,7 @@ int refill_inactive_scan(unsigned int priority, int oneshot)
 		}
 
 		/* Do aging on the pages. */
-		if (PageTestandClearReferenced(page)) {
+		if (PageTestandClearReferenced(page) || page_referenced(page)) {
 			age_page_up_nolock(page);
 			page_active = 1;
 		} else {
@@ -752,9 +832,12 @@ int refill_inactive_scan(unsigned int priority, int oneshot)
 			 * inactive_dirty list and back again...
 			 *
 			 * SUBTLE: we can have buffer pages with count 1.
+			 * The page tables' references are dropped later,
+			 * by page_launder().
 			 */
 			if (page->age == 0 && page_count(page) <=
-						(page->buffers ? 2 : 1)) {
+						(page->buffers ? 2 : 1) +
+						page_mapcount(page)) {
 				deactivate_page_nolock(page);
 				page_active = 0;
 			} else {
@@ -1117,63 +1200,96 @@ int try_to_free_pages(unsigned int gfp_mask)
 	return ret;
 }
 
-DECLARE_WAIT_QUEUE_HEAD(kreclaimd_wait);
 /*
  * Kreclaimd will move pages from the inactive_clean list to the
  * free list, in order to keep atomic allocations possible under
  * all circumstances. Even when kswapd is blocked on IO.
+ *
+ * There is one per node, woken for the zones of that node only, so
+ * a node short of free pages doesn't hold up reclaim on the others.
  */
-int kreclaimd(void *unused)
+int kreclaimd(void *data)
 {
 	struct task_struct *tsk = current;
-	pg_data_t *pgdat;
+	pg_data_t *pgdat = data;
 
 	tsk->session = 1;
 	tsk->pgrp = 1;
-	strcpy(tsk->comm, "kreclaimd");
+	sprintf(tsk->comm, "kreclaimd/%d", pgdat->node_id);
 	sigfillset(&tsk->blocked);
 	current->flags |= PF_MEMALLOC;
 
 	while (1) {
+		int i;
 
 		/*
 		 * We sleep until someone wakes us up from
 		 * page_alloc.c::__alloc_pages().
 		 */
-		interruptible_sleep_on(&kreclaimd_wait);
+		interruptible_sleep_on(&pgdat->kreclaimd_wait);
 
 		/*
 		 * Move some pages from the inactive_clean lists to
 		 * the free lists, if it is needed.
 		 */
-		pgdat = pgdat_list;
-		do {
-			int i;
-			for(i = 0; i < MAX_NR_ZONES; i++) {
-				zone_t *zone = pgdat->node_zones + i;
-				if (!zone->size)
-					continue;
-
-				while (zone->free_pages < zone->pages_low) {
-					struct page * page;
-					page = reclaim_page(zone);
-					if (!page)
-						break;
-					__free_page(page);
-				}
+		for(i = 0; i < MAX_NR_ZONES; i++) {
+			zone_t *zone = pgdat->node_zones + i;
+			if (!zone->size)
+				continue;
+
+			while (zone->free_pages < zone->pages_low) {
+				struct page * page;
+				page = reclaim_page(zone);
+				if (!page)
+					break;
+				free_cold_page(page);
 			}
-			pgdat = pgdat->node_next;
-		} while (pgdat);
+		}
 	}
 }
 
+/*
+ * Reclaim statistics per zone, for /proc/vmstat.
+ */
+int get_vmstat_info(char *page)
+{
+	pg_data_t *pgdat;
+	int i, len = 0;
+
+	len += sprintf(page + len, "active %d inactive_dirty %d "
+		       "inactive_target %lu memory_pressure %d\n",
+		       nr_active_pages, nr_inactive_dirty_pages,
+		       inactive_target, memory_pressure);
+	for (pgdat = pgdat_list; pgdat; pgdat = pgdat->node_next) {
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			zone_t *zone = pgdat->node_zones + i;
+
+			if (!zone->size)
+				continue;
+			if (len > PAGE_SIZE - 160)
+				return len;
+			len += sprintf(page + len, "node%-3d %-8s "
+				"free %lu clean %lu dirty %lu scan %lu "
+				"steal %lu write %lu stall %lu\n",
+				pgdat->node_id, zone->name, zone->free_pages,
+				zone->inactive_clean_pages,
+				zone->inactive_dirty_pages, zone->pgscan,
+				zone->pgsteal, zone->pgwrite, zone->allocstall);
+		}
+	}
+	return len;
+}
 
 static int __init kswapd_init(void)
 {
+	pg_data_t *pgdat;
+
 	printk("Starting kswapd v1.8\n");
 	swap_setup();
 	kernel_thread(kswapd, NULL, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
-	kernel_thread(kreclaimd, NULL, CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
+	for (pgdat = pgdat_list; pgdat; pgdat = pgdat->node_next)
+		kernel_thread(kreclaimd, pgdat,
+			      CLONE_FS | CLONE_FILES | CLONE_SIGNAL);
 	return 0;
 }
 
@@ -405,7 +405,7 @@ static int atm_arp_info(loff_t pos,char *buf)
 	}
 	count = pos;
 	read_lock_bh(&clip_tbl.lock);
-	for (i = 0; i <= NEIGH_HASHMASK; i++)
+	for (i = 0; i <= clip_tbl.hash_mask; i++)
 		for (n = clip_tbl.hash_buckets[i]; n; n = n->next) {
 			struct atmarp_entry *entry = NEIGH2ENTRY(n);
 			struct clip_vcc *vcc;
@@ -28,6 +28,9 @@
 #include "../atm/lec.h"
 #endif
 
+int fdb_hash_bits = BR_HASH_BITS;
+MODULE_PARM(fdb_hash_bits, "i");
+
 void br_dec_use_count()
 {
 	MOD_DEC_USE_COUNT;
@@ -42,6 +45,11 @@ static int __init br_init(void)
 {
 	printk(KERN_INFO "NET4: Ethernet Bridge 008 for NET4.0\n");
 
+	if (fdb_hash_bits < BR_HASH_BITS_MIN)
+		fdb_hash_bits = BR_HASH_BITS_MIN;
+	if (fdb_hash_bits > BR_HASH_BITS_MAX)
+		fdb_hash_bits = BR_HASH_BITS_MAX;
+
 	br_handle_frame_hook = br_handle_frame;
 #ifdef CONFIG_INET
 	br_ioctl_hook = br_ioctl_deviceless_stub;
@@ -15,6 +15,10 @@
 
 #include <linux/kernel.h>
 #include <linux/spinlock.h>
+#include <linux/brlock.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
 #include <linux/if_bridge.h>
 #include <asm/atomic.h>
 #include <asm/uaccess.h>
@@ -52,20 +56,64 @@ static __inline__ void copy_fdb(struct __fdb_entry *ent, struct net_bridge_fdb_e
 		ent->ageing_timer_value = jiffies - f->ageing_timer;
 }
 
-static __inline__ int br_mac_hash(unsigned char *mac)
+static __inline__ int br_mac_hash(struct net_bridge *br, unsigned char *mac)
 {
-	unsigned long x;
+	u32 a, b;
 
-	x = mac[0];
-	x = (x << 2) ^ mac[1];
-	x = (x << 2) ^ mac[2];
-	x = (x << 2) ^ mac[3];
-	x = (x << 2) ^ mac[4];
-	x = (x << 2) ^ mac[5];
+	a = (mac[0] << 8) | mac[1];
+	b = (mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5];
 
-	x ^= x >> 8;
+	return jhash_2words(a, b, br->hash_rnd) & ((1 << br->hash_bits) - 1);
+}
+
+/*
+ * The hash table is sized per bridge, 2^hash_bits buckets, set from
+ * fdb_hash_bits at creation and changeable with BRCTL_SET_FDB_HASH_BITS.
+ * Forwarding only reads the table, under the big reader lock
+ * BR_FDB_LOCK, so lookups on different CPUs do not share a lock line.
+ */
+
+static struct net_bridge_fdb_entry **br_fdb_alloc_hash(int bits)
+{
+	unsigned long size = sizeof(struct net_bridge_fdb_entry *) << bits;
+	struct net_bridge_fdb_entry **hash;
+
+	if (size <= PAGE_SIZE)
+		hash = kmalloc(size, GFP_KERNEL);
+	else
+		hash = vmalloc(size);
+	if (hash != NULL)
+		memset(hash, 0, size);
+	return hash;
+}
+
+static void br_fdb_free_hash(struct net_bridge_fdb_entry **hash, int bits)
+{
+	if ((sizeof(struct net_bridge_fdb_entry *) << bits) <= PAGE_SIZE)
+		kfree(hash);
+	else
+		vfree(hash);
+}
 
-	return x & (BR_HASH_SIZE - 1);
+int br_fdb_init(struct net_bridge *br, int bits)
+{
+	if (bits < BR_HASH_BITS_MIN)
+		bits = BR_HASH_BITS_MIN;
+	if (bits > BR_HASH_BITS_MAX)
+		bits = BR_HASH_BITS_MAX;
+
+	br->hash = br_fdb_alloc_hash(bits);
+	if (br->hash == NULL)
+		return -ENOMEM;
+	br->hash_bits = bits;
+	get_random_bytes(&br->hash_rnd, sizeof(br->hash_rnd));
+	return 0;
+}
+
+void br_fdb_fini(struct net_bridge *br)
+{
+	br_fdb_free_hash(br->hash, br->hash_bits);
+	br->hash = NULL;
 }
 
 static __inline__ void __hash_link(struct net_bridge *br,
@@ -88,6 +136,38 @@ static __inline__ void __hash_unlink(struct net_bridge_fdb_entry *ent)
 	ent->pprev_hash = NULL;
 }
 
+/* Called from process context, with the ioctl mutex held */
+int br_fdb_resize(struct net_bridge *br, int bits)
+{
+	struct net_bridge_fdb_entry **new_hash, **old_hash;
+	int i, old_bits;
+
+	if (bits < BR_HASH_BITS_MIN || bits > BR_HASH_BITS_MAX)
+		return -EINVAL;
+
+	new_hash = br_fdb_alloc_hash(bits);
+	if (new_hash == NULL)
+		return -ENOMEM;
+
+	br_write_lock_bh(BR_FDB_LOCK);
+	old_hash = br->hash;
+	old_bits = br->hash_bits;
+	br->hash = new_hash;
+	br->hash_bits = bits;
+	for (i=0;i<(1 << old_bits);i++) {
+		struct net_bridge_fdb_entry *f;
+
+		while ((f = old_hash[i]) != NULL) {
+			__hash_unlink(f);
+			__hash_link(br, f, br_mac_hash(br, f->addr.addr));
+		}
+	}
+	br_write_unlock_bh(BR_FDB_LOCK);
+
+	br_fdb_free_hash(old_hash, old_bits);
+	return 0;
+}
+
 
 
 void br_fdb_changeaddr(struct net_bridge_port *p, unsigned char *newaddr)
@@ -96,8 +176,8 @@ void br_fdb_changeaddr(struct net_bridge_port *p, unsigned char *newaddr)
 	int i;
 
 	br = p->br;
-	write_lock_bh(&br->hash_lock);
-	for (i=0;i<BR_HASH_SIZE;i++) {
+	br_write_lock_bh(BR_FDB_LOCK);
+	for (i=0;i<(1 << br->hash_bits);i++) {
 		struct net_bridge_fdb_entry *f;
 
 		f = br->hash[i];
@@ -105,16 +185,21 @@ void br_fdb_changeaddr(struct net_bridge_port *p, unsigned char *newaddr)
 			if (f->dst == p && f->is_local) {
 				__hash_unlink(f);
 				memcpy(f->addr.addr, newaddr, ETH_ALEN);
-				__hash_link(br, f, br_mac_hash(newaddr));
-				write_unlock_bh(&br->hash_lock);
+				__hash_link(br, f, br_mac_hash(br, newaddr));
+				br_write_unlock_bh(BR_FDB_LOCK);
 				return;
 			}
 			f = f->next_hash;
 		}
 	}
-	write_unlock_bh(&br->hash_lock);
+	br_write_unlock_bh(BR_FDB_LOCK);
 }
 
+/*
+ * Each chain is first checked under the read lock; the write lock, which
+ * stalls forwarding on all CPUs, is only taken for chains that actually
+ * hold expired entries.
+ */
 void br_fdb_cleanup(struct net_bridge *br)
 {
 	int i;
@@ -122,32 +207,52 @@ void br_fdb_cleanup(struct net_bridge *br)
 
 	timeout = __timeout(br);
 
-	write_lock_bh(&br->hash_lock);
-	for (i=0;i<BR_HASH_SIZE;i++) {
+	for (i=0;;i++) {
 		struct net_bridge_fdb_entry *f;
+		int expired = 0;
 
-		f = br->hash[i];
-		while (f != NULL) {
-			struct net_bridge_fdb_entry *g;
-
-			g = f->next_hash;
+		br_read_lock_bh(BR_FDB_LOCK);
+		if (i >= (1 << br->hash_bits)) {
+			br_read_unlock_bh(BR_FDB_LOCK);
+			break;
+		}
+		for (f = br->hash[i]; f != NULL; f = f->next_hash) {
 			if (!f->is_static &&
 			    time_before_eq(f->ageing_timer, timeout)) {
-				__hash_unlink(f);
-				br_fdb_put(f);
+				expired = 1;
+				break;
+			}
+		}
+		br_read_unlock_bh(BR_FDB_LOCK);
+
+		if (!expired)
+			continue;
+
+		br_write_lock_bh(BR_FDB_LOCK);
+		if (i < (1 << br->hash_bits)) {
+			f = br->hash[i];
+			while (f != NULL) {
+				struct net_bridge_fdb_entry *g;
+
+				g = f->next_hash;
+				if (!f->is_static &&
+				    time_before_eq(f->ageing_timer, timeout)) {
+					__hash_unlink(f);
+					br_fdb_put(f);
+				}
+				f = g;
 			}
-			f = g;
 		}
+		br_write_unlock_bh(BR_FDB_LOCK);
 	}
-	write_unlock_bh(&br->hash_lock);
 }
 
 void br_fdb_delete_by_port(struct net_bridge *br, struct net_bridge_port *p)
 {
 	int i;
 
-	write_lock_bh(&br->hash_lock);
-	for (i=0;i<BR_HASH_SIZE;i++) {
+	br_write_lock_bh(BR_FDB_LOCK);
+	for (i=0;i<(1 << br->hash_bits);i++) {
 		struct net_bridge_fdb_entry *f;
 
 		f = br->hash[i];
@@ -162,31 +267,31 @@ void br_fdb_delete_by_port(struct net_bridge *br, struct net_bridge_port *p)
 			f = g;
 		}
 	}
-	write_unlock_bh(&br->hash_lock);
+	br_write_unlock_bh(BR_FDB_LOCK);
 }
 
 struct net_bridge_fdb_entry *br_fdb_get(struct net_bridge *br, unsigned char *addr)
 {
 	struct net_bridge_fdb_entry *fdb;
 
-	read_lock_bh(&br->hash_lock);
-	fdb = br->hash[br_mac_hash(addr)];
+	br_read_lock_bh(BR_FDB_LOCK);
+	fdb = br->hash[br_mac_hash(br, addr)];
 	while (fdb != NULL) {
 		if (!memcmp(fdb->addr.addr, addr, ETH_ALEN)) {
 			if (!has_expired(br, fdb)) {
 				atomic_inc(&fdb->use_count);
-				read_unlock_bh(&br->hash_lock);
+				br_read_unlock_bh(BR_FDB_LOCK);
 				return fdb;
 			}
 
-			read_unlock_bh(&br->hash_lock);
+			br_read_unlock_bh(BR_FDB_LOCK);
 			return NULL;
 		}
 
 		fdb = fdb->next_hash;
 	}
 
-	read_unlock_bh(&br->hash_lock);
+	br_read_unlock_bh(BR_FDB_LOCK);
 	return NULL;
 }
 
@@ -208,8 +313,8 @@ int br_fdb_get_entries(struct net_bridge *br,
 	num = 0;
 	walk = (struct __fdb_entry *)_buf;
 
-	read_lock_bh(&br->hash_lock);
-	for (i=0;i<BR_HASH_SIZE;i++) {
+	br_read_lock_bh(BR_FDB_LOCK);
+	for (i=0;i<(1 << br->hash_bits);i++) {
 		struct net_bridge_fdb_entry *f;
 
 		f = br->hash[i];
@@ -233,9 +338,9 @@ int br_fdb_get_entries(struct net_bridge *br,
 			copy_fdb(&ent, f);
 
 			atomic_inc(&f->use_count);
-			read_unlock_bh(&br->hash_lock);
+			br_read_unlock_bh(BR_FDB_LOCK);
 			err = copy_to_user(walk, &ent, sizeof(struct __fdb_entry));
-			read_lock_bh(&br->hash_lock);
+			br_read_lock_bh(BR_FDB_LOCK);
 
 			g = f->next_hash;
 			pp = f->pprev_hash;
@@ -255,7 +360,7 @@ int br_fdb_get_entries(struct net_bridge *br,
 	}
 
  out:
-	read_unlock_bh(&br->hash_lock);
+	br_read_unlock_bh(BR_FDB_LOCK);
 	return num;
 
  out_disappeared:
@@ -287,14 +392,38 @@ void br_fdb_insert(struct net_bridge *br,
 	struct net_bridge_fdb_entry *fdb;
 	int hash;
 
-	hash = br_mac_hash(addr);
+	/* Fast path: the address is known on this port already. Only
+	 * refresh its ageing timer, and not more often than once per
+	 * BR_FDB_AGE_GRANULE.
+	 */
+	br_read_lock_bh(BR_FDB_LOCK);
+	fdb = br->hash[br_mac_hash(br, addr)];
+	while (fdb != NULL) {
+		if (!memcmp(fdb->addr.addr, addr, ETH_ALEN)) {
+			if (is_local)
+				break;
+			if (fdb->is_static) {
+				br_read_unlock_bh(BR_FDB_LOCK);
+				return;
+			}
+			if (fdb->dst != source)
+				break;
+			if (time_after(jiffies, fdb->ageing_timer + BR_FDB_AGE_GRANULE))
+				fdb->ageing_timer = jiffies;
+			br_read_unlock_bh(BR_FDB_LOCK);
+			return;
+		}
+		fdb = fdb->next_hash;
+	}
+	br_read_unlock_bh(BR_FDB_LOCK);
 
-	write_lock_bh(&br->hash_lock);
+	br_write_lock_bh(BR_FDB_LOCK);
+	hash = br_mac_hash(br, addr);
 	fdb = br->hash[hash];
 	while (fdb != NULL) {
 		if (!memcmp(fdb->addr.addr, addr, ETH_ALEN)) {
 			__fdb_possibly_replace(fdb, source, is_local);
-			write_unlock_bh(&br->hash_lock);
+			br_write_unlock_bh(BR_FDB_LOCK);
 			return;
 		}
 
@@ -303,7 +432,7 @@ void br_fdb_insert(struct net_bridge *br,
 
 	fdb = kmalloc(sizeof(*fdb), GFP_ATOMIC);
 	if (fdb == NULL) {
-		write_unlock_bh(&br->hash_lock);
+		br_write_unlock_bh(BR_FDB_LOCK);
 		return;
 	}
 
@@ -316,5 +445,5 @@ void br_fdb_insert(struct net_bridge *br,
 
 	__hash_link(br, fdb, hash);
 
-	write_unlock_bh(&br->hash_lock);
+	br_write_unlock_bh(BR_FDB_LOCK);
 }
@@ -32,6 +32,8 @@ static inline int should_forward(struct net_bridge_port *p, struct sk_buff *skb)
 static void __br_forward(struct net_bridge_port *to, struct sk_buff *skb)
 {
 	skb->dev = to->dev;
+	/* A receive checksum is no checksum to offload */
+	skb->ip_summed = CHECKSUM_NONE;
 	dev_queue_xmit(skb);
 }
 
@@ -101,6 +101,10 @@ static struct net_bridge *new_nb(char *name)
 		return NULL;
 
 	memset(br, 0, sizeof(*br));
+	if (br_fdb_init(br, fdb_hash_bits)) {
+		kfree(br);
+		return NULL;
+	}
 	dev = &br->dev;
 
 	strncpy(dev->name, name, IFNAMSIZ);
@@ -109,7 +113,6 @@ static struct net_bridge *new_nb(char *name)
 	br_dev_setup(dev);
 
 	br->lock = RW_LOCK_UNLOCKED;
-	br->hash_lock = RW_LOCK_UNLOCKED;
 
 	br->bridge_id.prio[0] = 0x80;
 	br->bridge_id.prio[1] = 0x00;
@@ -179,6 +182,7 @@ int br_add_bridge(char *name)
 		return -ENOMEM;
 
 	if (__dev_get_by_name(name) != NULL) {
+		br_fdb_fini(br);
 		kfree(br);
 		return -EEXIST;
 	}
@@ -210,6 +214,7 @@ int br_del_bridge(char *name)
 	*b = br->next;
 
 	unregister_netdev(&br->dev);
+	br_fdb_fini(br);
 	kfree(br);
 	br_dec_use_count();
 
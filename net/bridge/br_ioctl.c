@@ -179,6 +179,9 @@ static int br_ioctl_device(struct net_bridge *br,
 
 	case BRCTL_GET_FDB_ENTRIES:
 		return br_fdb_get_entries(br, (void *)arg0, arg1, arg2);
+
+	case BRCTL_SET_FDB_HASH_BITS:
+		return br_fdb_resize(br, arg0);
 	}
 
 	return -EOPNOTSUPP;
@@ -20,8 +20,14 @@
 #include <linux/if_bridge.h>
 #include "br_private_timer.h"
 
-#define BR_HASH_BITS 8
-#define BR_HASH_SIZE (1 << BR_HASH_BITS)
+#define BR_HASH_BITS 8		/* default, see fdb_hash_bits in br.c */
+#define BR_HASH_BITS_MIN 4
+#define BR_HASH_BITS_MAX 16
+
+/* Learning only refreshes the ageing timer of a known address this
+ * often, so that forwarding does not write to the fdb for every frame.
+ */
+#define BR_FDB_AGE_GRANULE (1*HZ)
 
 #define BR_HOLD_TIME (1*HZ)
 
@@ -84,8 +90,10 @@ struct net_bridge
 	struct net_bridge_port		*port_list;
 	struct net_device		dev;
 	struct net_device_stats		statistics;
-	rwlock_t			hash_lock;
-	struct net_bridge_fdb_entry	*hash[BR_HASH_SIZE];
+	/* Lookups take BR_FDB_LOCK for reading, changes for writing */
+	struct net_bridge_fdb_entry	**hash;
+	int				hash_bits;
+	__u32				hash_rnd;
 	struct timer_list		tick;
 
 	/* STP */
@@ -116,6 +124,7 @@ struct notifier_block br_device_notifier;
 unsigned char bridge_ula[6];
 
 /* br.c */
+extern int fdb_hash_bits;
 void br_dec_use_count(void);
 void br_inc_use_count(void);
 
@@ -139,6 +148,9 @@ void br_fdb_insert(struct net_bridge *br,
 		   struct net_bridge_port *source,
 		   unsigned char *addr,
 		   int is_local);
+int  br_fdb_init(struct net_bridge *br, int bits);
+void br_fdb_fini(struct net_bridge *br);
+int  br_fdb_resize(struct net_bridge *br, int bits);
 
 /* br_forward.c */
 void br_forward(struct net_bridge_port *to,
@@ -88,7 +88,10 @@
 #include <linux/stat.h>
 #include <linux/if_bridge.h>
 #include <linux/divert.h>
+#include <linux/ip.h>
+#include <linux/in.h>
 #include <net/dst.h>
+#include <net/checksum.h>
 #include <net/pkt_sched.h>
 #include <net/profile.h>
 #include <linux/init.h>
@@ -154,6 +157,11 @@ static void sample_queue(unsigned long dummy);
 static struct timer_list samp_timer = { function: sample_queue };
 #endif
 
+#ifdef CONFIG_SMP
+static int netdev_rps_cpu(struct sk_buff *skb);
+static int netif_rx_steer(struct sk_buff *skb, int this_cpu, int cpu);
+#endif
+
 #ifdef CONFIG_HOTPLUG
 static int net_run_sbin_hotplug(struct net_device *dev, char *action);
 #else
@@ -772,6 +780,18 @@ int dev_close(struct net_device *dev)
 
 	clear_bit(__LINK_STATE_START, &dev->state);
 
+	/*
+	 *	Wait for a scheduled poll to finish.  It cannot be taken
+	 *	off the poll list from here, that may be another CPU's;
+	 *	once netif_running() is false it is not scheduled again.
+	 */
+	smp_mb__after_clear_bit();
+	while (test_bit(__LINK_STATE_RX_SCHED, &dev->state)) {
+		/* No hurry. */
+		current->state = TASK_INTERRUPTIBLE;
+		schedule_timeout(1);
+	}
+
 	/*
 	 *	Call the device specific close. This cannot fail.
 	 *	Only if device is UP
@@ -862,7 +882,13 @@ void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 			((struct sock *)ptype->data != skb->sk))
 		{
 			struct sk_buff *skb2;
-			if ((skb2 = skb_clone(skb, GFP_ATOMIC)) == NULL)
+
+			/* The taps do not know about page fragments */
+			if (skb_is_nonlinear(skb))
+				skb2 = skb_copy(skb, GFP_ATOMIC);
+			else
+				skb2 = skb_clone(skb, GFP_ATOMIC);
+			if (skb2 == NULL)
 				break;
 
 			/* skb->nh should be correctly
@@ -887,6 +913,36 @@ void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 	br_read_unlock(BR_NETPROTO_LOCK);
 }
 
+/**
+ *	skb_checksum_help - complete a checksum left to the hardware
+ *	@skb: buffer with ip_summed == CHECKSUM_HW
+ *
+ *	The transport protocol has put the pseudo header sum in the checksum
+ *	field and the offset of that field, from skb->h.raw, in skb->csum.
+ *	Sum the rest in software for a device which cannot.  The buffer must
+ *	be linear.
+ */
+
+void skb_checksum_help(struct sk_buff *skb)
+{
+	int offset;
+	unsigned int csum;
+
+	offset = skb->h.raw - skb->data;
+	if (offset > (int)skb->len)
+		BUG();
+	csum = skb_checksum(skb, offset, skb->len-offset, 0);
+
+	offset = skb->tail - skb->h.raw;
+	if (offset <= 0)
+		BUG();
+	if (skb->csum+2 > offset)
+		BUG();
+
+	*(u16*)(skb->h.raw + skb->csum) = csum_fold(csum);
+	skb->ip_summed = CHECKSUM_NONE;
+}
+
 /**
  *	dev_queue_xmit - transmit a buffer
  *	@skb: buffer to transmit
@@ -895,16 +951,65 @@ void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
  *	have set the device and priority and built the buffer before calling this 
  *	function. The function can be called from an interrupt.
  *
+ *	Page fragments, checksums and TCP segmentation left to the hardware
+ *	are resolved here for devices which do not advertise NETIF_F_SG,
+ *	NETIF_F_*_CSUM and NETIF_F_TSO.
+ *
  *	A negative errno code is returned on a failure. A success does not
  *	guarantee the frame will be transmitted as it may be dropped due
  *	to congestion or traffic shaping.
  */
  
+/* A large TCP frame for a device which cannot segment it: queue its
+ * segments one by one.
+ */
+static int dev_queue_xmit_tso(struct sk_buff *skb)
+{
+	struct sk_buff *segs = skb_tso_segment(skb, GFP_ATOMIC);
+	int ret = 0;
+
+	kfree_skb(skb);
+	if (segs == NULL)
+		return -ENOMEM;
+
+	while (segs != NULL) {
+		struct sk_buff *next = segs->next;
+		int err;
+
+		segs->next = NULL;
+		err = dev_queue_xmit(segs);
+		if (err && !ret)
+			ret = err;
+		segs = next;
+	}
+	return ret;
+}
+
 int dev_queue_xmit(struct sk_buff *skb)
 {
 	struct net_device *dev = skb->dev;
 	struct Qdisc  *q;
 
+	if (skb_shinfo(skb)->tso_size && !(dev->features&NETIF_F_TSO))
+		return dev_queue_xmit_tso(skb);
+
+	if (skb_is_nonlinear(skb) && !(dev->features&NETIF_F_SG) &&
+	    skb_linearize(skb, GFP_ATOMIC) != 0) {
+		kfree_skb(skb);
+		return -ENOMEM;
+	}
+
+	if (skb->ip_summed == CHECKSUM_HW &&
+	    (!(dev->features&(NETIF_F_HW_CSUM|NETIF_F_NO_CSUM)) &&
+	     (!(dev->features&NETIF_F_IP_CSUM) ||
+	      skb->protocol != htons(ETH_P_IP)))) {
+		if (skb_is_nonlinear(skb) && skb_linearize(skb, GFP_ATOMIC) != 0) {
+			kfree_skb(skb);
+			return -ENOMEM;
+		}
+		skb_checksum_help(skb);
+	}
+
 	/* Grab device queue */
 	spin_lock_bh(&dev->queue_lock);
 	q = dev->qdisc;
@@ -970,6 +1075,8 @@ int dev_queue_xmit(struct sk_buff *skb)
   =======================================================================*/
 
 int netdev_max_backlog = 300;
+/* Packets the backlog of a CPU may pass up per round of polling */
+static int weight_p = 64;
 /* These numbers are selected based on intuition and some
  * experimentatiom, if you have more scientific way of doing this
  * please go ahead and fix things.
@@ -1119,6 +1226,17 @@ int netif_rx(struct sk_buff *skb)
 	if (skb->stamp.tv_sec == 0)
 		get_fast_time(&skb->stamp);
 
+#ifdef CONFIG_SMP
+	if (netdev_rps) {
+		int cpu = netdev_rps_cpu(skb);
+
+		if (cpu >= 0 && cpu != this_cpu) {
+			netdev_rx_stat[this_cpu].total++;
+			return netif_rx_steer(skb, this_cpu, cpu);
+		}
+	}
+#endif
+
 	/* The code is rearranged so that the path is the most
 	   short when CPU is congested, but is still operating.
 	 */
@@ -1135,7 +1253,6 @@ int netif_rx(struct sk_buff *skb)
 enqueue:
 			dev_hold(skb->dev);
 			__skb_queue_tail(&queue->input_pkt_queue,skb);
-			__cpu_raise_softirq(this_cpu, NET_RX_SOFTIRQ);
 			local_irq_restore(flags);
 #ifndef OFFLINE_SAMPLE
 			get_sample_stats(this_cpu);
@@ -1150,6 +1267,7 @@ enqueue:
 				netdev_wakeup();
 #endif
 		}
+		netif_rx_schedule(&queue->backlog_dev);
 		goto enqueue;
 	}
 
@@ -1202,17 +1320,18 @@ static int deliver_to_old_ones(struct packet_type *pt, struct sk_buff *skb, int
 }
 
 /* Reparent skb to master device. This function is called
- * only from net_rx_action under BR_NETPROTO_LOCK. It is misuse
- * of BR_NETPROTO_LOCK, but it is OK for now.
+ * only from netif_receive_skb under BR_NETPROTO_LOCK. It is misuse
+ * of BR_NETPROTO_LOCK, but it is OK for now.  The master cannot go
+ * away under the lock, so no reference is taken for it: whoever
+ * holds one on the device the packet came in on keeps it.
  */
 static __inline__ void skb_bond(struct sk_buff *skb)
 {
 	struct net_device *dev = skb->dev;
 	
 	if (dev->master) {
-		dev_hold(dev->master);
+		skb->real_dev = dev;
 		skb->dev = dev->master;
-		dev_put(dev);
 	}
 }
 
@@ -1310,120 +1429,241 @@ static inline void handle_diverter(struct sk_buff *skb)
 #endif   /* CONFIG_NET_DIVERT */
 
 
-static void net_rx_action(struct softirq_action *h)
-{
-	int this_cpu = smp_processor_id();
-	struct softnet_data *queue = &softnet_data[this_cpu];
-	unsigned long start_time = jiffies;
-	int bugdet = netdev_max_backlog;
-
-	br_read_lock(BR_NETPROTO_LOCK);
-
-	for (;;) {
-		struct sk_buff *skb;
-		struct net_device *rx_dev;
-
-		local_irq_disable();
-		skb = __skb_dequeue(&queue->input_pkt_queue);
-		local_irq_enable();
+/**
+ *	netif_receive_skb	-	process a received buffer
+ *	@skb: buffer to process
+ *
+ *	Hands a packet to the protocol handlers right away.  Called from
+ *	the NET_RX softirq only: by the poll method of a driver, or for
+ *	the packets queued by netif_rx().
+ */
 
-		if (skb == NULL)
-			break;
+int netif_receive_skb(struct sk_buff *skb)
+{
+	struct packet_type *ptype, *pt_prev;
+	unsigned short type;
+	int ret = NET_RX_DROP;
 
-		skb_bond(skb);
+	if (skb->stamp.tv_sec == 0)
+		get_fast_time(&skb->stamp);
 
-		rx_dev = skb->dev;
+	skb_bond(skb);
 
 #ifdef CONFIG_NET_FASTROUTE
-		if (skb->pkt_type == PACKET_FASTROUTE) {
-			netdev_rx_stat[this_cpu].fastroute_deferred_out++;
-			dev_queue_xmit(skb);
-			dev_put(rx_dev);
-			continue;
-		}
+	if (skb->pkt_type == PACKET_FASTROUTE) {
+		netdev_rx_stat[smp_processor_id()].fastroute_deferred_out++;
+		return dev_queue_xmit(skb);
+	}
 #endif
-		skb->h.raw = skb->nh.raw = skb->data;
-		{
-			struct packet_type *ptype, *pt_prev;
-			unsigned short type = skb->protocol;
-
-			pt_prev = NULL;
-			for (ptype = ptype_all; ptype; ptype = ptype->next) {
-				if (!ptype->dev || ptype->dev == skb->dev) {
-					if (pt_prev) {
-						if (!pt_prev->data) {
-							deliver_to_old_ones(pt_prev, skb, 0);
-						} else {
-							atomic_inc(&skb->users);
-							pt_prev->func(skb,
-								      skb->dev,
-								      pt_prev);
-						}
-					}
-					pt_prev = ptype;
+
+	skb->h.raw = skb->nh.raw = skb->data;
+
+	pt_prev = NULL;
+	for (ptype = ptype_all; ptype; ptype = ptype->next) {
+		if (!ptype->dev || ptype->dev == skb->dev) {
+			if (pt_prev) {
+				if (!pt_prev->data) {
+					ret = deliver_to_old_ones(pt_prev, skb, 0);
+				} else {
+					atomic_inc(&skb->users);
+					ret = pt_prev->func(skb, skb->dev, pt_prev);
 				}
 			}
+			pt_prev = ptype;
+		}
+	}
 
 #ifdef CONFIG_NET_DIVERT
-			if (skb->dev->divert && skb->dev->divert->divert)
-				handle_diverter(skb);
+	if (skb->dev->divert && skb->dev->divert->divert)
+		handle_diverter(skb);
 #endif /* CONFIG_NET_DIVERT */
 
-			
 #if defined(CONFIG_BRIDGE) || defined(CONFIG_BRIDGE_MODULE)
-			if (skb->dev->br_port != NULL &&
-			    br_handle_frame_hook != NULL) {
-				handle_bridge(skb, pt_prev);
-				dev_put(rx_dev);
-				continue;
-			}
+	if (skb->dev->br_port != NULL && br_handle_frame_hook != NULL)
+		return handle_bridge(skb, pt_prev);
 #endif
 
-			for (ptype=ptype_base[ntohs(type)&15];ptype;ptype=ptype->next) {
-				if (ptype->type == type &&
-				    (!ptype->dev || ptype->dev == skb->dev)) {
-					if (pt_prev) {
-						if (!pt_prev->data)
-							deliver_to_old_ones(pt_prev, skb, 0);
-						else {
-							atomic_inc(&skb->users);
-							pt_prev->func(skb,
-								      skb->dev,
-								      pt_prev);
-						}
-					}
-					pt_prev = ptype;
+	type = skb->protocol;
+	for (ptype=ptype_base[ntohs(type)&15];ptype;ptype=ptype->next) {
+		if (ptype->type == type &&
+		    (!ptype->dev || ptype->dev == skb->dev)) {
+			if (pt_prev) {
+				if (!pt_prev->data) {
+					ret = deliver_to_old_ones(pt_prev, skb, 0);
+				} else {
+					atomic_inc(&skb->users);
+					ret = pt_prev->func(skb, skb->dev, pt_prev);
 				}
 			}
+			pt_prev = ptype;
+		}
+	}
 
-			if (pt_prev) {
-				if (!pt_prev->data)
-					deliver_to_old_ones(pt_prev, skb, 1);
-				else
-					pt_prev->func(skb, skb->dev, pt_prev);
-			} else
-				kfree_skb(skb);
+	if (pt_prev) {
+		if (!pt_prev->data) {
+			ret = deliver_to_old_ones(pt_prev, skb, 1);
+		} else {
+			ret = pt_prev->func(skb, skb->dev, pt_prev);
 		}
+	} else {
+		kfree_skb(skb);
+		ret = NET_RX_DROP;
+	}
 
-		dev_put(rx_dev);
+	return ret;
+}
 
-		if (bugdet-- < 0 || jiffies - start_time > 1)
-			goto softnet_break;
+#ifdef CONFIG_SMP
+/*
+ * Receive flow steering.  With netdev_rps set, netif_rx() hashes the
+ * addresses and ports of TCP and UDP over IPv4 and queues the packet to
+ * the backlog of the CPU that last did a recvmsg() on a socket hashing
+ * to the same slot of netdev_rps_flows, so that protocol processing
+ * happens where the data will be consumed.  A slot holds that CPU + 1,
+ * 0 meaning no socket has been seen.  Only connected sockets match,
+ * and packets of drivers with a poll method are not steered.
+ */
+int netdev_rps = 0;
 
-#ifdef CONFIG_NET_HW_FLOWCONTROL
-	if (queue->throttle && queue->input_pkt_queue.qlen < no_cong_thresh ) {
-		if (atomic_dec_and_test(&netdev_dropping)) {
-			queue->throttle = 0;
-			netdev_wakeup();
-			goto softnet_break;
-		}
+#define NETDEV_RPS_FLOWS	4096
+
+static unsigned char netdev_rps_flows[NETDEV_RPS_FLOWS];
+
+static inline unsigned int netdev_rps_hash(u32 raddr, u32 laddr,
+					   u16 rport, u16 lport)
+{
+	u32 h = raddr ^ laddr ^ (((u32)rport << 16) | lport);
+
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h & (NETDEV_RPS_FLOWS - 1);
+}
+
+/* Called on recvmsg(), in process context. */
+void netdev_rps_record(u32 raddr, u32 laddr, u16 rport, u16 lport)
+{
+	unsigned char *flow = &netdev_rps_flows[netdev_rps_hash(raddr, laddr,
+								 rport, lport)];
+	unsigned char cpu = smp_processor_id() + 1;
+
+	if (*flow != cpu)
+		*flow = cpu;
+}
+
+/* The CPU to steer skb to, or -1 to keep it on this one. */
+static int netdev_rps_cpu(struct sk_buff *skb)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data;
+	unsigned int ihl;
+	u16 *ports;
+
+	if (skb->protocol != htons(ETH_P_IP) || skb->len < sizeof(struct iphdr))
+		return -1;
+	ihl = iph->ihl * 4;
+	if (ihl < sizeof(struct iphdr) || skb->len < ihl + 4 ||
+	    (iph->frag_off & htons(IP_MF|IP_OFFSET)) ||
+	    (iph->protocol != IPPROTO_TCP && iph->protocol != IPPROTO_UDP))
+		return -1;
+	ports = (u16 *)(skb->data + ihl);
+	return netdev_rps_flows[netdev_rps_hash(iph->saddr, iph->daddr,
+						ports[0], ports[1])] - 1;
+}
+
+static int netif_rx_steer(struct sk_buff *skb, int this_cpu, int cpu)
+{
+	struct softnet_data *queue = &softnet_data[cpu];
+	unsigned long flags;
+	int kick;
+
+	if (queue->rps_queue.qlen > netdev_max_backlog) {
+		netdev_rx_stat[this_cpu].dropped++;
+		kfree_skb(skb);
+		return NET_RX_DROP;
 	}
+
+	dev_hold(skb->dev);
+	spin_lock_irqsave(&queue->rps_queue.lock, flags);
+	__skb_queue_tail(&queue->rps_queue, skb);
+	kick = (queue->rps_queue.qlen == 1);
+	spin_unlock_irqrestore(&queue->rps_queue.lock, flags);
+
+	netdev_rx_stat[this_cpu].rps_steered++;
+	if (kick) {
+		netdev_rx_stat[this_cpu].rps_kicks++;
+		cpu_raise_softirq_remote(cpu, NET_RX_SOFTIRQ);
+	}
+	return NET_RX_SUCCESS;
+}
+
+/* Move what other CPUs steered here to our own backlog.  Irqs are off. */
+static void netif_rx_steered(struct softnet_data *queue)
+{
+	struct sk_buff *skb;
+
+	spin_lock(&queue->rps_queue.lock);
+	while ((skb = __skb_dequeue(&queue->rps_queue)) != NULL)
+		__skb_queue_tail(&queue->input_pkt_queue, skb);
+	spin_unlock(&queue->rps_queue.lock);
+	netif_rx_schedule(&queue->backlog_dev);
+}
 #endif
 
+/*
+ * The poll method of the backlog device of each CPU: the packets that
+ * drivers without a poll method queued with netif_rx().
+ */
+static int process_backlog(struct net_device *backlog_dev, int *budget)
+{
+	int work = 0;
+	int quota = backlog_dev->quota < *budget ? backlog_dev->quota : *budget;
+	int this_cpu = smp_processor_id();
+	struct softnet_data *queue = &softnet_data[this_cpu];
+	unsigned long start_time = jiffies;
+
+	for (;;) {
+		struct sk_buff *skb;
+		struct net_device *dev;
+
+		local_irq_disable();
+		skb = __skb_dequeue(&queue->input_pkt_queue);
+		if (skb == NULL)
+			goto job_done;
+		local_irq_enable();
+
+		dev = skb->dev;
+
+		netif_receive_skb(skb);
+
+		dev_put(dev);
+
+		work++;
+
+		if (work >= quota || jiffies - start_time > 1)
+			break;
+
+#ifdef CONFIG_NET_HW_FLOWCONTROL
+		if (queue->throttle && queue->input_pkt_queue.qlen < no_cong_thresh ) {
+			if (atomic_dec_and_test(&netdev_dropping)) {
+				queue->throttle = 0;
+				netdev_wakeup();
+				break;
+			}
+		}
+#endif
 	}
-	br_read_unlock(BR_NETPROTO_LOCK);
 
-	local_irq_disable();
+	backlog_dev->quota -= work;
+	*budget -= work;
+	return -1;
+
+job_done:
+	backlog_dev->quota -= work;
+	*budget -= work;
+
+	list_del(&backlog_dev->poll_list);
+	smp_mb__before_clear_bit();
+	netif_poll_enable(backlog_dev);
+
 	if (queue->throttle) {
 		queue->throttle = 0;
 #ifdef CONFIG_NET_HW_FLOWCONTROL
@@ -1432,20 +1672,66 @@ static void net_rx_action(struct softirq_action *h)
 #endif
 	}
 	local_irq_enable();
+	return 0;
+}
+
+/*
+ * Poll the devices on the poll list of this CPU round robin, each for
+ * at most its quota, until the list is empty or netdev_max_backlog
+ * packets or a jiffy have gone by.  A device that still has work goes
+ * to the end of the list with a fresh quota.
+ */
+static void net_rx_action(struct softirq_action *h)
+{
+	int this_cpu = smp_processor_id();
+	struct softnet_data *queue = &softnet_data[this_cpu];
+	unsigned long start_time = jiffies;
+	int budget = netdev_max_backlog;
+
+	br_read_lock(BR_NETPROTO_LOCK);
+	local_irq_disable();
+
+#ifdef CONFIG_SMP
+	if (queue->rps_queue.qlen)
+		netif_rx_steered(queue);
+#endif
+
+	while (!list_empty(&queue->poll_list)) {
+		struct net_device *dev;
+
+		if (budget <= 0 || jiffies - start_time > 1)
+			goto softnet_break;
 
+		local_irq_enable();
+
+		dev = list_entry(queue->poll_list.next, struct net_device, poll_list);
+
+		if (dev->quota <= 0 || dev->poll(dev, &budget)) {
+			local_irq_disable();
+			list_del(&dev->poll_list);
+			list_add_tail(&dev->poll_list, &queue->poll_list);
+			if (dev->quota < 0)
+				dev->quota += dev->weight;
+			else
+				dev->quota = dev->weight;
+		} else {
+			dev_put(dev);
+			local_irq_disable();
+		}
+	}
+
+	local_irq_enable();
+	br_read_unlock(BR_NETPROTO_LOCK);
 	NET_PROFILE_LEAVE(softnet_process);
 	return;
 
 softnet_break:
-	br_read_unlock(BR_NETPROTO_LOCK);
-
-	local_irq_disable();
 	netdev_rx_stat[this_cpu].time_squeeze++;
 	__cpu_raise_softirq(this_cpu, NET_RX_SOFTIRQ);
-	local_irq_enable();
 
+	local_irq_enable();
+	br_read_unlock(BR_NETPROTO_LOCK);
 	NET_PROFILE_LEAVE(softnet_process);
-	return;
 }
 
 static gifconf_func_t * gifconf_list [NPROTO];
@@ -1656,7 +1942,7 @@ static int dev_proc_stats(char *buffer, char **start, off_t offset,
 
 	for (lcpu=0; lcpu<smp_num_cpus; lcpu++) {
 		i = cpu_logical_map(lcpu);
-		len += sprintf(buffer+len, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+		len += sprintf(buffer+len, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
 			       netdev_rx_stat[i].total,
 			       netdev_rx_stat[i].dropped,
 			       netdev_rx_stat[i].time_squeeze,
@@ -1666,10 +1952,12 @@ static int dev_proc_stats(char *buffer, char **start, off_t offset,
 			       netdev_rx_stat[i].fastroute_defer,
 			       netdev_rx_stat[i].fastroute_deferred_out,
 #if 0
-			       netdev_rx_stat[i].fastroute_latency_reduction
+			       netdev_rx_stat[i].fastroute_latency_reduction,
 #else
-			       netdev_rx_stat[i].cpu_collision
+			       netdev_rx_stat[i].cpu_collision,
 #endif
+			       netdev_rx_stat[i].rps_steered,
+			       netdev_rx_stat[i].rps_kicks
 			       );
 	}
 
@@ -2619,6 +2907,12 @@ int __init net_dev_init(void)
 		queue->cng_level = 0;
 		queue->avg_blog = 10; /* arbitrary non-zero */
 		queue->completion_queue = NULL;
+		INIT_LIST_HEAD(&queue->poll_list);
+		set_bit(__LINK_STATE_START, &queue->backlog_dev.state);
+		queue->backlog_dev.weight = weight_p;
+		queue->backlog_dev.poll = process_backlog;
+		atomic_set(&queue->backlog_dev.refcnt, 1);
+		skb_queue_head_init(&queue->rps_queue);
 	}
 	
 #ifdef CONFIG_NET_PROFILE
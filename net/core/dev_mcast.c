@@ -61,8 +61,23 @@
  *	so that it must be bh protected.
  *
  *	We block accesses to device mc filters with dev->xmit_lock.
+ *
+ *	Entries are also hashed on the last bytes of the address, where
+ *	the group bits of a multicast MAC address are, so that a host in
+ *	thousands of groups does not walk the list on every change.  The
+ *	list itself is what the drivers load into their filters.
  */
 
+static inline struct dev_mc_list **dev_mc_hash(struct net_device *dev, void *addr, int alen)
+{
+	unsigned char *a = addr;
+	unsigned int h = a[alen - 1];
+
+	if (alen > 1)
+		h ^= a[alen - 2] << 3;
+	return &dev->mc_hash[h & (DEV_MC_HASH_SIZE - 1)];
+}
+
 /*
  *	Update the multicast list into the physical NIC controller.
  */
@@ -107,7 +122,7 @@ int dev_mc_delete(struct net_device *dev, void *addr, int alen, int glbl)
 
 	spin_lock_bh(&dev->xmit_lock);
 
-	for (dmip = &dev->mc_list; (dmi = *dmip) != NULL; dmip = &dmi->next) {
+	for (dmip = dev_mc_hash(dev, addr, alen); (dmi = *dmip) != NULL; dmip = &dmi->hash_next) {
 		/*
 		 *	Find the entry we want to delete. The device could
 		 *	have variable length entries so check these too.
@@ -126,7 +141,10 @@ int dev_mc_delete(struct net_device *dev, void *addr, int alen, int glbl)
 			/*
 			 *	Last user. So delete the entry.
 			 */
-			*dmip = dmi->next;
+			*dmip = dmi->hash_next;
+			*dmi->pprev = dmi->next;
+			if (dmi->next)
+				dmi->next->pprev = dmi->pprev;
 			dev->mc_count--;
 
 			kfree(dmi);
@@ -154,12 +172,13 @@ done:
 int dev_mc_add(struct net_device *dev, void *addr, int alen, int glbl)
 {
 	int err = 0;
-	struct dev_mc_list *dmi, *dmi1;
+	struct dev_mc_list *dmi, *dmi1, **hash;
 
 	dmi1 = (struct dev_mc_list *)kmalloc(sizeof(*dmi), GFP_ATOMIC);
 
 	spin_lock_bh(&dev->xmit_lock);
-	for (dmi = dev->mc_list; dmi != NULL; dmi = dmi->next) {
+	hash = dev_mc_hash(dev, addr, alen);
+	for (dmi = *hash; dmi != NULL; dmi = dmi->hash_next) {
 		if (memcmp(dmi->dmi_addr, addr, dmi->dmi_addrlen) == 0 &&
 		    dmi->dmi_addrlen == alen) {
 			if (glbl) {
@@ -179,10 +198,15 @@ int dev_mc_add(struct net_device *dev, void *addr, int alen, int glbl)
 	}
 	memcpy(dmi->dmi_addr, addr, alen);
 	dmi->dmi_addrlen = alen;
-	dmi->next = dev->mc_list;
 	dmi->dmi_users = 1;
 	dmi->dmi_gusers = glbl ? 1 : 0;
+	dmi->next = dev->mc_list;
+	if (dmi->next)
+		dmi->next->pprev = &dmi->next;
+	dmi->pprev = &dev->mc_list;
 	dev->mc_list = dmi;
+	dmi->hash_next = *hash;
+	*hash = dmi;
 	dev->mc_count++;
 
 	__dev_mc_upload(dev);
@@ -213,6 +237,7 @@ void dev_mc_discard(struct net_device *dev)
 		kfree(tmp);
 	}
 	dev->mc_count = 0;
+	memset(dev->mc_hash, 0, sizeof(dev->mc_hash));
 
 	spin_unlock_bh(&dev->xmit_lock);
 }
@@ -346,6 +346,59 @@ load_b:
 	return (0);
 }
 
+/**
+ *	sk_filter_load	-	slow path of a packet load
+ *	@skb: buffer the filter runs on
+ *	@k: offset of the load
+ *	@size: 1, 2 or 4 bytes
+ *	@val: where to store the value, in host order
+ *
+ * Compiled filters read the linear data themselves and call this
+ * for everything else: offsets in the page fragments, the negative
+ * SKF_NET_OFF/SKF_LL_OFF offsets and ancillary data. Returns 1 with
+ * @val set, or 0 if the filter has to return 0, as sk_run_filter()
+ * would.
+ */
+
+int sk_filter_load(struct sk_buff *skb, int k, int size, u32 *val)
+{
+	u8 buf[4];
+	u8 *ptr;
+
+	if (k >= 0) {
+		if (skb_copy_bits(skb, k, buf, size))
+			return 0;
+		ptr = buf;
+	} else if (k >= SKF_AD_OFF) {
+		switch (k-SKF_AD_OFF) {
+		case SKF_AD_PROTOCOL:
+			*val = htons(skb->protocol);
+			return 1;
+		case SKF_AD_PKTTYPE:
+			*val = skb->pkt_type;
+			return 1;
+		case SKF_AD_IFINDEX:
+			*val = skb->dev->ifindex;
+			return 1;
+		default:
+			return 0;
+		}
+	} else if ((ptr = load_pointer(skb, k)) == NULL)
+		return 0;
+
+	switch (size) {
+	case 4:
+		*val = ntohl(*(u32*)ptr);
+		break;
+	case 2:
+		*val = ntohs(*(u16*)ptr);
+		break;
+	default:
+		*val = *ptr;
+	}
+	return 1;
+}
+
 /**
  *	sk_chk_filter - verify socket filter code
  *	@filter: filter to verify
@@ -458,10 +511,15 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+#ifdef CONFIG_BPF_JIT
+	fp->bpf_func = NULL;
+#endif
 
 	if ((err = sk_chk_filter(fp->insns, fp->len))==0) {
 		struct sk_filter *old_fp;
 
+		bpf_jit_compile(fp);
+
 		spin_lock_bh(&sk->lock.slock);
 		old_fp = sk->filter;
 		sk->filter = fp;
@@ -22,6 +22,7 @@
 #include <linux/netdevice.h>
 #ifdef CONFIG_SYSCTL
 #include <linux/sysctl.h>
+#include <linux/random.h>
 #endif
 #include <net/neighbour.h>
 #include <net/dst.h>
@@ -111,16 +112,80 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 }
 
 
+/*
+ * Hash buckets grow with the number of entries, so that chains stay
+ * short however many neighbours there are, and shrink back when the
+ * entries are collected. Every resize picks a new hash_rnd, so chains
+ * cannot be made long on purpose. Called with the table write locked,
+ * possibly from softirq context.
+ */
+
+static struct neighbour **neigh_hash_alloc(unsigned int size)
+{
+	unsigned long bytes = size * sizeof(struct neighbour *);
+	struct neighbour **buckets;
+
+	if (bytes <= PAGE_SIZE)
+		buckets = kmalloc(bytes, GFP_ATOMIC);
+	else
+		buckets = (struct neighbour **)
+			__get_free_pages(GFP_ATOMIC, get_order(bytes));
+	if (buckets)
+		memset(buckets, 0, bytes);
+	return buckets;
+}
+
+static void neigh_hash_free(struct neighbour **buckets, unsigned int size)
+{
+	unsigned long bytes = size * sizeof(struct neighbour *);
+
+	if (bytes <= PAGE_SIZE)
+		kfree(buckets);
+	else
+		free_pages((unsigned long)buckets, get_order(bytes));
+}
+
+static void neigh_hash_resize(struct neigh_table *tbl, unsigned int new_size)
+{
+	struct neighbour **new_buckets, **old_buckets;
+	unsigned int i, old_size = tbl->hash_mask + 1;
+
+	new_buckets = neigh_hash_alloc(new_size);
+	if (new_buckets == NULL)
+		return;		/* Keep the old table, try again later */
+
+	old_buckets = tbl->hash_buckets;
+	get_random_bytes(&tbl->hash_rnd, sizeof(tbl->hash_rnd));
+
+	for (i = 0; i < old_size; i++) {
+		struct neighbour *n, *next;
+
+		for (n = old_buckets[i]; n; n = next) {
+			unsigned int h = tbl->hash(n->primary_key, n->dev) &
+					 (new_size - 1);
+
+			next = n->next;
+			n->next = new_buckets[h];
+			new_buckets[h] = n;
+		}
+	}
+
+	tbl->hash_buckets = new_buckets;
+	tbl->hash_mask = new_size - 1;
+	tbl->hash_chain_gc &= tbl->hash_mask;
+	neigh_hash_free(old_buckets, old_size);
+}
+
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
 	int shrunk = 0;
 	int i;
 
-	for (i=0; i<=NEIGH_HASHMASK; i++) {
+	write_lock_bh(&tbl->lock);
+	for (i=0; i<=tbl->hash_mask; i++) {
 		struct neighbour *n, **np;
 
 		np = &tbl->hash_buckets[i];
-		write_lock_bh(&tbl->lock);
 		while ((n = *np) != NULL) {
 			/* Neighbour record may be discarded if:
 			   - nobody refers to it.
@@ -147,8 +212,8 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 			write_unlock(&n->lock);
 			np = &n->next;
 		}
-		write_unlock_bh(&tbl->lock);
 	}
+	write_unlock_bh(&tbl->lock);
 	
 	tbl->last_flush = jiffies;
 	return shrunk;
@@ -181,7 +246,7 @@ int neigh_ifdown(struct neigh_table *tbl, struct net_device *dev)
 
 	write_lock_bh(&tbl->lock);
 
-	for (i=0; i<=NEIGH_HASHMASK; i++) {
+	for (i=0; i<=tbl->hash_mask; i++) {
 		struct neighbour *n, **np;
 
 		np = &tbl->hash_buckets[i];
@@ -271,9 +336,8 @@ struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 	u32 hash_val;
 	int key_len = tbl->key_len;
 
-	hash_val = tbl->hash(pkey, dev);
-
 	read_lock_bh(&tbl->lock);
+	hash_val = tbl->hash(pkey, dev) & tbl->hash_mask;
 	for (n = tbl->hash_buckets[hash_val]; n; n = n->next) {
 		if (dev == n->dev &&
 		    memcmp(n->primary_key, pkey, key_len) == 0) {
@@ -316,9 +380,12 @@ struct neighbour * neigh_create(struct neigh_table *tbl, const void *pkey,
 
 	n->confirmed = jiffies - (n->parms->base_reachable_time<<1);
 
-	hash_val = tbl->hash(pkey, dev);
-
 	write_lock_bh(&tbl->lock);
+
+	if (tbl->entries > tbl->hash_mask + 1)
+		neigh_hash_resize(tbl, (tbl->hash_mask + 1) << 1);
+
+	hash_val = tbl->hash(pkey, dev) & tbl->hash_mask;
 	for (n1 = tbl->hash_buckets[hash_val]; n1; n1 = n1->next) {
 		if (dev == n1->dev &&
 		    memcmp(n1->primary_key, pkey, key_len) == 0) {
@@ -546,11 +613,18 @@ static void neigh_sync(struct neighbour *n)
 	}
 }
 
+/*
+ * The periodic GC walks a few buckets per run instead of the whole
+ * table, so that every bucket is visited once per gc_interval and no
+ * single run holds the table lock for long, however big it grew.
+ */
+
 static void SMP_TIMER_NAME(neigh_periodic_timer)(unsigned long arg)
 {
 	struct neigh_table *tbl = (struct neigh_table*)arg;
 	unsigned long now = jiffies;
-	int i;
+	unsigned long expire;
+	unsigned int size, chunk;
 
 
 	write_lock(&tbl->lock);
@@ -566,10 +640,16 @@ static void SMP_TIMER_NAME(neigh_periodic_timer)(unsigned long arg)
 			p->reachable_time = neigh_rand_reach_time(p->base_reachable_time);
 	}
 
-	for (i=0; i <= NEIGH_HASHMASK; i++) {
+	size = tbl->hash_mask + 1;
+	chunk = size / (tbl->gc_interval ? : 1) + 1;
+	if (chunk > size)
+		chunk = size;
+
+	while (chunk--) {
 		struct neighbour *n, **np;
 
-		np = &tbl->hash_buckets[i];
+		np = &tbl->hash_buckets[tbl->hash_chain_gc];
+		tbl->hash_chain_gc = (tbl->hash_chain_gc + 1) & tbl->hash_mask;
 		while ((n = *np) != NULL) {
 			unsigned state;
 
@@ -605,7 +685,14 @@ next_elt:
 		}
 	}
 
-	mod_timer(&tbl->gc_timer, now + tbl->gc_interval);
+	if (size > NEIGH_HASH_MIN && tbl->entries < (size >> 2))
+		neigh_hash_resize(tbl, size >> 1);
+
+	/* Spread the walk of all buckets over gc_interval */
+	expire = tbl->gc_interval * (size / (tbl->gc_interval ? : 1) + 1) / size;
+	if (expire == 0)
+		expire = 1;
+	mod_timer(&tbl->gc_timer, now + expire);
 	write_unlock(&tbl->lock);
 }
 
@@ -1111,12 +1198,24 @@ void neigh_parms_release(struct neigh_table *tbl, struct neigh_parms *parms)
 }
 
 
+/* Tables that do not go through neigh_table_init() call this directly */
+void neigh_hash_init(struct neigh_table *tbl)
+{
+	tbl->hash_mask = NEIGH_HASH_MIN - 1;
+	tbl->hash_buckets = neigh_hash_alloc(NEIGH_HASH_MIN);
+	if (tbl->hash_buckets == NULL)
+		panic("cannot allocate neighbour cache hashes");
+	get_random_bytes(&tbl->hash_rnd, sizeof(tbl->hash_rnd));
+}
+
 void neigh_table_init(struct neigh_table *tbl)
 {
 	unsigned long now = jiffies;
 
 	tbl->parms.reachable_time = neigh_rand_reach_time(tbl->parms.base_reachable_time);
 
+	neigh_hash_init(tbl);
+
 	if (tbl->kmem_cachep == NULL)
 		tbl->kmem_cachep = kmem_cache_create(tbl->id,
 						     (tbl->entry_size+15)&~15,
@@ -1158,6 +1257,8 @@ int neigh_table_clear(struct neigh_table *tbl)
 	neigh_ifdown(tbl, NULL);
 	if (tbl->entries)
 		printk(KERN_CRIT "neighbour leakage\n");
+	neigh_hash_free(tbl->hash_buckets, tbl->hash_mask + 1);
+	tbl->hash_buckets = NULL;
 	write_lock(&neigh_tbl_lock);
 	for (tp = &neigh_tables; *tp; tp = &(*tp)->next) {
 		if (*tp == tbl) {
@@ -1347,11 +1448,11 @@ static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb, struct
 
 	s_h = cb->args[1];
 	s_idx = idx = cb->args[2];
-	for (h=0; h <= NEIGH_HASHMASK; h++) {
+	read_lock_bh(&tbl->lock);
+	for (h=0; h <= tbl->hash_mask; h++) {
 		if (h < s_h) continue;
 		if (h > s_h)
 			s_idx = 0;
-		read_lock_bh(&tbl->lock);
 		for (n = tbl->hash_buckets[h], idx = 0; n;
 		     n = n->next, idx++) {
 			if (idx < s_idx)
@@ -1364,8 +1465,8 @@ static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb, struct
 				return -1;
 			}
 		}
-		read_unlock_bh(&tbl->lock);
 	}
+	read_unlock_bh(&tbl->lock);
 
 	cb->args[1] = h;
 	cb->args[2] = idx;
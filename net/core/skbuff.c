@@ -51,6 +51,7 @@
 #include <linux/slab.h>
 #include <linux/cache.h>
 #include <linux/init.h>
+#include <linux/proc_fs.h>
 
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -59,6 +60,8 @@
 #include <net/udp.h>
 #include <net/sock.h>
 
+#include <net/checksum.h>
+
 #include <asm/uaccess.h>
 #include <asm/system.h>
 
@@ -71,6 +74,41 @@ static union {
 	char			pad[SMP_CACHE_BYTES];
 } skb_head_pool[NR_CPUS];
 
+/*
+ *	Receive buffer recycling.  A driver which refills its receive ring
+ *	with buffers of one size can have the freed ones, head and data
+ *	area together, kept on a per-CPU list of its pool instead of going
+ *	back to kmalloc.  Every data area made for a pool holds a reference
+ *	to it, so the pool outlives the buffers still in the stack when the
+ *	driver destroys it.
+ */
+
+struct skb_recycle_stat {
+	unsigned int	hits;		/* allocations served from the list */
+	unsigned int	misses;		/* allocations from kmalloc */
+	unsigned int	recycled;	/* frees put on the list */
+	unsigned int	released;	/* frees of cloned or fragmented buffers */
+	unsigned int	overflow;	/* frees with the list full */
+};
+
+struct skb_recycle_cpu {
+	struct sk_buff_head	list;
+	struct skb_recycle_stat	stat;
+} ____cacheline_aligned;
+
+struct skb_recycle_pool {
+	struct skb_recycle_pool	*next;
+	char			name[IFNAMSIZ];
+	unsigned int		size;	/* data area, rounded as by alloc_skb() */
+	unsigned int		max;	/* buffers kept per CPU */
+	int			dead;
+	atomic_t		refcnt;
+	struct skb_recycle_cpu	cpu[NR_CPUS];
+};
+
+static struct skb_recycle_pool *skb_recycle_pools;
+static spinlock_t skb_recycle_lock = SPIN_LOCK_UNLOCKED;
+
 /*
  *	Keep out-of-line to prevent kernel bloat.
  *	__builtin_return_address is not used because it is not always
@@ -187,7 +225,7 @@ struct sk_buff *alloc_skb(unsigned int size,int gfp_mask)
 
 	/* Get the DATA. Size must match skb_add_mtu(). */
 	size = ((size + 15) & ~15); 
-	data = kmalloc(size + sizeof(atomic_t), gfp_mask);
+	data = kmalloc(size + sizeof(struct skb_shared_info), gfp_mask);
 	if (data == NULL)
 		goto nodata;
 
@@ -202,10 +240,15 @@ struct sk_buff *alloc_skb(unsigned int size,int gfp_mask)
 
 	/* Set up other state */
 	skb->len = 0;
+	skb->data_len = 0;
 	skb->cloned = 0;
 
 	atomic_set(&skb->users, 1); 
 	atomic_set(skb_datarefp(skb), 1);
+	skb_shinfo(skb)->nr_frags = 0;
+	skb_shinfo(skb)->tso_size = 0;
+	skb_shinfo(skb)->tso_segs = 0;
+	skb_shinfo(skb)->pool = NULL;
 	return skb;
 
 nodata:
@@ -229,6 +272,7 @@ static inline void skb_headerinit(void *p, kmem_cache_t *cache,
 	skb->sk = NULL;
 	skb->stamp.tv_sec=0;	/* No idea about time */
 	skb->dev = NULL;
+	skb->real_dev = NULL;
 	skb->dst = NULL;
 	memset(skb->cb, 0, sizeof(skb->cb));
 	skb->pkt_type = PACKET_HOST;	/* Default type */
@@ -250,16 +294,182 @@ static inline void skb_headerinit(void *p, kmem_cache_t *cache,
 }
 
 /*
- *	Free an skbuff by memory without cleaning the state. 
+ *	Drop this buffer's reference to the data, and the page fragments
+ *	with it if it was the last one.
  */
-void kfree_skbmem(struct sk_buff *skb)
+static void skb_release_data(struct sk_buff *skb)
 {
-	if (!skb->cloned || atomic_dec_and_test(skb_datarefp(skb)))  
+	if (!skb->cloned || atomic_dec_and_test(skb_datarefp(skb))) {
+		struct skb_recycle_pool *pool = skb_shinfo(skb)->pool;
+		int i;
+
+		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
+			put_page(skb_shinfo(skb)->frags[i].page);
 		kfree(skb->head);
+		if (pool != NULL && atomic_dec_and_test(&pool->refcnt))
+			kfree(pool);
+	}
+}
+
+/*
+ *	Put a buffer back on its pool's list for this CPU.  Only one which
+ *	was never cloned and carries no page fragments is as good as new.
+ *	Returns zero if the buffer has to be freed instead.
+ */
+static int skb_recycle(struct sk_buff *skb)
+{
+	struct skb_recycle_pool *pool = skb_shinfo(skb)->pool;
+	struct skb_recycle_cpu *cpu = &pool->cpu[smp_processor_id()];
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&cpu->list.lock, flags);
+	if (skb->cloned || skb_shinfo(skb)->nr_frags) {
+		cpu->stat.released++;
+	} else if (skb_queue_len(&cpu->list) >= pool->max) {
+		cpu->stat.overflow++;
+	} else if (!pool->dead) {
+		skb->data = skb->head;
+		skb->tail = skb->head;
+		skb->len = 0;
+		skb->data_len = 0;
+		skb->truesize = pool->size + sizeof(struct sk_buff);
+		atomic_set(&skb->users, 1);
+		skb_shinfo(skb)->tso_size = 0;
+		skb_shinfo(skb)->tso_segs = 0;
+		__skb_queue_head(&cpu->list, skb);
+		cpu->stat.recycled++;
+		ret = 1;
+	}
+	spin_unlock_irqrestore(&cpu->list.lock, flags);
+	return ret;
+}
 
+/*
+ *	Free an skbuff by memory without cleaning the state. 
+ */
+void kfree_skbmem(struct sk_buff *skb)
+{
+	if (skb_shinfo(skb)->pool != NULL && skb_recycle(skb))
+		return;
+	skb_release_data(skb);
 	skb_head_to_pool(skb);
 }
 
+/**
+ *	skb_recycle_pool_create - make a pool of receive buffers
+ *	@name: name for the statistics, usually the device's
+ *	@length: length the driver passes to dev_alloc_skb_recycle()
+ *	@max: number of free buffers to keep for each CPU
+ *
+ *	The pool starts empty and fills up as the buffers taken from it
+ *	with dev_alloc_skb_recycle() are freed.  Returns %NULL if out of
+ *	memory; the driver can go on with a %NULL pool, which just does
+ *	not recycle.  Must be called from process context.
+ */
+
+struct skb_recycle_pool *skb_recycle_pool_create(const char *name,
+						 unsigned int length,
+						 unsigned int max)
+{
+	struct skb_recycle_pool *pool;
+	int i;
+
+	pool = kmalloc(sizeof(struct skb_recycle_pool), GFP_KERNEL);
+	if (pool == NULL)
+		return NULL;
+	memset(pool, 0, sizeof(struct skb_recycle_pool));
+	strncpy(pool->name, name, IFNAMSIZ-1);
+	pool->size = (length + 16 + 15) & ~15;
+	pool->max = max;
+	atomic_set(&pool->refcnt, 1);
+	for (i = 0; i < NR_CPUS; i++)
+		skb_queue_head_init(&pool->cpu[i].list);
+
+	spin_lock(&skb_recycle_lock);
+	pool->next = skb_recycle_pools;
+	skb_recycle_pools = pool;
+	spin_unlock(&skb_recycle_lock);
+	return pool;
+}
+
+/**
+ *	skb_recycle_pool_destroy - release a pool of receive buffers
+ *	@pool: pool to release
+ *
+ *	Frees the buffers kept in the pool.  Those still in use are freed
+ *	normally from now on, and the last of them frees the pool.  Must
+ *	be called from process context, after the driver has stopped
+ *	allocating from the pool.
+ */
+
+void skb_recycle_pool_destroy(struct skb_recycle_pool *pool)
+{
+	struct skb_recycle_pool **pp;
+	struct sk_buff *skb;
+	int i;
+
+	spin_lock(&skb_recycle_lock);
+	for (pp = &skb_recycle_pools; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == pool) {
+			*pp = pool->next;
+			break;
+		}
+	}
+	spin_unlock(&skb_recycle_lock);
+
+	/* skb_recycle() tests this under the list lock. */
+	pool->dead = 1;
+	mb();
+	for (i = 0; i < NR_CPUS; i++) {
+		while ((skb = skb_dequeue(&pool->cpu[i].list)) != NULL)
+			kfree_skbmem(skb);
+	}
+	if (atomic_dec_and_test(&pool->refcnt))
+		kfree(pool);
+}
+
+/**
+ *	alloc_skb_recycle - allocate a network buffer from a pool
+ *	@pool: pool made by skb_recycle_pool_create(), or %NULL
+ *	@size: size to allocate
+ *	@gfp_mask: allocation mask
+ *
+ *	As alloc_skb(), taking a free buffer of the pool for this CPU if
+ *	there is one.  A buffer allocated fresh is made for the pool and
+ *	goes back to it when freed.  Sizes larger than the pool's, and a
+ *	%NULL pool, get plain alloc_skb().
+ */
+
+struct sk_buff *alloc_skb_recycle(struct skb_recycle_pool *pool,
+				  unsigned int size, int gfp_mask)
+{
+	struct skb_recycle_cpu *cpu;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	if (pool == NULL || ((size + 15) & ~15) > pool->size)
+		return alloc_skb(size, gfp_mask);
+
+	cpu = &pool->cpu[smp_processor_id()];
+	spin_lock_irqsave(&cpu->list.lock, flags);
+	skb = __skb_dequeue(&cpu->list);
+	if (skb != NULL)
+		cpu->stat.hits++;
+	else
+		cpu->stat.misses++;
+	spin_unlock_irqrestore(&cpu->list.lock, flags);
+	if (skb != NULL)
+		return skb;
+
+	skb = alloc_skb(pool->size, gfp_mask);
+	if (skb != NULL) {
+		skb_shinfo(skb)->pool = pool;
+		atomic_inc(&pool->refcnt);
+	}
+	return skb;
+}
+
 /**
  *	__kfree_skb - private function 
  *	@skb: buffer
@@ -344,6 +554,7 @@ static void copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->list=NULL;
 	new->sk=NULL;
 	new->dev=old->dev;
+	new->real_dev=old->real_dev;
 	new->priority=old->priority;
 	new->protocol=old->protocol;
 	new->dst=dst_clone(old->dst);
@@ -355,6 +566,10 @@ static void copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	atomic_set(&new->users, 1);
 	new->pkt_type=old->pkt_type;
 	new->stamp=old->stamp;
+	new->csum=old->csum;
+	new->ip_summed=old->ip_summed;
+	skb_shinfo(new)->tso_size = skb_shinfo(old)->tso_size;
+	skb_shinfo(new)->tso_segs = skb_shinfo(old)->tso_segs;
 	new->destructor = NULL;
 	new->security=old->security;
 #ifdef CONFIG_NETFILTER
@@ -393,7 +608,7 @@ struct sk_buff *skb_copy(const struct sk_buff *skb, int gfp_mask)
 	 *	Allocate the copy buffer
 	 */
 	 
-	n=alloc_skb(skb->end - skb->head, gfp_mask);
+	n=alloc_skb(skb->end - skb->head + skb->data_len, gfp_mask);
 	if(n==NULL)
 		return NULL;
 
@@ -401,9 +616,12 @@ struct sk_buff *skb_copy(const struct sk_buff *skb, int gfp_mask)
 	skb_reserve(n,skb->data-skb->head);
 	/* Set the tail pointer and length */
 	skb_put(n,skb->len);
-	/* Copy the bytes */
-	memcpy(n->head,skb->head,skb->end-skb->head);
-	n->csum = skb->csum;
+	/* Copy the bytes, the page fragments going after the linear part */
+	memcpy(n->head,skb->head,skb->tail-skb->head);
+	if (skb->data_len &&
+	    skb_copy_bits(skb, skb_headlen(skb), n->data + skb_headlen(skb),
+			  skb->data_len))
+		BUG();
 	copy_skb_header(n, skb);
 
 	return n;
@@ -451,12 +669,372 @@ struct sk_buff *skb_copy_expand(const struct sk_buff *skb,
 	skb_put(n,skb->len);
 
 	/* Copy the data only. */
-	memcpy(n->data, skb->data, skb->len);
+	if (skb_copy_bits(skb, 0, n->data, skb->len))
+		BUG();
 
 	copy_skb_header(n, skb);
 	return n;
 }
 
+/**
+ *	pskb_expand_head - reallocate the header of an &sk_buff
+ *	@skb: buffer to reallocate
+ *	@nhead: room to add at head
+ *	@ntail: room to add at tail
+ *	@gfp_mask: allocation priority
+ *
+ *	Gives the buffer a private copy of its linear part and of the
+ *	fragment list, growing it by @nhead and @ntail bytes.  The page
+ *	fragments themselves stay shared with the clones.  The buffer must
+ *	not be shared (users == 1).  Returns zero on success or -ENOMEM,
+ *	in which case the buffer is unchanged.
+ */
+
+int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail, int gfp_mask)
+{
+	int i;
+	u8 *data;
+	int size = nhead + (skb->end - skb->head) + ntail;
+	long off;
+
+	if (skb_shared(skb))
+		BUG();
+
+	size = (size + 15) & ~15;
+
+	data = kmalloc(size + sizeof(struct skb_shared_info), gfp_mask);
+	if (data == NULL)
+		return -ENOMEM;
+
+	/* Copy only real data... and, alas, header. This should be
+	 * optimized for the cases when header is void. */
+	memcpy(data+nhead, skb->head, skb->tail-skb->head);
+	memcpy(data+size, skb->end, sizeof(struct skb_shared_info));
+
+	for (i=0; i<skb_shinfo(skb)->nr_frags; i++)
+		get_page(skb_shinfo(skb)->frags[i].page);
+
+	skb_release_data(skb);
+
+	off = (data+nhead) - skb->head;
+
+	skb->head = data;
+	skb->end  = data+size;
+
+	skb->data += off;
+	skb->tail += off;
+	skb->mac.raw += off;
+	skb->h.raw += off;
+	skb->nh.raw += off;
+	skb->cloned = 0;
+	atomic_set(skb_datarefp(skb), 1);
+	skb_shinfo(skb)->pool = NULL;
+	return 0;
+}
+
+/**
+ *	skb_linearize - move the page fragments into the linear part
+ *	@skb: buffer to linearize
+ *	@gfp_mask: allocation priority
+ *
+ *	Used for the devices and protocols that cannot handle page
+ *	fragments.  Returns zero on success or -ENOMEM, in which case
+ *	the buffer is unchanged.
+ */
+
+int skb_linearize(struct sk_buff *skb, int gfp_mask)
+{
+	unsigned int size;
+	u8 *data;
+	long offset;
+	int headerlen = skb->data - skb->head;
+	int expand = (skb->tail + skb->data_len) - skb->end;
+
+	if (skb_shared(skb))
+		BUG();
+
+	if (!skb_is_nonlinear(skb))
+		return 0;
+
+	if (expand <= 0)
+		expand = 0;
+
+	size = (skb->end - skb->head + expand);
+	size = (size + 15) & ~15;
+	data = kmalloc(size + sizeof(struct skb_shared_info), gfp_mask);
+	if (data == NULL)
+		return -ENOMEM;
+
+	/* Copy entire thing */
+	if (skb_copy_bits(skb, -headerlen, data, headerlen+skb->len))
+		BUG();
+	((struct skb_shared_info *)(data + size))->tso_size = skb_shinfo(skb)->tso_size;
+	((struct skb_shared_info *)(data + size))->tso_segs = skb_shinfo(skb)->tso_segs;
+
+	/* Offset between the two in bytes */
+	offset = data - skb->head;
+
+	/* Free old data. */
+	skb_release_data(skb);
+
+	skb->head = data;
+	skb->end  = data + size;
+
+	/* Set up new pointers */
+	skb->h.raw += offset;
+	skb->nh.raw += offset;
+	skb->mac.raw += offset;
+	skb->tail += offset + skb->data_len;
+	skb->data += offset;
+
+	/* Set up shinfo */
+	atomic_set(skb_datarefp(skb), 1);
+	skb_shinfo(skb)->nr_frags = 0;
+	skb_shinfo(skb)->pool = NULL;
+
+	skb->data_len = 0;
+	skb->cloned = 0;
+	return 0;
+}
+
+/* Trims a buffer with page fragments to len bytes.  Must not be
+ * called on a clone: see pskb_expand_head(). */
+void ___pskb_trim(struct sk_buff *skb, unsigned int len)
+{
+	int offset = skb_headlen(skb);
+	int nfrags = skb_shinfo(skb)->nr_frags;
+	int i;
+
+	for (i=0; i<nfrags; i++) {
+		int end = offset + skb_shinfo(skb)->frags[i].size;
+		if (end > len) {
+			if (len <= offset) {
+				put_page(skb_shinfo(skb)->frags[i].page);
+				skb_shinfo(skb)->nr_frags--;
+			} else {
+				skb_shinfo(skb)->frags[i].size = len-offset;
+			}
+		}
+		offset = end;
+	}
+
+	if (len < skb_headlen(skb)) {
+		skb->len = len;
+		skb->data_len = 0;
+		skb->tail = skb->data + len;
+	} else {
+		skb->data_len -= skb->len - len;
+		skb->len = len;
+	}
+}
+
+/**
+ *	skb_copy_bits - copy data out of a buffer
+ *	@skb: buffer to copy from
+ *	@offset: offset in the buffer, may be negative to reach the headroom
+ *	@to: destination
+ *	@len: bytes to copy
+ *
+ *	Copies from the linear part and the page fragments alike.  Returns
+ *	zero, or -EFAULT if the buffer is shorter than @offset + @len.
+ */
+
+int skb_copy_bits(const struct sk_buff *skb, int offset, void *to, int len)
+{
+	int i, copy;
+	int start = skb_headlen(skb);
+
+	if (offset > (int)skb->len-len)
+		return -EFAULT;
+
+	/* Copy header. */
+	if ((copy = start-offset) > 0) {
+		if (copy > len)
+			copy = len;
+		memcpy(to, skb->data + offset, copy);
+		if ((len -= copy) == 0)
+			return 0;
+		offset += copy;
+		to += copy;
+	}
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		int end = start + frag->size;
+
+		if ((copy = end-offset) > 0) {
+			if (copy > len)
+				copy = len;
+			memcpy(to, page_address(frag->page) + frag->page_offset +
+			       offset - start, copy);
+			if ((len -= copy) == 0)
+				return 0;
+			offset += copy;
+			to += copy;
+		}
+		start = end;
+	}
+	if (len)
+		return -EFAULT;
+	return 0;
+}
+
+/**
+ *	skb_checksum - checksum part of a buffer
+ *	@skb: buffer to checksum
+ *	@offset: where to start, from skb->data
+ *	@len: bytes to checksum
+ *	@csum: initial value
+ *
+ *	Like csum_partial(), over the linear part and the page fragments.
+ */
+
+unsigned int skb_checksum(const struct sk_buff *skb, int offset, int len,
+			  unsigned int csum)
+{
+	int i, copy;
+	int start = skb_headlen(skb);
+	int pos = 0;
+
+	/* Checksum header. */
+	if ((copy = start-offset) > 0) {
+		if (copy > len)
+			copy = len;
+		csum = csum_partial(skb->data+offset, copy, csum);
+		if ((len -= copy) == 0)
+			return csum;
+		offset += copy;
+		pos = copy;
+	}
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		int end = start + frag->size;
+
+		if ((copy = end-offset) > 0) {
+			unsigned int csum2;
+
+			if (copy > len)
+				copy = len;
+			csum2 = csum_partial(page_address(frag->page) +
+					     frag->page_offset + offset - start,
+					     copy, 0);
+			csum = csum_block_add(csum, csum2, pos);
+			if ((len -= copy) == 0)
+				return csum;
+			offset += copy;
+			pos += copy;
+		}
+		start = end;
+	}
+	if (len)
+		BUG();
+	return csum;
+}
+
+/**
+ *	skb_tso_segment - cut a large TCP frame into its segments
+ *	@skb: TCP/IPv4 frame with tso_size set and linear headers
+ *	@gfp_mask: allocation priority
+ *
+ *	Does for a device without NETIF_F_TSO what the hardware would:
+ *	each segment gets a copy of the headers, fixed up for its sequence
+ *	number, length and IP id, and shares the page fragments of @skb
+ *	holding its payload.  The TCP checksums are left as CHECKSUM_HW.
+ *	Returns the segments chained through ->next, or %NULL if out of
+ *	memory.  @skb itself is left alone.
+ */
+
+struct sk_buff *skb_tso_segment(struct sk_buff *skb, int gfp_mask)
+{
+	struct sk_buff *segs = NULL;
+	struct sk_buff **tail = &segs;
+	unsigned int mss = skb_shinfo(skb)->tso_size;
+	unsigned int headroom = skb_headroom(skb);
+	unsigned int doffset = skb->h.raw + (skb->h.th->doff<<2) - skb->data;
+	unsigned int offset = doffset;
+	u32 seq = ntohl(skb->h.th->seq);
+	u16 id = ntohs(skb->nh.iph->id);
+
+	while (offset < skb->len) {
+		struct sk_buff *nskb;
+		struct iphdr *iph;
+		struct tcphdr *th;
+		unsigned int len = skb->len - offset;
+		unsigned int hsize = 0;
+		int pos, i;
+
+		if (len > mss)
+			len = mss;
+		/* Payload still in the linear part is copied. */
+		if (skb_headlen(skb) > offset)
+			hsize = skb_headlen(skb) - offset;
+		if (hsize > len)
+			hsize = len;
+
+		nskb = alloc_skb(headroom + doffset + hsize, gfp_mask);
+		if (nskb == NULL)
+			goto nomem;
+		skb_reserve(nskb, headroom);
+		memcpy(skb_put(nskb, doffset), skb->data, doffset);
+		memcpy(skb_put(nskb, hsize), skb->data + offset, hsize);
+		copy_skb_header(nskb, skb);
+		skb_shinfo(nskb)->tso_size = 0;
+		skb_shinfo(nskb)->tso_segs = 0;
+
+		/* The rest is shared. */
+		pos = skb_headlen(skb);
+		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+			skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+			int start = offset + hsize;
+			int end = offset + len;
+
+			if (pos + frag->size > start && pos < end) {
+				int off = start > pos ? start - pos : 0;
+				int size = (pos + frag->size < end ? pos + frag->size : end) - (pos + off);
+
+				get_page(frag->page);
+				skb_add_frag(nskb, frag->page, frag->page_offset + off, size);
+			}
+			pos += frag->size;
+		}
+
+		iph = nskb->nh.iph;
+		iph->tot_len = htons(nskb->len - (nskb->nh.raw - nskb->data));
+		if (!(iph->frag_off & __constant_htons(IP_DF)))
+			iph->id = htons(id++);
+		iph->check = 0;
+		iph->check = ip_fast_csum((unsigned char *)iph, iph->ihl);
+
+		th = nskb->h.th;
+		th->seq = htonl(seq);
+		if (offset != doffset)
+			th->cwr = 0;
+		if (offset + len < skb->len)
+			th->fin = th->psh = 0;
+		th->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr,
+					       nskb->len - (nskb->h.raw - nskb->data),
+					       IPPROTO_TCP, 0);
+		nskb->csum = offsetof(struct tcphdr, check);
+		nskb->ip_summed = CHECKSUM_HW;
+
+		seq += len;
+		offset += len;
+		*tail = nskb;
+		tail = &nskb->next;
+	}
+	return segs;
+
+nomem:
+	while (segs != NULL) {
+		struct sk_buff *next = segs->next;
+
+		kfree_skb(segs);
+		segs = next;
+	}
+	return NULL;
+}
+
 #if 0
 /* 
  * 	Tune the memory allocator for a new MTU size.
@@ -464,12 +1042,67 @@ struct sk_buff *skb_copy_expand(const struct sk_buff *skb,
 void skb_add_mtu(int mtu)
 {
 	/* Must match allocation in alloc_skb */
-	mtu = ((mtu + 15) & ~15) + sizeof(atomic_t);
+	mtu = ((mtu + 15) & ~15) + sizeof(struct skb_shared_info);
 
 	kmem_add_cache_size(mtu);
 }
 #endif
 
+#ifdef CONFIG_PROC_FS
+/* Percentage, without overflowing on large counts. */
+static unsigned int skb_recycle_pct(unsigned int part, unsigned int total)
+{
+	while (part > ~0U/100) {
+		part >>= 1;
+		total >>= 1;
+	}
+	return total ? part*100/total : 0;
+}
+
+static int skb_recycle_read_proc(char *buffer, char **start, off_t offset,
+				 int length, int *eof, void *data)
+{
+	struct skb_recycle_pool *pool;
+	int len;
+
+	len = sprintf(buffer, "Pool      Size     Hits   Misses Recycled Released Overflow Hit%%\n");
+	spin_lock(&skb_recycle_lock);
+	for (pool = skb_recycle_pools; pool != NULL; pool = pool->next) {
+		struct skb_recycle_stat s;
+		int i, lcpu;
+
+		memset(&s, 0, sizeof(s));
+		for (lcpu = 0; lcpu < smp_num_cpus; lcpu++) {
+			i = cpu_logical_map(lcpu);
+			s.hits += pool->cpu[i].stat.hits;
+			s.misses += pool->cpu[i].stat.misses;
+			s.recycled += pool->cpu[i].stat.recycled;
+			s.released += pool->cpu[i].stat.released;
+			s.overflow += pool->cpu[i].stat.overflow;
+		}
+		len += sprintf(buffer+len, "%-8s %5u %8u %8u %8u %8u %8u %3u\n",
+			       pool->name, pool->size, s.hits, s.misses,
+			       s.recycled, s.released, s.overflow,
+			       skb_recycle_pct(s.hits, s.hits + s.misses));
+		if (len > PAGE_SIZE - 80)
+			break;
+	}
+	spin_unlock(&skb_recycle_lock);
+
+	len -= offset;
+
+	if (len > length)
+		len = length;
+	if (len < 0)
+		len = 0;
+
+	*start = buffer + offset;
+	*eof = 1;
+
+	return len;
+}
+#endif
+
 void __init skb_init(void)
 {
 	int i;
@@ -484,4 +1117,8 @@ void __init skb_init(void)
 
 	for (i=0; i<NR_CPUS; i++)
 		skb_queue_head_init(&skb_head_pool[i].list);
+
+#ifdef CONFIG_PROC_FS
+	create_proc_read_entry("net/skb_recycle", 0, 0, skb_recycle_read_proc, NULL);
+#endif
 }
@@ -19,6 +19,10 @@ extern int mod_cong;
 extern int netdev_fastroute;
 extern int net_msg_cost;
 extern int net_msg_burst;
+#ifdef CONFIG_SMP
+extern int netdev_rps;
+extern int netdev_tx_batch;
+#endif
 
 extern __u32 sysctl_wmem_max;
 extern __u32 sysctl_rmem_max;
@@ -67,6 +71,14 @@ ctl_table core_table[] = {
 	 &netdev_fastroute, sizeof(int), 0644, NULL,
 	 &proc_dointvec},
 #endif
+#ifdef CONFIG_SMP
+	{NET_CORE_RPS, "netdev_rps",
+	 &netdev_rps, sizeof(int), 0644, NULL,
+	 &proc_dointvec},
+#endif
+	{NET_CORE_TX_BATCH, "netdev_tx_batch",
+	 &netdev_tx_batch, sizeof(int), 0644, NULL,
+	 &proc_dointvec},
 	{NET_CORE_MSG_COST, "message_cost",
 	 &net_msg_cost, sizeof(int), 0644, NULL,
 	 &proc_dointvec_jiffies},
@@ -31,6 +31,7 @@
 #include <linux/string.h>
 #include <linux/netfilter_decnet.h>
 #include <linux/spinlock.h>
+#include <linux/jhash.h>
 #include <asm/atomic.h>
 #include <net/neighbour.h>
 #include <net/dst.h>
@@ -131,13 +132,7 @@ struct neigh_table dn_neigh_table = {
 
 static u32 dn_neigh_hash(const void *pkey, const struct net_device *dev)
 {
-	u32 hash_val;
-
-	hash_val = *(dn_address *)pkey;
-	hash_val ^= (hash_val >> 10);
-	hash_val ^= (hash_val >> 3);
-
-	return hash_val & NEIGH_HASHMASK;
+	return jhash_1word(*(dn_address *)pkey, dn_neigh_table.hash_rnd);
 }
 
 static int dn_neigh_construct(struct neighbour *neigh)
@@ -396,9 +391,8 @@ struct neighbour *dn_neigh_lookup(struct neigh_table *tbl, void *ptr)
 	struct neighbour *neigh;
 	u32 hash_val;
 
-	hash_val = tbl->hash(ptr, NULL);
-
 	read_lock_bh(&tbl->lock);
+	hash_val = tbl->hash(ptr, NULL) & tbl->hash_mask;
 	for(neigh = tbl->hash_buckets[hash_val]; neigh != NULL; neigh = neigh->next) {
 		if (memcmp(neigh->primary_key, ptr, tbl->key_len) == 0) {
 			atomic_inc(&neigh->refcnt);
@@ -560,7 +554,7 @@ int dn_neigh_elist(struct net_device *dev, unsigned char *ptr, int n)
 
 	read_lock_bh(&tbl->lock);
 
-	for(i = 0; i < NEIGH_HASHMASK; i++) {
+	for(i = 0; i <= tbl->hash_mask; i++) {
 		for(neigh = tbl->hash_buckets[i]; neigh != NULL; neigh = neigh->next) {
 			if (neigh->dev != dev)
 				continue;
@@ -603,8 +597,8 @@ static int dn_neigh_get_info(char *buffer, char **start, off_t offset, int lengt
 
 	len += sprintf(buffer + len, "Addr    Flags State Use Blksize Dev\n");
 
-	for(i=0;i <= NEIGH_HASHMASK; i++) {
-		read_lock_bh(&dn_neigh_table.lock);
+	read_lock_bh(&dn_neigh_table.lock);
+	for(i=0;i <= dn_neigh_table.hash_mask; i++) {
 		n = dn_neigh_table.hash_buckets[i];
 		for(; n != NULL; n = n->next) {
 			struct dn_neigh *dn = (struct dn_neigh *)n;
@@ -633,8 +627,8 @@ static int dn_neigh_get_info(char *buffer, char **start, off_t offset, int lengt
                        		goto done;
 			}
 		}
-		read_unlock_bh(&dn_neigh_table.lock);
 	}
+	read_unlock_bh(&dn_neigh_table.lock);
 
 done:
 
@@ -371,7 +371,8 @@ static int inet_create(struct socket *sock, int protocol)
 	sk->protinfo.af_inet.mc_loop=1;
 	sk->protinfo.af_inet.mc_ttl=1;
 	sk->protinfo.af_inet.mc_index=0;
-	sk->protinfo.af_inet.mc_list=NULL;
+	sk->protinfo.af_inet.mc_hash=NULL;
+	sk->protinfo.af_inet.mc_count=0;
 
 #ifdef INET_REFCNT_DEBUG
 	atomic_inc(&inet_sock_nr);
@@ -724,6 +725,12 @@ int inet_recvmsg(struct socket *sock, struct msghdr *msg, int size,
 	int addr_len = 0;
 	int err;
 
+#ifdef CONFIG_SMP
+	/* Have netif_rx() steer this flow to us from now on. */
+	if (netdev_rps)
+		netdev_rps_record(sk->daddr, sk->rcv_saddr, sk->dport, sk->sport);
+#endif
+
 	err = sk->prot->recvmsg(sk, msg, size, flags&MSG_DONTWAIT,
 				flags&~MSG_DONTWAIT, &addr_len);
 	if (err >= 0)
@@ -744,6 +751,28 @@ int inet_sendmsg(struct socket *sock, struct msghdr *msg, int size,
 	return sk->prot->sendmsg(sk, msg, size);
 }
 
+ssize_t inet_sendpage(struct socket *sock, struct page *page, int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+
+	/* We may need to bind the socket. */
+	if (sk->num==0 && inet_autobind(sk) != 0)
+		return -EAGAIN;
+
+	if (sk->prot->sendpage)
+		return sk->prot->sendpage(sk, page, offset, size, flags);
+	return sock_no_sendpage(sock, page, offset, size, flags);
+}
+
+ssize_t inet_receive_file(struct socket *sock, struct file *file, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+
+	if (!sk->prot->receive_file)
+		return -EINVAL;
+	return sk->prot->receive_file(sk, file, size, flags & MSG_DONTWAIT);
+}
+
 int inet_shutdown(struct socket *sock, int how)
 {
 	struct sock *sk = sock->sk;
@@ -934,7 +963,9 @@ struct proto_ops inet_stream_ops = {
 	getsockopt:	inet_getsockopt,
 	sendmsg:	inet_sendmsg,
 	recvmsg:	inet_recvmsg,
-	mmap:		sock_no_mmap
+	mmap:		sock_no_mmap,
+	sendpage:	inet_sendpage,
+	receive_file:	inet_receive_file,
 };
 
 struct proto_ops inet_dgram_ops = {
@@ -955,6 +986,7 @@ struct proto_ops inet_dgram_ops = {
 	sendmsg:	inet_sendmsg,
 	recvmsg:	inet_recvmsg,
 	mmap:		sock_no_mmap,
+	sendpage:	inet_sendpage,
 };
 
 struct net_proto_family inet_family_ops = {
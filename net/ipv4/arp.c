@@ -100,6 +100,7 @@
 #include <linux/init.h>
 #ifdef CONFIG_SYSCTL
 #include <linux/sysctl.h>
+#include <linux/jhash.h>
 #endif
 
 #include <net/ip.h>
@@ -221,15 +222,7 @@ int arp_mc_map(u32 addr, u8 *haddr, struct net_device *dev, int dir)
 
 static u32 arp_hash(const void *pkey, const struct net_device *dev)
 {
-	u32 hash_val;
-
-	hash_val = *(u32*)pkey;
-	hash_val ^= (hash_val>>16);
-	hash_val ^= hash_val>>8;
-	hash_val ^= hash_val>>3;
-	hash_val = (hash_val^dev->ifindex)&NEIGH_HASHMASK;
-
-	return hash_val;
+	return jhash_2words(*(u32*)pkey, dev->ifindex, arp_tbl.hash_rnd);
 }
 
 static int arp_constructor(struct neighbour *neigh)
@@ -1031,9 +1024,9 @@ static int arp_get_info(char *buffer, char **start, off_t offset, int length)
 	pos+=size;
 	len+=size;
 
-	for(i=0; i<=NEIGH_HASHMASK; i++) {
+	read_lock_bh(&arp_tbl.lock);
+	for(i=0; i<=arp_tbl.hash_mask; i++) {
 		struct neighbour *n;
-		read_lock_bh(&arp_tbl.lock);
 		for (n=arp_tbl.hash_buckets[i]; n; n=n->next) {
 			struct net_device *dev = n->dev;
 			int hatype = dev->type;
@@ -1087,8 +1080,8 @@ static int arp_get_info(char *buffer, char **start, off_t offset, int length)
  				goto done;
 			}
 		}
-		read_unlock_bh(&arp_tbl.lock);
 	}
+	read_unlock_bh(&arp_tbl.lock);
 
 	for (i=0; i<=PNEIGH_HASHMASK; i++) {
 		struct pneigh_entry *n;
@@ -831,8 +831,7 @@ fn_hash_dump_zone(struct sk_buff *skb, struct netlink_callback *cb,
 	int h, s_h;
 
 	s_h = cb->args[2];
-	for (h=0; h < fz->fz_divisor; h++) {
-		if (h < s_h) continue;
+	for (h=s_h; h < fz->fz_divisor; h++) {
 		if (h > s_h)
 			memset(&cb->args[3], 0, sizeof(cb->args) - 3*sizeof(cb->args[0]));
 		if (fz->fz_hash == NULL || fz->fz_hash[h] == NULL)
@@ -876,6 +875,13 @@ static void rtmsg_fib(int event, struct fib_node* f, int z, int tb_id,
 	u32 pid = req ? req->pid : 0;
 	int size = NLMSG_SPACE(sizeof(struct rtmsg)+256);
 
+	/* Loading a large table is dominated by notifications nobody
+	 * listens to; do not even build them.
+	 */
+	if (!(n->nlmsg_flags&NLM_F_ECHO) &&
+	    !netlink_has_listeners(rtnl, pid, RTMGRP_IPV4_ROUTE))
+		return;
+
 	skb = alloc_skb(size, GFP_KERNEL);
 	if (!skb)
 		return;
@@ -0,0 +1,1446 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		IPv4 FIB: lookup engine based on a level compressed trie.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * An alternative to fib_hash.c with the same fib_table interface.
+ * fib_hash probes one hash zone per prefix length, so with a full
+ * Internet table a lookup that misses the route cache costs up to 33
+ * hash probes.  Here a lookup is a walk down a trie of some five
+ * levels for such a table.
+ *
+ * The trie follows S. Nilsson and G. Karlsson, "IP-address lookup
+ * using LC-tries": internal nodes (tnodes) index 2^bits children by
+ * bits [pos, pos+bits) of the key, counting from the most significant
+ * bit.  Bits between a parent's index and a child's pos are skipped
+ * (path compression).  A tnode doubles its fan-out when at least half
+ * of the resulting slots would be used, and halves it when fewer than
+ * a quarter are used (level compression).
+ *
+ * Leaves hold one key each; all prefixes with that key hang off the
+ * leaf, longest first, each with a chain of routes kept in the same
+ * order fib_hash keeps a chain with one key.
+ *
+ * Locking: readers take fib_trie_lock for reading.  Updates are
+ * serialized by the RTNL semaphore; they build new nodes without the
+ * lock and only take it for writing to link them in.  Nodes replaced
+ * this way are freed after the lock is dropped.  Parent pointers are
+ * used by updates only.
+ */
+
+#include <linux/config.h>
+#include <asm/uaccess.h>
+#include <asm/system.h>
+#include <asm/bitops.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <linux/errno.h>
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/proc_fs.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <linux/init.h>
+
+#include <net/ip.h>
+#include <net/protocol.h>
+#include <net/route.h>
+#include <net/tcp.h>
+#include <net/sock.h>
+#include <net/ip_fib.h>
+
+/* Keys are addresses in host byte order. */
+typedef u32 t_key;
+
+#define KEYLENGTH	32
+
+#define MASK_PFX(k, l)	((l) == 0 ? 0 : ((k) >> (KEYLENGTH-(l))) << (KEYLENGTH-(l)))
+
+#define T_TNODE		0
+#define T_LEAF		1
+
+#define IS_TNODE(n)	((n)->type == T_TNODE)
+#define IS_LEAF(n)	((n)->type == T_LEAF)
+
+/* The common head of leaves and tnodes. */
+struct node
+{
+	t_key			key;
+	unsigned char		type;
+	struct tnode		*parent;
+};
+
+struct leaf
+{
+	t_key			key;
+	unsigned char		type;
+	struct tnode		*parent;
+	struct leaf_info	*list;		/* prefixes, longest first */
+};
+
+struct leaf_info
+{
+	struct leaf_info	*next;
+	int			plen;
+	t_key			mask;
+	struct fib_node		*fa_head;	/* routes to this prefix */
+};
+
+struct tnode
+{
+	t_key			key;		/* bits past pos are zero */
+	unsigned char		type;
+	struct tnode		*parent;
+	unsigned char		pos;		/* first bit of the index */
+	unsigned char		bits;		/* 2^bits children */
+	unsigned int		full_children;	/* children with no skipped bits */
+	unsigned int		empty_children;
+	struct node		*child[0];
+};
+
+struct fib_node
+{
+	struct fib_node		*fn_next;
+	struct fib_info		*fn_info;
+#define FIB_INFO(f)	((f)->fn_info)
+	u8			fn_tos;
+	u8			fn_type;
+	u8			fn_scope;
+	u8			fn_state;
+};
+
+#define FN_S_ACCESSED	2
+
+struct trie_use_stats
+{
+	unsigned int		gets;		/* lookups */
+	unsigned int		backtrack;	/* retries with shorter prefixes */
+	unsigned int		misses;		/* lookups without a route */
+} ____cacheline_aligned;
+
+struct trie
+{
+	struct node		*trie;
+	struct trie		*next;		/* for /proc/net/fib_triestat */
+	int			id;
+	struct trie_use_stats	stats[NR_CPUS];
+};
+
+/* Resize thresholds, in percent of the slots in use. */
+#define TNODE_INFLATE_THRESHOLD	50
+#define TNODE_HALVE_THRESHOLD	25
+#define TNODE_MAX_BITS		16
+
+static kmem_cache_t *fn_alias_kmem;
+static kmem_cache_t *trie_leaf_kmem;
+
+static rwlock_t fib_trie_lock = RW_LOCK_UNLOCKED;
+
+/* Nodes unlinked by the update in progress, chained through ->parent. */
+static struct node *trie_pending_free;
+
+static struct trie *trie_list;
+
+static __inline__ t_key tkey_extract_bits(t_key a, int offset, int bits)
+{
+	return (t_key)(a << offset) >> (KEYLENGTH - bits);
+}
+
+/* The first bit where a and b differ, or KEYLENGTH. */
+static __inline__ int tkey_mismatch(t_key a, t_key b)
+{
+	t_key diff = a ^ b;
+	int i = 0;
+
+	if (!diff)
+		return KEYLENGTH;
+	while (!(diff & (1U << (KEYLENGTH-1)))) {
+		diff <<= 1;
+		i++;
+	}
+	return i;
+}
+
+static __inline__ int tnode_child_length(struct tnode *tn)
+{
+	return 1 << tn->bits;
+}
+
+static __inline__ int tnode_full(struct tnode *tn, struct node *n)
+{
+	return n && IS_TNODE(n) &&
+		((struct tnode *)n)->pos == tn->pos + tn->bits;
+}
+
+static __inline__ int tnode_size(int bits)
+{
+	return sizeof(struct tnode) + (1 << bits) * sizeof(struct node *);
+}
+
+static struct tnode *tnode_new(t_key key, int pos, int bits)
+{
+	int size = tnode_size(bits);
+	struct tnode *tn;
+
+	if (size <= PAGE_SIZE)
+		tn = kmalloc(size, GFP_KERNEL);
+	else
+		tn = (struct tnode *)__get_free_pages(GFP_KERNEL, get_order(size));
+	if (tn == NULL)
+		return NULL;
+
+	memset(tn, 0, size);
+	tn->type = T_TNODE;
+	tn->key = MASK_PFX(key, pos);
+	tn->pos = pos;
+	tn->bits = bits;
+	tn->empty_children = 1 << bits;
+	return tn;
+}
+
+static void tnode_free(struct tnode *tn)
+{
+	int size = tnode_size(tn->bits);
+
+	if (size <= PAGE_SIZE)
+		kfree(tn);
+	else
+		free_pages((unsigned long)tn, get_order(size));
+}
+
+static struct leaf *leaf_new(t_key key)
+{
+	struct leaf *l = kmem_cache_alloc(trie_leaf_kmem, SLAB_KERNEL);
+
+	if (l) {
+		l->key = key;
+		l->type = T_LEAF;
+		l->parent = NULL;
+		l->list = NULL;
+	}
+	return l;
+}
+
+static struct leaf_info *leaf_info_new(int plen)
+{
+	struct leaf_info *li = kmalloc(sizeof(struct leaf_info), GFP_KERNEL);
+
+	if (li) {
+		li->next = NULL;
+		li->plen = plen;
+		li->mask = MASK_PFX(~0U, plen);
+		li->fa_head = NULL;
+	}
+	return li;
+}
+
+static void fn_free_node(struct fib_node *f)
+{
+	fib_release_info(FIB_INFO(f));
+	kmem_cache_free(fn_alias_kmem, f);
+}
+
+static void trie_defer_free(struct node *n)
+{
+	n->parent = (struct tnode *)trie_pending_free;
+	trie_pending_free = n;
+}
+
+static void trie_free_pending(void)
+{
+	struct node *n;
+
+	while ((n = trie_pending_free) != NULL) {
+		trie_pending_free = (struct node *)n->parent;
+		if (IS_LEAF(n))
+			kmem_cache_free(trie_leaf_kmem, n);
+		else
+			tnode_free((struct tnode *)n);
+	}
+}
+
+/* Set a child of a tnode, keeping the counters right.  The tnode must
+ * not be visible to readers yet, or fib_trie_lock must be held.
+ */
+static void put_child(struct tnode *tn, int i, struct node *n)
+{
+	struct node *chi = tn->child[i];
+
+	if (n == NULL && chi != NULL)
+		tn->empty_children++;
+	else if (n != NULL && chi == NULL)
+		tn->empty_children--;
+
+	if (tnode_full(tn, chi) && !tnode_full(tn, n))
+		tn->full_children--;
+	else if (!tnode_full(tn, chi) && tnode_full(tn, n))
+		tn->full_children++;
+
+	if (n)
+		n->parent = tn;
+	tn->child[i] = n;
+}
+
+/* Link n into the live trie, in slot i of tp or as the root. */
+static void trie_replace(struct trie *t, struct tnode *tp, int i, struct node *n)
+{
+	write_lock_bh(&fib_trie_lock);
+	if (tp)
+		put_child(tp, i, n);
+	else {
+		t->trie = n;
+		if (n)
+			n->parent = NULL;
+	}
+	write_unlock_bh(&fib_trie_lock);
+
+	trie_free_pending();
+}
+
+static struct node *resize(struct tnode *tn);
+
+/* Double the fan-out of tn.  Returns the new tnode, or tn itself if
+ * memory ran out; tn is left untouched in that case.
+ */
+static struct tnode *inflate(struct tnode *tn)
+{
+	struct tnode *oldtnode = tn;
+	int olen = tnode_child_length(tn);
+	int i;
+
+	tn = tnode_new(oldtnode->key, oldtnode->pos, oldtnode->bits + 1);
+	if (tn == NULL)
+		return oldtnode;
+
+	/* A full child with more than one bit is split in two.  Allocate
+	 * the halves first, so that failure leaves nothing to undo; they
+	 * wait in the slots they will end up in.
+	 */
+	for (i = 0; i < olen; i++) {
+		struct tnode *inode = (struct tnode *)oldtnode->child[i];
+		struct tnode *left, *right;
+		t_key m;
+
+		if (!tnode_full(oldtnode, (struct node *)inode) || inode->bits == 1)
+			continue;
+
+		m = 1U << (KEYLENGTH - 1 - inode->pos);
+		left = tnode_new(inode->key & ~m, inode->pos + 1, inode->bits - 1);
+		right = tnode_new(inode->key | m, inode->pos + 1, inode->bits - 1);
+		if (left == NULL || right == NULL) {
+			if (left)
+				tnode_free(left);
+			if (right)
+				tnode_free(right);
+			goto nomem;
+		}
+		tn->child[2*i] = (struct node *)left;
+		tn->child[2*i+1] = (struct node *)right;
+	}
+
+	for (i = 0; i < olen; i++) {
+		struct node *node = oldtnode->child[i];
+		struct tnode *inode, *left, *right;
+		int size, j;
+
+		if (node == NULL)
+			continue;
+
+		/* A leaf or a node with skipped bits: the new index bit
+		 * is in its key.
+		 */
+		if (!tnode_full(oldtnode, node)) {
+			put_child(tn, tkey_extract_bits(node->key, tn->pos, tn->bits), node);
+			continue;
+		}
+
+		inode = (struct tnode *)node;
+
+		/* A full child with one bit: its children move up. */
+		if (inode->bits == 1) {
+			put_child(tn, 2*i, inode->child[0]);
+			put_child(tn, 2*i+1, inode->child[1]);
+			trie_defer_free(node);
+			continue;
+		}
+
+		/* Otherwise the lower half of its children goes left,
+		 * the upper half right.
+		 */
+		left = (struct tnode *)tn->child[2*i];
+		right = (struct tnode *)tn->child[2*i+1];
+		tn->child[2*i] = tn->child[2*i+1] = NULL;
+
+		size = tnode_child_length(left);
+		for (j = 0; j < size; j++) {
+			put_child(left, j, inode->child[j]);
+			put_child(right, j, inode->child[j + size]);
+		}
+		put_child(tn, 2*i, resize(left));
+		put_child(tn, 2*i+1, resize(right));
+		trie_defer_free(node);
+	}
+	trie_defer_free((struct node *)oldtnode);
+	return tn;
+
+nomem:
+	for (i = 0; i < tnode_child_length(tn); i++)
+		if (tn->child[i])
+			tnode_free((struct tnode *)tn->child[i]);
+	tnode_free(tn);
+	return oldtnode;
+}
+
+/* Halve the fan-out of tn; see inflate() for the return value. */
+static struct tnode *halve(struct tnode *tn)
+{
+	struct tnode *oldtnode = tn;
+	int olen = tnode_child_length(tn);
+	int i;
+
+	tn = tnode_new(oldtnode->key, oldtnode->pos, oldtnode->bits - 1);
+	if (tn == NULL)
+		return oldtnode;
+
+	/* Two children sharing a slot need a binary node above them. */
+	for (i = 0; i < olen; i += 2) {
+		struct node *left = oldtnode->child[i];
+		struct node *right = oldtnode->child[i+1];
+		struct tnode *newn;
+
+		if (left == NULL || right == NULL)
+			continue;
+
+		newn = tnode_new(left->key, tn->pos + tn->bits, 1);
+		if (newn == NULL)
+			goto nomem;
+		tn->child[i/2] = (struct node *)newn;
+	}
+
+	for (i = 0; i < olen; i += 2) {
+		struct node *left = oldtnode->child[i];
+		struct node *right = oldtnode->child[i+1];
+		struct tnode *newn;
+
+		if (left == NULL) {
+			if (right)
+				put_child(tn, i/2, right);
+			continue;
+		}
+		if (right == NULL) {
+			put_child(tn, i/2, left);
+			continue;
+		}
+
+		newn = (struct tnode *)tn->child[i/2];
+		tn->child[i/2] = NULL;
+		put_child(newn, 0, left);
+		put_child(newn, 1, right);
+		put_child(tn, i/2, resize(newn));
+	}
+	trie_defer_free((struct node *)oldtnode);
+	return tn;
+
+nomem:
+	for (i = 0; i < tnode_child_length(tn); i++)
+		if (tn->child[i])
+			tnode_free((struct tnode *)tn->child[i]);
+	tnode_free(tn);
+	return oldtnode;
+}
+
+/* If tn has a single child, drop tn and return the child. */
+static struct node *tnode_collapse(struct tnode *tn)
+{
+	int i;
+
+	for (i = 0; i < tnode_child_length(tn); i++) {
+		struct node *n = tn->child[i];
+
+		if (n) {
+			trie_defer_free((struct node *)tn);
+			return n;
+		}
+	}
+	return NULL;
+}
+
+/* Returns what should replace tn in its parent: tn, a resized copy,
+ * its only child, or NULL.
+ */
+static struct node *resize(struct tnode *tn)
+{
+	struct tnode *ntn;
+
+	if (tn->empty_children == tnode_child_length(tn)) {
+		trie_defer_free((struct node *)tn);
+		return NULL;
+	}
+	if (tn->empty_children == tnode_child_length(tn) - 1)
+		return tnode_collapse(tn);
+
+	while (tn->full_children > 0 && tn->bits < TNODE_MAX_BITS &&
+	       TNODE_INFLATE_THRESHOLD * 2 * tnode_child_length(tn) <=
+	       100 * (tnode_child_length(tn) - tn->empty_children + tn->full_children)) {
+		ntn = inflate(tn);
+		if (ntn == tn)
+			break;
+		tn = ntn;
+	}
+
+	while (tn->bits > 1 &&
+	       100 * (tnode_child_length(tn) - tn->empty_children) <
+	       TNODE_HALVE_THRESHOLD * tnode_child_length(tn)) {
+		ntn = halve(tn);
+		if (ntn == tn)
+			break;
+		tn = ntn;
+	}
+
+	if (tn->empty_children == tnode_child_length(tn) - 1)
+		return tnode_collapse(tn);
+	return (struct node *)tn;
+}
+
+/* Resize tn and every tnode above it. */
+static void trie_rebalance(struct trie *t, struct tnode *tn)
+{
+	while (tn) {
+		struct tnode *tp = tn->parent;
+		t_key key = tn->key;
+		struct node *n;
+
+		n = resize(tn);
+		if (n != (struct node *)tn)
+			trie_replace(t, tp, tp ? tkey_extract_bits(key, tp->pos, tp->bits) : 0, n);
+		tn = tp;
+	}
+}
+
+static struct leaf *fib_find_leaf(struct trie *t, t_key key)
+{
+	struct node *n = t->trie;
+
+	while (n && IS_TNODE(n)) {
+		struct tnode *tn = (struct tnode *)n;
+
+		n = tn->child[tkey_extract_bits(key, tn->pos, tn->bits)];
+	}
+	if (n && n->key == key)
+		return (struct leaf *)n;
+	return NULL;
+}
+
+static struct leaf_info *fib_find_prefix(struct trie *t, t_key key, int plen)
+{
+	struct leaf *l = fib_find_leaf(t, key);
+	struct leaf_info *li;
+
+	if (l == NULL)
+		return NULL;
+	for (li = l->list; li; li = li->next)
+		if (li->plen == plen)
+			return li;
+	return NULL;
+}
+
+/* Add the prefix key/plen with its first route f. */
+static struct leaf_info *
+fib_insert_prefix(struct trie *t, t_key key, int plen, struct fib_node *f)
+{
+	struct node *n = t->trie;
+	struct tnode *tp = NULL, *tn;
+	struct leaf_info *li, **lp;
+	struct leaf *l;
+	int missbit;
+
+	/* Walk down while the tnodes' prefixes match the key. */
+	while (n && IS_TNODE(n)) {
+		tn = (struct tnode *)n;
+		if (MASK_PFX(key, tn->pos) != tn->key)
+			break;
+		tp = tn;
+		n = tn->child[tkey_extract_bits(key, tn->pos, tn->bits)];
+	}
+
+	li = leaf_info_new(plen);
+	if (li == NULL)
+		return NULL;
+	li->fa_head = f;
+
+	if (n && IS_LEAF(n) && n->key == key) {
+		l = (struct leaf *)n;
+		for (lp = &l->list; *lp; lp = &(*lp)->next)
+			if ((*lp)->plen < plen)
+				break;
+		li->next = *lp;
+		write_lock_bh(&fib_trie_lock);
+		*lp = li;
+		write_unlock_bh(&fib_trie_lock);
+		return li;
+	}
+
+	l = leaf_new(key);
+	if (l == NULL) {
+		kfree(li);
+		return NULL;
+	}
+	l->list = li;
+
+	if (n == NULL) {
+		trie_replace(t, tp, tp ? tkey_extract_bits(key, tp->pos, tp->bits) : 0,
+			     (struct node *)l);
+		tn = tp;
+	} else {
+		/* A binary node where the new key parts from n. */
+		tn = tnode_new(key, tkey_mismatch(key, n->key), 1);
+		if (tn == NULL) {
+			kmem_cache_free(trie_leaf_kmem, l);
+			kfree(li);
+			return NULL;
+		}
+		missbit = tkey_extract_bits(key, tn->pos, 1);
+		put_child(tn, missbit, (struct node *)l);
+		put_child(tn, 1 - missbit, n);
+		trie_replace(t, tp, tp ? tkey_extract_bits(key, tp->pos, tp->bits) : 0,
+			     (struct node *)tn);
+	}
+	trie_rebalance(t, tn);
+	return li;
+}
+
+static void trie_leaf_remove(struct trie *t, struct leaf *l)
+{
+	struct tnode *tp = l->parent;
+
+	trie_defer_free((struct node *)l);
+	trie_replace(t, tp, tp ? tkey_extract_bits(l->key, tp->pos, tp->bits) : 0, NULL);
+	trie_rebalance(t, tp);
+}
+
+/* Unlink an emptied prefix from its leaf, and the leaf if it is empty. */
+static void trie_prefix_remove(struct trie *t, struct leaf *l, struct leaf_info *li)
+{
+	struct leaf_info **lp;
+
+	for (lp = &l->list; *lp != li; lp = &(*lp)->next)
+		;
+	write_lock_bh(&fib_trie_lock);
+	*lp = li->next;
+	write_unlock_bh(&fib_trie_lock);
+	kfree(li);
+
+	if (l->list == NULL)
+		trie_leaf_remove(t, l);
+}
+
+static struct leaf *trie_leftmost(struct node *n)
+{
+	while (n && IS_TNODE(n)) {
+		struct tnode *tn = (struct tnode *)n;
+		int i;
+
+		for (i = 0; i < tnode_child_length(tn); i++)
+			if (tn->child[i])
+				break;
+		if (i == tnode_child_length(tn))
+			return NULL;
+		n = tn->child[i];
+	}
+	return (struct leaf *)n;
+}
+
+/* The leaf with the smallest key not below key, for walking the trie
+ * in key order without parent pointers.
+ */
+static struct leaf *trie_leaf_ge(struct node *n, t_key key)
+{
+	struct tnode *tn;
+	struct leaf *l;
+	int i;
+
+	if (n == NULL)
+		return NULL;
+	if (IS_LEAF(n))
+		return n->key >= key ? (struct leaf *)n : NULL;
+
+	tn = (struct tnode *)n;
+	if (MASK_PFX(key, tn->pos) != tn->key)
+		return MASK_PFX(key, tn->pos) < tn->key ? trie_leftmost(n) : NULL;
+
+	i = tkey_extract_bits(key, tn->pos, tn->bits);
+	if ((l = trie_leaf_ge(tn->child[i], key)) != NULL)
+		return l;
+	for (i++; i < tnode_child_length(tn); i++)
+		if (tn->child[i])
+			return trie_leftmost(tn->child[i]);
+	return NULL;
+}
+
+static __inline__ struct leaf *trie_nextleaf(struct trie *t, struct leaf *l)
+{
+	if (l->key == ~0U)
+		return NULL;
+	return trie_leaf_ge(t->trie, l->key + 1);
+}
+
+/* The longest prefix in the subtree of n that matches key and is no
+ * longer than limit.
+ *
+ * A prefix P/plen lives in the leaf with key P, whose bits past plen
+ * are zero.  Descending along the key finds the prefixes that run
+ * through the index bits of a tnode; shorter ones are in the slots
+ * whose index is the key's with trailing bits cleared, and we look
+ * there with the key cut to match, longest first.  Skipped bits that
+ * differ from the key cap the length, and are only allowed to be
+ * zero after the cap.
+ */
+static struct leaf_info *trie_lpm(struct node *n, t_key key, int limit)
+{
+	struct leaf_info *li, *best = NULL;
+	struct tnode *tn;
+	int pos, bits, m, k;
+	t_key cindex;
+
+	if (IS_LEAF(n)) {
+		for (li = ((struct leaf *)n)->list; li; li = li->next)
+			if (li->plen <= limit && !((key ^ n->key) & li->mask))
+				return li;
+		return NULL;
+	}
+
+	tn = (struct tnode *)n;
+	pos = tn->pos;
+	bits = tn->bits;
+
+	if (MASK_PFX(key, pos) != tn->key) {
+		m = tkey_mismatch(key, tn->key);
+		if (m < limit)
+			limit = m;
+	}
+	if (limit < pos && MASK_PFX(tn->key, limit) != tn->key)
+		return NULL;
+	key = MASK_PFX(key, limit);
+
+	cindex = tkey_extract_bits(key, pos, bits);
+	for (k = 0; k <= bits; k++) {
+		struct node *c;
+		int sub;
+
+		if (k && !(cindex & (1 << (k-1))))
+			continue;
+		sub = limit;
+		if (k && sub > pos + bits - k)
+			sub = pos + bits - k;
+		if (best && best->plen >= sub)
+			break;
+		c = tn->child[cindex & ~((1 << k) - 1)];
+		if (c == NULL)
+			continue;
+		li = trie_lpm(c, key, sub);
+		if (li && (best == NULL || li->plen > best->plen))
+			best = li;
+	}
+	return best;
+}
+
+static int
+fn_trie_lookup(struct fib_table *tb, const struct rt_key *key, struct fib_result *res)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct trie_use_stats *st = &t->stats[smp_processor_id()];
+	t_key k = ntohl(key->dst);
+	struct leaf_info *li;
+	int limit = KEYLENGTH;
+	int err;
+
+	st->gets++;
+	read_lock(&fib_trie_lock);
+	while (t->trie && (li = trie_lpm(t->trie, k, limit)) != NULL) {
+		struct fib_node *f;
+
+		for (f = li->fa_head; f; f = f->fn_next) {
+#ifdef CONFIG_IP_ROUTE_TOS
+			if (f->fn_tos && f->fn_tos != key->tos)
+				continue;
+#endif
+			f->fn_state |= FN_S_ACCESSED;
+
+			if (f->fn_scope < key->scope)
+				continue;
+
+			err = fib_semantic_match(f->fn_type, FIB_INFO(f), key, res);
+			if (err == 0) {
+				res->type = f->fn_type;
+				res->scope = f->fn_scope;
+				res->prefixlen = li->plen;
+				goto out;
+			}
+			if (err < 0)
+				goto out;
+		}
+
+		/* No route to this prefix would take the key. */
+		if (li->plen == 0)
+			break;
+		limit = li->plen - 1;
+		st->backtrack++;
+	}
+	st->misses++;
+	err = 1;
+out:
+	read_unlock(&fib_trie_lock);
+	return err;
+}
+
+static int trie_last_dflt = -1;
+
+static int fib_detect_death(struct fib_info *fi, int order,
+			    struct fib_info **last_resort, int *last_idx)
+{
+	struct neighbour *n;
+	int state = NUD_NONE;
+
+	n = neigh_lookup(&arp_tbl, &fi->fib_nh[0].nh_gw, fi->fib_dev);
+	if (n) {
+		state = n->nud_state;
+		neigh_release(n);
+	}
+	if (state==NUD_REACHABLE)
+		return 0;
+	if ((state&NUD_VALID) && order != trie_last_dflt)
+		return 0;
+	if ((state&NUD_VALID) ||
+	    (*last_idx<0 && order > trie_last_dflt)) {
+		*last_resort = fi;
+		*last_idx = order;
+	}
+	return 1;
+}
+
+static void
+fn_trie_select_default(struct fib_table *tb, const struct rt_key *key, struct fib_result *res)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	int order, last_idx;
+	struct leaf_info *li;
+	struct fib_node *f;
+	struct fib_info *fi = NULL;
+	struct fib_info *last_resort;
+
+	last_idx = -1;
+	last_resort = NULL;
+	order = -1;
+
+	read_lock(&fib_trie_lock);
+	li = fib_find_prefix(t, 0, 0);
+	if (li == NULL)
+		goto out;
+
+	for (f = li->fa_head; f; f = f->fn_next) {
+		struct fib_info *next_fi = FIB_INFO(f);
+
+		if (f->fn_scope != res->scope ||
+		    f->fn_type != RTN_UNICAST)
+			continue;
+
+		if (next_fi->fib_priority > res->fi->fib_priority)
+			break;
+		if (!next_fi->fib_nh[0].nh_gw || next_fi->fib_nh[0].nh_scope != RT_SCOPE_LINK)
+			continue;
+		f->fn_state |= FN_S_ACCESSED;
+
+		if (fi == NULL) {
+			if (next_fi != res->fi)
+				break;
+		} else if (!fib_detect_death(fi, order, &last_resort, &last_idx)) {
+			if (res->fi)
+				fib_info_put(res->fi);
+			res->fi = fi;
+			atomic_inc(&fi->fib_clntref);
+			trie_last_dflt = order;
+			goto out;
+		}
+		fi = next_fi;
+		order++;
+	}
+
+	if (order<=0 || fi==NULL) {
+		trie_last_dflt = -1;
+		goto out;
+	}
+
+	if (!fib_detect_death(fi, order, &last_resort, &last_idx)) {
+		if (res->fi)
+			fib_info_put(res->fi);
+		res->fi = fi;
+		atomic_inc(&fi->fib_clntref);
+		trie_last_dflt = order;
+		goto out;
+	}
+
+	if (last_idx >= 0) {
+		if (res->fi)
+			fib_info_put(res->fi);
+		res->fi = last_resort;
+		if (last_resort)
+			atomic_inc(&last_resort->fib_clntref);
+	}
+	trie_last_dflt = last_idx;
+out:
+	read_unlock(&fib_trie_lock);
+}
+
+#define FIB_SCAN(f, fp) \
+for ( ; ((f) = *(fp)) != NULL; (fp) = &(f)->fn_next)
+
+#ifndef CONFIG_IP_ROUTE_TOS
+#define FIB_SCAN_TOS(f, fp, tos) FIB_SCAN(f, fp)
+#else
+#define FIB_SCAN_TOS(f, fp, tos) \
+for ( ; ((f) = *(fp)) != NULL && (f)->fn_tos == (tos) ; (fp) = &(f)->fn_next)
+#endif
+
+
+#ifdef CONFIG_RTNETLINK
+static void rtmsg_fib(int, struct fib_node*, t_key, int, int,
+		      struct nlmsghdr *n,
+		      struct netlink_skb_parms *);
+#else
+#define rtmsg_fib(a, b, c, d, e, f, g)
+#endif
+
+
+static int
+fn_trie_insert(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
+	       struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct fib_node *new_f, *f, **fp, **del_fp;
+	struct fib_node *head = NULL;
+	struct leaf_info *li;
+	struct fib_info *fi;
+
+	int plen = r->rtm_dst_len;
+	int type = r->rtm_type;
+#ifdef CONFIG_IP_ROUTE_TOS
+	u8 tos = r->rtm_tos;
+#endif
+	t_key key = 0;
+	int err;
+
+	if (plen > 32)
+		return -EINVAL;
+	if (rta->rta_dst) {
+		u32 dst;
+		memcpy(&dst, rta->rta_dst, 4);
+		key = ntohl(dst);
+	}
+	if (MASK_PFX(key, plen) != key)
+		return -EINVAL;
+
+	if  ((fi = fib_create_info(r, rta, n, &err)) == NULL)
+		return err;
+
+	li = fib_find_prefix(t, key, plen);
+	fp = li ? &li->fa_head : &head;
+
+#ifdef CONFIG_IP_ROUTE_TOS
+	FIB_SCAN(f, fp) {
+		if (f->fn_tos <= tos)
+			break;
+	}
+#endif
+
+	del_fp = NULL;
+
+	FIB_SCAN_TOS(f, fp, tos) {
+		if (fi->fib_priority <= FIB_INFO(f)->fib_priority)
+			break;
+	}
+
+	/* Now f==*fp points to the first route with the same
+	   [tos,priority], if such a route exists, or to the route
+	   before which we will insert the new one.
+	 */
+
+	if (f &&
+#ifdef CONFIG_IP_ROUTE_TOS
+	    f->fn_tos == tos &&
+#endif
+	    fi->fib_priority == FIB_INFO(f)->fib_priority) {
+		struct fib_node **ins_fp;
+
+		err = -EEXIST;
+		if (n->nlmsg_flags&NLM_F_EXCL)
+			goto out;
+
+		if (n->nlmsg_flags&NLM_F_REPLACE) {
+			del_fp = fp;
+			fp = &f->fn_next;
+			f = *fp;
+			goto replace;
+		}
+
+		ins_fp = fp;
+		err = -EEXIST;
+
+		FIB_SCAN_TOS(f, fp, tos) {
+			if (fi->fib_priority != FIB_INFO(f)->fib_priority)
+				break;
+			if (f->fn_type == type && f->fn_scope == r->rtm_scope
+			    && FIB_INFO(f) == fi)
+				goto out;
+		}
+
+		if (!(n->nlmsg_flags&NLM_F_APPEND)) {
+			fp = ins_fp;
+			f = *fp;
+		}
+	}
+
+	err = -ENOENT;
+	if (!(n->nlmsg_flags&NLM_F_CREATE))
+		goto out;
+
+replace:
+	err = -ENOBUFS;
+	new_f = kmem_cache_alloc(fn_alias_kmem, SLAB_KERNEL);
+	if (new_f == NULL)
+		goto out;
+
+	memset(new_f, 0, sizeof(struct fib_node));
+
+#ifdef CONFIG_IP_ROUTE_TOS
+	new_f->fn_tos = tos;
+#endif
+	new_f->fn_type = type;
+	new_f->fn_scope = r->rtm_scope;
+	FIB_INFO(new_f) = fi;
+	new_f->fn_next = f;
+
+	/*
+	 * Insert new entry to the list, or the prefix to the trie.
+	 */
+
+	if (li == NULL) {
+		if (fib_insert_prefix(t, key, plen, new_f) == NULL) {
+			kmem_cache_free(fn_alias_kmem, new_f);
+			goto out;
+		}
+	} else {
+		write_lock_bh(&fib_trie_lock);
+		*fp = new_f;
+		write_unlock_bh(&fib_trie_lock);
+	}
+
+	if (del_fp) {
+		f = *del_fp;
+		/* Unlink replaced node */
+		write_lock_bh(&fib_trie_lock);
+		*del_fp = f->fn_next;
+		write_unlock_bh(&fib_trie_lock);
+
+		rtmsg_fib(RTM_DELROUTE, f, key, plen, tb->tb_id, n, req);
+		if (f->fn_state&FN_S_ACCESSED)
+			rt_cache_flush(-1);
+		fn_free_node(f);
+	} else {
+		rt_cache_flush(-1);
+	}
+	rtmsg_fib(RTM_NEWROUTE, new_f, key, plen, tb->tb_id, n, req);
+	return 0;
+
+out:
+	fib_release_info(fi);
+	return err;
+}
+
+
+static int
+fn_trie_delete(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
+	       struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct fib_node **fp, **del_fp, *f;
+	struct leaf_info *li;
+	struct leaf *l;
+	int plen = r->rtm_dst_len;
+	t_key key = 0;
+#ifdef CONFIG_IP_ROUTE_TOS
+	u8 tos = r->rtm_tos;
+#endif
+
+	if (plen > 32)
+		return -EINVAL;
+	if (rta->rta_dst) {
+		u32 dst;
+		memcpy(&dst, rta->rta_dst, 4);
+		key = ntohl(dst);
+	}
+	if (MASK_PFX(key, plen) != key)
+		return -EINVAL;
+
+	if ((l = fib_find_leaf(t, key)) == NULL)
+		return -ESRCH;
+	for (li = l->list; li; li = li->next)
+		if (li->plen == plen)
+			break;
+	if (li == NULL)
+		return -ESRCH;
+
+	fp = &li->fa_head;
+
+#ifdef CONFIG_IP_ROUTE_TOS
+	FIB_SCAN(f, fp) {
+		if (f->fn_tos == tos)
+			break;
+	}
+#endif
+
+	del_fp = NULL;
+	FIB_SCAN_TOS(f, fp, tos) {
+		struct fib_info * fi = FIB_INFO(f);
+
+		if ((!r->rtm_type || f->fn_type == r->rtm_type) &&
+		    (r->rtm_scope == RT_SCOPE_NOWHERE || f->fn_scope == r->rtm_scope) &&
+		    (!r->rtm_protocol || fi->fib_protocol == r->rtm_protocol) &&
+		    fib_nh_match(r, n, rta, fi) == 0) {
+			del_fp = fp;
+			break;
+		}
+	}
+
+	if (del_fp == NULL)
+		return -ESRCH;
+
+	f = *del_fp;
+	rtmsg_fib(RTM_DELROUTE, f, key, plen, tb->tb_id, n, req);
+
+	write_lock_bh(&fib_trie_lock);
+	*del_fp = f->fn_next;
+	write_unlock_bh(&fib_trie_lock);
+
+	if (f->fn_state&FN_S_ACCESSED)
+		rt_cache_flush(-1);
+	fn_free_node(f);
+
+	if (li->fa_head == NULL)
+		trie_prefix_remove(t, l, li);
+	return 0;
+}
+
+static int fn_flush_list(struct fib_node **fp)
+{
+	int found = 0;
+	struct fib_node *f;
+
+	while ((f = *fp) != NULL) {
+		struct fib_info *fi = FIB_INFO(f);
+
+		if (fi && (fi->fib_flags&RTNH_F_DEAD)) {
+			write_lock_bh(&fib_trie_lock);
+			*fp = f->fn_next;
+			write_unlock_bh(&fib_trie_lock);
+
+			fn_free_node(f);
+			found++;
+			continue;
+		}
+		fp = &f->fn_next;
+	}
+	return found;
+}
+
+static int fn_trie_flush(struct fib_table *tb)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct leaf *l, *next;
+	int found = 0;
+
+	for (l = trie_leaf_ge(t->trie, 0); l; l = next) {
+		struct leaf_info *li, *li_next;
+
+		/* Leaves survive the removal of others, tnodes do not. */
+		next = trie_nextleaf(t, l);
+
+		for (li = l->list; li; li = li_next) {
+			li_next = li->next;
+			found += fn_flush_list(&li->fa_head);
+			if (li->fa_head == NULL)
+				trie_prefix_remove(t, l, li);
+		}
+	}
+	return found;
+}
+
+
+#ifdef CONFIG_PROC_FS
+
+static int fn_trie_get_info(struct fib_table *tb, char *buffer, int first, int count)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	struct leaf *l;
+	int pos = 0;
+	int n = 0;
+
+	read_lock(&fib_trie_lock);
+	for (l = trie_leaf_ge(t->trie, 0); l; l = trie_nextleaf(t, l)) {
+		struct leaf_info *li;
+		struct fib_node *f;
+
+		for (li = l->list; li; li = li->next) {
+			for (f = li->fa_head; f; f = f->fn_next) {
+				if (++pos <= first)
+					continue;
+				fib_node_get_info(f->fn_type, 0, FIB_INFO(f),
+						  htonl(l->key), htonl(li->mask),
+						  buffer);
+				buffer += 128;
+				if (++n >= count)
+					goto out;
+			}
+		}
+	}
+out:
+	read_unlock(&fib_trie_lock);
+	return n;
+}
+
+struct trie_stat
+{
+	unsigned int		leaves;
+	unsigned int		prefixes;
+	unsigned int		tnodes;
+	unsigned int		nullpointers;
+	unsigned int		totdepth;
+	unsigned int		maxdepth;
+	unsigned long		memory;
+	unsigned int		nodesizes[TNODE_MAX_BITS+1];
+};
+
+static void trie_collect_stats(struct node *n, int depth, struct trie_stat *s)
+{
+	struct leaf_info *li;
+	struct tnode *tn;
+	int i;
+
+	if (IS_LEAF(n)) {
+		s->leaves++;
+		s->totdepth += depth;
+		if (depth > s->maxdepth)
+			s->maxdepth = depth;
+		s->memory += sizeof(struct leaf);
+		for (li = ((struct leaf *)n)->list; li; li = li->next) {
+			s->prefixes++;
+			s->memory += sizeof(struct leaf_info);
+		}
+		return;
+	}
+
+	tn = (struct tnode *)n;
+	s->tnodes++;
+	s->nodesizes[tn->bits]++;
+	s->nullpointers += tn->empty_children;
+	s->memory += tnode_size(tn->bits);
+	for (i = 0; i < tnode_child_length(tn); i++)
+		if (tn->child[i])
+			trie_collect_stats(tn->child[i], depth + 1, s);
+}
+
+/* /proc/net/fib_triestat: shape of each trie and lookup counters. */
+static int fib_triestat_get_info(char *buffer, char **start, off_t offset, int length)
+{
+	struct trie_stat s;
+	struct trie *t;
+	int len = 0;
+	int i;
+
+	for (t = trie_list; t; t = t->next) {
+		unsigned int gets = 0, backtrack = 0, misses = 0;
+		unsigned int avdepth;
+
+		if (len > PAGE_SIZE - 512)
+			break;
+
+		memset(&s, 0, sizeof(s));
+		read_lock(&fib_trie_lock);
+		if (t->trie)
+			trie_collect_stats(t->trie, 0, &s);
+		read_unlock(&fib_trie_lock);
+
+		for (i = 0; i < smp_num_cpus; i++) {
+			struct trie_use_stats *st = &t->stats[cpu_logical_map(i)];
+
+			gets += st->gets;
+			backtrack += st->backtrack;
+			misses += st->misses;
+		}
+
+		avdepth = s.leaves ? s.totdepth * 100 / s.leaves : 0;
+		len += sprintf(buffer+len, "Table %d:\n", t->id);
+		len += sprintf(buffer+len, "\tLeaves: %u Prefixes: %u Internal nodes: %u Null pointers: %u\n",
+			       s.leaves, s.prefixes, s.tnodes, s.nullpointers);
+		len += sprintf(buffer+len, "\tDepth: average %u.%02u max %u\n",
+			       avdepth / 100, avdepth % 100, s.maxdepth);
+		len += sprintf(buffer+len, "\tNode bits:");
+		for (i = 1; i <= TNODE_MAX_BITS; i++)
+			if (s.nodesizes[i])
+				len += sprintf(buffer+len, " %d:%u", i, s.nodesizes[i]);
+		len += sprintf(buffer+len, "\n\tMemory: %lu bytes\n", s.memory);
+		len += sprintf(buffer+len, "\tLookups: %u Backtracks: %u Misses: %u\n",
+			       gets, backtrack, misses);
+	}
+
+	if (offset >= len) {
+		*start = buffer;
+		return 0;
+	}
+	*start = buffer + offset;
+	len -= offset;
+	if (len > length)
+		len = length;
+	return len;
+}
+
+#endif /* CONFIG_PROC_FS */
+
+
+#ifdef CONFIG_RTNETLINK
+
+/* cb->args[1] holds the key of the leaf being dumped, cb->args[2] the
+ * number of its routes already sent.
+ */
+static int fn_trie_dump(struct fib_table *tb, struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct trie *t = (struct trie *)tb->tb_data;
+	int s_i = cb->args[2];
+	struct leaf *l;
+
+	read_lock(&fib_trie_lock);
+	for (l = trie_leaf_ge(t->trie, cb->args[1]); l; l = trie_nextleaf(t, l)) {
+		struct leaf_info *li;
+		struct fib_node *f;
+		u32 dst = htonl(l->key);
+		int i = 0;
+
+		if (l->key != cb->args[1])
+			s_i = 0;
+
+		for (li = l->list; li; li = li->next) {
+			for (f = li->fa_head; f; f = f->fn_next, i++) {
+				if (i < s_i)
+					continue;
+				if (fib_dump_info(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+						  RTM_NEWROUTE, tb->tb_id, f->fn_type, f->fn_scope,
+						  &dst, li->plen, f->fn_tos, FIB_INFO(f)) < 0) {
+					cb->args[1] = l->key;
+					cb->args[2] = i;
+					read_unlock(&fib_trie_lock);
+					return -1;
+				}
+			}
+		}
+	}
+	read_unlock(&fib_trie_lock);
+	return skb->len;
+}
+
+static void rtmsg_fib(int event, struct fib_node* f, t_key key, int z, int tb_id,
+		      struct nlmsghdr *n, struct netlink_skb_parms *req)
+{
+	struct sk_buff *skb;
+	u32 pid = req ? req->pid : 0;
+	u32 dst = htonl(key);
+	int size = NLMSG_SPACE(sizeof(struct rtmsg)+256);
+
+	/* Loading a large table is dominated by notifications nobody
+	 * listens to; do not even build them.
+	 */
+	if (!(n->nlmsg_flags&NLM_F_ECHO) &&
+	    !netlink_has_listeners(rtnl, pid, RTMGRP_IPV4_ROUTE))
+		return;
+
+	skb = alloc_skb(size, GFP_KERNEL);
+	if (!skb)
+		return;
+
+	if (fib_dump_info(skb, pid, n->nlmsg_seq, event, tb_id,
+			  f->fn_type, f->fn_scope, &dst, z, f->fn_tos,
+			  FIB_INFO(f)) < 0) {
+		kfree_skb(skb);
+		return;
+	}
+	NETLINK_CB(skb).dst_groups = RTMGRP_IPV4_ROUTE;
+	if (n->nlmsg_flags&NLM_F_ECHO)
+		atomic_inc(&skb->users);
+	netlink_broadcast(rtnl, skb, pid, RTMGRP_IPV4_ROUTE, GFP_KERNEL);
+	if (n->nlmsg_flags&NLM_F_ECHO)
+		netlink_unicast(rtnl, skb, pid, MSG_DONTWAIT);
+}
+
+#endif /* CONFIG_RTNETLINK */
+
+/* Same name as the hash engine's: fib_frontend.c does not care which
+ * one it gets.
+ */
+#ifdef CONFIG_IP_MULTIPLE_TABLES
+struct fib_table * fib_hash_init(int id)
+#else
+struct fib_table * __init fib_hash_init(int id)
+#endif
+{
+	struct fib_table *tb;
+	struct trie *t;
+
+	if (fn_alias_kmem == NULL) {
+		fn_alias_kmem = kmem_cache_create("ip_fib_alias",
+						  sizeof(struct fib_node),
+						  0, SLAB_HWCACHE_ALIGN,
+						  NULL, NULL);
+		trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
+						   sizeof(struct leaf),
+						   0, SLAB_HWCACHE_ALIGN,
+						   NULL, NULL);
+#ifdef CONFIG_PROC_FS
+		proc_net_create("fib_triestat", 0, fib_triestat_get_info);
+#endif
+	}
+
+	tb = kmalloc(sizeof(struct fib_table) + sizeof(struct trie), GFP_KERNEL);
+	if (tb == NULL)
+		return NULL;
+
+	tb->tb_id = id;
+	tb->tb_lookup = fn_trie_lookup;
+	tb->tb_insert = fn_trie_insert;
+	tb->tb_delete = fn_trie_delete;
+	tb->tb_flush = fn_trie_flush;
+	tb->tb_select_default = fn_trie_select_default;
+#ifdef CONFIG_RTNETLINK
+	tb->tb_dump = fn_trie_dump;
+#endif
+#ifdef CONFIG_PROC_FS
+	tb->tb_get_info = fn_trie_get_info;
+#endif
+	t = (struct trie *)tb->tb_data;
+	memset(t, 0, sizeof(struct trie));
+	t->id = id;
+	t->next = trie_list;
+	trie_list = t;
+	return tb;
+}
@@ -125,6 +125,17 @@
 
 #endif
 
+/* Called with in_dev->lock or the RTNL held */
+static struct ip_mc_list *ip_mc_find(struct in_device *in_dev, u32 group)
+{
+	struct ip_mc_list *im;
+
+	for (im = in_dev->mc_hash[ip_mc_hashfn(group)]; im; im = im->next_hash)
+		if (im->multiaddr == group)
+			break;
+	return im;
+}
+
 static void ip_ma_put(struct ip_mc_list *im)
 {
 	if (atomic_dec_and_test(&im->refcnt)) {
@@ -295,12 +306,9 @@ static void igmp_heard_report(struct in_device *in_dev, u32 group)
 		return;
 
 	read_lock(&in_dev->lock);
-	for (im=in_dev->mc_list; im!=NULL; im=im->next) {
-		if (im->multiaddr == group) {
-			igmp_stop_timer(im);
-			break;
-		}
-	}
+	im = ip_mc_find(in_dev, group);
+	if (im)
+		igmp_stop_timer(im);
 	read_unlock(&in_dev->lock);
 }
 
@@ -331,12 +339,16 @@ static void igmp_heard_query(struct in_device *in_dev, unsigned char max_resp_ti
 	 *   delay possible
 	 */
 	read_lock(&in_dev->lock);
-	for (im=in_dev->mc_list; im!=NULL; im=im->next) {
-		if (group && group != im->multiaddr)
-			continue;
-		if (im->multiaddr == IGMP_ALL_HOSTS)
-			continue;
-		igmp_mod_timer(im, max_delay);
+	if (group) {
+		im = ip_mc_find(in_dev, group);
+		if (im && im->multiaddr != IGMP_ALL_HOSTS)
+			igmp_mod_timer(im, max_delay);
+	} else {
+		for (im=in_dev->mc_list; im!=NULL; im=im->next) {
+			if (im->multiaddr == IGMP_ALL_HOSTS)
+				continue;
+			igmp_mod_timer(im, max_delay);
+		}
 	}
 	read_unlock(&in_dev->lock);
 }
@@ -476,15 +488,14 @@ static void igmp_group_added(struct ip_mc_list *im)
 
 void ip_mc_inc_group(struct in_device *in_dev, u32 addr)
 {
-	struct ip_mc_list *im;
+	struct ip_mc_list *im, **hash;
 
 	ASSERT_RTNL();
 
-	for (im=in_dev->mc_list; im; im=im->next) {
-		if (im->multiaddr == addr) {
-			im->users++;
-			goto out;
-		}
+	im = ip_mc_find(in_dev, addr);
+	if (im) {
+		im->users++;
+		goto out;
 	}
 
 	im = (struct ip_mc_list *)kmalloc(sizeof(*im), GFP_KERNEL);
@@ -506,9 +517,15 @@ void ip_mc_inc_group(struct in_device *in_dev, u32 addr)
 	im->reporter = 0;
 	im->loaded = 0;
 #endif
+	hash = &in_dev->mc_hash[ip_mc_hashfn(addr)];
 	write_lock_bh(&in_dev->lock);
 	im->next=in_dev->mc_list;
+	if (im->next)
+		im->next->pprev = &im->next;
+	im->pprev = &in_dev->mc_list;
 	in_dev->mc_list=im;
+	im->next_hash = *hash;
+	*hash = im;
 	write_unlock_bh(&in_dev->lock);
 	igmp_group_added(im);
 	if (in_dev->dev->flags & IFF_UP)
@@ -528,11 +545,14 @@ int ip_mc_dec_group(struct in_device *in_dev, u32 addr)
 	
 	ASSERT_RTNL();
 	
-	for (ip=&in_dev->mc_list; (i=*ip)!=NULL; ip=&i->next) {
+	for (ip=&in_dev->mc_hash[ip_mc_hashfn(addr)]; (i=*ip)!=NULL; ip=&i->next_hash) {
 		if (i->multiaddr==addr) {
 			if (--i->users == 0) {
 				write_lock_bh(&in_dev->lock);
-				*ip = i->next;
+				*ip = i->next_hash;
+				*i->pprev = i->next;
+				if (i->next)
+					i->next->pprev = i->pprev;
 				write_unlock_bh(&in_dev->lock);
 				igmp_group_dropped(i);
 
@@ -588,8 +608,11 @@ void ip_mc_destroy_dev(struct in_device *in_dev)
 	ASSERT_RTNL();
 
 	write_lock_bh(&in_dev->lock);
+	memset(in_dev->mc_hash, 0, sizeof(in_dev->mc_hash));
 	while ((i = in_dev->mc_list) != NULL) {
 		in_dev->mc_list = i->next;
+		if (i->next)
+			i->next->pprev = &in_dev->mc_list;
 		write_unlock_bh(&in_dev->lock);
 
 		igmp_group_dropped(i);
@@ -633,9 +656,8 @@ int ip_mc_join_group(struct sock *sk , struct ip_mreqn *imr)
 {
 	int err;
 	u32 addr = imr->imr_multiaddr.s_addr;
-	struct ip_mc_socklist *iml, *i;
+	struct ip_mc_socklist *iml, *i, **hash;
 	struct in_device *in_dev;
-	int count = 0;
 
 	if (!MULTICAST(addr))
 		return -EINVAL;
@@ -658,8 +680,18 @@ int ip_mc_join_group(struct sock *sk , struct ip_mreqn *imr)
 
 	iml = (struct ip_mc_socklist *)sock_kmalloc(sk, sizeof(*iml), GFP_KERNEL);
 
+	if (!sk->protinfo.af_inet.mc_hash) {
+		hash = sock_kmalloc(sk, IP_MC_HASH_SIZE * sizeof(*hash), GFP_KERNEL);
+		err = -ENOBUFS;
+		if (!hash)
+			goto done;
+		memset(hash, 0, IP_MC_HASH_SIZE * sizeof(*hash));
+		sk->protinfo.af_inet.mc_hash = hash;
+	}
+	hash = &sk->protinfo.af_inet.mc_hash[ip_mc_hashfn(addr)];
+
 	err = -EADDRINUSE;
-	for (i=sk->protinfo.af_inet.mc_list; i; i=i->next) {
+	for (i=*hash; i; i=i->next) {
 		if (memcmp(&i->multi, imr, sizeof(*imr)) == 0) {
 			/* New style additions are reference counted */
 			if (imr->imr_address.s_addr == 0) {
@@ -668,15 +700,15 @@ int ip_mc_join_group(struct sock *sk , struct ip_mreqn *imr)
 			}
 			goto done;
 		}
-		count++;
 	}
 	err = -ENOBUFS;
-	if (iml == NULL || count >= sysctl_igmp_max_memberships)
+	if (iml == NULL || sk->protinfo.af_inet.mc_count >= sysctl_igmp_max_memberships)
 		goto done;
 	memcpy(&iml->multi, imr, sizeof(*imr));
-	iml->next = sk->protinfo.af_inet.mc_list;
+	iml->next = *hash;
 	iml->count = 1;
-	sk->protinfo.af_inet.mc_list = iml;
+	*hash = iml;
+	sk->protinfo.af_inet.mc_count++;
 	ip_mc_inc_group(in_dev, addr);
 	iml = NULL;
 	err = 0;
@@ -696,8 +728,12 @@ int ip_mc_leave_group(struct sock *sk, struct ip_mreqn *imr)
 {
 	struct ip_mc_socklist *iml, **imlp;
 
+	if (!sk->protinfo.af_inet.mc_hash)
+		return -EADDRNOTAVAIL;
+
 	rtnl_lock();
-	for (imlp=&sk->protinfo.af_inet.mc_list; (iml=*imlp)!=NULL; imlp=&iml->next) {
+	imlp = &sk->protinfo.af_inet.mc_hash[ip_mc_hashfn(imr->imr_multiaddr.s_addr)];
+	for (; (iml=*imlp)!=NULL; imlp=&iml->next) {
 		if (iml->multi.imr_multiaddr.s_addr==imr->imr_multiaddr.s_addr &&
 		    iml->multi.imr_address.s_addr==imr->imr_address.s_addr &&
 		    (!imr->imr_ifindex || iml->multi.imr_ifindex==imr->imr_ifindex)) {
@@ -708,6 +744,7 @@ int ip_mc_leave_group(struct sock *sk, struct ip_mreqn *imr)
 			}
 
 			*imlp = iml->next;
+			sk->protinfo.af_inet.mc_count--;
 
 			in_dev = inetdev_by_index(iml->multi.imr_ifindex);
 			if (in_dev) {
@@ -729,39 +766,39 @@ int ip_mc_leave_group(struct sock *sk, struct ip_mreqn *imr)
 
 void ip_mc_drop_socket(struct sock *sk)
 {
-	struct ip_mc_socklist *iml;
+	struct ip_mc_socklist *iml, **hash = sk->protinfo.af_inet.mc_hash;
+	int h;
 
-	if (sk->protinfo.af_inet.mc_list == NULL)
+	if (hash == NULL)
 		return;
 
 	rtnl_lock();
-	while ((iml=sk->protinfo.af_inet.mc_list) != NULL) {
-		struct in_device *in_dev;
-		sk->protinfo.af_inet.mc_list = iml->next;
+	for (h = 0; h < IP_MC_HASH_SIZE; h++) {
+		while ((iml=hash[h]) != NULL) {
+			struct in_device *in_dev;
+			hash[h] = iml->next;
 
-		if ((in_dev = inetdev_by_index(iml->multi.imr_ifindex)) != NULL) {
-			ip_mc_dec_group(in_dev, iml->multi.imr_multiaddr.s_addr);
-			in_dev_put(in_dev);
+			if ((in_dev = inetdev_by_index(iml->multi.imr_ifindex)) != NULL) {
+				ip_mc_dec_group(in_dev, iml->multi.imr_multiaddr.s_addr);
+				in_dev_put(in_dev);
+			}
+			sock_kfree_s(sk, iml, sizeof(*iml));
 		}
-		sock_kfree_s(sk, iml, sizeof(*iml));
-
 	}
+	sk->protinfo.af_inet.mc_hash = NULL;
+	sk->protinfo.af_inet.mc_count = 0;
 	rtnl_unlock();
+	sock_kfree_s(sk, hash, IP_MC_HASH_SIZE * sizeof(*hash));
 }
 
 int ip_check_mc(struct in_device *in_dev, u32 mc_addr)
 {
-	struct ip_mc_list *im;
+	int ret;
 
 	read_lock(&in_dev->lock);
-	for (im=in_dev->mc_list; im; im=im->next) {
-		if (im->multiaddr == mc_addr) {
-			read_unlock(&in_dev->lock);
-			return 1;
-		}
-	}
+	ret = ip_mc_find(in_dev, mc_addr) != NULL;
 	read_unlock(&in_dev->lock);
-	return 0;
+	return ret;
 }
 
 
@@ -120,6 +120,8 @@ int ip_forward(struct sk_buff *skb)
 		return NET_RX_DROP;
 	iph = skb->nh.iph;
 	opt = &(IPCB(skb)->opt);
+	/* A receive checksum is no checksum to offload */
+	skb->ip_summed = CHECKSUM_NONE;
 
 	/* Decrease ttl after skb cow done */
 	ip_decrease_ttl(iph);
@@ -19,6 +19,8 @@
  *		Bill Hawes	:	Frag accounting and evictor fixes.
  *		John McDonald	:	0 length frag bug.
  *		Alexey Kuznetsov:	SMP races, threading, cleanup.
+ *					Keyed hash, per-bucket locks, per-CPU
+ *					memory accounting, tail insertion.
  */
 
 #include <linux/config.h>
@@ -36,6 +38,9 @@
 #include <linux/tcp.h>
 #include <linux/udp.h>
 #include <linux/inet.h>
+#include <linux/init.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
 #include <linux/netfilter_ipv4.h>
 
 /* NOTE. Logic of IP defragmentation is parallel to corresponding IPv6
@@ -77,67 +82,114 @@ struct ipq {
 #define LAST_IN			1
 
 	struct sk_buff	*fragments;	/* linked list of received fragments	*/
+	struct sk_buff	*fragments_tail;
 	int		len;		/* total length of original datagram	*/
 	int		meat;
 	spinlock_t	lock;
 	atomic_t	refcnt;
 	struct timer_list timer;	/* when will this queue expire?		*/
 	struct ipq	**pprev;
+	unsigned int	hash;		/* bucket we are chained in		*/
 	int		iif;		/* Device index - for icmp replies	*/
 };
 
-/* Hash table. */
+/* Hash table. Each bucket has its own lock; all users run in BH context. */
 
-#define IPQ_HASHSZ	64
+#define IPQ_HASHSZ	1024
 
-/* Per-bucket lock is easy to add now. */
-static struct ipq *ipq_hash[IPQ_HASHSZ];
-static rwlock_t ipfrag_lock = RW_LOCK_UNLOCKED;
-int ip_frag_nqueues = 0;
+static struct ipq_bucket {
+	struct ipq	*chain;
+	spinlock_t	lock;
+} ipq_hash[IPQ_HASHSZ];
+
+static u32 ipfrag_hash_rnd;
+
+/* Memory and queue accounting is per CPU.  Memory is folded into
+ * ip_frag_mem_folded whenever a CPU's share moves by more than
+ * IPFRAG_MEM_BATCH, which keeps the thresholds exact to within
+ * IPFRAG_MEM_BATCH per CPU.
+ */
+#define IPFRAG_MEM_BATCH	8192
+
+static struct ipfrag_cpu {
+	int	mem;
+	int	nqueues;
+} ____cacheline_aligned ipfrag_cpu[NR_CPUS];
+
+static atomic_t ip_frag_mem_folded = ATOMIC_INIT(0);
+
+static __inline__ void ipfrag_mem_add(int delta)
+{
+	struct ipfrag_cpu *c = &ipfrag_cpu[smp_processor_id()];
+
+	c->mem += delta;
+	if (c->mem > IPFRAG_MEM_BATCH || c->mem < -IPFRAG_MEM_BATCH) {
+		atomic_add(c->mem, &ip_frag_mem_folded);
+		c->mem = 0;
+	}
+}
+
+/* What the evictor goes by: the folded sum plus our own share. */
+static __inline__ int ipfrag_mem_estimate(void)
+{
+	return atomic_read(&ip_frag_mem_folded) +
+		ipfrag_cpu[smp_processor_id()].mem;
+}
+
+int ip_frag_mem(void)
+{
+	int res = atomic_read(&ip_frag_mem_folded);
+	int cpu;
+
+	for (cpu=0; cpu<smp_num_cpus; cpu++)
+		res += ipfrag_cpu[cpu_logical_map(cpu)].mem;
+	return res;
+}
+
+int ip_frag_nqueues(void)
+{
+	int res = 0;
+	int cpu;
+
+	for (cpu=0; cpu<smp_num_cpus; cpu++)
+		res += ipfrag_cpu[cpu_logical_map(cpu)].nqueues;
+	return res;
+}
 
 static __inline__ void __ipq_unlink(struct ipq *qp)
 {
 	if(qp->next)
 		qp->next->pprev = qp->pprev;
 	*qp->pprev = qp->next;
-	ip_frag_nqueues--;
+	ipfrag_cpu[smp_processor_id()].nqueues--;
 }
 
 static __inline__ void ipq_unlink(struct ipq *ipq)
 {
-	write_lock(&ipfrag_lock);
+	spinlock_t *lock = &ipq_hash[ipq->hash].lock;
+
+	spin_lock(lock);
 	__ipq_unlink(ipq);
-	write_unlock(&ipfrag_lock);
+	spin_unlock(lock);
 }
 
-/*
- * Was:	((((id) >> 1) ^ (saddr) ^ (daddr) ^ (prot)) & (IPQ_HASHSZ - 1))
- *
- * I see, I see evil hand of bigendian mafia. On Intel all the packets hit
- * one hash bucket with this hash function. 8)
- */
+/* Keyed, so that a remote sender cannot aim all its datagrams at one chain. */
 static __inline__ unsigned int ipqhashfn(u16 id, u32 saddr, u32 daddr, u8 prot)
 {
-	unsigned int h = saddr ^ daddr;
-
-	h ^= (h>>16)^id;
-	h ^= (h>>8)^prot;
-	return h & (IPQ_HASHSZ - 1);
+	return jhash_3words(((u32)id << 16) | prot, saddr, daddr,
+			    ipfrag_hash_rnd) & (IPQ_HASHSZ - 1);
 }
 
-
-atomic_t ip_frag_mem = ATOMIC_INIT(0);	/* Memory used for fragments */
-
 /* Memory Tracking Functions. */
 extern __inline__ void frag_kfree_skb(struct sk_buff *skb)
 {
-	atomic_sub(skb->truesize, &ip_frag_mem);
+	ipfrag_mem_add(-skb->truesize);
 	kfree_skb(skb);
 }
 
 extern __inline__ void frag_free_queue(struct ipq *qp)
 {
-	atomic_sub(sizeof(struct ipq), &ip_frag_mem);
+	ipfrag_mem_add(-(int)sizeof(struct ipq));
 	kfree(qp);
 }
 
@@ -147,7 +199,7 @@ extern __inline__ struct ipq *frag_alloc_queue(void)
 
 	if(!qp)
 		return NULL;
-	atomic_add(sizeof(struct ipq), &ip_frag_mem);
+	ipfrag_mem_add(sizeof(struct ipq));
 	return qp;
 }
 
@@ -197,29 +249,36 @@ static __inline__ void ipq_kill(struct ipq *ipq)
 }
 
 /* Memory limiting on fragments.  Evictor trashes the oldest 
- * fragment queue until we are back under the low threshold.
+ * fragment queue of each bucket in turn until we are back under
+ * the low threshold.  It resumes where the previous run stopped, so
+ * that the low buckets are not always the ones to suffer.
  */
 static void ip_evictor(void)
 {
+	static unsigned int rover;
 	int i, progress;
 
 	do {
-		if (atomic_read(&ip_frag_mem) <= sysctl_ipfrag_low_thresh)
-			return;
 		progress = 0;
 		/* FIXME: Make LRU queue of frag heads. -DaveM */
 		for (i = 0; i < IPQ_HASHSZ; i++) {
+			struct ipq_bucket *b;
 			struct ipq *qp;
-			if (ipq_hash[i] == NULL)
+
+			if (ipfrag_mem_estimate() <= sysctl_ipfrag_low_thresh)
+				return;
+
+			b = &ipq_hash[rover++ & (IPQ_HASHSZ - 1)];
+			if (b->chain == NULL)
 				continue;
 
-			write_lock(&ipfrag_lock);
-			if ((qp = ipq_hash[i]) != NULL) {
+			spin_lock(&b->lock);
+			if ((qp = b->chain) != NULL) {
 				/* find the oldest queue for this hash bucket */
 				while (qp->next)
 					qp = qp->next;
 				__ipq_unlink(qp);
-				write_unlock(&ipfrag_lock);
+				spin_unlock(&b->lock);
 
 				spin_lock(&qp->lock);
 				if (del_timer(&qp->timer))
@@ -232,7 +291,7 @@ static void ip_evictor(void)
 				progress = 1;
 				continue;
 			}
-			write_unlock(&ipfrag_lock);
+			spin_unlock(&b->lock);
 		}
 	} while (progress);
 }
@@ -272,21 +331,22 @@ out:
 
 static struct ipq *ip_frag_intern(unsigned int hash, struct ipq *qp_in)
 {
+	struct ipq_bucket *b = &ipq_hash[hash];
 	struct ipq *qp;
 
-	write_lock(&ipfrag_lock);
+	spin_lock(&b->lock);
 #ifdef CONFIG_SMP
 	/* With SMP race we have to recheck hash table, because
 	 * such entry could be created on other cpu, while we
-	 * promoted read lock to write lock.
+	 * allocated ours without the bucket lock.
 	 */
-	for(qp = ipq_hash[hash]; qp; qp = qp->next) {
+	for(qp = b->chain; qp; qp = qp->next) {
 		if(qp->id == qp_in->id		&&
 		   qp->saddr == qp_in->saddr	&&
 		   qp->daddr == qp_in->daddr	&&
 		   qp->protocol == qp_in->protocol) {
 			atomic_inc(&qp->refcnt);
-			write_unlock(&ipfrag_lock);
+			spin_unlock(&b->lock);
 			qp_in->last_in |= COMPLETE;
 			ipq_put(qp_in);
 			return qp;
@@ -299,12 +359,13 @@ static struct ipq *ip_frag_intern(unsigned int hash, struct ipq *qp_in)
 		atomic_inc(&qp->refcnt);
 
 	atomic_inc(&qp->refcnt);
-	if((qp->next = ipq_hash[hash]) != NULL)
+	if((qp->next = b->chain) != NULL)
 		qp->next->pprev = &qp->next;
-	ipq_hash[hash] = qp;
-	qp->pprev = &ipq_hash[hash];
-	ip_frag_nqueues++;
-	write_unlock(&ipfrag_lock);
+	b->chain = qp;
+	qp->pprev = &b->chain;
+	qp->hash = hash;
+	ipfrag_cpu[smp_processor_id()].nqueues++;
+	spin_unlock(&b->lock);
 	return qp;
 }
 
@@ -324,6 +385,7 @@ static struct ipq *ip_frag_create(unsigned hash, struct iphdr *iph)
 	qp->len = 0;
 	qp->meat = 0;
 	qp->fragments = NULL;
+	qp->fragments_tail = NULL;
 	qp->iif = 0;
 
 	/* Initialize a timer for this entry. */
@@ -350,20 +412,21 @@ static inline struct ipq *ip_find(struct iphdr *iph)
 	__u32 daddr = iph->daddr;
 	__u8 protocol = iph->protocol;
 	unsigned int hash = ipqhashfn(id, saddr, daddr, protocol);
+	struct ipq_bucket *b = &ipq_hash[hash];
 	struct ipq *qp;
 
-	read_lock(&ipfrag_lock);
-	for(qp = ipq_hash[hash]; qp; qp = qp->next) {
+	spin_lock(&b->lock);
+	for(qp = b->chain; qp; qp = qp->next) {
 		if(qp->id == id		&&
 		   qp->saddr == saddr	&&
 		   qp->daddr == daddr	&&
 		   qp->protocol == protocol) {
 			atomic_inc(&qp->refcnt);
-			read_unlock(&ipfrag_lock);
+			spin_unlock(&b->lock);
 			return qp;
 		}
 	}
-	read_unlock(&ipfrag_lock);
+	spin_unlock(&b->lock);
 
 	return ip_frag_create(hash, iph);
 }
@@ -420,13 +483,19 @@ static void ip_frag_queue(struct ipq *qp, struct sk_buff *skb)
 
 	/* Find out which fragments are in front and at the back of us
 	 * in the chain of fragments so far.  We must know where to put
-	 * this fragment, right?
+	 * this fragment, right?  Fragments mostly arrive in order, so
+	 * try the tail first.
 	 */
-	prev = NULL;
-	for(next = qp->fragments; next != NULL; next = next->next) {
-		if (FRAG_CB(next)->offset >= offset)
-			break;	/* bingo! */
-		prev = next;
+	prev = qp->fragments_tail;
+	if (prev != NULL && FRAG_CB(prev)->offset < offset) {
+		next = NULL;
+	} else {
+		prev = NULL;
+		for(next = qp->fragments; next != NULL; next = next->next) {
+			if (FRAG_CB(next)->offset >= offset)
+				break;	/* bingo! */
+			prev = next;
+		}
 	}
 
 	/* We found where to put this one.  Check for overlap with
@@ -481,6 +550,8 @@ static void ip_frag_queue(struct ipq *qp, struct sk_buff *skb)
 
 	/* Insert this fragment in the chain of fragments. */
 	skb->next = next;
+	if (next == NULL)
+		qp->fragments_tail = skb;
 	if (prev)
 		prev->next = skb;
 	else
@@ -490,7 +561,7 @@ static void ip_frag_queue(struct ipq *qp, struct sk_buff *skb)
 		qp->iif = skb->dev->ifindex;
 	skb->dev = NULL;
 	qp->meat += skb->len;
-	atomic_add(skb->truesize, &ip_frag_mem);
+	ipfrag_mem_add(skb->truesize);
 	if (offset == 0)
 		qp->last_in |= FIRST_IN;
 
@@ -608,7 +679,7 @@ struct sk_buff *ip_defrag(struct sk_buff *skb)
 	IP_INC_STATS_BH(IpReasmReqds);
 
 	/* Start by cleaning up the memory. */
-	if (atomic_read(&ip_frag_mem) > sysctl_ipfrag_high_thresh)
+	if (ipfrag_mem_estimate() > sysctl_ipfrag_high_thresh)
 		ip_evictor();
 
 	dev = skb->dev;
@@ -634,3 +705,13 @@ struct sk_buff *ip_defrag(struct sk_buff *skb)
 	kfree_skb(skb);
 	return NULL;
 }
+
+void __init ipfrag_init(void)
+{
+	int i;
+
+	for (i = 0; i < IPQ_HASHSZ; i++)
+		ipq_hash[i].lock = SPIN_LOCK_UNLOCKED;
+
+	get_random_bytes(&ipfrag_hash_rnd, sizeof(ipfrag_hash_rnd));
+}
@@ -139,6 +139,7 @@
 #include <net/arp.h>
 #include <net/icmp.h>
 #include <net/raw.h>
+#include <net/tcp.h>
 #include <net/checksum.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/mroute.h>
@@ -297,11 +298,18 @@ int ip_local_deliver(struct sk_buff *skb)
 		       ip_local_deliver_finish);
 }
 
+/* Let an established TCP socket supply the input route */
+int sysctl_ip_early_demux = 1;
+
 static inline int ip_rcv_finish(struct sk_buff *skb)
 {
 	struct net_device *dev = skb->dev;
 	struct iphdr *iph = skb->nh.iph;
 
+	if (skb->dst == NULL && sysctl_ip_early_demux &&
+	    iph->protocol == IPPROTO_TCP)
+		tcp_v4_early_demux(skb);
+
 	/*
 	 *	Initialise the virtual path cache for the packet. It describes
 	 *	how the packet travels inside Linux networking.
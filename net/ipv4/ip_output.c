@@ -301,7 +301,9 @@ static inline int ip_queue_xmit2(struct sk_buff *skb)
 		iph = skb->nh.iph;
 	}
 
-	if (skb->len > rt->u.dst.pmtu)
+	/* A TCP frame larger than the MTU is cut into segments by the
+	 * device or by dev_queue_xmit(), not fragmented. */
+	if (skb->len > rt->u.dst.pmtu && !skb_shinfo(skb)->tso_size)
 		goto fragment;
 
 	if (ip_dont_fragment(sk, &rt->u.dst))
@@ -316,6 +318,16 @@ static inline int ip_queue_xmit2(struct sk_buff *skb)
 	return skb->dst->output(skb);
 
 fragment:
+	/* Neither ip_fragment() nor icmp_send() know about page
+	 * fragments or checksums left to the hardware. */
+	if (skb_is_nonlinear(skb) && skb_linearize(skb, GFP_ATOMIC) != 0) {
+		kfree_skb(skb);
+		return -ENOMEM;
+	}
+	if (skb->ip_summed == CHECKSUM_HW)
+		skb_checksum_help(skb);
+	iph = skb->nh.iph;
+
 	if (ip_dont_fragment(sk, &rt->u.dst)) {
 		/* Reject packet ONLY if TCP might fragment
 		 * it itself, if were careful enough.
@@ -980,6 +992,7 @@ void __init ip_init(void)
 
 	ip_rt_init();
 	inet_initpeers();
+	ipfrag_init();
 
 #ifdef CONFIG_IP_MULTICAST
 	proc_net_create("igmp", 0, ip_mc_procinfo);
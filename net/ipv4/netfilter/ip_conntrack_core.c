@@ -23,11 +23,15 @@
 #include <linux/stddef.h>
 #include <linux/sysctl.h>
 #include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
+#include <linux/seqlock.h>
 
-/* This rwlock protects the main hash table, protocol/helper/expected
-   registrations, conntrack timers*/
-#define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
-#define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
+/* ip_conntrack_lock protects protocol/helper/expected registrations;
+   the main hash table and conntrack timers are covered by the bucket
+   locks (see ip_conntrack_core.h). */
+#define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(ip_conntrack_list_lock(x))
+#define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(ip_conntrack_list_lock(x))
 
 #include <linux/netfilter_ipv4/ip_conntrack.h>
 #include <linux/netfilter_ipv4/ip_conntrack_protocol.h>
@@ -42,12 +46,17 @@
 #endif
 
 DECLARE_RWLOCK(ip_conntrack_lock);
+DECLARE_RWLOCK_ARRAY(ip_conntrack_hash_lock, IP_CT_HASH_LOCKS);
+struct ip_conntrack_stat ip_conntrack_stat[NR_CPUS];
 
 void (*ip_conntrack_destroyed)(struct ip_conntrack *conntrack) = NULL;
 LIST_HEAD(expect_list);
 LIST_HEAD(protocol_list);
 static LIST_HEAD(helpers);
 unsigned int ip_conntrack_htable_size = 0;
+static u_int32_t ip_conntrack_hash_rnd;
+/* Bumped around a resize, which holds every lock there is. */
+static seqcount_t ip_conntrack_hash_seq = SEQCNT_ZERO;
 static int ip_conntrack_max = 0;
 static atomic_t ip_conntrack_count = ATOMIC_INIT(0);
 struct list_head *ip_conntrack_hash;
@@ -99,16 +108,49 @@ hash_conntrack(const struct ip_conntrack_tuple *tuple)
 #if 0
 	dump_tuple(tuple);
 #endif
-	/* ntohl because more differences in low bits. */
-	/* To ensure that halves of the same connection don't hash
-	   clash, we add the source per-proto again. */
-	return (ntohl(tuple->src.ip + tuple->dst.ip
-		     + tuple->src.u.all + tuple->dst.u.all
-		     + tuple->dst.protonum)
-		+ ntohs(tuple->src.u.all))
+	/* Keyed, so that nobody can line connections up in one chain.
+	   The ports go in whole, so the halves of a connection don't
+	   hash clash. */
+	return jhash_3words(tuple->src.ip,
+			    tuple->dst.ip ^ tuple->dst.protonum,
+			    (tuple->src.u.all << 16) | tuple->dst.u.all,
+			    ip_conntrack_hash_rnd)
 		% ip_conntrack_htable_size;
 }
 
+/* Lock the bucket of a tuple, and return its index.  Without
+   ip_conntrack_lock the table may be resized between hashing and
+   getting the lock; once any bucket lock is held it cannot be. */
+static unsigned int
+read_lock_tuple(const struct ip_conntrack_tuple *tuple)
+{
+	unsigned int hash, seq;
+
+	for (;;) {
+		seq = read_seqcount_begin(&ip_conntrack_hash_seq);
+		hash = hash_conntrack(tuple);
+		READ_LOCK(IP_CT_BUCKET_LOCK(hash));
+		if (!read_seqcount_retry(&ip_conntrack_hash_seq, seq))
+			return hash;
+		READ_UNLOCK(IP_CT_BUCKET_LOCK(hash));
+	}
+}
+
+static unsigned int
+write_lock_tuple(const struct ip_conntrack_tuple *tuple)
+{
+	unsigned int hash, seq;
+
+	for (;;) {
+		seq = read_seqcount_begin(&ip_conntrack_hash_seq);
+		hash = hash_conntrack(tuple);
+		WRITE_LOCK(IP_CT_BUCKET_LOCK(hash));
+		if (!read_seqcount_retry(&ip_conntrack_hash_seq, seq))
+			return hash;
+		WRITE_UNLOCK(IP_CT_BUCKET_LOCK(hash));
+	}
+}
+
 inline int
 get_tuple(const struct iphdr *iph, size_t len,
 	  struct ip_conntrack_tuple *tuple,
@@ -148,10 +190,84 @@ invert_tuple(struct ip_conntrack_tuple *inverse,
 	return protocol->invert_tuple(inverse, orig);
 }
 
+/* Sort the locks of up to three buckets into l[], each only once;
+   returns how many there are. */
+static unsigned int
+bucket_locks(unsigned int *l, unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int h[3] = { a, b, c };
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < 3; i++) {
+		unsigned int t = h[i] & (IP_CT_HASH_LOCKS - 1);
+
+		for (j = 0; j < n && l[j] != t; j++);
+		if (j < n)
+			continue;
+		for (j = n++; j > 0 && l[j-1] > t; j--)
+			l[j] = l[j-1];
+		l[j] = t;
+	}
+	return n;
+}
+
 static void
-clean_from_lists(struct ip_conntrack *ct)
+write_lock_buckets(unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int l[3], i, n;
+
+	n = bucket_locks(l, a, b, c);
+	for (i = 0; i < n; i++)
+		WRITE_LOCK(&ip_conntrack_hash_lock[l[i]]);
+}
+
+static void
+write_unlock_buckets(unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int l[3], n;
+
+	n = bucket_locks(l, a, b, c);
+	while (n--)
+		WRITE_UNLOCK(&ip_conntrack_hash_lock[l[n]]);
+}
+
+/* Take what is needed to unhash a conntrack: the locks of both its
+   buckets, and ip_conntrack_lock if it has an expectation to take
+   out.  Returns the latter, for clean_from_lists and
+   unlock_conntrack. */
+static int
+lock_conntrack(struct ip_conntrack *ct)
+{
+	int expecting = (ct->expected.expectant != NULL);
+	unsigned int orig, repl, seq;
+
+	if (expecting)
+		WRITE_LOCK(&ip_conntrack_lock);
+	for (;;) {
+		seq = read_seqcount_begin(&ip_conntrack_hash_seq);
+		orig = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		repl = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+		write_lock_buckets(orig, repl, repl);
+		if (!read_seqcount_retry(&ip_conntrack_hash_seq, seq))
+			break;
+		write_unlock_buckets(orig, repl, repl);
+	}
+	return expecting;
+}
+
+static void
+unlock_conntrack(struct ip_conntrack *ct, int expecting)
+{
+	write_unlock_buckets(hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple),
+			     hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple),
+			     hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple));
+	if (expecting)
+		WRITE_UNLOCK(&ip_conntrack_lock);
+}
+
+static void
+clean_from_lists(struct ip_conntrack *ct, int expecting)
 {
-	MUST_BE_WRITE_LOCKED(&ip_conntrack_lock);
 	/* Remove from both hash lists */
 	LIST_DELETE(&ip_conntrack_hash
 		    [hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple)],
@@ -160,7 +276,8 @@ clean_from_lists(struct ip_conntrack *ct)
 		    [hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple)],
 		    &ct->tuplehash[IP_CT_DIR_REPLY]);
 	/* If our expected is in the list, take it out. */
-	if (ct->expected.expectant) {
+	if (expecting && ct->expected.expectant) {
+		MUST_BE_WRITE_LOCKED(&ip_conntrack_lock);
 		IP_NF_ASSERT(list_inlist(&expect_list, &ct->expected));
 		IP_NF_ASSERT(ct->expected.expectant == ct);
 		LIST_DELETE(&expect_list, &ct->expected);
@@ -175,17 +292,18 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	/* Unconfirmed connections haven't been cleaned up by the
 	   timer: hence they cannot be simply deleted here. */
 	if (!(ct->status & IPS_CONFIRMED)) {
-		WRITE_LOCK(&ip_conntrack_lock);
+		int expecting = lock_conntrack(ct);
+
 		/* Race check: they can't get a reference if noone has
-                   one and we have the write lock. */
+                   one and we have the write lock of both buckets. */
 		if (atomic_read(&ct->ct_general.use) == 0) {
-			clean_from_lists(ct);
-			WRITE_UNLOCK(&ip_conntrack_lock);
+			clean_from_lists(ct, expecting);
+			unlock_conntrack(ct, expecting);
 		} else {
 			/* Either a last-minute confirmation (ie. ct
 			   now has timer attached), or a last-minute
 			   new skb has reference (still unconfirmed). */
-			WRITE_UNLOCK(&ip_conntrack_lock);
+			unlock_conntrack(ct, expecting);
 			return;
 		}
 	}
@@ -200,16 +318,18 @@ destroy_conntrack(struct nf_conntrack *nfct)
 		ip_conntrack_destroyed(ct);
 	kmem_cache_free(ip_conntrack_cachep, ct);
 	atomic_dec(&ip_conntrack_count);
+	IP_CT_STAT_INC(delete);
 }
 
 static void death_by_timeout(unsigned long ul_conntrack)
 {
 	struct ip_conntrack *ct = (void *)ul_conntrack;
+	int expecting;
 
-	WRITE_LOCK(&ip_conntrack_lock);
+	expecting = lock_conntrack(ct);
 	IP_NF_ASSERT(ct->status & IPS_CONFIRMED);
-	clean_from_lists(ct);
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	clean_from_lists(ct, expecting);
+	unlock_conntrack(ct, expecting);
 	ip_conntrack_put(ct);
 }
 
@@ -218,19 +338,20 @@ conntrack_tuple_cmp(const struct ip_conntrack_tuple_hash *i,
 		    const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
+	IP_CT_STAT_INC(searched);
 	return i->ctrack != ignored_conntrack
 		&& ip_ct_tuple_equal(tuple, &i->tuple);
 }
 
+/* hash is hash_conntrack(tuple), and its bucket must be locked. */
 static struct ip_conntrack_tuple_hash *
 __ip_conntrack_find(const struct ip_conntrack_tuple *tuple,
-		    const struct ip_conntrack *ignored_conntrack)
+		    const struct ip_conntrack *ignored_conntrack,
+		    unsigned int hash)
 {
 	struct ip_conntrack_tuple_hash *h;
 
-	MUST_BE_READ_LOCKED(&ip_conntrack_lock);
-	h = LIST_FIND(&ip_conntrack_hash[hash_conntrack(tuple)],
+	h = LIST_FIND(&ip_conntrack_hash[hash],
 		      conntrack_tuple_cmp,
 		      struct ip_conntrack_tuple_hash *,
 		      tuple, ignored_conntrack);
@@ -243,22 +364,29 @@ ip_conntrack_find_get(const struct ip_conntrack_tuple *tuple,
 		      const struct ip_conntrack *ignored_conntrack)
 {
 	struct ip_conntrack_tuple_hash *h;
+	unsigned int hash;
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = __ip_conntrack_find(tuple, ignored_conntrack);
+	hash = read_lock_tuple(tuple);
+	h = __ip_conntrack_find(tuple, ignored_conntrack, hash);
 	if (h)
 		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	READ_UNLOCK(IP_CT_BUCKET_LOCK(hash));
 
+	if (h)
+		IP_CT_STAT_INC(found);
 	return h;
 }
 
-/* Confirm a connection */
+/* Confirm a connection.  The lock of the original tuple's bucket
+   serialises the confirmed bit and the timer, against
+   ip_ct_refresh and the unhashing of unconfirmed connections. */
 void
 ip_conntrack_confirm(struct ip_conntrack *ct)
 {
+	unsigned int hash;
+
 	DEBUGP("Confirming conntrack %p\n", ct);
-	WRITE_LOCK(&ip_conntrack_lock);
+	hash = write_lock_tuple(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
 	/* Race check */
 	if (!(ct->status & IPS_CONFIRMED)) {
 		IP_NF_ASSERT(!timer_pending(&ct->timeout));
@@ -270,7 +398,7 @@ ip_conntrack_confirm(struct ip_conntrack *ct)
 		add_timer(&ct->timeout);
 		atomic_inc(&ct->ct_general.use);
 	}
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	WRITE_UNLOCK(IP_CT_BUCKET_LOCK(hash));
 }
 
 /* Returns true if a connection correspondings to the tuple (required
@@ -280,10 +408,11 @@ ip_conntrack_tuple_taken(const struct ip_conntrack_tuple *tuple,
 			 const struct ip_conntrack *ignored_conntrack)
 {
 	struct ip_conntrack_tuple_hash *h;
+	unsigned int hash;
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	READ_UNLOCK(&ip_conntrack_lock);
+	hash = read_lock_tuple(tuple);
+	h = __ip_conntrack_find(tuple, ignored_conntrack, hash);
+	READ_UNLOCK(IP_CT_BUCKET_LOCK(hash));
 
 	return h != NULL;
 }
@@ -400,17 +529,21 @@ static inline int unreplied(const struct ip_conntrack_tuple_hash *i)
 	return 0;
 }
 
-static int early_drop(struct list_head *chain)
+static int early_drop(unsigned int hash)
 {
 	/* Traverse backwards: gives us oldest, which is roughly LRU */
 	struct ip_conntrack_tuple_hash *h;
 	int dropped = 0;
 
-	READ_LOCK(&ip_conntrack_lock);
-	h = LIST_FIND(chain, unreplied, struct ip_conntrack_tuple_hash *);
+	READ_LOCK(IP_CT_BUCKET_LOCK(hash));
+	/* The table may have shrunk since the caller looked. */
+	h = NULL;
+	if (hash < ip_conntrack_htable_size)
+		h = LIST_FIND(&ip_conntrack_hash[hash], unreplied,
+			      struct ip_conntrack_tuple_hash *);
 	if (h)
 		atomic_inc(&h->ctrack->ct_general.use);
-	READ_UNLOCK(&ip_conntrack_lock);
+	READ_UNLOCK(IP_CT_BUCKET_LOCK(hash));
 
 	if (!h)
 		return dropped;
@@ -418,6 +551,7 @@ static int early_drop(struct list_head *chain)
 	if (del_timer(&h->ctrack->timeout)) {
 		death_by_timeout((unsigned long)h->ctrack);
 		dropped = 1;
+		IP_CT_STAT_INC(early_drop);
 	}
 	ip_conntrack_put(h->ctrack);
 	return dropped;
@@ -436,8 +570,8 @@ static inline int expect_cmp(const struct ip_conntrack_expect *i,
 	return ip_ct_tuple_mask_cmp(tuple, &i->tuple, &i->mask);
 }
 
-/* Allocate a new conntrack; we set everything up, then grab write
-   lock and see if we lost a race.  If we lost it we return 0,
+/* Allocate a new conntrack; we set everything up, then grab the
+   bucket locks and see if we lost a race.  If we lost it we return 0,
    indicating the controlling code should look again. */
 static int
 init_conntrack(const struct ip_conntrack_tuple *tuple,
@@ -450,7 +584,7 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 	struct ip_conntrack_expect *expected;
 	enum ip_conntrack_info ctinfo;
 	unsigned long extra_jiffies;
-	int i;
+	int i, claim = 0;
 	static unsigned int drop_next = 0;
 
 	hash = hash_conntrack(tuple);
@@ -463,23 +597,26 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 
 		/* Try dropping from random chain, or else from the
                    chain about to put into (in case they're trying to
-                   bomb one hash chain). */
-		if (drop_next >= ip_conntrack_htable_size)
-			drop_next = 0;
-		if (!early_drop(&ip_conntrack_hash[drop_next++])
-		    && !early_drop(&ip_conntrack_hash[hash]))
+                   bomb one hash chain).  drop_next is not locked:
+                   only make sure what we use of it is in range. */
+		i = drop_next++;
+		if (i >= ip_conntrack_htable_size)
+			i = drop_next = 0;
+		if (!early_drop(i) && !early_drop(hash)) {
+			IP_CT_STAT_INC(drop);
 			return 1;
+		}
 	}
 
 	if (!invert_tuple(&repl_tuple, tuple, protocol)) {
 		DEBUGP("Can't invert tuple.\n");
 		return 1;
 	}
-	repl_hash = hash_conntrack(&repl_tuple);
 
 	conntrack = kmem_cache_alloc(ip_conntrack_cachep, GFP_ATOMIC);
 	if (!conntrack) {
 		DEBUGP("Can't allocate conntrack.\n");
+		IP_CT_STAT_INC(drop);
 		return 1;
 	}
 
@@ -504,20 +641,40 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 	conntrack->timeout.function = death_by_timeout;
 	conntrack->timeout.expires = extra_jiffies;
 
-	/* Sew in at head of hash list. */
-	WRITE_LOCK(&ip_conntrack_lock);
-	/* Check noone else beat us in the race... */
-	if (__ip_conntrack_find(tuple, NULL)) {
-		WRITE_UNLOCK(&ip_conntrack_lock);
-		kmem_cache_free(ip_conntrack_cachep, conntrack);
-		return 0;
+	/* Helpers and expectations cannot change under the read lock;
+	   the write lock is only needed to claim an expectation, which
+	   is rare, so look for one first. */
+	READ_LOCK(&ip_conntrack_lock);
+	expected = LIST_FIND(&expect_list, expect_cmp,
+			     struct ip_conntrack_expect *, tuple);
+	if (expected) {
+		READ_UNLOCK(&ip_conntrack_lock);
+		WRITE_LOCK(&ip_conntrack_lock);
+		claim = 1;
+		expected = LIST_FIND(&expect_list, expect_cmp,
+				     struct ip_conntrack_expect *, tuple);
 	}
 	conntrack->helper = LIST_FIND(&helpers, helper_cmp,
 				      struct ip_conntrack_helper *,
 				      &repl_tuple);
-	/* Need finding and deleting of expected ONLY if we win race */
-	expected = LIST_FIND(&expect_list, expect_cmp,
-			     struct ip_conntrack_expect *, tuple);
+
+	/* Sew in at head of hash list.  The table cannot be resized
+	   while we hold ip_conntrack_lock. */
+	hash = hash_conntrack(tuple);
+	repl_hash = hash_conntrack(&repl_tuple);
+	write_lock_buckets(hash, repl_hash, repl_hash);
+	/* Check noone else beat us in the race... */
+	if (__ip_conntrack_find(tuple, NULL, hash)) {
+		write_unlock_buckets(hash, repl_hash, repl_hash);
+		if (claim)
+			WRITE_UNLOCK(&ip_conntrack_lock);
+		else
+			READ_UNLOCK(&ip_conntrack_lock);
+		kmem_cache_free(ip_conntrack_cachep, conntrack);
+		IP_CT_STAT_INC(insert_failed);
+		return 0;
+	}
+	/* Need deleting of expected ONLY if we win race */
 	if (expected) {
 		/* Welcome, Mr. Bond.  We've been expecting you... */
 		conntrack->status = IPS_EXPECTED;
@@ -535,7 +692,15 @@ init_conntrack(const struct ip_conntrack_tuple *tuple,
 	list_prepend(&ip_conntrack_hash[repl_hash],
 		     &conntrack->tuplehash[IP_CT_DIR_REPLY]);
 	atomic_inc(&ip_conntrack_count);
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	write_unlock_buckets(hash, repl_hash, repl_hash);
+	if (claim)
+		WRITE_UNLOCK(&ip_conntrack_lock);
+	else
+		READ_UNLOCK(&ip_conntrack_lock);
+
+	IP_CT_STAT_INC(new);
+	if (expected)
+		IP_CT_STAT_INC(expect_new);
 
 	/* Update skb to refer to this connection */
 	skb->nfct = &conntrack->infos[ctinfo];
@@ -694,6 +859,7 @@ unsigned int ip_conntrack_in(unsigned int hooknum,
 	ret = proto->packet(ct, (*pskb)->nh.iph, (*pskb)->len, ctinfo);
 	if (ret == -1) {
 		/* Invalid */
+		IP_CT_STAT_INC(invalid);
 		nf_conntrack_put((*pskb)->nfct);
 		(*pskb)->nfct = NULL;
 		return NF_ACCEPT;
@@ -704,6 +870,7 @@ unsigned int ip_conntrack_in(unsigned int hooknum,
 				       ct, ctinfo);
 		if (ret == -1) {
 			/* Invalid */
+			IP_CT_STAT_INC(invalid);
 			nf_conntrack_put((*pskb)->nfct);
 			(*pskb)->nfct = NULL;
 			return NF_ACCEPT;
@@ -783,19 +950,25 @@ void ip_conntrack_unexpect_related(struct ip_conntrack *related_to)
 int ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 			     const struct ip_conntrack_tuple *newreply)
 {
-	unsigned int newindex = hash_conntrack(newreply);
+	unsigned int newindex, oldindex, origindex;
 
-	WRITE_LOCK(&ip_conntrack_lock);
-	if (__ip_conntrack_find(newreply, conntrack)) {
-		WRITE_UNLOCK(&ip_conntrack_lock);
+	/* The original tuple's bucket too: everyone who locks this
+	   conntrack finds its reply bucket through the tuple we are
+	   about to change. */
+	READ_LOCK(&ip_conntrack_lock);
+	newindex = hash_conntrack(newreply);
+	oldindex = hash_conntrack(&conntrack->tuplehash[IP_CT_DIR_REPLY].tuple);
+	origindex = hash_conntrack(&conntrack->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+	write_lock_buckets(origindex, oldindex, newindex);
+	if (__ip_conntrack_find(newreply, conntrack, newindex)) {
+		write_unlock_buckets(origindex, oldindex, newindex);
+		READ_UNLOCK(&ip_conntrack_lock);
 		return 0;
 	}
 	DEBUGP("Altering reply tuple of %p to ", conntrack);
 	DUMP_TUPLE(newreply);
 
-	LIST_DELETE(&ip_conntrack_hash
-		    [hash_conntrack(&conntrack->tuplehash[IP_CT_DIR_REPLY]
-				    .tuple)],
+	LIST_DELETE(&ip_conntrack_hash[oldindex],
 		    &conntrack->tuplehash[IP_CT_DIR_REPLY]);
 	conntrack->tuplehash[IP_CT_DIR_REPLY].tuple = *newreply;
 	list_prepend(&ip_conntrack_hash[newindex],
@@ -803,7 +976,8 @@ int ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 	conntrack->helper = LIST_FIND(&helpers, helper_cmp,
 				      struct ip_conntrack_helper *,
 				      newreply);
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	write_unlock_buckets(origindex, oldindex, newindex);
+	READ_UNLOCK(&ip_conntrack_lock);
 	return 1;
 }
 
@@ -843,9 +1017,12 @@ void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 	LIST_DELETE(&helpers, me);
 
 	/* Get rid of expecteds, set helpers to NULL. */
-	for (i = 0; i < ip_conntrack_htable_size; i++)
+	for (i = 0; i < ip_conntrack_htable_size; i++) {
+		WRITE_LOCK(IP_CT_BUCKET_LOCK(i));
 		LIST_FIND_W(&ip_conntrack_hash[i], unhelp,
 			    struct ip_conntrack_tuple_hash *, me);
+		WRITE_UNLOCK(IP_CT_BUCKET_LOCK(i));
+	}
 	WRITE_UNLOCK(&ip_conntrack_lock);
 
 	/* Someone could be still looking at the helper in a bh. */
@@ -858,9 +1035,12 @@ void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 /* Refresh conntrack for this many jiffies. */
 void ip_ct_refresh(struct ip_conntrack *ct, unsigned long extra_jiffies)
 {
+	unsigned int hash;
+
 	IP_NF_ASSERT(ct->timeout.data == (unsigned long)ct);
 
-	WRITE_LOCK(&ip_conntrack_lock);
+	/* See ip_conntrack_confirm */
+	hash = write_lock_tuple(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
 	/* Timer may not be active yet */
 	if (!(ct->status & IPS_CONFIRMED))
 		ct->timeout.expires = extra_jiffies;
@@ -871,7 +1051,7 @@ void ip_ct_refresh(struct ip_conntrack *ct, unsigned long extra_jiffies)
 			add_timer(&ct->timeout);
 		}
 	}
-	WRITE_UNLOCK(&ip_conntrack_lock);
+	WRITE_UNLOCK(IP_CT_BUCKET_LOCK(hash));
 }
 
 /* Returns new sk_buff, or NULL */
@@ -920,13 +1100,16 @@ get_next_corpse(int (*kill)(const struct ip_conntrack *i, void *data),
 	struct ip_conntrack_tuple_hash *h = NULL;
 	unsigned int i;
 
+	/* Keeps the table from being resized under the walk. */
 	READ_LOCK(&ip_conntrack_lock);
 	for (i = 0; !h && i < ip_conntrack_htable_size; i++) {
+		READ_LOCK(IP_CT_BUCKET_LOCK(i));
 		h = LIST_FIND(&ip_conntrack_hash[i], do_kill,
 			      struct ip_conntrack_tuple_hash *, kill, data);
+		if (h)
+			atomic_inc(&h->ctrack->ct_general.use);
+		READ_UNLOCK(IP_CT_BUCKET_LOCK(i));
 	}
-	if (h)
-		atomic_inc(&h->ctrack->ct_general.use);
 	READ_UNLOCK(&ip_conntrack_lock);
 
 	return h;
@@ -947,15 +1130,16 @@ ip_ct_selective_cleanup(int (*kill)(const struct ip_conntrack *i, void *data),
 			/* Unconfirmed connection.  Clean from lists,
 			   mark confirmed so it gets cleaned as soon
 			   as skb freed. */
-			WRITE_LOCK(&ip_conntrack_lock);
+			int expecting = lock_conntrack(h->ctrack);
+
 			/* Lock protects race against another setting
                            of confirmed bit.  set_bit isolates this
                            bit from the others. */
 			if (!(h->ctrack->status & IPS_CONFIRMED)) {
-				clean_from_lists(h->ctrack);
+				clean_from_lists(h->ctrack, expecting);
 				set_bit(IPS_CONFIRMED_BIT, &h->ctrack->status);
 			}
-			WRITE_UNLOCK(&ip_conntrack_lock);
+			unlock_conntrack(h->ctrack, expecting);
 		}
 		/* ... else the timer will get him soon. */
 
@@ -1017,15 +1201,92 @@ static struct nf_sockopt_ops so_getorigdst
     SO_ORIGINAL_DST, SO_ORIGINAL_DST+1, &getorigdst,
     0, NULL };
 
+/* Move every connection into a new table of size buckets, hashed
+   with a new key.  Nothing is flushed; packets wait while it runs,
+   since it holds every lock there is. */
+int ip_conntrack_set_hashsize(unsigned int size)
+{
+	struct list_head *hash, *old;
+	unsigned int i, oldsize;
+	u_int32_t rnd;
+
+	if (size == 0)
+		return -EINVAL;
+
+	hash = vmalloc(sizeof(struct list_head) * size);
+	if (!hash)
+		return -ENOMEM;
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&hash[i]);
+	get_random_bytes(&rnd, sizeof(rnd));
+
+	WRITE_LOCK(&ip_conntrack_lock);
+	for (i = 0; i < IP_CT_HASH_LOCKS; i++)
+		WRITE_LOCK(&ip_conntrack_hash_lock[i]);
+	write_seqcount_begin(&ip_conntrack_hash_seq);
+
+	old = ip_conntrack_hash;
+	oldsize = ip_conntrack_htable_size;
+	ip_conntrack_hash = hash;
+	ip_conntrack_htable_size = size;
+	ip_conntrack_hash_rnd = rnd;
+
+	for (i = 0; i < oldsize; i++) {
+		while (!list_empty(&old[i])) {
+			struct ip_conntrack_tuple_hash *h
+				= (struct ip_conntrack_tuple_hash *)old[i].next;
+
+			list_del(&h->list);
+			list_add(&h->list, &hash[hash_conntrack(&h->tuple)]);
+		}
+	}
+
+	write_seqcount_end(&ip_conntrack_hash_seq);
+	for (i = IP_CT_HASH_LOCKS; i-- > 0; )
+		WRITE_UNLOCK(&ip_conntrack_hash_lock[i]);
+	WRITE_UNLOCK(&ip_conntrack_lock);
+
+	printk("ip_conntrack: hash resized from %u to %u buckets\n",
+	       oldsize, size);
+	vfree(old);
+	return 0;
+}
+
+/* Can be given at module load, and changed in
+   /proc/sys/net/ipv4/ip_conntrack_buckets afterwards. */
+static int hashsize = 0;
+MODULE_PARM(hashsize, "i");
+
 #define NET_IP_CONNTRACK_MAX 2089
 #define NET_IP_CONNTRACK_MAX_NAME "ip_conntrack_max"
+#define NET_IP_CONNTRACK_BUCKETS 2090
+#define NET_IP_CONNTRACK_BUCKETS_NAME "ip_conntrack_buckets"
 
 #ifdef CONFIG_SYSCTL
 static struct ctl_table_header *ip_conntrack_sysctl_header;
 
+static int
+proc_dobuckets(ctl_table *table, int write, struct file *filp,
+	       void *buffer, size_t *lenp)
+{
+	ctl_table tmp = *table;
+	int size = ip_conntrack_htable_size;
+	int ret;
+
+	tmp.data = &size;
+	ret = proc_dointvec(&tmp, write, filp, buffer, lenp);
+	if (ret || !write || size == ip_conntrack_htable_size)
+		return ret;
+	if (size <= 0)
+		return -EINVAL;
+	return ip_conntrack_set_hashsize(size);
+}
+
 static ctl_table ip_conntrack_table[] = {
 	{ NET_IP_CONNTRACK_MAX, NET_IP_CONNTRACK_MAX_NAME, &ip_conntrack_max,
 	  sizeof(ip_conntrack_max), 0644,  NULL, proc_dointvec },
+	{ NET_IP_CONNTRACK_BUCKETS, NET_IP_CONNTRACK_BUCKETS_NAME, NULL,
+	  sizeof(int), 0644, NULL, proc_dobuckets },
  	{ 0 }
 };
 
@@ -1072,10 +1333,14 @@ int __init ip_conntrack_init(void)
 
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
 	 * machine has 256 buckets.  1GB machine has 8192 buckets. */
-	ip_conntrack_htable_size
-		= (((num_physpages << PAGE_SHIFT) / 16384)
-		   / sizeof(struct list_head));
+	if (hashsize > 0)
+		ip_conntrack_htable_size = hashsize;
+	else
+		ip_conntrack_htable_size
+			= (((num_physpages << PAGE_SHIFT) / 16384)
+			   / sizeof(struct list_head));
 	ip_conntrack_max = 8 * ip_conntrack_htable_size;
+	get_random_bytes(&ip_conntrack_hash_rnd, sizeof(ip_conntrack_hash_rnd));
 
 	printk("ip_conntrack (%u buckets, %d max)\n",
 	       ip_conntrack_htable_size, ip_conntrack_max);
@@ -17,8 +17,8 @@
 #include <linux/version.h>
 #include <net/checksum.h>
 
-#define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
-#define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
+#define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(ip_conntrack_list_lock(x))
+#define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(ip_conntrack_list_lock(x))
 
 #include <linux/netfilter_ipv4/ip_conntrack.h>
 #include <linux/netfilter_ipv4/ip_conntrack_protocol.h>
@@ -134,9 +134,14 @@ list_conntracks(char *buffer, char **start, off_t offset, int length)
 	READ_LOCK(&ip_conntrack_lock);
 	/* Traverse hash; print originals then reply. */
 	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		if (LIST_FIND(&ip_conntrack_hash[i], conntrack_iterate,
-			      struct ip_conntrack_tuple_hash *,
-			      buffer, offset, &upto, &len, length))
+		int done;
+
+		READ_LOCK(IP_CT_BUCKET_LOCK(i));
+		done = (LIST_FIND(&ip_conntrack_hash[i], conntrack_iterate,
+				  struct ip_conntrack_tuple_hash *,
+				  buffer, offset, &upto, &len, length) != NULL);
+		READ_UNLOCK(IP_CT_BUCKET_LOCK(i));
+		if (done)
 			goto finished;
 	}
 
@@ -163,6 +168,39 @@ list_conntracks(char *buffer, char **start, off_t offset, int length)
 	return len;
 }
 
+/* One line per CPU, like /proc/net/softnet_stat. */
+static int
+conntrack_stats(char *buffer, char **start, off_t offset, int length)
+{
+	int i, lcpu;
+	int len = 0;
+
+	for (lcpu = 0; lcpu < smp_num_cpus; lcpu++) {
+		struct ip_conntrack_stat *st;
+
+		i = cpu_logical_map(lcpu);
+		st = &ip_conntrack_stat[i];
+		len += sprintf(buffer+len, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+			       st->searched,
+			       st->found,
+			       st->new,
+			       st->invalid,
+			       st->delete,
+			       st->insert_failed,
+			       st->drop,
+			       st->early_drop,
+			       st->expect_new);
+	}
+
+	len -= offset;
+	if (len > length)
+		len = length;
+	if (len < 0)
+		len = 0;
+	*start = buffer + offset;
+	return len;
+}
+
 static unsigned int ip_confirm(unsigned int hooknum,
 			       struct sk_buff **pskb,
 			       const struct net_device *in,
@@ -250,6 +288,7 @@ static int init_or_cleanup(int init)
 		goto cleanup_nothing;
 
 	proc_net_create("ip_conntrack",0,list_conntracks);
+	proc_net_create("ip_conntrack_stat",0,conntrack_stats);
 	ret = nf_register_hook(&ip_conntrack_in_ops);
 	if (ret < 0) {
 		printk("ip_conntrack: can't register in hook.\n");
@@ -282,6 +321,7 @@ static int init_or_cleanup(int init)
  cleanup_inops:
 	nf_unregister_hook(&ip_conntrack_in_ops);
  cleanup_init:
+	proc_net_remove("ip_conntrack_stat");
 	proc_net_remove("ip_conntrack");
 	ip_conntrack_cleanup();
  cleanup_nothing:
@@ -16,8 +16,8 @@
 #include <linux/version.h>
 #include <net/route.h>
 
-#define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(&ip_conntrack_lock)
-#define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(&ip_conntrack_lock)
+#define ASSERT_READ_LOCK(x) MUST_BE_READ_LOCKED(ip_conntrack_list_lock(x))
+#define ASSERT_WRITE_LOCK(x) MUST_BE_WRITE_LOCKED(ip_conntrack_list_lock(x))
 
 #include <linux/netfilter_ipv4/ip_conntrack.h>
 #include <linux/netfilter_ipv4/ip_conntrack_core.h>
@@ -63,7 +63,8 @@ do_masquerade(struct sk_buff **pskb, const struct net_device *dev)
 
 	info = &ct->nat.info;
 
-	WRITE_LOCK(&ip_nat_lock);
+	READ_LOCK(&ip_nat_lock);
+	WRITE_LOCK(IP_NAT_INFO_LOCK(ct));
 	/* Setup the masquerade, if not already */
 	if (!info->initialized) {
 		u_int32_t newsrc;
@@ -74,6 +75,8 @@ do_masquerade(struct sk_buff **pskb, const struct net_device *dev)
 		   anyway. */
 		if (ip_route_output(&rt, iph->daddr, 0, 0, 0) != 0) {
 			DEBUGP("ipnat_rule_masquerade: Can't reroute.\n");
+			WRITE_UNLOCK(IP_NAT_INFO_LOCK(ct));
+			READ_UNLOCK(&ip_nat_lock);
 			return NF_DROP;
 		}
 		newsrc = inet_select_addr(rt->u.dst.dev, rt->rt_gateway,
@@ -87,7 +90,8 @@ do_masquerade(struct sk_buff **pskb, const struct net_device *dev)
 
 		ret = ip_nat_setup_info(ct, &range, NF_IP_POST_ROUTING);
 		if (ret != NF_ACCEPT) {
-			WRITE_UNLOCK(&ip_nat_lock);
+			WRITE_UNLOCK(IP_NAT_INFO_LOCK(ct));
+			READ_UNLOCK(&ip_nat_lock);
 			return ret;
 		}
 
@@ -95,7 +99,8 @@ do_masquerade(struct sk_buff **pskb, const struct net_device *dev)
 		info->initialized = 1;
 	} else
 		DEBUGP("Masquerading already done on this conn.\n");
-	WRITE_UNLOCK(&ip_nat_lock);
+	WRITE_UNLOCK(IP_NAT_INFO_LOCK(ct));
+	READ_UNLOCK(&ip_nat_lock);
 
 	return do_bindings(ct, ctinfo, info, NF_IP_POST_ROUTING, pskb);
 }
@@ -287,9 +292,14 @@ masq_procinfo(char *buffer, char **start, off_t offset, int length)
 	READ_LOCK(&ip_conntrack_lock);
 	/* Traverse hash; print originals then reply. */
 	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		if (LIST_FIND(&ip_conntrack_hash[i], masq_iterate,
-			      struct ip_conntrack_tuple_hash *,
-			      buffer, offset, &upto, &len, length))
+		int done;
+
+		READ_LOCK(IP_CT_BUCKET_LOCK(i));
+		done = (LIST_FIND(&ip_conntrack_hash[i], masq_iterate,
+				  struct ip_conntrack_tuple_hash *,
+				  buffer, offset, &upto, &len, length) != NULL);
+		READ_UNLOCK(IP_CT_BUCKET_LOCK(i));
+		if (done)
 			break;
 	}
 	READ_UNLOCK(&ip_conntrack_lock);
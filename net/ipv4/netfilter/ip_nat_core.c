@@ -12,6 +12,9 @@
 #include <linux/skbuff.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/brlock.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
 #include <net/checksum.h>
 #include <net/icmp.h>
 #include <net/ip.h>
@@ -24,6 +27,7 @@
 #include <linux/netfilter_ipv4/ip_nat_protocol.h>
 #include <linux/netfilter_ipv4/ip_nat_core.h>
 #include <linux/netfilter_ipv4/ip_nat_helper.h>
+#include <linux/netfilter_ipv4/ip_conntrack_core.h>
 #include <linux/netfilter_ipv4/listhelp.h>
 
 #if 0
@@ -33,11 +37,20 @@
 #endif
 
 DECLARE_RWLOCK(ip_nat_lock);
+DECLARE_RWLOCK_ARRAY(ip_nat_info_lock, IP_NAT_INFO_LOCKS);
 
-#define IP_NAT_HTABLE_SIZE 64
+/* Each chain of the hashes is protected by one of these; never hold
+   more than one. */
+#define IP_NAT_HASH_LOCKS 256
+#define IP_NAT_BUCKET_LOCK(n) (&ip_nat_hash_lock[(n) & (IP_NAT_HASH_LOCKS-1)])
+static DECLARE_RWLOCK_ARRAY(ip_nat_hash_lock, IP_NAT_HASH_LOCKS);
 
-static struct list_head bysource[IP_NAT_HTABLE_SIZE];
-static struct list_head byipsproto[IP_NAT_HTABLE_SIZE];
+/* Sized from the conntrack hash; keyed, like it. */
+static unsigned int ip_nat_htable_size;
+static u_int32_t ip_nat_hash_rnd;
+
+static struct list_head *bysource;
+static struct list_head *byipsproto;
 LIST_HEAD(protos);
 static LIST_HEAD(helpers);
 
@@ -49,14 +62,33 @@ hash_by_ipsproto(u_int32_t src, u_int32_t dst, u_int16_t proto)
 {
 	/* Modified src and dst, to ensure we don't create two
            identical streams. */
-	return (src + dst + proto) % IP_NAT_HTABLE_SIZE;
+	return jhash_3words(src, dst, proto, ip_nat_hash_rnd)
+		% ip_nat_htable_size;
 }
 
 static inline size_t
 hash_by_src(const struct ip_conntrack_manip *manip, u_int16_t proto)
 {
 	/* Original src, to ensure we map it consistently if poss. */
-	return (manip->ip + manip->u.all + proto) % IP_NAT_HTABLE_SIZE;
+	return jhash_3words(manip->ip, manip->u.all, proto, ip_nat_hash_rnd)
+		% ip_nat_htable_size;
+}
+
+static void
+nat_hash_add(struct list_head *table, struct ip_nat_hash *h, size_t hash)
+{
+	WRITE_LOCK(IP_NAT_BUCKET_LOCK(hash));
+	list_add(&h->list, &table[hash]);
+	h->hash = hash;
+	WRITE_UNLOCK(IP_NAT_BUCKET_LOCK(hash));
+}
+
+static void
+nat_hash_del(struct ip_nat_hash *h)
+{
+	WRITE_LOCK(IP_NAT_BUCKET_LOCK(h->hash));
+	list_del(&h->list);
+	WRITE_UNLOCK(IP_NAT_BUCKET_LOCK(h->hash));
 }
 
 /* Noone using conntrack by the time this called. */
@@ -70,22 +102,8 @@ static void ip_nat_cleanup_conntrack(struct ip_conntrack *conn)
 	IP_NF_ASSERT(info->bysource.conntrack);
 	IP_NF_ASSERT(info->byipsproto.conntrack);
 
-	WRITE_LOCK(&ip_nat_lock);
-	LIST_DELETE(&bysource[hash_by_src(&conn->tuplehash[IP_CT_DIR_ORIGINAL]
-					  .tuple.src,
-					  conn->tuplehash[IP_CT_DIR_ORIGINAL]
-					  .tuple.dst.protonum)],
-		    &info->bysource);
-
-	LIST_DELETE(&byipsproto
-		    [hash_by_ipsproto(conn->tuplehash[IP_CT_DIR_REPLY]
-				      .tuple.src.ip,
-				      conn->tuplehash[IP_CT_DIR_REPLY]
-				      .tuple.dst.ip,
-				      conn->tuplehash[IP_CT_DIR_REPLY]
-				      .tuple.dst.protonum)],
-		    &info->byipsproto);
-	WRITE_UNLOCK(&ip_nat_lock);
+	nat_hash_del(&info->bysource);
+	nat_hash_del(&info->byipsproto);
 }
 
 /* We do checksum mangling, so if they were wrong before they're still
@@ -104,12 +122,12 @@ static inline int cmp_proto(const struct ip_nat_protocol *i, int proto)
 	return i->protonum == proto;
 }
 
+/* With ip_nat_lock, or from a hook, under BR_NETPROTO_LOCK. */
 struct ip_nat_protocol *
 find_nat_proto(u_int16_t protonum)
 {
 	struct ip_nat_protocol *i;
 
-	MUST_BE_READ_LOCKED(&ip_nat_lock);
 	i = LIST_FIND(&protos, cmp_proto, struct ip_nat_protocol *, protonum);
 	if (!i)
 		i = &unknown_nat_protocol;
@@ -132,6 +150,39 @@ ip_nat_used_tuple(const struct ip_conntrack_tuple *tuple,
 	return ip_conntrack_tuple_taken(&reply, ignored_conntrack);
 }
 
+#define IP_NAT_PORT_TRIES 128
+
+/* Each try is a conntrack lookup, and with tens of thousands of
+   bindings on one address, walking the range from one end finds the
+   same used stretch every time.  So start somewhere random, give up
+   after a bounded number of tries, and take a few fresh random starts
+   (with fewer tries each) before failing. */
+int
+ip_nat_unique_port(struct ip_conntrack_tuple *tuple,
+		   u_int16_t *portptr,
+		   unsigned int min,
+		   unsigned int range_size,
+		   const struct ip_conntrack *conntrack)
+{
+	unsigned int tries, i, off;
+
+	tries = range_size < IP_NAT_PORT_TRIES
+		? range_size : IP_NAT_PORT_TRIES;
+	off = net_random();
+	for (;;) {
+		for (i = 0; i < tries; i++, off++) {
+			*portptr = htons(min + off % range_size);
+			if (!ip_nat_used_tuple(tuple, conntrack))
+				return 1;
+		}
+		/* Tried them all, or enough. */
+		if (tries >= range_size || tries < 16)
+			return 0;
+		tries /= 2;
+		off = net_random();
+	}
+}
+
 /* Does tuple + the source manip come within the range mr */
 static int
 in_range(const struct ip_conntrack_tuple *tuple,
@@ -180,20 +231,24 @@ src_cmp(const struct ip_nat_hash *i,
 			    mr));
 }
 
-/* Only called for SRC manip */
-static struct ip_conntrack_manip *
+/* Only called for SRC manip.  Copies it out: once the chain is
+   unlocked, the conntrack can go. */
+static int
 find_appropriate_src(const struct ip_conntrack_tuple *tuple,
-		     const struct ip_nat_multi_range *mr)
+		     const struct ip_nat_multi_range *mr,
+		     struct ip_conntrack_manip *manip)
 {
 	unsigned int h = hash_by_src(&tuple->src, tuple->dst.protonum);
 	struct ip_nat_hash *i;
 
 	MUST_BE_READ_LOCKED(&ip_nat_lock);
+	READ_LOCK(IP_NAT_BUCKET_LOCK(h));
 	i = LIST_FIND(&bysource[h], src_cmp, struct ip_nat_hash *, tuple, mr);
 	if (i)
-		return &i->conntrack->tuplehash[IP_CT_DIR_ORIGINAL].tuple.src;
-	else
-		return NULL;
+		*manip = i->conntrack->tuplehash[IP_CT_DIR_ORIGINAL].tuple.src;
+	READ_UNLOCK(IP_NAT_BUCKET_LOCK(h));
+
+	return i != NULL;
 }
 
 /* If it's really a local destination manip, it may need to do a
@@ -238,11 +293,14 @@ count_maps(u_int32_t src, u_int32_t dst, u_int16_t protonum,
 	   const struct ip_conntrack *conntrack)
 {
 	unsigned int score = 0;
+	unsigned int h = hash_by_ipsproto(src, dst, protonum);
 
 	MUST_BE_READ_LOCKED(&ip_nat_lock);
-	LIST_FIND(&byipsproto[hash_by_ipsproto(src, dst, protonum)],
+	READ_LOCK(IP_NAT_BUCKET_LOCK(h));
+	LIST_FIND(&byipsproto[h],
 		  fake_cmp, struct ip_nat_hash *, src, dst, protonum, &score,
 		  conntrack);
+	READ_UNLOCK(IP_NAT_BUCKET_LOCK(h));
 
 	return score;
 }
@@ -399,13 +457,12 @@ get_unique_tuple(struct ip_conntrack_tuple *tuple,
 	   So far, we don't do local source mappings, so multiple
 	   manips not an issue.  */
 	if (hooknum == NF_IP_POST_ROUTING) {
-		struct ip_conntrack_manip *manip;
+		struct ip_conntrack_manip manip;
 
-		manip = find_appropriate_src(orig_tuple, mr);
-		if (manip) {
+		if (find_appropriate_src(orig_tuple, mr, &manip)) {
 			/* Apply same source manipulation. */
 			*tuple = ((struct ip_conntrack_tuple)
-				  { *manip, orig_tuple->dst });
+				  { manip, orig_tuple->dst });
 			DEBUGP("get_unique_tuple: Found current src map\n");
 			return 1;
 		}
@@ -481,7 +538,8 @@ ip_nat_setup_info(struct ip_conntrack *conntrack,
 	struct ip_conntrack_tuple orig_tp;
 	struct ip_nat_info *info = &conntrack->nat.info;
 
-	MUST_BE_WRITE_LOCKED(&ip_nat_lock);
+	MUST_BE_READ_LOCKED(&ip_nat_lock);
+	MUST_BE_WRITE_LOCKED(IP_NAT_INFO_LOCK(conntrack));
 	IP_NF_ASSERT(hooknum == NF_IP_PRE_ROUTING
 		     || hooknum == NF_IP_POST_ROUTING
 		     || hooknum == NF_IP_LOCAL_OUT);
@@ -624,13 +682,13 @@ void replace_in_hashes(struct ip_conntrack *conntrack,
 				   .tuple.dst.protonum);
 
 	IP_NF_ASSERT(info->bysource.conntrack == conntrack);
-	MUST_BE_WRITE_LOCKED(&ip_nat_lock);
+	MUST_BE_WRITE_LOCKED(IP_NAT_INFO_LOCK(conntrack));
 
-	list_del(&info->bysource.list);
-	list_del(&info->byipsproto.list);
+	nat_hash_del(&info->bysource);
+	nat_hash_del(&info->byipsproto);
 
-	list_prepend(&bysource[srchash], &info->bysource);
-	list_prepend(&byipsproto[ipsprotohash], &info->byipsproto);
+	nat_hash_add(bysource, &info->bysource, srchash);
+	nat_hash_add(byipsproto, &info->byipsproto, ipsprotohash);
 }
 
 void place_in_hashes(struct ip_conntrack *conntrack,
@@ -653,12 +711,12 @@ void place_in_hashes(struct ip_conntrack *conntrack,
 
 	IP_NF_ASSERT(!info->bysource.conntrack);
 
-	MUST_BE_WRITE_LOCKED(&ip_nat_lock);
+	MUST_BE_WRITE_LOCKED(IP_NAT_INFO_LOCK(conntrack));
 	info->byipsproto.conntrack = conntrack;
 	info->bysource.conntrack = conntrack;
 
-	list_prepend(&bysource[srchash], &info->bysource);
-	list_prepend(&byipsproto[ipsprotohash], &info->byipsproto);
+	nat_hash_add(bysource, &info->bysource, srchash);
+	nat_hash_add(byipsproto, &info->byipsproto, ipsprotohash);
 }
 
 static void
@@ -704,10 +762,10 @@ do_bindings(struct ip_conntrack *ct,
 	struct ip_nat_helper *helper;
 	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
 
-	/* Need nat lock to protect against modification, but neither
-	   conntrack (referenced) and helper (deleted with
+	/* Need the conntrack's lock to protect against modification,
+	   but neither conntrack (referenced) and helper (deleted with
 	   synchronize_bh()) can vanish. */
-	READ_LOCK(&ip_nat_lock);
+	READ_LOCK(IP_NAT_INFO_LOCK(ct));
 	for (i = 0; i < info->num_manips; i++) {
 		if (info->manips[i].direction == dir
 		    && info->manips[i].hooknum == hooknum) {
@@ -726,7 +784,7 @@ do_bindings(struct ip_conntrack *ct,
 		}
 	}
 	helper = info->helper;
-	READ_UNLOCK(&ip_nat_lock);
+	READ_UNLOCK(IP_NAT_INFO_LOCK(ct));
 
 	if (helper) {
 		/* Always defragged for helpers */
@@ -780,7 +838,7 @@ icmp_reply_translation(struct sk_buff *skb,
 	   such addresses are not too uncommon, as Alan Cox points
 	   out) */
 
-	READ_LOCK(&ip_nat_lock);
+	READ_LOCK(IP_NAT_INFO_LOCK(conntrack));
 	for (i = 0; i < info->num_manips; i++) {
 		DEBUGP("icmp_reply: manip %u dir %s hook %u\n",
 		       i, info->manips[i].direction == IP_CT_DIR_ORIGINAL ?
@@ -819,7 +877,7 @@ icmp_reply_translation(struct sk_buff *skb,
 				  &skb->nfcache);
 		}
 	}
-	READ_UNLOCK(&ip_nat_lock);
+	READ_UNLOCK(IP_NAT_INFO_LOCK(conntrack));
 
 	/* Since we mangled inside ICMP packet, recalculate its
 	   checksum from scratch.  (Hence the handling of incorrect
@@ -852,9 +910,9 @@ kill_helper(const struct ip_conntrack *i, void *helper)
 {
 	int ret;
 
-	READ_LOCK(&ip_nat_lock);
+	READ_LOCK(IP_NAT_INFO_LOCK(i));
 	ret = (i->nat.info.helper == helper);
-	READ_UNLOCK(&ip_nat_lock);
+	READ_UNLOCK(IP_NAT_INFO_LOCK(i));
 
 	return ret;
 }
@@ -885,6 +943,14 @@ int __init ip_nat_init(void)
 {
 	size_t i;
 
+	/* As many chains as conntrack had when we loaded. */
+	ip_nat_htable_size = ip_conntrack_htable_size;
+	bysource = vmalloc(sizeof(struct list_head) * ip_nat_htable_size * 2);
+	if (!bysource)
+		return -ENOMEM;
+	byipsproto = bysource + ip_nat_htable_size;
+	get_random_bytes(&ip_nat_hash_rnd, sizeof(ip_nat_hash_rnd));
+
 	/* Sew in builtin protocols. */
 	WRITE_LOCK(&ip_nat_lock);
 	list_append(&protos, &ip_nat_protocol_tcp);
@@ -892,7 +958,7 @@ int __init ip_nat_init(void)
 	list_append(&protos, &ip_nat_protocol_icmp);
 	WRITE_UNLOCK(&ip_nat_lock);
 
-	for (i = 0; i < IP_NAT_HTABLE_SIZE; i++) {
+	for (i = 0; i < ip_nat_htable_size; i++) {
 		INIT_LIST_HEAD(&bysource[i]);
 		INIT_LIST_HEAD(&byipsproto[i]);
 	}
@@ -907,4 +973,5 @@ int __init ip_nat_init(void)
 void ip_nat_cleanup(void)
 {
 	ip_conntrack_destroyed = NULL;
+	vfree(bysource);
 }
@@ -92,7 +92,8 @@ ip_nat_fn(unsigned int hooknum,
 	case IP_CT_NEW:
 		info = &ct->nat.info;
 
-		WRITE_LOCK(&ip_nat_lock);
+		READ_LOCK(&ip_nat_lock);
+		WRITE_LOCK(IP_NAT_INFO_LOCK(ct));
 		/* Seen it before?  This can happen for loopback, retrans,
 		   or local packets.. */
 		if (!(info->initialized & (1 << maniptype))) {
@@ -102,7 +103,8 @@ ip_nat_fn(unsigned int hooknum,
 			ret = ip_nat_rule_find(pskb, hooknum, in, out,
 					       ct, info);
 			if (ret != NF_ACCEPT) {
-				WRITE_UNLOCK(&ip_nat_lock);
+				WRITE_UNLOCK(IP_NAT_INFO_LOCK(ct));
+				READ_UNLOCK(&ip_nat_lock);
 				return ret;
 			}
 
@@ -116,7 +118,8 @@ ip_nat_fn(unsigned int hooknum,
 			DEBUGP("Already setup manip %s for ct %p\n",
 			       maniptype == IP_NAT_MANIP_SRC ? "SRC" : "DST",
 			       ct);
-		WRITE_UNLOCK(&ip_nat_lock);
+		WRITE_UNLOCK(IP_NAT_INFO_LOCK(ct));
+		READ_UNLOCK(&ip_nat_lock);
 		break;
 
 	default:
@@ -234,6 +237,9 @@ int ip_nat_protocol_register(struct ip_nat_protocol *proto)
 	int ret = 0;
 	struct list_head *i;
 
+	/* Packets walk the list without ip_nat_lock.  They hold
+	   BR_NETPROTO_LOCK first, then maybe ip_nat_lock; so do we. */
+	br_write_lock_bh(BR_NETPROTO_LOCK);
 	WRITE_LOCK(&ip_nat_lock);
 	for (i = protos.next; i != &protos; i = i->next) {
 		if (((struct ip_nat_protocol *)i)->protonum
@@ -248,6 +254,7 @@ int ip_nat_protocol_register(struct ip_nat_protocol *proto)
 
  out:
 	WRITE_UNLOCK(&ip_nat_lock);
+	br_write_unlock_bh(BR_NETPROTO_LOCK);
 	return ret;
 }
 
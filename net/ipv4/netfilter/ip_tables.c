@@ -96,6 +96,8 @@ struct ipt_table_info
 static LIST_HEAD(ipt_target);
 static LIST_HEAD(ipt_match);
 static LIST_HEAD(ipt_tables);
+/* Bumped, under ipt_mutex, whenever a table's contents are swapped. */
+static unsigned int ipt_generation;
 #define ADD_COUNTER(c,b,p) do { (c).bcnt += (b); (c).pcnt += (p); } while(0)
 
 #ifdef CONFIG_SMP
@@ -487,10 +489,24 @@ unconditional(const struct ipt_ip *ip)
 	return 1;
 }
 
+static struct ipt_target ipt_standard_target;
+static struct ipt_target ipt_error_target;
+
+/* Before check_entry() the target is known by name, after it by
+   pointer. */
+static inline int
+standard_target(const struct ipt_entry_target *t, int translated)
+{
+	if (translated)
+		return t->u.kernel.target == &ipt_standard_target;
+	return strcmp(t->u.user.name, IPT_STANDARD_TARGET) == 0;
+}
+
 /* Figures out from what hook each rule can be called: returns 0 if
    there are loops.  Puts hook bitmask in comefrom. */
 static int
-mark_source_chains(struct ipt_table_info *newinfo, unsigned int valid_hooks)
+mark_source_chains(struct ipt_table_info *newinfo, unsigned int valid_hooks,
+		   int translated)
 {
 	unsigned int hook;
 
@@ -521,8 +537,7 @@ mark_source_chains(struct ipt_table_info *newinfo, unsigned int valid_hooks)
 
 			/* Unconditional return/END. */
 			if (e->target_offset == sizeof(struct ipt_entry)
-			    && (strcmp(t->target.u.user.name,
-				       IPT_STANDARD_TARGET) == 0)
+			    && standard_target(&t->target, translated)
 			    && t->verdict < 0
 			    && unconditional(&e->ip)) {
 				unsigned int oldpos, size;
@@ -561,8 +576,7 @@ mark_source_chains(struct ipt_table_info *newinfo, unsigned int valid_hooks)
 			} else {
 				int newpos = t->verdict;
 
-				if (strcmp(t->target.u.user.name,
-					   IPT_STANDARD_TARGET) == 0
+				if (standard_target(&t->target, translated)
 				    && newpos >= 0) {
 					/* This a jump; chase it. */
 					duprintf("Jump rule %u -> %u\n",
@@ -664,8 +678,6 @@ check_match(struct ipt_entry_match *m,
 	return 0;
 }
 
-static struct ipt_target ipt_standard_target;
-
 static inline int
 check_entry(struct ipt_entry *e, const char *name, unsigned int size,
 	    unsigned int *i)
@@ -843,7 +855,7 @@ translate_table(const char *name,
 		}
 	}
 
-	if (!mark_source_chains(newinfo, valid_hooks))
+	if (!mark_source_chains(newinfo, valid_hooks, 0))
 		return -ELOOP;
 
 	/* Finally, each sanity check must pass */
@@ -902,6 +914,7 @@ replace_table(struct ipt_table *table,
 	}
 	oldinfo = table->private;
 	table->private = newinfo;
+	ipt_generation++;
 	write_unlock_bh(&table->lock);
 
 	return oldinfo;
@@ -1194,6 +1207,372 @@ do_add_counters(void *user, unsigned int len)
 	return ret;
 }
 
+/* Incremental updates.
+ *
+ * Changing one rule with IPT_SO_SET_REPLACE copies the whole table in
+ * from userspace, checks every rule again and hands every counter
+ * back.  IPT_SO_SET_INSERT and IPT_SO_SET_DELETE splice a single entry
+ * into or out of the table in the kernel instead: only a new entry is
+ * checked, jumps beyond the splice move by its size, and each CPU's
+ * copy keeps its own counters, which are only summed when read. */
+
+static inline int
+find_offset(const struct ipt_entry *e, const char *base, unsigned int off)
+{
+	return (const char *)e - base == off;
+}
+
+/* Is there an entry starting at off? */
+static inline int
+entry_at(const struct ipt_table_info *info, unsigned int off)
+{
+	return off < info->size
+		&& IPT_ENTRY_ITERATE(info->entries, info->size,
+				     find_offset, info->entries, off);
+}
+
+/* Jumps to pos stay there: to the new entry for an insert, to the one
+   which took the deleted entry's place for a delete. */
+static inline int
+relocate_entry(struct ipt_entry *e, unsigned int pos, int delta)
+{
+	struct ipt_standard_target *t = (void *)ipt_get_target(e);
+
+	if (standard_target(&t->target, 1) && t->verdict > (int)pos)
+		t->verdict += delta;
+	return 0;
+}
+
+static inline int
+clear_comefrom(struct ipt_entry *e)
+{
+	e->comefrom = 0;
+	return 0;
+}
+
+/* Lay out one copy of oldinfo, with delta bytes opened (or closed) at
+   pos, in newinfo.  The caller fills in any new entry. */
+static void
+splice_entries(struct ipt_table_info *newinfo,
+	       const struct ipt_table_info *oldinfo,
+	       unsigned int valid_hooks,
+	       unsigned int pos,
+	       int delta)
+{
+	unsigned int h, tail;
+
+	newinfo->size = oldinfo->size + delta;
+	newinfo->number = oldinfo->number + (delta > 0 ? 1 : -1);
+
+	for (h = 0; h < NF_IP_NUMHOOKS; h++) {
+		newinfo->hook_entry[h] = oldinfo->hook_entry[h];
+		newinfo->underflow[h] = oldinfo->underflow[h];
+		if (!(valid_hooks & (1 << h)))
+			continue;
+		if (oldinfo->hook_entry[h] > pos)
+			newinfo->hook_entry[h] += delta;
+		/* Inserting in front of the policy puts the new entry
+		   in its chain. */
+		if (oldinfo->underflow[h] > pos
+		    || (delta > 0 && oldinfo->underflow[h] == pos))
+			newinfo->underflow[h] += delta;
+	}
+
+	memcpy(newinfo->entries, oldinfo->entries, pos);
+	if (delta > 0) {
+		tail = oldinfo->size - pos;
+		memcpy(newinfo->entries + pos + delta,
+		       oldinfo->entries + pos, tail);
+		IPT_ENTRY_ITERATE(newinfo->entries + pos + delta, tail,
+				  relocate_entry, pos, delta);
+	} else {
+		tail = oldinfo->size - pos + delta;
+		memcpy(newinfo->entries + pos,
+		       oldinfo->entries + pos - delta, tail);
+		IPT_ENTRY_ITERATE(newinfo->entries + pos, tail,
+				  relocate_entry, pos, delta);
+	}
+	IPT_ENTRY_ITERATE(newinfo->entries, pos, relocate_entry, pos, delta);
+}
+
+/* Give every CPU's copy of newinfo, laid out by splice_entries() with
+   delta at pos, its counters from the same CPU's copy of the table,
+   and put it in place.  Returns the old table. */
+static struct ipt_table_info *
+splice_table(struct ipt_table *table,
+	     struct ipt_table_info *newinfo,
+	     unsigned int pos,
+	     int delta)
+{
+	struct ipt_table_info *oldinfo;
+	struct ipt_entry *e;
+	unsigned int cpu, off, newoff;
+
+	for (cpu = 1; cpu < smp_num_cpus; cpu++)
+		memcpy(newinfo->entries + TABLE_OFFSET(newinfo, cpu),
+		       newinfo->entries, newinfo->size);
+
+	write_lock_bh(&table->lock);
+	oldinfo = table->private;
+	for (cpu = 0; cpu < smp_num_cpus; cpu++) {
+		void *oldbase = oldinfo->entries + TABLE_OFFSET(oldinfo, cpu);
+		void *newbase = newinfo->entries + TABLE_OFFSET(newinfo, cpu);
+
+		for (off = 0; off < oldinfo->size; off += e->next_offset) {
+			e = oldbase + off;
+			if (off < pos)
+				newoff = off;
+			else if (delta < 0 && off == pos)
+				continue;
+			else
+				newoff = off + delta;
+			((struct ipt_entry *)(newbase + newoff))->counters
+				= e->counters;
+		}
+		if (delta > 0)
+			((struct ipt_entry *)(newbase + pos))->counters
+				= ((struct ipt_counters) { 0, 0 });
+#ifdef CONFIG_NETFILTER_DEBUG
+		((struct ipt_entry *)newbase)->comefrom = 0xdead57ac;
+#endif
+	}
+	table->private = newinfo;
+	ipt_generation++;
+	write_unlock_bh(&table->lock);
+
+	return oldinfo;
+}
+
+/* Sanity of a new entry at pos in the table it is going into; moves
+   its jump, given as an offset in oldinfo. */
+static int
+check_new_entry(struct ipt_entry *e,
+		unsigned int size,
+		const struct ipt_table_info *oldinfo,
+		unsigned int pos)
+{
+	struct ipt_standard_target *t;
+
+	if (e->next_offset != size
+	    || e->target_offset < sizeof(struct ipt_entry)
+	    || e->target_offset + sizeof(struct ipt_entry_target) > size) {
+		duprintf("check_new_entry: bad offsets %u/%u for %u\n",
+			 e->target_offset, e->next_offset, size);
+		return -EINVAL;
+	}
+
+	t = (void *)ipt_get_target(e);
+	if (standard_target(&t->target, 0)
+	    && t->target.u.target_size
+	    == IPT_ALIGN(sizeof(struct ipt_standard_target))
+	    && t->verdict >= 0) {
+		if (!entry_at(oldinfo, t->verdict)) {
+			duprintf("check_new_entry: no entry at %i\n",
+				 t->verdict);
+			return -EINVAL;
+		}
+		if (t->verdict > (int)pos)
+			t->verdict += size;
+	}
+
+	e->counters = ((struct ipt_counters) { 0, 0 });
+	return 0;
+}
+
+static int
+do_insert(void *user, unsigned int len)
+{
+	int ret;
+	struct ipt_insert tmp;
+	struct ipt_table *t;
+	struct ipt_table_info *newinfo, *oldinfo;
+	struct ipt_entry *e;
+	struct ipt_entry_target *target;
+	char name[IPT_FUNCTION_MAXNAMELEN];
+	unsigned int i, generation;
+
+	if (copy_from_user(&tmp, user, sizeof(tmp)) != 0)
+		return -EFAULT;
+
+	if (len != sizeof(tmp) + tmp.size
+	    || tmp.size % __alignof__(struct ipt_entry) != 0
+	    || tmp.size < sizeof(struct ipt_entry)
+			  + sizeof(struct ipt_entry_target))
+		return -EINVAL;
+
+	t = find_table_lock(tmp.name, &ret, &ipt_mutex);
+	if (!t)
+		return ret;
+
+	oldinfo = t->private;
+	if (tmp.num_entries != oldinfo->number) {
+		ret = -EAGAIN;
+		goto unlock;
+	}
+	if (!entry_at(oldinfo, tmp.offset)) {
+		duprintf("do_insert: no entry at %u\n", tmp.offset);
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	newinfo = vmalloc(sizeof(struct ipt_table_info)
+			  + SMP_ALIGN(oldinfo->size + tmp.size) * smp_num_cpus);
+	if (!newinfo) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	splice_entries(newinfo, oldinfo, t->valid_hooks,
+		       tmp.offset, tmp.size);
+	e = (struct ipt_entry *)(newinfo->entries + tmp.offset);
+	if (copy_from_user(e, user + sizeof(tmp), tmp.size) != 0) {
+		ret = -EFAULT;
+		goto free_newinfo_unlock;
+	}
+	ret = check_new_entry(e, tmp.size, oldinfo, tmp.offset);
+	if (ret != 0)
+		goto free_newinfo_unlock;
+
+	/* The new entry may make a loop, and needs to know what hooks
+	   reach it.  comefrom has been scribbled on by ipt_do_table, and
+	   the counters are used as scratch: both get redone below.  The
+	   rest of the table is translated, so the new entry's target is
+	   too, for the walk. */
+	target = ipt_get_target(e);
+	memcpy(name, target->u.user.name, sizeof(name));
+	target->u.kernel.target = standard_target(target, 0)
+		? &ipt_standard_target : NULL;
+	IPT_ENTRY_ITERATE(newinfo->entries, newinfo->size, clear_comefrom);
+	ret = mark_source_chains(newinfo, t->valid_hooks, 1) ? 0 : -ELOOP;
+	memcpy(target->u.user.name, name, sizeof(name));
+	if (ret != 0)
+		goto free_newinfo_unlock;
+	generation = ipt_generation;
+	up(&ipt_mutex);
+
+	/* This takes ipt_mutex itself, to look up matches and target. */
+	i = 0;
+	ret = check_entry(e, tmp.name, newinfo->size, &i);
+	if (ret != 0)
+		goto free_newinfo;
+
+	t = find_table_lock(tmp.name, &ret, &ipt_mutex);
+	if (!t)
+		goto free_newinfo_untrans;
+	if (generation != ipt_generation) {
+		ret = -EAGAIN;
+		goto free_newinfo_untrans_unlock;
+	}
+
+	oldinfo = splice_table(t, newinfo, tmp.offset, tmp.size);
+	up(&ipt_mutex);
+	vfree(oldinfo);
+	return 0;
+
+ free_newinfo_untrans_unlock:
+	up(&ipt_mutex);
+ free_newinfo_untrans:
+	cleanup_entry(e, NULL);
+ free_newinfo:
+	vfree(newinfo);
+	return ret;
+
+ free_newinfo_unlock:
+	vfree(newinfo);
+ unlock:
+	up(&ipt_mutex);
+	return ret;
+}
+
+/* Chain structure stays: policies, chain heads and the end of the
+   table (ERROR targets), and the RETURN closing a user-defined chain.
+   Those go with IPT_SO_SET_REPLACE. */
+static int
+deletable(const struct ipt_table_info *info,
+	  unsigned int valid_hooks,
+	  struct ipt_entry *e,
+	  unsigned int pos)
+{
+	struct ipt_standard_target *t = (void *)ipt_get_target(e);
+	struct ipt_entry *next;
+	unsigned int h;
+
+	for (h = 0; h < NF_IP_NUMHOOKS; h++)
+		if ((valid_hooks & (1 << h)) && info->underflow[h] == pos)
+			return 0;
+
+	if (t->target.u.kernel.target == &ipt_error_target)
+		return 0;
+
+	if (standard_target(&t->target, 1)
+	    && t->verdict < 0 && unconditional(&e->ip)
+	    && pos + e->next_offset < info->size) {
+		next = (void *)e + e->next_offset;
+		if (ipt_get_target(next)->u.kernel.target == &ipt_error_target)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+do_delete(void *user, unsigned int len)
+{
+	int ret;
+	struct ipt_delete tmp;
+	struct ipt_table *t;
+	struct ipt_table_info *newinfo, *oldinfo;
+	struct ipt_entry *e;
+
+	if (len != sizeof(tmp))
+		return -EINVAL;
+	if (copy_from_user(&tmp, user, sizeof(tmp)) != 0)
+		return -EFAULT;
+
+	t = find_table_lock(tmp.name, &ret, &ipt_mutex);
+	if (!t)
+		return ret;
+
+	oldinfo = t->private;
+	if (tmp.num_entries != oldinfo->number) {
+		ret = -EAGAIN;
+		goto unlock;
+	}
+	if (!entry_at(oldinfo, tmp.offset)) {
+		duprintf("do_delete: no entry at %u\n", tmp.offset);
+		ret = -EINVAL;
+		goto unlock;
+	}
+	e = (struct ipt_entry *)(oldinfo->entries + tmp.offset);
+	if (!deletable(oldinfo, t->valid_hooks, e, tmp.offset)) {
+		duprintf("do_delete: %u is chain structure\n", tmp.offset);
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	newinfo = vmalloc(sizeof(struct ipt_table_info)
+			  + SMP_ALIGN(oldinfo->size - e->next_offset)
+			  * smp_num_cpus);
+	if (!newinfo) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	/* Taking an entry out makes no loops, and the hooks marked on
+	   what is left can only be too many, which is harmless. */
+	splice_entries(newinfo, oldinfo, t->valid_hooks,
+		       tmp.offset, -(int)e->next_offset);
+	oldinfo = splice_table(t, newinfo, tmp.offset, -(int)e->next_offset);
+	up(&ipt_mutex);
+
+	cleanup_entry(e, NULL);
+	vfree(oldinfo);
+	return 0;
+
+ unlock:
+	up(&ipt_mutex);
+	return ret;
+}
+
 static int
 do_ipt_set_ctl(struct sock *sk,	int cmd, void *user, unsigned int len)
 {
@@ -1211,6 +1590,14 @@ do_ipt_set_ctl(struct sock *sk,	int cmd, void *user, unsigned int len)
 		ret = do_add_counters(user, len);
 		break;
 
+	case IPT_SO_SET_INSERT:
+		ret = do_insert(user, len);
+		break;
+
+	case IPT_SO_SET_DELETE:
+		ret = do_delete(user, len);
+		break;
+
 	default:
 		duprintf("do_ipt_set_ctl:  unknown request %i\n", cmd);
 		ret = -EINVAL;
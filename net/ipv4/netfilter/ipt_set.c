@@ -0,0 +1,540 @@
+/* Kernel module to match packets against sets of addresses.
+ *
+ * A blacklist of thousands of single address rules costs every packet
+ * a walk through all of them.  Put the addresses in a set instead and
+ * test it from one rule: a lookup costs the same however big the set
+ * is, and the set is changed through its own socket options without
+ * replacing the table.
+ *
+ * Three kinds of set:
+ *	iphash		addresses, in a hash keyed at creation
+ *	ipporthash	address/port pairs, the same way
+ *	ipmap		a bit for each address of one network
+ */
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
+#include <linux/proc_fs.h>
+#include <asm/uaccess.h>
+#include <asm/bitops.h>
+#include <asm/semaphore.h>
+
+#include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter_ipv4/ipt_set.h>
+
+/* The list of sets is only touched under ipt_set_mutex. */
+#define ASSERT_READ_LOCK(x)
+#define ASSERT_WRITE_LOCK(x)
+#include <linux/netfilter_ipv4/listhelp.h>
+
+#if 0
+#define duprintf(format, args...) printk(format , ## args)
+#else
+#define duprintf(format, args...)
+#endif
+
+#define IPT_SET_HASHSIZE	1024
+
+struct ipt_set_elem
+{
+	struct ipt_set_elem *next;
+	u_int32_t ip;
+	u_int16_t port;
+};
+
+struct ipt_set
+{
+	struct list_head list;
+	char name[IPT_SET_MAXNAMELEN];
+	u_int32_t type;
+
+	/* Rules using the set; it can't be destroyed while there are. */
+	unsigned int refcount;
+	unsigned int elements;
+
+	/* Readers are the packets, writers the socket options. */
+	rwlock_t lock;
+
+	/* Hashes: hashsize is a power of two. */
+	struct ipt_set_elem **hash;
+	unsigned int hashsize;
+	u_int32_t rnd;
+
+	/* Bitmap: one bit for each of the addresses from first on. */
+	unsigned long *map;
+	u_int32_t first, size;
+};
+
+/* Protects the list of sets, and serializes changes to them. */
+static DECLARE_MUTEX(ipt_set_mutex);
+static LIST_HEAD(ipt_sets);
+static kmem_cache_t *ipt_set_cachep;
+
+static inline unsigned int
+set_hash(const struct ipt_set *set, u_int32_t ip, u_int16_t port)
+{
+	return jhash_2words(ip, port, set->rnd) & (set->hashsize - 1);
+}
+
+static inline int
+set_name_cmp(const struct ipt_set *set, const char *name)
+{
+	return strcmp(set->name, name) == 0;
+}
+
+static inline struct ipt_set *
+find_set(const char *name)
+{
+	return LIST_FIND(&ipt_sets, set_name_cmp, struct ipt_set *, name);
+}
+
+/* Caller holds set->lock. */
+static struct ipt_set_elem **
+hash_find(const struct ipt_set *set, u_int32_t ip, u_int16_t port)
+{
+	struct ipt_set_elem **ep;
+
+	for (ep = &set->hash[set_hash(set, ip, port)]; *ep; ep = &(*ep)->next)
+		if ((*ep)->ip == ip && (*ep)->port == port)
+			return ep;
+	return NULL;
+}
+
+/* Caller holds set->lock.  Returns bit number, or -1 if outside. */
+static inline int
+map_bit(const struct ipt_set *set, u_int32_t ip)
+{
+	u_int32_t off = ntohl(ip) - set->first;
+
+	return off < set->size ? (int)off : -1;
+}
+
+static int
+set_test(struct ipt_set *set, u_int32_t ip, u_int16_t port)
+{
+	int ret, bit;
+
+	read_lock_bh(&set->lock);
+	if (set->type == IPT_SET_IPMAP) {
+		bit = map_bit(set, ip);
+		ret = bit >= 0 && test_bit(bit, set->map);
+	} else
+		ret = hash_find(set, ip, port) != NULL;
+	read_unlock_bh(&set->lock);
+
+	return ret;
+}
+
+static int
+set_add(struct ipt_set *set, u_int32_t ip, u_int16_t port)
+{
+	struct ipt_set_elem *e, **head;
+	int bit;
+
+	if (set->type == IPT_SET_IPMAP) {
+		write_lock_bh(&set->lock);
+		bit = map_bit(set, ip);
+		if (bit >= 0 && !test_and_set_bit(bit, set->map))
+			set->elements++;
+		write_unlock_bh(&set->lock);
+		return bit >= 0 ? 0 : -ERANGE;
+	}
+
+	e = kmem_cache_alloc(ipt_set_cachep, GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+	e->ip = ip;
+	e->port = port;
+
+	write_lock_bh(&set->lock);
+	if (hash_find(set, ip, port)) {
+		write_unlock_bh(&set->lock);
+		kmem_cache_free(ipt_set_cachep, e);
+		return -EEXIST;
+	}
+	head = &set->hash[set_hash(set, ip, port)];
+	e->next = *head;
+	*head = e;
+	set->elements++;
+	write_unlock_bh(&set->lock);
+	return 0;
+}
+
+static int
+set_del(struct ipt_set *set, u_int32_t ip, u_int16_t port)
+{
+	struct ipt_set_elem *e = NULL, **ep;
+	int bit, ret = -ENOENT;
+
+	write_lock_bh(&set->lock);
+	if (set->type == IPT_SET_IPMAP) {
+		bit = map_bit(set, ip);
+		if (bit >= 0 && test_and_clear_bit(bit, set->map)) {
+			set->elements--;
+			ret = 0;
+		}
+	} else if ((ep = hash_find(set, ip, port)) != NULL) {
+		e = *ep;
+		*ep = e->next;
+		set->elements--;
+		ret = 0;
+	}
+	write_unlock_bh(&set->lock);
+
+	if (e)
+		kmem_cache_free(ipt_set_cachep, e);
+	return ret;
+}
+
+static void
+set_flush(struct ipt_set *set)
+{
+	struct ipt_set_elem *e, *next;
+	unsigned int i;
+
+	if (set->type == IPT_SET_IPMAP) {
+		write_lock_bh(&set->lock);
+		memset(set->map, 0, (set->size + 7) / 8);
+		set->elements = 0;
+		write_unlock_bh(&set->lock);
+		return;
+	}
+
+	/* Unhook the chains under the lock, free them outside it. */
+	for (i = 0; i < set->hashsize; i++) {
+		write_lock_bh(&set->lock);
+		e = set->hash[i];
+		set->hash[i] = NULL;
+		write_unlock_bh(&set->lock);
+
+		for (; e; e = next) {
+			next = e->next;
+			kmem_cache_free(ipt_set_cachep, e);
+		}
+	}
+	write_lock_bh(&set->lock);
+	set->elements = 0;
+	write_unlock_bh(&set->lock);
+}
+
+static void
+set_free(struct ipt_set *set)
+{
+	if (set->hash) {
+		set_flush(set);
+		vfree(set->hash);
+	}
+	if (set->map)
+		vfree(set->map);
+	kfree(set);
+}
+
+static int
+set_create(const struct ipt_set_req *req)
+{
+	struct ipt_set *set;
+	unsigned int size, bytes;
+
+	set = kmalloc(sizeof(*set), GFP_KERNEL);
+	if (!set)
+		return -ENOMEM;
+	memset(set, 0, sizeof(*set));
+	strcpy(set->name, req->name);
+	set->type = req->type;
+	set->lock = RW_LOCK_UNLOCKED;
+
+	switch (req->type) {
+	case IPT_SET_IPHASH:
+	case IPT_SET_IPPORTHASH:
+		size = req->hashsize ? req->hashsize : IPT_SET_HASHSIZE;
+		if (size > IPT_SET_MAXSIZE)
+			goto inval;
+		for (set->hashsize = 1; set->hashsize < size; )
+			set->hashsize <<= 1;
+		bytes = set->hashsize * sizeof(struct ipt_set_elem *);
+		set->hash = vmalloc(bytes);
+		if (!set->hash)
+			goto nomem;
+		memset(set->hash, 0, bytes);
+		get_random_bytes(&set->rnd, sizeof(set->rnd));
+		break;
+
+	case IPT_SET_IPMAP:
+		/* The mask must be contiguous, and not too short. */
+		set->size = ~ntohl(req->mask) + 1;
+		if (set->size == 0 || (set->size & (set->size - 1))
+		    || set->size > IPT_SET_MAXSIZE)
+			goto inval;
+		set->first = ntohl(req->ip & req->mask);
+		bytes = (set->size + BITS_PER_LONG - 1) / BITS_PER_LONG
+			* sizeof(unsigned long);
+		set->map = vmalloc(bytes);
+		if (!set->map)
+			goto nomem;
+		memset(set->map, 0, bytes);
+		break;
+
+	default:
+		goto inval;
+	}
+
+	list_prepend(&ipt_sets, set);
+	return 0;
+
+ inval:
+	set_free(set);
+	return -EINVAL;
+ nomem:
+	set_free(set);
+	return -ENOMEM;
+}
+
+static int
+do_set_ctl(struct sock *sk, int cmd, void *user, unsigned int len)
+{
+	struct ipt_set_req req;
+	struct ipt_set *set;
+	int ret;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (len != sizeof(req)) {
+		duprintf("do_set_ctl: length %u != %u\n", len, sizeof(req));
+		return -EINVAL;
+	}
+	if (copy_from_user(&req, user, sizeof(req)) != 0)
+		return -EFAULT;
+	req.name[IPT_SET_MAXNAMELEN-1] = '\0';
+
+	ret = down_interruptible(&ipt_set_mutex);
+	if (ret != 0)
+		return ret;
+
+	set = find_set(req.name);
+	if (cmd == IPT_SET_SO_CREATE) {
+		ret = set ? -EEXIST : set_create(&req);
+		goto out;
+	}
+	if (!set) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	switch (cmd) {
+	case IPT_SET_SO_DESTROY:
+		if (set->refcount) {
+			ret = -EBUSY;
+			break;
+		}
+		LIST_DELETE(&ipt_sets, set);
+		set_free(set);
+		break;
+
+	case IPT_SET_SO_FLUSH:
+		set_flush(set);
+		break;
+
+	case IPT_SET_SO_ADD:
+		ret = set_add(set, req.ip, req.port);
+		break;
+
+	case IPT_SET_SO_DEL:
+		ret = set_del(set, req.ip, req.port);
+		break;
+
+	default:
+		duprintf("do_set_ctl: unknown request %i\n", cmd);
+		ret = -EINVAL;
+	}
+ out:
+	up(&ipt_set_mutex);
+	return ret;
+}
+
+static int
+match(const struct sk_buff *skb,
+      const struct net_device *in,
+      const struct net_device *out,
+      const void *matchinfo,
+      int offset,
+      const void *hdr,
+      u_int16_t datalen,
+      int *hotdrop)
+{
+	const struct ipt_set_info *info = matchinfo;
+	const struct iphdr *iph = skb->nh.iph;
+	u_int32_t ip = (info->flags & IPT_SET_SRC) ? iph->saddr : iph->daddr;
+	u_int16_t port = 0;
+
+	if (info->set->type == IPT_SET_IPPORTHASH) {
+		const u_int16_t *ports = hdr;
+
+		/* Must be big enough to read ports. */
+		if (offset == 0 && datalen < 2 * sizeof(u_int16_t)) {
+			duprintf("ipt_set: Dropping evil offset=0 tinygram.\n");
+			*hotdrop = 1;
+			return 0;
+		}
+		/* Fragments have no ports to look up. */
+		if (offset)
+			return 0;
+		port = (info->flags & IPT_SET_SRCPORT) ? ports[0] : ports[1];
+	}
+
+	return set_test(info->set, ip, port) ^ info->invert;
+}
+
+static int
+checkentry(const char *tablename,
+	   const struct ipt_ip *ip,
+	   void *matchinfo,
+	   unsigned int matchsize,
+	   unsigned int hook_mask)
+{
+	struct ipt_set_info *info = matchinfo;
+
+	if (matchsize != IPT_ALIGN(sizeof(struct ipt_set_info)))
+		return 0;
+	if (info->flags & ~(IPT_SET_SRC | IPT_SET_SRCPORT))
+		return 0;
+	info->name[IPT_SET_MAXNAMELEN-1] = '\0';
+
+	if (down_interruptible(&ipt_set_mutex) != 0)
+		return 0;
+	info->set = find_set(info->name);
+	if (info->set
+	    && info->set->type == IPT_SET_IPPORTHASH
+	    /* Ports only make sense for TCP and UDP. */
+	    && ((ip->proto != IPPROTO_TCP && ip->proto != IPPROTO_UDP)
+		|| (ip->flags & IPT_INV_PROTO))) {
+		duprintf("ipt_set: %s needs -p tcp or -p udp\n", info->name);
+		info->set = NULL;
+	}
+	if (info->set)
+		info->set->refcount++;
+	up(&ipt_set_mutex);
+
+	return info->set != NULL;
+}
+
+static void
+destroy(void *matchinfo, unsigned int matchsize)
+{
+	struct ipt_set_info *info = matchinfo;
+
+	down(&ipt_set_mutex);
+	info->set->refcount--;
+	up(&ipt_set_mutex);
+}
+
+static struct ipt_match set_match
+= { { NULL, NULL }, "set", &match, &checkentry, &destroy, THIS_MODULE };
+
+static struct nf_sockopt_ops set_sockopts
+= { { NULL, NULL }, PF_INET, IPT_SET_BASE_CTL, IPT_SET_SO_MAX+1, do_set_ctl,
+    0, 0, NULL, 0, NULL };
+
+#ifdef CONFIG_PROC_FS
+static const char *set_types[] = { "", "iphash", "ipporthash", "ipmap" };
+
+static inline int print_set(const struct ipt_set *set,
+			    off_t start_offset, char *buffer, int length,
+			    off_t *pos, unsigned int *count)
+{
+	if ((*count)++ >= start_offset) {
+		unsigned int namelen;
+
+		namelen = sprintf(buffer + *pos, "%s %s %u %u\n",
+				  set->name, set_types[set->type],
+				  set->elements, set->refcount);
+		if (*pos + namelen > length) {
+			/* Stop iterating */
+			return 1;
+		}
+		*pos += namelen;
+	}
+	return 0;
+}
+
+/* name, type, elements, rules using it: one line per set. */
+static int ipt_get_sets(char *buffer, char **start, off_t offset, int length)
+{
+	off_t pos = 0;
+	unsigned int count = 0;
+
+	if (down_interruptible(&ipt_set_mutex) != 0)
+		return 0;
+
+	LIST_FIND(&ipt_sets, print_set, struct ipt_set *,
+		  offset, buffer, length, &pos, &count);
+
+	up(&ipt_set_mutex);
+
+	/* `start' hack - see fs/proc/generic.c line ~105 */
+	*start=(char *)((unsigned long)count-offset);
+	return pos;
+}
+#endif /*CONFIG_PROC_FS*/
+
+static int __init init(void)
+{
+	int ret;
+
+	ipt_set_cachep = kmem_cache_create("ipt_set_elem",
+					   sizeof(struct ipt_set_elem), 0,
+					   SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!ipt_set_cachep)
+		return -ENOMEM;
+
+	ret = nf_register_sockopt(&set_sockopts);
+	if (ret < 0)
+		goto err_cache;
+
+#ifdef CONFIG_PROC_FS
+	if (!proc_net_create("ip_tables_sets", 0, ipt_get_sets)) {
+		ret = -ENOMEM;
+		goto err_sockopt;
+	}
+#endif
+
+	ret = ipt_register_match(&set_match);
+	if (ret < 0)
+		goto err_proc;
+	return 0;
+
+ err_proc:
+#ifdef CONFIG_PROC_FS
+	proc_net_remove("ip_tables_sets");
+ err_sockopt:
+#endif
+	nf_unregister_sockopt(&set_sockopts);
+ err_cache:
+	kmem_cache_destroy(ipt_set_cachep);
+	return ret;
+}
+
+static void __exit fini(void)
+{
+	ipt_unregister_match(&set_match);
+#ifdef CONFIG_PROC_FS
+	proc_net_remove("ip_tables_sets");
+#endif
+	nf_unregister_sockopt(&set_sockopts);
+
+	/* No rules left, so nothing refers to the sets. */
+	while (!list_empty(&ipt_sets)) {
+		struct ipt_set *set = (struct ipt_set *)ipt_sets.next;
+
+		list_del(&set->list);
+		set_free(set);
+	}
+	kmem_cache_destroy(ipt_set_cachep);
+}
+
+module_init(init);
+module_exit(fini);
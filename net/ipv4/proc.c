@@ -81,7 +81,7 @@ int afinet_get_info(char *buffer, char **start, off_t offset, int length)
 	len += sprintf(buffer+len,"RAW: inuse %d\n",
 		       fold_prot_inuse(&raw_prot));
 	len += sprintf(buffer+len, "FRAG: inuse %d memory %d\n",
-		       ip_frag_nqueues, atomic_read(&ip_frag_mem));
+		       ip_frag_nqueues(), ip_frag_mem());
 	if (offset >= len)
 	{
 		*start = buffer;
@@ -84,6 +84,8 @@
 #include <linux/mroute.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/random.h>
+#include <linux/seqlock.h>
+#include <linux/jhash.h>
 #include <net/protocol.h>
 #include <net/ip.h>
 #include <net/route.h>
@@ -123,6 +125,7 @@ static unsigned long rt_deadline;
 
 static struct timer_list rt_flush_timer;
 static struct timer_list rt_periodic_timer;
+static struct timer_list rt_gc_timer;
 
 /*
  *	Interface to generic destination cache.
@@ -190,6 +193,13 @@ __u8 ip_tos2prio[16] = {
  * 3) Only readers acquire references to rtable entries,
  *    they do so with atomic increments and with the
  *    lock held.
+ * 4) The table grows by linear hashing, one bucket at a time:
+ *    the chain of bucket rt_hash_split is divided between itself
+ *    and a new bucket at the top, with both locks held and
+ *    rt_hash_seq bumped.  Whoever picked a bucket from a view of
+ *    the table older than its lock looks it up again.  Buckets live
+ *    in page sized segments, which are never freed, so an old view
+ *    never points to freed memory.
  */
 
 struct rt_hash_bucket {
@@ -197,25 +207,82 @@ struct rt_hash_bucket {
 	rwlock_t	lock;
 } __attribute__((__aligned__(8)));
 
-static struct rt_hash_bucket 	*rt_hash_table;
-static unsigned			rt_hash_mask;
-static int			rt_hash_log;
+static struct rt_hash_bucket	**rt_hash_dir;		/* segments */
+static int			rt_hash_seg_shift;	/* log2(buckets per segment) */
+static unsigned			rt_hash_mask;		/* doubled below rt_hash_split */
+static unsigned			rt_hash_split;		/* next bucket to split */
+static unsigned			rt_hash_nr;		/* buckets in use */
+static unsigned			rt_hash_max;		/* directory is full */
+static int			rt_hash_log;		/* log2(rt_hash_mask+1) */
+static u32			rt_hash_rnd;
+static seqcount_t		rt_hash_seq = SEQCNT_ZERO;
 
 static int rt_intern_hash(unsigned hash, struct rtable * rth, struct rtable ** res);
 
+/* The key is random and is changed on every flush, so nobody
+ * outside can aim a stream of packets at one chain.
+ */
 static __inline__ unsigned rt_hash_code(u32 daddr, u32 saddr, u8 tos)
 {
-	unsigned hash = ((daddr&0xF0F0F0F0)>>4)|((daddr&0x0F0F0F0F)<<4);
-	hash ^= saddr^tos;
-	hash ^= (hash>>16);
-	return (hash^(hash>>8)) & rt_hash_mask;
+	return jhash_2words(daddr, saddr ^ tos, rt_hash_rnd);
+}
+
+/* Input routes are keyed by iif and output routes by oif, the other
+ * one is always zero.
+ */
+static __inline__ unsigned rt_key_hash(struct rt_key *key)
+{
+	return rt_hash_code(key->dst, key->src^((key->iif|key->oif)<<5), key->tos);
+}
+
+static __inline__ struct rt_hash_bucket *rt_hash_slot(unsigned i)
+{
+	return rt_hash_dir[i >> rt_hash_seg_shift] +
+		(i & ((1U << rt_hash_seg_shift) - 1));
+}
+
+static __inline__ struct rt_hash_bucket *rt_hash_bucket(unsigned hash, unsigned *seq)
+{
+	unsigned i;
+
+	do {
+		*seq = read_seqcount_begin(&rt_hash_seq);
+		i = hash & rt_hash_mask;
+		if (i < rt_hash_split)
+			i = hash & ((rt_hash_mask << 1) | 1);
+	} while (read_seqcount_retry(&rt_hash_seq, *seq));
+	return rt_hash_slot(i);
+}
+
+/* Find and lock the bucket of a hash value.  Once its lock is held
+ * the bucket cannot be split, so a stable sequence count says that
+ * it is still the right one.
+ */
+#define RT_HASH_LOCK(name, lockfn, unlockfn) \
+static __inline__ struct rt_hash_bucket *name(unsigned hash) \
+{ \
+	struct rt_hash_bucket *b; \
+	unsigned seq; \
+\
+	for (;;) { \
+		b = rt_hash_bucket(hash, &seq); \
+		lockfn(&b->lock); \
+		if (!read_seqcount_retry(&rt_hash_seq, seq)) \
+			return b; \
+		unlockfn(&b->lock); \
+	} \
 }
 
+RT_HASH_LOCK(rt_hash_read_lock, read_lock, read_unlock)
+RT_HASH_LOCK(rt_hash_read_lock_bh, read_lock_bh, read_unlock_bh)
+RT_HASH_LOCK(rt_hash_write_lock_bh, write_lock_bh, write_unlock_bh)
+
 static int rt_cache_get_info(char *buffer, char **start, off_t offset, int length)
 {
 	int len=0;
 	off_t pos=0;
 	char temp[129];
+	struct rt_hash_bucket *b;
 	struct rtable *r;
 	int i;
 
@@ -226,9 +293,10 @@ static int rt_cache_get_info(char *buffer, char **start, off_t offset, int lengt
 		len = 128;
   	}
 	
-	for (i = rt_hash_mask; i>=0; i--) {
-		read_lock_bh(&rt_hash_table[i].lock);
-		for (r = rt_hash_table[i].chain; r; r = r->u.rt_next) {
+	for (i = rt_hash_nr-1; i>=0; i--) {
+		b = rt_hash_slot(i);
+		read_lock_bh(&b->lock);
+		for (r = b->chain; r; r = r->u.rt_next) {
 			/*
 			 *	Spin through entries until we are ready
 			 */
@@ -256,11 +324,11 @@ static int rt_cache_get_info(char *buffer, char **start, off_t offset, int lengt
 			sprintf(buffer+len,"%-127s\n",temp);
 			len += 128;
 			if (pos >= offset+length) {
-				read_unlock_bh(&rt_hash_table[i].lock);
+				read_unlock_bh(&b->lock);
 				goto done;
 			}
 		}
-		read_unlock_bh(&rt_hash_table[i].lock);
+		read_unlock_bh(&b->lock);
         }
 
 done:
@@ -296,6 +364,26 @@ static __inline__ int rt_valuable(struct rtable *rth)
 		|| rth->u.dst.expires);
 }
 
+/* The lower the score, the better an entry is to evict from a long
+ * chain: old ones first, and of those the ones which are neither
+ * valuable nor output or unicast input routes.
+ */
+static __inline__ u32 rt_score(struct rtable *rt)
+{
+	u32 score = jiffies - rt->u.dst.lastuse;
+
+	score = ~score & ~(3<<30);
+
+	if (rt_valuable(rt))
+		score |= (1<<31);
+
+	if (!rt->key.iif ||
+	    !(rt->rt_flags&(RTCF_BROADCAST|RTCF_MULTICAST|RTCF_LOCAL)))
+		score |= (1<<30);
+
+	return score;
+}
+
 static __inline__ int rt_may_expire(struct rtable *rth, int tmo1, int tmo2)
 {
 	int age;
@@ -319,6 +407,7 @@ static void SMP_TIMER_NAME(rt_check_expire)(unsigned long dummy)
 {
 	int i, t;
 	static int rover;
+	struct rt_hash_bucket *b;
 	struct rtable *rth, **rthp;
 	unsigned long now = jiffies;
 
@@ -327,10 +416,12 @@ static void SMP_TIMER_NAME(rt_check_expire)(unsigned long dummy)
 	for (t=(ip_rt_gc_interval<<rt_hash_log); t>=0; t -= ip_rt_gc_timeout) {
 		unsigned tmo = ip_rt_gc_timeout;
 
-		i = (i + 1) & rt_hash_mask;
-		rthp = &rt_hash_table[i].chain;
+		if (++i >= rt_hash_nr)
+			i = 0;
+		b = rt_hash_slot(i);
+		rthp = &b->chain;
 
-		write_lock(&rt_hash_table[i].lock);
+		write_lock(&b->lock);
 		while ((rth = *rthp) != NULL) {
 			if (rth->u.dst.expires) {
 				/* Entry is expired even if it is in use */
@@ -351,7 +442,7 @@ static void SMP_TIMER_NAME(rt_check_expire)(unsigned long dummy)
 			*rthp = rth->u.rt_next;
 			rt_free(rth);
 		}
-		write_unlock(&rt_hash_table[i].lock);
+		write_unlock(&b->lock);
 
 		/* Fallback loop breaker. */
 		if ((jiffies - now) > 0)
@@ -369,16 +460,23 @@ SMP_TIMER_DEFINE(rt_check_expire, rt_gc_task);
 static void SMP_TIMER_NAME(rt_run_flush)(unsigned long dummy)
 {
 	int i;
+	struct rt_hash_bucket *b;
 	struct rtable * rth, * next;
 
 	rt_deadline = 0;
 
-	for (i=rt_hash_mask; i>=0; i--) {
-		write_lock_bh(&rt_hash_table[i].lock);
-		rth = rt_hash_table[i].chain;
+	/* New key: whatever sneaks in behind us while we walk the
+	   table is unreachable and will be aged out.
+	 */
+	get_random_bytes(&rt_hash_rnd, sizeof(rt_hash_rnd));
+
+	for (i=rt_hash_nr-1; i>=0; i--) {
+		b = rt_hash_slot(i);
+		write_lock_bh(&b->lock);
+		rth = b->chain;
 		if (rth)
-			rt_hash_table[i].chain = NULL;
-		write_unlock_bh(&rt_hash_table[i].lock);
+			b->chain = NULL;
+		write_unlock_bh(&b->lock);
 
 		for (; rth; rth=next) {
 			next = rth->u.rt_next;
@@ -442,108 +540,181 @@ void rt_cache_flush(int delay)
    We try to adjust it dynamically, so that if networking
    is idle expires is large enough to keep enough of warm entries,
    and when load increases it reduces to limit cache size.
+
+   None of this happens on the packet path any more.  dst_alloc()
+   only kicks rt_gc_timer, which grows the table while the chains
+   get long, and then looks at RT_GC_BUCKETS buckets per tick until
+   the goal of the round is reached.  Every full pass over the table
+   which falls short halves "expire".
  */
 
-static int rt_garbage_collect(void)
+#define RT_GC_BUCKETS	256
+
+static spinlock_t rt_gc_lock = SPIN_LOCK_UNLOCKED;
+
+/* Split the next bucket.  Called with rt_gc_lock held. */
+static int rt_hash_grow(void)
+{
+	unsigned old = rt_hash_split;
+	unsigned new = rt_hash_mask + 1 + old;
+	struct rt_hash_bucket *ob, *nb;
+	struct rtable *rth, **rthp, **tail;
+
+	if (new >= rt_hash_max)
+		return 0;
+
+	if (rt_hash_dir[new >> rt_hash_seg_shift] == NULL) {
+		int i;
+
+		nb = (struct rt_hash_bucket *)__get_free_page(GFP_ATOMIC);
+		if (nb == NULL)
+			return 0;
+		for (i = 0; i < (1 << rt_hash_seg_shift); i++) {
+			nb[i].lock = RW_LOCK_UNLOCKED;
+			nb[i].chain = NULL;
+		}
+		wmb();
+		rt_hash_dir[new >> rt_hash_seg_shift] = nb;
+	}
+
+	ob = rt_hash_slot(old);
+	nb = rt_hash_slot(new);
+
+	write_lock_bh(&ob->lock);
+	write_lock(&nb->lock);
+	write_seqcount_begin(&rt_hash_seq);
+
+	rthp = &ob->chain;
+	tail = &nb->chain;
+	while ((rth = *rthp) != NULL) {
+		if (!(rt_key_hash(&rth->key) & (rt_hash_mask + 1))) {
+			rthp = &rth->u.rt_next;
+			continue;
+		}
+		*rthp = rth->u.rt_next;
+		rth->u.rt_next = NULL;
+		*tail = rth;
+		tail = &rth->u.rt_next;
+	}
+
+	if (++rt_hash_split > rt_hash_mask) {
+		rt_hash_mask = (rt_hash_mask << 1) | 1;
+		rt_hash_split = 0;
+		rt_hash_log++;
+	}
+	rt_hash_nr++;
+
+	write_seqcount_end(&rt_hash_seq);
+	write_unlock(&nb->lock);
+	write_unlock_bh(&ob->lock);
+	return 1;
+}
+
+/* One step of the collector, over at most "budget" buckets.  "force"
+ * asks for everything that can go, now.  Returns non-zero when the
+ * round is not finished.  Called with rt_gc_lock held.
+ */
+static int rt_gc_step(int budget, int force)
 {
 	static unsigned expire = RT_GC_TIMEOUT;
 	static unsigned long last_gc;
 	static int rover;
 	static int equilibrium;
+	static int goal;
+	static unsigned scanned;
+	struct rt_hash_bucket *b;
 	struct rtable *rth, **rthp;
 	unsigned long now = jiffies;
-	int goal;
+	int elasticity = force ? 1 : ip_rt_gc_elasticity;
 
-	/*
-	 * Garbage collection is pretty expensive,
-	 * do not make it too frequently.
-	 */
-	if (now - last_gc < ip_rt_gc_min_interval &&
-	    atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-		return 0;
+	if (goal <= 0 || force) {
+		/*
+		 * Garbage collection is pretty expensive,
+		 * do not make it too frequently.
+		 */
+		if (!force && now - last_gc < ip_rt_gc_min_interval &&
+		    atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
+			return 0;
 
-	/* Calculate number of entries, which we want to expire now. */
-	goal = atomic_read(&ipv4_dst_ops.entries) - (ip_rt_gc_elasticity<<rt_hash_log);
-	if (goal <= 0) {
-		if (equilibrium < ipv4_dst_ops.gc_thresh)
-			equilibrium = ipv4_dst_ops.gc_thresh;
-		goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
-		if (goal > 0) {
-			equilibrium += min(goal/2, rt_hash_mask+1);
+		/* Calculate number of entries, which we want to expire now. */
+		goal = atomic_read(&ipv4_dst_ops.entries) - elasticity*rt_hash_nr;
+		if (goal <= 0) {
+			if (equilibrium < ipv4_dst_ops.gc_thresh)
+				equilibrium = ipv4_dst_ops.gc_thresh;
 			goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
+			if (goal > 0) {
+				equilibrium += min(goal/2, rt_hash_nr);
+				goal = atomic_read(&ipv4_dst_ops.entries) - equilibrium;
+			}
+		} else {
+			/* We are in dangerous area. Try to reduce cache really
+			 * aggressively.
+			 */
+			goal = max(goal/2, rt_hash_nr);
+			equilibrium = atomic_read(&ipv4_dst_ops.entries) - goal;
 		}
-	} else {
-		/* We are in dangerous area. Try to reduce cache really
-		 * aggressively.
-		 */
-		goal = max(goal/2, rt_hash_mask+1);
-		equilibrium = atomic_read(&ipv4_dst_ops.entries) - goal;
-	}
 
-	if (now - last_gc >= ip_rt_gc_min_interval)
-		last_gc = now;
+		if (now - last_gc >= ip_rt_gc_min_interval)
+			last_gc = now;
 
-	if (goal <= 0) {
-		equilibrium += goal;
-		goto work_done;
+		if (goal <= 0) {
+			equilibrium += goal;
+			goto work_done;
+		}
+		scanned = 0;
 	}
 
-	do {
-		int i, k;
-
-		for (i=rt_hash_mask, k=rover; i>=0; i--) {
-			unsigned tmo = expire;
+	while (budget-- > 0) {
+		unsigned tmo = expire;
 
-			k = (k + 1) & rt_hash_mask;
-			rthp = &rt_hash_table[k].chain;
-			write_lock_bh(&rt_hash_table[k].lock);
-			while ((rth = *rthp) != NULL) {
-				if (!rt_may_expire(rth, tmo, expire)) {
-					tmo >>= 1;
-					rthp = &rth->u.rt_next;
-					continue;
-				}
-				*rthp = rth->u.rt_next;
-				rt_free(rth);
-				goal--;
+		if (++rover >= rt_hash_nr)
+			rover = 0;
+		b = rt_hash_slot(rover);
+		rthp = &b->chain;
+		write_lock_bh(&b->lock);
+		while ((rth = *rthp) != NULL) {
+			if (!rt_may_expire(rth, tmo, expire)) {
+				tmo >>= 1;
+				rthp = &rth->u.rt_next;
+				continue;
 			}
-			write_unlock_bh(&rt_hash_table[k].lock);
-			if (goal <= 0)
-				break;
+			*rthp = rth->u.rt_next;
+			rt_free(rth);
+			goal--;
 		}
-		rover = k;
+		write_unlock_bh(&b->lock);
 
 		if (goal <= 0)
 			goto work_done;
 
-		/* Goal is not achieved. We stop process if:
+		if (++scanned < rt_hash_nr)
+			continue;
+		scanned = 0;
 
-		   - if expire reduced to zero. Otherwise, expire is halfed.
-		   - if table is not full.
-		   - if we are called from interrupt.
-		   - jiffies check is just fallback/debug loop breaker.
-		     We will not spin here for long time in any case.
+		/* A whole pass and goal is not achieved. We stop if
+		   expire is already zero or if the table is not full,
+		   otherwise expire is halfed and we go on.
 		 */
-
 		if (expire == 0)
 			break;
 
 		expire >>= 1;
 #if RT_CACHE_DEBUG >= 2
-		printk(KERN_DEBUG "expire>> %u %d %d %d\n", expire, atomic_read(&ipv4_dst_ops.entries), goal, i);
+		printk(KERN_DEBUG "expire>> %u %d %d %d\n", expire, atomic_read(&ipv4_dst_ops.entries), goal, rover);
 #endif
 
 		if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-			return 0;
-	} while (!in_softirq() && jiffies - now < 1);
+			break;
+	}
 
-	if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
-		return 0;
-	if (net_ratelimit())
-		printk("dst cache overflow\n");
-	return 1;
+	/* Out of budget in the middle of a pass: go on next time. */
+	if (budget < 0)
+		return 1;
+	goal = 0;
+	return 0;
 
 work_done:
+	goal = 0;
 	expire += ip_rt_gc_min_interval;
 	if (expire > ip_rt_gc_timeout ||
 	    atomic_read(&ipv4_dst_ops.entries) < ipv4_dst_ops.gc_thresh)
@@ -554,43 +725,112 @@ work_done:
 	return 0;
 }
 
+/* This runs via a timer and thus is always in BH context. */
+static void SMP_TIMER_NAME(rt_gc_run)(unsigned long dummy)
+{
+	int budget = RT_GC_BUCKETS;
+	int more;
+
+	spin_lock(&rt_gc_lock);
+
+	/* Keep chains at no more than half the elasticity on average,
+	   as long as the cache is allowed to grow.
+	 */
+	while (budget > 0 &&
+	       2*atomic_read(&ipv4_dst_ops.entries) > ip_rt_gc_elasticity*rt_hash_nr &&
+	       ip_rt_gc_elasticity*rt_hash_nr < ip_rt_max_size &&
+	       rt_hash_grow())
+		budget--;
+
+	more = rt_gc_step(budget, 0);
+	spin_unlock(&rt_gc_lock);
+
+	if (more)
+		mod_timer(&rt_gc_timer, jiffies + 1);
+}
+
+SMP_TIMER_DEFINE(rt_gc_run, rt_gc_run_task);
+
+/* dst_ops->gc: dst_alloc() calls it above gc_thresh, on the packet
+ * path as often as not.  Refuse the allocation only if the cache is full.
+ */
+static int rt_garbage_collect(void)
+{
+	if (!timer_pending(&rt_gc_timer))
+		mod_timer(&rt_gc_timer, jiffies);
+
+	if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
+		return 0;
+	if (net_ratelimit())
+		printk("dst cache overflow\n");
+	return 1;
+}
+
 static int rt_intern_hash(unsigned hash, struct rtable * rt, struct rtable ** rp)
 {
+	struct rt_hash_bucket *b;
 	struct rtable	*rth, **rthp;
+	struct rtable	*cand, **candp;
+	u32		min_score;
+	int		chain_length;
 	unsigned long	now = jiffies;
 	int attempts = !in_softirq();
 
 restart:
-	rthp = &rt_hash_table[hash].chain;
+	chain_length = 0;
+	min_score = ~(u32)0;
+	cand = NULL;
+	candp = NULL;
 
-	write_lock_bh(&rt_hash_table[hash].lock);
+	b = rt_hash_write_lock_bh(hash);
+	rthp = &b->chain;
 	while ((rth = *rthp) != NULL) {
 		if (memcmp(&rth->key, &rt->key, sizeof(rt->key)) == 0) {
 			/* Put it first */
 			*rthp = rth->u.rt_next;
-			rth->u.rt_next = rt_hash_table[hash].chain;
-			rt_hash_table[hash].chain = rth;
+			rth->u.rt_next = b->chain;
+			b->chain = rth;
 
 			rth->u.dst.__use++;
 			dst_hold(&rth->u.dst);
 			rth->u.dst.lastuse = now;
-			write_unlock_bh(&rt_hash_table[hash].lock);
+			write_unlock_bh(&b->lock);
 
 			rt_drop(rt);
 			*rp = rth;
 			return 0;
 		}
 
+		if (!atomic_read(&rth->u.dst.__refcnt)) {
+			u32 score = rt_score(rth);
+
+			if (score <= min_score) {
+				cand = rth;
+				candp = rthp;
+				min_score = score;
+			}
+		}
+
+		chain_length++;
 		rthp = &rth->u.rt_next;
 	}
 
+	/* A chain this long is being flooded with entries nobody
+	   comes back for. Do not let it grow, and do not wait for
+	   the collector either: drop its least useful free entry.
+	 */
+	if (cand && chain_length >= ip_rt_gc_elasticity) {
+		*candp = cand->u.rt_next;
+		rt_free(cand);
+	}
+
 	/* Try to bind route to arp only if it is output
 	   route or unicast forwarding path.
 	 */
 	if (rt->rt_type == RTN_UNICAST || rt->key.iif == 0) {
 		int err = arp_bind_neighbour(&rt->u.dst);
 		if (err) {
-			write_unlock_bh(&rt_hash_table[hash].lock);
+			write_unlock_bh(&b->lock);
 
 			if (err != -ENOBUFS) {
 				rt_drop(rt);
@@ -602,13 +842,9 @@ restart:
 			   it is most likely it holds some neighbour records.
 			 */
 			if (attempts-- > 0) {
-				int saved_elasticity = ip_rt_gc_elasticity;
-				int saved_int = ip_rt_gc_min_interval;
-				ip_rt_gc_elasticity = 1;
-				ip_rt_gc_min_interval = 0;
-				rt_garbage_collect();
-				ip_rt_gc_min_interval = saved_int;
-				ip_rt_gc_elasticity = saved_elasticity;
+				spin_lock_bh(&rt_gc_lock);
+				rt_gc_step(rt_hash_nr, 1);
+				spin_unlock_bh(&rt_gc_lock);
 				goto restart;
 			}
 
@@ -619,7 +855,7 @@ restart:
 		}
 	}
 
-	rt->u.rt_next = rt_hash_table[hash].chain;
+	rt->u.rt_next = b->chain;
 #if RT_CACHE_DEBUG >= 2
 	if (rt->u.rt_next) {
 		struct rtable * trt;
@@ -629,8 +865,8 @@ restart:
 		printk("\n");
 	}
 #endif
-	rt_hash_table[hash].chain = rt;
-	write_unlock_bh(&rt_hash_table[hash].lock);
+	b->chain = rt;
+	write_unlock_bh(&b->lock);
 	*rp = rt;
 	return 0;
 }
@@ -696,18 +932,19 @@ void __ip_select_ident(struct iphdr *iph, struct dst_entry *dst)
 
 static void rt_del(unsigned hash, struct rtable *rt)
 {
+	struct rt_hash_bucket *b;
 	struct rtable **rthp;
 
-	write_lock_bh(&rt_hash_table[hash].lock);
+	b = rt_hash_write_lock_bh(hash);
 	ip_rt_put(rt);
-	for (rthp = &rt_hash_table[hash].chain; *rthp; rthp = &(*rthp)->u.rt_next) {
+	for (rthp = &b->chain; *rthp; rthp = &(*rthp)->u.rt_next) {
 		if (*rthp == rt) {
 			*rthp = rt->u.rt_next;
 			rt_free(rt);
 			break;
 		}
 	}
-	write_unlock_bh(&rt_hash_table[hash].lock);
+	write_unlock_bh(&b->lock);
 }
 
 void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
@@ -715,6 +952,7 @@ void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
 {
 	int i, k;
 	struct in_device *in_dev = in_dev_get(dev);
+	struct rt_hash_bucket *b;
 	struct rtable *rth, **rthp;
 	u32  skeys[2] = { saddr, 0 };
 	int  ikeys[2] = { dev->ifindex, 0 };
@@ -742,9 +980,9 @@ void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
 		for (k=0; k<2; k++) {
 			unsigned hash = rt_hash_code(daddr, skeys[i]^(ikeys[k]<<5), tos);
 
-			rthp=&rt_hash_table[hash].chain;
+			b = rt_hash_read_lock(hash);
+			rthp = &b->chain;
 
-			read_lock(&rt_hash_table[hash].lock);
 			while ( (rth = *rthp) != NULL) {
 				struct rtable *rt;
 
@@ -765,7 +1003,7 @@ void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
 					break;
 
 				dst_clone(&rth->u.dst);
-				read_unlock(&rt_hash_table[hash].lock);
+				read_unlock(&b->lock);
 
 				rt = dst_alloc(&ipv4_dst_ops);
 				if (rt == NULL) {
@@ -812,7 +1050,7 @@ void ip_rt_redirect(u32 old_gw, u32 daddr, u32 new_gw,
 					ip_rt_put(rt);
 				goto do_next;
 			}
-			read_unlock(&rt_hash_table[hash].lock);
+			read_unlock(&b->lock);
 		do_next:
 			;
 		}
@@ -982,9 +1220,9 @@ unsigned short ip_rt_frag_needed(struct iphdr *iph, unsigned short new_mtu)
 
 	for (i=0; i<2; i++) {
 		unsigned hash = rt_hash_code(daddr, skeys[i], tos);
+		struct rt_hash_bucket *b = rt_hash_read_lock(hash);
 
-		read_lock(&rt_hash_table[hash].lock);
-		for (rth = rt_hash_table[hash].chain; rth; rth = rth->u.rt_next) {
+		for (rth = b->chain; rth; rth = rth->u.rt_next) {
 			if (rth->key.dst == daddr &&
 			    rth->key.src == skeys[i] &&
 			    rth->rt_dst == daddr &&
@@ -1017,7 +1255,7 @@ unsigned short ip_rt_frag_needed(struct iphdr *iph, unsigned short new_mtu)
 				}
 			}
 		}
-		read_unlock(&rt_hash_table[hash].lock);
+		read_unlock(&b->lock);
 	}
 	return est_mtu ? : new_mtu;
 }
@@ -1547,6 +1785,7 @@ martian_source:
 int ip_route_input(struct sk_buff *skb, u32 daddr, u32 saddr,
 		   u8 tos, struct net_device *dev)
 {
+	struct rt_hash_bucket *b;
 	struct rtable * rth;
 	unsigned	hash;
 	int iif = dev->ifindex;
@@ -1554,8 +1793,8 @@ int ip_route_input(struct sk_buff *skb, u32 daddr, u32 saddr,
 	tos &= IPTOS_RT_MASK;
 	hash = rt_hash_code(daddr, saddr^(iif<<5), tos);
 
-	read_lock(&rt_hash_table[hash].lock);
-	for (rth=rt_hash_table[hash].chain; rth; rth=rth->u.rt_next) {
+	b = rt_hash_read_lock(hash);
+	for (rth=b->chain; rth; rth=rth->u.rt_next) {
 		if (rth->key.dst == daddr &&
 		    rth->key.src == saddr &&
 		    rth->key.iif == iif &&
@@ -1567,12 +1806,12 @@ int ip_route_input(struct sk_buff *skb, u32 daddr, u32 saddr,
 			rth->u.dst.lastuse = jiffies;
 			dst_hold(&rth->u.dst);
 			rth->u.dst.__use++;
-			read_unlock(&rt_hash_table[hash].lock);
+			read_unlock(&b->lock);
 			skb->dst = (struct dst_entry*)rth;
 			return 0;
 		}
 	}
-	read_unlock(&rt_hash_table[hash].lock);
+	read_unlock(&b->lock);
 
 	/* Multicast recognition logic is moved from route cache to here.
 	   The problem was that too many Ethernet cards have broken/missing
@@ -1892,13 +2131,14 @@ e_nobufs:
 
 int ip_route_output_key(struct rtable **rp, const struct rt_key *key)
 {
+	struct rt_hash_bucket *b;
 	unsigned hash;
 	struct rtable *rth;
 
 	hash = rt_hash_code(key->dst, key->src^(key->oif<<5), key->tos);
 
-	read_lock_bh(&rt_hash_table[hash].lock);
-	for (rth=rt_hash_table[hash].chain; rth; rth=rth->u.rt_next) {
+	b = rt_hash_read_lock_bh(hash);
+	for (rth=b->chain; rth; rth=rth->u.rt_next) {
 		if (rth->key.dst == key->dst &&
 		    rth->key.src == key->src &&
 		    rth->key.iif == 0 &&
@@ -1912,12 +2152,12 @@ int ip_route_output_key(struct rtable **rp, const struct rt_key *key)
 			rth->u.dst.lastuse = jiffies;
 			dst_hold(&rth->u.dst);
 			rth->u.dst.__use++;
-			read_unlock_bh(&rt_hash_table[hash].lock);
+			read_unlock_bh(&b->lock);
 			*rp = rth;
 			return 0;
 		}
 	}
-	read_unlock_bh(&rt_hash_table[hash].lock);
+	read_unlock_bh(&b->lock);
 
 	return ip_route_output_slow(rp, key);
 }	
@@ -2096,30 +2336,32 @@ int inet_rtm_getroute(struct sk_buff *in_skb, struct nlmsghdr* nlh, void *arg)
 
 int ip_rt_dump(struct sk_buff *skb,  struct netlink_callback *cb)
 {
+	struct rt_hash_bucket *b;
 	struct rtable *rt;
 	int h, s_h;
 	int idx, s_idx;
 
 	s_h = cb->args[0];
 	s_idx = idx = cb->args[1];
-	for (h=0; h <= rt_hash_mask; h++) {
+	for (h=0; h < rt_hash_nr; h++) {
 		if (h < s_h) continue;
 		if (h > s_h)
 			s_idx = 0;
-		read_lock_bh(&rt_hash_table[h].lock);
-		for (rt = rt_hash_table[h].chain, idx = 0; rt; rt = rt->u.rt_next, idx++) {
+		b = rt_hash_slot(h);
+		read_lock_bh(&b->lock);
+		for (rt = b->chain, idx = 0; rt; rt = rt->u.rt_next, idx++) {
 			if (idx < s_idx)
 				continue;
 			skb->dst = dst_clone(&rt->u.dst);
 			if (rt_fill_info(skb, NETLINK_CB(cb->skb).pid,
 					 cb->nlh->nlmsg_seq, RTM_NEWROUTE, 1) <= 0) {
 				dst_release(xchg(&skb->dst, NULL));
-				read_unlock_bh(&rt_hash_table[h].lock);
+				read_unlock_bh(&b->lock);
 				goto done;
 			}
 			dst_release(xchg(&skb->dst, NULL));
 		}
-		read_unlock_bh(&rt_hash_table[h].lock);
+		read_unlock_bh(&b->lock);
 	}
 
 done:
@@ -2272,7 +2514,7 @@ static int ip_rt_acct_read(char *buffer, char **start, off_t offset,
 
 void __init ip_rt_init(void)
 {
-	int i, order, goal;
+	int i, order, goal, nsegs;
 
 #ifdef CONFIG_NET_CLS_ROUTE
 	for (order=0;
@@ -2297,39 +2539,64 @@ void __init ip_rt_init(void)
 	for (order = 0; (1UL << order) < goal; order++)
 		/* NOTHING */;
 
-	do {
-		rt_hash_mask = (1UL << order) * PAGE_SIZE /
-			sizeof(struct rt_hash_bucket);
-		while (rt_hash_mask & (rt_hash_mask-1))
-			rt_hash_mask--;
-		rt_hash_table = (struct rt_hash_bucket *)
-			__get_free_pages(GFP_ATOMIC, order);
-	} while (rt_hash_table == NULL && --order > 0);
-
-	if (!rt_hash_table)
+	/* The table is a directory page of segments, each a page of
+	   buckets. It starts as large as it always was and grows as far
+	   as the directory allows.
+	 */
+	for (rt_hash_seg_shift = 0;
+	     (2UL << rt_hash_seg_shift) <= PAGE_SIZE/sizeof(struct rt_hash_bucket);
+	     rt_hash_seg_shift++)
+		/* NOTHING */;
+
+	rt_hash_dir = (struct rt_hash_bucket **)__get_free_page(GFP_KERNEL);
+	if (!rt_hash_dir)
 		panic("Failed to allocate IP route cache hash table\n");
+	memset(rt_hash_dir, 0, PAGE_SIZE);
+	rt_hash_max = (PAGE_SIZE/sizeof(struct rt_hash_bucket *)) << rt_hash_seg_shift;
 
-	printk("IP: routing cache hash table of %u buckets, %ldKbytes\n",
-	       rt_hash_mask,
-	       (long) (rt_hash_mask*sizeof(struct rt_hash_bucket))/1024);
+	nsegs = 1 << order;
+	for (i = 0; i < nsegs; i++) {
+		struct rt_hash_bucket *b;
+		int k;
 
-	for (rt_hash_log=0; (1<<rt_hash_log) != rt_hash_mask; rt_hash_log++)
+		b = (struct rt_hash_bucket *)__get_free_page(GFP_KERNEL);
+		if (!b)
+			break;
+		for (k = 0; k < (1 << rt_hash_seg_shift); k++) {
+			b[k].lock = RW_LOCK_UNLOCKED;
+			b[k].chain = NULL;
+		}
+		rt_hash_dir[i] = b;
+	}
+	if (i == 0)
+		panic("Failed to allocate IP route cache hash table\n");
+	while (nsegs > i)
+		nsegs >>= 1;
+	while (i > nsegs) {
+		free_page((unsigned long)rt_hash_dir[--i]);
+		rt_hash_dir[i] = NULL;
+	}
+
+	rt_hash_nr = nsegs << rt_hash_seg_shift;
+	rt_hash_mask = rt_hash_nr - 1;
+	rt_hash_split = 0;
+	for (rt_hash_log=0; (1<<rt_hash_log) != rt_hash_nr; rt_hash_log++)
 		/* NOTHING */;
 
-	rt_hash_mask--;
-	for (i = 0; i <= rt_hash_mask; i++) {
-		rt_hash_table[i].lock = RW_LOCK_UNLOCKED;
-		rt_hash_table[i].chain = NULL;
-	}
+	get_random_bytes(&rt_hash_rnd, sizeof(rt_hash_rnd));
+
+	printk("IP: routing cache hash table of %u buckets, %ldKbytes, up to %u buckets\n",
+	       rt_hash_nr, (long) (nsegs*PAGE_SIZE)/1024, rt_hash_max);
 
-	ipv4_dst_ops.gc_thresh = (rt_hash_mask+1);
-	ip_rt_max_size = (rt_hash_mask+1)*16;
+	ipv4_dst_ops.gc_thresh = rt_hash_nr;
+	ip_rt_max_size = rt_hash_nr*16;
 
 	devinet_init();
 	ip_fib_init();
 
 	rt_flush_timer.function = rt_run_flush;
 	rt_periodic_timer.function = rt_check_expire;
+	rt_gc_timer.function = rt_gc_run;
 
 	/* All the timers, started at system startup tend
 	   to synchronize. Perturb it a bit.
@@ -116,6 +116,9 @@ ctl_table ipv4_table[] = {
 	{NET_IPV4_NONLOCAL_BIND, "ip_nonlocal_bind",
 	 &sysctl_ip_nonlocal_bind, sizeof(int), 0644, NULL,
 	 &proc_dointvec},
+	{NET_IPV4_EARLY_DEMUX, "ip_early_demux",
+	 &sysctl_ip_early_demux, sizeof(int), 0644, NULL,
+	 &proc_dointvec},
 	{NET_IPV4_TCP_SYN_RETRIES, "tcp_syn_retries",
 	 &sysctl_tcp_syn_retries, sizeof(int), 0644, NULL, &proc_dointvec},
 	{NET_TCP_SYNACK_RETRIES, "tcp_synack_retries",
@@ -226,6 +229,10 @@ ctl_table ipv4_table[] = {
 	 &sysctl_tcp_app_win, sizeof(int), 0644, NULL, &proc_dointvec},
 	{NET_TCP_ADV_WIN_SCALE, "tcp_adv_win_scale",
 	 &sysctl_tcp_adv_win_scale, sizeof(int), 0644, NULL, &proc_dointvec},
+	{NET_TCP_MODERATE_RCVBUF, "tcp_moderate_rcvbuf",
+	 &sysctl_tcp_moderate_rcvbuf, sizeof(int), 0644, NULL, &proc_dointvec},
+	{NET_TCP_PACING, "tcp_pacing",
+	 &sysctl_tcp_pacing, sizeof(int), 0644, NULL, &proc_dointvec},
 	{0}
 };
 
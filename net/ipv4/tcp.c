@@ -420,6 +420,7 @@
 #include <linux/poll.h>
 #include <linux/init.h>
 #include <linux/smp_lock.h>
+#include <linux/highmem.h>
 
 #include <net/icmp.h>
 #include <net/tcp.h>
@@ -433,6 +434,9 @@ struct tcp_mib	tcp_statistics[NR_CPUS*2];
 kmem_cache_t *tcp_openreq_cachep;
 kmem_cache_t *tcp_bucket_cachep;
 kmem_cache_t *tcp_timewait_cachep;
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+kmem_cache_t *tcp6_timewait_cachep;
+#endif
 
 atomic_t tcp_orphan_count = ATOMIC_INIT(0);
 
@@ -476,7 +480,7 @@ int tcp_mem_schedule(struct sock *sk, int size, int kind)
 		tcp_enter_memory_pressure();
 
 	if (kind) {
-		if (atomic_read(&sk->rmem_alloc) < sysctl_tcp_rmem[0])
+		if (tcp_rmem_alloc(sk) < sysctl_tcp_rmem[0])
 			return 1;
 	} else {
 		if (sk->wmem_queued < sysctl_tcp_wmem[0])
@@ -485,7 +489,7 @@ int tcp_mem_schedule(struct sock *sk, int size, int kind)
 
 	if (!tcp_memory_pressure ||
 	    sysctl_tcp_mem[2] > atomic_read(&tcp_sockets_allocated)
-	    * TCP_PAGES(sk->wmem_queued+atomic_read(&sk->rmem_alloc)+
+	    * TCP_PAGES(sk->wmem_queued+tcp_rmem_alloc(sk)+
 			sk->forward_alloc))
 		return 1;
 
@@ -521,8 +525,13 @@ void __tcp_mem_reclaim(struct sock *sk)
 void tcp_rfree(struct sk_buff *skb)
 {
 	struct sock *sk = skb->sk;
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
 
-	atomic_sub(skb->truesize, &sk->rmem_alloc);
+	tp->rmem_fwd += skb->truesize;
+	if (tp->rmem_fwd > 2*TCP_MEM_QUANTUM) {
+		atomic_sub(tp->rmem_fwd - TCP_MEM_QUANTUM, &sk->rmem_alloc);
+		tp->rmem_fwd = TCP_MEM_QUANTUM;
+	}
 	sk->forward_alloc += skb->truesize;
 }
 
@@ -531,7 +540,7 @@ void tcp_rfree(struct sk_buff *skb)
  */
 static __inline__ unsigned int tcp_listen_poll(struct sock *sk, poll_table *wait)
 {
-	return sk->tp_pinfo.af_tcp.accept_queue ? (POLLIN | POLLRDNORM) : 0;
+	return sk->ack_backlog ? (POLLIN | POLLRDNORM) : 0;
 }
 
 /*
@@ -686,7 +695,6 @@ int tcp_listen_start(struct sock *sk)
 
 	sk->max_ack_backlog = 0;
 	sk->ack_backlog = 0;
-	tp->accept_queue = tp->accept_queue_tail = NULL;
 	tp->syn_wait_lock = RW_LOCK_UNLOCKED;
 
 	lopt = kmalloc(sizeof(struct tcp_listen_opt), GFP_KERNEL);
@@ -734,17 +742,17 @@ static void tcp_listen_stop (struct sock *sk)
 {
 	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
 	struct tcp_listen_opt *lopt = tp->listen_opt;
-	struct open_request *acc_req = tp->accept_queue;
 	struct open_request *req;
 	int i;
 
 	tcp_delete_keepalive_timer(sk);
 
-	/* make all the listen_opt local to us */
+	/* make all the listen_opt local to us, segments arriving from
+	 * now on see no listen_opt and are dropped.
+	 */
 	write_lock_bh(&tp->syn_wait_lock);
 	tp->listen_opt =NULL;
 	write_unlock_bh(&tp->syn_wait_lock);
-	tp->accept_queue = tp->accept_queue_tail = NULL;
 
 	if (lopt->qlen) {
 		for (i=0; i<TCP_SYNQ_HSIZE; i++) {
@@ -766,34 +774,34 @@ static void tcp_listen_stop (struct sock *sk)
 	}
 	BUG_TRAP(lopt->qlen == 0);
 
-	kfree(lopt);
-
-	while ((req=acc_req) != NULL) {
-		struct sock *child = req->sk;
+	for (i=0; i<NR_CPUS; i++) {
+		while ((req = __tcp_acceptq_dequeue(&lopt->accept_queue[i])) != NULL) {
+			struct sock *child = req->sk;
 
-		acc_req = req->dl_next;
+			local_bh_disable();
+			bh_lock_sock(child);
+			BUG_TRAP(child->lock.users==0);
+			sock_hold(child);
 
-		local_bh_disable();
-		bh_lock_sock(child);
-		BUG_TRAP(child->lock.users==0);
-		sock_hold(child);
+			tcp_disconnect(child, O_NONBLOCK);
 
-		tcp_disconnect(child, O_NONBLOCK);
+			sock_orphan(child);
 
-		sock_orphan(child);
+			atomic_inc(&tcp_orphan_count);
 
-		atomic_inc(&tcp_orphan_count);
+			tcp_destroy_sock(child);
 
-		tcp_destroy_sock(child);
+			bh_unlock_sock(child);
+			local_bh_enable();
+			sock_put(child);
 
-		bh_unlock_sock(child);
-		local_bh_enable();
-		sock_put(child);
-
-		tcp_acceptq_removed(sk);
-		tcp_openreq_fastfree(req);
+			tcp_acceptq_removed(sk);
+			tcp_openreq_fastfree(req);
+		}
 	}
 	BUG_TRAP(sk->ack_backlog == 0);
+
+	kfree(lopt);
 }
 
 /*
@@ -886,12 +894,113 @@ static long wait_for_tcp_memory(struct sock * sk, long timeo)
 	return timeo;
 }
 
+/* Can the route gather page fragments and checksum them for us? */
+static inline int tcp_route_sg(struct sock *sk)
+{
+	return (sk->route_caps&NETIF_F_SG) &&
+	       (sk->route_caps&(NETIF_F_IP_CSUM|NETIF_F_NO_CSUM|NETIF_F_HW_CSUM));
+}
+
+/* How much data to gather into one frame.  A route which segments for
+ * us takes up to 64K at once; the stack cuts it down to what the windows
+ * allow when it is sent.
+ */
+static inline int tcp_xmit_size_goal(struct sock *sk, int mss_now)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+	int goal;
+
+	if (!(sk->route_caps&NETIF_F_TSO) || !tcp_route_sg(sk) || tp->urg_mode)
+		return mss_now;
+
+	goal = 65535 - tp->af_specific->net_header_len -
+		tp->ext_header_len - tp->tcp_header_len;
+	if (tp->max_window && goal > (tp->max_window>>1))
+		goal = tp->max_window>>1;
+	goal -= goal % mss_now;
+	return max(goal, mss_now);
+}
+
+static inline int tcp_wmem_schedule(struct sock *sk, int size)
+{
+	return sk->forward_alloc >= size || tcp_mem_schedule(sk, size, 0);
+}
+
+/* Does data at off in page continue the last fragment of skb? */
+static inline int tcp_frag_merges(struct sk_buff *skb, struct page *page, int off)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+	skb_frag_t *frag = &skb_shinfo(skb)->frags[i-1];
+
+	return i > 0 && frag->page == page &&
+	       frag->page_offset + frag->size == off;
+}
+
+static inline void tcp_append_frag(struct sk_buff *skb, struct page *page,
+				   int off, int size, int merge)
+{
+	if (merge) {
+		skb_shinfo(skb)->frags[skb_shinfo(skb)->nr_frags-1].size += size;
+		skb->len += size;
+		skb->data_len += size;
+	} else {
+		get_page(page);
+		skb_add_frag(skb, page, off, size);
+	}
+	skb->truesize += size;
+}
+
+/* Make sure the socket has a send page with free space and the memory
+ * to queue size more bytes.  The page is from low memory, so that
+ * devices and the fallbacks in the stack reach it with page_address().
+ */
+static int tcp_page_room(struct sock *sk, int size)
+{
+	if (!tcp_wmem_schedule(sk, size))
+		return 0;
+	if (sk->sndmsg_page == NULL || sk->sndmsg_off == PAGE_SIZE) {
+		struct page *page = alloc_page(sk->allocation);
+
+		if (page == NULL)
+			return 0;
+		if (sk->sndmsg_page != NULL)
+			__free_page(sk->sndmsg_page);
+		sk->sndmsg_page = page;
+		sk->sndmsg_off = 0;
+	}
+	return 1;
+}
+
+/* Copy up to size bytes of user data into the send page and append them
+ * to the fragments of skb.  Returns the number of bytes appended, zero
+ * when the fragment list is full or -EFAULT.
+ */
+static int tcp_copy_to_page(struct sock *sk, struct sk_buff *skb,
+			    unsigned char *from, int size)
+{
+	struct page *page = sk->sndmsg_page;
+	int off = sk->sndmsg_off;
+	int merge = tcp_frag_merges(skb, page, off);
+
+	if (!merge && skb_shinfo(skb)->nr_frags == MAX_SKB_FRAGS)
+		return 0;
+	if (size > PAGE_SIZE - off)
+		size = PAGE_SIZE - off;
+	if (copy_from_user(page_address(page) + off, from, size))
+		return -EFAULT;
+	tcp_append_frag(skb, page, off, size, merge);
+	sk->sndmsg_off = off + size;
+	return size;
+}
+
 /* When all user supplied data has been queued set the PSH bit */
 #define PSH_NEEDED (seglen == 0 && iovlen == 0)
 
 /*
  *	This routine copies from a user buffer into a socket,
- *	and starts the transmit system.
+ *	and starts the transmit system.  Routes which gather and
+ *	checksum page fragments get the data in pages, leaving the
+ *	checksum to the device.
  */
 
 int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
@@ -900,7 +1009,7 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 	struct tcp_opt *tp;
 	struct sk_buff *skb;
 	int iovlen, flags;
-	int mss_now;
+	int mss_now, size_goal, sg;
 	int err, copied;
 	long timeo;
 
@@ -923,6 +1032,8 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 	clear_bit(SOCK_ASYNC_NOSPACE, &sk->socket->flags);
 
 	mss_now = tcp_current_mss(sk);
+	size_goal = tcp_xmit_size_goal(sk, mss_now);
+	sg = tcp_route_sg(sk);
 
 	/* Ok commence sending. */
 	iovlen = msg->msg_iovlen;
@@ -954,16 +1065,24 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 			 */
 			skb = sk->write_queue.prev;
 			if (tp->send_head &&
-			    (mss_now - skb->len) > 0) {
-				copy = skb->len;
-				if (skb_tailroom(skb) > 0) {
-					int last_byte_was_odd = (copy % 4);
+			    (size_goal - skb->len) > 0) {
+				copy = size_goal - skb->len;
+				if(copy > seglen)
+					copy = seglen;
+				if (skb->ip_summed == CHECKSUM_HW) {
+					copy = tcp_page_room(sk, copy) ?
+						tcp_copy_to_page(sk, skb, from, copy) : 0;
+					if (copy < 0) {
+						err = copy;
+						continue;
+					}
+					sk->wmem_queued += copy;
+					sk->forward_alloc -= copy;
+				} else if (skb_tailroom(skb) > 0) {
+					int last_byte_was_odd = (skb->len % 4);
 
-					copy = mss_now - copy;
 					if(copy > skb_tailroom(skb))
 						copy = skb_tailroom(skb);
-					if(copy > seglen)
-						copy = seglen;
 					if(last_byte_was_odd) {
 						if(copy_from_user(skb_put(skb, copy),
 								  from, copy))
@@ -988,6 +1107,10 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 					 *	  ATM it might send partly zeroed
 					 *	  data in this case.
 					 */
+				} else {
+					copy = 0;
+				}
+				if (copy > 0) {
 					tp->write_seq += copy;
 					TCP_SKB_CB(skb)->end_seq += copy;
 					from += copy;
@@ -1004,31 +1127,28 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 						TCP_SKB_CB(skb)->sacked |= TCPCB_URG;
 					}
 					continue;
-				} else {
-					TCP_SKB_CB(skb)->flags |= TCPCB_FLAG_PSH;
-					tp->pushed_seq = tp->write_seq;
 				}
+				TCP_SKB_CB(skb)->flags |= TCPCB_FLAG_PSH;
+				tp->pushed_seq = tp->write_seq;
 			}
 
-			copy = min(seglen, mss_now);
+			copy = min(seglen, size_goal);
 
-			/* Determine how large of a buffer to allocate.  */
-			tmp = MAX_TCP_HEADER + 15 + tp->mss_cache;
-			if (copy < mss_now && !(flags & MSG_OOB)) {
-				/* What is happening here is that we want to
-				 * tack on later members of the users iovec
-				 * if possible into a single frame.  When we
-				 * leave this loop our we check to see if
-				 * we can send queued frames onto the wire.
-				 */
-				queue_it = 1;
-			} else {
-				queue_it = 0;
-			}
+			/* Determine how large of a buffer to allocate.  The
+			 * data of a gathering route goes in pages.
+			 */
+			tmp = MAX_TCP_HEADER + 15;
+			if (!sg)
+				tmp += tp->mss_cache;
 
 			skb = NULL;
 			if (tcp_memory_free(sk))
 				skb = tcp_alloc_skb(sk, tmp, sk->allocation);
+			if (skb != NULL && sg &&
+			    !tcp_page_room(sk, skb->truesize + copy)) {
+				__kfree_skb(skb);
+				skb = NULL;
+			}
 			if (skb == NULL) {
 				/* If we didn't get any memory, we need to sleep. */
 				set_bit(SOCK_ASYNC_NOSPACE, &sk->socket->flags);
@@ -1050,9 +1170,41 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 				 * we must find out about it.
 				 */
 				mss_now = tcp_current_mss(sk);
+				size_goal = tcp_xmit_size_goal(sk, mss_now);
 				continue;
 			}
 
+			/* TCP data bytes are SKB_PUT() on top, later
+			 * TCP+IP+DEV headers are SKB_PUSH()'d beneath.
+			 * Reserve header space and checksum the data.
+			 */
+			skb_reserve(skb, MAX_TCP_HEADER);
+			if (sg) {
+				skb->ip_summed = CHECKSUM_HW;
+				copy = tcp_copy_to_page(sk, skb, from, copy);
+				if (copy < 0) {
+					err = copy;
+					goto do_fault;
+				}
+			} else {
+				skb->csum = csum_and_copy_from_user(from,
+						skb_put(skb, copy), copy, 0, &err);
+				if (err)
+					goto do_fault;
+			}
+
+			if (copy < size_goal && !(flags & MSG_OOB)) {
+				/* What is happening here is that we want to
+				 * tack on later members of the users iovec
+				 * if possible into a single frame.  When we
+				 * leave this loop our we check to see if
+				 * we can send queued frames onto the wire.
+				 */
+				queue_it = 1;
+			} else {
+				queue_it = 0;
+			}
+
 			seglen -= copy;
 
 			/* Prepare control bits for TCP header creation engine. */
@@ -1070,17 +1222,6 @@ int tcp_sendmsg(struct sock *sk, struct msghdr *msg, int size)
 				tp->snd_up = tp->write_seq + copy;
 			}
 
-			/* TCP data bytes are SKB_PUT() on top, later
-			 * TCP+IP+DEV headers are SKB_PUSH()'d beneath.
-			 * Reserve header space and checksum the data.
-			 */
-			skb_reserve(skb, MAX_TCP_HEADER);
-			skb->csum = csum_and_copy_from_user(from,
-					skb_put(skb, copy), copy, 0, &err);
-
-			if (err)
-				goto do_fault;
-
 			from += copy;
 			copied += copy;
 
@@ -1130,6 +1271,203 @@ do_fault2:
 
 #undef PSH_NEEDED
 
+/*
+ *	Send part of a page.  A route which gathers and checksums page
+ *	fragments gets the page itself, referenced from the skb, unless
+ *	it is in high memory.  Otherwise the data goes into the skb, but
+ *	it is copied and checksummed in one pass from the kernel mapping
+ *	of the page, without the user access checks and fault handling
+ *	of tcp_sendmsg().
+ */
+
+ssize_t tcp_sendpage(struct sock *sk, struct page *page, int offset, size_t size, int flags)
+{
+	struct tcp_opt *tp;
+	struct sk_buff *skb;
+	char *from;
+	int mss_now, size_goal, sg;
+	int err, copied;
+	long timeo;
+
+	err = 0;
+	copied = 0;
+	tp = &(sk->tp_pinfo.af_tcp);
+	from = kmap(page) + offset;
+
+	lock_sock(sk);
+	TCP_CHECK_TIMER(sk);
+
+	timeo = sock_sndtimeo(sk, flags&MSG_DONTWAIT);
+
+	/* Wait for a connection to finish. */
+	if ((1 << sk->state) & ~(TCPF_ESTABLISHED | TCPF_CLOSE_WAIT))
+		if((err = wait_for_tcp_connect(sk, flags, &timeo)) != 0)
+			goto out_unlock;
+
+	clear_bit(SOCK_ASYNC_NOSPACE, &sk->socket->flags);
+
+	mss_now = tcp_current_mss(sk);
+	sg = tcp_route_sg(sk) && !PageHighMem(page);
+	size_goal = sg ? tcp_xmit_size_goal(sk, mss_now) : mss_now;
+
+	while (size > 0) {
+		int copy, tmp;
+
+		if (sk->err)
+			goto do_sock_err;
+		if (sk->shutdown & SEND_SHUTDOWN)
+			goto do_shutdown;
+
+		/* Tack onto a half built packet if there is one. */
+		skb = sk->write_queue.prev;
+		if (tp->send_head &&
+		    (size_goal - skb->len) > 0) {
+			copy = size_goal - skb->len;
+			if (copy > size)
+				copy = size;
+			if (sg && skb->ip_summed == CHECKSUM_HW) {
+				int merge = tcp_frag_merges(skb, page, offset);
+
+				if ((!merge &&
+				     skb_shinfo(skb)->nr_frags == MAX_SKB_FRAGS) ||
+				    !tcp_wmem_schedule(sk, copy)) {
+					copy = 0;
+				} else {
+					tcp_append_frag(skb, page, offset, copy, merge);
+					sk->wmem_queued += copy;
+					sk->forward_alloc -= copy;
+				}
+			} else if (skb_tailroom(skb) > 0) {
+				int last_byte_was_odd = (skb->len % 4);
+
+				if (copy > skb_tailroom(skb))
+					copy = skb_tailroom(skb);
+				if (last_byte_was_odd) {
+					memcpy(skb_put(skb, copy), from, copy);
+					skb->csum = csum_partial(skb->data,
+								 skb->len, 0);
+				} else {
+					skb->csum = csum_partial_copy_nocheck(
+						from, skb_put(skb, copy),
+						copy, skb->csum);
+				}
+			} else {
+				copy = 0;
+			}
+			if (copy > 0) {
+				tp->write_seq += copy;
+				TCP_SKB_CB(skb)->end_seq += copy;
+				from += copy;
+				offset += copy;
+				copied += copy;
+				size -= copy;
+				if (size == 0 ||
+				    after(tp->write_seq, tp->pushed_seq+(tp->max_window>>1))) {
+					TCP_SKB_CB(skb)->flags |= TCPCB_FLAG_PSH;
+					tp->pushed_seq = tp->write_seq;
+				}
+				continue;
+			}
+			TCP_SKB_CB(skb)->flags |= TCPCB_FLAG_PSH;
+			tp->pushed_seq = tp->write_seq;
+		}
+
+		copy = size_goal;
+		if (copy > size)
+			copy = size;
+
+		tmp = MAX_TCP_HEADER + 15;
+		if (!sg)
+			tmp += tp->mss_cache;
+		skb = NULL;
+		if (tcp_memory_free(sk))
+			skb = tcp_alloc_skb(sk, tmp, sk->allocation);
+		if (skb != NULL && sg &&
+		    !tcp_wmem_schedule(sk, skb->truesize + copy)) {
+			__kfree_skb(skb);
+			skb = NULL;
+		}
+		if (skb == NULL) {
+			/* If we didn't get any memory, we need to sleep. */
+			set_bit(SOCK_ASYNC_NOSPACE, &sk->socket->flags);
+			set_bit(SOCK_NOSPACE, &sk->socket->flags);
+
+			__tcp_push_pending_frames(sk, tp, mss_now, 1);
+
+			if (!timeo) {
+				err = -EAGAIN;
+				goto do_interrupted;
+			}
+			if (signal_pending(current)) {
+				err = sock_intr_errno(timeo);
+				goto do_interrupted;
+			}
+			timeo = wait_for_tcp_memory(sk, timeo);
+			mss_now = tcp_current_mss(sk);
+			size_goal = sg ? tcp_xmit_size_goal(sk, mss_now) : mss_now;
+			continue;
+		}
+
+		size -= copy;
+
+		if (size == 0 ||
+		    after(tp->write_seq+copy, tp->pushed_seq+(tp->max_window>>1))) {
+			TCP_SKB_CB(skb)->flags = TCPCB_FLAG_ACK|TCPCB_FLAG_PSH;
+			tp->pushed_seq = tp->write_seq + copy;
+		} else {
+			TCP_SKB_CB(skb)->flags = TCPCB_FLAG_ACK;
+		}
+		TCP_SKB_CB(skb)->sacked = 0;
+
+		skb_reserve(skb, MAX_TCP_HEADER);
+		if (sg) {
+			skb->ip_summed = CHECKSUM_HW;
+			tcp_append_frag(skb, page, offset, copy, 0);
+		} else {
+			skb->csum = csum_partial_copy_nocheck(from,
+					skb_put(skb, copy), copy, 0);
+		}
+
+		from += copy;
+		offset += copy;
+		copied += copy;
+
+		TCP_SKB_CB(skb)->seq = tp->write_seq;
+		TCP_SKB_CB(skb)->end_seq = TCP_SKB_CB(skb)->seq + copy;
+
+		/* This advances tp->write_seq for us. */
+		tcp_send_skb(sk, skb, copy < size_goal, mss_now);
+	}
+	err = copied;
+out:
+	__tcp_push_pending_frames(sk, tp, mss_now, tp->nonagle);
+out_unlock:
+	TCP_CHECK_TIMER(sk);
+	release_sock(sk);
+	kunmap(page);
+	return err;
+
+do_sock_err:
+	if (copied)
+		err = copied;
+	else
+		err = sock_error(sk);
+	goto out;
+do_shutdown:
+	if (copied)
+		err = copied;
+	else {
+		if (!(flags&MSG_NOSIGNAL))
+			send_sig(SIGPIPE, current, 0);
+		err = -EPIPE;
+	}
+	goto out;
+do_interrupted:
+	if (copied)
+		err = copied;
+	goto out_unlock;
+}
+
 /*
  *	Handle reading urgent data. BSD has very simple semantics for
  *	this, no blocking and very strange errors 8)
@@ -1227,7 +1565,7 @@ static void cleanup_rbuf(struct sock *sk, int copied)
 		    || (copied > 0 &&
 			(tp->ack.pending&TCP_ACK_PUSHED) &&
 			!tp->ack.pingpong &&
-			atomic_read(&sk->rmem_alloc) == 0)) {
+			tcp_rmem_alloc(sk) == 0)) {
 			time_to_ack = 1;
 		}
 	}
@@ -1604,6 +1942,8 @@ do_prequeue:
 	 * on connected socket. I was just happy when found this 8) --ANK
 	 */
 
+	tcp_rcv_space_adjust(sk);
+
 	/* Clean up data we have read: This will do ACK frames. */
 	cleanup_rbuf(sk, copied);
 
@@ -1621,6 +1961,178 @@ recv_urg:
 	goto out;
 }
 
+/*
+ *	Hand the data in the receive queue straight to an actor, for
+ *	in-kernel users that parse the byte stream themselves and would
+ *	otherwise recvmsg it into a bounce buffer first. Returns the
+ *	number of bytes the actor took.
+ *
+ *	Must be called with the socket locked, or from its data_ready
+ *	callback. Urgent data is not treated specially.
+ */
+
+int tcp_read_sock(struct sock *sk, read_descriptor_t *desc, sk_read_actor_t recv_actor)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+	struct sk_buff *skb;
+	u32 seq = tp->copied_seq;
+	u32 offset;
+	int copied = 0, used;
+
+	if (sk->state == TCP_LISTEN)
+		return -ENOTCONN;
+
+	while ((skb = skb_peek(&sk->receive_queue)) != NULL) {
+		offset = seq - TCP_SKB_CB(skb)->seq;
+		if (skb->h.th->syn)
+			offset--;
+		if (offset < skb->len) {
+			size_t len = skb->len - offset;
+
+			used = recv_actor(desc, skb, ((char *)skb->h.th) + skb->h.th->doff*4 + offset, len);
+			if (used <= 0) {
+				if (!copied)
+					copied = used;
+				break;
+			}
+			if (used > len)
+				used = len;
+			seq += used;
+			copied += used;
+			if (offset + used < skb->len)
+				break;
+		}
+		if (skb->h.th->fin) {
+			++seq;
+			skb->used = 1;
+			break;
+		}
+		skb->used = 1;
+		tcp_eat_skb(sk, skb);
+		if (!desc->count)
+			break;
+	}
+	tp->copied_seq = seq;
+
+	/* Clean up data we have read: This will do ACK frames. */
+	if (copied > 0)
+		cleanup_rbuf(sk, copied);
+	return copied;
+}
+
+/*
+ *	Receive straight into the page cache of a file, for splice():
+ *	each skb is copied once, into the page it ends up in, where
+ *	recv() and write() would copy it through a user buffer.
+ */
+
+struct tcp_file_desc {
+	read_descriptor_t	desc;
+	struct sk_buff		*skb;
+	int			offset;		/* in the skb */
+};
+
+static int tcp_file_fill(read_descriptor_t *desc, struct page *page,
+			 unsigned long offset, unsigned long size)
+{
+	struct tcp_file_desc *fd = (struct tcp_file_desc *) desc;
+
+	if (skb_copy_bits(fd->skb, fd->offset, page_address(page) + offset, size)) {
+		desc->error = -EFAULT;
+		return 0;
+	}
+	fd->offset += size;
+	desc->count -= size;
+	desc->written += size;
+	return size;
+}
+
+static int tcp_file_recv(read_descriptor_t *desc, struct sk_buff *skb,
+			 char *from, size_t len)
+{
+	struct file *file = (struct file *) desc->buf;
+	struct tcp_file_desc fd;
+
+	if (len > desc->count)
+		len = desc->count;
+	fd.desc.written = 0;
+	fd.desc.count = len;
+	fd.desc.buf = NULL;
+	fd.desc.error = 0;
+	fd.skb = skb;
+	fd.offset = from - (char *) skb->data;	/* the skb may be paged */
+	do_generic_file_fill(file, &file->f_pos, &fd.desc, tcp_file_fill);
+
+	desc->count -= fd.desc.written;
+	desc->written += fd.desc.written;
+	if (fd.desc.error) {
+		desc->error = fd.desc.error;
+		if (!fd.desc.written)
+			return fd.desc.error;
+	}
+	return fd.desc.written;
+}
+
+ssize_t tcp_receive_file(struct sock *sk, struct file *file, size_t size, int noblock)
+{
+	read_descriptor_t desc;
+	long timeo;
+	int err;
+
+	lock_sock(sk);
+	TCP_CHECK_TIMER(sk);
+
+	err = -ENOTCONN;
+	if (sk->state == TCP_LISTEN)
+		goto out;
+
+	timeo = sock_rcvtimeo(sk, noblock);
+	desc.written = 0;
+	desc.count = size;
+	desc.buf = (char *) file;
+	desc.error = 0;
+
+	while (desc.count) {
+		if (tcp_read_sock(sk, &desc, tcp_file_recv) < 0 || desc.error)
+			break;
+		if (desc.written) {
+			/* Like recv(), return what is there */
+			if (skb_queue_empty(&sk->receive_queue))
+				break;
+			continue;
+		}
+
+		if (sk->done)
+			break;
+		if (sk->err) {
+			desc.error = sock_error(sk);
+			break;
+		}
+		if (sk->shutdown & RCV_SHUTDOWN)
+			break;
+		if (sk->state == TCP_CLOSE) {
+			if (!sk->done)
+				desc.error = -ENOTCONN;
+			break;
+		}
+		if (!timeo) {
+			desc.error = -EAGAIN;
+			break;
+		}
+		timeo = tcp_data_wait(sk, timeo);
+		if (signal_pending(current)) {
+			desc.error = sock_intr_errno(timeo);
+			break;
+		}
+	}
+	err = desc.written ? desc.written : desc.error;
+
+out:
+	TCP_CHECK_TIMER(sk);
+	release_sock(sk);
+	return err;
+}
+
 /*
  *	State processing on a close. This implements the state shift for
  *	sending our FIN frame. Note that we only send a FIN for some
@@ -1700,6 +2212,7 @@ static __inline__ void tcp_kill_sk_queues(struct sock *sk)
 
 	/* Account for returned memory. */
 	tcp_mem_reclaim(sk);
+	tcp_release_fwd(sk);
 
 	BUG_TRAP(sk->wmem_queued == 0);
 	BUG_TRAP(sk->forward_alloc == 0);
@@ -2016,11 +2529,11 @@ static int wait_for_connect(struct sock * sk, long timeo)
 	for (;;) {
 		current->state = TASK_INTERRUPTIBLE;
 		release_sock(sk);
-		if (sk->tp_pinfo.af_tcp.accept_queue == NULL)
+		if (sk->ack_backlog == 0)
 			timeo = schedule_timeout(timeo);
 		lock_sock(sk);
 		err = 0;
-		if (sk->tp_pinfo.af_tcp.accept_queue)
+		if (sk->ack_backlog)
 			break;
 		err = -EINVAL;
 		if (sk->state != TCP_LISTEN)
@@ -2058,7 +2571,7 @@ struct sock *tcp_accept(struct sock *sk, int flags, int *err)
 		goto out;
 
 	/* Find already established connection */
-	if (!tp->accept_queue) {
+	if (!sk->ack_backlog) {
 		long timeo = sock_rcvtimeo(sk, flags & O_NONBLOCK);
 
 		/* If this is a non blocking socket don't sleep */
@@ -2071,12 +2584,12 @@ struct sock *tcp_accept(struct sock *sk, int flags, int *err)
 			goto out;
 	}
 
-	req = tp->accept_queue;
-	if ((tp->accept_queue = req->dl_next) == NULL)
-		tp->accept_queue_tail = NULL;
+	/* Children are queued from softirqs without the socket lock. */
+	write_lock_bh(&tp->syn_wait_lock);
+	req = tcp_acceptq_dequeue(sk);
+	write_unlock_bh(&tp->syn_wait_lock);
 
  	newsk = req->sk;
-	tcp_acceptq_removed(sk);
 	tcp_openreq_fastfree(req);
 	BUG_TRAP(newsk->state != TCP_SYN_RECV);
 	release_sock(sk);
@@ -2228,6 +2741,17 @@ int tcp_setsockopt(struct sock *sk, int level, int optname, char *optval,
 		}
 		break;
 
+	case TCP_PACING:
+		tp->pacing.on = val ? 1 : 0;
+		break;
+
+	case TCP_MAXRATE:
+		if (val < 0)
+			err = -EINVAL;
+		else
+			tp->pacing.maxrate = val;
+		break;
+
 	default:
 		err = -ENOPROTOOPT;
 		break;
@@ -2286,6 +2810,12 @@ int tcp_getsockopt(struct sock *sk, int level, int optname, char *optval,
 	case TCP_WINDOW_CLAMP:
 		val = tp->window_clamp;
 		break;
+	case TCP_PACING:
+		val = tp->pacing.on;
+		break;
+	case TCP_MAXRATE:
+		val = tp->pacing.maxrate;
+		break;
 	case TCP_INFO:
 	{
 		struct tcp_info info;
@@ -2386,12 +2916,26 @@ void __init tcp_init(void)
 	if(!tcp_bucket_cachep)
 		panic("tcp_init: Cannot alloc tcp_bind_bucket cache.");
 
+	/* There are lots of TIME_WAIT buckets and they are seldom
+	 * touched, so they are packed tight: no cache line alignment,
+	 * and no IPv6 addresses in IPv4 ones.
+	 */
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	tcp_timewait_cachep = kmem_cache_create("tcp_tw_bucket",
+						offsetof(struct tcp_tw_bucket, v6_daddr),
+						0, 0, NULL, NULL);
+	tcp6_timewait_cachep = kmem_cache_create("tcp6_tw_bucket",
+						 sizeof(struct tcp_tw_bucket),
+						 0, 0, NULL, NULL);
+	if(!tcp_timewait_cachep || !tcp6_timewait_cachep)
+		panic("tcp_init: Cannot alloc tcp_tw_bucket cache.");
+#else
 	tcp_timewait_cachep = kmem_cache_create("tcp_tw_bucket",
 						sizeof(struct tcp_tw_bucket),
-						0, SLAB_HWCACHE_ALIGN,
-						NULL, NULL);
+						0, 0, NULL, NULL);
 	if(!tcp_timewait_cachep)
 		panic("tcp_init: Cannot alloc tcp_tw_bucket cache.");
+#endif
 
 	/* Size and allocate the main established and bind bucket
 	 * hash tables.
@@ -86,6 +86,7 @@ int sysctl_tcp_ecn = 0;
 int sysctl_tcp_dsack = 1;
 int sysctl_tcp_app_win = 31;
 int sysctl_tcp_adv_win_scale = 2;
+int sysctl_tcp_moderate_rcvbuf = 1;
 
 int sysctl_tcp_stdurg = 0;
 int sysctl_tcp_rfc1337 = 0;
@@ -315,6 +316,10 @@ static void tcp_init_buffer_space(struct sock *sk)
 
 	tp->rcv_ssthresh = min(tp->rcv_ssthresh, tp->window_clamp);
 	tp->snd_cwnd_stamp = tcp_time_stamp;
+
+	tp->rcvq_space.space = tp->rcv_wnd;
+	tp->rcvq_space.seq = tp->copied_seq;
+	tp->rcvq_space.time = tcp_time_stamp;
 }
 
 /* 5. Recalculate window clamp after socket hit its memory bounds. */
@@ -338,11 +343,11 @@ static void tcp_clamp_window(struct sock *sk, struct tcp_opt *tp)
 		    !(sk->userlocks&SOCK_RCVBUF_LOCK) &&
 		    !tcp_memory_pressure &&
 		    atomic_read(&tcp_memory_allocated) < sysctl_tcp_mem[0])
-			sk->rcvbuf = min(atomic_read(&sk->rmem_alloc), sysctl_tcp_rmem[2]);
+			sk->rcvbuf = min(tcp_rmem_alloc(sk), sysctl_tcp_rmem[2]);
 	}
-	if (atomic_read(&sk->rmem_alloc) > sk->rcvbuf) {
+	if (tcp_rmem_alloc(sk) > sk->rcvbuf) {
 		app_win += ofo_win;
-		if (atomic_read(&sk->rmem_alloc) >= 2*sk->rcvbuf)
+		if (tcp_rmem_alloc(sk) >= 2*sk->rcvbuf)
 			app_win >>= 1;
 		if (app_win > tp->ack.rcv_mss)
 			app_win -= tp->ack.rcv_mss;
@@ -354,6 +359,109 @@ static void tcp_clamp_window(struct sock *sk, struct tcp_opt *tp)
 	}
 }
 
+/* 6. Grow rcvbuf following the application.
+ *
+ * The receiver estimates the rtt itself: one window of data takes
+ * one rtt to arrive, and timestamps, when we have them, give a sample
+ * with each segment.  Once per rtt we look at how much the application
+ * has read.  The buffer must hold twice that (one window in flight,
+ * one waiting for the reader) plus the skb overhead; if it does not,
+ * rcvbuf and window_clamp grow up to tcp_rmem[2].  Idle or slow
+ * readers never grow their buffers, so thousands of quiet sockets
+ * stay at tcp_rmem[1].  Nothing grows under tcp_mem pressure.
+ */
+static void tcp_rcv_rtt_update(struct tcp_opt *tp, u32 sample, int win_dep)
+{
+	u32 new_sample = tp->rcv_rtt_est.rtt;
+	long m = sample;
+
+	if (m == 0)
+		m = 1;
+
+	if (new_sample != 0) {
+		/* A window based sample is at least one rtt long, often
+		 * more if the sender is application limited, so take
+		 * the minimum.  Timestamp samples are smoothed as usual.
+		 */
+		if (!win_dep) {
+			m -= (new_sample >> 3);
+			new_sample += m;
+		} else if (m < new_sample)
+			new_sample = m << 3;
+	} else {
+		/* No previous measure. */
+		new_sample = m << 3;
+	}
+
+	tp->rcv_rtt_est.rtt = new_sample;
+}
+
+static inline void tcp_rcv_rtt_measure(struct tcp_opt *tp)
+{
+	if (tp->rcv_rtt_est.time == 0)
+		goto new_measure;
+	if (before(tp->rcv_nxt, tp->rcv_rtt_est.seq))
+		return;
+	tcp_rcv_rtt_update(tp, tcp_time_stamp - tp->rcv_rtt_est.time, 1);
+
+new_measure:
+	tp->rcv_rtt_est.seq = tp->rcv_nxt + tp->rcv_wnd;
+	tp->rcv_rtt_est.time = tcp_time_stamp;
+}
+
+static inline void tcp_rcv_rtt_measure_ts(struct tcp_opt *tp, struct sk_buff *skb)
+{
+	if (tp->rcv_tsecr &&
+	    (TCP_SKB_CB(skb)->end_seq - TCP_SKB_CB(skb)->seq >= tp->ack.rcv_mss))
+		tcp_rcv_rtt_update(tp, tcp_time_stamp - tp->rcv_tsecr, 0);
+}
+
+/* Called from tcp_recvmsg() after data was copied to the user. */
+void tcp_rcv_space_adjust(struct sock *sk)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+	int time, space;
+
+	if (tp->rcvq_space.time == 0)
+		goto new_measure;
+
+	time = tcp_time_stamp - tp->rcvq_space.time;
+	if (tp->rcv_rtt_est.rtt == 0 || time < (tp->rcv_rtt_est.rtt >> 3))
+		return;
+
+	space = 2*(tp->copied_seq - tp->rcvq_space.seq);
+	if (space <= tp->rcvq_space.space)
+		goto new_measure;
+	tp->rcvq_space.space = space;
+
+	if (sysctl_tcp_moderate_rcvbuf &&
+	    !(sk->userlocks&SOCK_RCVBUF_LOCK) &&
+	    !tcp_memory_pressure &&
+	    atomic_read(&tcp_memory_allocated) < sysctl_tcp_mem[0]) {
+		int new_clamp = space;
+		int rcvmem;
+
+		/* Convert the payload to memory, counting headers and
+		 * sk_buff overhead as tcp_fixup_rcvbuf() does.
+		 */
+		rcvmem = tp->advmss+MAX_TCP_HEADER+16+sizeof(struct sk_buff);
+		while (tcp_win_from_space(rcvmem) < tp->advmss)
+			rcvmem += 128;
+		space = max(space/tp->advmss, 1) * rcvmem;
+		space = min(space, sysctl_tcp_rmem[2]);
+
+		if (space > sk->rcvbuf) {
+			sk->rcvbuf = space;
+			tp->window_clamp = min(max(new_clamp, tp->window_clamp),
+					       65535U << tp->rcv_wscale);
+		}
+	}
+
+new_measure:
+	tp->rcvq_space.seq = tp->copied_seq;
+	tp->rcvq_space.time = tcp_time_stamp;
+}
+
 /* There is something which you must keep in mind when you analyze the
  * behavior of the tp->ato delayed ack timeout interval.  When a
  * connection starts up, we want to ack as quickly as possible.  The
@@ -372,6 +480,10 @@ static void tcp_event_data_recv(struct sock *sk, struct tcp_opt *tp, struct sk_b
 
 	tcp_measure_rcv_mss(tp, skb);
 
+	tcp_rcv_rtt_measure(tp);
+	if (tp->saw_tstamp)
+		tcp_rcv_rtt_measure_ts(tp, skb);
+
 	now = tcp_time_stamp;
 
 	if (!tp->ack.ato) {
@@ -761,6 +873,17 @@ static void tcp_update_reordering(struct tcp_opt *tp, int metric, int ts)
  *    for retransmitted and already SACKed segment -> reordering..
  * Both of these heuristics are not used in Loss state, when we cannot
  * account for retransmits accurately.
+ *
+ * SACK scoreboard hints.
+ * ---------------------
+ * With a window of thousands of segments, walking the queue from its head
+ * for every block of every ACK makes loss recovery quadratic. The blocks
+ * are sorted, so that one walk covers all of them, and the place where the
+ * walk for the first (most recent) block stopped is remembered together
+ * with its fack_count. When the next ACK only extends that block, which is
+ * what the receiver does while segments keep arriving above a hole, the
+ * walk resumes there and costs only the newly SACKed data. Anything that
+ * changes the queue in front of the hint drops it (tcp_clear_sack_hints()).
  */
 static int
 tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_una)
@@ -769,75 +892,135 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 	unsigned char *ptr = ack_skb->h.raw + TCP_SKB_CB(ack_skb)->sacked;
 	struct tcp_sack_block *sp = (struct tcp_sack_block *)(ptr+2);
 	int num_sacks = (ptr[1] - TCPOLEN_SACK_BASE)>>3;
+	int num_walk;
+	struct tcp_sack_block sack[4];
+	struct sk_buff *cached_skb;
+	int cached_fack_count;
 	int reord = tp->packets_out;
 	int prior_fackets;
+	u32 ack = TCP_SKB_CB(ack_skb)->ack_seq;
 	u32 lost_retrans = 0;
 	int flag = 0;
-	int i;
+	int dup_sack = 0;
+	int fastpath;
+	int i, j;
 
 	if (!tp->sacked_out)
 		tp->fackets_out = 0;
 	prior_fackets = tp->fackets_out;
 
-	for (i=0; i<num_sacks; i++, sp++) {
-		struct sk_buff *skb;
-		__u32 start_seq = ntohl(sp->start_seq);
-		__u32 end_seq = ntohl(sp->end_seq);
-		int fack_count = 0;
-		int dup_sack = 0;
-
-		/* Check for D-SACK. */
-		if (i == 0) {
-			u32 ack = TCP_SKB_CB(ack_skb)->ack_seq;
-
-			if (before(start_seq, ack)) {
-				dup_sack = 1;
-				tp->sack_ok |= 4;
-				NET_INC_STATS_BH(TCPDSACKRecv);
-			} else if (num_sacks > 1 &&
-				   !after(end_seq, ntohl(sp[1].end_seq)) &&
-				   !before(start_seq, ntohl(sp[1].start_seq))) {
-				dup_sack = 1;
-				tp->sack_ok |= 4;
-				NET_INC_STATS_BH(TCPDSACKOfoRecv);
-			}
+	memset(sack, 0, sizeof(sack));
+	for (i = 0; i < num_sacks; i++) {
+		sack[i].start_seq = ntohl(sp[i].start_seq);
+		sack[i].end_seq = ntohl(sp[i].end_seq);
+	}
+
+	/* Check for D-SACK. */
+	if (before(sack[0].start_seq, ack)) {
+		dup_sack = 1;
+		tp->sack_ok |= 4;
+		NET_INC_STATS_BH(TCPDSACKRecv);
+	} else if (num_sacks > 1 &&
+		   !after(sack[0].end_seq, sack[1].end_seq) &&
+		   !before(sack[0].start_seq, sack[1].start_seq)) {
+		dup_sack = 1;
+		tp->sack_ok |= 4;
+		NET_INC_STATS_BH(TCPDSACKOfoRecv);
+	}
+
+	/* D-SACK for already forgotten data...
+	 * Do dumb counting. */
+	if (dup_sack &&
+	    !after(sack[0].end_seq, prior_snd_una) &&
+	    after(sack[0].end_seq, tp->undo_marker))
+		tp->undo_retrans--;
+
+	/* Eliminate too old ACKs, but take into
+	 * account more or less fresh ones, they can
+	 * contain valid SACK info.
+	 */
+	if (before(ack, prior_snd_una-tp->max_window))
+		return 0;
 
-			/* D-SACK for already forgotten data...
-			 * Do dumb counting. */
-			if (dup_sack &&
-			    !after(end_seq, prior_snd_una) &&
-			    after(end_seq, tp->undo_marker))
-				tp->undo_retrans--;
+	/* Fast path: only the end of the first block moved. */
+	fastpath = !dup_sack &&
+		   sack[0].start_seq == tp->recv_sack_cache[0].start_seq;
+	for (i = 1; i < 4; i++) {
+		if (sack[i].start_seq != tp->recv_sack_cache[i].start_seq ||
+		    sack[i].end_seq != tp->recv_sack_cache[i].end_seq)
+			fastpath = 0;
+	}
+	memcpy(tp->recv_sack_cache, sack, sizeof(sack));
 
-			/* Eliminate too old ACKs, but take into
-			 * account more or less fresh ones, they can
-			 * contain valid SACK info.
-			 */
-			if (before(ack, prior_snd_una-tp->max_window))
-				return 0;
+	/* Event "B" in the comment above. */
+	for (i = 0; i < num_sacks; i++) {
+		if (after(sack[i].end_seq, tp->high_seq))
+			flag |= FLAG_DATA_LOST;
+	}
+
+	if (fastpath) {
+		num_walk = 1;
+		cached_skb = tp->sack_skb_hint;
+		cached_fack_count = tp->sack_cnt_hint;
+	} else {
+		/* Sort the blocks, leaving a D-SACK in front; it is
+		 * walked on its own.
+		 */
+		for (i = dup_sack + 1; i < num_sacks; i++) {
+			struct tcp_sack_block tmp = sack[i];
+
+			for (j = i; j > dup_sack &&
+			     after(sack[j-1].start_seq, tmp.start_seq); j--)
+				sack[j] = sack[j-1];
+			sack[j] = tmp;
 		}
+		num_walk = num_sacks;
+		cached_skb = NULL;
+		cached_fack_count = 0;
+	}
 
-		/* Event "B" in the comment above. */
-		if (after(end_seq, tp->high_seq))
-			flag |= FLAG_DATA_LOST;
+	for (i=0; i<num_walk; i++) {
+		struct sk_buff *skb;
+		__u32 start_seq = sack[i].start_seq;
+		__u32 end_seq = sack[i].end_seq;
+		int fack_count;
+		int in_dup = dup_sack && i == 0;
 
-		for_retrans_queue(skb, sk, tp) {
+		/* A D-SACK can lie anywhere below the other blocks,
+		 * they continue where the previous one stopped.
+		 */
+		if (in_dup || !cached_skb) {
+			skb = sk->write_queue.next;
+			fack_count = 0;
+		} else {
+			skb = cached_skb;
+			fack_count = cached_fack_count;
+		}
+
+		for (; skb != tp->send_head &&
+		       skb != (struct sk_buff *)&sk->write_queue;
+		     skb = skb->next) {
 			u8 sacked = TCP_SKB_CB(skb)->sacked;
 			int in_sack;
 
+			if (!in_dup) {
+				cached_skb = skb;
+				cached_fack_count = fack_count;
+			}
+
 			/* The retransmission queue is always in order, so
 			 * we can short-circuit the walk early.
 			 */
 			if(!before(TCP_SKB_CB(skb)->seq, end_seq))
 				break;
 
-			fack_count++;
+			fack_count += tcp_skb_pcount(skb);
 
 			in_sack = !after(start_seq, TCP_SKB_CB(skb)->seq) &&
 				!before(end_seq, TCP_SKB_CB(skb)->end_seq);
 
 			/* Account D-SACK for retransmitted packet. */
-			if ((dup_sack && in_sack) &&
+			if ((in_dup && in_sack) &&
 			    (sacked & TCPCB_RETRANS) &&
 			    after(TCP_SKB_CB(skb)->end_seq, tp->undo_marker))
 				tp->undo_retrans--;
@@ -845,7 +1028,7 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 			/* The frame is ACKed. */
 			if (!after(TCP_SKB_CB(skb)->end_seq, tp->snd_una)) {
 				if (sacked&TCPCB_RETRANS) {
-					if ((dup_sack && in_sack) &&
+					if ((in_dup && in_sack) &&
 					    (sacked&TCPCB_SACKED_ACKED))
 						reord = min(fack_count, reord);
 				} else {
@@ -859,11 +1042,6 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 				continue;
 			}
 
-			if ((sacked&TCPCB_SACKED_RETRANS) &&
-			    after(end_seq, TCP_SKB_CB(skb)->ack_seq) &&
-			    (!lost_retrans || after(end_seq, lost_retrans)))
-				lost_retrans = end_seq;
-
 			if (!in_sack)
 				continue;
 
@@ -875,8 +1053,8 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 					 */
 					if (sacked & TCPCB_LOST) {
 						TCP_SKB_CB(skb)->sacked &= ~(TCPCB_LOST|TCPCB_SACKED_RETRANS);
-						tp->lost_out--;
-						tp->retrans_out--;
+						tp->lost_out -= tcp_skb_pcount(skb);
+						tp->retrans_out -= tcp_skb_pcount(skb);
 					}
 				} else {
 					/* New sack for not retransmitted frame,
@@ -888,18 +1066,18 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 
 					if (sacked & TCPCB_LOST) {
 						TCP_SKB_CB(skb)->sacked &= ~TCPCB_LOST;
-						tp->lost_out--;
+						tp->lost_out -= tcp_skb_pcount(skb);
 					}
 				}
 
 				TCP_SKB_CB(skb)->sacked |= TCPCB_SACKED_ACKED;
 				flag |= FLAG_DATA_SACKED;
-				tp->sacked_out++;
+				tp->sacked_out += tcp_skb_pcount(skb);
 
 				if (fack_count > tp->fackets_out)
 					tp->fackets_out = fack_count;
 			} else {
-				if (dup_sack && (sacked&TCPCB_RETRANS))
+				if (in_dup && (sacked&TCPCB_RETRANS))
 					reord = min(fack_count, reord);
 			}
 
@@ -908,12 +1086,17 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 			 * undo_retrans is decreased above, L|R frames
 			 * are accounted above as well.
 			 */
-			if (dup_sack &&
+			if (in_dup &&
 			    (TCP_SKB_CB(skb)->sacked&TCPCB_SACKED_RETRANS)) {
 				TCP_SKB_CB(skb)->sacked &= ~TCPCB_SACKED_RETRANS;
-				tp->retrans_out--;
+				tp->retrans_out -= tcp_skb_pcount(skb);
 			}
 		}
+
+		if (!in_dup && end_seq == tp->recv_sack_cache[0].end_seq) {
+			tp->sack_skb_hint = cached_skb;
+			tp->sack_cnt_hint = cached_fack_count;
+		}
 	}
 
 	/* Check for lost retransmit. This superb idea is
@@ -921,9 +1104,24 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 	 * Later note: FACK people cheated me again 8),
 	 * we have to account for reordering! Ugly,
 	 * but should help.
+	 *
+	 * No retransmission in flight went out before
+	 * lost_retrans_low was sent, so a SACK below it
+	 * cannot show one lost and the queue is not walked.
 	 */
-	if (lost_retrans && tp->ca_state == TCP_CA_Recovery) {
+	if (tp->retrans_out && tp->ca_state == TCP_CA_Recovery) {
+		for (i = dup_sack; i < num_sacks; i++) {
+			u32 end_seq = tp->recv_sack_cache[i].end_seq;
+
+			if (after(end_seq, tp->lost_retrans_low) &&
+			    (!lost_retrans || after(end_seq, lost_retrans)))
+				lost_retrans = end_seq;
+		}
+	}
+
+	if (lost_retrans) {
 		struct sk_buff *skb;
+		u32 low = lost_retrans;
 
 		for_retrans_queue(skb, sk, tp) {
 			if (after(TCP_SKB_CB(skb)->seq, lost_retrans))
@@ -935,16 +1133,20 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 			    (IsFack(tp) ||
 			     !before(lost_retrans, TCP_SKB_CB(skb)->ack_seq+tp->reordering*tp->mss_cache))) {
 				TCP_SKB_CB(skb)->sacked &= ~TCPCB_SACKED_RETRANS;
-				tp->retrans_out--;
+				tp->retrans_out -= tcp_skb_pcount(skb);
 
 				if (!(TCP_SKB_CB(skb)->sacked&(TCPCB_LOST|TCPCB_SACKED_ACKED))) {
-					tp->lost_out++;
+					tp->lost_out += tcp_skb_pcount(skb);
 					TCP_SKB_CB(skb)->sacked |= TCPCB_LOST;
 					flag |= FLAG_DATA_SACKED;
 					NET_INC_STATS_BH(TCPLostRetransmit);
 				}
-			}
+			} else if ((TCP_SKB_CB(skb)->sacked&TCPCB_SACKED_RETRANS) &&
+				   before(TCP_SKB_CB(skb)->ack_seq, low))
+				low = TCP_SKB_CB(skb)->ack_seq;
 		}
+		/* Those further on were sent after lost_retrans. */
+		tp->lost_retrans_low = low;
 	}
 
 	tp->left_out = tp->sacked_out + tp->lost_out;
@@ -972,6 +1174,8 @@ void tcp_clear_retrans(struct tcp_opt *tp)
 
 	tp->undo_marker = 0;
 	tp->undo_retrans = 0;
+
+	tcp_clear_sack_hints(tp);
 }
 
 /* Enter Loss state. If "how" is not zero, forget all SACK information
@@ -1003,16 +1207,16 @@ void tcp_enter_loss(struct sock *sk, int how)
 		tp->undo_marker = tp->snd_una;
 
 	for_retrans_queue(skb, sk, tp) {
-		cnt++;
+		cnt += tcp_skb_pcount(skb);
 		if (TCP_SKB_CB(skb)->sacked&TCPCB_RETRANS)
 			tp->undo_marker = 0;
 		TCP_SKB_CB(skb)->sacked &= (~TCPCB_TAGBITS)|TCPCB_SACKED_ACKED;
 		if (!(TCP_SKB_CB(skb)->sacked&TCPCB_SACKED_ACKED) || how) {
 			TCP_SKB_CB(skb)->sacked &= ~TCPCB_SACKED_ACKED;
 			TCP_SKB_CB(skb)->sacked |= TCPCB_LOST;
-			tp->lost_out++;
+			tp->lost_out += tcp_skb_pcount(skb);
 		} else {
-			tp->sacked_out++;
+			tp->sacked_out += tcp_skb_pcount(skb);
 			tp->fackets_out = cnt;
 		}
 	}
@@ -1227,11 +1431,14 @@ tcp_mark_head_lost(struct sock *sk, struct tcp_opt *tp, int packets, u32 high_se
 	BUG_TRAP(cnt <= tp->packets_out);
 
 	for_retrans_queue(skb, sk, tp) {
-		if (--cnt < 0 || after(TCP_SKB_CB(skb)->end_seq, high_seq))
+		/* A large frame is lost whole even if only some of
+		 * its segments are counted. */
+		if (cnt <= 0 || after(TCP_SKB_CB(skb)->end_seq, high_seq))
 			break;
+		cnt -= tcp_skb_pcount(skb);
 		if (!(TCP_SKB_CB(skb)->sacked&TCPCB_TAGBITS)) {
 			TCP_SKB_CB(skb)->sacked |= TCPCB_LOST;
-			tp->lost_out++;
+			tp->lost_out += tcp_skb_pcount(skb);
 		}
 	}
 	tp->left_out = tp->sacked_out + tp->lost_out;
@@ -1745,15 +1952,15 @@ static int tcp_clean_rtx_queue(struct sock *sk)
 		if (sacked) {
 			if(sacked & TCPCB_RETRANS) {
 				if(sacked & TCPCB_SACKED_RETRANS)
-					tp->retrans_out--;
+					tp->retrans_out -= tcp_skb_pcount(skb);
 				acked |= FLAG_RETRANS_DATA_ACKED;
 				seq_rtt = -1;
 			} else if (seq_rtt < 0)
 				seq_rtt = now - scb->when;
 			if(sacked & TCPCB_SACKED_ACKED)
-				tp->sacked_out--;
+				tp->sacked_out -= tcp_skb_pcount(skb);
 			if(sacked & TCPCB_LOST)
-				tp->lost_out--;
+				tp->lost_out -= tcp_skb_pcount(skb);
 			if(sacked & TCPCB_URG) {
 				if (tp->urg_mode &&
 				    !before(scb->end_seq, tp->snd_up))
@@ -1761,9 +1968,15 @@ static int tcp_clean_rtx_queue(struct sock *sk)
 			}
 		} else if (seq_rtt < 0)
 			seq_rtt = now - scb->when;
-		if(tp->fackets_out)
-			tp->fackets_out--;
-		tp->packets_out--;
+		if (tp->fackets_out > tcp_skb_pcount(skb))
+			tp->fackets_out -= tcp_skb_pcount(skb);
+		else
+			tp->fackets_out = 0;
+		tp->packets_out -= tcp_skb_pcount(skb);
+		if (skb == tp->sack_skb_hint)
+			tp->sack_skb_hint = NULL;
+		else
+			tp->sack_cnt_hint -= tcp_skb_pcount(skb);
 		__skb_unlink(skb, skb->list);
 		tcp_free_skb(sk, skb);
 	}
@@ -2768,7 +2981,7 @@ static int tcp_prune_queue(struct sock *sk)
 
 	NET_INC_STATS_BH(PruneCalled);
 
-	if (atomic_read(&sk->rmem_alloc) >= sk->rcvbuf)
+	if (tcp_rmem_alloc(sk) >= sk->rcvbuf)
 		tcp_clamp_window(sk, tp);
 	else if (tcp_memory_pressure)
 		tp->rcv_ssthresh = min(tp->rcv_ssthresh, 4*tp->advmss);
@@ -2777,7 +2990,7 @@ static int tcp_prune_queue(struct sock *sk)
 	tcp_collapse_queue(sk, &tp->out_of_order_queue);
 	tcp_mem_reclaim(sk);
 
-	if (atomic_read(&sk->rmem_alloc) <= sk->rcvbuf)
+	if (tcp_rmem_alloc(sk) <= sk->rcvbuf)
 		return 0;
 
 	/* Collapsing did not help, destructive actions follow.
@@ -2798,7 +3011,7 @@ static int tcp_prune_queue(struct sock *sk)
 		tcp_mem_reclaim(sk);
 	}
 
-	if(atomic_read(&sk->rmem_alloc) <= sk->rcvbuf)
+	if(tcp_rmem_alloc(sk) <= sk->rcvbuf)
 		return 0;
 
 	/* If we are really being abused, tell the caller to silently
@@ -2842,7 +3055,7 @@ static void tcp_data(struct sk_buff *skb, struct sock *sk, unsigned int len)
 	 *	Make sure to do this before moving rcv_nxt, otherwise
 	 *	data might be acked for that we don't have enough room.
 	 */
-	if (atomic_read(&sk->rmem_alloc) > sk->rcvbuf ||
+	if (tcp_rmem_alloc(sk) > sk->rcvbuf ||
 	    !tcp_rmem_schedule(sk, skb)) {
 		if (tcp_prune_queue(sk) < 0 || !tcp_rmem_schedule(sk, skb))
 			goto drop;
@@ -670,6 +670,7 @@ int tcp_v4_connect(struct sock *sk, struct sockaddr *uaddr, int addr_len)
 	}
 
 	__sk_dst_set(sk, &rt->u.dst);
+	sk->route_caps = rt->u.dst.dev->features;
 
 	if (!sk->protinfo.af_inet.opt || !sk->protinfo.af_inet.opt->srr)
 		daddr = rt->rt_dst;
@@ -780,10 +781,7 @@ static void tcp_v4_synq_add(struct sock *sk, struct open_request *req)
 	req->sk = NULL;
 	req->index = h;
 	req->dl_next = lopt->syn_table[h];
-
-	write_lock(&tp->syn_wait_lock);
 	lopt->syn_table[h] = req;
-	write_unlock(&tp->syn_wait_lock);
 
 	tcp_synq_added(sk);
 }
@@ -1023,8 +1021,14 @@ out:
 void tcp_v4_send_check(struct sock *sk, struct tcphdr *th, int len, 
 		       struct sk_buff *skb)
 {
-	th->check = tcp_v4_check(th, len, sk->saddr, sk->daddr,
-				 csum_partial((char *)th, th->doff<<2, skb->csum));
+	if (skb->ip_summed == CHECKSUM_HW) {
+		/* Leave the pseudo header sum for the device to finish */
+		th->check = ~tcp_v4_check(th, len, sk->saddr, sk->daddr, 0);
+		skb->csum = offsetof(struct tcphdr, check);
+	} else {
+		th->check = tcp_v4_check(th, len, sk->saddr, sk->daddr,
+					 csum_partial((char *)th, th->doff<<2, skb->csum));
+	}
 }
 
 /*
@@ -1445,6 +1449,7 @@ struct sock * tcp_v4_syn_recv_sock(struct sock *sk, struct sk_buff *skb,
 		goto exit;
 
 	newsk->dst_cache = dst;
+	newsk->route_caps = dst->dev->features;
 
 	newtp = &(newsk->tp_pinfo.af_tcp);
 	newsk->daddr = req->af.v4_req.rmt_addr;
@@ -1534,6 +1539,66 @@ static int tcp_v4_checksum_init(struct sk_buff *skb)
 }
 
 
+/* Segments for a listening socket.  They change nothing but its SYN
+ * and accept queues, which live under syn_wait_lock, so this runs with
+ * or without the socket lock: SYNs are not held up by the owner of a
+ * listener (accept(), mostly) nor pushed to its backlog.  The child is
+ * processed after the lock is dropped.
+ */
+static int tcp_v4_listen_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+	struct sock *nsk;
+	int ret;
+
+	if (skb->len < (skb->h.th->doff<<2) || tcp_checksum_complete(skb))
+		goto csum_err;
+
+	write_lock(&tp->syn_wait_lock);
+	if (tp->listen_opt == NULL) {
+		/* Closed under us. */
+		write_unlock(&tp->syn_wait_lock);
+		goto discard;
+	}
+	nsk = tcp_v4_hnd_req(sk, skb);
+	if (nsk == sk) {
+		ret = tcp_rcv_state_process(sk, skb, skb->h.th, skb->len);
+		write_unlock(&tp->syn_wait_lock);
+		if (ret)
+			goto reset;
+		return 0;
+	}
+	write_unlock(&tp->syn_wait_lock);
+
+	if (!nsk)
+		goto discard;
+	if (tcp_child_process(sk, nsk, skb))
+		goto reset;
+	return 0;
+
+reset:
+	tcp_v4_send_reset(skb);
+discard:
+	kfree_skb(skb);
+	return 0;
+
+csum_err:
+	TCP_INC_STATS_BH(TcpInErrs);
+	goto discard;
+}
+
+/* A socket filter is changed under the socket lock only, so listeners
+ * with one still take it.
+ */
+static inline int tcp_listen_lockless(struct sock *sk)
+{
+#ifdef CONFIG_FILTER
+	if (sk->filter)
+		return 0;
+#endif
+	return sk->state == TCP_LISTEN;
+}
+
 /* The socket must have it's spinlock held when we get
  * here.
  *
@@ -1560,21 +1625,12 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 		return 0; 
 	}
 
+	if (sk->state == TCP_LISTEN)
+		return tcp_v4_listen_rcv(sk, skb);
+
 	if (skb->len < (skb->h.th->doff<<2) || tcp_checksum_complete(skb))
 		goto csum_err;
 
-	if (sk->state == TCP_LISTEN) { 
-		struct sock *nsk = tcp_v4_hnd_req(sk, skb);
-		if (!nsk)
-			goto discard;
-
-		if (nsk != sk) {
-			if (tcp_child_process(sk, nsk, skb))
-				goto reset;
-			return 0;
-		}
-	}
-
 	TCP_CHECK_TIMER(sk);
 	if (tcp_rcv_state_process(sk, skb, skb->h.th, skb->len))
 		goto reset;
@@ -1601,6 +1657,64 @@ csum_err:
  *	From tcp_input.c
  */
 
+/*
+ * Early demux: called from ip_rcv_finish() before the route lookup.  An
+ * established socket keeps the input route of the last segment it was
+ * sent, and a segment for it with the same route key can use that
+ * instead of looking it up in the route cache.  The socket itself is
+ * looked up again in tcp_v4_rcv(), after netfilter has had its say.
+ */
+void tcp_v4_early_demux(struct sk_buff *skb)
+{
+	struct iphdr *iph = skb->nh.iph;
+	struct tcphdr *th;
+	struct rtable *rt;
+	struct sock *sk;
+
+	if (skb->pkt_type != PACKET_HOST ||
+	    (iph->frag_off & htons(IP_MF|IP_OFFSET)) ||
+	    skb->len < (iph->ihl<<2) + sizeof(struct tcphdr))
+		return;
+	th = (struct tcphdr *) ((char *) iph + (iph->ihl<<2));
+
+	sk = __tcp_v4_lookup_established(iph->saddr, th->source, iph->daddr,
+					 ntohs(th->dest), skb->dev->ifindex);
+	if (!sk)
+		return;
+	if (sk->state == TCP_TIME_WAIT) {
+		tcp_tw_put((struct tcp_tw_bucket *) sk);
+		return;
+	}
+
+	bh_lock_sock(sk);
+	rt = (struct rtable *) sk->tp_pinfo.af_tcp.rx_dst;
+	if (rt && sk->state == TCP_ESTABLISHED && !rt->u.dst.obsolete &&
+	    rt->key.iif == skb->dev->ifindex &&
+	    rt->key.dst == iph->daddr && rt->key.src == iph->saddr &&
+#ifdef CONFIG_IP_ROUTE_FWMARK
+	    rt->key.fwmark == skb->nfmark &&
+#endif
+	    rt->key.tos == (iph->tos & IPTOS_RT_MASK)) {
+		rt->u.dst.lastuse = jiffies;
+		rt->u.dst.__use++;
+		skb->dst = dst_clone(&rt->u.dst);
+	}
+	bh_unlock_sock(sk);
+	sock_put(sk);
+}
+
+/* Remember the input route of an established socket, under its lock */
+static inline void tcp_v4_save_rx_dst(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+	struct dst_entry *dst = skb->dst;
+
+	if (dst == tp->rx_dst || sk->state != TCP_ESTABLISHED ||
+	    ((struct rtable *) dst)->rt_type != RTN_LOCAL)
+		return;
+	dst_release(xchg(&tp->rx_dst, dst_clone(dst)));
+}
+
 int tcp_v4_rcv(struct sk_buff *skb, unsigned short len)
 {
 	struct tcphdr *th;
@@ -1651,7 +1765,16 @@ process:
 
 	skb->dev = NULL;
 
+	if (tcp_listen_lockless(sk)) {
+		IP_INC_STATS_BH(IpInDelivers);
+		ret = tcp_v4_listen_rcv(sk, skb);
+		sock_put(sk);
+		return ret;
+	}
+
 	bh_lock_sock(sk);
+	if (sysctl_ip_early_demux)
+		tcp_v4_save_rx_dst(sk, skb);
 	ret = 0;
 	if (!sk->lock.users) {
 		if (!tcp_prequeue(sk, skb))
@@ -1740,7 +1863,7 @@ static int tcp_v4_reselect_saddr(struct sock *sk)
 		return err;
 
 	__sk_dst_set(sk, &rt->u.dst);
-	/* sk->route_caps = rt->u.dst.dev->features; */
+	sk->route_caps = rt->u.dst.dev->features;
 
 	new_saddr = rt->rt_src;
 
@@ -1788,12 +1911,12 @@ int tcp_v4_rebuild_header(struct sock *sk)
 			      sk->bound_dev_if);
 	if (!err) {
 		__sk_dst_set(sk, &rt->u.dst);
-		/* sk->route_caps = rt->u.dst.dev->features; */
+		sk->route_caps = rt->u.dst.dev->features;
 		return 0;
 	}
 
 	/* Routing failed... */
-	/* sk->route_caps = 0; */
+	sk->route_caps = 0;
 
 	if (!sysctl_ip_dynaddr ||
 	    sk->state != TCP_SYN_SENT ||
@@ -1916,6 +2039,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	tp->mss_cache = 536;
 
 	tp->reordering = sysctl_tcp_reordering;
+	tp->pacing.on = sysctl_tcp_pacing;
 
 	sk->state = TCP_CLOSE;
 
@@ -1946,10 +2070,17 @@ static int tcp_v4_destroy_sock(struct sock *sk)
 	/* Clean prequeue, it must be empty really */
 	__skb_queue_purge(&tp->ucopy.prequeue);
 
+	/* Drop the input route kept for early demux. */
+	dst_release(xchg(&tp->rx_dst, NULL));
+
 	/* Clean up a referenced TCP bind bucket. */
 	if(sk->prev != NULL)
 		tcp_put_port(sk);
 
+	/* If sendmsg cached page exists, toss it. */
+	if (sk->sndmsg_page != NULL)
+		__free_page(sk->sndmsg_page);
+
 	atomic_dec(&tcp_sockets_allocated);
 
 	return 0;
@@ -2179,6 +2310,8 @@ struct proto tcp_prot = {
 	setsockopt:	tcp_setsockopt,
 	getsockopt:	tcp_getsockopt,
 	sendmsg:	tcp_sendmsg,
+	sendpage:	tcp_sendpage,
+	receive_file:	tcp_receive_file,
 	recvmsg:	tcp_recvmsg,
 	backlog_rcv:	tcp_v4_do_rcv,
 	hash:		tcp_v4_hash,
@@ -354,7 +354,7 @@ void tcp_time_wait(struct sock *sk, int state, int timeo)
 		recycle_ok = tp->af_specific->remember_stamp(sk);
 
 	if (tcp_tw_count < sysctl_tcp_max_tw_buckets)
-		tw = kmem_cache_alloc(tcp_timewait_cachep, SLAB_ATOMIC);
+		tw = kmem_cache_alloc(tcp_tw_cachep(sk->family), SLAB_ATOMIC);
 
 	if(tw != NULL) {
 		int rto = (tp->rto<<2) - (tp->rto>>1);
@@ -447,6 +447,15 @@ static void SMP_TIMER_NAME(tcp_twkill)(unsigned long dummy)
 		goto out;
 
 	while((tw = tcp_tw_death_row[tcp_tw_death_row_slot]) != NULL) {
+		/* A slot holds TCP_TWKILL_PERIOD worth of closed
+		 * connections.  Do not reap them all in one softirq,
+		 * come back on the next tick for the rest.
+		 */
+		if (killed >= TCP_TWKILL_QUOTA) {
+			tcp_tw_count -= killed;
+			mod_timer(&tcp_tw_timer, jiffies+1);
+			goto account;
+		}
 		tcp_tw_death_row[tcp_tw_death_row_slot] = tw->next_death;
 		tw->pprev_death = NULL;
 		spin_unlock(&tw_death_lock);
@@ -463,6 +472,7 @@ static void SMP_TIMER_NAME(tcp_twkill)(unsigned long dummy)
 
 	if ((tcp_tw_count -= killed) != 0)
 		mod_timer(&tcp_tw_timer, jiffies+TCP_TWKILL_PERIOD);
+account:
 	net_statistics[smp_processor_id()*2].TimeWaited += killed;
 out:
 	spin_unlock(&tw_death_lock);
@@ -670,6 +680,10 @@ struct sock *tcp_create_openreq_child(struct sock *sk, struct open_request *req,
 		atomic_set(&newsk->omem_alloc, 0);
 		newsk->wmem_queued = 0;
 		newsk->forward_alloc = 0;
+		newsk->tp_pinfo.af_tcp.rmem_fwd = 0;
+		newsk->tp_pinfo.af_tcp.wmem_fwd = 0;
+		newsk->sndmsg_page = NULL;
+		newsk->sndmsg_off = 0;
 
 		newsk->done = 0;
 		newsk->userlocks = sk->userlocks & ~SOCK_BINDPORT_LOCK;
@@ -738,7 +752,6 @@ struct sock *tcp_create_openreq_child(struct sock *sk, struct open_request *req,
 		newtp->fin_seq = req->rcv_isn;
 		newtp->urg_data = 0;
 		newtp->listen_opt = NULL;
-		newtp->accept_queue = newtp->accept_queue_tail = NULL;
 		/* Deinitialize syn_wait_lock to trap illegal accesses. */
 		memset(&newtp->syn_wait_lock, 0, sizeof(newtp->syn_wait_lock));
 
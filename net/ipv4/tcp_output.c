@@ -43,6 +43,9 @@
 /* People can turn this off for buggy TCP's found in printers etc. */
 int sysctl_tcp_retrans_collapse = 1;
 
+/* Spread the congestion window over the RTT by default. */
+int sysctl_tcp_pacing = 0;
+
 static __inline__
 void update_send_head(struct sock *sk, struct tcp_opt *tp, struct sk_buff *skb)
 {
@@ -50,8 +53,23 @@ void update_send_head(struct sock *sk, struct tcp_opt *tp, struct sk_buff *skb)
 	if (tp->send_head == (struct sk_buff *) &sk->write_queue)
 		tp->send_head = NULL;
 	tp->snd_nxt = TCP_SKB_CB(skb)->end_seq;
-	if (tp->packets_out++ == 0)
+	if (tp->packets_out == 0)
 		tcp_reset_xmit_timer(sk, TCP_TIME_RETRANS, tp->rto);
+	tp->packets_out += tcp_skb_pcount(skb);
+}
+
+/* Set up a frame about to be sent for segmentation into mss_std sized
+ * segments, if it is larger than that.
+ */
+void tcp_set_skb_tso_segs(struct sk_buff *skb, unsigned int mss_std)
+{
+	if (skb->len <= mss_std) {
+		skb_shinfo(skb)->tso_size = 0;
+		skb_shinfo(skb)->tso_segs = 1;
+	} else {
+		skb_shinfo(skb)->tso_size = mss_std;
+		skb_shinfo(skb)->tso_segs = (skb->len + mss_std - 1) / mss_std;
+	}
 }
 
 /* SND.NXT, if window was not shrunk.
@@ -235,7 +253,7 @@ int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb)
 		}
 		th = (struct tcphdr *) skb_push(skb, tcp_header_size);
 		skb->h.th = th;
-		skb_set_owner_w(skb, sk);
+		tcp_set_owner_w(skb, sk);
 
 		/* Build TCP header and checksum it. */
 		th->source		= sk->sport;
@@ -321,9 +339,15 @@ void tcp_send_skb(struct sock *sk, struct sk_buff *skb, int force_queue, unsigne
 	__skb_queue_tail(&sk->write_queue, skb);
 	tcp_charge_skb(sk, skb);
 
-	if (!force_queue && tp->send_head == NULL && tcp_snd_test(tp, skb, cur_mss, tp->nonagle)) {
+	/* Frames larger than the MSS are left to tcp_write_xmit(), which
+	 * fits them to the windows first.
+	 */
+	if (!force_queue && tp->send_head == NULL && skb->len <= cur_mss &&
+	    tcp_snd_test(tp, skb, cur_mss, tp->nonagle) &&
+	    tcp_pace_test(sk, tp, skb)) {
 		/* Send it out now. */
 		TCP_SKB_CB(skb)->when = tcp_time_stamp;
+		tcp_set_skb_tso_segs(skb, cur_mss);
 		if (tcp_transmit_skb(sk, skb_clone(skb, sk->allocation)) == 0) {
 			tp->snd_nxt = TCP_SKB_CB(skb)->end_seq;
 			tcp_minshall_update(tp, cur_mss, skb);
@@ -342,15 +366,84 @@ void tcp_send_skb(struct sock *sk, struct sk_buff *skb, int force_queue, unsigne
  * packet to the list.  This won't be called frequently, I hope. 
  * Remember, these are still headerless SKBs at this point.
  */
-static int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len)
+/* Move the data of skb past len, which lies in its page fragments or
+ * in its linear part, to the empty buff.
+ */
+static void tcp_split_frags(struct sk_buff *skb, struct sk_buff *buff, u32 len)
+{
+	int i, k = 0;
+	int pos = skb_headlen(skb);
+	int nfrags = skb_shinfo(skb)->nr_frags;
+	skb_frag_t *frags = skb_shinfo(skb)->frags;
+
+	if (len < pos) {
+		/* Split line is inside the linear part: the tail of it
+		 * and all the fragments go.
+		 */
+		memcpy(skb_put(buff, pos - len), skb->data + len, pos - len);
+		for (i = 0; i < nfrags; i++)
+			skb_shinfo(buff)->frags[i] = frags[i];
+		skb_shinfo(buff)->nr_frags = nfrags;
+		skb_shinfo(skb)->nr_frags = 0;
+		buff->data_len = skb->data_len;
+		buff->len += buff->data_len;
+		skb->data_len = 0;
+		skb->len = len;
+		skb->tail = skb->data + len;
+		return;
+	}
+
+	skb_shinfo(skb)->nr_frags = 0;
+	for (i = 0; i < nfrags; i++) {
+		int size = frags[i].size;
+
+		if (pos + size > len) {
+			skb_shinfo(buff)->frags[k] = frags[i];
+			if (pos < len) {
+				/* Split the fragment itself; both halves
+				 * hold a reference to the page.
+				 */
+				get_page(frags[i].page);
+				skb_shinfo(buff)->frags[k].page_offset += len - pos;
+				skb_shinfo(buff)->frags[k].size -= len - pos;
+				frags[i].size = len - pos;
+				skb_shinfo(skb)->nr_frags++;
+			}
+			k++;
+		} else {
+			skb_shinfo(skb)->nr_frags++;
+		}
+		pos += size;
+	}
+	skb_shinfo(buff)->nr_frags = k;
+	buff->len = buff->data_len = skb->len - len;
+	skb->data_len -= buff->data_len;
+	skb->len = len;
+}
+
+static int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len, unsigned int mss_std)
 {
 	struct tcp_opt *tp = &sk->tp_pinfo.af_tcp;
 	struct sk_buff *buff;
 	int nsize = skb->len - len;
+	int old_factor = tcp_skb_pcount(skb);
+	int nlsize;
 	u16 flags;
 
+	/* The fragment list and segmentation info are about to change,
+	 * and they may still be shared with a clone in flight.
+	 */
+	if (skb_cloned(skb) &&
+	    pskb_expand_head(skb, 0, 0, GFP_ATOMIC))
+		return -ENOMEM;
+
+	/* Only the linear part of the tail is copied. */
+	nlsize = skb_headlen(skb) - len;
+	if (nlsize < 0)
+		nlsize = 0;
+
 	/* Get a new skb... force flag on. */
-	buff = tcp_alloc_skb(sk, nsize + MAX_TCP_HEADER, GFP_ATOMIC);
+	buff = tcp_alloc_skb(sk, nlsize + MAX_TCP_HEADER, GFP_ATOMIC);
 	if (buff == NULL)
 		return -ENOMEM; /* We'll just try again later. */
 	tcp_charge_skb(sk, buff);
@@ -367,28 +460,51 @@ static int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len)
 	TCP_SKB_CB(skb)->flags = flags & ~(TCPCB_FLAG_FIN|TCPCB_FLAG_PSH);
 	TCP_SKB_CB(buff)->flags = flags;
 	TCP_SKB_CB(buff)->sacked = TCP_SKB_CB(skb)->sacked&(TCPCB_LOST|TCPCB_EVER_RETRANS|TCPCB_AT_TAIL);
-	if (TCP_SKB_CB(buff)->sacked&TCPCB_LOST) {
-		tp->lost_out++;
-		tp->left_out++;
-	}
 	TCP_SKB_CB(buff)->sacked &= ~TCPCB_AT_TAIL;
 
-	/* Copy and checksum data tail into the new buffer. */
-	buff->csum = csum_partial_copy_nocheck(skb->data + len, skb_put(buff, nsize),
-					       nsize, 0);
+	if (skb_is_nonlinear(skb)) {
+		/* The device sums the fragments; the pages change owner. */
+		tcp_split_frags(skb, buff, len);
+		buff->truesize += buff->data_len;
+		skb->truesize -= buff->data_len;
+	} else {
+		/* Copy and checksum data tail into the new buffer. */
+		buff->csum = csum_partial_copy_nocheck(skb->data + len, skb_put(buff, nsize),
+						       nsize, 0);
+		skb_trim(skb, len);
+
+		/* Rechecksum original buffer. */
+		skb->csum = csum_partial(skb->data, skb->len, 0);
+	}
+	buff->ip_summed = skb->ip_summed;
 
 	/* This takes care of the FIN sequence number too. */
 	TCP_SKB_CB(skb)->end_seq = TCP_SKB_CB(buff)->seq;
-	skb_trim(skb, len);
-
-	/* Rechecksum original buffer. */
-	skb->csum = csum_partial(skb->data, skb->len, 0);
 
 	/* Looks stupid, but our code really uses when of
 	 * skbs, which it never sent before. --ANK
 	 */
 	TCP_SKB_CB(buff)->when = TCP_SKB_CB(skb)->when;
 
+	/* If the frame was sent already, the scoreboard counted it
+	 * as old_factor segments; count the two parts instead.  Only
+	 * the head keeps SACKED_RETRANS.
+	 */
+	tcp_set_skb_tso_segs(skb, mss_std);
+	tcp_set_skb_tso_segs(buff, mss_std);
+	if (before(TCP_SKB_CB(skb)->seq, tp->snd_nxt)) {
+		int diff = old_factor - tcp_skb_pcount(skb) - tcp_skb_pcount(buff);
+
+		tp->packets_out -= diff;
+		if (TCP_SKB_CB(skb)->sacked&TCPCB_LOST) {
+			tp->lost_out -= diff;
+			tp->left_out -= diff;
+		}
+		if (TCP_SKB_CB(skb)->sacked&TCPCB_SACKED_RETRANS)
+			tp->retrans_out -= old_factor - tcp_skb_pcount(skb);
+		tcp_clear_sack_hints(tp);
+	}
+
 	/* Link BUFF into the send queue. */
 	__skb_append(skb, buff);
 
@@ -454,6 +570,36 @@ int tcp_sync_mss(struct sock *sk, u32 pmtu)
 }
 
 
+/* Cut the head of the send queue down to what may go out as one frame:
+ * a single segment, or, over a route which segments for us, as many as
+ * the congestion and send windows have room for.  Also prepares it for
+ * the segmentation.
+ */
+static int tcp_tso_fit(struct sock *sk, struct tcp_opt *tp, struct sk_buff *skb,
+		       unsigned int mss_now)
+{
+	unsigned int limit = mss_now;
+
+	if ((sk->route_caps&NETIF_F_TSO) && !tp->urg_mode) {
+		u32 in_flight = tcp_packets_in_flight(tp);
+		u32 wnd_end = tp->snd_una + tp->snd_wnd;
+
+		if (tp->snd_cwnd > in_flight)
+			limit = (tp->snd_cwnd - in_flight) * mss_now;
+		if (after(wnd_end, TCP_SKB_CB(skb)->seq) &&
+		    limit > wnd_end - TCP_SKB_CB(skb)->seq)
+			limit = wnd_end - TCP_SKB_CB(skb)->seq;
+		limit -= limit % mss_now;
+		if (limit < mss_now)
+			limit = mss_now;
+	}
+
+	if (skb->len > limit && tcp_fragment(sk, skb, limit, mss_now))
+		return -ENOMEM;
+	tcp_set_skb_tso_segs(skb, mss_now);
+	return 0;
+}
+
 /* This routine writes packets to the network.  It advances the
  * send_head.  This happens as incoming acks open up the remote
  * window for us.
@@ -461,6 +607,74 @@ int tcp_sync_mss(struct sock *sk, u32 pmtu)
  * Returns 1, if no segments are in flight and we have queued segments, but
  * cannot send anything now because of SWS or another problem.
  */
+/* Pacing rate in bytes per jiffy, 0 if the socket is not paced.
+ *
+ * A paced socket sends cwnd segments per srtt, twice that in slow start
+ * so that pacing does not hold back window growth.  The user cap
+ * (TCP_MAXRATE) and the route's maxrate metric bound it further, and
+ * pace the socket on their own if TCP_PACING is off.
+ */
+static u32 tcp_pace_rate(struct sock *sk, struct tcp_opt *tp)
+{
+	struct dst_entry *dst = __sk_dst_get(sk);
+	u32 cap = tp->pacing.maxrate;
+	u32 rate = 0;
+
+	if (dst && dst->maxrate && (cap == 0 || dst->maxrate < cap))
+		cap = dst->maxrate;
+
+	if (tp->pacing.on && tp->srtt >= 8) {
+		rate = ((tp->snd_cwnd * tp->mss_cache) << 3) / tp->srtt;
+		if (tp->snd_cwnd < tp->snd_ssthresh)
+			rate <<= 1;
+	}
+
+	if (cap) {
+		cap = cap / HZ ? : 1;
+		if (rate == 0 || cap < rate)
+			rate = cap;
+	}
+	return rate;
+}
+
+/* May skb go out now as far as pacing is concerned?  Sending takes
+ * its length from the credit, which refills at the pacing rate and
+ * never banks more than one tick's worth (at least one segment).  When
+ * the credit is used up, the pacing timer is set for when it will be
+ * positive again, and transmission resumes from there.
+ */
+int tcp_pace_test(struct sock *sk, struct tcp_opt *tp, struct sk_buff *skb)
+{
+	u32 rate = tcp_pace_rate(sk, tp);
+	unsigned long now = jiffies;
+	unsigned long delta;
+	int burst;
+
+	if (rate == 0)
+		return 1;
+
+	burst = max(rate, (u32)tp->mss_cache);
+	delta = now - tp->pacing.stamp;
+	/* The credit may be negative: do not use min() here. */
+	if (delta > (burst + rate) / rate)
+		tp->pacing.credit = burst;
+	else {
+		tp->pacing.credit += delta * rate;
+		if (tp->pacing.credit > burst)
+			tp->pacing.credit = burst;
+	}
+	tp->pacing.stamp = now;
+
+	if (tp->pacing.credit > 0) {
+		tp->pacing.credit -= skb->len;
+		return 1;
+	}
+
+	if (!mod_timer(&tp->pacing.timer, now + 1 + (-tp->pacing.credit) / rate))
+		sock_hold(sk);
+	return 0;
+}
+
 int tcp_write_xmit(struct sock *sk)
 {
 	struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
@@ -473,6 +687,7 @@ int tcp_write_xmit(struct sock *sk)
 	if(sk->state != TCP_CLOSE) {
 		struct sk_buff *skb;
 		int sent_pkts = 0;
+		int paced = 0;
 
 		/* Account for SACKS, we may need to fragment due to this.
 		 * It is just like the real MSS changing on us midstream.
@@ -481,12 +696,20 @@ int tcp_write_xmit(struct sock *sk)
 		 */
 		mss_now = tcp_current_mss(sk); 
 
-		while((skb = tp->send_head) &&
-		      tcp_snd_test(tp, skb, mss_now, tcp_skb_is_last(sk, skb) ? tp->nonagle : 1)) {
-			if (skb->len > mss_now) {
-				if (tcp_fragment(sk, skb, mss_now))
-					break;
+		while((skb = tp->send_head) != NULL) {
+			/* Fit it first: the windows may be too small for
+			 * all of a large frame.
+			 */
+			if (skb->len > mss_now &&
+			    tcp_tso_fit(sk, tp, skb, mss_now))
+				break;
+			if (!tcp_snd_test(tp, skb, mss_now, tcp_skb_is_last(sk, skb) ? tp->nonagle : 1))
+				break;
+			if (!tcp_pace_test(sk, tp, skb)) {
+				paced = 1;
+				break;
 			}
+			tcp_set_skb_tso_segs(skb, mss_now);
 
 			TCP_SKB_CB(skb)->when = tcp_time_stamp;
 			if (tcp_transmit_skb(sk, skb_clone(skb, GFP_ATOMIC)))
@@ -502,7 +725,8 @@ int tcp_write_xmit(struct sock *sk)
 			return 0;
 		}
 
-		return !tp->packets_out && tp->send_head;
+		/* A paced socket is woken by its pacing timer. */
+		return !paced && !tp->packets_out && tp->send_head;
 	}
 	return 0;
 }
@@ -627,6 +851,10 @@ static void tcp_retrans_try_collapse(struct sock *sk, struct sk_buff *skb, int m
 		if (after(TCP_SKB_CB(next_skb)->end_seq, tp->snd_una+tp->snd_wnd))
 			return;
 
+		/* Page fragments are not collapsed. */
+		if (skb_is_nonlinear(skb) || skb_is_nonlinear(next_skb))
+			return;
+
 		/* Punt if not enough space exists in the first SKB for
 		 * the data in the second, or the total combined payload
 		 * would exceed the MSS.
@@ -678,6 +906,7 @@ static void tcp_retrans_try_collapse(struct sock *sk, struct sk_buff *skb, int m
 		 */
 		if (tp->fackets_out)
 			tp->fackets_out--;
+		tcp_clear_sack_hints(tp);
 		tcp_free_skb(sk, next_skb);
 		tp->packets_out--;
 	}
@@ -699,11 +928,11 @@ void tcp_simple_retransmit(struct sock *sk)
 		    !(TCP_SKB_CB(skb)->sacked&TCPCB_SACKED_ACKED)) {
 			if (TCP_SKB_CB(skb)->sacked&TCPCB_SACKED_RETRANS) {
 				TCP_SKB_CB(skb)->sacked &= ~TCPCB_SACKED_RETRANS;
-				tp->retrans_out--;
+				tp->retrans_out -= tcp_skb_pcount(skb);
 			}
 			if (!(TCP_SKB_CB(skb)->sacked&TCPCB_LOST)) {
 				TCP_SKB_CB(skb)->sacked |= TCPCB_LOST;
-				tp->lost_out++;
+				tp->lost_out += tcp_skb_pcount(skb);
 				lost = 1;
 			}
 		}
@@ -742,15 +971,15 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 	/* Do not sent more than we queued. 1/4 is reserved for possible
 	 * copying overhead: frgagmentation, tunneling, mangling etc.
 	 */
-	if (atomic_read(&sk->wmem_alloc) > min(sk->wmem_queued+(sk->wmem_queued>>2),sk->sndbuf))
+	if (tcp_wmem_alloc(sk) > min(sk->wmem_queued+(sk->wmem_queued>>2),sk->sndbuf))
 		return -EAGAIN;
 
+	/* Large frames are retransmitted a segment at a time;
+	 * tcp_fragment() accounts for the new SKB.
+	 */
 	if(skb->len > cur_mss) {
-		if(tcp_fragment(sk, skb, cur_mss))
+		if(tcp_fragment(sk, skb, cur_mss, cur_mss))
 			return -ENOMEM; /* We'll try again later. */
-
-		/* New SKB created, account for it. */
-		tp->packets_out++;
 	}
 
 	/* Collapse two adjacent packets if worthwhile and we can. */
@@ -770,7 +999,9 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 	 */
 	if(skb->len > 0 &&
 	   (TCP_SKB_CB(skb)->flags & TCPCB_FLAG_FIN) &&
-	   tp->snd_una == (TCP_SKB_CB(skb)->end_seq - 1)) {
+	   tp->snd_una == (TCP_SKB_CB(skb)->end_seq - 1) &&
+	   !(skb_is_nonlinear(skb) && skb_cloned(skb) &&
+	     pskb_expand_head(skb, 0, 0, GFP_ATOMIC))) {
 		TCP_SKB_CB(skb)->seq = TCP_SKB_CB(skb)->end_seq - 1;
 		skb_trim(skb, 0);
 		skb->csum = 0;
@@ -796,7 +1027,7 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 		}
 #endif
 		TCP_SKB_CB(skb)->sacked |= TCPCB_RETRANS;
-		tp->retrans_out++;
+		tp->retrans_out += tcp_skb_pcount(skb);
 
 		/* Save stamp of the first retransmit. */
 		if (!tp->retrans_stamp)
@@ -808,6 +1039,9 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 		 * see tcp_input.c tcp_sacktag_write_queue().
 		 */
 		TCP_SKB_CB(skb)->ack_seq = tp->snd_nxt;
+		if (tp->retrans_out == tcp_skb_pcount(skb) ||
+		    before(tp->snd_nxt, tp->lost_retrans_low))
+			tp->lost_retrans_low = tp->snd_nxt;
 	}
 	return err;
 }
@@ -847,7 +1081,8 @@ void tcp_xmit_retransmit_queue(struct sock *sk)
 						tcp_reset_xmit_timer(sk, TCP_TIME_RETRANS, tp->rto);
 				}
 
-				if (--packet_cnt <= 0)
+				packet_cnt -= tcp_skb_pcount(skb);
+				if (packet_cnt <= 0)
 					break;
 			}
 		}
@@ -1336,11 +1571,12 @@ int tcp_write_wakeup(struct sock *sk)
 			    skb->len > mss) {
 				seg_size = min(seg_size, mss);
 				TCP_SKB_CB(skb)->flags |= TCPCB_FLAG_PSH;
-				if (tcp_fragment(sk, skb, seg_size))
+				if (tcp_fragment(sk, skb, seg_size, mss))
 					return -1;
 			}
 			TCP_SKB_CB(skb)->flags |= TCPCB_FLAG_PSH;
 			TCP_SKB_CB(skb)->when = tcp_time_stamp;
+			tcp_set_skb_tso_segs(skb, mss);
 			err = tcp_transmit_skb(sk, skb_clone(skb, GFP_ATOMIC));
 			if (!err) {
 				update_send_head(sk, tp, skb);
@@ -34,6 +34,7 @@ int sysctl_tcp_orphan_retries;
 static void tcp_write_timer(unsigned long);
 static void tcp_delack_timer(unsigned long);
 static void tcp_keepalive_timer (unsigned long data);
+static void tcp_pacing_timer(unsigned long data);
 
 const char timer_bug_msg[] = KERN_DEBUG "tcpbug: unknown timer value\n";
 
@@ -60,6 +61,12 @@ void tcp_init_xmit_timers(struct sock *sk)
 	init_timer(&sk->timer);
 	sk->timer.function=&tcp_keepalive_timer;
 	sk->timer.data = (unsigned long) sk;
+
+	init_timer(&tp->pacing.timer);
+	tp->pacing.timer.function=&tcp_pacing_timer;
+	tp->pacing.timer.data = (unsigned long) sk;
+	tp->pacing.credit = 0;
+	tp->pacing.stamp = jiffies;
 }
 
 void tcp_clear_xmit_timers(struct sock *sk)
@@ -79,6 +86,10 @@ void tcp_clear_xmit_timers(struct sock *sk)
 
 	if(timer_pending(&sk->timer) && del_timer(&sk->timer))
 		__sock_put(sk);
+
+	if (timer_pending(&tp->pacing.timer) &&
+	    del_timer(&tp->pacing.timer))
+		__sock_put(sk);
 }
 
 static void tcp_write_err(struct sock *sk)
@@ -269,6 +280,29 @@ out_unlock:
 	sock_put(sk);
 }
 
+/* The pacing credit has been paid back: send what the window allows. */
+static void tcp_pacing_timer(unsigned long data)
+{
+	struct sock *sk = (struct sock*)data;
+	struct tcp_opt *tp = &sk->tp_pinfo.af_tcp;
+
+	bh_lock_sock(sk);
+	if (sk->lock.users) {
+		/* Try again later */
+		if (!mod_timer(&tp->pacing.timer, jiffies + 1))
+			sock_hold(sk);
+		goto out_unlock;
+	}
+
+	if (sk->state != TCP_CLOSE && tp->send_head)
+		tcp_push_pending_frames(sk, tp);
+	TCP_CHECK_TIMER(sk);
+
+out_unlock:
+	bh_unlock_sock(sk);
+	sock_put(sk);
+}
+
 static void tcp_probe_timer(struct sock *sk)
 {
 	struct tcp_opt *tp = &sk->tp_pinfo.af_tcp;
@@ -479,6 +513,11 @@ static void tcp_synack_timer(struct sock *sk)
 		max_retries = tp->defer_accept;
 
 	budget = 2*(TCP_SYNQ_HSIZE/(TCP_TIMEOUT_INIT/TCP_SYNQ_INTERVAL));
+
+	/* Segments for the listener change the table under this lock,
+	 * not under the socket lock we hold.
+	 */
+	write_lock(&tp->syn_wait_lock);
 	i = lopt->clock_hand;
 
 	do {
@@ -500,9 +539,7 @@ static void tcp_synack_timer(struct sock *sk)
 				}
 
 				/* Drop this request */
-				write_lock(&tp->syn_wait_lock);
 				*reqp = req->dl_next;
-				write_unlock(&tp->syn_wait_lock);
 				lopt->qlen--;
 				if (req->retrans == 0)
 					lopt->qlen_young--;
@@ -517,6 +554,7 @@ static void tcp_synack_timer(struct sock *sk)
 	} while (--budget > 0);
 
 	lopt->clock_hand = i;
+	write_unlock(&tp->syn_wait_lock);
 
 	if (lopt->qlen)
 		tcp_reset_keepalive_timer(sk, TCP_SYNQ_INTERVAL);
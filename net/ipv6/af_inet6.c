@@ -161,7 +161,8 @@ static int inet6_create(struct socket *sock, int protocol)
 	sk->protinfo.af_inet.mc_loop	= 1;
 	sk->protinfo.af_inet.mc_ttl	= 1;
 	sk->protinfo.af_inet.mc_index	= 0;
-	sk->protinfo.af_inet.mc_list	= NULL;
+	sk->protinfo.af_inet.mc_hash	= NULL;
+	sk->protinfo.af_inet.mc_count	= 0;
 
 	if (ipv4_config.no_pmtu_disc)
 		sk->protinfo.af_inet.pmtudisc = IP_PMTUDISC_DONT;
@@ -461,6 +462,8 @@ struct proto_ops inet6_stream_ops = {
 	sendmsg:	inet_sendmsg,			/* ok		*/
 	recvmsg:	inet_recvmsg,			/* ok		*/
 	mmap:		sock_no_mmap,
+	sendpage:	inet_sendpage,
+	receive_file:	inet_receive_file,
 };
 
 struct proto_ops inet6_dgram_ops = {
@@ -481,6 +484,7 @@ struct proto_ops inet6_dgram_ops = {
 	sendmsg:	inet_sendmsg,			/* ok		*/
 	recvmsg:	inet_recvmsg,			/* ok		*/
 	mmap:		sock_no_mmap,
+	sendpage:	inet_sendpage,
 };
 
 struct net_proto_family inet6_family_ops = {
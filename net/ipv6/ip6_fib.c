@@ -21,6 +21,7 @@
 #include <linux/netdevice.h>
 #include <linux/in6.h>
 #include <linux/init.h>
+#include <linux/brlock.h>
 
 #ifdef 	CONFIG_PROC_FS
 #include <linux/proc_fs.h>
@@ -1184,9 +1185,9 @@ void fib6_run_gc(unsigned long dummy)
 	gc_args.more = 0;
 
 
-	write_lock_bh(&rt6_lock);
+	br_write_lock_bh(BR_RT6_LOCK);
 	fib6_clean_tree(&ip6_routing_table, fib6_age, 0, NULL);
-	write_unlock_bh(&rt6_lock);
+	br_write_unlock_bh(BR_RT6_LOCK);
 
 	if (gc_args.more)
 		mod_timer(&ip6_fib_timer, jiffies + ip6_rt_gc_interval);
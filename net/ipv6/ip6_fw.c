@@ -47,9 +47,9 @@ struct flow_rule_ops ip6_fw_ops = {
 
 
 static struct rt6_info ip6_fw_null_entry = {
-	{{NULL, 0, 0, NULL,
-	  0, 0, 0, 0, 0, 0, 0, 0, -ENETUNREACH, NULL, NULL,
-	  ip6_pkt_discard, ip6_pkt_discard, NULL}},
+	{{error:	-ENETUNREACH,
+	  input:	ip6_pkt_discard,
+	  output:	ip6_pkt_discard}},
 	NULL, {{{0}}}, 256, RTF_REJECT|RTF_NONEXTHOP, ~0UL,
 	0, &ip6_fw_rule_list, {{{{0}}}, 128}, {{{{0}}}, 128}
 };
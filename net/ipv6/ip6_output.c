@@ -801,6 +801,8 @@ int ip6_forward(struct sk_buff *skb)
 		return 0;
 
 	hdr = skb->nh.ipv6h;
+	/* A receive checksum is no checksum to offload */
+	skb->ip_summed = CHECKSUM_NONE;
 
 	/* Mangling hops number delayed to point after skb COW */
  
@@ -72,6 +72,7 @@
 
 #include <net/checksum.h>
 #include <linux/proc_fs.h>
+#include <linux/jhash.h>
 
 static struct socket *ndisc_socket;
 
@@ -175,15 +176,10 @@ int ndisc_mc_map(struct in6_addr *addr, char *buf, struct net_device *dev, int d
 
 static u32 ndisc_hash(const void *pkey, const struct net_device *dev)
 {
-	u32 hash_val;
+	const u32 *p32 = pkey;
 
-	hash_val = *(u32*)(pkey + sizeof(struct in6_addr) - 4);
-	hash_val ^= (hash_val>>16);
-	hash_val ^= hash_val>>8;
-	hash_val ^= hash_val>>3;
-	hash_val = (hash_val^dev->ifindex)&NEIGH_HASHMASK;
-
-	return hash_val;
+	return jhash_3words(p32[2], p32[3], p32[0] ^ p32[1] ^ dev->ifindex,
+			    nd_tbl.hash_rnd);
 }
 
 static int ndisc_constructor(struct neighbour *neigh)
@@ -1142,10 +1138,10 @@ static int ndisc_get_info(char *buffer, char **start, off_t offset, int length)
 	unsigned long now = jiffies;
 	int i;
 
-	for (i = 0; i <= NEIGH_HASHMASK; i++) {
+	read_lock_bh(&nd_tbl.lock);
+	for (i = 0; i <= nd_tbl.hash_mask; i++) {
 		struct neighbour *neigh;
 
-		read_lock_bh(&nd_tbl.lock);
 		for (neigh = nd_tbl.hash_buckets[i]; neigh; neigh = neigh->next) {
 			int j;
 
@@ -1189,8 +1185,8 @@ static int ndisc_get_info(char *buffer, char **start, off_t offset, int length)
 				goto done;
 			}
 		}
-		read_unlock_bh(&nd_tbl.lock);
 	}
+	read_unlock_bh(&nd_tbl.lock);
 
 done:
 
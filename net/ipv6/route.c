@@ -25,6 +25,9 @@
 #include <linux/init.h>
 #include <linux/netlink.h>
 #include <linux/if_arp.h>
+#include <linux/brlock.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
 
 #ifdef 	CONFIG_PROC_FS
 #include <linux/proc_fs.h>
@@ -92,14 +95,14 @@ struct dst_ops ip6_dst_ops = {
 };
 
 struct rt6_info ip6_null_entry = {
-	{{NULL, ATOMIC_INIT(1), 1, &loopback_dev,
-	  -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	  -ENETUNREACH, NULL, NULL,
-	  ip6_pkt_discard, ip6_pkt_discard,
-#ifdef CONFIG_NET_CLS_ROUTE
-	  0,
-#endif
-	  &ip6_dst_ops}},
+	{{__refcnt:	ATOMIC_INIT(1),
+	  __use:	1,
+	  dev:		&loopback_dev,
+	  obsolete:	-1,
+	  error:	-ENETUNREACH,
+	  input:	ip6_pkt_discard,
+	  output:	ip6_pkt_discard,
+	  ops:		&ip6_dst_ops}},
 	NULL, {{{0}}}, RTF_REJECT|RTF_NONEXTHOP, ~0U,
 	255, ATOMIC_INIT(1), {NULL}, {{{{0}}}, 0}, {{{{0}}}, 0}
 };
@@ -128,9 +131,11 @@ static struct rt6_info	*rt6_flow_lookup(struct rt6_info *rt,
 #define ip6_rt_policy (0)
 #endif
 
-/* Protects all the ip6 fib */
-
-rwlock_t rt6_lock = RW_LOCK_UNLOCKED;
+/*
+ *	All the ip6 fib is protected by the BR_RT6_LOCK big reader lock,
+ *	so that lookups on different CPUs do not share a lock.  Below
+ *	"rt6_lock" in comments means that lock.
+ */
 
 
 /*
@@ -241,12 +246,12 @@ struct rt6_info *rt6_lookup(struct in6_addr *daddr, struct in6_addr *saddr,
 	struct fib6_node *fn;
 	struct rt6_info *rt;
 
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 	fn = fib6_lookup(&ip6_routing_table, daddr, saddr);
 	rt = rt6_device_match(fn->leaf, oif, strict);
 	dst_hold(&rt->u.dst);
 	rt->u.dst.__use++;
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
 
 	rt->u.dst.lastuse = jiffies;
 	if (rt->u.dst.error == 0)
@@ -255,6 +260,105 @@ struct rt6_info *rt6_lookup(struct in6_addr *daddr, struct in6_addr *saddr,
 	return NULL;
 }
 
+/*
+ *	Input destination cache.
+ *
+ *	ip6_route_input() remembers its result per (daddr, saddr, iif) in
+ *	a direct mapped table, the analogue of the IPv4 rt_hash_table, so
+ *	that most packets need neither the tree walk nor rt6_lock.  Only
+ *	usable results are kept.  Each slot holds a reference to its route.
+ *
+ *	Host clones (RTF_CACHE) come and go without touching the table:
+ *	a deleted one is obsolete and is simply not returned.  Any other
+ *	change of the tree may change the result for many destinations
+ *	and flushes the whole table.
+ */
+
+#define RT6_DCACHE_SIZE	1024	/* Must be a power of 2 */
+
+static struct rt6_dcache {
+	rwlock_t		lock;
+	int			iif;
+	struct in6_addr		daddr;
+	struct in6_addr		saddr;
+	struct rt6_info		*rt;
+} rt6_dcache[RT6_DCACHE_SIZE];
+
+static u32 rt6_dcache_rnd;
+
+static __inline__ struct rt6_dcache *rt6_dcache_slot(struct in6_addr *daddr,
+						     struct in6_addr *saddr,
+						     int iif)
+{
+	u32 h = jhash_3words(daddr->s6_addr32[0] ^ daddr->s6_addr32[2],
+			     daddr->s6_addr32[1] ^ daddr->s6_addr32[3],
+			     saddr->s6_addr32[2] ^ saddr->s6_addr32[3] ^ iif,
+			     rt6_dcache_rnd);
+
+	return &rt6_dcache[h & (RT6_DCACHE_SIZE - 1)];
+}
+
+static struct rt6_info *rt6_dcache_lookup(struct in6_addr *daddr,
+					  struct in6_addr *saddr, int iif)
+{
+	struct rt6_dcache *c = rt6_dcache_slot(daddr, saddr, iif);
+	struct rt6_info *rt;
+
+	read_lock_bh(&c->lock);
+	rt = c->rt;
+	if (rt && c->iif == iif &&
+	    rt->u.dst.obsolete <= 0 &&
+	    !ipv6_addr_cmp(&c->daddr, daddr) &&
+	    !ipv6_addr_cmp(&c->saddr, saddr))
+		dst_clone(&rt->u.dst);
+	else
+		rt = NULL;
+	read_unlock_bh(&c->lock);
+	return rt;
+}
+
+static void rt6_dcache_insert(struct in6_addr *daddr, struct in6_addr *saddr,
+			      int iif, struct rt6_info *rt)
+{
+	struct rt6_dcache *c = rt6_dcache_slot(daddr, saddr, iif);
+	struct rt6_info *old;
+
+	dst_clone(&rt->u.dst);
+
+	write_lock_bh(&c->lock);
+	old = c->rt;
+	ipv6_addr_copy(&c->daddr, daddr);
+	ipv6_addr_copy(&c->saddr, saddr);
+	c->iif = iif;
+	c->rt = rt;
+	write_unlock_bh(&c->lock);
+
+	if (old)
+		dst_release(&old->u.dst);
+}
+
+/* Called without rt6_lock */
+static void rt6_dcache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < RT6_DCACHE_SIZE; i++) {
+		struct rt6_dcache *c = &rt6_dcache[i];
+		struct rt6_info *old;
+
+		if (c->rt == NULL)
+			continue;
+
+		write_lock_bh(&c->lock);
+		old = c->rt;
+		c->rt = NULL;
+		write_unlock_bh(&c->lock);
+
+		if (old)
+			dst_release(&old->u.dst);
+	}
+}
+
 /* rt6_ins is called with FREE rt6_lock.
    It takes new route entry, the addition fails by any reason the
    route is freed. In any case, if caller does not hold it, it may
@@ -264,11 +368,14 @@ struct rt6_info *rt6_lookup(struct in6_addr *daddr, struct in6_addr *saddr,
 static int rt6_ins(struct rt6_info *rt)
 {
 	int err;
+	int flush = !(rt->rt6i_flags & RTF_CACHE);
 
-	write_lock_bh(&rt6_lock);
+	br_write_lock_bh(BR_RT6_LOCK);
 	err = fib6_add(&ip6_routing_table, rt);
-	write_unlock_bh(&rt6_lock);
+	br_write_unlock_bh(BR_RT6_LOCK);
 
+	if (flush)
+		rt6_dcache_flush();
 	return err;
 }
 
@@ -373,10 +480,18 @@ void ip6_route_input(struct sk_buff *skb)
 	int strict;
 	int attempts = 3;
 
+	if (ip6_rt_policy == 0) {
+		rt = rt6_dcache_lookup(&skb->nh.ipv6h->daddr,
+				       &skb->nh.ipv6h->saddr,
+				       skb->dev->ifindex);
+		if (rt)
+			goto out2;
+	}
+
 	strict = ipv6_addr_type(&skb->nh.ipv6h->daddr) & (IPV6_ADDR_MULTICAST|IPV6_ADDR_LINKLOCAL);
 
 relookup:
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 
 	fn = fib6_lookup(&ip6_routing_table, &skb->nh.ipv6h->daddr,
 			 &skb->nh.ipv6h->saddr);
@@ -412,13 +527,13 @@ restart:
 
 	if (ip6_rt_policy == 0) {
 		if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP)) {
-			read_unlock_bh(&rt6_lock);
+			br_read_unlock_bh(BR_RT6_LOCK);
 
 			rt = rt6_cow(rt, &skb->nh.ipv6h->daddr,
 				     &skb->nh.ipv6h->saddr);
 			
 			if (rt->u.dst.error != -EEXIST || --attempts <= 0)
-				goto out2;
+				goto out_cache;
 			/* Race condition! In the gap, when rt6_lock was
 			   released someone could insert this route.  Relookup.
 			 */
@@ -434,7 +549,11 @@ restart:
 	}
 
 out:
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
+out_cache:
+	if (ip6_rt_policy == 0 && rt->u.dst.error == 0)
+		rt6_dcache_insert(&skb->nh.ipv6h->daddr, &skb->nh.ipv6h->saddr,
+				  skb->dev->ifindex, rt);
 out2:
 	rt->u.dst.lastuse = jiffies;
 	rt->u.dst.__use++;
@@ -451,7 +570,7 @@ struct dst_entry * ip6_route_output(struct sock *sk, struct flowi *fl)
 	strict = ipv6_addr_type(fl->nl_u.ip6_u.daddr) & (IPV6_ADDR_MULTICAST|IPV6_ADDR_LINKLOCAL);
 
 relookup:
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 
 	fn = fib6_lookup(&ip6_routing_table, fl->nl_u.ip6_u.daddr,
 			 fl->nl_u.ip6_u.saddr);
@@ -491,7 +610,7 @@ restart:
 
 	if (ip6_rt_policy == 0) {
 		if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP)) {
-			read_unlock_bh(&rt6_lock);
+			br_read_unlock_bh(BR_RT6_LOCK);
 
 			rt = rt6_cow(rt, fl->nl_u.ip6_u.daddr,
 				     fl->nl_u.ip6_u.saddr);
@@ -514,7 +633,7 @@ restart:
 	}
 
 out:
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
 out2:
 	rt->u.dst.lastuse = jiffies;
 	rt->u.dst.__use++;
@@ -804,9 +923,10 @@ out:
 
 int ip6_del_rt(struct rt6_info *rt)
 {
+	int flush = !(rt->rt6i_flags & RTF_CACHE);
 	int err;
 
-	write_lock_bh(&rt6_lock);
+	br_write_lock_bh(BR_RT6_LOCK);
 
 	spin_lock_bh(&rt6_dflt_lock);
 	rt6_dflt_pointer = NULL;
@@ -815,8 +935,10 @@ int ip6_del_rt(struct rt6_info *rt)
 	dst_release(&rt->u.dst);
 
 	err = fib6_del(rt);
-	write_unlock_bh(&rt6_lock);
+	br_write_unlock_bh(BR_RT6_LOCK);
 
+	if (flush)
+		rt6_dcache_flush();
 	return err;
 }
 
@@ -826,7 +948,7 @@ int ip6_route_del(struct in6_rtmsg *rtmsg)
 	struct rt6_info *rt;
 	int err = -ESRCH;
 
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 
 	fn = fib6_locate(&ip6_routing_table,
 			 &rtmsg->rtmsg_dst, rtmsg->rtmsg_dst_len,
@@ -845,12 +967,12 @@ int ip6_route_del(struct in6_rtmsg *rtmsg)
 			    rtmsg->rtmsg_metric != rt->rt6i_metric)
 				continue;
 			dst_clone(&rt->u.dst);
-			read_unlock_bh(&rt6_lock);
+			br_read_unlock_bh(BR_RT6_LOCK);
 
 			return ip6_del_rt(rt);
 		}
 	}
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
 
 	return err;
 }
@@ -910,17 +1032,17 @@ void rt6_redirect(struct in6_addr *dest, struct in6_addr *saddr,
 		if (rt->rt6i_flags & RTF_DEFAULT) {
 			struct rt6_info *rt1;
 
-			read_lock(&rt6_lock);
+			br_read_lock(BR_RT6_LOCK);
 			for (rt1 = ip6_routing_table.leaf; rt1; rt1 = rt1->u.next) {
 				if (!ipv6_addr_cmp(saddr, &rt1->rt6i_gateway)) {
 					dst_clone(&rt1->u.dst);
 					dst_release(&rt->u.dst);
-					read_unlock(&rt6_lock);
+					br_read_unlock(BR_RT6_LOCK);
 					rt = rt1;
 					goto source_ok;
 				}
 			}
-			read_unlock(&rt6_lock);
+			br_read_unlock(BR_RT6_LOCK);
 		}
 		if (net_ratelimit())
 			printk(KERN_DEBUG "rt6_redirect: source isn't a valid nexthop "
@@ -1084,7 +1206,7 @@ struct rt6_info *rt6_get_dflt_router(struct in6_addr *addr, struct net_device *d
 
 	fn = &ip6_routing_table;
 
-	write_lock_bh(&rt6_lock);
+	br_write_lock_bh(BR_RT6_LOCK);
 	for (rt = fn->leaf; rt; rt=rt->u.next) {
 		if (dev == rt->rt6i_dev &&
 		    ipv6_addr_cmp(&rt->rt6i_gateway, addr) == 0)
@@ -1092,7 +1214,7 @@ struct rt6_info *rt6_get_dflt_router(struct in6_addr *addr, struct net_device *d
 	}
 	if (rt)
 		dst_clone(&rt->u.dst);
-	write_unlock_bh(&rt6_lock);
+	br_write_unlock_bh(BR_RT6_LOCK);
 	return rt;
 }
 
@@ -1124,7 +1246,7 @@ void rt6_purge_dflt_routers(int last_resort)
 		flags = RTF_DEFAULT | RTF_ADDRCONF;	
 
 restart:
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 	for (rt = ip6_routing_table.leaf; rt; rt = rt->u.next) {
 		if (rt->rt6i_flags & flags) {
 			dst_hold(&rt->u.dst);
@@ -1133,14 +1255,14 @@ restart:
 			rt6_dflt_pointer = NULL;
 			spin_unlock_bh(&rt6_dflt_lock);
 
-			read_unlock_bh(&rt6_lock);
+			br_read_unlock_bh(BR_RT6_LOCK);
 
 			ip6_del_rt(rt);
 
 			goto restart;
 		}
 	}
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
 }
 
 int ipv6_route_ioctl(unsigned int cmd, void *arg)
@@ -1373,9 +1495,11 @@ static int fib6_ifdown(struct rt6_info *rt, void *arg)
 
 void rt6_ifdown(struct net_device *dev)
 {
-	write_lock_bh(&rt6_lock);
+	br_write_lock_bh(BR_RT6_LOCK);
 	fib6_clean_tree(&ip6_routing_table, fib6_ifdown, 0, dev);
-	write_unlock_bh(&rt6_lock);
+	br_write_unlock_bh(BR_RT6_LOCK);
+
+	rt6_dcache_flush();
 }
 
 struct rt6_mtu_change_arg
@@ -1408,9 +1532,9 @@ void rt6_mtu_change(struct net_device *dev, unsigned mtu)
 
 	arg.dev = dev;
 	arg.mtu = mtu;
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 	fib6_clean_tree(&ip6_routing_table, rt6_mtu_change_route, 0, &arg);
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
 }
 
 #ifdef CONFIG_RTNETLINK
@@ -1642,14 +1766,14 @@ int inet6_dump_fib(struct sk_buff *skb, struct netlink_callback *cb)
 		w->func = fib6_dump_node;
 		w->args = &arg;
 		cb->args[0] = (long)w;
-		read_lock_bh(&rt6_lock);
+		br_read_lock_bh(BR_RT6_LOCK);
 		res = fib6_walk(w);
-		read_unlock_bh(&rt6_lock);
+		br_read_unlock_bh(BR_RT6_LOCK);
 	} else {
 		w->args = &arg;
-		read_lock_bh(&rt6_lock);
+		br_read_lock_bh(BR_RT6_LOCK);
 		res = fib6_walk_continue(w);
-		read_unlock_bh(&rt6_lock);
+		br_read_unlock_bh(BR_RT6_LOCK);
 	}
 #if RT6_DEBUG >= 3
 	if (res <= 0 && skb->len == 0)
@@ -1829,9 +1953,9 @@ static int rt6_proc_info(char *buffer, char **start, off_t offset, int length)
 	arg.skip = 0;
 	arg.len = 0;
 
-	read_lock_bh(&rt6_lock);
+	br_read_lock_bh(BR_RT6_LOCK);
 	fib6_clean_tree(&ip6_routing_table, rt6_info_route, 0, &arg);
-	read_unlock_bh(&rt6_lock);
+	br_read_unlock_bh(BR_RT6_LOCK);
 
 	*start = buffer;
 	if (offset)
@@ -1926,6 +2050,12 @@ ctl_table ipv6_route_table[] = {
 
 void __init ip6_route_init(void)
 {
+	int i;
+
+	for (i = 0; i < RT6_DCACHE_SIZE; i++)
+		rt6_dcache[i].lock = RW_LOCK_UNLOCKED;
+	get_random_bytes(&rt6_dcache_rnd, sizeof(rt6_dcache_rnd));
+
 	ip6_dst_ops.kmem_cachep = kmem_cache_create("ip6_dst_cache",
 						     sizeof(struct rt6_info),
 						     0, SLAB_HWCACHE_ALIGN,
@@ -1116,10 +1116,7 @@ static void tcp_v6_synq_add(struct sock *sk, struct open_request *req)
 	req->retrans = 0;
 	req->index = h;
 	req->dl_next = lopt->syn_table[h];
-
-	write_lock(&tp->syn_wait_lock);
 	lopt->syn_table[h] = req;
-	write_unlock(&tp->syn_wait_lock);
 
 	tcp_synq_added(sk);
 }
@@ -1460,7 +1457,26 @@ static int tcp_v6_do_rcv(struct sock *sk, struct sk_buff *skb)
 		goto csum_err;
 
 	if (sk->state == TCP_LISTEN) { 
-		struct sock *nsk = tcp_v6_hnd_req(sk, skb);
+		struct tcp_opt *tp = &(sk->tp_pinfo.af_tcp);
+		struct sock *nsk;
+		int ret;
+
+		/* The SYN and accept queues are under syn_wait_lock, as
+		 * IPv4 segments for this socket may change them without
+		 * the socket lock.
+		 */
+		write_lock(&tp->syn_wait_lock);
+		nsk = tcp_v6_hnd_req(sk, skb);
+		if (nsk == sk) {
+			ret = tcp_rcv_state_process(sk, skb, skb->h.th, skb->len);
+			write_unlock(&tp->syn_wait_lock);
+			if (ret)
+				goto reset;
+			if (opt_skb)
+				goto ipv6_pktoptions;
+			return 0;
+		}
+		write_unlock(&tp->syn_wait_lock);
 		if (!nsk)
 			goto discard;
 
@@ -1469,13 +1485,11 @@ static int tcp_v6_do_rcv(struct sock *sk, struct sk_buff *skb)
 		 * otherwise we just shortcircuit this and continue with
 		 * the new socket..
 		 */
- 		if(nsk != sk) {
-			if (tcp_child_process(sk, nsk, skb))
-				goto reset;
-			if (opt_skb)
-				__kfree_skb(opt_skb);
-			return 0;
-		}
+		if (tcp_child_process(sk, nsk, skb))
+			goto reset;
+		if (opt_skb)
+			__kfree_skb(opt_skb);
+		return 0;
 	}
 
 	TCP_CHECK_TIMER(sk);
@@ -1813,6 +1827,7 @@ static int tcp_v6_init_sock(struct sock *sk)
 	tp->mss_cache = 536;
 
 	tp->reordering = sysctl_tcp_reordering;
+	tp->pacing.on = sysctl_tcp_pacing;
 
 	sk->state = TCP_CLOSE;
 
@@ -1843,10 +1858,17 @@ static int tcp_v6_destroy_sock(struct sock *sk)
 	/* Clean prequeue, it must be empty really */
 	__skb_queue_purge(&tp->ucopy.prequeue);
 
+	/* Mapped IPv4 connections keep an input route for early demux. */
+	dst_release(xchg(&tp->rx_dst, NULL));
+
 	/* Clean up a referenced TCP bind bucket. */
 	if(sk->prev != NULL)
 		tcp_put_port(sk);
 
+	/* If sendmsg cached page exists, toss it. */
+	if (sk->sndmsg_page != NULL)
+		__free_page(sk->sndmsg_page);
+
 	atomic_dec(&tcp_sockets_allocated);
 
 	return inet6_destroy_sock(sk);
@@ -2098,6 +2120,8 @@ struct proto tcpv6_prot = {
 	setsockopt:	tcp_setsockopt,
 	getsockopt:	tcp_getsockopt,
 	sendmsg:	tcp_sendmsg,
+	sendpage:	tcp_sendpage,
+	receive_file:	tcp_receive_file,
 	recvmsg:	tcp_recvmsg,
 	backlog_rcv:	tcp_v6_do_rcv,
 	hash:		tcp_v6_hash,
@@ -117,17 +117,17 @@ int DataSending(const int CPUNR)
 			if (inode->i_mapping->a_ops->readpage) {
 				/* This does the actual transfer using sendfile */		
 				read_descriptor_t desc;
-				loff_t *ppos;
+				loff_t pos;
 		
-				CurrentRequest->filp->f_pos = CurrentRequest->BytesSent;
-
-				ppos = &CurrentRequest->filp->f_pos;
+				/* The file may be shared through the file cache,
+				   so don't use its f_pos */
+				pos = CurrentRequest->BytesSent;
 
 				desc.written = 0;
 				desc.count = ReadSize;
 				desc.buf = (char *) CurrentRequest->sock;
 				desc.error = 0;
-				do_generic_file_read(CurrentRequest->filp, ppos, &desc, sock_send_actor);
+				do_generic_file_read(CurrentRequest->filp, &pos, &desc, sock_send_actor);
 				if (desc.written>0)
 				{	
 					CurrentRequest->BytesSent += desc.written;
@@ -137,10 +137,12 @@ int DataSending(const int CPUNR)
 			else  /* FS doesn't support sendfile() */
 			{
 				mm_segment_t oldfs;
-				CurrentRequest->filp->f_pos = CurrentRequest->BytesSent;
+				loff_t pos;
+				
+				pos = CurrentRequest->BytesSent;
 				
 				oldfs = get_fs(); set_fs(KERNEL_DS);
-				retval = CurrentRequest->filp->f_op->read(CurrentRequest->filp, Block[CPUNR], ReadSize, &CurrentRequest->filp->f_pos);
+				retval = CurrentRequest->filp->f_op->read(CurrentRequest->filp, Block[CPUNR], ReadSize, &pos);
 				set_fs(oldfs);
 		
 				if (retval>0)
@@ -0,0 +1,282 @@
+/*
+
+kHTTPd -- the next generation
+
+Cache of opened files, indexed by the requested URL
+
+*/
+/****************************************************************
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2, or (at your option)
+ *	any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ****************************************************************/
+
+/*
+
+Purpose:
+
+Opening a file for a request means a full path lookup plus the security
+checks in security.c. On a small set of hot files that is most of the work
+per request, so the result (the opened file and its mime-type) is kept in
+a table indexed by the URL as it came from the client, with the least
+recently used entry replaced when the table is full.
+
+Every cache hit is revalidated: an entry whose file was deleted or renamed
+away, or whose permissions no longer pass the security rules, is dropped
+and the slow path is taken. Changes to the contents of the file need no
+invalidation; the cached file still refers to the same inode, and the
+reply-header cache in rfc.c is keyed by mtime and size.
+
+The cached files are shared by all daemons, so DataSending never uses
+their f_pos.
+
+*/
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/malloc.h>
+#include <linux/fs.h>
+#include <linux/dcache.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/file.h>
+
+#include <asm/atomic.h>
+
+#include "structure.h"
+#include "prototypes.h"
+#include "sysctl.h"
+
+#define KHTTPD_FILECACHE_HASH	64	/* Must be a power of 2 */
+#define KHTTPD_FILECACHE_MAX	256	/* Maximum number of cached files */
+
+struct FileCacheEntry
+{
+	struct list_head	hash;	/* Chain in the hash-bucket */
+	struct list_head	lru;	/* Most recently used first */
+	unsigned int		key;
+	struct file		*filp;
+	char			*MimeType;
+	__kernel_size_t		MimeLength;
+	char			URL[256];
+};
+
+static struct list_head	FileCacheHash[KHTTPD_FILECACHE_HASH];
+static LIST_HEAD(FileCacheLRU);
+static int		FileCacheCount;
+static spinlock_t	FileCacheLock = SPIN_LOCK_UNLOCKED;
+
+int	sysctl_khttpd_cache_hits;
+int	sysctl_khttpd_cache_misses;
+
+
+static unsigned int HashURL(const char *URL)
+{
+	unsigned int hash = 0;
+
+	while (*URL)
+		hash = (hash<<5) + hash + (unsigned char)*URL++;
+
+	return hash;
+}
+
+/* Is the cached file still what the security rules would give us? */
+static int EntryValid(struct FileCacheEntry *Entry)
+{
+	struct dentry *dentry = Entry->filp->f_dentry;
+	umode_t permission;
+
+	if (d_unhashed(dentry) || dentry->d_inode->i_nlink==0)
+		return 0;
+
+	permission = dentry->d_inode->i_mode;
+
+	if ((permission & sysctl_khttpd_permreq)==0)
+		return 0;
+	if ((permission & sysctl_khttpd_permforbid)!=0)
+		return 0;
+
+	return 1;
+}
+
+/* Caller holds FileCacheLock; the file has to be released afterwards */
+static struct file *UnlinkEntry(struct FileCacheEntry *Entry)
+{
+	struct file *filp = Entry->filp;
+
+	list_del(&Entry->hash);
+	list_del(&Entry->lru);
+	FileCacheCount--;
+
+	return filp;
+}
+
+
+/*
+
+OpenFileCached sets Request->filp and Request->MimeType/MimeLength for the
+file named in Request->FileName, from the cache when possible. On a miss it
+falls back to OpenFileForSecurity and ResolveMimeType and enters the result
+into the cache. Request->filp is NULL when userspace has to handle the
+request; Request->FileName may have been %-decoded in that case.
+
+*/
+void OpenFileCached(struct http_request *Request)
+{
+	struct FileCacheEntry *Entry,*New;
+	struct list_head *Head,*tmp;
+	struct file *Stale = NULL, *Evicted = NULL;
+	unsigned int key;
+
+	EnterFunction("OpenFileCached");
+
+	key = HashURL(Request->FileName);
+	Head = &FileCacheHash[key & (KHTTPD_FILECACHE_HASH-1)];
+
+	spin_lock(&FileCacheLock);
+	for (tmp = Head->next; tmp!=Head; tmp = tmp->next)
+	{
+		Entry = list_entry(tmp,struct FileCacheEntry,hash);
+
+		if (Entry->key!=key || strcmp(Entry->URL,Request->FileName)!=0)
+			continue;
+
+		if (!EntryValid(Entry))
+		{
+			Stale = UnlinkEntry(Entry);
+			spin_unlock(&FileCacheLock);
+			fput(Stale);
+			kfree(Entry);
+			spin_lock(&FileCacheLock);
+			break;
+		}
+
+		list_del(&Entry->lru);
+		list_add(&Entry->lru,&FileCacheLRU);
+
+		get_file(Entry->filp);
+		Request->filp = Entry->filp;
+		Request->MimeType = Entry->MimeType;
+		Request->MimeLength = Entry->MimeLength;
+		sysctl_khttpd_cache_hits++;
+		spin_unlock(&FileCacheLock);
+
+		LeaveFunction("OpenFileCached - hit");
+		return;
+	}
+	sysctl_khttpd_cache_misses++;
+	spin_unlock(&FileCacheLock);
+
+	/* Slow path. The URL is copied first because OpenFileForSecurity
+	   decodes the filename in place. */
+
+	New = kmalloc(sizeof(struct FileCacheEntry),(int)GFP_KERNEL);
+	if (New!=NULL)
+	{
+		New->key = key;
+		strcpy(New->URL,Request->FileName);
+	}
+
+	Request->filp = OpenFileForSecurity(Request->FileName);
+	Request->MimeType = ResolveMimeType(Request->FileName,&Request->MimeLength);
+
+	if (Request->filp==NULL || Request->MimeType==NULL || New==NULL)
+	{
+		if (New!=NULL)
+			kfree(New);
+		LeaveFunction("OpenFileCached - not cached");
+		return;
+	}
+
+	get_file(Request->filp);
+	New->filp = Request->filp;
+	New->MimeType = Request->MimeType;
+	New->MimeLength = Request->MimeLength;
+
+	spin_lock(&FileCacheLock);
+
+	/* Another daemon may have entered the same URL meanwhile */
+	for (tmp = Head->next; tmp!=Head; tmp = tmp->next)
+	{
+		Entry = list_entry(tmp,struct FileCacheEntry,hash);
+		if (Entry->key==key && strcmp(Entry->URL,New->URL)==0)
+		{
+			spin_unlock(&FileCacheLock);
+			fput(New->filp);
+			kfree(New);
+			LeaveFunction("OpenFileCached - raced");
+			return;
+		}
+	}
+
+	Entry = NULL;
+	if (FileCacheCount>=KHTTPD_FILECACHE_MAX)
+	{
+		Entry = list_entry(FileCacheLRU.prev,struct FileCacheEntry,lru);
+		Evicted = UnlinkEntry(Entry);
+	}
+
+	list_add(&New->hash,Head);
+	list_add(&New->lru,&FileCacheLRU);
+	FileCacheCount++;
+
+	spin_unlock(&FileCacheLock);
+
+	if (Evicted!=NULL)
+	{
+		fput(Evicted);
+		kfree(Entry);
+	}
+
+	LeaveFunction("OpenFileCached - miss");
+}
+
+/*
+
+FlushFileCache drops all entries. It is used when the daemons stop, so
+that no files (and filesystems) are kept busy, and when the security
+rules change.
+
+*/
+void FlushFileCache(void)
+{
+	struct FileCacheEntry *Entry;
+	struct file *filp;
+
+	EnterFunction("FlushFileCache");
+
+	spin_lock(&FileCacheLock);
+	while (!list_empty(&FileCacheLRU))
+	{
+		Entry = list_entry(FileCacheLRU.next,struct FileCacheEntry,lru);
+		filp = UnlinkEntry(Entry);
+		spin_unlock(&FileCacheLock);
+
+		fput(filp);
+		kfree(Entry);
+
+		spin_lock(&FileCacheLock);
+	}
+	spin_unlock(&FileCacheLock);
+
+	LeaveFunction("FlushFileCache");
+}
+
+void InitFileCache(void)
+{
+	int I;
+
+	for (I=0;I<KHTTPD_FILECACHE_HASH;I++)
+		INIT_LIST_HEAD(&FileCacheHash[I]);
+}
@@ -35,11 +35,12 @@ logging.c takes care of shutting down a connection.
 Purpose:
 
 Logging() terminates "finished" connections and will eventually log them to a 
-userspace daemon.
+userspace daemon. Persistent connections are handed back to the
+WaitForHeaderQueue for their next request instead.
 
 Return value:
 	The number of requests that changed status, thus the number of connections
-	that shut down.
+	that shut down or went back to waiting for a header.
 */
 
 
@@ -60,9 +61,11 @@ int Logging(const int CPUNR)
 
 		Req = CurrentRequest->Next;
 
-		CleanUpRequest(CurrentRequest);
-		
 		threadinfo[CPUNR].LoggingQueue = Req;
+		
+		if ((CurrentRequest->KeepAlive==0)||
+		    (KeepAliveRequest(CPUNR,CurrentRequest)<0))
+			CleanUpRequest(CurrentRequest);
 			
 		CurrentRequest = Req;
 	
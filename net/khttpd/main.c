@@ -310,6 +310,7 @@ static int ManagementDaemon(void *unused)
 			while (atomic_read(&DaemonCount)>0)
 		 		interruptible_sleep_on_timeout(&WQ,HZ);
 			StopListening();
+			FlushFileCache();
 		}
 
 		
@@ -329,6 +330,7 @@ static int ManagementDaemon(void *unused)
 		waitpid_result = waitpid(-1,NULL,__WCLONE|WNOHANG);
 		
 	StopListening();
+	FlushFileCache();
 	
 	
 	(void)printk(KERN_NOTICE "kHTTPd: Management daemon stopped. \n        You can unload the module now.\n");
@@ -355,6 +357,8 @@ int __init khttpd_init(void)
 	atomic_set(&ConnectCount,0);
 	atomic_set(&DaemonCount,0);
 	
+	InitFileCache();
+	
 
 	/* Maybe the mime-types will be set-able through sysctl in the future */	   
 		
@@ -217,6 +217,7 @@ situation, and they don't change anyhow.
 static char NoPerm[] = "HTTP/1.0 403 Forbidden\r\nServer: kHTTPd 0.1.6\r\n\r\n";
 static char TryLater[] = "HTTP/1.0 503 Service Unavailable\r\nServer: kHTTPd 0.1.6\r\nContent-Length: 15\r\n\r\nTry again later";
 static char NotModified[] = "HTTP/1.0 304 Not Modified\r\nServer: kHTTPd 0.1.6\r\n\r\n";
+static char NotModifiedKA[] = "HTTP/1.1 304 Not Modified\r\nServer: kHTTPd 0.1.6\r\nConnection: Keep-Alive\r\n\r\n";
 
 
 void Send403(struct socket *sock)
@@ -226,10 +227,13 @@ void Send403(struct socket *sock)
 	LeaveFunction("Send403");
 }
 
-void Send304(struct socket *sock)
+void Send304(struct socket *sock,const int KeepAlive)
 {
 	EnterFunction("Send304");
-	(void)SendBuffer(sock,NotModified,strlen(NotModified));
+	if (KeepAlive)
+		(void)SendBuffer(sock,NotModifiedKA,strlen(NotModifiedKA));
+	else
+		(void)SendBuffer(sock,NotModified,strlen(NotModified));
 	LeaveFunction("Send304");
 }
 
@@ -68,7 +68,7 @@ void CleanUpRequest(struct http_request *Req);
 int SendBuffer(struct socket *sock, const char *Buffer,const size_t Length);
 int SendBuffer_async(struct socket *sock, const char *Buffer,const size_t Length);
 void Send403(struct socket *sock);
-void Send304(struct socket *sock);
+void Send304(struct socket *sock,const int KeepAlive);
 void Send50x(struct socket *sock);
 
 /* accept.c */
@@ -80,6 +80,7 @@ int AcceptConnections(const int CPUNR,struct socket *Socket);
 int WaitForHeaders(const int CPUNR);
 void StopWaitingForHeaders(const int CPUNR);
 int InitWaitHeaders(int ThreadCount);
+int KeepAliveRequest(const int CPUNR,struct http_request *Request);
 
 /* datasending.c */
 
@@ -118,6 +119,13 @@ void AddDynamicString(const char *String);
 void GetSecureString(char *String);
 
 
+/* filecache.c */
+
+void OpenFileCached(struct http_request *Request);
+void FlushFileCache(void);
+void InitFileCache(void);
+
+
 /* logging.c */
 
 int Logging(const int CPUNR);
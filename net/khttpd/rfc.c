@@ -35,6 +35,8 @@ RFC related functions (headers and stuff)
 #include <linux/unistd.h>
 #include <linux/file.h>
 #include <linux/smp_lock.h>
+#include <linux/spinlock.h>
+#include <linux/jhash.h>
 
 #include <net/ip.h>
 #include <net/sock.h>
@@ -155,7 +157,7 @@ char *ResolveMimeType(const char *File,__kernel_size_t *Len)
 }
 
 
-static char HeaderPart1[] = "HTTP/1.0 200 OK\r\nServer: kHTTPd/0.1.6\r\nDate: ";
+static char HeaderPart1[] = "HTTP/1.1 200 OK\r\nServer: kHTTPd/0.1.6\r\nDate: ";
 #ifdef BENCHMARK
 static char HeaderPart1b[] ="HTTP/1.0 200 OK";
 #endif
@@ -163,6 +165,10 @@ static char HeaderPart3[] = "\r\nContent-type: ";
 static char HeaderPart5[] = "\r\nLast-modified: ";
 static char HeaderPart7[] = "\r\nContent-length: ";
 static char HeaderPart9[] = "\r\n\r\n";
+static char HeaderKeepAlive[] = "\r\nConnection: Keep-Alive\r\n\r\n";
+#ifndef BENCHMARK
+static char HeaderClose[] = "\r\nConnection: close\r\n\r\n";
+#endif
 
 #ifdef BENCHMARK
 /* In BENCHMARK-mode, just send the bare essentials */
@@ -198,10 +204,17 @@ void SendHTTPHeader(struct http_request *Request)
 	sprintf(Request->LengthS,"%i",Request->FileLength);
 	iov[4].iov_base = Request->LengthS;
 	iov[4].iov_len  = strlen(Request->LengthS);
-	iov[5].iov_base = HeaderPart9;
-	iov[5].iov_len  = 4;
+	if (Request->KeepAlive)
+	{
+		iov[5].iov_base = HeaderKeepAlive;
+		iov[5].iov_len  = sizeof(HeaderKeepAlive)-1;
+	} else
+	{
+		iov[5].iov_base = HeaderPart9;
+		iov[5].iov_len  = 4;
+	}
 	
-	len2=15+16+18+iov[2].iov_len+iov[4].iov_len+4;
+	len2=15+16+18+iov[2].iov_len+iov[4].iov_len+iov[5].iov_len;
 	
 	
 	len = 0;
@@ -215,20 +228,110 @@ void SendHTTPHeader(struct http_request *Request)
 	return;	
 }
 #else
+
+/*
+
+The Content-type, Last-modified and Content-length lines of the reply only
+depend on the file, so they are built once per inode and mtime and kept in
+a small direct-mapped cache. A reply then only costs a copy of the cached
+lines instead of a sprintf and a date conversion.
+
+*/
+
+#define KHTTPD_HEADERCACHE	128	/* Must be a power of 2 */
+
+struct HeaderCacheEntry
+{
+	unsigned int	dev;
+	unsigned long	ino;
+	int		mtime;
+	int		size;
+	char		*MimeType;
+	int		len;		/* 0 means unused */
+	char		data[KHTTPD_REPLYHEADER];
+};
+
+static struct HeaderCacheEntry	HeaderCache[KHTTPD_HEADERCACHE];
+static spinlock_t		HeaderCacheLock = SPIN_LOCK_UNLOCKED;
+
+static void PrepareHTTPHeader(struct http_request *Request)
+{
+	struct inode *inode;
+	struct HeaderCacheEntry *Entry;
+	unsigned int dev;
+	int cacheable;
+	
+	EnterFunction("PrepareHTTPHeader");
+	
+	inode = Request->filp->f_dentry->d_inode;
+	dev = kdev_t_to_nr(inode->i_dev);
+	Entry = &HeaderCache[jhash_2words((__u32)inode->i_ino,dev,0) & (KHTTPD_HEADERCACHE-1)];
+	
+	/* A file with an mtime in the future is sent with the current time,
+	   which changes every second; don't cache those. */
+	cacheable = (Request->Time<=CurrentTime_i);
+	
+	if (cacheable)
+	{
+		spin_lock(&HeaderCacheLock);
+		if ((Entry->len>0) &&
+		    (Entry->ino==inode->i_ino) &&
+		    (Entry->dev==dev) &&
+		    (Entry->mtime==Request->Time) &&
+		    (Entry->size==Request->FileLength) &&
+		    (Entry->MimeType==Request->MimeType))
+		{
+			memcpy(Request->ReplyHeader,Entry->data,Entry->len);
+			Request->ReplyHeaderLength = Entry->len;
+			spin_unlock(&HeaderCacheLock);
+			LeaveFunction("PrepareHTTPHeader - cached");
+			return;
+		}
+		spin_unlock(&HeaderCacheLock);
+	}
+	
+	sprintf(Request->LengthS,"%i",Request->FileLength);
+	time_Unix2RFC(min(Request->Time,CurrentTime_i),Request->TimeS);
+   	/* The min() is required by rfc1945, section 10.10:
+   	   It is not allowed to send a filetime in the future */
+	
+	Request->ReplyHeaderLength = sprintf(Request->ReplyHeader,
+		"%s%.*s%s%.29s%s%s",
+		HeaderPart3,(int)Request->MimeLength,Request->MimeType,
+		HeaderPart5,Request->TimeS,
+		HeaderPart7,Request->LengthS);
+	
+	if (cacheable)
+	{
+		spin_lock(&HeaderCacheLock);
+		Entry->dev	= dev;
+		Entry->ino	= inode->i_ino;
+		Entry->mtime	= Request->Time;
+		Entry->size	= Request->FileLength;
+		Entry->MimeType	= Request->MimeType;
+		Entry->len	= Request->ReplyHeaderLength;
+		memcpy(Entry->data,Request->ReplyHeader,Entry->len);
+		spin_unlock(&HeaderCacheLock);
+	}
+	
+	LeaveFunction("PrepareHTTPHeader");
+}
+
 void SendHTTPHeader(struct http_request *Request)
 {
 	struct msghdr	msg;
 	mm_segment_t	oldfs;
-	struct iovec	iov[9];
+	struct iovec	iov[4];
 	int 		len,len2;
-	__kernel_size_t	slen;
 	
 	EnterFunction("SendHTTPHeader");
 	
+	PrepareHTTPHeader(Request);
+	
 	msg.msg_name     = 0;
 	msg.msg_namelen  = 0;
 	msg.msg_iov	 = &(iov[0]);
-	msg.msg_iovlen   = 9;
+	msg.msg_iovlen   = 4;
 	msg.msg_control  = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_flags    = 0;  /* Synchronous for now */
@@ -237,34 +340,28 @@ void SendHTTPHeader(struct http_request *Request)
 	iov[0].iov_len  = 45;
 	iov[1].iov_base = CurrentTime;
 	iov[1].iov_len  = 29;
-	iov[2].iov_base = HeaderPart3;
-	iov[2].iov_len  = 16;
-	
-	iov[3].iov_base = Request->MimeType;
-	iov[3].iov_len  = Request->MimeLength;
-	
-	iov[4].iov_base = HeaderPart5;
-	iov[4].iov_len  = 17;
-	iov[5].iov_base = &(Request->TimeS[0]);
-	iov[5].iov_len  = 29;
-	iov[6].iov_base = HeaderPart7;
-	iov[6].iov_len  = 18;
-	iov[7].iov_base = &(Request->LengthS[0]);
-	slen = strlen(Request->LengthS); 
-	iov[7].iov_len  = slen;
-	iov[8].iov_base = HeaderPart9;
-	iov[8].iov_len  = 4;
-	
-	len2=45+2*29+16+17+18+slen+4+iov[3].iov_len;
+	iov[2].iov_base = Request->ReplyHeader;
+	iov[2].iov_len  = Request->ReplyHeaderLength;
+	if (Request->KeepAlive)
+	{
+		iov[3].iov_base = HeaderKeepAlive;
+		iov[3].iov_len  = sizeof(HeaderKeepAlive)-1;
+	} else
+	{
+		iov[3].iov_base = HeaderClose;
+		iov[3].iov_len  = sizeof(HeaderClose)-1;
+	}
+	
+	len2=45+29+iov[2].iov_len+iov[3].iov_len;
 	
 	len = 0;
-
+	
 	oldfs = get_fs(); set_fs(KERNEL_DS);
 	len = sock_sendmsg(Request->sock,&msg,len2);
 	set_fs(oldfs);
 	LeaveFunction("SendHTTPHeader");
 	
-
+	
 	return;	
 }
 #endif
@@ -284,10 +381,16 @@ void ParseHeader(char *Buffer,const int length, struct http_request *Head)
 	EnterFunction("ParseHeader");
 	Endval = Buffer + length;
 	
-	/* We want to parse only the first header if multiple headers are present */
+	/* We want to parse only the first header if multiple headers are present.
+	   Its length is what has to be consumed before the next pipelined
+	   request on the same connection can be parsed. */
 	tmp = strstr(Buffer,"\r\n\r\n"); 
 	if (tmp!=NULL)
+	{
 	    Endval = tmp;
+	    Head->RequestLength = tmp+4-Buffer;
+	} else
+	    Head->RequestLength = 0;
 	
 	
 	while (Buffer<Endval)
@@ -319,9 +422,16 @@ void ParseHeader(char *Buffer,const int length, struct http_request *Head)
 			{
 				tmp=EOL-1;
 				Head->HTTPVER = 9;
-			} else
+			} else if (strncmp(tmp+1,"HTTP/1.",7)==0 && tmp+8<Endval &&
+				   tmp[8]>='1' && tmp[8]<='9')
+				Head->HTTPVER = 11;
+			else
 				Head->HTTPVER = 10;
 			
+			/* HTTP/1.1 connections are persistent unless the
+			   client says otherwise */
+			Head->KeepAlive = (Head->HTTPVER==11);
+			
 			if (tmp>Endval) continue;
 			
 			strncpy(Head->FileName,sysctl_khttpd_docroot,sizeof(Head->FileName));
@@ -368,6 +478,18 @@ void ParseHeader(char *Buffer,const int length, struct http_request *Head)
 			continue;
 		}
 #endif		
+		if (strncmp("Connection: ",Buffer,12)==0)
+		{
+			Buffer+=12;
+			
+			if (strnicmp(Buffer,"keep-alive",10)==0)
+				Head->KeepAlive = 1;
+			else if (strnicmp(Buffer,"close",5)==0)
+				Head->KeepAlive = 0;
+			
+			Buffer=EOL+1;	
+			continue;
+		}
 		Buffer = EOL+1;  /* Skip line */
 	}
 	LeaveFunction("ParseHeader");
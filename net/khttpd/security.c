@@ -238,6 +238,9 @@ void AddDynamicString(const char *String)
 	Temp->Next = DynamicList;
 	DynamicList = Temp;
 	
+	/* Cached files passed the old rules only */
+	FlushFileCache();
+	
 	LeaveFunction("AddDynamicString");
 }
 
@@ -7,6 +7,8 @@
 
 struct http_request;
 
+#define KHTTPD_REPLYHEADER	192
+
 struct http_request
 {
 	/* Linked list */
@@ -22,6 +24,10 @@ struct http_request
 	int		Time;		/* mtime of the file, unix format */
 	int		BytesSent;	/* The number of bytes already sent */
 	int		IsForUserspace;	/* 1 means let Userspace handle this one */
+	int		KeepAlive;	/* 1 means the connection stays open afterwards */
+	int		RequestLength;	/* Bytes of this request in the receive queue */
+	unsigned long	IdleTimeout;	/* jiffies; an idle kept-alive connection is
+					   closed after this, 0 for a new connection */
 	
 	/* Wait queue */
 	
@@ -33,7 +39,7 @@ struct http_request
 	char		Agent[128];	/* The agent-string of the remote browser */
 	char		IMS[128];	/* If-modified-since time, rfc string format */
 	char		Host[128];	/* Value given by the Host: header */
-	int		HTTPVER;        /* HTTP-version; 9 for 0.9,   10 for 1.0 and above */
+	int		HTTPVER;        /* HTTP-version; 9 for 0.9, 10 for 1.0, 11 for 1.1 and above */
 
 
 	/* Derived date from the above fields */	
@@ -44,6 +50,9 @@ struct http_request
 					   based on the filename */
 	__kernel_size_t	MimeLength;	/* The length of this string */
 	
+	char		ReplyHeader[KHTTPD_REPLYHEADER]; /* Content-type, Last-modified
+					   and Content-length lines, from the header cache */
+	int		ReplyHeaderLength;
 };
 
 
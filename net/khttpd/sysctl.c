@@ -45,6 +45,7 @@ Sysctl interface
 
 #include <linux/file.h>
 #include "prototypes.h"
+#include "sysctl.h"
 
 
 
@@ -63,6 +64,7 @@ char	sysctl_khttpd_dynamicstring[200];
 int 	sysctl_khttpd_sloppymime= 0;
 int	sysctl_khttpd_threads	= 2;
 int	sysctl_khttpd_maxconnect = 1000;
+int	sysctl_khttpd_keepalive	= 15;	/* seconds, 0 disables keep-alive */
 
 
 static struct ctl_table_header *khttpd_table_header;
@@ -147,6 +149,42 @@ static ctl_table khttpd_table[] = {
 		NULL,
 		NULL
 	},
+	{	NET_KHTTPD_KEEPALIVE,
+		"keepalive",
+		&sysctl_khttpd_keepalive,
+		sizeof(int),
+		0644,
+		NULL,
+		proc_dointvec,
+		&sysctl_intvec,
+		NULL,
+		NULL,
+		NULL
+	},
+	{	NET_KHTTPD_CACHEHITS,
+		"cache_hits",
+		&sysctl_khttpd_cache_hits,
+		sizeof(int),
+		0444,
+		NULL,
+		proc_dointvec,
+		&sysctl_intvec,
+		NULL,
+		NULL,
+		NULL
+	},
+	{	NET_KHTTPD_CACHEMISSES,
+		"cache_misses",
+		&sysctl_khttpd_cache_misses,
+		sizeof(int),
+		0444,
+		NULL,
+		proc_dointvec,
+		&sysctl_intvec,
+		NULL,
+		NULL,
+		NULL
+	},
 	{	NET_KHTTPD_SLOPPYMIME,
 		"sloppymime",
 		&sysctl_khttpd_sloppymime,
@@ -13,5 +13,8 @@ extern int 	sysctl_khttpd_serverport;
 extern int 	sysctl_khttpd_sloppymime;
 extern int 	sysctl_khttpd_threads;
 extern int	sysctl_khttpd_maxconnect;
+extern int	sysctl_khttpd_keepalive;
+extern int	sysctl_khttpd_cache_hits;
+extern int	sysctl_khttpd_cache_misses;
 
 #endif
@@ -44,6 +44,7 @@ Return value:
 
 #include "structure.h"
 #include "prototypes.h"
+#include "sysctl.h"
 
 static	char			*Buffer[CONFIG_KHTTPD_NUMCPU];
 
@@ -86,9 +87,28 @@ int WaitForHeaders(const int CPUNR)
 		
 		
 		
+		sk = CurrentRequest->sock->sk;
+		
+		/* A kept-alive connection that stays idle too long is closed */
+		
+		if (CurrentRequest->IdleTimeout!=0 &&
+		    (time_after(jiffies,CurrentRequest->IdleTimeout) ||
+		     (sk->state==TCP_CLOSE_WAIT && skb_queue_empty(&(sk->receive_queue)))))
+		{
+			struct http_request *Next;
+			
+			Next = CurrentRequest->Next;
+			
+			*Prev = CurrentRequest->Next;
+			CurrentRequest->Next = NULL;
+			
+			CleanUpRequest(CurrentRequest);
+			CurrentRequest = Next;
+			continue;
+		}
+		
 		/* If data pending, take action */	
 		
-		sk = CurrentRequest->sock->sk;
 		
 		if (!skb_queue_empty(&(sk->receive_queue))) /* Do we have data ? */
 		{
@@ -100,6 +120,7 @@ int WaitForHeaders(const int CPUNR)
 			
 			if (DecodeHeader(CPUNR,CurrentRequest)<0)
 			{
+				Prev = &(CurrentRequest->Next);
 				CurrentRequest = CurrentRequest->Next;
 				continue;
 			} 
@@ -210,15 +231,25 @@ static int DecodeHeader(const int CPUNR, struct http_request *Request)
 		return 0;
 	}
 	
+	Buffer[CPUNR][len] = 0;
+	
 	/* Then, decode the header */
 	
 	
 	ParseHeader(Buffer[CPUNR],len,Request);
 	
-	Request->filp = OpenFileForSecurity(Request->FileName);
+	/* A HTTP/1.x header is not complete before the empty line, wait for
+	   the rest of it */
+	if ((Request->RequestLength==0)&&(Request->HTTPVER!=9))
+	{
+		LeaveFunction("DecodeHeader - incomplete");
+		return -1;
+	}
 	
+	if ((Request->RequestLength==0)||(sysctl_khttpd_keepalive<=0))
+		Request->KeepAlive = 0;
 	
-	Request->MimeType = ResolveMimeType(Request->FileName,&Request->MimeLength);
+	OpenFileCached(Request);
 	
 	
 	if (Request->MimeType==NULL) /* Unknown mime-type */
@@ -243,14 +274,10 @@ static int DecodeHeader(const int CPUNR, struct http_request *Request)
 		Request->FileLength = (int)Request->filp->f_dentry->d_inode->i_size;
 		Request->Time       = Request->filp->f_dentry->d_inode->i_mtime;
 		Request->IMS_Time   = mimeTime_to_UnixTime(Request->IMS);
-		sprintf(Request->LengthS,"%i",Request->FileLength);
-		time_Unix2RFC(min(Request->Time,CurrentTime_i),Request->TimeS);
-   	        /* The min() is required by rfc1945, section 10.10:
-   	           It is not allowed to send a filetime in the future */
 
 		if (Request->IMS_Time>Request->Time)
 		{	/* Not modified since last time */
-			Send304(Request->sock);
+			Send304(Request->sock,Request->KeepAlive);
 			Request->FileLength=0;
 		}
 		else   /* Normal Case */
@@ -258,6 +285,8 @@ static int DecodeHeader(const int CPUNR, struct http_request *Request)
 			Request->sock->sk->tp_pinfo.af_tcp.nonagle = 2; /* this is TCP_CORK */
 			if (Request->HTTPVER!=9)  /* HTTP/0.9 doesn't allow a header */
 				SendHTTPHeader(Request);
+			else
+				Request->KeepAlive = 0;
 		}
 		
 	
@@ -268,6 +297,91 @@ static int DecodeHeader(const int CPUNR, struct http_request *Request)
 }
 
 
+/*
+
+KeepAliveRequest prepares a finished request for the next one on the same
+connection: the header of the request that was just served is consumed
+from the socket (it was only peeked at), the per-request fields are reset
+and the request goes back to the WaitForHeaderQueue. Pipelined requests
+are already in the receive queue and are decoded on the next pass.
+
+Returns 0 on success; on failure the caller should clean up the request.
+
+*/
+
+int KeepAliveRequest(const int CPUNR, struct http_request *Request)
+{
+	struct msghdr		msg;
+	struct iovec		iov;
+	int			len;
+	
+	mm_segment_t		oldfs;
+	
+	EnterFunction("KeepAliveRequest");
+	
+	if (Request->sock->sk->state != TCP_ESTABLISHED)
+		return -1;
+	
+	while (Request->RequestLength>0)
+	{
+		msg.msg_name     = 0;
+		msg.msg_namelen  = 0;
+		msg.msg_iov	 = &iov;
+		msg.msg_iovlen   = 1;
+		msg.msg_control  = NULL;
+		msg.msg_controllen = 0;
+		msg.msg_flags    = MSG_DONTWAIT;
+		
+		msg.msg_iov->iov_base = &Buffer[CPUNR][0];
+		msg.msg_iov->iov_len  = (size_t)Request->RequestLength;
+		
+		oldfs = get_fs(); set_fs(KERNEL_DS);
+		len = sock_recvmsg(Request->sock,&msg,Request->RequestLength,MSG_DONTWAIT);
+		set_fs(oldfs);
+		
+		if (len<=0)
+		{
+			LeaveFunction("KeepAliveRequest - abort");
+			return -1;
+		}
+		Request->RequestLength -= len;
+	}
+	
+	if (Request->filp!=NULL)
+	{
+		fput(Request->filp);
+		Request->filp = NULL;
+	}
+	
+	Request->FileLength	= 0;
+	Request->Time		= 0;
+	Request->BytesSent	= 0;
+	Request->IsForUserspace	= 0;
+	Request->KeepAlive	= 0;
+	Request->FileNameLength	= 0;
+	Request->HTTPVER	= 0;
+	Request->IMS_Time	= 0;
+	Request->MimeType	= NULL;
+	Request->MimeLength	= 0;
+	Request->ReplyHeaderLength = 0;
+	/* ParseHeader relies on these being zero-filled */
+	memset(Request->FileName,0,sizeof(Request->FileName));
+	memset(Request->Agent,0,sizeof(Request->Agent));
+	memset(Request->IMS,0,sizeof(Request->IMS));
+	memset(Request->Host,0,sizeof(Request->Host));
+	
+	Request->IdleTimeout = jiffies + sysctl_khttpd_keepalive*HZ;
+	if (Request->IdleTimeout==0)
+		Request->IdleTimeout = 1;
+	
+	Request->Next = threadinfo[CPUNR].WaitForHeaderQueue;
+	threadinfo[CPUNR].WaitForHeaderQueue = Request;
+	
+	LeaveFunction("KeepAliveRequest");
+	return 0;
+}
+
+
 int InitWaitHeaders(int ThreadCount)
 {
 	int I,I2;
@@ -526,6 +526,29 @@ void netlink_broadcast(struct sock *ssk, struct sk_buff *skb, u32 pid,
 	kfree_skb(skb);
 }
 
+/* Would netlink_broadcast() deliver anything?  Lets senders of
+ * notifications skip building a message nobody is going to read.
+ */
+int netlink_has_listeners(struct sock *ssk, u32 pid, u32 group)
+{
+	struct sock *sk;
+	int protocol = ssk->protocol;
+	int found = 0;
+
+	read_lock(&nl_table_lock);
+	for (sk = nl_table[protocol]; sk; sk = sk->next) {
+		if (ssk == sk)
+			continue;
+		if (sk->protinfo.af_netlink->pid != pid &&
+		    (sk->protinfo.af_netlink->groups&group)) {
+			found = 1;
+			break;
+		}
+	}
+	read_unlock(&nl_table_lock);
+	return found;
+}
+
 void netlink_set_err(struct sock *ssk, u32 pid, u32 group, int code)
 {
 	struct sock *sk;
@@ -109,6 +109,7 @@ EXPORT_SYMBOL(sock_setsockopt);
 EXPORT_SYMBOL(sock_getsockopt);
 EXPORT_SYMBOL(sock_sendmsg);
 EXPORT_SYMBOL(sock_recvmsg);
+EXPORT_SYMBOL(sock_receive_file);
 EXPORT_SYMBOL(sk_alloc);
 EXPORT_SYMBOL(sk_free);
 EXPORT_SYMBOL(sock_wake_async);
@@ -127,6 +128,7 @@ EXPORT_SYMBOL(sock_no_shutdown);
 EXPORT_SYMBOL(sock_no_getsockopt);
 EXPORT_SYMBOL(sock_no_setsockopt);
 EXPORT_SYMBOL(sock_no_sendmsg);
+EXPORT_SYMBOL(sock_no_sendpage);
 EXPORT_SYMBOL(sock_no_recvmsg);
 EXPORT_SYMBOL(sock_no_mmap);
 EXPORT_SYMBOL(sock_rfree);
@@ -148,6 +150,7 @@ EXPORT_SYMBOL(sk_run_filter);
 #endif
 
 EXPORT_SYMBOL(neigh_table_init);
+EXPORT_SYMBOL(neigh_hash_init);
 EXPORT_SYMBOL(neigh_table_clear);
 EXPORT_SYMBOL(neigh_resolve_output);
 EXPORT_SYMBOL(neigh_connected_output);
@@ -277,6 +280,8 @@ EXPORT_SYMBOL(inet_shutdown);
 EXPORT_SYMBOL(inet_setsockopt);
 EXPORT_SYMBOL(inet_getsockopt);
 EXPORT_SYMBOL(inet_sendmsg);
+EXPORT_SYMBOL(inet_sendpage);
+EXPORT_SYMBOL(inet_receive_file);
 EXPORT_SYMBOL(inet_recvmsg);
 #ifdef INET_REFCNT_DEBUG
 EXPORT_SYMBOL(inet_sock_nr);
@@ -323,8 +328,14 @@ EXPORT_SYMBOL(tcp_statistics);
 EXPORT_SYMBOL(tcp_rcv_state_process);
 EXPORT_SYMBOL(tcp_timewait_state_process);
 EXPORT_SYMBOL(tcp_timewait_cachep);
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+EXPORT_SYMBOL(tcp6_timewait_cachep);
+#endif
 EXPORT_SYMBOL(tcp_timewait_kill);
 EXPORT_SYMBOL(tcp_sendmsg);
+EXPORT_SYMBOL(tcp_sendpage);
+EXPORT_SYMBOL(tcp_receive_file);
+EXPORT_SYMBOL(tcp_read_sock);
 EXPORT_SYMBOL(tcp_v4_rebuild_header);
 EXPORT_SYMBOL(tcp_v4_send_check);
 EXPORT_SYMBOL(tcp_v4_conn_request);
@@ -385,6 +396,7 @@ EXPORT_SYMBOL(secure_ipv6_id);
 #ifdef CONFIG_NETLINK
 EXPORT_SYMBOL(netlink_set_err);
 EXPORT_SYMBOL(netlink_broadcast);
+EXPORT_SYMBOL(netlink_has_listeners);
 EXPORT_SYMBOL(netlink_unicast);
 EXPORT_SYMBOL(netlink_kernel_create);
 EXPORT_SYMBOL(netlink_dump_start);
@@ -478,7 +490,17 @@ EXPORT_SYMBOL(alloc_skb);
 EXPORT_SYMBOL(__kfree_skb);
 EXPORT_SYMBOL(skb_clone);
 EXPORT_SYMBOL(skb_copy);
+EXPORT_SYMBOL(pskb_expand_head);
+EXPORT_SYMBOL(skb_linearize);
+EXPORT_SYMBOL(___pskb_trim);
+EXPORT_SYMBOL(skb_copy_bits);
+EXPORT_SYMBOL(skb_checksum);
+EXPORT_SYMBOL(skb_tso_segment);
+EXPORT_SYMBOL(skb_recycle_pool_create);
+EXPORT_SYMBOL(skb_recycle_pool_destroy);
+EXPORT_SYMBOL(alloc_skb_recycle);
 EXPORT_SYMBOL(netif_rx);
+EXPORT_SYMBOL(netif_receive_skb);
 EXPORT_SYMBOL(dev_add_pack);
 EXPORT_SYMBOL(dev_remove_pack);
 EXPORT_SYMBOL(dev_get);
@@ -490,6 +512,7 @@ EXPORT_SYMBOL(dev_load);
 #endif
 EXPORT_SYMBOL(dev_ioctl);
 EXPORT_SYMBOL(dev_queue_xmit);
+EXPORT_SYMBOL(skb_checksum_help);
 #ifdef CONFIG_NET_HW_FLOWCONTROL
 EXPORT_SYMBOL(netdev_dropping);
 EXPORT_SYMBOL(netdev_register_fc);
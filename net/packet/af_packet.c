@@ -168,17 +168,49 @@ struct packet_mclist
 };
 #endif
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing);
+static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing, int tx);
 #endif
 
 static void packet_flush_mclist(struct sock *sk);
 
+/*
+   Fanout groups.
+
+   Sockets bound to the same device and protocol may join a group.
+   The group then owns a single hook in the device list; every packet
+   is handed to exactly one running member, chosen by flow hash, round
+   robin or receiving CPU, through the member's own receive routine,
+   so a member with an RX ring still gets its frames in the ring.
+
+   fanout_lock serializes membership changes and the group hook;
+   f->lock only keeps the member array stable under packet_rcv_fanout.
+ */
+
+#define PACKET_FANOUT_MAX	256
+
+struct packet_fanout
+{
+	struct packet_fanout	*next;
+	unsigned int		id;
+	unsigned int		type;
+	int			refcnt;		/* sockets in the group	*/
+	unsigned int		rr_cur;
+	struct packet_type	prot_hook;
+	rwlock_t		lock;
+	unsigned int		num_members;	/* running members	*/
+	struct sock		*arr[PACKET_FANOUT_MAX];
+};
+
+static struct packet_fanout *fanout_list;
+static spinlock_t fanout_lock = SPIN_LOCK_UNLOCKED;
+
 struct packet_opt
 {
 	struct packet_type	prot_hook;
 	spinlock_t		bind_lock;
 	char			running;	/* prot_hook is attached*/
 	int			ifindex;	/* bound device		*/
+	struct packet_fanout	*fanout;
 	struct tpacket_stats	stats;
 #ifdef CONFIG_PACKET_MULTICAST
 	struct packet_mclist	*mclist;
@@ -195,6 +227,16 @@ struct packet_opt
 	unsigned int		iovmax;
 	unsigned int		head;
 	int			copy_thresh;
+
+	unsigned long		*tx_pg_vec;
+	unsigned int		tx_pg_vec_order;
+	unsigned int		tx_pg_vec_pages;
+	unsigned int		tx_pg_vec_len;
+
+	struct tpacket_hdr	**tx_iovec;
+	unsigned int		tx_frame_size;
+	unsigned int		tx_iovmax;
+	unsigned int		tx_head;
 #endif
 };
 
@@ -440,7 +482,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,  struct packe
 
 		bh_lock_sock(sk);
 		if ((filter = sk->filter) != NULL)
-			res = sk_run_filter(skb, sk->filter->insns, sk->filter->len);
+			res = SK_RUN_FILTER(sk->filter, skb);
 		bh_unlock_sock(sk);
 
 		if (res == 0)
@@ -545,7 +587,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,  struct pack
 
 		bh_lock_sock(sk);
 		if ((filter = sk->filter) != NULL)
-			res = sk_run_filter(skb, sk->filter->insns, sk->filter->len);
+			res = SK_RUN_FILTER(sk->filter, skb);
 		bh_unlock_sock(sk);
 
 		if (res == 0)
@@ -640,6 +682,303 @@ ring_is_full:
 
 #endif
 
+/*
+ *	Symmetric flow hash: both directions of a TCP or UDP conversation
+ *	go to the same member. Anything that is not IPv4 hashes on the
+ *	protocol alone.
+ */
+
+static unsigned int packet_fanout_hash(struct sk_buff *skb)
+{
+	struct iphdr *iph = skb->nh.iph;
+	u32 h;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb->nh.raw + sizeof(struct iphdr) > skb->tail)
+		return ntohs(skb->protocol);
+
+	h = iph->saddr ^ iph->daddr ^ iph->protocol;
+	if (!(iph->frag_off & htons(IP_MF|IP_OFFSET)) &&
+	    (iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP)) {
+		u16 *ports = (u16*)(skb->nh.raw + iph->ihl*4);
+
+		if ((u8*)(ports + 2) <= skb->tail)
+			h ^= ports[0] ^ ports[1];
+	}
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h;
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,  struct packet_type *pt)
+{
+	struct packet_fanout *f = (struct packet_fanout *) pt->data;
+	struct packet_opt *po;
+	unsigned int num, idx;
+
+	read_lock(&f->lock);
+	num = f->num_members;
+	if (num == 0) {
+		read_unlock(&f->lock);
+		kfree_skb(skb);
+		return 0;
+	}
+
+	switch (f->type) {
+	case PACKET_FANOUT_LB:
+		/* Unlocked on purpose, a lost update only skews the rotation */
+		idx = f->rr_cur++ % num;
+		break;
+	case PACKET_FANOUT_CPU:
+		idx = smp_processor_id() % num;
+		break;
+	default:
+		idx = packet_fanout_hash(skb) % num;
+		break;
+	}
+
+	po = f->arr[idx]->protinfo.af_packet;
+	po->prot_hook.func(skb, dev, &po->prot_hook);
+	read_unlock(&f->lock);
+	return 0;
+}
+
+static void packet_fanout_link(struct sock *sk)
+{
+	struct packet_fanout *f = sk->protinfo.af_packet->fanout;
+
+	spin_lock(&fanout_lock);
+	write_lock_bh(&f->lock);
+	f->arr[f->num_members++] = sk;
+	write_unlock_bh(&f->lock);
+	if (f->num_members == 1)
+		dev_add_pack(&f->prot_hook);
+	spin_unlock(&fanout_lock);
+}
+
+static void packet_fanout_unlink(struct sock *sk)
+{
+	struct packet_fanout *f = sk->protinfo.af_packet->fanout;
+	unsigned int i;
+
+	spin_lock(&fanout_lock);
+	write_lock_bh(&f->lock);
+	for (i = 0; i < f->num_members; i++)
+		if (f->arr[i] == sk)
+			break;
+	BUG_TRAP(i < f->num_members);
+	if (i < f->num_members)
+		f->arr[i] = f->arr[--f->num_members];
+	write_unlock_bh(&f->lock);
+	if (f->num_members == 0)
+		dev_remove_pack(&f->prot_hook);
+	spin_unlock(&fanout_lock);
+}
+
+/*
+ *	Attach/detach the receive path of a socket: its own hook,
+ *	or its slot in the fanout group. Caller holds bind_lock.
+ */
+
+static void packet_hook_add(struct sock *sk)
+{
+	struct packet_opt *po = sk->protinfo.af_packet;
+
+	if (po->fanout)
+		packet_fanout_link(sk);
+	else
+		dev_add_pack(&po->prot_hook);
+}
+
+static void packet_hook_remove(struct sock *sk)
+{
+	struct packet_opt *po = sk->protinfo.af_packet;
+
+	if (po->fanout)
+		packet_fanout_unlink(sk);
+	else
+		dev_remove_pack(&po->prot_hook);
+}
+
+static int packet_fanout_add(struct sock *sk, int val)
+{
+	struct packet_opt *po = sk->protinfo.af_packet;
+	struct packet_fanout *f, *nf;
+	unsigned int id = val & 0xffff;
+	unsigned int type = (val >> 16) & 0xffff;
+	int err;
+
+	if (type > PACKET_FANOUT_CPU)
+		return -EINVAL;
+
+	nf = kmalloc(sizeof(struct packet_fanout), GFP_KERNEL);
+	if (nf == NULL)
+		return -ENOMEM;
+
+	lock_sock(sk);
+	spin_lock(&po->bind_lock);
+
+	/* The group takes device and protocol from the first bound member */
+	err = -EINVAL;
+	if (!po->running)
+		goto out;
+	err = -EALREADY;
+	if (po->fanout)
+		goto out;
+
+	spin_lock(&fanout_lock);
+	for (f = fanout_list; f; f = f->next)
+		if (f->id == id)
+			break;
+
+	err = -EINVAL;
+	if (f == NULL) {
+		f = nf;
+		nf = NULL;
+		memset(f, 0, sizeof(struct packet_fanout));
+		f->id = id;
+		f->type = type;
+		f->lock = RW_LOCK_UNLOCKED;
+		f->prot_hook.type = po->prot_hook.type;
+		f->prot_hook.dev = po->prot_hook.dev;
+		f->prot_hook.func = packet_rcv_fanout;
+		f->prot_hook.data = (void *)f;
+		f->next = fanout_list;
+		fanout_list = f;
+	} else if (f->type != type ||
+		   f->prot_hook.type != po->prot_hook.type ||
+		   f->prot_hook.dev != po->prot_hook.dev) {
+		spin_unlock(&fanout_lock);
+		goto out;
+	} else if (f->refcnt == PACKET_FANOUT_MAX) {
+		spin_unlock(&fanout_lock);
+		err = -ENOSPC;
+		goto out;
+	}
+	f->refcnt++;
+	spin_unlock(&fanout_lock);
+
+	dev_remove_pack(&po->prot_hook);
+	po->fanout = f;
+	packet_fanout_link(sk);
+	err = 0;
+
+out:
+	spin_unlock(&po->bind_lock);
+	release_sock(sk);
+	if (nf)
+		kfree(nf);
+	return err;
+}
+
+/* Called on close, once the socket is no longer a running member */
+static void packet_fanout_release(struct sock *sk)
+{
+	struct packet_opt *po = sk->protinfo.af_packet;
+	struct packet_fanout *f = po->fanout, **fp;
+
+	if (f == NULL)
+		return;
+	po->fanout = NULL;
+
+	spin_lock(&fanout_lock);
+	if (--f->refcnt == 0) {
+		for (fp = &fanout_list; *fp; fp = &(*fp)->next) {
+			if (*fp == f) {
+				*fp = f->next;
+				break;
+			}
+		}
+	} else
+		f = NULL;
+	spin_unlock(&fanout_lock);
+
+	if (f)
+		kfree(f);
+}
+
+#ifdef CONFIG_PACKET_MMAP
+/*
+ *	Send every frame of the TX ring which the user marked with
+ *	TP_STATUS_SEND_REQUEST, starting at tx_head. Frames are copied
+ *	out, so a slot is given back as soon as its skb is queued.
+ */
+
+static int tpacket_snd(struct socket *sock, struct net_device *dev,
+		       unsigned short proto, unsigned char *addr,
+		       int reserve, int noblock)
+{
+	struct sock *sk = sock->sk;
+	struct packet_opt *po = sk->protinfo.af_packet;
+	struct tpacket_hdr *h;
+	struct sk_buff *skb;
+	int len, sent = 0, err = 0;
+
+	if (!(dev->flags & IFF_UP))
+		return -ENETDOWN;
+
+	lock_sock(sk);
+	while (po->tx_iovec) {
+		h = po->tx_iovec[po->tx_head];
+		if (h->tp_status != TP_STATUS_SEND_REQUEST)
+			break;
+		rmb();
+		h->tp_status = TP_STATUS_SENDING;
+
+		len = h->tp_len;
+		if (len <= 0 || len > dev->mtu+reserve ||
+		    len > po->tx_frame_size - TPACKET_TX_HDRLEN)
+			goto wrong_format;
+
+		skb = sock_alloc_send_skb(sk, len+dev->hard_header_len+15, 0,
+					  noblock, &err);
+		if (skb == NULL) {
+			/* Leave it for the next send() */
+			h->tp_status = TP_STATUS_SEND_REQUEST;
+			break;
+		}
+
+		skb_reserve(skb, (dev->hard_header_len+15)&~15);
+		skb->nh.raw = skb->data;
+
+		if (dev->hard_header) {
+			int res;
+			res = dev->hard_header(skb, dev, ntohs(proto), addr, NULL, len);
+			if (sock->type != SOCK_DGRAM) {
+				skb->tail = skb->data;
+				skb->len = 0;
+			} else if (res < 0) {
+				kfree_skb(skb);
+				goto wrong_format;
+			}
+		}
+
+		memcpy(skb_put(skb, len), (u8*)h + TPACKET_TX_HDRLEN, len);
+
+		skb->protocol = proto;
+		skb->dev = dev;
+		skb->priority = sk->priority;
+
+		mb();
+		h->tp_status = TP_STATUS_AVAILABLE;
+		po->tx_head = po->tx_head != po->tx_iovmax ? po->tx_head+1 : 0;
+
+		err = dev_queue_xmit(skb);
+		if (err > 0 && (err = net_xmit_errno(err)) != 0)
+			break;
+		sent += len;
+		continue;
+
+wrong_format:
+		mb();
+		h->tp_status = TP_STATUS_WRONG_FORMAT;
+		po->tx_head = po->tx_head != po->tx_iovmax ? po->tx_head+1 : 0;
+	}
+	release_sock(sk);
+
+	return sent ? sent : err;
+}
+#endif
 
 static int packet_sendmsg(struct socket *sock, struct msghdr *msg, int len,
 			  struct scm_cookie *scm)
@@ -677,6 +1016,14 @@ static int packet_sendmsg(struct socket *sock, struct msghdr *msg, int len,
 	if (sock->type == SOCK_RAW)
 		reserve = dev->hard_header_len;
 
+#ifdef CONFIG_PACKET_MMAP
+	if (sk->protinfo.af_packet->tx_iovec) {
+		err = tpacket_snd(sock, dev, proto, addr, reserve,
+				  msg->msg_flags & MSG_DONTWAIT);
+		goto out_unlock;
+	}
+#endif
+
 	err = -EMSGSIZE;
 	if (len > dev->mtu+reserve)
 		goto out_unlock;
@@ -765,10 +1112,11 @@ static int packet_release(struct socket *sock)
 		/*
 		 *	Remove the protocol hook
 		 */
-		dev_remove_pack(&sk->protinfo.af_packet->prot_hook);
+		packet_hook_remove(sk);
 		sk->protinfo.af_packet->running = 0;
 		__sock_put(sk);
 	}
+	packet_fanout_release(sk);
 
 #ifdef CONFIG_PACKET_MULTICAST
 	packet_flush_mclist(sk);
@@ -778,7 +1126,12 @@ static int packet_release(struct socket *sock)
 	if (sk->protinfo.af_packet->pg_vec) {
 		struct tpacket_req req;
 		memset(&req, 0, sizeof(req));
-		packet_set_ring(sk, &req, 1);
+		packet_set_ring(sk, &req, 1, 0);
+	}
+	if (sk->protinfo.af_packet->tx_pg_vec) {
+		struct tpacket_req req;
+		memset(&req, 0, sizeof(req));
+		packet_set_ring(sk, &req, 1, 1);
 	}
 #endif
 
@@ -810,6 +1163,11 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, int protocol)
 	lock_sock(sk);
 
 	spin_lock(&sk->protinfo.af_packet->bind_lock);
+	if (sk->protinfo.af_packet->fanout) {
+		spin_unlock(&sk->protinfo.af_packet->bind_lock);
+		release_sock(sk);
+		return -EINVAL;
+	}
 	if (sk->protinfo.af_packet->running) {
 		dev_remove_pack(&sk->protinfo.af_packet->prot_hook);
 		__sock_put(sk);
@@ -1278,6 +1636,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char *optval, int
 #endif
 #ifdef CONFIG_PACKET_MMAP
 	case PACKET_RX_RING:
+	case PACKET_TX_RING:
 	{
 		struct tpacket_req req;
 
@@ -1285,7 +1644,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char *optval, int
 			return -EINVAL;
 		if (copy_from_user(&req,optval,sizeof(req)))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0);
+		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1300,6 +1659,16 @@ packet_setsockopt(struct socket *sock, int level, int optname, char *optval, int
 		return 0;
 	}
 #endif
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen!=sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val,optval,sizeof(val)))
+			return -EFAULT;
+		return packet_fanout_add(sk, val);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1334,6 +1703,17 @@ int packet_getsockopt(struct socket *sock, int level, int optname,
 			return -EFAULT;
 		break;
 	}
+	case PACKET_FANOUT:
+	{
+		struct packet_fanout *f = sk->protinfo.af_packet->fanout;
+		int val = f ? (f->id | (f->type << 16)) : 0;
+
+		if (len > sizeof(int))
+			len = sizeof(int);
+		if (copy_to_user(optval, &val, len))
+			return -EFAULT;
+		break;
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1360,7 +1740,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					dev_remove_pack(&po->prot_hook);
+					packet_hook_remove(sk);
 					__sock_put(sk);
 					po->running = 0;
 					sk->err = ENETDOWN;
@@ -1381,7 +1761,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 		case NETDEV_UP:
 			spin_lock(&po->bind_lock);
 			if (dev->ifindex == po->ifindex && sk->num && po->running==0) {
-				dev_add_pack(&po->prot_hook);
+				packet_hook_add(sk);
 				sock_hold(sk);
 				po->running = 1;
 			}
@@ -1597,7 +1977,7 @@ static void free_pg_vec(unsigned long *pg_vec, unsigned order, unsigned len)
 }
 
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing)
+static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing, int tx)
 {
 	unsigned long *pg_vec = NULL;
 	struct tpacket_hdr **io_vec = NULL;
@@ -1661,7 +2041,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 
 			for (k=0; k<frames_per_block; k++, l++) {
 				io_vec[l] = (struct tpacket_hdr*)ptr;
-				io_vec[l]->tp_status = TP_STATUS_KERNEL;
+				io_vec[l]->tp_status = tx ? TP_STATUS_AVAILABLE :
+							    TP_STATUS_KERNEL;
 				ptr += req->tp_frame_size;
 			}
 		}
@@ -1674,39 +2055,57 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 	lock_sock(sk);
 
 	/* Detach socket from network */
-	spin_lock(&po->bind_lock);
-	if (po->running)
-		dev_remove_pack(&po->prot_hook);
-	spin_unlock(&po->bind_lock);
+	if (!tx) {
+		spin_lock(&po->bind_lock);
+		if (po->running)
+			packet_hook_remove(sk);
+		spin_unlock(&po->bind_lock);
+	}
 
 	err = -EBUSY;
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 
-		spin_lock_bh(&sk->receive_queue.lock);
-		pg_vec = XC(po->pg_vec, pg_vec);
-		io_vec = XC(po->iovec, io_vec);
-		po->iovmax = req->tp_frame_nr-1;
-		po->head = 0;
-		po->frame_size = req->tp_frame_size;
-		spin_unlock_bh(&sk->receive_queue.lock);
+		if (!tx) {
+			spin_lock_bh(&sk->receive_queue.lock);
+			pg_vec = XC(po->pg_vec, pg_vec);
+			io_vec = XC(po->iovec, io_vec);
+			po->iovmax = req->tp_frame_nr-1;
+			po->head = 0;
+			po->frame_size = req->tp_frame_size;
+			spin_unlock_bh(&sk->receive_queue.lock);
 
-		order = XC(po->pg_vec_order, order);
-		req->tp_block_nr = XC(po->pg_vec_len, req->tp_block_nr);
+			order = XC(po->pg_vec_order, order);
+			req->tp_block_nr = XC(po->pg_vec_len, req->tp_block_nr);
 
-		po->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
-		po->prot_hook.func = po->iovec ? tpacket_rcv : packet_rcv;
-		skb_queue_purge(&sk->receive_queue);
+			po->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
+			po->prot_hook.func = po->iovec ? tpacket_rcv : packet_rcv;
+			skb_queue_purge(&sk->receive_queue);
+		} else {
+			/* Senders hold the socket lock, nothing else looks */
+			pg_vec = XC(po->tx_pg_vec, pg_vec);
+			io_vec = XC(po->tx_iovec, io_vec);
+			po->tx_iovmax = req->tp_frame_nr-1;
+			po->tx_head = 0;
+			po->tx_frame_size = req->tp_frame_size;
+
+			order = XC(po->tx_pg_vec_order, order);
+			req->tp_block_nr = XC(po->tx_pg_vec_len, req->tp_block_nr);
+
+			po->tx_pg_vec_pages = req->tp_block_size/PAGE_SIZE;
+		}
 #undef XC
 		if (atomic_read(&po->mapped))
 			printk(KERN_DEBUG "packet_mmap: vma is busy: %d\n", atomic_read(&po->mapped));
 	}
 
-	spin_lock(&po->bind_lock);
-	if (po->running)
-		dev_add_pack(&po->prot_hook);
-	spin_unlock(&po->bind_lock);
+	if (!tx) {
+		spin_lock(&po->bind_lock);
+		if (po->running)
+			packet_hook_add(sk);
+		spin_unlock(&po->bind_lock);
+	}
 
 	release_sock(sk);
 
@@ -1734,10 +2133,12 @@ static int packet_mmap(struct file *file, struct socket *sock, struct vm_area_st
 
 	size = vma->vm_end - vma->vm_start;
 
+	/* The RX ring comes first, the TX ring right behind it */
 	lock_sock(sk);
-	if (po->pg_vec == NULL)
+	if (po->pg_vec == NULL && po->tx_pg_vec == NULL)
 		goto out;
-	if (size != po->pg_vec_len*po->pg_vec_pages*PAGE_SIZE)
+	if (size != (po->pg_vec_len*po->pg_vec_pages +
+		     po->tx_pg_vec_len*po->tx_pg_vec_pages)*PAGE_SIZE)
 		goto out;
 
 	atomic_inc(&po->mapped);
@@ -1750,6 +2151,13 @@ static int packet_mmap(struct file *file, struct socket *sock, struct vm_area_st
 			goto out;
 		start += po->pg_vec_pages*PAGE_SIZE;
 	}
+	for (i=0; i<po->tx_pg_vec_len; i++) {
+		if (remap_page_range(start, __pa(po->tx_pg_vec[i]),
+				     po->tx_pg_vec_pages*PAGE_SIZE,
+				     vma->vm_page_prot))
+			goto out;
+		start += po->tx_pg_vec_pages*PAGE_SIZE;
+	}
 	vma->vm_ops = &packet_mmap_ops;
 	err = 0;
 
@@ -23,6 +23,14 @@
  *	It is especially useful for link sharing combined with QoS;
  *	pure RSVP doesn't need such a general approach and can use
  *	much simpler (and faster) schemes, sort of cls_rsvp.c.
+ *
+ *	Nobody builds hash tables for thousands of "match ip dst X/32"
+ *	rules by hand, so the classifier does it itself: a long enough
+ *	run of consecutive nodes on one chain, each matching one whole
+ *	32bit word at the same offset, is indexed by that word.  The
+ *	walk jumps from the head of the run straight to the first node
+ *	with the packet's value, or past the run.  Match order is not
+ *	changed.
  */
 
 #include <asm/uaccess.h>
@@ -46,6 +54,7 @@
 #include <linux/etherdevice.h>
 #include <linux/notifier.h>
 #include <linux/rtnetlink.h>
+#include <linux/jhash.h>
 #include <net/ip.h>
 #include <net/route.h>
 #include <linux/skbuff.h>
@@ -63,9 +72,26 @@ struct tc_u_knode
 #endif
 	struct tcf_result	res;
 	struct tc_u_hnode	*ht_down;
+	struct tc_u_run		*run;	/* index of the run we are in */
 	struct tc_u32_sel	sel;
 };
 
+/* Index of a run of exact one word nodes: open addressing, filled in
+   list order, so equal values are met in list order too. */
+struct tc_u_run
+{
+	struct tc_u_run		*next;
+	unsigned		chain;	/* which chain of the hnode */
+	struct tc_u_knode	*head;
+	struct tc_u_knode	*end;	/* first node after the run */
+	int			off;
+	unsigned		mask;
+	struct tc_u_knode	*slot[0];
+};
+
+#define U32_RUN_MIN	8	/* shorter runs are walked */
+#define U32_RUN_MAX	(1<<14)	/* slots */
+
 struct tc_u_hnode
 {
 	struct tc_u_hnode	*next;
@@ -74,6 +100,7 @@ struct tc_u_hnode
 	int			refcnt;
 	unsigned		divisor;
 	u32			hgenerator;
+	struct tc_u_run		*runs;
 	struct tc_u_knode	*ht[1];
 };
 
@@ -97,6 +124,38 @@ static __inline__ unsigned u32_hash_fold(u32 key, struct tc_u32_sel *sel)
 	return h;
 }
 
+static __inline__ unsigned u32_run_hash(u32 val, struct tc_u_run *run)
+{
+	return jhash_1word(val, 0) & run->mask;
+}
+
+/* First node of the run holding val, after the node "after" if it is
+   given; the end of the run if there is none. */
+static struct tc_u_knode *
+u32_run_next(struct tc_u_run *run, u32 val, struct tc_u_knode *after)
+{
+	unsigned h = u32_run_hash(val, run);
+	struct tc_u_knode *n;
+
+	while ((n = run->slot[h]) != NULL) {
+		if (n == after)
+			after = NULL;
+		else if (after == NULL && n->sel.keys[0].val == val)
+			return n;
+		h = (h + 1) & run->mask;
+	}
+	return run->end;
+}
+
+/* Where to go after node n matched.  Inside a run only nodes with
+   the same value can match as well. */
+static __inline__ struct tc_u_knode *u32_next_knode(struct tc_u_knode *n)
+{
+	if (n->run == NULL)
+		return n->next;
+	return u32_run_next(n->run, n->sel.keys[0].val, n);
+}
+
 static int u32_classify(struct sk_buff *skb, struct tcf_proto *tp, struct tcf_result *res)
 {
 	struct {
@@ -122,8 +181,17 @@ next_ht:
 
 next_knode:
 	if (n) {
-		struct tc_u32_key *key = n->sel.keys;
+		struct tc_u32_key *key;
+
+		if (n->run && n->run->head == n) {
+			struct tc_u_run *run = n->run;
+
+			n = u32_run_next(run, *(u32*)(ptr+run->off), NULL);
+			if (n == run->end)
+				goto next_knode;
+		}
 
+		key = n->sel.keys;
 		for (i = n->sel.nkeys; i>0; i--, key++) {
 			if ((*(u32*)(ptr+key->off+(off2&key->offmask))^key->val)&key->mask) {
 				n = n->next;
@@ -143,7 +211,7 @@ check_terminal:
 #endif
 					return 0;
 			}
-			n = n->next;
+			n = u32_next_knode(n);
 			goto next_knode;
 		}
 
@@ -245,6 +313,122 @@ static void u32_put(struct tcf_proto *tp, unsigned long f)
 {
 }
 
+static __inline__ int u32_run_member(struct tc_u_knode *n)
+{
+	return n->sel.nkeys == 1 &&
+		n->sel.keys[0].mask == 0xFFFFFFFF &&
+		n->sel.keys[0].offmask == 0;
+}
+
+static struct tc_u_run *
+u32_build_run(unsigned chain, struct tc_u_knode *head,
+	      struct tc_u_knode *skip, int len)
+{
+	struct tc_u_run *run;
+	struct tc_u_knode *n;
+	unsigned size = 1;
+
+	while (size < len + len/2 && size < U32_RUN_MAX)
+		size <<= 1;
+	if (size < len + len/2)
+		return NULL;
+
+	run = kmalloc(sizeof(*run) + size*sizeof(void*), GFP_KERNEL);
+	if (run == NULL)
+		return NULL;
+	memset(run, 0, sizeof(*run) + size*sizeof(void*));
+	run->chain = chain;
+	run->head = head;
+	run->off = head->sel.keys[0].off;
+	run->mask = size - 1;
+
+	for (n = head; len; n = n->next) {
+		unsigned h;
+
+		if (n == skip)
+			continue;
+		h = u32_run_hash(n->sel.keys[0].val, run);
+		while (run->slot[h])
+			h = (h + 1) & run->mask;
+		run->slot[h] = n;
+		len--;
+	}
+	while (n == skip && n)
+		n = n->next;
+	run->end = n;
+	return run;
+}
+
+/* Rebuild the run indices of one chain, leaving out "skip", which the
+   caller is deleting; it is unlinked under the same lock as the new
+   indices go in, so the walk never sees a stale run end. */
+static void u32_reindex(struct tcf_proto *tp, struct tc_u_hnode *ht,
+			unsigned chain, struct tc_u_knode *skip)
+{
+	struct tc_u_run *runs = NULL, *old = NULL, **rp, *run;
+	struct tc_u_knode *n, *head, **kp;
+	int len;
+
+	n = ht->ht[chain];
+	while (n) {
+		if (n == skip || !u32_run_member(n)) {
+			n = n->next;
+			continue;
+		}
+		head = n;
+		len = 0;
+		for (; n; n = n->next) {
+			if (n == skip)
+				continue;
+			if (!u32_run_member(n) ||
+			    n->sel.keys[0].off != head->sel.keys[0].off)
+				break;
+			len++;
+		}
+		if (len >= U32_RUN_MIN &&
+		    (run = u32_build_run(chain, head, skip, len)) != NULL) {
+			run->next = runs;
+			runs = run;
+		}
+	}
+
+	tcf_tree_lock(tp);
+	if (skip) {
+		for (kp = &ht->ht[chain]; *kp; kp = &(*kp)->next) {
+			if (*kp == skip) {
+				*kp = skip->next;
+				break;
+			}
+		}
+	}
+	for (n = ht->ht[chain]; n; n = n->next)
+		n->run = NULL;
+	for (run = runs; run; run = run->next) {
+		for (n = run->head; n != run->end; n = n->next)
+			n->run = run;
+	}
+	for (rp = &ht->runs; (run = *rp) != NULL; ) {
+		if (run->chain == chain) {
+			*rp = run->next;
+			run->next = old;
+			old = run;
+		} else
+			rp = &run->next;
+	}
+	if (runs) {
+		for (run = runs; run->next; run = run->next)
+			;
+		run->next = ht->runs;
+		ht->runs = runs;
+	}
+	tcf_tree_unlock(tp);
+
+	while ((run = old) != NULL) {
+		old = run->next;
+		kfree(run);
+	}
+}
+
 static u32 gen_new_htid(struct tc_u_common *tp_c)
 {
 	int i = 0x800;
@@ -324,10 +508,7 @@ static int u32_delete_key(struct tcf_proto *tp, struct tc_u_knode* key)
 	if (ht) {
 		for (kp = &ht->ht[TC_U32_HASH(key->handle)]; *kp; kp = &(*kp)->next) {
 			if (*kp == key) {
-				tcf_tree_lock(tp);
-				*kp = key->next;
-				tcf_tree_unlock(tp);
-
+				u32_reindex(tp, ht, TC_U32_HASH(key->handle), key);
 				u32_destroy_key(tp, key);
 				return 0;
 			}
@@ -340,8 +521,14 @@ static int u32_delete_key(struct tcf_proto *tp, struct tc_u_knode* key)
 static void u32_clear_hnode(struct tcf_proto *tp, struct tc_u_hnode *ht)
 {
 	struct tc_u_knode *n;
+	struct tc_u_run *run;
 	unsigned h;
 
+	while ((run = ht->runs) != NULL) {
+		ht->runs = run->next;
+		kfree(run);
+	}
+
 	for (h=0; h<=ht->divisor; h++) {
 		while ((n = ht->ht[h]) != NULL) {
 			ht->ht[h] = n->next;
@@ -594,6 +781,9 @@ static int u32_change(struct tcf_proto *tp, unsigned long base, u32 handle,
 		wmb();
 		*ins = n;
 
+		/* It may start, extend or split a run. */
+		u32_reindex(tp, ht, TC_U32_HASH(handle), NULL);
+
 		*arg = (unsigned long)n;
 		return 0;
 	}
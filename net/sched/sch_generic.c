@@ -63,10 +63,37 @@ rwlock_t qdisc_tree_lock = RW_LOCK_UNLOCKED;
  */
 
 
+/* Packets dequeued at once for drivers with hard_start_xmit_batch */
+int netdev_tx_batch = 16;
+
+/* Put back a chain the driver did not take, keeping its order. */
+static void qdisc_requeue_chain(struct sk_buff *skb, struct Qdisc *q)
+{
+	struct sk_buff *prev = NULL;
+
+	while (skb) {
+		struct sk_buff *next = skb->next;
+
+		skb->next = prev;
+		prev = skb;
+		skb = next;
+	}
+	while (prev) {
+		struct sk_buff *next = prev->next;
+
+		prev->next = NULL;
+		q->ops->requeue(prev, q);
+		prev = next;
+	}
+}
+
 /* Kick device.
    Note, that this procedure can be called by a watchdog timer, so that
    we do not check dev->tbusy flag here.
 
+   A driver with hard_start_xmit_batch gets up to netdev_tx_batch
+   packets in one call, so that both locks are taken once per batch.
+
    Returns:  0  - queue is empty.
             >0  - queue is not empty, but throttled.
 	    <0  - queue is not empty. Device is throttled, if dev->tbusy != 0.
@@ -81,6 +108,14 @@ int qdisc_restart(struct net_device *dev)
 
 	/* Dequeue packet */
 	if ((skb = q->dequeue(q)) != NULL) {
+		if (dev->hard_start_xmit_batch) {
+			struct sk_buff *tail = skb;
+			int n = netdev_tx_batch;
+
+			while (--n > 0 && (tail->next = q->dequeue(q)) != NULL)
+				tail = tail->next;
+		}
+
 		if (spin_trylock(&dev->xmit_lock)) {
 			/* Remember that the driver is grabbed by us. */
 			dev->xmit_lock_owner = smp_processor_id();
@@ -89,10 +124,19 @@ int qdisc_restart(struct net_device *dev)
 			spin_unlock(&dev->queue_lock);
 
 			if (!netif_queue_stopped(dev)) {
-				if (netdev_nit)
-					dev_queue_xmit_nit(skb, dev);
+				if (netdev_nit) {
+					struct sk_buff *p;
 
-				if (dev->hard_start_xmit(skb, dev) == 0) {
+					for (p = skb; p; p = p->next)
+						dev_queue_xmit_nit(p, dev);
+				}
+
+				if (dev->hard_start_xmit_batch)
+					skb = dev->hard_start_xmit_batch(skb, dev);
+				else if (dev->hard_start_xmit(skb, dev) == 0)
+					skb = NULL;
+
+				if (skb == NULL) {
 					dev->xmit_lock_owner = -1;
 					spin_unlock(&dev->xmit_lock);
 
@@ -115,7 +159,13 @@ int qdisc_restart(struct net_device *dev)
 			   packet when deadloop is detected.
 			 */
 			if (dev->xmit_lock_owner == smp_processor_id()) {
-				kfree_skb(skb);
+				while (skb) {
+					struct sk_buff *next = skb->next;
+
+					skb->next = NULL;
+					kfree_skb(skb);
+					skb = next;
+				}
 				if (net_ratelimit())
 					printk(KERN_DEBUG "Dead loop on netdevice %s, fix it urgently!\n", dev->name);
 				return -1;
@@ -133,7 +183,7 @@ int qdisc_restart(struct net_device *dev)
 		   3. device is buggy (ppp)
 		 */
 
-		q->ops->requeue(skb, q);
+		qdisc_requeue_chain(skb, q);
 		netif_schedule(dev);
 		return 1;
 	}
@@ -0,0 +1,1386 @@
+/*
+ * net/sched/sch_htb.c	Hierarchical token bucket.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <asm/uaccess.h>
+#include <asm/system.h>
+#include <asm/bitops.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <linux/in.h>
+#include <linux/errno.h>
+#include <linux/interrupt.h>
+#include <linux/if_ether.h>
+#include <linux/inet.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/notifier.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <net/ip.h>
+#include <net/route.h>
+#include <linux/skbuff.h>
+#include <net/sock.h>
+#include <net/pkt_sched.h>
+
+
+/*	Hierarchical Token Bucket (HTB).
+	=======================================
+
+	Sources: Martin Devera, "HTB home", http://luxik.cdi.cz/~devik/qos/htb/
+		 (theory, and the HTB3 scheduler this one follows).
+
+	Description.
+	------------
+
+	Every class has two token buckets: rate (what it is guaranteed)
+	and ceil (what it may take at most, borrowing from its ancestors).
+	At any moment a class is in one of three modes:
+
+	CAN_SEND	- rate tokens left, it sends on its own account;
+	MAY_BORROW	- out of rate, but under ceil; it may send with
+			  tokens of the nearest ancestor which CAN_SEND;
+	CANT_SEND	- over ceil.
+
+	Leaves hold packets, inner classes only lend.  Each class has a
+	level: leaves are at 0, and an inner class is one below its
+	parent, the roots being at TC_HTB_MAXDEPTH-1.
+
+	Algorithm.
+	----------
+
+	A backlogged leaf, for its priority p, is attached either to the
+	"self feed" row[level][p] of the qdisc, if it CAN_SEND, or to the
+	feed of its parent, if it MAY_BORROW.  An inner class with anything
+	in a feed is attached the same way, so every active leaf hangs off
+	exactly one row entry: that of its nearest ancestor which CAN_SEND.
+
+	Dequeue scans rows from level 0 upwards and, within a level, from
+	the highest priority (0) down, picks a row entry and descends
+	through the feeds to a leaf.  Entries are kept in rbtrees sorted
+	by classid and served round robin with DRR quanta, so borrowing
+	is deterministic: the lowest level which can lend wins, then the
+	highest priority, then classid order.  The packet is charged to
+	the leaf and to all its ancestors; the one it was found at lends,
+	those below it borrow.
+
+	Classes not in CAN_SEND wait in a per-level rbtree sorted by the
+	time their mode will change.  Dequeue runs the events which are
+	due, and if nothing can be sent sleeps until the nearest one.
+
+	All of it is O(log n) in the number of active classes, so the
+	number of classes does not matter much; CBQ's estimation of idle
+	times is not needed at all.
+ */
+
+#define HTB_HSIZE	256	/* classid hash size, power of 2 */
+#define HTB_MAXWAIT	500000	/* longest wait, psched ticks */
+
+enum htb_cmode {
+	HTB_CANT_SEND,
+	HTB_MAY_BORROW,
+	HTB_CAN_SEND
+};
+
+struct htb_class
+{
+	u32			classid;
+	struct tc_stats		stats;
+	struct tc_htb_xstats	xstats;
+	int			refcnt;
+
+	/* Topology */
+	int			level;
+	struct htb_class	*parent;
+	struct list_head	hlist;		/* classid hash chain */
+	struct list_head	sibling;	/* parent's children */
+	struct list_head	children;
+
+	union {
+		struct htb_class_leaf {
+			struct Qdisc	*q;
+			int		prio;
+			int		aprio;	/* prio we are active at */
+			int		quantum;
+			int		deficit[TC_HTB_MAXDEPTH];
+			struct list_head drop_list;
+		} leaf;
+		struct htb_class_inner {
+			rb_root_t	feed[TC_HTB_NUMPRIO];
+			rb_node_t	*ptr[TC_HTB_NUMPRIO];
+			/* When ptr's class goes away, the next one
+			   after this classid is served. */
+			u32		last_ptr_id[TC_HTB_NUMPRIO];
+		} inner;
+	} un;
+	rb_node_t		node[TC_HTB_NUMPRIO];	/* in row or parent's feed */
+	rb_node_t		pq_node;		/* in wait_pq */
+	psched_time_t		pq_key;
+
+	int			prio_activity;	/* bit per active prio */
+	enum htb_cmode		cmode;
+
+	struct tcf_proto	*filter_list;
+	int			filter_cnt;
+
+	int			warned;
+
+	/* Token buckets */
+	struct qdisc_rate_table	*rate;
+	struct qdisc_rate_table	*ceil;
+	long			buffer, cbuffer;
+	long			mbuffer;	/* max wait */
+	long			tokens, ctokens;
+	psched_time_t		t_c;		/* checkpoint */
+};
+
+struct htb_sched
+{
+	struct list_head	root;		/* top level classes */
+	struct list_head	hash[HTB_HSIZE];
+	struct list_head	drops[TC_HTB_NUMPRIO];	/* active leaves */
+
+	/* Self feeds */
+	rb_root_t		row[TC_HTB_MAXDEPTH][TC_HTB_NUMPRIO];
+	int			row_mask[TC_HTB_MAXDEPTH];
+	rb_node_t		*ptr[TC_HTB_MAXDEPTH][TC_HTB_NUMPRIO];
+	u32			last_ptr_id[TC_HTB_MAXDEPTH][TC_HTB_NUMPRIO];
+
+	/* Classes waiting for a mode change, and the nearest change */
+	rb_root_t		wait_pq[TC_HTB_MAXDEPTH];
+	psched_time_t		near_ev_cache[TC_HTB_MAXDEPTH];
+
+	int			defcls;		/* for unclassified packets */
+	struct tcf_proto	*filter_list;
+
+	int			rate2quantum;	/* quantum = rate / rate2quantum */
+	psched_time_t		now;		/* time of this dequeue */
+	struct timer_list	timer;
+
+	/* Packets for the qdisc itself go out unshaped */
+	struct sk_buff_head	direct_queue;
+	int			direct_qlen;
+	long			direct_pkts;
+};
+
+/* Returned by htb_classify for packets which bypass shaping. */
+#define HTB_DIRECT	((struct htb_class*)-1)
+
+/* pq_node is not in a wait_pq while its color is this. */
+#define HTB_NOT_WAITING	(-1)
+
+static __inline__ unsigned htb_hash(u32 h)
+{
+	h ^= h>>8;
+	return h&(HTB_HSIZE-1);
+}
+
+static __inline__ struct htb_class *
+htb_find(u32 handle, struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct list_head *p;
+
+	if (TC_H_MAJ(handle) != sch->handle)
+		return NULL;
+
+	list_for_each(p, q->hash + htb_hash(handle)) {
+		struct htb_class *cl = list_entry(p, struct htb_class, hlist);
+		if (cl->classid == handle)
+			return cl;
+	}
+	return NULL;
+}
+
+/* Find the leaf for a packet: skb->priority naming one of our leaves
+   wins, then the filters, descending through inner classes, then the
+   default class.  Packets for the qdisc itself, or with nowhere to go,
+   are HTB_DIRECT. */
+static struct htb_class *
+htb_classify(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct htb_class *cl;
+	struct tcf_result res;
+	struct tcf_proto *tcf;
+	int result;
+
+	if (skb->priority == sch->handle)
+		return HTB_DIRECT;
+	if ((cl = htb_find(skb->priority, sch)) != NULL && cl->level == 0)
+		return cl;
+
+	tcf = q->filter_list;
+	while (tcf && (result = tc_classify(skb, tcf, &res)) >= 0) {
+#ifdef CONFIG_NET_CLS_POLICE
+		if (result == TC_POLICE_SHOT)
+			return NULL;
+#endif
+		if ((cl = (void*)res.class) == NULL) {
+			if (res.classid == sch->handle)
+				return HTB_DIRECT;
+			if ((cl = htb_find(res.classid, sch)) == NULL)
+				break;
+		}
+		if (!cl->level)
+			return cl;
+
+		/* An inner class: apply its own filters. */
+		tcf = cl->filter_list;
+	}
+
+	cl = htb_find(TC_H_MAKE(TC_H_MAJ(sch->handle), q->defcls), sch);
+	if (!cl || cl->level)
+		return HTB_DIRECT;
+	return cl;
+}
+
+static void htb_add_to_id_tree(rb_root_t *root, struct htb_class *cl, int prio)
+{
+	rb_node_t **p = &root->rb_node, *parent = NULL;
+
+	while (*p) {
+		struct htb_class *c;
+
+		parent = *p;
+		c = rb_entry(parent, struct htb_class, node[prio]);
+		if (cl->classid > c->classid)
+			p = &parent->rb_right;
+		else
+			p = &parent->rb_left;
+	}
+	rb_link_node(&cl->node[prio], parent, p);
+	rb_insert_color(&cl->node[prio], root);
+}
+
+/* The class's mode changes delay ticks from now; the caller made sure
+   it is not waiting already. */
+static void htb_add_to_wait_tree(struct htb_sched *q, struct htb_class *cl,
+				 long delay)
+{
+	rb_node_t **p = &q->wait_pq[cl->level].rb_node, *parent = NULL;
+
+	/* Far events are only rechecked; it keeps time arithmetic
+	   within what every clock source can do. */
+	if (delay > HTB_MAXWAIT)
+		delay = HTB_MAXWAIT;
+	PSCHED_TADD2(q->now, delay, cl->pq_key);
+
+	if (PSCHED_TLESS(cl->pq_key, q->near_ev_cache[cl->level]))
+		q->near_ev_cache[cl->level] = cl->pq_key;
+
+	while (*p) {
+		struct htb_class *c;
+
+		parent = *p;
+		c = rb_entry(parent, struct htb_class, pq_node);
+		if (PSCHED_TLESS(cl->pq_key, c->pq_key))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&cl->pq_node, parent, p);
+	rb_insert_color(&cl->pq_node, &q->wait_pq[cl->level]);
+}
+
+static __inline__ void htb_safe_rb_erase(rb_node_t *rb, rb_root_t *root)
+{
+	if (rb->rb_color == HTB_NOT_WAITING)
+		return;
+	rb_erase(rb, root);
+	rb->rb_color = HTB_NOT_WAITING;
+}
+
+static __inline__ void htb_next_rb_node(rb_node_t **n)
+{
+	*n = rb_next(*n);
+}
+
+static __inline__ void htb_add_class_to_row(struct htb_sched *q,
+					    struct htb_class *cl, int mask)
+{
+	q->row_mask[cl->level] |= mask;
+	while (mask) {
+		int prio = ffz(~mask);
+
+		mask &= ~(1 << prio);
+		htb_add_to_id_tree(q->row[cl->level] + prio, cl, prio);
+	}
+}
+
+static __inline__ void htb_remove_class_from_row(struct htb_sched *q,
+						 struct htb_class *cl, int mask)
+{
+	int m = 0;
+
+	while (mask) {
+		int prio = ffz(~mask);
+
+		mask &= ~(1 << prio);
+		if (q->ptr[cl->level][prio] == cl->node + prio)
+			htb_next_rb_node(q->ptr[cl->level] + prio);
+		rb_erase(cl->node + prio, q->row[cl->level] + prio);
+		if (!q->row[cl->level][prio].rb_node)
+			m |= 1 << prio;
+	}
+	q->row_mask[cl->level] &= ~m;
+}
+
+/* Attach the class's active prios to the feed of its parent while it
+   borrows, then up the tree, until a class which CAN_SEND takes them
+   into its row.  A parent whose feed was already in use for a prio
+   is attached above already. */
+static void htb_activate_prios(struct htb_sched *q, struct htb_class *cl)
+{
+	struct htb_class *p = cl->parent;
+	int m, mask = cl->prio_activity;
+
+	while (cl->cmode == HTB_MAY_BORROW && p && mask) {
+		m = mask;
+		while (m) {
+			int prio = ffz(~m);
+
+			m &= ~(1 << prio);
+			if (p->un.inner.feed[prio].rb_node)
+				mask &= ~(1 << prio);
+			htb_add_to_id_tree(p->un.inner.feed + prio, cl, prio);
+		}
+		p->prio_activity |= mask;
+		cl = p;
+		p = cl->parent;
+	}
+	if (cl->cmode == HTB_CAN_SEND && mask)
+		htb_add_class_to_row(q, cl, mask);
+}
+
+/* Reverse of htb_activate_prios. */
+static void htb_deactivate_prios(struct htb_sched *q, struct htb_class *cl)
+{
+	struct htb_class *p = cl->parent;
+	int m, mask = cl->prio_activity;
+
+	while (cl->cmode == HTB_MAY_BORROW && p && mask) {
+		m = mask;
+		mask = 0;
+		while (m) {
+			int prio = ffz(~m);
+
+			m &= ~(1 << prio);
+			if (p->un.inner.ptr[prio] == cl->node + prio) {
+				/* Forget the pointer, remember the place. */
+				p->un.inner.last_ptr_id[prio] = cl->classid;
+				p->un.inner.ptr[prio] = NULL;
+			}
+			rb_erase(cl->node + prio, p->un.inner.feed + prio);
+			if (!p->un.inner.feed[prio].rb_node)
+				mask |= 1 << prio;
+		}
+		p->prio_activity &= ~mask;
+		cl = p;
+		p = cl->parent;
+	}
+	if (cl->cmode == HTB_CAN_SEND && mask)
+		htb_remove_class_from_row(q, cl, mask);
+}
+
+/* Mode the class is in diff ticks after its checkpoint; diff is
+   turned into the time until that mode changes, 0 if never. */
+static __inline__ enum htb_cmode
+htb_class_mode(struct htb_class *cl, long *diff)
+{
+	long toks;
+
+	if ((toks = cl->ctokens + *diff) < 0) {
+		*diff = -toks;
+		return HTB_CANT_SEND;
+	}
+	if ((toks = cl->tokens + *diff) >= 0) {
+		*diff = 0;
+		return HTB_CAN_SEND;
+	}
+	*diff = -toks;
+	return HTB_MAY_BORROW;
+}
+
+static void
+htb_change_class_mode(struct htb_sched *q, struct htb_class *cl, long *diff)
+{
+	enum htb_cmode new_mode = htb_class_mode(cl, diff);
+
+	if (new_mode == cl->cmode)
+		return;
+
+	if (cl->prio_activity) {
+		if (cl->cmode != HTB_CANT_SEND)
+			htb_deactivate_prios(q, cl);
+		cl->cmode = new_mode;
+		if (new_mode != HTB_CANT_SEND)
+			htb_activate_prios(q, cl);
+	} else
+		cl->cmode = new_mode;
+}
+
+/* A leaf got backlog. */
+static __inline__ void htb_activate(struct htb_sched *q, struct htb_class *cl)
+{
+	if (!cl->prio_activity) {
+		cl->prio_activity = 1 << (cl->un.leaf.aprio = cl->un.leaf.prio);
+		htb_activate_prios(q, cl);
+		list_add_tail(&cl->un.leaf.drop_list, q->drops + cl->un.leaf.aprio);
+	}
+}
+
+/* A leaf lost its backlog. */
+static __inline__ void htb_deactivate(struct htb_sched *q, struct htb_class *cl)
+{
+	htb_deactivate_prios(q, cl);
+	cl->prio_activity = 0;
+	list_del_init(&cl->un.leaf.drop_list);
+}
+
+static int htb_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct htb_class *cl = htb_classify(skb, sch);
+	unsigned int len = skb->len;
+
+	if (cl == HTB_DIRECT) {
+		if (q->direct_queue.qlen >= q->direct_qlen)
+			goto drop;
+		__skb_queue_tail(&q->direct_queue, skb);
+		q->direct_pkts++;
+	} else if (cl == NULL) {
+		goto drop;
+	} else {
+		if (cl->un.leaf.q->enqueue(skb, cl->un.leaf.q) != NET_XMIT_SUCCESS) {
+			sch->stats.drops++;
+			cl->stats.drops++;
+			return NET_XMIT_DROP;
+		}
+		cl->stats.packets++;
+		cl->stats.bytes += len;
+		htb_activate(q, cl);
+	}
+
+	sch->q.qlen++;
+	sch->stats.packets++;
+	sch->stats.bytes += len;
+	return NET_XMIT_SUCCESS;
+
+drop:
+	sch->stats.drops++;
+	kfree_skb(skb);
+	return NET_XMIT_DROP;
+}
+
+static int htb_requeue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct htb_class *cl = htb_classify(skb, sch);
+
+	if (cl == HTB_DIRECT) {
+		if (q->direct_queue.qlen >= q->direct_qlen)
+			goto drop;
+		__skb_queue_head(&q->direct_queue, skb);
+	} else if (cl == NULL) {
+		goto drop;
+	} else {
+		if (cl->un.leaf.q->ops->requeue(skb, cl->un.leaf.q) != NET_XMIT_SUCCESS) {
+			sch->stats.drops++;
+			cl->stats.drops++;
+			return NET_XMIT_DROP;
+		}
+		htb_activate(q, cl);
+	}
+
+	sch->q.qlen++;
+	return NET_XMIT_SUCCESS;
+
+drop:
+	sch->stats.drops++;
+	kfree_skb(skb);
+	return NET_XMIT_DROP;
+}
+
+static void htb_timer(unsigned long arg)
+{
+	struct Qdisc *sch = (struct Qdisc*)arg;
+
+	sch->flags &= ~TCQ_F_THROTTLED;
+	netif_schedule(sch->dev);
+}
+
+static __inline__ long
+L2T(struct htb_class *cl, struct qdisc_rate_table *rate, int size)
+{
+	int slot = size >> rate->rate.cell_log;
+
+	if (slot > 255) {
+		cl->xstats.giants++;
+		slot = 255;
+	}
+	return rate->data[slot];
+}
+
+#define HTB_ACCNT(T,B,R) \
+	toks = diff + cl->T; \
+	if (toks > cl->B) \
+		toks = cl->B; \
+	toks -= L2T(cl, cl->R, bytes); \
+	if (toks <= -cl->mbuffer) \
+		toks = 1 - cl->mbuffer; \
+	cl->T = toks
+
+/* Charge bytes sent from a leaf found at the given level: the class
+   at that level lends, classes below it borrow, and everyone's ceil
+   pays.  Modes are updated on the way up. */
+static void htb_charge_class(struct htb_sched *q, struct htb_class *cl,
+			     int level, int bytes)
+{
+	enum htb_cmode old_mode;
+	long toks, diff;
+
+	while (cl) {
+		diff = PSCHED_TDIFF_SAFE(q->now, cl->t_c, (u32)cl->mbuffer, 0);
+		if (cl->level >= level) {
+			if (cl->level == level)
+				cl->xstats.lends++;
+			HTB_ACCNT(tokens, buffer, rate);
+		} else {
+			cl->xstats.borrows++;
+			cl->tokens += diff;	/* we move t_c below */
+		}
+		HTB_ACCNT(ctokens, cbuffer, ceil);
+		cl->t_c = q->now;
+
+		old_mode = cl->cmode;
+		diff = 0;
+		htb_change_class_mode(q, cl, &diff);
+		if (old_mode != cl->cmode) {
+			if (old_mode != HTB_CAN_SEND)
+				htb_safe_rb_erase(&cl->pq_node, q->wait_pq + cl->level);
+			if (cl->cmode != HTB_CAN_SEND) {
+				htb_add_to_wait_tree(q, cl, diff);
+				cl->stats.overlimits++;
+			}
+		}
+
+		/* Leaves counted it at enqueue. */
+		if (cl->level) {
+			cl->stats.bytes += bytes;
+			cl->stats.packets++;
+		}
+		cl = cl->parent;
+	}
+}
+
+/* Run the mode changes due at this level.  Returns ticks until the
+   next one, or 0 if none is pending. */
+static long htb_do_events(struct htb_sched *q, int level)
+{
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		struct htb_class *cl;
+		long diff;
+		rb_node_t *p = rb_first(&q->wait_pq[level]);
+
+		if (!p)
+			return 0;
+
+		cl = rb_entry(p, struct htb_class, pq_node);
+		if (PSCHED_TLESS(q->now, cl->pq_key)) {
+			diff = PSCHED_TDIFF(cl->pq_key, q->now);
+			return diff > 0 ? diff : 1;
+		}
+
+		htb_safe_rb_erase(p, q->wait_pq + level);
+		diff = PSCHED_TDIFF_SAFE(q->now, cl->t_c, (u32)cl->mbuffer, 0);
+		htb_change_class_mode(q, cl, &diff);
+		if (cl->cmode != HTB_CAN_SEND)
+			htb_add_to_wait_tree(q, cl, diff);
+	}
+	if (net_ratelimit())
+		printk(KERN_WARNING "htb: too many events!\n");
+	return 1;
+}
+
+/* Return the first node with classid >= id, or NULL. */
+static rb_node_t *
+htb_id_find_next_upper(int prio, rb_node_t *n, u32 id)
+{
+	rb_node_t *r = NULL;
+
+	while (n) {
+		struct htb_class *cl = rb_entry(n, struct htb_class, node[prio]);
+
+		if (id == cl->classid)
+			return n;
+
+		if (id > cl->classid) {
+			n = n->rb_right;
+		} else {
+			r = n;
+			n = n->rb_left;
+		}
+	}
+	return r;
+}
+
+/* Descend from a row through the feeds to the leaf whose turn it is.
+   Each tree has its round robin pointer; one which ran off the end
+   wraps and moves its parent's on. */
+static struct htb_class *
+htb_lookup_leaf(rb_root_t *tree, int prio, rb_node_t **pptr, u32 *pid)
+{
+	int i;
+	struct {
+		rb_node_t *root;
+		rb_node_t **pptr;
+		u32 *pid;
+	} stk[TC_HTB_MAXDEPTH], *sp = stk;
+
+	BUG_TRAP(tree->rb_node);
+	sp->root = tree->rb_node;
+	sp->pptr = pptr;
+	sp->pid = pid;
+
+	for (i = 0; i < 65535; i++) {
+		if (!*sp->pptr && *sp->pid) {
+			/* Our class went away; carry on after it. */
+			*sp->pptr = htb_id_find_next_upper(prio, sp->root, *sp->pid);
+		}
+		*sp->pid = 0;
+		if (!*sp->pptr) {
+			/* At the right end: rewind, and go up. */
+			*sp->pptr = sp->root;
+			while ((*sp->pptr)->rb_left)
+				*sp->pptr = (*sp->pptr)->rb_left;
+			if (sp > stk) {
+				sp--;
+				BUG_TRAP(*sp->pptr);
+				if (!*sp->pptr)
+					return NULL;
+				htb_next_rb_node(sp->pptr);
+			}
+		} else {
+			struct htb_class *cl;
+
+			cl = rb_entry(*sp->pptr, struct htb_class, node[prio]);
+			if (!cl->level)
+				return cl;
+			(++sp)->root = cl->un.inner.feed[prio].rb_node;
+			sp->pptr = cl->un.inner.ptr + prio;
+			sp->pid = cl->un.inner.last_ptr_id + prio;
+		}
+	}
+	BUG_TRAP(0);
+	return NULL;
+}
+
+/* Dequeue from the leaves under row[level][prio]. */
+static struct sk_buff *
+htb_dequeue_tree(struct htb_sched *q, int prio, int level)
+{
+	struct sk_buff *skb = NULL;
+	struct htb_class *cl, *start;
+
+	start = cl = htb_lookup_leaf(q->row[level] + prio, prio,
+				     q->ptr[level] + prio,
+				     q->last_ptr_id[level] + prio);
+	do {
+next:
+		if (!cl)
+			return NULL;
+
+		/* The leaf qdisc may have dropped on its own, or been
+		   grafted over; skip it. */
+		if (cl->un.leaf.q->q.qlen == 0) {
+			struct htb_class *next;
+
+			htb_deactivate(q, cl);
+			if ((q->row_mask[level] & (1 << prio)) == 0)
+				return NULL;
+
+			next = htb_lookup_leaf(q->row[level] + prio, prio,
+					       q->ptr[level] + prio,
+					       q->last_ptr_id[level] + prio);
+			if (cl == start)
+				start = next;
+			cl = next;
+			goto next;
+		}
+
+		if ((skb = cl->un.leaf.q->dequeue(cl->un.leaf.q)) != NULL)
+			break;
+		if (!cl->warned) {
+			printk(KERN_WARNING "htb: class %X isn't work conserving?!\n",
+			       cl->classid);
+			cl->warned = 1;
+		}
+		htb_next_rb_node((level ? cl->parent->un.inner.ptr : q->ptr[0]) + prio);
+		cl = htb_lookup_leaf(q->row[level] + prio, prio,
+				     q->ptr[level] + prio,
+				     q->last_ptr_id[level] + prio);
+	} while (cl != start);
+
+	if (skb != NULL) {
+		if ((cl->un.leaf.deficit[level] -= skb->len) < 0) {
+			cl->un.leaf.deficit[level] += cl->un.leaf.quantum;
+			htb_next_rb_node((level ? cl->parent->un.inner.ptr : q->ptr[0]) + prio);
+		}
+		if (!cl->un.leaf.q->q.qlen)
+			htb_deactivate(q, cl);
+		htb_charge_class(q, cl, level, skb->len);
+	}
+	return skb;
+}
+
+static void htb_delay_by(struct Qdisc *sch, long delay)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	long jdelay = PSCHED_US2JIFFIE(delay);
+
+	if (jdelay <= 0)
+		jdelay = 1;
+	mod_timer(&q->timer, jiffies + jdelay);
+	sch->flags |= TCQ_F_THROTTLED;
+	sch->stats.overlimits++;
+}
+
+static struct sk_buff *htb_dequeue(struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct sk_buff *skb;
+	long min_delay = HTB_MAXWAIT;
+	int level;
+
+	/* Unshaped packets first; they are cheap. */
+	if ((skb = __skb_dequeue(&q->direct_queue)) != NULL) {
+		sch->flags &= ~TCQ_F_THROTTLED;
+		sch->q.qlen--;
+		return skb;
+	}
+
+	if (!sch->q.qlen)
+		return NULL;
+	PSCHED_GET_TIME(q->now);
+
+	for (level = 0; level < TC_HTB_MAXDEPTH; level++) {
+		long delay;
+		int m;
+
+		/* Most of the time nothing is due. */
+		if (!PSCHED_TLESS(q->now, q->near_ev_cache[level])) {
+			delay = htb_do_events(q, level);
+			if (!delay)
+				delay = HTB_MAXWAIT;
+			PSCHED_TADD2(q->now, delay, q->near_ev_cache[level]);
+		} else
+			delay = PSCHED_TDIFF(q->near_ev_cache[level], q->now);
+
+		if (delay > 0 && delay < min_delay)
+			min_delay = delay;
+
+		m = ~q->row_mask[level];
+		while (m != -1) {
+			int prio = ffz(m);
+
+			m |= 1 << prio;
+			skb = htb_dequeue_tree(q, prio, level);
+			if (skb != NULL) {
+				sch->q.qlen--;
+				sch->flags &= ~TCQ_F_THROTTLED;
+				return skb;
+			}
+		}
+	}
+	htb_delay_by(sch, min_delay);
+	return NULL;
+}
+
+/* Drop from the lowest priority active leaf. */
+static int htb_drop(struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	int prio;
+
+	for (prio = TC_HTB_NUMPRIO - 1; prio >= 0; prio--) {
+		struct list_head *p;
+
+		list_for_each(p, q->drops + prio) {
+			struct htb_class *cl = list_entry(p, struct htb_class,
+							  un.leaf.drop_list);
+
+			if (cl->un.leaf.q->ops->drop &&
+			    cl->un.leaf.q->ops->drop(cl->un.leaf.q)) {
+				sch->q.qlen--;
+				sch->stats.drops++;
+				cl->stats.drops++;
+				if (!cl->un.leaf.q->q.qlen)
+					htb_deactivate(q, cl);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void htb_reset(struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	int i;
+
+	for (i = 0; i < HTB_HSIZE; i++) {
+		struct list_head *p;
+
+		list_for_each(p, q->hash + i) {
+			struct htb_class *cl = list_entry(p, struct htb_class, hlist);
+
+			if (cl->level)
+				memset(&cl->un.inner, 0, sizeof(cl->un.inner));
+			else {
+				qdisc_reset(cl->un.leaf.q);
+				INIT_LIST_HEAD(&cl->un.leaf.drop_list);
+			}
+			cl->prio_activity = 0;
+			cl->cmode = HTB_CAN_SEND;
+			cl->pq_node.rb_color = HTB_NOT_WAITING;
+		}
+	}
+	sch->flags &= ~TCQ_F_THROTTLED;
+	del_timer(&q->timer);
+	__skb_queue_purge(&q->direct_queue);
+	sch->q.qlen = 0;
+	memset(q->row, 0, sizeof(q->row));
+	memset(q->row_mask, 0, sizeof(q->row_mask));
+	memset(q->ptr, 0, sizeof(q->ptr));
+	memset(q->last_ptr_id, 0, sizeof(q->last_ptr_id));
+	memset(q->wait_pq, 0, sizeof(q->wait_pq));
+	memset(q->near_ev_cache, 0, sizeof(q->near_ev_cache));
+	for (i = 0; i < TC_HTB_NUMPRIO; i++)
+		INIT_LIST_HEAD(q->drops + i);
+}
+
+static int htb_init(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct rtattr *tb[TCA_HTB_INIT];
+	struct tc_htb_glob *gopt;
+	int i;
+
+	if (opt == NULL ||
+	    rtattr_parse(tb, TCA_HTB_INIT, RTA_DATA(opt), RTA_PAYLOAD(opt)) ||
+	    tb[TCA_HTB_INIT-1] == NULL ||
+	    RTA_PAYLOAD(tb[TCA_HTB_INIT-1]) < sizeof(*gopt))
+		return -EINVAL;
+
+	gopt = RTA_DATA(tb[TCA_HTB_INIT-1]);
+	if (gopt->version != TC_HTB_PROTOVER) {
+		printk(KERN_ERR "htb: need tc/htb version %d, you have %d\n",
+		       TC_HTB_PROTOVER, gopt->version);
+		return -EINVAL;
+	}
+
+	MOD_INC_USE_COUNT;
+
+	INIT_LIST_HEAD(&q->root);
+	for (i = 0; i < HTB_HSIZE; i++)
+		INIT_LIST_HEAD(q->hash + i);
+	for (i = 0; i < TC_HTB_NUMPRIO; i++)
+		INIT_LIST_HEAD(q->drops + i);
+
+	init_timer(&q->timer);
+	q->timer.function = htb_timer;
+	q->timer.data = (unsigned long)sch;
+	skb_queue_head_init(&q->direct_queue);
+
+	/* Some devices have zero tx_queue_len. */
+	q->direct_qlen = sch->dev->tx_queue_len;
+	if (q->direct_qlen < 2)
+		q->direct_qlen = 2;
+
+	if ((q->rate2quantum = gopt->rate2quantum) < 1)
+		q->rate2quantum = 1;
+	q->defcls = gopt->defcls;
+	return 0;
+}
+
+#ifdef CONFIG_RTNETLINK
+static int htb_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	unsigned char	 *b = skb->tail;
+	struct rtattr *rta;
+	struct tc_htb_glob gopt;
+
+	spin_lock_bh(&sch->dev->queue_lock);
+	gopt.direct_pkts = q->direct_pkts;
+	spin_unlock_bh(&sch->dev->queue_lock);
+	gopt.version = TC_HTB_PROTOVER;
+	gopt.rate2quantum = q->rate2quantum;
+	gopt.defcls = q->defcls;
+	gopt.debug = 0;
+
+	rta = (struct rtattr*)b;
+	RTA_PUT(skb, TCA_OPTIONS, 0, NULL);
+	RTA_PUT(skb, TCA_HTB_INIT, sizeof(gopt), &gopt);
+	rta->rta_len = skb->tail - b;
+	return skb->len;
+
+rtattr_failure:
+	skb_trim(skb, b - skb->data);
+	return -1;
+}
+
+static int
+htb_dump_class(struct Qdisc *sch, unsigned long arg,
+	       struct sk_buff *skb, struct tcmsg *tcm)
+{
+	struct htb_class *cl = (struct htb_class*)arg;
+	unsigned char	 *b = skb->tail;
+	struct rtattr *rta;
+	struct tc_htb_opt opt;
+
+	tcm->tcm_parent = cl->parent ? cl->parent->classid : TC_H_ROOT;
+	tcm->tcm_handle = cl->classid;
+	if (!cl->level)
+		tcm->tcm_info = cl->un.leaf.q->handle;
+
+	rta = (struct rtattr*)b;
+	RTA_PUT(skb, TCA_OPTIONS, 0, NULL);
+
+	memset(&opt, 0, sizeof(opt));
+	opt.rate = cl->rate->rate;
+	opt.buffer = cl->buffer;
+	opt.ceil = cl->ceil->rate;
+	opt.cbuffer = cl->cbuffer;
+	if (!cl->level) {
+		opt.quantum = cl->un.leaf.quantum;
+		opt.prio = cl->un.leaf.prio;
+	}
+	opt.level = cl->level;
+	RTA_PUT(skb, TCA_HTB_PARMS, sizeof(opt), &opt);
+	rta->rta_len = skb->tail - b;
+
+	spin_lock_bh(&sch->dev->queue_lock);
+	cl->stats.qlen = cl->level ? 0 : cl->un.leaf.q->q.qlen;
+	cl->xstats.tokens = cl->tokens;
+	cl->xstats.ctokens = cl->ctokens;
+	spin_unlock_bh(&sch->dev->queue_lock);
+	if (qdisc_copy_stats(skb, &cl->stats))
+		goto rtattr_failure;
+	RTA_PUT(skb, TCA_XSTATS, sizeof(cl->xstats), &cl->xstats);
+	return skb->len;
+
+rtattr_failure:
+	skb_trim(skb, b - skb->data);
+	return -1;
+}
+#endif
+
+static int htb_graft(struct Qdisc *sch, unsigned long arg, struct Qdisc *new,
+		     struct Qdisc **old)
+{
+	struct htb_class *cl = (struct htb_class*)arg;
+
+	if (cl && !cl->level) {
+		if (new == NULL &&
+		    (new = qdisc_create_dflt(sch->dev, &pfifo_qdisc_ops)) == NULL)
+			return -ENOBUFS;
+		sch_tree_lock(sch);
+		*old = cl->un.leaf.q;
+		cl->un.leaf.q = new;
+		sch->q.qlen -= (*old)->q.qlen;
+		qdisc_reset(*old);
+		sch_tree_unlock(sch);
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static struct Qdisc *htb_leaf(struct Qdisc *sch, unsigned long arg)
+{
+	struct htb_class *cl = (struct htb_class*)arg;
+
+	return (cl && !cl->level) ? cl->un.leaf.q : NULL;
+}
+
+static unsigned long htb_get(struct Qdisc *sch, u32 classid)
+{
+	struct htb_class *cl = htb_find(classid, sch);
+
+	if (cl)
+		cl->refcnt++;
+	return (unsigned long)cl;
+}
+
+static void htb_destroy_filters(struct tcf_proto **fl)
+{
+	struct tcf_proto *tp;
+
+	while ((tp = *fl) != NULL) {
+		*fl = tp->next;
+		tp->ops->destroy(tp);
+	}
+}
+
+/* Takes the class, and whatever is left of its subtree, out of the
+   scheduler and frees it. */
+static void htb_destroy_class(struct Qdisc *sch, struct htb_class *cl)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+
+	while (!list_empty(&cl->children))
+		htb_destroy_class(sch, list_entry(cl->children.next,
+						  struct htb_class, sibling));
+
+	if (!cl->level) {
+		sch->q.qlen -= cl->un.leaf.q->q.qlen;
+		qdisc_destroy(cl->un.leaf.q);
+	}
+	qdisc_put_rtab(cl->rate);
+	qdisc_put_rtab(cl->ceil);
+#ifdef CONFIG_NET_ESTIMATOR
+	qdisc_kill_estimator(&cl->stats);
+#endif
+	htb_destroy_filters(&cl->filter_list);
+
+	/* htb_delete may have done these already. */
+	list_del_init(&cl->hlist);
+	list_del_init(&cl->sibling);
+	if (cl->prio_activity)
+		htb_deactivate(q, cl);
+	if (cl->cmode != HTB_CAN_SEND)
+		htb_safe_rb_erase(&cl->pq_node, q->wait_pq + cl->level);
+
+	kfree(cl);
+}
+
+static void htb_destroy(struct Qdisc *sch)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	int i;
+
+	del_timer_sync(&q->timer);
+
+	/* Filters are bound to classes; they must go first. */
+	htb_destroy_filters(&q->filter_list);
+	for (i = 0; i < HTB_HSIZE; i++) {
+		struct list_head *p;
+
+		list_for_each(p, q->hash + i)
+			htb_destroy_filters(&list_entry(p, struct htb_class,
+							hlist)->filter_list);
+	}
+
+	while (!list_empty(&q->root))
+		htb_destroy_class(sch, list_entry(q->root.next,
+						  struct htb_class, sibling));
+
+	__skb_queue_purge(&q->direct_queue);
+	MOD_DEC_USE_COUNT;
+}
+
+static void htb_put(struct Qdisc *sch, unsigned long arg)
+{
+	struct htb_class *cl = (struct htb_class*)arg;
+
+	/* htb_delete has unlinked it already. */
+	if (--cl->refcnt == 0)
+		htb_destroy_class(sch, cl);
+}
+
+static int
+htb_change_class(struct Qdisc *sch, u32 classid, u32 parentid,
+		 struct rtattr **tca, unsigned long *arg)
+{
+	int err = -EINVAL;
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct htb_class *cl = (struct htb_class*)*arg, *parent;
+	struct rtattr *opt = tca[TCA_OPTIONS-1];
+	struct qdisc_rate_table *rtab = NULL, *ctab = NULL;
+	struct Qdisc *old_q = NULL;
+	struct rtattr *tb[TCA_HTB_RTAB];
+	struct tc_htb_opt *hopt;
+
+	if (opt == NULL ||
+	    rtattr_parse(tb, TCA_HTB_RTAB, RTA_DATA(opt), RTA_PAYLOAD(opt)) ||
+	    tb[TCA_HTB_PARMS-1] == NULL ||
+	    RTA_PAYLOAD(tb[TCA_HTB_PARMS-1]) < sizeof(*hopt))
+		goto failure;
+
+	parent = parentid == TC_H_ROOT ? NULL : htb_find(parentid, sch);
+
+	hopt = RTA_DATA(tb[TCA_HTB_PARMS-1]);
+	rtab = qdisc_get_rtab(&hopt->rate, tb[TCA_HTB_RTAB-1]);
+	ctab = qdisc_get_rtab(&hopt->ceil, tb[TCA_HTB_CTAB-1]);
+	if (rtab == NULL || ctab == NULL)
+		goto failure;
+
+	if (cl == NULL) {
+		struct Qdisc *new_q;
+
+		if (!classid || TC_H_MAJ(classid^sch->handle) ||
+		    htb_find(classid, sch))
+			goto failure;
+		if (parentid != TC_H_ROOT && parent == NULL)
+			goto failure;
+
+		/* Leaves are at 0, and parent must become one level
+		   above us. */
+		if (parent && parent->parent && parent->parent->level < 2) {
+			printk(KERN_ERR "htb: tree is too deep\n");
+			goto failure;
+		}
+
+		err = -ENOBUFS;
+		cl = kmalloc(sizeof(*cl), GFP_KERNEL);
+		if (cl == NULL)
+			goto failure;
+		memset(cl, 0, sizeof(*cl));
+		cl->refcnt = 1;
+		INIT_LIST_HEAD(&cl->sibling);
+		INIT_LIST_HEAD(&cl->hlist);
+		INIT_LIST_HEAD(&cl->children);
+		INIT_LIST_HEAD(&cl->un.leaf.drop_list);
+		cl->pq_node.rb_color = HTB_NOT_WAITING;
+		cl->stats.lock = &sch->dev->queue_lock;
+
+		/* Allocates; not under the tree lock. */
+		new_q = qdisc_create_dflt(sch->dev, &pfifo_qdisc_ops);
+
+		sch_tree_lock(sch);
+		if (parent && !parent->level) {
+			/* The parent was a leaf; make it an inner class. */
+			if (parent->prio_activity)
+				htb_deactivate(q, parent);
+			sch->q.qlen -= parent->un.leaf.q->q.qlen;
+			old_q = parent->un.leaf.q;
+
+			/* Its level changes, so must its wait tree. */
+			if (parent->cmode != HTB_CAN_SEND) {
+				htb_safe_rb_erase(&parent->pq_node, q->wait_pq);
+				parent->cmode = HTB_CAN_SEND;
+			}
+			parent->level = (parent->parent ? parent->parent->level
+					 : TC_HTB_MAXDEPTH) - 1;
+			memset(&parent->un.inner, 0, sizeof(parent->un.inner));
+		}
+		cl->un.leaf.q = new_q ? new_q : &noop_qdisc;
+
+		cl->classid = classid;
+		cl->parent = parent;
+
+		cl->tokens = hopt->buffer;
+		cl->ctokens = hopt->cbuffer;
+		cl->mbuffer = 60000000;		/* 1min */
+		PSCHED_GET_TIME(cl->t_c);
+		cl->cmode = HTB_CAN_SEND;
+
+		list_add_tail(&cl->hlist, q->hash + htb_hash(classid));
+		list_add_tail(&cl->sibling, parent ? &parent->children : &q->root);
+	} else {
+		if (parentid && parentid != TC_H_ROOT &&
+		    (!cl->parent || cl->parent->classid != parentid))
+			goto failure;
+		sch_tree_lock(sch);
+	}
+
+	if (!cl->level) {
+		cl->un.leaf.quantum = rtab->rate.rate / q->rate2quantum;
+		if (!hopt->quantum && cl->un.leaf.quantum < 1000) {
+			printk(KERN_WARNING "htb: quantum of class %X is small. Consider r2q change.\n",
+			       cl->classid);
+			cl->un.leaf.quantum = 1000;
+		}
+		if (!hopt->quantum && cl->un.leaf.quantum > 200000) {
+			printk(KERN_WARNING "htb: quantum of class %X is big. Consider r2q change.\n",
+			       cl->classid);
+			cl->un.leaf.quantum = 200000;
+		}
+		if (hopt->quantum)
+			cl->un.leaf.quantum = hopt->quantum;
+		if ((cl->un.leaf.prio = hopt->prio) >= TC_HTB_NUMPRIO)
+			cl->un.leaf.prio = TC_HTB_NUMPRIO - 1;
+	}
+
+	cl->buffer = hopt->buffer;
+	cl->cbuffer = hopt->cbuffer;
+	rtab = xchg(&cl->rate, rtab);
+	ctab = xchg(&cl->ceil, ctab);
+	sch_tree_unlock(sch);
+
+	if (old_q)
+		qdisc_destroy(old_q);
+	if (rtab)
+		qdisc_put_rtab(rtab);
+	if (ctab)
+		qdisc_put_rtab(ctab);
+
+#ifdef CONFIG_NET_ESTIMATOR
+	if (tca[TCA_RATE-1]) {
+		qdisc_kill_estimator(&cl->stats);
+		qdisc_new_estimator(&cl->stats, tca[TCA_RATE-1]);
+	}
+#endif
+	*arg = (unsigned long)cl;
+	return 0;
+
+failure:
+	if (rtab)
+		qdisc_put_rtab(rtab);
+	if (ctab)
+		qdisc_put_rtab(ctab);
+	return err;
+}
+
+static int htb_delete(struct Qdisc *sch, unsigned long arg)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct htb_class *cl = (struct htb_class*)arg;
+
+	if (!list_empty(&cl->children) || cl->filter_cnt)
+		return -EBUSY;
+
+	sch_tree_lock(sch);
+
+	/* Unreachable from now on; the rest is done by the last put. */
+	list_del_init(&cl->hlist);
+	list_del_init(&cl->sibling);
+	if (!cl->level) {
+		sch->q.qlen -= cl->un.leaf.q->q.qlen;
+		qdisc_reset(cl->un.leaf.q);
+	}
+	if (cl->prio_activity)
+		htb_deactivate(q, cl);
+	if (cl->cmode != HTB_CAN_SEND) {
+		htb_safe_rb_erase(&cl->pq_node, q->wait_pq + cl->level);
+		cl->cmode = HTB_CAN_SEND;
+	}
+
+	sch_tree_unlock(sch);
+
+	if (--cl->refcnt == 0)
+		htb_destroy_class(sch, cl);
+	return 0;
+}
+
+static struct tcf_proto **htb_find_tcf(struct Qdisc *sch, unsigned long arg)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	struct htb_class *cl = (struct htb_class *)arg;
+
+	return cl ? &cl->filter_list : &q->filter_list;
+}
+
+static unsigned long htb_bind_filter(struct Qdisc *sch, unsigned long parent,
+				     u32 classid)
+{
+	struct htb_class *cl = htb_find(classid, sch);
+
+	if (cl)
+		cl->filter_cnt++;
+	return (unsigned long)cl;
+}
+
+static void htb_unbind_filter(struct Qdisc *sch, unsigned long arg)
+{
+	struct htb_class *cl = (struct htb_class *)arg;
+
+	if (cl)
+		cl->filter_cnt--;
+}
+
+static void htb_walk(struct Qdisc *sch, struct qdisc_walker *arg)
+{
+	struct htb_sched *q = (struct htb_sched *)sch->data;
+	int i;
+
+	if (arg->stop)
+		return;
+
+	for (i = 0; i < HTB_HSIZE; i++) {
+		struct list_head *p;
+
+		list_for_each(p, q->hash + i) {
+			struct htb_class *cl = list_entry(p, struct htb_class, hlist);
+
+			if (arg->count < arg->skip) {
+				arg->count++;
+				continue;
+			}
+			if (arg->fn(sch, (unsigned long)cl, arg) < 0) {
+				arg->stop = 1;
+				return;
+			}
+			arg->count++;
+		}
+	}
+}
+
+static struct Qdisc_class_ops htb_class_ops =
+{
+	htb_graft,
+	htb_leaf,
+	htb_get,
+	htb_put,
+	htb_change_class,
+	htb_delete,
+	htb_walk,
+
+	htb_find_tcf,
+	htb_bind_filter,
+	htb_unbind_filter,
+
+#ifdef CONFIG_RTNETLINK
+	htb_dump_class,
+#endif
+};
+
+struct Qdisc_ops htb_qdisc_ops =
+{
+	NULL,
+	&htb_class_ops,
+	"htb",
+	sizeof(struct htb_sched),
+
+	htb_enqueue,
+	htb_dequeue,
+	htb_requeue,
+	htb_drop,
+
+	htb_init,
+	htb_reset,
+	htb_destroy,
+	NULL /* htb_change */,
+
+#ifdef CONFIG_RTNETLINK
+	htb_dump,
+#endif
+};
+
+#ifdef MODULE
+int init_module(void)
+{
+	return register_qdisc(&htb_qdisc_ops);
+}
+
+void cleanup_module(void)
+{
+	unregister_qdisc(&htb_qdisc_ops);
+}
+#endif
@@ -30,6 +30,7 @@
 #include <linux/etherdevice.h>
 #include <linux/notifier.h>
 #include <linux/init.h>
+#include <linux/jhash.h>
 #include <net/ip.h>
 #include <linux/ipv6.h>
 #include <net/route.h>
@@ -78,21 +79,32 @@
 	SFQ is superior for this purpose.
 
 	IMPLEMENTATION:
-	This implementation limits maximal queue length to 128;
-	maximal mtu to 2^15-1; number of hash buckets to 1024.
-	The only goal of this restrictions was that all data
-	fit into one 4K page :-). Struct sfq_sched_data is
-	organized in anti-cache manner: all the data for a bucket
-	are scattered over different locations. This is not good,
-	but it allowed me to put it into 4K.
-
-	It is easy to increase these values, but not in flight.  */
-
-#define SFQ_DEPTH		128
-#define SFQ_HASH_DIVISOR	1024
-
-/* This type should contain at least SFQ_DEPTH*2 values */
-typedef unsigned char sfq_index;
+	The number of hash buckets (divisor), the number of slots
+	(flows), the packets one slot may hold (depth) and the total
+	queue length (limit) are chosen per instance when it is
+	created; maximal mtu is still 2^15-1. Buckets map to slots
+	through ht[], and a slot is only taken while its flow has
+	packets queued, so the slots serve the flows that are active
+	now and the buckets may be many more than the slots.
+	Struct sfq_sched_data is organized in anti-cache manner: all
+	the data for a bucket are scattered over different locations.
+
+	The hash is jhash keyed with a random value. Perturbation picks
+	a new key and moves the queued packets to the slots of the new
+	key; a flow lives in exactly one slot, so its packets keep
+	their order.  */
+
+#define SFQ_DEF_FLOWS		128
+#define SFQ_DEF_DIVISOR		1024
+#define SFQ_DEF_DEPTH		128
+#define SFQ_DEF_LIMIT		127
+
+#define SFQ_MAX_FLOWS		4096
+#define SFQ_MAX_DIVISOR		65536
+#define SFQ_MAX_DEPTH		1024
+
+/* This type should contain at least flows+depth+1 values */
+typedef unsigned short sfq_index;
 
 struct sfq_head
 {
@@ -105,31 +117,27 @@ struct sfq_sched_data
 /* Parameters */
 	int		perturb_period;
 	unsigned	quantum;	/* Allotment per round: MUST BE >= MTU */
+	unsigned	limit;		/* Maximal packets in queue */
+	unsigned	divisor;	/* Hash buckets, power of 2 */
+	unsigned	flows;		/* Slots; also the "no slot" index */
+	unsigned	depth;		/* Maximal packets in one slot */
 
 /* Variables */
 	struct timer_list perturb_timer;
-	int		perturbation;
+	u32		perturbation;	/* Hash key */
+	int		rehash;		/* Key is due for a change */
 	sfq_index	tail;		/* Index of current slot in round */
 	sfq_index	max_depth;	/* Maximal depth */
 
-	sfq_index	ht[SFQ_HASH_DIVISOR];	/* Hash table */
-	sfq_index	next[SFQ_DEPTH];	/* Active slots link */
-	short		allot[SFQ_DEPTH];	/* Current allotment per slot */
-	unsigned short	hash[SFQ_DEPTH];	/* Hash value indexed by slots */
-	struct sk_buff_head	qs[SFQ_DEPTH];		/* Slot queue */
-	struct sfq_head	dep[SFQ_DEPTH*2];	/* Linked list of slots, indexed by depth */
+	sfq_index	*ht;		/* Hash table, [divisor] */
+	sfq_index	*next;		/* Active slots link, [flows] */
+	short		*allot;		/* Current allotment per slot, [flows] */
+	sfq_index	*hash;		/* Hash value indexed by slots, [flows] */
+	struct sk_buff_head *qs;	/* Slot queue, [flows] */
+	struct sfq_head	*dep;		/* Linked list of slots, indexed by depth,
+					   [flows+depth+1] */
 };
 
-static __inline__ unsigned sfq_fold_hash(struct sfq_sched_data *q, u32 h, u32 h1)
-{
-	int pert = q->perturbation;
-
-	/* Have we any rotation primitives? If not, WHY? */
-	h ^= (h1<<pert) ^ (h1>>(0x1F - pert));
-	h ^= h>>10;
-	return h & 0x3FF;
-}
-
 #ifndef IPPROTO_ESP
 #define IPPROTO_ESP 50
 #endif
@@ -166,13 +174,13 @@ static unsigned sfq_hash(struct sfq_sched_data *q, struct sk_buff *skb)
 		h = (u32)(unsigned long)skb->dst^skb->protocol;
 		h2 = (u32)(unsigned long)skb->sk;
 	}
-	return sfq_fold_hash(q, h, h2);
+	return jhash_2words(h, h2, q->perturbation) & (q->divisor - 1);
 }
 
-extern __inline__ void sfq_link(struct sfq_sched_data *q, sfq_index x)
+static __inline__ void sfq_link(struct sfq_sched_data *q, sfq_index x)
 {
 	sfq_index p, n;
-	int d = q->qs[x].qlen + SFQ_DEPTH;
+	int d = q->qs[x].qlen + q->flows;
 
 	p = d;
 	n = q->dep[d].next;
@@ -181,7 +189,7 @@ extern __inline__ void sfq_link(struct sfq_sched_data *q, sfq_index x)
 	q->dep[p].next = q->dep[n].prev = x;
 }
 
-extern __inline__ void sfq_dec(struct sfq_sched_data *q, sfq_index x)
+static __inline__ void sfq_dec(struct sfq_sched_data *q, sfq_index x)
 {
 	sfq_index p, n;
 
@@ -196,7 +204,7 @@ extern __inline__ void sfq_dec(struct sfq_sched_data *q, sfq_index x)
 	sfq_link(q, x);
 }
 
-extern __inline__ void sfq_inc(struct sfq_sched_data *q, sfq_index x)
+static __inline__ void sfq_inc(struct sfq_sched_data *q, sfq_index x)
 {
 	sfq_index p, n;
 	int d;
@@ -212,6 +220,103 @@ extern __inline__ void sfq_inc(struct sfq_sched_data *q, sfq_index x)
 	sfq_link(q, x);
 }
 
+/* Slot for a packet with this hash value. Returns q->flows when
+   the flow already holds depth packets, or when it is new and
+   every slot is busy. */
+
+static sfq_index sfq_slot(struct sfq_sched_data *q, unsigned hash)
+{
+	sfq_index x = q->ht[hash];
+
+	if (x == q->flows) {
+		/* Free slots are those of depth 0; the list head is q->flows */
+		x = q->dep[q->flows].next;
+		if (x != q->flows) {
+			q->ht[hash] = x;
+			q->hash[x] = hash;
+		}
+	} else if (q->qs[x].qlen >= q->depth)
+		x = q->flows;
+	return x;
+}
+
+/* A packet was just added to slot x */
+
+static __inline__ void sfq_queued(struct sfq_sched_data *q, sfq_index x)
+{
+	sfq_inc(q, x);
+	if (q->qs[x].qlen == 1) {		/* The flow is new */
+		if (q->tail == q->flows) {	/* It is the first flow */
+			q->tail = x;
+			q->next[x] = x;
+			q->allot[x] = q->quantum;
+		} else {
+			q->next[x] = q->next[q->tail];
+			q->next[q->tail] = x;
+			q->tail = x;
+		}
+	}
+}
+
+/* Put all slots back to depth 0, with nothing active */
+
+static void sfq_reset_slots(struct sfq_sched_data *q)
+{
+	int i;
+
+	for (i=0; i<=q->depth; i++) {
+		q->dep[i+q->flows].next = i+q->flows;
+		q->dep[i+q->flows].prev = i+q->flows;
+	}
+	for (i=0; i<q->flows; i++) {
+		skb_queue_head_init(&q->qs[i]);
+		sfq_link(q, i);
+	}
+	q->max_depth = 0;
+	q->tail = q->flows;
+}
+
+/* Change the hash key. Packets already queued are pulled out in
+   round-robin order and queued again under the new key; a flow's
+   packets all sit in one slot, so they come back in the same order. */
+
+static void sfq_rehash(struct Qdisc *sch)
+{
+	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
+	struct sk_buff_head list;
+	struct sk_buff *skb;
+	sfq_index x;
+
+	q->rehash = 0;
+	q->perturbation = net_random();
+	if (q->tail == q->flows)
+		return;
+
+	skb_queue_head_init(&list);
+	x = q->tail;
+	do {
+		x = q->next[x];
+		q->ht[q->hash[x]] = q->flows;
+		while ((skb = __skb_dequeue(&q->qs[x])) != NULL)
+			__skb_queue_tail(&list, skb);
+	} while (x != q->tail);
+	sfq_reset_slots(q);
+	sch->q.qlen = 0;
+
+	while ((skb = __skb_dequeue(&list)) != NULL) {
+		/* Flows merged by the new key may not fit into one slot */
+		x = sfq_slot(q, sfq_hash(q, skb));
+		if (x == q->flows) {
+			kfree_skb(skb);
+			sch->stats.drops++;
+			continue;
+		}
+		__skb_queue_tail(&q->qs[x], skb);
+		sfq_queued(q, x);
+		sch->q.qlen++;
+	}
+}
+
 static int sfq_drop(struct Qdisc *sch)
 {
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
@@ -222,7 +327,7 @@ static int sfq_drop(struct Qdisc *sch)
 	   drop a packet from it */
 
 	if (d > 1) {
-		sfq_index x = q->dep[d+SFQ_DEPTH].next;
+		sfq_index x = q->dep[d+q->flows].next;
 		skb = q->qs[x].prev;
 		__skb_unlink(skb, &q->qs[x]);
 		kfree_skb(skb);
@@ -242,7 +347,7 @@ static int sfq_drop(struct Qdisc *sch)
 		kfree_skb(skb);
 		sfq_dec(q, d);
 		sch->q.qlen--;
-		q->ht[q->hash[d]] = SFQ_DEPTH;
+		q->ht[q->hash[d]] = q->flows;
 		sch->stats.drops++;
 		return 1;
 	}
@@ -254,28 +359,20 @@ static int
 sfq_enqueue(struct sk_buff *skb, struct Qdisc* sch)
 {
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
-	unsigned hash = sfq_hash(q, skb);
 	sfq_index x;
 
-	x = q->ht[hash];
-	if (x == SFQ_DEPTH) {
-		q->ht[hash] = x = q->dep[SFQ_DEPTH].next;
-		q->hash[x] = hash;
+	if (q->rehash)
+		sfq_rehash(sch);
+
+	x = sfq_slot(q, sfq_hash(q, skb));
+	if (x == q->flows) {
+		sch->stats.drops++;
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
 	}
 	__skb_queue_tail(&q->qs[x], skb);
-	sfq_inc(q, x);
-	if (q->qs[x].qlen == 1) {		/* The flow is new */
-		if (q->tail == SFQ_DEPTH) {	/* It is the first flow */
-			q->tail = x;
-			q->next[x] = x;
-			q->allot[x] = q->quantum;
-		} else {
-			q->next[x] = q->next[q->tail];
-			q->next[q->tail] = x;
-			q->tail = x;
-		}
-	}
-	if (++sch->q.qlen < SFQ_DEPTH-1) {
+	sfq_queued(q, x);
+	if (++sch->q.qlen <= q->limit) {
 		sch->stats.bytes += skb->len;
 		sch->stats.packets++;
 		return 0;
@@ -289,28 +386,17 @@ static int
 sfq_requeue(struct sk_buff *skb, struct Qdisc* sch)
 {
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
-	unsigned hash = sfq_hash(q, skb);
 	sfq_index x;
 
-	x = q->ht[hash];
-	if (x == SFQ_DEPTH) {
-		q->ht[hash] = x = q->dep[SFQ_DEPTH].next;
-		q->hash[x] = hash;
+	x = sfq_slot(q, sfq_hash(q, skb));
+	if (x == q->flows) {
+		sch->stats.drops++;
+		kfree_skb(skb);
+		return NET_XMIT_CN;
 	}
 	__skb_queue_head(&q->qs[x], skb);
-	sfq_inc(q, x);
-	if (q->qs[x].qlen == 1) {		/* The flow is new */
-		if (q->tail == SFQ_DEPTH) {	/* It is the first flow */
-			q->tail = x;
-			q->next[x] = x;
-			q->allot[x] = q->quantum;
-		} else {
-			q->next[x] = q->next[q->tail];
-			q->next[q->tail] = x;
-			q->tail = x;
-		}
-	}
-	if (++sch->q.qlen < SFQ_DEPTH-1)
+	sfq_queued(q, x);
+	if (++sch->q.qlen <= q->limit)
 		return 0;
 
 	sch->stats.drops++;
@@ -329,7 +415,7 @@ sfq_dequeue(struct Qdisc* sch)
 	sfq_index a, old_a;
 
 	/* No active slots */
-	if (q->tail == SFQ_DEPTH)
+	if (q->tail == q->flows)
 		return NULL;
 
 	a = old_a = q->next[q->tail];
@@ -341,9 +427,11 @@ sfq_dequeue(struct Qdisc* sch)
 
 	/* Is the slot empty? */
 	if (q->qs[a].qlen == 0) {
+		/* Give the slot back; the bucket is free for the next flow */
+		q->ht[q->hash[a]] = q->flows;
 		a = q->next[a];
 		if (a == old_a) {
-			q->tail = SFQ_DEPTH;
+			q->tail = q->flows;
 			return skb;
 		}
 		q->next[q->tail] = a;
@@ -370,8 +458,9 @@ static void sfq_perturbation(unsigned long arg)
 	struct Qdisc *sch = (struct Qdisc*)arg;
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
 
-	q->perturbation = net_random()&0x1F;
-	q->perturb_timer.expires = jiffies + q->perturb_period;
+	/* The queues are only touched under dev->queue_lock, which
+	   we do not hold here: the next enqueue does the rehash. */
+	q->rehash = 1;
 
 	if (q->perturb_period) {
 		q->perturb_timer.expires = jiffies + q->perturb_period;
@@ -379,27 +468,52 @@ static void sfq_perturbation(unsigned long arg)
 	}
 }
 
+/* Parameters are taken once, when the qdisc is created; the tables
+   are sized from them, so they cannot change in flight. An old
+   struct tc_sfq_qopt without depth is accepted. */
+
 static int sfq_change(struct Qdisc *sch, struct rtattr *opt)
 {
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
 	struct tc_sfq_qopt *ctl = RTA_DATA(opt);
 
-	if (opt->rta_len < RTA_LENGTH(sizeof(*ctl)))
+	if (opt->rta_len < RTA_LENGTH(offsetof(struct tc_sfq_qopt, depth)))
+		return -EINVAL;
+
+	if (ctl->flows > SFQ_MAX_FLOWS ||
+	    ctl->divisor > SFQ_MAX_DIVISOR ||
+	    (ctl->divisor & (ctl->divisor - 1)))
 		return -EINVAL;
+	if (opt->rta_len >= RTA_LENGTH(sizeof(*ctl))) {
+		if (ctl->depth > SFQ_MAX_DEPTH)
+			return -EINVAL;
+		if (ctl->depth)
+			q->depth = ctl->depth;
+	}
 
-	sch_tree_lock(sch);
 	q->quantum = ctl->quantum ? : psched_mtu(sch->dev);
 	q->perturb_period = ctl->perturb_period*HZ;
-
-	del_timer(&q->perturb_timer);
-	if (q->perturb_period) {
-		q->perturb_timer.expires = jiffies + q->perturb_period;
-		add_timer(&q->perturb_timer);
-	}
-	sch_tree_unlock(sch);
+	if (ctl->flows)
+		q->flows = ctl->flows;
+	if (ctl->divisor)
+		q->divisor = ctl->divisor;
+	if (ctl->limit)
+		q->limit = ctl->limit;
+	if (q->limit > q->flows*q->depth)
+		q->limit = q->flows*q->depth;
 	return 0;
 }
 
+static void sfq_free_tables(struct sfq_sched_data *q)
+{
+	kfree(q->ht);
+	kfree(q->next);
+	kfree(q->allot);
+	kfree(q->hash);
+	kfree(q->qs);
+	kfree(q->dep);
+}
+
 static int sfq_init(struct Qdisc *sch, struct rtattr *opt)
 {
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
@@ -409,25 +523,41 @@ static int sfq_init(struct Qdisc *sch, struct rtattr *opt)
 	q->perturb_timer.function = sfq_perturbation;
 	init_timer(&q->perturb_timer);
 
-	for (i=0; i<SFQ_HASH_DIVISOR; i++)
-		q->ht[i] = SFQ_DEPTH;
-	for (i=0; i<SFQ_DEPTH; i++) {
-		skb_queue_head_init(&q->qs[i]);
-		q->dep[i+SFQ_DEPTH].next = i+SFQ_DEPTH;
-		q->dep[i+SFQ_DEPTH].prev = i+SFQ_DEPTH;
-	}
-	q->max_depth = 0;
-	q->tail = SFQ_DEPTH;
-	if (opt == NULL) {
-		q->quantum = psched_mtu(sch->dev);
-		q->perturb_period = 0;
-	} else {
+	q->quantum = psched_mtu(sch->dev);
+	q->perturb_period = 0;
+	q->flows = SFQ_DEF_FLOWS;
+	q->divisor = SFQ_DEF_DIVISOR;
+	q->depth = SFQ_DEF_DEPTH;
+	q->limit = SFQ_DEF_LIMIT;
+	if (opt) {
 		int err = sfq_change(sch, opt);
 		if (err)
 			return err;
 	}
-	for (i=0; i<SFQ_DEPTH; i++)
-		sfq_link(q, i);
+
+	q->ht = kmalloc(q->divisor*sizeof(sfq_index), GFP_KERNEL);
+	q->next = kmalloc(q->flows*sizeof(sfq_index), GFP_KERNEL);
+	q->allot = kmalloc(q->flows*sizeof(short), GFP_KERNEL);
+	q->hash = kmalloc(q->flows*sizeof(sfq_index), GFP_KERNEL);
+	q->qs = kmalloc(q->flows*sizeof(struct sk_buff_head), GFP_KERNEL);
+	q->dep = kmalloc((q->flows+q->depth+1)*sizeof(struct sfq_head),
+			 GFP_KERNEL);
+	if (!q->ht || !q->next || !q->allot || !q->hash || !q->qs || !q->dep) {
+		sfq_free_tables(q);
+		return -ENOBUFS;
+	}
+
+	for (i=0; i<q->divisor; i++)
+		q->ht[i] = q->flows;
+	memset(q->allot, 0, q->flows*sizeof(short));
+	sfq_reset_slots(q);
+	q->perturbation = net_random();
+	q->rehash = 0;
+
+	if (q->perturb_period) {
+		q->perturb_timer.expires = jiffies + q->perturb_period;
+		add_timer(&q->perturb_timer);
+	}
 	MOD_INC_USE_COUNT;
 	return 0;
 }
@@ -435,7 +565,8 @@ static int sfq_init(struct Qdisc *sch, struct rtattr *opt)
 static void sfq_destroy(struct Qdisc *sch)
 {
 	struct sfq_sched_data *q = (struct sfq_sched_data *)sch->data;
-	del_timer(&q->perturb_timer);
+	del_timer_sync(&q->perturb_timer);
+	sfq_free_tables(q);
 	MOD_DEC_USE_COUNT;
 }
 
@@ -449,9 +580,10 @@ static int sfq_dump(struct Qdisc *sch, struct sk_buff *skb)
 	opt.quantum = q->quantum;
 	opt.perturb_period = q->perturb_period/HZ;
 
-	opt.limit = SFQ_DEPTH;
-	opt.divisor = SFQ_HASH_DIVISOR;
-	opt.flows = SFQ_DEPTH;
+	opt.limit = q->limit;
+	opt.divisor = q->divisor;
+	opt.flows = q->flows;
+	opt.depth = q->depth;
 
 	RTA_PUT(skb, TCA_OPTIONS, sizeof(opt), &opt);
 
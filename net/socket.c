@@ -104,6 +104,8 @@ static ssize_t sock_readv(struct file *file, const struct iovec *vector,
 			  unsigned long count, loff_t *ppos);
 static ssize_t sock_writev(struct file *file, const struct iovec *vector,
 			  unsigned long count, loff_t *ppos);
+static ssize_t sock_sendpage(struct file *file, struct page *page,
+			     int offset, size_t size, loff_t *ppos);
 
 
 /*
@@ -122,7 +124,8 @@ static struct file_operations socket_file_ops = {
 	release:	sock_close,
 	fasync:		sock_fasync,
 	readv:		sock_readv,
-	writev:		sock_writev
+	writev:		sock_writev,
+	sendpage:	sock_sendpage
 };
 
 /*
@@ -424,6 +427,37 @@ extern __inline__ void sockfd_put(struct socket *sock)
 	fput(sock->file);
 }
 
+/*
+ * sockfd_lookup() with fget_light(), for the send and receive calls:
+ * let go of the socket with fput_light(sock->file, *fput_needed).
+ */
+static struct socket *sockfd_lookup_light(int fd, int *err, int *fput_needed)
+{
+	struct file *file;
+	struct inode *inode;
+	struct socket *sock;
+
+	if (!(file = fget_light(fd, fput_needed)))
+	{
+		*err = -EBADF;
+		return NULL;
+	}
+
+	inode = file->f_dentry->d_inode;
+	if (!inode->i_sock || !(sock = socki_lookup(inode)))
+	{
+		*err = -ENOTSOCK;
+		fput_light(file, *fput_needed);
+		return NULL;
+	}
+
+	if (sock->file != file) {
+		printk(KERN_ERR "socki_lookup: socket file changed!\n");
+		sock->file = file;
+	}
+	return sock;
+}
+
 /**
  *	sock_alloc	-	allocate a socket
  *	
@@ -602,6 +636,44 @@ static ssize_t sock_write(struct file *file, const char *ubuf,
 	return sock_sendmsg(sock, &msg, size);
 }
 
+/*
+ *	Send part of a page, for sendfile() and splice().  Protocols
+ *	without a sendpage method get it through sendmsg.
+ */
+
+static ssize_t sock_sendpage(struct file *file, struct page *page,
+			     int offset, size_t size, loff_t *ppos)
+{
+	struct socket *sock;
+	int flags;
+
+	if (ppos != &file->f_pos)
+		return -ESPIPE;
+
+	sock = socki_lookup(file->f_dentry->d_inode);
+
+	flags = !(file->f_flags & O_NONBLOCK) ? 0 : MSG_DONTWAIT;
+	if (sock->ops->sendpage)
+		return sock->ops->sendpage(sock, page, offset, size, flags);
+	return sock_no_sendpage(sock, page, offset, size, flags);
+}
+
+/*
+ *	Receive into a file's page cache, for splice() from a socket.
+ */
+
+ssize_t sock_receive_file(struct file *file, struct file *out, size_t size,
+			  int flags)
+{
+	struct socket *sock = socki_lookup(file->f_dentry->d_inode);
+
+	if (!sock->ops->receive_file)
+		return -EINVAL;
+	if (file->f_flags & O_NONBLOCK)
+		flags |= MSG_DONTWAIT;
+	return sock->ops->receive_file(sock, out, size, flags);
+}
+
 int sock_readv_writev(int type, struct inode * inode, struct file * file,
 		      const struct iovec * iov, long count, long size)
 {
@@ -1166,12 +1238,13 @@ asmlinkage long sys_sendto(int fd, void * buff, size_t len, unsigned flags,
 			   struct sockaddr *addr, int addr_len)
 {
 	struct socket *sock;
+	int fput_needed;
 	char address[MAX_SOCK_ADDR];
 	int err;
 	struct msghdr msg;
 	struct iovec iov;
 	
-	sock = sockfd_lookup(fd, &err);
+	sock = sockfd_lookup_light(fd, &err, &fput_needed);
 	if (!sock)
 		goto out;
 	iov.iov_base=buff;
@@ -1195,7 +1268,7 @@ asmlinkage long sys_sendto(int fd, void * buff, size_t len, unsigned flags,
 	err = sock_sendmsg(sock, &msg, len);
 
 out_put:		
-	sockfd_put(sock);
+	fput_light(sock->file, fput_needed);
 out:
 	return err;
 }
@@ -1219,12 +1292,13 @@ asmlinkage long sys_recvfrom(int fd, void * ubuf, size_t size, unsigned flags,
 			     struct sockaddr *addr, int *addr_len)
 {
 	struct socket *sock;
+	int fput_needed;
 	struct iovec iov;
 	struct msghdr msg;
 	char address[MAX_SOCK_ADDR];
 	int err,err2;
 
-	sock = sockfd_lookup(fd, &err);
+	sock = sockfd_lookup_light(fd, &err, &fput_needed);
 	if (!sock)
 		goto out;
 
@@ -1246,7 +1320,7 @@ asmlinkage long sys_recvfrom(int fd, void * ubuf, size_t size, unsigned flags,
 		if(err2<0)
 			err=err2;
 	}
-	sockfd_put(sock);			
+	fput_light(sock->file, fput_needed);			
 out:
 	return err;
 }
@@ -1324,9 +1398,8 @@ asmlinkage long sys_shutdown(int fd, int how)
  *	BSD sendmsg interface
  */
 
-asmlinkage long sys_sendmsg(int fd, struct msghdr *msg, unsigned flags)
+static int __sys_sendmsg(struct socket *sock, struct msghdr *msg, unsigned flags)
 {
-	struct socket *sock;
 	char address[MAX_SOCK_ADDR];
 	struct iovec iovstack[UIO_FASTIOV], *iov = iovstack;
 	unsigned char ctl[sizeof(struct cmsghdr) + 20];	/* 20 is size of ipv6_pktinfo */
@@ -1338,14 +1411,10 @@ asmlinkage long sys_sendmsg(int fd, struct msghdr *msg, unsigned flags)
 	if (copy_from_user(&msg_sys,msg,sizeof(struct msghdr)))
 		goto out; 
 
-	sock = sockfd_lookup(fd, &err);
-	if (!sock) 
-		goto out;
-
 	/* do not move before msg_sys is valid */
 	err = -EINVAL;
 	if (msg_sys.msg_iovlen > UIO_MAXIOV)
-		goto out_put;
+		goto out;
 
 	/* Check whether to allocate the iovec area*/
 	err = -ENOMEM;
@@ -1353,7 +1422,7 @@ asmlinkage long sys_sendmsg(int fd, struct msghdr *msg, unsigned flags)
 	if (msg_sys.msg_iovlen > UIO_FASTIOV) {
 		iov = sock_kmalloc(sock->sk, iov_size, GFP_KERNEL);
 		if (!iov)
-			goto out_put;
+			goto out;
 	}
 
 	/* This will also move the address data into kernel space */
@@ -1392,19 +1461,64 @@ out_freectl:
 out_freeiov:
 	if (iov != iovstack)
 		sock_kfree_s(sock->sk, iov, iov_size);
-out_put:
-	sockfd_put(sock);
 out:       
 	return err;
 }
 
+asmlinkage long sys_sendmsg(int fd, struct msghdr *msg, unsigned flags)
+{
+	struct socket *sock;
+	int fput_needed;
+	int err;
+
+	sock = sockfd_lookup_light(fd, &err, &fput_needed);
+	if (!sock) 
+		goto out;
+	err = __sys_sendmsg(sock, msg, flags);
+	fput_light(sock->file, fput_needed);
+out:
+	return err;
+}
+
 /*
- *	BSD recvmsg interface
+ *	Send a vector of messages. Returns the number of messages
+ *	sent; the error stops the loop and is only returned when
+ *	no message went out.
  */
 
-asmlinkage long sys_recvmsg(int fd, struct msghdr *msg, unsigned int flags)
+asmlinkage long sys_sendmmsg(int fd, struct mmsghdr *mmsg, unsigned int vlen,
+			     unsigned flags)
 {
 	struct socket *sock;
+	int fput_needed;
+	int err, datagrams;
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	sock = sockfd_lookup_light(fd, &err, &fput_needed);
+	if (!sock)
+		return err;
+
+	for (datagrams = 0; datagrams < vlen; datagrams++, mmsg++) {
+		err = __sys_sendmsg(sock, &mmsg->msg_hdr, flags);
+		if (err < 0)
+			break;
+		err = put_user(err, &mmsg->msg_len);
+		if (err)
+			break;
+	}
+
+	fput_light(sock->file, fput_needed);
+	return datagrams ? datagrams : err;
+}
+
+/*
+ *	BSD recvmsg interface
+ */
+
+static int __sys_recvmsg(struct socket *sock, struct msghdr *msg, unsigned int flags)
+{
 	struct iovec iovstack[UIO_FASTIOV];
 	struct iovec *iov=iovstack;
 	struct msghdr msg_sys;
@@ -1422,13 +1536,9 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr *msg, unsigned int flags)
 	if (copy_from_user(&msg_sys,msg,sizeof(struct msghdr)))
 		goto out;
 
-	sock = sockfd_lookup(fd, &err);
-	if (!sock)
-		goto out;
-
 	err = -EINVAL;
 	if (msg_sys.msg_iovlen > UIO_MAXIOV)
-		goto out_put;
+		goto out;
 	
 	/* Check whether to allocate the iovec area*/
 	err = -ENOMEM;
@@ -1436,7 +1546,7 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr *msg, unsigned int flags)
 	if (msg_sys.msg_iovlen > UIO_FASTIOV) {
 		iov = sock_kmalloc(sock->sk, iov_size, GFP_KERNEL);
 		if (!iov)
-			goto out_put;
+			goto out;
 	}
 
 	/*
@@ -1478,12 +1588,86 @@ asmlinkage long sys_recvmsg(int fd, struct msghdr *msg, unsigned int flags)
 out_freeiov:
 	if (iov != iovstack)
 		sock_kfree_s(sock->sk, iov, iov_size);
-out_put:
-	sockfd_put(sock);
 out:
 	return err;
 }
 
+asmlinkage long sys_recvmsg(int fd, struct msghdr *msg, unsigned int flags)
+{
+	struct socket *sock;
+	int fput_needed;
+	int err;
+
+	sock = sockfd_lookup_light(fd, &err, &fput_needed);
+	if (!sock)
+		goto out;
+	err = __sys_recvmsg(sock, msg, flags);
+	fput_light(sock->file, fput_needed);
+out:
+	return err;
+}
+
+/*
+ *	Receive up to vlen messages. Without MSG_DONTWAIT this waits
+ *	for all of them; MSG_WAITFORONE stops waiting once one has
+ *	arrived. The timeout, if given, is checked after each message
+ *	and gets the time left written back.
+ */
+
+asmlinkage long sys_recvmmsg(int fd, struct mmsghdr *mmsg, unsigned int vlen,
+			     unsigned int flags, struct timespec *timeout)
+{
+	struct socket *sock;
+	struct timespec ts;
+	unsigned long expires = 0;
+	int fput_needed;
+	int err, datagrams;
+
+	if (timeout) {
+		if (copy_from_user(&ts, timeout, sizeof(ts)))
+			return -EFAULT;
+		if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000L)
+			return -EINVAL;
+		expires = jiffies + timespec_to_jiffies(&ts);
+	}
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	sock = sockfd_lookup_light(fd, &err, &fput_needed);
+	if (!sock)
+		return err;
+
+	for (datagrams = 0; datagrams < vlen; datagrams++, mmsg++) {
+		err = __sys_recvmsg(sock, &mmsg->msg_hdr, flags & ~MSG_WAITFORONE);
+		if (err < 0)
+			break;
+		err = put_user(err, &mmsg->msg_len);
+		if (err)
+			break;
+
+		if (flags & MSG_WAITFORONE)
+			flags |= MSG_DONTWAIT;
+		if (timeout && time_after_eq(jiffies, expires)) {
+			datagrams++;
+			break;
+		}
+	}
+
+	/* Keep a real error for the next call, as a short read would */
+	if (datagrams && err < 0 && err != -EAGAIN)
+		sock->sk->err = -err;
+
+	fput_light(sock->file, fput_needed);
+
+	if (timeout) {
+		jiffies_to_timespec(time_after(expires, jiffies) ?
+				    expires - jiffies : 0, &ts);
+		if (copy_to_user(timeout, &ts, sizeof(ts)) && !datagrams)
+			return -EFAULT;
+	}
+	return datagrams ? datagrams : err;
+}
+
 
 /*
  *	Perform a file control on a socket file descriptor.
@@ -1504,9 +1688,10 @@ int sock_fcntl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 /* Argument list sizes for sys_socketcall */
 #define AL(x) ((x) * sizeof(unsigned long))
-static unsigned char nargs[18]={AL(0),AL(3),AL(3),AL(3),AL(2),AL(3),
+static unsigned char nargs[20]={AL(0),AL(3),AL(3),AL(3),AL(2),AL(3),
 				AL(3),AL(3),AL(4),AL(4),AL(4),AL(6),
-				AL(6),AL(2),AL(5),AL(5),AL(3),AL(3)};
+				AL(6),AL(2),AL(5),AL(5),AL(3),AL(3),
+				AL(5),AL(4)};
 #undef AL
 
 /*
@@ -1523,7 +1708,7 @@ asmlinkage long sys_socketcall(int call, unsigned long *args)
 	unsigned long a0,a1;
 	int err;
 
-	if(call<1||call>SYS_RECVMSG)
+	if(call<1||call>SYS_SENDMMSG)
 		return -EINVAL;
 
 	/* copy_from_user should be SMP safe. */
@@ -1588,6 +1773,13 @@ asmlinkage long sys_socketcall(int call, unsigned long *args)
 		case SYS_RECVMSG:
 			err = sys_recvmsg(a0, (struct msghdr *) a1, a[2]);
 			break;
+		case SYS_RECVMMSG:
+			err = sys_recvmmsg(a0, (struct mmsghdr *) a1, a[2], a[3],
+					   (struct timespec *) a[4]);
+			break;
+		case SYS_SENDMMSG:
+			err = sys_sendmmsg(a0, (struct mmsghdr *) a1, a[2], a[3]);
+			break;
 		default:
 			err = -EINVAL;
 			break;
@@ -69,15 +69,18 @@ rpcauth_destroy(struct rpc_auth *auth)
 	auth->au_ops->destroy(auth);
 }
 
-spinlock_t rpc_credcache_lock = SPIN_LOCK_UNLOCKED;
-
 /*
- * Initialize RPC credential cache
+ * Initialize RPC credential cache.  Each chain has its own lock, so that
+ * tasks of different users don't serialize on the cache.
  */
 void
 rpcauth_init_credcache(struct rpc_auth *auth)
 {
+	int		i;
+
 	memset(auth->au_credcache, 0, sizeof(auth->au_credcache));
+	for (i = 0; i < RPC_CREDCACHE_NR; i++)
+		spin_lock_init(&auth->au_credlock[i]);
 	auth->au_nextgc = jiffies + (auth->au_expire >> 1);
 }
 
@@ -108,15 +111,15 @@ rpcauth_free_credcache(struct rpc_auth *auth)
 	if (!(destroy = auth->au_ops->crdestroy))
 		destroy = (void (*)(struct rpc_cred *)) rpc_free;
 
-	spin_lock(&rpc_credcache_lock);
 	for (i = 0; i < RPC_CREDCACHE_NR; i++) {
+		spin_lock(&auth->au_credlock[i]);
 		q = &auth->au_credcache[i];
 		while ((cred = *q) != NULL) {
 			*q = cred->cr_next;
 			destroy(cred);
 		}
+		spin_unlock(&auth->au_credlock[i]);
 	}
-	spin_unlock(&rpc_credcache_lock);
 }
 
 /*
@@ -129,8 +132,10 @@ rpcauth_gc_credcache(struct rpc_auth *auth)
 	int		i;
 
 	dprintk("RPC: gc'ing RPC credentials for auth %p\n", auth);
-	spin_lock(&rpc_credcache_lock);
 	for (i = 0; i < RPC_CREDCACHE_NR; i++) {
+		if (!auth->au_credcache[i])
+			continue;
+		spin_lock(&auth->au_credlock[i]);
 		q = &auth->au_credcache[i];
 		while ((cred = *q) != NULL) {
 			if (!cred->cr_count &&
@@ -142,13 +147,12 @@ rpcauth_gc_credcache(struct rpc_auth *auth)
 			}
 			q = &cred->cr_next;
 		}
+		spin_unlock(&auth->au_credlock[i]);
 	}
-	spin_unlock(&rpc_credcache_lock);
 	while ((cred = free) != NULL) {
 		free = cred->cr_next;
 		rpcauth_crdestroy(auth, cred);
 	}
-	auth->au_nextgc = jiffies + auth->au_expire;
 }
 
 /*
@@ -159,13 +163,13 @@ rpcauth_insert_credcache(struct rpc_auth *auth, struct rpc_cred *cred)
 {
 	int		nr;
 
-	nr = (cred->cr_uid & RPC_CREDCACHE_MASK);
-	spin_lock(&rpc_credcache_lock);
+	nr = rpcauth_credhash(cred->cr_uid);
+	spin_lock(&auth->au_credlock[nr]);
 	cred->cr_next = auth->au_credcache[nr];
 	auth->au_credcache[nr] = cred;
 	cred->cr_count++;
 	cred->cr_expire = jiffies + auth->au_expire;
-	spin_unlock(&rpc_credcache_lock);
+	spin_unlock(&auth->au_credlock[nr]);
 }
 
 /*
@@ -178,33 +182,40 @@ rpcauth_lookup_credcache(struct rpc_auth *auth, int taskflags)
 	int		nr = 0;
 
 	if (!(taskflags & RPC_TASK_ROOTCREDS))
-		nr = current->uid & RPC_CREDCACHE_MASK;
+		nr = rpcauth_credhash(current->uid);
 
-	if (time_before(auth->au_nextgc, jiffies))
+	if (time_before(auth->au_nextgc, jiffies)) {
+		/* Only one caller does it */
+		auth->au_nextgc = jiffies + auth->au_expire;
 		rpcauth_gc_credcache(auth);
+	}
 
-	spin_lock(&rpc_credcache_lock);
+	/* A hit is moved to the front of its chain and held there */
+	spin_lock(&auth->au_credlock[nr]);
 	q = &auth->au_credcache[nr];
 	while ((cred = *q) != NULL) {
 		if (!(cred->cr_flags & RPCAUTH_CRED_DEAD) &&
 		    auth->au_ops->crmatch(cred, taskflags)) {
 			*q = cred->cr_next;
+			cred->cr_next = auth->au_credcache[nr];
+			auth->au_credcache[nr] = cred;
+			cred->cr_count++;
+			cred->cr_expire = jiffies + auth->au_expire;
 			break;
 		}
 		q = &cred->cr_next;
 	}
-	spin_unlock(&rpc_credcache_lock);
+	spin_unlock(&auth->au_credlock[nr]);
+	if (cred)
+		return cred;
 
-	if (!cred) {
-		cred = auth->au_ops->crcreate(taskflags);
+	cred = auth->au_ops->crcreate(taskflags);
+	if (cred) {
 #ifdef RPC_DEBUG
-		if (cred)
-			cred->cr_magic = RPCAUTH_CRED_MAGIC;
+		cred->cr_magic = RPCAUTH_CRED_MAGIC;
 #endif
-	}
-
-	if (cred)
 		rpcauth_insert_credcache(auth, cred);
+	}
 
 	return (struct rpc_cred *) cred;
 }
@@ -218,8 +229,8 @@ rpcauth_remove_credcache(struct rpc_auth *auth, struct rpc_cred *cred)
 	struct rpc_cred	**q, *cr;
 	int		nr;
 
-	nr = (cred->cr_uid & RPC_CREDCACHE_MASK);
-	spin_lock(&rpc_credcache_lock);
+	nr = rpcauth_credhash(cred->cr_uid);
+	spin_lock(&auth->au_credlock[nr]);
 	q = &auth->au_credcache[nr];
 	while ((cr = *q) != NULL) {
 		if (cred == cr) {
@@ -229,7 +240,7 @@ rpcauth_remove_credcache(struct rpc_auth *auth, struct rpc_cred *cred)
 		}
 		q = &cred->cr_next;
 	}
-	spin_unlock(&rpc_credcache_lock);
+	spin_unlock(&auth->au_credlock[nr]);
 }
 
 struct rpc_cred *
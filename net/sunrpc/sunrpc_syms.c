@@ -68,10 +68,13 @@ EXPORT_SYMBOL(rpcauth_releasecred);
 
 /* RPC server stuff */
 EXPORT_SYMBOL(svc_create);
+EXPORT_SYMBOL(svc_create_pooled);
 EXPORT_SYMBOL(svc_create_thread);
+EXPORT_SYMBOL(svc_bind_pool);
 EXPORT_SYMBOL(svc_exit_thread);
 EXPORT_SYMBOL(svc_destroy);
 EXPORT_SYMBOL(svc_drop);
+EXPORT_SYMBOL(svc_release_pages);
 EXPORT_SYMBOL(svc_process);
 EXPORT_SYMBOL(svc_recv);
 EXPORT_SYMBOL(svc_wake_up);
@@ -26,10 +26,12 @@
 /*
  * Create an RPC service
  */
-struct svc_serv *
-svc_create(struct svc_program *prog, unsigned int bufsize, unsigned int xdrsize)
+static struct svc_serv *
+__svc_create(struct svc_program *prog, unsigned int bufsize,
+	     unsigned int xdrsize, unsigned int npools)
 {
 	struct svc_serv	*serv;
+	unsigned int	i;
 
 	xdr_init();
 #ifdef RPC_DEBUG
@@ -40,6 +42,17 @@ svc_create(struct svc_program *prog, unsigned int bufsize, unsigned int xdrsize)
 		return NULL;
 
 	memset(serv, 0, sizeof(*serv));
+	serv->sv_pools = kmalloc(npools * sizeof(struct svc_pool), GFP_KERNEL);
+	if (!serv->sv_pools) {
+		kfree(serv);
+		return NULL;
+	}
+	memset(serv->sv_pools, 0, npools * sizeof(struct svc_pool));
+	for (i = 0; i < npools; i++) {
+		spin_lock_init(&serv->sv_pools[i].sp_lock);
+		serv->sv_pools[i].sp_cpu = i;
+	}
+	serv->sv_nrpools   = npools;
 	serv->sv_program   = prog;
 	serv->sv_nrthreads = 1;
 	serv->sv_stats     = prog->pg_stats;
@@ -55,6 +68,22 @@ svc_create(struct svc_program *prog, unsigned int bufsize, unsigned int xdrsize)
 	return serv;
 }
 
+struct svc_serv *
+svc_create(struct svc_program *prog, unsigned int bufsize, unsigned int xdrsize)
+{
+	return __svc_create(prog, bufsize, xdrsize, 1);
+}
+
+/*
+ * Create an RPC service with a pool of threads per CPU
+ */
+struct svc_serv *
+svc_create_pooled(struct svc_program *prog, unsigned int bufsize,
+		  unsigned int xdrsize)
+{
+	return __svc_create(prog, bufsize, xdrsize, smp_num_cpus);
+}
+
 /*
  * Destroy an RPC service
  */
@@ -78,6 +107,7 @@ svc_destroy(struct svc_serv *serv)
 
 	/* Unregister service with the portmapper */
 	svc_register(serv, 0, 0);
+	kfree(serv->sv_pools);
 	kfree(serv);
 }
 
@@ -99,6 +129,8 @@ svc_init_buffer(struct svc_buf *bufp, unsigned int size)
 	bufp->iov[0].iov_base = bufp->area;
 	bufp->iov[0].iov_len  = size;
 	bufp->nriov = 1;
+	bufp->nrpages = 0;
+	bufp->pglen = 0;
 
 	return 1;
 }
@@ -134,6 +166,9 @@ svc_create_thread(svc_thread_fn func, struct svc_serv *serv)
 	 || !svc_init_buffer(&rqstp->rq_defbuf, serv->sv_bufsz))
 		goto out_thread;
 
+	/* Deal the threads out to the pools in turn */
+	rqstp->rq_pool = &serv->sv_pools[(serv->sv_nrthreads - 1) %
+					 serv->sv_nrpools];
 	serv->sv_nrthreads++;
 	rqstp->rq_server = serv;
 	error = kernel_thread((int (*)(void *)) func, rqstp, 0);
@@ -148,6 +183,23 @@ out_thread:
 	goto out;
 }
 
+/*
+ * Move the calling server thread onto the CPU of its pool. The threads
+ * of a service with a single pool may run anywhere.
+ */
+void
+svc_bind_pool(struct svc_rqst *rqstp)
+{
+	int	cpu;
+
+	if (rqstp->rq_server->sv_nrpools == 1)
+		return;
+	cpu = cpu_logical_map(rqstp->rq_pool->sp_cpu);
+	set_cpus_allowed(current, 1UL << cpu);
+	while (smp_processor_id() != cpu)
+		schedule();
+}
+
 /*
  * Destroy an RPC server thread
  */
@@ -320,8 +372,10 @@ svc_process(struct svc_serv *serv, struct svc_rqst *rqstp)
 	}
 
 	/* Check RPC status result */
-	if (*statp != rpc_success)
+	if (*statp != rpc_success) {
 		resp->len = statp + 1 - resp->base;
+		svc_release_pages(rqstp);
+	}
 
 	/* Release reply info */
 	if (procp->pc_release)
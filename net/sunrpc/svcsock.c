@@ -31,6 +31,8 @@
 #include <linux/malloc.h>
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
 #include <net/sock.h>
 #include <net/checksum.h>
 #include <net/ip.h>
@@ -43,10 +45,12 @@
 
 /* SMP locking strategy:
  *
- * 	svc_sock->sk_lock and svc_serv->sv_lock protect their
- *	respective structures.
+ * 	svc_sock->sk_lock, svc_pool->sp_lock and svc_serv->sv_lock
+ *	protect their respective structures. sv_lock only covers the
+ *	list of all sockets; the idle threads and the sockets waiting
+ *	for one are kept per pool.
  *
- *	Antideadlock ordering is sk_lock --> sv_lock.
+ *	Antideadlock ordering is sk_lock --> sv_lock --> sp_lock.
  */
 
 #define RPCDBG_FACILITY	RPCDBG_SVCSOCK
@@ -60,21 +64,32 @@ static int		svc_udp_sendto(struct svc_rqst *);
 
 
 /*
- * Queue up an idle server thread.  Must have serv->sv_lock held.
+ * Queue up an idle server thread.  Must have pool->sp_lock held.
  */
 static inline void
-svc_serv_enqueue(struct svc_serv *serv, struct svc_rqst *rqstp)
+svc_pool_enqueue(struct svc_pool *pool, struct svc_rqst *rqstp)
 {
-	rpc_append_list(&serv->sv_threads, rqstp);
+	rpc_append_list(&pool->sp_threads, rqstp);
 }
 
 /*
- * Dequeue an nfsd thread.  Must have serv->sv_lock held.
+ * Dequeue an nfsd thread.  Must have pool->sp_lock held.
  */
 static inline void
-svc_serv_dequeue(struct svc_serv *serv, struct svc_rqst *rqstp)
+svc_pool_dequeue(struct svc_pool *pool, struct svc_rqst *rqstp)
 {
-	rpc_remove_list(&serv->sv_threads, rqstp);
+	rpc_remove_list(&pool->sp_threads, rqstp);
+}
+
+/*
+ * The pool of the CPU we are running on, which for a socket that just
+ * got data is the CPU that took the network interrupt.
+ */
+static inline struct svc_pool *
+svc_pool_for_cpu(struct svc_serv *serv)
+{
+	return &serv->sv_pools[cpu_number_map(smp_processor_id()) %
+			       serv->sv_nrpools];
 }
 
 /*
@@ -93,9 +108,35 @@ svc_release_skb(struct svc_rqst *rqstp)
 	skb_free_datagram(rqstp->rq_sock->sk_sk, skb);
 }
 
+/*
+ * Hand a socket with data pending to an idle thread of the given pool,
+ * if there is one.  Must be called with pool->sp_lock held.
+ */
+static inline int
+svc_pool_wake(struct svc_pool *pool, struct svc_sock *svsk)
+{
+	struct svc_rqst	*rqstp;
+
+	if ((rqstp = pool->sp_threads) == NULL)
+		return 0;
+	dprintk("svc: socket %p served by daemon %p\n",
+		svsk->sk_sk, rqstp);
+	svc_pool_dequeue(pool, rqstp);
+	if (rqstp->rq_sock)
+		printk(KERN_ERR 
+			"svc_sock_enqueue: server %p, rq_sock=%p!\n",
+			rqstp, rqstp->rq_sock);
+	rqstp->rq_sock = svsk;
+	svsk->sk_inuse++;
+	wake_up(&rqstp->rq_wait);
+	return 1;
+}
+
 /*
  * Queue up a socket with data pending. If there are idle nfsd
- * processes, wake 'em up.
+ * processes, wake 'em up: preferably one of the pool of this CPU,
+ * else one of any other pool. Only when every thread is busy does
+ * the socket wait, on this CPU's pool.
  *
  * This must be called with svsk->sk_lock held.
  */
@@ -103,19 +144,13 @@ static void
 svc_sock_enqueue(struct svc_sock *svsk)
 {
 	struct svc_serv	*serv = svsk->sk_server;
-	struct svc_rqst	*rqstp;
-
-	/* NOTE: Local BH is already disabled by our caller. */
-	spin_lock(&serv->sv_lock);
-
-	if (serv->sv_threads && serv->sv_sockets)
-		printk(KERN_ERR
-			"svc_sock_enqueue: threads and sockets both waiting??\n");
+	struct svc_pool	*local, *pool;
+	unsigned int	i;
 
 	if (svsk->sk_busy) {
 		/* Don't enqueue socket while daemon is receiving */
 		dprintk("svc: socket %p busy, not enqueued\n", svsk->sk_sk);
-		goto out_unlock;
+		return;
 	}
 
 	/* Mark socket as busy. It will remain in this state until the
@@ -124,37 +159,42 @@ svc_sock_enqueue(struct svc_sock *svsk)
 	 */
 	svsk->sk_busy = 1;
 
-	if ((rqstp = serv->sv_threads) != NULL) {
-		dprintk("svc: socket %p served by daemon %p\n",
-			svsk->sk_sk, rqstp);
-		svc_serv_dequeue(serv, rqstp);
-		if (rqstp->rq_sock)
-			printk(KERN_ERR 
-				"svc_sock_enqueue: server %p, rq_sock=%p!\n",
-				rqstp, rqstp->rq_sock);
-		rqstp->rq_sock = svsk;
-		svsk->sk_inuse++;
-		wake_up(&rqstp->rq_wait);
-	} else {
+	/* NOTE: Local BH is already disabled by our caller. */
+	local = svc_pool_for_cpu(serv);
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		pool = &serv->sv_pools[(local - serv->sv_pools + i) %
+				       serv->sv_nrpools];
+		spin_lock(&pool->sp_lock);
+		if (pool->sp_threads && pool->sp_sockets)
+			printk(KERN_ERR
+				"svc_sock_enqueue: threads and sockets both waiting??\n");
+		if (svc_pool_wake(pool, svsk)) {
+			spin_unlock(&pool->sp_lock);
+			return;
+		}
+		spin_unlock(&pool->sp_lock);
+	}
+
+	spin_lock(&local->sp_lock);
+	if (!svc_pool_wake(local, svsk)) {
 		dprintk("svc: socket %p put into queue\n", svsk->sk_sk);
-		rpc_append_list(&serv->sv_sockets, svsk);
+		rpc_append_list(&local->sp_sockets, svsk);
+		svsk->sk_pool = local;
 		svsk->sk_qued = 1;
 	}
-
-out_unlock:
-	spin_unlock(&serv->sv_lock);
+	spin_unlock(&local->sp_lock);
 }
 
 /*
- * Dequeue the first socket.  Must be called with the serv->sv_lock held.
+ * Dequeue the first socket.  Must be called with the pool->sp_lock held.
  */
 static inline struct svc_sock *
-svc_sock_dequeue(struct svc_serv *serv)
+svc_sock_dequeue(struct svc_pool *pool)
 {
 	struct svc_sock	*svsk;
 
-	if ((svsk = serv->sv_sockets) != NULL)
-		rpc_remove_list(&serv->sv_sockets, svsk);
+	if ((svsk = pool->sp_sockets) != NULL)
+		rpc_remove_list(&pool->sp_sockets, svsk);
 
 	if (svsk) {
 		dprintk("svc: socket %p dequeued, inuse=%d\n",
@@ -204,6 +244,19 @@ svc_sock_accepted(struct svc_sock *svsk)
 	spin_unlock_bh(&svsk->sk_lock);
 }
 
+/*
+ * Drop the page cache pages held for a zero-copy reply.
+ */
+void
+svc_release_pages(struct svc_rqst *rqstp)
+{
+	struct svc_buf	*bufp = &rqstp->rq_resbuf;
+
+	while (bufp->nrpages)
+		page_cache_release(bufp->pages[--bufp->nrpages]);
+	bufp->pglen = 0;
+}
+
 /*
  * Release a socket after use.
  */
@@ -215,6 +268,7 @@ svc_sock_release(struct svc_rqst *rqstp)
 	if (!svsk)
 		return;
 	svc_release_skb(rqstp);
+	svc_release_pages(rqstp);
 	rqstp->rq_sock = NULL;
 	if (!--(svsk->sk_inuse) && svsk->sk_dead) {
 		dprintk("svc: releasing dead socket\n");
@@ -229,18 +283,25 @@ svc_sock_release(struct svc_rqst *rqstp)
 void
 svc_wake_up(struct svc_serv *serv)
 {
+	struct svc_pool	*pool;
 	struct svc_rqst	*rqstp;
-
-	spin_lock_bh(&serv->sv_lock);
-	if ((rqstp = serv->sv_threads) != NULL) {
-		dprintk("svc: daemon %p woken up.\n", rqstp);
-		/*
-		svc_serv_dequeue(serv, rqstp);
-		rqstp->rq_sock = NULL;
-		 */
-		wake_up(&rqstp->rq_wait);
+	unsigned int	i;
+
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		pool = &serv->sv_pools[i];
+		spin_lock_bh(&pool->sp_lock);
+		if ((rqstp = pool->sp_threads) != NULL) {
+			dprintk("svc: daemon %p woken up.\n", rqstp);
+			/*
+			svc_pool_dequeue(pool, rqstp);
+			rqstp->rq_sock = NULL;
+			 */
+			wake_up(&rqstp->rq_wait);
+			spin_unlock_bh(&pool->sp_lock);
+			return;
+		}
+		spin_unlock_bh(&pool->sp_lock);
 	}
-	spin_unlock_bh(&serv->sv_lock);
 }
 
 /*
@@ -277,6 +338,85 @@ svc_sendto(struct svc_rqst *rqstp, struct iovec *iov, int nr)
 	return len;
 }
 
+/*
+ * Append the page data of a reply and its XDR padding to the reply
+ * iovec, so that sendmsg copies it straight from the page cache.
+ * The pages stay mapped until svc_unmap_pages.
+ */
+static u32	svc_pad;
+
+static void
+svc_map_pages(struct svc_buf *bufp)
+{
+	struct iovec	*iov = bufp->iov + bufp->nriov;
+	unsigned int	offset = bufp->pgbase, left = bufp->pglen, len;
+	int		i;
+
+	for (i = 0; i < bufp->nrpages; i++) {
+		len = PAGE_SIZE - offset;
+		if (len > left)
+			len = left;
+		iov->iov_base = (char *) kmap(bufp->pages[i]) + offset;
+		iov->iov_len  = len;
+		iov++;
+		left -= len;
+		offset = 0;
+	}
+	if (bufp->pglen & 3) {
+		iov->iov_base = &svc_pad;
+		iov->iov_len  = 4 - (bufp->pglen & 3);
+		iov++;
+	}
+	bufp->nriov = iov - bufp->iov;
+}
+
+static void
+svc_unmap_pages(struct svc_buf *bufp)
+{
+	int		i;
+
+	for (i = 0; i < bufp->nrpages; i++)
+		kunmap(bufp->pages[i]);
+}
+
+/*
+ * Send the page data of a reply with the socket's sendpage method,
+ * then its XDR padding. Returns the number of bytes sent, or the
+ * error if nothing could be sent.
+ */
+static int
+svc_sendpages(struct svc_rqst *rqstp)
+{
+	struct svc_buf	*bufp = &rqstp->rq_resbuf;
+	struct socket	*sock = rqstp->rq_sock->sk_sock;
+	unsigned int	offset = bufp->pgbase, left = bufp->pglen, len;
+	struct iovec	iov;
+	int		i, sent = 0, result;
+
+	for (i = 0; i < bufp->nrpages; i++) {
+		len = PAGE_SIZE - offset;
+		if (len > left)
+			len = left;
+		result = sock->ops->sendpage(sock, bufp->pages[i], offset, len,
+							MSG_DONTWAIT);
+		if (result < 0)
+			return sent ? sent : result;
+		sent += result;
+		if (result != len)
+			return sent;
+		left -= len;
+		offset = 0;
+	}
+	if (bufp->pglen & 3) {
+		iov.iov_base = &svc_pad;
+		iov.iov_len  = 4 - (bufp->pglen & 3);
+		result = svc_sendto(rqstp, &iov, 1);
+		if (result > 0)
+			sent += result;
+	}
+	return sent;
+}
+
 /*
  * Check input queue length
  */
@@ -428,6 +568,12 @@ svc_udp_sendto(struct svc_rqst *rqstp)
 	bufp->iov[0].iov_base = bufp->base;
 	bufp->iov[0].iov_len  = bufp->len << 2;
 
+	/* A datagram has to go out in one sendmsg, so READ data is
+	 * copied from the page cache by the socket layer.
+	 */
+	if (bufp->nrpages)
+		svc_map_pages(bufp);
+
 	error = svc_sendto(rqstp, bufp->iov, bufp->nriov);
 	if (error == -ECONNREFUSED)
 		/* ICMP error on earlier request. */
@@ -436,6 +582,8 @@ svc_udp_sendto(struct svc_rqst *rqstp)
 		/* Ignore and wait for re-xmit */
 		error = 0;
 
+	if (bufp->nrpages)
+		svc_unmap_pages(bufp);
 	return error;
 }
 
@@ -732,7 +880,8 @@ static int
 svc_tcp_sendto(struct svc_rqst *rqstp)
 {
 	struct svc_buf	*bufp = &rqstp->rq_resbuf;
-	int sent;
+	struct socket	*sock = rqstp->rq_sock->sk_sock;
+	int sent, reclen, result;
 
 	/* Set up the first element of the reply iovec.
 	 * Any other iovecs that may be in use have been taken
@@ -740,13 +889,28 @@ svc_tcp_sendto(struct svc_rqst *rqstp)
 	 */
 	bufp->iov[0].iov_base = bufp->base;
 	bufp->iov[0].iov_len  = bufp->len << 2;
-	bufp->base[0] = htonl(0x80000000|((bufp->len << 2) - 4));
-
-	sent = svc_sendto(rqstp, bufp->iov, bufp->nriov);
-	if (sent != bufp->len<<2) {
+	reclen = (bufp->len << 2) + XDR_QUADLEN(bufp->pglen) * 4;
+	bufp->base[0] = htonl(0x80000000|(reclen - 4));
+
+	if (!bufp->nrpages) {
+		sent = svc_sendto(rqstp, bufp->iov, bufp->nriov);
+	} else if (!sock->ops->sendpage) {
+		svc_map_pages(bufp);
+		sent = svc_sendto(rqstp, bufp->iov, bufp->nriov);
+		svc_unmap_pages(bufp);
+	} else {
+		/* Header from the reply buffer, data from the page cache */
+		sent = svc_sendto(rqstp, bufp->iov, bufp->nriov);
+		if (sent == bufp->len << 2) {
+			result = svc_sendpages(rqstp);
+			if (result > 0)
+				sent += result;
+		}
+	}
+	if (sent != reclen) {
 		printk(KERN_NOTICE "rpc-srv/tcp: %s: sent only %d bytes of %d - should shutdown socket\n",
 		       rqstp->rq_sock->sk_server->sv_name,
-		       sent, bufp->len << 2);
+		       sent, reclen);
 		/* FIXME: should shutdown the socket, or allocate more memort
 		 * or wait and try again or something.  Otherwise
 		 * client will get confused
@@ -784,7 +948,9 @@ svc_tcp_init(struct svc_sock *svsk)
 int
 svc_recv(struct svc_serv *serv, struct svc_rqst *rqstp, long timeout)
 {
-	struct svc_sock		*svsk;
+	struct svc_pool		*pool = rqstp->rq_pool;
+	struct svc_sock		*svsk = NULL;
+	unsigned int		i;
 	int			len;
 	DECLARE_WAITQUEUE(wait, current);
 
@@ -807,13 +973,33 @@ svc_recv(struct svc_serv *serv, struct svc_rqst *rqstp, long timeout)
 	if (signalled())
 		return -EINTR;
 
-	spin_lock_bh(&serv->sv_lock);
-	if ((svsk = svc_sock_dequeue(serv)) != NULL) {
+	/* Sockets queued on other pools are only there because all of
+	 * their threads were busy; take them before going to sleep.
+	 */
+	for (i = 1; i < serv->sv_nrpools; i++) {
+		struct svc_pool *other;
+
+		other = &serv->sv_pools[(pool - serv->sv_pools + i) %
+					serv->sv_nrpools];
+		if (!other->sp_sockets)
+			continue;
+		spin_lock_bh(&other->sp_lock);
+		if ((svsk = svc_sock_dequeue(other)) != NULL)
+			svsk->sk_inuse++;
+		spin_unlock_bh(&other->sp_lock);
+		if (svsk)
+			break;
+	}
+
+	spin_lock_bh(&pool->sp_lock);
+	if (svsk != NULL) {
+		rqstp->rq_sock = svsk;
+	} else if ((svsk = svc_sock_dequeue(pool)) != NULL) {
 		rqstp->rq_sock = svsk;
 		svsk->sk_inuse++;
 	} else {
 		/* No data pending. Go to sleep */
-		svc_serv_enqueue(serv, rqstp);
+		svc_pool_enqueue(pool, rqstp);
 
 		/*
 		 * We have to be able to interrupt this wait
@@ -821,21 +1007,21 @@ svc_recv(struct svc_serv *serv, struct svc_rqst *rqstp, long timeout)
 		 */
 		set_current_state(TASK_INTERRUPTIBLE);
 		add_wait_queue(&rqstp->rq_wait, &wait);
-		spin_unlock_bh(&serv->sv_lock);
+		spin_unlock_bh(&pool->sp_lock);
 
 		schedule_timeout(timeout);
 
-		spin_lock_bh(&serv->sv_lock);
+		spin_lock_bh(&pool->sp_lock);
 		remove_wait_queue(&rqstp->rq_wait, &wait);
 
 		if (!(svsk = rqstp->rq_sock)) {
-			svc_serv_dequeue(serv, rqstp);
-			spin_unlock_bh(&serv->sv_lock);
+			svc_pool_dequeue(pool, rqstp);
+			spin_unlock_bh(&pool->sp_lock);
 			dprintk("svc: server %p, no data yet\n", rqstp);
 			return signalled()? -EINTR : -EAGAIN;
 		}
 	}
-	spin_unlock_bh(&serv->sv_lock);
+	spin_unlock_bh(&pool->sp_lock);
 
 	dprintk("svc: server %p, socket %p, inuse=%d\n",
 		 rqstp, svsk, svsk->sk_inuse);
@@ -1030,8 +1216,12 @@ svc_delete_socket(struct svc_sock *svsk)
 		return;
 	}
 	*rsk = svsk->sk_list;
-	if (svsk->sk_qued)
-		rpc_remove_list(&serv->sv_sockets, svsk);
+	if (svsk->sk_qued) {
+		spin_lock(&svsk->sk_pool->sp_lock);
+		if (svsk->sk_qued)
+			rpc_remove_list(&svsk->sk_pool->sp_sockets, svsk);
+		spin_unlock(&svsk->sk_pool->sp_lock);
+	}
 
 	spin_unlock_bh(&serv->sv_lock);
 
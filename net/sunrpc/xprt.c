@@ -63,6 +63,7 @@
 #include <net/sock.h>
 #include <net/checksum.h>
 #include <net/udp.h>
+#include <net/tcp.h>
 
 #include <asm/uaccess.h>
 
@@ -99,7 +100,6 @@ static void	xprt_disconnect(struct rpc_xprt *);
 static void	xprt_reconn_status(struct rpc_task *task);
 static struct socket *xprt_create_socket(int, struct rpc_timeout *);
 static int	xprt_bind_socket(struct rpc_xprt *, struct socket *);
-static void	xprt_remove_pending(struct rpc_xprt *);
 
 #ifdef RPC_DEBUG_DATA
 /*
@@ -242,43 +242,6 @@ xprt_sendmsg(struct rpc_xprt *xprt, struct rpc_rqst *req)
 	return result;
 }
 
-/*
- * Read data from socket
- */
-static int
-xprt_recvmsg(struct rpc_xprt *xprt, struct iovec *iov, int nr, unsigned len, unsigned shift)
-{
-	struct socket	*sock = xprt->sock;
-	struct msghdr	msg;
-	mm_segment_t	oldfs;
-	struct iovec	niv[MAX_IOVEC];
-	int		result;
-
-	if (!sock)
-		return -ENOTCONN;
-
-	msg.msg_flags   = MSG_DONTWAIT|MSG_NOSIGNAL;
-	msg.msg_iov	= iov;
-	msg.msg_iovlen	= nr;
-	msg.msg_name	= NULL;
-	msg.msg_namelen = 0;
-	msg.msg_control = NULL;
-	msg.msg_controllen = 0;
-
-	/* Adjust the iovec if we've already filled it */
-	if (shift)
-		xprt_move_iov(&msg, niv, shift);
-
-	oldfs = get_fs(); set_fs(get_ds());
-	result = sock_recvmsg(sock, &msg, len, MSG_DONTWAIT);
-	set_fs(oldfs);
-
-	dprintk("RPC:      xprt_recvmsg(iov %p, len %d) = %d\n",
-						iov, len, result);
-	return result;
-}
-
-
 /*
  * Adjust RPC congestion window
  * We use a time-smoothed congestion estimator to avoid heavy oscillation.
@@ -393,7 +356,6 @@ xprt_disconnect(struct rpc_xprt *xprt)
 {
 	dprintk("RPC:      disconnected transport %p\n", xprt);
 	xprt_clear_connected(xprt);
-	xprt_remove_pending(xprt);
 	rpc_wake_up_status(&xprt->pending, -ENOTCONN);
 }
 
@@ -696,32 +658,77 @@ udp_data_ready(struct sock *sk, int len)
 }
 
 /*
- * TCP read fragment marker
+ * TCP receive
+ *
+ * Replies are parsed straight out of the socket's receive queue by
+ * tcp_read_sock(), from tcp_data_ready. Record markers and XIDs are
+ * picked out of the byte stream as they go by, and the reply itself is
+ * copied once, from the skb into the request's receive iovec, which for
+ * NFS READ points at the page cache pages being filled.
  */
-static inline int
-tcp_read_fraghdr(struct rpc_xprt *xprt)
+typedef struct {
+	char *		from;	/* next byte of the skb */
+	size_t		count;	/* bytes left in the skb */
+} tcp_reader_t;
+
+static inline size_t
+tcp_copy_data(tcp_reader_t *rd, void *to, size_t len)
 {
-	struct iovec	riov;
-	int		want, result;
+	if (len > rd->count)
+		len = rd->count;
+	memcpy(to, rd->from, len);
+	rd->from  += len;
+	rd->count -= len;
+	return len;
+}
 
-	if (xprt->tcp_offset >= xprt->tcp_reclen + sizeof(xprt->tcp_recm)) {
-		xprt->tcp_offset = 0;
-		xprt->tcp_reclen = 0;
+/*
+ * Copy to an iovec, skipping the first shift bytes of it
+ */
+static inline size_t
+tcp_copy_to_iov(tcp_reader_t *rd, struct iovec *iov, int nr,
+			unsigned int shift, size_t len)
+{
+	size_t	copied = 0, want;
+
+	for (; nr && shift >= iov->iov_len; nr--, iov++)
+		shift -= iov->iov_len;
+	for (; nr && len; nr--, iov++) {
+		want = iov->iov_len - shift;
+		if (want > len)
+			want = len;
+		want = tcp_copy_data(rd, (char *) iov->iov_base + shift, want);
+		copied += want;
+		len    -= want;
+		shift   = 0;
 	}
-	if (xprt->tcp_offset >= sizeof(xprt->tcp_recm))
-		goto done;
+	return copied;
+}
+
+/*
+ * Bytes of the current fragment not yet read
+ */
+static inline unsigned int
+tcp_fragment_left(struct rpc_xprt *xprt)
+{
+	return xprt->tcp_reclen + sizeof(xprt->tcp_recm) - xprt->tcp_offset;
+}
+
+/*
+ * TCP read fragment marker
+ */
+static inline void
+tcp_read_fraghdr(struct rpc_xprt *xprt, tcp_reader_t *rd)
+{
+	size_t	want, used;
 
 	want = sizeof(xprt->tcp_recm) - xprt->tcp_offset;
-	dprintk("RPC:      reading header (%d bytes)\n", want);
-	do {
-		riov.iov_base = ((u8*) &xprt->tcp_recm) + xprt->tcp_offset;
-		riov.iov_len  = want;
-		result = xprt_recvmsg(xprt, &riov, 1, want, 0);
-		if (result < 0)
-			return result;
-		xprt->tcp_offset += result;
-		want -= result;
-	} while (want);
+	dprintk("RPC:      reading header (%Zd bytes)\n", want);
+	used = tcp_copy_data(rd, ((u8*) &xprt->tcp_recm) + xprt->tcp_offset,
+				want);
+	xprt->tcp_offset += used;
+	if (used != want)
+		return;
 
 	/* Is this another fragment in the last message */
 	if (!xprt->tcp_more)
@@ -734,241 +741,123 @@ tcp_read_fraghdr(struct rpc_xprt *xprt)
 
 	dprintk("RPC:      New record reclen %d morefrags %d\n",
 				   xprt->tcp_reclen, xprt->tcp_more);
- done:
-	return xprt->tcp_reclen + sizeof(xprt->tcp_recm) - xprt->tcp_offset;
 }
 
 /*
  * TCP read xid
  */
-static inline int
-tcp_read_xid(struct rpc_xprt *xprt, int avail)
+static inline void
+tcp_read_xid(struct rpc_xprt *xprt, tcp_reader_t *rd)
 {
-	struct iovec	riov;
-	int		want, result;
-
-	if (xprt->tcp_copied >= sizeof(xprt->tcp_xid) || !avail)
-		goto done;
-	want = MIN(sizeof(xprt->tcp_xid) - xprt->tcp_copied, avail);
-	do {
-		dprintk("RPC:      reading xid (%d bytes)\n", want);
-		riov.iov_base = ((u8*) &xprt->tcp_xid) + xprt->tcp_copied;
-		riov.iov_len  = want;
-		result = xprt_recvmsg(xprt, &riov, 1, want, 0);
-		if (result < 0)
-			return result;
-		xprt->tcp_copied += result;
-		xprt->tcp_offset += result;
-		want  -= result;
-		avail -= result;
-	} while (want);
- done:
-	return avail;
+	size_t	want, used;
+
+	want = MIN(sizeof(xprt->tcp_xid) - xprt->tcp_copied,
+			tcp_fragment_left(xprt));
+	dprintk("RPC:      reading xid (%Zd bytes)\n", want);
+	used = tcp_copy_data(rd, ((u8*) &xprt->tcp_xid) + xprt->tcp_copied,
+				want);
+	xprt->tcp_copied += used;
+	xprt->tcp_offset += used;
 }
 
 /*
  * TCP read and complete request
  */
-static inline int
-tcp_read_request(struct rpc_xprt *xprt, struct rpc_rqst *req, int avail)
+static inline void
+tcp_read_request(struct rpc_xprt *xprt, struct rpc_rqst *req,
+			tcp_reader_t *rd)
 {
-	int	want, result;
+	size_t	want, used = 0;
 
-	if (req->rq_rlen <= xprt->tcp_copied || !avail)
-		goto done;
-	want = MIN(req->rq_rlen - xprt->tcp_copied, avail);
-	do {
-		dprintk("RPC: %4d TCP receiving %d bytes\n",
+	if (req->rq_rlen > xprt->tcp_copied) {
+		want = MIN(req->rq_rlen - xprt->tcp_copied,
+				tcp_fragment_left(xprt));
+		dprintk("RPC: %4d TCP receiving %Zd bytes\n",
 			req->rq_task->tk_pid, want);
+		used = tcp_copy_to_iov(rd, req->rq_rvec, req->rq_rnr,
+					xprt->tcp_copied, want);
+		xprt->tcp_copied += used;
+		xprt->tcp_offset += used;
+		if (used != want && rd->count == 0)
+			return;
+	}
 
-		result = xprt_recvmsg(xprt, req->rq_rvec, req->rq_rnr, want, xprt->tcp_copied);
-		if (result < 0)
-			return result;
-		xprt->tcp_copied += result;
-		xprt->tcp_offset += result;
-		avail  -= result;
-		want   -= result;
-	} while (want);
-
- done:
-	if (req->rq_rlen > xprt->tcp_copied && xprt->tcp_more)
-		return avail;
+	if (req->rq_rlen > xprt->tcp_copied &&
+	    (tcp_fragment_left(xprt) || xprt->tcp_more))
+		return;
 	dprintk("RPC: %4d received reply complete\n", req->rq_task->tk_pid);
 	xprt_complete_rqst(xprt, req, xprt->tcp_copied);
-
-	return avail;
 }
 
 /*
  * TCP discard extra bytes from a short read
  */
-static inline int
-tcp_read_discard(struct rpc_xprt *xprt, int avail)
-{
-	struct iovec	riov;
-	static u8	dummy[64];
-	int		want, result = 0;
-
-	while (avail) {
-		want = MIN(avail, sizeof(dummy));
-		riov.iov_base = dummy;
-		riov.iov_len  = want;
-		dprintk("RPC:      TCP skipping %d bytes\n", want);
-		result = xprt_recvmsg(xprt, &riov, 1, want, 0);
-		if (result < 0)
-			return result;
-		xprt->tcp_offset += result;
-		avail  -= result;
-	}
-	return avail;
-}
-
-/*
- * TCP record receive routine
- * This is not the most efficient code since we call recvfrom thrice--
- * first receiving the record marker, then the XID, then the data.
- * 
- * The optimal solution would be a RPC support in the TCP layer, which
- * would gather all data up to the next record marker and then pass us
- * the list of all TCP segments ready to be copied.
- */
-static int
-tcp_input_record(struct rpc_xprt *xprt)
-{
-	struct rpc_rqst	*req = NULL;
-	struct rpc_task	*task = NULL;
-	int		avail, result;
-
-	dprintk("RPC:      tcp_input_record\n");
-
-	if (xprt->shutdown)
-		return -EIO;
-	if (!xprt_connected(xprt))
-		return -ENOTCONN;
-
-	/* Read in a new fragment marker if necessary */
-	/* Can we ever really expect to get completely empty fragments? */
-	if ((result = tcp_read_fraghdr(xprt)) <= 0)
-		return result;
-	avail = result;
-
-	/* Read in the xid if necessary */
-	if ((result = tcp_read_xid(xprt, avail)) <= 0)
-		return result;
-	avail = result;
-
-	/* Find and lock the request corresponding to this xid */
-	req = xprt_lookup_rqst(xprt, xprt->tcp_xid);
-	if (req) {
-		task = req->rq_task;
-		/* Read in the request data */
-		result = tcp_read_request(xprt,  req, avail);
-		rpc_unlock_task(task);
-		if (result < 0)
-			return result;
-		avail = result;
-	}
-
-	/* Skip over any trailing bytes on short reads */
-	if ((result = tcp_read_discard(xprt, avail)) < 0)
-		return result;
-
-	dprintk("RPC:      tcp_input_record done (off %d reclen %d copied %d)\n",
-			xprt->tcp_offset, xprt->tcp_reclen, xprt->tcp_copied);
-	result = xprt->tcp_reclen;
-	return result;
-}
-
-/*
- *	TCP task queue stuff
- */
-LIST_HEAD(rpc_xprt_pending);	/* List of xprts having pending tcp requests */
-
-static inline
-void tcp_rpciod_queue(void)
-{
-	rpciod_wake_up();
-}
-
-static inline
-void xprt_append_pending(struct rpc_xprt *xprt)
-{
-	if (!list_empty(&xprt->rx_pending))
-		return;
-	spin_lock_bh(&rpc_queue_lock);
-	if (list_empty(&xprt->rx_pending)) {
-		list_add(&xprt->rx_pending, rpc_xprt_pending.prev);
-		dprintk("RPC:     xprt queue %p\n", xprt);
-		tcp_rpciod_queue();
-	}
-	spin_unlock_bh(&rpc_queue_lock);
-}
-
-static
-void xprt_remove_pending(struct rpc_xprt *xprt)
-{
-	spin_lock_bh(&rpc_queue_lock);
-	if (!list_empty(&xprt->rx_pending)) {
-		list_del(&xprt->rx_pending);
-		INIT_LIST_HEAD(&xprt->rx_pending);
-	}
-	spin_unlock_bh(&rpc_queue_lock);
-}
-
-static inline
-struct rpc_xprt *xprt_remove_pending_next(void)
+static inline void
+tcp_read_discard(struct rpc_xprt *xprt, tcp_reader_t *rd)
 {
-	struct rpc_xprt	*xprt = NULL;
+	size_t	want;
 
-	spin_lock_bh(&rpc_queue_lock);
-	if (!list_empty(&rpc_xprt_pending)) {
-		xprt = list_entry(rpc_xprt_pending.next, struct rpc_xprt, rx_pending);
-		list_del(&xprt->rx_pending);
-		INIT_LIST_HEAD(&xprt->rx_pending);
-	}
-	spin_unlock_bh(&rpc_queue_lock);
-	return xprt;
+	want = MIN(rd->count, tcp_fragment_left(xprt));
+	dprintk("RPC:      TCP skipping %Zd bytes\n", want);
+	rd->from  += want;
+	rd->count -= want;
+	xprt->tcp_offset += want;
 }
 
 /*
- *	This is protected from tcp_data_ready and the stack as its run
- *	inside of the RPC I/O daemon
+ * TCP record receive routine, called by tcp_read_sock for each
+ * piece of an skb. It always takes all of it.
  */
-void
-__rpciod_tcp_dispatcher(void)
+static int
+tcp_data_recv(read_descriptor_t *rd_desc, struct sk_buff *skb,
+		char *from, size_t len)
 {
-	struct rpc_xprt *xprt;
-	int safe_retry = 0, result;
-
-	dprintk("rpciod_tcp_dispatcher: Queue Running\n");
-
-	/*
-	 *	Empty each pending socket
-	 */
-	while ((xprt = xprt_remove_pending_next()) != NULL) {
-		dprintk("rpciod_tcp_dispatcher: Processing %p\n", xprt);
-
-		do {
-			result = tcp_input_record(xprt);
-		} while (result >= 0);
+	struct rpc_xprt	*xprt = (struct rpc_xprt *) rd_desc->buf;
+	struct rpc_rqst	*req;
+	tcp_reader_t	rd = { from, len };
+
+	dprintk("RPC:      tcp_data_recv\n");
+	while (rd.count) {
+		/* Read in a new fragment marker if necessary */
+		if (xprt->tcp_offset < sizeof(xprt->tcp_recm)) {
+			tcp_read_fraghdr(xprt, &rd);
+		} else if (xprt->tcp_copied < sizeof(xprt->tcp_xid)) {
+			/* Read in the xid if necessary */
+			tcp_read_xid(xprt, &rd);
+		} else if ((req = xprt_lookup_rqst(xprt, xprt->tcp_xid))) {
+			/* Read in the request data */
+			tcp_read_request(xprt, req, &rd);
+			rpc_unlock_task(req->rq_task);
+		}
 
-		if (safe_retry++ > 200) {
-			schedule();
-			safe_retry = 0;
+		/* Skip over any trailing bytes on short reads */
+		if (xprt->tcp_offset >= sizeof(xprt->tcp_recm) &&
+		    xprt->tcp_copied >= sizeof(xprt->tcp_xid) &&
+		    tcp_fragment_left(xprt) && rd.count)
+			tcp_read_discard(xprt, &rd);
+
+		if (xprt->tcp_offset >= sizeof(xprt->tcp_recm) &&
+		    !tcp_fragment_left(xprt)) {
+			dprintk("RPC:      tcp_data_recv done (reclen %d copied %d)\n",
+				xprt->tcp_reclen, xprt->tcp_copied);
+			xprt->tcp_offset = 0;
+			xprt->tcp_reclen = 0;
 		}
 	}
+	rd_desc->count -= len;
+	return len;
 }
 
 /*
- *	data_ready callback for TCP. We can't just jump into the
- *	tcp recvmsg functions inside of the network receive bh or
- * 	bad things occur. We queue it to pick up after networking
- *	is done.
+ *	data_ready callback for TCP. We are called from the network
+ *	receive bh with the socket locked, which is what tcp_read_sock
+ *	wants.
  */
  
-static void tcp_data_ready(struct sock *sk, int len)
+static void tcp_data_ready(struct sock *sk, int bytes)
 {
 	struct rpc_xprt	*xprt;
+	read_descriptor_t rd_desc;
 
 	dprintk("RPC:      tcp_data_ready...\n");
 	if (!(xprt = xprt_from_sock(sk)))
@@ -980,12 +869,15 @@ static void tcp_data_ready(struct sock *sk, int len)
 	if (xprt->shutdown)
 		goto out;
 
-	xprt_append_pending(xprt);
-
 	dprintk("RPC:      tcp_data_ready client %p\n", xprt);
 	dprintk("RPC:      state %x conn %d dead %d zapped %d\n",
 				sk->state, xprt_connected(xprt),
 				sk->dead, sk->zapped);
+
+	/* We use rd_desc to pass struct xprt to tcp_data_recv */
+	rd_desc.buf = (char *) xprt;
+	rd_desc.count = 65536;
+	tcp_read_sock(sk, &rd_desc, tcp_data_recv);
  out:
 	if (sk->sleep && waitqueue_active(sk->sleep))
 		wake_up_interruptible(sk->sleep);
@@ -1031,7 +923,7 @@ tcp_state_change(struct sock *sk)
  * low.
  */
 static void
-tcp_write_space(struct sock *sk)
+xprt_tcp_write_space(struct sock *sk)
 {
 	struct rpc_xprt	*xprt;
 	struct socket	*sock;
@@ -1252,7 +1144,7 @@ do_xprt_transmit(struct rpc_task *task)
 
 	switch (status) {
 	case -ENOMEM:
-		/* Protect against (udp|tcp)_write_space */
+		/* Protect against udp_write_space/xprt_tcp_write_space */
 		spin_lock_bh(&xprt_sock_lock);
 		if (!xprt_wspace(xprt)) {
 			task->tk_timeout = req->rq_timeout.to_current;
@@ -1498,8 +1390,6 @@ xprt_setup(struct socket *sock, int proto,
 	req->rq_next = NULL;
 	xprt->free = xprt->slot;
 
-	INIT_LIST_HEAD(&xprt->rx_pending);
-
 	dprintk("RPC:      created transport %p\n", xprt);
 	
 	xprt_bind_socket(xprt, sock);
@@ -1550,7 +1440,7 @@ xprt_bind_socket(struct rpc_xprt *xprt, struct socket *sock)
 	} else {
 		sk->data_ready = tcp_data_ready;
 		sk->state_change = tcp_state_change;
-		sk->write_space = tcp_write_space;
+		sk->write_space = xprt_tcp_write_space;
 		xprt_clear_connected(xprt);
 	}
 
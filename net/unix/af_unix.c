@@ -307,6 +307,18 @@ static void unix_write_space(struct sock *sk)
 	read_unlock(&sk->callback_lock);
 }
 
+/* The sender of a local message usually waits for the answer next, so
+ * wake the receiver synchronously and let the scheduler keep it close
+ * to the data it is about to read. */
+static void unix_data_ready(struct sock *sk, int len)
+{
+	read_lock(&sk->callback_lock);
+	if (sk->sleep && waitqueue_active(sk->sleep))
+		wake_up_interruptible_sync(sk->sleep);
+	sk_wake_async(sk, 1, POLL_IN);
+	read_unlock(&sk->callback_lock);
+}
+
 /* When dgram socket disconnects (or changes its peer), we clear its receive
  * queue of packets arrived from previous peer. First, it allows to do
  * flow control based only on wmem_alloc; second, sk connected to peer
@@ -480,6 +492,7 @@ static struct sock * unix_create1(struct socket *sock)
 	sock_init_data(sock,sk);
 
 	sk->write_space		=	unix_write_space;
+	sk->data_ready		=	unix_data_ready;
 
 	sk->max_ack_backlog = sysctl_unix_max_dgram_qlen;
 	sk->destruct = unix_sock_destructor;
@@ -1277,7 +1290,109 @@ out:
 	return err;
 }
 
-		
+
+/*
+ *	Large stream writes are carried in page fragments instead of one
+ *	big linear buffer: no high order allocations, and an skb can take
+ *	up to 64K, so a bulk transfer needs far fewer buffers and wakeups.
+ *	The pages come from low memory, page_address() reaches them.
+ */
+
+static int unix_fill_frags(struct sock *sk, struct sk_buff *skb,
+			   struct iovec *iov, int size)
+{
+	while (size > 0) {
+		int copy = min(size, PAGE_SIZE);
+		struct page *page = alloc_page(sk->allocation);
+
+		if (page == NULL)
+			return -ENOBUFS;
+		if (memcpy_fromiovec(page_address(page), iov, copy)) {
+			__free_page(page);
+			return -EFAULT;
+		}
+		skb_add_frag(skb, page, 0, copy);
+		skb->truesize += copy;
+		atomic_add(copy, &sk->wmem_alloc);
+		size -= copy;
+	}
+	return 0;
+}
+
+/* Copy len bytes from offset of a possibly paged skb to the iovec */
+static int unix_copy_to_iovec(struct sk_buff *skb, int offset,
+			      struct iovec *iov, int len)
+{
+	int start = skb_headlen(skb);
+	int i, copy;
+
+	if ((copy = start - offset) > 0) {
+		if (copy > len)
+			copy = len;
+		if (memcpy_toiovec(iov, skb->data + offset, copy))
+			return -EFAULT;
+		if ((len -= copy) == 0)
+			return 0;
+		offset += copy;
+	}
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		int end = start + frag->size;
+
+		if ((copy = end - offset) > 0) {
+			if (copy > len)
+				copy = len;
+			if (memcpy_toiovec(iov, page_address(frag->page) +
+					   frag->page_offset + offset - start, copy))
+				return -EFAULT;
+			if ((len -= copy) == 0)
+				return 0;
+			offset += copy;
+		}
+		start = end;
+	}
+	return 0;
+}
+
+/*
+ *	Consume len bytes from the front of a possibly paged skb. Fully
+ *	read pages are released at once. Stream skbs are never cloned, so
+ *	the fragment array is ours to change.
+ */
+
+static void unix_skb_pull(struct sk_buff *skb, int len)
+{
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	int head = skb_headlen(skb);
+	int i;
+
+	if (len <= head) {
+		__skb_pull(skb, len);
+		return;
+	}
+	__skb_pull(skb, head);
+	len -= head;
+
+	for (i = 0; len > 0 && len >= shinfo->frags[i].size; i++) {
+		len -= shinfo->frags[i].size;
+		skb->len -= shinfo->frags[i].size;
+		skb->data_len -= shinfo->frags[i].size;
+		put_page(shinfo->frags[i].page);
+	}
+	if (i) {
+		shinfo->nr_frags -= i;
+		memmove(shinfo->frags, shinfo->frags + i,
+			shinfo->nr_frags * sizeof(skb_frag_t));
+	}
+	if (len) {
+		shinfo->frags[0].page_offset += len;
+		shinfo->frags[0].size -= len;
+		skb->len -= len;
+		skb->data_len -= len;
+	}
+}
+
 static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg, int len,
 			       struct scm_cookie *scm)
 {
@@ -1286,7 +1401,7 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg, int len,
 	struct sockaddr_un *sunaddr=msg->msg_name;
 	int err,size;
 	struct sk_buff *skb;
-	int limit=0;
+	int paged;
 	int sent=0;
 
 	err = -EOPNOTSUPP;
@@ -1321,39 +1436,33 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg, int len,
 			size = sk->sndbuf/2 - 16;
 
 		/*
-		 *	Keep to page sized kmalloc()'s as various people
-		 *	have suggested. Big mallocs stress the vm too
-		 *	much.
+		 *	Anything beyond a page goes into page fragments,
+		 *	at most 64K per buffer. Big kmalloc()'s stress the
+		 *	vm too much.
 		 */
 
-		if (size > PAGE_SIZE-16)
-			limit = PAGE_SIZE-16; /* Fall back to a page if we can't grab a big buffer this instant */
-		else
-			limit = 0;	/* Otherwise just grab and wait */
+		paged = size > PAGE_SIZE-16;
+		if (paged && size > (MAX_SKB_FRAGS-2)*PAGE_SIZE)
+			size = (MAX_SKB_FRAGS-2)*PAGE_SIZE;
 
 		/*
 		 *	Grab a buffer
 		 */
 		 
-		skb=sock_alloc_send_skb(sk,size,limit,msg->msg_flags&MSG_DONTWAIT, &err);
+		skb=sock_alloc_send_skb(sk,paged ? 0 : size,0,msg->msg_flags&MSG_DONTWAIT, &err);
 
 		if (skb==NULL)
 			goto out_err;
 
-		/*
-		 *	If you pass two values to the sock_alloc_send_skb
-		 *	it tries to grab the large buffer with GFP_BUFFER
-		 *	(which can fail easily), and if it fails grab the
-		 *	fallback size buffer which is under a page and will
-		 *	succeed. [Alan]
-		 */
-		size = min(size, skb_tailroom(skb));
-
 		memcpy(UNIXCREDS(skb), &scm->creds, sizeof(struct ucred));
 		if (scm->fp)
 			unix_attach_fds(scm, skb);
 
-		if ((err = memcpy_fromiovec(skb_put(skb,size), msg->msg_iov, size)) != 0) {
+		if (paged)
+			err = unix_fill_frags(sk, skb, msg->msg_iov, size);
+		else
+			err = memcpy_fromiovec(skb_put(skb,size), msg->msg_iov, size);
+		if (err) {
 			kfree_skb(skb);
 			goto out_err;
 		}
@@ -1580,7 +1689,7 @@ static int unix_stream_recvmsg(struct socket *sock, struct msghdr *msg, int size
 		}
 
 		chunk = min(skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		if (unix_copy_to_iovec(skb, 0, msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1592,7 +1701,7 @@ static int unix_stream_recvmsg(struct socket *sock, struct msghdr *msg, int size
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK))
 		{
-			skb_pull(skb, chunk);
+			unix_skb_pull(skb, chunk);
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(scm, skb);
@@ -0,0 +1,406 @@
+/*
+ * kbench.c - time core kernel paths, one result line per test and CPU.
+ *
+ * The tests that have to run in a process are done here: null system
+ * call, context switch through a pipe, fork/exit, fork/exec/exit,
+ * anonymous and file page faults and loopback TCP.  The allocator and
+ * lookup tests are handed to /proc/kbench (CONFIG_KBENCH) and their
+ * results are passed through.  The output format is described in
+ * Documentation/kbench.txt.
+ *
+ * Build with "gcc -O2 -o kbench scripts/kbench.c" on i386.
+ *
+ * Usage: kbench [-c cpu] [-d depth]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef __NR_sched_setaffinity
+#define __NR_sched_setaffinity	223	/* include/asm-i386/unistd.h */
+#endif
+
+#define ROUNDS		8	/* as KBENCH_ROUNDS in kernel/kbench.c */
+#define PAGES		256
+
+typedef unsigned long long cycles_t;
+
+static inline cycles_t rdtsc(void)
+{
+	cycles_t t;
+
+	__asm__ __volatile__("rdtsc" : "=A" (t));
+	return t;
+}
+
+static int cpu;
+static char tmpdir[64];
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void report(const char *name, unsigned long arg, int loops,
+		   cycles_t total, cycles_t best)
+{
+	printf("%s %lu %d %d %lu %lu\n", name, arg, cpu, loops,
+	       (unsigned long) (total / ((cycles_t) ROUNDS * loops)),
+	       (unsigned long) (best / loops));
+	fflush(stdout);
+}
+
+/*
+ * A test does "loops" operations and returns the cycles they took;
+ * setup and teardown it does outside the timed part.
+ */
+static void run(const char *name, unsigned long arg, int loops,
+		cycles_t (*fn)(unsigned long, int))
+{
+	cycles_t c, total = 0, best = ~0ULL;
+	int r;
+
+	for (r = 0; r < ROUNDS; r++) {
+		c = fn(arg, loops);
+		total += c;
+		if (c < best)
+			best = c;
+	}
+	report(name, arg, loops, total, best);
+}
+
+static cycles_t null_syscall(unsigned long arg, int loops)
+{
+	cycles_t t0 = rdtsc();
+
+	while (loops--)
+		syscall(__NR_getppid);
+	return rdtsc() - t0;
+}
+
+/* Two processes on one CPU bounce a byte; one operation is one switch */
+static cycles_t ctxsw(unsigned long arg, int loops)
+{
+	int p1[2], p2[2], n = loops / 2;
+	cycles_t t0, t;
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(p1) || pipe(p2))
+		die("pipe");
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		while (read(p1[0], &c, 1) == 1)
+			if (write(p2[1], &c, 1) != 1)
+				break;
+		_exit(0);
+	}
+	t0 = rdtsc();
+	while (n--) {
+		if (write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1)
+			die("pipe");
+	}
+	t = rdtsc() - t0;
+	close(p1[1]);
+	waitpid(pid, NULL, 0);
+	close(p1[0]);
+	close(p2[0]);
+	close(p2[1]);
+	return t;
+}
+
+static cycles_t fork_exit(unsigned long arg, int loops)
+{
+	cycles_t t0 = rdtsc();
+	pid_t pid;
+
+	while (loops--) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (pid == 0)
+			_exit(0);
+		waitpid(pid, NULL, 0);
+	}
+	return rdtsc() - t0;
+}
+
+static cycles_t fork_exec(unsigned long arg, int loops)
+{
+	static char *argv[] = { "/bin/true", NULL };
+	static char *envp[] = { NULL };
+	cycles_t t0 = rdtsc();
+	pid_t pid;
+
+	while (loops--) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (pid == 0) {
+			execve(argv[0], argv, envp);
+			_exit(1);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return rdtsc() - t0;
+}
+
+/* One operation is the first touch of one page */
+static cycles_t fault_anon(unsigned long pages, int loops)
+{
+	long psize = getpagesize();
+	cycles_t t = 0, t0;
+	char *p;
+	unsigned long i;
+
+	while (loops > 0) {
+		p = mmap(NULL, pages * psize, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap");
+		t0 = rdtsc();
+		for (i = 0; i < pages && loops > 0; i++, loops--)
+			p[i * psize] = 1;
+		t += rdtsc() - t0;
+		munmap(p, pages * psize);
+	}
+	return t;
+}
+
+/* Minor faults on a file that is in the page cache */
+static cycles_t fault_file(unsigned long pages, int loops)
+{
+	long psize = getpagesize();
+	cycles_t t = 0, t0;
+	char name[96], *p, *buf;
+	unsigned long i;
+	volatile char c;
+	int fd;
+
+	sprintf(name, "%s/file", tmpdir);
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0)
+		die(name);
+	buf = calloc(1, psize);
+	for (i = 0; i < pages; i++)
+		if (write(fd, buf, psize) != psize)
+			die("write");
+	free(buf);
+
+	while (loops > 0) {
+		p = mmap(NULL, pages * psize, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			die("mmap");
+		t0 = rdtsc();
+		for (i = 0; i < pages && loops > 0; i++, loops--)
+			c = p[i * psize];
+		t += rdtsc() - t0;
+		munmap(p, pages * psize);
+	}
+	close(fd);
+	unlink(name);
+	return t;
+}
+
+/* One operation is one buffer of "size" bytes from writer to reader */
+static cycles_t tcp_loopback(unsigned long size, int loops)
+{
+	struct sockaddr_in sin;
+	int ls, s, len = sizeof(sin), n, one = 1;
+	long left = (long) size * loops;
+	cycles_t t0, t;
+	char *buf;
+	pid_t pid;
+
+	buf = malloc(size);
+	memset(buf, 0, size);
+	ls = socket(PF_INET, SOCK_STREAM, 0);
+	if (ls < 0)
+		die("socket");
+	setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(ls, (struct sockaddr *) &sin, sizeof(sin)) ||
+	    listen(ls, 1) ||
+	    getsockname(ls, (struct sockaddr *) &sin, &len))
+		die("bind");
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		s = socket(PF_INET, SOCK_STREAM, 0);
+		if (s < 0 || connect(s, (struct sockaddr *) &sin, sizeof(sin)))
+			_exit(1);
+		while (loops-- && write(s, buf, size) == size)
+			;
+		_exit(0);
+	}
+
+	s = accept(ls, NULL, NULL);
+	if (s < 0)
+		die("accept");
+	t0 = rdtsc();
+	while (left > 0 && (n = read(s, buf, size)) > 0)
+		left -= n;
+	t = rdtsc() - t0;
+	waitpid(pid, NULL, 0);
+	close(s);
+	close(ls);
+	free(buf);
+	return t;
+}
+
+/* Run one test in the kernel and pass its result line through */
+static void kernel_test(int fd, const char *name, const char *arg, int loops)
+{
+	char cmd[256], line[256];
+	int n;
+
+	n = sprintf(cmd, "%s %s %d", name, arg, loops);
+	if (write(fd, cmd, n) != n) {
+		fprintf(stderr, "kbench: %s %s: %s\n", name, arg,
+			strerror(errno));
+		return;
+	}
+	lseek(fd, 0, SEEK_SET);
+	n = read(fd, line, sizeof(line) - 1);
+	if (n <= 0)
+		return;
+	line[n] = 0;
+	fputs(line, stdout);
+	fflush(stdout);
+}
+
+static void kernel_tests(int depth)
+{
+	static int sizes[] = { 32, 64, 128, 256, 512, 1024, 2048, 4096,
+			       8192, 16384, 32768, 65536, 131072 };
+	static int skb_sizes[] = { 64, 256, 1536, 4096, 9000 };
+	char path[1024], arg[16];
+	int fd, i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		sprintf(arg, "%d", sizes[i]);
+		/* A new open for each test, the result buffer is small */
+		if ((fd = open("/proc/kbench", O_RDWR)) < 0)
+			goto noproc;
+		kernel_test(fd, "kmalloc", arg, 100000);
+		close(fd);
+		if ((fd = open("/proc/kbench", O_RDWR)) < 0)
+			goto noproc;
+		kernel_test(fd, "kmem_cache", arg, 100000);
+		close(fd);
+	}
+	for (i = 0; i < 4; i++) {
+		sprintf(arg, "%d", i);
+		if ((fd = open("/proc/kbench", O_RDWR)) < 0)
+			goto noproc;
+		kernel_test(fd, "alloc_pages", arg, 10000);
+		close(fd);
+	}
+	for (i = 0; i < sizeof(skb_sizes) / sizeof(skb_sizes[0]); i++) {
+		sprintf(arg, "%d", skb_sizes[i]);
+		if ((fd = open("/proc/kbench", O_RDWR)) < 0)
+			goto noproc;
+		kernel_test(fd, "skb", arg, 100000);
+		close(fd);
+	}
+
+	strcpy(path, tmpdir);
+	for (i = 0; i < depth && strlen(path) + 3 < sizeof(path); i++) {
+		strcat(path, "/d");
+		mkdir(path, 0700);
+	}
+	if ((fd = open("/proc/kbench", O_RDWR)) < 0)
+		goto noproc;
+	kernel_test(fd, "path_walk", path, 10000);
+	close(fd);
+	if ((fd = open("/proc/kbench", O_RDWR)) < 0)
+		goto noproc;
+	kernel_test(fd, "d_lookup", path, 100000);
+	close(fd);
+	while (strlen(path) > strlen(tmpdir)) {
+		rmdir(path);
+		*strrchr(path, '/') = 0;
+	}
+	return;
+
+noproc:
+	if (cpu == 0)
+		fprintf(stderr, "kbench: /proc/kbench: %s\n", strerror(errno));
+}
+
+static void bench_cpu(int depth)
+{
+	unsigned long mask = 1UL << cpu;
+
+	if (syscall(__NR_sched_setaffinity, 0, sizeof(mask), &mask) < 0)
+		die("sched_setaffinity");
+
+	run("null_syscall", 0, 100000, null_syscall);
+	run("ctxsw", 0, 20000, ctxsw);
+	run("fork_exit", 0, 200, fork_exit);
+	run("fork_exec", 0, 100, fork_exec);
+	run("fault_anon", PAGES, 4 * PAGES, fault_anon);
+	run("fault_file", PAGES, 4 * PAGES, fault_file);
+	run("tcp_loopback", 1024, 10000, tcp_loopback);
+	run("tcp_loopback", 65536, 1000, tcp_loopback);
+	kernel_tests(depth);
+}
+
+int main(int argc, char **argv)
+{
+	int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int only = -1, depth = 8, c;
+	struct utsname u;
+
+	while ((c = getopt(argc, argv, "c:d:")) != -1) {
+		switch (c) {
+		case 'c':
+			only = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: kbench [-c cpu] [-d depth]\n");
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	sprintf(tmpdir, "/tmp/kbench.%d", (int) getpid());
+	if (mkdir(tmpdir, 0700))
+		die(tmpdir);
+
+	uname(&u);
+	printf("# kbench 1 %s %s %s cpus %d\n", u.release, u.version,
+	       u.machine, ncpus);
+	printf("# test arg cpu loops mean best\n");
+
+	for (cpu = 0; cpu < ncpus; cpu++)
+		if (only < 0 || only == cpu)
+			bench_cpu(depth);
+
+	rmdir(tmpdir);
+	return 0;
+}